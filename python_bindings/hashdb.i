@@ -1,13 +1,191 @@
-%module (docstring="The hashdb module provides interfaces to the hashdb block hash database.") hashdb
+%module (docstring="The hashdb module provides interfaces to the hashdb block hash database.", threads="1") hashdb
 %include "std_string.i"
 %include "stdint.i"
 %include "std_set.i"
 %include "std_pair.i"
+%include "std_vector.i"
+%include "std_map.i"
 
 %{
+#include <cstring>
 #include "hashdb.hpp"
+
+// whether a buffer holds bytes or native integers of item_size bytes
+static bool is_integer_buffer(const Py_buffer& view, const size_t item_size) {
+  if (view.itemsize == 1) {
+    return true;
+  }
+  if (static_cast<size_t>(view.itemsize) != item_size ||
+      view.format == NULL) {
+    return false;
+  }
+  const char* format = view.format;
+  if (*format == '@' || *format == '=') {
+    ++format;
+  }
+  return format[0] != '\0' && format[1] == '\0' &&
+         std::strchr("bBhHiIlLqQnN", format[0]) != NULL;
+}
 %}
 
 %feature("autodoc", "1");
 
+// Every wrapped call releases the GIL while the native code runs so that
+// Python threads can overlap ingest, scans, and LMDB reads and writes with
+// other work.  The typemaps below touch Python objects and so run before
+// the GIL is released.  Small pure functions keep the GIL because the
+// release would cost more than the call.
+%nothread hashdb::version;
+%nothread hashdb::hex_to_bin;
+%nothread hashdb::bin_to_hex;
+%nothread hashdb::hash_data_json;
+%nothread hashdb::hash_binary;
+%nothread hashdb::read_hash_binary;
+%nothread hashdb::num_cpus;
+
+// Packed arrays are read and written in place through the buffer
+// protocol, so bytes, bytearray, memoryview, array.array, and numpy
+// arrays can be passed without converting them to strings or lists.
+// Arrays of wider types must be contiguous and hold native integers of
+// that size, or their bytes.
+%define %readonly_buffer(TYPE, DATA, SIZE)
+%typemap(in) (const TYPE* const DATA, const size_t SIZE)
+             (Py_buffer view, int has_view = 0) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_FORMAT | PyBUF_ND) != 0) {
+    SWIG_fail;
+  }
+  has_view = 1;
+  if (sizeof(TYPE) > 1 && !is_integer_buffer(view, sizeof(TYPE))) {
+    PyErr_SetString(PyExc_TypeError,
+                    "buffer items are not integers of the item size");
+    SWIG_fail;
+  }
+  if (view.len % sizeof(TYPE) != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer size is not a multiple of the item size");
+    SWIG_fail;
+  }
+  $1 = static_cast<const TYPE*>(view.buf);
+  $2 = view.len / sizeof(TYPE);
+}
+%typemap(freearg) (const TYPE* const DATA, const size_t SIZE) {
+  if (has_view$argnum) {
+    PyBuffer_Release(&view$argnum);
+  }
+}
+%typecheck(SWIG_TYPECHECK_STRING + 1) (const TYPE* const DATA,
+                                       const size_t SIZE) {
+  $1 = PyObject_CheckBuffer($input) ? 1 : 0;
+}
+%enddef
+
+%readonly_buffer(char, packed_hashes, packed_hashes_size)
+%readonly_buffer(char, unscanned_data, size)
+%readonly_buffer(uint64_t, k_entropies, k_entropies_size)
+
+%typemap(in) (uint64_t* const counts, const size_t counts_size)
+             (Py_buffer view, int has_view = 0) {
+  if (PyObject_GetBuffer($input, &view,
+                         PyBUF_WRITABLE | PyBUF_FORMAT | PyBUF_ND) != 0) {
+    SWIG_fail;
+  }
+  has_view = 1;
+  if (view.itemsize != sizeof(uint64_t) ||
+      !is_integer_buffer(view, sizeof(uint64_t))) {
+    PyErr_SetString(PyExc_TypeError,
+                    "counts must be a buffer of 8-byte unsigned integers");
+    SWIG_fail;
+  }
+  $1 = static_cast<uint64_t*>(view.buf);
+  $2 = view.len / sizeof(uint64_t);
+}
+%typemap(freearg) (uint64_t* const counts, const size_t counts_size) {
+  if (has_view$argnum) {
+    PyBuffer_Release(&view$argnum);
+  }
+}
+
+%typemap(in) (uint8_t* const bitmap, const size_t bitmap_size)
+             (Py_buffer view, int has_view = 0) {
+  if (PyObject_GetBuffer($input, &view, PyBUF_WRITABLE) != 0) {
+    SWIG_fail;
+  }
+  has_view = 1;
+  $1 = static_cast<uint8_t*>(view.buf);
+  $2 = view.len;
+}
+%typemap(freearg) (uint8_t* const bitmap, const size_t bitmap_size) {
+  if (has_view$argnum) {
+    PyBuffer_Release(&view$argnum);
+  }
+}
+
 %include "hashdb.hpp"
+
+%template(hash_inserts_t) std::vector<hashdb::hash_insert_t>;
+%template(strings_t) std::vector<std::string>;
+
+%extend hashdb::scan_manager_t {
+%pythoncode %{
+def hash_chunks(self, chunk_size=1024):
+    """Yield lists of up to chunk_size JSON hash texts, walking the
+    database in key order.
+
+    The walk holds one read transaction and cursor for its lifetime and
+    crosses into the library once per chunk."""
+    hash_iterator = hash_iterator_t(self)
+    while True:
+        json_hashes = hash_iterator.next_json_chunk(chunk_size)
+        if len(json_hashes) == 0:
+            return
+        yield json_hashes
+
+def hashes(self, chunk_size=1024):
+    """Yield the JSON text of each hash in the database in key order,
+    reading chunk_size hashes at a time, see hash_chunks."""
+    for json_hashes in self.hash_chunks(chunk_size):
+        for json_hash in json_hashes:
+            yield json_hash
+
+def hash_counts(self, hashes, hash_size=16, approximate=False):
+    """Return the count of each hash packed into hashes, any object
+    supporting the buffer protocol, as a numpy uint64 array, or as an
+    array.array of 8-byte integers if numpy is not available.
+
+    The counts are written in place by find_hash_counts."""
+    view = memoryview(hashes)
+    hashes_size = view.itemsize
+    for dimension in view.shape:
+        hashes_size *= dimension
+    if hash_size <= 0 or hashes_size % hash_size != 0:
+        raise ValueError("hashes size is not a multiple of hash_size")
+    count = hashes_size // hash_size
+    try:
+        import numpy
+        counts = numpy.zeros(count, dtype=numpy.uint64)
+    except ImportError:
+        import array
+        typecode = 'L' if array.array('L').itemsize == 8 else 'Q'
+        counts = array.array(typecode, [0]) * count
+    if not self.find_hash_counts(view, hash_size, approximate, counts):
+        raise ValueError("invalid packed hashes")
+    return counts
+
+def hash_exists(self, hashes, hash_size=16):
+    """Return a bytearray bitmap with bit i % 8 of byte i // 8 set if
+    hash i packed into hashes, any object supporting the buffer
+    protocol, is present in the hash_store.
+
+    The bitmap is written in place by find_hash_exists."""
+    view = memoryview(hashes)
+    hashes_size = view.itemsize
+    for dimension in view.shape:
+        hashes_size *= dimension
+    if hash_size <= 0 or hashes_size % hash_size != 0:
+        raise ValueError("hashes size is not a multiple of hash_size")
+    bitmap = bytearray((hashes_size // hash_size + 7) // 8)
+    if not self.find_hash_exists(view, hash_size, bitmap):
+        raise ValueError("invalid packed hashes")
+    return bitmap
+%}
+}
@@ -22,8 +22,12 @@ if sys.maxsize != 2**63 - 1:
 import hashdb
 import shutil
 import struct
+import array
+import threading
 import io
 import os
+import socket
+import subprocess
 
 # require equality, adapted from ../test_py/helpers.py
 def str_equals(a,b):
@@ -131,6 +135,30 @@ int_equals(scan_manager.find_approximate_hash_count("hhhhhhhh"), 1)
 
 str_equals(scan_manager.find_hash_json(hashdb.APPROXIMATE_COUNT, "hhhhhhhh"), '{"block_hash":"6868686868686868","approximate_count":1}')
 
+# find hashes
+json_texts = scan_manager.find_hashes_json(hashdb.COUNT, ["zzzzzzzz", "hhhhhhhh", "zzzzzzzz"])
+int_equals(len(json_texts), 3)
+str_equals(json_texts[0], "")
+str_equals(json_texts[1], '{"block_hash":"6868686868686868","count":1}')
+str_equals(json_texts[2], "")
+json_texts = scan_manager.find_hashes_json(hashdb.APPROXIMATE_COUNT, ["hhhhhhhh"])
+str_equals(json_texts[0], '{"block_hash":"6868686868686868","approximate_count":1}')
+
+# find packed hashes through the buffer protocol
+packed_hashes = bytearray(b"zzzzzzzzhhhhhhhhhhhhhhhh")
+json_texts = scan_manager.find_packed_hashes_json(hashdb.COUNT,
+                                                 packed_hashes, 8)
+int_equals(len(json_texts), 3)
+str_equals(json_texts[0], "")
+str_equals(json_texts[2], '{"block_hash":"6868686868686868","count":1}')
+counts = scan_manager.hash_counts(memoryview(packed_hashes), 8)
+int_equals(list(counts), [0, 1, 1])
+counts = scan_manager.hash_counts(packed_hashes, 8, True)
+int_equals(list(counts), [0, 1, 1])
+bitmap = scan_manager.hash_exists(packed_hashes, 8)
+int_equals(list(bitmap), [6])
+str_equals(scan_manager.find_hash_json(hashdb.EXISTS, "hhhhhhhh"), '{"block_hash":"6868686868686868","exists":true}')
+
 has_source_data, filesize, file_type, zero_count, nonprobative_count = scan_manager.find_source_data("tttttttt")
 bool_equals(has_source_data, True)
 int_equals(filesize, 100)
@@ -147,6 +175,17 @@ next_binary_hash = scan_manager.next_hash(first_binary_hash)
 next_binary_hash = scan_manager.next_hash(next_binary_hash)
 str_equals(hashdb.bin_to_hex(next_binary_hash), "")
 
+json_hashes = list(scan_manager.hashes())
+int_equals(len(json_hashes), 2)
+str_equals(json_hashes[0], scan_manager.export_hash_json(first_binary_hash))
+json_chunks = list(scan_manager.hash_chunks(1))
+int_equals(len(json_chunks), 2)
+str_equals(json_chunks[1][0], json_hashes[1])
+json_texts = scan_manager.scan_many(["zzzzzzzz", "hhhhhhhh"] * 5000, hashdb.COUNT, 2)
+int_equals(len(json_texts), 10000)
+str_equals(json_texts[9998], "")
+str_equals(json_texts[9999], '{"block_hash":"6868686868686868","count":1}')
+
 first_binary_source = scan_manager.first_source()
 str_equals(hashdb.bin_to_hex(first_binary_source), "7373737373737373")
 
@@ -238,5 +277,131 @@ int_equals(len(scanned), 79)
 scanned = read_scan_stream(scan_stream)
 int_equals(len(scanned), 79)
 
+# scan_stream EXISTS, one bit per record
+scan_stream = hashdb.scan_stream_t(scan_manager, 8, hashdb.EXISTS)
+scan_stream.put(in_bytes_h + in_bytes_h + in_bytes_h)
+scan_stream.wait_empty()
+scanned = scan_stream.get()
+int_equals(len(scanned), 1)
+int_equals(bytearray(scanned)[0], 7)
+
+# scan_stream with two threads on a pool shared by two streams
+scan_stream1 = hashdb.scan_stream_t(scan_manager, 8, hashdb.COUNT, 2, "", True)
+scan_stream2 = hashdb.scan_stream_t(scan_manager, 8, hashdb.COUNT, 2, "", True)
+scan_stream1.put(in_bytes_h)
+scan_stream2.put(in_bytes_h)
+scanned = read_scan_stream(scan_stream1)
+int_equals(len(scanned), 67)
+scanned = read_scan_stream(scan_stream2)
+int_equals(len(scanned), 67)
+del scan_stream1
+del scan_stream2
+
+# scans from Python threads run concurrently with the GIL released
+def find_counts(results, i):
+    results[i] = scan_manager.find_hashes_json(hashdb.COUNT, ["hhhhhhhh"] * 1000)
+results = [None] * 4
+threads = [threading.Thread(target=find_counts, args=(results, i)) for i in range(4)]
+for thread in threads:
+    thread.start()
+for thread in threads:
+    thread.join()
+for result in results:
+    str_equals(result[999], '{"block_hash":"6868686868686868","count":1}')
+
+# remote_scan_stream through a hashdb server
+server = subprocess.Popen(["../src/hashdb", "server", "-j", "c", "temp_1.hdb",
+                           "0"], stdout=subprocess.PIPE)
+port = 0
+for line in server.stdout:
+    line = line.decode()
+    if line.startswith("# hashdb server listening on "):
+        port = int(line.strip().split(":")[-1])
+        break
+bool_equals(port > 0, True)
+remote_stream = hashdb.remote_scan_stream_t(str(port), 8, 16, 2, 16)
+str_equals(remote_stream.error_message(), "")
+remote_stream.put(in_bytes_a)
+remote_stream.put(in_bytes_h)
+remote_stream.put(in_bytes_h)
+scanned = read_scan_stream(remote_stream)
+int_equals(len(scanned), 67)
+scanned = read_scan_stream(remote_stream)
+int_equals(len(scanned), 67)
+remote_stream.put(in_bytes_a)  # cached as missing, not sent
+bool_equals(remote_stream.empty(), True)
+del remote_stream
+server.terminate()
+server.wait()
+bad_stream = hashdb.remote_scan_stream_t("not an address", 8)
+bool_equals(bad_stream.error_message() != "", True)
+del bad_stream
+
+# ############################################################
+# test inserting many hashes of one source together
+# ############################################################
+shutil.rmtree("temp_2.hdb", True)
+str_equals(hashdb.create_hashdb("temp_2.hdb", settings, cmd), "")
+import_manager = hashdb.import_manager_t("temp_2.hdb", "insert_hashes test")
+hashes = hashdb.hash_inserts_t()
+hashes.append(hashdb.hash_insert_t("bbbbbbbb", 8000, ""))
+hashes.append(hashdb.hash_insert_t("aaaaaaaa", 7000, "H"))
+hashes.append(hashdb.hash_insert_t("bbbbbbbb", 8000, ""))
+import_manager.insert_hashes("ffffffff", hashes)
+str_equals(import_manager.size_hashes(), 2)
+str_equals(import_manager.size_sources(), 1)
+import_manager = None
+scan_manager = hashdb.scan_manager_t("temp_2.hdb")
+int_equals(scan_manager.find_hash_count("bbbbbbbb"), 2)
+scan_manager = None
+
+# k_entropies are 8-byte integers or their bytes
+import_manager = hashdb.import_manager_t("temp_2.hdb", "packed test")
+bool_equals(import_manager.insert_packed_hashes("gggggggg",
+                b"cccccccc", 8, array.array('Q', [6000])), True)
+bool_equals(import_manager.insert_packed_hashes("gggggggg",
+                b"dddddddd", 8, struct.pack("=Q", 5000)), True)
+for k_entropies, error in [(array.array('d', [5000.0]), TypeError),
+                           (array.array('I', [5000, 0]), TypeError),
+                           (b"\0" * 12, ValueError)]:
+    try:
+        import_manager.insert_packed_hashes("gggggggg", b"eeeeeeee", 8,
+                                            k_entropies)
+        bool_equals("no error raised", False)
+    except error:
+        pass
+import_manager = None
+scan_manager = hashdb.scan_manager_t("temp_2.hdb")
+int_equals(scan_manager.find_hash_count("cccccccc"), 1)
+int_equals(scan_manager.find_hash_count("dddddddd"), 1)
+int_equals(scan_manager.find_hash_count("eeeeeeee"), 0)
+scan_manager = None
+
+# ############################################################
+# test live metrics
+# ############################################################
+scan_manager = hashdb.scan_manager_t("temp_2.hdb")
+int_equals(scan_manager.find_hash_count("bbbbbbbb"), 2)
+metrics = hashdb.metrics_text()
+bool_equals("# TYPE hashdb_lookups_total counter" in metrics, True)
+bool_equals('hashdb_lmdb_max_readers{store="temp_2.hdb/lmdb_hash_store"' in metrics, True)
+str_equals(hashdb.start_metrics_server("unix:temp_metrics.sock"), "")
+bool_equals(hashdb.start_metrics_server("unix:temp_metrics.sock") != "", True)
+client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+client.connect("temp_metrics.sock")
+client.sendall(b"GET /metrics HTTP/1.0\r\n\r\n")
+response = b""
+while True:
+    data = client.recv(4096)
+    if not data:
+        break
+    response += data
+client.close()
+bool_equals(response.startswith(b"HTTP/1.0 200 OK"), True)
+bool_equals(b"hashdb_stage_seconds_total" in response, True)
+hashdb.stop_metrics_server()
+bool_equals(os.path.exists("temp_metrics.sock"), False)
+scan_manager = None
+
 print("Done.")
 
@@ -27,6 +27,7 @@
 #define ADDER_HPP
 
 #include "../src_libhashdb/hashdb.hpp"
+#include "file_hash_table.hpp"
 
 // Standard includes
 #include <cstdlib>
@@ -46,27 +47,32 @@ class adder_t {
   hashdb::import_manager_t* const manager_b;
   const std::string repository_name;
   progress_tracker_t* const tracker;
-  std::set<std::string> preexisting_sources;
-  std::set<std::string> processed_sources;
-  std::set<std::string> repository_sources;
-  std::set<std::string> non_repository_sources;
+
+  // the sources seen, flagged by how they are added
+  enum {PREEXISTING = 1, PROCESSED = 2, REPOSITORY = 4, NON_REPOSITORY = 8,
+        CLASSIFIED = 16};
+  file_hash_table_t sources;
+
+  // classifies sources by repository_name, or NULL when adding all sources
+  hashdb::repository_filter_t* const repository_filter;
 
   // do not allow copy or assignment
   adder_t(const adder_t&);
   adder_t& operator=(const adder_t&);
 
+  static void add_preexisting_source(void* const data,
+                                     const std::string& file_hash) {
+    static_cast<file_hash_table_t*>(data)->set(file_hash, PREEXISTING);
+  }
+
   // identify all preexisting sources in B and skip them during processing
   void load_preexisting_sources() {
-    std::string file_hash = manager_b->first_source();
-    while (file_hash != "") {
-      preexisting_sources.insert(file_hash);
-      file_hash = manager_b->next_source(file_hash);
-    }
+    manager_b->walk_sources(add_preexisting_source, &sources);
   }
 
   // helper function
-  inline bool is_preexisting_source(const std::string& data) {
-    return (preexisting_sources.find(data) != preexisting_sources.end());
+  inline bool is_preexisting_source(const std::string& data) const {
+    return sources.has(data, PREEXISTING);
   }
 
   // add source data
@@ -155,14 +161,29 @@ class adder_t {
   }
 
   void classify_repository_source(const std::string& file_block_hash) {
-    hashdb::source_names_t* names = new hashdb::source_names_t;
 
     // repository_name must be defined
     if (repository_name == "") {
       assert(0);
     }
 
+    // classify from the repository store when A has one
+    if (repository_filter->is_available()) {
+      bool in_repository;
+      bool in_other;
+      repository_filter->classify(file_block_hash, in_repository, in_other);
+      if (in_repository) {
+        sources.set(file_block_hash, REPOSITORY);
+      }
+      if (in_other) {
+        sources.set(file_block_hash, NON_REPOSITORY);
+      }
+      sources.set(file_block_hash, CLASSIFIED);
+      return;
+    }
+
     // read names
+    hashdb::source_names_t* names = new hashdb::source_names_t;
     manager_a->find_source_names(file_block_hash, *names);
 
     // look for repository_name
@@ -170,12 +191,13 @@ class adder_t {
                                it != names->end(); ++it) {
       if (it->first == repository_name) {
         // the source has the repository name
-        repository_sources.insert(file_block_hash);
+        sources.set(file_block_hash, REPOSITORY);
       } else {
         // the source has a non-repository name
-        non_repository_sources.insert(file_block_hash);
+        sources.set(file_block_hash, NON_REPOSITORY);
       }
     }
+    sources.set(file_block_hash, CLASSIFIED);
     delete names;
   }
 
@@ -188,10 +210,8 @@ class adder_t {
                   manager_b(p_manager_b),
                   repository_name(""),
                   tracker(p_tracker),
-                  preexisting_sources(),
-                  processed_sources(),
-                  repository_sources(),
-                  non_repository_sources() {
+                  sources(),
+                  repository_filter(NULL) {
     load_preexisting_sources();
   }
 
@@ -204,35 +224,26 @@ class adder_t {
                   manager_b(p_manager_b),
                   repository_name(p_repository_name),
                   tracker(p_tracker),
-                  preexisting_sources(),
-                  processed_sources(),
-                  repository_sources(),
-                  non_repository_sources() {
+                  sources(),
+                  repository_filter(new hashdb::repository_filter_t(
+                                    *manager_a, repository_name)) {
     load_preexisting_sources();
   }
 
+  ~adder_t() {
+    delete repository_filter;
+  }
+
   // add hash and source information and do not re-add sources
-  void add(const std::string& block_hash) {
-
-    // hash data
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                   new hashdb::source_sub_counts_t;
-
-    // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+  void add(const std::string& block_hash,
+           const uint64_t k_entropy,
+           const std::string& block_label,
+           const uint64_t count,
+           const hashdb::source_sub_counts_t& source_sub_counts) {
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
-         source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
 
       // skip preexisting sources
       if (is_preexisting_source(it->file_hash)) {
@@ -243,48 +254,34 @@ class adder_t {
       manager_b->merge_hash(block_hash, k_entropy, block_label,
                             it->file_hash, it->sub_count);
 
-      if (processed_sources.find(it->file_hash) == processed_sources.end()) {
+      if (!sources.has(it->file_hash, PROCESSED)) {
         // add source information
         add_source_data(it->file_hash);
         add_source_names(it->file_hash);
-        processed_sources.insert(it->file_hash);
+        sources.set(it->file_hash, PROCESSED);
       } else {
         // already processed
       }
     }
 
     // track these hashes
-    tracker->track_hash_data(source_sub_counts->size());
-
-    delete source_sub_counts;
+    tracker->track_hash_data(source_sub_counts.size());
   }
 
   // add hash and source information in count range and do not re-add sources
   void add_range(const std::string& block_hash,
+                 const uint64_t k_entropy,
+                 const std::string& block_label,
+                 const uint64_t count,
+                 const hashdb::source_sub_counts_t& source_sub_counts,
                  size_t m, size_t n) {
 
-    // hash data
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                     new hashdb::source_sub_counts_t;
-
-    // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
-
     // add if in range
     if (count >= m && (n==0 || count <= n)) {
 
       // process each source in source_sub_counts
       for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+           source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
 
         // skip preexisting sources
         if (is_preexisting_source(it->file_hash)) {
@@ -295,11 +292,11 @@ class adder_t {
         manager_b->merge_hash(block_hash, k_entropy, block_label,
                               it->file_hash, it->sub_count);
 
-        if (processed_sources.find(it->file_hash) == processed_sources.end()) {
+        if (!sources.has(it->file_hash, PROCESSED)) {
           // add source information
           add_source_data(it->file_hash);
           add_source_names(it->file_hash);
-          processed_sources.insert(it->file_hash);
+          sources.set(it->file_hash, PROCESSED);
         } else {
           // already processed
         }
@@ -307,33 +304,19 @@ class adder_t {
     }
 
     // track these hashes
-    tracker->track_hash_data(source_sub_counts->size());
-
-    delete source_sub_counts;
+    tracker->track_hash_data(source_sub_counts.size());
   }
 
   // add hashes and source references when the repository name matches
-  void add_repository(const std::string& block_hash) {
-
-    // hash data
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                 new hashdb::source_sub_counts_t;
-
-    // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+  void add_repository(const std::string& block_hash,
+                      const uint64_t k_entropy,
+                      const std::string& block_label,
+                      const uint64_t count,
+                      const hashdb::source_sub_counts_t& source_sub_counts) {
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
-         source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
 
       // skip preexisting sources
       if (is_preexisting_source(it->file_hash)) {
@@ -341,26 +324,24 @@ class adder_t {
       }
 
       // make sure the source is classified as copied or skipped
-      if (processed_sources.find(it->file_hash) == processed_sources.end() &&
-          non_repository_sources.find(it->file_hash) == non_repository_sources.end()) {
+      if (!sources.has(it->file_hash, CLASSIFIED)) {
 
         // not classified so classify it
         classify_repository_source(it->file_hash);
       }
 
       // only process sources matching repository_name
-      if (repository_sources.find(it->file_hash) !=
-                              repository_sources.end()) {
+      if (sources.has(it->file_hash, REPOSITORY)) {
 
         // add hash for source
         manager_b->merge_hash(block_hash, k_entropy, block_label,
                               it->file_hash, it->sub_count);
 
-        if (processed_sources.find(it->file_hash) == processed_sources.end()) {
+        if (!sources.has(it->file_hash, PROCESSED)) {
           // add source information
           add_source_data(it->file_hash);
           add_repository_source_names(it->file_hash);
-          processed_sources.insert(it->file_hash);
+          sources.set(it->file_hash, PROCESSED);
         } else {
           // already processed
         }
@@ -368,33 +349,19 @@ class adder_t {
     }
 
     // track these hashes
-    tracker->track_hash_data(source_sub_counts->size());
-
-    delete source_sub_counts;
+    tracker->track_hash_data(source_sub_counts.size());
   }
 
   // add hashes and source references when the repository name does not match
-  void add_non_repository(const std::string& block_hash) {
-
-    // hash data
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                      new hashdb::source_sub_counts_t;
-
-    // get hash data from A
-    bool found_hash = manager_a->find_hash(block_hash, k_entropy, block_label,
-                                           count, *source_sub_counts);
-    // hash required
-    if (!found_hash) {
-      // program error
-      assert(0);
-    }
+  void add_non_repository(const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const uint64_t count,
+                          const hashdb::source_sub_counts_t& source_sub_counts) {
 
     // process each source in source_sub_counts
     for (hashdb::source_sub_counts_t::const_iterator it =
-         source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
 
       // skip preexisting sources
       if (is_preexisting_source(it->file_hash)) {
@@ -402,26 +369,24 @@ class adder_t {
       }
 
       // make sure the source is classified as copied or skipped
-      if (processed_sources.find(it->file_hash) == processed_sources.end() &&
-          non_repository_sources.find(it->file_hash) == non_repository_sources.end()) {
+      if (!sources.has(it->file_hash, CLASSIFIED)) {
 
         // not classified so classify it
         classify_repository_source(it->file_hash);
       }
 
       // process sources that have at least one non-matching repository_name
-      if (non_repository_sources.find(it->file_hash) !=
-                              non_repository_sources.end()) {
+      if (sources.has(it->file_hash, NON_REPOSITORY)) {
 
         // add hash for source
         manager_b->merge_hash(block_hash, k_entropy, block_label,
                               it->file_hash, it->sub_count);
 
-        if (processed_sources.find(it->file_hash) == processed_sources.end()) {
+        if (!sources.has(it->file_hash, PROCESSED)) {
           // add source information
           add_source_data(it->file_hash);
           add_non_repository_source_names(it->file_hash);
-          processed_sources.insert(it->file_hash);
+          sources.set(it->file_hash, PROCESSED);
         } else {
           // already processed
         }
@@ -429,9 +394,7 @@ class adder_t {
     }
 
     // track these hashes
-    tracker->track_hash_data(source_sub_counts->size());
-
-    delete source_sub_counts;
+    tracker->track_hash_data(source_sub_counts.size());
   }
 };
 
@@ -26,6 +26,7 @@
 #define ADDER_SET_HPP
 
 #include "../src_libhashdb/hashdb.hpp"
+#include "file_hash_table.hpp"
 
 // Standard includes
 #include <cstdlib>
@@ -43,17 +44,23 @@ class adder_set_t {
   const hashdb::scan_manager_t* const manager_a;
   const hashdb::scan_manager_t* const manager_b;
   hashdb::import_manager_t* const manager_c;
-  progress_tracker_t* const tracker;
-  std::set<std::string> preexisting_sources;
-  std::set<std::string> processed_sources;
+
+  // the sources seen, flagged by how they are added
+  enum {PREEXISTING = 1, PROCESSED = 2};
+  file_hash_table_t sources;
 
   // do not allow copy or assignment
   adder_set_t(const adder_set_t&);
   adder_set_t& operator=(const adder_set_t&);
 
+  static void add_preexisting_source(void* const data,
+                                     const std::string& file_hash) {
+    static_cast<file_hash_table_t*>(data)->set(file_hash, PREEXISTING);
+  }
+
   // helper function
-  inline bool is_preexisting_source(const std::string& data) {
-    return (preexisting_sources.find(data) != preexisting_sources.end());
+  inline bool is_preexisting_source(const std::string& data) const {
+    return sources.has(data, PREEXISTING);
   }
 
   // add source data
@@ -106,170 +113,108 @@ class adder_set_t {
   public:
   adder_set_t(const hashdb::scan_manager_t* const p_manager_a,
               const hashdb::scan_manager_t* const p_manager_b,
-              hashdb::import_manager_t* const p_manager_c,
-              progress_tracker_t* const p_tracker) :
+              hashdb::import_manager_t* const p_manager_c) :
                   manager_a(p_manager_a),
                   manager_b(p_manager_b),
                   manager_c(p_manager_c),
-                  tracker(p_tracker),
-                  preexisting_sources(),
-                  processed_sources() {
+                  sources() {
 
     // identify all preexisting sources in C and skip them during processing
-    std::string file_hash = manager_c->first_source();
-    while (file_hash != "") {
-      preexisting_sources.insert(file_hash);
-      file_hash = manager_c->next_source(file_hash);
-    }
+    manager_c->walk_sources(add_preexisting_source, &sources);
   }
 
-  // add A and B into C where A and B hash sources are common
-  void intersect(const std::string& binary_hash) {
-
-    // read hash data from A
-    uint64_t k_entropy_a;
-    std::string block_label_a;
-    uint64_t count_a;
-    hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+  // add A and B into C where A and B hash sources are common,
+  // given the hash in A and B
+  void intersect(const std::string& binary_hash,
+                 const uint64_t k_entropy_a,
+                 const std::string& block_label_a,
+                 const uint64_t count_a,
+                 const hashdb::source_sub_counts_t& source_sub_counts_a,
+                 const hashdb::source_sub_counts_t& source_sub_counts_b) {
 
-    // read hash data from B
-    uint64_t k_entropy_b;
-    std::string block_label_b;
-    uint64_t count_b;
-    hashdb::source_sub_counts_t source_sub_counts_b;
-    bool found_hash_b = manager_b->find_hash(binary_hash, k_entropy_b,
-                                 block_label_b, count_b, source_sub_counts_b);
-    if (found_hash_b) {
-
-      // go through source offsets in A and look for matches in B
-      for (hashdb::source_sub_counts_t::const_iterator it_a =
-         source_sub_counts_a.begin(); it_a != source_sub_counts_a.end();
-         ++it_a) {
+    // go through source offsets in A and look for matches in B
+    for (hashdb::source_sub_counts_t::const_iterator it_a =
+       source_sub_counts_a.begin(); it_a != source_sub_counts_a.end();
+       ++it_a) {
 
-        // skip preexisting sources
-        if (is_preexisting_source(it_a->file_hash)) {
-          continue;
-        }
+      // skip preexisting sources
+      if (is_preexisting_source(it_a->file_hash)) {
+        continue;
+      }
 
-        if (source_sub_counts_b.find(*it_a) != source_sub_counts_b.end()) {
-          // in A and B so put into C
-          manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
-                                it_a->file_hash, it_a->sub_count);
-
-          if (processed_sources.find(it_a->file_hash) == processed_sources.end()) {
-            // add source information
-            add_source_data(it_a->file_hash);
-            add_source_names(it_a->file_hash);
-            processed_sources.insert(it_a->file_hash);
-          } else {
-            // already processed
-          }
+      if (source_sub_counts_b.find(*it_a) != source_sub_counts_b.end()) {
+        // in A and B so put into C
+        manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
+                              it_a->file_hash, it_a->sub_count);
+
+        if (!sources.has(it_a->file_hash, PROCESSED)) {
+          // add source information
+          add_source_data(it_a->file_hash);
+          add_source_names(it_a->file_hash);
+          sources.set(it_a->file_hash, PROCESSED);
+        } else {
+          // already processed
         }
       }
     }
-
-    // track these hashes
-    tracker->track_hash_data(source_sub_counts_a.size());
   }
 
-  // add A and B into C when A and B hash is common
-  void intersect_hash(const std::string& binary_hash) {
-
-    // read hash data from A
-    uint64_t k_entropy_a;
-    std::string block_label_a;
-    uint64_t count_a;
-    hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+  // add A and B into C when A and B hash is common,
+  // given the hash in A and B
+  void intersect_hash(const std::string& binary_hash,
+                      const uint64_t k_entropy_a,
+                      const std::string& block_label_a,
+                      const uint64_t count_a,
+                      const hashdb::source_sub_counts_t& source_sub_counts_a,
+                      const hashdb::source_sub_counts_t& source_sub_counts_b) {
 
-    // read hash data from B
-    uint64_t k_entropy_b;
-    std::string block_label_b;
-    uint64_t count_b;
-    hashdb::source_sub_counts_t source_sub_counts_b;
-    bool found_hash_b = manager_b->find_hash(binary_hash, k_entropy_b,
-                                 block_label_b, count_b, source_sub_counts_b);
-    if (found_hash_b) {
-
-      // union sources A and B into C
-      hashdb::source_sub_counts_t source_sub_counts_c;
-      for (hashdb::source_sub_counts_t::const_iterator it_a =
-           source_sub_counts_a.begin(); it_a != source_sub_counts_a.end();
-           ++it_a) {
-        source_sub_counts_c.insert(*it_a);
-      }
-      for (hashdb::source_sub_counts_t::const_iterator it_b =
-           source_sub_counts_b.begin(); it_b != source_sub_counts_b.end();
-           ++it_b) {
-        source_sub_counts_c.insert(*it_b);
-      }
+    // union sources A and B into C
+    hashdb::source_sub_counts_t source_sub_counts_c;
+    for (hashdb::source_sub_counts_t::const_iterator it_a =
+         source_sub_counts_a.begin(); it_a != source_sub_counts_a.end();
+         ++it_a) {
+      source_sub_counts_c.insert(*it_a);
+    }
+    for (hashdb::source_sub_counts_t::const_iterator it_b =
+         source_sub_counts_b.begin(); it_b != source_sub_counts_b.end();
+         ++it_b) {
+      source_sub_counts_c.insert(*it_b);
+    }
 
-      // copy union of sources
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts_c.begin(); it != source_sub_counts_c.end();
-           ++it) {
+    // copy union of sources
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts_c.begin(); it != source_sub_counts_c.end();
+         ++it) {
 
-        // skip preexisting sources
-        if (is_preexisting_source(it->file_hash)) {
-          continue;
-        }
+      // skip preexisting sources
+      if (is_preexisting_source(it->file_hash)) {
+        continue;
+      }
 
-        // add hash for source
-        manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
-                              it->file_hash, it->sub_count);
+      // add hash for source
+      manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
+                            it->file_hash, it->sub_count);
 
-        if (processed_sources.find(it->file_hash) == processed_sources.end()) {
-          // add source information
-          add_source_data(it->file_hash);
-          add_source_names(it->file_hash);
-          processed_sources.insert(it->file_hash);
-        } else {
-          // already processed
-        }
+      if (!sources.has(it->file_hash, PROCESSED)) {
+        // add source information
+        add_source_data(it->file_hash);
+        add_source_names(it->file_hash);
+        sources.set(it->file_hash, PROCESSED);
+      } else {
+        // already processed
       }
     }
-
-    // track these hashes
-    tracker->track_hash_data(source_sub_counts_a.size());
   }
 
-  // add A into C when A hash and source is not in B
-  void subtract(const std::string& binary_hash) {
-
-    // read hash data from A
-    uint64_t k_entropy_a;
-    std::string block_label_a;
-    uint64_t count_a;
-    hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+  // add A into C when A hash and source is not in B,
+  // given the hash in A and its sources in B, if any
+  void subtract(const std::string& binary_hash,
+                const uint64_t k_entropy_a,
+                const std::string& block_label_a,
+                const uint64_t count_a,
+                const hashdb::source_sub_counts_t& source_sub_counts_a,
+                const hashdb::source_sub_counts_t& source_sub_counts_b) {
 
-    // read hash data from B
-    uint64_t k_entropy_b;
-    std::string block_label_b;
-    uint64_t count_b;
-    hashdb::source_sub_counts_t source_sub_counts_b;
-    manager_b->find_hash(binary_hash, k_entropy_b,
-                                 block_label_b, count_b, source_sub_counts_b);
- 
     // put sources in A and not in B into C
     hashdb::source_sub_counts_t source_sub_counts_c;
     for (hashdb::source_sub_counts_t::const_iterator it_a =
@@ -294,68 +239,47 @@ class adder_set_t {
       manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
                             it->file_hash, it->sub_count);
 
-      if (processed_sources.find(it->file_hash) == processed_sources.end()) {
+      if (!sources.has(it->file_hash, PROCESSED)) {
         // add source information
         add_source_data(it->file_hash);
         add_source_names(it->file_hash);
-        processed_sources.insert(it->file_hash);
+        sources.set(it->file_hash, PROCESSED);
       } else {
         // already processed
       }
     }
-
-    // track these hashes
-    tracker->track_hash_data(source_sub_counts_a.size());
   }
 
-  // add A into C when A hash is not in B
-  void subtract_hash(const std::string& binary_hash) {
-
-    // read hash data from A
-    uint64_t k_entropy_a;
-    std::string block_label_a;
-    uint64_t count_a;
-    hashdb::source_sub_counts_t source_sub_counts_a;
-    bool found_hash_a = manager_a->find_hash(binary_hash, k_entropy_a,
-                                 block_label_a, count_a, source_sub_counts_a);
-    // hash required
-    if (!found_hash_a) {
-      // program error
-      assert(0);
-    }
+  // add A into C when A hash is not in B, given the hash in A only
+  void subtract_hash(const std::string& binary_hash,
+                     const uint64_t k_entropy_a,
+                     const std::string& block_label_a,
+                     const uint64_t count_a,
+                     const hashdb::source_sub_counts_t& source_sub_counts_a) {
 
-    // read hash count from B
-    size_t count = manager_b->find_hash_count(binary_hash);
-    if (count == 0) {
-      // hash not in B so copy to C
-
-      // copy A sources
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts_a.begin(); it != source_sub_counts_a.end();
-           ++it) {
+    // copy A sources
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts_a.begin(); it != source_sub_counts_a.end();
+         ++it) {
 
-        // skip preexisting sources
-        if (is_preexisting_source(it->file_hash)) {
-          continue;
-        }
+      // skip preexisting sources
+      if (is_preexisting_source(it->file_hash)) {
+        continue;
+      }
 
-        // add hash for source
-        manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
-                              it->file_hash, it->sub_count);
+      // add hash for source
+      manager_c->merge_hash(binary_hash, k_entropy_a, block_label_a,
+                            it->file_hash, it->sub_count);
 
-        if (processed_sources.find(it->file_hash) == processed_sources.end()) {
-          // add source information
-          add_source_data(it->file_hash);
-          add_source_names(it->file_hash);
-          processed_sources.insert(it->file_hash);
-        } else {
-          // already processed
-        }
+      if (!sources.has(it->file_hash, PROCESSED)) {
+        // add source information
+        add_source_data(it->file_hash);
+        add_source_names(it->file_hash);
+        sources.set(it->file_hash, PROCESSED);
+      } else {
+        // already processed
       }
     }
-
-    // track these hashes
-    tracker->track_hash_data(source_sub_counts_a.size());
   }
 
 };
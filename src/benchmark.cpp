@@ -0,0 +1,717 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Measure end-to-end throughput on a generated database whose hashes
+ * appear in sources with a Zipfian or measured multiplicity, the
+ * throughput and latency of scan_stream under concurrent producers, and
+ * the media read throughput of the scan reader path.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <atomic>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "../src_libhashdb/hashdb.hpp"
+#include "benchmark.hpp"
+
+// the most sources a hash may appear in
+static const uint64_t MAX_SOURCES = 100000;
+
+// hashes from a Zipf distribution appear in at most this many sources
+static const uint64_t ZIPF_MAX_DUPLICATES = 1000;
+
+// hashes are inserted into a source this many at a time
+static const size_t INSERT_BATCH_SIZE = 100000;
+
+// the most present hashes a scan_stream load draws from
+static const size_t MAX_STREAM_HASHES = 100000;
+
+// the job sizes media reads are measured at
+static const size_t READ_JOB_SIZES[] = {1048576, 4194304, 16777216};
+
+// a repeatable pseudorandom sequence, splitmix64
+class random_t {
+  private:
+  uint64_t state;
+
+  public:
+  explicit random_t(const uint64_t seed) : state(seed) {
+  }
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+  // uniform in [0, 1)
+  double uniform() {
+    return static_cast<double>(next() >> 11) / 9007199254740992.0;
+  }
+};
+
+// the binary block hash numbered i, hashes at or past count are absent
+static std::string block_hash(const uint64_t i) {
+  random_t random(i);
+  const uint64_t a = random.next();
+  const uint64_t b = random.next();
+  std::string hash(16, '\0');
+  for (size_t j=0; j<8; ++j) {
+    hash[j] = static_cast<char>(a >> (8 * j));
+    hash[j + 8] = static_cast<char>(b >> (8 * j));
+  }
+  return hash;
+}
+
+// the binary file hash of source number s
+static std::string file_hash(const uint64_t s) {
+  return block_hash(s ^ 0x8000000000000000ULL);
+}
+
+// seconds of wall clock time
+static double now() {
+  struct timeval t;
+  gettimeofday(&t, 0);
+  return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+// nanoseconds of monotonic clock time for timing lookups
+static uint64_t now_ns() {
+#ifdef CLOCK_MONOTONIC
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
+#else
+  return static_cast<uint64_t>(now() * 1000000000.0);
+#endif
+}
+
+// The cumulative weights of the number of sources a hash appears in,
+// where weights[d-1] is the weight of d sources.
+static std::vector<double> duplicate_weights(const double zipf_exponent,
+                                     const std::string& histogram_file) {
+  std::vector<double> weights;
+  if (histogram_file == "") {
+    for (uint64_t d=1; d<=ZIPF_MAX_DUPLICATES; ++d) {
+      weights.push_back(std::pow(static_cast<double>(d), -zipf_exponent));
+    }
+  } else {
+    // read {"duplicates":<d>, "distinct_hashes":<n>, ...} lines
+    std::ifstream in(histogram_file.c_str());
+    if (!in.is_open()) {
+      std::cerr << "Error: Cannot open " << histogram_file << "\n";
+      exit(1);
+    }
+    std::string line;
+    while (getline(in, line)) {
+      unsigned long long duplicates;
+      unsigned long long distinct_hashes;
+      if (sscanf(line.c_str(), "{\"duplicates\":%llu, \"distinct_hashes\":%llu",
+                 &duplicates, &distinct_hashes) != 2 || duplicates == 0) {
+        continue;
+      }
+      const uint64_t d = std::min(static_cast<uint64_t>(duplicates),
+                                  MAX_SOURCES);
+      if (weights.size() < d) {
+        weights.resize(d, 0.0);
+      }
+      weights[d - 1] += static_cast<double>(distinct_hashes);
+    }
+    if (weights.size() == 0) {
+      std::cerr << "Error: No duplicates histogram in " << histogram_file
+                << "\n";
+      exit(1);
+    }
+  }
+
+  // make cumulative
+  for (size_t i=1; i<weights.size(); ++i) {
+    weights[i] += weights[i - 1];
+  }
+  return weights;
+}
+
+// the number of sources of a hash, drawn from the cumulative weights
+static uint64_t draw_duplicates(const std::vector<double>& weights,
+                                random_t& random) {
+  const double u = random.uniform() * weights.back();
+  return static_cast<uint64_t>(std::upper_bound(weights.begin(),
+                               weights.end(), u) - weights.begin()) + 1;
+}
+
+// the bytes allocated to the files of a directory and its subdirectories
+static uint64_t allocated_size(const std::string& dir) {
+  uint64_t size = 0;
+  DIR* const d = opendir(dir.c_str());
+  if (d == NULL) {
+    return 0;
+  }
+  struct dirent* e;
+  while ((e = readdir(d)) != NULL) {
+    const std::string name(e->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    const std::string path = dir + "/" + name;
+    struct stat s;
+    if (stat(path.c_str(), &s) != 0) {
+      continue;
+    }
+    if (S_ISDIR(s.st_mode)) {
+      size += allocated_size(path);
+    } else {
+#ifdef WIN32
+      size += s.st_size;
+#else
+      size += static_cast<uint64_t>(s.st_blocks) * 512;
+#endif
+    }
+  }
+  closedir(d);
+  return size;
+}
+
+// the lookups of one scan thread
+struct scan_slice_t {
+  hashdb::scan_manager_t* manager;
+  hashdb::scan_mode_t scan_mode;
+  const std::vector<uint64_t>* probes;
+  size_t begin;
+  size_t end;
+  uint64_t matches;
+  std::vector<uint64_t> latencies;   // nanoseconds of each lookup
+  pthread_t thread;
+
+  scan_slice_t() : manager(NULL), scan_mode(hashdb::scan_mode_t::EXPANDED),
+                   probes(NULL), begin(0), end(0), matches(0), latencies(),
+                   thread() {
+  }
+
+  private:
+  // do not allow copy or assignment
+  scan_slice_t(const scan_slice_t&);
+  scan_slice_t& operator=(const scan_slice_t&);
+};
+
+static void* scan_slice(void* const arg) {
+  scan_slice_t* const slice = static_cast<scan_slice_t*>(arg);
+  slice->latencies.reserve(slice->end - slice->begin);
+  for (size_t i=slice->begin; i<slice->end; ++i) {
+    const std::string hash = block_hash((*slice->probes)[i]);
+    const uint64_t t0 = now_ns();
+    const std::string json_text =
+                   slice->manager->find_hash_json(slice->scan_mode, hash);
+    slice->latencies.push_back(now_ns() - t0);
+    if (json_text.size() != 0) {
+      ++slice->matches;
+    }
+  }
+  return NULL;
+}
+
+// the latency at quantile q of sorted latencies, in microseconds
+static double quantile_us(const std::vector<uint64_t>& sorted, double q) {
+  if (sorted.size() == 0) {
+    return 0.0;
+  }
+  const size_t i = std::min(sorted.size() - 1,
+                 static_cast<size_t>(q * static_cast<double>(sorted.size())));
+  return sorted[i] / 1000.0;
+}
+
+// scan the probes with num_threads threads and print the rates
+static void scan_probes(const std::string& hashdb_dir,
+                        const hashdb::scan_mode_t scan_mode,
+                        const std::vector<uint64_t>& probes,
+                        const size_t num_threads) {
+
+  hashdb::scan_manager_t manager(hashdb_dir);
+  std::vector<scan_slice_t*> slices;
+  const size_t slice_size = (probes.size() + num_threads - 1) / num_threads;
+  for (size_t i=0; i<num_threads; ++i) {
+    scan_slice_t* const slice = new scan_slice_t;
+    slice->manager = &manager;
+    slice->scan_mode = scan_mode;
+    slice->probes = &probes;
+    slice->begin = std::min(i * slice_size, probes.size());
+    slice->end = std::min(slice->begin + slice_size, probes.size());
+    slices.push_back(slice);
+  }
+
+  // scan the slices concurrently, the first one in this thread
+  const double t0 = now();
+  for (size_t i=1; i<slices.size(); ++i) {
+    if (pthread_create(&slices[i]->thread, NULL, scan_slice, slices[i])) {
+      std::cerr << "Error creating benchmark scan thread.\n";
+      exit(1);
+    }
+  }
+  scan_slice(slices[0]);
+  for (size_t i=1; i<slices.size(); ++i) {
+    pthread_join(slices[i]->thread, NULL);
+  }
+  const double seconds = std::max(now() - t0, 1e-9);
+
+  // merge the latencies
+  uint64_t matches = 0;
+  std::vector<uint64_t> latencies;
+  latencies.reserve(probes.size());
+  for (size_t i=0; i<slices.size(); ++i) {
+    matches += slices[i]->matches;
+    latencies.insert(latencies.end(), slices[i]->latencies.begin(),
+                     slices[i]->latencies.end());
+    delete slices[i];
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "{\"scan\":{\"threads\":" << num_threads
+            << ", \"lookups\":" << probes.size()
+            << ", \"matches\":" << matches
+            << ", \"seconds\":" << seconds
+            << ", \"lookups_per_second\":" << probes.size() / seconds
+            << ", \"p50_us\":" << quantile_us(latencies, 0.50)
+            << ", \"p99_us\":" << quantile_us(latencies, 0.99)
+            << "}}" << std::endl;
+}
+
+void benchmark(const std::string& hashdb_dir,
+               const hashdb::settings_t& settings,
+               const uint64_t count,
+               const hashdb::scan_mode_t scan_mode,
+               const size_t max_threads,
+               const double hit_rate,
+               const double zipf_exponent,
+               const std::string& histogram_file,
+               const std::string& cmd) {
+
+  // the database must be new
+  hashdb::settings_t existing_settings;
+  if (hashdb::read_settings(hashdb_dir, existing_settings) == "") {
+    std::cerr << "Error: The benchmark database '" << hashdb_dir
+              << "' already exists.\n";
+    exit(1);
+  }
+  std::string error_message = hashdb::create_hashdb(hashdb_dir, settings,
+                                                    cmd);
+  if (error_message.size() != 0) {
+    std::cerr << "Error: " << error_message << "\n";
+    exit(1);
+  }
+
+  // the sources of each hash as (source << 40 | hash) pairs, in source order
+  const std::vector<double> weights =
+                     duplicate_weights(zipf_exponent, histogram_file);
+  const uint64_t num_sources = std::max(static_cast<uint64_t>(1000),
+                                        static_cast<uint64_t>(weights.size()));
+  random_t random(1);
+  std::vector<uint64_t> pairs;
+  for (uint64_t i=0; i<count; ++i) {
+    const uint64_t duplicates = draw_duplicates(weights, random);
+    const uint64_t first_source = random.next() % num_sources;
+    for (uint64_t d=0; d<duplicates; ++d) {
+      pairs.push_back(((first_source + d) % num_sources) << 40 | i);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  // ingest the sources
+  const uint64_t mask = (static_cast<uint64_t>(1) << 40) - 1;
+  const double ingest_t0 = now();
+  {
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    size_t p = 0;
+    while (p < pairs.size()) {
+      const uint64_t source = pairs[p] >> 40;
+      const std::string source_hash = file_hash(source);
+      uint64_t blocks = 0;
+      hashdb::hash_inserts_t inserts;
+      while (p < pairs.size() && (pairs[p] >> 40) == source) {
+        const uint64_t i = pairs[p] & mask;
+        inserts.push_back(hashdb::hash_insert_t(block_hash(i),
+                                                (i * 7919) % 8000, ""));
+        ++p;
+        ++blocks;
+        if (inserts.size() == INSERT_BATCH_SIZE) {
+          manager.insert_hashes(source_hash, inserts);
+          inserts.clear();
+        }
+      }
+      manager.insert_hashes(source_hash, inserts);
+      std::stringstream ss;
+      ss << "benchmark_file_" << source;
+      manager.insert_source_name(source_hash, "benchmark_repository",
+                                 ss.str());
+      manager.insert_source_data(source_hash, blocks * settings.block_size,
+                                 "", 0, 0);
+    }
+  }
+  const double ingest_seconds = std::max(now() - ingest_t0, 1e-9);
+  const double ingest_mb = static_cast<double>(pairs.size()) *
+                           settings.block_size / (1024.0 * 1024.0);
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "{\"ingest\":{\"hashes\":" << count
+            << ", \"records\":" << pairs.size()
+            << ", \"sources\":" << num_sources
+            << ", \"seconds\":" << ingest_seconds
+            << ", \"mb_per_second\":" << ingest_mb / ingest_seconds
+            << ", \"records_per_second\":" << pairs.size() / ingest_seconds
+            << "}}" << std::endl;
+
+  // database size
+  const uint64_t db_bytes = allocated_size(hashdb_dir);
+  std::cout << "{\"size\":{\"bytes\":" << db_bytes
+            << ", \"bytes_per_hash\":"
+            << (count == 0 ? 0.0 : static_cast<double>(db_bytes) / count)
+            << ", \"bytes_per_record\":"
+            << (pairs.size() == 0 ? 0.0 :
+                static_cast<double>(db_bytes) / pairs.size())
+            << "}}" << std::endl;
+  pairs.clear();
+
+  // the scanned hashes, present with probability hit_rate
+  std::vector<uint64_t> probes;
+  probes.reserve(count);
+  for (uint64_t i=0; i<count; ++i) {
+    if (random.uniform() < hit_rate) {
+      probes.push_back(random.next() % count);
+    } else {
+      probes.push_back(count + random.next() % count);
+    }
+  }
+
+  // scan at 1, 2, 4, ... threads and at max_threads
+  for (size_t num_threads=1; ; num_threads*=2) {
+    const size_t threads = std::min(num_threads, max_threads);
+    scan_probes(hashdb_dir, scan_mode, probes, threads);
+    if (threads == max_threads) {
+      break;
+    }
+  }
+}
+
+// CPU seconds used by the calling thread, or 0 if not available
+static double thread_cpu_seconds() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec t;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t) != 0) {
+    return 0.0;
+  }
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+#else
+  return 0.0;
+#endif
+}
+
+// CPU seconds used by the process, or 0 if not available
+static double process_cpu_seconds() {
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+  struct timespec t;
+  if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t) != 0) {
+    return 0.0;
+  }
+  return t.tv_sec + t.tv_nsec / 1000000000.0;
+#else
+  return 0.0;
+#endif
+}
+
+// one producer thread putting batches onto a shared scan_stream
+struct stream_producer_t {
+  hashdb::scan_stream_t* scan_stream;
+  const std::vector<std::string>* present;  // hashes in the database
+  size_t hash_size;
+  double hit_rate;
+  size_t batch_size;
+  size_t batches;
+  uint64_t seed;
+  std::vector<uint64_t>* put_ns;   // put time of each sequence ID
+  std::atomic<size_t>* producers_done;
+  double cpu_seconds;
+  pthread_t thread;
+
+  stream_producer_t() : scan_stream(NULL), present(NULL), hash_size(0),
+                        hit_rate(0.0), batch_size(0), batches(0), seed(0),
+                        put_ns(NULL), producers_done(NULL), cpu_seconds(0.0),
+                        thread() {
+  }
+
+  private:
+  // do not allow copy or assignment
+  stream_producer_t(const stream_producer_t&);
+  stream_producer_t& operator=(const stream_producer_t&);
+};
+
+static void* produce_batches(void* const arg) {
+  stream_producer_t* const producer = static_cast<stream_producer_t*>(arg);
+  random_t random(producer->seed);
+  const double cpu_start = thread_cpu_seconds();
+  for (size_t b=0; b<producer->batches; ++b) {
+
+    // records of a hash, a 2-byte label length, and the record number
+    std::string batch;
+    for (size_t i=0; i<producer->batch_size; ++i) {
+      std::string hash;
+      if (producer->present->size() > 0 &&
+          random.uniform() < producer->hit_rate) {
+        hash = (*producer->present)[random.next() %
+                                    producer->present->size()];
+      } else {
+        hash = block_hash(random.next());
+        hash.resize(producer->hash_size, '\0');
+      }
+      const std::string label = std::to_string(i);
+      const uint16_t label_length = static_cast<uint16_t>(label.size());
+      batch.append(hash);
+      batch.append(reinterpret_cast<const char*>(&label_length),
+                   sizeof(uint16_t));
+      batch.append(label);
+    }
+
+    const uint64_t t0 = now_ns();
+    const uint64_t sequence_id = producer->scan_stream->put(std::move(batch));
+    (*producer->put_ns)[sequence_id] = t0;
+  }
+  producer->cpu_seconds = thread_cpu_seconds() - cpu_start;
+  ++*producer->producers_done;
+  return NULL;
+}
+
+// the stage object of name in stage_stats JSON, or {}
+static std::string stage_json(const std::string& stage_stats,
+                              const std::string& name) {
+  const size_t begin = stage_stats.find("\"" + name + "\":{");
+  if (begin == std::string::npos) {
+    return "{}";
+  }
+  const size_t open = stage_stats.find('{', begin);
+  const size_t close = stage_stats.find('}', open);
+  return stage_stats.substr(open, close - open + 1);
+}
+
+void benchmark_scan_stream(const std::string& hashdb_dir,
+                           const hashdb::scan_mode_t scan_mode,
+                           const size_t num_threads,
+                           const double hit_rate,
+                           const size_t num_producers,
+                           const size_t batch_size,
+                           const size_t batches) {
+
+  hashdb::scan_manager_t manager(hashdb_dir);
+
+  // the present hashes to draw from
+  std::vector<std::string> present;
+  {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    hashdb::hash_iterator_t hash_iterator(manager);
+    while (present.size() < MAX_STREAM_HASHES &&
+           hash_iterator.next(block_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
+      present.push_back(block_hash);
+    }
+  }
+  const size_t hash_size = (present.size() == 0) ? 16 : present[0].size();
+
+  hashdb::scan_stream_t scan_stream(&manager, hash_size, scan_mode,
+                                    static_cast<int>(num_threads));
+
+  // start the producers
+  const size_t total_batches = num_producers * batches;
+  std::vector<uint64_t> put_ns(total_batches, 0);
+  std::vector<uint64_t> get_ns(total_batches, 0);
+  std::atomic<size_t> producers_done(0);
+  std::vector<stream_producer_t*> producers;
+  const double t0 = now();
+  const double process_cpu_start = process_cpu_seconds();
+  for (size_t i=0; i<num_producers; ++i) {
+    stream_producer_t* const producer = new stream_producer_t;
+    producer->scan_stream = &scan_stream;
+    producer->present = &present;
+    producer->hash_size = hash_size;
+    producer->hit_rate = hit_rate;
+    producer->batch_size = batch_size;
+    producer->batches = batches;
+    producer->seed = i + 1;
+    producer->put_ns = &put_ns;
+    producer->producers_done = &producers_done;
+    if (pthread_create(&producer->thread, NULL, produce_batches, producer)) {
+      std::cerr << "Error creating benchmark producer thread.\n";
+      exit(1);
+    }
+    producers.push_back(producer);
+  }
+
+  // collect results in this thread until all are scanned and read.
+  // Arrays without a match are not returned except in EXISTS mode.
+  const double collector_cpu_start = thread_cpu_seconds();
+  uint64_t batches_returned = 0;
+  while (producers_done < num_producers || !scan_stream.empty()) {
+    uint64_t sequence_id;
+    const std::string scanned = scan_stream.get(100, sequence_id);
+    if (scanned.size() > 0 && sequence_id < total_batches) {
+      get_ns[sequence_id] = now_ns();
+      ++batches_returned;
+    }
+  }
+  const double collector_cpu = thread_cpu_seconds() - collector_cpu_start;
+  const double seconds = std::max(now() - t0, 1e-9);
+  const double process_cpu = process_cpu_seconds() - process_cpu_start;
+
+  // producer CPU
+  double producers_cpu = 0.0;
+  std::stringstream producer_utilization;
+  producer_utilization << std::fixed << std::setprecision(3);
+  for (size_t i=0; i<producers.size(); ++i) {
+    pthread_join(producers[i]->thread, NULL);
+    producers_cpu += producers[i]->cpu_seconds;
+    producer_utilization << (i == 0 ? "" : ", ")
+                         << producers[i]->cpu_seconds / seconds;
+    delete producers[i];
+  }
+
+  // end-to-end latencies of returned batches
+  std::vector<uint64_t> latencies;
+  latencies.reserve(batches_returned);
+  for (size_t i=0; i<total_batches; ++i) {
+    if (get_ns[i] != 0) {
+      latencies.push_back(get_ns[i] - put_ns[i]);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  // the scan threads use what the producers and collector do not
+  const size_t scan_threads = (num_threads == 0) ? hashdb::num_cpus()
+                                                 : num_threads;
+  const double scan_cpu = std::max(process_cpu - producers_cpu -
+                                   collector_cpu, 0.0);
+  const std::string stage_stats = hashdb::stage_stats_json();
+
+  std::cout << std::fixed << std::setprecision(3)
+            << "{\"scan_stream\":{\"producers\":" << num_producers
+            << ", \"scan_threads\":" << scan_threads
+            << ", \"batch_size\":" << batch_size
+            << ", \"batches\":" << total_batches
+            << ", \"batches_returned\":" << batches_returned
+            << ", \"seconds\":" << seconds
+            << ", \"hashes_per_second\":"
+            << total_batches * batch_size / seconds
+            << ", \"batches_per_second\":" << total_batches / seconds
+            << ", \"latency_p50_us\":" << quantile_us(latencies, 0.50)
+            << ", \"latency_p99_us\":" << quantile_us(latencies, 0.99)
+            << ", \"latency_max_us\":" << quantile_us(latencies, 1.0)
+            << ", \"queue_wait\":" << stage_json(stage_stats,
+                                                 "scan_queue_wait")
+            << ", \"scan_array\":" << stage_json(stage_stats, "scan_array")
+            << ", \"producer_cpu_utilization\":["
+            << producer_utilization.str() << "]"
+            << ", \"collector_cpu_utilization\":" << collector_cpu / seconds
+            << ", \"scan_thread_cpu_utilization\":"
+            << scan_cpu / seconds / scan_threads
+            << "}}" << std::endl;
+}
+
+void benchmark_read(const std::string& media_image,
+                    const size_t num_threads,
+                    const size_t max_queue_depth) {
+
+  // E01 images are always read through libewf
+  std::vector<std::string> readers;
+  const bool is_e01 = media_image.size() >= 4 &&
+                      media_image.substr(media_image.size() - 4) == ".E01";
+  if (is_e01) {
+    readers.push_back("read");
+  } else {
+    readers.push_back("mapped");
+    readers.push_back("read");
+    readers.push_back("direct");
+  }
+
+  const size_t num_job_sizes = sizeof(READ_JOB_SIZES) / sizeof(size_t);
+  for (size_t r=0; r<readers.size(); ++r) {
+    for (size_t j=0; j<num_job_sizes; ++j) {
+      for (size_t depth=1; ; depth*=2) {
+        const size_t queue_depth = std::min(depth, max_queue_depth);
+        uint64_t bytes_read;
+        double seconds;
+        double cpu_seconds;
+        const std::string error_message = hashdb::benchmark_media_read(
+                     media_image, readers[r], READ_JOB_SIZES[j],
+                     queue_depth, num_threads, bytes_read, seconds,
+                     cpu_seconds);
+        if (error_message.size() != 0) {
+          std::cerr << "Error: " << error_message << "\n";
+          exit(1);
+        }
+        seconds = std::max(seconds, 1e-9);
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "{\"read\":{\"reader\":\""
+                  << (is_e01 ? "ewf" : readers[r])
+                  << "\", \"job_size\":" << READ_JOB_SIZES[j]
+                  << ", \"queue_depth\":" << queue_depth
+                  << ", \"threads\":" << num_threads
+                  << ", \"bytes\":" << bytes_read
+                  << ", \"seconds\":" << seconds
+                  << ", \"mb_per_second\":"
+                  << bytes_read / (1024.0 * 1024.0) / seconds
+                  << ", \"cpu_ns_per_byte\":"
+                  << (bytes_read == 0 ? 0.0 :
+                      cpu_seconds * 1000000000.0 / bytes_read)
+                  << "}}" << std::endl;
+        if (queue_depth == max_queue_depth) {
+          break;
+        }
+      }
+    }
+  }
+}
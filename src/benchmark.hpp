@@ -0,0 +1,85 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Measure end-to-end throughput on a generated database whose hashes
+ * appear in sources with a Zipfian or measured multiplicity, the
+ * throughput and latency of scan_stream under concurrent producers, and
+ * the media read throughput of the scan reader path.
+ */
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+#include "../src_libhashdb/hashdb.hpp"
+
+/**
+ * Create hashdb_dir with settings and add count distinct hashes, then
+ * scan count hashes at 1, 2, 4, ... up to max_threads threads.  Prints
+ * JSON lines for ingest throughput, database size per record, and scan
+ * throughput and lookup latency at each thread count.
+ *
+ * The number of sources each hash appears in is drawn from a Zipf
+ * distribution with exponent zipf_exponent, or from the duplicates
+ * histogram in histogram_file, as printed by the histogram command, if
+ * one is given.  A fraction hit_rate of the scanned hashes are present.
+ */
+void benchmark(const std::string& hashdb_dir,
+               const hashdb::settings_t& settings,
+               const uint64_t count,
+               const hashdb::scan_mode_t scan_mode,
+               const size_t max_threads,
+               const double hit_rate,
+               const double zipf_exponent,
+               const std::string& histogram_file,
+               const std::string& cmd);
+
+/**
+ * Put batches of batch_size hashes onto one scan_stream_t of hashdb_dir
+ * with num_threads scan threads from each of num_producers threads, a
+ * fraction hit_rate of them drawn from the hashes of the database, while
+ * this thread gets the results.  Prints a JSON line with hashes per
+ * second, the end-to-end latency percentiles of returned batches, the
+ * queue wait and scan time of arrays, and the CPU utilization of each
+ * producer, the collector, and the scan threads on average.
+ */
+void benchmark_scan_stream(const std::string& hashdb_dir,
+                           const hashdb::scan_mode_t scan_mode,
+                           const size_t num_threads,
+                           const double hit_rate,
+                           const size_t num_producers,
+                           const size_t batch_size,
+                           const size_t batches);
+
+/**
+ * Read media_image through the scan reader path with hashing switched
+ * off, with each reader at each job size and at queue depths of 1, 2,
+ * 4, ... up to max_queue_depth, using num_threads job threads.  Prints
+ * a JSON line with MB/s and CPU nanoseconds per byte for each.  E01
+ * images are read once per job size and queue depth through libewf.
+ */
+void benchmark_read(const std::string& media_image,
+                    const size_t num_threads,
+                    const size_t max_queue_depth);
+
+#endif
@@ -31,6 +31,13 @@
 #include "scan_list.hpp"
 #include "adder.hpp"
 #include "adder_set.hpp"
+#include "merge_join.hpp"
+#include "sorted_run.hpp"
+#include "exchange_bin.hpp"
+#include "benchmark.hpp"
+#include "scan_server.hpp"
+#include "../src_libhashdb/hasher/hash_calculator.hpp"
+#include "../src_libhashdb/hasher/chunker.hpp"
 
 // Standard includes
 #include <cerrno>
@@ -39,8 +46,16 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <fstream>
+#include <iterator>
 #include <algorithm>
 #include <vector>
+#include <dirent.h>
+#include <unistd.h>    // for rmdir
+#include <sys/stat.h>
+
+// sort hashes in runs of this size for bulk loading during import
+static const size_t HASH_BULK_RUN_SIZE = 1000000;
 
 // leave alone else create using existing settings if new
 void create_if_new(const std::string& hashdb_dir,
@@ -74,6 +89,30 @@ void create_if_new(const std::string& hashdb_dir,
   }
 }
 
+// remove a directory and everything in it, such as a staging hashdb
+static void remove_dir_tree(const std::string& dir) {
+  DIR* const d = opendir(dir.c_str());
+  if (d == NULL) {
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    const std::string name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    const std::string path = dir + "/" + name;
+    struct stat s;
+    if (lstat(path.c_str(), &s) == 0 && S_ISDIR(s.st_mode)) {
+      remove_dir_tree(path);
+    } else {
+      std::remove(path.c_str());
+    }
+  }
+  closedir(d);
+  rmdir(dir.c_str());
+}
+
 // require hashdb_dir else fail
 static void require_hashdb_dir(const std::string& hashdb_dir) {
   std::string error_message;
@@ -117,11 +156,13 @@ class in_ptr_t {
   in_ptr_t& operator=(const in_ptr_t&);
 
   public:
-  in_ptr_t(const std::string& in_filename) : in(NULL) {
+  in_ptr_t(const std::string& in_filename, const bool binary = false) :
+           in(NULL) {
     if (in_filename == "-") {
       in = &std::cin;
     } else {
-      std::ifstream* inf = new std::ifstream(in_filename.c_str());
+      std::ifstream* inf = new std::ifstream(in_filename.c_str(),
+                  binary ? std::ios::in | std::ios::binary : std::ios::in);
       if (!inf->is_open()) {
         std::cerr << "Error: Cannot open " << in_filename
                   << ": " << strerror(errno) << "\n";
@@ -151,11 +192,13 @@ class out_ptr_t {
   out_ptr_t& operator=(const out_ptr_t&);
 
   public:
-  out_ptr_t(const std::string& out_filename) : out(NULL) {
+  out_ptr_t(const std::string& out_filename, const bool binary = false) :
+           out(NULL) {
     if (out_filename == "-") {
       out = &std::cout;
     } else {
-      std::ofstream* outf = new std::ofstream(out_filename.c_str());
+      std::ofstream* outf = new std::ofstream(out_filename.c_str(),
+                  binary ? std::ios::out | std::ios::binary : std::ios::out);
       if (!outf->is_open()) {
         std::cerr << "Error: Cannot open " << out_filename
                   << ": " << strerror(errno) << "\n";
@@ -194,28 +237,326 @@ class out_ptr_t {
     }
   }
 
+  void migrate(const std::string& hashdb_dir,
+               const uint32_t hash_data_format,
+               const std::string& cmd) {
+
+    std::string error_message;
+    error_message = hashdb::migrate_hash_data(hashdb_dir, hash_data_format,
+                                              cmd);
+
+    if (error_message.size() == 0) {
+      std::cout << "Hash data migrated to format " << hash_data_format
+                << ".\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  void compress_names(const std::string& hashdb_dir,
+                      const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+    std::string error_message;
+    error_message = hashdb::compress_source_names(hashdb_dir, cmd,
+                                                  bytes_before, bytes_after);
+
+    if (error_message.size() == 0) {
+      std::cout << "Source names compressed from " << bytes_before
+                << " to " << bytes_after << " bytes.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  void optimize(const std::string& hashdb_dir, const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+    uint64_t pages_before;
+    uint64_t pages_after;
+    std::string error_message;
+    error_message = hashdb::optimize_hashdb(hashdb_dir, cmd,
+                         bytes_before, bytes_after, pages_before, pages_after);
+
+    if (error_message.size() == 0) {
+      std::cout << "Hash database optimized from " << bytes_before
+                << " to " << bytes_after << " bytes and from "
+                << pages_before << " to " << pages_after << " pages.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  void rebuild_hash_store(const std::string& hashdb_dir,
+                          const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // the importer prints its changes when it closes
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    manager.rebuild_hash_store();
+  }
+
+  void freeze(const std::string& hashdb_dir,
+              const std::string& frozen_dir,
+              const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    std::string error_message;
+    error_message = hashdb::freeze_hashdb(hashdb_dir, frozen_dir, cmd);
+
+    if (error_message.size() == 0) {
+      std::cout << "Frozen database created.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
   // ************************************************************
   // import/export
   // ************************************************************
-  // import recursively from path
-  static void ingest(const std::string& hashdb_dir,
+  // merge the staging hashdbs into dest_dir in one merge join pass.
+  // A source ingested into more than one staging hashdb, because files
+  // with the same content went to different writers, takes its hashes
+  // and source data from the first staging hashdb it is in and its names
+  // from all.
+  static void merge_staging(const std::vector<std::string>& staging_dirs,
+                            const std::string& dest_dir,
+                            const std::string& cmd) {
+
+    // open the consumer at dest_dir
+    hashdb::import_manager_t consumer(dest_dir, cmd);
+    consumer.set_bulk_load(HASH_BULK_RUN_SIZE);
+
+    // open the producers, noting the first producer of each source
+    std::vector<const hashdb::scan_manager_t*> producers;
+    file_hash_table_t owners;
+    size_t total_hash_records = 0;
+    for (size_t i=0; i<staging_dirs.size(); ++i) {
+      hashdb::scan_manager_t* const producer =
+                               new hashdb::scan_manager_t(staging_dirs[i]);
+      total_hash_records += producer->size_hashes();
+      producers.push_back(producer);
+      for (std::string file_hash = producer->first_source();
+           file_hash.size() != 0;
+           file_hash = producer->next_source(file_hash)) {
+        uint8_t& owner = owners.flags(file_hash);
+        if (owner == 0) {
+          owner = static_cast<uint8_t>(i + 1);
+        }
+      }
+    }
+
+    // start progress tracker
+    progress_tracker_t progress_tracker(dest_dir, total_hash_records, cmd);
+
+    // an adder for each producer
+    std::vector<adder_t*> adders;
+    for (size_t i=0; i<producers.size(); ++i) {
+      adders.push_back(new adder_t(producers[i], &consumer,
+                                   &progress_tracker));
+    }
+
+    // add hashes in order, each source from its first producer
+    merge_join_t merge_join(producers);
+    std::vector<const merge_join_t::record_t*> records;
+    hashdb::source_sub_counts_t owned_sub_counts;
+    while (merge_join.next(records)) {
+      for (size_t i=0; i<records.size(); ++i) {
+        if (records[i] == NULL) {
+          continue;
+        }
+        owned_sub_counts.clear();
+        for (hashdb::source_sub_counts_t::const_iterator it =
+             records[i]->source_sub_counts.begin();
+             it != records[i]->source_sub_counts.end(); ++it) {
+          if (owners.find(it->file_hash) == i + 1) {
+            owned_sub_counts.insert(*it);
+          }
+        }
+        if (owned_sub_counts.size() != 0) {
+          adders[i]->add(records[i]->block_hash, records[i]->k_entropy,
+                         records[i]->block_label, records[i]->count,
+                         owned_sub_counts);
+        }
+      }
+    }
+
+    // add the sources that no hash added, such as files of zero blocks,
+    // and the names of sources from the producers after the first
+    for (size_t i=0; i<producers.size(); ++i) {
+      for (std::string file_hash = producers[i]->first_source();
+           file_hash.size() != 0;
+           file_hash = producers[i]->next_source(file_hash)) {
+        if (owners.find(file_hash) == i + 1) {
+          if (consumer.has_source(file_hash)) {
+            continue;
+          }
+          uint64_t filesize = 0;
+          std::string file_type = "";
+          uint64_t zero_count = 0;
+          uint64_t nonprobative_count = 0;
+          producers[i]->find_source_data(file_hash, filesize, file_type,
+                                         zero_count, nonprobative_count);
+          consumer.insert_source_data(file_hash, filesize, file_type,
+                                      zero_count, nonprobative_count);
+        }
+        hashdb::source_names_t names;
+        producers[i]->find_source_names(file_hash, names);
+        for (hashdb::source_names_t::const_iterator it = names.begin();
+             it != names.end(); ++it) {
+          consumer.insert_source_name(file_hash, it->first, it->second);
+        }
+      }
+    }
+
+    // close the producers
+    for (size_t i=0; i<producers.size(); ++i) {
+      delete adders[i];
+      delete producers[i];
+    }
+  }
+
+  // ingest into num_writers staging hashdbs beside hashdb_dir in parallel
+  // then merge them into hashdb_dir
+  static void ingest_staged(const std::string& hashdb_dir,
+                            const std::string& ingest_path,
+                            const size_t step_size,
+                            const std::string& repository_name,
+                            const std::string& whitelist_dir,
+                            const bool disable_recursive_processing,
+                            const bool disable_calculate_entropy,
+                            const bool disable_calculate_labels,
+                            const bool skip_nonprobative,
+                            const bool direct_reads,
+                            const bool quiet,
+                            const size_t num_writers,
+                            const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // create the staging hashdbs, which must be new
+    std::vector<std::string> staging_dirs;
+    for (size_t i=0; i<num_writers; ++i) {
+      std::stringstream ss;
+      ss << hashdb_dir << ".staging." << i;
+      hashdb::settings_t settings;
+      if (hashdb::read_settings(ss.str(), settings).size() == 0) {
+        std::cerr << "Error: Staging hashdb '" << ss.str()
+                  << "' already exists.\n";
+        exit(1);
+      }
+      create_if_new(ss.str(), hashdb_dir, cmd);
+      staging_dirs.push_back(ss.str());
+    }
+
+    // map: ingest a run of the files into each staging hashdb
+    hashdb::ingest_options_t options;
+    options.skip_nonprobative = skip_nonprobative;
+    options.direct_reads = direct_reads;
+    options.quiet = quiet;
+    std::string error_message = hashdb::ingest_staged(
+                    staging_dirs, ingest_path, step_size, repository_name,
+                    whitelist_dir,
+                    disable_recursive_processing,
+                    disable_calculate_entropy,
+                    disable_calculate_labels,
+                    cmd, options);
+
+    // merge: add the staging hashdbs into hashdb_dir
+    if (error_message.size() == 0) {
+      if (!quiet) {
+        std::cout << "# Merging " << num_writers
+                  << " staging hash databases into " << hashdb_dir << "\n";
+      }
+      merge_staging(staging_dirs, hashdb_dir, cmd);
+    }
+
+    // remove the staging hashdbs
+    for (size_t i=0; i<staging_dirs.size(); ++i) {
+      remove_dir_tree(staging_dirs[i]);
+    }
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // import recursively from path, or from stdin if path is "-"
+  static void ingest(const std::vector<std::string>& hashdb_dirs,
                      const std::string& ingest_path,
-                     const size_t step_size,
+                     const std::vector<size_t>& step_sizes,
                      const std::string& repository_name,
                      const std::string& whitelist_dir,
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
+                     const bool skip_nonprobative,
+                     const bool skip_unchanged,
+                     const bool direct_reads,
+                     const bool quiet,
+                     const std::string& checkpoint_file,
+                     const bool resume,
+                     const size_t num_writers,
                      const std::string& cmd) {
 
+    // maybe ingest through staging hashdbs written in parallel
+    if (num_writers > 1) {
+      ingest_staged(hashdb_dirs[0], ingest_path, step_sizes[0],
+                    repository_name, whitelist_dir,
+                    disable_recursive_processing, disable_calculate_entropy,
+                    disable_calculate_labels, skip_nonprobative,
+                    direct_reads, quiet, num_writers, cmd);
+      return;
+    }
+
+    // maybe ingest the stream on stdin, one file or a tar archive
+    hashdb::ingest_options_t options;
+    options.skip_nonprobative = skip_nonprobative;
+    options.quiet = quiet;
+    if (ingest_path == "-") {
+      std::string error_message = hashdb::ingest_stream(
+                    hashdb_dirs, step_sizes, 0, "stdin", repository_name,
+                    whitelist_dir,
+                    disable_recursive_processing,
+                    disable_calculate_entropy,
+                    disable_calculate_labels,
+                    cmd, options);
+      if (error_message.size() != 0) {
+        std::cerr << "Error: " << error_message << "\n";
+        exit(1);
+      }
+      return;
+    }
+
     // ingest
-    std::string error_message = hashdb::ingest(
-                    hashdb_dir, ingest_path, step_size, repository_name,
+    options.skip_unchanged = skip_unchanged;
+    options.direct_reads = direct_reads;
+    options.checkpoint_file = checkpoint_file;
+    options.resume = resume;
+    std::string error_message = hashdb::ingest_multiple(
+                    hashdb_dirs, step_sizes, ingest_path, repository_name,
                     whitelist_dir,
                     disable_recursive_processing,
                     disable_calculate_entropy,
                     disable_calculate_labels,
-                    cmd);
+                    cmd, options);
     if (error_message.size() != 0) {
       std::cerr << "Error: " << error_message << "\n";
       exit(1);
@@ -234,6 +575,7 @@ class out_ptr_t {
 
     // resources
     hashdb::import_manager_t manager(hashdb_dir, cmd);
+    manager.set_bulk_load(HASH_BULK_RUN_SIZE);
     hashdb::scan_manager_t* whitelist_manager = NULL;
     if (whitelist_dir != "") {
       require_hashdb_dir(whitelist_dir);
@@ -241,10 +583,13 @@ class out_ptr_t {
     }
     progress_tracker_t progress_tracker(hashdb_dir, 0, cmd);
 
-    // open the tab file for reading
-    in_ptr_t in_ptr(tab_file);
-    ::import_tab(manager, repository_name, tab_file, whitelist_manager,
-                 progress_tracker, *in_ptr());
+    // map the tab file else open it for reading
+    if (tab_file == "-" || !::import_tab_mapped(manager, repository_name,
+                          tab_file, whitelist_manager, progress_tracker)) {
+      in_ptr_t in_ptr(tab_file);
+      ::import_tab(manager, repository_name, tab_file, whitelist_manager,
+                   progress_tracker, *in_ptr());
+    }
 
     // done
     if (whitelist_manager != NULL) {
@@ -255,6 +600,7 @@ class out_ptr_t {
   // import json
   static void import_json(const std::string& hashdb_dir,
                           const std::string& json_file,
+                          const size_t num_threads,
                           const std::string& cmd) {
 
     // validate hashdb_dir path
@@ -262,16 +608,44 @@ class out_ptr_t {
 
     // resources
     hashdb::import_manager_t manager(hashdb_dir, cmd);
+    manager.set_bulk_load(HASH_BULK_RUN_SIZE);
     progress_tracker_t progress_tracker(hashdb_dir, 0, cmd);
 
-    // open the JSON file for reading
-    in_ptr_t in_ptr(json_file);
-    ::import_json(manager, progress_tracker, *in_ptr());
+    // import the shards of a sharded export
+    std::vector<std::string> shard_files;
+    if (json_file != "-" && ::read_json_manifest(json_file, shard_files)) {
+      for (std::vector<std::string>::const_iterator it = shard_files.begin();
+           it != shard_files.end(); ++it) {
+        in_ptr_t in_ptr(*it);
+        ::import_json(manager, progress_tracker, *in_ptr(), num_threads);
+      }
+      return;
+    }
+
+    // open the JSON or binary export for reading
+    in_ptr_t in_ptr(json_file, true);
+
+    // import a binary export
+    if (in_ptr()->peek() == exchange_bin_magic[0]) {
+      hashdb::settings_t settings;
+      hashdb::read_settings(hashdb_dir, settings);
+      const std::string error_message = ::import_bin(manager, settings,
+                                          progress_tracker, *in_ptr());
+      if (error_message.size() != 0) {
+        std::cerr << "Error: " << error_message << "\n";
+        exit(1);
+      }
+      return;
+    }
+
+    ::import_json(manager, progress_tracker, *in_ptr(), num_threads);
   }
 
   // export json
   static void export_json(const std::string& hashdb_dir,
                           const std::string& json_file,
+                          const size_t num_shards,
+                          const size_t num_threads,
                           const std::string& cmd) {
 
     // validate hashdb_dir path
@@ -281,6 +655,20 @@ class out_ptr_t {
     hashdb::scan_manager_t manager(hashdb_dir);
     progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
+    // export into shard files named by a manifest at json_file
+    if (num_shards != 0) {
+      if (json_file == "-") {
+        std::cerr << "Error: a sharded export requires an output file.\n";
+        exit(1);
+      }
+      std::stringstream ss;
+      ss << "# command: '" << cmd << "'\n"
+         << "# hashdb-Version: " << PACKAGE_VERSION << "\n";
+      ::export_json_shards(manager, progress_tracker, json_file, ss.str(),
+                           num_shards, num_threads);
+      return;
+    }
+
     // open the JSON file for writing
     out_ptr_t out_ptr(json_file);
 
@@ -289,10 +677,168 @@ class out_ptr_t {
                << "# hashdb-Version: " << PACKAGE_VERSION << "\n";
 
     // export the hashdb
-    ::export_json_hashes(manager, progress_tracker, *out_ptr());
+    ::export_json_hashes(manager, progress_tracker, *out_ptr(), num_threads);
     ::export_json_sources(manager, *out_ptr());
   }
 
+  // export in the binary exchange format
+  static void export_bin(const std::string& hashdb_dir,
+                         const std::string& bin_file,
+                         const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // resources
+    hashdb::settings_t settings;
+    hashdb::read_settings(hashdb_dir, settings);
+    hashdb::scan_manager_t manager(hashdb_dir);
+    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
+
+    // export
+    out_ptr_t out_ptr(bin_file, true);
+    const std::string error_message = ::export_bin(manager, settings,
+                                          progress_tracker, *out_ptr());
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // export hash prefix partitions as sorted runs
+  static void export_runs(const std::string& hashdb_dir,
+                          const size_t num_partitions,
+                          const std::string& run_prefix,
+                          const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+    if (num_partitions == 0) {
+      std::cerr << "Error: the number of partitions must be given with -S.\n";
+      exit(1);
+    }
+
+    // resources
+    hashdb::settings_t settings;
+    hashdb::read_settings(hashdb_dir, settings);
+    hashdb::scan_manager_t manager(hashdb_dir);
+    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
+
+    // export
+    const std::string error_message = ::export_sorted_runs(manager,
+                     settings, run_prefix, num_partitions, progress_tracker);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // load sorted runs of one partition
+  static void load_runs(const std::string& hashdb_dir,
+                        const std::vector<std::string>& run_files,
+                        const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // resources
+    hashdb::settings_t settings;
+    hashdb::read_settings(hashdb_dir, settings);
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    manager.set_bulk_load(HASH_BULK_RUN_SIZE);
+    progress_tracker_t progress_tracker(hashdb_dir, 0, cmd);
+
+    // load
+    const std::string error_message = ::load_sorted_runs(manager, settings,
+                                            run_files, progress_tracker);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // ingest into a local hashdb then export it as sorted runs, one for
+  // each hash prefix partition, for the nodes that own the partitions
+  static void ingest_runs(const std::string& hashdb_dir,
+                          const std::string& ingest_path,
+                          const size_t step_size,
+                          const std::string& repository_name,
+                          const std::string& whitelist_dir,
+                          const bool disable_recursive_processing,
+                          const bool disable_calculate_entropy,
+                          const bool disable_calculate_labels,
+                          const bool skip_nonprobative,
+                          const bool direct_reads,
+                          const bool quiet,
+                          const size_t num_partitions,
+                          const std::string& run_prefix,
+                          const std::string& cmd) {
+
+    // ingest
+    hashdb::ingest_options_t options;
+    options.skip_nonprobative = skip_nonprobative;
+    options.direct_reads = direct_reads;
+    options.quiet = quiet;
+    std::string error_message = hashdb::ingest(
+                    hashdb_dir, ingest_path, step_size, repository_name,
+                    whitelist_dir,
+                    disable_recursive_processing,
+                    disable_calculate_entropy,
+                    disable_calculate_labels,
+                    cmd, options);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+
+    // export the partitions
+    export_runs(hashdb_dir, num_partitions, run_prefix, cmd);
+  }
+
+  // export changes
+  static void export_changes(const std::string& hashdb_dir,
+                             const std::string& changes_file) {
+
+    const std::string error_message =
+                      hashdb::export_changes(hashdb_dir, changes_file);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // export filter
+  static void export_filter(const std::string& hashdb_dir,
+                            const std::string& filter_file) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    const std::string error_message =
+                      hashdb::export_filter(hashdb_dir, filter_file);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+    std::cout << "Filter exported.\n";
+  }
+
+  // apply changes
+  static void apply_changes(const std::string& hashdb_dir,
+                            const std::string& changes_file,
+                            const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    const std::string error_message =
+                      hashdb::apply_changes(hashdb_dir, changes_file, cmd);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
   // export json range
   static void export_json_range(const std::string& hashdb_dir,
                                 const std::string& json_file,
@@ -331,6 +877,19 @@ class out_ptr_t {
     require_hashdb_dir(hashdb_dir);
     create_if_new(dest_dir, hashdb_dir, cmd);
 
+    // copy the stores directly into an empty destination
+    if (hashdb::can_clone_hashdb(hashdb_dir, dest_dir)) {
+      const std::string error_message =
+                        hashdb::clone_hashdb(hashdb_dir, dest_dir, cmd);
+      if (error_message.size() != 0) {
+        std::cerr << "Error: " << error_message << "\n";
+        exit(1);
+      }
+      std::cout << "# Cloned " << hashdb_dir << " into empty " << dest_dir
+                << "\n";
+      return;
+    }
+
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
     hashdb::import_manager_t manager_b(dest_dir, cmd);
@@ -339,21 +898,23 @@ class out_ptr_t {
     adder_t adder(&manager_a, &manager_b, &progress_tracker);
 
     // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
+    hashdb::hash_iterator_t hash_iterator(manager_a);
+    std::string binary_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    while (hash_iterator.next(binary_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
       // add the hash
-      adder.add(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+      adder.add(binary_hash, k_entropy, block_label, count,
+                source_sub_counts);
     }
   }
 
   // add_multiple
-  // Flow:
-  //   1) Create an ordered multimap of key=hash, value=producer_t
-  //      where key is the first key from a producer.
-  //   2) Consume elements from the ordered multimap and copy them
-  //      until the producers are depleted.  Do not enque when a producer
-  //      is depleted.  Done when the ordered multimap becomes empty.
+  // Merge join the source DBs and add each hash from each DB that has it,
+  // in DB order.
   static void add_multiple(const std::vector<std::string>& p_hashdb_dirs,
                            const std::string& cmd) {
 
@@ -372,73 +933,45 @@ class out_ptr_t {
 
     // open the consumer at dest_dir
     hashdb::import_manager_t consumer(dest_dir, cmd);
+    consumer.set_bulk_load(HASH_BULK_RUN_SIZE);
 
-    // calculate the total hash records for the tracker
+    // open the producers
+    std::vector<const hashdb::scan_manager_t*> producers;
     size_t total_hash_records = 0;
     for (std::vector<std::string>::const_iterator it = hashdb_dirs.begin();
                     it != hashdb_dirs.end(); ++it) {
-      hashdb::scan_manager_t scan_manager(*it);
-      total_hash_records += scan_manager.size_hashes();
+      hashdb::scan_manager_t* const producer = new hashdb::scan_manager_t(*it);
+      total_hash_records += producer->size_hashes();
+      producers.push_back(producer);
     }
 
     // start progress tracker
     progress_tracker_t progress_tracker(dest_dir, total_hash_records, cmd);
 
-    // define the ordered multimap of key=hash, value=producer_t
-    typedef std::pair<hashdb::scan_manager_t*, adder_t*> producer_t;
-    typedef std::pair<std::string, producer_t> ordered_producers_value_t;
-    typedef std::multimap<std::string, producer_t> ordered_producers_t;
-
-    // create the multimap of ordered producers
-    ordered_producers_t ordered_producers;
-
-    // open the producers
-    for (std::vector<std::string>::const_iterator it = hashdb_dirs.begin();
-                    it != hashdb_dirs.end(); ++it) {
-      std::string hashdb_dir = *it;
-      hashdb::scan_manager_t* producer = new hashdb::scan_manager_t(hashdb_dir);
-      std::string binary_hash = producer->first_hash();
-      if (binary_hash.size() != 0) {
-        // the producer is not empty, so enqueue it
-        // create the adder
-        adder_t* adder = new adder_t(producer, &consumer, &progress_tracker);
-        ordered_producers.insert(ordered_producers_value_t(binary_hash,
-                                      producer_t(producer, adder)));
-
-      // also track total hashes to be processed
-      total_hash_records += producer->size_hashes();
+    // an adder for each producer
+    std::vector<adder_t*> adders;
+    for (size_t i=0; i<producers.size(); ++i) {
+      adders.push_back(new adder_t(producers[i], &consumer,
+                                   &progress_tracker));
+    }
 
-      } else {
-        // no hashes for this producer so close it
-        delete producer;
+    // add hashes in order until all hashes are consumed
+    merge_join_t merge_join(producers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      for (size_t i=0; i<records.size(); ++i) {
+        if (records[i] != NULL) {
+          adders[i]->add(records[i]->block_hash, records[i]->k_entropy,
+                         records[i]->block_label, records[i]->count,
+                         records[i]->source_sub_counts);
+        }
       }
     }
 
-    // add ordered hashes from producers until all hashes are consumed
-    while (ordered_producers.size() != 0) {
-      // get the hash, producer, and adder for the first hash
-      ordered_producers_t::iterator it = ordered_producers.begin();
-      hashdb::scan_manager_t* producer = it->second.first;
-      adder_t* adder = it->second.second;
-
-      // add the hash to the consumer
-      adder->add(it->first);
-
-      // get the next hash from this producer
-      std::string binary_hash = producer->next_hash(it->first);
-
-      // remove this hash, producer_t entry
-      ordered_producers.erase(it);
-
-      if (binary_hash.size() != 0) {
-        // hash exists so add the hash, producer, and adder
-        ordered_producers.insert(ordered_producers_value_t(binary_hash,
-                                      producer_t(producer, adder)));
-      } else {
-        // no hashes for this producer so close it
-        delete producer;
-        delete adder;
-      }
+    // close the producers
+    for (size_t i=0; i<producers.size(); ++i) {
+      delete adders[i];
+      delete producers[i];
     }
   }
 
@@ -460,11 +993,17 @@ class out_ptr_t {
     adder_t adder(&manager_a, &manager_b, repository_name, &progress_tracker);
 
     // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
+    hashdb::hash_iterator_t hash_iterator(manager_a);
+    std::string binary_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    while (hash_iterator.next(binary_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
       // add the hash
-      adder.add_repository(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+      adder.add_repository(binary_hash, k_entropy, block_label, count,
+                           source_sub_counts);
     }
   }
 
@@ -482,16 +1021,38 @@ class out_ptr_t {
     // resources
     hashdb::scan_manager_t manager_a(hashdb_dir);
     hashdb::import_manager_t manager_b(dest_dir, cmd);
+
+    // read just the hashes in range when A keeps a count index, whose
+    // number of hash data records is not known ahead
+    std::vector<std::string> indexed_hashes;
+    const bool indexed = manager_a.find_hashes_by_count(m, n, indexed_hashes);
     progress_tracker_t progress_tracker(dest_dir,
-                                        manager_a.size_hashes(), cmd);
+                              indexed ? 0 : manager_a.size_hashes(), cmd);
     adder_t adder(&manager_a, &manager_b, &progress_tracker);
 
+    std::string binary_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    if (indexed) {
+      for (std::vector<std::string>::const_iterator it =
+           indexed_hashes.begin(); it != indexed_hashes.end(); ++it) {
+        manager_a.find_hash(*it, k_entropy, block_label, count,
+                            source_sub_counts);
+        adder.add_range(*it, k_entropy, block_label, count,
+                        source_sub_counts, m, n);
+      }
+      return;
+    }
+
     // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
+    hashdb::hash_iterator_t hash_iterator(manager_a);
+    while (hash_iterator.next(binary_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
       // add the hash
-      adder.add_range(binary_hash, m, n);
-      binary_hash = manager_a.next_hash(binary_hash);
+      adder.add_range(binary_hash, k_entropy, block_label, count,
+                      source_sub_counts, m, n);
     }
   }
 
@@ -510,15 +1071,28 @@ class out_ptr_t {
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
     hashdb::import_manager_t manager_c(dest_dir, cmd);
+    manager_c.set_bulk_load(HASH_BULK_RUN_SIZE);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
-    adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
-                                                           &progress_tracker);
-
-    // iterate A to intersect A and B into C
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      adder_set.intersect(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    adder_set_t adder_set(&manager_a, &manager_b, &manager_c);
+
+    // intersect A and B into C
+    // merge join A and B
+    std::vector<const hashdb::scan_manager_t*> managers;
+    managers.push_back(&manager_a);
+    managers.push_back(&manager_b);
+    merge_join_t merge_join(managers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      const merge_join_t::record_t* const a = records[0];
+      const merge_join_t::record_t* const b = records[1];
+      if (a != NULL) {
+        if (b != NULL) {
+          adder_set.intersect(a->block_hash, a->k_entropy, a->block_label,
+                              a->count, a->source_sub_counts,
+                              b->source_sub_counts);
+        }
+        progress_tracker.track_hash_data(a->source_sub_counts.size());
+      }
     }
   }
 
@@ -537,15 +1111,29 @@ class out_ptr_t {
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
     hashdb::import_manager_t manager_c(dest_dir, cmd);
+    manager_c.set_bulk_load(HASH_BULK_RUN_SIZE);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
-    adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
-                                                          & progress_tracker);
-
-    // iterate A to intersect_hash A and B into C
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      adder_set.intersect_hash(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    adder_set_t adder_set(&manager_a, &manager_b, &manager_c);
+
+    // intersect_hash A and B into C
+    // merge join A and B
+    std::vector<const hashdb::scan_manager_t*> managers;
+    managers.push_back(&manager_a);
+    managers.push_back(&manager_b);
+    merge_join_t merge_join(managers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      const merge_join_t::record_t* const a = records[0];
+      const merge_join_t::record_t* const b = records[1];
+      if (a != NULL) {
+        if (b != NULL) {
+          adder_set.intersect_hash(a->block_hash, a->k_entropy,
+                                   a->block_label, a->count,
+                                   a->source_sub_counts,
+                                   b->source_sub_counts);
+        }
+        progress_tracker.track_hash_data(a->source_sub_counts.size());
+      }
     }
   }
 
@@ -564,17 +1152,28 @@ class out_ptr_t {
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
     hashdb::import_manager_t manager_c(dest_dir, cmd);
+    manager_c.set_bulk_load(HASH_BULK_RUN_SIZE);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
-    adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
-                                                          &progress_tracker);
-
-    // iterate A to add A to C if A hash and source not in B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-
-      // add A to C if A hash and source not in B
-      adder_set.subtract(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    adder_set_t adder_set(&manager_a, &manager_b, &manager_c);
+
+    // add A to C if A hash and source not in B
+    const hashdb::source_sub_counts_t no_source_sub_counts;
+    // merge join A and B
+    std::vector<const hashdb::scan_manager_t*> managers;
+    managers.push_back(&manager_a);
+    managers.push_back(&manager_b);
+    merge_join_t merge_join(managers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      const merge_join_t::record_t* const a = records[0];
+      const merge_join_t::record_t* const b = records[1];
+      if (a != NULL) {
+        adder_set.subtract(a->block_hash, a->k_entropy, a->block_label,
+                           a->count, a->source_sub_counts,
+                           (b != NULL) ? b->source_sub_counts
+                                       : no_source_sub_counts);
+        progress_tracker.track_hash_data(a->source_sub_counts.size());
+      }
     }
   }
 
@@ -593,127 +1192,422 @@ class out_ptr_t {
     hashdb::scan_manager_t manager_a(hashdb_dir1);
     hashdb::scan_manager_t manager_b(hashdb_dir2);
     hashdb::import_manager_t manager_c(dest_dir, cmd);
+    manager_c.set_bulk_load(HASH_BULK_RUN_SIZE);
     progress_tracker_t progress_tracker(dest_dir, manager_a.size_hashes(), cmd);
-    adder_set_t adder_set(&manager_a, &manager_b, &manager_c,
-                                                          &progress_tracker);
+    adder_set_t adder_set(&manager_a, &manager_b, &manager_c);
+
+    // add A to C if A hash not in B
+    // merge join A and B
+    std::vector<const hashdb::scan_manager_t*> managers;
+    managers.push_back(&manager_a);
+    managers.push_back(&manager_b);
+    merge_join_t merge_join(managers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      const merge_join_t::record_t* const a = records[0];
+      const merge_join_t::record_t* const b = records[1];
+      if (a != NULL) {
+        if (b == NULL) {
+          adder_set.subtract_hash(a->block_hash, a->k_entropy,
+                                  a->block_label, a->count,
+                                  a->source_sub_counts);
+        }
+        progress_tracker.track_hash_data(a->source_sub_counts.size());
+      }
+    }
+  }
+
+  // subtract_repository
+  static void subtract_repository(const std::string& hashdb_dir,
+                                  const std::string& dest_dir,
+                                  const std::string& repository_name,
+                                  const std::string& cmd) {
+
+    // validate hashdb directories, maybe make dest_dir
+    require_hashdb_dir(hashdb_dir);
+    create_if_new(dest_dir, hashdb_dir, cmd);
+
+    // resources
+    hashdb::scan_manager_t manager_a(hashdb_dir);
+    hashdb::import_manager_t manager_b(dest_dir, cmd);
+    manager_b.set_bulk_load(HASH_BULK_RUN_SIZE);
+    progress_tracker_t progress_tracker(dest_dir,
+                                        manager_a.size_hashes(), cmd);
+    adder_t adder(&manager_a, &manager_b, repository_name, &progress_tracker);
+
+    // add data for binary_hash from A to B
+    std::vector<const hashdb::scan_manager_t*> managers;
+    managers.push_back(&manager_a);
+    merge_join_t merge_join(managers);
+    std::vector<const merge_join_t::record_t*> records;
+    while (merge_join.next(records)) {
+      // add the hash
+      adder.add_non_repository(records[0]->block_hash, records[0]->k_entropy,
+                               records[0]->block_label, records[0]->count,
+                               records[0]->source_sub_counts);
+    }
+  }
+
+  // remove_source
+  static void remove_source(const std::string& hashdb_dir,
+                            const std::string& hex_file_hash,
+                            const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // get the binary hash
+    const std::string file_hash = hashdb::hex_to_bin(hex_file_hash);
 
-    // iterate A to add A to C if A hash not in B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
+    // reject invalid input
+    if (file_hash == "") {
+      std::cerr << "Error: Invalid hash: '" << hex_file_hash << "'\n";
+      exit(1);
+    }
+
+    // remove the source
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    if (!manager.remove_source(file_hash)) {
+      std::cout << "Source not found for '" << hex_file_hash << "'\n";
+    }
+  }
 
-      // add A to C if A hash not in B
-      adder_set.subtract_hash(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+  // remove_hash
+  static void remove_hash(const std::string& hashdb_dir,
+                          const std::string& hex_block_hash,
+                          const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // get the binary hash
+    const std::string block_hash = hashdb::hex_to_bin(hex_block_hash);
+
+    // reject invalid input
+    if (block_hash == "") {
+      std::cerr << "Error: Invalid hash: '" << hex_block_hash << "'\n";
+      exit(1);
+    }
+
+    // remove the hash
+    hashdb::import_manager_t manager(hashdb_dir, cmd);
+    if (!manager.remove_hash(block_hash)) {
+      std::cout << "Hash not found for '" << hex_block_hash << "'\n";
+    }
+  }
+
+  // ************************************************************
+  // scan
+  // ************************************************************
+  // scan
+  static void scan_list(const std::string& hashdb_dir,
+                        const std::string& hashes_file,
+                        const hashdb::scan_mode_t scan_mode,
+                        const size_t num_threads,
+                        const size_t max_sources,
+                        const bool compact_common,
+                        const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // resources
+    hashdb::scan_manager_t manager(hashdb_dir);
+    manager.set_max_sources(scan_mode, max_sources);
+    manager.set_compact_common(compact_common);
+
+    // open the hashes list file for reading
+    in_ptr_t in_ptr(hashes_file);
+
+    // print header information
+    print_header(cmd);
+
+    // scan the list
+    ::scan_list(manager, *in_ptr(), scan_mode, num_threads);
+
+    // done
+    std::cout << "# scan_list completed.\n";
+  }
+
+  // scan_hash
+  static void scan_hash(const std::string& hashdb_dir,
+                        const std::string& hex_block_hash,
+                        const hashdb::scan_mode_t scan_mode,
+                        const size_t max_sources,
+                        const bool has_first_source,
+                        const size_t first_source,
+                        const bool compact_common,
+                        const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // get the binary hash
+    std::string binary_hash = hashdb::hex_to_bin(hex_block_hash);
+
+    // reject invalid input
+    if (binary_hash == "") {
+      std::cerr << "Error: Invalid hash: '" << hex_block_hash << "'\n";
+      exit(1);
+    }
+
+    // open DB
+    hashdb::scan_manager_t scan_manager(hashdb_dir);
+    scan_manager.set_max_sources(scan_mode, max_sources);
+    scan_manager.set_compact_common(compact_common);
+
+    // scan, or get a page of the sources
+    std::string expanded_text = (has_first_source) ?
+             scan_manager.find_hash_sources_json(binary_hash, first_source,
+                                                 max_sources) :
+             scan_manager.find_hash_json(scan_mode, binary_hash);
+
+    if (expanded_text.size() != 0) {
+      std::cout << expanded_text << std::endl;
+    } else {
+      std::cout << "Hash not found for '" << hex_block_hash << "'\n";
+    }
+  }
+
+  // true if all count bytes at p are zero
+  static bool is_zero(const uint8_t* const p, const size_t count) {
+    for (size_t i=0; i<count; ++i) {
+      if (p[i] != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // similar
+  static void similar(const std::string& hashdb_dir,
+                      const std::string& file_or_hex_hash,
+                      const size_t max_sources,
+                      const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // read settings for the block size and hash algorithm
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+
+    // open DB
+    hashdb::scan_manager_t scan_manager(hashdb_dir);
+    if (!scan_manager.has_similarity_index()) {
+      std::cerr << "Error: Database '" << hashdb_dir
+                << "' has no similarity index.\n";
+      exit(1);
+    }
+
+    std::ifstream in(file_or_hex_hash.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      // compare to a source in the database
+      const std::string file_hash = hashdb::hex_to_bin(file_or_hex_hash);
+      if (file_hash == "") {
+        std::cerr << "Error: Invalid file or file hash: '"
+                  << file_or_hex_hash << "'\n";
+        exit(1);
+      }
+      std::cout << scan_manager.find_similar_to_source_json(file_hash,
+                                                 max_sources) << std::endl;
+      return;
+    }
+
+    // hash the blocks of the file as ingest does, or its content-defined
+    // chunks, skipping zero blocks
+    hasher::hash_calculator_t calculator(settings.block_hash_algorithm);
+    std::vector<std::string> block_hashes;
+    if (settings.max_chunk_size != 0) {
+      const std::vector<uint8_t> content(
+                  (std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+      const hasher::chunker_t chunker(settings.min_chunk_size,
+                                      settings.block_size,
+                                      settings.max_chunk_size);
+      hasher::chunks_t chunks;
+      chunker.find_chunks(content.data(), content.size(), content.size(),
+                          false, chunks);
+      for (size_t j=0; j<chunks.size(); ++j) {
+        if (!is_zero(content.data() + chunks[j].first, chunks[j].second)) {
+          block_hashes.push_back(calculator.calculate(content.data(),
+                       content.size(), chunks[j].first, chunks[j].second));
+        }
+      }
+    } else {
+      std::vector<uint8_t> buffer(settings.block_size);
+      while (in) {
+        in.read(reinterpret_cast<char*>(&buffer[0]), buffer.size());
+        const size_t count = static_cast<size_t>(in.gcount());
+        if (count == 0) {
+          break;
+        }
+        if (!is_zero(&buffer[0], count)) {
+          block_hashes.push_back(calculator.calculate(&buffer[0], count, 0,
+                                                      buffer.size()));
+        }
+      }
+    }
+    std::cout << scan_manager.find_similar_sources_json(block_hashes,
+                                                 max_sources) << std::endl;
+  }
+
+  // scan_media
+  static void scan_media(const std::vector<std::string>& hashdb_dirs,
+                         const std::string& media_image_filename,
+                         const size_t step_size,
+                         const bool disable_recursive_processing,
+                         const hashdb::scan_mode_t scan_mode,
+                         const uint64_t min_k_entropy,
+                         const bool skip_labeled,
+                         const bool summarize,
+                         const double sample_fraction,
+                         const bool scan_around_hits,
+                         const bool direct_reads,
+                         const bool quiet,
+                         const std::string& checkpoint_file,
+                         const bool resume,
+                         const std::string& cmd) {
+
+    // print header information
+    print_header(cmd);
+
+    // scan all of the media or a sample of it
+    hashdb::scan_media_options_t options;
+    options.min_k_entropy = min_k_entropy;
+    options.skip_labeled = skip_labeled;
+    options.direct_reads = direct_reads;
+    options.quiet = quiet;
+    std::string error_message;
+    if (sample_fraction > 0.0) {
+      error_message = hashdb::scan_media_sample(hashdb_dirs[0],
+                             media_image_filename, step_size,
+                             disable_recursive_processing, scan_mode,
+                             sample_fraction, scan_around_hits, options);
+    } else {
+      options.summarize = summarize;
+      options.checkpoint_file = checkpoint_file;
+      options.resume = resume;
+      error_message = hashdb::scan_media_multiple(hashdb_dirs,
+                             media_image_filename, step_size,
+                             disable_recursive_processing, scan_mode,
+                             options);
+    }
+    if (error_message.size() == 0) {
+      std::cout << "# scan_media completed.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
     }
   }
 
-  // subtract_repository
-  static void subtract_repository(const std::string& hashdb_dir,
-                                  const std::string& dest_dir,
-                                  const std::string& repository_name,
-                                  const std::string& cmd) {
-
-    // validate hashdb directories, maybe make dest_dir
-    require_hashdb_dir(hashdb_dir);
-    create_if_new(dest_dir, hashdb_dir, cmd);
+  // scan_media_list
+  static void scan_media_list(const std::vector<std::string>& hashdb_dirs,
+                              const std::string& media_list_filename,
+                              const size_t step_size,
+                              const bool disable_recursive_processing,
+                              const hashdb::scan_mode_t scan_mode,
+                              const uint64_t min_k_entropy,
+                              const bool skip_labeled,
+                              const bool summarize,
+                              const bool direct_reads,
+                              const bool quiet,
+                              const size_t queue_depth,
+                              const std::string& cmd) {
 
-    // resources
-    hashdb::scan_manager_t manager_a(hashdb_dir);
-    hashdb::import_manager_t manager_b(dest_dir, cmd);
-    progress_tracker_t progress_tracker(dest_dir,
-                                        manager_a.size_hashes(), cmd);
-    adder_t adder(&manager_a, &manager_b, repository_name, &progress_tracker);
+    // print header information
+    print_header(cmd);
 
-    // add data for binary_hash from A to B
-    std::string binary_hash = manager_a.first_hash();
-    while (binary_hash.size() != 0) {
-      // add the hash
-      adder.add_non_repository(binary_hash);
-      binary_hash = manager_a.next_hash(binary_hash);
+    // scan the media images, in parallel across devices
+    hashdb::scan_media_options_t options;
+    options.min_k_entropy = min_k_entropy;
+    options.skip_labeled = skip_labeled;
+    options.summarize = summarize;
+    options.direct_reads = direct_reads;
+    options.quiet = quiet;
+    std::string error_message = hashdb::scan_media_list(hashdb_dirs,
+                             media_list_filename, step_size,
+                             disable_recursive_processing, scan_mode,
+                             queue_depth, options);
+    if (error_message.size() == 0) {
+      std::cout << "# scan_media_list completed.\n";
+    } else {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
     }
   }
 
-  // ************************************************************
-  // scan
-  // ************************************************************
-  // scan
-  static void scan_list(const std::string& hashdb_dir,
-                        const std::string& hashes_file,
-                        const hashdb::scan_mode_t scan_mode,
-                        const std::string& cmd) {
+  // server
+  static void server(const std::string& hashdb_dir,
+                     const std::string& address,
+                     const hashdb::scan_mode_t scan_mode,
+                     const size_t num_threads,
+                     const bool warm,
+                     const bool lock_hash_store,
+                     const uint32_t max_staleness_ms,
+                     const std::string& cmd) {
 
     // validate hashdb_dir path
     require_hashdb_dir(hashdb_dir);
 
-    // resources
-    hashdb::scan_manager_t manager(hashdb_dir);
-
-    // open the hashes list file for reading
-    in_ptr_t in_ptr(hashes_file);
-
     // print header information
     print_header(cmd);
 
-    // scan the list
-    ::scan_list(manager, *in_ptr(), scan_mode);
-
-    // done
-    std::cout << "# scan_list completed.\n";
+    // serve until interrupted
+    ::scan_server(hashdb_dir, address, scan_mode, num_threads, warm,
+                  lock_hash_store, max_staleness_ms);
   }
 
-  // scan_hash
-  static void scan_hash(const std::string& hashdb_dir,
-                        const std::string& hex_block_hash,
-                        const hashdb::scan_mode_t scan_mode,
-                        const std::string& cmd) {
+  // warm
+  static void warm(const std::string& hashdb_dir,
+                   const size_t num_threads,
+                   const std::string& cmd) {
 
     // validate hashdb_dir path
     require_hashdb_dir(hashdb_dir);
 
-    // get the binary hash
-    std::string binary_hash = hashdb::hex_to_bin(hex_block_hash);
+    // print header information
+    print_header(cmd);
 
-    // reject invalid input
-    if (binary_hash == "") {
-      std::cerr << "Error: Invalid hash: '" << hex_block_hash << "'\n";
-      exit(1);
-    }
+    // read the stores into the page cache
+    hashdb::timestamp_t timestamp;
+    hashdb::scan_manager_t manager(hashdb_dir);
+    const uint64_t bytes = manager.warm(num_threads);
+    std::cout << "# warm read " << bytes << " bytes\n"
+              << "# " << timestamp.stamp("warm") << "\n";
+  }
 
-    // open DB
-    hashdb::scan_manager_t scan_manager(hashdb_dir);
+  // pin_common
+  static void pin_common(const std::string& hashdb_dir,
+                         const std::string& min_count_string,
+                         const size_t max_pinned,
+                         const std::string& cmd) {
 
-    // scan
-    std::string expanded_text = scan_manager.find_hash_json(
-                                                  scan_mode, binary_hash);
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
 
-    if (expanded_text.size() != 0) {
-      std::cout << expanded_text << std::endl;
-    } else {
-      std::cout << "Hash not found for '" << hex_block_hash << "'\n";
+    // read the minimum count
+    const size_t min_count = std::atoi(min_count_string.c_str());
+    if (min_count == 0) {
+      std::cerr << "Invalid minimum count: '" << min_count_string << "'\n";
+      exit(1);
     }
-  }
-
-  // scan_media
-  static void scan_media(const std::string& hashdb_dir,
-                         const std::string& media_image_filename,
-                         const size_t step_size,
-                         const bool disable_recursive_processing,
-                         const hashdb::scan_mode_t scan_mode,
-                         const std::string& cmd) {
 
     // print header information
     print_header(cmd);
 
-    // scan
-    std::string error_message = hashdb::scan_media(hashdb_dir,
-                             media_image_filename, step_size,
-                             disable_recursive_processing, scan_mode);
-    if (error_message.size() == 0) {
-      std::cout << "# scan_media completed.\n";
-    } else {
+    uint64_t num_pinned;
+    const std::string error_message = hashdb::pin_common_blocks(
+                           hashdb_dir, min_count, max_pinned, num_pinned);
+    if (error_message.size() != 0) {
       std::cerr << "Error: " << error_message << "\n";
       exit(1);
     }
+    std::cout << "# pinned " << num_pinned << " common blocks\n";
   }
 
   // ************************************************************
@@ -732,6 +1626,41 @@ class out_ptr_t {
     std::cout << manager.size() << std::endl;
   }
 
+  // estimate
+  static void estimate(const std::string& hashdb_dir1,
+                       const std::string& hashdb_dir2,
+                       const std::string& cmd) {
+
+    // validate hashdb_dir paths
+    require_hashdb_dir(hashdb_dir1);
+    if (hashdb_dir2 != "") {
+      require_hashdb_dir(hashdb_dir2);
+    }
+
+    uint64_t count1;
+    uint64_t count2;
+    uint64_t union_count;
+    uint64_t intersection_count;
+    const std::string error_message = hashdb::estimate_hashes(
+                    hashdb_dir1, hashdb_dir2, count1, count2, union_count,
+                    intersection_count);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+
+    if (hashdb_dir2 == "") {
+      std::cout << "{\"hashes\":" << count1 << "}" << std::endl;
+      return;
+    }
+    std::cout << "{\"hashes_1\":" << count1
+              << ",\"hashes_2\":" << count2
+              << ",\"union\":" << union_count
+              << ",\"intersect\":" << intersection_count
+              << ",\"subtract\":" << (count1 - intersection_count)
+              << "}" << std::endl;
+  }
+
   // sources
   static void sources(const std::string& hashdb_dir,
                       const std::string& cmd) {
@@ -746,85 +1675,74 @@ class out_ptr_t {
     ::export_json_sources(manager, std::cout);
   }
 
-  // histogram
-  static void histogram(const std::string& hashdb_dir,
-                        const std::string& cmd) {
-
-    // validate hashdb_dir path
-    require_hashdb_dir(hashdb_dir);
-
-    // open DB
-    hashdb::scan_manager_t manager(hashdb_dir);
-
-    // print header information
-    print_header(cmd);
-
-    // start progress tracker
-    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
-
-    // total number of hashes in the database
-    uint64_t total_hashes = 0;
+  // the partial histogram of one range of a parallel scan
+  struct histogram_range_t {
+    // total number of hashes in the range
+    uint64_t total_hashes;
 
     // total number of distinct hashes
-    uint64_t total_distinct_hashes = 0;
+    uint64_t total_distinct_hashes;
 
     // hash histogram as <count, number of hashes with count>
     std::map<uint32_t, uint64_t> hash_histogram;
 
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
-
-    // iterate over hashdb and set variables for calculating the histogram
-    std::string binary_hash = manager.first_hash();
-
-    // note if the DB is empty
-    if (binary_hash.size() == 0) {
-      std::cout << "The map is empty.\n";
+    histogram_range_t() : total_hashes(0), total_distinct_hashes(0),
+                          hash_histogram() {
     }
+  };
 
-    while (binary_hash.size() != 0) {
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                        source_sub_counts);
-      // update total hashes observed
-      total_hashes += count;
-      // update total distinct hashes
-      if (count == 1) {
-        ++total_distinct_hashes;
-      }
+  struct histogram_scan_t {
+    progress_tracker_t* const progress_tracker;
+    std::vector<histogram_range_t> ranges;
 
-      // update hash_histogram information
-      // look for existing entry
-      std::map<uint32_t, uint64_t>::iterator hash_histogram_it =
-                                              hash_histogram.find(count);
-      if (hash_histogram_it == hash_histogram.end()) {
+    histogram_scan_t(progress_tracker_t* const p_progress_tracker,
+                     const size_t num_ranges) :
+                  progress_tracker(p_progress_tracker),
+                  ranges(num_ranges) {
+    }
 
-        // this is the first hash found with this count value
-        // so start a new element for it
-        hash_histogram.insert(std::pair<uint32_t, uint64_t>(count, 1));
+    private:
+    // do not allow copy or assignment
+    histogram_scan_t(const histogram_scan_t&);
+    histogram_scan_t& operator=(const histogram_scan_t&);
+  };
+
+  static void histogram_hash(void* const data,
+                             const size_t range,
+                             const std::string& binary_hash,
+                             const uint64_t k_entropy,
+                             const std::string& block_label,
+                             const uint64_t count,
+                        const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    histogram_scan_t* const scan = static_cast<histogram_scan_t*>(data);
+    histogram_range_t& partial = scan->ranges[range];
+
+    // update total hashes observed
+    partial.total_hashes += count;
+    // update total distinct hashes
+    if (count == 1) {
+      ++partial.total_distinct_hashes;
+    }
 
-      } else {
+    // update hash_histogram information
+    ++partial.hash_histogram[count];
 
-        // increment existing value for number of hashes with this count
-        uint64_t old_number = hash_histogram_it->second;
-        hash_histogram.erase(count);
-        hash_histogram.insert(std::pair<uint32_t, uint64_t>(
-                                           count, old_number + 1));
-      }
+    // move forward
+    scan->progress_tracker->track_hash_data(source_sub_counts.size());
+  }
 
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
-    }
+  // print the totals and the hash histogram
+  static void print_histogram(const uint64_t total_hashes,
+                              const uint64_t total_distinct_hashes,
+                   const std::map<uint64_t, uint64_t>& hash_histogram) {
 
     // show totals
     std::cout << "{\"total_hashes\": " << total_hashes << ", "
               << "\"total_distinct_hashes\": " << total_distinct_hashes << "}\n";
 
     // show hash histogram as <count, number of hashes with count>
-    std::map<uint32_t, uint64_t>::iterator hash_histogram_it2;
+    std::map<uint64_t, uint64_t>::const_iterator hash_histogram_it2;
     for (hash_histogram_it2 = hash_histogram.begin();
          hash_histogram_it2 != hash_histogram.end(); ++hash_histogram_it2) {
       std::cout << "{\"duplicates\":" << hash_histogram_it2->first
@@ -834,10 +1752,122 @@ class out_ptr_t {
     }
   }
 
+  // histogram
+  static void histogram(const std::string& hashdb_dir,
+                        const bool recompute,
+                        const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // open DB
+    hashdb::scan_manager_t manager(hashdb_dir);
+
+    // print header information
+    print_header(cmd);
+
+    // note if the DB is empty
+    if (manager.size_hashes() == 0) {
+      std::cout << "The map is empty.\n";
+    }
+
+    uint64_t total_hashes = 0;
+    uint64_t total_distinct_hashes = 0;
+    std::map<uint64_t, uint64_t> hash_histogram;
+
+    // use the maintained histogram unless asked to recompute it
+    if (!recompute) {
+      manager.hash_histogram(total_hashes, total_distinct_hashes,
+                             hash_histogram);
+      print_histogram(total_hashes, total_distinct_hashes, hash_histogram);
+      return;
+    }
+
+    // start progress tracker
+    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
+
+    // calculate partial histograms over ranges of the hashdb in parallel
+    histogram_scan_t scan(&progress_tracker, hashdb::num_cpus());
+    manager.scan_ranges(scan.ranges.size(), histogram_hash, &scan);
+
+    // merge the partial histograms
+    for (std::vector<histogram_range_t>::const_iterator it =
+         scan.ranges.begin(); it != scan.ranges.end(); ++it) {
+      total_hashes += it->total_hashes;
+      total_distinct_hashes += it->total_distinct_hashes;
+      for (std::map<uint32_t, uint64_t>::const_iterator it2 =
+           it->hash_histogram.begin(); it2 != it->hash_histogram.end();
+           ++it2) {
+        hash_histogram[it2->first] += it2->second;
+      }
+    }
+    print_histogram(total_hashes, total_distinct_hashes, hash_histogram);
+  }
+
+  // the hashes of a parallel scan that match, by range, and the criteria
+  struct matching_hashes_scan_t {
+    progress_tracker_t* const progress_tracker;
+    std::vector<std::vector<std::string> > ranges;
+    const uint64_t count;
+    const std::string file_binary_hash;
+
+    matching_hashes_scan_t(progress_tracker_t* const p_progress_tracker,
+                           const size_t num_ranges,
+                           const uint64_t p_count,
+                           const std::string& p_file_binary_hash) :
+                  progress_tracker(p_progress_tracker),
+                  ranges(num_ranges),
+                  count(p_count),
+                  file_binary_hash(p_file_binary_hash) {
+    }
+
+    private:
+    // do not allow copy or assignment
+    matching_hashes_scan_t(const matching_hashes_scan_t&);
+    matching_hashes_scan_t& operator=(const matching_hashes_scan_t&);
+  };
+
+  // print the matching hashes in key order
+  static void print_matching_hashes(hashdb::scan_manager_t& manager,
+                                    const matching_hashes_scan_t& scan,
+                                    const hashdb::scan_mode_t scan_mode) {
+
+    // expand each hash in order since expanded scans report sources once
+    for (std::vector<std::vector<std::string> >::const_iterator it =
+         scan.ranges.begin(); it != scan.ranges.end(); ++it) {
+      for (std::vector<std::string>::const_iterator it2 = it->begin();
+           it2 != it->end(); ++it2) {
+        std::string expanded_text = manager.find_hash_json(scan_mode, *it2);
+        std::cout << hashdb::bin_to_hex(*it2) << "\t" << expanded_text
+                  << "\n";
+      }
+    }
+  }
+
+  // match hashes with the requested duplicates number
+  static void duplicates_hash(void* const data,
+                              const size_t range,
+                              const std::string& binary_hash,
+                              const uint64_t k_entropy,
+                              const std::string& block_label,
+                              const uint64_t count,
+                        const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    matching_hashes_scan_t* const scan =
+                               static_cast<matching_hashes_scan_t*>(data);
+    if (count == scan->count) {
+      scan->ranges[range].push_back(binary_hash);
+    }
+
+    // move forward
+    scan->progress_tracker->track_hash_data(source_sub_counts.size());
+  }
+
   // duplicates
   static void duplicates(const std::string& hashdb_dir,
                          const std::string& number_string,
                          const hashdb::scan_mode_t scan_mode,
+                         const bool recompute,
                          const std::string& cmd) {
 
     // validate hashdb_dir path
@@ -858,44 +1888,80 @@ class out_ptr_t {
     // print header information
     print_header(cmd);
 
-    // start progress tracker
-    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
-
-    bool any_found = false;
+    // skip the walk if the maintained histogram has no hash with this count
+    if (!recompute) {
+      uint64_t total_hashes;
+      uint64_t total_distinct_hashes;
+      std::map<uint64_t, uint64_t> hash_histogram;
+      manager.hash_histogram(total_hashes, total_distinct_hashes,
+                             hash_histogram);
+      if (hash_histogram.find(number) == hash_histogram.end()) {
+        std::cout << "No hashes were found with this count.\n";
+        return;
+      }
 
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
+      // read just the hashes with this count when there is a count index
+      matching_hashes_scan_t indexed_scan(NULL, 1, number, "");
+      if (manager.find_hashes_by_count(number, number,
+                                       indexed_scan.ranges[0])) {
+        print_matching_hashes(manager, indexed_scan, scan_mode);
+        if (indexed_scan.ranges[0].size() == 0) {
+          std::cout << "No hashes were found with this count.\n";
+        }
+        return;
+      }
+    }
 
-    // iterate over hashdb and set variables for finding duplicates
-    std::string binary_hash = manager.first_hash();
+    // start progress tracker
+    progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
-    while (binary_hash.size() != 0) {
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                                  source_sub_counts);
-      if (count == number) {
-        // show hash with requested duplicates number
-        std::string expanded_text = manager.find_hash_json(
-                                                    scan_mode, binary_hash);
-        std::cout << hashdb::bin_to_hex(binary_hash) << "\t"
-                  << expanded_text << "\n";
-        any_found = true;
-      }
+    // find duplicates over ranges of the hashdb in parallel
+    matching_hashes_scan_t scan(&progress_tracker, hashdb::num_cpus(),
+                                number, "");
+    manager.scan_ranges(scan.ranges.size(), duplicates_hash, &scan);
 
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
-    }
+    // show hashes with requested duplicates number
+    print_matching_hashes(manager, scan, scan_mode);
 
     // say so if nothing was found
+    bool any_found = false;
+    for (size_t i=0; i<scan.ranges.size(); ++i) {
+      any_found = any_found || (scan.ranges[i].size() != 0);
+    }
     if (!any_found) {
       std::cout << "No hashes were found with this count.\n";
       return;
     }
   }
 
+  // match hashes that belong to the requested source
+  static void hash_table_hash(void* const data,
+                              const size_t range,
+                              const std::string& binary_hash,
+                              const uint64_t k_entropy,
+                              const std::string& block_label,
+                              const uint64_t count,
+                        const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    matching_hashes_scan_t* const scan =
+                               static_cast<matching_hashes_scan_t*>(data);
+
+    // find sources that match the source we are looking for
+    for (hashdb::source_sub_counts_t::const_iterator it =
+                     source_sub_counts.begin();
+                     it!= source_sub_counts.end(); ++it) {
+      if (it->file_hash == scan->file_binary_hash) {
+
+        // the source matches so keep the hash and move on
+        scan->ranges[range].push_back(binary_hash);
+        break;
+      }
+    }
+
+    // move forward
+    scan->progress_tracker->track_hash_data(source_sub_counts.size());
+  }
+
   // hash_table
   static void hash_table(const std::string& hashdb_dir,
                          const std::string& hex_file_hash,
@@ -927,43 +1993,28 @@ class out_ptr_t {
     // print header information
     print_header(cmd);
 
+    // read the hashes of this source from the reverse index if there is one
+    if (manager.has_source_hash_index()) {
+      matching_hashes_scan_t scan(NULL, 1, 0, file_binary_hash);
+      manager.find_source_hashes(file_binary_hash, scan.ranges[0]);
+      progress_tracker_t progress_tracker(hashdb_dir, scan.ranges[0].size(),
+                                          cmd);
+      progress_tracker.track_count(scan.ranges[0].size());
+      print_matching_hashes(manager, scan, scan_mode);
+      return;
+    }
+
     // start progress tracker
     progress_tracker_t progress_tracker(hashdb_dir, manager.size_hashes(), cmd);
 
-    // space for variables
-    uint64_t k_entropy;
-    std::string block_label;
-    uint64_t count;
-    hashdb::source_sub_counts_t source_sub_counts;
-
-    // look for hashes that belong to this source
-    // get the first hash
-    std::string binary_hash = manager.first_hash();
-    while (binary_hash.size() != 0) {
-
-      // read hash data for the hash
-      manager.find_hash(binary_hash, k_entropy, block_label, count,
-                                                    source_sub_counts);
-
-      // find sources that match the source we are looking for
-      for (hashdb::source_sub_counts_t::const_iterator it =
-                       source_sub_counts.begin();
-                       it!= source_sub_counts.end(); ++it) {
-        if (it->file_hash == file_binary_hash) {
-
-          // the source matches so print the hash and move on
-          std::string expanded_text = manager.find_hash_json(
-                                                    scan_mode, binary_hash);
-          std::cout << hashdb::bin_to_hex(binary_hash) << "\t" << expanded_text
-                    << "\n";
-          break;
-        }
-      }
+    // look for hashes that belong to this source over ranges of the
+    // hashdb in parallel
+    matching_hashes_scan_t scan(&progress_tracker, hashdb::num_cpus(),
+                                0, file_binary_hash);
+    manager.scan_ranges(scan.ranges.size(), hash_table_hash, &scan);
 
-      // move forward
-      progress_tracker.track_hash_data(source_sub_counts.size());
-      binary_hash = manager.next_hash(binary_hash);
-    }
+    // show the hashes that belong to this source
+    print_matching_hashes(manager, scan, scan_mode);
   }
 
   // read_media
@@ -989,6 +2040,51 @@ class out_ptr_t {
     }
   }
 
+  // read_media_list
+  static void read_media_list(const std::string& media_image_filename,
+                              const std::string& media_offsets_filename,
+                              const std::string& count_string) {
+
+    // convert count string to number
+    const uint64_t count = s_to_uint64(count_string);
+
+    // read the media offsets, one per line
+    in_ptr_t in_ptr(media_offsets_filename);
+    std::vector<std::string> media_offsets;
+    std::string line;
+    while (getline(*in_ptr(), line)) {
+      if (line.size() == 0 || line[0] == '#') {
+        continue;
+      }
+      media_offsets.push_back(line);
+    }
+
+    // read the bytes
+    hashdb::media_reader_t media_reader(media_image_filename);
+    if (media_reader.error_message().size() != 0) {
+      std::cerr << "Error: " << media_reader.error_message() << "\n";
+      exit(1);
+    }
+    std::vector<std::string> bytes;
+    const std::string error_message =
+                      media_reader.read(media_offsets, count, bytes);
+
+    // print each media offset and its bytes in hex
+    for (size_t i = 0; i < media_offsets.size(); ++i) {
+      std::cout << media_offsets[i] << "\t" << hashdb::bin_to_hex(bytes[i])
+                << "\n";
+    }
+    std::cout << "# Member cache hits: " << media_reader.cache_hits()
+              << "\n"
+              << "# Member cache misses: " << media_reader.cache_misses()
+              << "\n";
+
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
   // read_media_size
   static void read_media_size(const std::string& media_image_filename) {
 
@@ -1191,6 +2287,70 @@ class out_ptr_t {
     }
   }
 
+  // benchmark
+  static void benchmark(const std::string& hashdb_dir,
+                        const hashdb::settings_t& settings,
+                        const std::string& count_string,
+                        const hashdb::scan_mode_t scan_mode,
+                        const size_t num_threads,
+                        const double hit_rate,
+                        const double zipf_exponent,
+                        const std::string& duplicates_histogram,
+                        const std::string& cmd) {
+
+    // convert count string to number
+    const uint64_t count = s_to_uint64(count_string);
+    if (count == 0) {
+      std::cerr << "Error: The benchmark count must be greater than 0.\n";
+      exit(1);
+    }
+
+    print_header(cmd);
+    ::benchmark(hashdb_dir, settings, count, scan_mode,
+                (num_threads == 0) ? hashdb::num_cpus() : num_threads,
+                hit_rate, zipf_exponent, duplicates_histogram, cmd);
+  }
+
+  // benchmark_scan_stream
+  static void benchmark_scan_stream(const std::string& hashdb_dir,
+                                    const hashdb::scan_mode_t scan_mode,
+                                    const size_t num_threads,
+                                    const double hit_rate,
+                                    const std::string& producers_string,
+                                    const std::string& batch_size_string,
+                                    const std::string& batches_string,
+                                    const std::string& cmd) {
+
+    // validate hashdb_dir path
+    require_hashdb_dir(hashdb_dir);
+
+    // convert the counts to numbers
+    const uint64_t producers = s_to_uint64(producers_string);
+    const uint64_t batch_size = s_to_uint64(batch_size_string);
+    const uint64_t batches = s_to_uint64(batches_string);
+    if (producers == 0 || batch_size == 0 || batches == 0) {
+      std::cerr << "Error: The producers, batch size, and batches must be "
+                << "greater than 0.\n";
+      exit(1);
+    }
+
+    print_header(cmd);
+    ::benchmark_scan_stream(hashdb_dir, scan_mode, num_threads, hit_rate,
+                            producers, batch_size, batches);
+  }
+
+  // benchmark_read
+  static void benchmark_read(const std::string& media_image,
+                             const size_t num_threads,
+                             const size_t queue_depth,
+                             const std::string& cmd) {
+
+    print_header(cmd);
+    ::benchmark_read(media_image,
+                     (num_threads == 0) ? hashdb::num_cpus() : num_threads,
+                     (queue_depth == 0) ? 8 : queue_depth);
+  }
+
   // test_scan_stream
   static void test_scan_stream(const std::string& hashdb_dir,
                                const std::string& count_string,
@@ -1237,9 +2397,9 @@ class out_ptr_t {
       }
     }
 
-    // get data until processing is done
+    // get data until processing is done, waiting instead of polling
     while (!scan_stream.empty()) {
-      const std::string scanned = scan_stream.get();
+      const std::string scanned = scan_stream.get(1000);
       if (scanned.size() > 0) {
         progress_tracker.track_count(list_size);
       }
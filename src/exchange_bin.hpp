@@ -0,0 +1,586 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Export and import the binary exchange format, which carries the same
+ * sources and hashes as a JSON export in a fraction of the space.
+ *
+ * A binary export starts with a magic string and the block size and
+ * block hash algorithm of its hashes.  Frames follow, each the raw
+ * size, the compressed size, and the CRC-32 of the raw bytes, followed
+ * by the raw bytes compressed using zlib.  Frames hold whole records.
+ * The source table comes first, each source numbered in the order it is
+ * written, then hash records in block hash order.  Each hash record
+ * gives its block hash as the number of leading bytes it shares with the
+ * previous hash of its frame followed by the rest of its bytes, and
+ * each of its sources as a source number and sub_count.  A source that
+ * hashes reference but that has no source data is numbered by a file
+ * hash record when first referenced.  An end record with the number of
+ * sources and hashes ends the export.  Numbers are LEB128 varints and
+ * strings are a varint size followed by the bytes.
+ */
+
+#ifndef EXCHANGE_BIN_HPP
+#define EXCHANGE_BIN_HPP
+
+#include "../src_libhashdb/hashdb.hpp"
+#include "progress_tracker.hpp"
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <iostream>
+#include <stdint.h>
+#include <zlib.h>
+
+static const char exchange_bin_magic[] = "hdbbin1\n";
+static const size_t exchange_bin_magic_size = 8;
+
+// frames are compressed once their records reach this size
+static const size_t exchange_bin_frame_size = 1048576;
+
+// larger frames are taken as corruption
+static const uint64_t exchange_bin_max_frame_size = 67108864;
+
+// imported sources are inserted in batches of up to this many
+static const size_t exchange_bin_source_batch_size = 16384;
+
+// record types in a frame
+static const uint64_t EXCHANGE_BIN_END = 0;
+static const uint64_t EXCHANGE_BIN_SOURCE = 1;
+static const uint64_t EXCHANGE_BIN_FILE_HASH = 2;
+static const uint64_t EXCHANGE_BIN_HASH = 3;
+
+inline void exchange_bin_put_uint64(std::string& s, uint64_t value) {
+  while (value >= 0x80) {
+    s.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  s.push_back(static_cast<char>(value));
+}
+
+inline void exchange_bin_put_string(std::string& s, const std::string& v) {
+  exchange_bin_put_uint64(s, v.size());
+  s.append(v);
+}
+
+class exchange_bin_writer_t {
+  private:
+  std::ostream& out;
+  std::string frame;            // the records of the frame being filled
+  std::string compressed;
+  std::string previous_hash;    // of the frame, for prefix coding
+  std::map<std::string, uint64_t> source_numbers;
+  uint64_t num_hashes;
+
+  // do not allow copy or assignment
+  exchange_bin_writer_t(const exchange_bin_writer_t&);
+  exchange_bin_writer_t& operator=(const exchange_bin_writer_t&);
+
+  void write_frame() {
+    if (frame.size() == 0) {
+      return;
+    }
+    uLongf compressed_size = compressBound(frame.size());
+    compressed.resize(compressed_size);
+    if (compress2(reinterpret_cast<Bytef*>(&compressed[0]),
+                  &compressed_size,
+                  reinterpret_cast<const Bytef*>(frame.data()),
+                  frame.size(), Z_BEST_SPEED) != Z_OK) {
+      std::cerr << "Error: unable to compress a binary export frame.\n";
+      exit(1);
+    }
+    const uint32_t crc = static_cast<uint32_t>(::crc32(0,
+                         reinterpret_cast<const Bytef*>(frame.data()),
+                         frame.size()));
+    std::string header;
+    exchange_bin_put_uint64(header, frame.size());
+    exchange_bin_put_uint64(header, compressed_size);
+    for (size_t i=0; i<4; ++i) {
+      header.push_back(static_cast<char>((crc >> (8 * i)) & 0xff));
+    }
+    out.write(header.data(), header.size());
+    out.write(compressed.data(), compressed_size);
+    frame.clear();
+    previous_hash.clear();
+  }
+
+  void end_record() {
+    if (frame.size() >= exchange_bin_frame_size) {
+      write_frame();
+    }
+  }
+
+  // the number of the source, numbering it as a bare file hash if new
+  uint64_t source_number(const std::string& file_hash) {
+    const std::map<std::string, uint64_t>::const_iterator it =
+                                          source_numbers.find(file_hash);
+    if (it != source_numbers.end()) {
+      return it->second;
+    }
+    const uint64_t number = source_numbers.size();
+    source_numbers[file_hash] = number;
+    exchange_bin_put_uint64(frame, EXCHANGE_BIN_FILE_HASH);
+    exchange_bin_put_string(frame, file_hash);
+    return number;
+  }
+
+  public:
+  exchange_bin_writer_t(std::ostream& p_out,
+                        const hashdb::settings_t& settings) :
+          out(p_out), frame(), compressed(), previous_hash(),
+          source_numbers(), num_hashes(0) {
+    std::string header(exchange_bin_magic, exchange_bin_magic_size);
+    exchange_bin_put_uint64(header, settings.block_size);
+    exchange_bin_put_string(header, settings.block_hash_algorithm);
+    out.write(header.data(), header.size());
+  }
+
+  // sources must be written before hashes
+  void write_source(const std::string& file_hash,
+                    const uint64_t filesize,
+                    const std::string& file_type,
+                    const uint64_t zero_count,
+                    const uint64_t nonprobative_count,
+                    const hashdb::source_names_t& names) {
+    const uint64_t number = source_numbers.size();
+    source_numbers[file_hash] = number;
+    exchange_bin_put_uint64(frame, EXCHANGE_BIN_SOURCE);
+    exchange_bin_put_string(frame, file_hash);
+    exchange_bin_put_uint64(frame, filesize);
+    exchange_bin_put_string(frame, file_type);
+    exchange_bin_put_uint64(frame, zero_count);
+    exchange_bin_put_uint64(frame, nonprobative_count);
+    exchange_bin_put_uint64(frame, names.size());
+    for (hashdb::source_names_t::const_iterator it = names.begin();
+         it != names.end(); ++it) {
+      exchange_bin_put_string(frame, it->first);
+      exchange_bin_put_string(frame, it->second);
+    }
+    end_record();
+  }
+
+  // hashes must be written in block hash order
+  void write_hash(const std::string& block_hash,
+                  const uint64_t k_entropy,
+                  const std::string& block_label,
+                  const hashdb::source_sub_counts_t& source_sub_counts) {
+    // number any sources not in the source table before the hash
+    std::vector<uint64_t> numbers;
+    numbers.reserve(source_sub_counts.size());
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      numbers.push_back(source_number(it->file_hash));
+    }
+
+    size_t shared = 0;
+    while (shared < block_hash.size() && shared < previous_hash.size() &&
+           block_hash[shared] == previous_hash[shared]) {
+      ++shared;
+    }
+    exchange_bin_put_uint64(frame, EXCHANGE_BIN_HASH);
+    exchange_bin_put_uint64(frame, shared);
+    exchange_bin_put_string(frame, block_hash.substr(shared));
+    exchange_bin_put_uint64(frame, k_entropy);
+    exchange_bin_put_string(frame, block_label);
+    exchange_bin_put_uint64(frame, numbers.size());
+    size_t i = 0;
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      exchange_bin_put_uint64(frame, numbers[i++]);
+      exchange_bin_put_uint64(frame, it->sub_count);
+    }
+    previous_hash = block_hash;
+    ++num_hashes;
+    end_record();
+  }
+
+  // end the export, return "" else the reason it was not written
+  std::string close() {
+    exchange_bin_put_uint64(frame, EXCHANGE_BIN_END);
+    exchange_bin_put_uint64(frame, source_numbers.size());
+    exchange_bin_put_uint64(frame, num_hashes);
+    write_frame();
+    out.flush();
+    if (out.fail()) {
+      return "Unable to write the binary export.";
+    }
+    return "";
+  }
+};
+
+class exchange_bin_reader_t {
+  private:
+  std::istream& in;
+  std::string compressed;
+  std::string frame;            // the raw records of the current frame
+  size_t offset;                // of the next record in frame
+  std::string previous_hash;
+
+  // do not allow copy or assignment
+  exchange_bin_reader_t(const exchange_bin_reader_t&);
+  exchange_bin_reader_t& operator=(const exchange_bin_reader_t&);
+
+  bool read_stream_uint64(uint64_t& value) {
+    value = 0;
+    for (size_t shift=0; shift<64; shift+=7) {
+      const int c = in.get();
+      if (c == EOF) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if ((c & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool read_stream_string(std::string& s) {
+    uint64_t size;
+    if (!read_stream_uint64(size) || size > 1048576) {
+      return false;
+    }
+    s.resize(size);
+    if (size > 0) {
+      in.read(&s[0], size);
+    }
+    return in.good();
+  }
+
+  // stop reading a corrupted export
+  bool corrupted(const std::string& reason) {
+    if (error_message.size() == 0) {
+      error_message = "The binary export is corrupted: " + reason + ".";
+    }
+    return false;
+  }
+
+  // read and check the next frame
+  bool read_frame() {
+    uint64_t raw_size;
+    uint64_t compressed_size;
+    unsigned char crc_bytes[4];
+    if (!read_stream_uint64(raw_size) ||
+        !read_stream_uint64(compressed_size)) {
+      return corrupted("it ends before its end record");
+    }
+    if (raw_size == 0 || raw_size > exchange_bin_max_frame_size ||
+        compressed_size > compressBound(exchange_bin_max_frame_size)) {
+      return corrupted("a frame has an invalid size");
+    }
+    in.read(reinterpret_cast<char*>(crc_bytes), 4);
+    compressed.resize(compressed_size);
+    if (compressed_size > 0) {
+      in.read(&compressed[0], compressed_size);
+    }
+    if (!in.good()) {
+      return corrupted("a frame is truncated");
+    }
+    frame.resize(raw_size);
+    uLongf size = raw_size;
+    if (uncompress(reinterpret_cast<Bytef*>(&frame[0]), &size,
+                   reinterpret_cast<const Bytef*>(compressed.data()),
+                   compressed_size) != Z_OK || size != raw_size) {
+      return corrupted("a frame does not decompress");
+    }
+    uint32_t crc = 0;
+    for (size_t i=0; i<4; ++i) {
+      crc |= static_cast<uint32_t>(crc_bytes[i]) << (8 * i);
+    }
+    if (crc != static_cast<uint32_t>(::crc32(0,
+                   reinterpret_cast<const Bytef*>(frame.data()), size))) {
+      return corrupted("a frame fails its checksum");
+    }
+    offset = 0;
+    previous_hash.clear();
+    return true;
+  }
+
+  bool get_uint64(uint64_t& value) {
+    value = 0;
+    for (size_t shift=0; shift<64 && offset<frame.size(); shift+=7) {
+      const uint8_t c = static_cast<uint8_t>(frame[offset++]);
+      value |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if ((c & 0x80) == 0) {
+        return true;
+      }
+    }
+    return corrupted("a record is truncated");
+  }
+
+  bool get_string(std::string& s) {
+    uint64_t size;
+    if (!get_uint64(size)) {
+      return false;
+    }
+    if (size > frame.size() - offset) {
+      return corrupted("a record is truncated");
+    }
+    s.assign(frame, offset, size);
+    offset += size;
+    return true;
+  }
+
+  public:
+  uint32_t block_size;
+  std::string block_hash_algorithm;
+
+  // the reason the export could not be read, else ""
+  std::string error_message;
+
+  // the fields of the record read by next
+  uint64_t type;
+  std::string file_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  hashdb::source_names_t names;
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  std::vector<std::pair<uint64_t, uint64_t> > source_sub_counts;
+  uint64_t num_sources;         // in the end record
+  uint64_t num_hashes;          // in the end record
+
+  exchange_bin_reader_t(std::istream& p_in) :
+          in(p_in), compressed(), frame(), offset(0), previous_hash(),
+          block_size(0), block_hash_algorithm(), error_message(),
+          type(EXCHANGE_BIN_END), file_hash(), filesize(0), file_type(),
+          zero_count(0), nonprobative_count(0), names(), block_hash(),
+          k_entropy(0), block_label(), source_sub_counts(),
+          num_sources(0), num_hashes(0) {
+    char magic[exchange_bin_magic_size];
+    uint64_t b;
+    in.read(magic, exchange_bin_magic_size);
+    if (!in.good() ||
+        std::string(magic, exchange_bin_magic_size) !=
+                 std::string(exchange_bin_magic, exchange_bin_magic_size) ||
+        !read_stream_uint64(b) || !read_stream_string(block_hash_algorithm)) {
+      error_message = "The input is not a binary export.";
+      return;
+    }
+    block_size = static_cast<uint32_t>(b);
+  }
+
+  // read the next record, false after the end record or on error
+  bool next() {
+    if (error_message.size() != 0) {
+      return false;
+    }
+    if (offset == frame.size() && !read_frame()) {
+      return false;
+    }
+    if (!get_uint64(type)) {
+      return false;
+    }
+    switch (type) {
+      case EXCHANGE_BIN_END:
+        get_uint64(num_sources) && get_uint64(num_hashes);
+        return false;
+
+      case EXCHANGE_BIN_SOURCE: {
+        uint64_t size;
+        if (!get_string(file_hash) || !get_uint64(filesize) ||
+            !get_string(file_type) || !get_uint64(zero_count) ||
+            !get_uint64(nonprobative_count) || !get_uint64(size)) {
+          return false;
+        }
+        names.clear();
+        for (uint64_t i=0; i<size; ++i) {
+          std::string repository_name;
+          std::string name;
+          if (!get_string(repository_name) || !get_string(name)) {
+            return false;
+          }
+          names.insert(hashdb::source_name_t(repository_name, name));
+        }
+        return true;
+      }
+
+      case EXCHANGE_BIN_FILE_HASH:
+        return get_string(file_hash);
+
+      case EXCHANGE_BIN_HASH: {
+        uint64_t shared;
+        std::string rest;
+        uint64_t size;
+        if (!get_uint64(shared) || shared > previous_hash.size() ||
+            !get_string(rest) || !get_uint64(k_entropy) ||
+            !get_string(block_label) || !get_uint64(size)) {
+          return corrupted("a hash record is invalid");
+        }
+        block_hash.assign(previous_hash, 0, shared);
+        block_hash.append(rest);
+        previous_hash = block_hash;
+        source_sub_counts.clear();
+        for (uint64_t i=0; i<size; ++i) {
+          uint64_t number;
+          uint64_t sub_count;
+          if (!get_uint64(number) || !get_uint64(sub_count)) {
+            return false;
+          }
+          source_sub_counts.push_back(std::pair<uint64_t, uint64_t>(
+                                                      number, sub_count));
+        }
+        return true;
+      }
+
+      default:
+        return corrupted("a record has an unknown type");
+    }
+  }
+};
+
+/**
+ * Export the sources and then the hashes of the hashdb of manager in
+ * the binary exchange format, see exchange_bin.hpp.
+ *
+ * Returns "" else the reason the export was not written.
+ */
+inline std::string export_bin(const hashdb::scan_manager_t& manager,
+                              const hashdb::settings_t& settings,
+                              progress_tracker_t& progress_tracker,
+                              std::ostream& os) {
+  exchange_bin_writer_t writer(os, settings);
+
+  // the source table
+  hashdb::source_iterator_t source_iterator(manager);
+  std::string file_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  hashdb::source_names_t names;
+  while (source_iterator.next(file_hash, filesize, file_type, zero_count,
+                              nonprobative_count, names)) {
+    writer.write_source(file_hash, filesize, file_type, zero_count,
+                        nonprobative_count, names);
+  }
+
+  // the hashes, in key order
+  hashdb::hash_iterator_t hash_iterator(manager);
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_sub_counts_t source_sub_counts;
+  while (hash_iterator.next(block_hash, k_entropy, block_label, count,
+                            source_sub_counts)) {
+    writer.write_hash(block_hash, k_entropy, block_label,
+                      source_sub_counts);
+    progress_tracker.track_hash_data(source_sub_counts.size());
+  }
+
+  return writer.close();
+}
+
+/**
+ * Import a binary export from in into the hashdb of manager.  Sources
+ * are inserted a frame at a time and hashes are merged in key order,
+ * as from sorted runs.  The export must hash blocks as settings does.
+ *
+ * Returns "" else the reason the export was not imported.  A frame
+ * found corrupted leaves the records before it imported.
+ */
+inline std::string import_bin(hashdb::import_manager_t& manager,
+                              const hashdb::settings_t& settings,
+                              progress_tracker_t& progress_tracker,
+                              std::istream& in) {
+  exchange_bin_reader_t reader(in);
+  if (reader.error_message.size() != 0) {
+    return reader.error_message;
+  }
+  if (reader.block_size != settings.block_size ||
+      reader.block_hash_algorithm != settings.block_hash_algorithm) {
+    return "The binary export does not match the block size and block "
+           "hash algorithm of the hashdb.";
+  }
+
+  // the file hash of each source number
+  std::vector<std::string> file_hashes;
+
+  // sources are inserted together before the next hash
+  std::vector<hashdb::json_record_t> sources;
+  size_t num_pending = 0;
+  uint64_t num_hashes = 0;
+
+  while (reader.next()) {
+    if (reader.type == EXCHANGE_BIN_SOURCE) {
+      file_hashes.push_back(reader.file_hash);
+      if (num_pending == sources.size()) {
+        sources.resize(sources.size() + 1);
+      }
+      hashdb::json_record_t& record = sources[num_pending++];
+      record.is_block_hash = false;
+      record.file_hash = reader.file_hash;
+      record.filesize = reader.filesize;
+      record.file_type = reader.file_type;
+      record.zero_count = reader.zero_count;
+      record.nonprobative_count = reader.nonprobative_count;
+      record.names = reader.names;
+      if (num_pending == exchange_bin_source_batch_size) {
+        manager.insert_sources(sources, num_pending);
+        num_pending = 0;
+      }
+      continue;
+    }
+    if (reader.type == EXCHANGE_BIN_FILE_HASH) {
+      file_hashes.push_back(reader.file_hash);
+      continue;
+    }
+
+    // a hash
+    if (num_pending != 0) {
+      manager.insert_sources(sources, num_pending);
+      num_pending = 0;
+    }
+    for (size_t i=0; i<reader.source_sub_counts.size(); ++i) {
+      const uint64_t number = reader.source_sub_counts[i].first;
+      if (number >= file_hashes.size()) {
+        return "The binary export is corrupted: a hash references an "
+               "unknown source.";
+      }
+      manager.merge_hash(reader.block_hash, reader.k_entropy,
+                         reader.block_label, file_hashes[number],
+                         reader.source_sub_counts[i].second);
+    }
+    ++num_hashes;
+    progress_tracker.track_hash_data(reader.source_sub_counts.size());
+  }
+  if (num_pending != 0) {
+    manager.insert_sources(sources, num_pending);
+  }
+
+  if (reader.error_message.size() != 0) {
+    return reader.error_message;
+  }
+  if (reader.num_sources != file_hashes.size() ||
+      reader.num_hashes != num_hashes) {
+    return "The binary export is corrupted: its record counts do not "
+           "match its end record.";
+  }
+  return "";
+}
+
+#endif
@@ -40,62 +40,195 @@
 
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <sstream>
+#include <fstream>
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
 
 void export_json_sources(const hashdb::scan_manager_t& manager,
                          std::ostream& os) {
 
-  std::string file_hash = manager.first_source();
-  while (file_hash.size() != 0) {
+  // walk the source stores together rather than finding each source
+  hashdb::source_iterator_t source_iterator(manager);
+  std::string json_source_string = source_iterator.next_json();
+  while (json_source_string.size() != 0) {
+    os << json_source_string << "\n";
 
-    // get source data
-    std::string json_source_string = manager.export_source_json(file_hash);
+    // next
+    json_source_string = source_iterator.next_json();
+  }
+}
 
-    // program error
-    if (json_source_string.size() == 0) {
-      assert(0);
-    }
+// the hashes of a parallel export, in a temporary file per range
+struct export_scan_t {
+  progress_tracker_t* const progress_tracker;
+  std::vector<FILE*> ranges;
 
-    os << json_source_string << "\n";
+  export_scan_t(progress_tracker_t* const p_progress_tracker) :
+                progress_tracker(p_progress_tracker), ranges() {
+  }
 
-    // next
-    file_hash = manager.next_source(file_hash);
+  private:
+  // do not allow copy or assignment
+  export_scan_t(const export_scan_t&);
+  export_scan_t& operator=(const export_scan_t&);
+};
+
+static void export_hash(void* const data,
+                        const size_t range,
+                        const std::string& block_hash,
+                        const uint64_t k_entropy,
+                        const std::string& block_label,
+                        const uint64_t count,
+                        const hashdb::source_sub_counts_t& source_sub_counts) {
+
+  export_scan_t* const scan = static_cast<export_scan_t*>(data);
+
+  // write the JSON
+  const std::string json_hash_string = hashdb::hash_data_json(block_hash,
+                          k_entropy, block_label, source_sub_counts) + "\n";
+  if (fwrite(json_hash_string.c_str(), 1, json_hash_string.size(),
+             scan->ranges[range]) != json_hash_string.size()) {
+    std::cerr << "Error writing temporary export file: "
+              << strerror(errno) << "\n";
+    exit(1);
   }
+
+  // update the progress tracker
+  scan->progress_tracker->track_hash_data(source_sub_counts.size());
 }
 
 void export_json_hashes(const hashdb::scan_manager_t& manager,
                         progress_tracker_t& progress_tracker,
-                        std::ostream& os) {
+                        std::ostream& os,
+                        const size_t num_threads) {
+
+  // with one range, write directly in key order
+  const size_t num_ranges = (num_threads == 0) ? hashdb::num_cpus()
+                                               : num_threads;
+  if (num_ranges == 1) {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    hashdb::hash_iterator_t hash_iterator(manager);
+    while (hash_iterator.next(block_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
 
-  // space for variables in order to use the tracker
-  std::string block_hash;
-  uint64_t k_entropy;
-  std::string block_label;
-  uint64_t count;
-  hashdb::source_sub_counts_t source_sub_counts;
-
-  block_hash = manager.first_hash();
-  while (block_hash.size() != 0) {
+      // emit the JSON
+      os << hashdb::hash_data_json(block_hash, k_entropy, block_label,
+                                   source_sub_counts) << "\n";
 
-    // get hash data
-    std::string json_hash_string = manager.export_hash_json(block_hash);
+      // update the progress tracker
+      progress_tracker.track_hash_data(source_sub_counts.size());
+    }
+    return;
+  }
 
-    // program error
-    if (json_hash_string.size() == 0) {
-      assert(0);
+  // export ranges of the hashes in parallel into temporary files
+  export_scan_t scan(&progress_tracker);
+  for (size_t i=0; i<num_ranges; ++i) {
+    FILE* const f = tmpfile();
+    if (f == NULL) {
+      std::cerr << "Error creating temporary export file: "
+                << strerror(errno) << "\n";
+      exit(1);
+    }
+    scan.ranges.push_back(f);
+  }
+  manager.scan_ranges(num_ranges, export_hash, &scan);
+
+  // emit the ranges in key order
+  char buffer[65536];
+  for (size_t i=0; i<num_ranges; ++i) {
+    rewind(scan.ranges[i]);
+    size_t size;
+    while ((size = fread(buffer, 1, sizeof(buffer), scan.ranges[i])) != 0) {
+      os.write(buffer, size);
     }
+    fclose(scan.ranges[i]);
+  }
+}
 
-    // emit the JSON
-    os << json_hash_string << "\n";
+// the name of shard file i of a sharded export, beside its manifest
+static std::string export_shard_filename(const std::string& json_file,
+                                         const size_t shard) {
+  std::stringstream ss;
+  ss << json_file << "." << shard;
+  return ss.str();
+}
 
-    // update the progress tracker, this accurate approach is expensive
-    manager.find_hash(block_hash, k_entropy, block_label,
-                      count, source_sub_counts);
-    progress_tracker.track_hash_data(source_sub_counts.size());
+static std::string basename_of(const std::string& path) {
+  const size_t slash = path.find_last_of('/');
+  return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
 
-    // next
-    block_hash = manager.next_hash(block_hash);
+static void close_export_file(FILE* const f, const std::string& filename) {
+  if (fclose(f) != 0) {
+    std::cerr << "Error writing export file " << filename << ": "
+              << strerror(errno) << "\n";
+    exit(1);
+  }
+}
+
+void export_json_shards(const hashdb::scan_manager_t& manager,
+                        progress_tracker_t& progress_tracker,
+                        const std::string& json_file,
+                        const std::string& header,
+                        const size_t num_shards,
+                        const size_t num_threads) {
+
+  // open the hash shard files, key range i goes to shard i
+  export_scan_t scan(&progress_tracker);
+  std::vector<std::string> filenames;
+  for (size_t i=0; i<num_shards; ++i) {
+    filenames.push_back(export_shard_filename(json_file, i));
+    FILE* const f = fopen(filenames[i].c_str(), "w");
+    if (f == NULL) {
+      std::cerr << "Error: Cannot open " << filenames[i] << ": "
+                << strerror(errno) << "\n";
+      exit(1);
+    }
+    fputs(header.c_str(), f);
+    scan.ranges.push_back(f);
+  }
+
+  // export the key ranges concurrently, each shard in key order
+  manager.scan_ranges(num_shards, (num_threads == 0) ?
+                      hashdb::num_cpus() : num_threads, export_hash, &scan);
+  for (size_t i=0; i<num_shards; ++i) {
+    close_export_file(scan.ranges[i], filenames[i]);
+  }
+
+  // export the sources into the last shard
+  filenames.push_back(export_shard_filename(json_file, num_shards));
+  std::ofstream sources_out(filenames.back().c_str());
+  if (!sources_out.is_open()) {
+    std::cerr << "Error: Cannot open " << filenames.back() << ": "
+              << strerror(errno) << "\n";
+    exit(1);
+  }
+  sources_out << header;
+  export_json_sources(manager, sources_out);
+  sources_out.close();
+
+  // write the manifest naming the shards, relative to the manifest
+  std::ofstream manifest_out(json_file.c_str());
+  if (!manifest_out.is_open()) {
+    std::cerr << "Error: Cannot open " << json_file << ": "
+              << strerror(errno) << "\n";
+    exit(1);
+  }
+  manifest_out << header
+               << "# hashdb-Manifest: " << filenames.size() << "\n";
+  for (size_t i=0; i<filenames.size(); ++i) {
+    manifest_out << "# hashdb-Shard: " << basename_of(filenames[i]) << "\n";
   }
 }
 
@@ -108,46 +241,35 @@ void export_json_range(const hashdb::scan_manager_t& manager,
   // the subset of cited sources to export
   std::set<std::string> source_hashes;
 
-  // space for variables in order to use the tracker
+  // space for hash data
   std::string block_hash;
   uint64_t k_entropy;
   std::string block_label;
   uint64_t count;
   hashdb::source_sub_counts_t source_sub_counts;
 
-  // export the block hashes that are in range
-  block_hash = manager.first_hash();
-  while (block_hash.size() != 0) {
-
-    manager.find_hash(block_hash, k_entropy, block_label,
-                      count, source_sub_counts);
-
-    if (block_hash >= begin_block_hash && block_hash <= end_block_hash) {
-      // process the block hash since it is in range
+  // export the block hashes that are in range, starting at the first
+  hashdb::hash_iterator_t hash_iterator(manager, begin_block_hash, "");
+  while (hash_iterator.next(block_hash, k_entropy, block_label, count,
+                            source_sub_counts)) {
 
-      // get JSON hash data
-      std::string json_hash_string = manager.export_hash_json(block_hash);
-
-      // program error
-      if (json_hash_string.size() == 0) {
-        assert(0);
-      }
+    if (block_hash > end_block_hash) {
+      // the rest are out of range
+      break;
+    }
 
-      // emit the JSON
-      os << json_hash_string << "\n";
+    // emit the JSON
+    os << hashdb::hash_data_json(block_hash, k_entropy, block_label,
+                                 source_sub_counts) << "\n";
 
-      // note the sources involved
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
-        source_hashes.insert(it->file_hash);
-      }
+    // note the sources involved
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      source_hashes.insert(it->file_hash);
     }
 
     // update the progress tracker
     progress_tracker.track_hash_data(source_sub_counts.size());
-
-    // next
-    block_hash = manager.next_hash(block_hash);
   }
 
   // export the cited sources
@@ -27,6 +27,7 @@
 #define EXPORT_JSON_HPP
 
 #include <iostream>
+#include <string>
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
 
@@ -35,7 +36,21 @@ void export_json_sources(const hashdb::scan_manager_t& manager,
 
 void export_json_hashes(const hashdb::scan_manager_t& manager,
                         progress_tracker_t& progress_tracker,
-                        std::ostream& os);
+                        std::ostream& os,
+                        const size_t num_threads);
+
+/**
+ * Export into num_shards hash files, each one key range in key order,
+ * plus one source file, walking num_threads ranges at a time.  The
+ * file at json_file is the manifest naming the shard files, which are
+ * at json_file.0 through json_file.num_shards.
+ */
+void export_json_shards(const hashdb::scan_manager_t& manager,
+                        progress_tracker_t& progress_tracker,
+                        const std::string& json_file,
+                        const std::string& header,
+                        const size_t num_shards,
+                        const size_t num_threads);
 
 void export_json_range(const hashdb::scan_manager_t& manager,
                        const std::string& begin_hexcode,
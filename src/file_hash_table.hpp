@@ -0,0 +1,132 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A compact table of file hashes, each with one byte of flags, for
+ * tracking the sources of a session.  File hashes of up to 16 bytes are
+ * kept inline in an open addressing table at most half full.  Longer
+ * and empty file hashes are kept in a map.
+ */
+
+#ifndef FILE_HASH_TABLE_HPP
+#define FILE_HASH_TABLE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstring>
+#include <stdint.h>
+
+class file_hash_table_t {
+  private:
+  struct slot_t {
+    uint8_t size;         // key size, 0 if the slot is empty
+    uint8_t flags;
+    char key[16];
+  };
+  std::vector<slot_t> slots;
+  size_t used;
+  std::map<std::string, uint8_t> long_keys;
+
+  // do not allow copy or assignment
+  file_hash_table_t(const file_hash_table_t&);
+  file_hash_table_t& operator=(const file_hash_table_t&);
+
+  // file hashes are uniform so their leading bytes place them
+  static size_t place(const std::string& key, const size_t mask) {
+    uint64_t leading = 0;
+    memcpy(&leading, key.data(), key.size() < 8 ? key.size() : 8);
+    return static_cast<size_t>((leading * 0x9e3779b97f4a7c15ULL) >> 16)
+           & mask;
+  }
+
+  // the slot of the key or the empty slot where it belongs
+  const slot_t& slot(const std::string& key) const {
+    const size_t mask = slots.size() - 1;
+    size_t i = place(key, mask);
+    while (slots[i].size != 0 && (slots[i].size != key.size() ||
+                      memcmp(slots[i].key, key.data(), key.size()) != 0)) {
+      i = (i + 1) & mask;
+    }
+    return slots[i];
+  }
+
+  slot_t& slot(const std::string& key) {
+    return const_cast<slot_t&>(
+                 static_cast<const file_hash_table_t*>(this)->slot(key));
+  }
+
+  void grow() {
+    std::vector<slot_t> old_slots(slots.size() * 2);
+    old_slots.swap(slots);
+    for (size_t i=0; i<old_slots.size(); ++i) {
+      if (old_slots[i].size != 0) {
+        slot(std::string(old_slots[i].key, old_slots[i].size)) =
+                                                          old_slots[i];
+      }
+    }
+  }
+
+  public:
+  file_hash_table_t() : slots(1024), used(0), long_keys() {
+  }
+
+  // the flags of the file hash, added with no flags if new
+  uint8_t& flags(const std::string& file_hash) {
+    if (file_hash.size() == 0 || file_hash.size() > sizeof(slots[0].key)) {
+      return long_keys[file_hash];
+    }
+    slot_t* s = &slot(file_hash);
+    if (s->size == 0) {
+      if (2 * (used + 1) > slots.size()) {
+        grow();
+        s = &slot(file_hash);
+      }
+      s->size = static_cast<uint8_t>(file_hash.size());
+      s->flags = 0;
+      memcpy(s->key, file_hash.data(), file_hash.size());
+      ++used;
+    }
+    return s->flags;
+  }
+
+  // the flags of the file hash, 0 if it is not in the table
+  uint8_t find(const std::string& file_hash) const {
+    if (file_hash.size() == 0 || file_hash.size() > sizeof(slots[0].key)) {
+      const std::map<std::string, uint8_t>::const_iterator it =
+                                            long_keys.find(file_hash);
+      return (it == long_keys.end()) ? 0 : it->second;
+    }
+    const slot_t& s = slot(file_hash);
+    return (s.size == 0) ? 0 : s.flags;
+  }
+
+  // true if the file hash has all of the flags
+  bool has(const std::string& file_hash, const uint8_t mask) const {
+    return (find(file_hash) & mask) == mask;
+  }
+
+  // set the flags of the file hash
+  void set(const std::string& file_hash, const uint8_t mask) {
+    flags(file_hash) |= mask;
+  }
+};
+
+#endif
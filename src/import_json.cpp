@@ -39,37 +39,220 @@
 #endif
 
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include <pthread.h>
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
 #include <fstream>
 
-void import_json(hashdb::import_manager_t& manager,
-                 progress_tracker_t& progress_tracker,
-                 std::istream& in) {
-  std::string line;
-  size_t line_number = 0;
-  while(getline(in, line)) {
-    ++line_number;
+// bytes of input read into one chunk, extended to the end of its last line
+static const size_t IMPORT_CHUNK_SIZE = 1 << 22;
 
-    // skip comment lines
-    if (line[0] == '#') {
-      continue;
+// A line-aligned chunk of input, parsed by one thread with its own parser.
+// Chunks are imported in input order by one writer.
+struct import_chunk_t {
+  hashdb::json_record_parser_t parser;
+  std::string text;
+  size_t line_number;                       // the line number of the first line
+  std::vector<hashdb::json_record_t> records;
+  size_t num_records;                       // records used in this chunk
+  std::string errors;                       // errors to print in order
+  pthread_t thread;
+
+  import_chunk_t() : parser(), text(), line_number(0), records(),
+                     num_records(0), errors(), thread() {
+  }
+
+  private:
+  // do not allow copy or assignment
+  import_chunk_t(const import_chunk_t&);
+  import_chunk_t& operator=(const import_chunk_t&);
+};
+
+// Read the next chunk, ending at a line end unless at the end of input.
+// Text past the last line end is kept in carry for the next chunk.
+// Returns the number of lines read.
+static size_t read_chunk(std::istream& in, std::string& carry,
+                         import_chunk_t& chunk) {
+  chunk.text.swap(carry);
+  carry.clear();
+  const size_t start = chunk.text.size();
+  chunk.text.resize(start + IMPORT_CHUNK_SIZE);
+  in.read(&chunk.text[start], IMPORT_CHUNK_SIZE);
+  chunk.text.resize(start + static_cast<size_t>(in.gcount()));
+
+  // keep a partial last line for the next chunk
+  if (in) {
+    const size_t last = chunk.text.find_last_of('\n');
+    if (last == std::string::npos) {
+      carry.swap(chunk.text);
+      chunk.text.clear();
+    } else {
+      carry.assign(chunk.text, last + 1, std::string::npos);
+      chunk.text.resize(last + 1);
     }
+  }
 
-    // skip empty lines
-    if (line.size() == 0) {
+  // count the lines
+  size_t num_lines = 0;
+  const char* p = chunk.text.data();
+  const char* const end = p + chunk.text.size();
+  while (p < end) {
+    const char* const eol = static_cast<const char*>(
+                                      memchr(p, '\n', end - p));
+    ++num_lines;
+    p = (eol == NULL) ? end : eol + 1;
+  }
+  return num_lines;
+}
+
+// parse the lines of a chunk into records
+static void* parse_chunk(void* const arg) {
+  import_chunk_t* const chunk = static_cast<import_chunk_t*>(arg);
+  std::stringstream errors;
+  chunk->num_records = 0;
+  size_t line_number = chunk->line_number;
+  const char* p = chunk->text.data();
+  const char* const end = p + chunk->text.size();
+  for (; p < end; ++line_number) {
+    const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+    if (eol == NULL) {
+      eol = end;
+    }
+    const char* const line = p;
+    const size_t size = eol - p;
+    p = eol + 1;
+
+    // skip comment lines and empty lines
+    if (size == 0 || line[0] == '#') {
       continue;
     }
 
-    // import JSON
-    std::string error_message = manager.import_json(line);
+    // parse JSON
+    if (chunk->num_records == chunk->records.size()) {
+      chunk->records.resize(chunk->records.size() + 1);
+    }
+    const std::string error_message = chunk->parser.parse(line, size,
+                                   chunk->records[chunk->num_records]);
     if (error_message.size() != 0) {
-      std::cerr << "Invalid line " << line_number
-                << " error: " << error_message
-                << ": '" << line << "'\n";
+      errors << "Invalid line " << line_number
+             << " error: " << error_message
+             << ": '" << std::string(line, size) << "'\n";
     } else {
-      progress_tracker.track();
+      ++chunk->num_records;
     }
   }
+  chunk->errors = errors.str();
+  return NULL;
 }
 
+// import a parsed chunk, registering its sources together and then
+// importing its hashes in order
+static void import_chunk(hashdb::import_manager_t& manager,
+                         progress_tracker_t& progress_tracker,
+                         const import_chunk_t& chunk) {
+  std::cerr << chunk.errors;
+  manager.insert_sources(chunk.records, chunk.num_records);
+  for (size_t i=0; i<chunk.num_records; ++i) {
+    if (chunk.records[i].is_block_hash) {
+      manager.import_record(chunk.records[i]);
+    }
+    progress_tracker.track();
+  }
+}
+
+// read chunks for a round and start parsing them, all in new threads
+static void start_round(std::istream& in, std::string& carry,
+                        size_t& line_number,
+                        std::vector<import_chunk_t*>& chunks,
+                        size_t& num_chunks) {
+  num_chunks = 0;
+  while (num_chunks < chunks.size() && (in || carry.size() != 0)) {
+    import_chunk_t* const chunk = chunks[num_chunks];
+    chunk->line_number = line_number + 1;
+    line_number += read_chunk(in, carry, *chunk);
+    if (chunk->text.size() == 0) {
+      continue;
+    }
+    if (pthread_create(&chunk->thread, NULL, parse_chunk, chunk)) {
+      std::cerr << "Error creating import thread.\n";
+      assert(0);
+    }
+    ++num_chunks;
+  }
+}
+
+void import_json(hashdb::import_manager_t& manager,
+                 progress_tracker_t& progress_tracker,
+                 std::istream& in,
+                 const size_t num_threads) {
+
+  const size_t num_parsers = (num_threads == 0) ? hashdb::num_cpus()
+                                                : num_threads;
+
+  // two rounds of chunks so one round is parsed while the other is imported
+  std::vector<import_chunk_t*> rounds[2];
+  size_t num_chunks[2] = {0, 0};
+  for (size_t r=0; r<2; ++r) {
+    for (size_t i=0; i<num_parsers; ++i) {
+      rounds[r].push_back(new import_chunk_t);
+    }
+  }
+
+  std::string carry;
+  size_t line_number = 0;
+  size_t current = 0;
+  start_round(in, carry, line_number, rounds[current], num_chunks[current]);
+  while (num_chunks[current] != 0) {
+
+    // finish parsing this round
+    for (size_t i=0; i<num_chunks[current]; ++i) {
+      pthread_join(rounds[current][i]->thread, NULL);
+    }
+
+    // parse the next round while importing this one
+    const size_t next = 1 - current;
+    start_round(in, carry, line_number, rounds[next], num_chunks[next]);
+    for (size_t i=0; i<num_chunks[current]; ++i) {
+      import_chunk(manager, progress_tracker, *rounds[current][i]);
+    }
+    current = next;
+  }
+
+  for (size_t r=0; r<2; ++r) {
+    for (size_t i=0; i<num_parsers; ++i) {
+      delete rounds[r][i];
+    }
+  }
+}
+
+bool read_json_manifest(const std::string& json_file,
+                        std::vector<std::string>& shard_files) {
+  shard_files.clear();
+  std::ifstream in(json_file.c_str());
+  if (!in.is_open()) {
+    return false;
+  }
+
+  // shard files are relative to the manifest
+  const size_t slash = json_file.find_last_of('/');
+  const std::string dir = (slash == std::string::npos) ? "" :
+                                            json_file.substr(0, slash + 1);
+
+  // the manifest is in the header comment lines
+  const std::string manifest_tag = "# hashdb-Manifest: ";
+  const std::string shard_tag = "# hashdb-Shard: ";
+  bool is_manifest = false;
+  std::string line;
+  while(getline(in, line) && line.size() != 0 && line[0] == '#') {
+    if (line.compare(0, manifest_tag.size(), manifest_tag) == 0) {
+      is_manifest = true;
+    } else if (line.compare(0, shard_tag.size(), shard_tag) == 0) {
+      shard_files.push_back(dir + line.substr(shard_tag.size()));
+    }
+  }
+  return is_manifest;
+}
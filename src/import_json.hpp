@@ -29,10 +29,25 @@
 #include "../src_libhashdb/hashdb.hpp"
 #include "progress_tracker.hpp"
 #include <fstream>
+#include <string>
+#include <vector>
 
+/**
+ * Import JSON lines from in.  Line-aligned chunks of input are parsed by
+ * num_threads threads, or one per CPU if 0, while the previous chunks
+ * are imported in input order.
+ */
 void import_json(hashdb::import_manager_t& manager,
                  progress_tracker_t& progress_tracker,
-                 std::istream& in);
+                 std::istream& in,
+                 const size_t num_threads);
+
+/**
+ * Read the shard files named by a sharded export manifest.  Returns
+ * false if json_file is not a manifest.
+ */
+bool read_json_manifest(const std::string& json_file,
+                        std::vector<std::string>& shard_files);
 
 #endif
 
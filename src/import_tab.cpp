@@ -45,105 +45,274 @@
 
 #include <iostream>
 #include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "../src_libhashdb/hashdb.hpp"
+#include "../src_libhashdb/hasher/mapped_file.hpp"
 #include "s_to_uint64.hpp"
+#include "file_hash_table.hpp"
 #include "progress_tracker.hpp"
 
-void import_tab(hashdb::import_manager_t& manager,
-                const std::string& repository_name,
-                const std::string& filename,
-                const hashdb::scan_manager_t* const whitelist_manager,
-                progress_tracker_t& progress_tracker,
-                std::istream& in) {
+// bytes of streamed input read at a time, extended to the end of a line
+static const size_t TAB_CHUNK_SIZE = 1 << 22;
+
+// the import state of a file hash seen in the session
+enum source_state_t {UNSEEN = 0, PREEXISTING, IMPORTABLE, NAMED};
+
+// decode hex into the reused binary string, reporting nothing
+static bool decode_hex_quietly(const char* const hex, const size_t size,
+                               std::string& binary) {
+  if (size == 0 || size % 2 != 0) {
+    return false;
+  }
+  binary.resize(size / 2);
+  return hashdb::hex_to_bin(hex, size, &binary[0]);
+}
+
+// decode hex into the reused binary string, reporting invalid hex the
+// way hashdb::hex_to_bin does
+static bool decode_hex(const char* const hex, const size_t size,
+                       std::string& binary) {
+  if (!decode_hex_quietly(hex, size, binary)) {
+    if (size != 0) {
+      hashdb::hex_to_bin(std::string(hex, size));
+    }
+    return false;
+  }
+  return true;
+}
+
+// imports the lines of tab input
+class tab_importer_t {
+  private:
+  hashdb::import_manager_t& manager;
+  const std::string& repository_name;
+  const std::string& filename;
+  const hashdb::scan_manager_t* const whitelist_manager;
+  progress_tracker_t& progress_tracker;
 
   // only import file hashes that are new to the session
-  std::set<std::string> importable_sources;
+  file_hash_table_t source_states;
+  size_t line_number;
+  std::string file_binary_hash;
+  std::string block_binary_hash;
 
-  std::string line;
-  size_t line_number = 0;
-  while(getline(in, line)) {
-    ++line_number;
+  // do not allow copy or assignment
+  tab_importer_t(const tab_importer_t&);
+  tab_importer_t& operator=(const tab_importer_t&);
 
-    // skip comment lines
-    if (line[0] == '#') {
-      continue;
+  // register the source data and name pair of the new file hashes of
+  // the valid lines, once per source.  Errors are reported on import.
+  void register_sources(const char* p, const char* const end) {
+    std::vector<hashdb::json_record_t> records;
+    while (p < end) {
+      const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+      if (eol == NULL) {
+        eol = end;
+      }
+      const char* const line = p;
+      const size_t size = eol - p;
+      p = eol + 1;
+
+      // only lines that import_line imports
+      if (size == 0 || line[0] == '#') {
+        continue;
+      }
+      const char* const tab1 = static_cast<const char*>(
+                                        memchr(line, '\t', size));
+      if (tab1 == NULL) {
+        continue;
+      }
+      const char* const tab2 = static_cast<const char*>(
+                            memchr(tab1 + 1, '\t', line + size - tab1 - 1));
+      if (tab2 == NULL ||
+          !decode_hex_quietly(tab1 + 1, tab2 - tab1 - 1, block_binary_hash) ||
+          !decode_hex_quietly(line, tab1 - line, file_binary_hash)) {
+        continue;
+      }
+
+      uint8_t& state = source_states.flags(file_binary_hash);
+      if (state == UNSEEN) {
+        state = manager.has_source(file_binary_hash) ?
+                PREEXISTING : IMPORTABLE;
+      }
+      if (state == IMPORTABLE) {
+        records.push_back(hashdb::json_record_t());
+        records.back().file_hash = file_binary_hash;
+        records.back().names.insert(hashdb::source_name_t(repository_name,
+                                                          filename));
+        state = NAMED;
+      }
     }
+    manager.insert_sources(records, records.size());
+  }
 
-    // skip empty lines
-    if (line.size() == 0) {
-      continue;
+  void import_line(const char* const line, const size_t size) {
+
+    // skip comment lines and empty lines
+    if (size == 0 || line[0] == '#') {
+      return;
     }
 
     // find tabs
-    size_t tab_index1 = line.find('\t');
-    if (tab_index1 == std::string::npos) {
-      std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
-      continue;
+    const char* const end = line + size;
+    const char* const tab1 = static_cast<const char*>(
+                                      memchr(line, '\t', size));
+    if (tab1 == NULL) {
+      std::cerr << "Tab not found on line " << line_number << ": '"
+                << std::string(line, size) << "'\n";
+      return;
     }
-    size_t tab_index2 = line.find('\t', tab_index1 + 1);
-    if (tab_index2 == std::string::npos) {
-      std::cerr << "Second tab not found on line " << line_number << ": '" << line << "'\n";
-      continue;
+    const char* const tab2 = static_cast<const char*>(
+                                      memchr(tab1 + 1, '\t', end - tab1 - 1));
+    if (tab2 == NULL) {
+      std::cerr << "Second tab not found on line " << line_number << ": '"
+                << std::string(line, size) << "'\n";
+      return;
     }
 
     // get file hash
-    std::string file_hash_string = line.substr(0, tab_index1);
-    std::string file_binary_hash = hashdb::hex_to_bin(file_hash_string);
-    if (file_binary_hash.size() == 0) {
+    if (!decode_hex(line, tab1 - line, file_binary_hash)) {
       std::cerr << "file hexdigest is invalid on line " << line_number
-                << ": '" << line << "', '" << file_hash_string << "'\n";
-      continue;
+                << ": '" << std::string(line, size) << "', '"
+                << std::string(line, tab1 - line) << "'\n";
+      return;
     }
 
-    // skip the file hash if it was preexisting else identify it as importable
-    if (importable_sources.find(file_binary_hash) == importable_sources.end()) {
-      // the file hash has not been seen yet so see if it is preexisting
-      if (manager.has_source(file_binary_hash)) {
-        // the file is preexisting so skip it
-        continue;
-      } else {
-        // the file hash is new so identify it as importable
-        importable_sources.insert(file_binary_hash);
-      }
+    // skip the file hash if it was preexisting else identify it as
+    // importable
+    uint8_t& state = source_states.flags(file_binary_hash);
+    if (state == UNSEEN) {
+      state = manager.has_source(file_binary_hash) ?
+              PREEXISTING : IMPORTABLE;
     }
-
-    // skip the file hash if it has not been identified as importable
-    if (importable_sources.find(file_binary_hash) == importable_sources.end()) {
-      continue;
+    if (state == PREEXISTING) {
+      return;
     }
 
     // get block hash
-    std::string block_hashdigest_string = line.substr(
-                                  tab_index1+1, tab_index2 - tab_index1 - 1);
-    std::string block_binary_hash = hashdb::hex_to_bin(block_hashdigest_string);
-    if (block_binary_hash == "") {
+    if (!decode_hex(tab1 + 1, tab2 - tab1 - 1, block_binary_hash)) {
       std::cerr << "Invalid block hash on line " << line_number
-                << ": '" << line << "', '" << block_hashdigest_string << "'\n";
-      continue;
+                << ": '" << std::string(line, size) << "', '"
+                << std::string(tab1 + 1, tab2 - tab1 - 1) << "'\n";
+      return;
     }
 
     // skip the file offset
 
     // mark with "w" if in whitelist
-    std::string whitelist_flag = "";
-    if (whitelist_manager != NULL) {
-      if (whitelist_manager->find_hash_count(block_binary_hash) > 0) {
-        whitelist_flag = "w";
-      }
-    }
-
-    // add source data
-    manager.insert_source_data(file_binary_hash, 0, "", 0, 0);
-
-    // add name pair
-    manager.insert_source_name(file_binary_hash, repository_name, filename);
+    static const std::string no_flag = "";
+    static const std::string whitelist_flag = "w";
+    const bool is_whitelisted = whitelist_manager != NULL &&
+                  whitelist_manager->find_hash_count(block_binary_hash) > 0;
 
     // add block hash
-    manager.insert_hash(block_binary_hash, 0.0, whitelist_flag,
+    manager.insert_hash(block_binary_hash, 0,
+                        is_whitelisted ? whitelist_flag : no_flag,
                         file_binary_hash);
 
     // update progress tracker
     progress_tracker.track();
   }
+
+  public:
+  tab_importer_t(hashdb::import_manager_t& p_manager,
+                 const std::string& p_repository_name,
+                 const std::string& p_filename,
+                 const hashdb::scan_manager_t* const p_whitelist_manager,
+                 progress_tracker_t& p_progress_tracker) :
+          manager(p_manager), repository_name(p_repository_name),
+          filename(p_filename), whitelist_manager(p_whitelist_manager),
+          progress_tracker(p_progress_tracker), source_states(),
+          line_number(0), file_binary_hash(), block_binary_hash() {
+  }
+
+  // import the lines in the text, the last line may lack its line end.
+  // The new sources of each block of lines are registered together
+  // before the hashes of the block are imported.
+  void import_lines(const char* p, const char* const end) {
+    while (p < end) {
+      const char* block_end = end;
+      if (static_cast<size_t>(end - p) > TAB_CHUNK_SIZE) {
+        block_end = static_cast<const char*>(memchr(p + TAB_CHUNK_SIZE,
+                              '\n', end - p - TAB_CHUNK_SIZE));
+        block_end = (block_end == NULL) ? end : block_end + 1;
+      }
+      register_sources(p, block_end);
+      while (p < block_end) {
+        const char* eol = static_cast<const char*>(
+                                      memchr(p, '\n', block_end - p));
+        if (eol == NULL) {
+          eol = block_end;
+        }
+        ++line_number;
+        import_line(p, eol - p);
+        p = eol + 1;
+      }
+    }
+  }
+};
+
+void import_tab(hashdb::import_manager_t& manager,
+                const std::string& repository_name,
+                const std::string& filename,
+                const hashdb::scan_manager_t* const whitelist_manager,
+                progress_tracker_t& progress_tracker,
+                std::istream& in) {
+
+  tab_importer_t importer(manager, repository_name, filename,
+                          whitelist_manager, progress_tracker);
+
+  // import chunks cut at line ends, keeping a partial last line
+  std::string text;
+  size_t start = 0;
+  while (in) {
+    text.resize(start + TAB_CHUNK_SIZE);
+    in.read(&text[start], TAB_CHUNK_SIZE);
+    text.resize(start + static_cast<size_t>(in.gcount()));
+    const size_t last = in ? text.find_last_of('\n') : text.size() - 1;
+    if (last == std::string::npos || text.size() == 0) {
+      start = text.size();
+      continue;
+    }
+    importer.import_lines(text.data(), text.data() + last + 1);
+    text.erase(0, last + 1);
+    start = text.size();
+  }
 }
 
+bool import_tab_mapped(hashdb::import_manager_t& manager,
+                       const std::string& repository_name,
+                       const std::string& filename,
+                       const hashdb::scan_manager_t* const whitelist_manager,
+                       progress_tracker_t& progress_tracker) {
+
+  // map the file
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  hasher::mapped_file_t* const mapped_file = (::fstat(fd, &st) == 0 &&
+                S_ISREG(st.st_mode)) ?
+                hasher::mapped_file_t::map(fd, st.st_size) : NULL;
+  ::close(fd);
+  if (mapped_file == NULL) {
+    return false;
+  }
+
+  // import the mapped text
+  const size_t size = static_cast<size_t>(st.st_size);
+  const char* const text = reinterpret_cast<const char*>(
+                                             mapped_file->acquire(0));
+  tab_importer_t importer(manager, repository_name, filename,
+                          whitelist_manager, progress_tracker);
+  importer.import_lines(text, text + size);
+  mapped_file->release(reinterpret_cast<const uint8_t*>(text), size);
+  mapped_file->release(NULL, 0);
+  return true;
+}
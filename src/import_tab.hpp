@@ -39,5 +39,15 @@ void import_tab(hashdb::import_manager_t& manager,
                 progress_tracker_t& progress_tracker,
                 std::istream& in);
 
+/**
+ * Import the tab file at filename through a memory mapping.  Returns
+ * false without importing if the file cannot be mapped.
+ */
+bool import_tab_mapped(hashdb::import_manager_t& manager,
+                       const std::string& repository_name,
+                       const std::string& filename,
+                       const hashdb::scan_manager_t* const whitelist_manager,
+                       progress_tracker_t& progress_tracker);
+
 #endif
 
@@ -71,30 +71,91 @@
 static const std::string default_repository_name = "";
 static const std::string default_whitelist_dir = "";
 
+// sorted runs are written at once, one open file per partition
+static const size_t MAX_RUN_PARTITIONS = 256;
+
 // usage
 static const std::string see_usage = "Please type 'hashdb -h' for usage.";
 
 // user-selected options
 static bool has_help = false;
 static bool has_block_size = false;
+static bool has_block_hash_algorithm = false;
+static bool has_hash_data_format = false;
+static bool has_hash_shard_bits = false;
+static bool has_initial_map_size = false;
+static bool has_max_map_size = false;
+static bool has_sync_policy = false;
+static bool has_store_path = false;
 static bool has_step_size = false;
 static bool has_repository_name = false;
 static bool has_whitelist_dir = false;
 static bool has_disable_recursive_processing = false;
 static bool has_disable_calculate_entropy = false;
 static bool has_disable_calculate_labels = false;
+static bool has_disable_nonprobative_hashes = false;
 static bool has_json_scan_mode = false;
+static bool has_scan_summary = false;
 static bool has_tuning = false;
 static bool has_part_range = false;
+static bool has_num_threads = false;
+static bool has_num_shards = false;
+static bool has_source_hash_index = false;
+static bool has_similarity_index = false;
+static bool has_count_index = false;
+static bool has_change_log = false;
+static bool has_recompute = false;
+static bool has_skip_unchanged = false;
+static bool has_sample_fraction = false;
+static bool has_scan_around_hits = false;
+static bool has_quiet = false;
+static bool has_hit_rate = false;
+static bool has_zipf_exponent = false;
+static bool has_duplicates_histogram = false;
+static bool has_metrics = false;
+static bool has_warm = false;
+static bool has_lock_hash_store = false;
+static bool has_direct_reads = false;
+static bool has_checkpoint = false;
+static bool has_resume = false;
+static bool has_queue_depth = false;
+static bool has_num_writers = false;
+static bool has_max_sources = false;
+static bool has_first_source = false;
+static bool has_compact_common = false;
+static bool has_max_pinned = false;
+static bool has_max_staleness = false;
+static bool has_min_entropy = false;
+static bool has_skip_labeled = false;
+static bool has_defer_hash_store = false;
+static bool has_format = false;
 
 // option values
 hashdb::settings_t settings;
 static std::string repository_name = default_repository_name;
 static std::string whitelist_dir = default_whitelist_dir;
 static size_t step_size = settings.block_size;
+static std::string step_size_list = "";
 static hashdb::scan_mode_t scan_mode = hashdb::scan_mode_t::EXPANDED_OPTIMIZED;
 static std::string begin_block_hash = "";
 static std::string end_block_hash = "";
+static size_t num_threads = 0;
+static size_t num_shards = 0;
+static double sample_fraction = 0.0;
+static double hit_rate = 0.5;
+static double zipf_exponent = 2.0;
+static std::string duplicates_histogram = "";
+static std::string metrics_address = "";
+static std::string checkpoint_file = "";
+static size_t queue_depth = 0;
+static size_t num_writers = 1;
+static size_t max_sources = 0;
+static size_t first_source = 0;
+static size_t max_pinned = 0;
+static uint32_t max_staleness_ms = 0;
+static uint64_t min_k_entropy = 0;
+static uint64_t memory_budget = 0;
+static std::string export_format = "json";
 
 // arguments
 static std::string cmd= "";         // the command line invocation text
@@ -147,6 +208,8 @@ static void set_disable_processing(const std::string& list) {
       has_disable_calculate_entropy = true;
     } else if (*it == 'l') {
       has_disable_calculate_labels = true;
+    } else if (*it == 'n') {
+      has_disable_nonprobative_hashes = true;
     } else {
       std::cerr << "Invalid disable processing option: '" << *it
                 << "'.  " << see_usage << "\n";
@@ -155,11 +218,52 @@ static void set_disable_processing(const std::string& list) {
   }
 }
 
+// parse a size in bytes with an optional K, M, G, or T binary suffix
+static uint64_t parse_size(const std::string& text,
+                           const std::string& name) {
+  char* end;
+  uint64_t size = std::strtoull(text.c_str(), &end, 10);
+  const std::string suffix(end);
+  if (suffix == "K") size <<= 10;
+  else if (suffix == "M") size <<= 20;
+  else if (suffix == "G") size <<= 30;
+  else if (suffix == "T") size <<= 40;
+  else if (suffix != "" || end == text.c_str()) {
+    std::cerr << "Invalid " << name << ": '" << text
+              << "'.  " << see_usage << "\n";
+    exit(1);
+  }
+  return size;
+}
+
+// parse a block size, or content-defined chunk sizes as
+// <min>:<average>:<max>, each with an optional size suffix
+static void set_block_size(const std::string& text) {
+  const size_t first = text.find(':');
+  if (first == std::string::npos) {
+    settings.block_size = std::atoi(text.c_str());
+    return;
+  }
+  const size_t second = text.find(':', first + 1);
+  if (second == std::string::npos) {
+    std::cerr << "Invalid chunk sizes: '" << text
+              << "'.  " << see_usage << "\n";
+    exit(1);
+  }
+  settings.min_chunk_size = static_cast<uint32_t>(
+                   parse_size(text.substr(0, first), "chunk sizes"));
+  settings.block_size = static_cast<uint32_t>(parse_size(
+                   text.substr(first + 1, second - first - 1), "chunk sizes"));
+  settings.max_chunk_size = static_cast<uint32_t>(
+                   parse_size(text.substr(second + 1), "chunk sizes"));
+}
+
 static void set_scan_mode(const std::string& mode) {
   if (mode == "e") scan_mode = hashdb::scan_mode_t::EXPANDED;
   else if (mode == "o") scan_mode = hashdb::scan_mode_t::EXPANDED_OPTIMIZED;
   else if (mode == "c") scan_mode = hashdb::scan_mode_t::COUNT;
   else if (mode == "a") scan_mode = hashdb::scan_mode_t::APPROXIMATE_COUNT;
+  else if (mode == "s") has_scan_summary = true;
   else {
     std::cerr << "Invalid scan mode option: '" << mode
               << "'.  " << see_usage << "\n";
@@ -193,18 +297,57 @@ int main(int argc,char **argv) {
       {"version",                       no_argument, 0, 'v'},
       {"Version",                       no_argument, 0, 'V'},
       {"block_size",              required_argument, 0, 'b'},
+      {"block_hash_algorithm",    required_argument, 0, 'a'},
+      {"hash_data_format",        required_argument, 0, 'f'},
+      {"hash_shard_bits",         required_argument, 0, 'k'},
+      {"initial_map_size",        required_argument, 0, 'i'},
+      {"max_map_size",            required_argument, 0, 'm'},
+      {"sync_policy",             required_argument, 0, 'y'},
+      {"store_path",              required_argument, 0, 'd'},
       {"step_size",               required_argument, 0, 's'},
       {"repository_name",         required_argument, 0, 'r'},
       {"whitelist_dir",           required_argument, 0, 'w'},
       {"disable_processing",      required_argument, 0, 'x'},
       {"json_scan_mode",          required_argument, 0, 'j'},
       {"part_range",              required_argument, 0, 'p'},
+      {"num_threads",             required_argument, 0, 'n'},
+      {"num_shards",              required_argument, 0, 'S'},
+      {"source_hash_index",             no_argument, 0, 'I'},
+      {"similarity_index",              no_argument, 0, 'Y'},
+      {"count_index",                   no_argument, 0, 'U'},
+      {"change_log",                    no_argument, 0, 'C'},
+      {"recompute",                     no_argument, 0, 'R'},
+      {"skip_unchanged",                no_argument, 0, 'u'},
+      {"sample_fraction",         required_argument, 0, 'F'},
+      {"scan_around_hits",              no_argument, 0, 'A'},
+      {"quiet",                         no_argument, 0, 'q'},
+      {"hit_rate",                required_argument, 0, 'P'},
+      {"zipf_exponent",           required_argument, 0, 'z'},
+      {"duplicates_histogram",    required_argument, 0, 'D'},
+      {"metrics",                 required_argument, 0, 'M'},
+      {"warm",                          no_argument, 0, 'W'},
+      {"lock_hash_store",               no_argument, 0, 'l'},
+      {"direct_reads",                  no_argument, 0, 'O'},
+      {"checkpoint",              required_argument, 0, 'K'},
+      {"resume",                        no_argument, 0, 'Z'},
+      {"queue_depth",             required_argument, 0, 'Q'},
+      {"num_writers",             required_argument, 0, 'N'},
+      {"max_sources",             required_argument, 0, 'T'},
+      {"first_source",            required_argument, 0, 'G'},
+      {"compact_common",                no_argument, 0, 'X'},
+      {"max_pinned",              required_argument, 0, 'B'},
+      {"max_staleness",           required_argument, 0, 'L'},
+      {"min_entropy",             required_argument, 0, 'e'},
+      {"skip_labeled",                  no_argument, 0, 'o'},
+      {"memory_budget",           required_argument, 0, 'g'},
+      {"defer_hash_store",              no_argument, 0, 'J'},
+      {"format",                  required_argument, 0, 'c'},
 
       // end
       {0,0,0,0}
     };
 
-    int ch = getopt_long(argc, argv, "hHvVb:s:r:w:x:j:m:p:",
+    int ch = getopt_long(argc, argv, "hHvVb:a:f:k:i:m:y:d:s:r:w:x:j:p:n:S:IYUCRuF:AqP:z:D:M:WlOK:ZQ:N:T:G:XB:L:e:og:Jc:",
                          long_options, &option_index);
     if (ch == -1) {
       // no more arguments
@@ -234,15 +377,66 @@ int main(int argc,char **argv) {
         break;
       }
 
-      case 'b': {	// block size
+      case 'b': {	// block size or chunk sizes
         has_block_size = true;
-        settings.block_size = std::atoi(optarg);
+        set_block_size(optarg);
+        break;
+      }
+
+      case 'a': {	// block hash algorithm
+        has_block_hash_algorithm = true;
+        settings.block_hash_algorithm = optarg;
+        break;
+      }
+
+      case 'f': {	// hash data format
+        has_hash_data_format = true;
+        settings.hash_data_format = std::atoi(optarg);
+        break;
+      }
+
+      case 'k': {	// hash shard bits
+        has_hash_shard_bits = true;
+        settings.hash_shard_bits = std::atoi(optarg);
+        break;
+      }
+
+      case 'i': {	// initial map size
+        has_initial_map_size = true;
+        settings.initial_map_size = parse_size(std::string(optarg), "map size");
+        break;
+      }
+
+      case 'm': {	// max map size
+        has_max_map_size = true;
+        settings.max_map_size = parse_size(std::string(optarg), "map size");
+        break;
+      }
+
+      case 'y': {	// sync policy
+        has_sync_policy = true;
+        settings.sync_policy = std::string(optarg);
+        break;
+      }
+
+      case 'd': {	// store path, <store>=<directory>
+        has_store_path = true;
+        const std::string store_path(optarg);
+        const size_t equals = store_path.find('=');
+        if (equals == std::string::npos || equals == 0) {
+          std::cerr << "Invalid store path '" << store_path
+                    << "'.  Use <store>=<directory>.\n";
+          exit(1);
+        }
+        settings.store_paths[store_path.substr(0, equals)] =
+                                          store_path.substr(equals + 1);
         break;
       }
 
       case 's': {	// step size
         has_step_size = true;
         step_size = std::atoi(optarg);
+        step_size_list = std::string(optarg);
         break;
       }
 
@@ -300,6 +494,209 @@ int main(int argc,char **argv) {
         break;
       }
 
+      case 'n': {	// number of threads
+        has_num_threads = true;
+        num_threads = std::atoi(optarg);
+        break;
+      }
+
+      case 'S': {	// number of export shards
+        has_num_shards = true;
+        num_shards = std::atoi(optarg);
+        if (num_shards == 0) {
+          std::cerr << "Invalid value for number of shards: '"
+                    << optarg << "'\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'I': {	// source hash index
+        has_source_hash_index = true;
+        settings.source_hash_index = true;
+        break;
+      }
+
+      case 'Y': {	// similarity index
+        has_similarity_index = true;
+        settings.similarity_index = true;
+        break;
+      }
+
+      case 'U': {	// count index
+        has_count_index = true;
+        settings.count_index = true;
+        break;
+      }
+
+      case 'C': {	// change log
+        has_change_log = true;
+        settings.change_log = true;
+        break;
+      }
+
+      case 'R': {	// recompute statistics
+        has_recompute = true;
+        break;
+      }
+
+      case 'u': {	// skip unchanged files
+        has_skip_unchanged = true;
+        break;
+      }
+
+      case 'F': {	// sample fraction
+        has_sample_fraction = true;
+        sample_fraction = std::atof(optarg);
+        break;
+      }
+
+      case 'A': {	// scan around sampled hits
+        has_scan_around_hits = true;
+        break;
+      }
+
+      case 'q': {	// quiet
+        has_quiet = true;
+        break;
+      }
+
+      case 'W': {	// warm the DB before serving
+        has_warm = true;
+        break;
+      }
+
+      case 'l': {	// lock the hash store in memory
+        has_lock_hash_store = true;
+        break;
+      }
+
+      case 'O': {	// read media around the page cache
+        has_direct_reads = true;
+        break;
+      }
+
+      case 'K': {	// record progress to resume from
+        has_checkpoint = true;
+        checkpoint_file = std::string(optarg);
+        break;
+      }
+
+      case 'Z': {	// resume from the checkpoint
+        has_resume = true;
+        break;
+      }
+
+      case 'Q': {	// chunks each device may read ahead
+        has_queue_depth = true;
+        queue_depth = std::atoi(optarg);
+        if (queue_depth == 0) {
+          std::cerr << "Invalid queue depth: '" << optarg << "'\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'N': {	// staging hashdbs written in parallel
+        has_num_writers = true;
+        num_writers = std::atoi(optarg);
+        if (num_writers == 0 || num_writers > 255) {
+          std::cerr << "Invalid number of writers: '" << optarg << "'\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'T': {	// sources reported per hash
+        has_max_sources = true;
+        max_sources = std::atoi(optarg);
+        if (max_sources == 0) {
+          std::cerr << "Invalid max sources: '" << optarg << "'\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'G': {	// first source of a page of sources
+        has_first_source = true;
+        first_source = std::atoi(optarg);
+        break;
+      }
+
+      case 'X': {	// compact common block responses
+        has_compact_common = true;
+        break;
+      }
+
+      case 'B': {	// common blocks pinned
+        has_max_pinned = true;
+        max_pinned = std::atoi(optarg);
+        break;
+      }
+
+      case 'L': {	// snapshot age while the hashdb is imported into
+        has_max_staleness = true;
+        max_staleness_ms = static_cast<uint32_t>(
+                                 std::strtoul(optarg, NULL, 10));
+        break;
+      }
+
+      case 'e': {	// lowest k_entropy scanned
+        has_min_entropy = true;
+        min_k_entropy = std::strtoull(optarg, NULL, 10);
+        break;
+      }
+
+      case 'o': {	// skip labeled blocks when scanning
+        has_skip_labeled = true;
+        break;
+      }
+
+      case 'P': {	// benchmark hit rate
+        has_hit_rate = true;
+        hit_rate = std::atof(optarg);
+        break;
+      }
+
+      case 'z': {	// benchmark Zipf exponent
+        has_zipf_exponent = true;
+        zipf_exponent = std::atof(optarg);
+        break;
+      }
+
+      case 'D': {	// benchmark duplicates histogram
+        has_duplicates_histogram = true;
+        duplicates_histogram = std::string(optarg);
+        break;
+      }
+
+      case 'M': {	// serve live metrics, allowed for every command
+        has_metrics = true;
+        metrics_address = std::string(optarg);
+        break;
+      }
+
+      case 'J': {	// defer hash store maintenance
+        has_defer_hash_store = true;
+        break;
+      }
+
+      case 'c': {	// export format
+        has_format = true;
+        export_format = std::string(optarg);
+        if (export_format != "json" && export_format != "bin") {
+          std::cerr << "Invalid export format: '" << optarg
+                    << "'.  Use json or bin.\n";
+          exit(1);
+        }
+        break;
+      }
+
+      case 'g': {	// memory budget, allowed for every command
+        memory_budget = parse_size(std::string(optarg), "memory budget");
+        break;
+      }
+
       default:
 //        std::cerr << "unexpected command character " << ch << "\n";
         exit(1);
@@ -336,8 +733,25 @@ int main(int argc,char **argv) {
     return 0;
   }
 
+  // maybe serve live metrics while the command runs
+  if (has_metrics) {
+    const std::string error_message =
+                         hashdb::start_metrics_server(metrics_address);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // bound the memory of buffers, caches, and batches
+  hashdb::set_memory_budget(memory_budget);
+
+  // maybe skip hash store writes until imports close
+  hashdb::set_defer_hash_store(has_defer_hash_store);
+
   // run the command
   run_command();
+  hashdb::stop_metrics_server();
 
 #ifdef HAVE_MCHECK
   muntrace();
@@ -353,6 +767,34 @@ void check_options(const std::string& options) {
     std::cerr << "The -b block_size option is not allowed for this command.\n";
     exit(1);
   }
+  if (has_block_hash_algorithm && options.find("a") == std::string::npos) {
+    std::cerr << "The -a block_hash_algorithm option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_hash_data_format && options.find("f") == std::string::npos) {
+    std::cerr << "The -f hash_data_format option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_hash_shard_bits && options.find("k") == std::string::npos) {
+    std::cerr << "The -k hash_shard_bits option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_initial_map_size && options.find("i") == std::string::npos) {
+    std::cerr << "The -i initial_map_size option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_max_map_size && options.find("m") == std::string::npos) {
+    std::cerr << "The -m max_map_size option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_store_path && options.find("d") == std::string::npos) {
+    std::cerr << "The -d store_path option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_sync_policy && options.find("y") == std::string::npos) {
+    std::cerr << "The -y sync_policy option is not allowed for this command.\n";
+    exit(1);
+  }
   if (has_step_size && options.find("s") == std::string::npos) {
     std::cerr << "The -s step_size option is not allowed for this command.\n";
     exit(1);
@@ -377,10 +819,24 @@ void check_options(const std::string& options) {
     std::cerr << "The -x l disable calculate labels option is not allowed for this command.\n";
     exit(1);
   }
+  if (has_disable_nonprobative_hashes &&
+      options.find("L") == std::string::npos) {
+    std::cerr << "The -x n disable storing non-probative hashes option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_disable_nonprobative_hashes && has_disable_calculate_labels) {
+    std::cerr << "The -x n option requires block labels and is not allowed with -x l.\n";
+    exit(1);
+  }
   if (has_disable_calculate_labels && options.find("j") == std::string::npos) {
     std::cerr << "The -j JSON scan mode option is not allowed for this command.\n";
     exit(1);
   }
+  if (has_scan_summary && command != "scan_media" &&
+      command != "scan_media_list") {
+    std::cerr << "The -j s summary scan mode is not allowed for this command.\n";
+    exit(1);
+  }
   if (has_tuning && options.find("t") ==
       std::string::npos) {
     std::cerr << "The -t tuning option is not allowed for this command.\n";
@@ -391,6 +847,180 @@ void check_options(const std::string& options) {
     std::cerr << "The -p part range option is not allowed for this command.\n";
     exit(1);
   }
+  if (has_num_threads && options.find("n") ==
+      std::string::npos) {
+    std::cerr << "The -n num_threads option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_num_shards && options.find("S") ==
+      std::string::npos) {
+    std::cerr << "The -S num_shards option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_source_hash_index && options.find("I") ==
+      std::string::npos) {
+    std::cerr << "The -I source_hash_index option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_similarity_index && options.find("Y") ==
+      std::string::npos) {
+    std::cerr << "The -Y similarity_index option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_count_index && options.find("U") ==
+      std::string::npos) {
+    std::cerr << "The -U count_index option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_change_log && options.find("C") ==
+      std::string::npos) {
+    std::cerr << "The -C change_log option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_recompute && options.find("R") ==
+      std::string::npos) {
+    std::cerr << "The -R recompute option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_skip_unchanged && options.find("u") ==
+      std::string::npos) {
+    std::cerr << "The -u skip_unchanged option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_sample_fraction && options.find("F") ==
+      std::string::npos) {
+    std::cerr << "The -F sample_fraction option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_scan_around_hits && options.find("A") ==
+      std::string::npos) {
+    std::cerr << "The -A scan_around_hits option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_quiet && options.find("q") ==
+      std::string::npos) {
+    std::cerr << "The -q quiet option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_warm && options.find("W") ==
+      std::string::npos) {
+    std::cerr << "The -W warm option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_lock_hash_store && options.find("l") ==
+      std::string::npos) {
+    std::cerr << "The -l lock_hash_store option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_direct_reads && options.find("O") ==
+      std::string::npos) {
+    std::cerr << "The -O direct_reads option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_checkpoint && options.find("K") ==
+      std::string::npos) {
+    std::cerr << "The -K checkpoint option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_resume && options.find("Z") ==
+      std::string::npos) {
+    std::cerr << "The -Z resume option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_queue_depth && options.find("Q") ==
+      std::string::npos) {
+    std::cerr << "The -Q queue_depth option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_num_writers && options.find("N") ==
+      std::string::npos) {
+    std::cerr << "The -N num_writers option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_max_sources && options.find("T") ==
+      std::string::npos) {
+    std::cerr << "The -T max_sources option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_first_source && options.find("G") ==
+      std::string::npos) {
+    std::cerr << "The -G first_source option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_compact_common && options.find("X") ==
+      std::string::npos) {
+    std::cerr << "The -X compact_common option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_max_pinned && options.find("B") ==
+      std::string::npos) {
+    std::cerr << "The -B max_pinned option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_max_staleness && options.find("L") ==
+      std::string::npos) {
+    std::cerr << "The -L max_staleness option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_min_entropy && options.find("e") ==
+      std::string::npos) {
+    std::cerr << "The -e min_entropy option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_skip_labeled && options.find("o") ==
+      std::string::npos) {
+    std::cerr << "The -o skip_labeled option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_defer_hash_store && options.find("J") ==
+      std::string::npos) {
+    std::cerr << "The -J defer_hash_store option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_format && options.find("c") == std::string::npos) {
+    std::cerr << "The -c format option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_resume && !has_checkpoint) {
+    std::cerr << "The -Z resume option requires the -K checkpoint option.\n";
+    exit(1);
+  }
+  if (has_hit_rate && options.find("P") ==
+      std::string::npos) {
+    std::cerr << "The -P hit_rate option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_zipf_exponent && options.find("z") ==
+      std::string::npos) {
+    std::cerr << "The -z zipf_exponent option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_duplicates_histogram && options.find("D") ==
+      std::string::npos) {
+    std::cerr << "The -D duplicates_histogram option is not allowed for this command.\n";
+    exit(1);
+  }
+  if (has_zipf_exponent && has_duplicates_histogram) {
+    std::cerr << "The -z zipf_exponent and -D duplicates_histogram options cannot be used together.\n";
+    exit(1);
+  }
+  if (has_hit_rate && !(hit_rate >= 0.0 && hit_rate <= 1.0)) {
+    std::cerr << "Invalid hit rate.  " << see_usage << "\n";
+    exit(1);
+  }
+  if (has_zipf_exponent && !(zipf_exponent > 0.0)) {
+    std::cerr << "Invalid Zipf exponent.  " << see_usage << "\n";
+    exit(1);
+  }
+  if (has_scan_around_hits && !has_sample_fraction) {
+    std::cerr << "The -A scan_around_hits option requires the -F sample_fraction option.\n";
+    exit(1);
+  }
+  if (has_sample_fraction && !(sample_fraction > 0.0 &&
+                               sample_fraction <= 1.0)) {
+    std::cerr << "Invalid sample fraction.  " << see_usage << "\n";
+    exit(1);
+  }
 }
 
 void check_params(const std::string& options, size_t param_count) {
@@ -407,41 +1037,159 @@ void run_command() {
 
   // new database
   if (command == "create") {
-    check_params("bamt", 1);
+    check_params("bamtfkiydIYUC", 1);
     commands::create(args[0], settings, cmd);
 
+  } else if (command == "migrate") {
+    check_params("f", 1);
+    commands::migrate(args[0], has_hash_data_format ?
+                      settings.hash_data_format : 2, cmd);
+
+  } else if (command == "compress_names") {
+    check_params("", 1);
+    commands::compress_names(args[0], cmd);
+
+  } else if (command == "optimize") {
+    check_params("", 1);
+    commands::optimize(args[0], cmd);
+
+  } else if (command == "rebuild_hash_store") {
+    check_params("", 1);
+    commands::rebuild_hash_store(args[0], cmd);
+
+  } else if (command == "freeze") {
+    check_params("", 2);
+    commands::freeze(args[0], args[1], cmd);
+
   // import
   } else if (command == "ingest") {
-    check_params("srwREL", 2);
+    check_options("srwRELuqOKZNJ");
+    // check param count, one or more hashdbs and then the import path
+    if (args.size() < 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
+    }
+    if (num_writers > 1 && (args.size() > 2 || has_skip_unchanged ||
+                            has_checkpoint)) {
+      std::cerr << "The -N num_writers option requires a single hashdb and is not allowed with -u or -K.\n";
+      exit(1);
+    }
+    if (args.back() == "-" && (num_writers > 1 || has_skip_unchanged ||
+                               has_checkpoint)) {
+      std::cerr << "Ingesting from stdin is not allowed with -u, -K, or -N.\n";
+      exit(1);
+    }
+    const std::vector<std::string> hashdb_dirs(args.begin(), args.end() - 1);
+
+    // one step size for all hashdbs, else a comma-separated list of one
+    // for each
+    std::vector<size_t> step_sizes(hashdb_dirs.size(), step_size);
+    if (step_size_list.find(',') != std::string::npos) {
+      step_sizes.clear();
+      std::stringstream ss(step_size_list);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+        step_sizes.push_back(std::atoi(item.c_str()));
+      }
+      if (step_sizes.size() != hashdb_dirs.size()) {
+        std::cerr << "The -s step_size option must have one step size for each hashdb.\n";
+        exit(1);
+      }
+    }
     if (repository_name == "") {
-      repository_name = args[1];
+      repository_name = (args.back() == "-") ? "stdin" : args.back();
     }
-    commands::ingest(args[0], args[1], step_size,
+    commands::ingest(hashdb_dirs, args.back(), step_sizes,
              repository_name, whitelist_dir,
              has_disable_recursive_processing,
              has_disable_calculate_entropy,
              has_disable_calculate_labels,
+             has_disable_nonprobative_hashes,
+             has_skip_unchanged,
+             has_direct_reads,
+             has_quiet,
+             checkpoint_file, has_resume,
+             num_writers,
              cmd);
 
   } else if (command == "import_tab") {
-    check_params("rw", 2);
+    check_params("rwJ", 2);
     if (repository_name == "") {
       repository_name = args[1];
     }
     commands::import_tab(args[0], args[1], repository_name, whitelist_dir, cmd);
 
   } else if (command == "import") {
-    check_params("", 2);
-    commands::import_json(args[0], args[1], cmd);
+    check_params("nJ", 2);
+    commands::import_json(args[0], args[1], num_threads, cmd);
 
   } else if (command == "export") {
-    check_params("p", 2);
-    if (has_part_range) {
+    check_params("pnSc", 2);
+    if (has_part_range && (has_num_threads || has_num_shards)) {
+      std::cerr << "The -p part range option is not allowed with -n or -S.\n";
+      exit(1);
+    }
+    if (export_format == "bin" &&
+        (has_part_range || has_num_threads || has_num_shards)) {
+      std::cerr << "The bin export format is not allowed with -p, -n, or -S.\n";
+      exit(1);
+    }
+    if (export_format == "bin") {
+      commands::export_bin(args[0], args[1], cmd);
+    } else if (has_part_range) {
       commands::export_json_range(args[0], args[1],
                                   begin_block_hash, end_block_hash, cmd);
     } else {
-      commands::export_json(args[0], args[1], cmd);
+      commands::export_json(args[0], args[1], num_shards, num_threads, cmd);
+    }
+
+  } else if (command == "export_changes") {
+    check_params("", 2);
+    commands::export_changes(args[0], args[1]);
+
+  } else if (command == "apply_changes") {
+    check_params("", 2);
+    commands::apply_changes(args[0], args[1], cmd);
+
+  } else if (command == "export_filter") {
+    check_params("", 2);
+    commands::export_filter(args[0], args[1]);
+
+  } else if (command == "ingest_runs") {
+    check_params("srwRELqOS", 3);
+    if (num_shards > MAX_RUN_PARTITIONS) {
+      std::cerr << "The -S option allows at most " << MAX_RUN_PARTITIONS
+                << " partitions.\n";
+      exit(1);
+    }
+    if (repository_name == "") {
+      repository_name = args[1];
+    }
+    commands::ingest_runs(args[0], args[1], step_size, repository_name,
+                          whitelist_dir, has_disable_recursive_processing,
+                          has_disable_calculate_entropy,
+                          has_disable_calculate_labels,
+                          has_disable_nonprobative_hashes, has_direct_reads,
+                          has_quiet, num_shards, args[2], cmd);
+
+  } else if (command == "export_runs") {
+    check_params("S", 2);
+    if (num_shards > MAX_RUN_PARTITIONS) {
+      std::cerr << "The -S option allows at most " << MAX_RUN_PARTITIONS
+                << " partitions.\n";
+      exit(1);
+    }
+    commands::export_runs(args[0], num_shards, args[1], cmd);
+
+  } else if (command == "load_runs") {
+    check_options("J");
+    // check param count, the hashdb and then one or more runs
+    if (args.size() < 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
     }
+    commands::load_runs(args[0], std::vector<std::string>(args.begin() + 1,
+                        args.end()), cmd);
 
   // database manipulation
   } else if (command == "add") {
@@ -499,36 +1247,109 @@ void run_command() {
     check_params("", 3);
     commands::subtract_repository(args[0], args[1], args[2], cmd);
 
+  } else if (command == "remove_source") {
+    check_params("", 2);
+    commands::remove_source(args[0], args[1], cmd);
+
+  } else if (command == "remove_hash") {
+    check_params("", 2);
+    commands::remove_hash(args[0], args[1], cmd);
+
   // scan
   } else if (command == "scan_list") {
-    check_params("j", 2);
-    commands::scan_list(args[0], args[1], scan_mode, cmd);
+    check_params("jnTX", 2);
+    commands::scan_list(args[0], args[1], scan_mode, num_threads,
+                        max_sources, has_compact_common, cmd);
 
   } else if (command == "scan_hash") {
-    check_params("j", 2);
-    commands::scan_hash(args[0], args[1], scan_mode, cmd);
+    check_params("jTGX", 2);
+    commands::scan_hash(args[0], args[1], scan_mode, max_sources,
+                        has_first_source, first_source, has_compact_common,
+                        cmd);
+
+  } else if (command == "similar") {
+    check_params("T", 2);
+    commands::similar(args[0], args[1], max_sources, cmd);
 
   } else if (command == "scan_media") {
-    check_params("sRj", 2);
-    commands::scan_media(args[0], args[1], step_size,
-                         has_disable_recursive_processing, scan_mode, cmd);
+    check_options("sRjFAqOKZeo");
+    // check param count, one or more hashdbs and then the media image
+    if (args.size() < 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
+    }
+    if (has_checkpoint && has_sample_fraction) {
+      std::cerr << "The -K checkpoint option is not allowed with the -F sample_fraction option.\n";
+      exit(1);
+    }
+    if (args.size() > 2 && has_sample_fraction) {
+      std::cerr << "The -F sample_fraction option is not allowed with more than one hashdb.\n";
+      exit(1);
+    }
+    if (has_scan_summary && (has_checkpoint || has_sample_fraction)) {
+      std::cerr << "The -j s summary scan mode is not allowed with the -K checkpoint or -F sample_fraction option.\n";
+      exit(1);
+    }
+    commands::scan_media(std::vector<std::string>(args.begin(),
+                         args.end() - 1), args.back(), step_size,
+                         has_disable_recursive_processing, scan_mode,
+                         min_k_entropy, has_skip_labeled, has_scan_summary,
+                         sample_fraction, has_scan_around_hits,
+                         has_direct_reads, has_quiet, checkpoint_file,
+                         has_resume, cmd);
+
+  } else if (command == "scan_media_list") {
+    check_options("sRjqOQeo");
+    // check param count, one or more hashdbs and then the media list file
+    if (args.size() < 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
+    }
+    commands::scan_media_list(std::vector<std::string>(args.begin(),
+                              args.end() - 1), args.back(), step_size,
+                              has_disable_recursive_processing, scan_mode,
+                              min_k_entropy, has_skip_labeled,
+                              has_scan_summary, has_direct_reads, has_quiet,
+                              queue_depth, cmd);
+
+  } else if (command == "server") {
+    check_params("jnWlL", 2);
+    commands::server(args[0], args[1], scan_mode, num_threads, has_warm,
+                     has_lock_hash_store, max_staleness_ms, cmd);
+
+  } else if (command == "warm") {
+    check_params("n", 1);
+    commands::warm(args[0], num_threads, cmd);
+
+  } else if (command == "pin_common") {
+    check_params("B", 2);
+    commands::pin_common(args[0], args[1], max_pinned, cmd);
 
   // statistics
   } else if (command == "size") {
     check_params("", 1);
     commands::size(args[0], cmd);
 
+  } else if (command == "estimate") {
+    check_options("");
+    // check param count, one hashdb or two
+    if (args.size() != 1 && args.size() != 2) {
+      std::cerr << "The number of paramters provided is not valid for this command.\n";
+      exit(1);
+    }
+    commands::estimate(args[0], (args.size() == 2) ? args[1] : "", cmd);
+
   } else if (command == "sources") {
     check_params("", 1);
     commands::sources(args[0], cmd);
 
   } else if (command == "histogram") {
-    check_params("", 1);
-    commands::histogram(args[0], cmd);
+    check_params("R", 1);
+    commands::histogram(args[0], has_recompute, cmd);
 
   } else if (command == "duplicates") {
-    check_params("j", 2);
-    commands::duplicates(args[0], args[1], scan_mode, cmd);
+    check_params("jR", 2);
+    commands::duplicates(args[0], args[1], scan_mode, has_recompute, cmd);
 
   } else if (command == "hash_table") {
     check_params("j", 2);
@@ -538,6 +1359,10 @@ void run_command() {
     check_params("", 3);
     commands::read_media(args[0], args[1], args[2]);
 
+  } else if (command == "read_media_list") {
+    check_params("", 3);
+    commands::read_media_list(args[0], args[1], args[2]);
+
   } else if (command == "read_media_size") {
     check_params("", 1);
     commands::read_media_size(args[0]);
@@ -559,6 +1384,22 @@ void run_command() {
     check_params("j", 2);
     commands::scan_same(args[0], args[1], scan_mode, cmd);
 
+  } else if (command == "benchmark") {
+    check_params("bamtfkiyICjnPzD", 2);
+    commands::benchmark(args[0], settings, args[1], scan_mode,
+                        num_threads, hit_rate, zipf_exponent,
+                        duplicates_histogram, cmd);
+
+  } else if (command == "benchmark_scan_stream") {
+    check_params("jnP", 4);
+    commands::benchmark_scan_stream(args[0], scan_mode, num_threads,
+                                    hit_rate, args[1], args[2], args[3],
+                                    cmd);
+
+  } else if (command == "benchmark_read") {
+    check_params("nQ", 1);
+    commands::benchmark_read(args[0], num_threads, queue_depth, cmd);
+
   } else if (command == "test_scan_stream") {
     check_params("j", 2);
     commands::test_scan_stream(args[0], args[1], scan_mode, cmd);
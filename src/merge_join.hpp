@@ -0,0 +1,153 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Walk the hashes of several hashdbs together in key order.
+ *
+ * Each hashdb is walked once with a hash_iterator_t.  Inputs are kept in
+ * a heap ordered by their current hash, so each step takes the smallest
+ * hash and every input that has it, in input order.
+ */
+
+#ifndef MERGE_JOIN_HPP
+#define MERGE_JOIN_HPP
+
+#include "../src_libhashdb/hashdb.hpp"
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <algorithm>
+
+class merge_join_t {
+  public:
+
+  // the current hash of one input
+  struct record_t {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    record_t() : block_hash(), k_entropy(0), block_label(), count(0),
+                 source_sub_counts() {
+    }
+  };
+
+  private:
+
+  // an input walks its DB and holds its current hash
+  struct input_t {
+    const size_t index;
+    hashdb::hash_iterator_t hash_iterator;
+    record_t record;
+
+    input_t(const size_t p_index,
+            const hashdb::scan_manager_t& scan_manager) :
+                  index(p_index), hash_iterator(scan_manager), record() {
+    }
+
+    // read the next hash, false when depleted
+    bool next() {
+      return hash_iterator.next(record.block_hash, record.k_entropy,
+                                record.block_label, record.count,
+                                record.source_sub_counts);
+    }
+
+    private:
+    // do not allow copy or assignment
+    input_t(const input_t&);
+    input_t& operator=(const input_t&);
+  };
+
+  // heap order, smallest hash first, then input order
+  static bool later(const input_t* const a, const input_t* const b) {
+    const int compare = a->record.block_hash.compare(b->record.block_hash);
+    return (compare != 0) ? (compare > 0) : (a->index > b->index);
+  }
+
+  std::vector<input_t*> inputs;
+  std::vector<input_t*> heap;           // inputs with a current hash
+  std::vector<input_t*> matched;        // inputs at the returned hash
+
+  // do not allow copy or assignment
+  merge_join_t(const merge_join_t&);
+  merge_join_t& operator=(const merge_join_t&);
+
+  // put an input into the heap unless it is depleted
+  void advance(input_t* const input) {
+    if (input->next()) {
+      heap.push_back(input);
+      std::push_heap(heap.begin(), heap.end(), later);
+    }
+  }
+
+  public:
+  merge_join_t(const std::vector<const hashdb::scan_manager_t*>& managers) :
+                  inputs(), heap(), matched() {
+    for (size_t i=0; i<managers.size(); ++i) {
+      inputs.push_back(new input_t(i, *managers[i]));
+      matched.push_back(inputs.back());
+    }
+  }
+
+  ~merge_join_t() {
+    for (size_t i=0; i<inputs.size(); ++i) {
+      delete inputs[i];
+    }
+  }
+
+  /**
+   * Move to the next hash in any input.  Set records to the record of
+   * the hash for each input that has it and NULL for each input that
+   * does not.  Records are valid until the next call.
+   *
+   * Returns:
+   *   False when all inputs are depleted.
+   */
+  bool next(std::vector<const record_t*>& records) {
+
+    // read past the hash that was returned last
+    for (size_t i=0; i<matched.size(); ++i) {
+      advance(matched[i]);
+    }
+    matched.clear();
+
+    records.assign(inputs.size(), NULL);
+    if (heap.size() == 0) {
+      return false;
+    }
+
+    // take every input at the smallest hash
+    const std::string block_hash = heap.front()->record.block_hash;
+    while (heap.size() != 0 &&
+           heap.front()->record.block_hash == block_hash) {
+      std::pop_heap(heap.begin(), heap.end(), later);
+      input_t* const input = heap.back();
+      heap.pop_back();
+      records[input->index] = &input->record;
+      matched.push_back(input);
+    }
+    return true;
+  }
+};
+
+#endif
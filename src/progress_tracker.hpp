@@ -20,8 +20,14 @@
 /**
  * \file
  * Track progress to show that long iterative actions are not hung.
- * Writes progress to cout and to <dir>/timestamp.json log.
- * Use total=0 if total is not known.
+ * Writes progress to cout and to <dir>/timestamp.json log, ending with
+ * the stage statistics of the process.
+ * Use total=0 if total is not known.  Tracking is threadsafe.
+ *
+ * Tracking only adds to a relaxed atomic count, so that loops over every
+ * hash pay one increment.  A reporter thread samples the count every
+ * progress_interval_seconds and shows it with its rate and, when the
+ * total is known, the estimated time left.
  */
 
 #ifndef PROGRESS_TRACKER_HPP
@@ -35,33 +41,86 @@
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <stdint.h>
+#include <sys/time.h>
+#include <pthread.h>
 #include "../src_libhashdb/hashdb.hpp" // for timestamp
 
 class progress_tracker_t {
   private:
+  static const uint32_t progress_interval_seconds = 5;
+
   const std::string dir;
   const uint64_t total;
-  uint64_t index;
+  std::atomic<uint64_t> index;
   std::ofstream os;
   hashdb::timestamp_t timestamp;
+  bool stopping;
+  pthread_t reporter;
+  pthread_mutex_t M;       // guards stopping
+  pthread_cond_t cond;     // signals stopping
 
   // do not allow copy or assignment
   progress_tracker_t(const progress_tracker_t&);
   progress_tracker_t& operator=(const progress_tracker_t&);
 
-  void show_progress() {
+  static double now_seconds() {
+    struct timeval t;
+    gettimeofday(&t, 0);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+  }
+
+  void show_progress(const uint64_t count, const double rate) {
     std::stringstream ss;
     if (total > 0) {
       // total is known
-      ss << "# Processing " << index << " of " << total;
+      ss << "# Processing " << count << " of " << total;
     } else {
       // total is not known
-      ss << "# Processing " << index << " of ?";
+      ss << "# Processing " << count << " of ?";
+    }
+    ss << " (" << static_cast<uint64_t>(rate) << " per second";
+    if (total > count && rate > 0) {
+      ss << ", about " << static_cast<uint64_t>((total - count) / rate)
+         << " seconds left";
     }
+    ss << ")";
     std::cout << ss.str() << "..." << std::endl;
     os << timestamp.stamp(ss.str()) << std::endl;
   }
 
+  // show progress every interval that the count moves until stopped
+  static void* run_reporter(void* const p_tracker) {
+    progress_tracker_t* const tracker =
+                            static_cast<progress_tracker_t*>(p_tracker);
+    double last_time = now_seconds();
+    uint64_t last_count = 0;
+    pthread_mutex_lock(&tracker->M);
+    while (!tracker->stopping) {
+      struct timeval t_now;
+      gettimeofday(&t_now, 0);
+      timespec deadline;
+      deadline.tv_sec = t_now.tv_sec + progress_interval_seconds;
+      deadline.tv_nsec = t_now.tv_usec * 1000;
+      pthread_cond_timedwait(&tracker->cond, &tracker->M, &deadline);
+      if (tracker->stopping) {
+        break;
+      }
+      const uint64_t count =
+                  tracker->index.load(std::memory_order_relaxed);
+      const double time = now_seconds();
+      if (count != last_count && time > last_time) {
+        tracker->show_progress(count, (count - last_count) /
+                                      (time - last_time));
+        last_count = count;
+        last_time = time;
+      }
+    }
+    pthread_mutex_unlock(&tracker->M);
+    return NULL;
+  }
+
   public:
   progress_tracker_t(const std::string& p_dir, const uint64_t p_total,
                      const std::string& cmd) :
@@ -69,7 +128,13 @@ class progress_tracker_t {
                          total(p_total),
                          index(0),
                          os(),
-                         timestamp() {
+                         timestamp(),
+                         stopping(false),
+                         reporter(),
+                         M(),
+                         cond() {
+    pthread_mutex_init(&M, NULL);
+    pthread_cond_init(&cond, NULL);
     std::string filename(dir+"/timestamp.json");
 
     // open, fatal if unable to open
@@ -83,21 +148,20 @@ class progress_tracker_t {
     // put header in log
     os << "# command: '" << cmd << "'\n"
        << "# hashdb-Version: " << PACKAGE_VERSION << "\n";
+
+    if (pthread_create(&reporter, NULL, run_reporter,
+                       static_cast<void*>(this)) != 0) {
+      std::cout << "Cannot start progress tracker thread.\n";
+      exit(1);
+    }
   }
 
   void track() {
-    ++index;
-    if (index%100000 == 0) {
-      show_progress();
-    }
+    index.fetch_add(1, std::memory_order_relaxed);
   }
 
   void track_count(const size_t count) {
-    size_t old_index = index;
-    index += count;
-    if ((index > 0) && (index / 100000 > old_index / 100000)) {
-      show_progress();
-    }
+    index.fetch_add(count, std::memory_order_relaxed);
   }
 
   void track_hash_data(const uint64_t count) {
@@ -107,18 +171,31 @@ class progress_tracker_t {
   }
 
   ~progress_tracker_t() {
+    // stop the reporter
+    pthread_mutex_lock(&M);
+    stopping = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&M);
+    pthread_join(reporter, NULL);
+
+    const uint64_t count = index.load();
     std::stringstream ss;
     if (total > 0) {
       // total is known
-      ss << "# Processing " << index << " of " << total << " completed.";
+      ss << "# Processing " << count << " of " << total << " completed.";
     } else {
       // total is not known
-      ss << "# Processing " << index << " of " << index << " completed.";
+      ss << "# Processing " << count << " of " << count << " completed.";
     }
     std::cout << ss.str() << std::endl;
     os << timestamp.stamp(ss.str()) << std::endl;
 
+    // stage latencies and lookup counts of this process
+    os << "# stage_stats: " << hashdb::stage_stats_json() << std::endl;
+
     os.close();
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&M);
   }
 };
 
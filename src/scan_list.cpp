@@ -39,20 +39,58 @@
 #endif
 
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cassert>
+#include <pthread.h>
 #include "../src_libhashdb/hashdb.hpp"
 
-void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
-               const hashdb::scan_mode_t scan_mode) {
+// number of input lines in one chunk, scanned in one batch
+static const size_t SCAN_CHUNK_SIZE = 10000;
 
-  size_t line_number = 0;
-  std::string line;
-  while(getline(in, line)) {
-    ++line_number;
+// A chunk of input lines, scanned by one thread.  Results stay in line
+// order so chunks are printed in input order.
+struct scan_chunk_t {
+  hashdb::scan_manager_t* manager;
+  hashdb::scan_mode_t scan_mode;   // the mode the chunk is scanned in
+  size_t line_number;              // the line number of the first line
+  std::vector<std::string> lines;
+
+  // printed text of each entry, followed by its scan result if a hash
+  std::vector<std::string> texts;
+  std::vector<std::string> results;
+  std::vector<bool> is_hash;
+
+  std::string errors;              // errors to print in order
+  pthread_t thread;
+
+  scan_chunk_t() : manager(NULL), scan_mode(hashdb::scan_mode_t::EXPANDED),
+                   line_number(0), lines(), texts(), results(), is_hash(),
+                   errors(), thread() {
+  }
+
+  private:
+  // do not allow copy or assignment
+  scan_chunk_t(const scan_chunk_t&);
+  scan_chunk_t& operator=(const scan_chunk_t&);
+};
+
+// parse the lines of a chunk and look up their hashes in one batch
+static void* scan_chunk(void* const arg) {
+  scan_chunk_t* const chunk = static_cast<scan_chunk_t*>(arg);
+  std::stringstream errors;
+  std::vector<std::string> binary_hashes;
+  std::vector<size_t> hash_entries;
 
-    // print comment lines
+  for (size_t i=0; i<chunk->lines.size(); ++i) {
+    const std::string& line = chunk->lines[i];
+    const size_t line_number = chunk->line_number + i;
+
+    // forward comment lines
     if (line[0] == '#') {
-      // forward to stdout
-      std::cout << line << "\n";
+      chunk->texts.push_back(line);
+      chunk->is_hash.push_back(false);
       continue;
     }
 
@@ -64,30 +102,117 @@ void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
     // find tabs
     size_t tab_index1 = line.find('\t');
     if (tab_index1 == std::string::npos) {
-      std::cerr << "Tab not found on line " << line_number << ": '" << line << "'\n";
+      errors << "Tab not found on line " << line_number << ": '" << line << "'\n";
       continue;
     }
 
-    // get label
-    std::string label = line.substr(0, tab_index1);
-
     // get block hash
-    std::string block_hashdigest_string = line.substr(tab_index1+1);
-    std::string block_binary_hash = hashdb::hex_to_bin(block_hashdigest_string);
+    std::string block_binary_hash = hashdb::hex_to_bin(
+                                            line.substr(tab_index1+1));
     if (block_binary_hash == "") {
-      std::cerr << "Invalid block hash on line " << line_number
-                << ": '" << line << "'\n";
+      errors << "Invalid block hash on line " << line_number
+             << ": '" << line << "'\n";
       continue;
     }
 
-    // scan
-    const std::string expanded_text = manager.find_hash_json(
-                                              scan_mode, block_binary_hash);
-    if (expanded_text.size() != 0) {
-      std::cout << label << "\t"
-                << block_hashdigest_string << "\t"
-                << expanded_text << std::endl;
+    // the label and hash digest are printed before the result
+    hash_entries.push_back(chunk->texts.size());
+    chunk->texts.push_back(line);
+    chunk->is_hash.push_back(true);
+    binary_hashes.push_back(block_binary_hash);
+  }
+
+  // scan the hashes together
+  chunk->results.resize(chunk->texts.size());
+  const std::vector<std::string> scanned_texts =
+                chunk->manager->find_hashes_json(chunk->scan_mode,
+                                                 binary_hashes);
+  for (size_t j=0; j<scanned_texts.size(); ++j) {
+    chunk->results[hash_entries[j]] = scanned_texts[j];
+  }
+  chunk->lines.clear();
+  chunk->errors = errors.str();
+  return NULL;
+}
+
+// print a scanned chunk in order, formatting binary results if optimizing
+static void print_chunk(hashdb::scan_manager_t& manager,
+                        const bool optimizing,
+                        const scan_chunk_t& chunk) {
+  std::string output;
+  for (size_t i=0; i<chunk.texts.size(); ++i) {
+    if (!chunk.is_hash[i]) {
+      output += chunk.texts[i];
+      output += "\n";
+      continue;
     }
+    if (chunk.results[i].size() == 0) {
+      continue;
+    }
+    output += chunk.texts[i];
+    output += "\t";
+    output += optimizing ? manager.hash_binary_json(chunk.results[i], true)
+                         : chunk.results[i];
+    output += "\n";
   }
+  std::cerr << chunk.errors;
+  std::cout.write(output.data(), output.size());
 }
 
+void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
+               const hashdb::scan_mode_t scan_mode,
+               const size_t num_threads) {
+
+  const size_t num_chunks = (num_threads == 0) ? hashdb::num_cpus()
+                                               : num_threads;
+
+  // Optimized scans are looked up in parallel as binary records and
+  // formatted in input order so the first occurrence of each hash and
+  // source is the one reported.
+  const bool optimizing =
+                  (scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED);
+  const hashdb::scan_mode_t chunk_scan_mode =
+                  optimizing ? hashdb::scan_mode_t::BINARY : scan_mode;
+
+  size_t line_number = 0;
+  std::string line;
+  bool more = true;
+  while (more) {
+
+    // read a chunk for each thread
+    std::vector<scan_chunk_t*> chunks;
+    while (more && chunks.size() < num_chunks) {
+      scan_chunk_t* const chunk = new scan_chunk_t;
+      chunk->manager = &manager;
+      chunk->scan_mode = chunk_scan_mode;
+      chunk->line_number = line_number + 1;
+      while (chunk->lines.size() < SCAN_CHUNK_SIZE) {
+        if (!getline(in, line)) {
+          more = false;
+          break;
+        }
+        ++line_number;
+        chunk->lines.push_back(line);
+      }
+      chunks.push_back(chunk);
+    }
+
+    // scan the chunks concurrently, the first one in this thread
+    for (size_t i=1; i<chunks.size(); ++i) {
+      if (pthread_create(&chunks[i]->thread, NULL, scan_chunk, chunks[i])) {
+        std::cerr << "Error creating scan thread.\n";
+        assert(0);
+      }
+    }
+    scan_chunk(chunks[0]);
+    for (size_t i=1; i<chunks.size(); ++i) {
+      pthread_join(chunks[i]->thread, NULL);
+    }
+
+    // print the chunks in order
+    for (size_t i=0; i<chunks.size(); ++i) {
+      print_chunk(manager, optimizing, *chunks[i]);
+      delete chunks[i];
+    }
+  }
+}
@@ -27,9 +27,12 @@
 #define SCAN_LIST_HPP
 
 #include <iostream>
+#include <cstddef>
 #include "../src_libhashdb/hashdb.hpp"
 
+// Scan with num_threads threads, or one per CPU if 0.
 void scan_list(hashdb::scan_manager_t& manager, std::istream& in,
-               const hashdb::scan_mode_t scan_mode);
+               const hashdb::scan_mode_t scan_mode,
+               const size_t num_threads);
 
 #endif
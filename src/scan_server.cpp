@@ -0,0 +1,628 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Serve scans of one database to many clients over TCP, see
+ * scan_server.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <csignal>
+#include <stdint.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+#include "../src_libhashdb/hashdb.hpp"
+#include "scan_server.hpp"
+
+#ifdef WIN32
+void scan_server(const std::string& /*hashdb_dir*/,
+                 const std::string& /*address*/,
+                 const hashdb::scan_mode_t /*scan_mode*/,
+                 const size_t /*num_threads*/,
+                 const bool /*warm*/,
+                 const bool /*lock_hash_store*/,
+                 const uint32_t /*max_staleness_ms*/) {
+  std::cerr << "Error: the server command is not available on Windows.\n";
+  exit(1);
+}
+#else
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const size_t HEADER_SIZE = 16;
+static const uint32_t MAX_PAYLOAD_SIZE = 64 * 1024 * 1024;
+
+// the most request bytes to scan together, and the most batches of a
+// connection to have in flight before reading stops
+static const size_t MAX_BATCH_SIZE = 4 * 1024 * 1024;
+static const size_t MAX_IN_FLIGHT = 4;
+
+// the response bytes of a connection beyond which reading stops
+static const size_t MAX_PENDING_OUTPUT = 16 * 1024 * 1024;
+
+static const uint32_t STATUS_OK = 0;
+static const uint32_t STATUS_MALFORMED = 1;
+
+// set by the signal handler, which also writes to the wake pipe
+static volatile sig_atomic_t stop_requested = 0;
+static int wake_write_fd = -1;
+
+static void handle_stop(int) {
+  stop_requested = 1;
+  const char c = 0;
+  if (write(wake_write_fd, &c, 1) < 0) {
+    // the loop will see stop_requested when it next wakes
+  }
+}
+
+static uint64_t get_le(const char* const p, const size_t size) {
+  uint64_t value = 0;
+  for (size_t i=size; i>0; --i) {
+    value = (value << 8) | static_cast<uint8_t>(p[i-1]);
+  }
+  return value;
+}
+
+static void put_le(std::string& s, uint64_t value, const size_t size) {
+  for (size_t i=0; i<size; ++i) {
+    s += static_cast<char>(value & 0xff);
+    value >>= 8;
+  }
+}
+
+struct request_t {
+  uint64_t request_id;
+  uint32_t hash_size;
+  std::string payload;
+  request_t() : request_id(0), hash_size(0), payload() {
+  }
+};
+
+// the complete requests read from one connection at one time
+struct batch_t {
+  uint64_t connection_id;
+  std::vector<request_t> requests;
+  std::string responses;
+  batch_t() : connection_id(0), requests(), responses() {
+  }
+};
+
+struct connection_t {
+  int fd;
+  std::string input;
+  std::string output;
+  size_t output_offset;
+  size_t in_flight;
+  bool read_closed;
+  connection_t(const int p_fd) : fd(p_fd), input(), output(),
+                output_offset(0), in_flight(0), read_closed(false) {
+  }
+};
+
+// the batches waiting for and returned from the workers
+class batch_queue_t {
+  private:
+  hashdb::scan_manager_t& scan_manager;
+  const hashdb::scan_mode_t scan_mode;
+  const int wake_fd;
+  std::deque<batch_t*> unscanned;
+  std::deque<batch_t*> scanned;
+  bool stopping;
+  pthread_mutex_t M;
+  pthread_cond_t unscanned_available;
+
+  // do not allow copy or assignment
+  batch_queue_t(const batch_queue_t&);
+  batch_queue_t& operator=(const batch_queue_t&);
+
+  // scan the requests of the batch together, adding their responses
+  void scan(batch_t& batch) {
+
+    // the hashes and labels of each well-formed request
+    std::vector<std::string> hashes;
+    std::vector<std::string> labels;
+    std::vector<size_t> ends;    // end in hashes of each request
+    std::vector<bool> valid;
+    for (size_t r=0; r<batch.requests.size(); ++r) {
+      const request_t& request = batch.requests[r];
+      const std::string& p = request.payload;
+      const size_t begin = hashes.size();
+      bool ok = (request.hash_size > 0);
+      size_t offset = 0;
+      while (ok && offset < p.size()) {
+        if (p.size() - offset < request.hash_size + 2) {
+          ok = false;
+          break;
+        }
+        const size_t label_size = static_cast<size_t>(
+                    get_le(p.data() + offset + request.hash_size, 2));
+        const size_t record_size = request.hash_size + 2 + label_size;
+        if (p.size() - offset < record_size) {
+          ok = false;
+          break;
+        }
+        hashes.push_back(p.substr(offset, request.hash_size));
+        labels.push_back(p.substr(offset + request.hash_size + 2,
+                                  label_size));
+        offset += record_size;
+      }
+      if (!ok) {
+        hashes.resize(begin);
+        labels.resize(begin);
+      }
+      ends.push_back(hashes.size());
+      valid.push_back(ok);
+    }
+
+    const std::vector<std::string> jsons =
+                         scan_manager.find_hashes_json(scan_mode, hashes);
+
+    size_t i = 0;
+    for (size_t r=0; r<batch.requests.size(); ++r) {
+      std::string payload;
+      for (; i<ends[r]; ++i) {
+        if (jsons[i].size() == 0) {
+          continue;
+        }
+        payload += hashes[i];
+        put_le(payload, labels[i].size(), 2);
+        payload += labels[i];
+        put_le(payload, jsons[i].size(), 4);
+        payload += jsons[i];
+      }
+      put_le(batch.responses, payload.size(), 4);
+      put_le(batch.responses, valid[r] ? STATUS_OK : STATUS_MALFORMED, 4);
+      put_le(batch.responses, batch.requests[r].request_id, 8);
+      batch.responses += payload;
+    }
+    batch.requests.clear();
+  }
+
+  public:
+  batch_queue_t(hashdb::scan_manager_t& p_scan_manager,
+                const hashdb::scan_mode_t p_scan_mode,
+                const int p_wake_fd) :
+                scan_manager(p_scan_manager), scan_mode(p_scan_mode),
+                wake_fd(p_wake_fd), unscanned(), scanned(),
+                stopping(false), M(), unscanned_available() {
+    pthread_mutex_init(&M, NULL);
+    pthread_cond_init(&unscanned_available, NULL);
+  }
+
+  ~batch_queue_t() {
+    for (size_t i=0; i<unscanned.size(); ++i) {
+      delete unscanned[i];
+    }
+    for (size_t i=0; i<scanned.size(); ++i) {
+      delete scanned[i];
+    }
+    pthread_cond_destroy(&unscanned_available);
+    pthread_mutex_destroy(&M);
+  }
+
+  void put(batch_t* const batch) {
+    pthread_mutex_lock(&M);
+    unscanned.push_back(batch);
+    pthread_cond_signal(&unscanned_available);
+    pthread_mutex_unlock(&M);
+  }
+
+  // take a scanned batch or NULL
+  batch_t* get() {
+    pthread_mutex_lock(&M);
+    batch_t* batch = NULL;
+    if (scanned.size() > 0) {
+      batch = scanned.front();
+      scanned.pop_front();
+    }
+    pthread_mutex_unlock(&M);
+    return batch;
+  }
+
+  void stop() {
+    pthread_mutex_lock(&M);
+    stopping = true;
+    pthread_cond_broadcast(&unscanned_available);
+    pthread_mutex_unlock(&M);
+  }
+
+  // scan batches until stopped
+  void work() {
+    while (true) {
+      pthread_mutex_lock(&M);
+      while (unscanned.size() == 0 && !stopping) {
+        pthread_cond_wait(&unscanned_available, &M);
+      }
+      if (stopping) {
+        pthread_mutex_unlock(&M);
+        return;
+      }
+      batch_t* const batch = unscanned.front();
+      unscanned.pop_front();
+      pthread_mutex_unlock(&M);
+
+      scan(*batch);
+
+      pthread_mutex_lock(&M);
+      scanned.push_back(batch);
+      pthread_mutex_unlock(&M);
+
+      // wake the poll loop, a full pipe already wakes it
+      const char c = 0;
+      if (write(wake_fd, &c, 1) < 0) {
+      }
+    }
+  }
+};
+
+static void* run_worker(void* const arg) {
+  static_cast<batch_queue_t*>(arg)->work();
+  return NULL;
+}
+
+static void set_nonblocking(const int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    std::cerr << "Error: unable to make socket non-blocking: "
+              << strerror(errno) << "\n";
+    exit(1);
+  }
+}
+
+// open the listening socket of address, fatal on error
+static int open_listener(const std::string& address) {
+  std::string host = "127.0.0.1";
+  std::string port = address;
+  const size_t colon = address.rfind(':');
+  if (colon != std::string::npos) {
+    host = address.substr(0, colon);
+    port = address.substr(colon + 1);
+  }
+  char* end;
+  const long port_number = strtol(port.c_str(), &end, 10);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  if (port.size() == 0 || *end != '\0' || port_number < 0 ||
+      port_number > 65535 ||
+      inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+    std::cerr << "Invalid address '" << address
+              << "', expected [host:]port.\n";
+    exit(1);
+  }
+  addr.sin_port = htons(static_cast<uint16_t>(port_number));
+
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  const int on = 1;
+  if (fd < 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+      bind(fd, reinterpret_cast<struct sockaddr*>(&addr),
+           sizeof(addr)) != 0 ||
+      listen(fd, 128) != 0) {
+    std::cerr << "Error: unable to listen on " << address << ": "
+              << strerror(errno) << "\n";
+    exit(1);
+  }
+  set_nonblocking(fd);
+
+  // report the port, which the system chooses when port is 0
+  socklen_t size = sizeof(addr);
+  getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &size);
+  std::cout << "# hashdb server listening on " << host << ":"
+            << ntohs(addr.sin_port) << std::endl;
+  return fd;
+}
+
+// move the complete requests of the connection into batches, false if
+// the connection sent a request that is too large
+static bool take_batches(connection_t& connection, const uint64_t id,
+                         batch_queue_t& batch_queue) {
+  size_t offset = 0;
+  batch_t* batch = NULL;
+  size_t batch_size = 0;
+  const std::string& in = connection.input;
+  while (in.size() - offset >= HEADER_SIZE &&
+         connection.in_flight < MAX_IN_FLIGHT) {
+    const char* const header = in.data() + offset;
+    const uint64_t payload_size = get_le(header, 4);
+    if (payload_size > MAX_PAYLOAD_SIZE) {
+      delete batch;
+      return false;
+    }
+    if (in.size() - offset - HEADER_SIZE < payload_size) {
+      break;
+    }
+    if (batch == NULL) {
+      batch = new batch_t;
+      batch->connection_id = id;
+      batch_size = 0;
+    }
+    batch->requests.push_back(request_t());
+    request_t& request = batch->requests.back();
+    request.hash_size = static_cast<uint32_t>(get_le(header + 4, 4));
+    request.request_id = get_le(header + 8, 8);
+    request.payload = in.substr(offset + HEADER_SIZE, payload_size);
+    offset += HEADER_SIZE + payload_size;
+    batch_size += payload_size;
+
+    // send a full batch
+    if (batch_size >= MAX_BATCH_SIZE) {
+      batch_queue.put(batch);
+      ++connection.in_flight;
+      batch = NULL;
+    }
+  }
+  if (batch != NULL) {
+    batch_queue.put(batch);
+    ++connection.in_flight;
+  }
+  connection.input.erase(0, offset);
+  return true;
+}
+
+// read what is available, false on error
+static bool read_connection(connection_t& connection) {
+  char buffer[65536];
+  while (true) {
+    const ssize_t count = recv(connection.fd, buffer, sizeof(buffer), 0);
+    if (count > 0) {
+      connection.input.append(buffer, static_cast<size_t>(count));
+      if (connection.input.size() >= MAX_BATCH_SIZE) {
+        return true;
+      }
+    } else if (count == 0) {
+      connection.read_closed = true;
+      return true;
+    } else if (errno == EINTR) {
+      continue;
+    } else {
+      return (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+  }
+}
+
+// write what the socket takes, false on error
+static bool write_connection(connection_t& connection) {
+  while (connection.output_offset < connection.output.size()) {
+    const ssize_t count = send(connection.fd,
+                  connection.output.data() + connection.output_offset,
+                  connection.output.size() - connection.output_offset,
+                  MSG_NOSIGNAL);
+    if (count > 0) {
+      connection.output_offset += static_cast<size_t>(count);
+    } else if (count < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+  }
+  connection.output.clear();
+  connection.output_offset = 0;
+  return true;
+}
+
+void scan_server(const std::string& hashdb_dir,
+                 const std::string& address,
+                 const hashdb::scan_mode_t scan_mode,
+                 const size_t num_threads,
+                 const bool warm,
+                 const bool lock_hash_store,
+                 const uint32_t max_staleness_ms) {
+
+  // open the DB
+  hashdb::scan_manager_t manager(hashdb_dir, 0, max_staleness_ms, true);
+
+  // fault in the stores so the first requests do not wait on the disk
+  if (warm) {
+    manager.warm(num_threads);
+  }
+  if (lock_hash_store) {
+    const std::string error_message = manager.lock_hash_store();
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // the wake pipe is written by workers and by the signal handler
+  int wake_fds[2];
+  if (pipe(wake_fds) != 0) {
+    std::cerr << "Error: unable to open pipe: " << strerror(errno) << "\n";
+    exit(1);
+  }
+  set_nonblocking(wake_fds[0]);
+  set_nonblocking(wake_fds[1]);
+  wake_write_fd = wake_fds[1];
+
+  const int listen_fd = open_listener(address);
+  batch_queue_t batch_queue(manager, scan_mode, wake_fds[1]);
+
+  // start the workers
+  const size_t worker_count = (num_threads == 0) ? hashdb::num_cpus()
+                                                 : num_threads;
+  std::vector<pthread_t> workers(worker_count);
+  for (size_t i=0; i<worker_count; ++i) {
+    if (pthread_create(&workers[i], NULL, run_worker, &batch_queue) != 0) {
+      std::cerr << "Error: unable to start server thread.\n";
+      exit(1);
+    }
+  }
+
+  signal(SIGINT, handle_stop);
+  signal(SIGTERM, handle_stop);
+
+  std::map<uint64_t, connection_t*> connections;
+  uint64_t next_id = 0;
+  std::vector<struct pollfd> fds;
+  std::vector<uint64_t> fd_ids;
+  while (!stop_requested) {
+
+    // poll the listener, the wake pipe, and every connection
+    fds.clear();
+    fd_ids.clear();
+    struct pollfd pfd;
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    fds.push_back(pfd);
+    pfd.fd = wake_fds[0];
+    fds.push_back(pfd);
+    for (std::map<uint64_t, connection_t*>::const_iterator it =
+         connections.begin(); it != connections.end(); ++it) {
+      const connection_t& c = *it->second;
+      pfd.fd = c.fd;
+      pfd.events = 0;
+      if (!c.read_closed && c.in_flight < MAX_IN_FLIGHT &&
+          c.output.size() < MAX_PENDING_OUTPUT) {
+        pfd.events |= POLLIN;
+      }
+      if (c.output.size() > 0) {
+        pfd.events |= POLLOUT;
+      }
+      if (pfd.events == 0) {
+        // wait for scanned batches without polling a closed socket
+        pfd.fd = -1;
+      }
+      fds.push_back(pfd);
+      fd_ids.push_back(it->first);
+    }
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "Error: poll failed: " << strerror(errno) << "\n";
+      exit(1);
+    }
+
+    // drain the wake pipe and take scanned batches
+    if (fds[1].revents != 0) {
+      char buffer[256];
+      while (read(wake_fds[0], buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    for (batch_t* batch = batch_queue.get(); batch != NULL;
+         batch = batch_queue.get()) {
+      std::map<uint64_t, connection_t*>::iterator it =
+                                  connections.find(batch->connection_id);
+      if (it != connections.end()) {
+        it->second->output += batch->responses;
+        --it->second->in_flight;
+      }
+      delete batch;
+    }
+
+    // read and write the connections, then batch complete requests
+    for (size_t i=0; i<fd_ids.size(); ++i) {
+      const short revents = fds[i+2].revents;
+      connection_t& c = *connections[fd_ids[i]];
+      bool ok = true;
+      if (revents & (POLLIN | POLLHUP)) {
+        ok = read_connection(c);
+      }
+      if (ok && (revents & POLLERR)) {
+        ok = false;
+      }
+      if (ok && !take_batches(c, fd_ids[i], batch_queue)) {
+        std::cerr << "Warning: closing a connection that sent a request "
+                  << "over " << MAX_PAYLOAD_SIZE << " bytes.\n";
+        ok = false;
+      }
+      if (ok && c.output.size() > 0) {
+        ok = write_connection(c);
+      }
+
+      // close when done or on error, scanned batches of a closed
+      // connection are dropped
+      if (!ok || (c.read_closed && c.in_flight == 0 &&
+                  c.output.size() == 0)) {
+        if (ok && c.input.size() != 0) {
+          std::cerr << "Warning: a connection closed within a request.\n";
+        }
+        close(c.fd);
+        delete &c;
+        connections.erase(fd_ids[i]);
+      }
+    }
+
+    // accept new connections
+    if (fds[0].revents & POLLIN) {
+      while (true) {
+        const int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+          break;
+        }
+        set_nonblocking(fd);
+        const int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        connections[next_id++] = new connection_t(fd);
+      }
+    }
+  }
+
+  // stop the workers and close the connections
+  batch_queue.stop();
+  for (size_t i=0; i<worker_count; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  for (std::map<uint64_t, connection_t*>::iterator it =
+       connections.begin(); it != connections.end(); ++it) {
+    close(it->second->fd);
+    delete it->second;
+  }
+  close(listen_fd);
+  close(wake_fds[0]);
+  close(wake_fds[1]);
+  std::cout << "# hashdb server stopped" << std::endl;
+}
+#endif
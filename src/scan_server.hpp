@@ -0,0 +1,71 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Serve scans of one database to many clients over TCP.
+ *
+ * The protocol is pipelined: a client may send many requests without
+ * waiting, and each response carries the ID of its request.  Responses
+ * to one connection may arrive in a different order than its requests.
+ * All integers are unsigned and little-endian.
+ *
+ * A request is a 16-byte header followed by its payload:
+ *   - 4 bytes: payload size in bytes, at most 64 MiB
+ *   - 4 bytes: hash size in bytes, 16 for MD5
+ *   - 8 bytes: request ID, chosen by the client
+ *   - payload: scan records as for scan_stream_t::put, each a binary
+ *     hash, a 2-byte label size, and the label
+ *
+ * A response is a 16-byte header followed by its payload:
+ *   - 4 bytes: payload size in bytes
+ *   - 4 bytes: status, 0 for success or 1 for a malformed request
+ *   - 8 bytes: the request ID
+ *   - payload: a record for each hash that matched, as for
+ *     scan_stream_t::get, each a binary hash, a 2-byte label size, the
+ *     label, a 4-byte JSON size, and the JSON text
+ */
+
+#ifndef SCAN_SERVER_HPP
+#define SCAN_SERVER_HPP
+
+#include <string>
+#include <cstddef>
+#include "../src_libhashdb/hashdb.hpp"
+
+/**
+ * Serve scans of hashdb_dir on address, [host:]port, listening on
+ * 127.0.0.1 when host is not given, until interrupted.  A poll loop
+ * reads and writes all connections, and num_threads workers, or one per
+ * CPU if 0, scan the complete requests of one connection together.
+ * When warm is set, the stores are read into the page cache before
+ * listening, and when lock_hash_store is set, the in-memory hash store
+ * is locked into RAM, exiting if it cannot be.  Each worker may answer
+ * from a snapshot up to max_staleness_ms milliseconds old while another
+ * process imports into the hashdb, see scan_manager_t.
+ */
+void scan_server(const std::string& hashdb_dir,
+                 const std::string& address,
+                 const hashdb::scan_mode_t scan_mode,
+                 const size_t num_threads,
+                 const bool warm,
+                 const bool lock_hash_store,
+                 const uint32_t max_staleness_ms);
+
+#endif
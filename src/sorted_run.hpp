@@ -0,0 +1,523 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Write and read sorted runs, the compact binary files that carry one
+ * hash prefix partition of a hashdb from the node that ingested it to
+ * the node that owns the partition.
+ *
+ * A run starts with a header naming its partition, the number of
+ * partitions, and the block size and block hash algorithm of its
+ * hashes.  Hash records follow in block hash order, each with the file
+ * hash and sub_count of each of its sources, then the source data and
+ * names of the sources they reference.  Numbers are LEB128 varints and
+ * strings are a varint size followed by the bytes.  Partition p of n
+ * holds the hashes whose leading 32 bits, times n, shifted right by 32,
+ * are p, so each partition is one range in key order.
+ */
+
+#ifndef SORTED_RUN_HPP
+#define SORTED_RUN_HPP
+
+#include "../src_libhashdb/hashdb.hpp"
+#include "progress_tracker.hpp"
+#include "file_hash_table.hpp"
+
+// Standard includes
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <stdint.h>
+
+static const char sorted_run_magic[] = "hdbrun1\n";
+static const size_t sorted_run_magic_size = 8;
+
+// record types in a run
+static const uint64_t SORTED_RUN_END = 0;
+static const uint64_t SORTED_RUN_HASH = 1;
+static const uint64_t SORTED_RUN_SOURCE = 2;
+
+// the partition of block_hash among num_partitions
+inline size_t sorted_run_partition(const std::string& block_hash,
+                                   const size_t num_partitions) {
+  uint64_t prefix = 0;
+  for (size_t i=0; i<4; ++i) {
+    prefix <<= 8;
+    if (i < block_hash.size()) {
+      prefix |= static_cast<uint8_t>(block_hash[i]);
+    }
+  }
+  return static_cast<size_t>((prefix * num_partitions) >> 32);
+}
+
+class sorted_run_writer_t {
+  private:
+  const std::string filename;
+  std::ofstream out;
+
+  // do not allow copy or assignment
+  sorted_run_writer_t(const sorted_run_writer_t&);
+  sorted_run_writer_t& operator=(const sorted_run_writer_t&);
+
+  void write_uint64(uint64_t value) {
+    while (value >= 0x80) {
+      out.put(static_cast<char>((value & 0x7f) | 0x80));
+      value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+  }
+
+  void write_string(const std::string& s) {
+    write_uint64(s.size());
+    out.write(s.c_str(), s.size());
+  }
+
+  public:
+  // the reason the run could not be created, else ""
+  std::string error_message;
+
+  sorted_run_writer_t(const std::string& p_filename,
+                      const size_t partition,
+                      const size_t num_partitions,
+                      const hashdb::settings_t& settings) :
+          filename(p_filename),
+          out(p_filename.c_str(), std::ios::binary | std::ios::trunc),
+          error_message() {
+    if (!out.is_open()) {
+      error_message = "Unable to create sorted run '" + filename + "'.";
+      return;
+    }
+    out.write(sorted_run_magic, sorted_run_magic_size);
+    write_uint64(partition);
+    write_uint64(num_partitions);
+    write_uint64(settings.block_size);
+    write_string(settings.block_hash_algorithm);
+  }
+
+  // hashes must be written in block hash order
+  void write_hash(const std::string& block_hash,
+                  const uint64_t k_entropy,
+                  const std::string& block_label,
+                  const hashdb::source_sub_counts_t& source_sub_counts) {
+    write_uint64(SORTED_RUN_HASH);
+    write_string(block_hash);
+    write_uint64(k_entropy);
+    write_string(block_label);
+    write_uint64(source_sub_counts.size());
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      write_string(it->file_hash);
+      write_uint64(it->sub_count);
+    }
+  }
+
+  // sources must be written after all hashes
+  void write_source(const std::string& file_hash,
+                    const uint64_t filesize,
+                    const std::string& file_type,
+                    const uint64_t zero_count,
+                    const uint64_t nonprobative_count,
+                    const hashdb::source_names_t& names) {
+    write_uint64(SORTED_RUN_SOURCE);
+    write_string(file_hash);
+    write_uint64(filesize);
+    write_string(file_type);
+    write_uint64(zero_count);
+    write_uint64(nonprobative_count);
+    write_uint64(names.size());
+    for (hashdb::source_names_t::const_iterator it = names.begin();
+         it != names.end(); ++it) {
+      write_string(it->first);
+      write_string(it->second);
+    }
+  }
+
+  // end the run, return "" else the reason the run was not written
+  std::string close() {
+    write_uint64(SORTED_RUN_END);
+    out.close();
+    if (out.fail()) {
+      return "Unable to write sorted run '" + filename + "'.";
+    }
+    return "";
+  }
+};
+
+class sorted_run_reader_t {
+  private:
+  std::ifstream in;
+  uint64_t type;            // the type of the record to read next
+
+  // do not allow copy or assignment
+  sorted_run_reader_t(const sorted_run_reader_t&);
+  sorted_run_reader_t& operator=(const sorted_run_reader_t&);
+
+  bool read_uint64(uint64_t& value) {
+    value = 0;
+    for (size_t shift=0; shift<64; shift+=7) {
+      const int c = in.get();
+      if (c == EOF) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(c & 0x7f) << shift;
+      if ((c & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool read_string(std::string& s) {
+    uint64_t size;
+    if (!read_uint64(size) || size > 1048576) {
+      return false;
+    }
+    s.resize(size);
+    if (size > 0) {
+      in.read(&s[0], size);
+    }
+    return in.good();
+  }
+
+  // stop reading a corrupted run
+  bool corrupted() {
+    error_message = "Sorted run '" + filename + "' is corrupted.";
+    type = SORTED_RUN_END;
+    return false;
+  }
+
+  // read the type of the next record
+  bool read_type() {
+    if (!read_uint64(type) || type > SORTED_RUN_SOURCE) {
+      return corrupted();
+    }
+    return true;
+  }
+
+  public:
+  const std::string filename;
+  size_t partition;
+  size_t num_partitions;
+  uint32_t block_size;
+  std::string block_hash_algorithm;
+
+  // the reason the run could not be read, else ""
+  std::string error_message;
+
+  sorted_run_reader_t(const std::string& p_filename) :
+          in(p_filename.c_str(), std::ios::binary), type(SORTED_RUN_END),
+          filename(p_filename), partition(0), num_partitions(0),
+          block_size(0), block_hash_algorithm(), error_message() {
+    if (!in.is_open()) {
+      error_message = "Unable to open sorted run '" + filename + "'.";
+      return;
+    }
+    char magic[sorted_run_magic_size];
+    uint64_t p, n, b;
+    in.read(magic, sorted_run_magic_size);
+    if (!in.good() ||
+        std::string(magic, sorted_run_magic_size) !=
+                   std::string(sorted_run_magic, sorted_run_magic_size) ||
+        !read_uint64(p) || !read_uint64(n) || !read_uint64(b) ||
+        !read_string(block_hash_algorithm) || n == 0 || p >= n) {
+      error_message = "File '" + filename + "' is not a sorted run.";
+      return;
+    }
+    partition = p;
+    num_partitions = n;
+    block_size = static_cast<uint32_t>(b);
+    read_type();
+  }
+
+  // read the next hash, false after the last hash or on error
+  bool next_hash(std::string& block_hash,
+                 uint64_t& k_entropy,
+                 std::string& block_label,
+                 hashdb::source_sub_counts_t& source_sub_counts) {
+    if (type != SORTED_RUN_HASH) {
+      return false;
+    }
+    uint64_t size;
+    if (!read_string(block_hash) || !read_uint64(k_entropy) ||
+        !read_string(block_label) || !read_uint64(size)) {
+      return corrupted();
+    }
+    source_sub_counts.clear();
+    for (uint64_t i=0; i<size; ++i) {
+      std::string file_hash;
+      uint64_t sub_count;
+      if (!read_string(file_hash) || !read_uint64(sub_count)) {
+        return corrupted();
+      }
+      source_sub_counts.insert(hashdb::source_sub_count_t(file_hash,
+                                                          sub_count));
+    }
+    return read_type();
+  }
+
+  // read the next source after the hashes, false after the last source
+  // or on error
+  bool next_source(std::string& file_hash,
+                   uint64_t& filesize,
+                   std::string& file_type,
+                   uint64_t& zero_count,
+                   uint64_t& nonprobative_count,
+                   hashdb::source_names_t& names) {
+    if (type != SORTED_RUN_SOURCE) {
+      return false;
+    }
+    uint64_t size;
+    if (!read_string(file_hash) || !read_uint64(filesize) ||
+        !read_string(file_type) || !read_uint64(zero_count) ||
+        !read_uint64(nonprobative_count) || !read_uint64(size)) {
+      return corrupted();
+    }
+    names.clear();
+    for (uint64_t i=0; i<size; ++i) {
+      std::string repository_name;
+      std::string name;
+      if (!read_string(repository_name) || !read_string(name)) {
+        return corrupted();
+      }
+      names.insert(hashdb::source_name_t(repository_name, name));
+    }
+    return read_type();
+  }
+};
+
+/**
+ * Export the hashes of the hashdb into num_partitions sorted runs named
+ * run_prefix.0 and on, with each source in the runs of the hashes that
+ * reference it.  Sources without hashes go into run 0.
+ *
+ * Returns "" else the reason the runs were not written.
+ */
+inline std::string export_sorted_runs(
+                             const hashdb::scan_manager_t& manager,
+                             const hashdb::settings_t& settings,
+                             const std::string& run_prefix,
+                             const size_t num_partitions,
+                             progress_tracker_t& progress_tracker) {
+
+  // open a writer and a table of referenced sources for each partition
+  std::vector<sorted_run_writer_t*> writers;
+  std::vector<file_hash_table_t*> referenced;
+  std::string error_message;
+  for (size_t p=0; p<num_partitions; ++p) {
+    std::stringstream ss;
+    ss << run_prefix << "." << p;
+    writers.push_back(new sorted_run_writer_t(ss.str(), p, num_partitions,
+                                              settings));
+    referenced.push_back(new file_hash_table_t);
+    if (error_message.size() == 0) {
+      error_message = writers.back()->error_message;
+    }
+  }
+
+  if (error_message.size() == 0) {
+    // write each hash into its partition, in key order
+    hashdb::hash_iterator_t hash_iterator(manager);
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    while (hash_iterator.next(block_hash, k_entropy, block_label, count,
+                              source_sub_counts)) {
+      const size_t p = sorted_run_partition(block_hash, num_partitions);
+      writers[p]->write_hash(block_hash, k_entropy, block_label,
+                             source_sub_counts);
+      for (hashdb::source_sub_counts_t::const_iterator it =
+           source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+        referenced[p]->set(it->file_hash, 1);
+      }
+      progress_tracker.track_hash_data(source_sub_counts.size());
+    }
+
+    // write each source into the partitions that reference it
+    hashdb::source_iterator_t source_iterator(manager);
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    hashdb::source_names_t names;
+    while (source_iterator.next(file_hash, filesize, file_type, zero_count,
+                                nonprobative_count, names)) {
+      bool is_referenced = false;
+      for (size_t p=0; p<num_partitions; ++p) {
+        if (referenced[p]->has(file_hash, 1)) {
+          is_referenced = true;
+          writers[p]->write_source(file_hash, filesize, file_type,
+                                   zero_count, nonprobative_count, names);
+        }
+      }
+      if (!is_referenced) {
+        writers[0]->write_source(file_hash, filesize, file_type,
+                                 zero_count, nonprobative_count, names);
+      }
+    }
+  }
+
+  // close the runs
+  for (size_t p=0; p<num_partitions; ++p) {
+    const std::string close_error = writers[p]->close();
+    if (error_message.size() == 0) {
+      error_message = close_error;
+    }
+    delete writers[p];
+    delete referenced[p];
+  }
+  return error_message;
+}
+
+// the current hash of one run being loaded
+struct sorted_run_input_t {
+  const size_t index;
+  sorted_run_reader_t reader;
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  hashdb::source_sub_counts_t source_sub_counts;
+  sorted_run_input_t(const size_t p_index, const std::string& filename) :
+          index(p_index), reader(filename), block_hash(), k_entropy(0),
+          block_label(), source_sub_counts() {
+  }
+  bool next() {
+    return reader.next_hash(block_hash, k_entropy, block_label,
+                            source_sub_counts);
+  }
+
+  private:
+  // do not allow copy or assignment
+  sorted_run_input_t(const sorted_run_input_t&);
+  sorted_run_input_t& operator=(const sorted_run_input_t&);
+};
+
+// heap order, smallest hash first, then run order
+inline bool sorted_run_later(const sorted_run_input_t* const a,
+                             const sorted_run_input_t* const b) {
+  const int compare = a->block_hash.compare(b->block_hash);
+  return (compare != 0) ? (compare > 0) : (a->index > b->index);
+}
+
+/**
+ * Load sorted runs of one partition into the hashdb of manager, merging
+ * the runs by block hash so that hashes arrive in key order.  The runs
+ * must hash blocks as settings does.
+ *
+ * Returns "" else the reason the runs were not loaded.  Runs are
+ * checked before any are loaded, but a run found corrupted while
+ * loading leaves the hashes before it loaded.
+ */
+inline std::string load_sorted_runs(hashdb::import_manager_t& manager,
+                                    const hashdb::settings_t& settings,
+                                    const std::vector<std::string>& filenames,
+                                    progress_tracker_t& progress_tracker) {
+
+  // open the runs and make sure they are of the same partition
+  std::vector<sorted_run_input_t*> inputs;
+  std::string error_message;
+  for (size_t i=0; i<filenames.size(); ++i) {
+    inputs.push_back(new sorted_run_input_t(i, filenames[i]));
+    const sorted_run_reader_t& reader = inputs.back()->reader;
+    if (error_message.size() != 0) {
+      continue;
+    }
+    if (reader.error_message.size() != 0) {
+      error_message = reader.error_message;
+    } else if (reader.block_size != settings.block_size ||
+               reader.block_hash_algorithm !=
+                                          settings.block_hash_algorithm) {
+      error_message = "Sorted run '" + reader.filename +
+             "' does not match the block size and block hash algorithm "
+             "of the hashdb.";
+    } else if (reader.partition != inputs[0]->reader.partition ||
+               reader.num_partitions != inputs[0]->reader.num_partitions) {
+      error_message = "Sorted run '" + reader.filename +
+             "' is not of the same partition as '" +
+             inputs[0]->reader.filename + "'.";
+    }
+  }
+
+  // merge the hashes of the runs in key order
+  std::vector<sorted_run_input_t*> heap;
+  if (error_message.size() == 0) {
+    for (size_t i=0; i<inputs.size(); ++i) {
+      if (inputs[i]->next()) {
+        heap.push_back(inputs[i]);
+        std::push_heap(heap.begin(), heap.end(), sorted_run_later);
+      }
+    }
+  }
+  while (heap.size() > 0) {
+    std::pop_heap(heap.begin(), heap.end(), sorted_run_later);
+    sorted_run_input_t* const input = heap.back();
+    heap.pop_back();
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         input->source_sub_counts.begin();
+         it != input->source_sub_counts.end(); ++it) {
+      manager.merge_hash(input->block_hash, input->k_entropy,
+                         input->block_label, it->file_hash, it->sub_count);
+    }
+    progress_tracker.track_hash_data(input->source_sub_counts.size());
+    if (input->next()) {
+      heap.push_back(input);
+      std::push_heap(heap.begin(), heap.end(), sorted_run_later);
+    }
+  }
+
+  // add the sources of each run
+  for (size_t i=0; i<inputs.size(); ++i) {
+    sorted_run_reader_t& reader = inputs[i]->reader;
+    if (error_message.size() == 0) {
+      error_message = reader.error_message;
+    }
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    hashdb::source_names_t names;
+    while (error_message.size() == 0 &&
+           reader.next_source(file_hash, filesize, file_type, zero_count,
+                              nonprobative_count, names)) {
+      manager.insert_source_data(file_hash, filesize, file_type,
+                                 zero_count, nonprobative_count);
+      for (hashdb::source_names_t::const_iterator it = names.begin();
+           it != names.end(); ++it) {
+        manager.insert_source_name(file_hash, it->first, it->second);
+      }
+    }
+    if (error_message.size() == 0) {
+      error_message = reader.error_message;
+    }
+  }
+
+  for (size_t i=0; i<inputs.size(); ++i) {
+    delete inputs[i];
+  }
+  return error_message;
+}
+
+#endif
@@ -42,15 +42,45 @@ void overview() {
   << "       hashdb [-h <command>]\n"
   << "       hashdb [options] <command> [<args>]\n"
   << "\n"
+  << "Any command:\n"
+  << "  -M, --metrics=<address>\n"
+  << "    while the command runs, serve live metrics in the Prometheus text\n"
+  << "    format over HTTP on <address>, [<host>:]<port> for TCP on 127.0.0.1\n"
+  << "    by default, or unix:<path> for a local socket\n"
+  << "  -g, --memory_budget=<size>\n"
+  << "    bound the memory that media buffers, source caches, batches of\n"
+  << "    hashes waiting to be written, and hashes and sources remembered by\n"
+  << "    -j o scans use together, in bytes with an optional K, M, G, or T\n"
+  << "    suffix.  Past the bound, reads and inserts wait, caches evict\n"
+  << "    sooner, and -j o scans may repeat information (default is no\n"
+  << "    bound).\n"
+  << "\n"
   << "New Database:\n"
-  << "  create [-b <block size>] <hashdb>\n"
+  << "  create [-b <block size>] [-a <algorithm>] [-f <format>]\n"
+  << "         [-k <shard bits>] [-I] [-Y] [-U] [-C] <hashdb>\n"
+  << "  migrate [-f <format>] <hashdb>\n"
+  << "  compress_names <hashdb>\n"
+  << "  optimize <hashdb>\n"
+  << "  rebuild_hash_store <hashdb>\n"
+  << "  freeze <hashdb> <frozen hashdb>\n"
   << "\n"
   << "Import/Export:\n"
   << "  ingest [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
-  << "         [-x <rel>] <hashdb.hdb> <import directory>\n"
-  << "  import_tab [-r <repository name>] [-w <whitelist.hdb>] <hashdb> <tab file>\n"
-  << "  import <hashdb> <json file>\n"
-  << "  export [-p <begin:end>] <hashdb> <json file>\n"
+  << "         [-x <reln>] [-u] [-q] [-O] [-K <checkpoint> [-Z]] [-N <writers>]\n"
+  << "         [-J] <hashdb.hdb> [<hashdb.hdb> ...] <import directory>\n"
+  << "  import_tab [-r <repository name>] [-w <whitelist.hdb>] [-J] <hashdb>\n"
+  << "             <tab file>\n"
+  << "  import [-n <threads>] [-J] <hashdb> <json file>\n"
+  << "  export [-p <begin:end>] [-n <threads>] [-S <shards>] [-c <format>]\n"
+  << "         <hashdb> <json file>\n"
+  << "  export_changes <hashdb> <changes file>\n"
+  << "  apply_changes <replica hashdb> <changes file>\n"
+  << "  export_filter <hashdb> <filter file>\n"
+  << "  ingest_runs [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
+  << "         [-x <reln>] [-q] [-O] -S <partitions> <hashdb> <import directory>\n"
+  << "         <run prefix>\n"
+  << "  export_runs -S <partitions> <hashdb> <run prefix>\n"
+  << "  load_runs [-J] <hashdb> <run file> [<run file> ...]\n"
   << "\n"
   << "Database Manipulation:\n"
   << "  add <source hashdb> <destination hashdb>\n"
@@ -62,18 +92,34 @@ void overview() {
   << "  subtract <source hashdb 1> <source hashdb 2> <destination hashdb>\n"
   << "  subtract_hash <source hashdb 1> <source hashdb 2> <destination hashdb>\n"
   << "  subtract_repository <source hashdb> <destination hashdb> <repository name>\n"
+  << "  remove_source <hashdb> <hex file hash>\n"
+  << "  remove_hash <hashdb> <hex block hash>\n"
   << "\n"
   << "Scan:\n"
-  << "  scan_list [-j e|o|c|a] <hashdb> <hash list file>\n"
-  << "  scan_hash [-j e|o|c|a] <hashdb> <hex block hash>\n"
-  << "  scan_media [-s <step size>] [-j e|o|c|a] [-x <r>] <hashdb> <media image>\n"
+  << "  scan_list [-j e|o|c|a] [-n <threads>] [-T <max sources>] [-X] <hashdb>\n"
+  << "            <hash list file>\n"
+  << "  scan_hash [-j e|o|c|a] [-T <max sources>] [-G <first source>] [-X]\n"
+  << "            <hashdb> <hex block hash>\n"
+  << "  similar [-T <max sources>] <hashdb> <file | hex file hash>\n"
+  << "  scan_media [-s <step size>] [-j e|o|c|a|s] [-x <r>] [-F <fraction> [-A]]\n"
+  << "             [-q] [-O] [-K <checkpoint> [-Z]] [-e <k entropy>] [-o]\n"
+  << "             <hashdb> [<hashdb> ...] <media image>\n"
+  << "  scan_media_list [-s <step size>] [-j e|o|c|a|s] [-x <r>] [-q] [-O]\n"
+  << "             [-Q <depth>] [-e <k entropy>] [-o] <hashdb> [<hashdb> ...]\n"
+  << "             <media list file>\n"
+  << "  server [-j e|o|c|a] [-n <threads>] [-W] [-l] [-L <ms>] <hashdb>\n"
+  << "             <[host:]port>\n"
+  << "  warm [-n <threads>] <hashdb>\n"
+  << "  pin_common [-B <max pinned>] <hashdb> <min count>\n"
   << "\n"
   << "Statistics:\n"
   << "  size <hashdb>\n"
-  << "  histogram <hashdb>\n"
-  << "  duplicates [-j e|o|c|a] <hashdb> <number>\n"
+  << "  estimate <hashdb1> [<hashdb2>]\n"
+  << "  histogram [-R] <hashdb>\n"
+  << "  duplicates [-j e|o|c|a] [-R] <hashdb> <number>\n"
   << "  hash_table [-j e|o|c|a] <hashdb> <hex file hash>\n"
   << "  read_media <media image> <offset> <count>\n"
+  << "  read_media_list <media image> <media offsets file> <count>\n"
   << "  read_media_size <media image>\n"
   << "\n"
   << "Performance Analysis:\n"
@@ -82,6 +128,11 @@ void overview() {
   << "  add_same <hashdb> <count>\n"
   << "  scan_same [-j e|o|c|a] <hashdb> <count>\n"
   << "  test_scan_stream <hashdb> <count>\n"
+  << "  benchmark [<create options>] [-j e|o|c|a] [-n <threads>] [-P <rate>]\n"
+  << "            [-z <exponent>|-D <histogram>] <hashdb> <count>\n"
+  << "  benchmark_scan_stream [-j e|o|c|a] [-n <threads>] [-P <rate>] <hashdb>\n"
+  << "            <producers> <batch size> <batches>\n"
+  << "  benchmark_read [-n <threads>] [-Q <depth>] <media image>\n"
   ;
 }
 
@@ -91,26 +142,146 @@ static void create() {
   const hashdb::settings_t settings;
 
   std::cout
-  << "create [-b <block size>] <hashdb>\n"
+  << "create [-b <block size>] [-a <algorithm>] [-f <format>]\n"
+  << "       [-k <shard bits>] [-I] [-Y] [-U] [-C] <hashdb>\n"
   << "  Create a new <hashdb> hash database.\n"
   << "\n"
   << "  Options:\n"
   << "  -b, --block_size=<block size>\n"
   << "    <block size>, in bytes, or use 0 for no restriction\n"
   << "    (default " << settings.block_size << ")\n"
+  << "    or <min>:<average>:<max> to hash content-defined chunks of\n"
+  << "    <min> to <max> bytes, about <average> bytes long, instead of\n"
+  << "    blocks at each step, so that content still matches after it\n"
+  << "    shifts.  Sizes take a K or M suffix, for example 2K:8K:64K.\n"
+  << "    <min> must be at least 64 and <max> at most 1M.\n"
+  << "  -a, --block_hash_algorithm=<algorithm>\n"
+  << "    the digest used for block hashes: md5, sha1, sha256, or\n"
+  << "    blake2s256 when supported by OpenSSL\n"
+  << "    (default " << settings.block_hash_algorithm << ")\n"
+  << "  -f, --hash_data_format=<format>\n"
+  << "    the hash data record format: 1 for variable-length fields, 2 for\n"
+  << "    fixed-width fields that are faster to read, or 3 for fixed-width\n"
+  << "    fields with the sources of hashes with many sources kept apart and\n"
+  << "    read a page at a time\n"
+  << "    (default " << settings.hash_data_format << ")\n"
+  << "  -k, --hash_shard_bits=<shard bits>\n"
+  << "    partition the hash stores into 2^<shard bits> LMDB environments by\n"
+  << "    leading hash bits so that ingest commits to them concurrently, 0\n"
+  << "    through 6 (default " << settings.hash_shard_bits << ")\n"
+  << "  -i, --initial_map_size=<size>\n"
+  << "    preallocate <size> bytes for the hash data store, with an optional\n"
+  << "    K, M, G, or T suffix, when its final size can be estimated\n"
+  << "    (default " << settings.initial_map_size << " to start small)\n"
+  << "  -m, --max_map_size=<size>\n"
+  << "    the size, in bytes, that any one store may grow to, with an\n"
+  << "    optional K, M, G, or T suffix, or 0 for no limit\n"
+  << "    (default " << settings.max_map_size << ")\n"
+  << "  -y, --sync_policy=<policy>\n"
+  << "    when imported data is synced to disk: none, periodic to sync in the\n"
+  << "    background every " << settings.sync_seconds << " seconds or "
+  << settings.sync_mb << " MiB, or flush\n"
+  << "    to sync when the importer flushes (default " << settings.sync_policy << ")\n"
+  << "  -d, --store_path=<store>=<directory>\n"
+  << "    place <store>, such as lmdb_hash_store, in a new directory within\n"
+  << "    <directory>, for example on faster media, and link to it from\n"
+  << "    <hashdb>.  Repeat to place more stores.\n"
+  << "  -I, --source_hash_index\n"
+  << "    keep a reverse index from each source to its block hashes so that\n"
+  << "    hash_table reads them without walking the database\n"
+  << "  -Y, --similarity_index\n"
+  << "    keep a MinHash signature of the block hashes of each source and an\n"
+  << "    index of the signatures so that similar finds similar sources\n"
+  << "  -U, --count_index\n"
+  << "    keep an index from each hash count of at least 2 to its hashes so\n"
+  << "    that duplicates and add_range read them without walking the\n"
+  << "    database\n"
+  << "  -C, --change_log\n"
+  << "    append imported changes to a change log that export_changes ships\n"
+  << "    to replicas\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>   the file path to the new hash database to create\n"
   ;
 }
 
+static void migrate() {
+  std::cout
+  << "migrate [-f <format>] <hashdb>\n"
+  << "  Rewrite the hash data records of <hashdb> in another format.\n"
+  << "  <hashdb> must not be in use.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -f, --hash_data_format=<format>\n"
+  << "    the hash data record format to migrate to, 1, 2, or 3 (default 2)\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to migrate\n"
+  ;
+}
+
+static void compress_names() {
+  std::cout
+  << "compress_names <hashdb>\n"
+  << "  Rewrite the source names of <hashdb> compressed with a dictionary of\n"
+  << "  their common repository names, path prefixes, and path components,\n"
+  << "  and report the savings.  Names imported later are compressed too.\n"
+  << "  <hashdb> must not be in use.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to compress the source names of\n"
+  ;
+}
+
+static void optimize() {
+  std::cout
+  << "optimize <hashdb>\n"
+  << "  Rewrite each store of <hashdb> in key order onto tightly packed pages,\n"
+  << "  leaving out the free pages left by updates, and report the savings.\n"
+  << "  <hashdb> must not be in use.  Pinned blocks must be pinned again.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to optimize\n"
+  ;
+}
+
+static void rebuild_hash_store() {
+  std::cout
+  << "rebuild_hash_store <hashdb>\n"
+  << "  Rebuild the hash store of <hashdb> from its hash data store in one\n"
+  << "  sequential pass.  Use after a -J import that was interrupted before\n"
+  << "  it could rebuild the hash store itself.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>   the hash database to rebuild the hash store of\n"
+  ;
+}
+
+static void freeze() {
+  std::cout
+  << "freeze <hashdb> <frozen hashdb>\n"
+  << "  Create <frozen hashdb>, a compact read-only copy of <hashdb> for\n"
+  << "  scanning.  Its hashes are kept sorted in one file that is mapped into\n"
+  << "  memory.  A frozen hash database cannot be imported into.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>          the hash database to freeze\n"
+  << "  <frozen hashdb>   the new frozen hash database\n"
+  ;
+}
+
 // Import/Export
 static void ingest() {
   std::cout
   << "ingest [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
-  << "       [-x <rel>] <hashdb.hdb> <import directory>\n"
+  << "       [-x <reln>] [-u] [-q] [-O] [-K <checkpoint> [-Z]] [-N <writers>]\n"
+  << "       [-J] <hashdb.hdb> [<hashdb.hdb> ...] <import directory>\n"
   << "  Import hashes recursively from <import directory> into hash database\n"
-  << "    <hashdb>.\n"
+  << "    <hashdb>.  Given more than one <hashdb>, each file is read once and\n"
+  << "    hashed with the block size of each <hashdb>.\n"
+  << "  If <import directory> is -, import from stdin without staging it to\n"
+  << "    a file: a tar archive is imported member by member as it is read,\n"
+  << "    anything else is imported as one file named stdin.\n"
   << "\n"
   << "  Options:\n"
   << "  -r, --repository_name=<repository name>\n"
@@ -120,22 +291,50 @@ static void ingest() {
   << "    The path to a whitelist hash database.  Hashes matching this database\n"
   << "    will be marked with a whitelist entropy flag.\n"
   << "  -s, --step_size\n"
-  << "    The step size to move along while calculating hashes.\n"
+  << "    The step size to move along while calculating hashes, or a\n"
+  << "    comma-separated list of one step size for each <hashdb>.\n"
   << "  -x, --disable_processing\n"
   << "    Disable further processing:\n"
   << "      r disables recursively processing embedded data.\n"
   << "      e disables calculating entropy.\n"
   << "      l disables calculating block labels.\n"
+  << "      n disables storing non-probative hashes, the blocks that get a\n"
+  << "        block label.  They are still counted in their source.\n"
+  << "  -u, --skip_unchanged\n"
+  << "    Skip files whose path, size, modification time, and inode are\n"
+  << "    unchanged since they were last ingested into <hashdb>.  Requires\n"
+  << "    a single <hashdb>.\n"
+  << "  -q, --quiet\n"
+  << "    Do not print the status of each part of each file ingested.\n"
+  << "  -O, --direct_reads\n"
+  << "    Read files around the page cache so that the hash database stays\n"
+  << "    cached.\n"
+  << "  -K, --checkpoint=<checkpoint>\n"
+  << "    Record progress in file <checkpoint> every few minutes, removing it\n"
+  << "    when the ingest completes.\n"
+  << "  -Z, --resume\n"
+  << "    Resume an interrupted ingest after the files that <checkpoint>\n"
+  << "    records as ingested.\n"
+  << "  -N, --num_writers=<writers>\n"
+  << "    Ingest into this many staging hash databases beside <hashdb> at\n"
+  << "    once, each from its own run of the files, then merge them into\n"
+  << "    <hashdb> and remove them.  Requires a single <hashdb> and is not\n"
+  << "    allowed with -u or -K.\n"
+  << "  -J, --defer_hash_store\n"
+  << "    Do not maintain the hash store during the import, then rebuild it\n"
+  << "    in one sequential pass at the end.  Until then, scans look hashes\n"
+  << "    up in the hash data store.\n"
   << "\n"
   << "  Parameters:\n"
-  << "  <import dir>   the directory to recursively import from\n"
+  << "  <import dir>   the directory to recursively import from, or - for stdin\n"
   << "  <hashdb>       the hash database to insert the imported hashes into\n"
   ;
 }
 
 static void import_tab() {
   std::cout
-  << "import_tab [-r <repository name>] [-w <whitelist.hdb>] <hashdb> <tab file>\n"
+  << "import_tab [-r <repository name>] [-w <whitelist.hdb>] [-J] <hashdb>\n"
+  << "           <tab file>\n"
   << "  Import hashes from file <tab file> into hash database <hashdb>.\n"
   << "\n"
   << "  Options:\n"
@@ -145,6 +344,8 @@ static void import_tab() {
   << "  -w, --whitelist_dir\n"
   << "    The path to a whitelist hash database.  Hashes matching this database\n"
   << "    will be marked with a whitelist entropy flag.\n"
+  << "  -J, --defer_hash_store\n"
+  << "    As for ingest.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to insert the imported hashes into\n"
@@ -154,8 +355,16 @@ static void import_tab() {
 
 static void import() {
   std::cout
-  << "import <hashdb> <json file>\n"
+  << "import [-n <threads>] [-J] <hashdb> <json file>\n"
   << "  Import hashes from file <json file> into hash database <hashdb>.\n"
+  << "  If <json file> is the manifest of a sharded export, import the files\n"
+  << "  it names.  If <json file> is a binary export, import it in key order.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -n, --num_threads\n"
+  << "    The number of JSON parsing threads (default is one per CPU).\n"
+  << "  -J, --defer_hash_store\n"
+  << "    As for ingest.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to insert the imported hashes into\n"
@@ -165,13 +374,26 @@ static void import() {
 
 static void export_json() {
   std::cout
-  << "export [-p <begin:end>] <hashdb> <json file>\n"
+  << "export [-p <begin:end>] [-n <threads>] [-S <shards>] [-c <format>]\n"
+  << "       <hashdb> <json file>\n"
   << "  Export hashes from hash database <hashdb> into file <json file>.\n"
   << "\n"
   << "  Options:\n"
   << "  -p, --part_range=<begin:end>\n"
   << "    The part of the hash database to export, from begin hex block hash to\n"
   << "    end hex block hash.  The entire hash database is exported by default.\n"
+  << "  -n, --num_threads\n"
+  << "    The number of export threads (default is one per CPU).\n"
+  << "  -S, --num_shards\n"
+  << "    Export hashes into <shards> files <json file>.0 and on, each one\n"
+  << "    range in key order, and sources into one more file.  <json file>\n"
+  << "    is written as a manifest naming the files.  Import the manifest to\n"
+  << "    import all the files.\n"
+  << "  -c, --format=<format>\n"
+  << "    The export format, json (default) or bin.  A bin export holds the same\n"
+  << "    sources and hashes in compressed, checksummed frames with the source\n"
+  << "    table first and hashes in key order.  It is not allowed with -p, -n,\n"
+  << "    or -S.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to export\n"
@@ -179,11 +401,114 @@ static void export_json() {
   ;
 }
 
+static void ingest_runs() {
+  std::cout
+  << "ingest_runs [-r <repository name>] [-w <whitelist.hdb>] [-s <step size>]\n"
+  << "       [-x <reln>] [-q] [-O] -S <partitions> <hashdb> <import directory>\n"
+  << "       <run prefix>\n"
+  << "  Ingest <import directory> into local hash database <hashdb> as ingest\n"
+  << "  does, then export <hashdb> as sorted runs as export_runs does, for\n"
+  << "  shipping each run to the node that owns its partition.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -r, -w, -s, -x, -q, -O\n"
+  << "    As for ingest.\n"
+  << "  -S, --num_shards=<partitions>\n"
+  << "    As for export_runs.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the local hash database to ingest into\n"
+  << "  <import dir>   the directory to recursively import from\n"
+  << "  <run prefix>   the path of the sorted runs, before the partition\n"
+  ;
+}
+
+static void export_runs() {
+  std::cout
+  << "export_runs -S <partitions> <hashdb> <run prefix>\n"
+  << "  Export the hashes of hash database <hashdb> into <partitions> sorted\n"
+  << "  runs <run prefix>.0 and on, one for each range of leading hash bits,\n"
+  << "  each with the sources its hashes reference.  Runs are a compact binary\n"
+  << "  format, see sorted_run.hpp.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -S, --num_shards=<partitions>\n"
+  << "    The number of hash prefix partitions, at most 256.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to export\n"
+  << "  <run prefix>   the path of the sorted runs, before the partition\n"
+  ;
+}
+
+static void load_runs() {
+  std::cout
+  << "load_runs [-J] <hashdb> <run file> [<run file> ...]\n"
+  << "  Merge sorted runs of one partition, from any number of nodes, into\n"
+  << "  hash database <hashdb>, the shard that owns the partition.  The runs\n"
+  << "  must share the block size and block hash algorithm of <hashdb>.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -J, --defer_hash_store\n"
+  << "    As for ingest.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to load the runs into\n"
+  << "  <run file>     a sorted run written by export_runs or ingest_runs\n"
+  ;
+}
+
+static void export_changes() {
+  std::cout
+  << "export_changes <hashdb> <changes file>\n"
+  << "  Export the changes imported into <hashdb> since its last\n"
+  << "  export_changes into <changes file>.  <hashdb> must have been created\n"
+  << "  with -C.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>         the hash database to export changes from\n"
+  << "  <changes file>   the file to export the changes into\n"
+  ;
+}
+
+static void apply_changes() {
+  std::cout
+  << "apply_changes <replica hashdb> <changes file>\n"
+  << "  Apply changes exported by export_changes to <replica hashdb>, a copy\n"
+  << "  of the exporting hash database made right after one of its\n"
+  << "  exports.  Changes the replica already has are skipped.  The replica\n"
+  << "  may be scanned while the changes apply.  Create the hash database\n"
+  << "  with -m so that scans keep running if the replica grows.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <replica hashdb>   the copy of the hash database to update\n"
+  << "  <changes file>     the changes to apply\n"
+  ;
+}
+
+static void export_filter() {
+  std::cout
+  << "export_filter <hashdb> <filter file>\n"
+  << "  Export a membership filter of the hashes in <hashdb> into <filter\n"
+  << "  file>, at about 1.5 bytes per hash.  Give <filter file> in place of\n"
+  << "  <hashdb> to scan_media or scan_media_list to scan media where\n"
+  << "  <hashdb> is not available.  Each candidate match is printed as its\n"
+  << "  offset and block hash, and about 1% of blocks not in <hashdb> are\n"
+  << "  candidates, so confirm candidates with scan_list against <hashdb>.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>        the hash database to export the filter of\n"
+  << "  <filter file>   the file to export the filter into\n"
+  ;
+}
+
 // Database Manipulation
 static void add() {
   std::cout
   << "add <source hashdb> <destination hashdb>\n"
   << "  Copy hashes from the <source hashdb> to the <destination hashdb>.\n"
+  << "  When <destination hashdb> is new or empty and its settings match,\n"
+  << "  the stores are copied directly instead of hash by hash.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <source hashdb>       the source hash database to copy hashes from\n"
@@ -221,7 +546,9 @@ static void add_range() {
   std::cout
   << "add_range <source hashdb> <destination hashdb> <m:n>\n"
   << "  Copy the hashes from the <source hashdb> to the <destination hashdb>\n"
-  << "  that have source reference count values between m and n.\n"
+  << "  that have source reference count values between m and n.  When\n"
+  << "  <source hashdb> keeps a count index, see create -U, and m is at\n"
+  << "  least 2, only the hashes in range are read.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <source hashdb>       the hash database to copy hashes from that have a\n"
@@ -310,9 +637,34 @@ static void subtract_repository() {
   ;
 }
 
+static void remove_source() {
+  std::cout
+  << "remove_source <hashdb> <hex file hash>\n"
+  << "  Remove the source with the <hex file hash> from the hash database,\n"
+  << "  along with its hash references.  Hashes left with no sources are removed.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>         the hash database to remove the source from\n"
+  << "  <hex file hash>  the file hash of the source to remove\n"
+  ;
+}
+
+static void remove_hash() {
+  std::cout
+  << "remove_hash <hashdb> <hex block hash>\n"
+  << "  Remove the <hex block hash> and its source references from the hash\n"
+  << "  database.  Sources are kept.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>          the hash database to remove the hash from\n"
+  << "  <hex block hash>  the block hash to remove\n"
+  ;
+}
+
 static void scan_list() {
   std::cout
-  << "scan_list [-j e|o|c|a] <hashdb> <hash list file>\n"
+  << "scan_list [-j e|o|c|a] [-n <threads>] [-T <max sources>] [-X] <hashdb>\n"
+  << "          <hash list file>\n"
   << "  Scan hash database <hashdb> for hashes in <hash list file> and print out\n"
   << "  matches.\n"
   << "\n"
@@ -324,6 +676,16 @@ static void scan_list() {
   << "        information.\n"
   << "      c return hash duplicates count\n"
   << "      a return approximate hash duplicates count\n"
+  << "  -n, --num_threads\n"
+  << "    The number of scan threads (default is one per CPU).  Output is in\n"
+  << "    input order.\n"
+  << "  -T, --max_sources\n"
+  << "    The most sources to report per hash in scan modes e and o (default is\n"
+  << "    all).  Hashes with more sources report source_count and\n"
+  << "    next_source_offset; get the rest with scan_hash -G.\n"
+  << "  -X, --compact_common\n"
+  << "    Report hashes pinned by pin_common compactly, with their count and\n"
+  << "    \"common_block\":true, in scan modes e and o.\n"
   << "  -x, --disable_processing\n"
   << "    Disable further processing:\n"
   << "      r disables recursively processing embedded data.\n"
@@ -337,7 +699,8 @@ static void scan_list() {
 
 void scan_hash() {
   std::cout
-  << "scan_hash [-j e|o|c|a] <hashdb> <hex block hash>\n"
+  << "scan_hash [-j e|o|c|a] [-T <max sources>] [-G <first source>] [-X]\n"
+  << "          <hashdb> <hex block hash>\n"
   << "  Scan hash database <hashdb> for the specified <hash value> and print\n"
   << "  out matches.\n"
   << "\n"
@@ -349,6 +712,16 @@ void scan_hash() {
   << "        information.\n"
   << "      c return hash duplicates count\n"
   << "      a return approximate hash duplicates count\n"
+  << "  -T, --max_sources\n"
+  << "    The most sources to report in scan modes e and o (default is all).\n"
+  << "    A hash with more sources reports source_count and\n"
+  << "    next_source_offset.\n"
+  << "  -G, --first_source\n"
+  << "    Report the sources from this offset on, such as a reported\n"
+  << "    next_source_offset, in expanded output.\n"
+  << "  -X, --compact_common\n"
+  << "    Report a hash pinned by pin_common compactly, with its count and\n"
+  << "    \"common_block\":true, in scan modes e and o.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>          the file path to the hash database to use as the\n"
@@ -357,11 +730,36 @@ void scan_hash() {
   ;
 }
 
+void similar() {
+  std::cout
+  << "similar [-T <max sources>] <hashdb> <file | hex file hash>\n"
+  << "  Find the sources in hash database <hashdb> whose block hashes are\n"
+  << "  similar to those of <file> or of the source with <hex file hash>,\n"
+  << "  most similar first.  Similarity is the Jaccard similarity of the\n"
+  << "  two sets of block hashes estimated from their MinHash signatures, to\n"
+  << "  within about 0.06.  Sources below a similarity of about 0.3 are\n"
+  << "  rarely found.  <hashdb> must be created with -Y.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -T, --max_sources\n"
+  << "    The most sources to report (default is all).\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>          the file path to the hash database to use as the\n"
+  << "                    lookup source\n"
+  << "  <file>            a file to hash in blocks as ingest does\n"
+  << "  <hex file hash>   the file hash of a source in <hashdb>\n"
+  ;
+}
+
 void scan_media() {
   std::cout
-  << "scan_media [-s <step size>] [-j e|o|c|a] [-x <r>] <hashdb> <media image>\n"
+  << "scan_media [-s <step size>] [-j e|o|c|a|s] [-x <r>] [-F <fraction> [-A]]\n"
+  << "           [-q] [-O] [-K <checkpoint> [-Z]] [-e <k entropy>] [-o]\n"
+  << "           <hashdb> [<hashdb> ...] <media image>\n"
   << "  Scan hash database <hashdb> for hashes in <media image> and print out\n"
-  << "  matches.\n"
+  << "  matches.  Given more than one <hashdb>, <media image> is read and\n"
+  << "  hashed once and each match is tagged with the <hashdb> it is in.\n"
   << "\n"
   << "  Options:\n"
   << "  -s, --step_size\n"
@@ -373,17 +771,164 @@ void scan_media() {
   << "        information.\n"
   << "      c return hash duplicates count\n"
   << "      a return approximate hash duplicates count\n"
+  << "      s return a summary line per matching source, with its matching\n"
+  << "        block count and offset range, when the scan is done, not with\n"
+  << "        -K or -F\n"
   << "  -x, --disable_processing\n"
   << "    Disable further processing:\n"
   << "      r disables recursively processing embedded data.\n"
+  << "  -F, --sample_fraction=<fraction>\n"
+  << "    Scan only this fraction of <media image>, greater than 0 and at\n"
+  << "    most 1, as one 1 MiB region from each of evenly sized strata, and\n"
+  << "    print the estimated match density with 95% confidence bounds.\n"
+  << "  -A, --scan_around_hits\n"
+  << "    With -F, also scan the rest of each stratum whose sampled region\n"
+  << "    has a match.\n"
+  << "  -q, --quiet\n"
+  << "    Do not print the status of each part of <media image> scanned.\n"
+  << "  -O, --direct_reads\n"
+  << "    Read <media image> around the page cache so that the hash database\n"
+  << "    stays cached.\n"
+  << "  -K, --checkpoint=<checkpoint>\n"
+  << "    Record the offset scanned through in file <checkpoint> every few\n"
+  << "    minutes, removing it when the scan completes.  Not with -F.\n"
+  << "  -Z, --resume\n"
+  << "    Resume an interrupted scan at the offset in <checkpoint>.  Matches\n"
+  << "    printed after that checkpoint are printed again.\n"
+  << "  -e, --min_entropy=<k entropy>\n"
+  << "    Skip blocks whose entropy, scaled up by 1,000 like k_entropy, is\n"
+  << "    under <k entropy> without looking them up.\n"
+  << "  -o, --skip_labeled\n"
+  << "    Skip blocks that get a block label without looking them up.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>          the file path to the hash database to use as the\n"
-  << "                    lookup source\n"
+  << "                    lookup source, one or more, with the same block size\n"
+  << "                    and block hash algorithm, without -F, or one filter\n"
+  << "                    file written by export_filter\n"
   << "  <media image>     the media image file to scan for matching block hashes\n"
   ;
 }
 
+void scan_media_list() {
+  std::cout
+  << "scan_media_list [-s <step size>] [-j e|o|c|a|s] [-x <r>] [-q] [-O]\n"
+  << "           [-Q <depth>] [-e <k entropy>] [-o] <hashdb> [<hashdb> ...]\n"
+  << "           <media list file>\n"
+  << "  Scan hash database <hashdb> for hashes in each media image named in\n"
+  << "  <media list file> and print out matches, each starting with the media\n"
+  << "  image it is in.  Media images on the same device are read one after\n"
+  << "  another and media images on different devices are read in parallel.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -s, --step_size\n"
+  << "    The step size to move along while calculating hashes.\n"
+  << "  -j, --json_scan_mode\n"
+  << "    The JSON scan mode selects optimization and output (default is o):\n"
+  << "      e return expanded output.\n"
+  << "      o return expanded output optimized to not repeat hash and source\n"
+  << "        information.\n"
+  << "      c return hash duplicates count\n"
+  << "      a return approximate hash duplicates count\n"
+  << "      s return a summary line per matching source, with its matching\n"
+  << "        block count and offset range, for each media image when the\n"
+  << "        scan is done\n"
+  << "  -x, --disable_processing\n"
+  << "    Disable further processing:\n"
+  << "      r disables recursively processing embedded data.\n"
+  << "  -q, --quiet\n"
+  << "    Do not print the status of each part of each media image scanned.\n"
+  << "  -O, --direct_reads\n"
+  << "    Read media images around the page cache so that the hash database\n"
+  << "    stays cached.\n"
+  << "  -Q, --queue_depth=<depth>\n"
+  << "    The number of chunks each device may read ahead (default is 2).\n"
+  << "  -e, --min_entropy=<k entropy>\n"
+  << "    Skip blocks whose entropy, scaled up by 1,000 like k_entropy, is\n"
+  << "    under <k entropy> without looking them up.\n"
+  << "  -o, --skip_labeled\n"
+  << "    Skip blocks that get a block label without looking them up.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>          the file path to the hash database to use as the\n"
+  << "                    lookup source, one or more, with the same block size\n"
+  << "                    and block hash algorithm, or one filter file written\n"
+  << "                    by export_filter\n"
+  << "  <media list file> the file listing the media images to scan, one path\n"
+  << "                    per line\n"
+  ;
+}
+
+void server() {
+  std::cout
+  << "server [-j e|o|c|a] [-n <threads>] [-W] [-l] [-L <ms>] <hashdb>\n"
+  << "       <[host:]port>\n"
+  << "  Serve scans of hash database <hashdb> to clients over TCP until\n"
+  << "  interrupted.  Clients send pipelined requests of scan_stream records\n"
+  << "  and receive matches in scan_stream output records, see scan_server.hpp.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -j, --json_scan_mode\n"
+  << "    The JSON scan mode selects optimization and output (default is o):\n"
+  << "      e return expanded output.\n"
+  << "      o return expanded output optimized to not repeat hash and source\n"
+  << "        information.\n"
+  << "      c return hash duplicates count\n"
+  << "      a return approximate hash duplicates count\n"
+  << "  -n, --num_threads\n"
+  << "    The number of scan threads (default is one per CPU).\n"
+  << "  -W, --warm\n"
+  << "    Read the database into the page cache before serving.\n"
+  << "  -l, --lock_hash_store\n"
+  << "    Lock the in-memory hash store into RAM, see ulimit -l.\n"
+  << "  -L, --max_staleness=<ms>\n"
+  << "    While another process imports into <hashdb>, answer from a read\n"
+  << "    snapshot up to <ms> milliseconds old instead of the latest data\n"
+  << "    (default is 0, the latest data).\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>          the file path to the hash database to use as the\n"
+  << "                    lookup source\n"
+  << "  <[host:]port>     the address to listen on, 127.0.0.1 if no host is\n"
+  << "                    given, or port 0 for a port chosen by the system\n"
+  ;
+}
+
+void warm() {
+  std::cout
+  << "warm [-n <threads>] <hashdb>\n"
+  << "  Read the hash store and then the hash data store of <hashdb> into the\n"
+  << "  page cache using large sequential reads so that later scans do not\n"
+  << "  wait on the disk.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -n, --num_threads\n"
+  << "    The number of reader threads (default is one per CPU).\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to warm\n"
+  ;
+}
+
+void pin_common() {
+  std::cout
+  << "pin_common [-B <max pinned>] <hashdb> <min count>\n"
+  << "  Pin the hashes of <hashdb> with at least <min count> sources so that\n"
+  << "  scans answer them from memory.  The pinned hashes are chosen from the\n"
+  << "  approximate counts of the hash store and saved in <hashdb>.  Pin again\n"
+  << "  after importing, since the pinned set is not used once the database\n"
+  << "  changes.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -B, --max_pinned\n"
+  << "    The most hashes to pin, the most common first (default is all).\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to pin common blocks of\n"
+  << "  <min count>    the smallest count of a pinned hash\n"
+  ;
+}
+
 // Statistics
 static void size() {
   std::cout
@@ -395,6 +940,23 @@ static void size() {
   ;
 }
 
+static void estimate() {
+  std::cout
+  << "estimate <hashdb1> [<hashdb2>]\n"
+  << "  Estimate the number of distinct block hashes in <hashdb1> from its\n"
+  << "  HyperLogLog sketch, which imports keep up to date.  Given <hashdb2>,\n"
+  << "  also estimate the hashes in each, in their union, in their intersect,\n"
+  << "  and in <hashdb1> subtract <hashdb2>, to size an intersect or subtract\n"
+  << "  before running it.  Estimates are within a few percent.  A hashdb\n"
+  << "  without a sketch is read once to make one.  Removed hashes are still\n"
+  << "  counted.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb1>      the hash database to estimate\n"
+  << "  <hashdb2>      a second hash database to estimate the overlap with\n"
+  ;
+}
+
 static void sources() {
   std::cout
   << "sources <hashdb>\n"
@@ -409,8 +971,14 @@ static void sources() {
 
 static void histogram() {
   std::cout
-  << "histogram <hashdb>\n"
+  << "histogram [-R] <hashdb>\n"
   << "  Print the histogram of hashes for the given <hashdb> database.\n"
+  << "  The histogram is kept up to date as hashes are imported so that it is\n"
+  << "  printed without reading every hash.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -R, --recompute\n"
+  << "    Calculate the histogram by reading every hash, for verification.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to print the histogram of hashes for\n"
@@ -419,9 +987,10 @@ static void histogram() {
 
 static void duplicates() {
   std::cout
-  << "duplicates [-j e|o|c|a] <hashdb> <number>\n"
+  << "duplicates [-j e|o|c|a] [-R] <hashdb> <number>\n"
   << "  Print the hashes in the given <hashdb> database that are sourced the\n"
-  << "  given <number> of times.\n"
+  << "  given <number> of times.  Hashes are not read when the histogram shows\n"
+  << "  that none are sourced <number> times.\n"
   << "\n"
   << "  Options:\n"
   << "  -j, --json_scan_mode\n"
@@ -431,6 +1000,9 @@ static void duplicates() {
   << "        information.\n"
   << "      c return hash duplicates count\n"
   << "      a return approximate hash duplicates count\n"
+  << "  -R, --recompute\n"
+  << "    Read every hash without checking the histogram or the count index\n"
+  << "    first.\n"
   << "\n"
   << "  Parameters:\n"
   << "  <hashdb>       the hash database to print duplicate hashes about\n"
@@ -442,7 +1014,8 @@ static void hash_table() {
   std::cout
   << "hash_table [-j e|o|c|a] <hashdb> <hex file hash>\n"
   << "  Print hashes from the given <hashdb> database that are associated with\n"
-  << "  the <source_id> source index.\n"
+  << "  the <source_id> source index.  Databases created with -I read them\n"
+  << "  from their source hash index instead of walking every hash.\n"
   << "\n"
   << "  Options:\n"
   << "  -j, --json_scan_mode\n"
@@ -472,6 +1045,22 @@ static void read_media() {
   ;
 }
 
+static void read_media_list() {
+  std::cout
+  << "read_media_list <media image> <media offsets file> <count>\n"
+  << "  Print the media offset and <count> raw bytes in hex for each media\n"
+  << "  offset in <media offsets file>, one per line.  The <media image> is\n"
+  << "  opened once, nearby reads are coalesced, and decompressed members\n"
+  << "  are kept for later media offsets into the same member.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <media image>         the media image file to read raw bytes from\n"
+  << "  <media offsets file>  the file of media offsets to read, for example\n"
+  << "                        1000 or 1000-zip-0, or - for stdin\n"
+  << "  <count>               the number of raw bytes to read at each offset\n"
+  ;
+}
+
 static void read_media_size() {
   std::cout
   << "read_media_size <media image>\n"
@@ -581,12 +1170,112 @@ static void test_scan_stream() {
   ;
 }
 
+static void benchmark() {
+  std::cout
+  << "benchmark [<create options>] [-j e|o|c|a] [-n <threads>] [-P <rate>]\n"
+  << "          [-z <exponent>|-D <histogram>] <hashdb> <count>\n"
+  << "  Create hash database <hashdb>, add <count> generated hashes that each\n"
+  << "  appear in a drawn number of sources, then scan <count> hashes at 1, 2,\n"
+  << "  4, ... threads.  Print JSON lines with ingest MB/s and records/s,\n"
+  << "  database bytes per hash and per record, and scans per second with\n"
+  << "  p50 and p99 lookup latency at each thread count.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  The -b, -a, -f, -k, -i, -m, -y, and -I options of create set the\n"
+  << "  settings of <hashdb>.\n"
+  << "  -j, --json_scan_mode\n"
+  << "    The JSON scan mode selects optimization and output (default is o):\n"
+  << "      e return expanded output.\n"
+  << "      o return expanded output optimized to not repeat hash and source\n"
+  << "        information.\n"
+  << "      c return hash duplicates count\n"
+  << "      a return approximate hash duplicates count\n"
+  << "  -n, --num_threads\n"
+  << "    The largest number of scan threads (default is one per CPU).\n"
+  << "  -P, --hit_rate=<rate>\n"
+  << "    The fraction of scanned hashes that are present (default is 0.5).\n"
+  << "  -z, --zipf_exponent=<exponent>\n"
+  << "    Draw the number of sources of each hash, up to 1000, from a Zipf\n"
+  << "    distribution with this exponent (default is 2.0).\n"
+  << "  -D, --duplicates_histogram=<histogram>\n"
+  << "    Draw the number of sources of each hash from the duplicates\n"
+  << "    histogram in file <histogram>, as printed by the histogram command\n"
+  << "    on a production database.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the new hash database to create\n"
+  << "  <count>        the number of hashes to add and to scan\n"
+  ;
+}
+
+static void benchmark_scan_stream() {
+  std::cout
+  << "benchmark_scan_stream [-j e|o|c|a] [-n <threads>] [-P <rate>] <hashdb>\n"
+  << "          <producers> <batch size> <batches>\n"
+  << "  Start <producers> threads that each put <batches> batches of <batch\n"
+  << "  size> hashes onto one shared scan stream of <hashdb> while another\n"
+  << "  thread gets the results.  Print a JSON line with hashes per second,\n"
+  << "  p50, p99, and maximum latency from put to get of batches returned,\n"
+  << "  the queue wait and scan time of arrays, and the CPU utilization of\n"
+  << "  each producer, of the collector, and of the scan threads on average.\n"
+  << "  Batches without a match are not returned by the scan stream, so\n"
+  << "  their latency is not measured.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -j, --json_scan_mode\n"
+  << "    The JSON scan mode selects optimization and output (default is o):\n"
+  << "      e return expanded output.\n"
+  << "      o return expanded output optimized to not repeat hash and source\n"
+  << "        information.\n"
+  << "      c return hash duplicates count\n"
+  << "      a return approximate hash duplicates count\n"
+  << "  -n, --num_threads\n"
+  << "    The number of scan threads (default is one per CPU).\n"
+  << "  -P, --hit_rate=<rate>\n"
+  << "    The fraction of hashes drawn from the first 100,000 hashes of\n"
+  << "    <hashdb> (default is 0.5).  The others are absent.\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <hashdb>       the hash database to scan\n"
+  << "  <producers>    the number of threads putting batches\n"
+  << "  <batch size>   the number of hashes in each batch\n"
+  << "  <batches>      the number of batches each producer puts\n"
+  ;
+}
+
+static void benchmark_read() {
+  std::cout
+  << "benchmark_read [-n <threads>] [-Q <depth>] <media image>\n"
+  << "  Read <media image> as scan_media does but without hashing, mapped,\n"
+  << "  read into buffers, and read around the page cache, in jobs of 1, 4,\n"
+  << "  and 16 MiB at queue depths of 1, 2, 4, ... chunks.  Print JSON lines\n"
+  << "  with MB/s and CPU nanoseconds per byte for each.  E01 images are read\n"
+  << "  through libewf.  Results depend on how much of the image is already\n"
+  << "  in the page cache.\n"
+  << "\n"
+  << "  Options:\n"
+  << "  -n, --num_threads\n"
+  << "    The number of job threads (default is one per CPU).\n"
+  << "  -Q, --queue_depth=<depth>\n"
+  << "    The largest number of chunks read ahead of the job queue (default\n"
+  << "    is 8).\n"
+  << "\n"
+  << "  Parameters:\n"
+  << "  <media image>  the media image to read\n"
+  ;
+}
+
 static void all() {
   overview();
 
   // New Database
   std::cout << "\nNew Database:\n";
   create();
+  migrate();
+  compress_names();
+  optimize();
+  rebuild_hash_store();
+  freeze();
 
   // Import/Export
   std::cout << "\nImport/Export:\n";
@@ -594,6 +1283,12 @@ static void all() {
   import_tab();
   import();
   export_json();
+  export_changes();
+  apply_changes();
+  export_filter();
+  ingest_runs();
+  export_runs();
+  load_runs();
 
   // Database Manipulation
   std::cout << "\nDatabase Manipulation:\n";
@@ -606,21 +1301,30 @@ static void all() {
   subtract();
   subtract_hash();
   subtract_repository();
+  remove_source();
+  remove_hash();
 
   // Scan
   std::cout << "\nScan:\n";
   scan_list();
   scan_hash();
+  similar();
   scan_media();
+  scan_media_list();
+  server();
+  warm();
+  pin_common();
 
   // Statistics
   std::cout << "\nStatistics:\n";
   size();
+  estimate();
   sources();
   histogram();
   duplicates();
   hash_table();
   read_media();
+  read_media_list();
   read_media_size();
 
   // Performance Analysis
@@ -630,6 +1334,9 @@ static void all() {
   add_same();
   scan_same();
   test_scan_stream();
+  benchmark();
+  benchmark_scan_stream();
+  benchmark_read();
 }
 
 void usage(const std::string& command) {
@@ -639,12 +1346,23 @@ void usage(const std::string& command) {
 
   // New Database
   else if (command == "create") create();
+  else if (command == "migrate") migrate();
+  else if (command == "compress_names") compress_names();
+  else if (command == "optimize") optimize();
+  else if (command == "rebuild_hash_store") rebuild_hash_store();
+  else if (command == "freeze") freeze();
 
   // Import/Export
   else if (command == "ingest") ingest();
   else if (command == "import_tab") import_tab();
   else if (command == "import") import();
   else if (command == "export") export_json();
+  else if (command == "export_changes") export_changes();
+  else if (command == "apply_changes") apply_changes();
+  else if (command == "export_filter") export_filter();
+  else if (command == "ingest_runs") ingest_runs();
+  else if (command == "export_runs") export_runs();
+  else if (command == "load_runs") load_runs();
 
   // Database Manipulation
   else if (command == "add") add();
@@ -656,19 +1374,28 @@ void usage(const std::string& command) {
   else if (command == "subtract") subtract();
   else if (command == "subtract_hash") subtract_hash();
   else if (command == "subtract_repository") subtract_repository();
+  else if (command == "remove_source") remove_source();
+  else if (command == "remove_hash") remove_hash();
 
   // Scan
   else if (command == "scan_list") scan_list();
   else if (command == "scan_hash") scan_hash();
+  else if (command == "similar") similar();
   else if (command == "scan_media") scan_media();
+  else if (command == "scan_media_list") scan_media_list();
+  else if (command == "server") server();
+  else if (command == "warm") warm();
+  else if (command == "pin_common") pin_common();
 
   // Statistics
   else if (command == "size") size();
+  else if (command == "estimate") estimate();
   else if (command == "sources") sources();
   else if (command == "histogram") histogram();
   else if (command == "duplicates") duplicates();
   else if (command == "hash_table") hash_table();
   else if (command == "read_media") read_media();
+  else if (command == "read_media_list") read_media_list();
   else if (command == "read_media_size") read_media_size();
 
   // Performance Analysis
@@ -677,6 +1404,9 @@ void usage(const std::string& command) {
   else if (command == "add_same") add_same();
   else if (command == "scan_same") scan_same();
   else if (command == "test_scan_stream") test_scan_stream();
+  else if (command == "benchmark") benchmark();
+  else if (command == "benchmark_scan_stream") benchmark_scan_stream();
+  else if (command == "benchmark_read") benchmark_read();
 
   // fail
   else {
@@ -0,0 +1,72 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * The dictionary of block labels given by calculate_block_label.  A
+ * calculated label is some of the flags R, H, W, and M in that order, so
+ * it is kept as a bitmask code from 1 to 15.  Code 0 means the label is
+ * empty or is not a calculated label, such as a label from imported
+ * JSON, and must be kept as a string.
+ */
+
+#ifndef BLOCK_LABEL_CODE_HPP
+#define BLOCK_LABEL_CODE_HPP
+
+#include <string>
+#include <stdint.h>
+
+namespace hashdb {
+
+  // block label flags, in the order they appear in a label
+  static const uint8_t block_label_ramp = 0x01;          // R
+  static const uint8_t block_label_histogram = 0x02;     // H
+  static const uint8_t block_label_whitespace = 0x04;    // W
+  static const uint8_t block_label_monotonic = 0x08;     // M
+  static const uint8_t max_block_label_code = 0x0f;
+
+  // the label of a code, "" for code 0
+  inline const std::string& block_label_of_code(const uint8_t code) {
+    static const std::string labels[max_block_label_code + 1] = {
+      "", "R", "H", "RH", "W", "RW", "HW", "RHW",
+      "M", "RM", "HM", "RHM", "WM", "RWM", "HWM", "RHWM"};
+    return labels[code & max_block_label_code];
+  }
+
+  // the code of a label, 0 when it is not in the dictionary
+  inline uint8_t block_label_code(const std::string& block_label) {
+    static const char flags[] = "RHWM";
+    uint8_t code = 0;
+    size_t j = 0;
+    for (size_t i = 0; i < block_label.size(); ++i) {
+      while (j < 4 && flags[j] != block_label[i]) {
+        ++j;
+      }
+      if (j == 4) {
+        return 0;
+      }
+      code |= static_cast<uint8_t>(1 << j);
+      ++j;
+    }
+    return code;
+  }
+
+} // end namespace hashdb
+
+#endif
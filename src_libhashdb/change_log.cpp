@@ -0,0 +1,475 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Export the change log of a hashdb and apply exported changes to a
+ * replica, see change_log.hpp.
+ *
+ * The hashdb directory holds the position of the last export in
+ * change_log_exported.txt.  A replica holds the position it has
+ * applied up to in change_log_applied.txt, or, right after it was
+ * copied, the copied change_log_exported.txt of its primary.
+ */
+
+#include <config.h>
+#include "change_log.hpp"
+#include "hashdb.hpp"
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <map>
+#include <cstdio>      // for std::rename
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include "rapidjson.h"
+#include "reader.h"
+
+namespace hashdb {
+
+  static std::string exported_filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/change_log_exported.txt";
+  }
+
+  static std::string applied_filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/change_log_applied.txt";
+  }
+
+  // read a position file, false if it does not exist or is invalid
+  static bool read_position(const std::string& filename,
+                            uint64_t& position) {
+    std::ifstream in(filename.c_str());
+    if (!in.is_open()) {
+      return false;
+    }
+    in >> position;
+    return !in.fail();
+  }
+
+  // replace a position file
+  static std::string write_position(const std::string& filename,
+                                    const uint64_t position) {
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str());
+    if (!out.is_open()) {
+      return "Unable to open position file '" + temp_filename + "': " +
+             strerror(errno);
+    }
+    out << position << "\n";
+    out.close();
+    if (out.fail() ||
+        std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      return "Unable to write position file '" + filename + "': " +
+             strerror(errno);
+    }
+    return "";
+  }
+
+  // the offset just past the last complete change at or after from
+  static uint64_t last_change_end(std::ifstream& in, const uint64_t from,
+                                  uint64_t end) {
+    char buffer[4096];
+    while (end > from) {
+      const uint64_t start = (end - from > sizeof(buffer)) ?
+                                         end - sizeof(buffer) : from;
+      in.seekg(static_cast<std::streamoff>(start));
+      in.read(buffer, static_cast<std::streamsize>(end - start));
+      for (uint64_t i=end - start; i>0; --i) {
+        if (buffer[i-1] == '\n') {
+          return start + i;
+        }
+      }
+      end = start;
+    }
+    return from;
+  }
+
+  std::string export_changes(const std::string& hashdb_dir,
+                             const std::string& changes_file) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (!settings.change_log) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' does not keep a change log.";
+    }
+
+    // the changes since the last export, up to the last complete change
+    uint64_t from = 0;
+    read_position(exported_filename(hashdb_dir), from);
+    const std::string log_filename = change_log_t::filename(hashdb_dir);
+    std::ifstream in(log_filename.c_str(), std::ios::binary);
+    uint64_t to = from;
+    if (in.is_open()) {
+      in.seekg(0, std::ios::end);
+      const uint64_t size = static_cast<uint64_t>(in.tellg());
+      if (size < from) {
+        return "The change log at path '" + log_filename +
+               "' is shorter than its last export.";
+      }
+      to = last_change_end(in, from, size);
+    } else if (from != 0) {
+      return "Unable to open change log '" + log_filename + "': " +
+             strerror(errno);
+    }
+
+    std::ofstream out(changes_file.c_str(), std::ios::binary);
+    if (!out.is_open()) {
+      return "Unable to open changes file '" + changes_file + "': " +
+             strerror(errno);
+    }
+    out << "{\"changes_from\":" << from << ", \"changes_to\":" << to
+        << "}\n";
+    if (to > from) {
+      in.clear();
+      in.seekg(static_cast<std::streamoff>(from));
+      std::vector<char> buffer(1<<20);
+      uint64_t remaining = to - from;
+      while (remaining > 0 && in.good()) {
+        const size_t count = (remaining < buffer.size()) ?
+                             static_cast<size_t>(remaining) : buffer.size();
+        in.read(&buffer[0], static_cast<std::streamsize>(count));
+        out.write(&buffer[0], in.gcount());
+        remaining -= static_cast<uint64_t>(in.gcount());
+      }
+      if (remaining > 0) {
+        return "Unable to read change log '" + log_filename + "'.";
+      }
+    }
+    out.close();
+    if (out.fail()) {
+      return "Unable to write changes file '" + changes_file + "'.";
+    }
+
+    // mark the changes exported
+    return write_position(exported_filename(hashdb_dir), to);
+  }
+
+  // the members of a change, or of the header of a changes file
+  struct change_t {
+    std::map<std::string, std::string> strings;
+    std::map<std::string, uint64_t> numbers;
+    bool has_hashes;
+    hash_inserts_t hashes;   // the [block_hash, k_entropy, label] triples
+    change_t() : strings(), numbers(), has_hashes(false), hashes() {
+    }
+  };
+
+  // read a change from its JSON line without building a DOM document.
+  // Members of other types are ignored, and a "hashes" array must hold
+  // only triples.
+  class change_handler_t : public rapidjson::BaseReaderHandler<
+                                    rapidjson::UTF8<>, change_handler_t> {
+    private:
+    change_t& change;
+    std::string key;
+    int depth;               // 1 in the change, 2 in hashes, 3 in a triple
+    size_t field;            // the next field of the triple
+    hash_insert_t triple;
+
+    public:
+    explicit change_handler_t(change_t& p_change) :
+                 change(p_change), key(), depth(0), field(0),
+                 triple() {
+    }
+
+    bool Default() {
+      return depth == 1;
+    }
+
+    bool StartObject() {
+      return ++depth == 1;
+    }
+
+    bool Key(const char* const str, const rapidjson::SizeType length,
+             const bool) {
+      key.assign(str, length);
+      return true;
+    }
+
+    bool EndObject(const rapidjson::SizeType) {
+      --depth;
+      return true;
+    }
+
+    bool String(const char* const str, const rapidjson::SizeType length,
+                const bool) {
+      if (depth == 1) {
+        change.strings[key].assign(str, length);
+        return true;
+      }
+      if (depth == 3 && field == 0) {
+        triple.block_hash = hashdb::hex_to_bin(std::string(str, length));
+        ++field;
+        return true;
+      }
+      if (depth == 3 && field == 2) {
+        triple.block_label.assign(str, length);
+        ++field;
+        return true;
+      }
+      return false;
+    }
+
+    bool Uint(const unsigned value) {
+      return Uint64(value);
+    }
+
+    bool Uint64(const uint64_t value) {
+      if (depth == 1) {
+        change.numbers[key] = value;
+        return true;
+      }
+      if (depth == 3 && field == 1) {
+        triple.k_entropy = value;
+        ++field;
+        return true;
+      }
+      return false;
+    }
+
+    bool StartArray() {
+      if (depth == 1 && key == "hashes") {
+        change.has_hashes = true;
+        depth = 2;
+        return true;
+      }
+      if (depth == 2) {
+        depth = 3;
+        field = 0;
+        return true;
+      }
+      return false;
+    }
+
+    bool EndArray(const rapidjson::SizeType) {
+      if (depth == 3) {
+        if (field != 3) {
+          return false;
+        }
+        change.hashes.push_back(triple);
+      }
+      --depth;
+      return true;
+    }
+  };
+
+  // parse a change, false if it is not a JSON object of valid members
+  static bool parse_change(const std::string& line, change_t& change) {
+    change_handler_t handler(change);
+    rapidjson::Reader reader;
+    rapidjson::StringStream stream(line.c_str());
+    return !reader.Parse(stream, handler).IsError();
+  }
+
+  // a string member of a change
+  static bool get_string(const change_t& change,
+                         const char* const name, std::string& value) {
+    std::map<std::string, std::string>::const_iterator it =
+                                              change.strings.find(name);
+    if (it == change.strings.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+
+  // a hexadecimal member of a change in binary
+  static bool get_hex(const change_t& change,
+                      const char* const name, std::string& value) {
+    std::string hex_string;
+    if (!get_string(change, name, hex_string)) {
+      return false;
+    }
+    value = hashdb::hex_to_bin(hex_string);
+    return value.size() != 0;
+  }
+
+  // an unsigned integer member of a change
+  static bool get_uint64(const change_t& change,
+                         const char* const name, uint64_t& value) {
+    std::map<std::string, uint64_t>::const_iterator it =
+                                              change.numbers.find(name);
+    if (it == change.numbers.end()) {
+      return false;
+    }
+    value = it->second;
+    return true;
+  }
+
+  // replay one change, false if it is invalid
+  static bool apply_change(import_manager_t& manager,
+                           const std::string& line) {
+    change_t change;
+    if (!parse_change(line, change)) {
+      return false;
+    }
+    std::string op;
+    std::string block_hash;
+    std::string file_hash;
+    std::string text1;
+    std::string text2;
+    uint64_t value1;
+    uint64_t value2;
+    uint64_t value3;
+    if (!get_string(change, "op", op)) {
+      return false;
+
+    } else if (op == "source_name") {
+      if (!get_hex(change, "file_hash", file_hash) ||
+          !get_string(change, "repository_name", text1) ||
+          !get_string(change, "filename", text2)) {
+        return false;
+      }
+      manager.insert_source_name(file_hash, text1, text2);
+
+    } else if (op == "source_data") {
+      if (!get_hex(change, "file_hash", file_hash) ||
+          !get_uint64(change, "filesize", value1) ||
+          !get_string(change, "file_type", text1) ||
+          !get_uint64(change, "zero_count", value2) ||
+          !get_uint64(change, "nonprobative_count", value3)) {
+        return false;
+      }
+      manager.insert_source_data(file_hash, value1, text1, value2, value3);
+
+    } else if (op == "insert_hash" || op == "merge_hash") {
+      if (!get_hex(change, "block_hash", block_hash) ||
+          !get_uint64(change, "k_entropy", value1) ||
+          !get_string(change, "block_label", text1) ||
+          !get_hex(change, "file_hash", file_hash)) {
+        return false;
+      }
+      if (op == "insert_hash") {
+        manager.insert_hash(block_hash, value1, text1, file_hash);
+      } else {
+        if (!get_uint64(change, "sub_count", value2)) {
+          return false;
+        }
+        manager.merge_hash(block_hash, value1, text1, file_hash, value2);
+      }
+
+    } else if (op == "insert_hashes") {
+      if (!get_hex(change, "file_hash", file_hash) || !change.has_hashes) {
+        return false;
+      }
+      manager.insert_hashes(file_hash, change.hashes);
+
+    } else if (op == "remove_source") {
+      if (!get_hex(change, "file_hash", file_hash)) {
+        return false;
+      }
+      manager.remove_source(file_hash);
+
+    } else if (op == "remove_hash") {
+      if (!get_hex(change, "block_hash", block_hash)) {
+        return false;
+      }
+      manager.remove_hash(block_hash);
+
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  std::string apply_changes(const std::string& hashdb_dir,
+                            const std::string& changes_file,
+                            const std::string& command_string) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // read the range of the changes
+    std::ifstream in(changes_file.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return "Unable to open changes file '" + changes_file + "': " +
+             strerror(errno);
+    }
+    std::string line;
+    getline(in, line);
+    change_t header;
+    uint64_t from;
+    uint64_t to;
+    if (!parse_change(line, header) ||
+        !get_uint64(header, "changes_from", from) ||
+        !get_uint64(header, "changes_to", to) || to < from) {
+      return "Invalid changes file '" + changes_file + "'.";
+    }
+    const uint64_t header_size = line.size() + 1;
+    in.seekg(0, std::ios::end);
+    if (static_cast<uint64_t>(in.tellg()) != header_size + to - from) {
+      return "The changes file '" + changes_file + "' is incomplete.";
+    }
+    in.seekg(static_cast<std::streamoff>(header_size));
+
+    // the changes must follow on from the replica
+    uint64_t position = 0;
+    if (!read_position(applied_filename(hashdb_dir), position)) {
+      read_position(exported_filename(hashdb_dir), position);
+    }
+    if (from > position) {
+      std::stringstream ss;
+      ss << "The changes in '" << changes_file << "' start at position "
+         << from << " but the replica at path '" << hashdb_dir
+         << "' is at position " << position << ".";
+      return ss.str();
+    }
+    if (to <= position) {
+      // already applied
+      return "";
+    }
+
+    // replay the changes past the position, without logging them
+    uint64_t offset = from;
+    {
+      import_manager_t manager(hashdb_dir, command_string);
+      delete manager.change_log;
+      manager.change_log = NULL;
+      while (offset < to && getline(in, line)) {
+        const uint64_t next = offset + line.size() + 1;
+        if (next > position && !apply_change(manager, line)) {
+          std::stringstream ss;
+          ss << "Invalid change at position " << offset << " in '"
+             << changes_file << "'.";
+          error_message = ss.str();
+          break;
+        }
+        offset = next;
+      }
+    }
+
+    // the replica has the changes before offset
+    if (offset > position) {
+      const std::string position_error =
+               write_position(applied_filename(hashdb_dir), offset);
+      if (error_message.size() == 0) {
+        error_message = position_error;
+      }
+    }
+    return error_message;
+  }
+}
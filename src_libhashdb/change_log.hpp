@@ -0,0 +1,223 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Append the changes made by an import_manager_t to the change log of
+ * a hashdb so that export_changes can ship them to replicas.
+ *
+ * Each change is one line of JSON in change_log.json under the hashdb
+ * directory, written as the call that makes it is made.  A change is
+ * named by "op" and holds the arguments of that import_manager_t call
+ * with binary hashes in hexadecimal, so that apply_changes replays the
+ * call on a replica.  The position of a change in the log is its byte
+ * offset.  Threadsafe.
+ */
+
+#ifndef CHANGE_LOG_HPP
+#define CHANGE_LOG_HPP
+
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <pthread.h>
+#include "hashdb.hpp"
+#include "rapidjson.h"
+#include "writer.h"
+#include "stringbuffer.h"
+
+namespace hashdb {
+
+class change_log_t {
+  private:
+  std::ofstream os;
+  rapidjson::StringBuffer strbuf;
+  rapidjson::Writer<rapidjson::StringBuffer> writer;
+  pthread_mutex_t M;
+
+  // do not allow copy or assignment
+  change_log_t(const change_log_t&);
+  change_log_t& operator=(const change_log_t&);
+
+  void string(const std::string& s) {
+    writer.String(s.c_str(), s.size());
+  }
+
+  void hex(const std::string& binary) {
+    string(hashdb::bin_to_hex(binary));
+  }
+
+  // lock and start a change
+  void begin(const char* const op) {
+    pthread_mutex_lock(&M);
+    strbuf.Clear();
+    writer.Reset(strbuf);
+    writer.StartObject();
+    writer.String("op");
+    writer.String(op);
+  }
+
+  // end the change, append it, and unlock
+  void end() {
+    writer.EndObject();
+    os.write(strbuf.GetString(), strbuf.GetSize());
+    os.put('\n');
+    pthread_mutex_unlock(&M);
+  }
+
+  public:
+  static std::string filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/change_log.json";
+  }
+
+  change_log_t(const std::string& hashdb_dir) :
+                    os(), strbuf(), writer(strbuf), M() {
+
+    // open append, fatal if unable to open
+    const std::string log_filename = filename(hashdb_dir);
+    os.open(log_filename.c_str(), std::fstream::app | std::fstream::binary);
+    if (!os.is_open()) {
+      std::cerr << "Cannot open change log file " << log_filename
+                << ": " << strerror(errno) << "\nAborting.\n";
+      exit(1);
+    }
+    pthread_mutex_init(&M, NULL);
+  }
+
+  ~change_log_t() {
+    os.close();
+    pthread_mutex_destroy(&M);
+  }
+
+  // write appended changes through to the file
+  void flush() {
+    pthread_mutex_lock(&M);
+    os.flush();
+    pthread_mutex_unlock(&M);
+  }
+
+  void insert_source_name(const std::string& file_hash,
+                          const std::string& repository_name,
+                          const std::string& filename) {
+    begin("source_name");
+    writer.String("file_hash");
+    hex(file_hash);
+    writer.String("repository_name");
+    string(repository_name);
+    writer.String("filename");
+    string(filename);
+    end();
+  }
+
+  void insert_source_data(const std::string& file_hash,
+                          const uint64_t filesize,
+                          const std::string& file_type,
+                          const uint64_t zero_count,
+                          const uint64_t nonprobative_count) {
+    begin("source_data");
+    writer.String("file_hash");
+    hex(file_hash);
+    writer.String("filesize");
+    writer.Uint64(filesize);
+    writer.String("file_type");
+    string(file_type);
+    writer.String("zero_count");
+    writer.Uint64(zero_count);
+    writer.String("nonprobative_count");
+    writer.Uint64(nonprobative_count);
+    end();
+  }
+
+  void insert_hash(const std::string& block_hash,
+                   const uint64_t k_entropy,
+                   const std::string& block_label,
+                   const std::string& file_hash) {
+    begin("insert_hash");
+    writer.String("block_hash");
+    hex(block_hash);
+    writer.String("k_entropy");
+    writer.Uint64(k_entropy);
+    writer.String("block_label");
+    string(block_label);
+    writer.String("file_hash");
+    hex(file_hash);
+    end();
+  }
+
+  // hashes is written as [block_hash, k_entropy, block_label] triples
+  void insert_hashes(const std::string& file_hash,
+                     const hash_inserts_t& hashes) {
+    begin("insert_hashes");
+    writer.String("file_hash");
+    hex(file_hash);
+    writer.String("hashes");
+    writer.StartArray();
+    for (hash_inserts_t::const_iterator it = hashes.begin();
+         it != hashes.end(); ++it) {
+      writer.StartArray();
+      hex(it->block_hash);
+      writer.Uint64(it->k_entropy);
+      string(it->block_label);
+      writer.EndArray();
+    }
+    writer.EndArray();
+    end();
+  }
+
+  void merge_hash(const std::string& block_hash,
+                  const uint64_t k_entropy,
+                  const std::string& block_label,
+                  const std::string& file_hash,
+                  const uint64_t sub_count) {
+    begin("merge_hash");
+    writer.String("block_hash");
+    hex(block_hash);
+    writer.String("k_entropy");
+    writer.Uint64(k_entropy);
+    writer.String("block_label");
+    string(block_label);
+    writer.String("file_hash");
+    hex(file_hash);
+    writer.String("sub_count");
+    writer.Uint64(sub_count);
+    end();
+  }
+
+  void remove_source(const std::string& file_hash) {
+    begin("remove_source");
+    writer.String("file_hash");
+    hex(file_hash);
+    end();
+  }
+
+  void remove_hash(const std::string& block_hash) {
+    begin("remove_hash");
+    writer.String("block_hash");
+    hex(block_hash);
+    end();
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,183 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides the pinned set of common blocks of a hashdb: the hashes with
+ * the highest counts, which account for many scan matches and which
+ * clients usually discard as non-probative.
+ *
+ * The set is chosen from the approximate counts of the hash store by
+ * pin_common_blocks and saved to common_blocks in the hashdb directory.
+ * The file records the generation of the hash store it was made from,
+ * see lmdb_hash_manager_t::generation, so that a stale set is not used.
+ *
+ * scan_manager_t reads a current set when it opens and keeps the whole
+ * scan result of each pinned hash in memory, including its JSON text for
+ * each scan mode and a compact common block response, so that scans
+ * answer pinned hashes without LMDB lookups or building JSON.
+ */
+
+#ifndef COMMON_BLOCKS_HPP
+#define COMMON_BLOCKS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include "hashdb.hpp"
+
+namespace hashdb {
+
+// the scan results of a pinned hash
+struct common_block_t {
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  source_sub_counts_t source_sub_counts;
+  std::string expanded_json;      // EXPANDED with every source
+  std::string compact_json;       // the compact common block response
+  std::string count_json;         // COUNT
+  std::string approximate_json;   // APPROXIMATE_COUNT
+  std::string binary;             // BINARY
+  common_block_t() : k_entropy(0), block_label(), count(0),
+                     source_sub_counts(), expanded_json(), compact_json(),
+                     count_json(), approximate_json(), binary() {
+  }
+};
+
+class common_blocks_t {
+
+  private:
+  // do not allow copy or assignment
+  common_blocks_t(const common_blocks_t&);
+  common_blocks_t& operator=(const common_blocks_t&);
+
+  struct file_header_t {
+    char magic[8];
+    uint64_t generation;
+    uint64_t min_count;
+    uint64_t num_hashes;
+  };
+
+  public:
+  uint64_t generation;                   // of the hash store
+  uint64_t min_count;                    // the approximate count pinned
+  std::vector<std::string> block_hashes; // ascending
+  std::map<std::string, common_block_t> results; // filled by the scanner
+
+  common_blocks_t(const uint64_t p_generation, const uint64_t p_min_count) :
+           generation(p_generation), min_count(p_min_count),
+           block_hashes(), results() {
+  }
+
+  static std::string filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/common_blocks";
+  }
+
+  /**
+   * The result of a pinned hash, or NULL if it is not pinned.
+   */
+  const common_block_t* find(const std::string& block_hash) const {
+    if (results.size() == 0) {
+      return NULL;
+    }
+    std::map<std::string, common_block_t>::const_iterator it =
+                                                results.find(block_hash);
+    return (it == results.end()) ? NULL : &it->second;
+  }
+
+  /**
+   * Read the set from filename.  Returns NULL if the file is missing or
+   * is not for the hash store of this generation.
+   */
+  static common_blocks_t* read(const std::string& filename,
+                               const uint64_t p_generation) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return NULL;
+    }
+    file_header_t header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good() || memcmp(header.magic, "hdbcmn1", 8) != 0 ||
+        header.generation != p_generation) {
+      return NULL;
+    }
+    common_blocks_t* common_blocks =
+                     new common_blocks_t(p_generation, header.min_count);
+    for (uint64_t i=0; i<header.num_hashes && in.good(); ++i) {
+      uint8_t size = 0;
+      in.read(reinterpret_cast<char*>(&size), 1);
+      std::string block_hash(size, '\0');
+      if (size != 0) {
+        in.read(&block_hash[0], size);
+      }
+      common_blocks->block_hashes.push_back(block_hash);
+    }
+    if (!in.good()) {
+      delete common_blocks;
+      return NULL;
+    }
+    return common_blocks;
+  }
+
+  /**
+   * Write the set to filename, replacing any existing file.  Returns
+   * false if it cannot be written.
+   */
+  bool write(const std::string& filename) const {
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    file_header_t header;
+    memcpy(header.magic, "hdbcmn1", 8);
+    header.generation = generation;
+    header.min_count = min_count;
+    header.num_hashes = block_hashes.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      const uint8_t size = static_cast<uint8_t>(block_hashes[i].size());
+      out.write(reinterpret_cast<const char*>(&size), 1);
+      out.write(block_hashes[i].c_str(), size);
+    }
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
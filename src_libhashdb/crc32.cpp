@@ -41,7 +41,24 @@
  */
 
 // wrapped into header file and retyped buf for compatibility with hashdb
+//
+// Where the CPU has them, long inputs are folded with carry-less
+// multiplies (PCLMULQDQ, after Gopal et al., "Fast CRC Computation for
+// Generic Polynomials Using PCLMULQDQ Instruction") and ARMv8 uses its
+// CRC32 instructions.  Both give the same CRC as the table.
+#include <config.h>
+#include <cstring>
 #include "crc32.h"
+#include "cpu_dispatch.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32_PCLMUL
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && \
+      !defined(WORDS_BIGENDIAN)
+#define CRC32_ARM
+#include <arm_acle.h>
+#endif
 
 namespace hashdb {
 
@@ -91,6 +108,109 @@ namespace hashdb {
 	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
   };
 
+  // update the inverted crc with the table
+  static uint32_t crc32_table(uint32_t crc, const uint8_t* p, size_t size) {
+	while (size--)
+		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+	return crc;
+  }
+
+#ifdef CRC32_PCLMUL
+  // update the inverted crc with size bytes, a multiple of 16 and at
+  // least 64, by folding four 128-bit lanes and Barrett reduction
+  __attribute__((target("pclmul,sse4.1")))
+  static uint32_t crc32_pclmul(uint32_t crc, const uint8_t* p, size_t size) {
+    // fold and reduction constants for the reflected polynomial
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i* const v = reinterpret_cast<const __m128i*>(p);
+
+    __m128i x1 = _mm_loadu_si128(v);
+    __m128i x2 = _mm_loadu_si128(v + 1);
+    __m128i x3 = _mm_loadu_si128(v + 2);
+    __m128i x4 = _mm_loadu_si128(v + 3);
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    p += 64;
+    size -= 64;
+
+    // fold 64 bytes at a time
+    while (size >= 64) {
+      const __m128i* const w = reinterpret_cast<const __m128i*>(p);
+      const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+      const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+      const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+      const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+      x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), x5);
+      x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), x6);
+      x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), x7);
+      x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), x8);
+      x1 = _mm_xor_si128(x1, _mm_loadu_si128(w));
+      x2 = _mm_xor_si128(x2, _mm_loadu_si128(w + 1));
+      x3 = _mm_xor_si128(x3, _mm_loadu_si128(w + 2));
+      x4 = _mm_xor_si128(x4, _mm_loadu_si128(w + 3));
+      p += 64;
+      size -= 64;
+    }
+
+    // fold the four lanes and then any 16 byte blocks into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    while (size >= 16) {
+      x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+      x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+      x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+      p += 16;
+      size -= 16;
+    }
+
+    // fold 128 bits to 64
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+    // Barrett reduce to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+  }
+
+  static const bool use_pclmul = hasher::cpu_features().pclmul;
+#endif
+
+#ifdef CRC32_ARM
+  // update the inverted crc using the ARMv8 CRC32 instructions
+  __attribute__((target("+crc")))
+  static uint32_t crc32_arm(uint32_t crc, const uint8_t* p, size_t size) {
+    for (; size >= 8; p += 8, size -= 8) {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      crc = __crc32d(crc, word);
+    }
+    for (; size > 0; ++p, --size) {
+      crc = __crc32b(crc, *p);
+    }
+    return crc;
+  }
+
+  static const bool use_arm = hasher::cpu_features().arm_crc32;
+#endif
+
   // crc32 of some bytes
   uint32_t
   crc32(uint32_t crc, const uint8_t* const buf, size_t size)
@@ -100,10 +220,33 @@ namespace hashdb {
 	p = buf;
 	crc = crc ^ ~0U;
 
-	while (size--)
-		crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+#ifdef CRC32_PCLMUL
+	if (use_pclmul && size >= 64) {
+		const size_t folded = size & ~static_cast<size_t>(15);
+		crc = crc32_pclmul(crc, p, folded);
+		p += folded;
+		size -= folded;
+	}
+#endif
+#ifdef CRC32_ARM
+	if (use_arm) {
+		return crc32_arm(crc, p, size) ^ ~0U;
+	}
+#endif
 
-	return crc ^ ~0U;
+	return crc32_table(crc, p, size) ^ ~0U;
   }
 }
 
+namespace hasher {
+  const char* crc_kernel() {
+#if defined(CRC32_PCLMUL)
+    return (hashdb::use_pclmul) ? "pclmul" : "scalar";
+#elif defined(CRC32_ARM)
+    return (hashdb::use_arm) ? "arm" : "scalar";
+#else
+    return "scalar";
+#endif
+  }
+} // end namespace hasher
+
@@ -0,0 +1,595 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Read and write the frozen hash store, see frozen_hash_store.hpp.
+ */
+
+#include <config.h>
+#include "frozen_hash_store.hpp"
+#include "lmdb_helper.h"
+#include "numa_nodes.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdio>      // for std::rename
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(WIN32)
+#define FROZEN_HASH_STORE_MMAP
+#include <sys/mman.h>
+#endif
+
+namespace hashdb {
+
+  static const char frozen_magic[8] = "hdbfrz1";
+
+  // the first 8 bytes of a hash as a big-endian number, zero padded, so
+  // that numbers sort like their hashes
+  static uint64_t leading_bits(const uint8_t* const p, const size_t size) {
+    uint64_t bits = 0;
+    for (size_t i=0; i<8; ++i) {
+      bits = (bits << 8) | ((i < size) ? p[i] : 0);
+    }
+    return bits;
+  }
+
+  // the directory entry of a hash
+  static uint64_t directory_index(const uint64_t bits,
+                                  const uint32_t directory_bits) {
+    return (directory_bits == 0) ? 0 : bits >> (64 - directory_bits);
+  }
+
+  // bytes of padding after size to align to 8 bytes
+  static uint64_t padding(const uint64_t size) {
+    return (8 - size % 8) % 8;
+  }
+
+  // skip a record
+  static const uint8_t* skip_record(const uint8_t* p) {
+    uint64_t value;
+    p = lmdb_helper::decode_uint64_t(p, value);    // k_entropy
+    p = lmdb_helper::decode_uint64_t(p, value);    // block label size
+    p += value;
+    p = lmdb_helper::decode_uint64_t(p, value);    // count
+    p = lmdb_helper::decode_uint64_t(p, value);    // number of sources
+    for (uint64_t i=value; i>0; --i) {
+      uint64_t field;
+      p = lmdb_helper::decode_uint64_t(p, field);  // source ID delta
+      p = lmdb_helper::decode_uint64_t(p, field);  // sub_count
+    }
+    return p;
+  }
+
+  // ************************************************************
+  // frozen_hash_store_t
+  // ************************************************************
+  frozen_hash_store_t::frozen_hash_store_t() :
+          data(NULL), filesize(0), fd(-1), buffer(),
+          hash_size(0), num_hashes(0), directory_bits(0),
+          hashes(NULL), directory(NULL), group_offsets(NULL),
+          records(NULL) {
+  }
+
+  frozen_hash_store_t::~frozen_hash_store_t() {
+#ifdef FROZEN_HASH_STORE_MMAP
+    if (fd >= 0) {
+      ::munmap(const_cast<uint8_t*>(data), static_cast<size_t>(filesize));
+      ::close(fd);
+    }
+#endif
+  }
+
+  std::string frozen_hash_store_t::filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/frozen_hash_store";
+  }
+
+  uint32_t frozen_hash_store_t::directory_bits_for(
+                                         const uint64_t p_num_hashes) {
+    uint32_t bits = 0;
+    while (bits < 28 && (p_num_hashes >> bits) > group_size) {
+      ++bits;
+    }
+    return bits;
+  }
+
+  bool frozen_hash_store_t::open_sections() {
+    file_header_t header;
+    if (filesize < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, frozen_magic, 8) != 0 ||
+        header.directory_bits > 28 ||
+        (header.hash_size == 0 && header.num_hashes != 0)) {
+      return false;
+    }
+    hash_size = static_cast<size_t>(header.hash_size);
+    num_hashes = header.num_hashes;
+    directory_bits = static_cast<uint32_t>(header.directory_bits);
+
+    // the sections must fill the file
+    uint64_t offset = sizeof(header);
+    hashes = data + offset;
+    offset += num_hashes * hash_size;
+    offset += padding(offset);
+    directory = reinterpret_cast<const uint64_t*>(data + offset);
+    offset += ((static_cast<uint64_t>(1) << directory_bits) + 1) * 8;
+    group_offsets = reinterpret_cast<const uint64_t*>(data + offset);
+    offset += ((num_hashes + group_size - 1) / group_size + 1) * 8;
+    records = data + offset;
+    offset += header.records_size;
+    return offset == filesize;
+  }
+
+  frozen_hash_store_t* frozen_hash_store_t::open(
+                                         const std::string& hashdb_dir) {
+    const std::string store_filename = filename(hashdb_dir);
+    if (access(store_filename.c_str(), F_OK) != 0) {
+      // not frozen
+      return NULL;
+    }
+
+    frozen_hash_store_t* store = new frozen_hash_store_t;
+    bool opened = false;
+#ifdef FROZEN_HASH_STORE_MMAP
+    const int file_fd = ::open(store_filename.c_str(), O_RDONLY);
+    struct stat s;
+    if (file_fd >= 0 && fstat(file_fd, &s) == 0 && s.st_size > 0) {
+      void* const p = ::mmap(NULL, static_cast<size_t>(s.st_size),
+                             PROT_READ, MAP_SHARED, file_fd, 0);
+      if (p != MAP_FAILED) {
+#ifdef MADV_RANDOM
+        // lookups do not benefit from reading ahead
+        ::madvise(p, static_cast<size_t>(s.st_size), MADV_RANDOM);
+#endif
+        store->data = static_cast<const uint8_t*>(p);
+        store->filesize = static_cast<uint64_t>(s.st_size);
+        store->fd = file_fd;
+        opened = true;
+      }
+    }
+    if (!opened && file_fd >= 0) {
+      ::close(file_fd);
+    }
+#endif
+    if (!opened) {
+      // read the whole file
+      std::ifstream in(store_filename.c_str(), std::ios::binary);
+      in.seekg(0, std::ios::end);
+      const std::streamoff size = in.tellg();
+      in.seekg(0, std::ios::beg);
+      if (in.good() && size > 0) {
+        store->buffer.resize(static_cast<size_t>(size));
+        in.read(reinterpret_cast<char*>(&store->buffer[0]), size);
+        store->data = &store->buffer[0];
+        store->filesize = static_cast<uint64_t>(size);
+        opened = in.good();
+      }
+    }
+
+    if (!opened || !store->open_sections()) {
+      std::cerr << "Error: the frozen hash store at path '"
+                << store_filename << "' is corrupted.\n";
+      assert(0);
+    }
+    return store;
+  }
+
+  int frozen_hash_store_t::compare(const uint64_t index,
+                                   const std::string& block_hash) const {
+    const size_t size = (block_hash.size() < hash_size) ?
+                                              block_hash.size() : hash_size;
+    const int c = memcmp(hashes + index * hash_size, block_hash.c_str(),
+                         size);
+    if (c != 0) {
+      return c;
+    }
+    return (hash_size < block_hash.size()) ? -1 :
+           (hash_size > block_hash.size()) ? 1 : 0;
+  }
+
+  uint64_t frozen_hash_store_t::guess(const uint64_t bits,
+                                      const uint64_t lo,
+                                      const uint64_t hi) const {
+    const uint64_t rest = bits << directory_bits;
+    const double fraction = static_cast<double>(rest) /
+                            18446744073709551616.0;
+    const uint64_t g = lo + static_cast<uint64_t>(
+                         fraction * static_cast<double>(hi - lo));
+    return (g >= hi) ? hi - 1 : g;
+  }
+
+  uint64_t frozen_hash_store_t::lower_bound(
+                                   const std::string& block_hash) const {
+    if (num_hashes == 0) {
+      return 0;
+    }
+
+    // the hashes with the leading bits of block_hash
+    const uint64_t bits = leading_bits(
+                     reinterpret_cast<const uint8_t*>(block_hash.c_str()),
+                     block_hash.size());
+    const uint64_t d = directory_index(bits, directory_bits);
+    uint64_t lo = directory[d];
+    uint64_t hi = directory[d + 1];
+
+    // guess by interpolating on the bits after the directory bits, then
+    // gallop from the guess toward block_hash.  The answer is in
+    // [lo, hi].
+    if (hi - lo > 2) {
+      const uint64_t g = guess(bits, lo, hi);
+      uint64_t step = 1;
+      if (compare(g, block_hash) < 0) {
+        lo = g + 1;
+        while (hi - lo >= step && compare(lo + step - 1, block_hash) < 0) {
+          lo += step;
+          step *= 2;
+        }
+        if (hi - lo >= step) {
+          hi = lo + step - 1;
+        }
+      } else {
+        hi = g;
+        while (hi - lo >= step && compare(hi - step, block_hash) >= 0) {
+          hi -= step;
+          step *= 2;
+        }
+        if (hi - lo >= step) {
+          lo = hi - step + 1;
+        }
+      }
+    }
+
+    // binary search the rest
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if (compare(mid, block_hash) < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  bool frozen_hash_store_t::find(const std::string& block_hash,
+                                 uint64_t& index) const {
+    index = lower_bound(block_hash);
+    return index < num_hashes && compare(index, block_hash) == 0;
+  }
+
+  void frozen_hash_store_t::find_batch(
+                        const std::vector<std::string>& block_hashes,
+                        std::vector<uint64_t>& indexes,
+                        const bool prefetch_records) const {
+    indexes.assign(block_hashes.size(), num_hashes);
+    if (num_hashes == 0) {
+      return;
+    }
+
+    const size_t batch_size = lmdb_helper::prefetch_batch_size;
+    uint64_t bits[lmdb_helper::prefetch_batch_size];
+    for (size_t begin=0; begin<block_hashes.size(); begin+=batch_size) {
+      const size_t end = (block_hashes.size() - begin > batch_size) ?
+                         begin + batch_size : block_hashes.size();
+
+      // the directory entries
+      for (size_t i=begin; i<end; ++i) {
+        bits[i - begin] = leading_bits(
+                reinterpret_cast<const uint8_t*>(block_hashes[i].c_str()),
+                block_hashes[i].size());
+        lmdb_helper::prefetch(
+                &directory[directory_index(bits[i - begin], directory_bits)]);
+      }
+
+      // the hashes at the interpolated guesses
+      for (size_t i=begin; i<end; ++i) {
+        const uint64_t d = directory_index(bits[i - begin], directory_bits);
+        if (directory[d] < directory[d + 1]) {
+          lmdb_helper::prefetch(hashes + hash_size *
+                      guess(bits[i - begin], directory[d], directory[d + 1]));
+        }
+      }
+
+      // the searches, then the record offsets of the hashes found
+      for (size_t i=begin; i<end; ++i) {
+        uint64_t index;
+        if (find(block_hashes[i], index)) {
+          indexes[i] = index;
+          if (prefetch_records) {
+            lmdb_helper::prefetch(&group_offsets[index / group_size]);
+          }
+        }
+      }
+
+      // the records
+      if (prefetch_records) {
+        for (size_t i=begin; i<end; ++i) {
+          if (indexes[i] != num_hashes) {
+            lmdb_helper::prefetch(
+                        records + group_offsets[indexes[i] / group_size]);
+          }
+        }
+      }
+    }
+  }
+
+  std::string frozen_hash_store_t::hash_at(const uint64_t index) const {
+    return std::string(reinterpret_cast<const char*>(
+                                  hashes + index * hash_size), hash_size);
+  }
+
+  const uint8_t* frozen_hash_store_t::record(const uint64_t index) const {
+    const uint8_t* p = records + group_offsets[index / group_size];
+    for (uint64_t i = index % group_size; i > 0; --i) {
+      p = skip_record(p);
+    }
+    return p;
+  }
+
+  void frozen_hash_store_t::read(const uint64_t index,
+                     uint64_t& k_entropy,
+                     std::string& block_label,
+                     uint64_t& count,
+                     source_id_sub_counts_t& source_id_sub_counts) const {
+    source_id_sub_counts.clear();
+    const uint8_t* p = record(index);
+    p = lmdb_helper::decode_uint64_t(p, k_entropy);
+    uint64_t label_size;
+    p = lmdb_helper::decode_uint64_t(p, label_size);
+    block_label = std::string(reinterpret_cast<const char*>(p),
+                              static_cast<size_t>(label_size));
+    p += label_size;
+    p = lmdb_helper::decode_uint64_t(p, count);
+    uint64_t num_sources;
+    p = lmdb_helper::decode_uint64_t(p, num_sources);
+    uint64_t source_id = 0;
+    for (uint64_t i=0; i<num_sources; ++i) {
+      uint64_t delta;
+      uint64_t sub_count;
+      p = lmdb_helper::decode_uint64_t(p, delta);
+      p = lmdb_helper::decode_uint64_t(p, sub_count);
+      source_id += delta;
+      source_id_sub_counts.insert(source_id_sub_counts.end(),
+                              source_id_sub_count_t(source_id, sub_count));
+    }
+  }
+
+  uint64_t frozen_hash_store_t::read_count(const uint64_t index) const {
+    const uint8_t* p = record(index);
+    uint64_t value;
+    p = lmdb_helper::decode_uint64_t(p, value);    // k_entropy
+    p = lmdb_helper::decode_uint64_t(p, value);    // block label size
+    p += value;
+    lmdb_helper::decode_uint64_t(p, value);        // count
+    return value;
+  }
+
+  bool frozen_hash_store_t::lock() const {
+    const uint8_t* const end = reinterpret_cast<const uint8_t*>(
+                                                          group_offsets);
+    return lmdb_helper::lock_memory(hashes, end - hashes, false);
+  }
+
+  bool frozen_hash_store_t::interleave() const {
+    return hashdb::interleave_memory(data, filesize);
+  }
+
+  void frozen_hash_store_t::find_stats(hashdb::hash_stats_t& stats) const {
+    hashdb::hash_stats_t store_stats(0, num_hashes);
+    const uint64_t num_groups = (num_hashes + group_size - 1) / group_size;
+    for (uint64_t g=0; g<num_groups; ++g) {
+      const uint8_t* p = records + group_offsets[g];
+      const uint64_t end = (g + 1 < num_groups) ? group_size :
+                                      num_hashes - g * group_size;
+      for (uint64_t i=0; i<end; ++i) {
+        uint64_t value;
+        const uint8_t* q = lmdb_helper::decode_uint64_t(p, value);
+        q = lmdb_helper::decode_uint64_t(q, value);
+        q += value;
+        lmdb_helper::decode_uint64_t(q, value);
+        store_stats.change(0, value);
+        p = skip_record(p);
+      }
+    }
+    stats.add(store_stats);
+  }
+
+  // ************************************************************
+  // frozen_hash_store_writer_t
+  // ************************************************************
+  frozen_hash_store_writer_t::frozen_hash_store_writer_t(
+                                   const std::string& hashdb_dir) :
+          store_filename(frozen_hash_store_t::filename(hashdb_dir)),
+          hashes_out((store_filename + ".hashes").c_str(),
+                     std::ios::binary | std::ios::trunc),
+          records_out((store_filename + ".records").c_str(),
+                      std::ios::binary | std::ios::trunc),
+          group_offsets(), last_hash(""), num_hashes(0), records_size(0),
+          error_message("") {
+    if (!hashes_out.is_open() || !records_out.is_open()) {
+      error_message = "Unable to create the frozen hash store at path '"
+                      + store_filename + "'.";
+    }
+  }
+
+  frozen_hash_store_writer_t::~frozen_hash_store_writer_t() {
+    hashes_out.close();
+    records_out.close();
+    std::remove((store_filename + ".hashes").c_str());
+    std::remove((store_filename + ".records").c_str());
+    std::remove((store_filename + ".tmp").c_str());
+  }
+
+  bool frozen_hash_store_writer_t::add(const std::string& block_hash,
+                       const uint64_t k_entropy,
+                       const std::string& block_label,
+                       const uint64_t count,
+                       const source_id_sub_counts_t& source_id_sub_counts) {
+    if (error_message.size() != 0) {
+      return false;
+    }
+    if (block_hash.size() == 0 ||
+        (num_hashes != 0 && block_hash.size() != last_hash.size())) {
+      error_message = "A frozen hashdb requires block hashes of one size.";
+      return false;
+    }
+    if (num_hashes != 0 && block_hash <= last_hash) {
+      error_message = "Block hashes must be frozen in ascending order.";
+      return false;
+    }
+
+    // a group starts every group_size hashes
+    if (num_hashes % frozen_hash_store_t::group_size == 0) {
+      group_offsets.push_back(records_size);
+    }
+    last_hash = block_hash;
+    ++num_hashes;
+    hashes_out.write(block_hash.c_str(), block_hash.size());
+
+    // pack the record
+    std::string packed;
+    uint8_t encoding[10];
+    const uint8_t* const begin = encoding;
+    packed.append(reinterpret_cast<const char*>(begin),
+          lmdb_helper::encode_uint64_t(k_entropy, encoding) - begin);
+    packed.append(reinterpret_cast<const char*>(begin),
+          lmdb_helper::encode_uint64_t(block_label.size(), encoding) - begin);
+    packed.append(block_label);
+    packed.append(reinterpret_cast<const char*>(begin),
+          lmdb_helper::encode_uint64_t(count, encoding) - begin);
+    packed.append(reinterpret_cast<const char*>(begin),
+          lmdb_helper::encode_uint64_t(source_id_sub_counts.size(),
+                                       encoding) - begin);
+    uint64_t source_id = 0;
+    for (source_id_sub_counts_t::const_iterator it =
+         source_id_sub_counts.begin(); it != source_id_sub_counts.end();
+         ++it) {
+      packed.append(reinterpret_cast<const char*>(begin),
+            lmdb_helper::encode_uint64_t(it->source_id - source_id,
+                                         encoding) - begin);
+      packed.append(reinterpret_cast<const char*>(begin),
+            lmdb_helper::encode_uint64_t(it->sub_count, encoding) - begin);
+      source_id = it->source_id;
+    }
+    records_out.write(packed.c_str(), packed.size());
+    records_size += packed.size();
+    return true;
+  }
+
+  // copy the staged file at path to out
+  static bool append_file(const std::string& path, std::ofstream& out) {
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return false;
+    }
+    std::vector<char> chunk(1<<20);
+    while (in.good()) {
+      in.read(&chunk[0], chunk.size());
+      out.write(&chunk[0], in.gcount());
+    }
+    return in.eof() && out.good();
+  }
+
+  std::string frozen_hash_store_writer_t::close() {
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    hashes_out.close();
+    records_out.close();
+    if (hashes_out.fail() || records_out.fail()) {
+      return "Unable to write the frozen hash store at path '"
+             + store_filename + "'.";
+    }
+    group_offsets.push_back(records_size);
+
+    // count the hashes under each directory entry
+    const size_t hash_size = last_hash.size();
+    const uint32_t directory_bits =
+                   frozen_hash_store_t::directory_bits_for(num_hashes);
+    std::vector<uint64_t> directory(
+                   (static_cast<size_t>(1) << directory_bits) + 1, 0);
+    if (num_hashes != 0) {
+      std::ifstream in((store_filename + ".hashes").c_str(),
+                       std::ios::binary);
+      std::vector<char> chunk(hash_size * 4096);
+      uint64_t remaining = num_hashes;
+      while (remaining != 0 && in.good()) {
+        const uint64_t n = (remaining < 4096) ? remaining : 4096;
+        in.read(&chunk[0], n * hash_size);
+        for (uint64_t i=0; i<n; ++i) {
+          const uint64_t bits = leading_bits(reinterpret_cast<uint8_t*>(
+                                       &chunk[i * hash_size]), hash_size);
+          ++directory[directory_index(bits, directory_bits) + 1];
+        }
+        remaining -= n;
+      }
+      if (remaining != 0) {
+        return "Unable to read the hashes staged for the frozen hash store.";
+      }
+    }
+    for (size_t d=1; d<directory.size(); ++d) {
+      directory[d] += directory[d - 1];
+    }
+
+    // write the store
+    const std::string temp_filename = store_filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return "Unable to create the frozen hash store at path '"
+             + store_filename + "'.";
+    }
+    frozen_hash_store_t::file_header_t header;
+    memcpy(header.magic, frozen_magic, 8);
+    header.hash_size = hash_size;
+    header.num_hashes = num_hashes;
+    header.directory_bits = directory_bits;
+    header.records_size = records_size;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const bool copied = append_file(store_filename + ".hashes", out);
+    const char zeros[8] = {0,0,0,0,0,0,0,0};
+    out.write(zeros, padding(sizeof(header) + num_hashes * hash_size));
+    out.write(reinterpret_cast<const char*>(&directory[0]),
+              directory.size() * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&group_offsets[0]),
+              group_offsets.size() * sizeof(uint64_t));
+    const bool copied_records = append_file(store_filename + ".records",
+                                            out);
+    out.close();
+    if (!copied || !copied_records || out.fail()) {
+      return "Unable to write the frozen hash store at path '"
+             + store_filename + "'.";
+    }
+#ifdef _WIN32
+    std::remove(store_filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), store_filename.c_str()) != 0) {
+      return "Unable to move the frozen hash store into place.";
+    }
+    return "";
+  }
+
+} // end namespace hashdb
@@ -0,0 +1,243 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides the hash store of a frozen hashdb, a read-only copy of the
+ * hash data store in one flat file that is mapped into memory, see
+ * hashdb::freeze_hashdb.
+ *
+ * The file holds, in order:
+ *   * A header with the hash size, the number of hashes, the number of
+ *     directory bits, and the size of the record section.
+ *   * The hashes, sorted, each hash_size bytes, so lookups need no
+ *     B-tree pages and the hashes of a search sit next to each other.
+ *   * A directory of 2^directory_bits + 1 hash indexes.  Entry b is the
+ *     index of the first hash whose leading directory_bits bits are b or
+ *     more.  There are about 16 hashes per directory entry.
+ *   * The offset of the record of every 16th hash in the record section.
+ *   * The records, one per hash in hash order, packed as varints:
+ *     k_entropy, the size of the block label, the block label, count,
+ *     the number of sources, then the source ID minus the previous
+ *     source ID and the sub_count of each source in source ID order.
+ *
+ * A lookup reads the directory entry for the hash, then interpolates
+ * on the hash bits that follow the directory bits to guess where the
+ * hash is in its range.  Block hashes are uniformly distributed so the
+ * guess is usually on the cache line of the hash.  The search then
+ * gallops outward from the guess and finishes with a binary search,
+ * so hashes that are not uniform are found in logarithmic time.
+ *
+ * Numbers are in host byte order, like the hash filter file, so a
+ * frozen hashdb is read on machines of the byte order that froze it.
+ */
+
+#ifndef FROZEN_HASH_STORE_HPP
+#define FROZEN_HASH_STORE_HPP
+
+#include "source_id_sub_counts.hpp"
+#include "hash_stats.hpp"
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+namespace hashdb {
+
+class frozen_hash_store_t {
+  friend class frozen_hash_store_writer_t;
+
+  private:
+  struct file_header_t {
+    char magic[8];
+    uint64_t hash_size;
+    uint64_t num_hashes;
+    uint64_t directory_bits;
+    uint64_t records_size;
+  };
+
+  // the file, mapped or read into buffer
+  const uint8_t* data;
+  uint64_t filesize;
+  int fd;                       // open while mapped, else -1
+  std::vector<uint8_t> buffer;  // when the file is not mapped
+
+  // the sections of the file
+  size_t hash_size;
+  uint64_t num_hashes;
+  uint32_t directory_bits;
+  const uint8_t* hashes;
+  const uint64_t* directory;
+  const uint64_t* group_offsets;
+  const uint8_t* records;
+
+  // do not allow copy or assignment
+  frozen_hash_store_t(const frozen_hash_store_t&);
+  frozen_hash_store_t& operator=(const frozen_hash_store_t&);
+
+  frozen_hash_store_t();
+
+  // set the sections from the header, false if the file is not valid
+  bool open_sections();
+
+  // the interpolated guess for a hash with leading bits in [lo, hi)
+  uint64_t guess(const uint64_t bits, const uint64_t lo,
+                 const uint64_t hi) const;
+
+  // compare the hash at index with block_hash, like memcmp
+  int compare(const uint64_t index, const std::string& block_hash) const;
+
+  // the record of the hash at index
+  const uint8_t* record(const uint64_t index) const;
+
+  public:
+  /**
+   * Hashes are grouped by this many for the record offsets.
+   */
+  static const uint64_t group_size = 16;
+
+  /**
+   * The hash store file of a hashdb.
+   */
+  static std::string filename(const std::string& hashdb_dir);
+
+  /**
+   * The number of directory bits for num_hashes hashes.
+   */
+  static uint32_t directory_bits_for(const uint64_t num_hashes);
+
+  /**
+   * Open the frozen hash store of hashdb_dir, or return NULL if the
+   * hashdb is not frozen.  Aborts if the file is corrupted.
+   */
+  static frozen_hash_store_t* open(const std::string& hashdb_dir);
+
+  ~frozen_hash_store_t();
+
+  /**
+   * The index of the first hash that is not less than block_hash, or
+   * size() if there is none.
+   */
+  uint64_t lower_bound(const std::string& block_hash) const;
+
+  /**
+   * Find block_hash.  Return false if it is not present.
+   */
+  bool find(const std::string& block_hash, uint64_t& index) const;
+
+  /**
+   * Find each hash in block_hashes, as find, with the lookups of
+   * lmdb_helper::prefetch_batch_size hashes interleaved in stages so
+   * that their cache misses overlap.  indexes[i] is the index of
+   * block_hashes[i], or size() if it is not present.  With
+   * prefetch_records, the records of the hashes found are prefetched
+   * too.
+   */
+  void find_batch(const std::vector<std::string>& block_hashes,
+                  std::vector<uint64_t>& indexes,
+                  const bool prefetch_records) const;
+
+  /**
+   * The hash at index.
+   */
+  std::string hash_at(const uint64_t index) const;
+
+  /**
+   * Read the data of the hash at index.
+   */
+  void read(const uint64_t index,
+            uint64_t& k_entropy,
+            std::string& block_label,
+            uint64_t& count,
+            source_id_sub_counts_t& source_id_sub_counts) const;
+
+  /**
+   * The source count of the hash at index.
+   */
+  uint64_t read_count(const uint64_t index) const;
+
+  /**
+   * Add the statistics of the store to stats.
+   */
+  void find_stats(hashdb::hash_stats_t& stats) const;
+
+  /**
+   * Lock the hashes and the directory in memory.  Return false if they
+   * cannot be locked.
+   */
+  bool lock() const;
+
+  /**
+   * Spread the store across the NUMA nodes.  Return false if not
+   * possible.
+   */
+  bool interleave() const;
+
+  /**
+   * The number of hashes.
+   */
+  uint64_t size() const {
+    return num_hashes;
+  }
+};
+
+/**
+ * Write the frozen hash store of a hashdb from its hashes in ascending
+ * order.  The hashes and records are staged in temporary files next to
+ * the store so that memory use does not grow with the store.
+ */
+class frozen_hash_store_writer_t {
+
+  private:
+  const std::string store_filename;
+  std::ofstream hashes_out;
+  std::ofstream records_out;
+  std::vector<uint64_t> group_offsets;
+  std::string last_hash;
+  uint64_t num_hashes;
+  uint64_t records_size;
+  std::string error_message;
+
+  // do not allow copy or assignment
+  frozen_hash_store_writer_t(const frozen_hash_store_writer_t&);
+  frozen_hash_store_writer_t& operator=(const frozen_hash_store_writer_t&);
+
+  public:
+  explicit frozen_hash_store_writer_t(const std::string& hashdb_dir);
+  ~frozen_hash_store_writer_t();
+
+  /**
+   * Add the next hash, which must sort after the last one and be the
+   * size of the others.  Return false and set the error message if not.
+   */
+  bool add(const std::string& block_hash,
+           const uint64_t k_entropy,
+           const std::string& block_label,
+           const uint64_t count,
+           const source_id_sub_counts_t& source_id_sub_counts);
+
+  /**
+   * Write the store.  Return "" if successful else reason if not.
+   */
+  std::string close();
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,195 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Buffer hash inserts so that they can be written to the hash data
+ * store and the hash store using one write transaction per batch.
+ * Threadsafe when used through lock and unlock.  Also provides the
+ * entry type used for appending sorted hash data.
+ *
+ * A batch is due for writing when it holds batch_size entries or when
+ * batch_milliseconds have elapsed since its first entry was added.
+ * Timing is checked when entries are added, so an idle batch is
+ * written at the next add or at flush.
+ */
+
+#ifndef HASH_BATCH_HPP
+#define HASH_BATCH_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <sys/time.h>
+#include "source_id_sub_counts.hpp"
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+// Conservative number of new LMDB pages a batched write may consume.
+static const size_t batch_pages_per_entry = 8;
+
+struct hash_batch_entry_t {
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t source_id;
+  uint64_t sub_count;   // for merge, else occurrences collapsed, 0 is 1
+  bool is_merge;
+  hash_batch_entry_t() : block_hash(), k_entropy(0), block_label(),
+                         source_id(0), sub_count(0), is_merge(false) {
+  }
+  hash_batch_entry_t(const std::string& p_block_hash,
+                     const uint64_t p_k_entropy,
+                     const std::string& p_block_label,
+                     const uint64_t p_source_id,
+                     const uint64_t p_sub_count,
+                     const bool p_is_merge) :
+          block_hash(p_block_hash),
+          k_entropy(p_k_entropy),
+          block_label(p_block_label),
+          source_id(p_source_id),
+          sub_count(p_sub_count),
+          is_merge(p_is_merge) {
+  }
+};
+
+typedef std::vector<hash_batch_entry_t> hash_batch_entries_t;
+
+// the number of occurrences an insert entry stands for
+inline uint64_t insert_occurrences(const hash_batch_entry_t& entry) {
+  return (entry.sub_count > 0) ? entry.sub_count : 1;
+}
+
+// Collapse runs of inserts of the same block hash and source, as from
+// repeated blocks in one file, into one entry each that counts the
+// occurrences, so that each is written once.  Entries must be sorted
+// by block hash.
+inline void collapse_inserts(hash_batch_entries_t& entries) {
+  size_t kept = 0;
+  for (size_t i=0; i<entries.size(); ++i) {
+    if (kept > 0 && !entries[i].is_merge && !entries[kept-1].is_merge &&
+        entries[i].source_id == entries[kept-1].source_id &&
+        entries[i].block_hash == entries[kept-1].block_hash) {
+      entries[kept-1].sub_count = insert_occurrences(entries[kept-1]) +
+                                  insert_occurrences(entries[i]);
+      continue;
+    }
+    if (kept != i) {
+      entries[kept] = entries[i];
+    }
+    ++kept;
+  }
+  entries.resize(kept);
+}
+
+// the final hash data for one hash, for appending in sorted order
+struct hash_append_entry_t {
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  source_id_sub_counts_t source_id_sub_counts;
+  hash_append_entry_t() : block_hash(), k_entropy(0), block_label(),
+                          count(0), source_id_sub_counts() {
+  }
+};
+
+typedef std::vector<hash_append_entry_t> hash_append_entries_t;
+
+class hash_batch_t {
+
+  private:
+  size_t batch_size;
+  size_t batch_milliseconds;
+  struct timeval t_first;
+
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  hash_batch_t(const hash_batch_t&);
+  hash_batch_t& operator=(const hash_batch_t&);
+
+  size_t elapsed_milliseconds() const {
+    struct timeval t_now;
+    gettimeofday(&t_now, 0);
+    return (t_now.tv_sec - t_first.tv_sec) * 1000 +
+           (t_now.tv_usec - t_first.tv_usec) / 1000;
+  }
+
+  public:
+  // pending entries, access while locked
+  hash_batch_entries_t entries;
+
+  hash_batch_t() :
+          batch_size(1), batch_milliseconds(0), t_first(), M(), entries() {
+    MUTEX_INIT(&M);
+  }
+
+  ~hash_batch_t() {
+    MUTEX_DESTROY(&M);
+  }
+
+  void lock() const {
+    MUTEX_LOCK(&M);
+  }
+
+  void unlock() const {
+    MUTEX_UNLOCK(&M);
+  }
+
+  // set limits, call while locked.  batch_size 0 or 1 disables batching.
+  // batch_milliseconds 0 disables the time limit.
+  void set_limits(const size_t p_batch_size,
+                  const size_t p_batch_milliseconds) {
+    batch_size = p_batch_size;
+    batch_milliseconds = p_batch_milliseconds;
+    entries.reserve(batch_size);
+  }
+
+  // true if inserts should be buffered, call while locked
+  bool enabled() const {
+    return batch_size > 1;
+  }
+
+  // add entry, return true if the batch is due for writing.
+  // Call while locked.
+  bool add(const hash_batch_entry_t& entry) {
+    if (entries.size() == 0) {
+      gettimeofday(&t_first, 0);
+    }
+    entries.push_back(entry);
+    return entries.size() >= batch_size ||
+           (batch_milliseconds > 0 &&
+            elapsed_milliseconds() >= batch_milliseconds);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,604 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Load hashes into the hash data store and the hash store in sorted
+ * order.  Threadsafe when used through lock and unlock.
+ *
+ * Added hashes are collected into runs that are sorted in memory and
+ * spilled to run files under the hashdb directory.  At load time the
+ * runs are merged.  When both hash stores are empty, each hash is
+ * written once using MDB_APPEND, giving sequential page writes and
+ * densely packed pages.  Otherwise the sorted hashes are inserted
+ * using batched writes.
+ *
+ * Records of the same hash are applied in the order they were added,
+ * and hash data changes are counted the same way
+ * lmdb_hash_data_manager_t counts them.  The hash store keeps one count
+ * per hash prefix, so the records of each prefix, which are adjacent in
+ * sorted order, are passed to it in the order they were added and its
+ * changes and counts are those of per-record inserts.
+ */
+
+#ifndef HASH_BULK_LOADER_HPP
+#define HASH_BULK_LOADER_HPP
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>      // for std::remove
+#include <stdint.h>
+#include <unistd.h>    // for rmdir
+#include <sys/stat.h>  // for mkdir
+#include "lmdb_helper.h"
+#include "lmdb_changes.hpp"
+#include "lmdb_hash_data_manager.hpp"
+#include "lmdb_hash_manager.hpp"
+#include "hash_batch.hpp"
+#include "source_id_sub_counts.hpp"
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+// hash records written to LMDB per transaction
+static const size_t bulk_chunk_size = 10000;
+
+// run files merged at one time
+static const size_t bulk_max_open_runs = 64;
+
+// a hash record ordered by block hash then by the order it was added.
+// std::string ordering matches the default LMDB key ordering.
+struct bulk_record_t {
+  hash_batch_entry_t entry;
+  uint64_t sequence;
+  bulk_record_t() : entry(), sequence(0) {
+  }
+  bulk_record_t(const hash_batch_entry_t& p_entry,
+                const uint64_t p_sequence) :
+          entry(p_entry), sequence(p_sequence) {
+  }
+  bool operator<(const bulk_record_t& that) const {
+    if (entry.block_hash < that.entry.block_hash) return true;
+    if (that.entry.block_hash < entry.block_hash) return false;
+    return sequence < that.sequence;
+  }
+};
+
+inline void write_bulk_uint64(std::ostream& out, const uint64_t value) {
+  uint8_t buf[10];
+  const uint8_t* const end = lmdb_helper::encode_uint64_t(value, buf);
+  out.write(reinterpret_cast<const char*>(buf), end - buf);
+}
+
+inline bool read_bulk_uint64(std::istream& in, uint64_t& value) {
+  uint8_t buf[10];
+  for (size_t i=0; i<10; ++i) {
+    const int c = in.get();
+    if (c == EOF) {
+      return false;
+    }
+    buf[i] = static_cast<uint8_t>(c);
+    if ((buf[i] & 0x80) == 0) {
+      lmdb_helper::decode_uint64_t(buf, value);
+      return true;
+    }
+  }
+  std::cerr << "corrupted bulk load run file\n";
+  assert(0);
+  return false;
+}
+
+inline void write_bulk_string(std::ostream& out, const std::string& s) {
+  write_bulk_uint64(out, s.size());
+  out.write(s.c_str(), s.size());
+}
+
+inline bool read_bulk_string(std::istream& in, std::string& s) {
+  uint64_t size;
+  if (!read_bulk_uint64(in, size)) {
+    return false;
+  }
+  s.resize(size);
+  if (size > 0) {
+    in.read(&s[0], size);
+  }
+  return in.good();
+}
+
+inline void write_bulk_record(std::ostream& out,
+                              const bulk_record_t& record) {
+  write_bulk_string(out, record.entry.block_hash);
+  write_bulk_uint64(out, record.entry.k_entropy);
+  write_bulk_string(out, record.entry.block_label);
+  write_bulk_uint64(out, record.entry.source_id);
+  write_bulk_uint64(out, record.entry.sub_count);
+  write_bulk_uint64(out, record.entry.is_merge ? 1 : 0);
+  write_bulk_uint64(out, record.sequence);
+}
+
+// false at EOF
+inline bool read_bulk_record(std::istream& in, bulk_record_t& record) {
+  uint64_t is_merge;
+  if (!read_bulk_string(in, record.entry.block_hash)) {
+    return false;
+  }
+  if (!read_bulk_uint64(in, record.entry.k_entropy) ||
+      !read_bulk_string(in, record.entry.block_label) ||
+      !read_bulk_uint64(in, record.entry.source_id) ||
+      !read_bulk_uint64(in, record.entry.sub_count) ||
+      !read_bulk_uint64(in, is_merge) ||
+      !read_bulk_uint64(in, record.sequence)) {
+    std::cerr << "truncated bulk load run file\n";
+    assert(0);
+  }
+  record.entry.is_merge = (is_merge != 0);
+  return true;
+}
+
+// merge sorted run files into one sorted sequence of records
+class bulk_run_merger_t {
+
+  private:
+  struct run_t {
+    std::ifstream in;
+    bulk_record_t record;
+    run_t(const std::string& filename) :
+            in(filename.c_str(), std::ios::binary), record() {
+      if (!in.is_open()) {
+        std::cerr << "Error: unable to open bulk load run file '"
+                  << filename << "'.  Aborting.\n";
+        exit(1);
+      }
+    }
+  };
+
+  // order the heap by smallest record first
+  struct greater_t {
+    bool operator()(const run_t* const a, const run_t* const b) const {
+      return b->record < a->record;
+    }
+  };
+
+  std::vector<run_t*> runs;
+  std::priority_queue<run_t*, std::vector<run_t*>, greater_t> heap;
+
+  // do not allow copy or assignment
+  bulk_run_merger_t(const bulk_run_merger_t&);
+  bulk_run_merger_t& operator=(const bulk_run_merger_t&);
+
+  public:
+  bulk_run_merger_t(const std::vector<std::string>& filenames) :
+          runs(), heap() {
+    for (std::vector<std::string>::const_iterator it = filenames.begin();
+         it != filenames.end(); ++it) {
+      run_t* run = new run_t(*it);
+      runs.push_back(run);
+      if (read_bulk_record(run->in, run->record)) {
+        heap.push(run);
+      }
+    }
+  }
+
+  ~bulk_run_merger_t() {
+    for (std::vector<run_t*>::iterator it = runs.begin();
+         it != runs.end(); ++it) {
+      delete *it;
+    }
+  }
+
+  // false when done
+  bool next(bulk_record_t& record) {
+    if (heap.empty()) {
+      return false;
+    }
+    run_t* run = heap.top();
+    heap.pop();
+    record = run->record;
+    if (read_bulk_record(run->in, run->record)) {
+      heap.push(run);
+    }
+    return true;
+  }
+};
+
+class hash_bulk_loader_t {
+
+  private:
+  const std::string temp_dir;
+  size_t run_size;
+  uint64_t sequence;
+  std::vector<bulk_record_t> records;
+  std::vector<std::string> run_filenames;
+  size_t run_number;
+
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  hash_bulk_loader_t(const hash_bulk_loader_t&);
+  hash_bulk_loader_t& operator=(const hash_bulk_loader_t&);
+
+  // open a new run file for writing
+  std::string open_run(std::ofstream& out) {
+    if (run_filenames.size() == 0 && access(temp_dir.c_str(), F_OK) != 0) {
+#ifdef _WIN32
+      if(mkdir(temp_dir.c_str())){
+#else
+      if(mkdir(temp_dir.c_str(),0777)){
+#endif
+        std::cerr << "Error: Could not make bulk load directory '"
+                  << temp_dir << "'.\nCannot continue.\n";
+        exit(1);
+      }
+    }
+    std::stringstream ss;
+    ss << temp_dir << "/run_" << run_number++;
+    out.open(ss.str().c_str(), std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      std::cerr << "Error: unable to create bulk load run file '"
+                << ss.str() << "'.  Aborting.\n";
+      exit(1);
+    }
+    return ss.str();
+  }
+
+  void close_run(std::ofstream& out, const std::string& filename) {
+    out.close();
+    if (out.fail()) {
+      std::cerr << "Error: unable to write bulk load run file '"
+                << filename << "'.  Aborting.\n";
+      exit(1);
+    }
+  }
+
+  // sort the records in memory and spill them to a new run file
+  void spill() {
+    std::sort(records.begin(), records.end());
+    std::ofstream out;
+    const std::string filename = open_run(out);
+    for (std::vector<bulk_record_t>::const_iterator it = records.begin();
+         it != records.end(); ++it) {
+      write_bulk_record(out, *it);
+    }
+    close_run(out, filename);
+    run_filenames.push_back(filename);
+    std::vector<bulk_record_t>().swap(records);
+  }
+
+  // merge runs until few enough remain to merge at once
+  void reduce_runs() {
+    while (run_filenames.size() > bulk_max_open_runs) {
+      const std::vector<std::string> merge_filenames(run_filenames.begin(),
+                      run_filenames.begin() + bulk_max_open_runs);
+      run_filenames.erase(run_filenames.begin(),
+                      run_filenames.begin() + bulk_max_open_runs);
+
+      std::ofstream out;
+      const std::string filename = open_run(out);
+      {
+        bulk_run_merger_t merger(merge_filenames);
+        bulk_record_t record;
+        while (merger.next(record)) {
+          write_bulk_record(out, record);
+        }
+      }
+      close_run(out, filename);
+      remove_runs(merge_filenames);
+      run_filenames.push_back(filename);
+    }
+  }
+
+  void remove_runs(const std::vector<std::string>& filenames) {
+    for (std::vector<std::string>::const_iterator it = filenames.begin();
+         it != filenames.end(); ++it) {
+      std::remove(it->c_str());
+    }
+  }
+
+  static bool same_prefix(const std::string& a, const std::string& b) {
+    return a.compare(0, num_prefix_bytes, b, 0, num_prefix_bytes) == 0;
+  }
+
+  // Put the records of each hash store prefix back in the order they
+  // were added.  Records of one hash keep their order.
+  static void order_prefixes(hash_batch_entries_t& entries,
+                             std::vector<size_t>& counts,
+                             const std::vector<uint64_t>& sequences) {
+    std::vector<std::pair<uint64_t, size_t> > order;
+    order.reserve(entries.size());
+    for (size_t i=0; i<entries.size(); ++i) {
+      order.push_back(std::pair<uint64_t, size_t>(sequences[i], i));
+    }
+    size_t begin = 0;
+    bool is_ordered = true;
+    while (begin < entries.size()) {
+      size_t end = begin + 1;
+      while (end < entries.size() &&
+             same_prefix(entries[end].block_hash, entries[begin].block_hash)) {
+        ++end;
+      }
+      if (end - begin > 1 && entries[begin].block_hash !=
+                             entries[end - 1].block_hash) {
+        std::sort(order.begin() + begin, order.begin() + end);
+        is_ordered = false;
+      }
+      begin = end;
+    }
+    if (is_ordered) {
+      return;
+    }
+    hash_batch_entries_t ordered_entries;
+    std::vector<size_t> ordered_counts;
+    ordered_entries.reserve(entries.size());
+    for (size_t i=0; i<order.size(); ++i) {
+      ordered_entries.push_back(entries[order[i].second]);
+      if (counts.size() != 0) {
+        ordered_counts.push_back(counts[order[i].second]);
+      }
+    }
+    entries.swap(ordered_entries);
+    counts.swap(ordered_counts);
+  }
+
+  // Apply the next record of the current hash the way
+  // lmdb_hash_data_manager_t would.  Return the updated source count.
+  size_t apply(hash_append_entry_t& group,
+               const hash_batch_entry_t& entry,
+               hashdb::lmdb_changes_t& changes) {
+
+    const std::string block_label = truncate_block_label(entry.block_label);
+    source_id_sub_counts_t& sub_counts = group.source_id_sub_counts;
+
+    // a new hash is Type 1
+    if (sub_counts.size() == 0) {
+      group.block_hash = entry.block_hash;
+      group.k_entropy = entry.k_entropy;
+      group.block_label = block_label;
+      if (entry.is_merge) {
+        group.count = add2(entry.sub_count, 0);
+        ++changes.hash_data_merged;
+      } else {
+        const uint64_t n = insert_occurrences(entry);
+        group.count = add2(n, 0);
+        changes.hash_data_inserted += n;
+      }
+      sub_counts.insert(source_id_sub_count_t(entry.source_id, group.count));
+      return group.count;
+    }
+
+    // check for mismatched data
+    if (mismatched_data(entry.k_entropy, group.k_entropy,
+                        block_label, group.block_label)) {
+      ++changes.hash_data_mismatched_data_detected;
+    }
+
+    // find any existing sub_count for this source
+    const bool is_type1 = (sub_counts.size() == 1);
+    source_id_sub_counts_t::iterator it = sub_counts.lower_bound(
+                             source_id_sub_count_t(entry.source_id, 0));
+    const bool is_present = (it != sub_counts.end() &&
+                             it->source_id == entry.source_id);
+
+    if (entry.is_merge) {
+      if (is_present) {
+        // merged before, no change
+        if (mismatched_sub_count(entry.sub_count, it->sub_count)) {
+          ++changes.hash_data_mismatched_sub_count_detected;
+        }
+        ++changes.hash_data_merged_same;
+      } else {
+        // new source
+        group.count = add4(group.count, entry.sub_count);
+        sub_counts.insert(source_id_sub_count_t(entry.source_id,
+                                                add2(entry.sub_count, 0)));
+        ++changes.hash_data_merged;
+      }
+
+    } else {
+      const uint64_t n = insert_occurrences(entry);
+      if (is_present) {
+        // increment sub_count
+        const uint64_t sub_count = add2(it->sub_count, n);
+        sub_counts.erase(it);
+        sub_counts.insert(source_id_sub_count_t(entry.source_id, sub_count));
+      } else {
+        // new source
+        sub_counts.insert(source_id_sub_count_t(entry.source_id,
+                                                add2(n, 0)));
+      }
+      group.count = (is_type1 && is_present) ? add2(group.count, n) :
+                                               add4(group.count, n);
+      changes.hash_data_inserted += n;
+    }
+    return group.count;
+  }
+
+  public:
+  hash_bulk_loader_t(const std::string& hashdb_dir) :
+          temp_dir(hashdb_dir + "/temp_bulk_load"),
+          run_size(0), sequence(0), records(), run_filenames(),
+          run_number(0), M() {
+    MUTEX_INIT(&M);
+  }
+
+  ~hash_bulk_loader_t() {
+    if (records.size() != 0 || run_filenames.size() != 0) {
+      std::cerr << "Processing error: bulk load hashes were not loaded.\n";
+      remove_runs(run_filenames);
+      rmdir(temp_dir.c_str());
+    }
+    MUTEX_DESTROY(&M);
+  }
+
+  void lock() const {
+    MUTEX_LOCK(&M);
+  }
+
+  void unlock() const {
+    MUTEX_UNLOCK(&M);
+  }
+
+  // set the number of records per run, call while locked.
+  // 0 disables bulk loading.
+  void set_run_size(const size_t p_run_size) {
+    run_size = p_run_size;
+  }
+
+  // true if hashes should be deferred for bulk loading, call while locked
+  bool enabled() const {
+    return run_size > 0;
+  }
+
+  // add a hash record, call while locked
+  void add(const hash_batch_entry_t& entry) {
+    records.push_back(bulk_record_t(entry, sequence++));
+    if (records.size() >= run_size) {
+      spill();
+    }
+  }
+
+  // load all added hashes into the hash stores, call while locked
+  void load(lmdb_hash_data_manager_t& hash_data_manager,
+            lmdb_hash_manager_t& hash_manager,
+            hashdb::lmdb_changes_t& changes) {
+
+    if (records.size() == 0 && run_filenames.size() == 0) {
+      return;
+    }
+
+    // set up the sorted record source
+    bulk_run_merger_t* merger = NULL;
+    if (run_filenames.size() == 0) {
+      // all records are in memory
+      std::sort(records.begin(), records.end());
+    } else {
+      if (records.size() != 0) {
+        spill();
+      }
+      reduce_runs();
+      merger = new bulk_run_merger_t(run_filenames);
+    }
+    size_t record_index = 0;
+
+    // append only into empty stores
+    const bool is_append = (hash_data_manager.size() == 0 &&
+                            hash_manager.size() == 0);
+
+    // records of whole hash store prefixes, their counts, the order they
+    // were added, and the final hash data of their hashes
+    hash_batch_entries_t chunk_entries;
+    std::vector<size_t> chunk_counts;
+    std::vector<uint64_t> chunk_sequences;
+    hash_append_entries_t chunk_groups;
+    hash_append_entry_t group;
+
+    while (true) {
+
+      // get the next sorted record
+      bulk_record_t record;
+      bool has_record;
+      if (merger == NULL) {
+        has_record = (record_index < records.size());
+        if (has_record) {
+          record = records[record_index++];
+        }
+      } else {
+        has_record = merger->next(record);
+      }
+
+      if (!is_append) {
+        // insert sorted records using batched writes, ending chunks
+        // between prefixes
+        if (chunk_entries.size() > 0 && (!has_record ||
+             (chunk_entries.size() >= bulk_chunk_size &&
+              !same_prefix(record.entry.block_hash,
+                           chunk_entries.back().block_hash)))) {
+          order_prefixes(chunk_entries, chunk_counts, chunk_sequences);
+          hash_data_manager.insert_batch(chunk_entries, chunk_counts,
+                                         changes);
+          hash_manager.insert_batch(chunk_entries, chunk_counts, changes);
+          chunk_entries.clear();
+          chunk_sequences.clear();
+        }
+        if (!has_record) {
+          break;
+        }
+        chunk_entries.push_back(record.entry);
+        chunk_sequences.push_back(record.sequence);
+        continue;
+      }
+
+      // close the group at the end of its hash
+      if (group.source_id_sub_counts.size() > 0 &&
+          (!has_record || record.entry.block_hash != group.block_hash)) {
+        chunk_groups.push_back(group);
+        group = hash_append_entry_t();
+
+        // write whole prefixes
+        if (!has_record || (chunk_entries.size() >= bulk_chunk_size &&
+                            !same_prefix(record.entry.block_hash,
+                                         chunk_entries.back().block_hash))) {
+          hash_data_manager.append_batch(chunk_groups);
+          order_prefixes(chunk_entries, chunk_counts, chunk_sequences);
+          hash_manager.append_batch(chunk_entries, chunk_counts, changes);
+          chunk_groups.clear();
+          chunk_entries.clear();
+          chunk_counts.clear();
+          chunk_sequences.clear();
+        }
+      }
+      if (!has_record) {
+        break;
+      }
+
+      // apply the record to its group
+      chunk_counts.push_back(apply(group, record.entry, changes));
+      chunk_entries.push_back(record.entry);
+      chunk_sequences.push_back(record.sequence);
+    }
+
+    // clean up
+    if (merger != NULL) {
+      delete merger;
+    }
+    std::vector<bulk_record_t>().swap(records);
+    if (run_filenames.size() > 0) {
+      remove_runs(run_filenames);
+      run_filenames.clear();
+      rmdir(temp_dir.c_str());
+    }
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,238 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides a blocked Bloom filter of hash store keys so that most
+ * lookups of absent hashes are answered from memory.
+ *
+ * Each key sets one bit in each of the eight 32-bit words of one
+ * 32-byte block, so a lookup reads one cache line.  At 12 bits per key
+ * about 1% of absent keys pass the filter.  A filter never rejects a
+ * key that was added.
+ *
+ * The filter is saved to and read from a file.  The file records the
+ * LMDB transaction ID and the number of keys of the store it was built
+ * from so that a stale filter is not used.  Writers that add keys
+ * restamp the filter with the new transaction ID and key count before
+ * saving it.
+ */
+
+#ifndef HASH_FILTER_HPP
+#define HASH_FILTER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+
+namespace hashdb {
+
+class hash_filter_t {
+  friend class portable_filter_t;
+
+  private:
+  static const uint32_t words_per_block = 8;
+  static const uint64_t bits_per_key = 12;
+
+  std::vector<uint32_t> words;
+  uint64_t num_blocks;
+
+  // do not allow copy or assignment
+  hash_filter_t(const hash_filter_t&);
+  hash_filter_t& operator=(const hash_filter_t&);
+
+  // hash up to the first 8 bytes of the key, which are already well mixed
+  // for block hashes, into 64 bits
+  static uint64_t key_hash(const void* const key, const size_t key_size) {
+    uint64_t h = 0;
+    memcpy(&h, key, (key_size < 8) ? key_size : 8);
+    h ^= key_size;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // the block for h, then one bit in each word from the low 32 bits of h
+  uint32_t* block(const uint64_t h) {
+    return &words[((h >> 32) * num_blocks >> 32) * words_per_block];
+  }
+  const uint32_t* block(const uint64_t h) const {
+    return &words[((h >> 32) * num_blocks >> 32) * words_per_block];
+  }
+  static uint32_t bit(const uint32_t h, const uint32_t i) {
+    static const uint32_t salt[words_per_block] = {
+               0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+               0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+    return 1U << ((h * salt[i]) >> 27);
+  }
+
+  struct file_header_t {
+    char magic[8];
+    uint64_t txnid;
+    uint64_t num_keys;
+    uint64_t num_blocks;
+  };
+
+  // the number of blocks for a filter sized for num_keys keys
+  static uint64_t blocks_for(const uint64_t p_num_keys) {
+    uint64_t blocks = (p_num_keys * bits_per_key + 255) / 256;
+    if (blocks == 0) {
+      blocks = 1;
+    }
+    // the block index uses 32 bits
+    if (blocks > 0xffffffffULL) {
+      blocks = 0xffffffffULL;
+    }
+    return blocks;
+  }
+
+  // create an empty filter with p_num_blocks blocks
+  hash_filter_t(const uint64_t p_txnid, const uint64_t p_num_keys,
+                const uint64_t p_num_blocks) :
+           words(p_num_blocks * words_per_block, 0), num_blocks(p_num_blocks),
+           txnid(p_txnid), num_keys(p_num_keys) {
+  }
+
+  public:
+  uint64_t txnid;      // transaction ID of the store
+  uint64_t num_keys;   // number of keys in the store
+
+  /**
+   * Create an empty filter sized for p_num_keys keys.
+   */
+  hash_filter_t(const uint64_t p_txnid, const uint64_t p_num_keys) :
+           words(), num_blocks(blocks_for(p_num_keys)),
+           txnid(p_txnid), num_keys(p_num_keys) {
+    words.resize(num_blocks * words_per_block, 0);
+  }
+
+  /**
+   * Record the transaction ID and key count of the store after keys
+   * have been added.
+   */
+  void stamp(const uint64_t p_txnid, const uint64_t p_num_keys) {
+    txnid = p_txnid;
+    num_keys = p_num_keys;
+  }
+
+  /**
+   * True when the store has grown to twice the keys the filter was
+   * sized for, so that too many absent keys pass and it should be
+   * rebuilt.
+   */
+  bool is_overfull() const {
+    return blocks_for(num_keys) > 2 * num_blocks;
+  }
+
+  void add(const void* const key, const size_t key_size) {
+    const uint64_t h = key_hash(key, key_size);
+    uint32_t* const b = block(h);
+    for (uint32_t i=0; i<words_per_block; ++i) {
+      b[i] |= bit(static_cast<uint32_t>(h), i);
+    }
+  }
+
+  // false if the key is certainly absent
+  bool maybe_contains(const void* const key, const size_t key_size) const {
+    const uint64_t h = key_hash(key, key_size);
+    const uint32_t* const b = block(h);
+    for (uint32_t i=0; i<words_per_block; ++i) {
+      if ((b[i] & bit(static_cast<uint32_t>(h), i)) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Read the filter from filename.  Returns NULL if the file is missing
+   * or is not for the store with this transaction ID and key count.
+   */
+  static hash_filter_t* read(const std::string& filename,
+                             const uint64_t p_txnid,
+                             const uint64_t p_num_keys) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return NULL;
+    }
+    file_header_t header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good() || memcmp(header.magic, "hdbflt1", 8) != 0 ||
+        header.txnid != p_txnid || header.num_keys != p_num_keys) {
+      return NULL;
+    }
+    if (header.num_blocks == 0 || header.num_blocks > 0xffffffffULL) {
+      return NULL;
+    }
+    hash_filter_t* filter =
+               new hash_filter_t(p_txnid, p_num_keys, header.num_blocks);
+    in.read(reinterpret_cast<char*>(&filter->words[0]),
+            filter->words.size() * sizeof(uint32_t));
+    if (!in.good()) {
+      delete filter;
+      return NULL;
+    }
+    return filter;
+  }
+
+  /**
+   * Write the filter to filename, replacing any existing file.  Returns
+   * false if it cannot be written, for example in a read-only directory.
+   */
+  bool write(const std::string& filename) const {
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    file_header_t header;
+    memcpy(header.magic, "hdbflt1", 8);
+    header.txnid = txnid;
+    header.num_keys = num_keys;
+    header.num_blocks = num_blocks;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&words[0]),
+              words.size() * sizeof(uint32_t));
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -0,0 +1,362 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides an in-memory copy of the hash store as a sorted array so that
+ * approximate counts are found without LMDB lookups.
+ *
+ * Each hash store key, a 7-byte hash prefix, and its 1-byte count
+ * encoding are packed into one 64-bit entry, the prefix in the high
+ * bytes so that entries sort like their keys.  Entries cost 8 bytes per
+ * key, several times less than LMDB nodes in the page cache.  A radix
+ * directory on the leading prefix bits, with about 16 entries per
+ * directory entry, narrows a lookup to one or two cache lines of
+ * entries, which are then binary searched.
+ *
+ * The index is saved to a file with its directory, and a saved index is
+ * mapped read-only rather than copied into memory, so that opening it
+ * costs nothing until lookups touch its pages.  The file records the
+ * LMDB transaction ID and the number of keys of the store it was built
+ * from so that a stale index is not used.  Stores with keys shorter than
+ * 7 bytes, from hashes shorter than 7 bytes, do not get an index.
+ */
+
+#ifndef HASH_PREFIX_INDEX_HPP
+#define HASH_PREFIX_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+#include "lmdb_helper.h"
+#include "numa_nodes.hpp"
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(WIN32)
+#define HASH_PREFIX_INDEX_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+namespace hashdb {
+
+class hash_prefix_index_t {
+
+  private:
+  std::vector<uint64_t> built_entries;    // of a built or copied index
+  std::vector<uint64_t> built_directory;
+  const uint64_t* entries;    // prefix << 8 | count byte, ascending
+  const uint64_t* directory;  // first entry of each radix, and end
+  uint64_t num_entries;
+  uint32_t directory_bits;
+  void* mapped;               // the mapped file of a read index, or NULL
+  size_t mapped_size;
+
+  // do not allow copy or assignment
+  hash_prefix_index_t(const hash_prefix_index_t&);
+  hash_prefix_index_t& operator=(const hash_prefix_index_t&);
+
+  struct file_header_t {
+    char magic[8];
+    uint64_t txnid;
+    uint64_t num_keys;
+    uint64_t directory_bits;
+  };
+
+  static uint64_t directory_size(const uint32_t bits) {
+    return (static_cast<uint64_t>(1) << bits) + 1;
+  }
+
+  // the prefix as a big-endian number
+  static uint64_t prefix_value(const void* const prefix) {
+    const uint8_t* const p = static_cast<const uint8_t*>(prefix);
+    uint64_t value = 0;
+    for (size_t i=0; i<prefix_size; ++i) {
+      value = (value << 8) | p[i];
+    }
+    return value;
+  }
+
+  // the directory entry of a prefix value
+  uint64_t radix(const uint64_t value) const {
+    return (directory_bits == 0) ? 0 : value >> (56 - directory_bits);
+  }
+
+  // point at the entries and directory of a file image, checking that
+  // they fill it
+  bool use_image(const uint8_t* const image, const uint64_t image_size) {
+    file_header_t header;
+    if (image_size < sizeof(header)) {
+      return false;
+    }
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, "hdbpfx2", 8) != 0 ||
+        header.txnid != txnid || header.num_keys != num_keys ||
+        header.directory_bits > 28 ||
+        image_size != sizeof(header) + (num_keys +
+                 directory_size(static_cast<uint32_t>(
+                 header.directory_bits))) * sizeof(uint64_t)) {
+      return false;
+    }
+    directory_bits = static_cast<uint32_t>(header.directory_bits);
+    entries = reinterpret_cast<const uint64_t*>(image + sizeof(header));
+    directory = entries + num_keys;
+    num_entries = num_keys;
+    return true;
+  }
+
+  public:
+  static const size_t prefix_size = 7;
+
+  uint64_t txnid;      // transaction ID of the store
+  uint64_t num_keys;   // number of keys in the store
+
+  /**
+   * Create an empty index for a store of p_num_keys keys.
+   */
+  hash_prefix_index_t(const uint64_t p_txnid, const uint64_t p_num_keys) :
+           built_entries(), built_directory(), entries(NULL),
+           directory(NULL), num_entries(0), directory_bits(0),
+           mapped(NULL), mapped_size(0),
+           txnid(p_txnid), num_keys(p_num_keys) {
+    built_entries.reserve(p_num_keys);
+  }
+
+  ~hash_prefix_index_t() {
+#ifdef HASH_PREFIX_INDEX_MMAP
+    if (mapped != NULL) {
+      ::munmap(mapped, mapped_size);
+    }
+#endif
+  }
+
+  /**
+   * Add the next key, prefix_size bytes, in ascending order.
+   */
+  void add(const void* const prefix, const uint8_t count_byte) {
+    built_entries.push_back((prefix_value(prefix) << 8) | count_byte);
+  }
+
+  /**
+   * Build the directory once all keys are added.
+   */
+  void finish() {
+    directory_bits = 0;
+    while (directory_bits < 28 &&
+           (built_entries.size() >> directory_bits) > 16) {
+      ++directory_bits;
+    }
+    built_directory.assign(directory_size(directory_bits), 0);
+    for (size_t i=0; i<built_entries.size(); ++i) {
+      ++built_directory[radix(built_entries[i] >> 8) + 1];
+    }
+    for (size_t d=1; d<built_directory.size(); ++d) {
+      built_directory[d] += built_directory[d - 1];
+    }
+    entries = built_entries.empty() ? NULL : &built_entries[0];
+    directory = &built_directory[0];
+    num_entries = built_entries.size();
+  }
+
+  /**
+   * True if the index is a mapped file rather than a copy in memory.
+   */
+  bool is_mapped() const {
+    return mapped != NULL;
+  }
+  /**
+   * Find the count encoding of the key, prefix_size bytes.  Return false
+   * if the key is absent.
+   */
+  bool find(const void* const prefix, uint8_t& count_byte) const {
+    const uint64_t value = prefix_value(prefix);
+    const uint64_t d = radix(value);
+    uint64_t lo = directory[d];
+    uint64_t hi = directory[d + 1];
+    while (lo < hi) {
+      const uint64_t mid = lo + (hi - lo) / 2;
+      if ((entries[mid] >> 8) < value) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo == directory[d + 1] || (entries[lo] >> 8) != value) {
+      return false;
+    }
+    count_byte = static_cast<uint8_t>(entries[lo]);
+    return true;
+  }
+
+  /**
+   * Find the count encodings of n keys, prefix_size bytes each, as find,
+   * with the lookups interleaved in stages so that their cache misses
+   * overlap.  n is at most lmdb_helper::prefetch_batch_size.
+   */
+  void find_batch(const char* const* const prefixes, const size_t n,
+                  uint8_t* const count_bytes, bool* const found) const {
+    uint64_t values[lmdb_helper::prefetch_batch_size];
+    for (size_t i=0; i<n; ++i) {
+      values[i] = prefix_value(prefixes[i]);
+      lmdb_helper::prefetch(&directory[radix(values[i])]);
+    }
+
+    // the middle of each range, where the search starts
+    for (size_t i=0; i<n; ++i) {
+      const uint64_t d = radix(values[i]);
+      if (directory[d] < directory[d + 1]) {
+        lmdb_helper::prefetch(
+               &entries[directory[d] + (directory[d + 1] - directory[d]) / 2]);
+      }
+    }
+
+    for (size_t i=0; i<n; ++i) {
+      found[i] = find(prefixes[i], count_bytes[i]);
+    }
+  }
+
+  /**
+   * Lock the index in memory, on huge pages where available.  Return
+   * false if it cannot be locked.
+   */
+  bool lock() const {
+    return num_entries == 0 ||
+           (lmdb_helper::lock_memory(entries,
+                                     num_entries * sizeof(uint64_t), true) &&
+            lmdb_helper::lock_memory(directory,
+                directory_size(directory_bits) * sizeof(uint64_t), false));
+  }
+
+  /**
+   * Spread the index across the NUMA nodes so that scan threads on every
+   * node see the same memory bandwidth.  Return false if not possible.
+   */
+  bool interleave() const {
+    return num_entries == 0 ||
+           (hashdb::interleave_memory(entries,
+                                      num_entries * sizeof(uint64_t)) &&
+            hashdb::interleave_memory(directory,
+                      directory_size(directory_bits) * sizeof(uint64_t)));
+  }
+
+  /**
+   * Read the index from filename, mapping it where mmap is available.
+   * Returns NULL if the file is missing or is not for the store with
+   * this transaction ID and key count.
+   */
+  static hash_prefix_index_t* read(const std::string& filename,
+                                   const uint64_t p_txnid,
+                                   const uint64_t p_num_keys) {
+    hash_prefix_index_t* index =
+                        new hash_prefix_index_t(p_txnid, p_num_keys);
+#ifdef HASH_PREFIX_INDEX_MMAP
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      delete index;
+      return NULL;
+    }
+    struct stat s;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &s) == 0 && s.st_size > 0) {
+      p = ::mmap(NULL, static_cast<size_t>(s.st_size), PROT_READ,
+                 MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (p == MAP_FAILED) {
+      delete index;
+      return NULL;
+    }
+#ifdef MADV_RANDOM
+    // lookups do not benefit from reading ahead
+    ::madvise(p, static_cast<size_t>(s.st_size), MADV_RANDOM);
+#endif
+    index->mapped = p;
+    index->mapped_size = static_cast<size_t>(s.st_size);
+    if (!index->use_image(static_cast<const uint8_t*>(p),
+                          static_cast<uint64_t>(s.st_size))) {
+      delete index;
+      return NULL;
+    }
+#else
+    // read the whole file
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    in.seekg(0, std::ios::end);
+    const std::streamoff size = in.tellg();
+    in.seekg(0, std::ios::beg);
+    if (!in.good() || size <= 0 || size % sizeof(uint64_t) != 0) {
+      delete index;
+      return NULL;
+    }
+    index->built_entries.resize(static_cast<size_t>(size) /
+                                sizeof(uint64_t));
+    in.read(reinterpret_cast<char*>(&index->built_entries[0]), size);
+    if (!in.good() || !index->use_image(reinterpret_cast<const uint8_t*>(
+                   &index->built_entries[0]), static_cast<uint64_t>(size))) {
+      delete index;
+      return NULL;
+    }
+#endif
+    return index;
+  }
+
+  /**
+   * Write the index to filename, replacing any existing file.  Returns
+   * false if it cannot be written, for example in a read-only directory.
+   */
+  bool write(const std::string& filename) const {
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    file_header_t header;
+    memcpy(header.magic, "hdbpfx2", 8);
+    header.txnid = txnid;
+    header.num_keys = num_keys;
+    header.directory_bits = directory_bits;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (num_entries != 0) {
+      out.write(reinterpret_cast<const char*>(entries),
+                num_entries * sizeof(uint64_t));
+    }
+    out.write(reinterpret_cast<const char*>(directory),
+              directory_size(directory_bits) * sizeof(uint64_t));
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,195 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides running statistics of the hash data store: the total of the
+ * hash counts, the number of hashes with a count of 1, and the number of
+ * hashes with each count.
+ *
+ * Writers update the statistics each time the count of a hash changes,
+ * so they can be reported without walking the store.  Like the hash
+ * filter, the statistics are saved to and read from a file that records
+ * the LMDB transaction ID and the number of entries of the store they
+ * are for so that stale statistics are not used.
+ */
+
+#ifndef HASH_STATS_HPP
+#define HASH_STATS_HPP
+
+#include <string>
+#include <map>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+
+namespace hashdb {
+
+class hash_stats_t {
+
+  private:
+  struct file_header_t {
+    char magic[8];
+    uint64_t txnid;
+    uint64_t num_keys;
+    uint64_t total_hashes;
+    uint64_t total_distinct_hashes;
+    uint64_t num_counts;
+  };
+
+  public:
+  // the histogram as <count, number of hashes with count>
+  typedef std::map<uint64_t, uint64_t> histogram_t;
+
+  uint64_t txnid;                  // transaction ID of the store
+  uint64_t num_keys;               // number of entries in the store
+  uint64_t total_hashes;           // total of the hash counts
+  uint64_t total_distinct_hashes;  // number of hashes with count 1
+  histogram_t histogram;
+
+  hash_stats_t(const uint64_t p_txnid, const uint64_t p_num_keys) :
+           txnid(p_txnid), num_keys(p_num_keys), total_hashes(0),
+           total_distinct_hashes(0), histogram() {
+  }
+
+  /**
+   * Record the transaction ID and entry count of the store after
+   * hashes have been changed.
+   */
+  void stamp(const uint64_t p_txnid, const uint64_t p_num_keys) {
+    txnid = p_txnid;
+    num_keys = p_num_keys;
+  }
+
+  /**
+   * Account for a hash whose count changed from old_count to new_count,
+   * where a count of 0 means the hash is not in the store.
+   */
+  void change(const uint64_t old_count, const uint64_t new_count) {
+    if (old_count == new_count) {
+      return;
+    }
+    if (old_count != 0) {
+      histogram_t::iterator it = histogram.find(old_count);
+      if (it != histogram.end() && --it->second == 0) {
+        histogram.erase(it);
+      }
+      total_hashes -= old_count;
+      if (old_count == 1) {
+        --total_distinct_hashes;
+      }
+    }
+    if (new_count != 0) {
+      ++histogram[new_count];
+      total_hashes += new_count;
+      if (new_count == 1) {
+        ++total_distinct_hashes;
+      }
+    }
+  }
+
+  // add the statistics of another part of the store
+  void add(const hash_stats_t& other) {
+    total_hashes += other.total_hashes;
+    total_distinct_hashes += other.total_distinct_hashes;
+    for (histogram_t::const_iterator it = other.histogram.begin();
+         it != other.histogram.end(); ++it) {
+      histogram[it->first] += it->second;
+    }
+  }
+
+  /**
+   * Read the statistics from filename.  Returns NULL if the file is
+   * missing or is not for the store with this transaction ID and entry
+   * count.
+   */
+  static hash_stats_t* read(const std::string& filename,
+                            const uint64_t p_txnid,
+                            const uint64_t p_num_keys) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return NULL;
+    }
+    file_header_t header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good() || memcmp(header.magic, "hdbsts1", 8) != 0 ||
+        header.txnid != p_txnid || header.num_keys != p_num_keys) {
+      return NULL;
+    }
+    hash_stats_t* stats = new hash_stats_t(p_txnid, p_num_keys);
+    stats->total_hashes = header.total_hashes;
+    stats->total_distinct_hashes = header.total_distinct_hashes;
+    for (uint64_t i=0; i<header.num_counts; ++i) {
+      uint64_t pair[2];
+      in.read(reinterpret_cast<char*>(pair), sizeof(pair));
+      if (!in.good()) {
+        delete stats;
+        return NULL;
+      }
+      stats->histogram[pair[0]] = pair[1];
+    }
+    return stats;
+  }
+
+  /**
+   * Write the statistics to filename, replacing any existing file.
+   * Returns false if they cannot be written, for example in a read-only
+   * directory.
+   */
+  bool write(const std::string& filename) const {
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    file_header_t header;
+    memcpy(header.magic, "hdbsts1", 8);
+    header.txnid = txnid;
+    header.num_keys = num_keys;
+    header.total_hashes = total_hashes;
+    header.total_distinct_hashes = total_distinct_hashes;
+    header.num_counts = histogram.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (histogram_t::const_iterator it = histogram.begin();
+         it != histogram.end(); ++it) {
+      const uint64_t pair[2] = {it->first, it->second};
+      out.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+    }
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -0,0 +1,335 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Write inserted hashes to the hash data store and the hash store from
+ * one writer thread so that threads producing hashes do not wait on
+ * LMDB writes.  Threadsafe.
+ *
+ * Producers push batches of entries.  The writer thread takes every
+ * pending batch at once, sorts the combined entries by block hash, and
+ * writes them using one write transaction per store.  Push blocks while
+ * max_pending batches are waiting, bounding memory use.  Waiting batches
+ * are drawn from the memory budget, and push also blocks while a batch
+ * waits and the budget is spent.  Records of the same hash are applied
+ * in the order they were pushed.
+ *
+ * When the stores are sharded, the entries of each shard are written by
+ * a thread of their own so that the shards commit concurrently.
+ */
+
+#ifndef HASH_WRITER_HPP
+#define HASH_WRITER_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <cassert>
+#include <pthread.h>
+#include "lmdb_changes.hpp"
+#include "lmdb_hash_data_manager.hpp"
+#include "lmdb_hash_manager.hpp"
+#include "hash_batch.hpp"
+#include "memory_budget.hpp"
+
+namespace hashdb {
+
+class hash_writer_t {
+
+  private:
+  lmdb_hash_data_manager_t& hash_data_manager;
+  lmdb_hash_manager_t& hash_manager;
+  hashdb::lmdb_changes_t& changes;
+  hash_batch_t& hash_batch;  // locked to serialize with batched writes
+
+  size_t max_pending;
+  std::vector<hash_batch_entries_t> pending;
+  uint64_t pending_bytes;    // taken from the budget
+  bool is_running;
+  bool is_writing;
+  bool is_done;
+  pthread_t thread;
+
+  mutable pthread_mutex_t M;
+  pthread_cond_t has_work;
+  pthread_cond_t changed;    // room, written, or stopped
+
+  // do not allow copy or assignment
+  hash_writer_t(const hash_writer_t&);
+  hash_writer_t& operator=(const hash_writer_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  // the approximate memory of a batch
+  static uint64_t batch_bytes(const hash_batch_entries_t& entries) {
+    uint64_t bytes = entries.capacity() * sizeof(hash_batch_entry_t);
+    for (size_t i=0; i<entries.size(); ++i) {
+      bytes += entries[i].block_hash.size() + entries[i].block_label.size();
+    }
+    return bytes;
+  }
+
+  static bool block_hash_less(const hash_batch_entry_t& a,
+                              const hash_batch_entry_t& b) {
+    return a.block_hash < b.block_hash;
+  }
+
+  // the entries of one shard and the thread writing them
+  struct shard_write_t {
+    hash_writer_t* writer;
+    hash_batch_entries_t entries;
+    pthread_t thread;
+    shard_write_t() : writer(0), entries(), thread() {
+    }
+
+    private:
+    // do not allow copy or assignment
+    shard_write_t(const shard_write_t&);
+    shard_write_t& operator=(const shard_write_t&);
+  };
+
+  // write entries of one shard or of all shards
+  void write_entries(const hash_batch_entries_t& entries) {
+    std::vector<size_t> counts;
+    hash_data_manager.insert_batch(entries, counts, changes);
+    hash_manager.insert_batch(entries, counts, changes);
+  }
+
+  static void* run_shard(void* const arg) {
+    shard_write_t* const shard_write = static_cast<shard_write_t*>(arg);
+    shard_write->writer->write_entries(shard_write->entries);
+    return NULL;
+  }
+
+  // write sorted entries using one thread per shard
+  void write_shards(const hash_batch_entries_t& entries) {
+
+    // split the entries into runs of one shard
+    std::vector<shard_write_t*> shard_writes;
+    size_t begin = 0;
+    while (begin < entries.size()) {
+      const size_t s = hash_data_manager.shard_index(entries[begin].block_hash);
+      size_t end = begin + 1;
+      while (end < entries.size() &&
+             hash_data_manager.shard_index(entries[end].block_hash) == s) {
+        ++end;
+      }
+      shard_write_t* const shard_write = new shard_write_t;
+      shard_write->writer = this;
+      shard_write->entries.assign(entries.begin() + begin,
+                                  entries.begin() + end);
+      shard_writes.push_back(shard_write);
+      begin = end;
+    }
+
+    // write the runs concurrently
+    for (size_t i=1; i<shard_writes.size(); ++i) {
+      if (pthread_create(&shard_writes[i]->thread, NULL, run_shard,
+                         shard_writes[i])) {
+        std::cerr << "Error creating hash shard writer thread.\n";
+        assert(0);
+      }
+    }
+    if (shard_writes.size() > 0) {
+      write_entries(shard_writes[0]->entries);
+    }
+    for (size_t i=1; i<shard_writes.size(); ++i) {
+      pthread_join(shard_writes[i]->thread, NULL);
+    }
+    for (size_t i=0; i<shard_writes.size(); ++i) {
+      delete shard_writes[i];
+    }
+  }
+
+  // write batches in one write transaction per store
+  void write(std::vector<hash_batch_entries_t>& batches) {
+    hash_batch_entries_t* entries = &batches[0];
+    hash_batch_entries_t combined;
+    if (batches.size() > 1) {
+      size_t size = 0;
+      for (size_t i=0; i<batches.size(); ++i) {
+        size += batches[i].size();
+      }
+      combined.reserve(size);
+      for (size_t i=0; i<batches.size(); ++i) {
+        combined.insert(combined.end(), batches[i].begin(), batches[i].end());
+      }
+      entries = &combined;
+    }
+    std::stable_sort(entries->begin(), entries->end(), block_hash_less);
+
+    hash_batch.lock();
+    if (hash_data_manager.shard_count() > 1) {
+      write_shards(*entries);
+    } else {
+      write_entries(*entries);
+    }
+    hash_batch.unlock();
+  }
+
+  void write_loop() {
+    lock();
+    while (true) {
+      while (pending.size() == 0 && !is_done) {
+        pthread_cond_wait(&has_work, &M);
+      }
+      if (pending.size() == 0) {
+        // done and drained
+        break;
+      }
+
+      // take every pending batch
+      std::vector<hash_batch_entries_t> batches;
+      batches.swap(pending);
+      const uint64_t batches_bytes = pending_bytes;
+      pending_bytes = 0;
+      is_writing = true;
+      pthread_cond_broadcast(&changed);
+      unlock();
+
+      write(batches);
+      batches.clear();
+      memory_budget().release(batches_bytes);
+
+      lock();
+      is_writing = false;
+      pthread_cond_broadcast(&changed);
+    }
+    unlock();
+  }
+
+  static void* run(void* const arg) {
+    static_cast<hash_writer_t*>(arg)->write_loop();
+    return NULL;
+  }
+
+  public:
+  hash_writer_t(lmdb_hash_data_manager_t& p_hash_data_manager,
+                lmdb_hash_manager_t& p_hash_manager,
+                hashdb::lmdb_changes_t& p_changes,
+                hash_batch_t& p_hash_batch) :
+          hash_data_manager(p_hash_data_manager),
+          hash_manager(p_hash_manager),
+          changes(p_changes),
+          hash_batch(p_hash_batch),
+          max_pending(0), pending(), pending_bytes(0),
+          is_running(false), is_writing(false), is_done(false),
+          thread(), M(), has_work(), changed() {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&has_work,NULL) ||
+       pthread_cond_init(&changed,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+  }
+
+  ~hash_writer_t() {
+    stop();
+    pthread_cond_destroy(&has_work);
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&M);
+  }
+
+  // start the writer thread or change its limit
+  void start(const size_t p_max_pending) {
+    lock();
+    max_pending = (p_max_pending == 0) ? 1 : p_max_pending;
+    pthread_cond_broadcast(&changed);
+    if (!is_running) {
+      is_done = false;
+      if (pthread_create(&thread, NULL, run, this)) {
+        std::cerr << "Error creating hash writer thread.\n";
+        assert(0);
+      }
+      is_running = true;
+    }
+    unlock();
+  }
+
+  // write pending batches and stop the writer thread
+  void stop() {
+    lock();
+    if (!is_running) {
+      unlock();
+      return;
+    }
+    is_done = true;
+    pthread_cond_signal(&has_work);
+    unlock();
+    pthread_join(thread, NULL);
+    lock();
+    is_running = false;
+    is_done = false;
+    unlock();
+  }
+
+  /**
+   * Queue entries for the writer thread, taking their contents.  Blocks
+   * while max_pending batches wait or while a batch waits and the memory
+   * budget is spent.  Returns false without taking the entries when the
+   * writer thread is not running.
+   */
+  bool push(hash_batch_entries_t& entries) {
+    const uint64_t bytes = batch_bytes(entries);
+    lock();
+    if (!is_running) {
+      unlock();
+      return false;
+    }
+    while (pending.size() >= max_pending ||
+           (pending.size() > 0 && !memory_budget().try_acquire(bytes))) {
+      pthread_cond_wait(&changed, &M);
+    }
+    if (pending.size() == 0) {
+      // the writer will take this batch, so take its memory regardless
+      memory_budget().charge(bytes);
+    }
+    pending_bytes += bytes;
+    pending.push_back(hash_batch_entries_t());
+    pending.back().swap(entries);
+    pthread_cond_signal(&has_work);
+    unlock();
+    return true;
+  }
+
+  // wait until every pushed batch is written
+  void drain() {
+    lock();
+    while (pending.size() > 0 || is_writing) {
+      pthread_cond_wait(&changed, &M);
+    }
+    unlock();
+  }
+};
+
+} // end namespace hashdb
+
+#endif
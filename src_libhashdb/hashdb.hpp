@@ -32,9 +32,14 @@
 
 #include <string>
 #include <set>
+#include <map>
+#include <vector>
 #include <stdint.h>
 #include <sys/time.h>   // timeval* for timestamp_t
 #include <pthread.h>    // pthread_t* for scan_stream_t
+#if !defined(SWIG) && __cplusplus >= 201103L
+#include <future>       // for async_scan_t::submit_future
+#endif
 
 // ************************************************************
 // version of the hashdb library
@@ -47,16 +52,44 @@ const char* hashdb_version();
 
 namespace scan_stream {
   class scan_thread_data_t;
+  class scan_pool_t;
+  class remote_stream_data_t;
+  class async_scan_data_t;
+}
+namespace hasher {
+  class file_reader_t;
 }
 namespace hashdb {
   class lmdb_hash_data_manager_t;
+  class lmdb_hash_data_cursor_t;
+  class source_id_cache_t;
+  class source_batch_t;
   class lmdb_hash_manager_t;
   class lmdb_source_data_manager_t;
   class lmdb_source_id_manager_t;
   class lmdb_source_name_manager_t;
+  class lmdb_repository_manager_t;
+  class lmdb_source_hash_manager_t;
+  class lmdb_source_signature_manager_t;
+  class lmdb_count_index_manager_t;
+  class source_id_bitmap_t;
+  class source_cache_t;
+  class source_list_cache_t;
+  struct common_block_t;
+  class common_blocks_t;
   class lmdb_changes_t;
+  class hash_batch_t;
+  struct hash_batch_entry_t;
+  class hash_bulk_loader_t;
+  class hash_writer_t;
+  class hll_sketch_t;
+  class json_record_arena_t;
   class logger_t;
+  class change_log_t;
+  struct stage_totals_t;
   class locked_member_t;
+  class media_member_cache_t;
+  struct warm_state_t;
 
   // ************************************************************
   // version of the hashdb library
@@ -88,6 +121,13 @@ namespace hashdb {
   // pair(repository_name, filename)
   typedef std::pair<std::string, std::string> source_name_t;
   typedef std::set<source_name_t>             source_names_t;
+
+  /**
+   * The callback of import_manager_t::walk_sources, called with the
+   * caller's data for each source file hash in key order.
+   */
+  typedef void (*source_callback_t)(void* const data,
+                                    const std::string& file_hash);
 #endif
 
   // ************************************************************
@@ -99,6 +139,61 @@ namespace hashdb {
    * Attributes:
    *   settings_version - The version of the settings record
    *   block_size - Size, in bytes, of data blocks.
+   *   block_hash_algorithm - The digest used for block hashes, one of
+   *     md5, sha1, sha256, or blake2s256 when OpenSSL provides it.
+   *   hash_filter_generation - The hash store transaction ID that the
+   *     saved hash filter was last made current for by an import, or 0.
+   *   hash_data_format - The hash data store record format, 1 for
+   *     variable-length fields, 2 for fixed-width fields, or 3 for
+   *     fixed-width fields with the sources of hashes that have more than
+   *     a few kept in a separate MDB_DUPFIXED database, from which they
+   *     are read a page at a time.
+   *   min_chunk_size - The smallest content-defined chunk, or 0 to hash
+   *     blocks of block_size bytes at each step.  With chunks, block_size
+   *     is the average chunk size and each chunk is hashed, so content
+   *     still matches after it shifts, see hasher/chunker.hpp.
+   *   max_chunk_size - The largest content-defined chunk, or 0.
+   *   source_name_format - The source name store record format, 1 for
+   *     plain name pairs or 2 for pairs compressed with the trained
+   *     dictionary of the hashdb, see compress_source_names.
+   *   hash_shard_bits - The number of leading hash bits that partition
+   *     the hash data store and the hash store into 2^hash_shard_bits
+   *     LMDB environments, 0 through 6.
+   *   initial_map_size - The expected size, in bytes, of the hash data
+   *     store.  It is preallocated when the hashdb is created so that
+   *     import does not repeatedly grow the store, or 0 to start small.
+   *   max_map_size - The size, in bytes, that any one LMDB environment
+   *     may grow to, or 0 for no limit.
+   *   sync_policy - When writes are synced to disk: none to leave
+   *     writeback to the operating system, periodic to sync in the
+   *     background every sync_seconds or sync_mb of new data, or flush
+   *     to sync when the importer is flushed.  Writes are also synced
+   *     when an importer closes unless the policy is none.
+   *   sync_seconds - The periodic sync interval, in seconds.
+   *   sync_mb - The periodic sync volume, in MiB of new data.
+   *   max_readers - The read transactions that may be open at once in
+   *     each LMDB environment, across processes, or 0 for the larger of
+   *     the LMDB default of 126 and 4 per CPU.  Each scan thread takes
+   *     one.
+   *   source_hash_index - Whether the hashdb keeps a reverse index from
+   *     each source to its block hashes.
+   *   similarity_index - Whether the hashdb keeps a MinHash signature of
+   *     the block hashes of each source and an index of the signatures,
+   *     for finding similar sources, see find_similar_sources_json.
+   *   count_index - Whether the hashdb keeps a secondary index from each
+   *     hash count of at least 2 to the block hashes with that count, for
+   *     finding the hashes in a count range without reading every hash.
+   *   change_log - Whether imports append their changes to a change log
+   *     that export_changes ships to replicas.
+   *   frozen - Whether the hashdb is a read-only copy made by
+   *     freeze_hashdb.
+   *   hash_store_rebuild - Whether the hash store is stale because an
+   *     import deferred maintaining it, see set_defer_hash_store.  Scans
+   *     then find hashes in the hash data store until it is rebuilt.
+   *   store_paths - The directory to place each named store in when it
+   *     is created, such as lmdb_hash_store on fast local media, instead
+   *     of the hashdb directory.  The store in the hashdb directory links
+   *     to its placed directory.
    */
   struct settings_t {
 #ifndef SWIG
@@ -106,6 +201,26 @@ namespace hashdb {
 #endif
     uint32_t settings_version;
     uint32_t block_size;
+    std::string block_hash_algorithm;
+    uint32_t min_chunk_size;
+    uint32_t max_chunk_size;
+    uint64_t hash_filter_generation;
+    uint32_t hash_data_format;
+    uint32_t source_name_format;
+    uint32_t hash_shard_bits;
+    uint64_t initial_map_size;
+    uint64_t max_map_size;
+    std::string sync_policy;
+    uint32_t sync_seconds;
+    uint32_t sync_mb;
+    uint32_t max_readers;
+    bool source_hash_index;
+    bool similarity_index;
+    bool count_index;
+    bool change_log;
+    bool frozen;
+    bool hash_store_rebuild;
+    std::map<std::string, std::string> store_paths;
     settings_t();
     std::string settings_string() const;
   };
@@ -115,11 +230,16 @@ namespace hashdb {
   // ************************************************************
   /**
    * The scan mode controls scan optimization and returned JSON content.
+   * BINARY returns the binary hash record of hash_binary instead of JSON.
+   * EXISTS only checks the hash store, and scan_stream_t returns a
+   * membership bitmap per array in this mode.
    */
   enum scan_mode_t {EXPANDED,
                     EXPANDED_OPTIMIZED,
                     COUNT,
-                    APPROXIMATE_COUNT};
+                    APPROXIMATE_COUNT,
+                    BINARY,
+                    EXISTS};
 
   // ************************************************************
   // misc support interfaces
@@ -143,6 +263,233 @@ namespace hashdb {
                             const hashdb::settings_t& settings,
                             const std::string& command_string);
 
+  /**
+   * Rewrite the hash data store of a hashdb in another record format.
+   * The hashdb must not be in use.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to migrate.
+   *   hash_data_format - The record format to migrate to, see settings_t.
+   *   command_string - String to put into the hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string migrate_hash_data(const std::string& hashdb_dir,
+                                const uint32_t hash_data_format,
+                                const std::string& command_string);
+
+  /**
+   * Rewrite the source name store of a hashdb in the compressed source
+   * name format.  A dictionary of the common repository names, filename
+   * prefixes, and path components is trained from the names in the store
+   * and kept in the hashdb directory, and names imported later are
+   * compressed with it too.  The hashdb must not be in use.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to compress.
+   *   command_string - String to put into the hashdb log.
+   *   bytes_before - The size of the source name store before.
+   *   bytes_after - The size of the source name store after.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string compress_source_names(const std::string& hashdb_dir,
+                                    const std::string& command_string,
+                                    uint64_t& bytes_before,
+                                    uint64_t& bytes_after);
+
+  /**
+   * Make a frozen copy of a hashdb for scanning only.  The hash data
+   * store and the hash store are replaced by one flat file of sorted
+   * hashes and packed records that is mapped into memory, and the source
+   * stores are copied compactly.  scan_manager_t opens a frozen hashdb
+   * like any other, and import_manager_t refuses to.  Block hashes must
+   * all be of one size.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to freeze.
+   *   frozen_dir - Path to the frozen database to create.  The path must
+   *     not exist yet.
+   *   command_string - String to put into the new hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string freeze_hashdb(const std::string& hashdb_dir,
+                            const std::string& frozen_dir,
+                            const std::string& command_string);
+
+  /**
+   * Write a membership filter of the hashes of a hashdb to a file of
+   * about 1.5 bytes per hash, for scanning media where the hashdb is not
+   * available.  scan_media, scan_media_list, and scan_media_sample scan
+   * against a filter file given in place of a hashdb directory, printing
+   * the offset and block hash of each candidate match.  About 1% of
+   * absent hashes are candidates, so candidates are then confirmed with
+   * scan_list against the hashdb.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to export the filter of.
+   *   filter_file - Path to the filter file to write.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string export_filter(const std::string& hashdb_dir,
+                            const std::string& filter_file);
+
+  /**
+   * Estimate the number of distinct block hashes in a hashdb from the
+   * HyperLogLog sketch that import_manager_t keeps in the hashdb
+   * directory, and given a second hashdb, estimate the hashes in their
+   * union and in their intersection, to size an intersect or subtract
+   * before running it.  Estimates are within a few percent.  A hashdb
+   * without a sketch, made before sketches were kept, is read once to
+   * make one.  Hashes removed from a hashdb are still counted.
+   *
+   * Parameters:
+   *   hashdb_dir1 - Path to a database.
+   *   hashdb_dir2 - Path to a second database, or "" for none.
+   *   count1 - The hashes of hashdb_dir1.
+   *   count2 - The hashes of hashdb_dir2, or 0.
+   *   union_count - The hashes in either database.
+   *   intersection_count - The hashes in both databases, or 0.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string estimate_hashes(const std::string& hashdb_dir1,
+                              const std::string& hashdb_dir2,
+                              uint64_t& count1,
+                              uint64_t& count2,
+                              uint64_t& union_count,
+                              uint64_t& intersection_count);
+
+  /**
+   * Return true if dest_dir is an empty hashdb that clone_hashdb can
+   * copy hashdb_dir into: neither is frozen, the hash store of
+   * hashdb_dir does not need rebuilding, their block size, block
+   * hash algorithm, hash data format, hash shard bits, and source hash
+   * index match, and dest_dir keeps no change log.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to copy.
+   *   dest_dir - Path to the empty database to copy into.
+   */
+  bool can_clone_hashdb(const std::string& hashdb_dir,
+                        const std::string& dest_dir);
+
+  /**
+   * Copy a hashdb into an empty hashdb, see can_clone_hashdb, by copying
+   * each store compactly at disk speed instead of adding each hash.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to copy.
+   *   dest_dir - Path to the empty database to copy into.
+   *   command_string - String to put into the hashdb log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string clone_hashdb(const std::string& hashdb_dir,
+                           const std::string& dest_dir,
+                           const std::string& command_string);
+
+  /**
+   * Rewrite each LMDB store of a hashdb in key order onto tightly packed
+   * pages, leaving out free pages left by merges and record promotions.
+   * Each store is copied beside its data file and then the copy is
+   * renamed over it.  The hashdb must not be in use.  The hash store
+   * prefix indexes are saved again for scans to map.  Saved hash
+   * statistics and filters are made again when next needed, and blocks
+   * must be pinned again.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to optimize.
+   *   command_string - String to put into the hashdb log.
+   *   bytes_before - Bytes of the store data files before.
+   *   bytes_after - Bytes of the store data files after.
+   *   pages_before - Pages in use by the stores before.
+   *   pages_after - Pages in use by the stores after.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string optimize_hashdb(const std::string& hashdb_dir,
+                              const std::string& command_string,
+                              uint64_t& bytes_before, uint64_t& bytes_after,
+                              uint64_t& pages_before,
+                              uint64_t& pages_after);
+
+  /**
+   * Pin the most common blocks of a hashdb so that scans answer them
+   * from memory.  Hashes whose approximate count in the hash store is at
+   * least min_count, and whose count is too, are saved to common_blocks
+   * in the hashdb directory, most common first up to max_hashes.
+   * scan_manager_t keeps the scan results of the pinned hashes in memory
+   * while the hash store is unchanged.  Pin again after importing.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database.
+   *   min_count - The smallest count to pin, at least 1.
+   *   max_hashes - The most hashes to pin, or 0 for no limit.
+   *   num_pinned - The number of hashes pinned.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string pin_common_blocks(const std::string& hashdb_dir,
+                                const size_t min_count,
+                                const size_t max_hashes,
+#ifndef SWIG
+                                uint64_t& num_pinned
+#else
+                                uint64_t& OUTPUT // hashes
+#endif
+                               );
+
+  /**
+   * Write the changes appended to the change log of a hashdb since its
+   * last export, see settings_t::change_log, and mark them exported.
+   * The first line of changes_file records the position range of the
+   * changes in the change log, as {"changes_from":from, "changes_to":to}.
+   * Import may continue while changes are exported.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the database to export changes from.
+   *   changes_file - Path to the file to write the changes to.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string export_changes(const std::string& hashdb_dir,
+                             const std::string& changes_file);
+
+  /**
+   * Apply changes written by export_changes to a replica, a copy of the
+   * exporting hashdb made right after one of its exports.  Changes the
+   * replica already has are skipped, and changes that do not follow on
+   * from the replica are refused.  The replica keeps serving scans
+   * while changes apply, because LMDB readers keep their snapshots and
+   * read the new data at their next lookup.  Readers map max_map_size
+   * bytes when it is set so that they are not stopped when the replica
+   * grows.  If apply is interrupted, copy the replica again.  Applied
+   * changes are not appended to the change log of the replica.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the replica.
+   *   changes_file - Path to the changes to apply.
+   *   command_string - String to put into the replica log.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string apply_changes(const std::string& hashdb_dir,
+                            const std::string& changes_file,
+                            const std::string& command_string);
+
   /**
    * Return hashdb settings else reason for failure.
    * The current implementation may abort if something worse than a simple
@@ -174,6 +521,170 @@ namespace hashdb {
    */
   std::string bin_to_hex(const std::string& binary_string);
 
+#ifndef SWIG
+  /**
+   * Write the hexadecimal representation of size binary bytes into hex,
+   * which must have room for 2*size characters.
+   */
+  void bin_to_hex(const char* const binary, const size_t size,
+                  char* const hex);
+
+  /**
+   * Write the binary value of size hex digits into binary, which must
+   * have room for size/2 bytes.  Return false if size is odd or any
+   * digit is invalid.
+   */
+  bool hex_to_bin(const char* const hex, const size_t size,
+                  char* const binary);
+
+  /**
+   * Return the JSON text of a hash and its data in the form that
+   * scan_manager_t::export_hash_json returns.
+   */
+  std::string hash_data_json(const std::string& block_hash,
+                             const uint64_t k_entropy,
+                             const std::string& block_label,
+                             const source_sub_counts_t& source_sub_counts);
+
+  /**
+   * Return the binary record of a hash and its data, as returned by
+   * scan mode BINARY.  Integers are in host byte order:
+   *   uint16_t block hash size, block hash,
+   *   uint64_t k_entropy,
+   *   uint16_t block label size, block label,
+   *   uint64_t count,
+   *   uint32_t number of sources, then for each source:
+   *     uint16_t file hash size, file hash,
+   *     uint64_t sub_count.
+   */
+  std::string hash_binary(const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const uint64_t count,
+                          const source_sub_counts_t& source_sub_counts);
+
+  /**
+   * Read a binary hash record made by hash_binary.
+   *
+   * Returns:
+   *   True if the record is complete, false if it is truncated.
+   */
+  bool read_hash_binary(const std::string& binary,
+                        std::string& block_hash,
+                        uint64_t& k_entropy,
+                        std::string& block_label,
+                        uint64_t& count,
+                        source_sub_counts_t& source_sub_counts);
+
+  /**
+   * The callback of scan_manager_t::scan_ranges, called with the
+   * caller's data for each hash in range number range.  Calls for one
+   * range are in key order and calls for different ranges run
+   * concurrently, so keep partial results per range.
+   */
+  typedef void (*hash_range_callback_t)(
+                             void* const data,
+                             const size_t range,
+                             const std::string& block_hash,
+                             const uint64_t k_entropy,
+                             const std::string& block_label,
+                             const uint64_t count,
+                             const source_sub_counts_t& source_sub_counts);
+#endif
+
+  /**
+   * Return the number of CPUs in the system, the default number of
+   * threads for parallel work.
+   */
+  size_t num_cpus();
+
+  /**
+   * Return JSON with the count, total seconds, and mean and approximate
+   * p50 and p99 microseconds of each stage of ingest and scan, summed
+   * over all threads since the process started, and the hit and miss
+   * counts of the hash store and the hash data store.  May be called
+   * while an ingest or scan runs.
+   */
+  std::string stage_stats_json();
+
+  /**
+   * Return the kernels selected for this CPU, such as
+   * "zero_check=avx2 md5=avx2 entropy=scalar label=sse2 hex=sse2
+   * crc=pclmul".
+   * Kernels are selected once from the CPU features, limited by the
+   * HASHDB_CPU environment variable when it is scalar, sse2, sse4.2,
+   * avx2, avx512, or neon.
+   */
+  std::string cpu_kernels();
+
+  /**
+   * Return the live metrics of this process in the Prometheus text
+   * format: stage counts and seconds, store lookups and hit ratios, the
+   * depths of the ingest job queues and the scan_stream queues, the
+   * map use and reader slots of each open LMDB store, and the hits and
+   * misses of the source caches of each scan manager.
+   */
+  std::string metrics_text();
+
+  /**
+   * Serve metrics_text() as an HTTP response to each connection in a
+   * background thread.  address is [host:]port for TCP, listening on
+   * 127.0.0.1 when host is not given, or unix:path for a local socket.
+   * Return "" or the reason the server could not be started.
+   */
+  std::string start_metrics_server(const std::string& address);
+
+  // stop any metrics server
+  void stop_metrics_server();
+
+  /**
+   * Bound the memory that buffer pools, the source caches of expanded
+   * scans, batches waiting to be written, and the hashes and sources
+   * remembered by EXPANDED_OPTIMIZED scans use together, in bytes, or 0
+   * for no bound.  Past the bound, media reads and hash inserts wait for
+   * memory to be released, caches evict sooner, and remembered hashes and
+   * sources may be reported again.  Each user may still take what it
+   * needs to make progress.  Set before importing or scanning.
+   */
+  void set_memory_budget(const uint64_t bytes);
+
+  /**
+   * Options of ingest and of the ingest functions like it.  The defaults
+   * store every block, ingest every file, read through the page cache,
+   * and print the status of each ingest job.
+   *
+   * Attributes:
+   *   skip_nonprobative - Do not store the non-probative blocks, the
+   *     blocks that get a block label.  They are still counted in the
+   *     nonprobative_count of their source.  The hash stores are smaller,
+   *     and scans never match these blocks.
+   *   skip_unchanged - Skip files whose path, size, modification time,
+   *     and inode match a previous ingest into this database, only
+   *     attributing them to repository_name.  Requires ingesting files
+   *     into a single hash database.
+   *   direct_reads - Read files around the page cache so that reading
+   *     large media does not evict the hash database.  Aligned reads use
+   *     O_DIRECT and other reads are dropped from the cache as they are
+   *     read.  E01 files are read through the cache.  Not for streams.
+   *   quiet - Do not print the status of each ingest job.
+   *   checkpoint_file - Path to a file to record progress in every few
+   *     minutes so that an interrupted ingest can be resumed, or "" for
+   *     none.  Files are ingested in sorted path order and the file is
+   *     removed when the ingest completes.  Not for streams or staged
+   *     ingests.
+   *   resume - Resume from checkpoint_file, skipping the files it
+   *     records as ingested.
+   */
+  struct ingest_options_t {
+    bool skip_nonprobative;
+    bool skip_unchanged;
+    bool direct_reads;
+    bool quiet;
+    std::string checkpoint_file;
+    bool resume;
+    ingest_options_t();
+  };
+
   /**
    * Calculate and ingest hashes from files recursively from a source
    * path.  Files with EWF extensions (.E01 files) will be ingested as
@@ -193,6 +704,8 @@ namespace hashdb {
    *   disable_calculate_entropy - Disable calculating block entropy values.
    *   disable_calculate_labels - Disable calculating block entropy labels.
    *   command_string - String to put into the new hashdb log.
+   *   options - Options such as skipping non-probative blocks or
+   *     unchanged files, see ingest_options_t.
    *
    * Returns:
    *   "" if successful else reason if not.
@@ -205,7 +718,141 @@ namespace hashdb {
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
-                     const std::string& command_string);
+                     const std::string& command_string,
+                     const ingest_options_t& options = ingest_options_t());
+
+  /**
+   * Calculate and import hashes from the path into several hash data
+   * stores at once, as ingest does for one.  Each file is read and its
+   * file hash calculated once, and its block hashes are calculated for
+   * each hash database with the block size and block hash algorithm of
+   * that database and its own step size.
+   *
+   * Parameters:
+   *   hashdb_dirs - Paths to the hashdb data stores to import into.
+   *   step_sizes - The step size for each hashdb data store.
+   *   The other parameters are as for ingest.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string ingest_multiple(const std::vector<std::string>& hashdb_dirs,
+                     const std::vector<size_t>& step_sizes,
+                     const std::string& ingest_path,
+                     const std::string& repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& command_string,
+                     const ingest_options_t& options = ingest_options_t());
+
+  /**
+   * Calculate and import hashes from a sequential stream such as a pipe,
+   * without staging it to a file, into one or more hash data stores as
+   * ingest_multiple does.  A stream that starts with a tar header is read
+   * as a tar archive, ingesting each regular file as its header is read.
+   * Any other stream is ingested as one file.  Each file is read and
+   * its file hash calculated once.
+   *
+   * Parameters:
+   *   hashdb_dirs - Paths to the hashdb data stores to import into.
+   *   step_sizes - The step size for each hashdb data store.
+   *   fd - The open file descriptor to read the stream from, for
+   *     example 0 for stdin.  It is not closed.
+   *   stream_name - The filename of a stream that is not a tar archive,
+   *     and the repository name if repository_name is "".
+   *   The other parameters are as for ingest.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string ingest_stream(const std::vector<std::string>& hashdb_dirs,
+                     const std::vector<size_t>& step_sizes,
+                     const int fd,
+                     const std::string& stream_name,
+                     const std::string& repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& command_string,
+                     const ingest_options_t& options = ingest_options_t());
+
+  /**
+   * Calculate and import hashes from path into several staging
+   * databases in parallel, for merging into one hash database
+   * afterwards.  The files are divided in name order into one run for
+   * each staging database, each run holding about the same number of
+   * bytes, and each run is ingested by its own writer so that the LMDB
+   * writes of the staging databases proceed at the same time.  The
+   * hashing threads are divided among the writers.
+   *
+   * Parameters:
+   *   staging_dirs - Paths to the hashdb data stores to ingest into.
+   *   The other parameters are as for ingest.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string ingest_staged(const std::vector<std::string>& staging_dirs,
+                     const std::string& ingest_path,
+                     const size_t step_size,
+                     const std::string& repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& command_string,
+                     const ingest_options_t& options = ingest_options_t());
+
+  /**
+   * Options of scan_media and of the scan functions like it.  The
+   * defaults scan every block, print a line for each matching block,
+   * read through the page cache, print the status of each scan job, and
+   * take no checkpoints.
+   *
+   * Attributes:
+   *   min_k_entropy - The lowest block entropy to scan, scaled up by
+   *     1,000 like k_entropy, or 0 to scan every entropy.  Blocks that
+   *     consumers usually discard are skipped: they are not hashed,
+   *     looked up, or printed, and are counted as filtered.  Entropy and
+   *     labels are calculated as in ingest.
+   *   skip_labeled - Skip blocks that get a block label.
+   *   summarize - Print a summary of the sources matched when the media
+   *     image is done instead of a line for each matching block.  Scan
+   *     threads count the matches of each source in their own maps and
+   *     add them to the summary once per job.  There is one line per
+   *     source, most matching blocks first, tagged with the media image
+   *     and hash database as match lines are.  blocks counts the matching
+   *     blocks that have the source, and first_offset and last_offset
+   *     bound the media offsets of those not in embedded data.  Example
+   *     syntax:
+   *       {"file_hash":"b9e7...","filesize":8000,"blocks":12,
+   *        "first_offset":4096,"last_offset":16384}
+   *     A summarized scan takes no checkpoints, is not against a filter
+   *     file, and does not sample.
+   *   direct_reads - Read the media image around the page cache, as
+   *     ingest does.
+   *   quiet - Do not print the status of each scan job.
+   *   checkpoint_file - Path to a file to record the scanned offset in
+   *     every few minutes so that an interrupted scan can be resumed, or
+   *     "" for none.  The file is removed when the scan completes.  Only
+   *     scan_media and scan_media_multiple take checkpoints.
+   *   resume - Resume at the offset recorded in checkpoint_file.  Matches
+   *     printed after the last checkpoint of the interrupted scan are
+   *     printed again.
+   */
+  struct scan_media_options_t {
+    uint64_t min_k_entropy;
+    bool skip_labeled;
+    bool summarize;
+    bool direct_reads;
+    bool quiet;
+    std::string checkpoint_file;
+    bool resume;
+    scan_media_options_t();
+  };
 
   /**
    * Calculate and scan for hashes from the media image file.  Files with
@@ -221,6 +868,8 @@ namespace hashdb {
    *   disable_recursive_processing - Disable processing embedded data.
    *   scan_mode - The mode to use for performing the scan.  Controls
    *     scan optimization and returned JSON content.
+   *   options - Options such as filtering blocks, summarizing, or taking
+   *     checkpoints, see scan_media_options_t.
    *
    * Returns:
    *   "" if successful else reason if not.
@@ -229,7 +878,93 @@ namespace hashdb {
                      const std::string& media_image_file,
                      const size_t step_size,
                      const bool disable_recursive_processing,
-                     const hashdb::scan_mode_t scan_mode);
+                     const hashdb::scan_mode_t scan_mode,
+                     const scan_media_options_t& options =
+                                                 scan_media_options_t());
+
+  /**
+   * Calculate hashes from the media image file once and scan for them in
+   * several hash databases, as scan_media does for one.  When there is
+   * more than one hash database, each match is printed once for each
+   * hash database it is found in, tagged with the hashdb_dir of that
+   * database between the block hash and the JSON text.
+   *
+   * Parameters:
+   *   hashdb_dirs - Paths to the hashdb data stores to scan against.
+   *     They must share their block size and block hash algorithm.
+   *   The other parameters are as for scan_media.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string scan_media_multiple(const std::vector<std::string>& hashdb_dirs,
+                     const std::string& media_image_file,
+                     const size_t step_size,
+                     const bool disable_recursive_processing,
+                     const hashdb::scan_mode_t scan_mode,
+                     const scan_media_options_t& options =
+                                                 scan_media_options_t());
+
+  /**
+   * Scan the media images named in a media list file, one path per line,
+   * against the hash databases as scan_media_multiple does.  Images on
+   * the same device are read one after another and images on different
+   * devices are read in parallel, each device reading ahead up to
+   * queue_depth chunks into the job queue shared by all devices.  Each
+   * match line starts with the path of the media image it was found in.
+   * Blank lines and lines starting with '#' are skipped.
+   *
+   * Parameters:
+   *   hashdb_dirs - Paths to the hashdb data stores to scan against.
+   *   media_list_file - File naming the media images to scan.
+   *   queue_depth - Chunks each device may read ahead, 0 for the default.
+   *   The other parameters are as for scan_media.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string scan_media_list(const std::vector<std::string>& hashdb_dirs,
+                     const std::string& media_list_file,
+                     const size_t step_size,
+                     const bool disable_recursive_processing,
+                     const hashdb::scan_mode_t scan_mode,
+                     const size_t queue_depth,
+                     const scan_media_options_t& options =
+                                                 scan_media_options_t());
+
+  /**
+   * Estimate the density of hashes that match in the media image file by
+   * scanning a fraction of it.  The media image is divided into strata and
+   * one 1 MiB region at a repeatable pseudorandom step-aligned position in
+   * each stratum is scanned, printing matches as scan_media does.  The
+   * estimated match density and matching block count are printed with
+   * 95% confidence bounds.
+   *
+   * Parameters:
+   *   hashdb_dir - Path to the hashdb data store to scan against.
+   *   media_image_file - Path to a media image file, which can be a
+   *     raw file or an E01 file.
+   *   step_size - The step size to move along while calculating hashes.
+   *   disable_recursive_processing - Disable processing embedded data.
+   *   scan_mode - The mode to use for performing the scan.
+   *   sample_fraction - The fraction of the media image to scan, greater
+   *     than 0 and at most 1.
+   *   scan_around_hits - Also scan the rest of each stratum whose sampled
+   *     region has a match.
+   *   options - As for scan_media.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
+   */
+  std::string scan_media_sample(const std::string& hashdb_dir,
+                     const std::string& media_image_file,
+                     const size_t step_size,
+                     const bool disable_recursive_processing,
+                     const hashdb::scan_mode_t scan_mode,
+                     const double sample_fraction,
+                     const bool scan_around_hits,
+                     const scan_media_options_t& options =
+                                                 scan_media_options_t());
 
   /**
    * Read raw bytes at the media offset in the media image file.  Files
@@ -303,26 +1038,288 @@ namespace hashdb {
 #endif
                              );
 
-  // ************************************************************
-  // import
-  // ************************************************************
   /**
-   * Manage all LMDB updates.  All interfaces are locked and threadsafe.
-   * A logger is opened for logging the command and for logging
-   * timestamps and changes applied during the session.  Upon closure,
-   * changes are written to the logger and the logger is closed.
+   * Read a media image the way scan_media does, through read-ahead, the
+   * job queue, and the job threads, with hashing switched off, to
+   * measure the reader path alone.  Each job touches every page of its
+   * buffer and releases it.  Holes of sparse files are skipped, as in
+   * scan_media.  Results depend on how much of the image is already in
+   * the page cache.
+   *
+   * Parameters:
+   *   media_image_file - Path to a media image file, which can be a
+   *     raw file or an E01 file.
+   *   reader - How single files are read: "mapped" to map them, "read"
+   *     to read them into buffers, or "direct" to read them around the
+   *     page cache, as the direct_reads option of scan_media does.  E01
+   *     files are read through libewf whatever the reader.
+   *   job_size - The bytes of each job, a multiple of 4096 up to 16 MiB.
+   *   queue_depth - The chunks read ahead of the job queue.
+   *   num_threads - The job threads, or 0 for one per CPU.
+   *   bytes_read - The bytes read, not counting holes.
+   *   seconds - The wall clock seconds taken.
+   *   cpu_seconds - The user and system CPU seconds this process took.
+   *
+   * Returns:
+   *   "" if successful else reason if not.
    */
-  class import_manager_t {
+  std::string benchmark_media_read(const std::string& media_image_file,
+                                   const std::string& reader,
+                                   const size_t job_size,
+                                   const size_t queue_depth,
+                                   const size_t num_threads,
+#ifndef SWIG
+                                   uint64_t& bytes_read,
+                                   double& seconds,
+                                   double& cpu_seconds
+#else
+                                   uint64_t& OUTPUT, // bytes_read
+                                   double& OUTPUT,   // seconds
+                                   double& OUTPUT    // cpu_seconds
+#endif
+                                  );
+
+  /**
+   * Read many media offsets from one media image, for verifying many
+   * matches in the same image.  The media image is opened once.  A batch
+   * of media offsets is read in media order, with raw reads near each
+   * other coalesced into one read, and decompressed members such as
+   * zip and gzip members are kept, up to a memory limit, for later
+   * media offsets into the same member.  Not threadsafe: use one reader
+   * per thread.
+   */
+  class media_reader_t {
 
     private:
-    lmdb_hash_data_manager_t* lmdb_hash_data_manager;
-    lmdb_hash_manager_t* lmdb_hash_manager;
-    lmdb_source_data_manager_t* lmdb_source_data_manager;
-    lmdb_source_id_manager_t* lmdb_source_id_manager;
-    lmdb_source_name_manager_t* lmdb_source_name_manager;
+    hasher::file_reader_t* file_reader;
+    media_member_cache_t* member_cache;
+    uint8_t* read_buf;
 
-    logger_t* logger;
+    public:
+#ifndef SWIG
+    // do not allow copy or assignment
+    media_reader_t(const media_reader_t&) = delete;
+    media_reader_t& operator=(const media_reader_t&) = delete;
+#endif
+
+    /**
+     * Open the media image for reading.  Check error_message for
+     * whether it opened.
+     *
+     * Parameters:
+     *   media_image_file - Path to a media image file, which can be a
+     *     raw file or an E01 file.
+     *   max_cache_bytes - The memory to keep decompressed members in.
+     *     The least recently read members are dropped past the limit.
+     */
+    media_reader_t(const std::string& media_image_file,
+                   const size_t max_cache_bytes = 67108864);
+
+    /**
+     * The destructor closes the media image and frees cached members.
+     */
+    ~media_reader_t();
+
+    /**
+     * Return "" if the media image is open, else the reason it is not.
+     */
+    std::string error_message() const;
+
+    /**
+     * Return the size, in bytes, of the media image.
+     */
+    uint64_t size() const;
+
+    /**
+     * Read raw bytes at the media offset, as read_media does.
+     *
+     * Parameters:
+     *   media_offset - The offset into the media image file, for
+     *     example "1000" or "1000-zip-0".
+     *   count - The number of bytes to read.
+     *   bytes - The raw bytes read.
+     *
+     * Returns:
+     *   "" if successful else reason if not.
+     */
+    std::string read(const std::string& media_offset,
+                     const uint64_t count,
+#ifndef SWIG
+                     std::string& bytes
+#else
+                     std::string& OUTPUT // bytes
+#endif
+                    );
+
+    /**
+     * Read raw bytes at each media offset in the batch.  Media offsets
+     * that fail are read as "".
+     *
+     * Parameters:
+     *   media_offsets - The media offsets to read.
+     *   count - The number of bytes to read at each media offset.
+     *   bytes - The raw bytes read, in the order of media_offsets.
+     *
+     * Returns:
+     *   "" if successful else the reason the first failing media offset
+     *   failed.
+     */
+    std::string read(const std::vector<std::string>& media_offsets,
+                     const uint64_t count,
+                     std::vector<std::string>& bytes);
+
+    /**
+     * Return the number of decompressed members found in and not found
+     * in the member cache.
+     */
+    size_t cache_hits() const;
+    size_t cache_misses() const;
+  };
+
+  // ************************************************************
+  // import
+  // ************************************************************
+  /**
+   * The hash data for one block, for inserting many blocks of one source
+   * together.
+   *
+   * Attributes:
+   *   block_hash - The block hash in binary form.
+   *   k_entropy - An entropy value for the block, scaled up by 1,000.
+   *   block_label - Text indicating the type of the block or "".
+   */
+  struct hash_insert_t {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    hash_insert_t(const std::string& p_block_hash = "",
+                  const uint64_t p_k_entropy = 0,
+                  const std::string& p_block_label = "");
+  };
+  typedef std::vector<hash_insert_t> hash_inserts_t;
+
+#ifndef SWIG
+  /**
+   * One hash or source record parsed from JSON by json_record_parser_t,
+   * so that parsing can run apart from import_manager_t::import_record.
+   *
+   * Attributes:
+   *   is_block_hash - True for a hash record, false for a source record.
+   *   block_hash, k_entropy, block_label, source_sub_counts - The hash
+   *     record, with a (file_hash, sub_count) pair for each source.
+   *   file_hash, filesize, file_type, zero_count, nonprobative_count,
+   *     names - The source record.
+   */
+  struct json_record_t {
+    bool is_block_hash;
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    std::vector<std::pair<std::string, uint64_t> > source_sub_counts;
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    source_names_t names;
+    json_record_t();
+  };
+
+  /**
+   * Parse JSON hash and source records.  Each parser has its own
+   * reusable rapidjson memory pools, so use one parser per thread.
+   */
+  class json_record_parser_t {
+    private:
+    json_record_arena_t* arena;
+    std::vector<char> buffer;     // a copy of the text for in-situ parsing
+
+    // do not allow copy or assignment
+    json_record_parser_t(const json_record_parser_t&);
+    json_record_parser_t& operator=(const json_record_parser_t&);
+
+    public:
+    json_record_parser_t();
+    ~json_record_parser_t();
+
+    /**
+     * Parse one JSON record in the syntax of import_manager_t::import_json.
+     *
+     * Parameters:
+     *   json_text - The JSON text, which is not modified.
+     *   size - The size of the JSON text.
+     *   record - The parsed record.
+     *
+     * Returns:
+     *   "" else error message if JSON is invalid.
+     */
+    std::string parse(const char* const json_text, const size_t size,
+                      json_record_t& record);
+  };
+#endif
+
+  /**
+   * Skip maintaining the hash store during imports, for bulk loads.  Each
+   * insert and merge then writes only the hash data store.  The hashdb is
+   * marked in its settings as needing a hash store rebuild, during which
+   * scans find hashes in the hash data store instead, and the importer
+   * rebuilds the hash store in one pass of appends when it closes.  An
+   * importer opened on a marked hashdb defers too, so an interrupted
+   * load is rebuilt by the next import or by rebuild_hash_store.  Set
+   * before opening an import_manager_t.
+   *
+   * Parameters:
+   *   defer_hash_store - Skip hash store writes until the importer
+   *     closes.
+   */
+  void set_defer_hash_store(const bool defer_hash_store);
+
+  /**
+   * Manage all LMDB updates.  All interfaces are locked and threadsafe.
+   * A logger is opened for logging the command and for logging
+   * timestamps and changes applied during the session.  Upon closure,
+   * changes are written to the logger and the logger is closed.
+   */
+  class import_manager_t {
+
+    private:
+    const std::string hashdb_dir;
+    lmdb_hash_data_manager_t* lmdb_hash_data_manager;
+    lmdb_hash_manager_t* lmdb_hash_manager;
+    lmdb_source_data_manager_t* lmdb_source_data_manager;
+    lmdb_source_id_manager_t* lmdb_source_id_manager;
+    lmdb_source_name_manager_t* lmdb_source_name_manager;
+    lmdb_repository_manager_t* lmdb_repository_manager;
+    lmdb_source_hash_manager_t* lmdb_source_hash_manager; // or NULL
+    lmdb_source_signature_manager_t* lmdb_source_signature_manager; // or NULL
+    lmdb_count_index_manager_t* lmdb_count_index_manager; // or NULL
+
+    logger_t* logger;
     hashdb::lmdb_changes_t* changes;
+    hash_batch_t* hash_batch;
+    hash_bulk_loader_t* hash_bulk_loader;
+    hash_writer_t* hash_writer;
+    stage_totals_t* stage_start;     // stage counts when opened
+    change_log_t* change_log;        // or NULL
+    hll_sketch_t* hll_sketch;        // or NULL if not kept
+
+    // apply_changes does not log the changes it applies
+    friend std::string apply_changes(const std::string& hashdb_dir,
+                                     const std::string& changes_file,
+                                     const std::string& command_string);
+
+    // write pending batched hashes, call while the batch is locked
+    void write_batch();
+
+    // bulk load, batch, or write the hash
+    void add_hash(const hash_batch_entry_t& entry);
+
+    // write pending hashes, then sync the stores as the sync policy
+    // requires or, when force is set, always
+    void flush_stores(const bool force);
+
+    // merge the hash sketch into the sketch file of the hashdb
+    void save_sketch();
 
     public:
 #ifndef SWIG
@@ -342,10 +1339,80 @@ namespace hashdb {
                      const std::string& command_string);
 
     /**
-     * The destructor closes the log file and data store resources.
+     * The destructor writes any batched or bulk load hashes, rebuilds a
+     * deferred hash store, saves the hash sketch, and closes the log
+     * file and data store resources.
      */
     ~import_manager_t();
 
+    /**
+     * Buffer inserted and merged hashes and write them to the hash
+     * stores using one write transaction per batch instead of one
+     * transaction per hash.  Batching is disabled by default.  Batched
+     * hashes are not visible to readers until they are written.
+     * Pending hashes are written before the new limits take effect.
+     *
+     * Parameters:
+     *   batch_size - The number of hashes to buffer before writing,
+     *     or 0 or 1 to disable batching.
+     *   batch_milliseconds - Write the batch at the next insert once
+     *     this much time has passed since its first hash was buffered,
+     *     or 0 for no time limit.
+     */
+    void set_batch(const size_t batch_size,
+                   const size_t batch_milliseconds);
+
+    /**
+     * Defer inserted and merged hashes and load them into the hash
+     * stores in sorted order when flushed or closed.  Deferred hashes
+     * are sorted in runs of run_size records which are spilled to files
+     * under the hashdb directory.  When the hash stores are empty, the
+     * hashes are appended, giving sequential writes and densely packed
+     * pages.  Otherwise they are inserted in sorted order.  Deferred
+     * hashes are not visible to readers until they are loaded.  Bulk
+     * loading takes precedence over batching.  Pending hashes are
+     * loaded before the new run size takes effect.
+     *
+     * Parameters:
+     *   run_size - The number of hashes to sort in memory before
+     *     spilling them to a run file, or 0 to disable bulk loading.
+     */
+    void set_bulk_load(const size_t run_size);
+
+    /**
+     * Hand hashes inserted by insert_hashes to a dedicated writer thread
+     * so that callers do not wait for LMDB writes.  The writer combines
+     * all waiting batches into one write transaction per store.  Writes
+     * are not visible to readers until they complete.  Bulk loading
+     * takes precedence.  Pending batches are written before the new
+     * setting takes effect.
+     *
+     * Parameters:
+     *   max_pending - The number of batches that may wait for the writer
+     *     before insert_hashes blocks, or 0 to write synchronously.
+     */
+    void set_async_insert(const size_t max_pending);
+
+    /**
+     * Write any batched, asynchronous, or bulk load hashes now.
+     */
+    void flush();
+
+    /**
+     * Write hashes as flush does and then sync every store to disk
+     * whatever the sync policy, and save the hash sketch, so that a
+     * checkpoint taken after sync returns survives a crash.
+     */
+    void sync();
+
+    /**
+     * Write hashes as flush does, then replace the hash store with one
+     * made from the hash data store in one pass of appends in key order,
+     * and clear the mark that it needs rebuilding.  Hash store writes
+     * resume if they were deferred, see set_defer_hash_store.
+     */
+    void rebuild_hash_store();
+
     /**
      * Insert the repository_name, filename pair associated with the
      * source.
@@ -396,6 +1463,49 @@ namespace hashdb {
                      const std::string& block_label,
                      const std::string& file_hash);
 
+    /**
+     * Insert or change the hash data for many blocks of one source.
+     * The hashes are sorted and then written to the hash data store and
+     * the hash store using one write transaction each, or deferred when
+     * bulk loading.  Use this during ingest where the file offsets are
+     * guaranteed to be new.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source file in binary form.
+     *   hashes - The block hash, k_entropy, and block_label of each
+     *     block.
+     */
+    void insert_hashes(const std::string& file_hash,
+                       const hash_inserts_t& hashes);
+
+    /**
+     * Insert many blocks of one source given their hashes packed into
+     * one array and their k_entropy values in another, with no block
+     * labels.  In Python, packed_hashes and k_entropies may be any
+     * objects supporting the buffer protocol, such as bytes and numpy
+     * arrays.  k_entropies must hold native 8-byte integers or their
+     * bytes.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source file in binary form.
+     *   packed_hashes - The block hashes in binary form, each hash_size
+     *     bytes, packed without delimiters.
+     *   packed_hashes_size - The size of packed_hashes in bytes.
+     *   hash_size - The size of one block hash in bytes, 16 for MD5.
+     *   k_entropies - The k_entropy of each block.
+     *   k_entropies_size - The number of k_entropy values.
+     *
+     * Returns:
+     *   True if inserted, false if packed_hashes_size is not a multiple
+     *   of hash_size or there is not one k_entropy per hash.
+     */
+    bool insert_packed_hashes(const std::string& file_hash,
+                              const char* const packed_hashes,
+                              const size_t packed_hashes_size,
+                              const size_t hash_size,
+                              const uint64_t* const k_entropies,
+                              const size_t k_entropies_size);
+
 #ifndef SWIG
     /**
      * Insert or change the hash data associated with the block_hash.
@@ -446,6 +1556,57 @@ namespace hashdb {
      */
     std::string import_json(const std::string& json_string);
 
+#ifndef SWIG
+    /**
+     * Import a hash or source record parsed by json_record_parser_t.
+     *
+     * Parameters:
+     *   record - The parsed record.
+     */
+    void import_record(const json_record_t& record);
+
+    /**
+     * Insert or change the source data and source names of many source
+     * records at once, as import_record does for each.  Existing source
+     * IDs are resolved in one sorted sweep, new source IDs are allocated
+     * contiguously, and each source store is written in one transaction.
+     * Hash records are skipped.
+     *
+     * Parameters:
+     *   records - The parsed records.
+     *   num_records - The number of records to use from the start of
+     *     records.
+     */
+    void insert_sources(const std::vector<json_record_t>& records,
+                        const size_t num_records);
+#endif
+
+    /**
+     * Remove a source: its references from the hash data, its names,
+     * its source data, and its file hash.  Hashes left with no sources
+     * are removed.  Pending hashes are written first.  A removed source
+     * may be imported again.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source file in binary form.
+     *
+     * Returns:
+     *   true if the source was in the database.
+     */
+    bool remove_source(const std::string& file_hash);
+
+    /**
+     * Remove a block hash and its references to sources.  Pending
+     * hashes are written first.  Sources are kept.
+     *
+     * Parameters:
+     *   block_hash - The block hash in binary form.
+     *
+     * Returns:
+     *   true if the block hash was in the database.
+     */
+    bool remove_hash(const std::string& block_hash);
+
     /**
      * See if the file hash is in the database.
      *
@@ -475,6 +1636,19 @@ namespace hashdb {
      */
     std::string next_source(const std::string& file_hash) const;
 
+#ifndef SWIG
+    /**
+     * Walk every source in the database in key order in one read
+     * transaction, faster than first_source and next_source for
+     * loading all sources.
+     *
+     * Parameters:
+     *   callback - The function to call for each source file hash.
+     *   data - The caller's data, passed to callback.
+     */
+    void walk_sources(source_callback_t callback, void* const data) const;
+#endif
+
     /**
      * Return the sizes of LMDB databases in the data store.
      */
@@ -498,6 +1672,9 @@ namespace hashdb {
    * Manage LMDB scans.  All interfaces are locked and threadsafe.
    */
   class scan_manager_t {
+    friend class hash_iterator_t;
+    friend class source_iterator_t;
+    friend class repository_filter_t;
 
     private:
     lmdb_hash_data_manager_t* lmdb_hash_data_manager;
@@ -505,17 +1682,49 @@ namespace hashdb {
     lmdb_source_data_manager_t* lmdb_source_data_manager;
     lmdb_source_id_manager_t* lmdb_source_id_manager;
     lmdb_source_name_manager_t* lmdb_source_name_manager;
+    lmdb_repository_manager_t* lmdb_repository_manager;
+    lmdb_source_hash_manager_t* lmdb_source_hash_manager; // or NULL
+    lmdb_source_signature_manager_t* lmdb_source_signature_manager; // or NULL
+    lmdb_count_index_manager_t* lmdb_count_index_manager; // or NULL
 
     // support find_expanded_hash_json when optimizing
     locked_member_t* hashes;
     locked_member_t* sources;
 
+    // source and source list JSON reported by find_expanded_hash_json
+    source_cache_t* source_cache;
+    source_list_cache_t* source_list_cache;
+
+    // sources reported per hash by scan mode, 0 for all
+    size_t expanded_max_sources;
+    size_t optimized_max_sources;
+    size_t max_sources_of(const scan_mode_t scan_mode) const;
+
+    // memoized results of pinned common blocks, or NULL
+    common_blocks_t* common_blocks;
+    bool compact_common;
+
+    // the progress of warm and the thread of start_warm
+    warm_state_t* warm_state;
+
+    // the process that opened the stores
+    uint64_t opener_pid;
+
+    const common_block_t* find_common_block(const scan_mode_t scan_mode,
+                                     const std::string& block_hash) const;
+    std::string common_block_json(const scan_mode_t scan_mode,
+                                  const std::string& block_hash,
+                                  const common_block_t& result);
+
     // low-level find interfaces
     std::string find_expanded_hash_json(const bool optimizing,
-                                     const std::string& block_hash);
+                                     const std::string& block_hash,
+                                     const size_t first_source,
+                                     const size_t max_sources);
     std::string find_hash_count_json(const std::string& block_hash) const;
     std::string find_approximate_hash_count_json(
                                      const std::string& block_hash) const;
+    std::string find_hash_binary(const std::string& block_hash) const;
     public:
 #ifndef SWIG
     // do not allow copy or assignment
@@ -528,14 +1737,138 @@ namespace hashdb {
      *
      * Parameters:
      *   hashdb_dir - Path to the database to scan against.
+     *   max_optimizing_bytes - The memory that EXPANDED_OPTIMIZED scans
+     *     may use to remember the hashes and sources they reported, or
+     *     0 for no limit.  Past the limit, hashes and sources may be
+     *     reported again.
+     *   max_staleness_ms - How long, in milliseconds, each scan thread
+     *     may keep reading one snapshot while another process imports
+     *     into the hashdb, or 0 to read the latest data on every lookup.
+     *     Keeping a snapshot saves renewing it for each lookup.  Idle
+     *     snapshots past this age are released so that they do not keep
+     *     the import from reusing old pages.
+     *   build_indexes - True to build in memory the hash store prefix
+     *     indexes and filters that are not saved, for long-running scans
+     *     that make up the cost of reading the whole hash store.  Saved
+     *     indexes and filters are used either way.
      */
-    scan_manager_t(const std::string& hashdb_dir);
+    scan_manager_t(const std::string& hashdb_dir,
+                   const size_t max_optimizing_bytes = 0,
+                   const uint32_t max_staleness_ms = 0,
+                   const bool build_indexes = false);
 
     /**
      * The destructor closes read-only data store resources.
      */
     ~scan_manager_t();
 
+    /**
+     * Reopen the stores in a child process after fork, so that a scan
+     * manager opened once in a parent serves prefork workers.  The
+     * parent's LMDB environments are left untouched, since closing them
+     * in the child would release the parent's reader slots.  The hash
+     * filters, frozen stores, and common block results are kept as the
+     * child inherited them, so their pages are shared with the parent
+     * until written.  Call this in the child before scanning and fork
+     * while no other thread is using the scan manager.  It does nothing
+     * in the process that opened the scan manager.  Memory locked using
+     * lock_hash_store is not locked in the child.
+     */
+    void reopen_after_fork();
+
+    /**
+     * Share the hashes and sources that EXPANDED_OPTIMIZED scans have
+     * reported with every scan manager, in any process, sharing the same
+     * name, so that each is reported in full once across all of them,
+     * such as by several worker processes scanning one job.  The state
+     * is kept in POSIX shared memory of about max_bytes, sized by the
+     * first scan manager to share it, and lasts until
+     * remove_optimized_state.  Past that size, or for keys longer than
+     * a SHA-256 hash, hashes and sources may be reported again.  What
+     * this scan manager reported before sharing is not shared.  Call
+     * before scanning.  Workers forked after sharing share it too.
+     *
+     * Parameters:
+     *   name - The name of the shared state, without a slash.
+     *   max_bytes - The memory of the shared state.
+     *
+     * Returns:
+     *   "" if successful else reason if not.
+     */
+    std::string share_optimized_state(const std::string& name,
+                                      const size_t max_bytes);
+
+    /**
+     * Remove the shared state of name made by share_optimized_state.
+     * Scan managers sharing it keep it until they close.
+     *
+     * Returns:
+     *   "" if successful else reason if not.
+     */
+    static std::string remove_optimized_state(const std::string& name);
+
+    /**
+     * Read the hash store and then the hash data store into the page
+     * cache with parallel large sequential reads, so that scans after a
+     * reboot do not wait on random page faults.  Hash store shards that
+     * are held in memory are not read.
+     *
+     * Parameters:
+     *   num_threads - The number of reading threads, or 0 for one per
+     *     CPU.
+     *
+     * Returns:
+     *   The number of bytes read.
+     */
+    uint64_t warm(const size_t num_threads = 0);
+
+    /**
+     * Start warm on a background thread and return at once, for example
+     * to warm a new version of a database while a scan_stream_t keeps
+     * scanning the old one, see scan_stream_t::swap_scan_manager.  Scans
+     * may run while it warms.  Closing the scan manager stops warming.
+     * It does nothing if warming has already started.
+     *
+     * Parameters:
+     *   num_threads - The number of reading threads, or 0 for one per
+     *     CPU.
+     */
+    void start_warm(const size_t num_threads = 0);
+
+    /**
+     * Report the progress of warm or start_warm.
+     *
+     * Parameters:
+     *   bytes_read - The bytes read so far.
+     *   bytes_to_read - The bytes to read, 0 until warming starts.
+     *
+     * Returns:
+     *   True once warming has finished.
+     */
+    bool warm_progress(uint64_t& bytes_read, uint64_t& bytes_to_read) const;
+
+    /**
+     * Lock the in-memory hash store so that it is not paged out, on huge
+     * pages where available.  It stays locked while the scan manager is
+     * open.
+     *
+     * Returns:
+     *   "" if successful else reason if not, for example when the memory
+     *   lock limit is too small.
+     */
+    std::string lock_hash_store();
+
+    /**
+     * Spread the in-memory hash store across the NUMA nodes, page by
+     * page, so that scan threads on every node share its memory
+     * bandwidth.  Pages already placed are moved.
+     *
+     * Returns:
+     *   "" if successful else reason if not, for example when the
+     *   machine has one NUMA node.
+     */
+    std::string interleave_hash_store();
+
 #ifndef SWIG
     /**
      * Find hash, return hash and source information.
@@ -670,24 +2003,107 @@ namespace hashdb {
      */
     bool find_source_names(const std::string& file_hash,
                            source_names_t& source_names) const;
+
+    /**
+     * Whether the database keeps the reverse index of
+     * find_source_hashes, see settings_t::source_hash_index.
+     */
+    bool has_source_hash_index() const;
+
+    /**
+     * Find the block hashes of a source from the reverse index without
+     * walking the hash store.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source file in binary form.
+     *   block_hashes - The binary block hashes of the source, in hash
+     *     order.
+     *
+     * Returns:
+     *   True if the source has block hashes, false if it has none or
+     *   the database has no reverse index.
+     */
+    bool find_source_hashes(const std::string& file_hash,
+                            std::vector<std::string>& block_hashes) const;
+
+    /**
+     * Find the sources whose block hashes are similar to a set of block
+     * hashes from the similarity index, see settings_t::similarity_index.
+     * Similarity is the Jaccard similarity of the two sets of hashes
+     * estimated from their MinHash signatures, to within about 0.06.
+     * Sources below a similarity of about 0.3 are rarely found.
+     *
+     * Parameters:
+     *   block_hashes - The binary block hashes to compare sources to.
+     *   max_sources - The most sources to return, or 0 for no limit.
+     *
+     * Returns:
+     *   JSON text of the sources most similar first, for example
+     *   [{"file_hash":"b9e7...","similarity":0.750}], or [] if no
+     *   source is similar or the database has no similarity index.
+     */
+    std::string find_similar_sources_json(
+                          const std::vector<std::string>& block_hashes,
+                          const size_t max_sources) const;
 #endif
 
     /**
-     * Find hash, return JSON text else "" if not there.
+     * Whether the database keeps the similarity index of
+     * find_similar_sources_json, see settings_t::similarity_index.
+     */
+    bool has_similarity_index() const;
+
+    /**
+     * Find the sources similar to a source in the database, as
+     * find_similar_sources_json does for its block hashes.  The source
+     * itself is not returned.
      *
      * Parameters:
-     *   scan_mode - The mode to use for performing the scan.  Controls
-     *     scan optimization and returned JSON content.
-     *   block_hash - The block hash in binary form.
+     *   file_hash - The file hash of the source in binary form.
+     *   max_sources - The most sources to return, or 0 for no limit.
      *
      * Returns:
-     *   JSON text if hash is present, false and "" if not.  Example syntax
-     *   based on mode:
-     *     EXPANDED - always return all available data.  Example syntax:
-     *       {
-     *         "block_hash": "c313ac...",
-     *         "k_entropy": 2500,
-     *         "block_label": "W",
+     *   JSON text of the similar sources, or [] if the source has no
+     *   signature or the database has no similarity index.
+     */
+    std::string find_similar_to_source_json(const std::string& file_hash,
+                                            const size_t max_sources) const;
+
+    /**
+     * Find the block hashes whose count is in a count range from the
+     * count index, see settings_t::count_index, without walking the hash
+     * store.  Only counts of at least 2 are indexed.
+     *
+     * Parameters:
+     *   min_count - The smallest count to find, at least 2.
+     *   max_count - The largest count to find, or 0 for no limit.
+     *   block_hashes - The binary block hashes found, in count then hash
+     *     order.
+     *
+     * Returns:
+     *   True if the range was read from the count index, false if the
+     *   database has no count index or min_count is under 2.
+     */
+    bool find_hashes_by_count(const uint64_t min_count,
+                              const uint64_t max_count,
+                              std::vector<std::string>& block_hashes) const;
+
+    /**
+     * Find hash, return JSON text else "" if not there.
+     *
+     * Parameters:
+     *   scan_mode - The mode to use for performing the scan.  Controls
+     *     scan optimization and returned JSON content.
+     *   block_hash - The block hash in binary form.
+     *
+     * Returns:
+     *   JSON text if hash is present, false and "" if not.  Example syntax
+     *   based on mode:
+     *     EXPANDED - always return all available data.  Example syntax:
+     *       {
+     *         "block_hash": "c313ac...",
+     *         "k_entropy": 2500,
+     *         "block_label": "W",
      *         "count": 2,
      *         "source_list_id": 57,
      *         "sources": [{
@@ -713,12 +2129,205 @@ namespace hashdb {
      *       with truncated hash values.  Faster than COUNT because it
      *       accesses the hash_store.  Example syntax:
      *       { "block_hash": "c313ac...", "approximate_count": 1 }
+     *     BINARY - Return all available data, without source data, as
+     *       the binary record of hash_binary.  Format it as EXPANDED JSON
+     *       using hash_binary_json.
+     *     EXISTS - Return whether the hash is present, checking the
+     *       hash_store only, so it can be wrong in the same way as
+     *       APPROXIMATE_COUNT.  Example syntax:
+     *       { "block_hash": "c313ac...", "exists": true }
+     *   When set_max_sources limits the sources of EXPANDED or
+     *   EXPANDED_OPTIMIZED and a hash has more, the JSON ends with the
+     *   number of sources and the offset of the next source to get from
+     *   find_hash_sources_json, for example:
+     *       ..., "source_count": 250000, "next_source_offset": 100 }
      */
     std::string find_hash_json(const scan_mode_t scan_mode,
                                const std::string& block_hash);
 
     /**
-     * Return the first block hash in the database.
+     * Report at most max_sources sources per hash in scan mode EXPANDED
+     * or EXPANDED_OPTIMIZED, so that hashes with very many sources are
+     * found in bounded time.  Other modes do not report source lists.
+     * Set before scanning.
+     *
+     * Parameters:
+     *   scan_mode - The scan mode to limit.
+     *   max_sources - The most sources to report per hash, 0 for all.
+     */
+    void set_max_sources(const scan_mode_t scan_mode,
+                         const size_t max_sources);
+
+    /**
+     * Answer the pinned common blocks of pin_common_blocks in scan mode
+     * EXPANDED or EXPANDED_OPTIMIZED with a compact common block
+     * response instead of their sources, for clients that discard them.
+     * Set before scanning.  Example syntax:
+     *       { "block_hash": "c313ac...", "count": 52000,
+     *         "common_block": true }
+     *
+     * Parameters:
+     *   compact_common - Whether to report pinned hashes compactly.
+     */
+    void set_compact_common(const bool compact_common);
+
+    /**
+     * Return the number of pinned common blocks answered from memory.
+     */
+    size_t size_common_blocks() const;
+
+    /**
+     * Find a page of the sources of a hash, return JSON text in the
+     * EXPANDED format else "" if the hash is not there.  Pages are
+     * consistent while the database is not changed.
+     *
+     * Parameters:
+     *   block_hash - The block hash in binary form.
+     *   first_source - The offset of the first source to report, 0 or a
+     *     next_source_offset reported for this hash.
+     *   max_sources - The most sources to report, 0 for all.
+     *
+     * Returns:
+     *   JSON text as for EXPANDED, with "source_count" and any
+     *   "next_source_offset" when this is not the whole list.
+     */
+    std::string find_hash_sources_json(const std::string& block_hash,
+                                       const size_t first_source,
+                                       const size_t max_sources);
+
+    /**
+     * Find hashes, return JSON text for each hash in the order given,
+     * using "" for hashes that are not present.  The distinct hashes are
+     * looked up in sorted order in one pass through each store, which is
+     * faster than calling find_hash_json for each hash.
+     *
+     * Parameters:
+     *   scan_mode - The scan mode, see find_hash_json.
+     *   block_hashes - The block hashes in binary form.
+     *
+     * Returns:
+     *   JSON text for each hash, see find_hash_json.
+     */
+    std::vector<std::string> find_hashes_json(
+                   const hashdb::scan_mode_t scan_mode,
+                   const std::vector<std::string>& block_hashes);
+
+    /**
+     * Find hashes as find_hashes_json does, dividing them among threads
+     * so that large batches are looked up concurrently.  EXPANDED_OPTIMIZED
+     * scans use one thread so that hashes and sources are reported the
+     * first time they appear in the order given.
+     *
+     * Parameters:
+     *   block_hashes - The block hashes in binary form.
+     *   scan_mode - The scan mode, see find_hash_json.
+     *   num_threads - The number of threads, or 0 for one per CPU.
+     *
+     * Returns:
+     *   JSON text for each hash in the order given, see find_hash_json.
+     */
+    std::vector<std::string> scan_many(
+                   const std::vector<std::string>& block_hashes,
+                   const hashdb::scan_mode_t scan_mode,
+                   const size_t num_threads = 0);
+
+    /**
+     * Find hashes packed into one array, see find_hashes_json.  In
+     * Python, packed_hashes may be any object supporting the buffer
+     * protocol.
+     *
+     * Parameters:
+     *   scan_mode - The scan mode, see find_hash_json.
+     *   packed_hashes - The block hashes in binary form, each hash_size
+     *     bytes, packed without delimiters.
+     *   packed_hashes_size - The size of packed_hashes in bytes, a
+     *     multiple of hash_size.
+     *   hash_size - The size of one block hash in bytes, 16 for MD5.
+     *
+     * Returns:
+     *   JSON text for each hash, see find_hash_json, or no JSON text if
+     *   packed_hashes_size is not a multiple of hash_size.
+     */
+    std::vector<std::string> find_packed_hashes_json(
+                   const hashdb::scan_mode_t scan_mode,
+                   const char* const packed_hashes,
+                   const size_t packed_hashes_size,
+                   const size_t hash_size);
+
+    /**
+     * Find the count, or the approximate count, of each hash packed into
+     * one array, looking up the distinct hashes in sorted order.  In
+     * Python, packed_hashes may be any object supporting the buffer
+     * protocol and counts may be any writable buffer of 8-byte unsigned
+     * integers, such as a numpy uint64 array.  Also see hash_counts in Python,
+     * which returns the counts as a new array.
+     *
+     * Parameters:
+     *   packed_hashes - The block hashes in binary form, each hash_size
+     *     bytes, packed without delimiters.
+     *   packed_hashes_size - The size of packed_hashes in bytes.
+     *   hash_size - The size of one block hash in bytes, 16 for MD5.
+     *   approximate - Find approximate counts, see
+     *     find_approximate_hash_count.
+     *   counts - Set to the count of each hash.
+     *   counts_size - The number of counts there is room for.
+     *
+     * Returns:
+     *   True if found, false if packed_hashes_size is not a multiple
+     *   of hash_size or there is not room for one count per hash.
+     */
+    bool find_hash_counts(const char* const packed_hashes,
+                          const size_t packed_hashes_size,
+                          const size_t hash_size,
+                          const bool approximate,
+                          uint64_t* const counts,
+                          const size_t counts_size) const;
+
+    /**
+     * Find whether each hash packed into one array is present, checking
+     * the hash_store only as scan mode EXISTS does, in input order and
+     * without sorting.  In Python, packed_hashes may be any object
+     * supporting the buffer protocol and bitmap may be any writable
+     * buffer, such as a bytearray.  Also see hash_exists in Python, which
+     * returns the bitmap as a new bytearray.
+     *
+     * Parameters:
+     *   packed_hashes - The block hashes in binary form, each hash_size
+     *     bytes, packed without delimiters.
+     *   packed_hashes_size - The size of packed_hashes in bytes.
+     *   hash_size - The size of one block hash in bytes, 16 for MD5.
+     *   bitmap - Set to one bit per hash, bit i % 8 of byte i / 8 for
+     *     hash i, set if the hash is present.
+     *   bitmap_size - The number of bytes there is room for.
+     *
+     * Returns:
+     *   True if found, false if packed_hashes_size is not a multiple
+     *   of hash_size or there is not room for one bit per hash.
+     */
+    bool find_hash_exists(const char* const packed_hashes,
+                          const size_t packed_hashes_size,
+                          const size_t hash_size,
+                          uint8_t* const bitmap,
+                          const size_t bitmap_size) const;
+
+    /**
+     * Format a binary hash record returned by scan mode BINARY as the
+     * JSON text of scan mode EXPANDED, adding source data.
+     *
+     * Parameters:
+     *   binary - The binary hash record, see hash_binary.
+     *   optimizing - Format as scan mode EXPANDED_OPTIMIZED instead,
+     *     suppressing hash and source data reported before.
+     *
+     * Returns:
+     *   JSON text, or "" if the record is truncated.
+     */
+    std::string hash_binary_json(const std::string& binary,
+                                 const bool optimizing = false);
+
+    /**
+     * Return the first block hash in the database.  Use hash_iterator_t
+     * to walk the whole database.
      *
      * Returns:
      *   block_hash if a first hash is available else "" if DB is empty.
@@ -727,7 +2336,8 @@ namespace hashdb {
 
     /**
      * Return the next block hash in the database.  Error if last hash
-     *   does not exist.
+     *   does not exist.  Each call searches for the last hash, so use
+     *   hash_iterator_t to walk the whole database.
      *
      * Parameters:
      *   last_block_hash - The previous block hash in binary form.
@@ -758,6 +2368,56 @@ namespace hashdb {
      */
     std::string next_source(const std::string& file_hash) const;
 
+#ifndef SWIG
+    /**
+     * Walk the hashes in parallel.  The hash space is split into
+     * num_ranges ranges in key order and each range is walked by its
+     * own thread using its own hash_iterator_t.  Returns when every
+     * range is walked.
+     *
+     * Parameters:
+     *   num_ranges - The number of ranges and threads, at least 1.
+     *   callback - The function to call for each hash, with the range
+     *     number, from 0, of the hash.
+     *   data - The caller's data, passed to callback.
+     */
+    void scan_ranges(const size_t num_ranges,
+                     hash_range_callback_t callback,
+                     void* const data) const;
+
+    /**
+     * Walk the hashes in parallel using num_threads threads.  The hash
+     * space is split into num_ranges ranges in key order and each thread
+     * takes the next range not yet walked until all are walked.
+     *
+     * Parameters:
+     *   num_ranges - The number of ranges, at least 1.
+     *   num_threads - The number of threads, at least 1.
+     *   callback - The function to call for each hash, with the range
+     *     number, from 0, of the hash.
+     *   data - The caller's data, passed to callback.
+     */
+    void scan_ranges(const size_t num_ranges,
+                     const size_t num_threads,
+                     hash_range_callback_t callback,
+                     void* const data) const;
+
+    /**
+     * Read the histogram of hash counts which import_manager_t maintains
+     * as it changes hashes.  If the saved histogram is not for the
+     * current hash data store it is calculated by walking the store and
+     * saved for next time.
+     *
+     * Parameters:
+     *   total_hashes - The total of the counts of all hashes.
+     *   total_distinct_hashes - The number of hashes with a count of 1.
+     *   histogram - The number of hashes with each count.
+     */
+    void hash_histogram(uint64_t& total_hashes,
+                        uint64_t& total_distinct_hashes,
+                        std::map<uint64_t, uint64_t>& histogram) const;
+#endif
+
     /**
      * Return the sizes of LMDB databases in JSON format.
      */
@@ -774,6 +2434,206 @@ namespace hashdb {
     size_t size_sources() const;
   };
 
+  // ************************************************************
+  // hash iterator
+  // ************************************************************
+  /**
+   * Walk the hashes of a database in key order, reading each hash with
+   * its data.  The walk holds one read transaction and cursor, so each
+   * step reads forward from the last rather than searching for it.
+   * The scan manager must outlive the iterator.  In Python, use the
+   * scan manager's hashes() generator.
+   */
+  class hash_iterator_t {
+    private:
+    const scan_manager_t& scan_manager;
+    lmdb_hash_data_cursor_t* cursor;
+    source_id_cache_t* source_id_cache;
+
+#ifndef SWIG
+    // do not allow copy or assignment
+    hash_iterator_t(const hash_iterator_t&) = delete;
+    hash_iterator_t& operator=(const hash_iterator_t&) = delete;
+#endif
+
+    public:
+    /**
+     * Start a walk at the first hash.
+     *
+     * Parameters:
+     *   scan_manager - The open database to walk.
+     */
+    hash_iterator_t(const scan_manager_t& scan_manager);
+
+    /**
+     * Start a walk of the hashes from begin_block_hash up to but not
+     * including end_block_hash.
+     *
+     * Parameters:
+     *   scan_manager - The open database to walk.
+     *   begin_block_hash - The first hash to walk, or "" for the start.
+     *   end_block_hash - The hash to stop at, or "" for the end.
+     */
+    hash_iterator_t(const scan_manager_t& scan_manager,
+                    const std::string& begin_block_hash,
+                    const std::string& end_block_hash);
+
+    /**
+     * The destructor ends the walk's read transaction.
+     */
+    ~hash_iterator_t();
+
+#ifndef SWIG
+    /**
+     * Read the next hash and its data, see scan_manager_t::find_hash.
+     *
+     * Returns:
+     *   True if a hash was read, false and empty fields at the end.
+     */
+    bool next(std::string& block_hash,
+              uint64_t& k_entropy,
+              std::string& block_label,
+              uint64_t& count,
+              source_sub_counts_t& source_sub_counts);
+#endif
+
+    /**
+     * Read the next hash and its data as JSON text, see
+     * scan_manager_t::export_hash_json.
+     *
+     * Returns:
+     *   JSON text for the next hash, or "" at the end.
+     */
+    std::string next_json();
+
+    /**
+     * Read up to max_count hashes as JSON text, see next_json, so that
+     * Python walks cross into the library once per chunk.
+     *
+     * Parameters:
+     *   max_count - The most hashes to read.
+     *
+     * Returns:
+     *   JSON text for each hash read, fewer than max_count at the end.
+     */
+    std::vector<std::string> next_json_chunk(const size_t max_count);
+  };
+
+  // ************************************************************
+  // source iterator
+  // ************************************************************
+  /**
+   * Walk the sources of a database in file hash order, reading each
+   * source with its data and names.  Sources are read in batches: the
+   * file hashes of a batch are read from the source ID store, then the
+   * source data and source name stores are each swept forward once in
+   * source ID key order and joined to them, so a walk reads the stores
+   * sequentially rather than searching all three for each source.  The
+   * scan manager must outlive the iterator.
+   */
+  class source_iterator_t {
+    private:
+    const scan_manager_t& scan_manager;
+    source_batch_t* batch;
+
+#ifndef SWIG
+    // do not allow copy or assignment
+    source_iterator_t(const source_iterator_t&) = delete;
+    source_iterator_t& operator=(const source_iterator_t&) = delete;
+#endif
+
+    public:
+    /**
+     * Start a walk at the first source.
+     *
+     * Parameters:
+     *   scan_manager - The open database to walk.
+     */
+    source_iterator_t(const scan_manager_t& scan_manager);
+
+    ~source_iterator_t();
+
+#ifndef SWIG
+    /**
+     * Read the next source with its data and names, see
+     * scan_manager_t::find_source_data and find_source_names.
+     *
+     * Returns:
+     *   True if a source was read, false and empty fields at the end.
+     */
+    bool next(std::string& file_hash,
+              uint64_t& filesize,
+              std::string& file_type,
+              uint64_t& zero_count,
+              uint64_t& nonprobative_count,
+              source_names_t& source_names);
+#endif
+
+    /**
+     * Read the next source as JSON text, see
+     * scan_manager_t::export_source_json.
+     *
+     * Returns:
+     *   JSON text for the next source, or "" at the end.
+     */
+    std::string next_json();
+  };
+
+#ifndef SWIG
+  // ************************************************************
+  // repository filter
+  // ************************************************************
+  /**
+   * Classify sources by whether they have names in a repository, using
+   * the source ID bitmaps of the repository store rather than reading
+   * each source's names.  Databases made before the repository store
+   * existed do not have one until they are next opened for importing,
+   * so check is_available and read the source names when it is not.
+   * The scan manager must outlive the filter.
+   */
+  class repository_filter_t {
+    private:
+    const scan_manager_t& scan_manager;
+    const bool available;
+    source_id_bitmap_t* repository_ids;   // IDs named in the repository
+    source_id_bitmap_t* other_ids;        // IDs named in other repositories
+
+    // do not allow copy or assignment
+    repository_filter_t(const repository_filter_t&) = delete;
+    repository_filter_t& operator=(const repository_filter_t&) = delete;
+
+    public:
+    /**
+     * Load the source IDs of repository_name and of all other
+     * repositories.
+     *
+     * Parameters:
+     *   scan_manager - The open database to classify sources of.
+     *   repository_name - The repository to classify by.
+     */
+    repository_filter_t(const scan_manager_t& scan_manager,
+                        const std::string& repository_name);
+
+    ~repository_filter_t();
+
+    /**
+     * Whether the database has a repository store to classify with.
+     */
+    bool is_available() const;
+
+    /**
+     * Classify the source, see scan_manager_t::find_source_names.
+     *
+     * Parameters:
+     *   file_hash - The file hash of the source.
+     *   in_repository - Whether the source has a name in the repository.
+     *   in_other - Whether the source has a name in another repository.
+     */
+    void classify(const std::string& file_hash,
+                  bool& in_repository, bool& in_other) const;
+  };
+#endif
+
   // ************************************************************
   // scan_stream
   // ************************************************************
@@ -786,10 +2646,11 @@ namespace hashdb {
    */
   class scan_stream_t {
     private:
-    const int num_threads;
-    ::pthread_t* threads;
+    scan_stream::scan_pool_t* scan_pool;
+    const bool use_shared_pool;
     scan_stream::scan_thread_data_t* scan_thread_data;
-    bool done;
+
+    uint64_t submit(std::string& unscanned_data);
 
 #ifndef SWIG
     // do not allow copy or assignment
@@ -811,11 +2672,62 @@ namespace hashdb {
                   const size_t hash_size,
                   const hashdb::scan_mode_t scan_mode);
 
+    /**
+     * Create a streaming scan service with a chosen number of scan
+     * threads.
+     *
+     * Parameters:
+     *   scan_manger - The hashdb scan manager to use for scanning.
+     *   hash_size - The size, in bytes, of a binary hash, 16 for MD5.
+     *   scan_mode - The mode to use for performing the scan.  Controls
+     *     scan optimization and returned JSON content.
+     *   num_threads - The number of scan threads, or 0 for one per CPU.
+     *   cpu_affinity - The CPUs to pin scan threads to, as a CPU list
+     *     such as "0-3,8", or as a NUMA node such as "node1".  Use
+     *     "numa" to spread threads over every NUMA node, queue each
+     *     array on the node of the submitting CPU, and interleave the
+     *     hash store across the nodes.  Use "" to not pin threads.
+     *   use_shared_pool - Use the process-wide pool of scan threads
+     *     shared by all scan_stream_t objects instead of starting new
+     *     threads.  The pool is started by its first user with that
+     *     user's num_threads and cpu_affinity.
+     */
+    scan_stream_t(hashdb::scan_manager_t* const scan_manager,
+                  const size_t hash_size,
+                  const hashdb::scan_mode_t scan_mode,
+                  const int num_threads,
+                  const std::string& cpu_affinity = "",
+                  const bool use_shared_pool = false);
+
     /**
      * Release scan_stream resources.
      */
     ~scan_stream_t();
 
+    /**
+     * Return scanned data in submission order instead of in the order
+     * scanning finishes.  Up to reorder_window arrays that finish early
+     * are held until earlier arrays finish.  Scan threads wait when the
+     * window is full.  Call before the first put.
+     *
+     * Parameters:
+     *   reorder_window - The number of arrays that may be held.
+     */
+    void set_ordered(const size_t reorder_window);
+
+    /**
+     * Size scan batches to take about microseconds to scan, 1000 by
+     * default.  The scan threads measure the cost of a lookup, an array
+     * much larger than the batch size is split into parts scanned in
+     * parallel, and small arrays queued behind busy threads are scanned
+     * together.  Results are still returned one per put.  Use 0 to scan
+     * each array as one batch.  Call before the first put.
+     *
+     * Parameters:
+     *   microseconds - The scan time to size batches to.
+     */
+    void set_batch_latency(const size_t microseconds);
+
     /**
      * Submit a string containing an array of records to scan.
      *
@@ -828,8 +2740,28 @@ namespace hashdb {
      *       with the scan record.
      *     - A binary label associated with the scan record, of the
      *       length just indicated.
+     *
+     * Returns:
+     *   The sequence ID of this array, counting from 0 for the first.
+     */
+    uint64_t put(const std::string& unscanned_data);
+
+    /**
+     * Submit an array of records to scan from a buffer, copying it once.
+     * The record format is the same as for put(const std::string&).  In
+     * Python, unscanned_data may be any object supporting the buffer
+     * protocol, such as bytes, memoryview, or a numpy array.
+     */
+    uint64_t put(const char* const unscanned_data, const size_t size);
+
+#if !defined(SWIG) && __cplusplus >= 201103L
+    /**
+     * Submit an array of records to scan, taking ownership of the
+     * buffer so it is not copied.  The record format is the same as
+     * for put(const std::string&).
      */
-    void put(const std::string& unscanned_data);
+    uint64_t put(std::string&& unscanned_data);
+#endif
 
     /**
      * Receive a string containing an array of records of matched scanned
@@ -849,19 +2781,292 @@ namespace hashdb {
      *     with the hash that matched.
      *   - JSON text formatted based on the scan mode selected, of the
      *     length just indicated.
+     *   In scan mode EXISTS the result is instead a bitmap of one bit
+     *   per submitted record, bit i % 8 of byte i / 8 for record i, set
+     *   if its hash is present, and every array with records has one.
      */
     std::string get();
 
+    /**
+     * Receive a string containing an array of records of matched scanned
+     * data, waiting until data is available, until all submitted data
+     * has been scanned, or until the timeout passes.  The record format
+     * is the same as for get().
+     *
+     * Parameters:
+     *   timeout_milliseconds - The longest time to wait for data.
+     *
+     * Returns:
+     *   An array of records of matched scanned data or "" if no data
+     *   is available.
+     */
+    std::string get(const size_t timeout_milliseconds);
+
+#ifndef SWIG
+    /**
+     * Same as get(timeout_milliseconds), also providing the sequence ID
+     * returned by the put that submitted the array.  sequence_id is not
+     * set when "" is returned.
+     */
+    std::string get(const size_t timeout_milliseconds, uint64_t& sequence_id);
+#endif
+
     /**
      * Returns true if scan_stream is empty, meaning that there is no
      * unscanned data left to scan and there is no scanned data left to
-     * retrieve.  If not empty, a thread yield is issued so that the
-     * caller can busy-wait with less waste.
+     * retrieve.
      *
      * Returns:
      *   true if scan_stream is empty.
      */
     bool empty();
+
+    /**
+     * Wait until all submitted data has been scanned.  Scanned data may
+     * still be waiting to be retrieved using get.
+     */
+    void wait_empty();
+
+    /**
+     * Scan arrays put after this call against new_scan_manager, for
+     * example a new version of the database opened and warmed with
+     * scan_manager_t::start_warm while this stream kept scanning the
+     * old one.  Arrays already put finish on the scan manager replaced,
+     * which must stay open until wait_drained returns true for it.  The
+     * time from the swap until the replaced scan manager drains is
+     * recorded as the scan_swap stage, see stage_stats_json.  Call from
+     * the thread that puts.
+     *
+     * Parameters:
+     *   new_scan_manager - The scan manager to scan against next.
+     *
+     * Returns:
+     *   The scan manager replaced.
+     */
+    hashdb::scan_manager_t* swap_scan_manager(
+                       hashdb::scan_manager_t* const new_scan_manager);
+
+    /**
+     * Wait until no array is being scanned against scan_manager, a scan
+     * manager replaced by swap_scan_manager, so that it may be closed.
+     * With set_ordered, scan threads wait for scanned data to be
+     * retrieved, so keep calling get while waiting.
+     *
+     * Parameters:
+     *   scan_manager - The scan manager replaced.
+     *   timeout_milliseconds - The longest time to wait.
+     *
+     * Returns:
+     *   True if no array is being scanned against scan_manager.
+     */
+    bool wait_drained(const hashdb::scan_manager_t* const scan_manager,
+                      const size_t timeout_milliseconds);
+  };
+
+#ifndef SWIG
+  // ************************************************************
+  // async_scan
+  // ************************************************************
+  /**
+   * The result of scanning one hash, see scan_manager_t::find_hash.
+   */
+  struct hash_result_t {
+    std::string block_hash;
+    bool found;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    source_sub_counts_t source_sub_counts;
+    hash_result_t();
+  };
+  typedef std::vector<hash_result_t> hash_results_t;
+
+  /**
+   * The callback of async_scan_t::submit, called on a scan thread with
+   * the caller's data, the request ID returned by submit, and a result
+   * for each hash in the order submitted.  Callbacks for different
+   * requests may run concurrently.
+   */
+  typedef void (*scan_completion_t)(void* const data,
+                                    const uint64_t request_id,
+                                    const hash_results_t& results);
+
+  /**
+   * Scan batches of hashes on a pool of scan threads without blocking
+   * the caller.  A batch completes by calling a completion callback, by
+   * fulfilling a future, or by queueing its results for get_completed,
+   * in which case event_fd becomes readable so that an event loop such
+   * as asio or epoll can wait for results without a polling thread.
+   * All interfaces are threadsafe.
+   */
+  class async_scan_t {
+    private:
+    scan_stream::async_scan_data_t* data;
+
+    // do not allow copy or assignment
+    async_scan_t(const async_scan_t&);
+    async_scan_t& operator=(const async_scan_t&);
+
+    public:
+    /**
+     * Start scan threads.
+     *
+     * Parameters:
+     *   scan_manager - The hashdb scan manager to use for scanning.
+     *   num_threads - The number of scan threads, or 0 for one per CPU.
+     */
+    async_scan_t(const scan_manager_t* const scan_manager,
+                 const int num_threads = 0);
+
+    /**
+     * Wait for submitted batches to complete and stop the scan threads.
+     * Results not yet retrieved with get_completed are discarded.
+     */
+    ~async_scan_t();
+
+    /**
+     * Submit a batch of hashes, calling completion with completion_data
+     * and the results on a scan thread when they are scanned.
+     *
+     * Returns:
+     *   The request ID of the batch, counting from 0 for the first.
+     */
+    uint64_t submit(const std::vector<std::string>& block_hashes,
+                    scan_completion_t completion,
+                    void* const completion_data);
+
+    /**
+     * Submit a batch of hashes whose results are queued for
+     * get_completed, making event_fd readable.
+     *
+     * Returns:
+     *   The request ID of the batch, counting from 0 for the first.
+     */
+    uint64_t submit(const std::vector<std::string>& block_hashes);
+
+#if __cplusplus >= 201103L
+    /**
+     * Submit a batch of hashes, returning a future of its results.
+     */
+    std::future<hash_results_t> submit_future(
+                         const std::vector<std::string>& block_hashes);
+#endif
+
+    /**
+     * A file descriptor that is readable while results queued by
+     * submit may be waiting, or -1 where it is not supported.  It is an
+     * eventfd on Linux and a pipe elsewhere.  When it is readable, read
+     * and discard up to 8 bytes from it and then call get_completed
+     * until it returns false.  Do not close it.
+     */
+    int event_fd() const;
+
+    /**
+     * Move the results of a batch completed for get_completed into
+     * results, without waiting.
+     *
+     * Returns:
+     *   True and the request ID and results, or false if none is ready.
+     */
+    bool get_completed(uint64_t& request_id, hash_results_t& results);
+
+    /**
+     * Wait until every submitted batch has completed.
+     */
+    void wait_idle();
+  };
+#endif
+
+  // ************************************************************
+  // remote_scan_stream
+  // ************************************************************
+  /**
+   * Provide the scan_stream_t interface backed by a hashdb server, see
+   * the hashdb server command.  Records are coalesced into requests of
+   * about batch_size bytes and up to max_in_flight requests are kept
+   * outstanding.  Hashes found missing are kept in a negative cache of
+   * up to negative_cache_size hashes and are not sent again while
+   * cached, so a hash added to the database after it was cached is not
+   * reported by this stream until it expires from the cache.
+   *
+   * The put and get record formats are the same as for scan_stream_t.
+   * Records coalesced into one request share one sequence ID, and a put
+   * larger than batch_size is split into several requests and returns
+   * the sequence ID of the first.
+   */
+  class remote_scan_stream_t {
+    private:
+    scan_stream::remote_stream_data_t* data;
+
+#ifndef SWIG
+    // do not allow copy or assignment
+    remote_scan_stream_t(const remote_scan_stream_t&);
+    remote_scan_stream_t& operator=(const remote_scan_stream_t&);
+#endif
+
+    public:
+    /**
+     * Connect to a hashdb server.  On failure a warning is printed and
+     * error_message() tells why.
+     *
+     * Parameters:
+     *   address - The [host:]port of the server, host defaults to
+     *     127.0.0.1.
+     *   hash_size - The size, in bytes, of a binary hash, 16 for MD5.
+     *   batch_size - The request size, in bytes, at which to send.
+     *   max_in_flight - The number of requests to keep outstanding.
+     *   negative_cache_size - The number of missing hashes to remember,
+     *     0 to disable the cache.
+     */
+    remote_scan_stream_t(const std::string& address,
+                         const size_t hash_size,
+                         const size_t batch_size = 65536,
+                         const size_t max_in_flight = 8,
+                         const size_t negative_cache_size = 65536);
+
+    /**
+     * Close the connection.  Results not yet retrieved are discarded.
+     */
+    ~remote_scan_stream_t();
+
+    /**
+     * The reason the stream failed, or "" if it has not failed.
+     */
+    std::string error_message() const;
+
+    /**
+     * Put unscanned data, see scan_stream_t::put.
+     */
+    uint64_t put(const std::string& unscanned_data);
+
+    /**
+     * Put unscanned data from a buffer, see scan_stream_t::put.
+     */
+    uint64_t put(const char* const unscanned_data, const size_t size);
+
+    /**
+     * Send any coalesced records and receive available scanned data
+     * without waiting, see scan_stream_t::get.
+     */
+    std::string get();
+
+    /**
+     * Send any coalesced records and receive scanned data, waiting up
+     * to timeout_milliseconds, see scan_stream_t::get.
+     */
+    std::string get(const size_t timeout_milliseconds);
+
+    /**
+     * Send any coalesced records and return true if no requests are
+     * outstanding and no scanned data is left to retrieve.
+     */
+    bool empty();
+
+    /**
+     * Send any coalesced records and wait until all requests are
+     * answered.
+     */
+    void wait_empty();
   };
 
   // ************************************************************
@@ -0,0 +1,171 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Measure the reader path of scan_media with hashing switched off, see
+ * benchmark_media_read.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <string>
+#include <sstream>
+#include <sys/time.h>
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+#include "num_cpus.hpp"
+#include "hashdb.hpp"
+#include "file_reader.hpp"
+#include "read_ahead.hpp"
+#include "buffer_pool.hpp"
+#include "threadpool.hpp"
+#include "job.hpp"
+#include "job_queue.hpp"
+
+static const size_t MAX_JOB_SIZE = 16777216;   // 2^24=16MiB, as scanned
+
+namespace hashdb {
+
+  // seconds of wall clock time
+  static double wall_seconds() {
+    struct timeval t;
+    gettimeofday(&t, 0);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+  }
+
+  // user and system CPU seconds of this process, or 0 if not available
+  static double process_cpu_seconds() {
+#ifdef WIN32
+    return 0.0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0.0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+#endif
+  }
+
+  std::string benchmark_media_read(const std::string& media_image_file,
+                                   const std::string& reader,
+                                   const size_t job_size,
+                                   const size_t queue_depth,
+                                   const size_t num_threads,
+                                   uint64_t& bytes_read,
+                                   double& seconds,
+                                   double& cpu_seconds) {
+    bytes_read = 0;
+    seconds = 0.0;
+    cpu_seconds = 0.0;
+
+    // validate the parameters
+    if (reader != "mapped" && reader != "read" && reader != "direct") {
+      return "Invalid reader '" + reader +
+             "', expected mapped, read, or direct.";
+    }
+    if (job_size == 0 || job_size > MAX_JOB_SIZE ||
+        job_size % hasher::single_file_reader_t::direct_alignment != 0) {
+      std::stringstream ss;
+      ss << "Invalid job size " << job_size << ", expected a multiple of "
+         << hasher::single_file_reader_t::direct_alignment << " up to "
+         << MAX_JOB_SIZE << ".";
+      return ss.str();
+    }
+    if (queue_depth == 0) {
+      return "Invalid queue depth 0.";
+    }
+
+    // open the file reader, around the page cache for direct reads
+    const hasher::file_reader_t file_reader(hasher::utf8_to_native(
+                                  media_image_file), reader == "direct");
+    if (file_reader.error_message.size() > 0) {
+      return file_reader.error_message;
+    }
+
+    const size_t num_cpus = hashdb::numCPU();
+    const size_t threads = (num_threads == 0) ? num_cpus : num_threads;
+    const double wall_start = wall_seconds();
+    const double cpu_start = process_cpu_seconds();
+
+    // create the job queue to hold more jobs than threads
+    hasher::job_queue_t* job_queue = new hasher::job_queue_t(threads * 2);
+
+    // create the buffer pool to hold buffers for queued jobs, jobs being
+    // processed, and chunks read ahead or being read by each E01 reader
+    hasher::buffer_pool_t buffer_pool(job_size,
+                                      threads * 3 + num_cpus +
+                                      queue_depth + 2, queue_depth + 2);
+
+    // create the threadpool that will process jobs until done_adding
+    hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(threads, job_queue);
+
+    // read the file and push its chunks onto the job queue
+    std::string error_message;
+    {
+      hasher::read_ahead_t read_ahead(file_reader, job_size, job_size,
+                                      queue_depth, buffer_pool, 0,
+                                      reader == "mapped");
+      hasher::read_chunk_t chunk;
+      while (read_ahead.next(chunk)) {
+        if (chunk.error_message.size() > 0) {
+          error_message = chunk.error_message;
+          break;
+        }
+        if (chunk.is_hole) {
+          continue;
+        }
+        bytes_read += chunk.buffer_size;
+        job_queue->push(hasher::job_t::new_read_job(
+                   file_reader.filename,
+                   file_reader.filesize,
+                   chunk.offset,      // file_offset
+                   chunk.buffer,      // buffer
+                   chunk.buffer_size, // buffer_size
+                   chunk.buffer_size, // buffer_data_size
+                   chunk.mapped_file, // mapped_file
+                   chunk.buffer_pool)); // buffer_pool
+      }
+    }
+
+    // done once every job is processed
+    job_queue->done_adding();
+    delete threadpool;
+    delete job_queue;
+
+    seconds = wall_seconds() - wall_start;
+    cpu_seconds = process_cpu_seconds() - cpu_start;
+    return error_message;
+  }
+}
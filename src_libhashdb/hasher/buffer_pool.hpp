@@ -0,0 +1,224 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides a threadsafe pool of fixed-size buffers that are recycled
+ * between the file reader and the job threads.
+ *
+ * Buffers are allocated on first use, up to max_buffers, and are not
+ * zero-filled since they are read into before use.  They are aligned to
+ * buffer_alignment bytes so that they may be read into with O_DIRECT, or
+ * FILE_FLAG_NO_BUFFERING on Windows.  acquire blocks while all buffers
+ * are in use, so the pool bounds the memory held by buffers
+ * that are read ahead, queued, or being processed.
+ *
+ * Buffers past min_buffers are drawn from the memory budget.  When the
+ * budget is spent, acquire waits for a buffer to be released instead of
+ * allocating, so min_buffers must cover the buffers that the reader
+ * holds while it waits.
+ *
+ * Use release_buffer to release a job buffer to whichever of a pool, a
+ * file mapping, or new[] it came from.
+ */
+
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <iostream>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <cassert>
+#include <stdint.h>
+#include <pthread.h>
+#include "mapped_file.hpp"
+#include "memory_budget.hpp"
+#ifdef WIN32
+#include <malloc.h>   // for _aligned_malloc
+#endif
+
+namespace hasher {
+
+class buffer_pool_t {
+
+  private:
+  const size_t max_buffers;
+  const size_t min_buffers;
+  std::vector<uint8_t*> free_buffers;
+  size_t allocated;
+
+  // back-pressure counter
+  uint64_t acquire_waits;
+
+  mutable pthread_mutex_t M;                  // mutext
+  pthread_cond_t buffer_available;
+
+  // do not allow copy or assignment
+  buffer_pool_t(const buffer_pool_t&);
+  buffer_pool_t& operator=(const buffer_pool_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  // true if a buffer may be allocated, taking its memory from the budget
+  bool may_allocate() const {
+    if (allocated >= max_buffers) {
+      return false;
+    }
+    if (allocated < min_buffers) {
+      hashdb::memory_budget().charge(buffer_size);
+      return true;
+    }
+    return hashdb::memory_budget().try_acquire(buffer_size);
+  }
+
+  // allocate an aligned buffer, else NULL
+  uint8_t* allocate() const {
+#ifdef WIN32
+    return static_cast<uint8_t*>(_aligned_malloc(buffer_size,
+                                                 buffer_alignment));
+#else
+    void* p = NULL;
+    if (posix_memalign(&p, buffer_alignment, buffer_size) != 0) {
+      return NULL;
+    }
+    return static_cast<uint8_t*>(p);
+#endif
+  }
+
+  void deallocate(uint8_t* const buffer) const {
+#ifdef WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+  }
+
+  public:
+  static const size_t buffer_alignment = 4096;
+  const size_t buffer_size;
+
+  buffer_pool_t(const size_t p_buffer_size, const size_t p_max_buffers,
+                const size_t p_min_buffers = 1) :
+                max_buffers(p_max_buffers == 0 ? 1 : p_max_buffers),
+                min_buffers(p_min_buffers == 0 ? 1 : p_min_buffers),
+                free_buffers(), allocated(0), acquire_waits(0),
+                M(), buffer_available(), buffer_size(p_buffer_size) {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&buffer_available,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+    free_buffers.reserve(max_buffers);
+  }
+
+  ~buffer_pool_t() {
+    lock();
+    if (free_buffers.size() != allocated) {
+      // program error if buffers are still in use
+      std::cerr << "Processing error: buffer pool ended but "
+                << (allocated - free_buffers.size())
+                << " buffers are in use.\n";
+    }
+    for (size_t i=0; i<free_buffers.size(); ++i) {
+      deallocate(free_buffers[i]);
+    }
+    hashdb::memory_budget().release(free_buffers.size() * buffer_size);
+    unlock();
+    pthread_cond_destroy(&buffer_available);
+    pthread_mutex_destroy(&M);
+  }
+
+  // blocks until a buffer is available, returns NULL if allocation fails
+  uint8_t* acquire() {
+    lock();
+    if (free_buffers.size() == 0 && !may_allocate()) {
+      // wait for a buffer to be released
+      ++acquire_waits;
+      while (free_buffers.size() == 0) {
+        pthread_cond_wait(&buffer_available, &M);
+      }
+    }
+
+    uint8_t* buffer = NULL;
+    if (free_buffers.size() > 0) {
+      // reuse the most recently released buffer while it is still warm
+      buffer = free_buffers.back();
+      free_buffers.pop_back();
+    } else {
+      // allocate a new buffer, not zero-filled
+      buffer = allocate();
+      if (buffer != NULL) {
+        ++allocated;
+      } else {
+        hashdb::memory_budget().release(buffer_size);
+      }
+    }
+    unlock();
+    return buffer;
+  }
+
+  // return a buffer obtained from acquire
+  void release(const uint8_t* const buffer) {
+    lock();
+    free_buffers.push_back(const_cast<uint8_t*>(buffer));
+    pthread_cond_signal(&buffer_available);
+    unlock();
+  }
+
+  // number of times acquire waited because all buffers were in use
+  uint64_t acquire_wait_count() const {
+    lock();
+    const uint64_t count = acquire_waits;
+    unlock();
+    return count;
+  }
+};
+
+/**
+ * Release a buffer to buffer_pool, else to mapped_file, else to delete[].
+ */
+inline void release_buffer(buffer_pool_t* const buffer_pool,
+                           mapped_file_t* const mapped_file,
+                           const uint8_t* const buffer,
+                           const size_t size) {
+  if (buffer_pool != NULL) {
+    buffer_pool->release(buffer);
+  } else if (mapped_file != NULL) {
+    mapped_file->release(buffer, size);
+  } else {
+    delete[] buffer;
+  }
+}
+
+} // end namespace hasher
+
+#endif
+
@@ -22,9 +22,24 @@
  * Calculate entropy from data.
  *
  * Adapted from bulk_extractor/scan_hashdb.cpp and bulk_extractor sbuf.
+ *
+ * All four traits are evaluated in one pass over the block without
+ * allocating: 32-bit words feed the ramp, histogram and monotonic
+ * counters while whitespace is counted 16 bytes at a time.  The histogram
+ * is a small open-addressing table on the stack for blocks up to
+ * MAX_STACK_WORDS words.
+ *
+ * block_label_calculator_t keeps these traits for a sliding window.  A
+ * count of keys having each count gives the histogram maximum as words
+ * leave the window.
+ *
+ * The kernels that count a whole block are templates on the block size,
+ * with 0 for any size.  Blocks of 512 and 4096 bytes get kernels with
+ * fixed trip counts and histogram sizes, chosen once per calculator.
  */
 
-#include <sstream>
+#include <string>
+#include <vector>
 #include <cstring>
 #include <cstdlib>
 #include <stdint.h>
@@ -34,121 +49,467 @@
 #include <sys/stat.h>
 #include <iostream>
 #include <unistd.h>
-#include <cctype> // isspace
-#include <map> // isspace
 #include "calculate_block_label.hpp"
+#include "block_label_code.hpp"
+#include "cpu_dispatch.hpp"
+
+#if defined(__SSE2__)
+#define BLOCK_LABEL_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define BLOCK_LABEL_NEON
+#include <arm_neon.h>
+#endif
 
 namespace hasher {
 
-// rules for determining if a block should be ignored
-static bool ramp_trait(const uint8_t* const buffer, const size_t size) {
-    uint32_t count = 0;
-    for(size_t i=0; i+8 < size; i+= 4) {
-        // note that little endian is detected and big endian is not detected
-        uint32_t a = (uint32_t)(buffer[i+0]<<0) 
-                   | (uint32_t)(buffer[i+1]<<8) 
-                   | (uint32_t)(buffer[i+2]<<16) 
-                   | (uint32_t)(buffer[i+3]<<24);
-        uint32_t b = (uint32_t)(buffer[i+4]<<0) 
-                   | (uint32_t)(buffer[i+5]<<8) 
-                   | (uint32_t)(buffer[i+6]<<16) 
-                   | (uint32_t)(buffer[i+7]<<24);
-        if (a+1 == b) {
-            count += 1;
-        }
-    }
-    return count > size/8;
-}
-
-static bool hist_trait(const uint8_t* const buffer, const size_t size) {
-    std::map<uint32_t,uint32_t> hist;
-    for(size_t i=0; i+4 < size; i+= 4) {
-        uint32_t a = (uint32_t)(buffer[i+3]<<0) 
-                   | (uint32_t)(buffer[i+2]<<8) 
-                   | (uint32_t)(buffer[i+1]<<16) 
-                   | (uint32_t)(buffer[i+0]<<24);
-        hist[a] += 1;
-    }
-    if (hist.size() < 3) return true;
-
-    for (std::map<uint32_t,uint32_t>::const_iterator it = hist.begin();it != hist.end(); it++){
-        if ((it->second) > size/16){
-            return true;
-        }
-    }
-    return false;
-}
-
-static bool whitespace_trait(const uint8_t* const buffer, const size_t size) {
+  // histogram tables for blocks up to this many words live on the stack
+  static const size_t MAX_STACK_WORDS = 2048;
+
+  // bytes matched by isspace in the C locale
+  static inline bool is_space(const uint8_t c) {
+    return c == ' ' || (uint8_t)(c - '\t') < 5;
+  }
+
+  // use count_space_16 when the CPU features allow its vector kernel
+#if defined(BLOCK_LABEL_SSE2)
+  static const bool use_count_space_16 = cpu_features().sse2;
+#elif defined(BLOCK_LABEL_NEON)
+  static const bool use_count_space_16 = cpu_features().neon;
+#else
+  static const bool use_count_space_16 = false;
+#endif
+
+  const char* block_label_kernel() {
+#if defined(BLOCK_LABEL_SSE2)
+    return (use_count_space_16) ? "sse2" : "scalar";
+#elif defined(BLOCK_LABEL_NEON)
+    return (use_count_space_16) ? "neon" : "scalar";
+#else
+    return "scalar";
+#endif
+  }
+
+  // count whitespace in 16 bytes
+  static inline size_t count_space_16(const uint8_t* const p) {
+#if defined(BLOCK_LABEL_SSE2)
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    // (c - 9) < 5 unsigned, done as a signed compare after biasing by 0x80
+    const __m128i t = _mm_add_epi8(_mm_sub_epi8(v, _mm_set1_epi8(9)),
+                                   _mm_set1_epi8((char)0x80));
+    const __m128i control = _mm_cmplt_epi8(t, _mm_set1_epi8((char)0x85));
+    const __m128i space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+    const int mask = _mm_movemask_epi8(_mm_or_si128(control, space));
+    return __builtin_popcount(mask);
+#elif defined(BLOCK_LABEL_NEON)
+    const uint8x16_t v = vld1q_u8(p);
+    const uint8x16_t control = vcltq_u8(vsubq_u8(v, vdupq_n_u8(9)),
+                                        vdupq_n_u8(5));
+    const uint8x16_t space = vceqq_u8(v, vdupq_n_u8(' '));
+    const uint8x16_t ones = vshrq_n_u8(vorrq_u8(control, space), 7);
+    return vaddvq_u8(ones);
+#else
     size_t count = 0;
-    for(size_t i=0; i<size; i++){
-        if (::isspace(buffer[i])) count+=1;
+    for (size_t i=0; i<16; ++i) {
+      count += is_space(p[i]);
+    }
+    return count;
+#endif
+  }
+
+  // little endian word at p
+  static inline uint32_t le_word(const uint8_t* const p) {
+    return (uint32_t)(p[0]<<0) 
+         | (uint32_t)(p[1]<<8) 
+         | (uint32_t)(p[2]<<16) 
+         | ((uint32_t)p[3]<<24);
+  }
+
+  // open-addressing word histogram, a count of 0 marks an empty slot
+  class word_histogram_t {
+    private:
+    uint32_t* const keys;
+    uint32_t* const counts;
+    const size_t mask;
+    size_t distinct;
+    uint32_t max_count;
+
+    // do not allow copy or assignment
+    word_histogram_t(const word_histogram_t&);
+    word_histogram_t& operator=(const word_histogram_t&);
+
+    public:
+    // capacity must be a power of two larger than the number of words
+    word_histogram_t(uint32_t* const p_keys, uint32_t* const p_counts,
+                     const size_t capacity) :
+                 keys(p_keys), counts(p_counts), mask(capacity - 1),
+                 distinct(0), max_count(0) {
+      ::memset(counts, 0, capacity * sizeof(uint32_t));
+    }
+
+    void add(const uint32_t key) {
+      uint32_t h = key * 0x9E3779B1u;
+      h ^= h >> 16;
+      size_t slot = h & mask;
+      while (counts[slot] != 0 && keys[slot] != key) {
+        slot = (slot + 1) & mask;
+      }
+      if (counts[slot] == 0) {
+        keys[slot] = key;
+        ++distinct;
+      }
+      const uint32_t count = ++counts[slot];
+      if (count > max_count) {
+        max_count = count;
+      }
+    }
+
+    size_t size() const {
+      return distinct;
+    }
+
+    uint32_t max() const {
+      return max_count;
+    }
+  };
+
+  static size_t histogram_capacity(const size_t words) {
+    size_t capacity = 16;
+    while (capacity < words * 2) {
+      capacity *= 2;
+    }
+    return capacity;
+  }
+
+  // count whitespace in size bytes, SIZE is 0 for any size
+  template<size_t SIZE>
+  static size_t count_space(const uint8_t* const buffer,
+                            const size_t p_size) {
+    const size_t size = (SIZE > 0) ? SIZE : p_size;
+    size_t space_count = 0;
+    size_t j = 0;
+    if (use_count_space_16) {
+      for (; j+16 <= size; j += 16) {
+        space_count += count_space_16(buffer + j);
+      }
     }
-    return count >= (size * 3)/4;
-}
+    for (; j < size; ++j) {
+      space_count += is_space(buffer[j]);
+    }
+    return space_count;
+  }
 
-static bool monotonic_trait(const uint8_t* const buffer, const size_t size) {
+  // the label code of a block of size bytes given its traits
+  static uint8_t block_flags(const size_t size,
+                                 const uint32_t ramp_count,
+                                 const size_t distinct,
+                                 const uint32_t max_count,
+                                 const size_t space_count,
+                                 const int increasing,
+                                 const int decreasing,
+                                 const int same) {
     const double total = size / 4.0;
+    uint8_t flags = 0;
+    if (ramp_count > size/8) {
+      flags |= hashdb::block_label_ramp;
+    }
+    if (distinct < 3 || max_count > size/16) {
+      flags |= hashdb::block_label_histogram;
+    }
+    if (space_count >= (size * 3)/4) {
+      flags |= hashdb::block_label_whitespace;
+    }
+    if (increasing / total >= 0.75 || decreasing / total >= 0.75 ||
+        same / total >= 0.75) {
+      flags |= hashdb::block_label_monotonic;
+    }
+    return flags;
+  }
+
+  template<size_t SIZE>
+  static uint8_t calculate_block_label_private(
+                     const uint8_t* const buffer, const size_t p_size,
+                     word_histogram_t& hist) {
+
+    const size_t size = (SIZE > 0) ? SIZE : p_size;
+
+    uint32_t ramp_count = 0;
     int increasing = 0, decreasing = 0, same = 0;
-    for (size_t i=0; i+8 < size; i += 4) {
-
-        // note that little endian is detected and big endian is not detected
-        uint32_t a = (uint32_t)(buffer[i+0]<<0) 
-                   | (uint32_t)(buffer[i+1]<<8) 
-                   | (uint32_t)(buffer[i+2]<<16) 
-                   | (uint32_t)(buffer[i+3]<<24);
-        uint32_t b = (uint32_t)(buffer[i+4]<<0) 
-                   | (uint32_t)(buffer[i+5]<<8) 
-                   | (uint32_t)(buffer[i+6]<<16) 
-                   | (uint32_t)(buffer[i+7]<<24);
-
-
-        if (b > a) {
-            increasing++;
-        } else if (b < a) {
-            decreasing++;
-        } else {
-            same++;
-        }
-    }
-    if (increasing / total >= 0.75) return true;
-    if (decreasing / total >= 0.75) return true;
-    if (same / total >= 0.75) return true;
-    return false;
-}
-
-  static std::string calculate_block_label_private(
-                     const uint8_t* const buffer, const size_t count) {
-
-    std::stringstream ss_flags;
-    if (ramp_trait(buffer, count))       ss_flags << "R";
-    if (hist_trait(buffer, count))       ss_flags << "H";
-    if (whitespace_trait(buffer, count)) ss_flags << "W";
-    if (monotonic_trait(buffer, count))  ss_flags << "M";
-    return ss_flags.str();
+    size_t space_count = 0;
+
+    // word traits: hist uses words at i where i+4 < size and pairs of
+    // words at i and i+4 are compared where i+8 < size
+    size_t i = 0;
+    for (; i+8 < size; i += 4) {
+      // note that little endian is detected and big endian is not detected
+      const uint32_t a = le_word(buffer + i);
+      const uint32_t b = le_word(buffer + i + 4);
+      hist.add(a);
+      if (a+1 == b) {
+        ramp_count += 1;
+      }
+      if (b > a) {
+        increasing++;
+      } else if (b < a) {
+        decreasing++;
+      } else {
+        same++;
+      }
+    }
+    for (; i+4 < size; i += 4) {
+      hist.add(le_word(buffer + i));
+    }
+
+    // whitespace
+    space_count = count_space<SIZE>(buffer, size);
+
+    return block_flags(size, ramp_count, hist.size(), hist.max(),
+                       space_count, increasing, decreasing, same);
   }
 
-  // safely calculate block label by padding with zeros on overflow.
-  std::string calculate_block_label(const uint8_t* const buffer,
-                                    const size_t buffer_size,
-                                    const size_t offset,
-                                    const size_t count) {
+  template<size_t SIZE>
+  static uint8_t calculate_block_label_private(
+                     const uint8_t* const buffer, const size_t p_size) {
+
+    const size_t size = (SIZE > 0) ? SIZE : p_size;
+    const size_t words = size / 4;
+    if (words <= MAX_STACK_WORDS) {
+      const size_t capacity = histogram_capacity(words);
+      uint32_t keys[MAX_STACK_WORDS * 2];
+      uint32_t counts[MAX_STACK_WORDS * 2];
+      word_histogram_t hist(keys, counts, capacity);
+      return calculate_block_label_private<SIZE>(buffer, size, hist);
+    } else {
+      const size_t capacity = histogram_capacity(words);
+      std::vector<uint32_t> keys(capacity);
+      std::vector<uint32_t> counts(capacity);
+      word_histogram_t hist(&keys[0], &counts[0], capacity);
+      return calculate_block_label_private<SIZE>(buffer, size, hist);
+    }
+  }
+
+  typedef uint8_t (*label_kernel_t)(const uint8_t* const, const size_t);
+
+  // the label kernel for a block size
+  static label_kernel_t select_label_kernel(const size_t size) {
+    switch (size) {
+      case 512: return &calculate_block_label_private<512>;
+      case 4096: return &calculate_block_label_private<4096>;
+      default: return &calculate_block_label_private<0>;
+    }
+  }
+
+  // safely calculate block label code by padding with zeros on overflow.
+  uint8_t calculate_block_label_code(const uint8_t* const buffer,
+                                     const size_t buffer_size,
+                                     const size_t offset,
+                                     const size_t count) {
 
     if (offset + count <= buffer_size) {
       // calculate when not a buffer overrun
-      return calculate_block_label_private(buffer + offset, count);
+      return select_label_kernel(count)(buffer + offset, count);
     } else if (offset > buffer_size) {
       // program error
       assert(0);
-      return ""; // for mingw
+      return 0; // for mingw
     } else {
       // make new buffer from old but zero-extended
       uint8_t* b = new uint8_t[count]();
       ::memcpy (b, buffer+offset, buffer_size - offset);
-      std::string block_label = calculate_block_label_private(b, count);
+      const uint8_t code = select_label_kernel(count)(b, count);
       delete[] b;
-      return block_label;
+      return code;
     }
   }
-} // end namespace hasher
 
+  // safely calculate block label by padding with zeros on overflow.
+  std::string calculate_block_label(const uint8_t* const buffer,
+                                    const size_t buffer_size,
+                                    const size_t offset,
+                                    const size_t count) {
+    return hashdb::block_label_of_code(calculate_block_label_code(
+                                     buffer, buffer_size, offset, count));
+  }
+
+  // ************************************************************
+  // block_label_calculator_t
+  // ************************************************************
+  block_label_calculator_t::block_label_calculator_t(
+                       const size_t p_block_size, const size_t step_size) :
+          block_size(p_block_size),
+          is_sliding(step_size < p_block_size && step_size % 4 == 0 &&
+                     p_block_size % 4 == 0 && p_block_size >= 16),
+          capacity((is_sliding) ? histogram_capacity(block_size / 4) * 2 : 0),
+          keys((is_sliding) ? new uint32_t[capacity] : NULL),
+          counts((is_sliding) ? new uint32_t[capacity] : NULL),
+          occupied((is_sliding) ? new uint8_t[capacity] : NULL),
+          count_sizes((is_sliding) ? new uint32_t[block_size / 4 + 1] : NULL),
+          fill_kernel(select_fill_kernel(p_block_size)),
+          used(0), distinct(0), max_count(0),
+          ramp_count(0), increasing(0), decreasing(0), same(0),
+          space_count(0),
+          window_buffer(NULL), window_offset(0) {
+  }
+
+  block_label_calculator_t::~block_label_calculator_t() {
+    delete[] keys;
+    delete[] counts;
+    delete[] occupied;
+    delete[] count_sizes;
+  }
+
+  // the slot holding key, else the empty slot to put it in
+  size_t block_label_calculator_t::slot_of(const uint32_t key) const {
+    const size_t mask = capacity - 1;
+    uint32_t h = key * 0x9E3779B1u;
+    h ^= h >> 16;
+    size_t slot = h & mask;
+    while (occupied[slot] && keys[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  void block_label_calculator_t::add_word(const uint32_t key) {
+    const size_t slot = slot_of(key);
+    if (!occupied[slot]) {
+      occupied[slot] = 1;
+      keys[slot] = key;
+      counts[slot] = 0;
+      ++used;
+    }
+    const uint32_t count = ++counts[slot];
+    if (count == 1) {
+      ++distinct;
+    } else {
+      --count_sizes[count - 1];
+    }
+    ++count_sizes[count];
+    if (count > max_count) {
+      max_count = count;
+    }
+  }
+
+  void block_label_calculator_t::remove_word(const uint32_t key) {
+    const size_t slot = slot_of(key);
+    const uint32_t count = counts[slot]--;
+    --count_sizes[count];
+    if (count == 1) {
+      --distinct;
+    } else {
+      ++count_sizes[count - 1];
+    }
+    if (count == max_count && count_sizes[count] == 0) {
+      max_count = count - 1;
+    }
+  }
+
+  // add (sign 1) or remove (sign -1) the traits of the words at p and p+4
+  void block_label_calculator_t::pair_traits(const uint8_t* const p,
+                                             const int sign) {
+    const uint32_t a = le_word(p);
+    const uint32_t b = le_word(p + 4);
+    if (a+1 == b) {
+      ramp_count += sign;
+    }
+    if (b > a) {
+      increasing += sign;
+    } else if (b < a) {
+      decreasing += sign;
+    } else {
+      same += sign;
+    }
+  }
+
+  // the fill kernel for a block size
+  block_label_calculator_t::fill_kernel_t
+  block_label_calculator_t::select_fill_kernel(const size_t size) {
+    switch (size) {
+      case 512: return &block_label_calculator_t::fill_block<512>;
+      case 4096: return &block_label_calculator_t::fill_block<4096>;
+      default: return &block_label_calculator_t::fill_block<0>;
+    }
+  }
+
+  // count the traits of the block at p, like calculate_block_label_private
+  void block_label_calculator_t::fill(const uint8_t* const p) {
+    (this->*fill_kernel)(p);
+  }
+
+  // fill for blocks of SIZE bytes, 0 for block_size
+  template<size_t SIZE>
+  void block_label_calculator_t::fill_block(const uint8_t* const p) {
+    const size_t size = (SIZE > 0) ? SIZE : block_size;
+    ::memset(occupied, 0, capacity);
+    ::memset(count_sizes, 0, (block_size / 4 + 1) * sizeof(uint32_t));
+    used = 0;
+    distinct = 0;
+    max_count = 0;
+    ramp_count = 0;
+    increasing = 0;
+    decreasing = 0;
+    same = 0;
+
+    // words at i where i+4 < size, and pairs at i where i+8 < size
+    for (size_t i=0; i+4 < size; i += 4) {
+      add_word(le_word(p + i));
+      if (i+8 < size) {
+        pair_traits(p + i, 1);
+      }
+    }
+    space_count = count_space<SIZE>(p, size);
+  }
+
+  // move the window at p forward by shift bytes, a multiple of 4
+  void block_label_calculator_t::slide(const uint8_t* const p,
+                                       const size_t shift) {
+    const size_t last_word = block_size - 8;   // last word in the histogram
+    const size_t last_pair = block_size - 12;  // last pair compared
+    for (size_t i=0; i<shift; i += 4) {
+      remove_word(le_word(p + i));
+      add_word(le_word(p + last_word + 4 + i));
+      pair_traits(p + i, -1);
+      pair_traits(p + last_pair + 4 + i, 1);
+    }
+    space_count = space_count - count_space<0>(p, shift) +
+                  count_space<0>(p + block_size, shift);
+
+    // rebuild the histogram before keys counted 0 fill it
+    if (used > capacity / 2) {
+      fill(p + shift);
+    }
+  }
+
+  uint8_t block_label_calculator_t::calculate_code(
+                                      const uint8_t* const buffer,
+                                      const size_t buffer_size,
+                                      const size_t offset) {
+
+    if (!is_sliding || offset + block_size > buffer_size) {
+      window_buffer = NULL;
+      return calculate_block_label_code(buffer, buffer_size, offset,
+                                        block_size);
+    }
+
+    if (window_buffer == buffer && offset > window_offset &&
+        offset - window_offset < block_size &&
+        (offset - window_offset) % 4 == 0) {
+      slide(buffer + window_offset, offset - window_offset);
+    } else {
+      fill(buffer + offset);
+    }
+    window_buffer = buffer;
+    window_offset = offset;
+    return block_flags(block_size, ramp_count, distinct, max_count,
+                       space_count, increasing, decreasing, same);
+  }
+
+  std::string block_label_calculator_t::calculate(
+                                      const uint8_t* const buffer,
+                                      const size_t buffer_size,
+                                      const size_t offset) {
+    return hashdb::block_label_of_code(calculate_code(buffer, buffer_size,
+                                                      offset));
+  }
+
+} // end namespace hasher
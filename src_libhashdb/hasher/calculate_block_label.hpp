@@ -27,6 +27,7 @@
 #ifndef CALCULATE_BLOCK_LABEL_HPP
 #define CALCULATE_BLOCK_LABEL_HPP
 
+#include <string>
 #include <cstring>
 #include <cstdlib>
 #include <stdint.h>
@@ -41,6 +42,15 @@
 
 namespace hasher {
 
+  /**
+   * safely calculate block label code, see block_label_code.hpp, by
+   * padding with zeros on overflow.
+   */
+  uint8_t calculate_block_label_code(const uint8_t* const buffer,
+                                     const size_t buffer_size,
+                                     const size_t offset,
+                                     const size_t count);
+
   /**
    * safely calculate block label by padding with zeros on overflow.
    */
@@ -49,6 +59,75 @@ namespace hasher {
                                     const size_t offset,
                                     const size_t count);
 
+  /**
+   * Calculates the labels of blocks at increasing offsets in a buffer,
+   * giving the same labels as calculate_block_label.  When step_size is
+   * less than block_size and a multiple of 4, the traits of the previous
+   * block are kept and only the words and bytes leaving and entering the
+   * window are counted when the next block overlaps it.
+   */
+  class block_label_calculator_t {
+
+    private:
+    const size_t block_size;
+    const bool is_sliding;
+
+    // word histogram that keeps keys whose count drops to 0 in place so
+    // that probing still finds the keys after them
+    const size_t capacity;
+    uint32_t* const keys;
+    uint32_t* const counts;
+    uint8_t* const occupied;
+    uint32_t* const count_sizes;  // number of keys having each count
+
+    // counts a whole block, chosen for the block size
+    typedef void (block_label_calculator_t::*fill_kernel_t)(
+                                                  const uint8_t* const);
+    const fill_kernel_t fill_kernel;
+    size_t used;                  // occupied slots
+    size_t distinct;              // keys with a nonzero count
+    uint32_t max_count;
+
+    // traits of the window
+    int ramp_count;
+    int increasing;
+    int decreasing;
+    int same;
+    size_t space_count;
+
+    // the window currently counted, or NULL when there is none
+    const uint8_t* window_buffer;
+    size_t window_offset;
+
+    // do not allow copy or assignment
+    block_label_calculator_t(const block_label_calculator_t&);
+    block_label_calculator_t& operator=(const block_label_calculator_t&);
+
+    size_t slot_of(const uint32_t key) const;
+    void add_word(const uint32_t key);
+    void remove_word(const uint32_t key);
+    void pair_traits(const uint8_t* const p, const int sign);
+    static fill_kernel_t select_fill_kernel(const size_t size);
+    template<size_t SIZE> void fill_block(const uint8_t* const p);
+    void fill(const uint8_t* const p);
+    void slide(const uint8_t* const p, const size_t shift);
+
+    public:
+    block_label_calculator_t(const size_t p_block_size,
+                             const size_t step_size);
+    ~block_label_calculator_t();
+
+    // safely calculate the label code of the block at offset
+    uint8_t calculate_code(const uint8_t* const buffer,
+                           const size_t buffer_size,
+                           const size_t offset);
+
+    // safely calculate the label of the block at offset
+    std::string calculate(const uint8_t* const buffer,
+                          const size_t buffer_size,
+                          const size_t offset);
+  };
+
 } // end namespace hasher
 
 #endif
@@ -0,0 +1,176 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Records the progress of a long ingest or scan_media run so that an
+ * interrupted run can resume from its last checkpoint.
+ *
+ * A checkpoint is taken while no jobs are in flight and, for ingest,
+ * after the hash database is synced, so the work it records as done is
+ * on disk.  It is text, one "key<tab>value" line each:
+ *   kind        ingest or scan_media
+ *   path        the ingest path or the media image
+ *   done        for ingest, the last file ingested in sorted order; for
+ *               scan_media, the media offset below which the scan is
+ *               done
+ *   zero_count  for scan_media, the zero blocks counted below done
+ *
+ * The file is written to a temporary file, synced, and renamed over the
+ * checkpoint, so it is replaced whole or not at all.  It is used from
+ * the thread that pushes jobs.
+ */
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+namespace hasher {
+
+class checkpoint_t {
+
+  private:
+  const std::string filename;
+  const uint64_t interval_seconds;
+  uint64_t last_seconds;
+
+  static uint64_t now_seconds() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return static_cast<uint64_t>(now.tv_sec);
+  }
+
+  public:
+  std::string kind;
+  std::string path;
+  std::string done;
+  uint64_t zero_count;
+
+  /**
+   * A checkpoint of kind for path, written to p_filename when due every
+   * p_interval_seconds.
+   */
+  checkpoint_t(const std::string& p_filename,
+               const uint64_t p_interval_seconds,
+               const std::string& p_kind,
+               const std::string& p_path) :
+          filename(p_filename), interval_seconds(p_interval_seconds),
+          last_seconds(now_seconds()),
+          kind(p_kind), path(p_path), done(""), zero_count(0) {
+  }
+
+  /**
+   * Read the checkpoint to resume from, return error_message or "".  It
+   * must be of the same kind and path.
+   */
+  std::string read() {
+    std::ifstream in(filename.c_str());
+    if (!in.is_open()) {
+      return "Unable to open checkpoint file '" + filename + "'.";
+    }
+    std::string read_kind;
+    std::string read_path;
+    std::string line;
+    while (getline(in, line)) {
+      const size_t tab = line.find('\t');
+      if (tab == std::string::npos) {
+        continue;
+      }
+      const std::string key = line.substr(0, tab);
+      const std::string value = line.substr(tab + 1);
+      if (key == "kind") {
+        read_kind = value;
+      } else if (key == "path") {
+        read_path = value;
+      } else if (key == "done") {
+        done = value;
+      } else if (key == "zero_count") {
+        zero_count = std::strtoull(value.c_str(), NULL, 10);
+      }
+    }
+    if (read_kind != kind || read_path != path) {
+      return "Checkpoint file '" + filename + "' is not for " + kind +
+             " of '" + path + "'.";
+    }
+    return "";
+  }
+
+  /**
+   * Whether the interval has passed since the last write.
+   */
+  bool is_due() const {
+    return now_seconds() >= last_seconds + interval_seconds;
+  }
+
+  /**
+   * Write the checkpoint, return error_message or "".
+   */
+  std::string write() {
+    std::stringstream ss;
+    ss << "kind\t" << kind << "\n"
+       << "path\t" << path << "\n"
+       << "done\t" << done << "\n"
+       << "zero_count\t" << zero_count << "\n";
+    const std::string text = ss.str();
+
+    const std::string temp_file = filename + ".tmp";
+    FILE* const f = std::fopen(temp_file.c_str(), "wb");
+    if (f == NULL) {
+      return "Unable to write checkpoint file '" + temp_file + "'.";
+    }
+    bool ok = (std::fwrite(text.c_str(), 1, text.size(), f) == text.size());
+    ok = (std::fflush(f) == 0) && ok;
+#ifndef WIN32
+    ok = (fsync(fileno(f)) == 0) && ok;
+#endif
+    ok = (std::fclose(f) == 0) && ok;
+    if (!ok) {
+      std::remove(temp_file.c_str());
+      return "Unable to write checkpoint file '" + temp_file + "'.";
+    }
+#ifdef WIN32
+    // rename does not replace an existing file on Windows
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_file.c_str(), filename.c_str()) != 0) {
+      return "Unable to replace checkpoint file '" + filename + "'.";
+    }
+    last_seconds = now_seconds();
+    return "";
+  }
+
+  /**
+   * Remove the checkpoint once the run completes.
+   */
+  void remove() const {
+    std::remove(filename.c_str());
+  }
+};
+
+} // end namespace hasher
+
+#endif
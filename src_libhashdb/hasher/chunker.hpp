@@ -0,0 +1,177 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Find content-defined chunk boundaries with a gear rolling hash, as
+ * FastCDC does, so that chunks of content still match after it shifts by
+ * any number of bytes.  The gear hash after a byte depends only on the 64
+ * bytes ending there.  A chunk ends after the first byte at least
+ * min_size bytes in whose gear hash has its top bits clear, or at
+ * max_size bytes.  The number of top bits makes chunks average about
+ * avg_size bytes.
+ *
+ * Jobs cut a file into parts, so a job at a nonzero file offset starts
+ * its first chunk at its first boundary, ignoring min_size, and leaves
+ * the bytes before it to the last chunk of the job before, which reads
+ * on into its overlap up to max_size bytes.  Both usually find the same
+ * boundary, so chunking resynchronizes across jobs.
+ */
+
+#ifndef CHUNKER_HPP
+#define CHUNKER_HPP
+
+#include <cstddef>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+namespace hasher {
+
+// the bytes ingest and scan jobs read past their data, so the largest
+// chunk that may run past the data of a job
+static const size_t max_chunk_size_limit = 1048576;
+
+// the offset and size of each chunk of a buffer
+typedef std::vector<std::pair<size_t, size_t> > chunks_t;
+
+class chunker_t {
+
+  private:
+  // the bytes the gear hash depends on
+  static const size_t window_size = 64;
+
+  const size_t min_size;
+  const size_t max_size;
+  const uint64_t mask;
+  const uint64_t* const gear;
+
+  // a fixed pseudorandom value for each byte value
+  static const uint64_t* gear_table() {
+    struct table_t {
+      uint64_t values[256];
+      table_t() {
+        uint64_t state = 0;
+        for (size_t i=0; i<256; ++i) {
+          // splitmix64
+          state += 0x9e3779b97f4a7c15ULL;
+          uint64_t z = state;
+          z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+          z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+          values[i] = z ^ (z >> 31);
+        }
+      }
+    };
+    static const table_t table;
+    return table.values;
+  }
+
+  // the top bits a boundary has clear, so that boundaries fall about
+  // avg_size - min_size bytes past the minimum
+  static uint64_t boundary_mask(const size_t min_size,
+                                const size_t avg_size) {
+    size_t bits = 0;
+    while (bits < 63 && (static_cast<size_t>(2) << bits) <=
+                                                   avg_size - min_size) {
+      ++bits;
+    }
+    return (bits == 0) ? 0 : ~static_cast<uint64_t>(0) << (64 - bits);
+  }
+
+  // the end of the chunk starting at start
+  size_t next_boundary(const uint8_t* const buffer,
+                       const size_t buffer_size,
+                       const size_t start) const {
+    const size_t limit = (buffer_size - start < max_size) ?
+                         buffer_size : start + max_size;
+    if (limit - start <= min_size) {
+      return limit;
+    }
+
+    // fill the window before the minimum so that the boundary depends on
+    // the content only
+    size_t i = start + min_size - window_size;
+    uint64_t h = 0;
+    for (; i < start + min_size; ++i) {
+      h = (h << 1) + gear[buffer[i]];
+    }
+    for (; i < limit; ++i) {
+      h = (h << 1) + gear[buffer[i]];
+      if ((h & mask) == 0) {
+        return i + 1;
+      }
+    }
+    return limit;
+  }
+
+  // the first boundary of a job after the first of a file, or 0 if there
+  // is none within max_size bytes
+  size_t first_boundary(const uint8_t* const buffer,
+                        const size_t buffer_size) const {
+    const size_t limit = (buffer_size < max_size) ? buffer_size : max_size;
+    uint64_t h = 0;
+    for (size_t i=0; i < limit; ++i) {
+      h = (h << 1) + gear[buffer[i]];
+      if (i + 1 >= window_size && (h & mask) == 0) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+
+  // do not allow copy or assignment
+  chunker_t(const chunker_t&);
+  chunker_t& operator=(const chunker_t&);
+
+  public:
+  /**
+   * Chunk with the chunk sizes of settings_t: min_size of at least 64,
+   * below avg_size, below max_size.
+   */
+  chunker_t(const size_t p_min_size, const size_t avg_size,
+            const size_t p_max_size) :
+          min_size(p_min_size), max_size(p_max_size),
+          mask(boundary_mask(p_min_size, avg_size)), gear(gear_table()) {
+  }
+
+  /**
+   * Find the chunks that start in the first data_size bytes of buffer.
+   * The last may run past data_size into the rest of the buffer.  Set
+   * resync for a job at a nonzero file offset to start at its first
+   * boundary.
+   */
+  void find_chunks(const uint8_t* const buffer,
+                   const size_t buffer_size,
+                   const size_t data_size,
+                   const bool resync,
+                   chunks_t& chunks) const {
+    chunks.clear();
+    size_t start = (resync) ? first_boundary(buffer, buffer_size) : 0;
+    while (start < data_size) {
+      const size_t end = next_boundary(buffer, buffer_size, start);
+      chunks.push_back(std::pair<size_t, size_t>(start, end - start));
+      start = end;
+    }
+  }
+};
+
+} // end namespace hasher
+
+#endif
+
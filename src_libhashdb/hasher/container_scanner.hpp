@@ -0,0 +1,146 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Find where embedded containers such as zip or tar data may start.
+ *
+ * Each container format has a magic prefix, a signature check, and a
+ * decoder.  A buffer is scanned with one memchr pass per format for the
+ * first magic byte, so the per-byte work is done by the C library's
+ * vectorized search instead of a signature call at every offset.  To
+ * recurse into a new format, add it to the containers table.
+ */
+
+#ifndef CONTAINER_SCANNER_HPP
+#define CONTAINER_SCANNER_HPP
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include "uncompress.hpp"
+
+namespace hasher {
+
+  // a container format that can be recursed into
+  struct container_t {
+    // the name used in the recursion path, for example "zip"
+    const char* name;
+
+    // the bytes that every instance has at magic_offset
+    const char* magic;
+    size_t magic_size;
+    size_t magic_offset;
+
+    // full signature check at an offset where magic matches
+    bool (*signature)(const uint8_t* const b, const size_t b_size,
+                      const size_t offset);
+
+    // get a new out_buf, setting in_used, return "" else reason for error
+    std::string (*decode)(const uint8_t* const in_buf,
+                          const size_t in_size,
+                          const size_t in_offset,
+                          uint8_t** out_buf,
+                          size_t* out_size,
+                          size_t* in_used);
+  };
+
+  // the container formats, in the order they are tried at one offset
+  inline const container_t* containers(size_t* count) {
+    static const container_t table[] = {
+      {"zip", "PK\x03\x04", 4, 0, zip_signature, new_from_zip},
+      {"gzip", "\x1f\x8b\x08", 3, 0, gzip_signature, new_from_gzip},
+#if defined(HAVE_BZLIB_H) && defined(HAVE_LIBBZ2)
+      {"bzip2", "BZh", 3, 0, bzip2_signature, new_from_bzip2},
+#endif
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+      {"xz", "\xfd" "7zXZ", 5, 0, xz_signature, new_from_xz},
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+      {"zstd", "\x28\xb5\x2f\xfd", 4, 0, zstd_signature, new_from_zstd},
+#endif
+      {"7z", "7z\xbc\xaf", 4, 0, sevenz_signature, new_from_7z},
+      {"tar", "ustar", 5, 257, tar_signature, new_from_tar},
+    };
+    *count = sizeof(table) / sizeof(table[0]);
+    return table;
+  }
+
+  // the container with the given name, or NULL if not available
+  inline const container_t* find_container(const std::string& name) {
+    size_t count;
+    const container_t* const table = containers(&count);
+    for (size_t c=0; c<count; ++c) {
+      if (name == table[c].name) {
+        return &table[c];
+      }
+    }
+    return NULL;
+  }
+
+  // offset and containers() index of a signature match
+  typedef std::pair<size_t, size_t> container_candidate_t;
+  typedef std::vector<container_candidate_t> container_candidates_t;
+
+  /**
+   * Find the offsets below scan_size where a container signature
+   * matches, in offset order.  Signatures may read up to b_size.
+   */
+  inline void find_container_candidates(const uint8_t* const b,
+                                        const size_t b_size,
+                                        const size_t scan_size,
+                                        container_candidates_t& candidates) {
+    candidates.clear();
+    size_t count;
+    const container_t* const table = containers(&count);
+    for (size_t c=0; c<count; ++c) {
+      const container_t& container = table[c];
+      if (b_size <= container.magic_offset) {
+        continue;
+      }
+      const uint8_t first = static_cast<uint8_t>(container.magic[0]);
+      const uint8_t* p = b + container.magic_offset;
+      const uint8_t* const end = b + std::min(b_size,
+                                         scan_size + container.magic_offset);
+      while (p < end) {
+        p = static_cast<const uint8_t*>(memchr(p, first, end - p));
+        if (p == NULL) {
+          break;
+        }
+        const size_t offset = p - b - container.magic_offset;
+        if (p + container.magic_size <= b + b_size &&
+            memcmp(p, container.magic, container.magic_size) == 0 &&
+            container.signature(b, b_size, offset)) {
+          candidates.push_back(container_candidate_t(offset, c));
+        }
+        ++p;
+      }
+    }
+
+    // interleave the formats by offset
+    std::sort(candidates.begin(), candidates.end());
+  }
+
+} // end namespace hasher
+
+#endif
+
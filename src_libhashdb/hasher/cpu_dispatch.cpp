@@ -0,0 +1,121 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Detect CPU features and report the selected kernels, see
+ * cpu_dispatch.hpp.
+ */
+
+#include <config.h>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+#include "hashdb.hpp"
+#include "cpu_dispatch.hpp"
+
+#if defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+namespace hasher {
+
+  // the level named by HASHDB_CPU, or -1 for no limit
+  static int requested_level() {
+    const char* const value = ::getenv("HASHDB_CPU");
+    if (value == NULL || value[0] == '\0') {
+      return -1;
+    }
+    static const char* const names[] = {"scalar", "sse2", "sse4.2", "avx2",
+                                        "avx512"};
+    for (int i=0; i<5; ++i) {
+      if (::strcmp(value, names[i]) == 0) {
+        return i;
+      }
+    }
+    if (::strcmp(value, "neon") == 0) {
+      return 1;
+    }
+    std::cerr << "Warning: HASHDB_CPU '" << value << "' is not scalar, "
+              << "sse2, sse4.2, avx2, avx512, or neon, ignoring it.\n";
+    return -1;
+  }
+
+  static cpu_features_t detect_features() {
+    cpu_features_t features;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2");
+    features.sse4_2 = __builtin_cpu_supports("sse4.2");
+    features.pclmul = __builtin_cpu_supports("pclmul") &&
+                      __builtin_cpu_supports("sse4.1");
+    features.avx2 = __builtin_cpu_supports("avx2");
+    features.avx512 = __builtin_cpu_supports("avx512f") &&
+                      __builtin_cpu_supports("avx512bw");
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    features.neon = true;
+#if defined(__linux__) && defined(HWCAP_CRC32)
+    features.arm_crc32 = (::getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+#endif
+
+    // limit to the requested level, where every level but scalar
+    // keeps the ARM features
+    const int level = requested_level();
+    if (level >= 0) {
+      features.sse2 = features.sse2 && level >= 1;
+      features.sse4_2 = features.sse4_2 && level >= 2;
+      features.pclmul = features.pclmul && level >= 2;
+      features.avx2 = features.avx2 && level >= 3;
+      features.avx512 = features.avx512 && level >= 4;
+      features.neon = features.neon && level >= 1;
+      features.arm_crc32 = features.arm_crc32 && level >= 1;
+    }
+    return features;
+  }
+
+  const cpu_features_t& cpu_features() {
+    static const cpu_features_t features = detect_features();
+    return features;
+  }
+
+  std::string selected_kernels() {
+    std::string kernels = "zero_check=";
+    kernels += zero_check_kernel();
+    kernels += " md5=";
+    kernels += md5_kernel();
+    kernels += " entropy=scalar label=";
+    kernels += block_label_kernel();
+    kernels += " hex=";
+    kernels += hex_kernel();
+    kernels += " crc=";
+    kernels += crc_kernel();
+    return kernels;
+  }
+
+} // end namespace hasher
+
+namespace hashdb {
+  std::string cpu_kernels() {
+    return hasher::selected_kernels();
+  }
+} // end namespace hashdb
@@ -0,0 +1,74 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Select hasher kernels from the features of the CPU at runtime, so that
+ * one binary uses AVX-512, AVX2, SSE2, or NEON where the CPU has them.
+ *
+ * Features are detected once, on first use.  Set the HASHDB_CPU
+ * environment variable to scalar, sse2, sse4.2, avx2, avx512, or neon to
+ * limit kernels to that level, for example to compare kernels in a
+ * benchmark.  Kernels never use features the CPU does not have.
+ */
+
+#ifndef CPU_DISPATCH_HPP
+#define CPU_DISPATCH_HPP
+#include <string>
+
+namespace hasher {
+
+  // instruction set features that kernels may use
+  struct cpu_features_t {
+    bool sse2;
+    bool sse4_2;
+    bool pclmul;     // carry-less multiply with SSE4.1
+    bool avx2;
+    bool avx512;     // AVX-512 F and BW
+    bool neon;
+    bool arm_crc32;
+    cpu_features_t() : sse2(false), sse4_2(false), pclmul(false),
+                       avx2(false), avx512(false), neon(false),
+                       arm_crc32(false) {
+    }
+  };
+
+  /**
+   * The features kernels may use: those of this CPU, limited by
+   * HASHDB_CPU.
+   */
+  const cpu_features_t& cpu_features();
+
+  // the kernel each module selected, defined by that module
+  const char* zero_check_kernel();
+  const char* md5_kernel();
+  const char* block_label_kernel();
+  const char* hex_kernel();
+  const char* crc_kernel();
+
+  /**
+   * The selected kernels, such as
+   * "zero_check=avx2 md5=avx2 entropy=scalar label=sse2 hex=sse2
+   * crc=pclmul".
+   */
+  std::string selected_kernels();
+
+} // end namespace hasher
+
+#endif
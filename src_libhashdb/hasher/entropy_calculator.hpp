@@ -27,6 +27,17 @@
  * The entropy is calculated for 16-bit alphabet elements.
  *
  * The entropy returned is calculated entropy * 1,000 rounded into an integer.
+ *
+ * Element counts are kept in a flat array with a bitmap of the elements
+ * present.  Entropy terms are summed in ascending element order so the
+ * result is bit-identical to summing over an ordered map.  When the next
+ * block overlaps the previous block in the same buffer at an even
+ * distance, only the elements leaving and entering the window are
+ * updated.
+ *
+ * Counting a whole block runs a kernel chosen when the calculator is
+ * made: blocks of 512 and 4096 bytes use kernels with a fixed trip count
+ * and others use the general loop.
  */
 
 #ifndef ENTROPY_CALCULATOR_HPP
@@ -36,43 +47,112 @@
 #include <cmath>
 #include <cstring>
 #include <cstdlib>
-#include <map>
+#include <cassert>
 
 namespace hasher {
 
 class entropy_calculator_t {
 
   private:
-  typedef std::map<size_t, size_t>::const_iterator bucket_it_t;
+  static const size_t NUM_ELEMENTS = 65536;
+  static const size_t NUM_WORDS = NUM_ELEMENTS / 64;
+
   const size_t slots;
+  void (entropy_calculator_t::* const fill_kernel)(const uint8_t* const);
   float* const lookup_table; // index 0 is not used
+  uint32_t* const counts;    // count for each element
+  uint64_t* const present;   // bit set when the element count is nonzero
+
+  // the window currently counted, or NULL when counts are clear
+  const uint8_t* window_buffer;
+  size_t window_offset;
 
   // do not allow copy or assignment
   entropy_calculator_t(const entropy_calculator_t&);
   entropy_calculator_t& operator=(const entropy_calculator_t&);
 
-  uint64_t calculate_private(const uint8_t* const buffer) const {
+  static uint16_t element_at(const uint8_t* const p) {
+    return (uint16_t)(p[0]<<0 | p[1]<<8);
+  }
+
+  void add(const uint16_t element) {
+    if (counts[element]++ == 0) {
+      present[element >> 6] |= (uint64_t)1 << (element & 63);
+    }
+  }
+
+  void remove(const uint16_t element) {
+    if (--counts[element] == 0) {
+      present[element >> 6] &= ~((uint64_t)1 << (element & 63));
+    }
+  }
 
-    // calculate entropy buckets
-    std::map<size_t, size_t> buckets;
-    for (size_t i=0; i<slots; i++) {
-      uint16_t element = (uint16_t)(buffer[i*2+0]<<0 | buffer[i*2+1]<<8);
-      buckets[element] += 1;
+  // zero the counts of present elements
+  void clear() {
+    for (size_t w=0; w<NUM_WORDS; ++w) {
+      uint64_t bits = present[w];
+      while (bits != 0) {
+        counts[w * 64 + __builtin_ctzll(bits)] = 0;
+        bits &= bits - 1;
+      }
+      present[w] = 0;
     }
+    window_buffer = NULL;
+  }
 
-    // sum the entropy from the buckets
+  // count the elements of the block at p, SLOTS is 0 for any block size
+  template<size_t SLOTS>
+  void fill_slots(const uint8_t* const p) {
+    const size_t n = (SLOTS > 0) ? SLOTS : slots;
+    for (size_t i=0; i<n; i++) {
+      add(element_at(p + i*2));
+    }
+  }
+
+  // the fill kernel for a block size
+  static void (entropy_calculator_t::* select_fill_kernel(
+                   const size_t block_size))(const uint8_t* const) {
+    switch (block_size) {
+      case 512: return &entropy_calculator_t::fill_slots<256>;
+      case 4096: return &entropy_calculator_t::fill_slots<2048>;
+      default: return &entropy_calculator_t::fill_slots<0>;
+    }
+  }
+
+  // count the elements of the block at p
+  void fill(const uint8_t* const p) {
+    clear();
+    (this->*fill_kernel)(p);
+  }
+
+  // sum the entropy of the present elements in ascending element order
+  uint64_t sum() const {
     float entropy = 0;
-    for (bucket_it_t it = buckets.begin(); it != buckets.end(); ++it) {
-      entropy += lookup_table[it->second];
+    for (size_t w=0; w<NUM_WORDS; ++w) {
+      uint64_t bits = present[w];
+      while (bits != 0) {
+        entropy += lookup_table[counts[w * 64 + __builtin_ctzll(bits)]];
+        bits &= bits - 1;
+      }
     }
 
     return round(entropy * 1000);
   }
 
+  uint64_t calculate_private(const uint8_t* const buffer) {
+    fill(buffer);
+    return sum();
+  }
+
   public:
   entropy_calculator_t(const size_t block_size) :
                    slots(block_size / 2),
-                   lookup_table(new float[slots+1]) {
+                   fill_kernel(select_fill_kernel(block_size)),
+                   lookup_table(new float[slots+1]),
+                   counts(new uint32_t[NUM_ELEMENTS]()),
+                   present(new uint64_t[NUM_WORDS]()),
+                   window_buffer(NULL),
+                   window_offset(0) {
 
     // compute entropy values for each slot
     for (size_t i=1; i<= slots; ++i) {
@@ -83,17 +163,38 @@ class entropy_calculator_t {
 
   ~entropy_calculator_t(){
     delete[] lookup_table;
+    delete[] counts;
+    delete[] present;
   }
 
   // safely calculate block entropy by padding with zeros on overflow.
   // Returns entropy * 1,000 as an int for 3 decimal precision.
   uint64_t calculate(const uint8_t* const buffer,
                   const size_t buffer_size,
-                  const size_t offset) const {
+                  const size_t offset) {
 
     if (offset + slots * 2 <= buffer_size) {
       // calculate when not a buffer overrun
-      return calculate_private(buffer + offset);
+      const size_t window_size = slots * 2;
+      if (window_buffer == buffer && offset > window_offset &&
+          offset - window_offset < window_size &&
+          (offset - window_offset) % 2 == 0) {
+
+        // slide the counted window forward to offset
+        const size_t shift = (offset - window_offset) / 2;
+        const uint8_t* const leaving = buffer + window_offset;
+        const uint8_t* const entering = buffer + window_offset + window_size;
+        for (size_t i=0; i<shift; i++) {
+          remove(element_at(leaving + i*2));
+          add(element_at(entering + i*2));
+        }
+      } else {
+        fill(buffer + offset);
+      }
+      window_buffer = buffer;
+      window_offset = offset;
+      return sum();
+
     } else if (offset > buffer_size) {
       // program error
       assert(0);
@@ -104,6 +205,7 @@ class entropy_calculator_t {
       ::memcpy (b, buffer+offset, buffer_size - offset);
       float entropy = calculate_private(b);
       delete[] b;
+      window_buffer = NULL;
       return round(entropy * 1000);
     }
   }
@@ -92,7 +92,8 @@ class file_reader_t {
   }
 
   // open the file for reading, return error_message or ""
-  std::string open_reader(const filename_t& native_filename) {
+  std::string open_reader(const filename_t& native_filename,
+                          const bool direct_reads) {
     switch(file_reader_type) {
 
       // E01
@@ -103,7 +104,8 @@ class file_reader_t {
 
       // SINGLE binary file
       case file_reader_type_t::SINGLE: {
-        single_file_reader = new single_file_reader_t(native_filename);
+        single_file_reader = new single_file_reader_t(native_filename,
+                                                      direct_reads);
         return single_file_reader->error_message;
       }
       default: assert(0); std::exit(1);
@@ -130,17 +132,19 @@ class file_reader_t {
   public:
   /**
    * Opens a file reader.  The reader detects file types.
-   * Provide the filename or device name to read from.
+   * Provide the filename or device name to read from, and whether to
+   * read single files around the page cache, see single_file_reader_t.
    * Check error_message.
    * To read: read(offset, buffer, buffer_size).
    * Use as desired: filename, filesize, file_reader_type.
    */
-  file_reader_t(const filename_t& p_native_filename) :
+  file_reader_t(const filename_t& p_native_filename,
+                const bool direct_reads = false) :
           ewf_file_reader(NULL),
           single_file_reader(NULL),
           filename(native_to_utf8(p_native_filename)),
           file_reader_type(reader_type(filename)),
-          error_message(open_reader(p_native_filename)),
+          error_message(open_reader(p_native_filename, direct_reads)),
           filesize(get_filesize()),
           last_offset(0),
           last_buffer(NULL),
@@ -209,6 +213,39 @@ class file_reader_t {
       default: assert(0); std::exit(1);
     }
   }
+
+  // whether bytes [offset, offset + size) are a hole of a sparse single
+  // file.  E01 files are never treated as having holes.
+  bool is_hole(const uint64_t offset, const uint64_t size) const {
+    if (file_reader_type == file_reader_type_t::SINGLE) {
+      return single_file_reader->is_hole(offset, size);
+    }
+    return false;
+  }
+
+  // ask the OS to start reading a single file into the page cache
+  void will_need() const {
+    if (file_reader_type == file_reader_type_t::SINGLE) {
+      single_file_reader->will_need();
+    }
+  }
+
+  // open another reader of an E01 file so that reads from different
+  // threads decompress in parallel, else NULL.  Check its is_open.
+  ewf_file_reader_t* new_ewf_file_reader() const {
+    if (file_reader_type == file_reader_type_t::E01) {
+      return new ewf_file_reader_t(ewf_file_reader->filename);
+    }
+    return NULL;
+  }
+
+  // map the file if it is a single file that can be mapped, else NULL
+  mapped_file_t* map() const {
+    if (file_reader_type == file_reader_type_t::SINGLE) {
+      return single_file_reader->map();
+    }
+    return NULL;
+  }
 };
 
 } // end namespace hasher
@@ -57,13 +57,15 @@
 #ifdef WIN32
 int pread64(HANDLE current_handle,char *buf,size_t bytes,uint64_t offset)
 {
+    // the offset goes in the OVERLAPPED structure rather than the shared
+    // file pointer, so the read completes before returning
     DWORD bytes_read = 0;
-    LARGE_INTEGER li;
-    li.QuadPart = offset;
-    li.LowPart = SetFilePointer(current_handle, li.LowPart, &li.HighPart, FILE_BEGIN);
-    if(li.LowPart == INVALID_SET_FILE_POINTER) return -1;
-    if (FALSE == ReadFile(current_handle, buf, (DWORD) bytes, &bytes_read, NULL)){
-        return -1;
+    OVERLAPPED request;
+    ZeroMemory(&request, sizeof(request));
+    request.Offset = (DWORD) offset;
+    request.OffsetHigh = (DWORD) (offset >> 32);
+    if (FALSE == ReadFile(current_handle, buf, (DWORD) bytes, &bytes_read, &request)){
+        return (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
     }
     return bytes_read;
 }
@@ -54,7 +54,13 @@
 #include <fcntl.h>
 #include <stack>
 #include <set>
+#include <map>
+#include <vector>
+#include <pthread.h>
 #include "filename_t.hpp"
+#include "filename_list.hpp"
+#include "file_reader.hpp"
+#include "num_cpus.hpp"
 
 namespace hasher {
 
@@ -122,6 +128,26 @@ static void strip_non_first_multipart_filenames(filenames_t& filenames) {
   }
 }
 
+// file sizes found while walking
+typedef std::map<filename_t, uint64_t> file_sizes_t;
+
+// media bytes of the files, opening E01 files to get their media size
+static uint64_t total_media_bytes(const filenames_t& files,
+                                  const file_sizes_t& file_sizes) {
+  uint64_t total_bytes = 0;
+  for (filenames_t::const_iterator it = files.begin(); it != files.end();
+                                                                     ++it) {
+    const file_sizes_t::const_iterator size_it = file_sizes.find(*it);
+    if (is_multipart(*it) || size_it == file_sizes.end()) {
+      const file_reader_t file_reader(*it);
+      total_bytes += file_reader.filesize;
+    } else {
+      total_bytes += size_it->second;
+    }
+  }
+  return total_bytes;
+}
+
 // ************************************************************
 // filename_list
 // ************************************************************
@@ -131,7 +157,9 @@ static void strip_non_first_multipart_filenames(filenames_t& filenames) {
 
 // get files, return error_message or ""
 std::string filename_list(const std::string& utf8_filename,
-                          filenames_t* files) {
+                          filenames_t* files, uint64_t* total_bytes) {
+
+  file_sizes_t file_sizes;
 
   // get native filename
   const std::wstring native_filename = hasher::utf8_to_native(utf8_filename);
@@ -151,6 +179,9 @@ std::string filename_list(const std::string& utf8_filename,
   if (!(file_attributes & FILE_ATTRIBUTE_DIRECTORY)) {
     // not directory so just use filename
     files->insert(native_filename);
+    if (total_bytes != NULL) {
+      *total_bytes = total_media_bytes(*files, file_sizes);
+    }
     return "";
   }
 
@@ -230,6 +261,9 @@ std::string filename_list(const std::string& utf8_filename,
 
       } else {
         files->insert(absolute_filename);
+        file_sizes[absolute_filename] =
+                           (((uint64_t)file_data.nFileSizeHigh)<<32) |
+                           (file_data.nFileSizeLow);
       }
 
     // next
@@ -250,6 +284,10 @@ std::string filename_list(const std::string& utf8_filename,
   // strip out non-first recursive filenames such as *.E02, etc.
   strip_non_first_multipart_filenames(*files);
 
+  if (total_bytes != NULL) {
+    *total_bytes = total_media_bytes(*files, file_sizes);
+  }
+
   // done
   return "";
 }
@@ -268,43 +306,54 @@ public:
     }
 };
 
-// get files, return error_message or ""
-std::string filename_list(const std::string& filename, filenames_t* files) {
+// directories shared by the walker threads
+class directory_walker_t {
 
-  // clear files
-  files->clear();
+  private:
+  // state, protected by M
+  std::stack<std::string> directories;
+  size_t busy;                        // threads reading a directory
+  std::set<dev_inode_t> seen_dev_inodes;
+  filenames_t* const files;
+  file_sizes_t* const file_sizes;
 
-  // first make sure the filename is a directory
-  DIR *d = opendir(filename.c_str());
-  if (d == NULL) {
-    // filename is not a directory
-    files->insert(filename);
-    return "";
-  } else {
-    // close resource
-    closedir(d);
-  }
+  mutable pthread_mutex_t M;
+  pthread_cond_t changed;
 
-  // stack for processing found directories
-  std::stack<std::string> directories;
+  // do not allow copy or assignment
+  directory_walker_t(const directory_walker_t&);
+  directory_walker_t& operator=(const directory_walker_t&);
 
-  // push the first directory for processing
-  directories.push(filename);
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
 
-  // process directories until empty
-  std::set<dev_inode_t> seen_dev_inodes;
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
 
-  while (!directories.empty()) {
-    const std::string path = directories.top();
-    directories.pop();
+  // an entry found in a directory
+  struct entry_t {
+    std::string filename;
+    dev_inode_t dev_inode;
+    bool is_directory;
+    uint64_t filesize;
+    entry_t(const std::string& p_filename, const struct stat& st) :
+            filename(p_filename), dev_inode(st.st_dev, st.st_ino),
+            is_directory(S_ISDIR(st.st_mode)), filesize(st.st_size) {
+    }
+  };
+
+  // read the entries of one directory, return false if it cannot be read
+  static bool read_directory(const std::string& path,
+                             std::vector<entry_t>& entries) {
 
     // read POSIX directory entry
     DIR *dir= opendir(path.c_str());
     if (dir == NULL) {
-      std::stringstream ss;
-      ss << "failure in opendir reading path " << path
-         << ", " << strerror(errno);
-      return ss.str();
+      return false;
     }
 
     // read files in directory
@@ -336,35 +385,148 @@ std::string filename_list(const std::string& filename, filenames_t* files) {
       if(S_ISSOCK(st.st_mode)) continue; // socket
       if(S_ISBLK(st.st_mode)) continue;  // block device
       if(S_ISCHR(st.st_mode)) continue;  // character device
-      dev_inode_t dev_inode(st.st_dev, st.st_ino);
-      if (seen_dev_inodes.find(dev_inode) == seen_dev_inodes.end()) {
-        // new
-        seen_dev_inodes.insert(dev_inode);
-      } else {
-        // seen
-        continue;
+      entries.push_back(entry_t(next_filename, st));
+    }
+    // close resource
+    closedir(dir);
+    return true;
+  }
+
+  static void* run(void* const arg) {
+    static_cast<directory_walker_t*>(arg)->walk_loop();
+    return 0;
+  }
+
+  // take directories until all are read
+  void walk_loop() {
+    lock();
+    while (true) {
+      while (directories.empty() && busy > 0) {
+        pthread_cond_wait(&changed, &M);
+      }
+      if (directories.empty()) {
+        // done
+        pthread_cond_broadcast(&changed);
+        unlock();
+        return;
       }
+      const std::string path = directories.top();
+      directories.pop();
+      ++busy;
+      unlock();
+
+      // read the directory without holding the lock
+      std::vector<entry_t> entries;
+      const bool is_read = read_directory(path, entries);
+
+      lock();
+      --busy;
+      if (!is_read) {
+        // list a directory that cannot be read as a file, which will
+        // then fail to open
+        files->insert(path);
+      }
+      for (std::vector<entry_t>::const_iterator it = entries.begin();
+                                            it != entries.end(); ++it) {
 
-      // send filename to the directories stack or to the filenames vector
-      DIR *name = opendir(next_filename.c_str());
-      if (name == NULL) {
-        // filename is not a directory
-        files->insert(next_filename);
-      } else {
-        // filename is a directory
-        directories.push(next_filename);
+        // skip files seen before
+        if (!seen_dev_inodes.insert(it->dev_inode).second) {
+          continue;
+        }
 
-        // close resource
-        closedir(name);
+        // send filename to the directories stack or to the filenames set
+        if (it->is_directory) {
+          directories.push(it->filename);
+          pthread_cond_signal(&changed);
+        } else {
+          files->insert(it->filename);
+          (*file_sizes)[it->filename] = it->filesize;
+        }
       }
+      pthread_cond_broadcast(&changed);
     }
+  }
+
+  public:
+  directory_walker_t(filenames_t* const p_files,
+                     file_sizes_t* const p_file_sizes) :
+            directories(), busy(0), seen_dev_inodes(),
+            files(p_files), file_sizes(p_file_sizes),
+            M(), changed() {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&changed,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+  }
+
+  ~directory_walker_t() {
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&M);
+  }
+
+  // walk the directory tree using num_threads threads
+  void walk(const std::string& path, const size_t num_threads) {
+    directories.push(path);
+    std::vector<pthread_t> threads(num_threads);
+    for (size_t i=0; i<num_threads; ++i) {
+      if (pthread_create(&threads[i], NULL, directory_walker_t::run,
+                         this) != 0) {
+        std::cerr << "Unable to start directory walker thread.\n";
+        assert(0);
+      }
+    }
+    for (size_t i=0; i<num_threads; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+};
+
+// the most threads to walk directories with
+static const size_t max_walker_threads = 8;
+
+// get files, return error_message or ""
+std::string filename_list(const std::string& filename, filenames_t* files,
+                          uint64_t* total_bytes) {
+
+  file_sizes_t file_sizes;
+
+  // clear files
+  files->clear();
+
+  // first make sure the filename is a directory
+  DIR *d = opendir(filename.c_str());
+  if (d == NULL) {
+    // filename is not a directory
+    files->insert(filename);
+    if (total_bytes != NULL) {
+      *total_bytes = total_media_bytes(*files, file_sizes);
+    }
+    return "";
+  } else {
     // close resource
-    closedir(dir);
+    closedir(d);
   }
 
+  // walk the directories, more threads help when directories are
+  // on storage with high latency
+  const int num_cpus = hashdb::numCPU();
+  const size_t num_threads = (num_cpus < 1) ? 1 :
+                      (static_cast<size_t>(num_cpus) > max_walker_threads)
+                      ? max_walker_threads : static_cast<size_t>(num_cpus);
+  directory_walker_t directory_walker(files, &file_sizes);
+  directory_walker.walk(filename, num_threads);
+
   // strip out non-first recursive filenames such as *.E02, etc.
   strip_non_first_multipart_filenames(*files);
 
+  if (total_bytes != NULL) {
+    *total_bytes = total_media_bytes(*files, file_sizes);
+  }
+
   // done
   return "";
 }
@@ -7,12 +7,21 @@
 #define FILENAME_LIST_HPP
 
 #include <string>
+#include <stdint.h>
 #include "filename_t.hpp"
 
 namespace hasher {
 
+  /**
+   * Get the files at the path, which may be a file or a directory to
+   * walk, and return "" else reason for error.  Directories are walked
+   * in parallel.  Set total_bytes, if provided, to the media bytes of
+   * the files, taken from the walk except for E01 files, which are
+   * opened to get their media size.
+   */
   std::string filename_list(const std::string& utf8_filename,
-                            hasher::filenames_t* files);
+                            hasher::filenames_t* files,
+                            uint64_t* total_bytes = NULL);
 
 }
 
@@ -30,6 +30,7 @@
 #endif
 
 #include <string>
+#include <vector>
 #include <stdint.h>
 #include <assert.h>
 #include <fcntl.h>
@@ -39,9 +40,44 @@
 #include <unistd.h>
 
 #include <openssl/evp.h>
+#include "md5_multi_buffer.hpp"
 
 namespace hasher {
 
+/**
+ * Return the OpenSSL digest for the named block hash algorithm,
+ * or NULL if the name is not supported.  Names are those accepted
+ * for the block_hash_algorithm setting.
+ */
+inline const EVP_MD* block_hash_md(const std::string& algorithm) {
+  if (algorithm == "md5") {
+    return EVP_md5();
+  }
+  if (algorithm == "sha1") {
+    return EVP_sha1();
+  }
+  if (algorithm == "sha256") {
+    return EVP_sha256();
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_BLAKE2)
+  if (algorithm == "blake2s256") {
+    return EVP_blake2s256();
+  }
+#endif
+  return NULL;
+}
+
+/**
+ * The block hash algorithm names supported by this build, for usage text.
+ */
+inline std::string block_hash_algorithm_names() {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_BLAKE2)
+  return "md5, sha1, sha256, blake2s256";
+#else
+  return "md5, sha1, sha256";
+#endif
+}
+
 class hash_calculator_t {
 
   private:
@@ -55,6 +91,20 @@ class hash_calculator_t {
                         in_progress(false) {
   }
 
+  /**
+   * Hash using the named block hash algorithm.  The name must be one
+   * accepted by block_hash_md.
+   */
+  explicit hash_calculator_t(const std::string& algorithm) :
+                        md_context(EVP_MD_CTX_create()),
+                        md(block_hash_md(algorithm)),
+                        in_progress(false) {
+    if (md == NULL) {
+      std::cerr << "Invalid block hash algorithm '" << algorithm << "'\n";
+      assert(0);
+    }
+  }
+
   ~hash_calculator_t(){
     EVP_MD_CTX_destroy(md_context);
   }
@@ -111,6 +161,46 @@ class hash_calculator_t {
                        static_cast<size_t>(md_len));
   }
 
+  /**
+   * Calculate hashes of count bytes in buffer at each offset, in order.
+   * Blocks that fit in the buffer are hashed several at a time using
+   * multi-buffer MD5 when available.  Other blocks are hashed by
+   * calculate.
+   */
+  void calculate_batch(const uint8_t* const buffer,
+                       const size_t buffer_size,
+                       const std::vector<size_t>& offsets,
+                       const size_t count,
+                       std::vector<std::string>& hashes) {
+
+    hashes.resize(offsets.size());
+    const size_t lanes = (md == EVP_md5()) ? md5_multi_buffer_lanes() : 0;
+    const uint8_t* messages[16];
+    uint8_t digests[16 * 16];
+    size_t i = 0;
+    while (i < offsets.size()) {
+
+      // gather blocks that fit in the buffer, up to one per lane
+      size_t n = 0;
+      while (n < lanes && n < 16 && i + n < offsets.size() &&
+             offsets[i + n] + count <= buffer_size) {
+        messages[n] = buffer + offsets[i + n];
+        ++n;
+      }
+
+      if (n > 1) {
+        md5_multi_buffer(messages, n, count, digests);
+        for (size_t j = 0; j < n; ++j) {
+          hashes[i + j].assign(reinterpret_cast<char*>(digests + 16 * j), 16);
+        }
+        i += n;
+      } else {
+        hashes[i] = calculate(buffer, buffer_size, offsets[i], count);
+        ++i;
+      }
+    }
+  }
+
   /**
    * Begin a hash calculation.
    */
@@ -130,7 +220,7 @@ class hash_calculator_t {
   /**
    * Update a hash calculation.
    */
-  void update(uint8_t* const buffer,
+  void update(const uint8_t* const buffer,
               const size_t buffer_size,
               const size_t offset,
               const size_t count) {
@@ -19,7 +19,7 @@
 
 /**
  * \file
- * Support hashdb ingest recursive from path.
+ * Support hashdb ingest recursive from path or from a stream.
  */
 #include <config.h>
 // this process of getting WIN32 defined was inspired
@@ -37,236 +37,984 @@
 #endif
 
 #include <string>
+#include <vector>
+#include <cstring>
 #include <cassert>
 #include <iostream>
 #include <unistd.h> // for F_OK
 #include <sstream>
+#include <pthread.h>
 #include "num_cpus.hpp"
 #include "hashdb.hpp"
 #include "filename_t.hpp"
 #include "file_reader.hpp"
+#include "file_reader_helper.hpp"
+#include "read_ahead.hpp"
+#include "stream_reader.hpp"
+#include "open_ahead.hpp"
+#include "buffer_pool.hpp"
+#include "pending_source.hpp"
 #include "hash_calculator.hpp"
 #include "filename_list.hpp"
 #include "threadpool.hpp"
 #include "job.hpp"
 #include "job_queue.hpp"
 #include "ingest_tracker.hpp"
+#include "ingest_cache.hpp"
+#include "checkpoint.hpp"
 #include "tprint.hpp"
+#include "stage_stats.hpp"
+#include "probes.hpp"
 
 static const size_t BUFFER_DATA_SIZE = 16777216;   // 2^24=16MiB
 static const size_t BUFFER_SIZE = 17825792;        // 2^24+2^20=17MiB
 static const size_t MAX_RECURSION_DEPTH = 7;
+static const size_t HASH_BATCH_SIZE = 1000;         // hashes per write
+static const size_t HASH_BATCH_MILLISECONDS = 1000;
+static const size_t READ_AHEAD_CHUNKS = 2;         // reads outstanding
+static const uint64_t MAX_HELD_BYTES = 134217728;  // 2^27=128MiB
+static const size_t OPEN_AHEAD_THREADS = 4;        // files opened at once
+static const size_t OPEN_AHEAD_FILES = 64;         // files opened ahead
+static const uint64_t PACKED_FILE_SIZE = 1048576;  // 2^20=1MiB, or less
+static const size_t PACKED_FILES_MAX = 4096;       // files per packed job
+static const uint64_t CHECKPOINT_SECONDS = 300;    // between checkpoints
 
 namespace hashdb {
   // ************************************************************
   // helpers
   // ************************************************************
-  static uint64_t calculate_total_bytes(const hasher::filenames_t filenames) {
+  // small files read back to back into one buffer for one packed job
+  class file_pack_t {
+    private:
+    // do not allow copy or assignment
+    file_pack_t(const file_pack_t&);
+    file_pack_t& operator=(const file_pack_t&);
 
-    // iterate over files
-    uint64_t total_bytes = 0;
-    int i = 0;
-    for (hasher::filenames_t::const_iterator it=filenames.begin();
-                                           it != filenames.end(); ++it) {
+    public:
+    uint8_t* buffer;  // from the buffer pool, or NULL if nothing is packed
+    size_t size;
+    hasher::packed_files_t packed_files;
+    file_pack_t() : buffer(NULL), size(0), packed_files() {
+    }
+  };
+
+  // a hash database that ingest feeds, with its own block size and step
+  // size, import manager, ingest tracker, and pack of small files
+  class ingest_target_t {
+    private:
+    // do not allow copy or assignment
+    ingest_target_t(const ingest_target_t&);
+    ingest_target_t& operator=(const ingest_target_t&);
+
+    public:
+    const std::string hashdb_dir;
+    const size_t step_size;
+    const size_t block_size;
+    const size_t min_chunk_size;
+    const size_t max_chunk_size;
+    const std::string block_hash_algorithm;
+    hashdb::import_manager_t import_manager;
+    hasher::ingest_tracker_t* ingest_tracker; // once the files are listed
+    file_pack_t pack;
+    ingest_target_t(const std::string& p_hashdb_dir,
+                    const size_t p_step_size,
+                    const hashdb::settings_t& settings,
+                    const std::string& cmd) :
+            hashdb_dir(p_hashdb_dir), step_size(p_step_size),
+            block_size(settings.block_size),
+            min_chunk_size(settings.min_chunk_size),
+            max_chunk_size(settings.max_chunk_size),
+            block_hash_algorithm(settings.block_hash_algorithm),
+            import_manager(p_hashdb_dir, cmd),
+            ingest_tracker(NULL), pack() {
+    }
+    ~ingest_target_t() {
+      delete ingest_tracker;
+    }
+  };
+  typedef std::vector<ingest_target_t*> ingest_targets_t;
+
+  // close the import managers of the targets
+  static void close_targets(ingest_targets_t& targets) {
+    for (size_t k=0; k<targets.size(); ++k) {
+      delete targets[k];
+    }
+    targets.clear();
+  }
+
+  // copy a chunk into a buffer from the pool so that another target can
+  // own it, return false if allocation fails.  Holes have no buffer.
+  static bool copy_chunk(const hasher::read_chunk_t& chunk,
+                         hasher::buffer_pool_t& buffer_pool,
+                         hasher::read_chunk_t& copy) {
+    copy = chunk;
+    if (chunk.is_hole) {
+      return true;
+    }
+    uint8_t* const buffer = buffer_pool.acquire();
+    if (buffer == NULL) {
+      return false;
+    }
+    std::memcpy(buffer, chunk.buffer, chunk.buffer_size);
+    copy.buffer = buffer;
+    copy.mapped_file = NULL;
+    copy.buffer_pool = &buffer_pool;
+    return true;
+  }
+
+  // release the buffer of a chunk
+  static void release_chunk(const hasher::read_chunk_t& chunk) {
+    if (!chunk.is_hole) {
+      hasher::release_buffer(chunk.buffer_pool, chunk.mapped_file,
+                             chunk.buffer, chunk.buffer_size);
+    }
+  }
+
+  // push a job for the chunk onto the job queue, taking its buffer
+  static void push_chunk(
+        const hasher::read_chunk_t& chunk,
+        const std::string& filename,
+        const uint64_t filesize,
+        ingest_target_t& target,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const std::string& file_hash,
+        hasher::pending_source_t* const pending_source,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        const bool disable_ingest_hashes,
+        const size_t max_recursion_depth,
+        hasher::job_queue_t* const job_queue) {
+
+    const size_t data_size = (chunk.buffer_size > BUFFER_DATA_SIZE)
+                             ? BUFFER_DATA_SIZE : chunk.buffer_size;
+    if (chunk.is_hole) {
+      // a hole is all zero blocks, counted without a job
+      const size_t zero_count = (data_size + target.step_size - 1) /
+                                target.step_size;
+      if (disable_ingest_hashes) {
+        // a duplicate source is not counted again
+      } else if (pending_source != NULL) {
+        if (pending_source->add_part(hashdb::hash_inserts_t(), zero_count,
+                                     0)) {
+          delete pending_source;
+        }
+      } else {
+        target.ingest_tracker->track_source(file_hash, zero_count, 0);
+      }
+      target.ingest_tracker->track_bytes(data_size);
+      return;
+    }
+    HASHDB_PROBE3(job_dispatch, static_cast<int>(hasher::job_type_t::INGEST),
+                  chunk.offset, data_size);
+    job_queue->push(hasher::job_t::new_ingest_job(
+                 &target.import_manager,
+                 target.ingest_tracker,
+                 whitelist_scan_manager,
+                 repository_name,
+                 target.step_size,
+                 target.block_size,
+                 target.min_chunk_size,
+                 target.max_chunk_size,
+                 target.block_hash_algorithm,
+                 file_hash,
+                 pending_source,
+                 filename,
+                 filesize,
+                 chunk.offset, // file_offset
+                 disable_recursive_processing,
+                 disable_calculate_entropy,
+                 disable_calculate_labels,
+                 disable_ingest_hashes,
+                 chunk.buffer,      // buffer
+                 chunk.buffer_size, // buffer_size
+                 data_size,         // buffer_data_size,
+                 chunk.mapped_file, // mapped_file
+                 chunk.buffer_pool, // buffer_pool
+                 max_recursion_depth,
+                 0,      // recursion_depth
+                 ""));   // recursion path
+  }
+
+  // push the packed files of the target as one job, taking its buffer
+  static void push_pack(
+        ingest_target_t& target,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue) {
+
+    file_pack_t& pack = target.pack;
+    if (pack.buffer == NULL) {
+      // nothing to push
+      return;
+    }
+
+    // identify the maximum recursion depth
+    size_t max_recursion_depth = 
+                    (disable_recursive_processing) ? MAX_RECURSION_DEPTH : 0;
+
+    HASHDB_PROBE3(job_dispatch,
+                  static_cast<int>(hasher::job_type_t::INGEST_PACKED),
+                  0, pack.size);
+    job_queue->push(hasher::job_t::new_packed_ingest_job(
+                 &target.import_manager,
+                 target.ingest_tracker,
+                 whitelist_scan_manager,
+                 repository_name,
+                 target.step_size,
+                 target.block_size,
+                 target.min_chunk_size,
+                 target.max_chunk_size,
+                 target.block_hash_algorithm,
+                 disable_recursive_processing,
+                 disable_calculate_entropy,
+                 disable_calculate_labels,
+                 pack.packed_files,
+                 pack.buffer,       // buffer
+                 pack.size,         // buffer_size
+                 pack.size,         // buffer_data_size
+                 &buffer_pool,      // buffer_pool
+                 max_recursion_depth));
+    pack.buffer = NULL;
+    pack.size = 0;
+    pack.packed_files.clear();
+  }
+
+  // push the packs of all targets
+  static void push_packs(
+        const ingest_targets_t& targets,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue) {
+    for (size_t k=0; k<targets.size(); ++k) {
+      push_pack(*targets[k], whitelist_scan_manager, repository_name,
+                disable_recursive_processing, disable_calculate_entropy,
+                disable_calculate_labels, buffer_pool, job_queue);
+    }
+  }
 
-      // maybe print status
-      if (++i % 1000 == 0) {
-        std::cout << "# Reading size of file " << i
-                  << " of " << filenames.size() << " ...\n";
+  // make room in the packs of all targets for a small file, pushing the
+  // packs first if they are full.  The packs of all targets fill
+  // together.
+  static std::string make_pack_room(
+        const uint64_t filesize,
+        const ingest_targets_t& targets,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue) {
+
+    // make room
+    const file_pack_t& first_pack = targets[0]->pack;
+    if (first_pack.size + filesize > BUFFER_DATA_SIZE ||
+        first_pack.packed_files.size() >= PACKED_FILES_MAX) {
+      push_packs(targets, whitelist_scan_manager, repository_name,
+                 disable_recursive_processing, disable_calculate_entropy,
+                 disable_calculate_labels, buffer_pool, job_queue);
+    }
+    for (size_t k=0; k<targets.size(); ++k) {
+      file_pack_t& pack = targets[k]->pack;
+      if (pack.buffer == NULL) {
+        // blocks while all pool buffers are in use
+        pack.buffer = buffer_pool.acquire();
+        if (pack.buffer == NULL) {
+          return "bad memory allocation";
+        }
       }
+    }
+    return "";
+  }
 
-      // append size to total
-      const hasher::file_reader_t file_reader(*it);
-      total_bytes += file_reader.filesize;
+  // add the small file read to the end of the first pack to the packs of
+  // all targets
+  static void add_packed_file(
+        const std::string& filename,
+        const uint64_t filesize,
+        const size_t bytes_read,
+        const ingest_targets_t& targets,
+        const std::string& repository_name,
+        hasher::ingest_cache_t* const ingest_cache) {
+
+    // define the file type, currently not defined
+    const std::string file_type = "";
+
+    // get the source file hash
+    const file_pack_t& first_pack = targets[0]->pack;
+    const uint8_t* const file_buffer = first_pack.buffer + first_pack.size;
+    hasher::hash_calculator_t hash_calculator;
+    const std::string file_hash = hash_calculator.calculate(
+                                  file_buffer, bytes_read, 0, bytes_read);
+    if (ingest_cache != NULL) {
+      ingest_cache->update(filename, file_hash);
     }
 
-    if (i > 1000) {
-        std::cout << "# Done reading file sizes, total size is " << total_bytes << "\n";
+    for (size_t k=0; k<targets.size(); ++k) {
+      ingest_target_t& target = *targets[k];
+      file_pack_t& pack = target.pack;
+      if (k > 0) {
+        std::memcpy(pack.buffer + pack.size, file_buffer, bytes_read);
       }
 
-    return total_bytes;
+      // store the source repository name and filename
+      target.import_manager.insert_source_name(file_hash, repository_name,
+                                               filename);
+
+      // add source file information to ingest_tracker, do not re-ingest
+      // hashes from duplicate sources
+      const bool source_added = target.ingest_tracker->add_source(
+                           file_hash, filesize, file_type, 1);
+
+      pack.packed_files.push_back(hasher::packed_file_t(
+                 filename, file_hash, filesize,
+                 pack.size, bytes_read, (source_added == false)));
+      pack.size += bytes_read;
+    }
+  }
+
+  // read a small file into the packs
+  static std::string pack_file(
+        const hasher::file_reader_t& file_reader,
+        const ingest_targets_t& targets,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue,
+        hasher::ingest_cache_t* const ingest_cache) {
+
+    const std::string room_error_message = make_pack_room(
+                 file_reader.filesize, targets, whitelist_scan_manager,
+                 repository_name, disable_recursive_processing,
+                 disable_calculate_entropy, disable_calculate_labels,
+                 buffer_pool, job_queue);
+    if (room_error_message.size() > 0) {
+      return room_error_message;
+    }
+
+    // read the file into the first pack
+    const file_pack_t& first_pack = targets[0]->pack;
+    uint8_t* const file_buffer = first_pack.buffer + first_pack.size;
+    size_t bytes_read;
+    const uint64_t read_start = hashdb::stage_clock_ns();
+    const std::string read_error_message = file_reader.read(
+              0, file_buffer, static_cast<size_t>(file_reader.filesize),
+              &bytes_read);
+    hashdb::stage_record(hashdb::STAGE_READ,
+                         hashdb::stage_clock_ns() - read_start);
+    if (read_error_message.size() > 0) {
+      return read_error_message;
+    }
+
+    add_packed_file(file_reader.filename, file_reader.filesize, bytes_read,
+                    targets, repository_name, ingest_cache);
+    return "";
   }
 
   std::string ingest_file(
         const hasher::file_reader_t& file_reader,
-        hashdb::import_manager_t& import_manager,
-        hasher::ingest_tracker_t& ingest_tracker,
+        const ingest_targets_t& targets,
         const hashdb::scan_manager_t* const whitelist_scan_manager,
         const std::string& repository_name,
-        const size_t step_size,
-        const size_t block_size,
         const bool disable_recursive_processing,
         const bool disable_calculate_entropy,
         const bool disable_calculate_labels,
-        hasher::job_queue_t* const job_queue) {
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue,
+        hasher::ingest_cache_t* const ingest_cache) {
 
     // identify the maximum recursion depth
     size_t max_recursion_depth = 
                     (disable_recursive_processing) ? MAX_RECURSION_DEPTH : 0;
 
-    // create buffer b to read into
-    size_t b_size = (file_reader.filesize <= BUFFER_SIZE) ?
-                          file_reader.filesize : BUFFER_SIZE;
-    uint8_t* b = new (std::nothrow) uint8_t[b_size]();
-    if (b == NULL) {
-      return "bad memory allocation";
+    // define the file type, currently not defined
+    const std::string file_type = "";
+
+    // calculate the number of buffer parts required to process this file
+    const size_t parts_total = (file_reader.filesize + (BUFFER_DATA_SIZE - 1)) /
+                               BUFFER_DATA_SIZE;
+
+    // Each file is read once, hashing each chunk as it is read.  Chunks
+    // of files that fit in the held chunks are pushed once the file hash
+    // is known.  Chunks of larger files are pushed as they are read using
+    // a pending source that is bound to the file hash at the end.  Each
+    // target after the first gets its own copy of each chunk.
+    const bool hold_chunks = (file_reader.filesize <= MAX_HELD_BYTES);
+    std::vector<std::vector<hasher::read_chunk_t> > held_chunks(
+                                                        targets.size());
+    std::vector<hasher::pending_source_t*> pending_sources(targets.size(),
+                                                           NULL);
+    if (!hold_chunks) {
+      for (size_t k=0; k<targets.size(); ++k) {
+        pending_sources[k] = new hasher::pending_source_t(
+                 &targets[k]->import_manager, targets[k]->ingest_tracker,
+                 targets[k]->hashdb_dir, file_reader.filesize,
+                 file_type, parts_total);
+      }
     }
+    size_t parts_pushed = 0;
 
-    // read into buffer b
-    size_t bytes_read;
+    // get a source file hash calculator
+    hasher::hash_calculator_t hash_calculator;
+    hash_calculator.init();
+
+    // read and hash the file
     std::string error_message;
-    error_message = file_reader.read(0, b, b_size, &bytes_read);
+    std::vector<uint8_t> zeros;  // for hashing holes, sized on first use
+    std::vector<hasher::read_chunk_t> chunks(targets.size());
+    {
+      hasher::read_ahead_t read_ahead(file_reader, BUFFER_DATA_SIZE,
+                                      BUFFER_SIZE, READ_AHEAD_CHUNKS,
+                                      buffer_pool);
+      hasher::read_chunk_t chunk;
+      while (read_ahead.next(chunk)) {
+        if (chunk.error_message.size() > 0) {
+          // abort
+          error_message = chunk.error_message;
+          break;
+        }
+
+        // hash the part of the chunk that the next chunk does not repeat
+        const size_t data_size = (chunk.buffer_size > BUFFER_DATA_SIZE)
+                                 ? BUFFER_DATA_SIZE : chunk.buffer_size;
+        if (chunk.is_hole) {
+          // the hole reads as zeros
+          zeros.resize(BUFFER_DATA_SIZE, 0);
+          hash_calculator.update(&zeros[0], zeros.size(), 0, data_size);
+        } else {
+          hash_calculator.update(chunk.buffer, chunk.buffer_size, 0,
+                                 data_size);
+        }
+
+        // copy the chunk for the other targets before any job may
+        // release it
+        chunks[0] = chunk;
+        size_t copied = 1;
+        while (copied < targets.size() &&
+               copy_chunk(chunk, buffer_pool, chunks[copied])) {
+          ++copied;
+        }
+        if (copied < targets.size()) {
+          // abort
+          for (size_t k=0; k<copied; ++k) {
+            release_chunk(chunks[k]);
+          }
+          error_message = "bad memory allocation";
+          break;
+        }
+
+        for (size_t k=0; k<targets.size(); ++k) {
+          if (hold_chunks) {
+            held_chunks[k].push_back(chunks[k]);
+          } else {
+            push_chunk(chunks[k], file_reader.filename,
+                       file_reader.filesize, *targets[k],
+                       whitelist_scan_manager, repository_name,
+                       "", pending_sources[k],
+                       disable_recursive_processing,
+                       disable_calculate_entropy,
+                       disable_calculate_labels, false,
+                       max_recursion_depth, job_queue);
+          }
+        }
+        if (!hold_chunks) {
+          ++parts_pushed;
+        }
+      }
+    }
+
+    // get the source file hash
+    const std::string file_hash = hash_calculator.final();
+
     if (error_message.size() > 0) {
       // abort
-      delete[] b;
+      for (size_t k=0; k<targets.size(); ++k) {
+        for (size_t i=0; i<held_chunks[k].size(); ++i) {
+          release_chunk(held_chunks[k][i]);
+        }
+        if (pending_sources[k] != NULL &&
+            pending_sources[k]->abandon(parts_pushed)) {
+          delete pending_sources[k];
+        }
+      }
       return error_message;
     }
 
+    if (ingest_cache != NULL) {
+      ingest_cache->update(file_reader.filename, file_hash);
+    }
+
+    for (size_t k=0; k<targets.size(); ++k) {
+      ingest_target_t& target = *targets[k];
+
+      // store the source repository name and filename
+      target.import_manager.insert_source_name(file_hash, repository_name,
+                                               file_reader.filename);
+
+      if (pending_sources[k] != NULL) {
+        // the pushed jobs may now add their hashes under the file hash
+        if (pending_sources[k]->bind(file_hash)) {
+          delete pending_sources[k];
+        }
+        continue;
+      }
+
+      // add source file information to ingest_tracker
+      const bool source_added = target.ingest_tracker->add_source(
+                     file_hash, file_reader.filesize, file_type, parts_total);
+
+      // do not re-ingest hashes from duplicate sources
+      const bool disable_ingest_hashes = (source_added == false);
+
+      // push the held file sections onto the job queue
+      for (size_t i=0; i<held_chunks[k].size(); ++i) {
+        push_chunk(held_chunks[k][i], file_reader.filename,
+                   file_reader.filesize, target,
+                   whitelist_scan_manager, repository_name,
+                   file_hash, NULL,
+                   disable_recursive_processing, disable_calculate_entropy,
+                   disable_calculate_labels, disable_ingest_hashes,
+                   max_recursion_depth, job_queue);
+      }
+    }
+    return "";
+  }
+
+  // ingest the file being read from the stream.  Its size is known once
+  // it is read to the end, so its chunks are held until then, or pushed
+  // as they are read using pending sources once they would hold more
+  // than MAX_HELD_BYTES.  expected_size is the size of the file given by
+  // the stream, or 0.
+  static std::string ingest_stream_file(
+        hasher::stream_reader_t& stream_reader,
+        const std::string& filename,
+        const uint64_t expected_size,
+        const ingest_targets_t& targets,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue) {
+
+    // identify the maximum recursion depth
+    size_t max_recursion_depth = 
+                    (disable_recursive_processing) ? MAX_RECURSION_DEPTH : 0;
+
+    // define the file type, currently not defined
+    const std::string file_type = "";
+
+    bool hold_chunks = true;
+    std::vector<std::vector<hasher::read_chunk_t> > held_chunks(
+                                                        targets.size());
+    std::vector<hasher::pending_source_t*> pending_sources(targets.size(),
+                                                           NULL);
+    uint64_t filesize = 0;
+    size_t parts_total = 0;
+    size_t parts_pushed = 0;
+
     // get a source file hash calculator
     hasher::hash_calculator_t hash_calculator;
     hash_calculator.init();
 
-    // hash first buffer b
-    hash_calculator.update(b, b_size, 0, b_size);
+    // read and hash the file
+    std::string error_message;
+    std::vector<hasher::read_chunk_t> chunks(targets.size());
+    hasher::read_chunk_t chunk;
+    while (stream_reader.next_chunk(chunk)) {
+      if (chunk.error_message.size() > 0) {
+        // abort
+        error_message = chunk.error_message;
+        break;
+      }
 
-    // read and hash subsequent buffers in b2
-    if (file_reader.filesize > BUFFER_SIZE) {
+      // hash the part of the chunk that the next chunk does not repeat
+      const size_t data_size = (chunk.buffer_size > BUFFER_DATA_SIZE)
+                               ? BUFFER_DATA_SIZE : chunk.buffer_size;
+      hash_calculator.update(chunk.buffer, chunk.buffer_size, 0, data_size);
+      filesize += data_size;
+      ++parts_total;
 
-      // create b2 to read into
-      uint8_t* b2 = new (std::nothrow) uint8_t[BUFFER_SIZE]();
-      if (b2 == NULL) {
+      // copy the chunk for the other targets before any job may
+      // release it
+      chunks[0] = chunk;
+      size_t copied = 1;
+      while (copied < targets.size() &&
+             copy_chunk(chunk, buffer_pool, chunks[copied])) {
+        ++copied;
+      }
+      if (copied < targets.size()) {
         // abort
-        delete[] b;
-        return "bad memory allocation";
+        for (size_t k=0; k<copied; ++k) {
+          release_chunk(chunks[k]);
+        }
+        error_message = "bad memory allocation";
+        break;
+      }
+      for (size_t k=0; k<targets.size(); ++k) {
+        held_chunks[k].push_back(chunks[k]);
       }
 
-      // read and hash b2 into final source file hash value
-      for (uint64_t offset = BUFFER_SIZE;
-           offset < file_reader.filesize;
-           offset += BUFFER_SIZE) {
+      // once too much is held, push the held chunks and the chunks after
+      // them as they are read
+      if (hold_chunks && filesize > MAX_HELD_BYTES) {
+        hold_chunks = false;
+        for (size_t k=0; k<targets.size(); ++k) {
+          pending_sources[k] = new hasher::pending_source_t(
+                   &targets[k]->import_manager, targets[k]->ingest_tracker,
+                   targets[k]->hashdb_dir, expected_size, file_type, 0);
+        }
+      }
+      if (!hold_chunks) {
+        for (size_t k=0; k<targets.size(); ++k) {
+          for (size_t i=0; i<held_chunks[k].size(); ++i) {
+            push_chunk(held_chunks[k][i], filename, expected_size,
+                       *targets[k], whitelist_scan_manager,
+                       repository_name, "", pending_sources[k],
+                       disable_recursive_processing,
+                       disable_calculate_entropy,
+                       disable_calculate_labels, false,
+                       max_recursion_depth, job_queue);
+          }
+        }
+        parts_pushed += held_chunks[0].size();
+        for (size_t k=0; k<targets.size(); ++k) {
+          held_chunks[k].clear();
+        }
+      }
+    }
 
-        // print status
-        std::stringstream ss;
-        ss << "# Calculating file hash for file " << file_reader.filename
-           << " offset " << offset
-           << " size " << file_reader.filesize
-           << "\n";
-        hashdb::tprint(std::cout, ss.str());
+    // get the source file hash
+    const std::string file_hash = hash_calculator.final();
 
-        // read into b2
-        size_t b2_bytes_read = 0;
-        error_message = file_reader.read(
-                              offset, b2, BUFFER_SIZE, &b2_bytes_read);
-        if (error_message.size() > 0) {
-          // abort
-          delete[] b2;
-          delete[] b;
-          return error_message;
+    if (error_message.size() > 0) {
+      // abort
+      for (size_t k=0; k<targets.size(); ++k) {
+        for (size_t i=0; i<held_chunks[k].size(); ++i) {
+          release_chunk(held_chunks[k][i]);
+        }
+        if (pending_sources[k] != NULL &&
+            pending_sources[k]->abandon(parts_pushed)) {
+          delete pending_sources[k];
         }
+      }
+      return error_message;
+    }
+
+    if (filesize == 0) {
+      std::stringstream ss;
+      ss << "# Skipping file " << filename << " size 0\n";
+      hashdb::tprint(std::cout, ss.str());
+      return "";
+    }
 
-        // hash b2 into final source file hash value
-        hash_calculator.update(b2, BUFFER_SIZE, 0, b2_bytes_read);
+    for (size_t k=0; k<targets.size(); ++k) {
+      ingest_target_t& target = *targets[k];
+
+      // store the source repository name and filename
+      target.import_manager.insert_source_name(file_hash, repository_name,
+                                               filename);
+
+      if (pending_sources[k] != NULL) {
+        // the pushed jobs may now add their hashes under the file hash
+        pending_sources[k]->set_size(filesize, parts_pushed);
+        if (pending_sources[k]->bind(file_hash)) {
+          delete pending_sources[k];
+        }
+        continue;
       }
 
-      delete[] b2;
+      // add source file information to ingest_tracker
+      const bool source_added = target.ingest_tracker->add_source(
+                     file_hash, filesize, file_type, parts_total);
+
+      // do not re-ingest hashes from duplicate sources
+      const bool disable_ingest_hashes = (source_added == false);
+
+      // push the held file sections onto the job queue
+      for (size_t i=0; i<held_chunks[k].size(); ++i) {
+        push_chunk(held_chunks[k][i], filename, filesize, target,
+                   whitelist_scan_manager, repository_name,
+                   file_hash, NULL,
+                   disable_recursive_processing, disable_calculate_entropy,
+                   disable_calculate_labels, disable_ingest_hashes,
+                   max_recursion_depth, job_queue);
+      }
     }
+    return "";
+  }
 
-    // get the source file hash
-    const std::string file_hash = hash_calculator.final();
+  // see if whitelist_dir is present, making sure its hashes are
+  // comparable with ingested hashes
+  static std::string check_whitelist(const std::string& whitelist_dir,
+                           const std::vector<hashdb::settings_t>& settings,
+                           bool& has_whitelist) {
+    has_whitelist = false;
+    hashdb::settings_t whitelist_settings;
+    if (hashdb::read_settings(whitelist_dir, whitelist_settings).size()
+                                                                != 0) {
+      // no whitelist
+      return "";
+    }
+    for (size_t k=0; k<settings.size(); ++k) {
+      if (whitelist_settings.block_hash_algorithm !=
+                                     settings[k].block_hash_algorithm) {
+        return "Whitelist block hash algorithm '" +
+               whitelist_settings.block_hash_algorithm +
+               "' does not match block hash algorithm '" +
+               settings[k].block_hash_algorithm + "'.";
+      }
+    }
+    has_whitelist = true;
+    return "";
+  }
 
-    // store the source repository name and filename
-    import_manager.insert_source_name(file_hash, repository_name,
-                                      file_reader.filename);
+  // ingest the files into the targets, hashing with num_cpus threads.
+  // Checkpoint and ingest_cache may be NULL.
+  static void ingest_filenames(
+        ingest_targets_t& targets,
+        const hasher::filenames_t& filenames,
+        const uint64_t total_bytes,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        const bool skip_nonprobative,
+        const bool direct_reads,
+        const bool quiet,
+        const bool report_progress,
+        const size_t num_cpus,
+        hasher::checkpoint_t* const checkpoint,
+        hasher::ingest_cache_t* const ingest_cache) {
 
-    // define the file type, currently not defined
-    const std::string file_type = "";
+    // create the ingest_trackers, the first reports progress for all
+    for (size_t k=0; k<targets.size(); ++k) {
+      targets[k]->ingest_tracker = new hasher::ingest_tracker_t(
+               &targets[k]->import_manager, total_bytes, quiet,
+               report_progress && (k == 0), skip_nonprobative,
+               (k == 0) ? ingest_cache : NULL);
+    }
 
-    // calculate the number of buffer parts required to process this file
-    const size_t parts_total = (file_reader.filesize + (BUFFER_DATA_SIZE - 1)) /
-                               BUFFER_DATA_SIZE;
+    // write block hashes from one writer thread per hash database so
+    // hasher threads do not wait on LMDB, allowing one waiting batch per
+    // hasher thread
+    for (size_t k=0; k<targets.size(); ++k) {
+      targets[k]->import_manager.set_async_insert(num_cpus);
+    }
+
+    // create the job queue to hold 2X more jobs than threads
+    // Note: 2X is arbitrary.  The idea is to always have work available
+    // but not to unnecessarily fill up RAM with buffers.
+    hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
 
-    // add source file information to ingest_tracker
-    const bool source_added = ingest_tracker.add_source(file_hash,
-                           file_reader.filesize, file_type, parts_total);
+    // create the buffer pool to hold buffers for queued jobs, jobs being
+    // processed, chunks read ahead or being read by each E01 reader, and
+    // held chunks and packs, with copies for each target after the first.
+    // All but the queued and processed jobs are held by the reader.
+    hasher::buffer_pool_t buffer_pool(BUFFER_SIZE, READ_AHEAD_CHUNKS + 2 +
+                targets.size() * (num_cpus * 4 + 1 +
+                MAX_HELD_BYTES / BUFFER_DATA_SIZE),
+                READ_AHEAD_CHUNKS + 2 +
+                targets.size() * (1 + MAX_HELD_BYTES / BUFFER_DATA_SIZE));
 
-    // do not re-ingest hashes from duplicate sources
-    const bool disable_ingest_hashes = (source_added == false);
+    // create the threadpool that will process jobs until done_adding
+    hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(num_cpus, job_queue);
 
-    // build buffers from file sections and push them onto the job queue
+    // iterate over files, opening them ahead and packing small files
+    // into shared jobs
+    hasher::open_ahead_t open_ahead(filenames, OPEN_AHEAD_THREADS,
+                                    OPEN_AHEAD_FILES, BUFFER_DATA_SIZE,
+                                    direct_reads);
+    hasher::file_reader_t* opened_file_reader;
+    while (open_ahead.next(opened_file_reader)) {
+      const hasher::file_reader_t& file_reader = *opened_file_reader;
 
-    // push buffer b onto the job queue
-    size_t b_data_size = (b_size > BUFFER_DATA_SIZE)
-                         ? BUFFER_DATA_SIZE : b_size;
-    job_queue->push(hasher::job_t::new_ingest_job(
-                 &import_manager,
-                 &ingest_tracker,
-                 whitelist_scan_manager,
+      if (file_reader.error_message.size() == 0) {
+
+        // only process when file size > 0
+        if (file_reader.filesize > 0) {
+          const bool is_packed = (file_reader.filesize <= PACKED_FILE_SIZE &&
+                 file_reader.file_reader_type == hasher::SINGLE);
+          std::string success = (is_packed) ? pack_file(
+                 file_reader, targets, whitelist_scan_manager,
                  repository_name,
-                 step_size,
-                 block_size,
-                 file_hash,
-                 file_reader.filename,
-                 file_reader.filesize,
-                 0,      // file_offset
                  disable_recursive_processing,
                  disable_calculate_entropy,
                  disable_calculate_labels,
-                 disable_ingest_hashes,
-                 b,      // buffer
-                 b_size, // buffer_size
-                 b_data_size, // buffer_data_size,
-                 max_recursion_depth,
-                 0,      // recursion_depth
-                 ""));   // recursion path
+                 buffer_pool,
+                 job_queue,
+                 ingest_cache) : ingest_file(
+                 file_reader, targets, whitelist_scan_manager,
+                 repository_name,
+                 disable_recursive_processing,
+                 disable_calculate_entropy,
+                 disable_calculate_labels,
+                 buffer_pool,
+                 job_queue,
+                 ingest_cache);
+          if (success.size() > 0) {
+            std::stringstream ss;
+            ss << "# Error while importing file " << file_reader.filename
+               << ", " << file_reader.error_message << "\n";
+            hashdb::tprint(std::cout, ss.str());
+          }
 
-    // read and push remaining buffers onto the job queue
-    for (uint64_t offset = BUFFER_DATA_SIZE;
-         offset < file_reader.filesize;
-         offset += BUFFER_DATA_SIZE) {
+        } else {
+          std::stringstream ss;
+          ss << "# Skipping file " << file_reader.filename
+             << " size " << file_reader.filesize << "\n";
+          hashdb::tprint(std::cout, ss.str());
+        }
+      } else {
+        // this file could not be opened
+        std::stringstream ss;
+        ss << "# Unable to import file: " << file_reader.error_message << "\n";
+        hashdb::tprint(std::cout, ss.str());
+      }
 
-      // create b2 to read into
-      uint8_t* b2 = new (std::nothrow) uint8_t[BUFFER_SIZE]();
-      if (b2 == NULL) {
-        // abort
-        return "bad memory allocation";
+      // maybe checkpoint, once all work through this file is on disk
+      if (checkpoint != NULL && checkpoint->is_due()) {
+        push_packs(targets, whitelist_scan_manager, repository_name,
+                   disable_recursive_processing, disable_calculate_entropy,
+                   disable_calculate_labels, buffer_pool, job_queue);
+        threadpool->wait_idle();
+        for (size_t k=0; k<targets.size(); ++k) {
+          targets[k]->import_manager.sync();
+        }
+        std::string error_message =
+                       (ingest_cache != NULL) ? ingest_cache->write() : "";
+        if (error_message.size() == 0) {
+          checkpoint->done = file_reader.filename;
+          error_message = checkpoint->write();
+        }
+        if (error_message.size() != 0) {
+          std::stringstream ss;
+          ss << "# Checkpoint not taken: " << error_message << "\n";
+          hashdb::tprint(std::cout, ss.str());
+        }
       }
+      delete opened_file_reader;
+    }
 
-      // read into b2
-      size_t b2_bytes_read = 0;
-      error_message = file_reader.read(
-                                  offset, b2, BUFFER_SIZE, &b2_bytes_read);
-      if (error_message.size() > 0) {
-        // abort submitting jobs for this file
-        delete[] b2;
-        return error_message;
+    // push the last packed files
+    push_packs(targets, whitelist_scan_manager, repository_name,
+               disable_recursive_processing, disable_calculate_entropy,
+               disable_calculate_labels, buffer_pool, job_queue);
+
+    // done
+    job_queue->done_adding();
+    delete threadpool;
+    delete job_queue;
+  }
+
+  // ingest the files of the stream into the targets, hashing with
+  // num_cpus threads.  Returns "" else the reason the stream could not
+  // be read to the end.
+  static std::string ingest_stream_files(
+        ingest_targets_t& targets,
+        const int fd,
+        const std::string& stream_name,
+        const hashdb::scan_manager_t* const whitelist_scan_manager,
+        const std::string& repository_name,
+        const bool disable_recursive_processing,
+        const bool disable_calculate_entropy,
+        const bool disable_calculate_labels,
+        const bool skip_nonprobative,
+        const bool quiet,
+        const size_t num_cpus) {
+
+    // create the ingest_trackers, the total number of bytes is not known
+    for (size_t k=0; k<targets.size(); ++k) {
+      targets[k]->ingest_tracker = new hasher::ingest_tracker_t(
+               &targets[k]->import_manager, 0, quiet, (k == 0),
+               skip_nonprobative);
+      targets[k]->import_manager.set_async_insert(num_cpus);
+    }
+
+    // the job queue, buffer pool, and threadpool are as for
+    // ingest_filenames, where the stream reader takes the place of the
+    // read ahead chunks
+    hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
+    hasher::buffer_pool_t buffer_pool(BUFFER_SIZE, READ_AHEAD_CHUNKS + 2 +
+                targets.size() * (num_cpus * 4 + 1 +
+                MAX_HELD_BYTES / BUFFER_DATA_SIZE),
+                READ_AHEAD_CHUNKS + 2 +
+                targets.size() * (1 + MAX_HELD_BYTES / BUFFER_DATA_SIZE));
+    hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(num_cpus, job_queue);
+
+    // read the files in stream order, packing small tar members into
+    // shared jobs
+    hasher::stream_reader_t stream_reader(fd, stream_name, BUFFER_DATA_SIZE,
+                                          BUFFER_SIZE, buffer_pool);
+    std::string filename;
+    uint64_t filesize;
+    bool size_known;
+    while (stream_reader.next_file(filename, filesize, size_known)) {
+      if (size_known && filesize == 0) {
+        std::stringstream ss;
+        ss << "# Skipping file " << filename << " size 0\n";
+        hashdb::tprint(std::cout, ss.str());
+        continue;
       }
 
-      // push this buffer b2 onto the job queue
-      size_t b2_data_size = (b2_bytes_read > BUFFER_DATA_SIZE)
-                                        ? BUFFER_DATA_SIZE : b2_bytes_read;
-      job_queue->push(hasher::job_t::new_ingest_job(
-                 &import_manager,
-                 &ingest_tracker,
-                 whitelist_scan_manager,
-                 repository_name,
-                 step_size,
-                 block_size,
-                 file_hash,
-                 file_reader.filename,
-                 file_reader.filesize,
-                 offset,  // file_offset
-                 disable_recursive_processing,
-                 disable_calculate_entropy,
-                 disable_calculate_labels,
-                 disable_ingest_hashes,
-                 b2,      // buffer
-                 b2_bytes_read, // buffer_size
-                 b2_data_size,  // buffer_data_size
-                 max_recursion_depth,
-                 0,      // recursion_depth
-                 ""));   // recursion path
+      std::string error_message;
+      if (size_known && filesize <= PACKED_FILE_SIZE) {
+        error_message = make_pack_room(filesize, targets,
+                 whitelist_scan_manager, repository_name,
+                 disable_recursive_processing, disable_calculate_entropy,
+                 disable_calculate_labels, buffer_pool, job_queue);
+        size_t bytes_read = 0;
+        if (error_message.size() == 0) {
+          const file_pack_t& first_pack = targets[0]->pack;
+          error_message = stream_reader.read_file(
+                          first_pack.buffer + first_pack.size, &bytes_read);
+        }
+        if (error_message.size() == 0) {
+          add_packed_file(filename, filesize, bytes_read, targets,
+                          repository_name, NULL);
+        }
+      } else {
+        error_message = ingest_stream_file(stream_reader, filename,
+                 filesize, targets, whitelist_scan_manager,
+                 repository_name, disable_recursive_processing,
+                 disable_calculate_entropy, disable_calculate_labels,
+                 buffer_pool, job_queue);
+      }
+      if (error_message.size() > 0) {
+        std::stringstream ss;
+        ss << "# Error while importing file " << filename
+           << ", " << error_message << "\n";
+        hashdb::tprint(std::cout, ss.str());
+      }
     }
-    return "";
+
+    // push the last packed files
+    push_packs(targets, whitelist_scan_manager, repository_name,
+               disable_recursive_processing, disable_calculate_entropy,
+               disable_calculate_labels, buffer_pool, job_queue);
+
+    // done
+    job_queue->done_adding();
+    delete threadpool;
+    delete job_queue;
+    return stream_reader.get_error_message();
   }
 
   // ************************************************************
@@ -275,26 +1023,60 @@ namespace hashdb {
   std::string ingest(const std::string& hashdb_dir,
                      const std::string& ingest_path,
                      const size_t step_size,
+                     const std::string& repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& cmd,
+                     const ingest_options_t& options) {
+    return ingest_multiple(std::vector<std::string>(1, hashdb_dir),
+                           std::vector<size_t>(1, step_size), ingest_path,
+                           repository_name, whitelist_dir,
+                           disable_recursive_processing,
+                           disable_calculate_entropy,
+                           disable_calculate_labels, cmd, options);
+  }
+
+  // ************************************************************
+  // ingest_multiple
+  // ************************************************************
+  std::string ingest_multiple(const std::vector<std::string>& hashdb_dirs,
+                     const std::vector<size_t>& step_sizes,
+                     const std::string& ingest_path,
                      const std::string& p_repository_name,
                      const std::string& whitelist_dir,
                      const bool disable_recursive_processing,
                      const bool disable_calculate_entropy,
                      const bool disable_calculate_labels,
-                     const std::string& cmd) {
+                     const std::string& cmd,
+                     const ingest_options_t& options) {
 
     bool has_whitelist = false;
     hashdb::scan_manager_t* whitelist_scan_manager = NULL;
 
-    // make sure hashdb_dir is there
+    if (hashdb_dirs.size() == 0) {
+      return "No hash database to ingest into.";
+    }
+    if (step_sizes.size() != hashdb_dirs.size()) {
+      return "There must be one step size for each hash database.";
+    }
+    if (options.skip_unchanged && hashdb_dirs.size() > 1) {
+      return "Skipping unchanged files requires a single hash database.";
+    }
+
+    // make sure each hashdb_dir is there
     std::string error_message;
-    hashdb::settings_t settings;
-    error_message = hashdb::read_settings(hashdb_dir, settings);
-    if (error_message.size() != 0) {
-      return error_message;
+    std::vector<hashdb::settings_t> settings(hashdb_dirs.size());
+    for (size_t k=0; k<hashdb_dirs.size(); ++k) {
+      error_message = hashdb::read_settings(hashdb_dirs[k], settings[k]);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
     }
 
     // make sure file or directory at ingest_path is readable
-    if (access(hashdb_dir.c_str(), F_OK) != 0) {
+    if (access(hashdb_dirs[0].c_str(), F_OK) != 0) {
       return "Invalid ingest path '" + ingest_path + "'.";
     }
 
@@ -303,96 +1085,396 @@ namespace hashdb {
             (p_repository_name.size() > 0) ? p_repository_name : ingest_path;
 
     // see if whitelist_dir is present
-    error_message = hashdb::read_settings(whitelist_dir, settings);
-    if (error_message.size() == 0) {
-      has_whitelist = true;
-    } else {
-      // no whitelist
-      error_message = "";
+    error_message = check_whitelist(whitelist_dir, settings, has_whitelist);
+    if (error_message.size() != 0) {
+      return error_message;
     }
 
-    // open import manager
-    hashdb::import_manager_t import_manager(hashdb_dir, cmd);
+    // open import managers
+    ingest_targets_t targets;
+    for (size_t k=0; k<hashdb_dirs.size(); ++k) {
+      targets.push_back(new ingest_target_t(hashdb_dirs[k], step_sizes[k],
+                                            settings[k], cmd));
+      targets[k]->import_manager.set_batch(HASH_BATCH_SIZE,
+                                           HASH_BATCH_MILLISECONDS);
+    }
+    hashdb::import_manager_t& import_manager = targets[0]->import_manager;
 
-    // get the list of filenames to be processed
+    // get the list of filenames to be processed and the total number of
+    // bytes that will be processed
     hasher::filenames_t filenames;
-    error_message = hasher::filename_list(ingest_path, &filenames);
+    uint64_t total_bytes = 0;
+    error_message = hasher::filename_list(ingest_path, &filenames,
+                                          &total_bytes);
     if (error_message.size() != 0) {
+      close_targets(targets);
       return error_message;
     }
 
-    // calculate the total number of bytes that will be processed
-    uint64_t total_bytes = calculate_total_bytes(filenames);
+    // maybe resume after the last file of an interrupted ingest
+    hasher::checkpoint_t* const checkpoint =
+                 (options.checkpoint_file.size() > 0) ?
+                 new hasher::checkpoint_t(options.checkpoint_file,
+                            CHECKPOINT_SECONDS, "ingest", ingest_path) : NULL;
+    if (checkpoint != NULL && options.resume) {
+      error_message = checkpoint->read();
+      if (error_message.size() != 0) {
+        delete checkpoint;
+        close_targets(targets);
+        return error_message;
+      }
+      const hasher::filenames_t::iterator done_end = filenames.upper_bound(
+                                     hasher::utf8_to_native(checkpoint->done));
+      size_t num_done = 0;
+      for (hasher::filenames_t::iterator it = filenames.begin();
+           it != done_end; ++it) {
+        uint64_t filesize = 0;
+        hasher::get_filesize_by_filename(*it, &filesize);
+        total_bytes -= (filesize < total_bytes) ? filesize : total_bytes;
+        ++num_done;
+      }
+      filenames.erase(filenames.begin(), done_end);
+      std::stringstream ss;
+      ss << "# Resuming after " << num_done << " files ingested through "
+         << checkpoint->done << "\n";
+      hashdb::tprint(std::cout, ss.str());
+    }
 
-    // create the ingest_tracker
-    hasher::ingest_tracker_t ingest_tracker(&import_manager, total_bytes);
+    // maybe skip files that are unchanged since they were last ingested,
+    // attributing them to this repository without reading them
+    hasher::ingest_cache_t* const ingest_cache = (options.skip_unchanged) ?
+                              new hasher::ingest_cache_t(hashdb_dirs[0]) : NULL;
+    if (ingest_cache != NULL) {
+      size_t num_unchanged = 0;
+      for (hasher::filenames_t::iterator it = filenames.begin();
+           it != filenames.end(); ) {
+        hasher::ingest_cache_t::members_t members;
+        const std::string file_hash = ingest_cache->lookup(*it, &members);
+        if (file_hash.size() == 0) {
+          ++it;
+          continue;
+        }
+        uint64_t filesize = 0;
+        hasher::get_filesize_by_filename(*it, &filesize);
+        const std::string filename = hasher::native_to_utf8(*it);
+        import_manager.insert_source_name(file_hash, repository_name,
+                                          filename);
+        for (hasher::ingest_cache_t::members_t::const_iterator member_it =
+                    members.begin(); member_it != members.end(); ++member_it) {
+          import_manager.insert_source_name(member_it->first, repository_name,
+                                      filename + "-" + member_it->second);
+        }
+        total_bytes -= (filesize < total_bytes) ? filesize : total_bytes;
+        ++num_unchanged;
+        filenames.erase(it++);
+      }
+      std::stringstream ss;
+      ss << "# Skipping " << num_unchanged << " unchanged files\n";
+      hashdb::tprint(std::cout, ss.str());
+    }
 
     // maybe open whitelist DB
     if (has_whitelist) {
       whitelist_scan_manager = new scan_manager_t(whitelist_dir);
     }
 
-    // get the number of CPUs
-    const size_t num_cpus = hashdb::numCPU();
+    // ingest the files, caching them only if their members are found
+    ingest_filenames(targets, filenames, total_bytes, whitelist_scan_manager,
+                     repository_name, disable_recursive_processing,
+                     disable_calculate_entropy, disable_calculate_labels,
+                     options.skip_nonprobative, options.direct_reads,
+                     options.quiet, true, hashdb::numCPU(), checkpoint,
+                     (disable_recursive_processing) ? NULL : ingest_cache);
 
-    // create the job queue to hold 2X more jobs than threads
-    // Note: 2X is arbitrary.  The idea is to always have work available
-    // but not to unnecessarily fill up RAM with buffers.
-    hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
+    if (has_whitelist) {
+      delete whitelist_scan_manager;
+    }
 
-    // create the threadpool that will process jobs until job_queue.is_done
-    hasher::threadpool_t* const threadpool =
-                               new hasher::threadpool_t(num_cpus, job_queue);
+    // remember the files ingested
+    if (ingest_cache != NULL) {
+      error_message = ingest_cache->write();
+      delete ingest_cache;
+      if (error_message.size() != 0) {
+        delete checkpoint;
+        close_targets(targets);
+        return error_message;
+      }
+    }
+
+    // the ingest is complete so there is nothing to resume
+    if (checkpoint != NULL) {
+      for (size_t k=0; k<targets.size(); ++k) {
+        targets[k]->import_manager.sync();
+      }
+      checkpoint->remove();
+      delete checkpoint;
+    }
+    close_targets(targets);
 
-    // iterate over files
-    for (hasher::filenames_t::const_iterator it=filenames.begin();
-                                           it != filenames.end(); it++) {
-      const hasher::file_reader_t file_reader(*it);
+    // success
+    return "";
+  }
 
-      if (file_reader.error_message.size() == 0) {
+  // ************************************************************
+  // ingest_stream
+  // ************************************************************
+  std::string ingest_stream(const std::vector<std::string>& hashdb_dirs,
+                     const std::vector<size_t>& step_sizes,
+                     const int fd,
+                     const std::string& stream_name,
+                     const std::string& p_repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& cmd,
+                     const ingest_options_t& options) {
 
-        // only process when file size > 0
-        if (file_reader.filesize > 0) {
-          std::string success = ingest_file(
-                 file_reader, import_manager, ingest_tracker,
-                 whitelist_scan_manager,
-                 repository_name, step_size, settings.block_size,
-                 disable_recursive_processing,
-                 disable_calculate_entropy,
-                 disable_calculate_labels,
-                 job_queue);
-          if (success.size() > 0) {
-            std::stringstream ss;
-            ss << "# Error while importing file " << file_reader.filename
-               << ", " << file_reader.error_message << "\n";
-            hashdb::tprint(std::cout, ss.str());
-          }
+    if (hashdb_dirs.size() == 0) {
+      return "No hash database to ingest into.";
+    }
+    if (step_sizes.size() != hashdb_dirs.size()) {
+      return "There must be one step size for each hash database.";
+    }
+    if (options.skip_unchanged || options.direct_reads ||
+        options.checkpoint_file.size() > 0) {
+      return "A stream is ingested without skipping unchanged files, "
+             "direct reads, or checkpoints.";
+    }
 
-        } else {
-          std::stringstream ss;
-          ss << "# Skipping file " << file_reader.filename
-             << " size " << file_reader.filesize << "\n";
-          hashdb::tprint(std::cout, ss.str());
-        }
-      } else {
-        // this file could not be opened
-        std::stringstream ss;
-        ss << "# Unable to import file: " << file_reader.error_message << "\n";
-        hashdb::tprint(std::cout, ss.str());
+    // make sure each hashdb_dir is there
+    std::string error_message;
+    std::vector<hashdb::settings_t> settings(hashdb_dirs.size());
+    for (size_t k=0; k<hashdb_dirs.size(); ++k) {
+      error_message = hashdb::read_settings(hashdb_dirs[k], settings[k]);
+      if (error_message.size() != 0) {
+        return error_message;
       }
     }
 
-    // done
-    job_queue->done_adding();
-    delete threadpool;
-    delete job_queue;
-    if (has_whitelist) {
-      delete whitelist_scan_manager;
+    // establish repository_name
+    const std::string repository_name =
+            (p_repository_name.size() > 0) ? p_repository_name : stream_name;
+
+    // see if whitelist_dir is present
+    bool has_whitelist = false;
+    error_message = check_whitelist(whitelist_dir, settings, has_whitelist);
+    if (error_message.size() != 0) {
+      return error_message;
     }
 
+    // open import managers
+    ingest_targets_t targets;
+    for (size_t k=0; k<hashdb_dirs.size(); ++k) {
+      targets.push_back(new ingest_target_t(hashdb_dirs[k], step_sizes[k],
+                                            settings[k], cmd));
+      targets[k]->import_manager.set_batch(HASH_BATCH_SIZE,
+                                           HASH_BATCH_MILLISECONDS);
+    }
+
+    // maybe open whitelist DB
+    hashdb::scan_manager_t* const whitelist_scan_manager = (has_whitelist) ?
+                              new scan_manager_t(whitelist_dir) : NULL;
+
+    // ingest the files of the stream
+    error_message = ingest_stream_files(targets, fd, stream_name,
+                     whitelist_scan_manager, repository_name,
+                     disable_recursive_processing, disable_calculate_entropy,
+                     disable_calculate_labels, options.skip_nonprobative,
+                     options.quiet, hashdb::numCPU());
+
+    delete whitelist_scan_manager;
+    close_targets(targets);
+    return error_message;
+  }
+
+  // ************************************************************
+  // ingest_staged
+  // ************************************************************
+  // one of the writers of ingest_staged, ingesting its range of the files
+  // into its own staging hash database on its own thread
+  class staged_writer_t {
+    private:
+    // do not allow copy or assignment
+    staged_writer_t(const staged_writer_t&);
+    staged_writer_t& operator=(const staged_writer_t&);
+
+    const hashdb::scan_manager_t* const whitelist_scan_manager;
+    const std::string repository_name;
+    const bool disable_recursive_processing;
+    const bool disable_calculate_entropy;
+    const bool disable_calculate_labels;
+    const bool skip_nonprobative;
+    const bool direct_reads;
+    const bool quiet;
+    const bool report_progress;
+    const size_t num_cpus;
+    pthread_t thread;
+
+    static void* run(void* const arg) {
+      staged_writer_t& writer = *static_cast<staged_writer_t*>(arg);
+      ingest_filenames(writer.targets, writer.filenames, writer.total_bytes,
+                       writer.whitelist_scan_manager, writer.repository_name,
+                       writer.disable_recursive_processing,
+                       writer.disable_calculate_entropy,
+                       writer.disable_calculate_labels,
+                       writer.skip_nonprobative, writer.direct_reads,
+                       writer.quiet, writer.report_progress, writer.num_cpus,
+                       NULL, NULL);
+      return NULL;
+    }
+
+    public:
+    ingest_targets_t targets;
+    hasher::filenames_t filenames;
+    uint64_t total_bytes;
+
+    staged_writer_t(const std::string& staging_dir,
+                    const size_t step_size,
+                    const hashdb::settings_t& settings,
+                    const hashdb::scan_manager_t* const
+                                               p_whitelist_scan_manager,
+                    const std::string& p_repository_name,
+                    const bool p_disable_recursive_processing,
+                    const bool p_disable_calculate_entropy,
+                    const bool p_disable_calculate_labels,
+                    const bool p_skip_nonprobative,
+                    const bool p_direct_reads,
+                    const bool p_quiet,
+                    const bool p_report_progress,
+                    const size_t p_num_cpus,
+                    const std::string& cmd) :
+          whitelist_scan_manager(p_whitelist_scan_manager),
+          repository_name(p_repository_name),
+          disable_recursive_processing(p_disable_recursive_processing),
+          disable_calculate_entropy(p_disable_calculate_entropy),
+          disable_calculate_labels(p_disable_calculate_labels),
+          skip_nonprobative(p_skip_nonprobative),
+          direct_reads(p_direct_reads),
+          quiet(p_quiet), report_progress(p_report_progress),
+          num_cpus(p_num_cpus), thread(), targets(), filenames(),
+          total_bytes(0) {
+      targets.push_back(new ingest_target_t(staging_dir, step_size,
+                                            settings, cmd));
+      targets[0]->import_manager.set_batch(HASH_BATCH_SIZE,
+                                           HASH_BATCH_MILLISECONDS);
+    }
+
+    ~staged_writer_t() {
+      close_targets(targets);
+    }
+
+    void start() {
+      if (pthread_create(&thread, NULL, staged_writer_t::run, this) != 0) {
+        std::cerr << "Unable to start staging writer thread.\n";
+        assert(0);
+      }
+    }
+
+    void join() {
+      pthread_join(thread, NULL);
+    }
+  };
+
+  std::string ingest_staged(const std::vector<std::string>& staging_dirs,
+                     const std::string& ingest_path,
+                     const size_t step_size,
+                     const std::string& p_repository_name,
+                     const std::string& whitelist_dir,
+                     const bool disable_recursive_processing,
+                     const bool disable_calculate_entropy,
+                     const bool disable_calculate_labels,
+                     const std::string& cmd,
+                     const ingest_options_t& options) {
+
+    if (staging_dirs.size() == 0) {
+      return "No staging hash database to ingest into.";
+    }
+    if (options.skip_unchanged || options.checkpoint_file.size() > 0) {
+      return "A staged ingest is made without skipping unchanged files "
+             "or checkpoints.";
+    }
+
+    // make sure each staging_dir is there
+    std::string error_message;
+    std::vector<hashdb::settings_t> settings(staging_dirs.size());
+    for (size_t k=0; k<staging_dirs.size(); ++k) {
+      error_message = hashdb::read_settings(staging_dirs[k], settings[k]);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+    }
+
+    // establish repository_name
+    const std::string repository_name =
+            (p_repository_name.size() > 0) ? p_repository_name : ingest_path;
+
+    // see if whitelist_dir is present
+    bool has_whitelist = false;
+    error_message = check_whitelist(whitelist_dir, settings, has_whitelist);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // get the list of filenames to be processed and the total number of
+    // bytes that will be processed
+    hasher::filenames_t filenames;
+    uint64_t total_bytes = 0;
+    error_message = hasher::filename_list(ingest_path, &filenames,
+                                          &total_bytes);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // maybe open whitelist DB
+    hashdb::scan_manager_t* const whitelist_scan_manager = (has_whitelist) ?
+                              new scan_manager_t(whitelist_dir) : NULL;
+
+    // the hashing threads are divided among the writers
+    const size_t num_writers = staging_dirs.size();
+    const size_t all_cpus = hashdb::numCPU();
+    const size_t num_cpus = (all_cpus > num_writers) ?
+                             all_cpus / num_writers : 1;
+
+    // give each writer a run of files in name order holding about the
+    // same number of bytes, the first writer reporting progress for its
+    // run
+    std::vector<staged_writer_t*> writers;
+    for (size_t k=0; k<num_writers; ++k) {
+      writers.push_back(new staged_writer_t(staging_dirs[k], step_size,
+                 settings[k], whitelist_scan_manager, repository_name,
+                 disable_recursive_processing, disable_calculate_entropy,
+                 disable_calculate_labels, options.skip_nonprobative,
+                 options.direct_reads, options.quiet, (k == 0), num_cpus,
+                 cmd));
+    }
+    uint64_t bytes_assigned = 0;
+    size_t k = 0;
+    for (hasher::filenames_t::const_iterator it = filenames.begin();
+         it != filenames.end(); ++it) {
+      while (k + 1 < num_writers &&
+             bytes_assigned >= total_bytes / num_writers * (k + 1)) {
+        ++k;
+      }
+      uint64_t filesize = 0;
+      hasher::get_filesize_by_filename(*it, &filesize);
+      writers[k]->filenames.insert(*it);
+      writers[k]->total_bytes += filesize;
+      bytes_assigned += filesize;
+    }
+
+    // ingest each run into its staging hash database in parallel
+    for (k=0; k<num_writers; ++k) {
+      writers[k]->start();
+    }
+    for (k=0; k<num_writers; ++k) {
+      writers[k]->join();
+      delete writers[k];
+    }
+    delete whitelist_scan_manager;
+
     // success
     return "";
   }
 
 } // end namespace hashdb
-
@@ -0,0 +1,338 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Remembers the file hash of each ingested file by its path, size,
+ * modification time, and inode so that an ingest into the same
+ * database can skip files that have not changed since they were
+ * ingested without reading them.
+ *
+ * The cache also remembers the file hash and recursion path of each
+ * member found by recursive processing, such as the files in a zip, so
+ * that a skipped file still gets the source names of its members.
+ *
+ * The cache is stored as text in hashdb_dir/ingest_cache.txt, one file
+ * per line: file hash in hex, size, mtime in nanoseconds, inode, then the
+ * absolute path.  Each member follows its file on a line of its own: a
+ * tab, the member file hash in hex, a tab, then the recursion path.
+ * It is only written after ingest completes, so every file it names was
+ * fully ingested.  lookup() and update() are used from the thread that
+ * reads the files, add_member() from the hasher threads.
+ */
+
+#ifndef INGEST_CACHE_HPP
+#define INGEST_CACHE_HPP
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <vector>
+#include <stdint.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "hashdb.hpp"
+#include "filename_t.hpp"
+
+namespace hasher {
+
+class ingest_cache_t {
+
+  public:
+  // member file hash and recursion path pairs
+  typedef std::vector<std::pair<std::string, std::string> > members_t;
+
+  private:
+  class file_key_t {
+    public:
+    uint64_t filesize;
+    int64_t mtime;
+    uint64_t inode;
+    file_key_t() : filesize(0), mtime(0), inode(0) {
+    }
+    file_key_t(const uint64_t p_filesize, const int64_t p_mtime,
+               const uint64_t p_inode) :
+            filesize(p_filesize), mtime(p_mtime), inode(p_inode) {
+    }
+    bool operator==(const file_key_t& other) const {
+      return filesize == other.filesize && mtime == other.mtime &&
+             inode == other.inode;
+    }
+  };
+
+  class entry_t {
+    public:
+    file_key_t key;
+    std::string file_hash;
+    members_t members;
+    entry_t() : key(), file_hash(), members() {
+    }
+    entry_t(const file_key_t& p_key, const std::string& p_file_hash) :
+            key(p_key), file_hash(p_file_hash), members() {
+    }
+  };
+
+  const std::string cache_file;
+
+  // cached entries by absolute utf8 path
+  std::map<std::string, entry_t> entries;
+
+  // paths and keys of the files looked up but not cached, by filename
+  std::map<std::string, std::pair<std::string, file_key_t> > pending;
+
+  // absolute paths of the files updated, by filename
+  std::map<std::string, std::string> updated;
+
+  // members found since the last write, by filename
+  std::map<std::string, members_t> found_members;
+  mutable pthread_mutex_t M;
+
+  // do not allow copy or assignment
+  ingest_cache_t(const ingest_cache_t&);
+  ingest_cache_t& operator=(const ingest_cache_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  // nanoseconds so that a rewrite within the same second is noticed
+#ifdef WIN32
+  static int64_t mtime_ns(const struct _stat64& st) {
+    return static_cast<int64_t>(st.st_mtime) * 1000000000;
+  }
+#elif defined(__APPLE__)
+  static int64_t mtime_ns(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 +
+           st.st_mtimespec.tv_nsec;
+  }
+#else
+  static int64_t mtime_ns(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+           st.st_mtim.tv_nsec;
+  }
+#endif
+
+  // get the absolute utf8 path and key of a file, false if not available
+  static bool stat_file(const filename_t& filename, std::string* path,
+                        file_key_t* key) {
+#ifdef WIN32
+    struct _stat64 st;
+    if (_wstat64(filename.c_str(), &st) != 0) {
+      return false;
+    }
+    wchar_t full_path[_MAX_PATH];
+    if (_wfullpath(full_path, filename.c_str(), _MAX_PATH) == NULL) {
+      return false;
+    }
+    *path = native_to_utf8(filename_t(full_path));
+#else
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) {
+      return false;
+    }
+    char full_path[PATH_MAX];
+    if (realpath(filename.c_str(), full_path) == NULL) {
+      return false;
+    }
+    *path = full_path;
+#endif
+    if (path->find('\n') != std::string::npos) {
+      // not representable in the cache file
+      return false;
+    }
+    *key = file_key_t(static_cast<uint64_t>(st.st_size),
+                      mtime_ns(st),
+                      static_cast<uint64_t>(st.st_ino));
+    return true;
+  }
+
+  void read_cache_file() {
+    std::ifstream in(cache_file.c_str());
+    std::string line;
+    entry_t* entry = NULL;
+    while (getline(in, line)) {
+      if (line.size() > 0 && line[0] == '\t') {
+        // a member of the file on the line before
+        std::stringstream ss(line);
+        std::string hex_member_hash;
+        std::string recursion_path;
+        ss >> hex_member_hash >> recursion_path;
+        const std::string member_hash = hashdb::hex_to_bin(hex_member_hash);
+        if (entry != NULL && !ss.fail() && member_hash.size() != 0) {
+          entry->members.push_back(members_t::value_type(member_hash,
+                                                         recursion_path));
+        }
+        continue;
+      }
+      entry = NULL;
+      std::stringstream ss(line);
+      std::string hex_file_hash;
+      file_key_t key;
+      std::string path;
+      ss >> hex_file_hash >> key.filesize >> key.mtime >> key.inode;
+      if (ss.fail() || ss.get() != '\t' || !getline(ss, path) ||
+          path.size() == 0) {
+        // skip a damaged line
+        continue;
+      }
+      const std::string file_hash = hashdb::hex_to_bin(hex_file_hash);
+      if (file_hash.size() == 0) {
+        continue;
+      }
+      entries[path] = entry_t(key, file_hash);
+      entry = &entries[path];
+    }
+  }
+
+  public:
+  ingest_cache_t(const std::string& hashdb_dir) :
+                 cache_file(hashdb_dir + "/ingest_cache.txt"),
+                 entries(),
+                 pending(),
+                 updated(),
+                 found_members(),
+                 M() {
+    read_cache_file();
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+  }
+
+  ~ingest_cache_t() {
+    pthread_mutex_destroy(&M);
+  }
+
+  /**
+   * Return the cached file hash and set members if the file is unchanged
+   * since it was cached, else "" and remember the file's key for update().
+   */
+  std::string lookup(const filename_t& filename, members_t* members) {
+    std::string path;
+    file_key_t key;
+    if (!stat_file(filename, &path, &key)) {
+      return "";
+    }
+    std::map<std::string, entry_t>::const_iterator it = entries.find(path);
+    if (it != entries.end() && it->second.key == key) {
+      *members = it->second.members;
+      return it->second.file_hash;
+    }
+    pending[native_to_utf8(filename)] =
+                               std::pair<std::string, file_key_t>(path, key);
+    return "";
+  }
+
+  /**
+   * Cache the file hash of a file passed to lookup(), keyed as it was
+   * when looked up.
+   */
+  void update(const std::string& filename, const std::string& file_hash) {
+    std::map<std::string, std::pair<std::string, file_key_t> >::iterator
+                                              it = pending.find(filename);
+    if (it == pending.end()) {
+      return;
+    }
+    entries[it->second.first] = entry_t(it->second.second, file_hash);
+    lock();
+    updated[filename] = it->second.first;
+    unlock();
+    pending.erase(it);
+  }
+
+  /**
+   * Remember a member found by recursive processing within the file.
+   * Members may be found before update() is called for the file.
+   */
+  void add_member(const std::string& filename, const std::string& member_hash,
+                  const std::string& recursion_path) {
+    lock();
+    found_members[filename].push_back(
+                    members_t::value_type(member_hash, recursion_path));
+    unlock();
+  }
+
+  // write the cache, return error_message or "".  Call once the files
+  // updated are fully processed so that their members are all known.
+  std::string write() {
+
+    // give the updated files the members found in them
+    lock();
+    for (std::map<std::string, std::string>::const_iterator it =
+                              updated.begin(); it != updated.end(); ++it) {
+      std::map<std::string, members_t>::iterator member_it =
+                                          found_members.find(it->first);
+      if (member_it != found_members.end()) {
+        entries[it->second].members.swap(member_it->second);
+        found_members.erase(member_it);
+      }
+    }
+    updated.clear();
+    unlock();
+
+    const std::string temp_file = cache_file + ".tmp";
+    {
+      std::ofstream out(temp_file.c_str());
+      for (std::map<std::string, entry_t>::const_iterator it =
+                              entries.begin(); it != entries.end(); ++it) {
+        out << hashdb::bin_to_hex(it->second.file_hash) << "\t"
+            << it->second.key.filesize << "\t"
+            << it->second.key.mtime << "\t"
+            << it->second.key.inode << "\t"
+            << it->first << "\n";
+        const members_t& members = it->second.members;
+        for (members_t::const_iterator member_it = members.begin();
+                             member_it != members.end(); ++member_it) {
+          out << "\t" << hashdb::bin_to_hex(member_it->first) << "\t"
+              << member_it->second << "\n";
+        }
+      }
+      out.close();
+      if (out.fail()) {
+        std::remove(temp_file.c_str());
+        return "Unable to write ingest cache file '" + temp_file + "'.";
+      }
+    }
+#ifdef WIN32
+    // rename does not replace an existing file on Windows
+    std::remove(cache_file.c_str());
+#endif
+    if (std::rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+      return "Unable to replace ingest cache file '" + cache_file + "'.";
+    }
+    return "";
+  }
+};
+
+} // end namespace hasher
+
+#endif
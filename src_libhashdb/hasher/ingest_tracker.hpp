@@ -23,7 +23,10 @@
  *   1) to be able to know if the same source file hash has been processed.
  *   2) to track zero_count and nonprobative_count and store them
  *      when the total is ready.
- * Also tracks total bytes processed in order to provide progress feedback.
+ * Also tracks total bytes processed in order to provide progress feedback
+ * and whether per-job status is quiet.  When one read of the files feeds
+ * several trackers, only one of them reports progress, and only one of
+ * them passes members found by recursive processing to the ingest cache.
  */
 
 #ifndef INGEST_TRACKER_HPP
@@ -42,6 +45,7 @@
 #include <pthread.h>
 #include <map>
 #include "tprint.hpp"
+#include "ingest_cache.hpp"
 
 namespace hasher {
 
@@ -72,6 +76,7 @@ class ingest_tracker_t {
   const uint64_t bytes_total;
   uint64_t bytes_done;
   uint64_t bytes_reported_done;
+  ingest_cache_t* const ingest_cache;
   mutable pthread_mutex_t M;
   
   // do not allow copy or assignment
@@ -98,15 +103,32 @@ class ingest_tracker_t {
   }
 
   public:
+  // true to not print the status of each job
+  const bool quiet;
+
+  // true to print the bytes completed
+  const bool report_progress;
+
+  // true to count but not store blocks that get a block label
+  const bool skip_nonprobative;
+
   ingest_tracker_t(hashdb::import_manager_t* const p_import_manager,
-                   const size_t p_bytes_total) :
+                   const size_t p_bytes_total,
+                   const bool p_quiet = false,
+                   const bool p_report_progress = true,
+                   const bool p_skip_nonprobative = false,
+                   ingest_cache_t* const p_ingest_cache = NULL) :
                import_manager(p_import_manager),
                source_data_map(),
                preexisting_sources(),
                bytes_total(p_bytes_total),
                bytes_done(0),
                bytes_reported_done(0),
-               M() {
+               ingest_cache(p_ingest_cache),
+               M(),
+               quiet(p_quiet),
+               report_progress(p_report_progress),
+               skip_nonprobative(p_skip_nonprobative) {
     identify_preexisting_sources();
     if(pthread_mutex_init(&M,NULL)) {
       std::cerr << "Error obtaining mutex.\n";
@@ -175,17 +197,25 @@ class ingest_tracker_t {
 
   void track_bytes(const uint64_t count) {
     static const size_t INCREMENT = 134217728; // = 2^27 = 100 MiB
+    if (!report_progress) {
+      return;
+    }
     lock();
     bytes_done += count;
     if (bytes_done == bytes_total ||
         bytes_done > bytes_reported_done + INCREMENT) {
 
-      // print %done
+      // print %done, or only the bytes done when reading a stream whose
+      // total is not known
       std::stringstream ss;
-      ss << "# " << bytes_done
-         << " of " << bytes_total
-         << " bytes completed (" << bytes_done * 100 / bytes_total
-         << "%)\n";
+      if (bytes_total == 0) {
+        ss << "# " << bytes_done << " bytes completed\n";
+      } else {
+        ss << "# " << bytes_done
+           << " of " << bytes_total
+           << " bytes completed (" << bytes_done * 100 / bytes_total
+           << "%)\n";
+      }
       hashdb::tprint(std::cout, ss.str());
 
 
@@ -201,6 +231,14 @@ class ingest_tracker_t {
     unlock();
     return has_hash;
   }
+
+  // remember a member found by recursive processing of a file
+  void add_member(const std::string& filename, const std::string& member_hash,
+                  const std::string& recursion_path) {
+    if (ingest_cache != NULL) {
+      ingest_cache->add_member(filename, member_hash, recursion_path);
+    }
+  }
 };
 
 } // end namespace hasher
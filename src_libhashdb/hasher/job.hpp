@@ -20,7 +20,10 @@
 /**
  * \file
  * job data is used by threads for ingesting or scanning data.
- * There are two job types, see job_type_t.
+ * There are four job types, see job_type_t.  An INGEST_PACKED job
+ * holds many small files back to back in one buffer, see packed_file_t.
+ * A READ job only touches its buffer, for measuring the reader path
+ * without hashing, see benchmark_media_read.
  */
 
 #ifndef JOB_HPP
@@ -30,15 +33,69 @@
 #include <sstream>
 #include <cstdlib>
 #include <stdint.h>
+#include <vector>
+#include <utility>
 //#include <unistd.h>
 #include "hashdb.hpp"
 #include "hash_calculator.hpp"
 #include "ingest_tracker.hpp"
 #include "scan_tracker.hpp"
+#include "portable_filter.hpp"
 
 namespace hasher {
 
-enum job_type_t {INGEST, SCAN};
+class pending_source_t;
+class mapped_file_t;
+class buffer_pool_t;
+
+enum job_type_t {INGEST, SCAN, INGEST_PACKED, READ};
+
+// one small file in the buffer of an INGEST_PACKED job
+struct packed_file_t {
+  std::string filename;
+  std::string file_hash;
+  uint64_t filesize;
+  size_t offset;                 // where the file is in the job buffer
+  size_t size;                   // bytes of the file in the job buffer
+  bool disable_ingest_hashes;    // true if the source was already added
+  packed_file_t(const std::string& p_filename,
+                const std::string& p_file_hash,
+                const uint64_t p_filesize,
+                const size_t p_offset,
+                const size_t p_size,
+                const bool p_disable_ingest_hashes) :
+          filename(p_filename), file_hash(p_file_hash),
+          filesize(p_filesize), offset(p_offset), size(p_size),
+          disable_ingest_hashes(p_disable_ingest_hashes) {
+  }
+};
+typedef std::vector<packed_file_t> packed_files_t;
+
+// a hash database a SCAN job looks up each block hash in, with the tag
+// printed with its matches, or "" to print matches untagged.  A filter
+// file exported by export_filter is looked up in place of a hash
+// database, see portable_filter.hpp.
+struct scan_target_t {
+  std::string tag;
+  hashdb::scan_manager_t* scan_manager;      // or NULL for a filter
+  hashdb::portable_filter_t* filter;         // or NULL
+  scan_target_t(const std::string& p_tag,
+                hashdb::scan_manager_t* const p_scan_manager,
+                hashdb::portable_filter_t* const p_filter) :
+          tag(p_tag), scan_manager(p_scan_manager), filter(p_filter) {
+  }
+  scan_target_t(const scan_target_t& other) :
+          tag(other.tag), scan_manager(other.scan_manager),
+          filter(other.filter) {
+  }
+  scan_target_t& operator=(const scan_target_t& other) {
+    tag = other.tag;
+    scan_manager = other.scan_manager;
+    filter = other.filter;
+    return *this;
+  }
+};
+typedef std::vector<scan_target_t> scan_managers_t;
 
 class job_t {
 
@@ -48,11 +105,15 @@ class job_t {
         hasher::ingest_tracker_t* const p_ingest_tracker,
         const hashdb::scan_manager_t* const p_whitelist_scan_manager,
         const std::string p_repository_name,
-        hashdb::scan_manager_t* const p_scan_manager,
+        const scan_managers_t* const p_scan_managers,
         hasher::scan_tracker_t* const p_scan_tracker,
         const size_t p_step_size,
         const size_t p_block_size,
+        const size_t p_min_chunk_size,
+        const size_t p_max_chunk_size,
+        const std::string p_block_hash_algorithm,
         const std::string p_file_hash,
+        hasher::pending_source_t* const p_pending_source,
         const std::string p_filename,
         const uint64_t p_filesize,
         const uint64_t p_file_offset,
@@ -64,19 +125,26 @@ class job_t {
         const uint8_t* const p_buffer,
         const size_t p_buffer_size,
         const size_t p_buffer_data_size,
+        hasher::mapped_file_t* const p_mapped_file,
+        hasher::buffer_pool_t* const p_buffer_pool,
         const size_t p_max_recursion_depth,
         const size_t p_recursion_depth,
-        const std::string p_recursion_path) :
+        const std::string p_recursion_path,
+        const packed_files_t& p_packed_files) :
                    job_type(p_job_type),
                    import_manager(p_import_manager),
                    ingest_tracker(p_ingest_tracker),
                    whitelist_scan_manager(p_whitelist_scan_manager),
                    repository_name(p_repository_name),
-                   scan_manager(p_scan_manager),
+                   scan_managers(p_scan_managers),
                    scan_tracker(p_scan_tracker),
                    step_size(p_step_size),
                    block_size(p_block_size),
+                   min_chunk_size(p_min_chunk_size),
+                   max_chunk_size(p_max_chunk_size),
+                   block_hash_algorithm(p_block_hash_algorithm),
                    file_hash(p_file_hash),
+                   pending_source(p_pending_source),
                    filename(p_filename),
                    filesize(p_filesize),
                    file_offset(p_file_offset),
@@ -88,9 +156,12 @@ class job_t {
                    buffer(p_buffer),
                    buffer_size(p_buffer_size),
                    buffer_data_size(p_buffer_data_size),
+                   mapped_file(p_mapped_file),
+                   buffer_pool(p_buffer_pool),
                    max_recursion_depth(p_max_recursion_depth),
                    recursion_depth(p_recursion_depth),
                    recursion_path(p_recursion_path),
+                   packed_files(p_packed_files),
                    error_message("") {
   }
 
@@ -104,11 +175,15 @@ class job_t {
   hasher::ingest_tracker_t* const ingest_tracker;
   const hashdb::scan_manager_t* const whitelist_scan_manager;
   const std::string repository_name;
-  hashdb::scan_manager_t* const scan_manager;
+  const scan_managers_t* const scan_managers;
   hasher::scan_tracker_t* const scan_tracker;
   const size_t step_size;
   const size_t block_size;
+  const size_t min_chunk_size;     // content-defined chunks, see chunker.hpp
+  const size_t max_chunk_size;     // or 0 for blocks every step_size
+  const std::string block_hash_algorithm;
   const std::string file_hash;
+  hasher::pending_source_t* const pending_source; // or NULL
   const std::string filename;
   const uint64_t filesize;
   const uint64_t file_offset;
@@ -120,9 +195,12 @@ class job_t {
   const uint8_t* const buffer;
   const size_t buffer_size;
   const size_t buffer_data_size;
+  hasher::mapped_file_t* const mapped_file; // or NULL
+  hasher::buffer_pool_t* const buffer_pool; // or NULL, else new[]
   const size_t max_recursion_depth;
   const size_t recursion_depth;
   const std::string recursion_path;
+  const packed_files_t packed_files; // for INGEST_PACKED
   std::string error_message;
 
   // ingest
@@ -133,7 +211,11 @@ class job_t {
         const std::string p_repository_name,
         const size_t p_step_size,
         const size_t p_block_size,
+        const size_t p_min_chunk_size,
+        const size_t p_max_chunk_size,
+        const std::string p_block_hash_algorithm,
         const std::string p_file_hash,
+        hasher::pending_source_t* const p_pending_source,
         const std::string p_filename,
         const uint64_t p_filesize,
         const uint64_t p_file_offset,
@@ -144,6 +226,8 @@ class job_t {
         const uint8_t* const p_buffer,
         const size_t p_buffer_size,
         const size_t p_buffer_data_size,
+        hasher::mapped_file_t* const p_mapped_file,
+        hasher::buffer_pool_t* const p_buffer_pool,
         const size_t p_max_recursion_depth,
         const size_t p_recursion_depth,
         const std::string p_recursion_path) {
@@ -154,11 +238,15 @@ class job_t {
                      p_ingest_tracker,
                      p_whitelist_scan_manager,
                      p_repository_name,
-                     NULL, // scan_manager
+                     NULL, // scan_managers
                      NULL, // scan_tracker
                      p_step_size,
                      p_block_size,
+                     p_min_chunk_size,
+                     p_max_chunk_size,
+                     p_block_hash_algorithm,
                      p_file_hash,
+                     p_pending_source,
                      p_filename,
                      p_filesize,
                      p_file_offset,
@@ -170,17 +258,79 @@ class job_t {
                      p_buffer,
                      p_buffer_size,
                      p_buffer_data_size,
+                     p_mapped_file,
+                     p_buffer_pool,
                      p_max_recursion_depth,
                      p_recursion_depth,
-                     p_recursion_path);
+                     p_recursion_path,
+                     packed_files_t());
+  }
+
+  // ingest small files packed into one buffer
+  static job_t* new_packed_ingest_job(
+        hashdb::import_manager_t* const p_import_manager,
+        hasher::ingest_tracker_t* const p_ingest_tracker,
+        const hashdb::scan_manager_t* const p_whitelist_scan_manager,
+        const std::string p_repository_name,
+        const size_t p_step_size,
+        const size_t p_block_size,
+        const size_t p_min_chunk_size,
+        const size_t p_max_chunk_size,
+        const std::string p_block_hash_algorithm,
+        const bool p_disable_recursive_processing,
+        const bool p_disable_calculate_entropy,
+        const bool p_disable_calculate_labels,
+        const packed_files_t& p_packed_files,
+        const uint8_t* const p_buffer,
+        const size_t p_buffer_size,
+        const size_t p_buffer_data_size,
+        hasher::buffer_pool_t* const p_buffer_pool,
+        const size_t p_max_recursion_depth) {
+
+    return new job_t(
+                     job_type_t::INGEST_PACKED,
+                     p_import_manager,
+                     p_ingest_tracker,
+                     p_whitelist_scan_manager,
+                     p_repository_name,
+                     NULL, // scan_managers
+                     NULL, // scan_tracker
+                     p_step_size,
+                     p_block_size,
+                     p_min_chunk_size,
+                     p_max_chunk_size,
+                     p_block_hash_algorithm,
+                     "",   // file hashes are in packed_files
+                     NULL, // pending_source
+                     (p_packed_files.size() > 0)
+                               ? p_packed_files[0].filename : "",
+                     p_buffer_data_size, // filesize is the packed size
+                     0,    // file_offset
+                     p_disable_recursive_processing,
+                     p_disable_calculate_entropy,
+                     p_disable_calculate_labels,
+                     false, // disable_ingest_hashes is in packed_files
+                     hashdb::scan_mode_t::EXPANDED, // scan_mode not used
+                     p_buffer,
+                     p_buffer_size,
+                     p_buffer_data_size,
+                     NULL, // mapped_file
+                     p_buffer_pool,
+                     p_max_recursion_depth,
+                     0,    // recursion_depth
+                     "",   // recursion_path
+                     p_packed_files);
   }
 
   // scan
   static job_t* new_scan_job(
-        hashdb::scan_manager_t* const p_scan_manager,
+        const scan_managers_t* const p_scan_managers,
         hasher::scan_tracker_t* const p_scan_tracker,
         const size_t p_step_size,
         const size_t p_block_size,
+        const size_t p_min_chunk_size,
+        const size_t p_max_chunk_size,
+        const std::string p_block_hash_algorithm,
         const std::string p_filename,
         const uint64_t p_filesize,
         const uint64_t p_file_offset,
@@ -189,6 +339,8 @@ class job_t {
         const uint8_t* const p_buffer,
         const size_t p_buffer_size,
         const size_t p_buffer_data_size,
+        hasher::mapped_file_t* const p_mapped_file,
+        hasher::buffer_pool_t* const p_buffer_pool,
         const size_t p_max_recursion_depth,
         const size_t p_recursion_depth,
         const std::string p_recursion_path) {
@@ -199,11 +351,15 @@ class job_t {
                      NULL, // ingest_tracker
                      NULL, // whitelist_scan_manager
                      "",   // repository_name
-                     p_scan_manager,
+                     p_scan_managers,
                      p_scan_tracker,
                      p_step_size,
                      p_block_size,
+                     p_min_chunk_size,
+                     p_max_chunk_size,
+                     p_block_hash_algorithm,
                      "",   // file hash
+                     NULL, // pending_source
                      p_filename,
                      p_filesize,
                      p_file_offset,
@@ -215,9 +371,57 @@ class job_t {
                      p_buffer,
                      p_buffer_size,
                      p_buffer_data_size,
+                     p_mapped_file,
+                     p_buffer_pool,
                      p_max_recursion_depth,
                      p_recursion_depth,
-                     p_recursion_path);
+                     p_recursion_path,
+                     packed_files_t());
+  }
+
+  // read only, the buffer is touched but not hashed
+  static job_t* new_read_job(
+        const std::string p_filename,
+        const uint64_t p_filesize,
+        const uint64_t p_file_offset,
+        const uint8_t* const p_buffer,
+        const size_t p_buffer_size,
+        const size_t p_buffer_data_size,
+        hasher::mapped_file_t* const p_mapped_file,
+        hasher::buffer_pool_t* const p_buffer_pool) {
+
+    return new job_t(
+                     job_type_t::READ,
+                     NULL, // import_manager
+                     NULL, // ingest_tracker
+                     NULL, // whitelist_scan_manager
+                     "",   // repository_name
+                     NULL, // scan_managers
+                     NULL, // scan_tracker
+                     p_buffer_data_size, // step_size not used
+                     p_buffer_data_size, // block_size not used
+                     0,    // min_chunk_size
+                     0,    // max_chunk_size
+                     "",   // block_hash_algorithm
+                     "",   // file hash
+                     NULL, // pending_source
+                     p_filename,
+                     p_filesize,
+                     p_file_offset,
+                     true,  // disable_recursive_processing
+                     true,  // disable_calculate_entropy
+                     true,  // disable_calculate_labels
+                     true,  // disable_ingest_hashes
+                     hashdb::scan_mode_t::EXPANDED, // scan_mode not used
+                     p_buffer,
+                     p_buffer_size,
+                     p_buffer_data_size,
+                     p_mapped_file,
+                     p_buffer_pool,
+                     0,    // max_recursion_depth
+                     0,    // recursion_depth
+                     "",   // recursion_path
+                     packed_files_t());
   }
 };
 
@@ -0,0 +1,118 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides a threadsafe double-ended queue of jobs owned by one worker
+ * thread.  The owner pushes and pops at the back so it works on its
+ * newest job first.  Idle workers steal from the front so they take
+ * the oldest job.
+ */
+
+#ifndef JOB_DEQUE_HPP
+#define JOB_DEQUE_HPP
+
+#include <iostream>
+#include <deque>
+#include <cassert>
+#include <pthread.h>
+#include "job.hpp"
+
+namespace hasher {
+
+class job_deque_t {
+
+  private:
+  std::deque<const hasher::job_t*> jobs;
+  mutable pthread_mutex_t M;
+
+  // do not allow copy or assignment
+  job_deque_t(const job_deque_t&);
+  job_deque_t& operator=(const job_deque_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  public:
+  job_deque_t() : jobs(), M() {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+  }
+
+  ~job_deque_t() {
+    lock();
+    if (jobs.size() > 0) {
+      // program error if deque is not empty
+      std::cerr << "Processing error: job ended but job deque is not empty.\n";
+    }
+    unlock();
+    pthread_mutex_destroy(&M);
+  }
+
+  // owner adds a job to the back
+  void push_back(const hasher::job_t* const job) {
+    lock();
+    jobs.push_back(job);
+    unlock();
+  }
+
+  // owner takes its newest job from the back, NULL if empty
+  const hasher::job_t* pop_back() {
+    lock();
+    const hasher::job_t* job = NULL;
+    if (jobs.size() > 0) {
+      job = jobs.back();
+      jobs.pop_back();
+    }
+    unlock();
+    return job;
+  }
+
+  // another worker takes the oldest job from the front, NULL if empty
+  const hasher::job_t* steal() {
+    lock();
+    const hasher::job_t* job = NULL;
+    if (jobs.size() > 0) {
+      job = jobs.front();
+      jobs.pop_front();
+    }
+    unlock();
+    return job;
+  }
+
+  size_t size() const {
+    lock();
+    const size_t count = jobs.size();
+    unlock();
+    return count;
+  }
+};
+
+} // end namespace hasher
+
+#endif
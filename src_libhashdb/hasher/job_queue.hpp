@@ -19,15 +19,19 @@
 
 /**
  * \file
- * Provides a threadsafe job queue with a maximum size:
+ * Provides a threadsafe blocking job queue with a maximum size:
  *
- * On push: yield the thread until the *job can be added.
- * On pop: pop the *job.  Returns NULL when empty.
+ * On push: block until the *job can be added.
+ * On pop: block until a *job is available.  Returns NULL when done
+ * adding and the queue is empty.
  *
- * When done, set is_done to true so threads can know to exit.
+ * When done, call done_adding so blocked threads can know to exit.
  *
  * The idea is to have a few more buffers than threads so threads always
  * have a buffer to consume and we don't fill up RAM with waiting buffers.
+ *
+ * Back-pressure counters tell how often push waited on a full queue
+ * and how often pop waited on an empty queue.
  */
 
 
@@ -45,8 +49,8 @@
 #include <libewf.h>
 
 #include <pthread.h>
-#include <sched.h>  // sched_yield
 #include "job.hpp"
+#include "metrics.hpp"
 
 namespace hasher {
 
@@ -60,71 +64,140 @@ class job_queue_t {
   bool is_done_adding;
 
   private:
+  // jobs pushed, for waiting until they are done
+  uint64_t pushes;
+
+  // back-pressure counters
+  uint64_t push_waits;
+  uint64_t pop_waits;
+  size_t max_depth;
+
   mutable pthread_mutex_t M;                  // mutext
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
 
   // do not allow copy or assignment
   job_queue_t(const job_queue_t&);
   job_queue_t& operator=(const job_queue_t&);
 
-  void lock() {
+  void lock() const {
     if(pthread_mutex_lock(&M)) {
       assert(0);
     }
   }
 
-  void unlock() {
+  void unlock() const {
     pthread_mutex_unlock(&M);
   }
 
+  // report the depth and back-pressure of the queue
+  static void add_metrics(const void* const data, const uint64_t id,
+                          hashdb::metric_samples_t& samples) {
+    const job_queue_t* const q = static_cast<const job_queue_t*>(data);
+    std::stringstream ss;
+    ss << "queue=\"" << id << "\"";
+    const std::string labels = ss.str();
+    q->lock();
+    samples.push_back(hashdb::metric_sample_t("hashdb_job_queue_depth",
+                "gauge", "Number of ingest and scan jobs queued.", labels,
+                static_cast<double>(q->job_queue.size())));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_job_queue_max_depth", "gauge",
+                "Largest number of jobs queued at once.", labels,
+                static_cast<double>(q->max_depth)));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_job_queue_push_waits_total", "counter",
+                "Times a job waited for room in the queue.", labels,
+                static_cast<double>(q->push_waits)));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_job_queue_pop_waits_total", "counter",
+                "Times a worker waited for a job.", labels,
+                static_cast<double>(q->pop_waits)));
+    q->unlock();
+  }
+
   public:
   job_queue_t(const size_t p_max_queue_size) :
                 max_queue_size(p_max_queue_size), job_queue(),
-                is_done_adding(false), M() {
+                is_done_adding(false), pushes(0),
+                push_waits(0), pop_waits(0), max_depth(0),
+                M(), not_full(), not_empty() {
     if(pthread_mutex_init(&M,NULL)) {
       std::cerr << "Error obtaining mutex.\n";
       assert(0);
     }
+    if(pthread_cond_init(&not_full,NULL) ||
+       pthread_cond_init(&not_empty,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+    hashdb::metrics_register(add_metrics, this);
   }
-    
+
   ~job_queue_t() {
+    hashdb::metrics_unregister(this);
     lock();
     if (job_queue.size() > 0) {
       // program error if queue is not empty
       std::cerr << "Processing error: job ended but job queue is not empty.\n";
     }
     unlock();
+    pthread_cond_destroy(&not_full);
+    pthread_cond_destroy(&not_empty);
     pthread_mutex_destroy(&M);
   }
 
   void push(const hasher::job_t* const job) {
-    while(true) {
-      // get job queue size
-      lock();
-      size_t size = job_queue.size();
-      unlock();
-      if (size < max_queue_size) {
-
-        // add job to queue now
-        lock();
-        job_queue.push(job);
-        unlock();
-        break;
-
-      } else {
-        // try again later
-        sched_yield();
+    lock();
+    if (job_queue.size() >= max_queue_size) {
+      // wait for space
+      ++push_waits;
+      while (job_queue.size() >= max_queue_size) {
+        pthread_cond_wait(&not_full, &M);
       }
     }
+
+    // add job to queue now
+    job_queue.push(job);
+    ++pushes;
+    if (job_queue.size() > max_depth) {
+      max_depth = job_queue.size();
+    }
+    pthread_cond_signal(&not_empty);
+    unlock();
   }
 
+  // blocks until a job is available, returns NULL when done
   const hasher::job_t* pop() {
-    const hasher::job_t* job = NULL;
     lock();
+    if (job_queue.size() == 0 && !is_done_adding) {
+      // wait for a job or for done
+      ++pop_waits;
+      while (job_queue.size() == 0 && !is_done_adding) {
+        pthread_cond_wait(&not_empty, &M);
+      }
+    }
+
+    const hasher::job_t* job = NULL;
     if (job_queue.size() > 0) {
       job = job_queue.front();
       job_queue.pop();
+      pthread_cond_signal(&not_full);
     } else {
-      // empty so return NULL
+      // done and empty so return NULL
+    }
+    unlock();
+    return job;
+  }
+
+  // returns a job if one is available, otherwise NULL without waiting
+  const hasher::job_t* try_pop() {
+    lock();
+    const hasher::job_t* job = NULL;
+    if (job_queue.size() > 0) {
+      job = job_queue.front();
+      job_queue.pop();
+      pthread_cond_signal(&not_full);
     }
     unlock();
     return job;
@@ -133,15 +206,50 @@ class job_queue_t {
   void done_adding() {
     lock();
     is_done_adding = true;
+
+    // wake all waiting threads so they can exit
+    pthread_cond_broadcast(&not_empty);
     unlock();
   }
 
-  bool is_done() {
+  bool is_done() const {
     lock();
     bool done = is_done_adding && job_queue.size() == 0;
     unlock();
     return done;
   }
+
+  // number of jobs pushed
+  uint64_t push_count() const {
+    lock();
+    const uint64_t count = pushes;
+    unlock();
+    return count;
+  }
+
+  // number of times push waited because the queue was full
+  uint64_t push_wait_count() const {
+    lock();
+    const uint64_t count = push_waits;
+    unlock();
+    return count;
+  }
+
+  // number of times pop waited because the queue was empty
+  uint64_t pop_wait_count() const {
+    lock();
+    const uint64_t count = pop_waits;
+    unlock();
+    return count;
+  }
+
+  // the largest number of jobs queued at once
+  size_t max_queue_depth() const {
+    lock();
+    const size_t depth = max_depth;
+    unlock();
+    return depth;
+  }
 };
 
 } // end namespace hasher
@@ -0,0 +1,163 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Memory-mapped file views, see mapped_file.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(WIN32)
+#define MAPPED_FILE_MMAP
+#include <sys/mman.h>
+#endif
+#include "mapped_file.hpp"
+
+namespace hasher {
+
+  mapped_file_t::mapped_file_t(const uint8_t* const p_data,
+                               const uint64_t p_filesize,
+                               const int p_fd) :
+           data(p_data), filesize(p_filesize), fd(p_fd),
+           references(1), M() {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+  }
+
+  mapped_file_t::~mapped_file_t() {
+#ifdef MAPPED_FILE_MMAP
+    ::munmap(const_cast<uint8_t*>(data), static_cast<size_t>(filesize));
+    ::close(fd);
+#endif
+    pthread_mutex_destroy(&M);
+  }
+
+  mapped_file_t* mapped_file_t::map(const int fd, const uint64_t filesize) {
+#ifdef MAPPED_FILE_MMAP
+    // the file must fit in the address space
+    if (filesize == 0 || filesize != static_cast<size_t>(filesize)) {
+      return NULL;
+    }
+    void* const p = ::mmap(NULL, static_cast<size_t>(filesize), PROT_READ,
+                           MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      return NULL;
+    }
+    const int dup_fd = ::dup(fd);
+    if (dup_fd < 0) {
+      ::munmap(p, static_cast<size_t>(filesize));
+      return NULL;
+    }
+#ifdef MADV_SEQUENTIAL
+    ::madvise(p, static_cast<size_t>(filesize), MADV_SEQUENTIAL);
+#endif
+    return new mapped_file_t(static_cast<const uint8_t*>(p), filesize,
+                             dup_fd);
+#else
+    (void)fd;
+    (void)filesize;
+    return NULL;
+#endif
+  }
+
+  void mapped_file_t::will_need(const uint64_t offset,
+                                const size_t size) const {
+#if defined(MAPPED_FILE_MMAP) && defined(MADV_WILLNEED)
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t begin = static_cast<size_t>(offset) / page * page;
+    const size_t end = (static_cast<size_t>(offset) + size < filesize) ?
+                       static_cast<size_t>(offset) + size :
+                       static_cast<size_t>(filesize);
+    if (begin < end) {
+      ::madvise(const_cast<uint8_t*>(data) + begin, end - begin,
+                MADV_WILLNEED);
+    }
+#else
+    (void)offset;
+    (void)size;
+#endif
+  }
+
+  void mapped_file_t::drop_pages(const uint8_t* const buffer,
+                                 const size_t size) const {
+#ifdef MAPPED_FILE_MMAP
+    // only whole pages inside the range
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const size_t offset = static_cast<size_t>(buffer - data);
+    const size_t begin = (offset + page - 1) / page * page;
+    const size_t end = (offset + size) / page * page;
+    if (begin >= end) {
+      return;
+    }
+#ifdef MADV_DONTNEED
+    ::madvise(const_cast<uint8_t*>(data) + begin, end - begin,
+              MADV_DONTNEED);
+#endif
+#ifdef HAVE_POSIX_FADVISE
+    ::posix_fadvise(fd, begin, end - begin, POSIX_FADV_DONTNEED);
+#endif
+#else
+    (void)buffer;
+    (void)size;
+#endif
+  }
+
+  const uint8_t* mapped_file_t::acquire(const uint64_t offset) {
+    pthread_mutex_lock(&M);
+    ++references;
+    pthread_mutex_unlock(&M);
+    return data + offset;
+  }
+
+  void mapped_file_t::release(const uint8_t* const buffer,
+                              const size_t size) {
+    if (buffer != NULL) {
+      drop_pages(buffer, size);
+    }
+    pthread_mutex_lock(&M);
+    const bool last = (--references == 0);
+    pthread_mutex_unlock(&M);
+    if (last) {
+      delete this;
+    }
+  }
+
+} // end namespace hasher
+
@@ -0,0 +1,89 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A read-only memory mapping of a whole file whose ranges are handed
+ * out as job buffers without copying.
+ *
+ * The mapping is reference counted: the creator holds one reference and
+ * each buffer handed out holds another.  Releasing a buffer drops its
+ * pages from memory since ingest and scan read each range once.  The
+ * mapping is removed when the last reference is released.
+ */
+
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace hasher {
+
+class mapped_file_t {
+
+  private:
+  const uint8_t* const data;
+  const uint64_t filesize;
+  const int fd;          // kept to drop released pages from the cache
+  size_t references;
+  mutable pthread_mutex_t M;
+
+  mapped_file_t(const uint8_t* const p_data, const uint64_t p_filesize,
+                const int p_fd);
+  ~mapped_file_t();
+
+  // do not allow copy or assignment
+  mapped_file_t(const mapped_file_t&);
+  mapped_file_t& operator=(const mapped_file_t&);
+
+  // drop the whole pages within the range from memory
+  void drop_pages(const uint8_t* const buffer, const size_t size) const;
+
+  public:
+  /**
+   * Map the open file, or return NULL if it cannot be mapped.  The
+   * caller holds the first reference.
+   */
+  static mapped_file_t* map(const int fd, const uint64_t filesize);
+
+  /**
+   * Hint that the range will be read soon.
+   */
+  void will_need(const uint64_t offset, const size_t size) const;
+
+  /**
+   * Take a reference for a buffer at offset in the mapping.
+   */
+  const uint8_t* acquire(const uint64_t offset);
+
+  /**
+   * Release a reference.  When buffer is not NULL, its first size bytes
+   * are no longer needed.  Releasing the last reference removes the
+   * mapping.
+   */
+  void release(const uint8_t* const buffer, const size_t size);
+
+};
+
+} // end namespace hasher
+
+#endif
+
@@ -0,0 +1,255 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Multi-buffer MD5 using AVX2, see md5_multi_buffer.hpp.
+ * The MD5 steps follow RFC 1321.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdlib>
+#include <assert.h>
+#include "md5_multi_buffer.hpp"
+#include "cpu_dispatch.hpp"
+
+// MD5 words are little-endian so use lanes only on little-endian hosts
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(WORDS_BIGENDIAN)
+#define MD5_MULTI_BUFFER_AVX2
+#include <immintrin.h>
+#endif
+
+namespace hasher {
+
+#ifdef MD5_MULTI_BUFFER_AVX2
+
+  static const size_t avx2_lanes = 8;
+
+  // per-step additive constants
+  static const uint32_t T[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+  // per-step left rotate amounts
+  static const int S[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+
+  // per-step message word index
+  static const int K[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+    5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9};
+
+  __attribute__((target("avx2")))
+  static inline __m256i rotl(const __m256i x, const int s) {
+    return _mm256_or_si256(_mm256_slli_epi32(x, s),
+                           _mm256_srli_epi32(x, 32 - s));
+  }
+
+  // hash nblocks 64-byte blocks of each lane starting at offset
+  __attribute__((target("avx2")))
+  static void md5_avx2_blocks(__m256i* const state,
+                              const uint8_t* const* const lanes,
+                              const size_t offset,
+                              const size_t nblocks) {
+    const __m256i ones = _mm256_set1_epi32(-1);
+    for (size_t block = 0; block < nblocks; ++block) {
+      const size_t position = offset + block * 64;
+
+      // gather message word k of every lane
+      __m256i m[16];
+      for (int k = 0; k < 16; ++k) {
+        uint32_t w[avx2_lanes];
+        for (size_t lane = 0; lane < avx2_lanes; ++lane) {
+          std::memcpy(&w[lane], lanes[lane] + position + k * 4,
+                      sizeof(uint32_t));
+        }
+        m[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));
+      }
+
+      __m256i a = state[0];
+      __m256i b = state[1];
+      __m256i c = state[2];
+      __m256i d = state[3];
+      for (int i = 0; i < 64; ++i) {
+        __m256i f;
+        if (i < 16) {
+          // (b & c) | (~b & d)
+          f = _mm256_or_si256(_mm256_and_si256(b, c),
+                              _mm256_andnot_si256(b, d));
+        } else if (i < 32) {
+          // (b & d) | (c & ~d)
+          f = _mm256_or_si256(_mm256_and_si256(b, d),
+                              _mm256_andnot_si256(d, c));
+        } else if (i < 48) {
+          // b ^ c ^ d
+          f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+        } else {
+          // c ^ (b | ~d)
+          f = _mm256_xor_si256(c,
+                         _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+        }
+        const __m256i sum = _mm256_add_epi32(
+                  _mm256_add_epi32(a, f),
+                  _mm256_add_epi32(m[K[i]],
+                                   _mm256_set1_epi32(static_cast<int>(T[i]))));
+        const __m256i rotated = rotl(sum, S[i]);
+        a = d;
+        d = c;
+        c = b;
+        b = _mm256_add_epi32(b, rotated);
+      }
+      state[0] = _mm256_add_epi32(state[0], a);
+      state[1] = _mm256_add_epi32(state[1], b);
+      state[2] = _mm256_add_epi32(state[2], c);
+      state[3] = _mm256_add_epi32(state[3], d);
+    }
+  }
+
+  __attribute__((target("avx2")))
+  static void md5_avx2(const uint8_t* const* const messages,
+                       const size_t count,
+                       const size_t length,
+                       uint8_t* const digests) {
+
+    // unused lanes repeat the first message
+    const uint8_t* lanes[avx2_lanes];
+    for (size_t lane = 0; lane < avx2_lanes; ++lane) {
+      lanes[lane] = (lane < count) ? messages[lane] : messages[0];
+    }
+
+    __m256i state[4];
+    state[0] = _mm256_set1_epi32(0x67452301);
+    state[1] = _mm256_set1_epi32(static_cast<int>(0xefcdab89));
+    state[2] = _mm256_set1_epi32(static_cast<int>(0x98badcfe));
+    state[3] = _mm256_set1_epi32(0x10325476);
+
+    // whole blocks
+    const size_t full_blocks = length / 64;
+    md5_avx2_blocks(state, lanes, 0, full_blocks);
+
+    // remaining bytes, 0x80, zeros, and the bit length in one or two
+    // padding blocks
+    const size_t remainder = length % 64;
+    const size_t tail_blocks = (remainder < 56) ? 1 : 2;
+    uint8_t tails[avx2_lanes][128];
+    const uint8_t* tail_lanes[avx2_lanes];
+    const uint64_t bit_length = static_cast<uint64_t>(length) * 8;
+    for (size_t lane = 0; lane < avx2_lanes; ++lane) {
+      uint8_t* const tail = tails[lane];
+      std::memset(tail, 0, sizeof(tails[lane]));
+      std::memcpy(tail, lanes[lane] + full_blocks * 64, remainder);
+      tail[remainder] = 0x80;
+      for (int i = 0; i < 8; ++i) {
+        tail[tail_blocks * 64 - 8 + i] =
+                          static_cast<uint8_t>(bit_length >> (8 * i));
+      }
+      tail_lanes[lane] = tail;
+    }
+    md5_avx2_blocks(state, tail_lanes, 0, tail_blocks);
+
+    // digests are the little-endian state words of each lane
+    uint32_t words[4][avx2_lanes];
+    for (int i = 0; i < 4; ++i) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(words[i]), state[i]);
+    }
+    for (size_t lane = 0; lane < count; ++lane) {
+      for (int i = 0; i < 4; ++i) {
+        std::memcpy(digests + 16 * lane + 4 * i, &words[i][lane],
+                    sizeof(uint32_t));
+      }
+    }
+  }
+
+  static size_t select_lanes() {
+    return (cpu_features().avx2) ? avx2_lanes : 0;
+  }
+
+  static const size_t lanes_available = select_lanes();
+
+#else
+
+  static const size_t lanes_available = 0;
+
+#endif
+
+  size_t md5_multi_buffer_lanes() {
+    return lanes_available;
+  }
+
+  const char* md5_kernel() {
+    return (lanes_available > 0) ? "avx2" : "scalar";
+  }
+
+  void md5_multi_buffer(const uint8_t* const* const messages,
+                        const size_t count,
+                        const size_t length,
+                        uint8_t* const digests) {
+#ifdef MD5_MULTI_BUFFER_AVX2
+    if (count > 0 && count <= lanes_available) {
+      md5_avx2(messages, count, length, digests);
+      return;
+    }
+#else
+    (void)messages;
+    (void)length;
+    (void)digests;
+#endif
+    // program error, lanes are not available
+    if (count > 0) {
+      assert(0);
+    }
+  }
+
+} // end namespace hasher
@@ -0,0 +1,53 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Multi-buffer MD5: hash several equal-length messages at once, one
+ * message per 32-bit vector lane.  Uses AVX2 when the CPU supports it,
+ * selected at runtime.  Callers fall back to hash_calculator_t
+ * when md5_multi_buffer_lanes returns 0.
+ */
+
+#ifndef MD5_MULTI_BUFFER_HPP
+#define MD5_MULTI_BUFFER_HPP
+#include <stdint.h>
+#include <cstdlib>
+
+namespace hasher {
+
+  /**
+   * The number of messages md5_multi_buffer hashes at once, or 0 if
+   * multi-buffer MD5 is not available on this CPU.
+   */
+  size_t md5_multi_buffer_lanes();
+
+  /**
+   * Calculate the MD5 of count messages of length bytes each, where
+   * count is at most md5_multi_buffer_lanes.  Digest i is written to
+   * digests + 16 * i.
+   */
+  void md5_multi_buffer(const uint8_t* const* const messages,
+                        const size_t count,
+                        const size_t length,
+                        uint8_t* const digests);
+
+} // end namespace hasher
+
+#endif
@@ -0,0 +1,380 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * MD5 on an OpenCL device, see md5_offload.hpp.  The few OpenCL entry
+ * points used are declared here and loaded with dlopen so that no
+ * OpenCL headers or libraries are needed to build.  The MD5 steps
+ * follow RFC 1321.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <pthread.h>
+#include "md5_offload.hpp"
+
+#if defined(HAVE_DLFCN_H) && !defined(WIN32)
+#define MD5_OFFLOAD_OPENCL
+#include <dlfcn.h>
+#endif
+
+namespace hasher {
+
+#ifdef MD5_OFFLOAD_OPENCL
+
+  // one work item per block, bytes past buffer_size hash as zeros
+  static const char* const kernel_source =
+    "__constant uint K[64] = {\n"
+    "  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,\n"
+    "  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,\n"
+    "  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,\n"
+    "  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,\n"
+    "  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,\n"
+    "  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,\n"
+    "  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,\n"
+    "  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,\n"
+    "  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,\n"
+    "  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,\n"
+    "  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,\n"
+    "  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,\n"
+    "  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,\n"
+    "  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,\n"
+    "  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,\n"
+    "  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};\n"
+    "__constant uint S[64] = {\n"
+    "  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,\n"
+    "  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,\n"
+    "  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,\n"
+    "  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};\n"
+    "__kernel void md5_blocks(__global const uchar* buffer,\n"
+    "                         const ulong buffer_size,\n"
+    "                         const ulong step_size,\n"
+    "                         const uint block_size,\n"
+    "                         const ulong num_blocks,\n"
+    "                         __global uchar* digests) {\n"
+    "  const ulong block = get_global_id(0);\n"
+    "  if (block >= num_blocks) {\n"
+    "    return;\n"
+    "  }\n"
+    "  const ulong offset = block * step_size;\n"
+    "  const ulong bits = (ulong)block_size * 8;\n"
+    "  const uint padded = ((block_size + 8) / 64 + 1) * 64;\n"
+    "  uint h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};\n"
+    "  for (uint chunk = 0; chunk < padded; chunk += 64) {\n"
+    "    uint m[16];\n"
+    "    for (uint w = 0; w < 16; ++w) {\n"
+    "      uint word = 0;\n"
+    "      for (uint k = 0; k < 4; ++k) {\n"
+    "        const uint p = chunk + w * 4 + k;\n"
+    "        uint v = 0;\n"
+    "        if (p < block_size) {\n"
+    "          v = (offset + p < buffer_size) ? buffer[offset + p] : 0;\n"
+    "        } else if (p == block_size) {\n"
+    "          v = 0x80;\n"
+    "        } else if (p >= padded - 8) {\n"
+    "          v = (uint)(bits >> (8 * (p - (padded - 8)))) & 0xff;\n"
+    "        }\n"
+    "        word |= v << (8 * k);\n"
+    "      }\n"
+    "      m[w] = word;\n"
+    "    }\n"
+    "    uint a = h[0], b = h[1], c = h[2], d = h[3];\n"
+    "    for (uint i = 0; i < 64; ++i) {\n"
+    "      uint f, g;\n"
+    "      if (i < 16) {\n"
+    "        f = (b & c) | (~b & d);\n"
+    "        g = i;\n"
+    "      } else if (i < 32) {\n"
+    "        f = (d & b) | (~d & c);\n"
+    "        g = (5 * i + 1) & 15;\n"
+    "      } else if (i < 48) {\n"
+    "        f = b ^ c ^ d;\n"
+    "        g = (3 * i + 5) & 15;\n"
+    "      } else {\n"
+    "        f = c ^ (b | ~d);\n"
+    "        g = (7 * i) & 15;\n"
+    "      }\n"
+    "      const uint t = d;\n"
+    "      d = c;\n"
+    "      c = b;\n"
+    "      b = b + rotate(a + f + K[i] + m[g], S[i]);\n"
+    "      a = t;\n"
+    "    }\n"
+    "    h[0] += a;\n"
+    "    h[1] += b;\n"
+    "    h[2] += c;\n"
+    "    h[3] += d;\n"
+    "  }\n"
+    "  for (uint i = 0; i < 16; ++i) {\n"
+    "    digests[block * 16 + i] = (uchar)(h[i / 4] >> (8 * (i % 4)));\n"
+    "  }\n"
+    "}\n";
+
+  // the OpenCL types and constants used
+  typedef int32_t cl_int;
+  typedef uint32_t cl_uint;
+  typedef uint64_t cl_ulong;
+  typedef struct opaque_platform* cl_platform_id;
+  typedef struct opaque_device* cl_device_id;
+  typedef struct opaque_context* cl_context;
+  typedef struct opaque_queue* cl_command_queue;
+  typedef struct opaque_program* cl_program;
+  typedef struct opaque_kernel* cl_kernel;
+  typedef struct opaque_mem* cl_mem;
+  typedef struct opaque_event* cl_event;
+  static const cl_int CL_SUCCESS = 0;
+  static const cl_ulong CL_DEVICE_TYPE_GPU = 1 << 2;
+  static const cl_ulong CL_DEVICE_TYPE_ACCELERATOR = 1 << 3;
+  static const cl_uint CL_DEVICE_NAME = 0x102B;
+  static const cl_ulong CL_MEM_WRITE_ONLY = 1 << 1;
+  static const cl_ulong CL_MEM_READ_ONLY = 1 << 2;
+  static const cl_ulong CL_MEM_COPY_HOST_PTR = 1 << 5;
+  static const cl_uint CL_TRUE = 1;
+
+  // the OpenCL entry points used
+  struct opencl_t {
+    cl_int (*GetPlatformIDs)(cl_uint, cl_platform_id*, cl_uint*);
+    cl_int (*GetDeviceIDs)(cl_platform_id, cl_ulong, cl_uint, cl_device_id*,
+                           cl_uint*);
+    cl_int (*GetDeviceInfo)(cl_device_id, cl_uint, size_t, void*, size_t*);
+    cl_context (*CreateContext)(const intptr_t*, cl_uint, const cl_device_id*,
+                          void (*)(const char*, const void*, size_t, void*),
+                          void*, cl_int*);
+    cl_command_queue (*CreateCommandQueue)(cl_context, cl_device_id,
+                                           cl_ulong, cl_int*);
+    cl_program (*CreateProgramWithSource)(cl_context, cl_uint, const char**,
+                                          const size_t*, cl_int*);
+    cl_int (*BuildProgram)(cl_program, cl_uint, const cl_device_id*,
+                           const char*, void (*)(cl_program, void*), void*);
+    cl_kernel (*CreateKernel)(cl_program, const char*, cl_int*);
+    cl_mem (*CreateBuffer)(cl_context, cl_ulong, size_t, void*, cl_int*);
+    cl_int (*SetKernelArg)(cl_kernel, cl_uint, size_t, const void*);
+    cl_int (*EnqueueNDRangeKernel)(cl_command_queue, cl_kernel, cl_uint,
+                                   const size_t*, const size_t*,
+                                   const size_t*, cl_uint, const cl_event*,
+                                   cl_event*);
+    cl_int (*EnqueueReadBuffer)(cl_command_queue, cl_mem, cl_uint, size_t,
+                                size_t, void*, cl_uint, const cl_event*,
+                                cl_event*);
+    cl_int (*ReleaseMemObject)(cl_mem);
+  };
+
+  // the device, set up once on first use
+  static pthread_mutex_t device_M = PTHREAD_MUTEX_INITIALIZER;
+  static bool device_tried = false;
+  static bool device_ready = false;
+  static std::string device_name;
+  static opencl_t cl;
+  static cl_context context = NULL;
+  static cl_command_queue queue = NULL;
+  static cl_kernel kernel = NULL;
+
+  // load one entry point, false if missing
+  template <typename T>
+  static bool load(void* const library, const char* const name, T& f) {
+    void* const p = ::dlsym(library, name);
+    std::memcpy(&f, &p, sizeof(f));
+    return p != NULL;
+  }
+
+  // load OpenCL and build the kernel on the first GPU or accelerator,
+  // call while locked
+  static bool open_device() {
+    const char* const value = ::getenv("HASHDB_OFFLOAD");
+    if (value != NULL && std::string(value) == "none") {
+      return false;
+    }
+    void* library = ::dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+      library = ::dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+    }
+    if (library == NULL) {
+      return false;
+    }
+    if (!load(library, "clGetPlatformIDs", cl.GetPlatformIDs) ||
+        !load(library, "clGetDeviceIDs", cl.GetDeviceIDs) ||
+        !load(library, "clGetDeviceInfo", cl.GetDeviceInfo) ||
+        !load(library, "clCreateContext", cl.CreateContext) ||
+        !load(library, "clCreateCommandQueue", cl.CreateCommandQueue) ||
+        !load(library, "clCreateProgramWithSource",
+              cl.CreateProgramWithSource) ||
+        !load(library, "clBuildProgram", cl.BuildProgram) ||
+        !load(library, "clCreateKernel", cl.CreateKernel) ||
+        !load(library, "clCreateBuffer", cl.CreateBuffer) ||
+        !load(library, "clSetKernelArg", cl.SetKernelArg) ||
+        !load(library, "clEnqueueNDRangeKernel", cl.EnqueueNDRangeKernel) ||
+        !load(library, "clEnqueueReadBuffer", cl.EnqueueReadBuffer) ||
+        !load(library, "clReleaseMemObject", cl.ReleaseMemObject)) {
+      ::dlclose(library);
+      return false;
+    }
+
+    // the first GPU or accelerator of any platform
+    cl_platform_id platforms[8];
+    cl_uint num_platforms = 0;
+    if (cl.GetPlatformIDs(8, platforms, &num_platforms) != CL_SUCCESS) {
+      return false;
+    }
+    cl_device_id device = NULL;
+    for (cl_uint i=0; i<num_platforms && i<8 && device == NULL; ++i) {
+      cl_uint num_devices = 0;
+      if (cl.GetDeviceIDs(platforms[i],
+                          CL_DEVICE_TYPE_GPU | CL_DEVICE_TYPE_ACCELERATOR,
+                          1, &device, &num_devices) != CL_SUCCESS ||
+          num_devices == 0) {
+        device = NULL;
+      }
+    }
+    if (device == NULL) {
+      return false;
+    }
+    char name[256] = "";
+    cl.GetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, NULL);
+
+    // the kernel
+    cl_int rc;
+    context = cl.CreateContext(NULL, 1, &device, NULL, NULL, &rc);
+    if (rc != CL_SUCCESS) {
+      return false;
+    }
+    queue = cl.CreateCommandQueue(context, device, 0, &rc);
+    if (rc != CL_SUCCESS) {
+      return false;
+    }
+    const char* source = kernel_source;
+    cl_program program = cl.CreateProgramWithSource(context, 1, &source,
+                                                    NULL, &rc);
+    if (rc != CL_SUCCESS ||
+        cl.BuildProgram(program, 1, &device, "", NULL, NULL) != CL_SUCCESS) {
+      std::cerr << "Unable to build the MD5 kernel for OpenCL device '"
+                << name << "', hashing on the CPU.\n";
+      return false;
+    }
+    kernel = cl.CreateKernel(program, "md5_blocks", &rc);
+    if (rc != CL_SUCCESS) {
+      return false;
+    }
+    device_name = name;
+    return true;
+  }
+
+  // set up the device once, false if there is none
+  static bool have_device() {
+    pthread_mutex_lock(&device_M);
+    if (!device_tried) {
+      device_tried = true;
+      device_ready = open_device();
+    }
+    pthread_mutex_unlock(&device_M);
+    return device_ready;
+  }
+
+  bool md5_offload(const uint8_t* const buffer,
+                   const size_t buffer_size,
+                   const size_t data_size,
+                   const size_t step_size,
+                   const size_t block_size,
+                   std::vector<uint8_t>& digests) {
+    if (step_size == 0 || data_size == 0 || !have_device()) {
+      return false;
+    }
+    const cl_ulong num_blocks = (data_size + step_size - 1) / step_size;
+    digests.resize(num_blocks * 16);
+
+    // copy the buffer in, run, and copy the digests out, one call at
+    // a time on the shared queue
+    pthread_mutex_lock(&device_M);
+    cl_int rc;
+    cl_mem in = cl.CreateBuffer(context,
+                                CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                buffer_size, const_cast<uint8_t*>(buffer),
+                                &rc);
+    bool ok = (rc == CL_SUCCESS);
+    cl_mem out = NULL;
+    if (ok) {
+      out = cl.CreateBuffer(context, CL_MEM_WRITE_ONLY, digests.size(),
+                            NULL, &rc);
+      ok = (rc == CL_SUCCESS);
+    }
+    if (ok) {
+      const cl_ulong size = buffer_size;
+      const cl_ulong step = step_size;
+      const cl_uint count = static_cast<cl_uint>(block_size);
+      const size_t global = static_cast<size_t>(num_blocks);
+      ok = cl.SetKernelArg(kernel, 0, sizeof(in), &in) == CL_SUCCESS &&
+           cl.SetKernelArg(kernel, 1, sizeof(size), &size) == CL_SUCCESS &&
+           cl.SetKernelArg(kernel, 2, sizeof(step), &step) == CL_SUCCESS &&
+           cl.SetKernelArg(kernel, 3, sizeof(count), &count) == CL_SUCCESS &&
+           cl.SetKernelArg(kernel, 4, sizeof(num_blocks),
+                           &num_blocks) == CL_SUCCESS &&
+           cl.SetKernelArg(kernel, 5, sizeof(out), &out) == CL_SUCCESS &&
+           cl.EnqueueNDRangeKernel(queue, kernel, 1, NULL, &global, NULL,
+                                   0, NULL, NULL) == CL_SUCCESS &&
+           cl.EnqueueReadBuffer(queue, out, CL_TRUE, 0, digests.size(),
+                                &digests[0], 0, NULL, NULL) == CL_SUCCESS;
+    }
+    if (out != NULL) {
+      cl.ReleaseMemObject(out);
+    }
+    if (in != NULL) {
+      cl.ReleaseMemObject(in);
+    }
+    pthread_mutex_unlock(&device_M);
+    return ok;
+  }
+
+  std::string md5_offload_device() {
+    return have_device() ? device_name : "";
+  }
+
+#else
+
+  bool md5_offload(const uint8_t* const, const size_t, const size_t,
+                   const size_t, const size_t, std::vector<uint8_t>&) {
+    return false;
+  }
+
+  std::string md5_offload_device() {
+    return "";
+  }
+
+#endif
+
+} // end namespace hasher
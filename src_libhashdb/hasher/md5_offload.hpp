@@ -0,0 +1,66 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * MD5 of every step offset of a job buffer on an OpenCL device, so
+ * that scans with small steps do not spend their CPU time hashing.
+ * The OpenCL library is loaded at runtime, so one binary runs with or
+ * without a device, and callers hash on the CPU when md5_offload
+ * returns false.
+ *
+ * Set the HASHDB_OFFLOAD environment variable to none to not use a
+ * device.
+ */
+
+#ifndef MD5_OFFLOAD_HPP
+#define MD5_OFFLOAD_HPP
+#include <stdint.h>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+namespace hasher {
+
+  // the smallest buffer worth the copy to and from a device
+  const size_t md5_offload_min_bytes = 1 << 20;
+
+  /**
+   * Calculate the MD5 of the block_size-byte block at each multiple of
+   * step_size below data_size in buffer.  Bytes past buffer_size hash
+   * as zeros.  Digest i, of the block at offset i * step_size, is
+   * written to digests at 16 * i.  Return false if no device is
+   * available.  Threadsafe, calls share the device one at a time.
+   */
+  bool md5_offload(const uint8_t* const buffer,
+                   const size_t buffer_size,
+                   const size_t data_size,
+                   const size_t step_size,
+                   const size_t block_size,
+                   std::vector<uint8_t>& digests);
+
+  /**
+   * The name of the device md5_offload uses, or "" if none.
+   */
+  std::string md5_offload_device();
+
+} // end namespace hasher
+
+#endif
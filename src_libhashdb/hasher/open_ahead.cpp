@@ -0,0 +1,165 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Open files ahead of their consumer, see open_ahead.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <assert.h>
+#include <pthread.h>
+#include "file_reader.hpp"
+#include "open_ahead.hpp"
+
+namespace hasher {
+
+  open_ahead_t::open_ahead_t(const filenames_t& p_filenames,
+                             const size_t num_threads,
+                             const size_t p_max_ahead,
+                             const uint64_t p_prefetch_size,
+                             const bool p_direct_reads) :
+           filenames(p_filenames),
+           max_ahead(p_max_ahead == 0 ? 1 : p_max_ahead),
+           prefetch_size(p_prefetch_size),
+           direct_reads(p_direct_reads),
+           next_open_it(filenames.begin()), next_open_index(0),
+           next_take_index(0), file_readers(),
+           openers_active(num_threads == 0 ? 1 : num_threads),
+           is_stopped(false),
+           threads(openers_active), M(), reader_available(),
+           room_available() {
+
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&reader_available,NULL) ||
+       pthread_cond_init(&room_available,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+    for (size_t i=0; i<threads.size(); ++i) {
+      if (::pthread_create(&threads[i], NULL, open_ahead_t::run, this) != 0) {
+        std::cerr << "Unable to start open-ahead thread.\n";
+        assert(0);
+      }
+    }
+  }
+
+  open_ahead_t::~open_ahead_t() {
+    // stop opening and wait for the opener threads
+    lock();
+    is_stopped = true;
+    pthread_cond_broadcast(&room_available);
+    unlock();
+    for (size_t i=0; i<threads.size(); ++i) {
+      int status = pthread_join(threads[i], NULL);
+      if (status != 0) {
+        std::cerr << "error in open-ahead join " << status << "\n";
+      }
+    }
+
+    // close file readers that were not taken
+    for (std::map<size_t, file_reader_t*>::const_iterator it =
+                   file_readers.begin(); it != file_readers.end(); ++it) {
+      delete it->second;
+    }
+    file_readers.clear();
+    pthread_cond_destroy(&reader_available);
+    pthread_cond_destroy(&room_available);
+    pthread_mutex_destroy(&M);
+  }
+
+  void* open_ahead_t::run(void* const arg) {
+    static_cast<open_ahead_t*>(arg)->open_loop();
+    return 0;
+  }
+
+  void open_ahead_t::open_loop() {
+    lock();
+    while (true) {
+
+      // claim the next file while not too far ahead of the consumer
+      while (!is_stopped && next_open_it != filenames.end() &&
+             next_open_index >= next_take_index + max_ahead) {
+        pthread_cond_wait(&room_available, &M);
+      }
+      if (is_stopped || next_open_it == filenames.end()) {
+        break;
+      }
+      const filename_t filename = *next_open_it;
+      const size_t index = next_open_index;
+      ++next_open_it;
+      ++next_open_index;
+      unlock();
+
+      // open the file without holding the lock
+      file_reader_t* const file_reader = new file_reader_t(filename,
+                                                           direct_reads);
+      if (file_reader->error_message.size() == 0 &&
+          file_reader->filesize <= prefetch_size) {
+        file_reader->will_need();
+      }
+
+      lock();
+      file_readers[index] = file_reader;
+      pthread_cond_signal(&reader_available);
+    }
+    --openers_active;
+    pthread_cond_signal(&reader_available);
+    unlock();
+  }
+
+  bool open_ahead_t::next(file_reader_t*& file_reader) {
+    lock();
+    std::map<size_t, file_reader_t*>::iterator it;
+    while ((it = file_readers.find(next_take_index)) == file_readers.end() &&
+           openers_active > 0) {
+      pthread_cond_wait(&reader_available, &M);
+    }
+    if (it == file_readers.end()) {
+      // done
+      unlock();
+      return false;
+    }
+    file_reader = it->second;
+    file_readers.erase(it);
+    ++next_take_index;
+    pthread_cond_broadcast(&room_available);
+    unlock();
+    return true;
+  }
+
+} // end namespace hasher
@@ -0,0 +1,111 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Opens the files of a file list ahead of their consumer on separate
+ * threads so that per-file open latency overlaps with ingesting the
+ * files before them.
+ *
+ * Up to max_ahead files are opened but not taken at once.  Files of up
+ * to prefetch_size bytes are also hinted to the OS to be read into the
+ * page cache so that their first read does not wait on storage.  The
+ * consumer takes each file reader in file list order using next and
+ * then owns it.
+ */
+
+#ifndef OPEN_AHEAD_HPP
+#define OPEN_AHEAD_HPP
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <cassert>
+#include <pthread.h>
+#include "filename_t.hpp"
+#include "file_reader.hpp"
+
+namespace hasher {
+
+class open_ahead_t {
+
+  private:
+  const filenames_t& filenames;
+  const size_t max_ahead;
+  const uint64_t prefetch_size;
+  const bool direct_reads;
+
+  // state, protected by M
+  filenames_t::const_iterator next_open_it; // the next file to open
+  size_t next_open_index;
+  size_t next_take_index;                   // the next file to take
+  std::map<size_t, file_reader_t*> file_readers; // opened but not taken
+  size_t openers_active;
+  bool is_stopped;
+
+  std::vector< ::pthread_t> threads;
+  mutable pthread_mutex_t M;
+  pthread_cond_t reader_available;
+  pthread_cond_t room_available;
+
+  // do not allow copy or assignment
+  open_ahead_t(const open_ahead_t&);
+  open_ahead_t& operator=(const open_ahead_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  static void* run(void* const arg);
+  void open_loop();
+
+  public:
+  /**
+   * Start opening the files using num_threads threads, for direct reads
+   * if p_direct_reads is set.
+   */
+  open_ahead_t(const filenames_t& p_filenames,
+               const size_t num_threads,
+               const size_t p_max_ahead,
+               const uint64_t p_prefetch_size,
+               const bool p_direct_reads);
+
+  /**
+   * Stop opening, wait for the opener threads, and close any file
+   * readers that were not taken.
+   */
+  ~open_ahead_t();
+
+  /**
+   * Take the next file reader, blocking until it is opened.  Check its
+   * error_message.  Returns false when there are no more files.
+   */
+  bool next(file_reader_t*& file_reader);
+};
+
+} // end namespace hasher
+
+#endif
+
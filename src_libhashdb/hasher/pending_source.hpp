@@ -0,0 +1,297 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A provisional source for ingest jobs pushed before the file hash of
+ * their file is known, so that a file can be hashed while its chunks
+ * are read and dispatched and is read only once.
+ *
+ * Each job adds its block hashes for its part of the file.  Until the
+ * producer binds the final file hash, parts are spilled to an unlinked
+ * temporary file in the hashdb directory.  Bind records the source with
+ * the ingest tracker and, unless the source was already ingested,
+ * inserts the spilled hashes.  Parts added after bind are inserted
+ * directly.  If the file cannot be read to the end, the producer
+ * abandons the source and its hashes are discarded.  The size of a file
+ * read from a stream is set once it is read to the end.
+ *
+ * Whichever call completes the source, bind, abandon, or the final
+ * add_part, returns true and the caller deletes the source.
+ */
+
+#ifndef PENDING_SOURCE_HPP
+#define PENDING_SOURCE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <assert.h>
+#include <iostream>
+#include <unistd.h>
+#include <pthread.h>
+#include "hashdb.hpp"
+#include "ingest_tracker.hpp"
+
+namespace hasher {
+
+class pending_source_t {
+
+  private:
+  // spilled hashes are inserted in batches of this many
+  static const size_t replay_batch_size = 100000;
+
+  hashdb::import_manager_t* const import_manager;
+  hasher::ingest_tracker_t* const ingest_tracker;
+  uint64_t filesize;
+  const std::string file_type;
+  size_t parts_total;
+
+  // state, protected by M
+  std::string file_hash;
+  bool is_bound;
+  bool is_abandoned;
+  bool is_duplicate;
+  size_t parts_done;
+  size_t parts_spilled;
+  uint64_t spilled_zero_count;
+  uint64_t spilled_nonprobative_count;
+  FILE* spill_file;
+
+  mutable pthread_mutex_t M;
+
+  // do not allow copy or assignment
+  pending_source_t(const pending_source_t&);
+  pending_source_t& operator=(const pending_source_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  static FILE* open_spill_file(const std::string& dir) {
+#ifdef WIN32
+    FILE* const f = std::tmpfile();
+#else
+    // unlinked now so that it is removed when closed
+    std::string name = dir + "/_pending_source_XXXXXX";
+    std::vector<char> path(name.begin(), name.end());
+    path.push_back('\0');
+    const int fd = ::mkstemp(&path[0]);
+    FILE* const f = (fd < 0) ? NULL : ::fdopen(fd, "w+b");
+    if (fd >= 0) {
+      ::unlink(&path[0]);
+    }
+#endif
+    if (f == NULL) {
+      std::cerr << "Error creating pending source file in " << dir << "\n";
+      assert(0);
+    }
+    return f;
+  }
+
+  void write_bytes(const void* const p, const size_t n) {
+    if (n > 0 && std::fwrite(p, 1, n, spill_file) != n) {
+      std::cerr << "Error writing pending source file.\n";
+      assert(0);
+    }
+  }
+
+  bool read_bytes(void* const p, const size_t n) {
+    return n == 0 || std::fread(p, 1, n, spill_file) == n;
+  }
+
+  // append a part to the spill file, call while locked
+  void spill(const hashdb::hash_inserts_t& hashes) {
+    for (hashdb::hash_inserts_t::const_iterator it = hashes.begin();
+         it != hashes.end(); ++it) {
+      const uint8_t hash_size = static_cast<uint8_t>(it->block_hash.size());
+      const uint16_t label_size =
+                            static_cast<uint16_t>(it->block_label.size());
+      write_bytes(&hash_size, sizeof(hash_size));
+      write_bytes(it->block_hash.data(), hash_size);
+      write_bytes(&it->k_entropy, sizeof(it->k_entropy));
+      write_bytes(&label_size, sizeof(label_size));
+      write_bytes(it->block_label.data(), label_size);
+    }
+  }
+
+  // insert the spilled hashes, call while locked
+  void replay() {
+    if (std::fflush(spill_file) != 0 || std::fseek(spill_file, 0, SEEK_SET)) {
+      std::cerr << "Error reading pending source file.\n";
+      assert(0);
+    }
+    hashdb::hash_inserts_t hashes;
+    hashes.reserve(replay_batch_size);
+    hashdb::hash_insert_t hash;
+    uint8_t hash_size;
+    uint16_t label_size;
+    char bytes[65536];
+    while (read_bytes(&hash_size, sizeof(hash_size))) {
+      if (!read_bytes(bytes, hash_size)) {
+        break;
+      }
+      hash.block_hash.assign(bytes, hash_size);
+      read_bytes(&hash.k_entropy, sizeof(hash.k_entropy));
+      read_bytes(&label_size, sizeof(label_size));
+      read_bytes(bytes, label_size);
+      hash.block_label.assign(bytes, label_size);
+      hashes.push_back(hash);
+      if (hashes.size() == replay_batch_size) {
+        import_manager->insert_hashes(file_hash, hashes);
+        hashes.clear();
+      }
+    }
+    import_manager->insert_hashes(file_hash, hashes);
+  }
+
+  // true when no more calls will be made, call while locked
+  bool is_complete() const {
+    return (is_bound || is_abandoned) && parts_done == parts_total;
+  }
+
+  public:
+  /**
+   * Create a provisional source for a file of parts_total parts.
+   * Spilled hashes are kept under spill_dir.
+   */
+  pending_source_t(hashdb::import_manager_t* const p_import_manager,
+                   hasher::ingest_tracker_t* const p_ingest_tracker,
+                   const std::string& spill_dir,
+                   const uint64_t p_filesize,
+                   const std::string& p_file_type,
+                   const size_t p_parts_total) :
+          import_manager(p_import_manager),
+          ingest_tracker(p_ingest_tracker),
+          filesize(p_filesize),
+          file_type(p_file_type),
+          parts_total(p_parts_total),
+          file_hash(""),
+          is_bound(false), is_abandoned(false), is_duplicate(false),
+          parts_done(0), parts_spilled(0),
+          spilled_zero_count(0), spilled_nonprobative_count(0),
+          spill_file(open_spill_file(spill_dir)),
+          M() {
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+  }
+
+  ~pending_source_t() {
+    std::fclose(spill_file);
+    pthread_mutex_destroy(&M);
+  }
+
+  /**
+   * Add the block hashes and counts of one part.  Returns true when the
+   * source is complete and should be deleted.
+   */
+  bool add_part(const hashdb::hash_inserts_t& hashes,
+                const uint64_t zero_count,
+                const uint64_t nonprobative_count) {
+    lock();
+    if (!is_bound && !is_abandoned) {
+      // keep the part until the file hash is known
+      spill(hashes);
+      ++parts_spilled;
+      spilled_zero_count += zero_count;
+      spilled_nonprobative_count += nonprobative_count;
+      ++parts_done;
+      const bool complete = is_complete();
+      unlock();
+      return complete;
+    }
+
+    const bool insert = is_bound && !is_duplicate;
+    ++parts_done;
+    const bool complete = is_complete();
+    unlock();
+
+    if (insert) {
+      import_manager->insert_hashes(file_hash, hashes);
+      ingest_tracker->track_source(file_hash, zero_count,
+                                   nonprobative_count);
+    }
+    return complete;
+  }
+
+  /**
+   * Set the size of a file read from a stream, which is not known until
+   * its last part is pushed.  Call before bind.
+   */
+  void set_size(const uint64_t p_filesize, const size_t p_parts_total) {
+    lock();
+    filesize = p_filesize;
+    parts_total = p_parts_total;
+    unlock();
+  }
+
+  /**
+   * Bind the final file hash after every part has been pushed.  Returns
+   * true when the source is complete and should be deleted.
+   */
+  bool bind(const std::string& p_file_hash) {
+    lock();
+    file_hash = p_file_hash;
+    is_bound = true;
+
+    // do not re-ingest hashes from duplicate sources
+    is_duplicate = !ingest_tracker->add_source(file_hash, filesize,
+                                               file_type, parts_total);
+    if (!is_duplicate && parts_spilled > 0) {
+      replay();
+      ingest_tracker->track_source(file_hash, spilled_zero_count,
+                                   spilled_nonprobative_count);
+      for (size_t i=1; i<parts_spilled; ++i) {
+        ingest_tracker->track_source(file_hash, 0, 0);
+      }
+    }
+    const bool complete = is_complete();
+    unlock();
+    return complete;
+  }
+
+  /**
+   * Discard the source because the file could not be read to the end,
+   * after parts_pushed parts were pushed.  Returns true when the source
+   * is complete and should be deleted.
+   */
+  bool abandon(const size_t parts_pushed) {
+    lock();
+    is_abandoned = true;
+    parts_total = parts_pushed;
+    const bool complete = is_complete();
+    unlock();
+    return complete;
+  }
+};
+
+} // end namespace hasher
+
+#endif
+
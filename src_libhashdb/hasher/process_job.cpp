@@ -38,6 +38,7 @@
 
 #include <cstring>
 #include <sstream>
+#include <vector>
 #include <cstdlib>
 #include <stdint.h>
 #include <assert.h>
@@ -52,27 +53,264 @@
 #include "process_job.hpp"
 #include "process_recursive.hpp"
 #include "hash_calculator.hpp"
+#include "md5_offload.hpp"
 #include "entropy_calculator.hpp"
 #include "calculate_block_label.hpp"
+#include "block_label_code.hpp"
+#include "zero_scanner.hpp"
+#include "chunker.hpp"
+#include "pending_source.hpp"
+#include "buffer_pool.hpp"
+#include "stage_stats.hpp"
+#include "probes.hpp"
 
 namespace hasher {
 
-  // detect if block is all zero
-  inline bool all_zero(const uint8_t* const buffer, const size_t buffer_size,
-                       const size_t offset, const size_t p_count) {
+  // number of block hashes to calculate together when scanning
+  static const size_t hash_batch_size = 64;
+
+  // number of blocks analyzed together when ingesting, one per multi-buffer
+  // hash lane, so the blocks are still in L1 cache for entropy and labels
+  static const size_t analysis_batch_size = 8;
+
+  // bytes of scan match lines collected before printing them
+  static const size_t match_output_size = 65536;
+
+  // a READ job touches one byte this often, no more than a page apart
+  static const size_t read_touch_stride = 4096;
+
+  // remove the offsets, and any chunk sizes, of blocks under the entropy
+  // threshold or with a block label, as set in the scan tracker,
+  // returning the number removed
+  static size_t filter_offsets(const hasher::job_t& job,
+                     hasher::entropy_calculator_t& entropy_calculator,
+                     hasher::block_label_calculator_t& label_calculator,
+                     std::vector<size_t>& offsets,
+                     std::vector<size_t>& sizes) {
+    const size_t num_offsets = offsets.size();
+    const bool has_sizes = (sizes.size() == offsets.size());
+    const uint64_t min_k_entropy = job.scan_tracker->min_k_entropy;
+    if (min_k_entropy > 0) {
+      hashdb::stage_timer_t timer(hashdb::STAGE_ENTROPY);
+      size_t kept = 0;
+      for (size_t j=0; j < offsets.size(); ++j) {
+        if (entropy_calculator.calculate(job.buffer, job.buffer_size,
+                                   offsets[j]) >= min_k_entropy) {
+          if (has_sizes) {
+            sizes[kept] = sizes[j];
+          }
+          offsets[kept++] = offsets[j];
+        }
+      }
+      offsets.resize(kept);
+      if (has_sizes) {
+        sizes.resize(kept);
+      }
+    }
+    if (job.scan_tracker->skip_labeled) {
+      hashdb::stage_timer_t timer(hashdb::STAGE_LABEL);
+      size_t kept = 0;
+      for (size_t j=0; j < offsets.size(); ++j) {
+        if (label_calculator.calculate_code(job.buffer, job.buffer_size,
+                                            offsets[j]) == 0) {
+          if (has_sizes) {
+            sizes[kept] = sizes[j];
+          }
+          offsets[kept++] = offsets[j];
+        }
+      }
+      offsets.resize(kept);
+      if (has_sizes) {
+        sizes.resize(kept);
+      }
+    }
+    return num_offsets - offsets.size();
+  }
 
-    // number of bytes
-    const size_t count =
-          (offset + p_count <= buffer_size) ? p_count : buffer_size - offset;
-    for (size_t i=offset+1; i < offset + count; ++i) {
-      if (buffer[i] != 0) {
-        return false;
+  // collect up to max_offsets offsets of nonzero blocks starting at
+  // offset, advancing offset and counting skipped zero blocks
+  static void next_offsets(const hasher::job_t& job,
+                           hasher::zero_scanner_t& zero_scanner,
+                           const size_t max_offsets,
+                           size_t& offset,
+                           size_t& zero_count,
+                           std::vector<size_t>& offsets) {
+    offsets.clear();
+    for (; offset < job.buffer_data_size && offsets.size() < max_offsets;
+                                           offset += job.step_size) {
+
+      // skip if all the bytes are the same
+      if (zero_scanner.all_zero(offset, job.block_size)) {
+        ++zero_count;
+        continue;
+      }
+      offsets.push_back(offset);
+    }
+  }
+
+  // find the content-defined chunks of the job, see chunker.hpp
+  static void find_chunks(const hasher::job_t& job,
+                          hasher::chunks_t& chunks) {
+    hashdb::stage_timer_t timer(hashdb::STAGE_HASH);
+    const hasher::chunker_t chunker(job.min_chunk_size, job.block_size,
+                                    job.max_chunk_size);
+    chunker.find_chunks(job.buffer, job.buffer_size, job.buffer_data_size,
+                        job.file_offset != 0, chunks);
+  }
+
+  // collect up to max_offsets offsets and sizes of nonzero chunks
+  // starting at chunk index, advancing index and counting skipped zero
+  // chunks
+  static void next_chunks(const hasher::chunks_t& chunks,
+                          hasher::zero_scanner_t& zero_scanner,
+                          const size_t max_offsets,
+                          size_t& index,
+                          size_t& zero_count,
+                          std::vector<size_t>& offsets,
+                          std::vector<size_t>& sizes) {
+    offsets.clear();
+    sizes.clear();
+    for (; index < chunks.size() && offsets.size() < max_offsets; ++index) {
+      if (zero_scanner.all_zero(chunks[index].first, chunks[index].second)) {
+        ++zero_count;
+        continue;
+      }
+      offsets.push_back(chunks[index].first);
+      sizes.push_back(chunks[index].second);
+    }
+  }
+
+  // calculate the block hash of each chunk
+  static void calculate_chunks(const hasher::job_t& job,
+                               hasher::hash_calculator_t& hash_calculator,
+                               const std::vector<size_t>& offsets,
+                               const std::vector<size_t>& sizes,
+                               std::vector<std::string>& block_hashes) {
+    block_hashes.resize(offsets.size());
+    for (size_t j=0; j < offsets.size(); ++j) {
+      block_hashes[j] = hash_calculator.calculate(job.buffer,
+                                   job.buffer_size, offsets[j], sizes[j]);
+    }
+  }
+
+  // block analysis results for one ingest job, stored as parallel arrays
+  struct block_results_t {
+    std::vector<std::string> block_hashes;
+    std::vector<uint64_t> k_entropies;
+    std::vector<uint8_t> block_label_codes;
+    block_results_t() : block_hashes(), k_entropies(), block_label_codes() {
+    }
+    size_t size() const {
+      return block_hashes.size();
+    }
+  };
+
+  // analyze the nonzero blocks of an ingest job a few at a time: zero
+  // detection, hashing, entropy and labeling all run on each batch while
+  // it is cache-hot
+  static void analyze_blocks(const hasher::job_t& job,
+                             block_results_t& results,
+                             size_t& zero_count,
+                             size_t& nonprobative_count) {
+
+    // get calculator objects, content-defined chunks are analyzed by
+    // their first min_chunk_size bytes
+    const bool chunking = (job.max_chunk_size != 0);
+    const size_t analysis_size = (chunking) ? job.min_chunk_size
+                                            : job.block_size;
+    hasher::hash_calculator_t hash_calculator(job.block_hash_algorithm);
+    hasher::entropy_calculator_t entropy_calculator(analysis_size);
+    hasher::block_label_calculator_t block_label_calculator(analysis_size,
+                            (chunking) ? analysis_size : job.step_size);
+
+    // zero detection that scans each byte of the buffer once
+    hasher::zero_scanner_t zero_scanner(job.buffer, job.buffer_size);
+
+    // any chunks
+    hasher::chunks_t chunks;
+    if (chunking) {
+      find_chunks(job, chunks);
+    }
+
+    // room for every block in the buffer
+    const size_t max_blocks = (chunking) ? chunks.size() :
+               (job.buffer_data_size + job.step_size - 1) / job.step_size;
+    results.block_hashes.reserve(max_blocks);
+    results.k_entropies.reserve(max_blocks);
+    results.block_label_codes.reserve(max_blocks);
+
+    std::vector<size_t> offsets;
+    std::vector<size_t> sizes;
+    std::vector<std::string> block_hashes;
+    size_t i = 0;    // the offset, or the chunk index when chunking
+    while ((chunking) ? i < chunks.size() : i < job.buffer_data_size) {
+
+      // collect the offsets of the next blocks to analyze
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_ZERO_CHECK);
+        if (chunking) {
+          next_chunks(chunks, zero_scanner, analysis_batch_size, i,
+                      zero_count, offsets, sizes);
+        } else {
+          next_offsets(job, zero_scanner, analysis_batch_size, i,
+                       zero_count, offsets);
+        }
+      }
+
+      // calculate their block hashes together
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_HASH);
+        if (chunking) {
+          calculate_chunks(job, hash_calculator, offsets, sizes,
+                           block_hashes);
+        } else {
+          hash_calculator.calculate_batch(job.buffer, job.buffer_size,
+                                          offsets, job.block_size,
+                                          block_hashes);
+        }
+      }
+      results.block_hashes.insert(results.block_hashes.end(),
+                                  block_hashes.begin(), block_hashes.end());
+
+      // calculate entropy
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_ENTROPY);
+        for (size_t j=0; j < offsets.size(); ++j) {
+          uint64_t k_entropy = 0;
+          if (!job.disable_calculate_entropy) {
+            k_entropy = entropy_calculator.calculate(job.buffer,
+                                      job.buffer_size, offsets[j]);
+          }
+          results.k_entropies.push_back(k_entropy);
+        }
+      }
+
+      // calculate block label
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_LABEL);
+        for (size_t j=0; j < offsets.size(); ++j) {
+          uint8_t code = 0;
+          if (!job.disable_calculate_labels) {
+            code = block_label_calculator.calculate_code(job.buffer,
+                                     job.buffer_size, offsets[j]);
+            if (code != 0) {
+              ++nonprobative_count;
+            }
+          }
+          results.block_label_codes.push_back(code);
+        }
       }
     }
-    return true;
   }
 
   static void print_status(const hasher::job_t& job) {
+    // maybe be quiet
+    const bool quiet = (job.job_type == hasher::job_type_t::SCAN) ?
+                       job.scan_tracker->quiet : job.ingest_tracker->quiet;
+    if (quiet) {
+      return;
+    }
+
     // print job_type, file with recursion path, offset, and filesize
     std::stringstream ss;
 
@@ -82,6 +320,13 @@ namespace hasher {
         ss << "# Ingesting ";
         break;
       }
+      case hasher::job_type_t::INGEST_PACKED: {
+        // one line for the packed files
+        ss << "# Ingesting " << job.packed_files.size() << " files from "
+           << job.filename << " size " << job.buffer_data_size << "\n";
+        hashdb::tprint(std::cout, ss.str());
+        return;
+      }
       case hasher::job_type_t::SCAN: {
         ss << "# Scanning ";
         break;
@@ -107,59 +352,48 @@ namespace hasher {
   }
 
 
-  // process INGEST job
-  static void process_ingest_job(const hasher::job_t& job) {
-
-    // print status
-    print_status(job);
+  // ingest the blocks of the job buffer and process any recursion
+  static void ingest_blocks(const hasher::job_t& job) {
 
     if (!job.disable_ingest_hashes) {
-      // get hash calculator object
-      hasher::hash_calculator_t hash_calculator;
-
-      // get entropy calculator object
-      hasher::entropy_calculator_t entropy_calculator(job.block_size);
 
-      // iterate over buffer to add block hashes and metadata
+      // analyze the blocks in the buffer
       size_t zero_count = 0;
       size_t nonprobative_count = 0;
-      for (size_t i=0; i < job.buffer_data_size; i+= job.step_size) {
-
-        // skip if all the bytes are the same
-        if (all_zero(job.buffer, job.buffer_size, i, job.block_size)) {
-          ++zero_count;
+      block_results_t results;
+      analyze_blocks(job, results, zero_count, nonprobative_count);
+
+      // add the block hashes to the DB together, except non-probative
+      // blocks when they are only counted
+      hashdb::hash_inserts_t hashes;
+      hashes.reserve(results.size());
+      for (size_t j=0; j < results.size(); ++j) {
+        const uint8_t code = results.block_label_codes[j];
+        if (job.ingest_tracker->skip_nonprobative && code != 0) {
           continue;
         }
-
-        // calculate block hash
-        const std::string block_hash = hash_calculator.calculate(job.buffer,
-                                    job.buffer_size, i, job.block_size);
-
-        // calculate entropy
-        uint64_t k_entropy = 0;
-        if (!job.disable_calculate_entropy) {
-          k_entropy = entropy_calculator.calculate(job.buffer,
-                                    job.buffer_size, i);
-        }
-
-        // calculate block label
-        std::string block_label = "";
-        if (!job.disable_calculate_labels) {
-          block_label = hasher::calculate_block_label(job.buffer,
-                                   job.buffer_size, i, job.block_size);
-          if (block_label.size() != 0) {
-            ++nonprobative_count;
-          }
+        hashes.push_back(hashdb::hash_insert_t());
+        hashdb::hash_insert_t& hash = hashes.back();
+        hash.block_hash.swap(results.block_hashes[j]);
+        hash.k_entropy = results.k_entropies[j];
+        if (code != 0) {
+          hash.block_label = hashdb::block_label_of_code(code);
         }
-
-        // add block hash to DB
-        job.import_manager->insert_hash(block_hash, k_entropy, block_label,
-                                        job.file_hash);
       }
+      if (job.pending_source != NULL) {
+        // the file hash may not be known yet
+        if (job.pending_source->add_part(hashes, zero_count,
+                                         nonprobative_count)) {
+          delete job.pending_source;
+        }
+      } else {
+        job.import_manager->insert_hashes(job.file_hash, hashes);
 
-      // submit tracked source counts to the ingest tracker for final reporting
-      job.ingest_tracker->track_source(
+        // submit tracked source counts to the ingest tracker for final
+        // reporting
+        job.ingest_tracker->track_source(
                                job.file_hash, zero_count, nonprobative_count);
+      }
     }
 
     // submit bytes processed to the ingest tracker for final reporting
@@ -172,12 +406,94 @@ namespace hasher {
     if (!job.disable_recursive_processing) {
       process_recursive(job);
     }
+  }
+
+  // process INGEST job
+  static void process_ingest_job(const hasher::job_t& job) {
+
+    // print status
+    print_status(job);
+
+    ingest_blocks(job);
+
+    // we are now done with this job.  Delete it.
+    hasher::release_buffer(job.buffer_pool, job.mapped_file, job.buffer,
+                           job.buffer_data_size);
+    delete &job;
+  }
+
+  // process INGEST_PACKED job
+  static void process_packed_ingest_job(const hasher::job_t& job) {
+
+    // print status
+    print_status(job);
+
+    // ingest each file as an INGEST job whose buffer is a view into the
+    // packed buffer
+    for (hasher::packed_files_t::const_iterator it = job.packed_files.begin();
+                                       it != job.packed_files.end(); ++it) {
+      const hasher::job_t* const file_job = hasher::job_t::new_ingest_job(
+                 job.import_manager,
+                 job.ingest_tracker,
+                 job.whitelist_scan_manager,
+                 job.repository_name,
+                 job.step_size,
+                 job.block_size,
+                 job.min_chunk_size,
+                 job.max_chunk_size,
+                 job.block_hash_algorithm,
+                 it->file_hash,
+                 NULL,   // pending_source
+                 it->filename,
+                 it->filesize,
+                 0,      // file_offset
+                 job.disable_recursive_processing,
+                 job.disable_calculate_entropy,
+                 job.disable_calculate_labels,
+                 it->disable_ingest_hashes,
+                 job.buffer + it->offset, // buffer
+                 it->size,               // buffer_size
+                 it->size,               // buffer_data_size
+                 NULL,   // mapped_file
+                 NULL,   // buffer_pool
+                 job.max_recursion_depth,
+                 0,      // recursion_depth
+                 "");    // recursion path
+      ingest_blocks(*file_job);
+      delete file_job;
+    }
 
     // we are now done with this job.  Delete it.
-    delete[] job.buffer;
+    hasher::release_buffer(job.buffer_pool, job.mapped_file, job.buffer,
+                           job.buffer_data_size);
     delete &job;
   }
 
+  // add a matching block to the summaries of the sources in its binary
+  // hash record
+  static void summarize_match(const std::string& binary,
+                              const bool top_level,
+                              const uint64_t offset,
+                              hasher::source_summaries_t& summaries) {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t source_sub_counts;
+    if (!hashdb::read_hash_binary(binary, block_hash, k_entropy, block_label,
+                                  count, source_sub_counts)) {
+      return;
+    }
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      hasher::source_summary_t& summary = summaries[it->file_hash];
+      ++summary.blocks;
+      if (top_level) {
+        summary.add_offset(offset);
+      }
+    }
+  }
+
   // process SCAN job
   static void process_scan_job(const hasher::job_t& job) {
 
@@ -185,55 +501,209 @@ namespace hasher {
     print_status(job);
 
     size_t zero_count = 0;
+    size_t filtered_count = 0;
+    size_t hashed_count = 0;
+    size_t match_count = 0;
+
+    // get calculator objects, content-defined chunks are analyzed by
+    // their first min_chunk_size bytes
+    const bool chunking = (job.max_chunk_size != 0);
+    const size_t analysis_size = (chunking) ? job.min_chunk_size
+                                            : job.block_size;
+    hasher::hash_calculator_t hash_calculator(job.block_hash_algorithm);
+    const bool filtering = job.scan_tracker->filter_active();
+    hasher::entropy_calculator_t entropy_calculator(analysis_size);
+    hasher::block_label_calculator_t label_calculator(analysis_size,
+                            (chunking) ? analysis_size : job.step_size);
+
+    // zero detection that scans each byte of the buffer once
+    hasher::zero_scanner_t zero_scanner(job.buffer, job.buffer_size);
+
+    // any chunks
+    hasher::chunks_t chunks;
+    if (chunking) {
+      find_chunks(job, chunks);
+    }
 
-    // get hash calculator object
-    hasher::hash_calculator_t hash_calculator;
+    // match lines are collected and printed in large writes, or matches
+    // are summarized by source and added to the scan tracker once
+    std::string matches;
+    const bool summarizing = job.scan_tracker->summarize;
+    std::vector<hasher::source_summaries_t> summaries(
+                                           job.scan_managers->size());
+
+    // hash every step of large MD5 buffers at once on a device if there
+    // is one, lookups stay on the CPU
+    std::vector<uint8_t> digests;
+    bool offloaded = false;
+    if (!chunking && job.buffer_data_size >= hasher::md5_offload_min_bytes &&
+        job.block_hash_algorithm == "md5") {
+      hashdb::stage_timer_t timer(hashdb::STAGE_HASH);
+      offloaded = hasher::md5_offload(job.buffer, job.buffer_size,
+                                      job.buffer_data_size, job.step_size,
+                                      job.block_size, digests);
+    }
 
     // iterate over buffer to calculate and scan for block hashes
-    for (size_t i=0; i < job.buffer_data_size; i+= job.step_size) {
-
-      // skip if all the bytes are the same
-      if (all_zero(job.buffer, job.buffer_size, i, job.block_size)) {
-        ++zero_count;
-        continue;
+    std::vector<size_t> offsets;
+    std::vector<size_t> sizes;
+    std::vector<std::string> block_hashes;
+    size_t i = 0;    // the offset, or the chunk index when chunking
+    while ((chunking) ? i < chunks.size() : i < job.buffer_data_size) {
+
+      // collect the offsets of the next blocks to hash
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_ZERO_CHECK);
+        if (chunking) {
+          next_chunks(chunks, zero_scanner, hash_batch_size, i, zero_count,
+                      offsets, sizes);
+        } else {
+          next_offsets(job, zero_scanner, hash_batch_size, i, zero_count,
+                       offsets);
+        }
       }
 
-      // calculate block hash
-      const std::string block_hash = hash_calculator.calculate(job.buffer,
-                  job.buffer_size, i, job.block_size);
+      // skip blocks that would be discarded before hashing them
+      if (filtering) {
+        filtered_count += filter_offsets(job, entropy_calculator,
+                                         label_calculator, offsets, sizes);
+      }
 
-      // scan
-      const std::string json_string = 
-              job.scan_manager->find_hash_json(job.scan_mode, block_hash);
+      // calculate their block hashes together
+      {
+        hashdb::stage_timer_t timer(hashdb::STAGE_HASH);
+        if (offloaded) {
+          block_hashes.resize(offsets.size());
+          for (size_t j=0; j < offsets.size(); ++j) {
+            block_hashes[j].assign(reinterpret_cast<const char*>(
+                     &digests[16 * (offsets[j] / job.step_size)]), 16);
+          }
+        } else if (chunking) {
+          calculate_chunks(job, hash_calculator, offsets, sizes,
+                           block_hashes);
+        } else {
+          hash_calculator.calculate_batch(job.buffer, job.buffer_size,
+                                          offsets, job.block_size,
+                                          block_hashes);
+        }
+      }
+      hashed_count += offsets.size();
+
+      // scan them together so their lookups are interleaved, once in
+      // each hash database
+      const hasher::scan_managers_t& scan_managers = *job.scan_managers;
+      std::vector<std::vector<std::string> > json_strings(
+                                                  scan_managers.size());
+      for (size_t k=0; k < scan_managers.size(); ++k) {
+        const hashdb::portable_filter_t* const filter =
+                                                 scan_managers[k].filter;
+        if (filter == NULL) {
+          json_strings[k] = scan_managers[k].scan_manager->find_hashes_json(
+                     summarizing ? hashdb::scan_mode_t::BINARY :
+                                   job.scan_mode, block_hashes);
+          continue;
+        }
 
-      if (json_string.size() > 0) {
-        // match so print offset <tab> file <tab> json
-        std::stringstream ss;
-        if (job.recursion_path != "") {
-          // prepend recursion path before offset
-          ss << job.recursion_path << "-";
+        // a filter marks its candidates with non-empty text
+        json_strings[k].assign(block_hashes.size(), "");
+        for (size_t j=0; j < block_hashes.size(); ++j) {
+          if (filter->maybe_contains(block_hashes[j])) {
+            json_strings[k][j] = "candidate";
+          }
         }
+      }
 
-        // add the offset
-        ss << job.file_offset + i << "\t";
+      for (size_t j=0; j < offsets.size(); ++j) {
+        const size_t offset = offsets[j];
+        const std::string& block_hash = block_hashes[j];
+        bool is_match = false;
 
-        // add the block hash
-        ss << hashdb::bin_to_hex(block_hash) << "\t";
+        for (size_t k=0; k < scan_managers.size(); ++k) {
 
-        // add the json text and a newline
-        ss << json_string << "\n";
+          // format binary records as JSON text
+          std::string& json_string = json_strings[k][j];
+          if (json_string.size() == 0) {
+            continue;
+          }
+          if (summarizing) {
+            is_match = true;
+            summarize_match(json_string, job.recursion_depth == 0,
+                            job.file_offset + offset, summaries[k]);
+            continue;
+          }
+          const bool is_candidate = (scan_managers[k].filter != NULL);
+          if (job.scan_mode == hashdb::scan_mode_t::BINARY && !is_candidate) {
+            json_string = scan_managers[k].scan_manager->hash_binary_json(
+                                                              json_string);
+          }
+          is_match = true;
 
-        // print it
-        hashdb::tprint(std::cout, ss.str());
+          // match so print offset <tab> file <tab> json, after the media
+          // image when scanning several
+          if (job.scan_tracker->media_tag.size() > 0) {
+            matches += job.scan_tracker->media_tag;
+            matches += "\t";
+          }
+          if (job.recursion_path != "") {
+            // prepend recursion path before offset
+            matches += job.recursion_path;
+            matches += "-";
+          }
+
+          // add the offset
+          matches += std::to_string(job.file_offset + offset);
+          matches += "\t";
+
+          // add the block hash, which ends a candidate line so that
+          // candidates can be confirmed with scan_list
+          matches += hashdb::bin_to_hex(block_hash);
+          if (is_candidate) {
+            matches += "\n";
+          } else {
+            matches += "\t";
+
+            // add the tag of the hash database when scanning several
+            if (scan_managers[k].tag.size() > 0) {
+              matches += scan_managers[k].tag;
+              matches += "\t";
+            }
+
+            // add the json text and a newline
+            matches += json_string;
+            matches += "\n";
+          }
+
+          // print them
+          if (matches.size() >= match_output_size) {
+            hashdb::tprint(std::cout, matches);
+            matches.clear();
+          }
+        }
+        if (is_match) {
+          ++match_count;
+        }
       }
     }
+    if (matches.size() > 0) {
+      hashdb::tprint(std::cout, matches);
+    }
+    for (size_t k=0; k < summaries.size(); ++k) {
+      job.scan_tracker->track_sources(k, summaries[k]);
+    }
 
-    // submit tracked zero_count to the scan tracker for final reporting
+    // submit tracked zero_count and filtered_count to the scan tracker
+    // for final reporting
     job.scan_tracker->track_zero_count(zero_count);
+    if (filtered_count > 0) {
+      job.scan_tracker->track_filtered_count(filtered_count);
+    }
 
-    // submit tracked bytes processed to the scan tracker for final reporting
+    // submit tracked bytes and blocks processed to the scan tracker for
+    // final reporting
     if (job.recursion_depth == 0) {
       job.scan_tracker->track_bytes(job.buffer_data_size);
+      job.scan_tracker->track_blocks(job.file_offset,
+                      hashed_count + filtered_count + zero_count, match_count);
     }
 
     // recursively find and process any uncompressible data
@@ -242,12 +712,34 @@ namespace hasher {
     }
 
     // we are now done with this job.  Delete it.
-    delete[] job.buffer;
+    hasher::release_buffer(job.buffer_pool, job.mapped_file, job.buffer,
+                           job.buffer_data_size);
+    delete &job;
+  }
+
+  // process READ job
+  static void process_read_job(const hasher::job_t& job) {
+
+    // touch every page so that mapped pages are faulted in as hashing
+    // would fault them
+    const volatile uint8_t* const buffer = job.buffer;
+    for (size_t i=0; i < job.buffer_data_size; i += read_touch_stride) {
+      (void)buffer[i];
+    }
+
+    hasher::release_buffer(job.buffer_pool, job.mapped_file, job.buffer,
+                           job.buffer_data_size);
     delete &job;
   }
 
   void process_job(const hasher::job_t& job) {
 
+    // the job is deleted once processed
+    const int job_type = static_cast<int>(job.job_type);
+    const uint64_t file_offset = job.file_offset;
+    const size_t data_size = job.buffer_data_size;
+    HASHDB_PROBE3(job_start, job_type, file_offset, data_size);
+
     switch(job.job_type) {
       case hasher::job_type_t::INGEST: {
         process_ingest_job(job);
@@ -259,9 +751,20 @@ namespace hasher {
         break;
       }
 
+      case hasher::job_type_t::INGEST_PACKED: {
+        process_packed_ingest_job(job);
+        break;
+      }
+
+      case hasher::job_type_t::READ: {
+        process_read_job(job);
+        break;
+      }
+
       default:
         assert(0);
     }
+    HASHDB_PROBE3(job_end, job_type, file_offset, data_size);
   }
 } // end namespace hasher
 
@@ -25,6 +25,7 @@
 #ifndef PROCESS_JOB_HPP
 #define PROCESS_JOB_HPP
 
+#include <stdint.h>
 #include "job.hpp"
 
 namespace hasher {
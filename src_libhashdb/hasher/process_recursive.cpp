@@ -53,8 +53,9 @@
 #include <unistd.h>
 #include "hashdb.hpp"
 #include "job.hpp"
-#include "uncompress.hpp"
+#include "container_scanner.hpp"
 #include "process_job.hpp"
+#include "threadpool.hpp"
 #include "hash_calculator.hpp"
 #include "entropy_calculator.hpp"
 #include "calculate_block_label.hpp"
@@ -125,6 +126,8 @@ namespace hasher {
         // store the source repository name and recursed filename
         parent_job.import_manager->insert_source_name(recursed_file_hash,
                    parent_job.repository_name, recursed_filename);
+        parent_job.ingest_tracker->add_member(parent_job.filename,
+                                      recursed_file_hash, recursion_path);
 
         // define the file type, currently not defined
         const std::string file_type = "";
@@ -147,7 +150,11 @@ namespace hasher {
                    parent_job.repository_name,
                    parent_job.step_size,
                    parent_job.block_size,
+                   parent_job.min_chunk_size,
+                   parent_job.max_chunk_size,
+                   parent_job.block_hash_algorithm,
                    recursed_file_hash,
+                   NULL,              // pending_source
                    parent_job.filename,
                    uncompressed_size, // file size is buffer_size
                    0,                 // file_offset
@@ -158,12 +165,14 @@ namespace hasher {
                    uncompressed_buffer,
                    uncompressed_size, // buffer_size
                    uncompressed_size, // buffer_data_size
+                   NULL,              // mapped_file
+                   NULL,              // buffer_pool
                    parent_job.max_recursion_depth,
                    parent_job.recursion_depth + 1,
                    recursion_path);
 
-        // run the new recursed ingest job
-        process_job(*recursed_ingest_job);
+        // queue the new recursed ingest job so idle workers may steal it
+        threadpool_t::push_recursed_job(recursed_ingest_job);
         break;
       }
 
@@ -179,10 +188,13 @@ namespace hasher {
               parent_job.recursion_path, parent_file_offset, compression_name);
 
         job_t* recursed_scan_media_job = job_t::new_scan_job(
-                   parent_job.scan_manager,
+                   parent_job.scan_managers,
                    parent_job.scan_tracker,
                    parent_job.step_size,
                    parent_job.block_size,
+                   parent_job.min_chunk_size,
+                   parent_job.max_chunk_size,
+                   parent_job.block_hash_algorithm,
                    parent_job.filename,
                    uncompressed_size, // file size is buffer_size
                    0,                 // file_offset
@@ -191,14 +203,20 @@ namespace hasher {
                    uncompressed_buffer,
                    uncompressed_size, // buffer_size
                    uncompressed_size, // buffer_data_size
+                   NULL,              // mapped_file
+                   NULL,              // buffer_pool
                    parent_job.max_recursion_depth,
                    parent_job.recursion_depth + 1,
                    recursion_path);
 
-        // run the new recursed scan media job
-        process_job(*recursed_scan_media_job);
+        // queue the new recursed scan media job so idle workers may steal it
+        threadpool_t::push_recursed_job(recursed_scan_media_job);
         break;
       }
+
+      // INGEST_PACKED jobs recurse file by file as INGEST jobs
+      default:
+        assert(0);
     }
   }
 
@@ -210,31 +228,35 @@ namespace hasher {
       return;
     }
 
-    // scan each byte for a compression signature, stop before end
-    for (size_t i=0; i < job.buffer_data_size; ++i) {
-
-      if (zip_signature(job.buffer, job.buffer_size, i)) {
-
-        // inflate and recurse
-        uint8_t* out_buf;
-        size_t out_size;
-        std::string error_message = new_from_zip(
-                                           job.buffer, job.buffer_size, i,
-                                           &out_buf, &out_size);
-        if (error_message == "") {
-          recurse(job, i, "zip", out_buf, out_size);
-        }
-
-      } else if (gzip_signature(job.buffer, job.buffer_size, i)) {
+    // find the container signatures, stop before end
+    container_candidates_t candidates;
+    find_container_candidates(job.buffer, job.buffer_size,
+                              job.buffer_data_size, candidates);
+
+    size_t count;
+    const container_t* const table = containers(&count);
+    size_t next_offset = 0;
+    for (container_candidates_t::const_iterator it = candidates.begin();
+         it != candidates.end(); ++it) {
+
+      // do not scan the compressed bytes that were just recursed into
+      const size_t offset = it->first;
+      if (offset < next_offset) {
+        continue;
+      }
 
-        // inflate and recurse
-        uint8_t* out_buf;
-        size_t out_size;
-        std::string error_message = new_from_gzip(
-                                           job.buffer, job.buffer_size, i,
-                                           &out_buf, &out_size);
-        if (error_message == "") {
-          recurse(job, i, "gzip", out_buf, out_size);
+      // decode and recurse
+      const container_t& container = table[it->second];
+      uint8_t* out_buf;
+      size_t out_size;
+      size_t in_used = 0;
+      std::string error_message = container.decode(
+                                         job.buffer, job.buffer_size, offset,
+                                         &out_buf, &out_size, &in_used);
+      if (error_message == "") {
+        recurse(job, offset, container.name, out_buf, out_size);
+        if (out_size > 0) {
+          next_offset = offset + in_used;
         }
       }
     }
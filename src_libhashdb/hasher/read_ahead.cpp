@@ -0,0 +1,277 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Read a file ahead of its consumer, see read_ahead.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <assert.h>
+#include <pthread.h>
+#include "file_reader.hpp"
+#include "read_ahead.hpp"
+#include "num_cpus.hpp"
+#include "stage_stats.hpp"
+
+namespace hasher {
+
+  read_ahead_t::read_ahead_t(const file_reader_t& p_file_reader,
+                             const uint64_t p_step_size,
+                             const size_t p_read_size,
+                             const size_t p_max_ahead,
+                             buffer_pool_t& p_buffer_pool,
+                             const uint64_t p_start_offset,
+                             const bool p_allow_map) :
+           file_reader(p_file_reader),
+           step_size(p_step_size),
+           read_size(p_read_size),
+           max_ahead(p_max_ahead == 0 ? 1 : p_max_ahead),
+           buffer_pool(p_buffer_pool),
+           mapped_file(map_file(p_allow_map)),
+           num_readers(reader_count()),
+           chunks(), next_read_offset(p_start_offset),
+           next_take_offset(p_start_offset),
+           readers_started(0), readers_active(num_readers),
+           is_error(false), is_stopped(false),
+           threads(num_readers), M(), chunk_available(), room_available() {
+
+    if (read_size > buffer_pool.buffer_size) {
+      std::cerr << "Read size exceeds buffer pool buffer size.\n";
+      assert(0);
+    }
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&chunk_available,NULL) ||
+       pthread_cond_init(&room_available,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+    for (size_t i=0; i<num_readers; ++i) {
+      if (::pthread_create(&threads[i], NULL, read_ahead_t::run, this) != 0) {
+        std::cerr << "Unable to start read-ahead thread.\n";
+        assert(0);
+      }
+    }
+  }
+
+  read_ahead_t::~read_ahead_t() {
+    // stop reading and wait for the reader threads
+    lock();
+    is_stopped = true;
+    pthread_cond_broadcast(&room_available);
+    unlock();
+    for (size_t i=0; i<threads.size(); ++i) {
+      int status = pthread_join(threads[i], NULL);
+      if (status != 0) {
+        std::cerr << "error in read-ahead join " << status << "\n";
+      }
+    }
+
+    // release chunks that were not taken
+    for (std::map<uint64_t, read_chunk_t>::const_iterator it =
+                                 chunks.begin(); it != chunks.end(); ++it) {
+      release_buffer(it->second.buffer_pool, it->second.mapped_file,
+                     it->second.buffer, it->second.buffer_size);
+    }
+    chunks.clear();
+
+    // taken chunks keep the mapping until they are released
+    if (mapped_file != NULL) {
+      mapped_file->release(NULL, 0);
+    }
+    pthread_cond_destroy(&chunk_available);
+    pthread_cond_destroy(&room_available);
+    pthread_mutex_destroy(&M);
+  }
+
+  // map files of at least one step, smaller files are read into buffers
+  mapped_file_t* read_ahead_t::map_file(const bool allow_map) const {
+    if (!allow_map || file_reader.filesize < step_size) {
+      return NULL;
+    }
+    return file_reader.map();
+  }
+
+  // one reader per CPU for E01 files that span more than one step
+  size_t read_ahead_t::reader_count() const {
+    if (file_reader.file_reader_type != E01 ||
+        file_reader.filesize <= step_size) {
+      return 1;
+    }
+    const uint64_t steps = (file_reader.filesize + step_size - 1) / step_size;
+    const int num_cpus = hashdb::numCPU();
+    const size_t count = (num_cpus < 1) ? 1 : static_cast<size_t>(num_cpus);
+    return (count > steps) ? static_cast<size_t>(steps) : count;
+  }
+
+  void* read_ahead_t::run(void* const arg) {
+    static_cast<read_ahead_t*>(arg)->read_loop();
+    return 0;
+  }
+
+  // claim the next offset to read, blocking while the readers are too
+  // far ahead of the consumer, return false if there is nothing to read
+  bool read_ahead_t::claim(uint64_t* offset) {
+    const uint64_t window = (max_ahead + num_readers) * step_size;
+    lock();
+    while (!is_stopped && !is_error &&
+           next_read_offset < file_reader.filesize &&
+           next_read_offset >= next_take_offset + window) {
+      pthread_cond_wait(&room_available, &M);
+    }
+    if (is_stopped || is_error || next_read_offset >= file_reader.filesize) {
+      unlock();
+      return false;
+    }
+    *offset = next_read_offset;
+    next_read_offset += step_size;
+    unlock();
+    return true;
+  }
+
+  // add a chunk for the consumer, return false if stopped
+  bool read_ahead_t::add(const read_chunk_t& chunk) {
+    lock();
+    if (is_stopped) {
+      unlock();
+      return false;
+    }
+    chunks[chunk.offset] = chunk;
+    if (chunk.error_message.size() > 0) {
+      is_error = true;
+      pthread_cond_broadcast(&room_available);
+    }
+    pthread_cond_signal(&chunk_available);
+    unlock();
+    return true;
+  }
+
+  void read_ahead_t::read_loop() {
+
+    // the first reader reads using file_reader and the others open their
+    // own E01 handle
+    lock();
+    const size_t reader_index = readers_started++;
+    unlock();
+    ewf_file_reader_t* const ewf_file_reader =
+               (reader_index == 0) ? NULL : file_reader.new_ewf_file_reader();
+    const bool is_usable = (reader_index == 0 ||
+               (ewf_file_reader != NULL && ewf_file_reader->is_open));
+
+    const uint64_t filesize = file_reader.filesize;
+    uint64_t offset;
+    while (is_usable && claim(&offset)) {
+
+      // read no more than what remains of the file
+      const size_t size = (filesize - offset < read_size) ?
+                          static_cast<size_t>(filesize - offset) : read_size;
+
+      read_chunk_t chunk;
+      chunk.offset = offset;
+      if (file_reader.is_hole(offset, size)) {
+        // nothing to read
+        chunk.buffer_size = size;
+        chunk.is_hole = true;
+      } else if (mapped_file != NULL) {
+        // a view into the mapping, paged in ahead of the consumer
+        mapped_file->will_need(offset, size);
+        chunk.buffer = mapped_file->acquire(offset);
+        chunk.buffer_size = size;
+        chunk.mapped_file = mapped_file;
+      } else {
+        // blocks while all pool buffers are in use
+        uint8_t* const buffer = buffer_pool.acquire();
+        if (buffer == NULL) {
+          chunk.error_message = "bad memory allocation";
+        } else {
+          hashdb::stage_timer_t timer(hashdb::STAGE_READ);
+          chunk.error_message = (ewf_file_reader == NULL)
+                   ? file_reader.read(offset, buffer, size, &chunk.buffer_size)
+                   : ewf_file_reader->read(offset, buffer, size,
+                                           &chunk.buffer_size);
+          chunk.buffer = buffer;
+          chunk.buffer_pool = &buffer_pool;
+        }
+      }
+
+      if (chunk.error_message.size() > 0) {
+        // deliver the error then stop reading
+        release_buffer(chunk.buffer_pool, chunk.mapped_file, chunk.buffer, 0);
+        chunk.buffer = NULL;
+        chunk.buffer_pool = NULL;
+        chunk.mapped_file = NULL;
+        chunk.buffer_size = 0;
+        add(chunk);
+        break;
+      }
+
+      if (!add(chunk)) {
+        // the consumer stopped reading
+        release_buffer(chunk.buffer_pool, chunk.mapped_file, chunk.buffer,
+                       chunk.buffer_size);
+        break;
+      }
+    }
+    delete ewf_file_reader;
+
+    lock();
+    --readers_active;
+    pthread_cond_signal(&chunk_available);
+    unlock();
+  }
+
+  bool read_ahead_t::next(read_chunk_t& chunk) {
+    lock();
+    std::map<uint64_t, read_chunk_t>::iterator it;
+    while ((it = chunks.find(next_take_offset)) == chunks.end() &&
+           readers_active > 0) {
+      pthread_cond_wait(&chunk_available, &M);
+    }
+    if (it == chunks.end()) {
+      // done and the next chunk was not read
+      unlock();
+      return false;
+    }
+    chunk = it->second;
+    chunks.erase(it);
+    next_take_offset += step_size;
+    pthread_cond_broadcast(&room_available);
+    unlock();
+    return true;
+  }
+
+} // end namespace hasher
@@ -0,0 +1,176 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Reads a file ahead of its consumer on separate threads so that file
+ * I/O overlaps with hashing and job dispatch.
+ *
+ * Chunks of up to read_size bytes are read at offsets 0, step_size,
+ * 2*step_size, and so on until the end of the file, or from a start
+ * offset on when resuming.  Up to max_ahead
+ * chunks wait to be taken at once.  The consumer takes each chunk in
+ * offset order using next and then owns its buffer.
+ *
+ * E01 files are read by one thread per CPU, each with its own libewf
+ * handle, so that chunk decompression runs in parallel.  Each thread
+ * reads whole steps, which are a multiple of the EWF chunk size, so
+ * the threads decompress different EWF chunks except where a read
+ * overlaps the next step.  Up to max_ahead plus one chunk per reader
+ * are read but not taken at once.  Other files are read by one thread.
+ *
+ * Single files of at least step_size bytes are memory mapped so that
+ * chunks are views into the mapping rather than copies.  Other files
+ * are read into buffers from the buffer pool, which must hold buffers
+ * of at least read_size bytes.  Release a chunk buffer using
+ * release_buffer.
+ *
+ * A chunk that is all in a hole of a sparse file is not read.  It is
+ * delivered with is_hole set, no buffer, and buffer_size set to the
+ * size that would have been read, and all of its bytes are zero.
+ *
+ * A read error is delivered as a chunk with an error_message and no
+ * buffer, after which no more chunks are read.  The file reader must
+ * not be used by others while a read_ahead_t reads from it.
+ */
+
+#ifndef READ_AHEAD_HPP
+#define READ_AHEAD_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <cassert>
+#include <pthread.h>
+#include "file_reader.hpp"
+#include "mapped_file.hpp"
+#include "buffer_pool.hpp"
+
+namespace hasher {
+
+// one chunk of a file
+struct read_chunk_t {
+  const uint8_t* buffer; // owned by whoever holds the chunk
+  size_t buffer_size;    // number of bytes read into buffer
+  uint64_t offset;
+  mapped_file_t* mapped_file; // mapping buffer is a view into, or NULL
+  buffer_pool_t* buffer_pool; // pool buffer came from, or NULL
+  bool is_hole;          // all zero and not read, so there is no buffer
+  std::string error_message;
+  read_chunk_t() : buffer(NULL), buffer_size(0), offset(0),
+                   mapped_file(NULL), buffer_pool(NULL), is_hole(false),
+                   error_message() {
+  }
+  read_chunk_t(const read_chunk_t& other) :
+                   buffer(other.buffer), buffer_size(other.buffer_size),
+                   offset(other.offset), mapped_file(other.mapped_file),
+                   buffer_pool(other.buffer_pool), is_hole(other.is_hole),
+                   error_message(other.error_message) {
+  }
+  read_chunk_t& operator=(const read_chunk_t& other) {
+    buffer = other.buffer;
+    buffer_size = other.buffer_size;
+    offset = other.offset;
+    mapped_file = other.mapped_file;
+    buffer_pool = other.buffer_pool;
+    is_hole = other.is_hole;
+    error_message = other.error_message;
+    return *this;
+  }
+};
+
+class read_ahead_t {
+
+  private:
+  const file_reader_t& file_reader;
+  const uint64_t step_size;
+  const size_t read_size;
+  const size_t max_ahead;
+  buffer_pool_t& buffer_pool;
+  mapped_file_t* const mapped_file;   // or NULL to read into buffers
+
+  const size_t num_readers;
+
+  // state, protected by M
+  std::map<uint64_t, read_chunk_t> chunks; // read but not taken
+  uint64_t next_read_offset;  // the next offset for a reader to read
+  uint64_t next_take_offset;  // the offset of the next chunk to take
+  size_t readers_started;
+  size_t readers_active;      // readers that may still add chunks
+  bool is_error;     // a read failed so no more offsets are read
+  bool is_stopped;   // the consumer is done taking chunks
+
+  std::vector< ::pthread_t> threads;
+  mutable pthread_mutex_t M;
+  pthread_cond_t chunk_available;
+  pthread_cond_t room_available;
+
+  // do not allow copy or assignment
+  read_ahead_t(const read_ahead_t&);
+  read_ahead_t& operator=(const read_ahead_t&);
+
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() const {
+    pthread_mutex_unlock(&M);
+  }
+
+  mapped_file_t* map_file(const bool allow_map) const;
+  size_t reader_count() const;
+  static void* run(void* const arg);
+  void read_loop();
+  bool claim(uint64_t* offset);
+  bool add(const read_chunk_t& chunk);
+
+  public:
+  /**
+   * Start reading file_reader from p_start_offset, a multiple of
+   * p_step_size.  Files are read into buffers rather than mapped when
+   * p_allow_map is false.
+   */
+  read_ahead_t(const file_reader_t& p_file_reader,
+               const uint64_t p_step_size,
+               const size_t p_read_size,
+               const size_t p_max_ahead,
+               buffer_pool_t& p_buffer_pool,
+               const uint64_t p_start_offset = 0,
+               const bool p_allow_map = true);
+
+  /**
+   * Stop reading, wait for the reader threads, and release any chunks
+   * that were not taken.
+   */
+  ~read_ahead_t();
+
+  /**
+   * Take the next chunk, blocking until it is read.  Returns false when
+   * there are no more chunks.
+   */
+  bool next(read_chunk_t& chunk);
+};
+
+} // end namespace hasher
+
+#endif
+
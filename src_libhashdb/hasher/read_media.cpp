@@ -19,7 +19,8 @@
 
 /**
  * \file
- * Media accessors, specifically, read_media and read_media_size.
+ * Media accessors, specifically, media_reader_t, read_media and
+ * read_media_size.
  */
 #include <config.h>
 // this process of getting WIN32 defined was inspired
@@ -41,6 +42,10 @@
 #include <iostream>
 #include <unistd.h> // for F_OK
 #include <sstream>
+#include <vector>
+#include <list>
+#include <map>
+#include <algorithm>
 #include "num_cpus.hpp"
 #include "hashdb.hpp"
 #include "file_reader.hpp"
@@ -49,144 +54,367 @@
 #include "job.hpp"
 #include "job_queue.hpp"
 #include "scan_tracker.hpp"
-#include "uncompress.hpp" // for new_from_zip
+#include "container_scanner.hpp" // for find_container
 
 namespace hashdb {
 
-  // convenience function to
-  // read bytes from media starting at offset.
-  std::string read_media(const std::string& media_filename,
-                         const uint64_t offset,
-                         const uint64_t count,
-                         std::string& bytes) {
-    std::stringstream ss;
-    ss << offset;
-    return read_media(media_filename, ss.str(), count, bytes);
-  }
+  // the most bytes read at the first offset of a forensic path, which is
+  // also the most that a member can be decompressed from
+  static const size_t media_read_size = 1048576; // 1MiB = 2^20
 
-  // read count bytes at media offset.
-  // Two example paths are 1000 and 1000-zip-0.
-  // Return "" and reason on failure.
-  std::string read_media(const std::string& media_filename,
-                         const std::string& media_offset,
-                         const uint64_t count,
-                         std::string& bytes) {
+  // raw reads of a batch this close together are coalesced into one read
+  static const uint64_t coalesce_gap = 65536;
 
-    // split forensic path into array of parts
-    // The number of parts will be odd.  The first part is the first_from_offset
-    // and can be uint64_t.  The remaining part pairs will be the part type
-    // such as "zip" and the part from_offset which will be less than uint32_t.
-    std::vector<std::string> parts;
+  // decompressed members by the forensic path that reaches them, for
+  // example "1000-zip", with the least recently read dropped first
+  class media_member_cache_t {
+
+    private:
+    typedef std::list<std::string> lru_t;
+    struct member_t {
+      uint8_t* buf;
+      size_t size;
+      lru_t::iterator lru_it;
+      member_t(uint8_t* const p_buf, const size_t p_size,
+               const lru_t::iterator p_lru_it) :
+                 buf(p_buf), size(p_size), lru_it(p_lru_it) {
+      }
+    };
+    std::map<std::string, member_t> members;
+    lru_t lru;
+    const size_t max_bytes;
+    size_t cached_bytes;
+
+    // do not allow copy or assignment
+    media_member_cache_t(const media_member_cache_t&);
+    media_member_cache_t& operator=(const media_member_cache_t&);
+
+    public:
+    size_t hits;
+    size_t misses;
+
+    media_member_cache_t(const size_t p_max_bytes) :
+                 members(), lru(), max_bytes(p_max_bytes), cached_bytes(0),
+                 hits(0), misses(0) {
+    }
+
+    ~media_member_cache_t() {
+      for (std::map<std::string, member_t>::iterator it = members.begin();
+           it != members.end(); ++it) {
+        delete[] it->second.buf;
+      }
+    }
+
+    // find the member, marking it most recently read
+    bool find(const std::string& path, const uint8_t** buf, size_t* size) {
+      std::map<std::string, member_t>::iterator it = members.find(path);
+      if (it == members.end()) {
+        return false;
+      }
+      lru.splice(lru.end(), lru, it->second.lru_it);
+      *buf = it->second.buf;
+      *size = it->second.size;
+      return true;
+    }
+
+    // take the member if it fits, else leave it with the caller
+    bool insert(const std::string& path, uint8_t* const buf,
+                const size_t size) {
+      if (size > max_bytes || members.find(path) != members.end()) {
+        return false;
+      }
+      while (cached_bytes + size > max_bytes) {
+        std::map<std::string, member_t>::iterator it =
+                                               members.find(lru.front());
+        cached_bytes -= it->second.size;
+        delete[] it->second.buf;
+        members.erase(it);
+        lru.pop_front();
+      }
+      members.insert(std::pair<std::string, member_t>(path,
+                     member_t(buf, size, lru.insert(lru.end(), path))));
+      cached_bytes += size;
+      return true;
+    }
+  };
+
+  // split forensic path into array of parts
+  // The number of parts will be odd.  The first part is the first_from_offset
+  // and can be uint64_t.  The remaining part pairs will be the part type
+  // such as "zip" and the part from_offset which will be less than uint32_t.
+  static void split_forensic_path(const std::string& media_offset,
+                                  std::vector<std::string>& parts) {
+    parts.clear();
     std::stringstream ss(media_offset);
     std::string part;
     while (std::getline(ss, part, '-')) {
       parts.push_back(part);
     }
+  }
 
-    // get file offset into in_offset
-    std::vector<std::string>::const_iterator it = parts.begin();
-    if (it == parts.end()) {
-      return "invalid forensic path, media offset expected";
-    }
+  static uint64_t first_from_offset_of(
+                                  const std::vector<std::string>& parts) {
     uint64_t first_from_offset = 0;
-    std::istringstream iss(*it);
+    std::istringstream iss(parts[0]);
     iss >> first_from_offset;
+    return first_from_offset;
+  }
 
-    // open the file reader
-    const hasher::file_reader_t file_reader(hasher::utf8_to_native(
-                                                           media_filename));
-    if (file_reader.error_message.size() > 0) {
-      // the file failed to open
-      return file_reader.error_message;
+  // get bytes from range
+  static void copy_range(const uint8_t* const from_buf,
+                         const size_t from_size,
+                         const uint64_t from_offset,
+                         const uint64_t count,
+                         std::string& bytes) {
+    if (from_offset + count <= from_size) {
+      // range is within buffer
+      bytes = std::string(reinterpret_cast<const char*>(
+                                    from_buf + from_offset), count);
+    } else if (from_offset > from_size) {
+      // range starts outside buffer
+      bytes = "";
+    } else {
+      // range exceeds buffer limit
+      bytes = std::string(reinterpret_cast<const char*>(
+                        from_buf + from_offset), from_size - from_offset);
     }
+  }
+
+  // read count bytes at the split forensic path, decompressing down the
+  // path from the deepest member that is cached
+  static std::string read_parts(const hasher::file_reader_t& file_reader,
+                                media_member_cache_t& member_cache,
+                                uint8_t* const read_buf,
+                                const std::vector<std::string>& parts,
+                                const uint64_t count,
+                                std::string& bytes) {
 
-    // create a buffer to read into, allow 1MB
-    size_t from_size = 1048576; // 1MiB = 2^20
-    uint8_t* from_buf = new (std::nothrow) uint8_t[from_size]();
-    if (from_buf == NULL) {
-      // abort
-      return "bad memory allocation";
+    bytes = "";
+    if (parts.size() == 0) {
+      return "invalid forensic path, media offset expected";
     }
 
-    // read into from_buf
-    const std::string read_error_message =
-          file_reader.read(first_from_offset, from_buf, from_size, &from_size);
-    if (read_error_message != "") {
-      delete[] from_buf;
-      return read_error_message;
+    // the paths of the members along the forensic path
+    std::vector<std::string> member_paths;
+    std::string member_path = parts[0];
+    for (size_t i = 1; i < parts.size(); i += 2) {
+      member_path += "-" + parts[i];
+      member_paths.push_back(member_path);
+      member_path += (i + 1 < parts.size()) ? "-" + parts[i + 1] : "";
     }
 
-    // now recursively read down the forensic path
+    // start from the deepest cached member, else from the media
+    const uint8_t* from_buf = NULL;
+    size_t from_size = 0;
     size_t from_offset = 0;
-    while (++it != parts.end()) {
+    bool owned = false;
+    size_t layer = member_paths.size();
+    while (layer > 0 && !member_cache.find(member_paths[layer - 1],
+                                           &from_buf, &from_size)) {
+      --layer;
+    }
+    if (layer > 0) {
+      ++member_cache.hits;
+      if (2 * layer >= parts.size()) {
+        return "invalid forensic path, compression offset expected";
+      }
+      from_offset = ::atol(parts[2 * layer].c_str());
+    } else {
+      // read into read_buf
+      from_size = media_read_size;
+      const std::string read_error_message = file_reader.read(
+                           first_from_offset_of(parts), read_buf, from_size,
+                           &from_size);
+      if (read_error_message != "") {
+        return read_error_message;
+      }
+      from_buf = read_buf;
+    }
+
+    // now recursively read down the forensic path
+    for (; layer < member_paths.size(); ++layer) {
 
       // get compression type
-      std::string compression_type = *it;
+      const std::string& compression_type = parts[2 * layer + 1];
+      const hasher::container_t* const container =
+                                    hasher::find_container(compression_type);
+      if (container == NULL) {
+        // unrecognized compression type
+        if (owned) delete[] from_buf;
+        return "invalid forensic path, compression type expected";
+      }
 
       // read into new to_buf
       uint8_t* to_buf = NULL;
       size_t to_size = 0;
-
-      if (compression_type == "zip") {
-        std::string error_message = hasher::new_from_zip(
-                                          from_buf, from_size, from_offset,
-                                          &to_buf, &to_size);
-        if (error_message != "") {
-          // error in zip decompression
-          delete[] from_buf;
-          return error_message;
-        }
-
-      } else if (compression_type == "gzip") {
-        std::string error_message = hasher::new_from_gzip(
-                                          from_buf, from_size, from_offset,
-                                          &to_buf, &to_size);
-        if (error_message != "") {
-          // error in gzip decompression
-          delete[] from_buf;
-          return error_message;
-        }
-
-      } else {
-        // unrecognized compression type
-        delete[] from_buf;
-        return "invalid forensic path, compression type expected";
+      size_t in_used;
+      std::string error_message = container->decode(
+                                        from_buf, from_size, from_offset,
+                                        &to_buf, &to_size, &in_used);
+      if (owned) delete[] from_buf;
+      if (error_message != "") {
+        // error in decompression
+        return error_message;
       }
+      ++member_cache.misses;
+
+      // keep the member for later forensic paths into it
+      owned = !member_cache.insert(member_paths[layer], to_buf, to_size);
 
       // get from_offset
-      if (++it == parts.end()) {
+      if (2 * layer + 2 >= parts.size()) {
         // missing offset
-        delete[] from_buf;
-        delete[] to_buf;
+        if (owned) delete[] to_buf;
         return "invalid forensic path, compression offset expected";
       }
-      from_offset = ::atol(it->c_str());
-
-      // done with from_buf
-      delete[] from_buf;
+      from_offset = ::atol(parts[2 * layer + 2].c_str());
 
       // move new to_buf into working from_buf
       from_buf = to_buf;
       from_size = to_size;
     }
 
-    // get bytes from range
-    if (from_offset + count <= from_size) {
-      // range is within buffer
-      bytes = std::string(reinterpret_cast<const char*>(
-                                    from_buf + from_offset), count);
-    } else if (from_offset > from_size) {
-      // range starts outside buffer
+    copy_range(from_buf, from_size, from_offset, count, bytes);
+    if (owned) delete[] from_buf;
+    return "";
+  }
+
+  media_reader_t::media_reader_t(const std::string& media_image_file,
+                                 const size_t max_cache_bytes) :
+             file_reader(new hasher::file_reader_t(
+                                hasher::utf8_to_native(media_image_file))),
+             member_cache(new media_member_cache_t(max_cache_bytes)),
+             read_buf(new uint8_t[media_read_size]()) {
+  }
+
+  media_reader_t::~media_reader_t() {
+    delete file_reader;
+    delete member_cache;
+    delete[] read_buf;
+  }
+
+  std::string media_reader_t::error_message() const {
+    return file_reader->error_message;
+  }
+
+  uint64_t media_reader_t::size() const {
+    return file_reader->filesize;
+  }
+
+  size_t media_reader_t::cache_hits() const {
+    return member_cache->hits;
+  }
+
+  size_t media_reader_t::cache_misses() const {
+    return member_cache->misses;
+  }
+
+  std::string media_reader_t::read(const std::string& media_offset,
+                                   const uint64_t count,
+                                   std::string& bytes) {
+    if (file_reader->error_message.size() > 0) {
+      // the file failed to open
       bytes = "";
-    } else {
-      // range exceeds buffer limit
-      bytes = std::string(reinterpret_cast<const char*>(
-                        from_buf + from_offset), from_size - from_offset);
+      return file_reader->error_message;
     }
+    std::vector<std::string> parts;
+    split_forensic_path(media_offset, parts);
+    return read_parts(*file_reader, *member_cache, read_buf, parts, count,
+                      bytes);
+  }
 
-    // done
-    delete[] from_buf;
-    return "";
+  // read in media order so that paths into the same member follow each
+  // other, and coalesce raw reads that are near each other
+  std::string media_reader_t::read(
+                           const std::vector<std::string>& media_offsets,
+                           const uint64_t count,
+                           std::vector<std::string>& bytes) {
+    bytes.assign(media_offsets.size(), "");
+    if (file_reader->error_message.size() > 0) {
+      // the file failed to open
+      return file_reader->error_message;
+    }
+
+    // split the paths and order them by media offset then path
+    std::vector<std::vector<std::string> > parts(media_offsets.size());
+    std::vector<std::pair<uint64_t, size_t> > order;
+    order.reserve(media_offsets.size());
+    std::string first_error_message = "";
+    for (size_t i = 0; i < media_offsets.size(); ++i) {
+      split_forensic_path(media_offsets[i], parts[i]);
+      if (parts[i].size() == 0) {
+        if (first_error_message == "") {
+          first_error_message = "invalid forensic path, media offset expected";
+        }
+        continue;
+      }
+      order.push_back(std::pair<uint64_t, size_t>(
+                                first_from_offset_of(parts[i]), i));
+    }
+    std::sort(order.begin(), order.end());
+
+    const uint64_t raw_count = (count < media_read_size) ?
+                               count : media_read_size;
+    size_t j = 0;
+    while (j < order.size()) {
+      const size_t i = order[j].second;
+      std::string error_message;
+      if (parts[i].size() > 1) {
+        // compressed, read through the member cache
+        error_message = read_parts(*file_reader, *member_cache, read_buf,
+                                   parts[i], count, bytes[i]);
+        ++j;
+      } else {
+        // raw, find the run of raw reads to coalesce
+        const uint64_t run_begin = order[j].first;
+        uint64_t run_end = run_begin + raw_count;
+        size_t k = j + 1;
+        while (k < order.size() && parts[order[k].second].size() == 1 &&
+               order[k].first <= run_end + coalesce_gap &&
+               order[k].first + raw_count - run_begin <= media_read_size) {
+          run_end = order[k].first + raw_count;
+          ++k;
+        }
+
+        // read the run then copy out each range
+        size_t run_size = 0;
+        error_message = file_reader->read(run_begin, read_buf,
+                        static_cast<size_t>(run_end - run_begin), &run_size);
+        if (error_message == "") {
+          for (; j < k; ++j) {
+            copy_range(read_buf, run_size, order[j].first - run_begin,
+                       raw_count, bytes[order[j].second]);
+          }
+        }
+        j = k;
+      }
+      if (error_message != "" && first_error_message == "") {
+        first_error_message = error_message;
+      }
+    }
+    return first_error_message;
+  }
+
+  // convenience function to
+  // read bytes from media starting at offset.
+  std::string read_media(const std::string& media_filename,
+                         const uint64_t offset,
+                         const uint64_t count,
+                         std::string& bytes) {
+    std::stringstream ss;
+    ss << offset;
+    return read_media(media_filename, ss.str(), count, bytes);
+  }
+
+  // read count bytes at media offset.
+  // Two example paths are 1000 and 1000-zip-0.
+  // Return "" and reason on failure.
+  std::string read_media(const std::string& media_filename,
+                         const std::string& media_offset,
+                         const uint64_t count,
+                         std::string& bytes) {
+    media_reader_t media_reader(media_filename, 0);
+    return media_reader.read(media_offset, count, bytes);
   }
 
   // read size, in bytes, of the given media
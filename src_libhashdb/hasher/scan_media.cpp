@@ -37,23 +37,39 @@
 #endif
 
 #include <string>
+#include <vector>
 #include <cassert>
 #include <iostream>
 #include <unistd.h> // for F_OK
 #include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "num_cpus.hpp"
 #include "hashdb.hpp"
 #include "file_reader.hpp"
+#include "read_ahead.hpp"
+#include "buffer_pool.hpp"
 #include "hash_calculator.hpp"
 #include "threadpool.hpp"
 #include "job.hpp"
 #include "job_queue.hpp"
 #include "scan_tracker.hpp"
+#include "checkpoint.hpp"
+#include "stage_stats.hpp"
 #include "tprint.hpp"
 
 static const size_t BUFFER_DATA_SIZE = 16777216;   // 2^24=16MiB
 static const size_t BUFFER_SIZE = 17825792;        // 2^24+2^20=17MiB
 static const size_t MAX_RECURSION_DEPTH = 7;
+static const size_t READ_AHEAD_CHUNKS = 2;         // reads outstanding
+static const size_t SAMPLE_REGION_SIZE = 1048576;  // 2^20=1MiB per sample
+static const double CONFIDENCE_Z = 1.96;           // 95% confidence
+static const uint64_t CHECKPOINT_SECONDS = 300;    // between checkpoints
 
 namespace hashdb {
   // ************************************************************
@@ -61,96 +77,156 @@ namespace hashdb {
   // ************************************************************
   std::string scan_file(
         const hasher::file_reader_t& file_reader,
-        hashdb::scan_manager_t& scan_manager,
+        const hasher::scan_managers_t& scan_managers,
         hasher::scan_tracker_t& scan_tracker,
         const size_t step_size,
         const size_t block_size,
+        const size_t min_chunk_size,
+        const size_t max_chunk_size,
+        const std::string& block_hash_algorithm,
         const bool process_embedded_data,
         const hashdb::scan_mode_t scan_mode,
-        hasher::job_queue_t* const job_queue) {
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue,
+        const hasher::threadpool_t* const threadpool,
+        hasher::checkpoint_t* const checkpoint,
+        const uint64_t start_offset,
+        const size_t max_ahead) {
 
     // identify the maximum recursion depth
     size_t max_recursion_depth = 
                         (process_embedded_data) ? MAX_RECURSION_DEPTH : 0;
 
-    // create buffer b to read into
-    size_t b_size = (file_reader.filesize <= BUFFER_SIZE) ?
-                          file_reader.filesize : BUFFER_SIZE;
-    uint8_t* b = new (std::nothrow) uint8_t[b_size]();
-    if (b == NULL) {
-      return "bad memory allocation";
-    }
-
-    // read into buffer b
-    size_t bytes_read;
-    std::string error_message;
-    error_message = file_reader.read(0, b, b_size, &bytes_read);
-    if (error_message.size() > 0) {
-      // abort
-      delete[] b;
-      return error_message;
-    }
+    // read file sections ahead and push them onto the job queue
+    hasher::read_ahead_t read_ahead(file_reader, BUFFER_DATA_SIZE,
+                                    BUFFER_SIZE, max_ahead,
+                                    buffer_pool, start_offset);
+    hasher::read_chunk_t chunk;
+    while (read_ahead.next(chunk)) {
+      if (chunk.error_message.size() > 0) {
+        // abort submitting jobs for this file
+        return chunk.error_message;
+      }
 
-    // build buffers from file sections and push them onto the job queue
+      // maybe checkpoint, once everything below this chunk is reported
+      if (checkpoint != NULL && checkpoint->is_due()) {
+        threadpool->wait_idle();
+        std::cout.flush();
+        std::stringstream done;
+        done << chunk.offset;
+        checkpoint->done = done.str();
+        checkpoint->zero_count = scan_tracker.zero_count;
+        const std::string error_message = checkpoint->write();
+        if (error_message.size() > 0) {
+          std::stringstream ss;
+          ss << "# Checkpoint not taken: " << error_message << "\n";
+          hashdb::tprint(std::cout, ss.str());
+        }
+      }
 
-    // push buffer b onto the job queue
-    size_t b_data_size = (b_size > BUFFER_DATA_SIZE)
-                         ? BUFFER_DATA_SIZE : b_size;
-    job_queue->push(hasher::job_t::new_scan_job(
-                 &scan_manager,
+      // push this buffer onto the job queue
+      size_t data_size = (chunk.buffer_size > BUFFER_DATA_SIZE)
+                                        ? BUFFER_DATA_SIZE : chunk.buffer_size;
+      if (chunk.is_hole) {
+        // a hole is all zero blocks, counted without a job
+        const size_t zero_count = (data_size + step_size - 1) / step_size;
+        scan_tracker.track_zero_count(zero_count);
+        scan_tracker.track_bytes(data_size);
+        scan_tracker.track_blocks(chunk.offset, zero_count, 0);
+        continue;
+      }
+      job_queue->push(hasher::job_t::new_scan_job(
+                 &scan_managers,
                  &scan_tracker,
                  step_size,
                  block_size,
+                 min_chunk_size,
+                 max_chunk_size,
+                 block_hash_algorithm,
                  file_reader.filename,
                  file_reader.filesize,
-                 0,      // file_offset
+                 chunk.offset,      // file_offset
                  process_embedded_data,
                  scan_mode,
-                 b,      // buffer
-                 b_size, // buffer_size
-                 b_data_size, // buffer_data_size,
+                 chunk.buffer,      // buffer
+                 chunk.buffer_size, // buffer_size
+                 data_size,         // buffer_data_size
+                 chunk.mapped_file, // mapped_file
+                 chunk.buffer_pool, // buffer_pool
                  max_recursion_depth,
                  0,      // recursion_depth
                  ""));   // recursion path
+    }
+    return "";
+  }
 
-    // read and push remaining buffers onto the job queue
-    for (uint64_t offset = BUFFER_DATA_SIZE;
-         offset < file_reader.filesize;
-         offset += BUFFER_DATA_SIZE) {
+  // read bytes [begin, end) of the file in parts of up to part_size bytes
+  // and push them onto the job queue
+  static std::string scan_range(
+        const hasher::file_reader_t& file_reader,
+        const uint64_t begin,
+        const uint64_t end,
+        const size_t part_size,
+        const hasher::scan_managers_t& scan_managers,
+        hasher::scan_tracker_t& scan_tracker,
+        const size_t step_size,
+        const size_t block_size,
+        const size_t min_chunk_size,
+        const size_t max_chunk_size,
+        const std::string& block_hash_algorithm,
+        const bool process_embedded_data,
+        const hashdb::scan_mode_t scan_mode,
+        hasher::buffer_pool_t& buffer_pool,
+        hasher::job_queue_t* const job_queue) {
 
-      // create b2 to read into
-      uint8_t* b2 = new (std::nothrow) uint8_t[BUFFER_SIZE]();
-      if (b2 == NULL) {
-        // abort
+    // identify the maximum recursion depth
+    size_t max_recursion_depth = 
+                        (process_embedded_data) ? MAX_RECURSION_DEPTH : 0;
+
+    for (uint64_t offset = begin; offset < end; offset += part_size) {
+
+      // read the part and the block or chunk that straddles its end
+      const size_t data_size = (end - offset < part_size)
+                               ? static_cast<size_t>(end - offset) : part_size;
+      size_t read_size = data_size + ((max_chunk_size > block_size)
+                                      ? max_chunk_size : block_size);
+      if (read_size > BUFFER_SIZE) {
+        read_size = BUFFER_SIZE;
+      }
+      if (read_size > file_reader.filesize - offset) {
+        read_size = static_cast<size_t>(file_reader.filesize - offset);
+      }
+      uint8_t* const buffer = buffer_pool.acquire();
+      if (buffer == NULL) {
         return "bad memory allocation";
       }
-
-      // read into b2
-      size_t b2_bytes_read = 0;
-      error_message = file_reader.read(
-                                  offset, b2, BUFFER_SIZE, &b2_bytes_read);
-      if (error_message.size() > 0) {
-        // abort submitting jobs for this file
-        delete[] b2;
-        return error_message;
+      size_t bytes_read;
+      const std::string read_error_message =
+                 file_reader.read(offset, buffer, read_size, &bytes_read);
+      if (read_error_message.size() > 0) {
+        buffer_pool.release(buffer);
+        return read_error_message;
       }
 
-      // push this buffer b2 onto the job queue
-      size_t b2_data_size = (b2_bytes_read > BUFFER_DATA_SIZE)
-                                        ? BUFFER_DATA_SIZE : b2_bytes_read;
+      // push this buffer onto the job queue
       job_queue->push(hasher::job_t::new_scan_job(
-                 &scan_manager,
+                 &scan_managers,
                  &scan_tracker,
                  step_size,
                  block_size,
+                 min_chunk_size,
+                 max_chunk_size,
+                 block_hash_algorithm,
                  file_reader.filename,
                  file_reader.filesize,
-                 offset,  // file_offset
+                 offset,            // file_offset
                  process_embedded_data,
                  scan_mode,
-                 b2,      // buffer
-                 b2_bytes_read, // buffer_size
-                 b2_data_size,  // buffer_data_size
+                 buffer,            // buffer
+                 bytes_read,        // buffer_size
+                 (bytes_read < data_size) ? bytes_read : data_size,
+                 NULL,              // mapped_file
+                 &buffer_pool,      // buffer_pool
                  max_recursion_depth,
                  0,      // recursion_depth
                  ""));   // recursion path
@@ -158,6 +234,152 @@ namespace hashdb {
     return "";
   }
 
+  // a deterministic pseudorandom sequence so samples are repeatable
+  static uint64_t next_random(uint64_t& state) {
+    // splitmix64
+    state += 0x9e3779b97f4a7c15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // close the scan managers
+  static void close_scan_managers(hasher::scan_managers_t& scan_managers) {
+    for (size_t i=0; i<scan_managers.size(); ++i) {
+      delete scan_managers[i].scan_manager;
+      delete scan_managers[i].filter;
+    }
+    scan_managers.clear();
+  }
+
+  // open scan managers, tagging matches by hash database when scanning
+  // against more than one, and set the settings that media is hashed
+  // with.  Block hashes of each hash database must be calculated the same
+  // way so that each block is hashed once.  A filter file exported by
+  // export_filter is opened in place of a hash database and is scanned
+  // against alone.
+  static std::string open_scan_managers(
+                         const std::vector<std::string>& hashdb_dirs,
+                         hashdb::settings_t& settings,
+                         hasher::scan_managers_t& scan_managers) {
+
+    if (hashdb_dirs.size() == 0) {
+      return "No hash database to scan against.";
+    }
+    std::string error_message;
+    if (hashdb::portable_filter_t::is_filter_file(hashdb_dirs[0])) {
+      if (hashdb_dirs.size() > 1) {
+        return "A filter file is scanned against alone.";
+      }
+      hashdb::portable_filter_t* const filter =
+                 hashdb::portable_filter_t::read(hashdb_dirs[0],
+                                                 error_message);
+      if (filter == NULL) {
+        return error_message;
+      }
+      settings.block_size = filter->block_size;
+      settings.block_hash_algorithm = filter->block_hash_algorithm;
+      scan_managers.push_back(hasher::scan_target_t("", NULL, filter));
+      return "";
+    }
+
+    // make sure each hashdb_dir is there
+    error_message = hashdb::read_settings(hashdb_dirs[0], settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    for (size_t i=1; i<hashdb_dirs.size(); ++i) {
+      if (hashdb::portable_filter_t::is_filter_file(hashdb_dirs[i])) {
+        return "A filter file is scanned against alone.";
+      }
+      hashdb::settings_t other_settings;
+      error_message = hashdb::read_settings(hashdb_dirs[i], other_settings);
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+      if (other_settings.block_size != settings.block_size ||
+          other_settings.min_chunk_size != settings.min_chunk_size ||
+          other_settings.max_chunk_size != settings.max_chunk_size ||
+          other_settings.block_hash_algorithm !=
+                                       settings.block_hash_algorithm) {
+        return "Block size, chunk sizes, and block hash algorithm of '" +
+               hashdb_dirs[i] + "' do not match those of '" +
+               hashdb_dirs[0] + "'.";
+      }
+    }
+    for (size_t i=0; i<hashdb_dirs.size(); ++i) {
+      scan_managers.push_back(hasher::scan_target_t(
+                  (hashdb_dirs.size() > 1) ? hashdb_dirs[i] : "",
+                  new hashdb::scan_manager_t(hashdb_dirs[i], 0, 0, true),
+                  NULL));
+    }
+    return "";
+  }
+
+  // most matching blocks first
+  static bool more_blocks(const std::pair<uint64_t, std::string>& a,
+                          const std::pair<uint64_t, std::string>& b) {
+    return (a.first != b.first) ? a.first > b.first : a.second < b.second;
+  }
+
+  // print the source summaries of a scan, most matching blocks first,
+  // tagged as match lines are
+  static void print_scan_summary(const hasher::scan_tracker_t& scan_tracker,
+                        const hasher::scan_managers_t& scan_managers) {
+    std::stringstream ss;
+    for (size_t k=0; k<scan_tracker.source_summaries.size(); ++k) {
+      const hasher::source_summaries_t& summaries =
+                                       scan_tracker.source_summaries[k];
+      std::vector<std::pair<uint64_t, std::string> > order;
+      order.reserve(summaries.size());
+      for (hasher::source_summaries_t::const_iterator it =
+           summaries.begin(); it != summaries.end(); ++it) {
+        order.push_back(std::pair<uint64_t, std::string>(it->second.blocks,
+                                                         it->first));
+      }
+      std::sort(order.begin(), order.end(), more_blocks);
+
+      for (size_t i=0; i<order.size(); ++i) {
+        const std::string& file_hash = order[i].second;
+        const hasher::source_summary_t& summary =
+                                       summaries.find(file_hash)->second;
+        uint64_t filesize = 0;
+        std::string file_type;
+        uint64_t zero_count;
+        uint64_t nonprobative_count;
+        scan_managers[k].scan_manager->find_source_data(file_hash, filesize,
+                             file_type, zero_count, nonprobative_count);
+        if (scan_tracker.media_tag.size() > 0) {
+          ss << scan_tracker.media_tag << "\t";
+        }
+        if (scan_managers[k].tag.size() > 0) {
+          ss << scan_managers[k].tag << "\t";
+        }
+        ss << "{\"file_hash\":\"" << hashdb::bin_to_hex(file_hash)
+           << "\",\"filesize\":" << filesize
+           << ",\"blocks\":" << summary.blocks;
+        if (summary.has_offsets) {
+          ss << ",\"first_offset\":" << summary.first_offset
+             << ",\"last_offset\":" << summary.last_offset;
+        }
+        ss << "}\n";
+      }
+    }
+    hashdb::tprint(std::cout, ss.str());
+  }
+
+  // a filter has no sources to summarize
+  static std::string check_scan_summary(
+                         const hasher::scan_managers_t& scan_managers,
+                         const bool summarize) {
+    if (summarize && scan_managers.size() > 0 &&
+        scan_managers[0].filter != NULL) {
+      return "A scan of a filter file is not summarized.";
+    }
+    return "";
+  }
+
   // ************************************************************
   // scan_media
   // ************************************************************
@@ -165,29 +387,87 @@ namespace hashdb {
                          const std::string& media_filename,
                          const size_t step_size,
                          const bool process_embedded_data,
-                         const hashdb::scan_mode_t scan_mode) {
+                         const hashdb::scan_mode_t scan_mode,
+                         const scan_media_options_t& options) {
+    return scan_media_multiple(std::vector<std::string>(1, hashdb_dir),
+                               media_filename, step_size,
+                               process_embedded_data, scan_mode, options);
+  }
+
+  // ************************************************************
+  // scan_media_multiple
+  // ************************************************************
+  std::string scan_media_multiple(const std::vector<std::string>& hashdb_dirs,
+                         const std::string& media_filename,
+                         const size_t step_size,
+                         const bool process_embedded_data,
+                         const hashdb::scan_mode_t scan_mode,
+                         const scan_media_options_t& options) {
 
-    // make sure hashdb_dir is there
+    // open the scan managers
     std::string error_message;
     hashdb::settings_t settings;
-    error_message = hashdb::read_settings(hashdb_dir, settings);
+    hasher::scan_managers_t scan_managers;
+    error_message = open_scan_managers(hashdb_dirs, settings, scan_managers);
+    if (error_message.size() == 0) {
+      error_message = check_scan_summary(scan_managers, options.summarize);
+    }
     if (error_message.size() != 0) {
+      close_scan_managers(scan_managers);
       return error_message;
     }
 
-    // open scan manager
-    hashdb::scan_manager_t scan_manager(hashdb_dir);
-
     // open the file reader
     const hasher::file_reader_t file_reader(hasher::utf8_to_native(
-                                                           media_filename));
+                                     media_filename), options.direct_reads);
     if (file_reader.error_message.size() > 0) {
       // the file failed to open
+      close_scan_managers(scan_managers);
       return file_reader.error_message;
     }
 
+    // a summary is printed at the end so there is no offset to resume at
+    if (options.checkpoint_file.size() > 0 && options.summarize) {
+      close_scan_managers(scan_managers);
+      return "A summarized scan does not take checkpoints.";
+    }
+
     // create the scan_tracker
-    hasher::scan_tracker_t scan_tracker(file_reader.filesize);
+    hasher::scan_tracker_t scan_tracker(file_reader.filesize,
+                                        options.quiet, "",
+                                        options.min_k_entropy,
+                                        options.skip_labeled,
+                                        options.summarize);
+
+    // maybe resume at the offset of an interrupted scan
+    hasher::checkpoint_t* const checkpoint =
+                 (options.checkpoint_file.size() > 0) ?
+                 new hasher::checkpoint_t(options.checkpoint_file,
+                                          CHECKPOINT_SECONDS,
+                                          "scan_media", media_filename) : NULL;
+    uint64_t start_offset = 0;
+    if (checkpoint != NULL && options.resume) {
+      error_message = checkpoint->read();
+      if (error_message.size() != 0) {
+        delete checkpoint;
+        close_scan_managers(scan_managers);
+        return error_message;
+      }
+      start_offset = std::strtoull(checkpoint->done.c_str(), NULL, 10);
+      if (start_offset % BUFFER_DATA_SIZE != 0 ||
+          start_offset > file_reader.filesize) {
+        error_message = "Invalid offset '" + checkpoint->done +
+                        "' in checkpoint file '" + options.checkpoint_file +
+                        "'.";
+        delete checkpoint;
+        close_scan_managers(scan_managers);
+        return error_message;
+      }
+      scan_tracker.track_zero_count(checkpoint->zero_count);
+      std::stringstream ss;
+      ss << "# Resuming at offset " << start_offset << "\n";
+      hashdb::tprint(std::cout, ss.str());
+    }
 
     // get the number of CPUs
     const size_t num_cpus = hashdb::numCPU();
@@ -195,15 +475,26 @@ namespace hashdb {
     // create the job queue to hold more jobs than threads
     hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
 
-    // create the threadpool that will process jobs until job_queue.is_done
+    // create the buffer pool to hold buffers for queued jobs, jobs being
+    // processed, and chunks read ahead or being read by each E01 reader
+    hasher::buffer_pool_t buffer_pool(BUFFER_SIZE,
+                                      num_cpus * 4 + READ_AHEAD_CHUNKS + 2,
+                                      READ_AHEAD_CHUNKS + 2);
+
+    // create the threadpool that will process jobs until done_adding
     hasher::threadpool_t* const threadpool =
                                new hasher::threadpool_t(num_cpus, job_queue);
 
     // scan the file
-    std::string success = scan_file(file_reader, scan_manager, scan_tracker,
+    std::string success = scan_file(file_reader, scan_managers, scan_tracker,
                                     step_size, settings.block_size,
+                                    settings.min_chunk_size,
+                                    settings.max_chunk_size,
+                                    settings.block_hash_algorithm,
                                     process_embedded_data, scan_mode,
-                                    job_queue);
+                                    buffer_pool, job_queue, threadpool,
+                                    checkpoint, start_offset,
+                                    READ_AHEAD_CHUNKS);
     if (success.size() > 0) {
       std::stringstream ss;
       ss << "# Error while scanning file " << file_reader.filename
@@ -215,13 +506,491 @@ namespace hashdb {
     job_queue->done_adding();
     delete threadpool;
     delete job_queue;
+    if (options.summarize) {
+      print_scan_summary(scan_tracker, scan_managers);
+    }
+    close_scan_managers(scan_managers);
 
     std::cout << "# Total zero-byte blocks found: " << scan_tracker.zero_count
               << "\n";
+    if (scan_tracker.filter_active()) {
+      std::cout << "# Total filtered blocks: " << scan_tracker.filtered_count
+                << "\n";
+    }
+
+    // the scan is complete so there is nothing to resume
+    if (checkpoint != NULL) {
+      checkpoint->remove();
+      delete checkpoint;
+    }
 
     // success
     return "";
   }
 
-} // end namespace hashdb
+  // ************************************************************
+  // scan_media_list
+  // ************************************************************
+  // The media images on one device, scanned one after another by one
+  // feeder thread that pushes jobs onto the job queue shared by all
+  // devices.  Each device reads ahead queue_depth chunks.
+  class device_queue_t {
+    private:
+    // do not allow copy or assignment
+    device_queue_t(const device_queue_t&);
+    device_queue_t& operator=(const device_queue_t&);
+
+    const hasher::scan_managers_t& scan_managers;
+    const size_t step_size;
+    const hashdb::settings_t settings;
+    const bool process_embedded_data;
+    const hashdb::scan_mode_t scan_mode;
+    const hashdb::scan_media_options_t options;
+    const size_t queue_depth;
+    hasher::buffer_pool_t& buffer_pool;
+    hasher::job_queue_t* const job_queue;
+    const hasher::threadpool_t* const threadpool;
+    pthread_t thread;
+
+    static void* run(void* const arg) {
+      static_cast<device_queue_t*>(arg)->scan_all();
+      return NULL;
+    }
+
+    void scan_all() {
+      const uint64_t start_ns = hashdb::stage_clock_ns();
+      for (size_t i=0; i<media_filenames.size(); ++i) {
+        const hasher::file_reader_t file_reader(hasher::utf8_to_native(
+                               media_filenames[i]), options.direct_reads);
+        if (file_reader.error_message.size() > 0) {
+          std::stringstream ss;
+          ss << "# Unable to scan media image " << media_filenames[i]
+             << ": " << file_reader.error_message << "\n";
+          hashdb::tprint(std::cout, ss.str());
+          scan_trackers.push_back(NULL);
+          continue;
+        }
+
+        // jobs report to the tracker after this file is read, so it is
+        // kept until all jobs are done
+        hasher::scan_tracker_t* const scan_tracker =
+                           new hasher::scan_tracker_t(file_reader.filesize,
+                                    options.quiet, media_filenames[i],
+                                    options.min_k_entropy,
+                                    options.skip_labeled, options.summarize);
+        scan_trackers.push_back(scan_tracker);
+        const std::string error_message = scan_file(file_reader,
+                 scan_managers, *scan_tracker, step_size,
+                 settings.block_size, settings.min_chunk_size,
+                 settings.max_chunk_size, settings.block_hash_algorithm,
+                 process_embedded_data, scan_mode, buffer_pool, job_queue,
+                 threadpool, NULL, 0, queue_depth);
+        if (error_message.size() > 0) {
+          std::stringstream ss;
+          ss << "# Error while scanning file " << file_reader.filename
+             << ", " << error_message << "\n";
+          hashdb::tprint(std::cout, ss.str());
+        }
+        bytes_scanned += file_reader.filesize;
+      }
+      elapsed_ns = hashdb::stage_clock_ns() - start_ns;
+    }
+
+    public:
+    std::vector<std::string> media_filenames;
+    std::vector<hasher::scan_tracker_t*> scan_trackers; // NULL if unread
+    uint64_t bytes_scanned;
+    uint64_t elapsed_ns;
+
+    device_queue_t(const hasher::scan_managers_t& p_scan_managers,
+                   const size_t p_step_size,
+                   const hashdb::settings_t& p_settings,
+                   const bool p_process_embedded_data,
+                   const hashdb::scan_mode_t p_scan_mode,
+                   const hashdb::scan_media_options_t& p_options,
+                   const size_t p_queue_depth,
+                   hasher::buffer_pool_t& p_buffer_pool,
+                   hasher::job_queue_t* const p_job_queue,
+                   const hasher::threadpool_t* const p_threadpool) :
+            scan_managers(p_scan_managers), step_size(p_step_size),
+            settings(p_settings),
+            process_embedded_data(p_process_embedded_data),
+            scan_mode(p_scan_mode), options(p_options),
+            queue_depth(p_queue_depth), buffer_pool(p_buffer_pool),
+            job_queue(p_job_queue), threadpool(p_threadpool), thread(),
+            media_filenames(), scan_trackers(),
+            bytes_scanned(0), elapsed_ns(0) {
+    }
+
+    ~device_queue_t() {
+      for (size_t i=0; i<scan_trackers.size(); ++i) {
+        delete scan_trackers[i];
+      }
+    }
+
+    void start() {
+      if (pthread_create(&thread, NULL, device_queue_t::run, this) != 0) {
+        std::cerr << "Unable to start device thread.\n";
+        assert(0);
+      }
+    }
 
+    void join() {
+      pthread_join(thread, NULL);
+    }
+  };
+
+  std::string scan_media_list(const std::vector<std::string>& hashdb_dirs,
+                         const std::string& media_list_file,
+                         const size_t step_size,
+                         const bool process_embedded_data,
+                         const hashdb::scan_mode_t scan_mode,
+                         const size_t queue_depth,
+                         const scan_media_options_t& options) {
+
+    if (options.checkpoint_file.size() > 0) {
+      return "A media list scan takes no checkpoints.";
+    }
+
+    // open the scan managers
+    std::string error_message;
+    hashdb::settings_t settings;
+    hasher::scan_managers_t scan_managers;
+    error_message = open_scan_managers(hashdb_dirs, settings, scan_managers);
+    if (error_message.size() == 0) {
+      error_message = check_scan_summary(scan_managers, options.summarize);
+    }
+    if (error_message.size() != 0) {
+      close_scan_managers(scan_managers);
+      return error_message;
+    }
+
+    // read the media image names, one per line
+    std::ifstream in(media_list_file.c_str());
+    if (!in.is_open()) {
+      close_scan_managers(scan_managers);
+      return "Unable to open media list file '" + media_list_file + "'.";
+    }
+    std::vector<std::string> media_filenames;
+    std::string line;
+    while (getline(in, line)) {
+      if (line.size() > 0 && line[line.size() - 1] == '\r') {
+        line.resize(line.size() - 1);
+      }
+      if (line.size() == 0 || line[0] == '#') {
+        continue;
+      }
+      media_filenames.push_back(line);
+    }
+
+    // group the media images by the device they are on
+    std::map<uint64_t, std::vector<std::string> > device_filenames;
+    for (size_t i=0; i<media_filenames.size(); ++i) {
+      struct stat s;
+      if (stat(media_filenames[i].c_str(), &s) != 0) {
+        close_scan_managers(scan_managers);
+        return "Unable to read media image '" + media_filenames[i] + "'.";
+      }
+      device_filenames[static_cast<uint64_t>(s.st_dev)].push_back(
+                                                        media_filenames[i]);
+    }
+
+
+    // get the number of CPUs
+    const size_t num_cpus = hashdb::numCPU();
+    const size_t depth = (queue_depth == 0) ? READ_AHEAD_CHUNKS : queue_depth;
+
+    // create the job queue, shared by all devices, to hold more jobs than
+    // threads.  Devices that read faster push more of the jobs.
+    hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
+
+    // create the buffer pool to hold buffers for queued jobs, jobs being
+    // processed, and chunks read ahead for each device
+    hasher::buffer_pool_t buffer_pool(BUFFER_SIZE, num_cpus * 4 +
+                                 device_filenames.size() * (depth + 2),
+                                 device_filenames.size() * (depth + 2));
+
+    // create the threadpool that will process jobs until done_adding
+    hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(num_cpus, job_queue);
+
+    // scan the media images of each device on its own thread
+    std::vector<device_queue_t*> devices;
+    for (std::map<uint64_t, std::vector<std::string> >::const_iterator it =
+         device_filenames.begin(); it != device_filenames.end(); ++it) {
+      device_queue_t* const device = new device_queue_t(scan_managers,
+                 step_size, settings, process_embedded_data, scan_mode,
+                 options, depth, buffer_pool, job_queue, threadpool);
+      device->media_filenames = it->second;
+      devices.push_back(device);
+      device->start();
+    }
+    for (size_t i=0; i<devices.size(); ++i) {
+      devices[i]->join();
+    }
+
+    // done
+    job_queue->done_adding();
+    delete threadpool;
+    delete job_queue;
+    if (options.summarize) {
+      for (size_t i=0; i<devices.size(); ++i) {
+        for (size_t j=0; j<devices[i]->scan_trackers.size(); ++j) {
+          if (devices[i]->scan_trackers[j] != NULL) {
+            print_scan_summary(*devices[i]->scan_trackers[j],
+                               scan_managers);
+          }
+        }
+      }
+    }
+    close_scan_managers(scan_managers);
+
+    // report zero blocks by media image and throughput by device
+    std::stringstream ss;
+    for (size_t i=0; i<devices.size(); ++i) {
+      const device_queue_t& device = *devices[i];
+      for (size_t j=0; j<device.media_filenames.size(); ++j) {
+        if (device.scan_trackers[j] != NULL) {
+          ss << "# Total zero-byte blocks found in "
+             << device.media_filenames[j] << ": "
+             << device.scan_trackers[j]->zero_count << "\n";
+          if (device.scan_trackers[j]->filter_active()) {
+            ss << "# Total filtered blocks in "
+               << device.media_filenames[j] << ": "
+               << device.scan_trackers[j]->filtered_count << "\n";
+          }
+        }
+      }
+      const double seconds = device.elapsed_ns / 1e9;
+      ss << "# Device " << i << ": " << device.media_filenames.size()
+         << " media images, " << device.bytes_scanned << " bytes in "
+         << seconds << " seconds";
+      if (seconds > 0) {
+        ss << " (" << device.bytes_scanned / seconds / 1048576 << " MiB/s)";
+      }
+      ss << "\n";
+      delete devices[i];
+    }
+    std::cout << ss.str();
+
+    // success
+    return "";
+  }
+
+  // ************************************************************
+  // scan_media_sample
+  // ************************************************************
+  std::string scan_media_sample(const std::string& hashdb_dir,
+                         const std::string& media_filename,
+                         const size_t step_size,
+                         const bool process_embedded_data,
+                         const hashdb::scan_mode_t scan_mode,
+                         const double sample_fraction,
+                         const bool scan_around_hits,
+                         const scan_media_options_t& options) {
+
+    if (!(sample_fraction > 0.0 && sample_fraction <= 1.0)) {
+      return "Invalid sample fraction, it must be above 0 and at most 1.";
+    }
+    if (options.summarize || options.checkpoint_file.size() > 0) {
+      return "A sampled scan is not summarized and takes no checkpoints.";
+    }
+    if (step_size == 0) {
+      return "Invalid step size 0.";
+    }
+
+    // open the scan manager
+    std::string error_message;
+    hashdb::settings_t settings;
+    hasher::scan_managers_t scan_managers;
+    error_message = open_scan_managers(std::vector<std::string>(1,
+                                  hashdb_dir), settings, scan_managers);
+    if (error_message.size() != 0) {
+      close_scan_managers(scan_managers);
+      return error_message;
+    }
+
+    // open the file reader
+    const hasher::file_reader_t file_reader(hasher::utf8_to_native(
+                                     media_filename), options.direct_reads);
+    if (file_reader.error_message.size() > 0) {
+      // the file failed to open
+      close_scan_managers(scan_managers);
+      return file_reader.error_message;
+    }
+    const uint64_t filesize = file_reader.filesize;
+
+    // Sample one step-aligned region at a random position in each stratum.
+    // Strata are step-aligned and hold the region size divided by the
+    // sample fraction.
+    const uint64_t region_size = (SAMPLE_REGION_SIZE < step_size) ?
+                step_size : SAMPLE_REGION_SIZE / step_size * step_size;
+    uint64_t stratum_size = static_cast<uint64_t>(
+                region_size / sample_fraction) / step_size * step_size;
+    if (stratum_size < region_size) {
+      stratum_size = region_size;
+    }
+    std::vector<std::pair<uint64_t, uint64_t> > regions;
+    uint64_t sampled_bytes = 0;
+    uint64_t random_state = filesize;
+    for (uint64_t stratum = 0; stratum < filesize; stratum += stratum_size) {
+      const uint64_t span = (filesize - stratum < stratum_size) ?
+                            filesize - stratum : stratum_size;
+      uint64_t begin = stratum;
+      if (span > region_size) {
+        const uint64_t positions = (span - region_size) / step_size + 1;
+        begin += next_random(random_state) % positions * step_size;
+      }
+      const uint64_t end = (begin + region_size < stratum + span) ?
+                           begin + region_size : stratum + span;
+      regions.push_back(std::pair<uint64_t, uint64_t>(begin, end));
+      sampled_bytes += end - begin;
+    }
+
+    // get the number of CPUs
+    const size_t num_cpus = hashdb::numCPU();
+
+    // create the buffer pool to hold buffers for queued jobs and jobs
+    // being processed
+    hasher::buffer_pool_t buffer_pool(BUFFER_SIZE, num_cpus * 4 + 2, 2);
+
+    // scan the sampled regions
+    hasher::scan_tracker_t scan_tracker(sampled_bytes, options.quiet, "",
+                                        options.min_k_entropy,
+                                        options.skip_labeled);
+    {
+      hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
+      hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(num_cpus, job_queue);
+      for (size_t i=0; i<regions.size() && error_message.size() == 0; ++i) {
+        error_message = scan_range(file_reader, regions[i].first,
+                                   regions[i].second, region_size,
+                                   scan_managers, scan_tracker,
+                                   step_size, settings.block_size,
+                                   settings.min_chunk_size,
+                                   settings.max_chunk_size,
+                                   settings.block_hash_algorithm,
+                                   process_embedded_data, scan_mode,
+                                   buffer_pool, job_queue);
+      }
+      job_queue->done_adding();
+      delete threadpool;
+      delete job_queue;
+    }
+    if (error_message.size() > 0) {
+      close_scan_managers(scan_managers);
+      return error_message;
+    }
+
+    // estimate the fraction of blocks that match from the densities of
+    // the sampled regions, with a finite population correction
+    const size_t n = scan_tracker.region_densities.size();
+    const double density = (scan_tracker.blocks_scanned == 0) ? 0.0 :
+                           static_cast<double>(scan_tracker.blocks_matched) /
+                           scan_tracker.blocks_scanned;
+    double margin = 0.0;
+    if (n > 1) {
+      double sum_squares = 0.0;
+      for (size_t i=0; i<n; ++i) {
+        const double d = scan_tracker.region_densities[i] - density;
+        sum_squares += d * d;
+      }
+      const double population = static_cast<double>(
+                              (filesize + region_size - 1) / region_size);
+      const double correction = (n < population) ? 1.0 - n / population : 0.0;
+      margin = CONFIDENCE_Z *
+               std::sqrt(sum_squares / (n - 1) / n * correction);
+    }
+    const double low = (density - margin < 0.0) ? 0.0 : density - margin;
+    const double high = (density + margin > 1.0) ? 1.0 : density + margin;
+    const double total_blocks = static_cast<double>(
+                                (filesize + step_size - 1) / step_size);
+
+    std::stringstream ss;
+    ss << "# Sampled " << regions.size() << " regions, "
+       << sampled_bytes << " of " << filesize << " bytes\n"
+       << "# Sampled blocks scanned: " << scan_tracker.blocks_scanned
+       << ", matched: " << scan_tracker.blocks_matched << "\n"
+       << "# Estimated match density: " << density
+       << " (95% confidence " << low << " to " << high << ")\n"
+       << "# Estimated matching blocks: "
+       << static_cast<uint64_t>(density * total_blocks + 0.5)
+       << " (95% confidence " << static_cast<uint64_t>(low * total_blocks)
+       << " to " << static_cast<uint64_t>(high * total_blocks + 0.5)
+       << ")\n";
+    hashdb::tprint(std::cout, ss.str());
+
+    size_t zero_count = scan_tracker.zero_count;
+    size_t filtered_count = scan_tracker.filtered_count;
+
+    // scan the rest of the strata of the sampled regions with matches
+    if (scan_around_hits && scan_tracker.hit_offsets.size() > 0) {
+      std::stringstream ss2;
+      ss2 << "# Scanning around " << scan_tracker.hit_offsets.size()
+          << " sampled regions with matches\n";
+      hashdb::tprint(std::cout, ss2.str());
+
+      std::vector<std::pair<uint64_t, uint64_t> > ranges;
+      uint64_t range_bytes = 0;
+      for (size_t i=0; i<regions.size(); ++i) {
+        if (scan_tracker.hit_offsets.find(regions[i].first) ==
+                                         scan_tracker.hit_offsets.end()) {
+          continue;
+        }
+        const uint64_t stratum = regions[i].first / stratum_size *
+                                 stratum_size;
+        const uint64_t stratum_end = (filesize - stratum < stratum_size) ?
+                                     filesize : stratum + stratum_size;
+        if (stratum < regions[i].first) {
+          ranges.push_back(std::pair<uint64_t, uint64_t>(
+                                            stratum, regions[i].first));
+        }
+        if (regions[i].second < stratum_end) {
+          ranges.push_back(std::pair<uint64_t, uint64_t>(
+                                            regions[i].second, stratum_end));
+        }
+      }
+      for (size_t i=0; i<ranges.size(); ++i) {
+        range_bytes += ranges[i].second - ranges[i].first;
+      }
+
+      hasher::scan_tracker_t around_tracker(range_bytes, options.quiet, "",
+                                            options.min_k_entropy,
+                                            options.skip_labeled);
+      hasher::job_queue_t* job_queue = new hasher::job_queue_t(num_cpus * 2);
+      hasher::threadpool_t* const threadpool =
+                               new hasher::threadpool_t(num_cpus, job_queue);
+      for (size_t i=0; i<ranges.size() && error_message.size() == 0; ++i) {
+        error_message = scan_range(file_reader, ranges[i].first,
+                                   ranges[i].second, BUFFER_DATA_SIZE,
+                                   scan_managers, around_tracker,
+                                   step_size, settings.block_size,
+                                   settings.min_chunk_size,
+                                   settings.max_chunk_size,
+                                   settings.block_hash_algorithm,
+                                   process_embedded_data, scan_mode,
+                                   buffer_pool, job_queue);
+      }
+      job_queue->done_adding();
+      delete threadpool;
+      delete job_queue;
+      if (error_message.size() > 0) {
+        close_scan_managers(scan_managers);
+        return error_message;
+      }
+      zero_count += around_tracker.zero_count;
+      filtered_count += around_tracker.filtered_count;
+    }
+
+    close_scan_managers(scan_managers);
+
+    std::cout << "# Total zero-byte blocks found: " << zero_count << "\n";
+    if (scan_tracker.filter_active()) {
+      std::cout << "# Total filtered blocks: " << filtered_count << "\n";
+    }
+
+    // success
+    return "";
+  }
+
+} // end namespace hashdb
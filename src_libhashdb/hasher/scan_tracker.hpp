@@ -21,6 +21,13 @@
  * \file
  * Tracks zero_count during threaded ingest to know how many zero blocks
  *   are skipped.  Read zero_count after all threads have closed.
+ * Also tracks the blocks scanned and matched in each top-level scan
+ *   job in order to estimate match density from sampled regions.
+ * When several media images are scanned at once, each has a tracker
+ *   tagged with its media image, which is printed with its matches and
+ *   progress.
+ * Also accumulates the matches of each source when scans print a
+ *   summary, see the summarize parameter of hashdb::scan_media.
  */
 
 #ifndef SCAN_TRACKER_HPP
@@ -37,10 +44,46 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <sstream>
 #include "tprint.hpp"
 
 namespace hasher {
 
+// the matches of one source in a scan summary
+struct source_summary_t {
+  uint64_t blocks;          // matching blocks with the source
+  bool has_offsets;         // whether a top-level block matched
+  uint64_t first_offset;    // of the top-level matching blocks
+  uint64_t last_offset;
+  source_summary_t() :
+           blocks(0), has_offsets(false), first_offset(0), last_offset(0) {
+  }
+
+  void add(const source_summary_t& other) {
+    blocks += other.blocks;
+    if (other.has_offsets) {
+      add_offset(other.first_offset);
+      add_offset(other.last_offset);
+    }
+  }
+
+  void add_offset(const uint64_t offset) {
+    if (!has_offsets || offset < first_offset) {
+      first_offset = offset;
+    }
+    if (!has_offsets || offset > last_offset) {
+      last_offset = offset;
+    }
+    has_offsets = true;
+  }
+};
+
+// the summaries of the sources matched in one hash database, by file hash
+typedef std::map<std::string, source_summary_t> source_summaries_t;
+
 class scan_tracker_t {
 
   public:
@@ -49,6 +92,44 @@ class scan_tracker_t {
    */
   size_t zero_count;
 
+  /**
+   * Read filtered_count, the blocks skipped by the scan filter, after
+   * threads have closed.
+   */
+  size_t filtered_count;
+
+  /**
+   * Read block and match totals of top-level scan jobs after threads
+   * have closed.  region_densities holds the fraction of blocks matched
+   * in each job and hit_offsets holds the file offsets of jobs with a
+   * match.
+   */
+  uint64_t blocks_scanned;
+  uint64_t blocks_matched;
+  std::vector<double> region_densities;
+  std::set<uint64_t> hit_offsets;
+
+  /**
+   * Read the source summaries of each hash database scanned against, by
+   * its index, after threads have closed.
+   */
+  std::vector<source_summaries_t> source_summaries;
+
+  // true to not print the status of each job
+  const bool quiet;
+
+  // the media image to print with matches and progress, or ""
+  const std::string media_tag;
+
+  // scanned blocks under min_k_entropy, or with a block label when
+  // skip_labeled is set, are skipped before they are hashed or looked up
+  const uint64_t min_k_entropy;
+  const bool skip_labeled;
+
+  // true to accumulate matches in source_summaries instead of printing
+  // a line for each matching block
+  const bool summarize;
+
   private:
   const uint64_t bytes_total;
   uint64_t bytes_done;
@@ -70,8 +151,21 @@ class scan_tracker_t {
   }
 
   public:
-  scan_tracker_t(const uint64_t p_bytes_total) :
-                     zero_count(0), bytes_total(p_bytes_total),
+  scan_tracker_t(const uint64_t p_bytes_total,
+                 const bool p_quiet = false,
+                 const std::string& p_media_tag = "",
+                 const uint64_t p_min_k_entropy = 0,
+                 const bool p_skip_labeled = false,
+                 const bool p_summarize = false) :
+                     zero_count(0), filtered_count(0),
+                     blocks_scanned(0), blocks_matched(0),
+                     region_densities(), hit_offsets(),
+                     source_summaries(), quiet(p_quiet),
+                     media_tag(p_media_tag),
+                     min_k_entropy(p_min_k_entropy),
+                     skip_labeled(p_skip_labeled),
+                     summarize(p_summarize),
+                     bytes_total(p_bytes_total),
                      bytes_done(0), bytes_reported_done(0), M() {
     if(pthread_mutex_init(&M,NULL)) {
       std::cerr << "Error obtaining mutex.\n";
@@ -83,12 +177,56 @@ class scan_tracker_t {
     pthread_mutex_destroy(&M);
   }
 
+  // whether the scan filter skips any blocks
+  bool filter_active() const {
+    return min_k_entropy > 0 || skip_labeled;
+  }
+
   void track_zero_count(const uint64_t p_zero_count) {
     lock();
     zero_count += p_zero_count;
     unlock();
   }
 
+  void track_filtered_count(const uint64_t p_filtered_count) {
+    lock();
+    filtered_count += p_filtered_count;
+    unlock();
+  }
+
+  void track_blocks(const uint64_t file_offset, const uint64_t scanned,
+                    const uint64_t matched) {
+    if (scanned == 0) {
+      return;
+    }
+    lock();
+    blocks_scanned += scanned;
+    blocks_matched += matched;
+    region_densities.push_back(static_cast<double>(matched) / scanned);
+    if (matched > 0) {
+      hit_offsets.insert(file_offset);
+    }
+    unlock();
+  }
+
+  // add the source summaries of a job for the hash database with index
+  void track_sources(const size_t index,
+                     const source_summaries_t& p_source_summaries) {
+    if (p_source_summaries.size() == 0) {
+      return;
+    }
+    lock();
+    if (source_summaries.size() <= index) {
+      source_summaries.resize(index + 1);
+    }
+    source_summaries_t& summaries = source_summaries[index];
+    for (source_summaries_t::const_iterator it =
+         p_source_summaries.begin(); it != p_source_summaries.end(); ++it) {
+      summaries[it->first].add(it->second);
+    }
+    unlock();
+  }
+
   void track_bytes(const uint64_t count) {
     static const size_t INCREMENT = 134217728; // = 2^27 = 100 MiB
     lock();
@@ -98,7 +236,11 @@ class scan_tracker_t {
 
       // print %done
       std::stringstream ss;
-      ss << "# " << bytes_done
+      ss << "# ";
+      if (media_tag.size() > 0) {
+        ss << media_tag << " ";
+      }
+      ss << bytes_done
          << " of " << bytes_total
          << " bytes completed (" << bytes_done * 100 / bytes_total
          << "%)\n";
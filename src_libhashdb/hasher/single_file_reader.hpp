@@ -22,6 +22,20 @@
  * Read chunks from a single file
  *
  * Adapted heavily from bulk_extractor/src/image_process.cpp.
+ *
+ * When opened for direct reads, reads bypass the page cache so that
+ * scanning or ingesting large media does not evict the hash database.
+ * Reads whose offset, buffer, and size are multiples of direct_alignment use
+ * O_DIRECT where available, and other reads are dropped from the cache
+ * after they are read, using POSIX_FADV_DONTNEED.  Files are not mapped
+ * then, so they are read into the aligned buffers of the buffer pool.
+ *
+ * On Windows the file is opened for overlapped I/O with
+ * FILE_FLAG_SEQUENTIAL_SCAN.  Each read is split into up to
+ * overlapped_requests parts that are read at once, each at its own
+ * offset, so reads from several threads do not contend for a shared
+ * file pointer.  For direct reads, aligned reads use a second
+ * handle opened with FILE_FLAG_NO_BUFFERING.
  */
 
 
@@ -29,15 +43,19 @@
 #define SINGLE_FILE_READER_HPP
 
 #include <unistd.h>
+#include <fcntl.h>  // for posix_fadvise
+#include <cerrno>
 #include <sstream>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <set>
 #include <cassert>
+#include <stdint.h>
 #include <libewf.h>
 #include "filename_t.hpp"
 #include "file_reader_helper.hpp"
+#include "mapped_file.hpp"
 
 #ifndef O_BINARY
 #define O_BINARY 0
@@ -50,10 +68,13 @@ class single_file_reader_t {
   private:
   // SINGLE file data
 #ifdef WIN32
-  HANDLE file_handle;         // currently open file
+  HANDLE file_handle;         // currently open file, for overlapped reads
+  HANDLE direct_handle;       // the file opened unbuffered, or invalid
 #else
   int fd;                     // currently open file
+  int direct_fd;              // the file opened with O_DIRECT, or -1
 #endif
+  const bool drop_behind;     // keep reads out of the page cache
 
   public:
   const filename_t native_filename;
@@ -76,13 +97,21 @@ class single_file_reader_t {
 #ifdef WIN32
     file_handle = CreateFileW(native_filename.c_str(), FILE_READ_DATA,
                                     FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
-                                     OPEN_EXISTING, 0, NULL);
+                                     OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
     if(file_handle==INVALID_HANDLE_VALUE){
       std::stringstream ss;
       ss << "hashdb file reader cannot open file "
          << native_to_utf8(native_filename);
       return ss.str();
     }
+    // aligned reads bypass the cache, or use file_handle if refused
+    if (drop_behind) {
+      direct_handle = CreateFileW(native_filename.c_str(), FILE_READ_DATA,
+                                    FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                                     OPEN_EXISTING,
+                       FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING, NULL);
+    }
 #else        
     fd = ::open(native_filename.c_str(),O_RDONLY|O_BINARY);
     if(fd<=0) {
@@ -90,10 +119,107 @@ class single_file_reader_t {
       ss << "hashdb file reader cannot open file " << native_filename;
       return ss.str();
     }
+#ifdef HAVE_POSIX_FADVISE
+    // files are read mostly in order so ask for aggressive read-ahead
+    (void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#ifdef O_DIRECT
+    // aligned reads bypass the cache, or use fd if O_DIRECT is refused
+    if (drop_behind) {
+      direct_fd = ::open(native_filename.c_str(),
+                         O_RDONLY|O_BINARY|O_DIRECT);
+    }
+#endif
 #endif
     return "";
   }
 
+#ifdef WIN32
+  // read buffer_size bytes at offset as up to overlapped_requests parts
+  // outstanding at once, return false on error.  Every part started is
+  // waited for, since it reads into buffer.
+  static bool overlapped_read(const HANDLE handle,
+                              const uint64_t offset,
+                              uint8_t* const buffer,
+                              const size_t buffer_size,
+                              size_t* const bytes_read) {
+
+    // parts are whole multiples of direct_alignment
+    size_t part_size = (buffer_size + overlapped_requests - 1) /
+                       overlapped_requests;
+    part_size = (part_size + direct_alignment - 1) / direct_alignment *
+                direct_alignment;
+    if (part_size < overlapped_min_part_size) {
+      part_size = overlapped_min_part_size;
+    }
+
+    OVERLAPPED requests[overlapped_requests];
+    DWORD sizes[overlapped_requests];
+    bool started[overlapped_requests];
+    size_t num_requests = 0;
+    bool ok = true;
+    for (size_t begin = 0; begin < buffer_size; begin += part_size) {
+      OVERLAPPED& request = requests[num_requests];
+      ZeroMemory(&request, sizeof(request));
+      const uint64_t part_offset = offset + begin;
+      request.Offset = static_cast<DWORD>(part_offset);
+      request.OffsetHigh = static_cast<DWORD>(part_offset >> 32);
+      request.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+      if (request.hEvent == NULL) {
+        ok = false;
+        break;
+      }
+      sizes[num_requests] = static_cast<DWORD>(
+               (buffer_size - begin < part_size) ? buffer_size - begin
+                                                 : part_size);
+      started[num_requests] = true;
+      if (!ReadFile(handle, buffer + begin, sizes[num_requests], NULL,
+                    &request)) {
+        const DWORD error = GetLastError();
+        if (error != ERROR_IO_PENDING) {
+          // a part past the end of the file reads nothing
+          started[num_requests] = false;
+          ok = ok && (error == ERROR_HANDLE_EOF);
+        }
+      }
+      ++num_requests;
+    }
+
+    // the bytes read run up to the first short part
+    *bytes_read = 0;
+    bool short_read = false;
+    for (size_t i=0; i<num_requests; ++i) {
+      DWORD count = 0;
+      if (started[i] &&
+          !GetOverlappedResult(handle, &requests[i], &count, TRUE)) {
+        ok = ok && (GetLastError() == ERROR_HANDLE_EOF);
+        count = 0;
+      }
+      CloseHandle(requests[i].hEvent);
+      if (!short_read) {
+        *bytes_read += count;
+        short_read = (count < sizes[i]);
+      }
+    }
+    return ok;
+  }
+#else
+  // read using O_DIRECT, return false to read through the cache instead
+  bool direct_read(const uint64_t offset,
+                   uint8_t* const buffer,
+                   const size_t buffer_size,
+                   ssize_t* const count) const {
+    if (direct_fd < 0 || offset % direct_alignment != 0 ||
+        reinterpret_cast<uintptr_t>(buffer) % direct_alignment != 0 ||
+        buffer_size % direct_alignment != 0) {
+      return false;
+    }
+    *count = ::pread(direct_fd, buffer, buffer_size,
+                     static_cast<off_t>(offset));
+    return *count >= 0;
+  }
+#endif
+
   uint64_t get_filesize() {
     if (temp_error_message.size() == 0) {
       // open so try to get filesize
@@ -112,14 +238,33 @@ class single_file_reader_t {
 
   public:
   /**
-   * Opens a single file reader.
+   * Direct reads must be aligned to this many bytes.
    */
-  single_file_reader_t(const filename_t& p_native_filename) :
+  static const size_t direct_alignment = 4096;
+
+#ifdef WIN32
+  /**
+   * Overlapped reads outstanding at once for each read, and the size
+   * below which a read is not split further.
+   */
+  static const size_t overlapped_requests = 4;
+  static const size_t overlapped_min_part_size = 1048576;
+#endif
+
+  /**
+   * Opens a single file reader, reading around the page cache when
+   * direct_reads is set.
+   */
+  single_file_reader_t(const filename_t& p_native_filename,
+                       const bool direct_reads) :
 #ifdef WIN32
           file_handle(INVALID_HANDLE_VALUE),
+          direct_handle(INVALID_HANDLE_VALUE),
 #else
           fd(-1),
+          direct_fd(-1),
 #endif
+          drop_behind(direct_reads),
           native_filename(p_native_filename),
           temp_error_message(open_reader()),
           filesize(get_filesize()),
@@ -131,8 +276,10 @@ class single_file_reader_t {
     // SINGLE binary file
 #ifdef WIN32
     if(file_handle!=INVALID_HANDLE_VALUE) ::CloseHandle(file_handle);
+    if(direct_handle!=INVALID_HANDLE_VALUE) ::CloseHandle(direct_handle);
 #else
     if(fd>=0) close(fd);
+    if(direct_fd>=0) close(direct_fd);
 #endif
   }
 
@@ -150,19 +297,16 @@ class single_file_reader_t {
     }
 
 #ifdef WIN32
-    LARGE_INTEGER li;
-    li.QuadPart = offset;
-    li.LowPart = SetFilePointer(file_handle, li.LowPart, &li.HighPart, FILE_BEGIN);
-    if(li.LowPart == INVALID_SET_FILE_POINTER) {
-      return "read failed, invalid set file pointer";
-    }
-    DWORD dword_bytes_read = 0;
-    bool did_read = ReadFile(file_handle,
-                    buffer, (DWORD) buffer_size, &dword_bytes_read, NULL);
-    if (!did_read) {
+    // unbuffered reads must be aligned
+    const bool aligned = direct_handle != INVALID_HANDLE_VALUE &&
+              offset % direct_alignment == 0 &&
+              reinterpret_cast<uintptr_t>(buffer) % direct_alignment == 0 &&
+              buffer_size % direct_alignment == 0;
+    if (!overlapped_read((aligned) ? direct_handle : file_handle,
+                         offset, buffer, buffer_size, bytes_read)) {
+      *bytes_read = 0;
       return "read failed";
     }
-    *bytes_read = dword_bytes_read;
     return "";
 #else
   #if defined(HAVE_PREAD64)
@@ -175,7 +319,17 @@ class single_file_reader_t {
   #define pread64(d,buffer,nbyte,offset) pread(d,buffer,nbyte,offset)
   #endif
 
-    ssize_t count = ::pread64(fd,buffer,buffer_size,offset);
+    ssize_t count;
+    if (!direct_read(offset, buffer, buffer_size, &count)) {
+      count = ::pread64(fd,buffer,buffer_size,offset);
+#ifdef HAVE_POSIX_FADVISE
+      if (drop_behind && count > 0) {
+        // drop what was read, which is not read again
+        (void)posix_fadvise(fd, static_cast<off_t>(offset),
+                            static_cast<off_t>(count), POSIX_FADV_DONTNEED);
+      }
+#endif
+    }
     if (count < 0) {
       *bytes_read = 0;
       return "read failed";
@@ -183,6 +337,52 @@ class single_file_reader_t {
       *bytes_read = static_cast<size_t>(count);
       return "";
     }
+#endif
+  }
+
+  /**
+   * Whether bytes [offset, offset + size) are all in a hole of a sparse
+   * file, found using SEEK_DATA.  False if holes cannot be found.
+   */
+  bool is_hole(const uint64_t offset, const uint64_t size) const {
+#if !defined(WIN32) && defined(SEEK_DATA)
+    if (error_message.size() > 0 || size == 0) {
+      return false;
+    }
+    const off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+      // ENXIO when there is no data at or after offset
+      return errno == ENXIO;
+    }
+    return static_cast<uint64_t>(data) >= offset + size;
+#else
+    (void)offset;
+    (void)size;
+    return false;
+#endif
+  }
+
+  // ask the OS to start reading the whole file into the page cache
+  void will_need() const {
+#if !defined(WIN32) && defined(HAVE_POSIX_FADVISE)
+    if (error_message.size() == 0 && !drop_behind) {
+      (void)posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+#endif
+  }
+
+  /**
+   * Map the file for zero-copy reads, or return NULL if it cannot be
+   * mapped or reads bypass the page cache.  The caller holds the first reference.
+   */
+  mapped_file_t* map() const {
+    if (error_message.size() > 0 || drop_behind) {
+      return NULL;
+    }
+#ifdef WIN32
+    return NULL;
+#else
+    return mapped_file_t::map(fd, filesize);
 #endif
   }
 };
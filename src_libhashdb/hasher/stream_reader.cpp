@@ -0,0 +1,374 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Read the files of a sequential stream, see stream_reader.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include "stream_reader.hpp"
+#include "uncompress.hpp"
+#include "stage_stats.hpp"
+
+namespace hasher {
+
+  stream_reader_t::stream_reader_t(const int p_fd,
+                                   const std::string& p_stream_name,
+                                   const uint64_t p_step_size,
+                                   const size_t p_read_size,
+                                   buffer_pool_t& p_buffer_pool) :
+           fd(p_fd),
+           stream_name(p_stream_name),
+           step_size(p_step_size),
+           read_size(p_read_size),
+           buffer_pool(p_buffer_pool),
+           is_started(false), is_tar(false), is_done(false),
+           has_file(false), is_file_end(false), has_header(false),
+           file_remaining(0), pad_remaining(0), file_offset(0),
+           error_message(""), header(512, 0), peek_offset(0), peek_size(0),
+           overlap() {
+  }
+
+  // read up to size bytes, fewer only at the end of the stream or on
+  // error, first taking any bytes of the first block not yet used
+  size_t stream_reader_t::read_bytes(uint8_t* const buffer,
+                                     const size_t size) {
+    size_t count = 0;
+    if (peek_offset < peek_size) {
+      count = (peek_size - peek_offset < size) ?
+                                     peek_size - peek_offset : size;
+      std::memcpy(buffer, &header[peek_offset], count);
+      peek_offset += count;
+    }
+    const uint64_t read_start = hashdb::stage_clock_ns();
+    while (count < size) {
+      const ssize_t n = ::read(fd, buffer + count, size - count);
+      if (n > 0) {
+        count += static_cast<size_t>(n);
+      } else if (n == 0) {
+        // end of stream
+        break;
+      } else if (errno != EINTR) {
+        error_message = "Error reading stream " + stream_name + ": " +
+                        std::strerror(errno);
+        break;
+      }
+    }
+    hashdb::stage_record(hashdb::STAGE_READ,
+                         hashdb::stage_clock_ns() - read_start);
+    return count;
+  }
+
+  // skip size bytes, returning false if the stream ends first
+  bool stream_reader_t::skip_bytes(uint64_t size) {
+    uint8_t bytes[65536];
+    while (size > 0) {
+      const size_t want = (size > sizeof(bytes)) ?
+                          sizeof(bytes) : static_cast<size_t>(size);
+      if (read_bytes(bytes, want) != want) {
+        return false;
+      }
+      size -= want;
+    }
+    return true;
+  }
+
+  // read the size bytes of a tar entry and its padding into value
+  bool stream_reader_t::read_string(const uint64_t size,
+                                    std::string& value) {
+    if (size > 1048576) {
+      // not a name
+      return false;
+    }
+    std::vector<uint8_t> bytes(static_cast<size_t>(size) + 1, 0);
+    if (read_bytes(&bytes[0], static_cast<size_t>(size)) != size ||
+        !skip_bytes((512 - size % 512) % 512)) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char*>(&bytes[0]));
+    return true;
+  }
+
+  // see if the stream is a tar archive
+  bool stream_reader_t::start() {
+    is_started = true;
+    peek_size = read_bytes(&header[0], header.size());
+    if (error_message.size() > 0) {
+      is_done = true;
+      return false;
+    }
+    if (peek_size == header.size() && tar_signature(&header[0],
+                                                    header.size(), 0)) {
+      // the first block is the first tar header
+      is_tar = true;
+      has_header = true;
+      peek_offset = peek_size;
+    }
+    return true;
+  }
+
+  // read tar headers up to the next regular file, returning false at
+  // the end of the archive or on error
+  bool stream_reader_t::next_member(std::string& filename,
+                                    uint64_t& filesize) {
+    std::string long_name;
+    while (true) {
+      if (!has_header) {
+        const size_t count = read_bytes(&header[0], header.size());
+        if (error_message.size() > 0) {
+          return false;
+        }
+        if (count == 0) {
+          // the archive ends without its end blocks
+          return false;
+        }
+        if (count < header.size()) {
+          error_message = "Stream " + stream_name +
+                          " ends inside a tar header.";
+          return false;
+        }
+      }
+      has_header = false;
+      const uint8_t* const h = &header[0];
+
+      // an all zero block ends the archive
+      size_t i = 0;
+      while (i < header.size() && h[i] == 0) {
+        ++i;
+      }
+      if (i == header.size()) {
+        return false;
+      }
+      if (!tar_signature(h, header.size(), 0)) {
+        error_message = "Stream " + stream_name +
+                        " has an invalid tar header.";
+        return false;
+      }
+
+      const uint64_t size = tar_file_size(h);
+      const uint64_t padding = (512 - size % 512) % 512;
+      const uint8_t type = h[156];
+      if (type == 'L') {
+        // GNU long name of the next entry
+        if (!read_string(size, long_name)) {
+          error_message = "Stream " + stream_name +
+                          " has an invalid tar long name.";
+          return false;
+        }
+        continue;
+      }
+      if (type == 'x') {
+        // pax records of the next entry, "<length> <key>=<value>\n"
+        std::string records;
+        if (!read_string(size, records)) {
+          error_message = "Stream " + stream_name +
+                          " has invalid tar pax records.";
+          return false;
+        }
+        const size_t path = records.find(" path=");
+        if (path != std::string::npos) {
+          const size_t end = records.find('\n', path);
+          if (end != std::string::npos) {
+            long_name = records.substr(path + 6, end - path - 6);
+          }
+        }
+        continue;
+      }
+      if (type != '0' && type != 0x00 && type != '7') {
+        // not a regular file
+        if (!skip_bytes(size + padding)) {
+          error_message = "Stream " + stream_name +
+                          " ends inside a tar entry.";
+          return false;
+        }
+        long_name = "";
+        continue;
+      }
+
+      // the name, after the prefix of a POSIX ustar header
+      if (long_name.size() > 0) {
+        filename = long_name;
+      } else {
+        filename.assign(reinterpret_cast<const char*>(h),
+                        strnlen(reinterpret_cast<const char*>(h), 100));
+        if (h[262] == 0x00 && h[345] != 0x00) {
+          filename = std::string(reinterpret_cast<const char*>(h + 345),
+                     strnlen(reinterpret_cast<const char*>(h + 345), 155)) +
+                     "/" + filename;
+        }
+      }
+      filesize = size;
+      file_remaining = size;
+      pad_remaining = padding;
+      return true;
+    }
+  }
+
+  // skip what is left of the file being read
+  void stream_reader_t::end_file() {
+    has_file = false;
+    overlap.clear();
+    if (is_tar && !is_done &&
+        !skip_bytes(file_remaining + pad_remaining)) {
+      if (error_message.size() == 0) {
+        error_message = "Stream " + stream_name +
+                        " ends inside a tar member.";
+      }
+      is_done = true;
+    }
+    file_remaining = 0;
+    pad_remaining = 0;
+  }
+
+  bool stream_reader_t::next_file(std::string& filename,
+                                  uint64_t& filesize,
+                                  bool& size_known) {
+    if (!is_started && !start()) {
+      return false;
+    }
+    if (has_file) {
+      end_file();
+    }
+    if (is_done) {
+      return false;
+    }
+    file_offset = 0;
+    is_file_end = false;
+    if (is_tar) {
+      if (!next_member(filename, filesize)) {
+        is_done = true;
+        return false;
+      }
+      size_known = true;
+    } else {
+      // the whole stream is the one file
+      filename = stream_name;
+      filesize = 0;
+      size_known = false;
+      is_done = true;
+    }
+    has_file = true;
+    return true;
+  }
+
+  bool stream_reader_t::next_chunk(read_chunk_t& chunk) {
+    if (!has_file || is_file_end) {
+      return false;
+    }
+    chunk = read_chunk_t();
+    chunk.offset = file_offset;
+
+    uint8_t* const buffer = buffer_pool.acquire();
+    if (buffer == NULL) {
+      chunk.error_message = "bad memory allocation";
+      error_message = chunk.error_message;
+      has_file = false;
+      is_done = true;
+      return true;
+    }
+
+    // copy the bytes shared with the last chunk, then read the rest
+    if (overlap.size() > 0) {
+      std::memcpy(buffer, &overlap[0], overlap.size());
+    }
+    size_t want = read_size - overlap.size();
+    if (is_tar && want > file_remaining) {
+      want = static_cast<size_t>(file_remaining);
+    }
+    const size_t count = read_bytes(buffer + overlap.size(), want);
+    if (is_tar) {
+      file_remaining -= count;
+    }
+    if (error_message.size() == 0 && is_tar && count < want) {
+      error_message = "Stream " + stream_name +
+                      " ends inside a tar member.";
+    }
+    if (error_message.size() > 0) {
+      // abort
+      buffer_pool.release(buffer);
+      chunk.error_message = error_message;
+      has_file = false;
+      is_done = true;
+      return true;
+    }
+
+    chunk.buffer = buffer;
+    chunk.buffer_size = overlap.size() + count;
+    chunk.buffer_pool = &buffer_pool;
+    if (chunk.buffer_size == 0) {
+      // the file is empty
+      buffer_pool.release(buffer);
+      is_file_end = true;
+      return false;
+    }
+
+    // a short chunk ends the file, else keep what the next repeats
+    if (chunk.buffer_size < read_size) {
+      is_file_end = true;
+      overlap.clear();
+    } else {
+      overlap.assign(buffer + step_size, buffer + chunk.buffer_size);
+    }
+    file_offset += step_size;
+    return true;
+  }
+
+  std::string stream_reader_t::read_file(uint8_t* const buffer,
+                                         size_t* const bytes_read) {
+    *bytes_read = 0;
+    if (!has_file || !is_tar || file_offset != 0) {
+      return "The stream file is not a whole tar member.";
+    }
+    const size_t size = static_cast<size_t>(file_remaining);
+    *bytes_read = read_bytes(buffer, size);
+    file_remaining -= *bytes_read;
+    if (error_message.size() == 0 && *bytes_read < size) {
+      error_message = "Stream " + stream_name +
+                      " ends inside a tar member.";
+    }
+    if (error_message.size() > 0) {
+      has_file = false;
+      is_done = true;
+      return error_message;
+    }
+    is_file_end = true;
+    return "";
+  }
+
+} // end namespace hasher
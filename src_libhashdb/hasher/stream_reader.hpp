@@ -0,0 +1,133 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Reads the files of a sequential stream such as a pipe, which cannot
+ * seek, so that it may be ingested without staging it to a file.
+ *
+ * The stream is either one file or, when it starts with a ustar
+ * header block, a tar archive whose regular files are read in archive
+ * order as their headers are parsed.  GNU long names and pax path
+ * records name the file that follows them.  Other entries are skipped.
+ *
+ * For each file, next_file gives its name and, for tar members, its
+ * size.  Its chunks are then taken in order using next_chunk as
+ * read_ahead_t delivers them: chunks of up to read_size bytes at
+ * offsets 0, step_size, 2*step_size, and so on, read into buffers
+ * from the buffer pool, where the bytes that a chunk shares with the
+ * one before it are copied rather than read again.  Small tar members
+ * may instead be read whole using read_file.
+ *
+ * A read error, or a stream that ends inside a tar member, is
+ * delivered as a chunk with an error_message and no buffer, after
+ * which the stream ends.
+ */
+
+#ifndef STREAM_READER_HPP
+#define STREAM_READER_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "read_ahead.hpp"
+#include "buffer_pool.hpp"
+
+namespace hasher {
+
+class stream_reader_t {
+
+  private:
+  const int fd;
+  const std::string stream_name;
+  const uint64_t step_size;
+  const size_t read_size;
+  buffer_pool_t& buffer_pool;
+
+  // state
+  bool is_started;
+  bool is_tar;
+  bool is_done;        // no more files
+  bool has_file;       // a file is being read
+  bool is_file_end;    // the last chunk taken ends the file
+  bool has_header;     // the first block is a tar header not yet parsed
+  uint64_t file_remaining;  // bytes of a tar member not yet read
+  uint64_t pad_remaining;   // padding after the tar member
+  uint64_t file_offset;     // offset of the next chunk
+  std::string error_message;
+  std::vector<uint8_t> header;  // the first block, then each header
+  size_t peek_offset;           // bytes of the first block used
+  size_t peek_size;             // bytes of the first block read
+  std::vector<uint8_t> overlap; // bytes the next chunk repeats
+
+  // do not allow copy or assignment
+  stream_reader_t(const stream_reader_t&);
+  stream_reader_t& operator=(const stream_reader_t&);
+
+  size_t read_bytes(uint8_t* const buffer, const size_t size);
+  bool skip_bytes(uint64_t size);
+  bool read_string(const uint64_t size, std::string& value);
+  bool start();
+  bool next_member(std::string& filename, uint64_t& filesize);
+  void end_file();
+
+  public:
+  /**
+   * Read the stream open at p_fd, naming a stream that is not a tar
+   * archive p_stream_name.  The fd is not closed.
+   */
+  stream_reader_t(const int p_fd,
+                  const std::string& p_stream_name,
+                  const uint64_t p_step_size,
+                  const size_t p_read_size,
+                  buffer_pool_t& p_buffer_pool);
+
+  /**
+   * Start reading the next file, skipping what is left of the last.
+   * Sets filesize to the size of a tar member, else to 0 and
+   * size_known to false.  Returns false when there are no more files
+   * or the stream cannot be read, see error_message.
+   */
+  bool next_file(std::string& filename, uint64_t& filesize,
+                 bool& size_known);
+
+  /**
+   * Take the next chunk of the file.  The caller owns its buffer.
+   * Returns false at the end of the file.
+   */
+  bool next_chunk(read_chunk_t& chunk);
+
+  /**
+   * Read all of a tar member of known size into buffer, which must have
+   * room for it.  Returns "" else the reason.
+   */
+  std::string read_file(uint8_t* const buffer, size_t* const bytes_read);
+
+  /**
+   * The reason the stream could not be read, or "".
+   */
+  const std::string& get_error_message() const {
+    return error_message;
+  }
+};
+
+} // end namespace hasher
+
+#endif
@@ -0,0 +1,263 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Work-stealing threadpool, see threadpool.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <iostream>
+#include <assert.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include "job.hpp"
+#include "job_queue.hpp"
+#include "job_deque.hpp"
+#include "process_job.hpp"
+#include "threadpool.hpp"
+
+namespace hasher {
+
+  // recursed jobs a worker may queue before it processes them itself.
+  // Recursed buffers may be large so keep this small.
+  static const size_t max_local_jobs = 2;
+
+  // how long an idle worker waits before checking job_queue again
+  static const long idle_wait_microseconds = 10000;
+
+  // thread-specific worker_t of the calling thread, NULL if not a worker
+  static pthread_key_t worker_key;
+  static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+
+  static void make_worker_key() {
+    if (pthread_key_create(&worker_key, NULL)) {
+      std::cerr << "Error obtaining thread key.\n";
+      assert(0);
+    }
+  }
+
+  threadpool_t::threadpool_t(const int p_num_threads,
+                             job_queue_t* const p_job_queue) :
+           num_threads(p_num_threads),
+           threads(new ::pthread_t[num_threads]),
+           workers(new worker_t[num_threads]),
+           job_deques(new job_deque_t[num_threads]),
+           job_queue(p_job_queue),
+           busy_count(0), queued_count(0), steals(0), queue_jobs_done(0),
+           M(), work_available() {
+
+    pthread_once(&worker_key_once, make_worker_key);
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    if(pthread_cond_init(&work_available,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+
+    // open the requested number of threads
+    for (int i=0; i<num_threads; i++) {
+      workers[i].threadpool = this;
+      workers[i].index = i;
+      int rc = ::pthread_create(&threads[i], NULL, threadpool_t::run,
+                                (void*)&workers[i]);
+      if (rc != 0) {
+        std::cerr << "Unable to start hasher thread.\n";
+        assert(0);
+      }
+    }
+  }
+
+  threadpool_t::~threadpool_t() {
+    // join each thread
+    for (int i=0; i<num_threads; i++) {
+      int status = pthread_join(threads[i], NULL);
+      if (status != 0) {
+        std::cerr << "error in threadpool join " << status << "\n";
+      }
+    }
+    pthread_cond_destroy(&work_available);
+    pthread_mutex_destroy(&M);
+    delete[] job_deques;
+    delete[] workers;
+    delete[] threads;
+  }
+
+  void* threadpool_t::run(void* const arg) {
+    worker_t* const worker = static_cast<worker_t* const>(arg);
+    pthread_setspecific(worker_key, worker);
+
+    // next_job returns NULL when all work is done
+    const hasher::job_t* job;
+    bool from_queue;
+    while ((job = worker->threadpool->next_job(worker->index, from_queue))
+                                                             != NULL) {
+      // process the job, which may push recursed jobs onto our deque
+      hasher::process_job(*job);
+      worker->threadpool->finished_job(from_queue);
+    }
+    return 0;
+  }
+
+  // record that a job was taken, must be called before processing it
+  void threadpool_t::took_job(const bool from_deque, const bool stolen) {
+    lock();
+    if (from_deque) {
+      --queued_count;
+    }
+    if (stolen) {
+      ++steals;
+    }
+    ++busy_count;
+    unlock();
+  }
+
+  void threadpool_t::finished_job(const bool from_queue) {
+    lock();
+    --busy_count;
+    if (from_queue) {
+      ++queue_jobs_done;
+    }
+    if (busy_count == 0) {
+      // idle workers may now block on job_queue or exit
+      pthread_cond_broadcast(&work_available);
+    }
+    unlock();
+  }
+
+  const hasher::job_t* threadpool_t::next_job(const size_t index,
+                                              bool& from_queue) {
+    from_queue = false;
+    while (true) {
+      // newest job from our own deque
+      const hasher::job_t* job = job_deques[index].pop_back();
+      if (job != NULL) {
+        took_job(true, false);
+        return job;
+      }
+
+      // oldest job from another worker's deque
+      for (int i=1; i<num_threads; i++) {
+        job = job_deques[(index + i) % num_threads].steal();
+        if (job != NULL) {
+          took_job(true, true);
+          return job;
+        }
+      }
+
+      // job from the injector queue.  Only block on it when no other
+      // worker is busy and could create recursed jobs for us to steal.
+      lock();
+      const bool all_idle = (busy_count == 0 && queued_count == 0);
+      unlock();
+      job = (all_idle) ? job_queue->pop() : job_queue->try_pop();
+      if (job != NULL) {
+        took_job(false, false);
+        from_queue = true;
+        return job;
+      }
+
+      // nothing to do now
+      lock();
+      if (busy_count == 0 && queued_count == 0 && job_queue->is_done()) {
+        // all work is done
+        unlock();
+        return NULL;
+      }
+      if (queued_count == 0) {
+        // wait for a recursed job, for workers to finish, or for a while
+        // in case job_queue has a new job
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        long usec = now.tv_usec + idle_wait_microseconds;
+        struct timespec until;
+        until.tv_sec = now.tv_sec + usec / 1000000;
+        until.tv_nsec = (usec % 1000000) * 1000;
+        pthread_cond_timedwait(&work_available, &M, &until);
+      }
+      unlock();
+    }
+  }
+
+  bool threadpool_t::push_local(const size_t index,
+                                const hasher::job_t* const job) {
+    if (job_deques[index].size() >= max_local_jobs) {
+      // deque is full
+      return false;
+    }
+    job_deques[index].push_back(job);
+    lock();
+    ++queued_count;
+    pthread_cond_signal(&work_available);
+    unlock();
+    return true;
+  }
+
+  void threadpool_t::push_recursed_job(const hasher::job_t* const job) {
+    pthread_once(&worker_key_once, make_worker_key);
+    const worker_t* const worker =
+                 static_cast<const worker_t*>(pthread_getspecific(worker_key));
+    if (worker == NULL ||
+        !worker->threadpool->push_local(worker->index, job)) {
+      // not a pool worker or too many queued so process it now
+      hasher::process_job(*job);
+    }
+  }
+
+  void threadpool_t::wait_idle() const {
+    const uint64_t pushed = job_queue->push_count();
+    lock();
+    while (queue_jobs_done < pushed || busy_count != 0 || queued_count != 0) {
+      // workers broadcast when they all go idle, but check again in a
+      // while in case the last job finished before we waited
+      struct timeval now;
+      gettimeofday(&now, NULL);
+      long usec = now.tv_usec + idle_wait_microseconds;
+      struct timespec until;
+      until.tv_sec = now.tv_sec + usec / 1000000;
+      until.tv_nsec = (usec % 1000000) * 1000;
+      pthread_cond_timedwait(&work_available, &M, &until);
+    }
+    unlock();
+  }
+
+  uint64_t threadpool_t::steal_count() const {
+    lock();
+    const uint64_t count = steals;
+    unlock();
+    return count;
+  }
+
+} // end namespace hasher
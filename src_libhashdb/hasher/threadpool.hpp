@@ -19,10 +19,16 @@
 
 /**
  * \file
- * Creates a pool of threads.
+ * Creates a pool of work-stealing threads.
  *
- * Threads will continually pop *job from job_queue
- * and call hasher::process_job(job) until job_queue->is_done().
+ * Top-level jobs come from the shared job_queue, which acts as the
+ * injector queue.  Recursed jobs created while processing a job are
+ * pushed onto the local deque of the worker that created them using
+ * push_recursed_job.  A worker takes its newest local job first, then
+ * steals the oldest job from another worker, then pops from job_queue.
+ *
+ * Threads exit when job_queue is done and empty, no jobs are queued on
+ * any deque, and no worker is busy.
  *
  * Destructor waits on join for all threads.
  */
@@ -39,69 +45,79 @@
 #include <sys/stat.h>
 #include <iostream>
 #include <unistd.h>
-#include <sched.h>  // sched_yield
 #include <pthread.h>
 #include "job.hpp"
 #include "job_queue.hpp"
-#include "process_job.hpp"
+#include "job_deque.hpp"
 
 namespace hasher {
 
-  static void* run(void* const arg) {
-    // get job_queue
-    hasher::job_queue_t* const job_queue =
-                           static_cast<hasher::job_queue_t* const>(arg);
-
-    while (job_queue->is_done() == false) {
-      const hasher::job_t* const job = job_queue->pop();
-      if (job == NULL) {
-        // queue is active but empty
-        sched_yield();
-      } else {
-        // process the job
-        hasher::process_job(*job);
-      }
-    }
-    return 0;
+class threadpool_t;
+
+// identifies a worker thread within its threadpool
+struct worker_t {
+  threadpool_t* threadpool;
+  size_t index;
+  worker_t() : threadpool(NULL), index(0) {
   }
+};
 
 class threadpool_t {
   private:
   const int num_threads;
   ::pthread_t* threads;
-  const hasher::job_queue_t* job_queue;
+  worker_t* workers;
+  job_deque_t* job_deques;
+  hasher::job_queue_t* const job_queue;
+
+  // pool state, protected by M
+  size_t busy_count;    // workers processing a job
+  size_t queued_count;  // jobs waiting in job_deques
+  uint64_t steals;      // jobs taken from another worker's deque
+  uint64_t queue_jobs_done;  // jobs from job_queue processed
+
+  mutable pthread_mutex_t M;
+  mutable pthread_cond_t work_available;
 
   // do not allow copy or assignment
   threadpool_t(const threadpool_t&);
   threadpool_t& operator=(const threadpool_t&);
 
-  public:
-  threadpool_t(const int p_num_threads, const job_queue_t* const p_job_queue) :
-           num_threads(p_num_threads),
-           threads(new ::pthread_t[num_threads]),
-           job_queue(p_job_queue) {
-
-    // open one thread per CPU
-    for (int i=0; i<num_threads; i++) {
-      int rc = ::pthread_create(&threads[i], NULL, hasher::run,
-                                (void*)job_queue);
-      if (rc != 0) {
-        std::cerr << "Unable to start hasher thread.\n";
-        assert(0);
-      }
+  void lock() const {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
     }
   }
 
-  ~threadpool_t() {
-    // join each thread
-    for (int i=0; i<num_threads; i++) {
-      int status = pthread_join(threads[i], NULL);
-      if (status != 0) {
-        std::cerr << "error in threadpool join " << status << "\n";
-      }
-    }
-    delete[] threads;
+  void unlock() const {
+    pthread_mutex_unlock(&M);
   }
+
+  static void* run(void* const arg);
+  const hasher::job_t* next_job(const size_t index, bool& from_queue);
+  void took_job(const bool from_deque, const bool stolen);
+  void finished_job(const bool from_queue);
+  bool push_local(const size_t index, const hasher::job_t* const job);
+
+  public:
+  threadpool_t(const int p_num_threads, job_queue_t* const p_job_queue);
+  ~threadpool_t();
+
+  /**
+   * Queue a recursed job on the calling worker's local deque so idle
+   * workers may steal it.  The job is processed immediately instead
+   * when the caller is not a pool worker or its deque is full.
+   */
+  static void push_recursed_job(const hasher::job_t* const job);
+
+  /**
+   * Block until every job pushed onto job_queue so far, and the jobs
+   * they recursed, is processed.  Call from the thread that pushes.
+   */
+  void wait_idle() const;
+
+  // number of jobs stolen from another worker's deque
+  uint64_t steal_count() const;
 };
 
 } // end namespace hasher
@@ -0,0 +1,138 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provide the inflater used by the uncompress routines.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include <limits.h>
+#include <zlib.h>
+#include "uncompress.hpp"
+#include "tprint.hpp" // threadsafe report unusual condition
+
+namespace hasher {
+
+  // the first buffer size when the uncompressed size is not known
+  static const size_t default_size = 1048576; // 2^20 = 1MiB
+
+  uint8_t* new_output_buffer(const size_t size_hint, const size_t max_size,
+                             size_t* capacity) {
+    *capacity = (size_hint == 0) ? default_size : size_hint;
+    if (*capacity > max_size) {
+      *capacity = max_size;
+    }
+    uint8_t* const buf = new (std::nothrow) uint8_t[*capacity];
+    if (buf == NULL) {
+      // comment that the buffer acquisition request failed
+      hashdb::tprint(std::cout, "# bad memory allocation in uncompression");
+    }
+    return buf;
+  }
+
+  bool grow_output_buffer(uint8_t** buf, size_t* capacity, const size_t used,
+                          const size_t max_size) {
+    if (*capacity >= max_size) {
+      return false;
+    }
+
+    // double the capacity
+    const size_t new_capacity = (*capacity > max_size / 2)
+                                ? max_size : *capacity * 2;
+    uint8_t* const new_buf = new (std::nothrow) uint8_t[new_capacity];
+    if (new_buf == NULL) {
+      // keep what fit
+      hashdb::tprint(std::cout, "# bad memory allocation in uncompression");
+      return false;
+    }
+    memcpy(new_buf, *buf, used);
+    delete[] *buf;
+    *buf = new_buf;
+    *capacity = new_capacity;
+    return true;
+  }
+
+  std::string inflater_t::inflate_new(const uint8_t* const in_buf,
+                                      const size_t in_size,
+                                      const size_t size_hint,
+                                      const size_t max_size,
+                                      uint8_t** out_buf,
+                                      size_t* out_size,
+                                      size_t* in_used) {
+
+    *out_buf = NULL;
+    *out_size = 0;
+    *in_used = 0;
+
+    // initialize zlib once, then reset it for each decompression
+    int r = is_initialized ? inflateReset2(&zs, window_bits)
+                           : inflateInit2(&zs, window_bits);
+    if (r != Z_OK) {
+      return "zlib inflate failed";
+    }
+    is_initialized = true;
+
+    // create the first uncompressed buffer
+    size_t capacity;
+    uint8_t* buf = new_output_buffer(size_hint, max_size, &capacity);
+    if (buf == NULL) {
+      return "bad memory allocation in uncompression";
+    }
+
+    zs.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(in_buf));
+    zs.avail_in = (in_size > UINT_MAX) ? UINT_MAX : in_size;
+    zs.next_out = buf;
+    zs.avail_out = capacity;
+
+    // inflate, growing the buffer while it fills, and accept total_out
+    // whatever the zlib return code
+    while (true) {
+      r = inflate(&zs, Z_SYNC_FLUSH);
+      if (r != Z_OK || zs.avail_out != 0 ||
+          !grow_output_buffer(&buf, &capacity, zs.total_out, max_size)) {
+        break;
+      }
+      zs.next_out = buf + zs.total_out;
+      zs.avail_out = capacity - zs.total_out;
+    }
+
+    *out_buf = buf;
+    *out_size = zs.total_out;
+    *in_used = zs.total_in;
+    return "";
+  }
+} // end namespace hasher
+
@@ -26,9 +26,71 @@
 #define UNCOMPRESS_HPP
 
 #include "stdint.h"
+#include <string>
+#include <cstring>
+#include <zlib.h>
 
 namespace hasher {
 
+  // the largest uncompressed object to recurse into
+  static const size_t uncompressed_size_max = 268435456; // 2^28 = 256MiB
+
+  // Get a new buffer of size_hint bytes, or a default if 0, up to
+  // max_size, setting capacity.  Return NULL if out of memory.
+  uint8_t* new_output_buffer(const size_t size_hint, const size_t max_size,
+                             size_t* capacity);
+
+  // Double buf up to max_size, keeping its first used bytes.  Return
+  // false, leaving buf as is, if it is at max_size or out of memory.
+  bool grow_output_buffer(uint8_t** buf, size_t* capacity, const size_t used,
+                          const size_t max_size);
+
+  /**
+   * Inflate into a new buffer that grows with the output instead of one
+   * allocated and zero-filled at the largest possible size.  The zlib
+   * state is reset between uses instead of being allocated each time,
+   * so keep one per thread.
+   */
+  class inflater_t {
+
+    private:
+    z_stream zs;
+    int window_bits;
+    bool is_initialized;
+
+    // do not allow copy or assignment
+    inflater_t(const inflater_t&);
+    inflater_t& operator=(const inflater_t&);
+
+    public:
+    // window_bits selects the format, for example -15 for raw deflate
+    // or 16+MAX_WBITS for gzip
+    explicit inflater_t(const int p_window_bits) :
+             zs(), window_bits(p_window_bits), is_initialized(false) {
+      memset(&zs, 0, sizeof(zs));
+    }
+
+    ~inflater_t() {
+      if (is_initialized) {
+        inflateEnd(&zs);
+      }
+    }
+
+    /**
+     * Inflate in_buf into a new out_buf of up to max_size bytes, starting
+     * with size_hint bytes, or a default if 0.  Data up to a zlib error
+     * or the end of input is kept.  Set in_used to the bytes consumed.
+     * Return "" else reason for error, in which case out_buf is NULL.
+     */
+    std::string inflate_new(const uint8_t* const in_buf,
+                            const size_t in_size,
+                            const size_t size_hint,
+                            const size_t max_size,
+                            uint8_t** out_buf,
+                            size_t* out_size,
+                            size_t* in_used);
+  };
+
   // zip
   inline bool zip_signature(const uint8_t* const b, const size_t b_size,
                      const size_t offset) {
@@ -43,11 +105,13 @@ namespace hasher {
 
   // Get a new out_buff which must be deleted, successful or not.
   // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
   std::string new_from_zip(const uint8_t* const in_buf,
                            const size_t in_size,
                            const size_t in_offset,
                            uint8_t** out_buf,
-                           size_t* out_size);
+                           size_t* out_size,
+                           size_t* in_used = NULL);
 
   // gzip
   inline bool gzip_signature(const uint8_t* const b, const size_t b_size,
@@ -64,11 +128,175 @@ namespace hasher {
 
   // Get a new out_buff which must be deleted, successful or not.
   // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
   std::string new_from_gzip(const uint8_t* const in_buf,
                             const size_t in_size,
                             const size_t in_offset,
                             uint8_t** out_buf,
-                            size_t* out_size);
+                            size_t* out_size,
+                            size_t* in_used = NULL);
+
+  // bzip2
+  inline bool bzip2_signature(const uint8_t* const b, const size_t b_size,
+                     const size_t offset) {
+    // stream header and first block magic, do not let this overflow.
+    if (offset + 10 > b_size) {
+      return false;
+    }
+
+    return (b[offset+0]=='B' && b[offset+1]=='Z' && b[offset+2]=='h' &&
+            b[offset+3]>='1' && b[offset+3]<='9' &&
+            b[offset+4]==0x31 && b[offset+5]==0x41 && b[offset+6]==0x59 &&
+            b[offset+7]==0x26 && b[offset+8]==0x53 && b[offset+9]==0x59);
+  }
+
+  // Get a new out_buff which must be deleted, successful or not.
+  // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
+  std::string new_from_bzip2(const uint8_t* const in_buf,
+                             const size_t in_size,
+                             const size_t in_offset,
+                             uint8_t** out_buf,
+                             size_t* out_size,
+                             size_t* in_used = NULL);
+
+  // xz
+  inline bool xz_signature(const uint8_t* const b, const size_t b_size,
+                     const size_t offset) {
+    // stream header size for XZ, do not let this overflow.
+    if (offset + 12 > b_size) {
+      return false;
+    }
+
+    // magic then stream flags, which have reserved bits that are zero
+    return (b[offset+0]==0xfd && b[offset+1]=='7' && b[offset+2]=='z' &&
+            b[offset+3]=='X' && b[offset+4]=='Z' && b[offset+5]==0x00 &&
+            b[offset+6]==0x00 && (b[offset+7] & 0xf0)==0x00);
+  }
+
+  // Get a new out_buff which must be deleted, successful or not.
+  // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
+  std::string new_from_xz(const uint8_t* const in_buf,
+                          const size_t in_size,
+                          const size_t in_offset,
+                          uint8_t** out_buf,
+                          size_t* out_size,
+                          size_t* in_used = NULL);
+
+  // zstd
+  inline bool zstd_signature(const uint8_t* const b, const size_t b_size,
+                     const size_t offset) {
+    // magic and the smallest frame header, do not let this overflow.
+    if (offset + 6 > b_size) {
+      return false;
+    }
+
+    // magic then the frame header descriptor, whose reserved bit is zero
+    return (b[offset+0]==0x28 && b[offset+1]==0xb5 && b[offset+2]==0x2f &&
+            b[offset+3]==0xfd && (b[offset+4] & 0x08)==0x00);
+  }
+
+  // Get a new out_buff which must be deleted, successful or not.
+  // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
+  std::string new_from_zstd(const uint8_t* const in_buf,
+                            const size_t in_size,
+                            const size_t in_offset,
+                            uint8_t** out_buf,
+                            size_t* out_size,
+                            size_t* in_used = NULL);
+
+  // 7z
+  inline bool sevenz_signature(const uint8_t* const b, const size_t b_size,
+                     const size_t offset) {
+    // signature header size for 7z, do not let this overflow.
+    if (offset + 32 > b_size) {
+      return false;
+    }
+
+    // magic then major version 0
+    return (b[offset+0]=='7' && b[offset+1]=='z' && b[offset+2]==0xbc &&
+            b[offset+3]==0xaf && b[offset+4]==0x27 && b[offset+5]==0x1c &&
+            b[offset+6]==0x00);
+  }
+
+  // Get a new out_buff which must be deleted, successful or not.
+  // Only archives whose files are stored with the copy method are read,
+  // yielding their files back to back.
+  // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
+  std::string new_from_7z(const uint8_t* const in_buf,
+                          const size_t in_size,
+                          const size_t in_offset,
+                          uint8_t** out_buf,
+                          size_t* out_size,
+                          size_t* in_used = NULL);
+
+  // tar
+  inline bool tar_signature(const uint8_t* const b, const size_t b_size,
+                     const size_t offset) {
+    // one header block for tar, do not let this overflow.
+    if (offset + 512 > b_size) {
+      return false;
+    }
+
+    // POSIX "ustar\0" or GNU "ustar  \0" magic at 257
+    const uint8_t* const h = b + offset;
+    if (memcmp(h+257, "ustar", 5) != 0 ||
+        !((h[262]==0x00 && h[263]=='0' && h[264]=='0') ||
+          (h[262]==' ' && h[263]==' ' && h[264]==0x00))) {
+      return false;
+    }
+
+    // the checksum at 148 is the byte sum with the checksum as spaces
+    uint32_t sum = 8 * ' ';
+    for (size_t i=0; i<512; ++i) {
+      if (i < 148 || i >= 156) {
+        sum += h[i];
+      }
+    }
+    uint32_t checksum = 0;
+    size_t i = 148;
+    while (i < 156 && h[i] == ' ') {
+      ++i;
+    }
+    for (; i < 156 && h[i] >= '0' && h[i] <= '7'; ++i) {
+      checksum = checksum * 8 + (h[i] - '0');
+    }
+    return sum == checksum;
+  }
+
+  // the size of the data of the entry whose header block is h, which is
+  // octal, or base-256 if the high bit is set
+  inline uint64_t tar_file_size(const uint8_t* const h) {
+    uint64_t file_size = 0;
+    if (h[124] & 0x80) {
+      for (size_t i=125; i<136; ++i) {
+        file_size = (file_size << 8) | h[i];
+      }
+    } else {
+      size_t i = 124;
+      while (i < 136 && h[i] == ' ') {
+        ++i;
+      }
+      for (; i < 136 && h[i] >= '0' && h[i] <= '7'; ++i) {
+        file_size = file_size * 8 + (h[i] - '0');
+      }
+    }
+    return file_size;
+  }
+
+  // Get a new out_buff which must be deleted, successful or not.
+  // The data of the regular file whose header is at in_offset is read.
+  // Return "" else reason for error.
+  // Set in_used, if provided, to the bytes used from in_offset.
+  std::string new_from_tar(const uint8_t* const in_buf,
+                           const size_t in_size,
+                           const size_t in_offset,
+                           uint8_t** out_buf,
+                           size_t* out_size,
+                           size_t* in_used = NULL);
 
 } // end namespace hasher
 
@@ -0,0 +1,235 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+// Based on the 7z format description in the LZMA SDK, 7zFormat.txt,
+// https://www.7-zip.org/sdk.html
+
+/**
+ * \file
+ * Provide uncompress routines for selected compression algorithms.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include "uncompress.hpp"
+#include "tprint.hpp" // threadsafe report unusual condition
+
+namespace hasher {
+
+  // property IDs used in headers
+  enum { k7z_end = 0x00, k7z_header = 0x01, k7z_main_streams_info = 0x04,
+         k7z_pack_info = 0x06, k7z_unpack_info = 0x07, k7z_folder = 0x0b,
+         k7z_size = 0x09, k7z_crc = 0x0a };
+
+  inline uint64_t u64(const uint8_t* const b) {
+    uint64_t n = 0;
+    for (int i=7; i>=0; --i) {
+      n = (n << 8) | b[i];
+    }
+    return n;
+  }
+
+  // read the variable length number at p, return false if past end
+  static bool read_7z_number(const uint8_t*& p, const uint8_t* const end,
+                             uint64_t* number) {
+    if (p >= end) {
+      return false;
+    }
+    const uint8_t first = *p++;
+    uint8_t mask = 0x80;
+    *number = 0;
+    for (int i=0; i<8; ++i) {
+      if ((first & mask) == 0) {
+        *number |= static_cast<uint64_t>(first & (mask - 1)) << (8 * i);
+        return true;
+      }
+      if (p >= end) {
+        return false;
+      }
+      *number |= static_cast<uint64_t>(*p++) << (8 * i);
+      mask >>= 1;
+    }
+    return true;
+  }
+
+  // read the pack position and total pack size, skipping CRCs
+  static bool read_7z_pack_info(const uint8_t*& p, const uint8_t* const end,
+                                uint64_t* pack_pos, uint64_t* pack_size) {
+    uint64_t num_pack_streams;
+    if (!read_7z_number(p, end, pack_pos) ||
+        !read_7z_number(p, end, &num_pack_streams)) {
+      return false;
+    }
+    *pack_size = 0;
+    while (p < end) {
+      const uint8_t id = *p++;
+      if (id == k7z_end) {
+        return true;
+      } else if (id == k7z_size) {
+        for (uint64_t i=0; i<num_pack_streams; ++i) {
+          uint64_t size;
+          if (!read_7z_number(p, end, &size)) {
+            return false;
+          }
+          *pack_size += size;
+        }
+      } else if (id == k7z_crc) {
+        uint64_t num_defined = num_pack_streams;
+        if (p >= end) {
+          return false;
+        }
+        if (*p++ == 0) {
+          // bit vector of defined CRCs
+          num_defined = 0;
+          for (uint64_t i=0; i<num_pack_streams; ++i) {
+            if (p + i / 8 >= end) {
+              return false;
+            }
+            num_defined += (p[i / 8] >> (7 - i % 8)) & 1;
+          }
+          p += (num_pack_streams + 7) / 8;
+        }
+        if (static_cast<uint64_t>(end - p) < num_defined * 4) {
+          return false;
+        }
+        p += num_defined * 4;
+      } else {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  // true if every folder is one copy coder
+  static bool read_7z_folders_are_copy(const uint8_t*& p,
+                                       const uint8_t* const end) {
+    uint64_t num_folders;
+    if (p >= end || *p++ != k7z_folder ||
+        !read_7z_number(p, end, &num_folders) ||
+        p >= end || *p++ != 0) {
+      // no folders or external folders
+      return false;
+    }
+    for (uint64_t i=0; i<num_folders; ++i) {
+      uint64_t num_coders;
+      if (!read_7z_number(p, end, &num_coders) || num_coders != 1 ||
+          p + 2 > end) {
+        return false;
+      }
+
+      // a simple coder with the one-byte copy method ID 0x00
+      const uint8_t flags = *p++;
+      if ((flags & 0x0f) != 1 || (flags & 0x10) != 0 || *p++ != 0x00) {
+        return false;
+      }
+      if (flags & 0x20) {
+        // skip coder properties
+        uint64_t properties_size;
+        if (!read_7z_number(p, end, &properties_size) ||
+            static_cast<uint64_t>(end - p) < properties_size) {
+          return false;
+        }
+        p += properties_size;
+      }
+    }
+    return true;
+  }
+
+  // return new out_buf else error text
+  std::string new_from_7z(const uint8_t* const in_buf,
+                          const size_t in_size,
+                          const size_t in_offset,
+                          uint8_t** out_buf,
+                          size_t* out_size,
+                          size_t* in_used) {
+
+    // pointer to the output buffer that will be created using new
+    *out_buf = NULL;
+    *out_size = 0;
+
+    // validate the buffer range
+    if (in_size < in_offset + 32) {
+      // nothing to do
+      return "7z region too small";
+    }
+
+    // the signature header locates the header after the packed streams
+    const uint8_t* const b = in_buf + in_offset;
+    const uint64_t next_header_offset = u64(b+12);
+    const uint64_t next_header_size = u64(b+20);
+    const uint64_t available = in_size - in_offset - 32;
+    if (next_header_offset > available ||
+        next_header_size > available - next_header_offset ||
+        next_header_size == 0) {
+      return "7z header outside data range";
+    }
+    const uint8_t* p = b + 32 + next_header_offset;
+    const uint8_t* const end = p + next_header_size;
+
+    // a packed header means the archive is compressed
+    if (*p++ != k7z_header || p >= end || *p++ != k7z_main_streams_info ||
+        p >= end || *p++ != k7z_pack_info) {
+      return "7z archive is not stored";
+    }
+    uint64_t pack_pos;
+    uint64_t pack_size;
+    if (!read_7z_pack_info(p, end, &pack_pos, &pack_size) ||
+        p >= end || *p++ != k7z_unpack_info ||
+        !read_7z_folders_are_copy(p, end)) {
+      return "7z archive is not stored";
+    }
+    if (pack_pos > next_header_offset ||
+        pack_size > next_header_offset - pack_pos) {
+      return "7z invalid pack info";
+    }
+    if (pack_size == 0 || pack_size > uncompressed_size_max) {
+      return "7z stored size out of range";
+    }
+
+    // copy the stored files
+    *out_buf = new (std::nothrow) uint8_t[pack_size];
+    if (*out_buf == NULL) {
+      // comment that the buffer acquisition request failed
+      hashdb::tprint(std::cout, "# bad memory allocation in 7z extraction");
+      return "bad memory allocation in 7z extraction";
+    }
+    memcpy(*out_buf, b + 32 + pack_pos, pack_size);
+    *out_size = pack_size;
+
+    if (in_used != NULL) {
+      *in_used = 32 + next_header_offset + next_header_size;
+    }
+    return "";
+  }
+} // end namespace hasher
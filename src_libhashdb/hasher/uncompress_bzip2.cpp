@@ -0,0 +1,110 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+// Based on the bzip2 and libbzip2 manual, https://sourceware.org/bzip2/
+
+/**
+ * \file
+ * Provide uncompress routines for selected compression algorithms.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include "uncompress.hpp"
+
+#if defined(HAVE_BZLIB_H) && defined(HAVE_LIBBZ2)
+#include <limits.h>
+#include <bzlib.h>
+
+namespace hasher {
+
+  // return new out_buf else error text
+  std::string new_from_bzip2(const uint8_t* const in_buf,
+                             const size_t in_size,
+                             const size_t in_offset,
+                             uint8_t** out_buf,
+                             size_t* out_size,
+                             size_t* in_used) {
+
+    // pointer to the output buffer that will be created using new
+    *out_buf = NULL;
+    *out_size = 0;
+
+    // set up the decompression structure
+    bz_stream bzs;
+    memset(&bzs, 0, sizeof(bzs));
+    if (BZ2_bzDecompressInit(&bzs, 0, 0) != BZ_OK) {
+      return "bzip2 decompress init failed";
+    }
+
+    // create the first uncompressed buffer
+    size_t capacity;
+    uint8_t* buf = new_output_buffer(0, uncompressed_size_max, &capacity);
+    if (buf == NULL) {
+      BZ2_bzDecompressEnd(&bzs);
+      return "bad memory allocation in bzip2 uncompression";
+    }
+
+    const size_t max_in_size = in_size - in_offset;
+    bzs.next_in = const_cast<char*>(reinterpret_cast<const char*>(
+                                                        in_buf + in_offset));
+    bzs.avail_in = (max_in_size > UINT_MAX) ? UINT_MAX : max_in_size;
+    size_t total_out = 0;
+
+    // decompress, growing the buffer while it fills, and accept total_out
+    // whatever the return code
+    while (true) {
+      bzs.next_out = reinterpret_cast<char*>(buf + total_out);
+      bzs.avail_out = capacity - total_out;
+      const unsigned int avail_out = bzs.avail_out;
+      const int r = BZ2_bzDecompress(&bzs);
+      total_out += avail_out - bzs.avail_out;
+      if (r != BZ_OK || bzs.avail_out != 0 ||
+          !grow_output_buffer(&buf, &capacity, total_out,
+                              uncompressed_size_max)) {
+        break;
+      }
+    }
+
+    *out_buf = buf;
+    *out_size = total_out;
+    if (in_used != NULL) {
+      *in_used = max_in_size - bzs.avail_in;
+    }
+    BZ2_bzDecompressEnd(&bzs);
+    return "";
+  }
+} // end namespace hasher
+
+#endif
@@ -51,6 +51,7 @@
 #include <iostream>
 #include <unistd.h>
 #include <zlib.h>
+#include "uncompress.hpp"
 #include "tprint.hpp" // threadsafe report unusual condition
 
 namespace hasher {
@@ -60,9 +61,8 @@ namespace hasher {
                             const size_t in_size,
                             const size_t in_offset,
                             uint8_t** out_buf,
-                            size_t* out_size) {
-
-    const size_t max_out_size = 256*1024*1024;
+                            size_t* out_size,
+                            size_t* in_used) {
 
     // pointer to the output buffer that will be created using new
     *out_buf = NULL;
@@ -71,46 +71,23 @@ namespace hasher {
     // validate the buffer range
     if (in_size < in_offset + 18) {
       // nothing to do
-      *out_buf = new uint8_t[0]();
       return "gzip region too small";
     }
 
-    // create the destination uncompressed buffer
-    *out_buf = new (std::nothrow) uint8_t[max_out_size]();
-    if (*out_buf == NULL) {
-      // comment that the buffer acquisition request failed
-      hashdb::tprint(std::cout,
-                     "# bad memory allocation in gzip uncompression");
-      return "bad memory allocation in gzip uncompression";
+    // inflate, ignoring any zlib error code and accepting total_out
+    static thread_local inflater_t inflater(16+MAX_WBITS);
+    size_t compressed_used;
+    std::string error_message = inflater.inflate_new(
+                  in_buf + in_offset, in_size - in_offset,
+                  0, uncompressed_size_max,
+                  out_buf, out_size, &compressed_used);
+    if (error_message != "") {
+      return "gzip " + error_message;
     }
-
-    // calculate maximum input size
-    const size_t max_in_size = in_size - in_offset;
-
-    // set up the decompression structure
-    z_stream zs;
-    memset (&zs, 0, sizeof(zs));
-
-    zs.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(
-                                                        in_buf + in_offset));
-    zs.avail_in = max_in_size;
-    zs.next_out = *out_buf;
-    zs.avail_out = max_out_size;
-
-    int r = inflateInit2(&zs,16+MAX_WBITS);
-    if(r==0){
-      // ignore any error code and accept total_out
-      r = inflate(&zs,Z_SYNC_FLUSH);
-      *out_size = zs.total_out;
-      r = inflateEnd(&zs);
-      return "";
-    } else {
-
-      // inflate failed
-      delete[] *out_buf;
-      *out_buf = NULL;
-      return "gzip zlib inflate failed";
+    if (in_used != NULL) {
+      *in_used = compressed_used;
     }
+    return "";
   }
 } // end namespace hasher
 
@@ -0,0 +1,104 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+// Based on the POSIX pax interchange format, ustar header block,
+// https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+
+/**
+ * \file
+ * Provide uncompress routines for selected compression algorithms.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include "uncompress.hpp"
+#include "tprint.hpp" // threadsafe report unusual condition
+
+namespace hasher {
+
+  // return new out_buf else error text
+  std::string new_from_tar(const uint8_t* const in_buf,
+                           const size_t in_size,
+                           const size_t in_offset,
+                           uint8_t** out_buf,
+                           size_t* out_size,
+                           size_t* in_used) {
+
+    // pointer to the output buffer that will be created using new
+    *out_buf = NULL;
+    *out_size = 0;
+
+    // validate the buffer range
+    if (in_size < in_offset + 512) {
+      // nothing to do
+      return "tar region too small";
+    }
+
+    const uint8_t* const h = in_buf + in_offset;
+
+    // only regular files have data to recurse into
+    if (h[156] != '0' && h[156] != 0x00 && h[156] != '7') {
+      return "tar entry is not a file";
+    }
+
+    const uint64_t file_size = tar_file_size(h);
+    if (file_size == 0) {
+      return "tar file is empty";
+    }
+
+    // keep what is in the buffer
+    const size_t data_offset = in_offset + 512;
+    const size_t data_size = (file_size > in_size - data_offset)
+                             ? in_size - data_offset : file_size;
+    if (data_size > uncompressed_size_max) {
+      return "tar file too large";
+    }
+
+    // copy the file data since the new buffer is owned by the caller
+    *out_buf = new (std::nothrow) uint8_t[data_size];
+    if (*out_buf == NULL) {
+      // comment that the buffer acquisition request failed
+      hashdb::tprint(std::cout, "# bad memory allocation in tar extraction");
+      return "bad memory allocation in tar extraction";
+    }
+    memcpy(*out_buf, in_buf + data_offset, data_size);
+    *out_size = data_size;
+
+    // the data is padded to a whole header block
+    if (in_used != NULL) {
+      *in_used = 512 + ((data_size + 511) / 512) * 512;
+    }
+    return "";
+  }
+} // end namespace hasher
@@ -0,0 +1,106 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+// Based on the .xz file format specification 1.0.4,
+// https://tukaani.org/xz/xz-file-format.txt
+
+/**
+ * \file
+ * Provide uncompress routines for selected compression algorithms.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include "uncompress.hpp"
+
+#if defined(HAVE_LZMA_H) && defined(HAVE_LIBLZMA)
+#include <lzma.h>
+
+namespace hasher {
+
+  // return new out_buf else error text
+  std::string new_from_xz(const uint8_t* const in_buf,
+                          const size_t in_size,
+                          const size_t in_offset,
+                          uint8_t** out_buf,
+                          size_t* out_size,
+                          size_t* in_used) {
+
+    // pointer to the output buffer that will be created using new
+    *out_buf = NULL;
+    *out_size = 0;
+
+    // set up the decoder for one .xz stream
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (lzma_stream_decoder(&strm, UINT64_MAX, 0) != LZMA_OK) {
+      return "xz decoder init failed";
+    }
+
+    // create the first uncompressed buffer
+    size_t capacity;
+    uint8_t* buf = new_output_buffer(0, uncompressed_size_max, &capacity);
+    if (buf == NULL) {
+      lzma_end(&strm);
+      return "bad memory allocation in xz uncompression";
+    }
+
+    strm.next_in = in_buf + in_offset;
+    strm.avail_in = in_size - in_offset;
+    strm.next_out = buf;
+    strm.avail_out = capacity;
+
+    // decode, growing the buffer while it fills, and accept total_out
+    // whatever the return code
+    while (true) {
+      const lzma_ret r = lzma_code(&strm, LZMA_FINISH);
+      if (r != LZMA_OK || strm.avail_out != 0 ||
+          !grow_output_buffer(&buf, &capacity, strm.total_out,
+                              uncompressed_size_max)) {
+        break;
+      }
+      strm.next_out = buf + strm.total_out;
+      strm.avail_out = capacity - strm.total_out;
+    }
+
+    *out_buf = buf;
+    *out_size = strm.total_out;
+    if (in_used != NULL) {
+      *in_used = strm.total_in;
+    }
+    lzma_end(&strm);
+    return "";
+  }
+} // end namespace hasher
+
+#endif
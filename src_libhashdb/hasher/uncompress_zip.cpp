@@ -48,13 +48,13 @@
 #include <iostream>
 #include <unistd.h>
 #include <zlib.h>
+#include "uncompress.hpp"
 #include "tprint.hpp" // threadsafe report unusual condition
 
 namespace hasher {
 
   static const uint32_t zip_name_len_max = 1024;
   static const size_t uncompressed_size_min = 6;
-  static const size_t uncompressed_size_max = 16777216; // 2^24 = 16MiB
 
   inline uint16_t u16(const uint8_t* const b) {
     return (uint16_t)(b[0]<<0) | (uint16_t)(b[1]<<8);
@@ -70,7 +70,8 @@ namespace hasher {
                            const size_t in_size,
                            const size_t in_offset,
                            uint8_t** out_buf,
-                           size_t* out_size) {
+                           size_t* out_size,
+                           size_t* in_used) {
 
     // pointer to the output buffer that will be created using new
     *out_buf = NULL;
@@ -107,54 +108,25 @@ namespace hasher {
                compressed_offset + compr_size > in_size) 
                           ? in_size - compressed_offset : compr_size;
 
-    // size of uncompressed data
-    const uint32_t potential_uncompressed_size =
-               (compr_size == 0 || compr_size > uncompressed_size_max)
-                                  ? uncompressed_size_max : uncompr_size;
-    
     // skip if uncompressed size is too small
-    if (potential_uncompressed_size < uncompressed_size_min) {
+    if (compr_size != 0 && uncompr_size < uncompressed_size_min) {
       return "zip uncompress size too small";
     }
 
-    // create the uncompressed buffer
-    *out_buf = new (std::nothrow) uint8_t[potential_uncompressed_size]();
-    if (*out_buf == NULL) {
-      // comment that the buffer acquisition request failed
-      hashdb::tprint(std::cout, "# bad memory allocation in zip uncompression");
-      return "bad memory allocation in zip uncompression";
+    // inflate, starting with the size in the header if it is given
+    static thread_local inflater_t inflater(-15);
+    size_t compressed_used;
+    std::string error_message = inflater.inflate_new(
+                  in_buf + compressed_offset, compressed_size,
+                  (compr_size == 0) ? 0 : uncompr_size, uncompressed_size_max,
+                  out_buf, out_size, &compressed_used);
+    if (error_message != "") {
+      return "zip " + error_message;
     }
-
-    // set up zlib data
-    z_stream zs;
-    memset(&zs, 0, sizeof(zs));
-    zs.next_in = const_cast<Bytef *>(reinterpret_cast<const Bytef *>(
-                                         in_buf + compressed_offset));
-    zs.avail_in = compressed_size;
-    zs.next_out = *out_buf;
-    zs.avail_out = potential_uncompressed_size;
-
-    // initialize zlib for this decompression
-    int r = inflateInit2(&zs, -15);
-    if (r == 0) {
-
-      // inflate
-      inflate(&zs, Z_SYNC_FLUSH);
-
-      // set out_size
-      *out_size = zs.total_out;
-
-      // close zlib
-      inflateEnd(&zs);
-      return "";
-
-    } else {
-
-      // inflate failed
-      delete[] *out_buf;
-      *out_buf = NULL;
-      return "zip zlib inflate failed";
+    if (in_used != NULL) {
+      *in_used = compressed_offset - in_offset + compressed_used;
     }
+    return "";
   }
 } // end namespace hasher
 
@@ -0,0 +1,137 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+// Based on the Zstandard compression format, RFC 8878,
+// https://www.rfc-editor.org/rfc/rfc8878
+
+/**
+ * \file
+ * Provide uncompress routines for selected compression algorithms.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <cstring>
+#include <stdint.h>
+#include <iostream>
+#include "uncompress.hpp"
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#include <zstd.h>
+
+namespace hasher {
+
+  // decompression context, kept per thread
+  class zstd_dstream_t {
+    private:
+    // do not allow copy or assignment
+    zstd_dstream_t(const zstd_dstream_t&);
+    zstd_dstream_t& operator=(const zstd_dstream_t&);
+
+    public:
+    ZSTD_DStream* const zds;
+    zstd_dstream_t() : zds(ZSTD_createDStream()) {
+    }
+    ~zstd_dstream_t() {
+      ZSTD_freeDStream(zds);
+    }
+  };
+
+  // return new out_buf else error text
+  std::string new_from_zstd(const uint8_t* const in_buf,
+                            const size_t in_size,
+                            const size_t in_offset,
+                            uint8_t** out_buf,
+                            size_t* out_size,
+                            size_t* in_used) {
+
+    // pointer to the output buffer that will be created using new
+    *out_buf = NULL;
+    *out_size = 0;
+
+    // start a new frame
+    static thread_local zstd_dstream_t dstream;
+    if (dstream.zds == NULL || ZSTD_isError(ZSTD_initDStream(dstream.zds))) {
+      return "zstd decoder init failed";
+    }
+
+    // create the first uncompressed buffer, sized by the frame header
+    // if it has the content size
+    const unsigned long long content_size = ZSTD_getFrameContentSize(
+                                 in_buf + in_offset, in_size - in_offset);
+    const size_t size_hint = (content_size == ZSTD_CONTENTSIZE_UNKNOWN ||
+                              content_size == ZSTD_CONTENTSIZE_ERROR ||
+                              content_size > uncompressed_size_max)
+                             ? 0 : static_cast<size_t>(content_size);
+    size_t capacity;
+    uint8_t* buf = new_output_buffer(size_hint, uncompressed_size_max,
+                                     &capacity);
+    if (buf == NULL) {
+      return "bad memory allocation in zstd uncompression";
+    }
+
+    ZSTD_inBuffer in = {in_buf + in_offset, in_size - in_offset, 0};
+    ZSTD_outBuffer out = {buf, capacity, 0};
+
+    // decompress one frame, growing the buffer while it fills, and
+    // accept out.pos whatever the return code
+    while (true) {
+      const size_t in_pos = in.pos;
+      const size_t out_pos = out.pos;
+      const size_t r = ZSTD_decompressStream(dstream.zds, &out, &in);
+      if (ZSTD_isError(r) || r == 0) {
+        // error or end of frame
+        break;
+      }
+      if (out.pos == out.size) {
+        if (!grow_output_buffer(&buf, &capacity, out.pos,
+                                uncompressed_size_max)) {
+          break;
+        }
+        out.dst = buf;
+        out.size = capacity;
+      } else if (in.pos == in.size || (in.pos == in_pos &&
+                                        out.pos == out_pos)) {
+        // out of input or no progress
+        break;
+      }
+    }
+
+    *out_buf = buf;
+    *out_size = out.pos;
+    if (in_used != NULL) {
+      *in_used = in.pos;
+    }
+    return "";
+  }
+} // end namespace hasher
+
+#endif
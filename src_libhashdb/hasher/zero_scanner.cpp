@@ -0,0 +1,196 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Find nonzero bytes using SSE2, AVX2, AVX-512, or NEON where available,
+ * see zero_scanner.hpp.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdlib>
+#include "zero_scanner.hpp"
+#include "cpu_dispatch.hpp"
+
+#if defined(__SSE2__)
+#define ZERO_SCANNER_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ZERO_SCANNER_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define ZERO_SCANNER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace hasher {
+
+  // check bytes one 64-bit word at a time
+  static size_t find_nonzero_words(const uint8_t* const buffer,
+                                   size_t begin, const size_t end) {
+    while (begin + sizeof(uint64_t) <= end) {
+      uint64_t word;
+      std::memcpy(&word, buffer + begin, sizeof(uint64_t));
+      if (word != 0) {
+        break;
+      }
+      begin += sizeof(uint64_t);
+    }
+    while (begin < end && buffer[begin] == 0) {
+      ++begin;
+    }
+    return begin;
+  }
+
+#ifdef ZERO_SCANNER_SSE2
+  static size_t find_nonzero_sse2(const uint8_t* const buffer,
+                                  size_t begin, const size_t end) {
+    const __m128i zero = _mm_setzero_si128();
+    while (begin + 64 <= end) {
+      const __m128i* const p =
+                  reinterpret_cast<const __m128i*>(buffer + begin);
+      const __m128i v = _mm_or_si128(
+                  _mm_or_si128(_mm_loadu_si128(p), _mm_loadu_si128(p+1)),
+                  _mm_or_si128(_mm_loadu_si128(p+2), _mm_loadu_si128(p+3)));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff) {
+        break;
+      }
+      begin += 64;
+    }
+    return find_nonzero_words(buffer, begin, end);
+  }
+#endif
+
+#ifdef ZERO_SCANNER_AVX2
+  __attribute__((target("avx2")))
+  static size_t find_nonzero_avx2(const uint8_t* const buffer,
+                                  size_t begin, const size_t end) {
+    while (begin + 128 <= end) {
+      const __m256i* const p =
+                  reinterpret_cast<const __m256i*>(buffer + begin);
+      const __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256(p), _mm256_loadu_si256(p+1)),
+            _mm256_or_si256(_mm256_loadu_si256(p+2), _mm256_loadu_si256(p+3)));
+      if (!_mm256_testz_si256(v, v)) {
+        break;
+      }
+      begin += 128;
+    }
+    return find_nonzero_words(buffer, begin, end);
+  }
+#endif
+
+#ifdef ZERO_SCANNER_AVX2
+  __attribute__((target("avx512f")))
+  static size_t find_nonzero_avx512(const uint8_t* const buffer,
+                                    size_t begin, const size_t end) {
+    while (begin + 256 <= end) {
+      const uint8_t* const p = buffer + begin;
+      const __m512i v = _mm512_or_si512(
+            _mm512_or_si512(_mm512_loadu_si512(p), _mm512_loadu_si512(p+64)),
+            _mm512_or_si512(_mm512_loadu_si512(p+128),
+                            _mm512_loadu_si512(p+192)));
+      if (_mm512_test_epi64_mask(v, v) != 0) {
+        break;
+      }
+      begin += 256;
+    }
+    return find_nonzero_avx2(buffer, begin, end);
+  }
+#endif
+
+#ifdef ZERO_SCANNER_NEON
+  static size_t find_nonzero_neon(const uint8_t* const buffer,
+                                  size_t begin, const size_t end) {
+    while (begin + 64 <= end) {
+      const uint8_t* const p = buffer + begin;
+      const uint8x16_t v = vorrq_u8(vorrq_u8(vld1q_u8(p), vld1q_u8(p+16)),
+                                    vorrq_u8(vld1q_u8(p+32), vld1q_u8(p+48)));
+      if (vmaxvq_u8(v) != 0) {
+        break;
+      }
+      begin += 64;
+    }
+    return find_nonzero_words(buffer, begin, end);
+  }
+#endif
+
+  typedef size_t (*find_nonzero_function_t)(const uint8_t* const,
+                                            size_t, const size_t);
+
+  // the widest implementation the CPU features allow, and its name
+  static find_nonzero_function_t select_find_nonzero(const char*& name) {
+    const cpu_features_t& features = cpu_features();
+#ifdef ZERO_SCANNER_AVX2
+    if (features.avx512) {
+      name = "avx512";
+      return find_nonzero_avx512;
+    }
+    if (features.avx2) {
+      name = "avx2";
+      return find_nonzero_avx2;
+    }
+#endif
+#if defined(ZERO_SCANNER_SSE2)
+    if (features.sse2) {
+      name = "sse2";
+      return find_nonzero_sse2;
+    }
+#elif defined(ZERO_SCANNER_NEON)
+    if (features.neon) {
+      name = "neon";
+      return find_nonzero_neon;
+    }
+#endif
+    (void)features;
+    name = "scalar";
+    return find_nonzero_words;
+  }
+
+  static const char* find_nonzero_name = "";
+  static const find_nonzero_function_t find_nonzero_function =
+                                     select_find_nonzero(find_nonzero_name);
+
+  const char* zero_check_kernel() {
+    return find_nonzero_name;
+  }
+
+  size_t find_nonzero(const uint8_t* const buffer,
+                      const size_t begin, const size_t end) {
+    return find_nonzero_function(buffer, begin, end);
+  }
+
+} // end namespace hasher
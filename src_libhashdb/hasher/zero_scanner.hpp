@@ -0,0 +1,92 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Detect all-zero blocks in a buffer.
+ *
+ * find_nonzero locates the next nonzero byte using the widest vector
+ * instructions available, selected at runtime.
+ *
+ * zero_scanner_t remembers the nonzero byte found by its last search,
+ * so blocks at increasing offsets scan each byte of the buffer at most
+ * once, even when steps overlap because step_size < block_size.
+ */
+
+#ifndef ZERO_SCANNER_HPP
+#define ZERO_SCANNER_HPP
+#include <stdint.h>
+#include <cstdlib>
+
+namespace hasher {
+
+  /**
+   * Return the index of the first nonzero byte in buffer[begin, end),
+   * or end if all of the bytes are zero.
+   */
+  size_t find_nonzero(const uint8_t* const buffer,
+                      const size_t begin, const size_t end);
+
+class zero_scanner_t {
+
+  private:
+  const uint8_t* const buffer;
+  const size_t buffer_size;
+
+  // buffer[searched_from, next_nonzero) is known to be zero
+  size_t searched_from;
+  size_t next_nonzero;
+
+  // do not allow copy or assignment
+  zero_scanner_t(const zero_scanner_t&);
+  zero_scanner_t& operator=(const zero_scanner_t&);
+
+  public:
+  zero_scanner_t(const uint8_t* const p_buffer, const size_t p_buffer_size) :
+                 buffer(p_buffer), buffer_size(p_buffer_size),
+                 searched_from(0), next_nonzero(0) {
+  }
+
+  /**
+   * Detect if the block at offset is all zero.  The first byte of the
+   * block is not checked.  Call with increasing offsets for best speed.
+   */
+  bool all_zero(const size_t offset, const size_t p_count) {
+
+    // number of bytes
+    const size_t count =
+          (offset + p_count <= buffer_size) ? p_count : buffer_size - offset;
+    const size_t begin = offset + 1;
+    const size_t end = offset + count;
+    if (begin >= end) {
+      return true;
+    }
+
+    // search again unless the last search covers begin
+    if (begin < searched_from || begin > next_nonzero) {
+      searched_from = begin;
+      next_nonzero = find_nonzero(buffer, begin, buffer_size);
+    }
+    return next_nonzero >= end;
+  }
+};
+
+} // end namespace hasher
+
+#endif
@@ -17,20 +17,164 @@
 //
 // Released into the public domain on February 25, 2013 by Bruce Allen.
 
+
 /**
  * \file
- * hex conversion code for the hashdb library.
+ * hex conversion code for the hashdb library.  Conversion uses SSE2
+ * sixteen bytes at a time where available and allowed by the selected
+ * CPU features, see hasher/cpu_dispatch.hpp.
  */
 
 #include <config.h>
 #include <string>
 #include <cassert>
 #include <iostream>
-#include <sstream>
+#include <stdint.h>
 #include "hashdb.hpp"
+#include "cpu_dispatch.hpp"
+
+#if defined(__SSE2__)
+#define HEX_HELPER_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace hashdb {
 
+static const char hex_digits[] = "0123456789abcdef";
+
+#ifdef HEX_HELPER_SSE2
+static const bool use_sse2 = hasher::cpu_features().sse2;
+#endif
+
+// the value of a hex digit, or 16 if invalid
+inline uint8_t hex_value(const uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 16;
+}
+
+#ifdef HEX_HELPER_SSE2
+// the hex digits of the nibbles in the bytes of n
+static inline __m128i nibble_digits_sse2(const __m128i n) {
+  // '0' + n, plus 'a' - '0' - 10 for n > 9
+  const __m128i digits = _mm_add_epi8(n, _mm_set1_epi8('0'));
+  const __m128i is_alpha = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+  return _mm_add_epi8(digits, _mm_and_si128(is_alpha,
+                                            _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// encode 16 bytes into 32 hex digits
+static inline void encode_sse2(const char* const binary, char* const hex) {
+  const __m128i b = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(binary));
+  const __m128i mask = _mm_set1_epi8(0x0f);
+  const __m128i hi = nibble_digits_sse2(
+                    _mm_and_si128(_mm_srli_epi16(b, 4), mask));
+  const __m128i lo = nibble_digits_sse2(_mm_and_si128(b, mask));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(hex),
+                   _mm_unpacklo_epi8(hi, lo));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(hex + 16),
+                   _mm_unpackhi_epi8(hi, lo));
+}
+
+// the values of 16 hex digits, false if any is invalid
+static inline bool digit_values_sse2(const char* const hex, __m128i& values) {
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex));
+
+  // '0' to '9'
+  const __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+  const __m128i is_digit = _mm_cmpeq_epi8(
+                       _mm_min_epu8(d, _mm_set1_epi8(9)), d);
+
+  // 'a' to 'f' or 'A' to 'F'
+  const __m128i a = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)),
+                                 _mm_set1_epi8('a'));
+  const __m128i is_alpha = _mm_cmpeq_epi8(
+                       _mm_min_epu8(a, _mm_set1_epi8(5)), a);
+
+  if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xffff) {
+    return false;
+  }
+  values = _mm_or_si128(_mm_and_si128(is_digit, d),
+                        _mm_and_si128(is_alpha,
+                                  _mm_add_epi8(a, _mm_set1_epi8(10))));
+  return true;
+}
+
+// decode 32 hex digits into 16 bytes, false if any digit is invalid
+static inline bool decode_sse2(const char* const hex, char* const binary) {
+  __m128i v0;
+  __m128i v1;
+  if (!digit_values_sse2(hex, v0) || !digit_values_sse2(hex + 16, v1)) {
+    return false;
+  }
+
+  // each 16-bit lane holds the high digit then the low digit
+  const __m128i low_byte = _mm_set1_epi16(0x00ff);
+  const __m128i b0 = _mm_or_si128(
+                       _mm_slli_epi16(_mm_and_si128(v0, low_byte), 4),
+                       _mm_srli_epi16(v0, 8));
+  const __m128i b1 = _mm_or_si128(
+                       _mm_slli_epi16(_mm_and_si128(v1, low_byte), 4),
+                       _mm_srli_epi16(v1, 8));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(binary),
+                   _mm_packus_epi16(b0, b1));
+  return true;
+}
+#endif
+
+/**
+ * Write the 2*size hexadecimal digits of size binary bytes into hex.
+ */
+void bin_to_hex(const char* const binary, const size_t size,
+                char* const hex) {
+  size_t i = 0;
+#ifdef HEX_HELPER_SSE2
+  if (use_sse2) {
+    for (; i + 16 <= size; i += 16) {
+      encode_sse2(binary + i, hex + i * 2);
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    const uint8_t c = static_cast<uint8_t>(binary[i]);
+    hex[i*2] = hex_digits[c >> 4];
+    hex[i*2+1] = hex_digits[c & 0x0f];
+  }
+}
+
+/**
+ * Write the size/2 binary bytes of size hex digits into binary.
+ * Return false if size is odd or any digit is invalid.
+ */
+bool hex_to_bin(const char* const hex, const size_t size,
+                char* const binary) {
+  // size must be even
+  if (size%2 != 0) {
+    return false;
+  }
+
+  size_t i = 0;
+#ifdef HEX_HELPER_SSE2
+  if (use_sse2) {
+    for (; i + 32 <= size; i += 32) {
+      if (!decode_sse2(hex + i, binary + i / 2)) {
+        return false;
+      }
+    }
+  }
+#endif
+  for (; i < size; i += 2) {
+    const uint8_t d0 = hex_value(static_cast<uint8_t>(hex[i]));
+    const uint8_t d1 = hex_value(static_cast<uint8_t>(hex[i+1]));
+    if (d0 > 15 || d1 > 15) {
+      return false;
+    }
+    binary[i / 2] = static_cast<char>(d0 << 4 | d1);
+  }
+  return true;
+}
 
 /**
  * Return binary string or empty if hexdigest length is not even
@@ -46,73 +190,33 @@ std::string hex_to_bin(const std::string& hex_string) {
     return "";
   }
 
-  size_t i = 0;
-  size_t j = 0;
-  uint8_t bin[size];
-  for (; i<size; i+=2) {
-    uint8_t c0 = hex_string[i];
-    uint8_t c1 = hex_string[i+1];
-    uint8_t d0;
-    uint8_t d1;
-
-    if(c0>='0' && c0<='9') d0 = c0-'0';
-    else if(c0>='a' && c0<='f') d0 = c0-'a'+10;
-    else if(c0>='A' && c0<='F') d0 = c0-'A'+10;
-    else {
-      std::cerr << "hex_to_bin: unexpected hex character in '"
-                << hex_string << "'\n";
-      return "";
-    }
-
-    if(c1>='0' && c1<='9') d1 = c1-'0';
-    else if(c1>='a' && c1<='f') d1 = c1-'a'+10;
-    else if(c1>='A' && c1<='F') d1 = c1-'A'+10;
-    else {
-      std::cerr << "hex_to_bin: unexpected hex character in '"
-                << hex_string << "'\n";
-      return "";
-    }
-
-    bin[j++] = d0 << 4 | d1;
-  }
-  return std::string(reinterpret_cast<char*>(bin), j);
-}
-
-inline uint8_t tohex(uint8_t c) {
-  switch(c) {
-    case 0 : return '0'; break;
-    case 1 : return '1'; break;
-    case 2 : return '2'; break;
-    case 3 : return '3'; break;
-    case 4 : return '4'; break;
-    case 5 : return '5'; break;
-    case 6 : return '6'; break;
-    case 7 : return '7'; break;
-    case 8 : return '8'; break;
-    case 9 : return '9'; break;
-    case 10 : return 'a'; break;
-    case 11 : return 'b'; break;
-    case 12 : return 'c'; break;
-    case 13 : return 'd'; break;
-    case 14 : return 'e'; break;
-    case 15 : return 'f'; break;
-    default:
-      std::cerr << "char " << (uint32_t)c << "\n";
-      assert(0);
-      return 0; // for mingw compiler
+  std::string binary_string(size / 2, 0);
+  if (size > 0 && !hex_to_bin(hex_string.data(), size, &binary_string[0])) {
+    std::cerr << "hex_to_bin: unexpected hex character in '"
+              << hex_string << "'\n";
+    return "";
   }
+  return binary_string;
 }
 
 /**
  * Return hexadecimal representation of the binary string.
  */
 std::string bin_to_hex(const std::string& binary_string) {
-  std::stringstream ss;
-  for (size_t i=0; i<binary_string.size(); i++) {
-    uint8_t c = binary_string.c_str()[i];
-    ss << tohex(c>>4) << tohex(c&0x0f);
+  std::string hex_string(binary_string.size() * 2, 0);
+  if (binary_string.size() > 0) {
+    bin_to_hex(binary_string.data(), binary_string.size(), &hex_string[0]);
   }
-  return ss.str();
+  return hex_string;
 }
 } // end namespace hashdb
 
+namespace hasher {
+  const char* hex_kernel() {
+#ifdef HEX_HELPER_SSE2
+    return (hashdb::use_sse2) ? "sse2" : "scalar";
+#else
+    return "scalar";
+#endif
+  }
+} // end namespace hasher
@@ -0,0 +1,205 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides a HyperLogLog sketch of the block hashes of a hashdb, for
+ * estimating how many distinct hashes a hashdb has and how many it
+ * shares with another, see hashdb::estimate_hashes.
+ *
+ * The sketch has 2^14 one-byte registers, 16 KiB, for a standard error
+ * of about 0.8%.  Each block hash is mixed into 64 bits, the leading 14
+ * bits pick a register, and the register keeps the highest rank, the
+ * position of the first 1 bit, of the rest.  Registers are updated
+ * atomically so that import threads add hashes without a lock.  The
+ * union of two sketches is their register-wise maximum.  Sketches only
+ * grow, so hashes removed from a hashdb are still counted.
+ *
+ * The file holds a magic string and the precision followed by the
+ * registers.
+ */
+
+#ifndef HLL_SKETCH_HPP
+#define HLL_SKETCH_HPP
+
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <atomic>
+#include <stdint.h>
+
+namespace hashdb {
+
+class hll_sketch_t {
+
+  private:
+  static const size_t precision = 14;
+  static const size_t num_registers = static_cast<size_t>(1) << precision;
+
+  std::atomic<uint8_t>* registers;
+
+  // do not allow copy or assignment
+  hll_sketch_t(const hll_sketch_t&);
+  hll_sketch_t& operator=(const hll_sketch_t&);
+
+  // FNV-1a over the hash then a finalizer, since not every block hash
+  // is uniform in its leading bytes
+  static uint64_t mix(const char* const p, const size_t size) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i=0; i<size; ++i) {
+      h = (h ^ static_cast<uint8_t>(p[i])) * 0x100000001b3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+  }
+
+  // raise a register to rank
+  void raise(const size_t index, const uint8_t rank) {
+    uint8_t current = registers[index].load(std::memory_order_relaxed);
+    while (current < rank &&
+           !registers[index].compare_exchange_weak(current, rank,
+                                                std::memory_order_relaxed)) {
+    }
+  }
+
+  public:
+  hll_sketch_t() : registers(new std::atomic<uint8_t>[num_registers]) {
+    for (size_t i=0; i<num_registers; ++i) {
+      registers[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  ~hll_sketch_t() {
+    delete[] registers;
+  }
+
+  // add a block hash
+  void add(const std::string& block_hash) {
+    const uint64_t h = mix(block_hash.c_str(), block_hash.size());
+    const size_t index = static_cast<size_t>(h >> (64 - precision));
+    uint64_t rest = h << precision;
+    uint8_t rank = 1;
+    while (rank <= 64 - precision && (rest & 0x8000000000000000ULL) == 0) {
+      rest <<= 1;
+      ++rank;
+    }
+    raise(index, rank);
+  }
+
+  // add the hashes of another sketch
+  void merge(const hll_sketch_t& other) {
+    for (size_t i=0; i<num_registers; ++i) {
+      raise(i, other.registers[i].load(std::memory_order_relaxed));
+    }
+  }
+
+  // the estimated number of distinct hashes added
+  uint64_t estimate() const {
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t i=0; i<num_registers; ++i) {
+      const uint8_t rank = registers[i].load(std::memory_order_relaxed);
+      sum += std::ldexp(1.0, -static_cast<int>(rank));
+      if (rank == 0) {
+        ++zeros;
+      }
+    }
+    const double m = static_cast<double>(num_registers);
+    double e = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+
+    // small counts are better estimated by the empty registers
+    if (e <= 2.5 * m && zeros != 0) {
+      e = m * std::log(m / static_cast<double>(zeros));
+    }
+    return static_cast<uint64_t>(e + 0.5);
+  }
+
+  /**
+   * Read the sketch from filename.  Returns "" if successful else
+   * reason if not.
+   */
+  std::string read(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return "Unable to open sketch file '" + filename + "'.";
+    }
+    char magic[8];
+    uint8_t file_precision = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&file_precision), 1);
+    if (!in.good() || memcmp(magic, "hdbhll1", 8) != 0 ||
+        file_precision != precision) {
+      return "'" + filename + "' is not a sketch file.";
+    }
+    char buffer[num_registers];
+    in.read(buffer, num_registers);
+    if (!in.good()) {
+      return "Sketch file '" + filename + "' is truncated.";
+    }
+    for (size_t i=0; i<num_registers; ++i) {
+      registers[i].store(static_cast<uint8_t>(buffer[i]),
+                         std::memory_order_relaxed);
+    }
+    return "";
+  }
+
+  /**
+   * Write the sketch to filename, replacing any existing file.  Returns
+   * "" if successful else reason if not.
+   */
+  std::string write(const std::string& filename) const {
+    char buffer[num_registers];
+    for (size_t i=0; i<num_registers; ++i) {
+      buffer[i] = static_cast<char>(
+                         registers[i].load(std::memory_order_relaxed));
+    }
+    const uint8_t file_precision = precision;
+
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return "Unable to create sketch file '" + filename + "'.";
+    }
+    out.write("hdbhll1", 8);
+    out.write(reinterpret_cast<const char*>(&file_precision), 1);
+    out.write(buffer, num_registers);
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return "Unable to write sketch file '" + filename + "'.";
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return "Unable to replace sketch file '" + filename + "'.";
+    }
+    return "";
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
@@ -40,18 +40,24 @@
 #include "hashdb.hpp"
 #include <string>
 #include <sstream>
+#include <iomanip>
 #include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
 #include <stdint.h>
 #include <climits>
+#include <cstring>      // for memcpy
 #ifndef HAVE_CXX11
 #include <cassert>
+#include <cerrno>
 #endif
 #include <sys/stat.h>   // for mkdir
 #include <fcntl.h>      // scan_stream_f
 #include <time.h>       // for timestamp
 #include <sys/types.h>  // for timestamp
 #include <sys/time.h>   // for timestamp
-#include <unistd.h>     // for pipe
+#include <unistd.h>     // for pipe and getpid
 #include "file_modes.h"
 #include "settings_manager.hpp"
 #include "lmdb_hash_data_manager.hpp"
@@ -59,13 +65,32 @@
 #include "lmdb_source_data_manager.hpp"
 #include "lmdb_source_id_manager.hpp"
 #include "lmdb_source_name_manager.hpp"
+#include "source_name_codec.hpp"
+#include "lmdb_repository_manager.hpp"
+#include "lmdb_source_hash_manager.hpp"
+#include "lmdb_source_signature_manager.hpp"
+#include "lmdb_count_index_manager.hpp"
 #include "logger.hpp"
+#include "change_log.hpp"
 #include "locked_member.hpp"
+#include "shared_member.hpp"
+#include "source_cache.hpp"
+#include "common_blocks.hpp"
 #include "lmdb_changes.hpp"
+#include "hash_batch.hpp"
+#include "hash_bulk_loader.hpp"
+#include "hash_writer.hpp"
+#include "hll_sketch.hpp"
 #include "rapidjson.h"
 #include "writer.h"
 #include "document.h"
 #include "crc32.h"      // for find_expanded_hash_json
+#include "num_cpus.hpp"
+#include "stage_stats.hpp"
+#include "chunker.hpp"
+#include <pthread.h>    // for scan_ranges
+#include <atomic>       // for warm_progress
+#include "mutex_lock.hpp"
 
 // ************************************************************
 // version of the hashdb library
@@ -83,73 +108,224 @@ namespace hashdb {
   // ************************************************************
   // private helper functions
   // ************************************************************
-  // obtain rapidjson::Value type from a std::string
-  static rapidjson::Value v(const std::string& s,
-                            rapidjson::Document::AllocatorType& allocator) {
-    rapidjson::Value value;
-    value.SetString(s.c_str(), s.size(), allocator);
-    return value;
-  }
+  // A JSON writer into a reusable buffer.  JSON text is emitted
+  // directly through the writer without building a document.
+  class json_writer_t {
+    private:
+    rapidjson::StringBuffer strbuf;
 
-  // helper for producing expanded source for a source ID
-  static void provide_source_information(
-                        const hashdb::scan_manager_t& manager,
-                        const std::string file_hash,
-                        rapidjson::Document::AllocatorType& allocator,
-                        rapidjson::Value& json_source) {
+    // do not allow copy or assignment
+    json_writer_t(const json_writer_t&);
+    json_writer_t& operator=(const json_writer_t&);
 
-    // fields to hold source information
-    uint64_t filesize;
-    std::string file_type;
-    uint64_t zero_count;
-    uint64_t nonprobative_count;
-    hashdb::source_names_t* source_names(new hashdb::source_names_t);
+    public:
+    rapidjson::Writer<rapidjson::StringBuffer> writer;
 
-    // read source data
-    manager.find_source_data(file_hash, filesize, file_type,
-                             zero_count, nonprobative_count);
+    json_writer_t() : strbuf(), writer(strbuf) {
+    }
 
-    // provide source data
-    const std::string hex_file_hash = hashdb::bin_to_hex(file_hash);
+    // start a new JSON text, keeping the buffer
+    void reset() {
+      strbuf.Clear();
+      writer.Reset(strbuf);
+    }
+
+    // a string value or member name
+    void string(const std::string& s) {
+      writer.String(s.c_str(), s.size());
+    }
+
+    // a binary string value as hexadecimal
+    void hex(const std::string& binary) {
+      char hex_buffer[128];
+      if (binary.size() * 2 > sizeof(hex_buffer)) {
+        string(hashdb::bin_to_hex(binary));
+        return;
+      }
+      hashdb::bin_to_hex(binary.data(), binary.size(), hex_buffer);
+      writer.String(hex_buffer, binary.size() * 2, true);
+    }
 
-    // value for strings
-    json_source.AddMember("file_hash", v(hex_file_hash, allocator), allocator);
-    json_source.AddMember("filesize", filesize, allocator);
-    json_source.AddMember("file_type", v(file_type, allocator), allocator);
-    json_source.AddMember("zero_count", zero_count, allocator);
-    json_source.AddMember("nonprobative_count", nonprobative_count, allocator);
+    // the JSON text
+    std::string text() const {
+      return std::string(strbuf.GetString(), strbuf.GetSize());
+    }
+  };
+
+  // Declare a JSON writer reused by the calling thread where available.
+  // Each function has its own so nested formatting is safe.
+#ifdef HAVE_CXX11
+#define THREAD_JSON_WRITER(json) \
+    static thread_local json_writer_t json; \
+    json.reset()
+#else
+#define THREAD_JSON_WRITER(json) \
+    json_writer_t json
+#endif
 
-    // read source names
-    manager.find_source_names(file_hash, *source_names);
+  // the hash sketch file of a hashdb
+  static std::string sketch_filename(const std::string& hashdb_dir) {
+    return hashdb_dir + "/hll_sketch";
+  }
 
-    // name_pairs object
-    rapidjson::Value json_name_pairs(rapidjson::kArrayType);
+  // a string as JSON text
+  static std::string json_string(const std::string& s) {
+    THREAD_JSON_WRITER(json);
+    json.string(s);
+    return json.text();
+  }
 
-    // provide names
+  // helper for producing the expanded source JSON object for a source ID
+  static std::string provide_source_json(
+                        const hashdb::scan_manager_t& manager,
+                        hashdb::source_cache_t& source_cache,
+                        const std::string file_hash) {
+
+    // use the cached source
+    hashdb::source_information_t* information(
+                                 new hashdb::source_information_t);
+    if (source_cache.find(file_hash, *information)) {
+      const std::string json_text = information->json;
+      delete information;
+      return json_text;
+    }
+
+    // read source information
+    manager.find_source_data(file_hash, information->filesize,
+                             information->file_type,
+                             information->zero_count,
+                             information->nonprobative_count);
+    manager.find_source_names(file_hash, information->source_names);
+
+    // write JSON
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+
+    // provide source data
+    json.writer.Key("file_hash");
+    json.hex(file_hash);
+    json.writer.Key("filesize");
+    json.writer.Uint64(information->filesize);
+    json.writer.Key("file_type");
+    json.string(information->file_type);
+    json.writer.Key("zero_count");
+    json.writer.Uint64(information->zero_count);
+    json.writer.Key("nonprobative_count");
+    json.writer.Uint64(information->nonprobative_count);
+
+    // name_pairs array
+    json.writer.Key("name_pairs");
+    json.writer.StartArray();
     hashdb::source_names_t::const_iterator it;
-    for (it = source_names->begin(); it != source_names->end(); ++it) {
+    for (it = information->source_names.begin();
+         it != information->source_names.end(); ++it) {
       // repository name
-      json_name_pairs.PushBack(v(it->first, allocator), allocator);
+      json.string(it->first);
       // filename
-      json_name_pairs.PushBack(v(it->second, allocator), allocator);
+      json.string(it->second);
     }
-    json_source.AddMember("name_pairs", json_name_pairs, allocator);
+    json.writer.EndArray();
+    json.writer.EndObject();
 
-    delete source_names;
+    // cache the JSON text
+    information->json = json.text();
+    source_cache.insert(file_hash, *information);
+
+    const std::string json_text = information->json;
+    delete information;
+    return json_text;
+  }
+
+  // helper for producing the source_sub_counts JSON array of a source list
+  static std::string provide_source_sub_counts_json(
+                    hashdb::source_list_cache_t& source_list_cache,
+                    const uint32_t crc,
+                    const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    // use the cached source list if it is this list, the CRC is only
+    // over file hashes
+    const std::string key(static_cast<const char*>(
+                          static_cast<const void*>(&crc)), sizeof(crc));
+    hashdb::source_list_t* source_list(new hashdb::source_list_t);
+    if (source_list_cache.find(key, *source_list) &&
+        source_list->source_sub_counts.size() == source_sub_counts.size()) {
+      bool is_same = true;
+      hashdb::source_sub_counts_t::const_iterator it = source_sub_counts.begin();
+      hashdb::source_sub_counts_t::const_iterator cached_it =
+                                      source_list->source_sub_counts.begin();
+      for (; it != source_sub_counts.end(); ++it, ++cached_it) {
+        if (it->file_hash != cached_it->file_hash ||
+            it->sub_count != cached_it->sub_count) {
+          is_same = false;
+          break;
+        }
+      }
+      if (is_same) {
+        const std::string json_text = source_list->json;
+        delete source_list;
+        return json_text;
+      }
+    }
+
+    // add source_sub_counts as pairs of file hash, sub_count
+    std::stringstream ss;
+    ss << "[";
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      if (it != source_sub_counts.begin()) {
+        ss << ",";
+      }
+      ss << "\"" << hashdb::bin_to_hex(it->file_hash) << "\","
+         << it->sub_count;
+    }
+    ss << "]";
+
+    // cache the JSON text
+    source_list->source_sub_counts = source_sub_counts;
+    source_list->json = ss.str();
+    source_list_cache.insert(key, *source_list);
+
+    const std::string json_text = source_list->json;
+    delete source_list;
+    return json_text;
   }
 
   static uint32_t calculate_crc(
                        const hashdb::source_sub_counts_t& source_sub_counts) {
 
-    // calculate the CRC for the sources
-    uint32_t crc = 0;
+    // calculate the CRC for the sources in one pass over the file hashes
+    // so long source lists use the folding CRC kernel
+    if (source_sub_counts.size() == 1) {
+      const std::string& file_hash = source_sub_counts.begin()->file_hash;
+      return hashdb::crc32(0, reinterpret_cast<const uint8_t*>(
+                           file_hash.data()), file_hash.size());
+    }
+    std::string file_hashes;
+    file_hashes.reserve(source_sub_counts.size() * 16);
     for (hashdb::source_sub_counts_t::const_iterator it =
          source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
-      crc = hashdb::crc32(crc, static_cast<uint8_t*>(static_cast<void*>(
-                          const_cast<char*>((*it).file_hash.c_str()))),
-                          it->file_hash.size());
+      file_hashes += it->file_hash;
+    }
+    return hashdb::crc32(0, reinterpret_cast<const uint8_t*>(
+                         file_hashes.data()), file_hashes.size());
+  }
+
+  // split hashes packed into one array, false if not a multiple of size
+  static bool split_packed_hashes(const char* const packed_hashes,
+                                  const size_t packed_hashes_size,
+                                  const size_t hash_size,
+                                  std::vector<std::string>& block_hashes) {
+    if (hash_size == 0 || packed_hashes_size % hash_size != 0) {
+      std::cerr << "Error: packed hashes size " << packed_hashes_size
+                << " is not a multiple of hash size " << hash_size << "\n";
+      return false;
+    }
+    block_hashes.clear();
+    block_hashes.reserve(packed_hashes_size / hash_size);
+    for (size_t offset=0; offset<packed_hashes_size; offset+=hash_size) {
+      block_hashes.push_back(std::string(packed_hashes + offset, hash_size));
     }
-    return crc;
+    return true;
   }
 
   // ************************************************************
@@ -166,13 +342,65 @@ namespace hashdb {
   // ************************************************************
   // misc support interfaces
   // ************************************************************
+  // the LMDB policy of a store.  Only the hash data store, which holds
+  // most of the data, is preallocated.
+  static lmdb_helper::env_policy_t store_policy(
+                                   const hashdb::settings_t& settings,
+                                   const bool is_hash_data_store) {
+    lmdb_helper::env_policy_t policy;
+    policy.initial_map_size = (is_hash_data_store) ?
+                                       settings.initial_map_size : 0;
+    policy.max_map_size = settings.max_map_size;
+    if (!lmdb_helper::sync_policy_from_name(settings.sync_policy,
+                                            policy.sync_policy)) {
+      std::cerr << "program error in sync_policy " << settings.sync_policy
+                << "\n";
+      assert(0);
+    }
+    policy.sync_seconds = settings.sync_seconds;
+    policy.sync_bytes = static_cast<uint64_t>(settings.sync_mb) << 20;
+    policy.max_readers = settings.max_readers;
+    if (policy.max_readers == 0) {
+      // leave a slot for each scan thread with room for a walker and
+      // other processes
+      const uint32_t cpu_readers = 4 * static_cast<uint32_t>(numCPU());
+      policy.max_readers = (cpu_readers > 126) ? cpu_readers : 126;
+    }
+    return policy;
+  }
+
+  // the stores that settings_t::store_paths may place
+  static const char* const placeable_stores[] = {"lmdb_hash_data_store",
+                                                 "lmdb_hash_store",
+                                                 "lmdb_source_data_store",
+                                                 "lmdb_source_id_store",
+                                                 "lmdb_source_name_store",
+                                                 "lmdb_repository_store",
+                                                 "lmdb_source_hash_store",
+                                                 "lmdb_source_signature_store",
+                                                 "lmdb_count_index_store"};
+
+  // the policy of a new store, placed where settings.store_paths asks
+  static lmdb_helper::env_policy_t placed_policy(
+                                   const hashdb::settings_t& settings,
+                                   const std::string& store_name,
+                                   const lmdb_helper::env_policy_t& policy) {
+    lmdb_helper::env_policy_t placed(policy);
+    std::map<std::string, std::string>::const_iterator it =
+                                     settings.store_paths.find(store_name);
+    if (it != settings.store_paths.end()) {
+      placed.store_location = it->second;
+    }
+    return placed;
+  }
+
   /**
    * Return "" if hashdb is created else reason if not.
    * The current implementation may abort if something worse than a simple
    * path problem happens.
    */
   std::string create_hashdb(const std::string& hashdb_dir,
-                            const hashdb::settings_t& settings,
+                            const hashdb::settings_t& p_settings,
                             const std::string& command_string) {
 
     // path must be empty
@@ -180,6 +408,104 @@ namespace hashdb {
       return "Path '" + hashdb_dir + "' already exists.";
     }
 
+    // a new hashdb has no saved hash filter
+    hashdb::settings_t settings(p_settings);
+    settings.hash_filter_generation = 0;
+
+    // the hash data format must be known
+    if (settings.hash_data_format != hashdb::varint_hash_data_format &&
+        settings.hash_data_format != hashdb::fixed_hash_data_format &&
+        settings.hash_data_format != hashdb::dupfixed_hash_data_format) {
+      std::stringstream ss;
+      ss << "Invalid hash data format " << settings.hash_data_format
+         << ".  Supported formats are " << hashdb::varint_hash_data_format
+         << ", " << hashdb::fixed_hash_data_format << ", and "
+         << hashdb::dupfixed_hash_data_format << ".";
+      return ss.str();
+    }
+
+    // the source name format must be known
+    if (settings.source_name_format != hashdb::plain_source_name_format &&
+        settings.source_name_format !=
+                                   hashdb::compressed_source_name_format) {
+      std::stringstream ss;
+      ss << "Invalid source name format " << settings.source_name_format
+         << ".  Supported formats are " << hashdb::plain_source_name_format
+         << " and " << hashdb::compressed_source_name_format << ".";
+      return ss.str();
+    }
+
+    // the number of shard bits must be supported
+    if (settings.hash_shard_bits > hashdb::max_hash_shard_bits) {
+      std::stringstream ss;
+      ss << "Invalid hash shard bits " << settings.hash_shard_bits
+         << ".  The maximum is " << hashdb::max_hash_shard_bits << ".";
+      return ss.str();
+    }
+
+    // the preallocated map must fit within the maximum map size
+    if (settings.max_map_size != 0 &&
+        (settings.initial_map_size >> settings.hash_shard_bits) >
+                                                 settings.max_map_size) {
+      std::stringstream ss;
+      ss << "Invalid initial map size " << settings.initial_map_size
+         << ".  It may not exceed the maximum map size "
+         << settings.max_map_size << " of each shard.";
+      return ss.str();
+    }
+
+    // the sync policy must be known and its intervals nonzero
+    lmdb_helper::sync_policy_t sync_policy;
+    if (!lmdb_helper::sync_policy_from_name(settings.sync_policy,
+                                            sync_policy)) {
+      return "Invalid sync policy '" + settings.sync_policy +
+             "'.  Supported policies are none, periodic, and flush.";
+    }
+    if (settings.sync_seconds == 0 || settings.sync_mb == 0) {
+      return "Invalid sync interval.  The sync seconds and MiB must not be 0.";
+    }
+
+    // the block hash algorithm must be supported
+    if (hasher::block_hash_md(settings.block_hash_algorithm) == NULL) {
+      return "Invalid block hash algorithm '" +
+             settings.block_hash_algorithm + "'.  Supported algorithms are "
+             + hasher::block_hash_algorithm_names() + ".";
+    }
+
+    // content-defined chunks must fit the window of the rolling hash and
+    // the bytes read past each job, and straddle the average chunk size
+    if (settings.min_chunk_size != 0 || settings.max_chunk_size != 0) {
+      if (settings.min_chunk_size < 64 ||
+          settings.min_chunk_size >= settings.block_size ||
+          settings.max_chunk_size <= settings.block_size ||
+          settings.max_chunk_size > hasher::max_chunk_size_limit) {
+        std::stringstream ss;
+        ss << "Invalid chunk sizes " << settings.min_chunk_size << ":"
+           << settings.block_size << ":" << settings.max_chunk_size
+           << ".  The minimum must be at least 64 and below the average"
+           << ", which must be below the maximum, which must not exceed "
+           << hasher::max_chunk_size_limit << ".";
+        return ss.str();
+      }
+    }
+
+    // each placed store must be known and its path must be writable to
+    // the settings file as is
+    for (std::map<std::string, std::string>::const_iterator it =
+         settings.store_paths.begin(); it != settings.store_paths.end();
+         ++it) {
+      const char* const* const end = placeable_stores +
+                 sizeof(placeable_stores) / sizeof(placeable_stores[0]);
+      if (std::find(placeable_stores, end, it->first) == end) {
+        return "Invalid store '" + it->first + "' for a store path.";
+      }
+      if (it->second.size() == 0 ||
+          it->second.find_first_of("\"\\") != std::string::npos) {
+        return "Invalid store path '" + it->second + "' for store '" +
+               it->first + "'.";
+      }
+    }
+
     // create the new hashdb directory
     int status;
 #ifdef WIN32
@@ -198,12 +524,46 @@ namespace hashdb {
       return error_message;
     }
 
-    // create new LMDB stores
-    lmdb_hash_data_manager_t(hashdb_dir, RW_NEW);
-    lmdb_hash_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_data_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_id_manager_t(hashdb_dir, RW_NEW);
-    lmdb_source_name_manager_t(hashdb_dir, RW_NEW);
+    // compressed names start with an untrained dictionary
+    if (settings.source_name_format != hashdb::plain_source_name_format) {
+      const source_name_codec_t codec((std::vector<std::string>()),
+                            std::vector<std::string>(), std::string());
+      if (!codec.write(hashdb_dir + "/" +
+                       hashdb::source_name_dictionary_filename)) {
+        return "Unable to write the source name dictionary at path '" +
+               hashdb_dir + "'.";
+      }
+    }
+
+    // create new LMDB stores, each where it is placed
+    const lmdb_helper::env_policy_t policy = store_policy(settings, false);
+    lmdb_hash_data_manager_t(hashdb_dir, RW_NEW, settings.hash_data_format,
+                             settings.hash_shard_bits,
+                             placed_policy(settings, "lmdb_hash_data_store",
+                                           store_policy(settings, true)));
+    lmdb_hash_manager_t(hashdb_dir, RW_NEW, settings.hash_shard_bits,
+                        placed_policy(settings, "lmdb_hash_store", policy));
+    lmdb_source_data_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_source_data_store", policy));
+    lmdb_source_id_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_source_id_store", policy));
+    lmdb_source_name_manager_t(hashdb_dir, RW_NEW,
+                 settings.source_name_format,
+                 placed_policy(settings, "lmdb_source_name_store", policy));
+    lmdb_repository_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_repository_store", policy));
+    if (settings.source_hash_index) {
+      lmdb_source_hash_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_source_hash_store", policy));
+    }
+    if (settings.similarity_index) {
+      lmdb_source_signature_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_source_signature_store", policy));
+    }
+    if (settings.count_index) {
+      lmdb_count_index_manager_t(hashdb_dir, RW_NEW,
+                 placed_policy(settings, "lmdb_count_index_store", policy));
+    }
 
     // create the log
     logger_t(hashdb_dir, command_string);
@@ -211,76 +571,1601 @@ namespace hashdb {
     return "";
   }
 
-  // ************************************************************
-  // source sub_counts
-  // ************************************************************
-  source_sub_count_t::source_sub_count_t(const std::string& p_file_hash,
-                    const uint64_t p_sub_count) :
-          file_hash(p_file_hash),
-          sub_count(p_sub_count) {
+  // the settings of hashdb_dir, which the caller has validated
+  static hashdb::settings_t read_store_settings(
+                                   const std::string& hashdb_dir) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      std::cerr << "Error: " << error_message << "\n";
+      assert(0);
     }
-  bool source_sub_count_t::operator<(const source_sub_count_t& that) const {
-    return (file_hash < that.file_hash);
+    return settings;
   }
 
-  // ************************************************************
-  // settings
-  // ************************************************************
-  settings_t::settings_t() :
-         settings_version(settings_t::CURRENT_SETTINGS_VERSION),
-         block_size(512) {
+  // remove an LMDB store directory, and the placed directory it links
+  // to if it is placed
+  static void remove_store(const std::string& store_dir) {
+    std::remove((store_dir + "/data.mdb").c_str());
+    std::remove((store_dir + "/lock.mdb").c_str());
+#ifndef WIN32
+    char placed_dir[4096];
+    const ssize_t size = readlink(store_dir.c_str(), placed_dir,
+                                  sizeof(placed_dir));
+    if (size > 0 && static_cast<size_t>(size) < sizeof(placed_dir)) {
+      rmdir(std::string(placed_dir, static_cast<size_t>(size)).c_str());
+      std::remove(store_dir.c_str());
+      return;
+    }
+#endif
+    rmdir(store_dir.c_str());
   }
 
-  std::string settings_t::settings_string() const {
-    std::stringstream ss;
-    ss << "{\"settings_version\":" << settings_version
-       << ", \"block_size\":" << block_size
-       << "}";
-    return ss.str();
+  // copy the source name dictionary of a hashdb with compressed names
+  static std::string copy_source_name_dictionary(
+                                   const std::string& hashdb_dir,
+                                   const hashdb::settings_t& settings,
+                                   const std::string& dest_dir) {
+    if (settings.source_name_format == hashdb::plain_source_name_format) {
+      return "";
+    }
+    source_name_codec_t* const codec = source_name_codec_t::read(
+                hashdb_dir + "/" + hashdb::source_name_dictionary_filename);
+    if (codec == NULL) {
+      return "Unable to read the source name dictionary at path '" +
+             hashdb_dir + "'.";
+    }
+    const bool is_written = codec->write(dest_dir + "/" +
+                                 hashdb::source_name_dictionary_filename);
+    delete codec;
+    if (!is_written) {
+      return "Unable to write the source name dictionary at path '" +
+             dest_dir + "'.";
+    }
+    return "";
   }
 
-  // ************************************************************
-  // import
-  // ************************************************************
-  import_manager_t::import_manager_t(const std::string& hashdb_dir,
-                                     const std::string& command_string) :
-          // LMDB managers
-          lmdb_hash_data_manager(0),
-          lmdb_hash_manager(0),
-          lmdb_source_data_manager(0),
-          lmdb_source_id_manager(0),
-          lmdb_source_name_manager(0),
+  std::string migrate_hash_data(const std::string& hashdb_dir,
+                                const uint32_t hash_data_format,
+                                const std::string& command_string) {
 
-          // log
-          logger(new logger_t(hashdb_dir, command_string)),
-          changes(new hashdb::lmdb_changes_t) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (hash_data_format != hashdb::varint_hash_data_format &&
+        hash_data_format != hashdb::fixed_hash_data_format &&
+        hash_data_format != hashdb::dupfixed_hash_data_format) {
+      std::stringstream ss;
+      ss << "Invalid hash data format " << hash_data_format
+         << ".  Supported formats are " << hashdb::varint_hash_data_format
+         << ", " << hashdb::fixed_hash_data_format << ", and "
+         << hashdb::dupfixed_hash_data_format << ".";
+      return ss.str();
+    }
+    if (settings.hash_data_format == hash_data_format) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' already uses this hash data format.";
+    }
+    if (settings.frozen) {
+      return "The hashdb at path '" + hashdb_dir + "' is frozen.";
+    }
 
-    // open managers
-    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
-                                                          RW_MODIFY);
-    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, RW_MODIFY);
-    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
-    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
-    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
-                                                              RW_MODIFY);
+    // the new store is built in a work directory inside the hashdb
+    const std::string work_dir = hashdb_dir + "/_migrate";
+    const uint32_t shard_bits = settings.hash_shard_bits;
+    const size_t num_shards = static_cast<size_t>(1) << shard_bits;
+    for (size_t s=0; s<num_shards; ++s) {
+      remove_store(shard_store_dir(work_dir, "lmdb_hash_data_store",
+                                   shard_bits, s));
+    }
+    rmdir(work_dir.c_str());
+#ifdef WIN32
+    int status = mkdir(work_dir.c_str());
+#else
+    int status = mkdir(work_dir.c_str(),0777);
+#endif
+    if (status != 0) {
+      return "Unable to create work directory '" + work_dir + "'.";
+    }
+
+    // copy every hash in key order
+    {
+      lmdb_hash_data_manager_t from_manager(hashdb_dir, READ_ONLY,
+                                     settings.hash_data_format, shard_bits);
+      lmdb_hash_data_manager_t to_manager(work_dir, RW_NEW, hash_data_format,
+                             shard_bits,
+                             placed_policy(settings, "lmdb_hash_data_store",
+                                           store_policy(settings, true)));
+      lmdb_hash_data_cursor_t cursor(from_manager);
+      hash_append_entries_t entries;
+      hash_append_entry_t entry;
+      while (cursor.next(entry.block_hash, entry.k_entropy, entry.block_label,
+                         entry.count, entry.source_id_sub_counts)) {
+        entries.push_back(entry);
+        if (entries.size() == 10000) {
+          to_manager.append_batch(entries);
+          entries.clear();
+        }
+      }
+      to_manager.append_batch(entries);
+    }
+
+    // swap in the new store shards then remove the old ones
+    for (size_t s=0; s<num_shards; ++s) {
+      const std::string store_dir = shard_store_dir(hashdb_dir,
+                                  "lmdb_hash_data_store", shard_bits, s);
+      const std::string old_store_dir = shard_store_dir(hashdb_dir,
+                                  "_old_lmdb_hash_data_store", shard_bits, s);
+      if (std::rename(store_dir.c_str(), old_store_dir.c_str()) != 0) {
+        return "Unable to move '" + store_dir + "'.";
+      }
+      if (std::rename(shard_store_dir(work_dir, "lmdb_hash_data_store",
+                                      shard_bits, s).c_str(),
+                      store_dir.c_str()) != 0) {
+        std::rename(old_store_dir.c_str(), store_dir.c_str());
+        return "Unable to move the migrated hash data store into place.";
+      }
+    }
+    settings.hash_data_format = hash_data_format;
+    error_message = hashdb::write_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    for (size_t s=0; s<num_shards; ++s) {
+      remove_store(shard_store_dir(hashdb_dir, "_old_lmdb_hash_data_store",
+                                   shard_bits, s));
+
+      // the saved statistics are for the old store
+      std::remove(shard_store_dir(hashdb_dir, "hash_stats",
+                                  shard_bits, s).c_str());
+    }
+    rmdir(work_dir.c_str());
+
+    // log the migration
+    logger_t logger(hashdb_dir, command_string);
+    logger.add_hashdb_settings(settings);
+    return "";
   }
 
-  import_manager_t::~import_manager_t() {
+  std::string freeze_hashdb(const std::string& hashdb_dir,
+                            const std::string& frozen_dir,
+                            const std::string& command_string) {
 
-    // show changes
-    logger->add_lmdb_changes(*changes);
-    std::cout << *changes;
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.frozen) {
+      return "The hashdb at path '" + hashdb_dir + "' is already frozen.";
+    }
 
-    // close resources
-    delete lmdb_hash_data_manager;
-    delete lmdb_hash_manager;
-    delete lmdb_source_data_manager;
-    delete lmdb_source_id_manager;
-    delete lmdb_source_name_manager;
-    delete logger;
-    delete changes;
+    // the frozen hashdb has one unsharded hash store file and is not
+    // written to
+    hashdb::settings_t frozen_settings(settings);
+    frozen_settings.hash_shard_bits = 0;
+    frozen_settings.initial_map_size = 0;
+    frozen_settings.change_log = false;
+    frozen_settings.count_index = false;
+    frozen_settings.frozen = true;
+    frozen_settings.hash_store_rebuild = false;
+    error_message = create_hashdb(frozen_dir, frozen_settings,
+                                  command_string);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // copy the source stores compactly so that source IDs are kept
+    const char* const source_stores[] = {"lmdb_source_data_store",
+                                         "lmdb_source_id_store",
+                                         "lmdb_source_name_store",
+                                         "lmdb_repository_store",
+                                         "lmdb_source_hash_store",
+                                         "lmdb_source_signature_store"};
+    for (size_t i=0; i<sizeof(source_stores)/sizeof(source_stores[0]);
+         ++i) {
+      const std::string from_dir = hashdb_dir + "/" + source_stores[i];
+      const std::string to_dir = frozen_dir + "/" + source_stores[i];
+      if (access((from_dir + "/data.mdb").c_str(), F_OK) != 0) {
+        // the store is not kept by this hashdb
+        continue;
+      }
+      remove_store(to_dir);
+#ifdef WIN32
+      int status = mkdir(to_dir.c_str());
+#else
+      int status = mkdir(to_dir.c_str(),0777);
+#endif
+      if (status != 0) {
+        return "Unable to create store directory '" + to_dir + "'.";
+      }
+      MDB_env* env = lmdb_helper::open_env(from_dir, READ_ONLY);
+      const int rc = mdb_env_copy2(env, to_dir.c_str(), MDB_CP_COMPACT);
+      lmdb_helper::close_env(env);
+      if (rc != 0) {
+        return "Unable to copy store '" + from_dir + "': " +
+               mdb_strerror(rc) + ".";
+      }
+    }
+    error_message = copy_source_name_dictionary(hashdb_dir, settings,
+                                                frozen_dir);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // write every hash in key order to the frozen hash store
+    {
+      lmdb_hash_data_manager_t manager(hashdb_dir, READ_ONLY,
+                   settings.hash_data_format, settings.hash_shard_bits);
+      lmdb_hash_data_cursor_t cursor(manager);
+      frozen_hash_store_writer_t writer(frozen_dir);
+      std::string block_hash;
+      uint64_t k_entropy;
+      std::string block_label;
+      uint64_t count;
+      source_id_sub_counts_t source_id_sub_counts;
+      while (cursor.next(block_hash, k_entropy, block_label, count,
+                         source_id_sub_counts)) {
+        if (!writer.add(block_hash, k_entropy, block_label, count,
+                        source_id_sub_counts)) {
+          break;
+        }
+      }
+      error_message = writer.close();
+    }
+    return error_message;
+  }
+
+  std::string export_filter(const std::string& hashdb_dir,
+                            const std::string& filter_file) {
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    if (settings.hash_store_rebuild) {
+      return "The hash store of the hashdb at path '" + hashdb_dir +
+             "' must be rebuilt first, see rebuild_hash_store.";
+    }
+
+    // a filter records a block size but not chunk sizes
+    if (settings.max_chunk_size != 0) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' hashes content-defined chunks, which filters do not support.";
+    }
+
+    // add the prefix of every hash in the hash store
+    lmdb_hash_manager_t manager(hashdb_dir, READ_ONLY,
+                                settings.hash_shard_bits,
+                                store_policy(settings, false));
+    portable_filter_t filter(manager.size(), settings.block_size,
+                             settings.block_hash_algorithm,
+                             num_prefix_bytes);
+    manager.add_to_filter(filter);
+    return filter.write(filter_file);
+  }
+
+  // the sketch of a hashdb, from its sketch file or else from reading
+  // its hashes, which are then saved as its sketch file
+  static std::string read_sketch(const std::string& hashdb_dir,
+                                 hll_sketch_t& sketch) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (sketch.read(sketch_filename(hashdb_dir)).size() == 0) {
+      return "";
+    }
+    {
+      hashdb::scan_manager_t manager(hashdb_dir);
+      hashdb::hash_iterator_t it(manager);
+      std::string block_hash;
+      uint64_t k_entropy;
+      std::string block_label;
+      uint64_t count;
+      hashdb::source_sub_counts_t source_sub_counts;
+      while (it.next(block_hash, k_entropy, block_label, count,
+                     source_sub_counts)) {
+        sketch.add(block_hash);
+      }
+    }
+    error_message = sketch.write(sketch_filename(hashdb_dir));
+    if (error_message.size() != 0) {
+      std::cerr << "Warning: " << error_message << "\n";
+    }
+    return "";
+  }
+
+  std::string estimate_hashes(const std::string& hashdb_dir1,
+                              const std::string& hashdb_dir2,
+                              uint64_t& count1,
+                              uint64_t& count2,
+                              uint64_t& union_count,
+                              uint64_t& intersection_count) {
+    count1 = 0;
+    count2 = 0;
+    union_count = 0;
+    intersection_count = 0;
+
+    hll_sketch_t sketch1;
+    std::string error_message = read_sketch(hashdb_dir1, sketch1);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    count1 = sketch1.estimate();
+    union_count = count1;
+    if (hashdb_dir2 == "") {
+      return "";
+    }
+
+    hll_sketch_t sketch2;
+    error_message = read_sketch(hashdb_dir2, sketch2);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    count2 = sketch2.estimate();
+    sketch1.merge(sketch2);
+    union_count = sketch1.estimate();
+
+    // the intersection is what the union does not add to both counts
+    intersection_count = (count1 + count2 > union_count) ?
+                                count1 + count2 - union_count : 0;
+    if (intersection_count > count1 || intersection_count > count2) {
+      intersection_count = (count1 < count2) ? count1 : count2;
+    }
+    return "";
+  }
+
+  // the LMDB stores of a hashdb with these settings
+  static void hashdb_stores(const std::string& hashdb_dir,
+                            const hashdb::settings_t& settings,
+                            std::vector<std::string>& stores) {
+    const char* const source_stores[] = {"lmdb_source_data_store",
+                                         "lmdb_source_id_store",
+                                         "lmdb_source_name_store",
+                                         "lmdb_repository_store",
+                                         "lmdb_source_hash_store",
+                                         "lmdb_source_signature_store",
+                                         "lmdb_count_index_store"};
+    stores.clear();
+    for (size_t i=0; i<sizeof(source_stores)/sizeof(source_stores[0]);
+         ++i) {
+      stores.push_back(hashdb_dir + "/" + source_stores[i]);
+    }
+    const size_t num_shards = static_cast<size_t>(1) <<
+                              settings.hash_shard_bits;
+    for (size_t s=0; s<num_shards; ++s) {
+      stores.push_back(shard_store_dir(hashdb_dir, "lmdb_hash_data_store",
+                                       settings.hash_shard_bits, s));
+      stores.push_back(shard_store_dir(hashdb_dir, "lmdb_hash_store",
+                                       settings.hash_shard_bits, s));
+    }
+  }
+
+  bool can_clone_hashdb(const std::string& hashdb_dir,
+                        const std::string& dest_dir) {
+
+    hashdb::settings_t settings;
+    hashdb::settings_t dest_settings;
+    if (hashdb::read_settings(hashdb_dir, settings).size() != 0 ||
+        hashdb::read_settings(dest_dir, dest_settings).size() != 0) {
+      return false;
+    }
+
+    // the stores must be laid out alike and current, and the
+    // destination must not owe a change log to replicas
+    if (settings.frozen || dest_settings.frozen ||
+        settings.hash_store_rebuild || dest_settings.change_log ||
+        settings.block_size != dest_settings.block_size ||
+        settings.block_hash_algorithm !=
+                                  dest_settings.block_hash_algorithm ||
+        settings.min_chunk_size != dest_settings.min_chunk_size ||
+        settings.max_chunk_size != dest_settings.max_chunk_size ||
+        settings.hash_data_format != dest_settings.hash_data_format ||
+        settings.source_name_format != dest_settings.source_name_format ||
+        settings.hash_shard_bits != dest_settings.hash_shard_bits ||
+        settings.source_hash_index != dest_settings.source_hash_index ||
+        settings.similarity_index != dest_settings.similarity_index ||
+        settings.count_index != dest_settings.count_index) {
+      return false;
+    }
+
+    // every destination store must be empty
+    std::vector<std::string> stores;
+    hashdb_stores(dest_dir, dest_settings, stores);
+    for (size_t i=0; i<stores.size(); ++i) {
+      if (access((stores[i] + "/data.mdb").c_str(), F_OK) != 0) {
+        continue;
+      }
+      // the hash data store of the dupfixed format keeps its records in
+      // named databases
+      const bool is_split = dest_settings.hash_data_format ==
+                                  hashdb::dupfixed_hash_data_format &&
+               stores[i].find("lmdb_hash_data_store") != std::string::npos;
+      lmdb_helper::env_policy_t policy;
+      if (is_split) {
+        policy.max_dbs = lmdb_helper::split_max_dbs;
+      }
+      MDB_env* env = lmdb_helper::open_env(stores[i], READ_ONLY, policy);
+      const size_t size = lmdb_helper::size(env,
+                     lmdb_helper::open_dbis(env, READ_ONLY, true, is_split));
+      lmdb_helper::close_env(env);
+      if (size != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::string clone_hashdb(const std::string& hashdb_dir,
+                           const std::string& dest_dir,
+                           const std::string& command_string) {
+
+    if (!can_clone_hashdb(hashdb_dir, dest_dir)) {
+      return "The hashdb at path '" + dest_dir +
+             "' is not an empty hashdb with matching settings.";
+    }
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(dest_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // the saved hash statistics, filters, indexes, and pinned blocks are
+    // for the empty stores, and are made again for the copies
+    const size_t num_shards = static_cast<size_t>(1) <<
+                              settings.hash_shard_bits;
+    for (size_t s=0; s<num_shards; ++s) {
+      std::remove(shard_store_dir(dest_dir, "hash_stats",
+                                  settings.hash_shard_bits, s).c_str());
+      std::remove(shard_store_dir(dest_dir, "hash_filter",
+                                  settings.hash_shard_bits, s).c_str());
+      std::remove(shard_store_dir(dest_dir, "hash_prefix_index",
+                                  settings.hash_shard_bits, s).c_str());
+    }
+    std::remove((dest_dir + "/common_blocks").c_str());
+
+    // copy each store compactly in place of the empty one
+    std::vector<std::string> from_stores;
+    std::vector<std::string> to_stores;
+    hashdb_stores(hashdb_dir, settings, from_stores);
+    hashdb_stores(dest_dir, settings, to_stores);
+    for (size_t i=0; i<from_stores.size(); ++i) {
+      const std::string& from_dir = from_stores[i];
+      const std::string& to_dir = to_stores[i];
+      if (access((from_dir + "/data.mdb").c_str(), F_OK) != 0) {
+        // the store is not kept by this hashdb
+        continue;
+      }
+
+      // keep the store directory, which may be placed
+      std::remove((to_dir + "/data.mdb").c_str());
+      std::remove((to_dir + "/lock.mdb").c_str());
+      if (access(to_dir.c_str(), F_OK) != 0) {
+#ifdef WIN32
+        int status = mkdir(to_dir.c_str());
+#else
+        int status = mkdir(to_dir.c_str(),0777);
+#endif
+        if (status != 0) {
+          return "Unable to create store directory '" + to_dir + "'.";
+        }
+      }
+      MDB_env* env = lmdb_helper::open_env(from_dir, READ_ONLY);
+      const int rc = mdb_env_copy2(env, to_dir.c_str(), MDB_CP_COMPACT);
+      lmdb_helper::close_env(env);
+      if (rc != 0) {
+        return "Unable to copy store '" + from_dir + "': " +
+               mdb_strerror(rc) + ".";
+      }
+    }
+
+    // the names are coded with the dictionary of the source
+    error_message = copy_source_name_dictionary(hashdb_dir, settings,
+                                                dest_dir);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+
+    // the copy has the hashes of the source, so it takes its sketch
+    hll_sketch_t sketch;
+    if (sketch.read(sketch_filename(hashdb_dir)).size() == 0) {
+      error_message = sketch.write(sketch_filename(dest_dir));
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+    } else {
+      std::remove(sketch_filename(dest_dir).c_str());
+    }
+
+    // log the clone
+    logger_t logger(dest_dir, command_string);
+    logger.add_log("# cloned from " + hashdb_dir + "\n");
+    return "";
+  }
+
+  // the size of a file, or 0 if it cannot be read
+  static uint64_t file_bytes(const std::string& filename) {
+    struct stat s;
+    return (stat(filename.c_str(), &s) == 0) ?
+                                  static_cast<uint64_t>(s.st_size) : 0;
+  }
+
+  // the pages in use by a store, up through its last page
+  static uint64_t store_pages(MDB_env* env) {
+    MDB_envinfo env_info;
+    const int rc = mdb_env_info(env, &env_info);
+    if (rc != 0) {
+      std::cerr << "LMDB env info error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return static_cast<uint64_t>(env_info.me_last_pgno) + 1;
+  }
+
+  // the bytes of the pages in use by a store
+  static uint64_t store_bytes(const std::string& store_dir) {
+    MDB_env* env = lmdb_helper::open_env(store_dir, READ_ONLY);
+    MDB_stat stat;
+    mdb_env_stat(env, &stat);
+    const uint64_t bytes = store_pages(env) * stat.ms_psize;
+    lmdb_helper::close_env(env);
+    return bytes;
+  }
+
+  // count each name walked toward a source name dictionary
+  static void train_source_name(void* const data,
+                                const uint64_t /*source_id*/,
+                                const std::string& repository_name,
+                                const std::string& filename) {
+    static_cast<source_name_trainer_t*>(data)->add(repository_name,
+                                                   filename);
+  }
+
+  // copies each name walked into a source name store in batches
+  class source_name_copier_t {
+    private:
+    lmdb_source_name_manager_t* const manager;
+    source_name_entries_t entries;
+    lmdb_changes_t changes;
+
+    // do not allow copy or assignment
+    source_name_copier_t(const source_name_copier_t&);
+    source_name_copier_t& operator=(const source_name_copier_t&);
+
+    public:
+    source_name_copier_t(lmdb_source_name_manager_t* const p_manager) :
+            manager(p_manager), entries(), changes() {
+    }
+
+    void add(const uint64_t source_id, const std::string& repository_name,
+             const std::string& filename) {
+      entries.push_back(source_name_entry_t());
+      entries.back().source_id = source_id;
+      entries.back().repository_name = repository_name;
+      entries.back().filename = filename;
+      if (entries.size() == 10000) {
+        flush();
+      }
+    }
+
+    void flush() {
+      manager->insert_batch(entries, changes);
+      entries.clear();
+    }
+  };
+
+  static void copy_source_name(void* const data, const uint64_t source_id,
+                               const std::string& repository_name,
+                               const std::string& filename) {
+    static_cast<source_name_copier_t*>(data)->add(source_id,
+                                              repository_name, filename);
+  }
+
+  std::string compress_source_names(const std::string& hashdb_dir,
+                                    const std::string& command_string,
+                                    uint64_t& bytes_before,
+                                    uint64_t& bytes_after) {
+    bytes_before = 0;
+    bytes_after = 0;
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.source_name_format ==
+                                hashdb::compressed_source_name_format) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' already compresses its source names.";
+    }
+    if (settings.frozen) {
+      return "The hashdb at path '" + hashdb_dir + "' is frozen.";
+    }
+
+    // the new store and its dictionary are built in a work directory
+    // inside the hashdb
+    const std::string work_dir = hashdb_dir + "/_compress";
+    const std::string store_dir = hashdb_dir + "/lmdb_source_name_store";
+    const std::string work_store_dir = work_dir + "/lmdb_source_name_store";
+    const std::string dictionary_filename = std::string("/") +
+                            hashdb::source_name_dictionary_filename;
+    remove_store(work_store_dir);
+    std::remove((work_dir + dictionary_filename).c_str());
+    rmdir(work_dir.c_str());
+#ifdef WIN32
+    int status = mkdir(work_dir.c_str());
+#else
+    int status = mkdir(work_dir.c_str(),0777);
+#endif
+    if (status != 0) {
+      return "Unable to create work directory '" + work_dir + "'.";
+    }
+
+    // train the dictionary from every name then copy every name
+    {
+      lmdb_source_name_manager_t from_manager(hashdb_dir, READ_ONLY);
+      source_name_trainer_t trainer;
+      from_manager.walk(train_source_name, &trainer);
+      source_name_codec_t* const codec = trainer.train();
+      const bool is_written = codec->write(work_dir + dictionary_filename);
+      delete codec;
+      if (!is_written) {
+        return "Unable to write the source name dictionary at path '" +
+               work_dir + "'.";
+      }
+      lmdb_source_name_manager_t to_manager(work_dir, RW_NEW,
+                     hashdb::compressed_source_name_format,
+                     placed_policy(settings, "lmdb_source_name_store",
+                                   store_policy(settings, false)));
+      source_name_copier_t copier(&to_manager);
+      from_manager.walk(copy_source_name, &copier);
+      copier.flush();
+      to_manager.flush(true);
+    }
+    bytes_before = store_bytes(store_dir);
+    bytes_after = store_bytes(work_store_dir);
+
+    // swap in the new store and its dictionary then remove the old store
+    const std::string old_store_dir = hashdb_dir +
+                                      "/_old_lmdb_source_name_store";
+    if (std::rename(store_dir.c_str(), old_store_dir.c_str()) != 0) {
+      return "Unable to move '" + store_dir + "'.";
+    }
+    if (std::rename(work_store_dir.c_str(), store_dir.c_str()) != 0 ||
+        std::rename((work_dir + dictionary_filename).c_str(),
+                    (hashdb_dir + dictionary_filename).c_str()) != 0) {
+      std::rename(store_dir.c_str(), work_store_dir.c_str());
+      std::rename(old_store_dir.c_str(), store_dir.c_str());
+      return "Unable to move the compressed source name store into place.";
+    }
+    settings.source_name_format = hashdb::compressed_source_name_format;
+    error_message = hashdb::write_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    remove_store(old_store_dir);
+    rmdir(work_dir.c_str());
+
+    // log the compression
+    std::stringstream ss;
+    ss << "# source names compressed from " << bytes_before
+       << " bytes to " << bytes_after << " bytes\n";
+    logger_t logger(hashdb_dir, command_string);
+    logger.add_log(ss.str());
+    logger.add_hashdb_settings(settings);
+    return "";
+  }
+
+  std::string optimize_hashdb(const std::string& hashdb_dir,
+                              const std::string& command_string,
+                              uint64_t& bytes_before, uint64_t& bytes_after,
+                              uint64_t& pages_before,
+                              uint64_t& pages_after) {
+    bytes_before = 0;
+    bytes_after = 0;
+    pages_before = 0;
+    pages_after = 0;
+
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.frozen) {
+      return "The hashdb at path '" + hashdb_dir + "' is frozen.";
+    }
+
+    // copy each store in key order onto tightly packed pages, leaving
+    // out its free pages.  The copy is only as large as its pages, and
+    // is made beside the store so that a placed store stays placed.
+    std::vector<std::string> stores;
+    hashdb_stores(hashdb_dir, settings, stores);
+    std::vector<bool> is_kept(stores.size(), false);
+    for (size_t i=0; i<stores.size(); ++i) {
+      if (access((stores[i] + "/data.mdb").c_str(), F_OK) != 0) {
+        // the store is not kept by this hashdb
+        continue;
+      }
+      is_kept[i] = true;
+      const std::string copy_filename = stores[i] + "/_optimized.mdb";
+      bytes_before += file_bytes(stores[i] + "/data.mdb");
+      MDB_env* env = lmdb_helper::open_env(stores[i], READ_ONLY);
+      pages_before += store_pages(env);
+      MDB_stat stat;
+      mdb_env_stat(env, &stat);
+      const int fd = open(copy_filename.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC, 0664);
+      int rc = (fd < 0) ? errno : mdb_env_copyfd2(env, fd, MDB_CP_COMPACT);
+      if (fd >= 0 && (fsync(fd) != 0 || close(fd) != 0) && rc == 0) {
+        rc = errno;
+      }
+      lmdb_helper::close_env(env);
+      if (rc != 0) {
+        std::remove(copy_filename.c_str());
+        return "Unable to copy store '" + stores[i] + "': " +
+               mdb_strerror(rc) + ".";
+      }
+      const uint64_t copy_bytes = file_bytes(copy_filename);
+      bytes_after += copy_bytes;
+      pages_after += copy_bytes / stat.ms_psize;
+    }
+
+    // swap in each copy by renaming it over the old data file
+    for (size_t i=0; i<stores.size(); ++i) {
+      if (!is_kept[i]) {
+        continue;
+      }
+      if (std::rename((stores[i] + "/_optimized.mdb").c_str(),
+                      (stores[i] + "/data.mdb").c_str()) != 0) {
+        return "Unable to move the optimized store into '" + stores[i] +
+               "'.";
+      }
+    }
+
+    // the saved hash statistics, filters, indexes, and pinned blocks are
+    // stamped with transaction IDs of the old stores, and are made again
+    const size_t num_shards = static_cast<size_t>(1) <<
+                              settings.hash_shard_bits;
+    for (size_t s=0; s<num_shards; ++s) {
+      std::remove(shard_store_dir(hashdb_dir, "hash_stats",
+                                  settings.hash_shard_bits, s).c_str());
+      std::remove(shard_store_dir(hashdb_dir, "hash_filter",
+                                  settings.hash_shard_bits, s).c_str());
+      std::remove(shard_store_dir(hashdb_dir, "hash_prefix_index",
+                                  settings.hash_shard_bits, s).c_str());
+    }
+    std::remove((hashdb_dir + "/common_blocks").c_str());
+
+    // save the prefix indexes now, since scans only map saved ones
+    if (!settings.hash_store_rebuild) {
+      lmdb_hash_manager_t hash_manager(hashdb_dir, RW_MODIFY,
+                  settings.hash_shard_bits, store_policy(settings, false));
+      error_message = hash_manager.save_prefix_indexes();
+      if (error_message.size() != 0) {
+        return error_message;
+      }
+    }
+
+    // log the optimization
+    std::stringstream ss;
+    ss << "# optimized from " << bytes_before << " bytes and "
+       << pages_before << " pages to " << bytes_after << " bytes and "
+       << pages_after << " pages\n";
+    logger_t logger(hashdb_dir, command_string);
+    logger.add_log(ss.str());
+    return "";
+  }
+
+  // order pinned hash candidates by descending count
+  static bool more_common(const std::pair<size_t, std::string>& a,
+                          const std::pair<size_t, std::string>& b) {
+    return (a.first != b.first) ? a.first > b.first : a.second < b.second;
+  }
+
+  std::string pin_common_blocks(const std::string& hashdb_dir,
+                                const size_t min_count,
+                                const size_t max_hashes,
+                                uint64_t& num_pinned) {
+    num_pinned = 0;
+    if (min_count == 0) {
+      return "The minimum count of common blocks must be at least 1.";
+    }
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() != 0) {
+      return error_message;
+    }
+    if (settings.hash_store_rebuild) {
+      return "The hash store of the hashdb at path '" + hashdb_dir +
+             "' must be rebuilt first, see rebuild_hash_store.";
+    }
+    lmdb_hash_manager_t hash_manager(hashdb_dir, READ_ONLY,
+                                     settings.hash_shard_bits);
+    lmdb_hash_data_manager_t hash_data_manager(hashdb_dir, READ_ONLY,
+                   settings.hash_data_format, settings.hash_shard_bits);
+
+    // the hashes under common prefixes, kept if their own counts are
+    // common too
+    std::vector<std::string> keys;
+    hash_manager.find_common(min_count, keys);
+    std::vector<std::pair<size_t, std::string> > candidates;
+    std::vector<std::string> block_hashes;
+    for (size_t i=0; i<keys.size(); ++i) {
+      hash_data_manager.find_prefix_hashes(keys[i], block_hashes);
+      for (size_t j=0; j<block_hashes.size(); ++j) {
+        const size_t count = hash_data_manager.find_count(block_hashes[j]);
+        if (count >= min_count) {
+          candidates.push_back(std::pair<size_t, std::string>(
+                                                 count, block_hashes[j]));
+        }
+      }
+    }
+
+    // keep the most common
+    std::sort(candidates.begin(), candidates.end(), more_common);
+    if (max_hashes != 0 && candidates.size() > max_hashes) {
+      candidates.resize(max_hashes);
+    }
+    common_blocks_t common_blocks(hash_manager.generation(), min_count);
+    for (size_t i=0; i<candidates.size(); ++i) {
+      common_blocks.block_hashes.push_back(candidates[i].second);
+    }
+    std::sort(common_blocks.block_hashes.begin(),
+              common_blocks.block_hashes.end());
+    if (!common_blocks.write(common_blocks_t::filename(hashdb_dir))) {
+      return "Unable to write the common blocks of '" + hashdb_dir + "'.";
+    }
+    num_pinned = common_blocks.block_hashes.size();
+    return "";
+  }
+
+  size_t num_cpus() {
+    return numCPU();
+  }
+
+  // ************************************************************
+  // source sub_counts
+  // ************************************************************
+  source_sub_count_t::source_sub_count_t(const std::string& p_file_hash,
+                    const uint64_t p_sub_count) :
+          file_hash(p_file_hash),
+          sub_count(p_sub_count) {
+    }
+  bool source_sub_count_t::operator<(const source_sub_count_t& that) const {
+    return (file_hash < that.file_hash);
+  }
+
+  // ************************************************************
+  // settings
+  // ************************************************************
+  settings_t::settings_t() :
+         settings_version(settings_t::CURRENT_SETTINGS_VERSION),
+         block_size(512),
+         block_hash_algorithm("md5"),
+         min_chunk_size(0),
+         max_chunk_size(0),
+         hash_filter_generation(0),
+         hash_data_format(hashdb::varint_hash_data_format),
+         source_name_format(hashdb::plain_source_name_format),
+         hash_shard_bits(0),
+         initial_map_size(0),
+         max_map_size(0),
+         sync_policy("periodic"),
+         sync_seconds(30),
+         sync_mb(1024),
+         max_readers(0),
+         source_hash_index(false),
+         similarity_index(false),
+         count_index(false),
+         change_log(false),
+         frozen(false),
+         hash_store_rebuild(false),
+         store_paths() {
+  }
+
+  std::string settings_t::settings_string() const {
+    std::stringstream ss;
+    ss << "{\"settings_version\":" << settings_version
+       << ", \"block_size\":" << block_size
+       << ", \"block_hash_algorithm\":\"" << block_hash_algorithm << "\"";
+    if (max_chunk_size != 0) {
+      ss << ", \"min_chunk_size\":" << min_chunk_size
+         << ", \"max_chunk_size\":" << max_chunk_size;
+    }
+    if (hash_filter_generation != 0) {
+      ss << ", \"hash_filter_generation\":" << hash_filter_generation;
+    }
+    if (hash_data_format != hashdb::varint_hash_data_format) {
+      ss << ", \"hash_data_format\":" << hash_data_format;
+    }
+    if (source_name_format != hashdb::plain_source_name_format) {
+      ss << ", \"source_name_format\":" << source_name_format;
+    }
+    if (hash_shard_bits != 0) {
+      ss << ", \"hash_shard_bits\":" << hash_shard_bits;
+    }
+    if (initial_map_size != 0) {
+      ss << ", \"initial_map_size\":" << initial_map_size;
+    }
+    if (max_map_size != 0) {
+      ss << ", \"max_map_size\":" << max_map_size;
+    }
+    if (sync_policy != "periodic") {
+      ss << ", \"sync_policy\":\"" << sync_policy << "\"";
+    }
+    if (sync_seconds != 30) {
+      ss << ", \"sync_seconds\":" << sync_seconds;
+    }
+    if (sync_mb != 1024) {
+      ss << ", \"sync_mb\":" << sync_mb;
+    }
+    if (max_readers != 0) {
+      ss << ", \"max_readers\":" << max_readers;
+    }
+    if (source_hash_index) {
+      ss << ", \"source_hash_index\":true";
+    }
+    if (similarity_index) {
+      ss << ", \"similarity_index\":true";
+    }
+    if (count_index) {
+      ss << ", \"count_index\":true";
+    }
+    if (change_log) {
+      ss << ", \"change_log\":true";
+    }
+    if (frozen) {
+      ss << ", \"frozen\":true";
+    }
+    if (hash_store_rebuild) {
+      ss << ", \"hash_store_rebuild\":true";
+    }
+    if (store_paths.size() != 0) {
+      ss << ", \"store_paths\":{";
+      for (std::map<std::string, std::string>::const_iterator it =
+           store_paths.begin(); it != store_paths.end(); ++it) {
+        if (it != store_paths.begin()) {
+          ss << ",";
+        }
+        ss << "\"" << it->first << "\":\"" << it->second << "\"";
+      }
+      ss << "}";
+    }
+    ss << "}";
+    return ss.str();
+  }
+
+  // ************************************************************
+  // ingest options
+  // ************************************************************
+  ingest_options_t::ingest_options_t() :
+         skip_nonprobative(false),
+         skip_unchanged(false),
+         direct_reads(false),
+         quiet(false),
+         checkpoint_file(""),
+         resume(false) {
+  }
+
+  // ************************************************************
+  // scan_media options
+  // ************************************************************
+  scan_media_options_t::scan_media_options_t() :
+         min_k_entropy(0),
+         skip_labeled(false),
+         summarize(false),
+         direct_reads(false),
+         quiet(false),
+         checkpoint_file(""),
+         resume(false) {
+  }
+
+  // ************************************************************
+  // JSON record parser
+  // ************************************************************
+  json_record_t::json_record_t() :
+          is_block_hash(false), block_hash(), k_entropy(0), block_label(),
+          source_sub_counts(), file_hash(), filesize(0), file_type(),
+          zero_count(0), nonprobative_count(0), names() {
+  }
+
+  // rapidjson memory pools over fixed buffers, which are reused for
+  // each record and overflow into allocated chunks for large records
+  static const size_t JSON_VALUE_ARENA_SIZE = 65536;
+  static const size_t JSON_STACK_ARENA_SIZE = 16384;
+  typedef rapidjson::MemoryPoolAllocator<> json_pool_allocator_t;
+  typedef rapidjson::GenericDocument<rapidjson::UTF8<>,
+                                     json_pool_allocator_t,
+                                     json_pool_allocator_t> json_document_t;
+
+  class json_record_arena_t {
+    private:
+    char value_buffer[JSON_VALUE_ARENA_SIZE];
+    char stack_buffer[JSON_STACK_ARENA_SIZE];
+
+    // do not allow copy or assignment
+    json_record_arena_t(const json_record_arena_t&);
+    json_record_arena_t& operator=(const json_record_arena_t&);
+
+    public:
+    json_pool_allocator_t value_allocator;
+    json_pool_allocator_t stack_allocator;
+    json_record_arena_t() :
+          value_buffer(), stack_buffer(),
+          value_allocator(value_buffer, sizeof(value_buffer)),
+          stack_allocator(stack_buffer, sizeof(stack_buffer)) {
+    }
+
+    // release chunks allocated past the buffers and reuse the buffers
+    void clear() {
+      value_allocator.Clear();
+      stack_allocator.Clear();
+    }
+  };
+
+  json_record_parser_t::json_record_parser_t() :
+          arena(new json_record_arena_t), buffer() {
+  }
+
+  json_record_parser_t::~json_record_parser_t() {
+    delete arena;
+  }
+
+  std::string json_record_parser_t::parse(const char* const json_text,
+                                          const size_t size,
+                                          json_record_t& record) {
+
+    // parse a copy of the text in place into the arena
+    buffer.assign(json_text, json_text + size);
+    buffer.push_back('\0');
+    arena->clear();
+    json_document_t document(&arena->value_allocator,
+                             JSON_STACK_ARENA_SIZE / 2,
+                             &arena->stack_allocator);
+    if (document.ParseInsitu(&buffer[0]).HasParseError() ||
+        !document.IsObject()) {
+      return "Invalid JSON syntax";
+    }
+
+    // block_hash or file_hash
+    if (document.HasMember("block_hash")) {
+      record.is_block_hash = true;
+
+      // block_hash
+      if (!document["block_hash"].IsString()) {
+        return "Invalid block_hash field";
+      }
+      record.block_hash = hashdb::hex_to_bin(
+                                         document["block_hash"].GetString());
+
+      // entropy (optional)
+      record.k_entropy = 0;
+      if (document.HasMember("k_entropy")) {
+        if (document["k_entropy"].IsUint64()) {
+          record.k_entropy = document["k_entropy"].GetUint64();
+        } else {
+          return "Invalid k_entropy field";
+        }
+      }
+
+      // block_label (optional)
+      record.block_label.clear();
+      if (document.HasMember("block_label")) {
+        if (document["block_label"].IsString()) {
+          record.block_label = document["block_label"].GetString();
+        } else {
+          return "Invalid block_label field";
+        }
+      }
+
+      // source_sub_counts:[]
+      if (!document.HasMember("source_sub_counts") ||
+                    !document["source_sub_counts"].IsArray()) {
+        return "Invalid source_sub_counts field";
+      }
+      const rapidjson::Value& json_source_sub_counts =
+                                        document["source_sub_counts"];
+      record.source_sub_counts.clear();
+      for (rapidjson::SizeType i = 0;
+           i+1 < json_source_sub_counts.Size(); i+=2) {
+
+        // source hash
+        if (!json_source_sub_counts[i+0].IsString()) {
+          return "Invalid source hash in source_sub_counts";
+        }
+
+        // sub_count
+        if (!json_source_sub_counts[i+1].IsUint64()) {
+          return "Invalid sub_count in source_sub_counts";
+        }
+
+        // hash data for this source and source sub_count
+        record.source_sub_counts.push_back(std::pair<std::string, uint64_t>(
+                       hashdb::hex_to_bin(json_source_sub_counts[i].GetString()),
+                       json_source_sub_counts[i+1].GetUint64()));
+      }
+      return "";
+
+    } else if (document.HasMember("file_hash")) {
+      record.is_block_hash = false;
+
+      // parse file_hash
+      if (!document["file_hash"].IsString()) {
+        return "Invalid file_hash field";
+      }
+      record.file_hash = hashdb::hex_to_bin(
+                                       document["file_hash"].GetString());
+
+      // parse filesize
+      if (!document.HasMember("filesize") ||
+                    !document["filesize"].IsUint64()) {
+        return "Invalid filesize field";
+      }
+      record.filesize = document["filesize"].GetUint64();
+
+      // parse file_type (optional)
+      record.file_type.clear();
+      if (document.HasMember("file_type")) {
+        if (document["file_type"].IsString()) {
+          record.file_type = document["file_type"].GetString();
+        } else {
+          return "Invalid file_type field";
+        }
+      }
+
+      // zero_count (optional)
+      record.zero_count = 0;
+      if (document.HasMember("zero_count")) {
+        if (document["zero_count"].IsUint64()) {
+          record.zero_count = document["zero_count"].GetUint64();
+        } else {
+          return "Invalid zero_count field";
+        }
+      }
+
+      // nonprobative_count (optional)
+      record.nonprobative_count = 0;
+      if (document.HasMember("nonprobative_count")) {
+        if (document["nonprobative_count"].IsUint64()) {
+          record.nonprobative_count =
+                                  document["nonprobative_count"].GetUint64();
+        } else {
+          return "Invalid nonprobative_count field";
+        }
+      }
+
+      // parse name_pairs:[]
+      if (!document.HasMember("name_pairs") ||
+                    !document["name_pairs"].IsArray()) {
+        return "Invalid name_pairs field";
+      }
+      const rapidjson::Value& json_names = document["name_pairs"];
+      record.names.clear();
+      for (rapidjson::SizeType i = 0; i< json_names.Size(); i+=2) {
+
+        // parse repository name
+        if (!json_names[i].IsString()) {
+          return "Invalid repository name in name_pairs field";
+        }
+
+        // parse filename
+        if (i+1 == json_names.Size() || !json_names[i+1].IsString()) {
+          return "Invalid filename in name_pairs field";
+        }
+
+        // add repository name, filename pair
+        record.names.insert(hashdb::source_name_t(json_names[i].GetString(),
+                                                  json_names[i+1].GetString()));
+      }
+      return "";
+
+    } else {
+      return "A block_hash or file_hash field is required";
+    }
+  }
+
+  // ************************************************************
+  // import
+  // ************************************************************
+  hash_insert_t::hash_insert_t(const std::string& p_block_hash,
+                               const uint64_t p_k_entropy,
+                               const std::string& p_block_label) :
+          block_hash(p_block_hash),
+          k_entropy(p_k_entropy),
+          block_label(p_block_label) {
+  }
+
+  // order batch entries by block hash for key-ordered writes
+  static bool block_hash_less(const hash_batch_entry_t& a,
+                              const hash_batch_entry_t& b) {
+    return a.block_hash < b.block_hash;
+  }
+
+  // imports skip hash store writes, see set_defer_hash_store
+  static bool import_defers_hash_store = false;
+
+  void set_defer_hash_store(const bool defer_hash_store) {
+    import_defers_hash_store = defer_hash_store;
+  }
+
+  // set or clear the mark that the hash store needs rebuilding
+  static void mark_hash_store_rebuild(const std::string& hashdb_dir,
+                                      const bool hash_store_rebuild) {
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() == 0 &&
+        settings.hash_store_rebuild != hash_store_rebuild) {
+      settings.hash_store_rebuild = hash_store_rebuild;
+      error_message = hashdb::write_settings(hashdb_dir, settings);
+    }
+    if (error_message.size() != 0) {
+      std::cerr << "Error: unable to mark the hash store rebuild: "
+                << error_message << "\n";
+      exit(1);
+    }
+  }
+
+  // the number of hashes appended per write transaction of a rebuild
+  static const size_t rebuild_chunk_size = 10000;
+
+  // add a source name to the repository store
+  static void index_repository_name(void* const data,
+                                    const uint64_t source_id,
+                                    const std::string& repository_name,
+                                    const std::string& /*filename*/) {
+    static_cast<lmdb_repository_manager_t*>(data)->insert(
+                                             repository_name, source_id);
+  }
+
+  import_manager_t::import_manager_t(const std::string& p_hashdb_dir,
+                                     const std::string& command_string) :
+          hashdb_dir(p_hashdb_dir),
+
+          // LMDB managers
+          lmdb_hash_data_manager(0),
+          lmdb_hash_manager(0),
+          lmdb_source_data_manager(0),
+          lmdb_source_id_manager(0),
+          lmdb_source_name_manager(0),
+          lmdb_repository_manager(0),
+          lmdb_source_hash_manager(0),
+          lmdb_source_signature_manager(0),
+          lmdb_count_index_manager(0),
+
+          // log
+          logger(new logger_t(hashdb_dir, command_string)),
+          changes(new hashdb::lmdb_changes_t),
+          hash_batch(new hash_batch_t),
+          hash_bulk_loader(new hash_bulk_loader_t(hashdb_dir)),
+          hash_writer(0),
+          stage_start(new stage_totals_t),
+          change_log(0),
+          hll_sketch(new hll_sketch_t) {
+
+    // stage counts are logged as the change since now
+    stage_snapshot(*stage_start);
+
+    // open managers
+    const hashdb::settings_t settings = read_store_settings(hashdb_dir);
+    if (settings.frozen) {
+      std::cerr << "Error: the hashdb at path '" << hashdb_dir
+                << "' is frozen and cannot be changed.\n";
+      exit(1);
+    }
+    const lmdb_helper::env_policy_t policy = store_policy(settings, false);
+    lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
+                  RW_MODIFY, settings.hash_data_format,
+                  settings.hash_shard_bits, store_policy(settings, true));
+    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, RW_MODIFY,
+                  settings.hash_shard_bits, policy);
+    lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
+                                      RW_MODIFY, policy);
+    lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
+                                      RW_MODIFY, policy);
+    lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
+                                      RW_MODIFY, settings.source_name_format,
+                                      policy);
+    lmdb_repository_manager = new lmdb_repository_manager_t(hashdb_dir,
+                                      RW_MODIFY, policy);
+
+    // index the source names of a database made before the repository
+    // store existed
+    if (lmdb_repository_manager->is_new()) {
+      lmdb_source_name_manager->walk(index_repository_name,
+                                     lmdb_repository_manager);
+      lmdb_repository_manager->flush();
+    }
+
+    if (settings.source_hash_index) {
+      lmdb_source_hash_manager = new lmdb_source_hash_manager_t(hashdb_dir,
+                                      RW_MODIFY, policy);
+    }
+    if (settings.similarity_index) {
+      lmdb_source_signature_manager = new lmdb_source_signature_manager_t(
+                                      hashdb_dir, RW_MODIFY, policy);
+    }
+    if (settings.count_index) {
+      lmdb_count_index_manager = new lmdb_count_index_manager_t(hashdb_dir,
+                                      RW_MODIFY, policy);
+      lmdb_hash_data_manager->set_count_index(lmdb_count_index_manager);
+    }
+    hash_writer = new hash_writer_t(*lmdb_hash_data_manager,
+                                    *lmdb_hash_manager, *changes,
+                                    *hash_batch);
+    if (settings.change_log) {
+      change_log = new change_log_t(hashdb_dir);
+    }
+
+    // keep the hash sketch of a hashdb that has one or that is empty.
+    // estimate_hashes makes the sketch of an older hashdb.
+    if (hll_sketch->read(sketch_filename(hashdb_dir)).size() != 0 &&
+        lmdb_hash_data_manager->size() != 0) {
+      delete hll_sketch;
+      hll_sketch = NULL;
+    }
+
+    // mark the hash store stale before skipping its writes
+    if (import_defers_hash_store || settings.hash_store_rebuild) {
+      mark_hash_store_rebuild(hashdb_dir, true);
+      lmdb_hash_manager->set_deferred(true);
+    }
+  }
+
+  import_manager_t::~import_manager_t() {
+
+    // write any batched hashes, bring a deferred hash store up to date,
+    // and stop the writer thread
+    flush();
+    if (lmdb_hash_manager->deferred()) {
+      rebuild_hash_store();
+    }
+    delete hash_writer;
+    save_sketch();
+
+    // save the hash filter and stamp its generation in the settings
+    const uint64_t generation = lmdb_hash_manager->flush_filter();
+    hashdb::settings_t settings;
+    std::string error_message = hashdb::read_settings(hashdb_dir, settings);
+    if (error_message.size() == 0 &&
+        settings.hash_filter_generation != generation) {
+      settings.hash_filter_generation = generation;
+      error_message = hashdb::write_settings(hashdb_dir, settings);
+    }
+    if (error_message.size() != 0) {
+      std::cerr << "Warning: unable to update the hash filter generation: "
+                << error_message << "\n";
+    }
+
+    // show changes
+    logger->add_lmdb_changes(*changes);
+    std::cout << *changes;
+
+    // close resources
+    delete lmdb_hash_data_manager;
+    delete lmdb_hash_manager;
+    delete lmdb_source_data_manager;
+    delete lmdb_source_id_manager;
+    delete lmdb_source_name_manager;
+    delete lmdb_repository_manager;
+    delete lmdb_source_hash_manager;
+    delete lmdb_source_signature_manager;
+    delete lmdb_count_index_manager;
+
+    // log the stage latencies and lookup counts of this import, after
+    // the closed stores have synced
+    logger->add_log("stage_stats: " + stage_stats_json(*stage_start) +
+                    "\n");
+    delete logger;
+    delete changes;
+    delete hash_batch;
+    delete hash_bulk_loader;
+    delete stage_start;
+    delete change_log;
+    delete hll_sketch;
+  }
+
+  void import_manager_t::write_batch() {
+    std::vector<size_t> counts;
+    lmdb_hash_data_manager->insert_batch(hash_batch->entries, counts,
+                                         *changes);
+    lmdb_hash_manager->insert_batch(hash_batch->entries, counts, *changes);
+    hash_batch->entries.clear();
+  }
+
+  void import_manager_t::set_batch(const size_t batch_size,
+                                   const size_t batch_milliseconds) {
+    hash_batch->lock();
+    write_batch();
+    hash_batch->set_limits(batch_size, batch_milliseconds);
+    hash_batch->unlock();
+  }
+
+  void import_manager_t::set_bulk_load(const size_t run_size) {
+    hash_bulk_loader->lock();
+    hash_bulk_loader->load(*lmdb_hash_data_manager, *lmdb_hash_manager,
+                           *changes);
+    hash_bulk_loader->set_run_size(run_size);
+    hash_bulk_loader->unlock();
+  }
+
+  void import_manager_t::set_async_insert(const size_t max_pending) {
+    hash_writer->stop();
+    if (max_pending > 0) {
+      hash_writer->start(max_pending);
+    }
+  }
+
+  void import_manager_t::flush() {
+    flush_stores(false);
+  }
+
+  void import_manager_t::sync() {
+    flush_stores(true);
+  }
+
+  void import_manager_t::flush_stores(const bool force) {
+    hash_writer->drain();
+
+    hash_batch->lock();
+    write_batch();
+    hash_batch->unlock();
+
+    hash_bulk_loader->lock();
+    hash_bulk_loader->load(*lmdb_hash_data_manager, *lmdb_hash_manager,
+                           *changes);
+    hash_bulk_loader->unlock();
+
+    // save the hash data statistics for readers
+    lmdb_hash_data_manager->flush_stats();
+
+    // sync if the sync policy is flush or force is set
+    lmdb_hash_data_manager->flush(force);
+    lmdb_hash_manager->flush(force);
+    lmdb_source_data_manager->flush(force);
+    lmdb_source_id_manager->flush(force);
+    lmdb_source_name_manager->flush(force);
+    lmdb_repository_manager->flush(force);
+    if (lmdb_source_hash_manager != NULL) {
+      lmdb_source_hash_manager->flush(force);
+    }
+    if (lmdb_source_signature_manager != NULL) {
+      lmdb_source_signature_manager->flush(force);
+    }
+    if (lmdb_count_index_manager != NULL) {
+      lmdb_count_index_manager->flush(force);
+    }
+    if (change_log != NULL) {
+      change_log->flush();
+    }
+    if (force) {
+      save_sketch();
+    }
+  }
+
+  void import_manager_t::save_sketch() {
+    if (hll_sketch == NULL) {
+      return;
+    }
+
+    // keep the hashes that other importers saved since this one opened
+    const std::string filename = sketch_filename(hashdb_dir);
+    hll_sketch_t saved;
+    if (saved.read(filename).size() == 0) {
+      hll_sketch->merge(saved);
+    }
+    const std::string error_message = hll_sketch->write(filename);
+    if (error_message.size() != 0) {
+      std::cerr << "Warning: " << error_message << "\n";
+    }
+  }
+
+  void import_manager_t::rebuild_hash_store() {
+    flush();
+    lmdb_hash_manager->set_deferred(false);
+    lmdb_hash_manager->clear();
+
+    // append the prefix of each hash in key order, with the largest
+    // count of the hashes that share it
+    lmdb_hash_data_cursor_t cursor(*lmdb_hash_data_manager);
+    hash_batch_entries_t entries;
+    std::vector<size_t> counts;
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    source_id_sub_counts_t source_id_sub_counts;
+    while (cursor.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts)) {
+      if (entries.size() != 0 && entries.back().block_hash.compare(
+                     0, num_prefix_bytes, block_hash, 0,
+                     num_prefix_bytes) == 0) {
+        if (count > counts.back()) {
+          counts.back() = count;
+        }
+        continue;
+      }
+      if (entries.size() == rebuild_chunk_size) {
+        lmdb_hash_manager->append_batch(entries, counts, *changes);
+        entries.clear();
+        counts.clear();
+      }
+      entries.push_back(hash_batch_entry_t(block_hash, 0, "", 0, 0, false));
+      counts.push_back(count);
+    }
+    lmdb_hash_manager->append_batch(entries, counts, *changes);
+
+    // the mark is cleared once the new store is on disk
+    lmdb_hash_manager->flush(true);
+    mark_hash_store_rebuild(hashdb_dir, false);
+  }
+
+  void import_manager_t::add_hash(const hash_batch_entry_t& entry) {
+
+    // count the hash in the sketch
+    if (hll_sketch != NULL) {
+      hll_sketch->add(entry.block_hash);
+    }
+
+    // index the hash under its source
+    if (lmdb_source_hash_manager != NULL) {
+      lmdb_source_hash_manager->insert(entry.source_id, entry.block_hash);
+    }
+
+    // add the hash to the signature of its source
+    if (lmdb_source_signature_manager != NULL) {
+      lmdb_source_signature_manager->add(entry.source_id, entry.block_hash);
+    }
+
+    // maybe defer the hash for a sorted bulk load
+    hash_bulk_loader->lock();
+    if (hash_bulk_loader->enabled()) {
+      hash_bulk_loader->add(entry);
+      hash_bulk_loader->unlock();
+      return;
+    }
+    hash_bulk_loader->unlock();
+
+    // maybe buffer the hash for a batched write
+    hash_batch->lock();
+    if (hash_batch->enabled()) {
+      if (hash_batch->add(entry)) {
+        write_batch();
+      }
+      hash_batch->unlock();
+      return;
+    }
+    hash_batch->unlock();
+
+    // insert or merge hash into hash data manager
+    size_t count;
+    if (entry.is_merge) {
+      count = lmdb_hash_data_manager->merge(
+                   entry.block_hash, entry.k_entropy, entry.block_label,
+                   entry.source_id, entry.sub_count, *changes);
+    } else {
+      count = lmdb_hash_data_manager->insert(
+                   entry.block_hash, entry.k_entropy, entry.block_label,
+                   entry.source_id, *changes);
+    }
+
+    // insert hash into hash manager
+    lmdb_hash_manager->insert(entry.block_hash, count, *changes);
+  }
+
+  // order source entries by source ID for key-ordered writes
+  static bool source_data_entry_less(const source_data_entry_t& a,
+                                     const source_data_entry_t& b) {
+    return a.source_id < b.source_id;
+  }
+
+  static bool source_name_entry_less(const source_name_entry_t& a,
+                                     const source_name_entry_t& b) {
+    return a.source_id < b.source_id;
   }
 
   void import_manager_t::insert_source_name(
@@ -291,11 +2176,15 @@ namespace hashdb {
       std::cerr << "Error: insert_source_name called with empty file_hash\n";
       return;
     }
+    if (change_log != NULL) {
+      change_log->insert_source_name(file_hash, repository_name, filename);
+    }
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
     lmdb_source_name_manager->insert(source_id, repository_name, filename,
                                      *changes);
+    lmdb_repository_manager->insert(repository_name, source_id);
 
     // If the source ID is new then add a blank source data record just to keep
     // from breaking the reverse look-up done in scan_manager_t.
@@ -315,6 +2204,10 @@ namespace hashdb {
       std::cerr << "Error: insert_source_data called with empty file_hash\n";
       return;
     }
+    if (change_log != NULL) {
+      change_log->insert_source_data(file_hash, filesize, file_type,
+                                     zero_count, nonprobative_count);
+    }
     uint64_t source_id;
     lmdb_source_id_manager->insert(file_hash, *changes, source_id);
     lmdb_source_data_manager->insert(source_id, file_hash,
@@ -335,16 +2228,137 @@ namespace hashdb {
       std::cerr << "Error: insert_hash called with empty file_hash\n";
       return;
     }
+    if (change_log != NULL) {
+      change_log->insert_hash(block_hash, k_entropy, block_label, file_hash);
+    }
 
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
 
     // insert hash into hash data manager and hash manager
-    const size_t count = lmdb_hash_data_manager->insert(
-                 block_hash, k_entropy, block_label,
-                 source_id, *changes);
-    lmdb_hash_manager->insert(block_hash, count, *changes);
+    add_hash(hash_batch_entry_t(block_hash, k_entropy, block_label,
+                                source_id, 0, false));
+
+    // If the source ID is new then add a blank source data record just to keep
+    // from breaking the reverse look-up done in scan_manager_t.
+    if (is_new_id == true) {
+      lmdb_source_data_manager->insert(source_id, file_hash, 0, "", 0, 0,
+                                       *changes);
+    }
+  }
+
+  // add many packed hashes of one source
+  bool import_manager_t::insert_packed_hashes(const std::string& file_hash,
+                                       const char* const packed_hashes,
+                                       const size_t packed_hashes_size,
+                                       const size_t hash_size,
+                                       const uint64_t* const k_entropies,
+                                       const size_t k_entropies_size) {
+    std::vector<std::string> block_hashes;
+    if (!split_packed_hashes(packed_hashes, packed_hashes_size, hash_size,
+                             block_hashes)) {
+      return false;
+    }
+    if (k_entropies_size != block_hashes.size()) {
+      std::cerr << "Error: " << k_entropies_size << " k_entropies for "
+                << block_hashes.size() << " hashes\n";
+      return false;
+    }
+    hash_inserts_t inserts;
+    inserts.reserve(block_hashes.size());
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      inserts.push_back(hash_insert_t(block_hashes[i], k_entropies[i]));
+    }
+    insert_hashes(file_hash, inserts);
+    return true;
+  }
+
+  // add many hashes of one source, used during ingest
+  void import_manager_t::insert_hashes(const std::string& file_hash,
+                                       const hash_inserts_t& hashes) {
+
+    if (file_hash.size() == 0) {
+      std::cerr << "Error: insert_hashes called with empty file_hash\n";
+      return;
+    }
+    if (hashes.size() == 0) {
+      return;
+    }
+    if (change_log != NULL) {
+      change_log->insert_hashes(file_hash, hashes);
+    }
+
+    uint64_t source_id;
+    bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
+                                                    source_id);
+
+    // build the entries in block hash order
+    hash_batch_entries_t entries;
+    entries.reserve(hashes.size());
+    for (hash_inserts_t::const_iterator it = hashes.begin();
+         it != hashes.end(); ++it) {
+      if (it->block_hash.size() == 0) {
+        std::cerr << "Error: insert_hashes called with empty block_hash\n";
+        continue;
+      }
+      entries.push_back(hash_batch_entry_t(it->block_hash, it->k_entropy,
+                                    it->block_label, source_id, 0, false));
+    }
+    std::sort(entries.begin(), entries.end(), block_hash_less);
+
+    // write a block repeated within the file once, with its count
+    collapse_inserts(entries);
+
+    // count the hashes in the sketch
+    if (hll_sketch != NULL) {
+      for (hash_batch_entries_t::const_iterator it = entries.begin();
+           it != entries.end(); ++it) {
+        hll_sketch->add(it->block_hash);
+      }
+    }
+
+    // index the hashes under their source
+    if (lmdb_source_hash_manager != NULL) {
+      for (hash_batch_entries_t::const_iterator it = entries.begin();
+           it != entries.end(); ++it) {
+        lmdb_source_hash_manager->insert(source_id, it->block_hash);
+      }
+    }
+
+    // add the hashes to the signature of their source
+    if (lmdb_source_signature_manager != NULL && entries.size() != 0) {
+      hashdb::source_signature_t signature;
+      for (hash_batch_entries_t::const_iterator it = entries.begin();
+           it != entries.end(); ++it) {
+        signature.add(it->block_hash);
+      }
+      lmdb_source_signature_manager->merge(source_id, signature);
+    }
+
+    // maybe defer the hashes for a sorted bulk load
+    hash_bulk_loader->lock();
+    const bool bulk_load = hash_bulk_loader->enabled();
+    if (bulk_load) {
+      for (hash_batch_entries_t::const_iterator it = entries.begin();
+           it != entries.end(); ++it) {
+        hash_bulk_loader->add(*it);
+      }
+    }
+    hash_bulk_loader->unlock();
+
+    // otherwise queue them for the writer thread or write them now,
+    // serialized with batched writes
+    if (!bulk_load) {
+      hashdb::stage_timer_t timer(hashdb::STAGE_INSERT_WAIT);
+      if (!hash_writer->push(entries)) {
+        std::vector<size_t> counts;
+        hash_batch->lock();
+        lmdb_hash_data_manager->insert_batch(entries, counts, *changes);
+        lmdb_hash_manager->insert_batch(entries, counts, *changes);
+        hash_batch->unlock();
+      }
+    }
 
     // If the source ID is new then add a blank source data record just to keep
     // from breaking the reverse look-up done in scan_manager_t.
@@ -369,18 +2383,18 @@ namespace hashdb {
       std::cerr << "Error: insert_hash called with empty file_hash\n";
       return;
     }
+    if (change_log != NULL) {
+      change_log->merge_hash(block_hash, k_entropy, block_label, file_hash,
+                             sub_count);
+    }
 
     uint64_t source_id;
     bool is_new_id = lmdb_source_id_manager->insert(file_hash, *changes,
                                                     source_id);
 
-    // merge hash into hash data manager
-    const size_t count = lmdb_hash_data_manager->merge(
-                 block_hash, k_entropy, block_label,
-                 source_id, sub_count, *changes);
-
-    // insert hash into hash manager
-    lmdb_hash_manager->insert(block_hash, count, *changes);
+    // merge hash into hash data manager and hash manager
+    add_hash(hash_batch_entry_t(block_hash, k_entropy, block_label,
+                                source_id, sub_count, true));
 
     // If the source ID is new then add a blank source data record just to keep
     // from breaking the reverse look-up done in scan_manager_t.
@@ -394,165 +2408,237 @@ namespace hashdb {
   std::string import_manager_t::import_json(
                           const std::string& json_string) {
 
-    // open input as a JSON DOM document
-    rapidjson::Document document;
-    if (document.Parse(json_string.c_str()).HasParseError() ||
-        !document.IsObject()) {
-      return "Invalid JSON syntax";
+    // parse with the calling thread's parser where available
+#ifdef HAVE_CXX11
+    static thread_local json_record_parser_t parser;
+    static thread_local json_record_t record;
+#else
+    json_record_parser_t parser;
+    json_record_t record;
+#endif
+    const std::string error_message = parser.parse(json_string.c_str(),
+                                                   json_string.size(), record);
+    if (error_message.size() != 0) {
+      return error_message;
     }
+    import_record(record);
+    return "";
+  }
 
-    // block_hash or file_hash
-    if (document.HasMember("block_hash")) {
-
-      // block_hash
-      if (!document["block_hash"].IsString()) {
-        return "Invalid block_hash field";
-      }
-      const std::string block_hash = hashdb::hex_to_bin(
-                                         document["block_hash"].GetString());
+  void import_manager_t::import_record(const json_record_t& record) {
+    if (record.is_block_hash) {
 
-      // entropy (optional)
-      uint64_t k_entropy = 0;
-      if (document.HasMember("k_entropy")) {
-        if (document["k_entropy"].IsUint64()) {
-          k_entropy = document["k_entropy"].GetUint64();
-        } else {
-          return "Invalid k_entropy field";
-        }
+      // add hash data for each source and source sub_count
+      for (std::vector<std::pair<std::string, uint64_t> >::const_iterator it =
+           record.source_sub_counts.begin();
+           it != record.source_sub_counts.end(); ++it) {
+        merge_hash(record.block_hash, record.k_entropy, record.block_label,
+                   it->first, it->second);
       }
 
-      // block_label (optional)
-      std::string block_label = "";
-      if (document.HasMember("block_label")) {
-        if (document["block_label"].IsString()) {
-          block_label = document["block_label"].GetString();
-        } else {
-          return "Invalid block_label field";
-        }
-      }
+    } else {
 
-      // source_sub_counts:[]
-      if (!document.HasMember("source_sub_counts") ||
-                    !document["source_sub_counts"].IsArray()) {
-        return "Invalid source_sub_counts field";
+      // insert the source data and source names
+      insert_source_data(record.file_hash, record.filesize, record.file_type,
+                         record.zero_count, record.nonprobative_count);
+      for (hashdb::source_names_t::const_iterator it = record.names.begin();
+           it != record.names.end(); ++it) {
+        insert_source_name(record.file_hash, it->first, it->second);
       }
-      const rapidjson::Value& json_source_sub_counts =
-                                        document["source_sub_counts"];
-      hashdb::source_sub_counts_t* source_sub_counts =
-                                        new hashdb::source_sub_counts_t;
-      for (rapidjson::SizeType i = 0;
-           i+1 < json_source_sub_counts.Size(); i+=2) {
+    }
+  }
 
-        // source hash
-        if (!json_source_sub_counts[i+0].IsString()) {
-          delete source_sub_counts;
-          return "Invalid source hash in source_sub_counts";
-        }
-        const std::string file_hash = hashdb::hex_to_bin(
-                                        json_source_sub_counts[i].GetString());
+  void import_manager_t::insert_sources(
+                          const std::vector<json_record_t>& records,
+                          const size_t num_records) {
 
-        // sub_count
-        if (!json_source_sub_counts[i+1].IsUint64()) {
-          delete source_sub_counts;
-          return "Invalid sub_count in source_sub_counts";
+    // the file hashes of the source records
+    std::vector<std::string> file_hashes;
+    for (size_t i=0; i<num_records; ++i) {
+      const json_record_t& record = records[i];
+      if (record.is_block_hash) {
+        continue;
+      }
+      if (record.file_hash.size() == 0) {
+        std::cerr << "Error: insert_sources called with empty file_hash\n";
+        continue;
+      }
+      if (change_log != NULL) {
+        change_log->insert_source_data(record.file_hash, record.filesize,
+                     record.file_type, record.zero_count,
+                     record.nonprobative_count);
+        for (source_names_t::const_iterator it = record.names.begin();
+             it != record.names.end(); ++it) {
+          change_log->insert_source_name(record.file_hash, it->first,
+                                         it->second);
         }
-        const uint64_t sub_count = json_source_sub_counts[i+1].GetUint64();
-
-        // add hash data for this source and source sub_count
-        merge_hash(block_hash, k_entropy, block_label, file_hash, sub_count);
       }
+      file_hashes.push_back(record.file_hash);
+    }
+    // resolve or allocate the source IDs in one transaction
+    std::vector<uint64_t> source_ids;
+    lmdb_source_id_manager->insert_batch(file_hashes, *changes, source_ids);
+
+    // gather the source data and names by source ID
+    source_data_entries_t data_entries;
+    source_name_entries_t name_entries;
+    size_t k = 0;
+    for (size_t i=0; i<num_records; ++i) {
+      const json_record_t& record = records[i];
+      if (record.is_block_hash || record.file_hash.size() == 0) {
+        continue;
+      }
+      const uint64_t source_id = source_ids[k++];
+      data_entries.push_back(source_data_entry_t());
+      source_data_entry_t& data_entry = data_entries.back();
+      data_entry.source_id = source_id;
+      data_entry.file_binary_hash = record.file_hash;
+      data_entry.filesize = record.filesize;
+      data_entry.file_type = record.file_type;
+      data_entry.zero_count = record.zero_count;
+      data_entry.nonprobative_count = record.nonprobative_count;
+      for (source_names_t::const_iterator it = record.names.begin();
+           it != record.names.end(); ++it) {
+        name_entries.push_back(source_name_entry_t());
+        source_name_entry_t& name_entry = name_entries.back();
+        name_entry.source_id = source_id;
+        name_entry.repository_name = it->first;
+        name_entry.filename = it->second;
+        lmdb_repository_manager->insert(it->first, source_id);
+      }
+    }
 
-      delete source_sub_counts;
-      return "";
-
-    } else if (document.HasMember("file_hash")) {
+    // write each store in one transaction in key order, keeping the
+    // record order of entries of the same source
+    std::stable_sort(data_entries.begin(), data_entries.end(),
+                     source_data_entry_less);
+    std::stable_sort(name_entries.begin(), name_entries.end(),
+                     source_name_entry_less);
+    lmdb_source_data_manager->insert_batch(data_entries, *changes);
+    lmdb_source_name_manager->insert_batch(name_entries, *changes);
+  }
 
-      // parse file_hash
-      if (!document.HasMember("file_hash") ||
-                    !document["file_hash"].IsString()) {
-        return "Invalid file_hash field";
+  // the number of hashes removed per write transaction
+  static const size_t remove_batch_size = 65536;
+
+  // Remove sources from hashes and set the hash store count of each hash
+  // to what is left under its prefix.
+  static void remove_hash_entries(
+                     lmdb_hash_data_manager_t& hash_data_manager,
+                     lmdb_hash_manager_t& hash_manager,
+                     const hash_remove_entries_t& entries,
+                     hashdb::lmdb_changes_t& changes) {
+    std::vector<size_t> counts;
+    hash_data_manager.remove_batch(entries, counts, changes);
+    std::vector<std::string> block_hashes;
+    block_hashes.reserve(entries.size());
+    for (size_t i=0; i<entries.size(); ++i) {
+      block_hashes.push_back(entries[i].block_hash);
+      if (counts[i] == 0) {
+        // another hash may share the prefix
+        counts[i] = hash_data_manager.find_prefix_count(
+                           entries[i].block_hash.substr(0, num_prefix_bytes));
       }
-      const std::string file_hash = hashdb::hex_to_bin(
-                                       document["file_hash"].GetString());
+    }
+    hash_manager.remove_batch(block_hashes, counts, changes);
+  }
 
-      // parse filesize
-      if (!document.HasMember("filesize") ||
-                    !document["filesize"].IsUint64()) {
-        return "Invalid filesize field";
-      }
-      const uint64_t filesize = document["filesize"].GetUint64();
+  bool import_manager_t::remove_source(const std::string& file_hash) {
 
-      // parse file_type (optional)
-      std::string file_type = "";
-      if (document.HasMember("file_type")) {
-        if (document["file_type"].IsString()) {
-          file_type = document["file_type"].GetString();
-        } else {
-          return "Invalid file_type field";
-        }
-      }
+    // write pending hashes so that they are removed too
+    flush();
 
-      // zero_count (optional)
-      uint64_t zero_count = 0;
-      if (document.HasMember("zero_count")) {
-        if (document["zero_count"].IsUint64()) {
-          zero_count = document["zero_count"].GetUint64();
-        } else {
-          return "Invalid zero_count field";
-        }
-      }
+    uint64_t source_id;
+    if (!lmdb_source_id_manager->find(file_hash, source_id)) {
+      return false;
+    }
 
-      // nonprobative_count (optional)
-      uint64_t nonprobative_count = 0;
-      if (document.HasMember("nonprobative_count")) {
-        if (document["nonprobative_count"].IsUint64()) {
-          nonprobative_count = document["nonprobative_count"].GetUint64();
-        } else {
-          return "Invalid nonprobative_count field";
+    // find the hashes of the source
+    std::vector<std::string> block_hashes;
+    if (lmdb_source_hash_manager == NULL ||
+        !lmdb_source_hash_manager->find(source_id, block_hashes)) {
+      block_hashes.clear();
+      lmdb_hash_data_cursor_t cursor(*lmdb_hash_data_manager);
+      std::string block_hash;
+      uint64_t k_entropy;
+      std::string block_label;
+      uint64_t count;
+      source_id_sub_counts_t source_id_sub_counts;
+      while (cursor.next(block_hash, k_entropy, block_label, count,
+                         source_id_sub_counts)) {
+        if (find_source(source_id_sub_counts, source_id) !=
+                                           source_id_sub_counts.end()) {
+          block_hashes.push_back(block_hash);
         }
       }
+    }
 
-      // parse name_pairs:[]
-      if (!document.HasMember("name_pairs") ||
-                    !document["name_pairs"].IsArray()) {
-        return "Invalid name_pairs field";
+    // remove the source from its hashes
+    hash_remove_entries_t entries;
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      entries.push_back(hash_remove_entry_t(block_hashes[i], source_id));
+      if (entries.size() == remove_batch_size) {
+        remove_hash_entries(*lmdb_hash_data_manager, *lmdb_hash_manager,
+                            entries, *changes);
+        entries.clear();
       }
-      const rapidjson::Value& json_names = document["name_pairs"];
-      hashdb::source_names_t* names = new hashdb::source_names_t;
-      for (rapidjson::SizeType i = 0; i< json_names.Size(); i+=2) {
-
-        // parse repository name
-        if (!json_names[i].IsString()) {
-          delete names;
-          return "Invalid repository name in name_pairs field";
-        }
-        const std::string repository_name = json_names[i].GetString();
+    }
+    remove_hash_entries(*lmdb_hash_data_manager, *lmdb_hash_manager,
+                        entries, *changes);
+    if (lmdb_source_hash_manager != NULL) {
+      lmdb_source_hash_manager->remove(source_id, "");
+    }
+    if (lmdb_source_signature_manager != NULL) {
+      lmdb_source_signature_manager->remove(source_id);
+    }
 
-        // parse filename
-        if (!json_names[i+1].IsString()) {
-          delete names;
-          return "Invalid filename in name_pairs field";
-        }
-        const std::string filename = json_names[i+1].GetString();
+    // remove the source from its repositories then remove its names,
+    // data, and ID
+    source_names_t names;
+    lmdb_source_name_manager->find(source_id, names);
+    for (source_names_t::const_iterator it = names.begin();
+         it != names.end(); ++it) {
+      lmdb_repository_manager->remove(it->first, source_id);
+    }
+    lmdb_source_name_manager->remove(source_id);
+    lmdb_source_data_manager->remove(source_id);
+    lmdb_source_id_manager->remove(file_hash, *changes, source_id);
+    if (change_log != NULL) {
+      change_log->remove_source(file_hash);
+    }
+    return true;
+  }
 
-        // add repository name, filename pair
-        names->insert(hashdb::source_name_t(repository_name, filename));
-      }
+  bool import_manager_t::remove_hash(const std::string& block_hash) {
 
-      // everything worked so insert the source data and source names
-      insert_source_data(file_hash,
-                         filesize, file_type, zero_count, nonprobative_count);
-      for (hashdb::source_names_t::const_iterator it = names->begin();
-           it != names->end(); ++it) {
-        insert_source_name(file_hash, it->first, it->second);
-      }
+    // write pending hashes so that they are removed too
+    flush();
 
-      delete names;
-      return "";
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    source_id_sub_counts_t source_id_sub_counts;
+    if (!lmdb_hash_data_manager->find(block_hash, k_entropy, block_label,
+                                      count, source_id_sub_counts)) {
+      return false;
+    }
 
-    } else {
-      return "A block_hash or file_hash field is required";
+    // remove the hash then its entries in the source hash index
+    hash_remove_entries_t entries;
+    entries.push_back(hash_remove_entry_t(block_hash, 0));
+    remove_hash_entries(*lmdb_hash_data_manager, *lmdb_hash_manager,
+                        entries, *changes);
+    if (lmdb_source_hash_manager != NULL) {
+      for (source_id_sub_counts_t::const_iterator it =
+           source_id_sub_counts.begin();
+           it != source_id_sub_counts.end(); ++it) {
+        lmdb_source_hash_manager->remove(it->source_id, block_hash);
+      }
+    }
+    if (change_log != NULL) {
+      change_log->remove_hash(block_hash);
     }
+    return true;
   }
 
   bool import_manager_t::has_source(const std::string& file_hash) const {
@@ -568,6 +2654,11 @@ namespace hashdb {
     return lmdb_source_id_manager->next_source(file_hash);
   }
 
+  void import_manager_t::walk_sources(source_callback_t callback,
+                                      void* const data) const {
+    lmdb_source_id_manager->walk_sources(callback, data);
+  }
+
   std::string import_manager_t::size() const {
     std::stringstream ss;
     ss << "{\"hash_data_store\":" << lmdb_hash_data_manager->size()
@@ -583,63 +2674,549 @@ namespace hashdb {
     return lmdb_hash_data_manager->size();
   }
 
-  size_t import_manager_t::size_sources() const {
-    return lmdb_source_id_manager->size();
+  size_t import_manager_t::size_sources() const {
+    return lmdb_source_id_manager->size();
+  }
+
+  // ************************************************************
+  // scan
+  // ************************************************************
+  // Expanded hash JSON for a matched hash.  If optimizing, report only
+  // hashes and sources not reported before.  The JSON is assembled from
+  // cached source and source list JSON text.  When source_sub_counts
+  // holds only the sources of the hash from first_source on, of
+  // num_sources, report source_count and any next_source_offset.
+  static std::string expanded_hash_json(
+                    const hashdb::scan_manager_t& manager,
+                    locked_member_t& hashes,
+                    locked_member_t& sources,
+                    source_cache_t& source_cache,
+                    source_list_cache_t& source_list_cache,
+                    const bool optimizing,
+                    const std::string& block_hash,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t count,
+                    const hashdb::source_sub_counts_t& source_sub_counts,
+                    const uint64_t num_sources,
+                    const size_t first_source) {
+
+    // block_hash
+    std::string json_text = "{\"block_hash\":\"";
+    json_text += hashdb::bin_to_hex(block_hash);
+    json_text += "\"";
+
+    // report hash if not caching or this is the first time for the hash
+    if (!optimizing || hashes.locked_insert(block_hash)) {
+
+      // add entropy, block_label, count, and source_list_id
+      const uint32_t crc = calculate_crc(source_sub_counts);
+      std::stringstream ss;
+      ss << ",\"k_entropy\":" << k_entropy
+         << ",\"block_label\":" << json_string(block_label)
+         << ",\"count\":" << count
+         << ",\"source_list_id\":" << crc;
+      json_text += ss.str();
+
+      // the sources array with each source object
+      json_text += ",\"sources\":[";
+      bool is_first = true;
+      for (hashdb::source_sub_counts_t::const_iterator it =
+           source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+        if (!optimizing || sources.locked_insert(it->file_hash)) {
+          if (!is_first) {
+            json_text += ",";
+          }
+          is_first = false;
+
+          // provide the complete source information for this source
+          json_text += provide_source_json(manager, source_cache,
+                                           it->file_hash);
+        }
+      }
+      json_text += "]";
+
+      // add source_sub_counts
+      json_text += ",\"source_sub_counts\":";
+      json_text += provide_source_sub_counts_json(source_list_cache, crc,
+                                                  source_sub_counts);
+
+      // a page of the sources
+      const uint64_t next_source = first_source + source_sub_counts.size();
+      if (first_source > 0 || next_source < num_sources) {
+        std::stringstream page_ss;
+        page_ss << ",\"source_count\":" << num_sources;
+        if (next_source < num_sources) {
+          page_ss << ",\"next_source_offset\":" << next_source;
+        }
+        json_text += page_ss.str();
+      }
+    }
+
+    json_text += "}";
+    return json_text;
+  }
+
+  // Hash count JSON with the count under name, or "" if count is 0.
+  static std::string hash_count_json(const std::string& block_hash,
+                                     const char* const name,
+                                     const uint64_t count) {
+
+    // no match
+    if (count == 0) {
+      return "";
+    }
+
+    // write JSON
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+
+    // block hash
+    json.writer.Key("block_hash");
+    json.hex(block_hash);
+
+    // count
+    json.writer.Key(name);
+    json.writer.Uint64(count);
+    json.writer.EndObject();
+    return json.text();
+  }
+
+  // Hash JSON reporting that the hash exists.
+  static std::string hash_exists_json(const std::string& block_hash) {
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+    json.writer.Key("block_hash");
+    json.hex(block_hash);
+    json.writer.Key("exists");
+    json.writer.Bool(true);
+    json.writer.EndObject();
+    return json.text();
+  }
+
+  // Convert hash data source IDs to source file hashes.
+  static void to_source_sub_counts(
+               const lmdb_source_data_manager_t& lmdb_source_data_manager,
+               const hashdb::source_id_sub_counts_t& source_id_sub_counts,
+               hashdb::source_sub_counts_t& source_sub_counts) {
+
+    for (hashdb::source_id_sub_counts_t::const_iterator it =
+         source_id_sub_counts.begin(); it != source_id_sub_counts.end();
+         ++it) {
+
+      // space for unused returned source variables
+      std::string file_hash;
+      uint64_t filesize;
+      std::string file_type;
+      uint64_t zero_count;
+      uint64_t nonprobative_count;
+
+      // get file_hash from source_id
+      bool source_data_found = lmdb_source_data_manager.find(
+                              it->source_id, file_hash,
+                              filesize, file_type,
+                              zero_count, nonprobative_count);
+
+      // source_data must have a source_id to match the source_id in hash_data
+      if (source_data_found == false) {
+        assert(0);
+      }
+
+      // add the source sub_counts
+      source_sub_counts.insert(hashdb::source_sub_count_t(file_hash,
+                                                          it->sub_count));
+    }
+  }
+
+  // the most source IDs a hash iterator remembers the file hash of
+  static const size_t max_source_id_cache_size = 1000000;
+
+  // The decode state of a hash iterator: the file hashes of the source
+  // IDs it has seen, so that a walk reads each source once instead of
+  // once per hash, and space for the source IDs of each record.
+  class source_id_cache_t {
+    private:
+    std::map<uint64_t, std::string> file_hashes;
+
+    // do not allow copy or assignment
+    source_id_cache_t(const source_id_cache_t&);
+    source_id_cache_t& operator=(const source_id_cache_t&);
+
+    public:
+    source_id_sub_counts_t source_id_sub_counts;
+
+    source_id_cache_t() : file_hashes(), source_id_sub_counts() {
+    }
+
+    // convert source IDs to source file hashes
+    void to_source_sub_counts(
+               const lmdb_source_data_manager_t& lmdb_source_data_manager,
+               hashdb::source_sub_counts_t& source_sub_counts) {
+
+      for (hashdb::source_id_sub_counts_t::const_iterator it =
+           source_id_sub_counts.begin(); it != source_id_sub_counts.end();
+           ++it) {
+
+        std::map<uint64_t, std::string>::const_iterator cached =
+                                         file_hashes.find(it->source_id);
+        if (cached != file_hashes.end()) {
+          source_sub_counts.insert(hashdb::source_sub_count_t(
+                                         cached->second, it->sub_count));
+          continue;
+        }
+
+        // space for unused returned source variables
+        std::string file_hash;
+        uint64_t filesize;
+        std::string file_type;
+        uint64_t zero_count;
+        uint64_t nonprobative_count;
+
+        // get file_hash from source_id
+        bool source_data_found = lmdb_source_data_manager.find(
+                                it->source_id, file_hash,
+                                filesize, file_type,
+                                zero_count, nonprobative_count);
+
+        // source_data must have a source_id to match the source_id in
+        // hash_data
+        if (source_data_found == false) {
+          assert(0);
+        }
+
+        if (file_hashes.size() < max_source_id_cache_size) {
+          file_hashes[it->source_id] = file_hash;
+        }
+
+        // add the source sub_counts
+        source_sub_counts.insert(hashdb::source_sub_count_t(file_hash,
+                                                            it->sub_count));
+      }
+    }
+  };
+
+  // the progress of warm and the thread of start_warm
+  struct warm_state_t {
+    lmdb_helper::warm_progress_t progress;
+    std::atomic<bool> done;
+    std::vector<std::string> filenames;
+    size_t num_threads;
+    bool started;
+    pthread_t thread;
+    warm_state_t() : progress(), done(false), filenames(), num_threads(0),
+                     started(false), thread() {
+    }
+
+    private:
+    // do not allow copy or assignment
+    warm_state_t(const warm_state_t&);
+    warm_state_t& operator=(const warm_state_t&);
+  };
+
+  static void* run_warm(void* const arg) {
+    warm_state_t* const warm_state = static_cast<warm_state_t*>(arg);
+    lmdb_helper::warm_files(warm_state->filenames, warm_state->num_threads,
+                            &warm_state->progress);
+    warm_state->done.store(true);
+    return NULL;
   }
 
-  // ************************************************************
-  // scan
-  // ************************************************************
-  scan_manager_t::scan_manager_t(const std::string& hashdb_dir) :
+  scan_manager_t::scan_manager_t(const std::string& hashdb_dir,
+                                 const size_t max_optimizing_bytes,
+                                 const uint32_t max_staleness_ms,
+                                 const bool build_indexes) :
           // LMDB managers
           lmdb_hash_data_manager(0),
           lmdb_hash_manager(0),
           lmdb_source_data_manager(0),
           lmdb_source_id_manager(0),
           lmdb_source_name_manager(0),
+          lmdb_repository_manager(0),
+          lmdb_source_hash_manager(0),
+          lmdb_source_signature_manager(0),
+          lmdb_count_index_manager(0),
 
           // for find_expanded_hash_json
-          hashes(new locked_member_t),
-          sources(new locked_member_t) {
-
-    // open managers
+          hashes(new locked_member_t(max_optimizing_bytes / 2)),
+          sources(new locked_member_t(max_optimizing_bytes / 2)),
+          source_cache(new source_cache_t(default_source_cache_capacity)),
+          source_list_cache(new source_list_cache_t(
+                                       default_source_cache_capacity)),
+          expanded_max_sources(0),
+          optimized_max_sources(0),
+          common_blocks(NULL),
+          compact_common(false),
+          warm_state(new warm_state_t),
+          opener_pid(static_cast<uint64_t>(getpid())) {
+
+    // open managers, mapped to the maximum map size if there is one
+    const hashdb::settings_t settings = read_store_settings(hashdb_dir);
+    lmdb_helper::env_policy_t policy = store_policy(settings, false);
+    policy.max_snapshot_ms = max_staleness_ms;
     lmdb_hash_data_manager = new lmdb_hash_data_manager_t(hashdb_dir,
-                                                          READ_ONLY);
-    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, READ_ONLY);
+                  READ_ONLY, settings.hash_data_format,
+                  settings.hash_shard_bits, policy);
+    lmdb_hash_manager = new lmdb_hash_manager_t(hashdb_dir, READ_ONLY,
+                  settings.hash_shard_bits, policy,
+                  settings.hash_store_rebuild ? lmdb_hash_data_manager : NULL,
+                  build_indexes);
     lmdb_source_data_manager = new lmdb_source_data_manager_t(hashdb_dir,
-                                                              READ_ONLY);
+                                                      READ_ONLY, policy);
     lmdb_source_id_manager = new lmdb_source_id_manager_t(hashdb_dir,
-                                                              READ_ONLY);
+                                                      READ_ONLY, policy);
     lmdb_source_name_manager = new lmdb_source_name_manager_t(hashdb_dir,
-                                                              READ_ONLY);
+                              READ_ONLY, settings.source_name_format, policy);
+    lmdb_repository_manager = new lmdb_repository_manager_t(hashdb_dir,
+                                                      READ_ONLY, policy);
+    if (settings.source_hash_index) {
+      lmdb_source_hash_manager = new lmdb_source_hash_manager_t(hashdb_dir,
+                                                      READ_ONLY, policy);
+    }
+    if (settings.similarity_index) {
+      lmdb_source_signature_manager = new lmdb_source_signature_manager_t(
+                                          hashdb_dir, READ_ONLY, policy);
+    }
+    if (settings.count_index) {
+      lmdb_count_index_manager = new lmdb_count_index_manager_t(hashdb_dir,
+                                                      READ_ONLY, policy);
+    }
+
+    // memoize the scan results of the pinned common blocks
+    common_blocks = common_blocks_t::read(common_blocks_t::filename(
+                     hashdb_dir), lmdb_hash_manager->generation());
+    if (common_blocks != NULL) {
+      for (size_t i=0; i<common_blocks->block_hashes.size(); ++i) {
+        const std::string& block_hash = common_blocks->block_hashes[i];
+        common_block_t result;
+        if (!find_hash(block_hash, result.k_entropy, result.block_label,
+                       result.count, result.source_sub_counts)) {
+          continue;
+        }
+        result.expanded_json = expanded_hash_json(*this, *hashes, *sources,
+                             *source_cache, *source_list_cache, false,
+                             block_hash, result.k_entropy,
+                             result.block_label, result.count,
+                             result.source_sub_counts,
+                             result.source_sub_counts.size(), 0);
+        std::stringstream ss;
+        ss << "{\"block_hash\":\"" << bin_to_hex(block_hash)
+           << "\",\"count\":" << result.count << ",\"common_block\":true}";
+        result.compact_json = ss.str();
+        result.count_json = hash_count_json(block_hash, "count",
+                                            result.count);
+        result.approximate_json = hash_count_json(block_hash,
+                 "approximate_count", lmdb_hash_manager->find(block_hash));
+        result.binary = hash_binary(block_hash, result.k_entropy,
+                 result.block_label, result.count, result.source_sub_counts);
+        common_blocks->results[block_hash] = result;
+      }
+    }
+  }
+
+  uint64_t scan_manager_t::warm(const size_t num_threads) {
+    std::vector<std::string> filenames;
+    lmdb_hash_manager->store_files(filenames);
+    lmdb_hash_data_manager->store_files(filenames);
+    const uint64_t bytes_read = lmdb_helper::warm_files(filenames,
+                         (num_threads == 0) ? num_cpus() : num_threads,
+                         &warm_state->progress);
+    warm_state->done.store(true);
+    return bytes_read;
+  }
+
+  void scan_manager_t::start_warm(const size_t num_threads) {
+    if (warm_state->started) {
+      return;
+    }
+    lmdb_hash_manager->store_files(warm_state->filenames);
+    lmdb_hash_data_manager->store_files(warm_state->filenames);
+    warm_state->num_threads = (num_threads == 0) ? num_cpus() : num_threads;
+    warm_state->started = true;
+    if (pthread_create(&warm_state->thread, NULL, run_warm,
+                       warm_state) != 0) {
+      std::cerr << "Error: unable to start warm thread.\n";
+      exit(1);
+    }
+  }
+
+  bool scan_manager_t::warm_progress(uint64_t& bytes_read,
+                                     uint64_t& bytes_to_read) const {
+    // done first, so that the counts read after it are final
+    const bool done = warm_state->done.load();
+    bytes_read = warm_state->progress.bytes_read.load();
+    bytes_to_read = warm_state->progress.bytes_to_read.load();
+    return done;
+  }
+
+  std::string scan_manager_t::lock_hash_store() {
+    return lmdb_hash_manager->lock_in_memory();
+  }
+
+  std::string scan_manager_t::interleave_hash_store() {
+    return lmdb_hash_manager->interleave_in_memory();
   }
 
   scan_manager_t::~scan_manager_t() {
+
+    // stop warming before closing the stores it reads
+    if (warm_state->started) {
+      warm_state->progress.stop.store(true);
+      pthread_join(warm_state->thread, NULL);
+    }
+    delete warm_state;
+
     delete lmdb_hash_data_manager;
     delete lmdb_hash_manager;
     delete lmdb_source_data_manager;
     delete lmdb_source_id_manager;
     delete lmdb_source_name_manager;
+    delete lmdb_repository_manager;
+    delete lmdb_source_hash_manager;
+    delete lmdb_source_signature_manager;
+    delete lmdb_count_index_manager;
 
     // for find_expanded_hash_json
     delete hashes;
     delete sources;
+    delete source_cache;
+    delete source_list_cache;
+    delete common_blocks;
+  }
+
+  void scan_manager_t::reopen_after_fork() {
+    const uint64_t pid = static_cast<uint64_t>(getpid());
+    if (pid == opener_pid) {
+      return;
+    }
+    lmdb_hash_data_manager->reopen_after_fork();
+    lmdb_hash_manager->reopen_after_fork();
+    lmdb_source_data_manager->reopen_after_fork();
+    lmdb_source_id_manager->reopen_after_fork();
+    lmdb_source_name_manager->reopen_after_fork();
+    lmdb_repository_manager->reopen_after_fork();
+    if (lmdb_source_hash_manager != NULL) {
+      lmdb_source_hash_manager->reopen_after_fork();
+    }
+    if (lmdb_source_signature_manager != NULL) {
+      lmdb_source_signature_manager->reopen_after_fork();
+    }
+    if (lmdb_count_index_manager != NULL) {
+      lmdb_count_index_manager->reopen_after_fork();
+    }
+    opener_pid = pid;
+  }
+
+  std::string scan_manager_t::share_optimized_state(const std::string& name,
+                                                    const size_t max_bytes) {
+    std::string error_message;
+    shared_member_t* const shared_hashes = shared_member_t::open(
+                              name + ".hashes", max_bytes / 2, error_message);
+    if (shared_hashes == NULL) {
+      return error_message;
+    }
+    shared_member_t* const shared_sources = shared_member_t::open(
+                             name + ".sources", max_bytes / 2, error_message);
+    if (shared_sources == NULL) {
+      delete shared_hashes;
+      return error_message;
+    }
+    hashes->share(shared_hashes);
+    sources->share(shared_sources);
+    return "";
+  }
+
+  std::string scan_manager_t::remove_optimized_state(const std::string& name) {
+    const std::string hashes_error = shared_member_t::remove(name + ".hashes");
+    const std::string sources_error =
+                                shared_member_t::remove(name + ".sources");
+    return (hashes_error.size() > 0) ? hashes_error : sources_error;
+  }
+
+  void scan_manager_t::set_compact_common(const bool p_compact_common) {
+    compact_common = p_compact_common;
+  }
+
+  size_t scan_manager_t::size_common_blocks() const {
+    return (common_blocks == NULL) ? 0 : common_blocks->results.size();
+  }
+
+  // the memoized result of a pinned hash that can answer the scan mode,
+  // else NULL
+  const common_block_t* scan_manager_t::find_common_block(
+                   const hashdb::scan_mode_t scan_mode,
+                   const std::string& block_hash) const {
+    if (common_blocks == NULL) {
+      return NULL;
+    }
+    const common_block_t* const result = common_blocks->find(block_hash);
+    if (result == NULL) {
+      return NULL;
+    }
+    if (common_blocks->generation != lmdb_hash_manager->generation()) {
+      // the hashdb changed since the results were memoized
+      return NULL;
+    }
+    const bool expanded = scan_mode == hashdb::scan_mode_t::EXPANDED ||
+                          scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED;
+    const size_t max_sources = max_sources_of(scan_mode);
+    if (expanded && !compact_common && max_sources != 0 &&
+        result->source_sub_counts.size() > max_sources) {
+      // a page of the sources is read instead
+      return NULL;
+    }
+    return result;
+  }
+
+  // JSON text of a pinned hash from its memoized result
+  std::string scan_manager_t::common_block_json(
+                   const hashdb::scan_mode_t scan_mode,
+                   const std::string& block_hash,
+                   const common_block_t& result) {
+    switch(scan_mode) {
+      case hashdb::scan_mode_t::EXPANDED:
+        return compact_common ? result.compact_json : result.expanded_json;
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED:
+        if (compact_common) {
+          return result.compact_json;
+        }
+        // the first report of the hash or its sources depends on the scan
+        return expanded_hash_json(*this, *hashes, *sources, *source_cache,
+                             *source_list_cache, true, block_hash,
+                             result.k_entropy, result.block_label,
+                             result.count, result.source_sub_counts,
+                             result.source_sub_counts.size(), 0);
+      case hashdb::scan_mode_t::COUNT: return result.count_json;
+      case hashdb::scan_mode_t::APPROXIMATE_COUNT:
+        return result.approximate_json;
+      case hashdb::scan_mode_t::BINARY: return result.binary;
+      case hashdb::scan_mode_t::EXISTS: return hash_exists_json(block_hash);
+      default: assert(0); std::exit(1);
+    }
   }
 
   std::string scan_manager_t::find_hash_json(
                    const hashdb::scan_mode_t scan_mode,
                    const std::string& block_hash) {
 
+    // pinned common blocks are answered from memory
+    const common_block_t* const common_block =
+                                 find_common_block(scan_mode, block_hash);
+    if (common_block != NULL) {
+      return common_block_json(scan_mode, block_hash, *common_block);
+    }
+
     // delegate to low-level handler
     switch(scan_mode) {
 
       // EXPANDED
       case hashdb::scan_mode_t::EXPANDED:
-        return find_expanded_hash_json(false, block_hash);
+        return find_expanded_hash_json(false, block_hash, 0,
+                                       expanded_max_sources);
 
       // EXPANDED_OPTIMIZED
       case hashdb::scan_mode_t::EXPANDED_OPTIMIZED:
-        return find_expanded_hash_json(true, block_hash);
+        return find_expanded_hash_json(true, block_hash, 0,
+                                       optimized_max_sources);
 
       // COUNT
       case hashdb::scan_mode_t::COUNT:
@@ -649,101 +3226,479 @@ namespace hashdb {
       case hashdb::scan_mode_t::APPROXIMATE_COUNT:
         return find_approximate_hash_count_json(block_hash);
 
+      // BINARY
+      case hashdb::scan_mode_t::BINARY:
+        return find_hash_binary(block_hash);
+
+      // EXISTS
+      case hashdb::scan_mode_t::EXISTS:
+        return (find_approximate_hash_count(block_hash) == 0) ? "" :
+                                              hash_exists_json(block_hash);
+
+      default: assert(0); std::exit(1);
+    }
+  }
+
+  // order probe indexes by block hash
+  struct block_hash_index_less_t {
+    const std::vector<std::string>& block_hashes;
+    block_hash_index_less_t(const std::vector<std::string>& p_block_hashes) :
+                  block_hashes(p_block_hashes) {
+    }
+    bool operator()(const size_t a, const size_t b) const {
+      return block_hashes[a] < block_hashes[b];
+    }
+  };
+
+  std::vector<std::string> scan_manager_t::find_hashes_json(
+                   const hashdb::scan_mode_t scan_mode,
+                   const std::vector<std::string>& block_hashes) {
+
+    std::vector<std::string> json_texts(block_hashes.size());
+    const size_t none = static_cast<size_t>(-1);
+
+    // sort the probes and look up each distinct hash once, except pinned
+    // common blocks, which are answered from memory
+    std::vector<const common_block_t*> common_of(block_hashes.size(), NULL);
+    std::vector<size_t> order;
+    order.reserve(block_hashes.size());
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      if (block_hashes[i].size() == 0) {
+        std::cerr << "Error: find_hashes_json called with empty block_hash\n";
+        continue;
+      }
+      common_of[i] = find_common_block(scan_mode, block_hashes[i]);
+      if (common_of[i] != NULL) {
+        continue;
+      }
+      order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(),
+              block_hash_index_less_t(block_hashes));
+    std::vector<std::string> probes;
+    std::vector<size_t> probe_of(block_hashes.size(), none);
+    for (size_t j=0; j<order.size(); ++j) {
+      const std::string& block_hash = block_hashes[order[j]];
+      if (probes.size() == 0 || probes.back() != block_hash) {
+        probes.push_back(block_hash);
+      }
+      probe_of[order[j]] = probes.size() - 1;
+    }
+
+    switch(scan_mode) {
+
+      // EXPANDED, EXPANDED_OPTIMIZED, and BINARY
+      case hashdb::scan_mode_t::EXPANDED:
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED:
+      case hashdb::scan_mode_t::BINARY: {
+        const bool optimizing =
+                  (scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED);
+
+        // first check hash store
+        std::vector<size_t> approximate_counts;
+        lmdb_hash_manager->find_sorted(probes, approximate_counts);
+
+        // read hashes that may be present using hash data manager
+        std::vector<std::string> candidates;
+        std::vector<size_t> candidate_of(probes.size(), none);
+        for (size_t j=0; j<probes.size(); ++j) {
+          if (approximate_counts[j] != 0) {
+            candidate_of[j] = candidates.size();
+            candidates.push_back(probes[j]);
+          }
+        }
+        std::vector<hash_data_t> hash_data;
+        lmdb_hash_data_manager->find_sorted(candidates, hash_data,
+                                            max_sources_of(scan_mode));
+
+        // report in input order so optimizing reports first occurrences
+        for (size_t i=0; i<block_hashes.size(); ++i) {
+          if (common_of[i] != NULL) {
+            json_texts[i] = common_block_json(scan_mode, block_hashes[i],
+                                              *common_of[i]);
+            continue;
+          }
+          if (probe_of[i] == none || candidate_of[probe_of[i]] == none) {
+            continue;
+          }
+          const hash_data_t& data = hash_data[candidate_of[probe_of[i]]];
+          if (!data.found) {
+            continue;
+          }
+          hashdb::source_sub_counts_t source_sub_counts;
+          to_source_sub_counts(*lmdb_source_data_manager,
+                               data.source_id_sub_counts, source_sub_counts);
+          if (scan_mode == hashdb::scan_mode_t::BINARY) {
+            json_texts[i] = hash_binary(block_hashes[i], data.k_entropy,
+                               data.block_label, data.count,
+                               source_sub_counts);
+            continue;
+          }
+          json_texts[i] = expanded_hash_json(*this, *hashes, *sources,
+                               *source_cache, *source_list_cache,
+                               optimizing, block_hashes[i],
+                               data.k_entropy, data.block_label, data.count,
+                               source_sub_counts, data.num_sources, 0);
+        }
+        break;
+      }
+
+      // COUNT
+      case hashdb::scan_mode_t::COUNT: {
+        std::vector<size_t> counts;
+        lmdb_hash_data_manager->find_count_sorted(probes, counts);
+        for (size_t i=0; i<block_hashes.size(); ++i) {
+          if (common_of[i] != NULL) {
+            json_texts[i] = common_of[i]->count_json;
+          } else if (probe_of[i] != none) {
+            json_texts[i] = hash_count_json(block_hashes[i], "count",
+                                            counts[probe_of[i]]);
+          }
+        }
+        break;
+      }
+
+      // APPROXIMATE_COUNT
+      case hashdb::scan_mode_t::APPROXIMATE_COUNT: {
+        std::vector<size_t> approximate_counts;
+        lmdb_hash_manager->find_sorted(probes, approximate_counts);
+        for (size_t i=0; i<block_hashes.size(); ++i) {
+          if (common_of[i] != NULL) {
+            json_texts[i] = common_of[i]->approximate_json;
+          } else if (probe_of[i] != none) {
+            json_texts[i] = hash_count_json(block_hashes[i],
+                        "approximate_count", approximate_counts[probe_of[i]]);
+          }
+        }
+        break;
+      }
+
+      // EXISTS
+      case hashdb::scan_mode_t::EXISTS: {
+        std::vector<size_t> approximate_counts;
+        lmdb_hash_manager->find_sorted(probes, approximate_counts);
+        for (size_t i=0; i<block_hashes.size(); ++i) {
+          if (common_of[i] != NULL || (probe_of[i] != none &&
+                                 approximate_counts[probe_of[i]] != 0)) {
+            json_texts[i] = hash_exists_json(block_hashes[i]);
+          }
+        }
+        break;
+      }
+
       default: assert(0); std::exit(1);
     }
+    return json_texts;
+  }
+
+  // one slice of a scan_many batch
+  struct scan_many_slice_t {
+    scan_manager_t* scan_manager;
+    hashdb::scan_mode_t scan_mode;
+    std::vector<std::string> block_hashes;
+    std::vector<std::string> json_texts;
+    pthread_t thread;
+    scan_many_slice_t() : scan_manager(NULL),
+                          scan_mode(hashdb::scan_mode_t::COUNT),
+                          block_hashes(), json_texts(), thread() {
+    }
+
+    private:
+    // do not allow copy or assignment
+    scan_many_slice_t(const scan_many_slice_t&);
+    scan_many_slice_t& operator=(const scan_many_slice_t&);
+  };
+
+  static void* run_scan_many_slice(void* const arg) {
+    scan_many_slice_t* const slice = static_cast<scan_many_slice_t*>(arg);
+    slice->json_texts = slice->scan_manager->find_hashes_json(
+                                  slice->scan_mode, slice->block_hashes);
+    return NULL;
+  }
+
+  // the fewest hashes worth a thread of their own
+  static const size_t scan_many_min_slice = 4096;
+
+  // Find hashes, dividing them among threads.
+  std::vector<std::string> scan_manager_t::scan_many(
+                   const std::vector<std::string>& block_hashes,
+                   const hashdb::scan_mode_t scan_mode,
+                   const size_t num_threads) {
+    size_t slice_count = (num_threads == 0) ? num_cpus() : num_threads;
+    slice_count = std::min(slice_count,
+                           block_hashes.size() / scan_many_min_slice);
+    if (scan_mode == hashdb::scan_mode_t::EXPANDED_OPTIMIZED ||
+        slice_count <= 1) {
+      return find_hashes_json(scan_mode, block_hashes);
+    }
+
+    // contiguous slices, the first in this thread
+    std::vector<scan_many_slice_t*> slices(slice_count);
+    const size_t slice_size = (block_hashes.size() + slice_count - 1) /
+                              slice_count;
+    for (size_t i=0; i<slice_count; ++i) {
+      const size_t begin = std::min(i * slice_size, block_hashes.size());
+      const size_t end = std::min(begin + slice_size, block_hashes.size());
+      slices[i] = new scan_many_slice_t;
+      slices[i]->scan_manager = this;
+      slices[i]->scan_mode = scan_mode;
+      slices[i]->block_hashes.assign(block_hashes.begin() + begin,
+                                    block_hashes.begin() + end);
+    }
+    for (size_t i=1; i<slice_count; ++i) {
+      if (pthread_create(&slices[i]->thread, NULL, run_scan_many_slice,
+                         slices[i])) {
+        std::cerr << "Error creating scan_many thread.\n";
+        assert(0);
+      }
+    }
+    run_scan_many_slice(slices[0]);
+    for (size_t i=1; i<slice_count; ++i) {
+      pthread_join(slices[i]->thread, NULL);
+    }
+
+    // join the results in the order given
+    std::vector<std::string> json_texts;
+    json_texts.reserve(block_hashes.size());
+    for (size_t i=0; i<slice_count; ++i) {
+      json_texts.insert(json_texts.end(), slices[i]->json_texts.begin(),
+                        slices[i]->json_texts.end());
+      delete slices[i];
+    }
+    return json_texts;
+  }
+
+  // Find packed hashes, return JSON text for each.
+  std::vector<std::string> scan_manager_t::find_packed_hashes_json(
+                   const hashdb::scan_mode_t scan_mode,
+                   const char* const packed_hashes,
+                   const size_t packed_hashes_size,
+                   const size_t hash_size) {
+    std::vector<std::string> block_hashes;
+    if (!split_packed_hashes(packed_hashes, packed_hashes_size, hash_size,
+                             block_hashes)) {
+      return std::vector<std::string>();
+    }
+    return find_hashes_json(scan_mode, block_hashes);
+  }
+
+  // Find the count or approximate count of each packed hash.
+  bool scan_manager_t::find_hash_counts(const char* const packed_hashes,
+                                        const size_t packed_hashes_size,
+                                        const size_t hash_size,
+                                        const bool approximate,
+                                        uint64_t* const counts,
+                                        const size_t counts_size) const {
+    std::vector<std::string> block_hashes;
+    if (!split_packed_hashes(packed_hashes, packed_hashes_size, hash_size,
+                             block_hashes)) {
+      return false;
+    }
+    if (counts_size < block_hashes.size()) {
+      std::cerr << "Error: room for " << counts_size << " counts but "
+                << block_hashes.size() << " hashes\n";
+      return false;
+    }
+
+    // sort the probes and look up each distinct hash once
+    std::vector<size_t> order(block_hashes.size());
+    for (size_t i=0; i<order.size(); ++i) {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(),
+              block_hash_index_less_t(block_hashes));
+    std::vector<std::string> probes;
+    std::vector<size_t> probe_of(block_hashes.size());
+    for (size_t j=0; j<order.size(); ++j) {
+      const std::string& block_hash = block_hashes[order[j]];
+      if (probes.size() == 0 || probes.back() != block_hash) {
+        probes.push_back(block_hash);
+      }
+      probe_of[order[j]] = probes.size() - 1;
+    }
+
+    std::vector<size_t> probe_counts;
+    if (approximate) {
+      lmdb_hash_manager->find_sorted(probes, probe_counts);
+    } else {
+      lmdb_hash_data_manager->find_count_sorted(probes, probe_counts);
+    }
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      counts[i] = probe_counts[probe_of[i]];
+    }
+    return true;
+  }
+
+  // Find whether each packed hash is present.
+  bool scan_manager_t::find_hash_exists(const char* const packed_hashes,
+                                        const size_t packed_hashes_size,
+                                        const size_t hash_size,
+                                        uint8_t* const bitmap,
+                                        const size_t bitmap_size) const {
+    if (hash_size == 0 || packed_hashes_size % hash_size != 0) {
+      std::cerr << "Error: packed hashes size " << packed_hashes_size
+                << " is not a multiple of hash size " << hash_size << "\n";
+      return false;
+    }
+    const size_t count = packed_hashes_size / hash_size;
+    if (bitmap_size < (count + 7) / 8) {
+      std::cerr << "Error: room for " << bitmap_size << " bitmap bytes but "
+                << count << " hashes\n";
+      return false;
+    }
+    lmdb_hash_manager->find_exists(packed_hashes, count, hash_size, bitmap);
+    return true;
   }
 
   // Find expanded hash, optimized with caching, return JSON.
-  // If optimizing, cache hashes and sources.
+  // If optimizing, cache hashes and sources.  Report max_sources sources
+  // from first_source on, all if max_sources is 0.
   std::string scan_manager_t::find_expanded_hash_json(
-                    const bool optimizing, const std::string& block_hash) {
+                    const bool optimizing, const std::string& block_hash,
+                    const size_t first_source, const size_t max_sources) {
+
+    if (block_hash.size() == 0) {
+      std::cerr << "Error: find_hash called with empty block_hash\n";
+      return "";
+    }
+
+    // first check hash store
+    if (lmdb_hash_manager->find(block_hash) == 0) {
+      return "";
+    }
 
     // fields to hold the scan
     uint64_t k_entropy;
     std::string block_label;
     uint64_t count;
-    hashdb::source_sub_counts_t* source_sub_counts =
-                                           new hashdb::source_sub_counts_t;
+    uint64_t num_sources;
+    hashdb::source_id_sub_counts_t* source_id_sub_counts =
+                                        new hashdb::source_id_sub_counts_t;
 
     // scan
-    bool matched = scan_manager_t::find_hash(block_hash,
-                           k_entropy, block_label, count, *source_sub_counts);
+    bool matched = lmdb_hash_data_manager->find_sources(block_hash,
+                           first_source, max_sources, k_entropy, block_label,
+                           count, *source_id_sub_counts, num_sources);
 
     // done if no match
     if (matched == false) {
-      delete source_sub_counts;
+      delete source_id_sub_counts;
       return "";
     }
 
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
-    // block_hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-
-    // report hash if not caching or this is the first time for the hash
-    if (!optimizing || hashes->locked_insert(block_hash)) {
-
-      // add entropy
-      json_doc.AddMember("k_entropy", k_entropy, allocator);
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                           new hashdb::source_sub_counts_t;
+    to_source_sub_counts(*lmdb_source_data_manager, *source_id_sub_counts,
+                         *source_sub_counts);
+    delete source_id_sub_counts;
+    const std::string json_text = expanded_hash_json(*this, *hashes,
+                             *sources, *source_cache, *source_list_cache,
+                             optimizing, block_hash,
+                             k_entropy, block_label, count,
+                             *source_sub_counts, num_sources, first_source);
+    delete source_sub_counts;
+    return json_text;
+  }
 
-      // add block_label
-      json_doc.AddMember("block_label", v(block_label, allocator), allocator);
+  // limit the sources reported by a scan mode
+  void scan_manager_t::set_max_sources(const hashdb::scan_mode_t scan_mode,
+                                       const size_t max_sources) {
+    switch(scan_mode) {
+      case hashdb::scan_mode_t::EXPANDED:
+        expanded_max_sources = max_sources;
+        break;
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED:
+        optimized_max_sources = max_sources;
+        break;
+      default:
+        // other modes do not report sources as JSON
+        break;
+    }
+  }
 
-      // add count
-      json_doc.AddMember("count", count, allocator);
+  size_t scan_manager_t::max_sources_of(
+                            const hashdb::scan_mode_t scan_mode) const {
+    switch(scan_mode) {
+      case hashdb::scan_mode_t::EXPANDED: return expanded_max_sources;
+      case hashdb::scan_mode_t::EXPANDED_OPTIMIZED:
+        return optimized_max_sources;
+      default: return 0;
+    }
+  }
 
-      // add source_list_id
-      uint32_t crc = calculate_crc(*source_sub_counts);
-      json_doc.AddMember("source_list_id", crc, allocator);
+  // a page of the sources of a hash
+  std::string scan_manager_t::find_hash_sources_json(
+                    const std::string& block_hash,
+                    const size_t first_source,
+                    const size_t max_sources) {
+    return find_expanded_hash_json(false, block_hash, first_source,
+                                   max_sources);
+  }
 
-      // the sources array
-      rapidjson::Value json_sources(rapidjson::kArrayType);
+  // Find hash, return its binary record.
+  std::string scan_manager_t::find_hash_binary(
+                    const std::string& block_hash) const {
 
-      // add each source object
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
-        if (!optimizing || sources->locked_insert(it->file_hash)) {
+    // fields to hold the scan
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                           new hashdb::source_sub_counts_t;
 
-          // create a json_source object for the json_sources array
-          rapidjson::Value json_source(rapidjson::kObjectType);
+    // scan
+    bool matched = scan_manager_t::find_hash(block_hash,
+                           k_entropy, block_label, count, *source_sub_counts);
 
-          // provide the complete source information for this source
-          provide_source_information(*this, it->file_hash, allocator,
-                                     json_source);
-          json_sources.PushBack(json_source, allocator);
-        }
-      }
-      json_doc.AddMember("sources", json_sources, allocator);
+    // done if no match
+    if (matched == false) {
+      delete source_sub_counts;
+      return "";
+    }
 
-      // add source_sub_counts as pairs of file hash, sub_count
-      rapidjson::Value json_source_sub_counts(rapidjson::kArrayType);
+    const std::string binary = hash_binary(block_hash, k_entropy,
+                                    block_label, count, *source_sub_counts);
+    delete source_sub_counts;
+    return binary;
+  }
 
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
+  std::string scan_manager_t::hash_binary_json(const std::string& binary,
+                                               const bool optimizing) {
 
-        // file hash
-        json_source_sub_counts.PushBack(
-                   v(hashdb::bin_to_hex(it->file_hash), allocator), allocator);
+    // fields to hold the record
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                           new hashdb::source_sub_counts_t;
 
-        // sub_count
-        json_source_sub_counts.PushBack(it->sub_count, allocator);
+    if (!read_hash_binary(binary, block_hash, k_entropy, block_label, count,
+                          *source_sub_counts)) {
+      std::cerr << "Error: hash_binary_json called with truncated record\n";
+      delete source_sub_counts;
+      return "";
+    }
 
-      }
-      json_doc.AddMember("source_sub_counts", json_source_sub_counts,
-                         allocator);
+    // pinned common blocks are answered from memory
+    const hashdb::scan_mode_t scan_mode = optimizing ?
+                                  hashdb::scan_mode_t::EXPANDED_OPTIMIZED :
+                                  hashdb::scan_mode_t::EXPANDED;
+    const common_block_t* const common_block =
+                                 find_common_block(scan_mode, block_hash);
+    if (common_block != NULL) {
+      delete source_sub_counts;
+      return common_block_json(scan_mode, block_hash, *common_block);
     }
 
+    const std::string json_text = expanded_hash_json(*this, *hashes,
+                             *sources, *source_cache, *source_list_cache,
+                             optimizing, block_hash,
+                             k_entropy, block_label, count,
+                             *source_sub_counts, source_sub_counts->size(),
+                             0);
     delete source_sub_counts;
-
-    // return JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    return json_text;
   }
 
   // find hash, return associated hash and source data
@@ -778,40 +3733,154 @@ namespace hashdb {
                                   block_label, count, *source_id_sub_counts);
     if (has_hash) {
       // build source_sub_count from source_id_sub_count
-      for (hashdb::source_id_sub_counts_t::const_iterator it =
-           source_id_sub_counts->begin(); it != source_id_sub_counts->end();
-           ++it) {
+      to_source_sub_counts(*lmdb_source_data_manager, *source_id_sub_counts,
+                           source_sub_counts);
+      delete source_id_sub_counts;
+      return true;
 
-        // space for unused returned source variables
-        std::string file_hash;
-        uint64_t filesize;
-        std::string file_type;
-        uint64_t zero_count;
-        uint64_t nonprobative_count;
+    } else {
+      // no action, lmdb_hash_data_manager.find clears out fields
+      delete source_id_sub_counts;
+      return false;
+    }
+  }
+
+  // JSON export text for a hash and its data
+  // append an integer in host byte order
+  template <typename T>
+  static void append_binary(std::string& binary, const T value) {
+    binary.append(static_cast<const char*>(static_cast<const void*>(&value)),
+                  sizeof(T));
+  }
+
+  // append a string after its uint16_t size
+  static void append_binary_string(std::string& binary,
+                                   const std::string& s) {
+    if (s.size() > 0xffff) {
+      std::cerr << "program error in binary string size " << s.size() << "\n";
+      assert(0);
+    }
+    append_binary(binary, static_cast<uint16_t>(s.size()));
+    binary.append(s);
+  }
+
+  // read an integer in host byte order, false if truncated
+  template <typename T>
+  static bool read_binary(const std::string& binary, size_t& index,
+                          T& value) {
+    if (binary.size() - index < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, binary.data() + index, sizeof(T));
+    index += sizeof(T);
+    return true;
+  }
+
+  // read a string after its uint16_t size, false if truncated
+  static bool read_binary_string(const std::string& binary, size_t& index,
+                                 std::string& s) {
+    uint16_t size;
+    if (!read_binary(binary, index, size) || binary.size() - index < size) {
+      return false;
+    }
+    s.assign(binary, index, size);
+    index += size;
+    return true;
+  }
+
+  std::string hash_binary(
+               const std::string& block_hash,
+               const uint64_t k_entropy,
+               const std::string& block_label,
+               const uint64_t count,
+               const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    std::string binary;
+    binary.reserve(2 + block_hash.size() + 8 + 2 + block_label.size() + 8 +
+                   4 + source_sub_counts.size() * (2 + block_hash.size() + 8));
+    append_binary_string(binary, block_hash);
+    append_binary(binary, k_entropy);
+    append_binary_string(binary, block_label);
+    append_binary(binary, count);
+    append_binary(binary, static_cast<uint32_t>(source_sub_counts.size()));
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+      append_binary_string(binary, it->file_hash);
+      append_binary(binary, it->sub_count);
+    }
+    return binary;
+  }
 
-        // get file_hash from source_id
-        bool source_data_found = lmdb_source_data_manager->find(
-                                it->source_id, file_hash,
-                                filesize, file_type,
-                                zero_count, nonprobative_count);
+  bool read_hash_binary(const std::string& binary,
+                        std::string& block_hash,
+                        uint64_t& k_entropy,
+                        std::string& block_label,
+                        uint64_t& count,
+                        hashdb::source_sub_counts_t& source_sub_counts) {
 
-        // source_data must have a source_id to match the source_id in hash_data
-        if (source_data_found == false) {
-          assert(0);
-        }
+    // clear fields
+    block_hash = "";
+    k_entropy = 0;
+    block_label = "";
+    count = 0;
+    source_sub_counts.clear();
 
-        // add the source sub_counts
-        source_sub_counts.insert(hashdb::source_sub_count_t(file_hash,
-                                                            it->sub_count));
+    size_t index = 0;
+    uint32_t num_sources;
+    if (!read_binary_string(binary, index, block_hash) ||
+        !read_binary(binary, index, k_entropy) ||
+        !read_binary_string(binary, index, block_label) ||
+        !read_binary(binary, index, count) ||
+        !read_binary(binary, index, num_sources)) {
+      return false;
+    }
+    for (uint32_t i=0; i<num_sources; ++i) {
+      std::string file_hash;
+      uint64_t sub_count;
+      if (!read_binary_string(binary, index, file_hash) ||
+          !read_binary(binary, index, sub_count)) {
+        source_sub_counts.clear();
+        return false;
       }
-      delete source_id_sub_counts;
-      return true;
+      source_sub_counts.insert(hashdb::source_sub_count_t(
+                                                   file_hash, sub_count));
+    }
+    return true;
+  }
 
-    } else {
-      // no action, lmdb_hash_data_manager.find clears out fields
-      delete source_id_sub_counts;
-      return false;
+  std::string hash_data_json(
+               const std::string& block_hash,
+               const uint64_t k_entropy,
+               const std::string& block_label,
+               const hashdb::source_sub_counts_t& source_sub_counts) {
+
+    // write JSON
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+
+    // put in hash data
+    json.writer.Key("block_hash");
+    json.hex(block_hash);
+    json.writer.Key("k_entropy");
+    json.writer.Uint64(k_entropy);
+    json.writer.Key("block_label");
+    json.string(block_label);
+
+    // put in source_sub_counts as pairs of file hash, sub_count
+    json.writer.Key("source_sub_counts");
+    json.writer.StartArray();
+    for (hashdb::source_sub_counts_t::const_iterator it =
+         source_sub_counts.begin(); it != source_sub_counts.end(); ++it) {
+
+      // file hash
+      json.hex(it->file_hash);
+
+      // sub_count
+      json.writer.Uint64(it->sub_count);
     }
+    json.writer.EndArray();
+    json.writer.EndObject();
+    return json.text();
   }
 
   // export hash, return result as JSON string
@@ -831,41 +3900,8 @@ namespace hashdb {
 
     std::string json_hash_string;
     if (found_hash) {
-
-      // prepare JSON
-      rapidjson::Document json_doc;
-      rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-      json_doc.SetObject();
-
-      // put in hash data
-      std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-      json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-      json_doc.AddMember("k_entropy", k_entropy, allocator);
-      json_doc.AddMember("block_label", v(block_label, allocator), allocator);
-
-      // put in source_sub_counts as pairs of file hash, sub_count
-      rapidjson::Value json_source_sub_counts(rapidjson::kArrayType);
-
-      for (hashdb::source_sub_counts_t::const_iterator it =
-           source_sub_counts->begin(); it != source_sub_counts->end(); ++it) {
-
-        // file hash
-        json_source_sub_counts.PushBack(
-                   v(hashdb::bin_to_hex(it->file_hash), allocator), allocator);
-
-        // sub_count
-        json_source_sub_counts.PushBack(it->sub_count, allocator);
-
-      }
-      json_doc.AddMember("source_sub_counts", json_source_sub_counts,
-                         allocator);
-
-      // write JSON text
-      rapidjson::StringBuffer strbuf;
-      rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-      json_doc.Accept(writer);
-      json_hash_string = strbuf.GetString();
-
+      json_hash_string = hash_data_json(block_hash, k_entropy,
+                                        block_label, *source_sub_counts);
     } else {
       // not found
       json_hash_string = "";
@@ -891,32 +3927,8 @@ namespace hashdb {
   std::string scan_manager_t::find_hash_count_json(
                                     const std::string& block_hash) const {
 
-    // get count
-    size_t count = find_hash_count(block_hash);
-
-    // no match
-    if (count == 0) {
-      return "";
-    }
-
     // return JSON with count
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
-    // block hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-
-    // count
-    json_doc.AddMember("count", (uint64_t)count, allocator);
-
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    return hash_count_json(block_hash, "count", find_hash_count(block_hash));
   }
 
   size_t scan_manager_t::find_approximate_hash_count(
@@ -933,34 +3945,9 @@ namespace hashdb {
   std::string scan_manager_t::find_approximate_hash_count_json(
                                     const std::string& block_hash) const {
 
-    // get approximate count
-    size_t approximate_count =
-           find_approximate_hash_count(block_hash);
-
-    // no match
-    if (approximate_count == 0) {
-      return "";
-    }
-
     // return JSON with approximate count
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
-    // block hash
-    std::string hex_block_hash = hashdb::bin_to_hex(block_hash);
-    json_doc.AddMember("block_hash", v(hex_block_hash, allocator), allocator);
-
-    // approximate count
-    json_doc.AddMember("approximate_count",
-                                  (uint64_t)approximate_count, allocator);
-
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    return hash_count_json(block_hash, "approximate_count",
+                           find_approximate_hash_count(block_hash));
   }
 
   bool scan_manager_t::find_source_data(
@@ -1023,6 +4010,191 @@ namespace hashdb {
     }
   }
 
+  bool scan_manager_t::find_hashes_by_count(const uint64_t min_count,
+                                 const uint64_t max_count,
+                                 std::vector<std::string>& block_hashes) const {
+    block_hashes.clear();
+    if (lmdb_count_index_manager == NULL ||
+        min_count < lmdb_count_index_manager_t::min_indexed_count) {
+      return false;
+    }
+    lmdb_count_index_manager->find(min_count, max_count, block_hashes);
+    return true;
+  }
+
+  bool scan_manager_t::has_source_hash_index() const {
+    return lmdb_source_hash_manager != NULL;
+  }
+
+  bool scan_manager_t::find_source_hashes(const std::string& file_hash,
+                         std::vector<std::string>& block_hashes) const {
+
+    block_hashes.clear();
+    if (lmdb_source_hash_manager == NULL || file_hash.size() == 0) {
+      return false;
+    }
+
+    // read source_id
+    uint64_t source_id;
+    if (!lmdb_source_id_manager->find(file_hash, source_id)) {
+      return false;
+    }
+    return lmdb_source_hash_manager->find(source_id, block_hashes);
+  }
+
+  // a source found similar to a signature
+  struct similar_source_t {
+    double similarity;
+    std::string file_hash;
+    similar_source_t(const double p_similarity,
+                     const std::string& p_file_hash) :
+            similarity(p_similarity), file_hash(p_file_hash) {
+    }
+    // most similar first
+    bool operator<(const similar_source_t& other) const {
+      if (similarity > other.similarity) {
+        return true;
+      }
+      if (similarity < other.similarity) {
+        return false;
+      }
+      return file_hash < other.file_hash;
+    }
+  };
+
+  // the JSON text of the sources similar to a signature, excluding
+  // the source with exclude_id
+  static std::string similar_sources_json(
+                 const lmdb_source_signature_manager_t& signature_manager,
+                 const lmdb_source_data_manager_t& source_data_manager,
+                 const hashdb::source_signature_t& signature,
+                 const uint64_t exclude_id,
+                 const size_t max_sources) {
+
+    std::set<uint64_t> source_ids;
+    signature_manager.find_candidates(signature, source_ids);
+
+    // score the candidates
+    std::vector<similar_source_t> similar;
+    for (std::set<uint64_t>::const_iterator it = source_ids.begin();
+         it != source_ids.end(); ++it) {
+      hashdb::source_signature_t candidate;
+      if (*it == exclude_id || !signature_manager.find(*it, candidate)) {
+        continue;
+      }
+      std::string file_hash;
+      uint64_t filesize;
+      std::string file_type;
+      uint64_t zero_count;
+      uint64_t nonprobative_count;
+      if (!source_data_manager.find(*it, file_hash, filesize, file_type,
+                                    zero_count, nonprobative_count)) {
+        continue;
+      }
+      similar.push_back(similar_source_t(signature.similarity(candidate),
+                                         file_hash));
+    }
+    std::sort(similar.begin(), similar.end());
+    if (max_sources != 0 && similar.size() > max_sources) {
+      similar.erase(similar.begin() + max_sources, similar.end());
+    }
+
+    std::stringstream ss;
+    ss << "[";
+    for (size_t i=0; i<similar.size(); ++i) {
+      if (i != 0) {
+        ss << ",";
+      }
+      ss << "{\"file_hash\":\"" << hashdb::bin_to_hex(similar[i].file_hash)
+         << "\",\"similarity\":" << std::fixed << std::setprecision(3)
+         << similar[i].similarity << "}";
+    }
+    ss << "]";
+    return ss.str();
+  }
+
+  std::string scan_manager_t::find_similar_sources_json(
+                          const std::vector<std::string>& block_hashes,
+                          const size_t max_sources) const {
+
+    if (lmdb_source_signature_manager == NULL || block_hashes.size() == 0) {
+      return "[]";
+    }
+    hashdb::source_signature_t signature;
+    for (size_t i=0; i<block_hashes.size(); ++i) {
+      signature.add(block_hashes[i]);
+    }
+    return similar_sources_json(*lmdb_source_signature_manager,
+                                *lmdb_source_data_manager, signature,
+                                0, max_sources);
+  }
+
+  bool scan_manager_t::has_similarity_index() const {
+    return lmdb_source_signature_manager != NULL;
+  }
+
+  std::string scan_manager_t::find_similar_to_source_json(
+                          const std::string& file_hash,
+                          const size_t max_sources) const {
+
+    if (lmdb_source_signature_manager == NULL || file_hash.size() == 0) {
+      return "[]";
+    }
+
+    // read source_id and its signature
+    uint64_t source_id;
+    hashdb::source_signature_t signature;
+    if (!lmdb_source_id_manager->find(file_hash, source_id) ||
+        !lmdb_source_signature_manager->find(source_id, signature)) {
+      return "[]";
+    }
+    return similar_sources_json(*lmdb_source_signature_manager,
+                                *lmdb_source_data_manager, signature,
+                                source_id, max_sources);
+  }
+
+  // the JSON text of a source
+  static std::string source_data_json(const std::string& file_hash,
+                                      const uint64_t filesize,
+                                      const std::string& file_type,
+                                      const uint64_t zero_count,
+                                      const uint64_t nonprobative_count,
+                                      const source_names_t& source_names) {
+
+    // write JSON
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+
+    // set source data
+    json.writer.Key("file_hash");
+    json.hex(file_hash);
+    json.writer.Key("filesize");
+    json.writer.Uint64(filesize);
+    json.writer.Key("file_type");
+    json.string(file_type);
+    json.writer.Key("zero_count");
+    json.writer.Uint64(zero_count);
+    json.writer.Key("nonprobative_count");
+    json.writer.Uint64(nonprobative_count);
+
+    // name_pairs array
+    json.writer.Key("name_pairs");
+    json.writer.StartArray();
+
+    // provide names
+    for (hashdb::source_names_t::const_iterator it = source_names.begin();
+         it != source_names.end(); ++it) {
+      // repository name
+      json.string(it->first);
+      // filename
+      json.string(it->second);
+    }
+    json.writer.EndArray();
+    json.writer.EndObject();
+
+    return json.text();
+  }
+
   // export source, return result as JSON string
   std::string scan_manager_t::export_source_json(
                                const std::string& file_hash) const {
@@ -1033,11 +4205,6 @@ namespace hashdb {
     uint64_t zero_count;
     uint64_t nonprobative_count;
 
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-
     // get source data
     bool has_source_data = find_source_data(file_hash, filesize,
                                  file_type, zero_count, nonprobative_count);
@@ -1047,39 +4214,18 @@ namespace hashdb {
 
     // source found
 
-    // set source data
-    std::string hex_file_hash = hashdb::bin_to_hex(file_hash);
-    json_doc.AddMember("file_hash", v(hex_file_hash, allocator), allocator);
-    json_doc.AddMember("filesize", filesize, allocator);
-    json_doc.AddMember("file_type", v(file_type, allocator), allocator);
-    json_doc.AddMember("zero_count", zero_count, allocator);
-    json_doc.AddMember("nonprobative_count", nonprobative_count, allocator);
-
     // get source names
     hashdb::source_names_t* source_names = new hashdb::source_names_t;
     find_source_names(file_hash, *source_names);
 
-    // name_pairs object
-    rapidjson::Value json_name_pairs(rapidjson::kArrayType);
-
-    // provide names
-    for (hashdb::source_names_t::const_iterator it = source_names->begin();
-         it != source_names->end(); ++it) {
-      // repository name
-      json_name_pairs.PushBack(v(it->first, allocator), allocator);
-      // filename
-      json_name_pairs.PushBack(v(it->second, allocator), allocator);
-    }
-    json_doc.AddMember("name_pairs", json_name_pairs, allocator);
+    const std::string json_source_string = source_data_json(file_hash,
+                 filesize, file_type, zero_count, nonprobative_count,
+                 *source_names);
 
     // done with source names
     delete source_names;
 
-    // write JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    return json_source_string;
   }
 
   std::string scan_manager_t::first_hash() const {
@@ -1117,6 +4263,16 @@ namespace hashdb {
     return ss.str();
   }
 
+  void scan_manager_t::hash_histogram(uint64_t& total_hashes,
+                        uint64_t& total_distinct_hashes,
+                        std::map<uint64_t, uint64_t>& histogram) const {
+    hashdb::hash_stats_t stats(0, 0);
+    lmdb_hash_data_manager->find_stats(stats);
+    total_hashes = stats.total_hashes;
+    total_distinct_hashes = stats.total_distinct_hashes;
+    histogram = stats.histogram;
+  }
+
   size_t scan_manager_t::size_hashes() const {
     return lmdb_hash_data_manager->size();
   }
@@ -1125,6 +4281,366 @@ namespace hashdb {
     return lmdb_source_id_manager->size();
   }
 
+  // one range of a parallel scan
+  struct hash_range_scan_t {
+    const scan_manager_t* scan_manager;
+    size_t range;
+    std::string begin_block_hash;
+    std::string end_block_hash;
+    hash_range_callback_t callback;
+    void* data;
+    hash_range_scan_t() : scan_manager(NULL), range(0), begin_block_hash(),
+                          end_block_hash(), callback(NULL), data(NULL) {
+    }
+
+    private:
+    // do not allow copy or assignment
+    hash_range_scan_t(const hash_range_scan_t&);
+    hash_range_scan_t& operator=(const hash_range_scan_t&);
+  };
+
+  // the ranges of a parallel scan, taken in order by the scan threads
+  struct hash_range_scans_t {
+    std::vector<hash_range_scan_t*> range_scans;
+    size_t next_range;
+    mutable pthread_mutex_t M;
+    hash_range_scans_t() : range_scans(), next_range(0), M() {
+      MUTEX_INIT(&M);
+    }
+    ~hash_range_scans_t() {
+      for (size_t i=0; i<range_scans.size(); ++i) {
+        delete range_scans[i];
+      }
+      MUTEX_DESTROY(&M);
+    }
+
+    // the next range to walk or NULL when all are taken
+    hash_range_scan_t* take() {
+      MUTEX_LOCK(&M);
+      hash_range_scan_t* const range_scan =
+                      (next_range < range_scans.size()) ?
+                      range_scans[next_range++] : NULL;
+      MUTEX_UNLOCK(&M);
+      return range_scan;
+    }
+
+    private:
+    // do not allow copy or assignment
+    hash_range_scans_t(const hash_range_scans_t&);
+    hash_range_scans_t& operator=(const hash_range_scans_t&);
+  };
+
+  // the hash that begins range number range of num_ranges, from the
+  // leading 32 bits of the hash space, or "" for the start
+  static std::string range_begin_hash(const size_t range,
+                                      const size_t num_ranges) {
+    if (range == 0) {
+      return "";
+    }
+    const uint64_t prefix = (static_cast<uint64_t>(range) << 32) / num_ranges;
+    std::string begin_block_hash(4, '\0');
+    for (size_t i=0; i<4; ++i) {
+      begin_block_hash[i] = static_cast<char>((prefix >> (24 - 8*i)) & 0xff);
+    }
+    return begin_block_hash;
+  }
+
+  // walk ranges until all are taken
+  static void* run_hash_range_scans(void* const arg) {
+    hash_range_scans_t* const range_scans =
+                                 static_cast<hash_range_scans_t*>(arg);
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t count;
+    source_sub_counts_t* source_sub_counts = new source_sub_counts_t;
+    hash_range_scan_t* range_scan;
+    while ((range_scan = range_scans->take()) != NULL) {
+      hash_iterator_t hash_iterator(*range_scan->scan_manager,
+                range_scan->begin_block_hash, range_scan->end_block_hash);
+      while (hash_iterator.next(block_hash, k_entropy, block_label, count,
+                                *source_sub_counts)) {
+        range_scan->callback(range_scan->data, range_scan->range, block_hash,
+                             k_entropy, block_label, count,
+                             *source_sub_counts);
+      }
+    }
+    delete source_sub_counts;
+    return NULL;
+  }
+
+  void scan_manager_t::scan_ranges(const size_t num_ranges,
+                                   hash_range_callback_t callback,
+                                   void* const data) const {
+    scan_ranges(num_ranges, num_ranges, callback, data);
+  }
+
+  void scan_manager_t::scan_ranges(const size_t num_ranges,
+                                   const size_t num_threads,
+                                   hash_range_callback_t callback,
+                                   void* const data) const {
+    if (num_ranges == 0 || num_ranges > (static_cast<uint64_t>(1) << 32)) {
+      std::cerr << "Usage error: invalid number of scan ranges "
+                << num_ranges << "\n";
+      assert(0);
+    }
+    if (num_threads == 0) {
+      std::cerr << "Usage error: invalid number of scan threads 0\n";
+      assert(0);
+    }
+
+    // the ranges
+    hash_range_scans_t range_scans;
+    for (size_t i=0; i<num_ranges; ++i) {
+      hash_range_scan_t* const range_scan = new hash_range_scan_t;
+      range_scan->scan_manager = this;
+      range_scan->range = i;
+      range_scan->begin_block_hash = range_begin_hash(i, num_ranges);
+      range_scan->end_block_hash = (i + 1 == num_ranges) ? "" :
+                                   range_begin_hash(i + 1, num_ranges);
+      range_scan->callback = callback;
+      range_scan->data = data;
+      range_scans.range_scans.push_back(range_scan);
+    }
+
+    // walk the ranges concurrently, the first thread in this thread
+    const size_t thread_count = std::min(num_threads, num_ranges);
+    std::vector<pthread_t> threads(thread_count);
+    for (size_t i=1; i<thread_count; ++i) {
+      if (pthread_create(&threads[i], NULL, run_hash_range_scans,
+                         &range_scans)) {
+        std::cerr << "Error creating hash range scan thread.\n";
+        assert(0);
+      }
+    }
+    run_hash_range_scans(&range_scans);
+    for (size_t i=1; i<thread_count; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+
+  // ************************************************************
+  // hash iterator
+  // ************************************************************
+  // ************************************************************
+  // repository filter
+  // ************************************************************
+  repository_filter_t::repository_filter_t(
+                         const scan_manager_t& p_scan_manager,
+                         const std::string& repository_name) :
+          scan_manager(p_scan_manager),
+          available(scan_manager.lmdb_repository_manager->is_available()),
+          repository_ids(new source_id_bitmap_t),
+          other_ids(new source_id_bitmap_t) {
+    if (!available) {
+      return;
+    }
+    const lmdb_repository_manager_t& manager =
+                                   *scan_manager.lmdb_repository_manager;
+    manager.find(repository_name, *repository_ids);
+    const std::vector<std::string> names = manager.repository_names();
+    source_id_bitmap_t ids;
+    for (std::vector<std::string>::const_iterator it = names.begin();
+         it != names.end(); ++it) {
+      if (*it != repository_name) {
+        manager.find(*it, ids);
+        other_ids->unite(ids);
+      }
+    }
+  }
+
+  repository_filter_t::~repository_filter_t() {
+    delete repository_ids;
+    delete other_ids;
+  }
+
+  bool repository_filter_t::is_available() const {
+    return available;
+  }
+
+  void repository_filter_t::classify(const std::string& file_hash,
+                                     bool& in_repository,
+                                     bool& in_other) const {
+    uint64_t source_id;
+    if (file_hash.size() == 0 ||
+        !scan_manager.lmdb_source_id_manager->find(file_hash, source_id)) {
+      in_repository = false;
+      in_other = false;
+      return;
+    }
+    in_repository = repository_ids->contains(source_id);
+    in_other = other_ids->contains(source_id);
+  }
+
+  // ************************************************************
+  // hash iterator
+  // ************************************************************
+  hash_iterator_t::hash_iterator_t(const scan_manager_t& p_scan_manager) :
+          scan_manager(p_scan_manager),
+          cursor(new lmdb_hash_data_cursor_t(
+                                *p_scan_manager.lmdb_hash_data_manager)),
+          source_id_cache(new source_id_cache_t) {
+  }
+
+  hash_iterator_t::hash_iterator_t(const scan_manager_t& p_scan_manager,
+                                   const std::string& begin_block_hash,
+                                   const std::string& end_block_hash) :
+          scan_manager(p_scan_manager),
+          cursor(new lmdb_hash_data_cursor_t(
+                                *p_scan_manager.lmdb_hash_data_manager,
+                                begin_block_hash, end_block_hash)),
+          source_id_cache(new source_id_cache_t) {
+  }
+
+  hash_iterator_t::~hash_iterator_t() {
+    delete cursor;
+    delete source_id_cache;
+  }
+
+  bool hash_iterator_t::next(std::string& block_hash,
+                             uint64_t& k_entropy,
+                             std::string& block_label,
+                             uint64_t& count,
+                             source_sub_counts_t& source_sub_counts) {
+
+    source_sub_counts.clear();
+    const bool has_next = cursor->next(block_hash, k_entropy, block_label,
+                          count, source_id_cache->source_id_sub_counts);
+    if (has_next) {
+      source_id_cache->to_source_sub_counts(
+                    *scan_manager.lmdb_source_data_manager, source_sub_counts);
+    }
+    return has_next;
+  }
+
+  std::string hash_iterator_t::next_json() {
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t unused_count;
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                new hashdb::source_sub_counts_t;
+    std::string json_hash_string;
+    if (next(block_hash, k_entropy, block_label, unused_count,
+             *source_sub_counts)) {
+      json_hash_string = hash_data_json(block_hash, k_entropy,
+                                        block_label, *source_sub_counts);
+    }
+    delete source_sub_counts;
+    return json_hash_string;
+  }
+
+  std::vector<std::string> hash_iterator_t::next_json_chunk(
+                                              const size_t max_count) {
+    std::vector<std::string> json_hashes;
+    std::string block_hash;
+    uint64_t k_entropy;
+    std::string block_label;
+    uint64_t unused_count;
+    hashdb::source_sub_counts_t* source_sub_counts =
+                                new hashdb::source_sub_counts_t;
+    while (json_hashes.size() < max_count &&
+           next(block_hash, k_entropy, block_label, unused_count,
+                *source_sub_counts)) {
+      json_hashes.push_back(hash_data_json(block_hash, k_entropy,
+                                           block_label, *source_sub_counts));
+    }
+    delete source_sub_counts;
+    return json_hashes;
+  }
+
+  // ************************************************************
+  // source iterator
+  // ************************************************************
+  // the sources read by one step of a source walk
+  static const size_t source_batch_size = 16384;
+
+  class source_batch_t {
+    public:
+    std::vector<std::string> file_hashes;
+    std::vector<uint64_t> source_ids;
+    source_data_entries_t source_data;
+    std::vector<source_names_t> source_names;
+    size_t next;      // the next source to return
+    bool at_end;      // the source ID store has no more
+    source_batch_t() : file_hashes(), source_ids(), source_data(),
+                       source_names(), next(0), at_end(false) {
+    }
+  };
+
+  source_iterator_t::source_iterator_t(const scan_manager_t& p_scan_manager) :
+          scan_manager(p_scan_manager),
+          batch(new source_batch_t) {
+  }
+
+  source_iterator_t::~source_iterator_t() {
+    delete batch;
+  }
+
+  bool source_iterator_t::next(std::string& file_hash,
+                               uint64_t& filesize,
+                               std::string& file_type,
+                               uint64_t& zero_count,
+                               uint64_t& nonprobative_count,
+                               source_names_t& source_names) {
+
+    // read the next batch of sources in file hash order then join their
+    // data and names, each read in source ID key order
+    if (batch->next == batch->file_hashes.size() && !batch->at_end) {
+      const std::string last_file_hash = (batch->file_hashes.size() == 0) ?
+                                      "" : batch->file_hashes.back();
+      batch->at_end = !scan_manager.lmdb_source_id_manager->read_batch(
+                      last_file_hash, source_batch_size,
+                      batch->file_hashes, batch->source_ids);
+      batch->next = 0;
+      batch->source_data.resize(batch->source_ids.size());
+      for (size_t i=0; i<batch->source_ids.size(); ++i) {
+        batch->source_data[i].source_id = batch->source_ids[i];
+      }
+      scan_manager.lmdb_source_data_manager->find_batch(batch->source_data);
+      scan_manager.lmdb_source_name_manager->find_batch(batch->source_ids,
+                                                        batch->source_names);
+    }
+
+    if (batch->next == batch->file_hashes.size()) {
+      // at end
+      file_hash = "";
+      filesize = 0;
+      file_type = "";
+      zero_count = 0;
+      nonprobative_count = 0;
+      source_names.clear();
+      return false;
+    }
+
+    const size_t i = batch->next++;
+    const source_data_entry_t& entry = batch->source_data[i];
+    file_hash = batch->file_hashes[i];
+    filesize = entry.filesize;
+    file_type = entry.file_type;
+    zero_count = entry.zero_count;
+    nonprobative_count = entry.nonprobative_count;
+    source_names.swap(batch->source_names[i]);
+    return true;
+  }
+
+  std::string source_iterator_t::next_json() {
+    std::string file_hash;
+    uint64_t filesize;
+    std::string file_type;
+    uint64_t zero_count;
+    uint64_t nonprobative_count;
+    hashdb::source_names_t* source_names = new hashdb::source_names_t;
+    std::string json_source_string;
+    if (next(file_hash, filesize, file_type, zero_count, nonprobative_count,
+             *source_names)) {
+      json_source_string = source_data_json(file_hash, filesize, file_type,
+                           zero_count, nonprobative_count, *source_names);
+    }
+    delete source_names;
+    return json_source_string;
+  }
+
   // ************************************************************
   // timestamp
   // ************************************************************
@@ -1175,20 +4691,16 @@ namespace hashdb {
     snprintf(total_time, 16, "%d.%06d", (int)t.tv_sec, (int)t.tv_usec);
 
     // return the named timestamp
-    // prepare JSON
-    rapidjson::Document json_doc;
-    rapidjson::Document::AllocatorType& allocator = json_doc.GetAllocator();
-    json_doc.SetObject();
-    json_doc.AddMember("name", v(name, allocator), allocator);
-    json_doc.AddMember("delta", v(std::string(delta), allocator), allocator);
-    json_doc.AddMember("total", v(std::string(total_time), allocator),
-                                                                  allocator);
-
-    // copy JSON text
-    rapidjson::StringBuffer strbuf;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-    json_doc.Accept(writer);
-    return strbuf.GetString();
+    THREAD_JSON_WRITER(json);
+    json.writer.StartObject();
+    json.writer.Key("name");
+    json.string(name);
+    json.writer.Key("delta");
+    json.writer.String(delta);
+    json.writer.Key("total");
+    json.writer.String(total_time);
+    json.writer.EndObject();
+    return json.text();
   }
 }
 
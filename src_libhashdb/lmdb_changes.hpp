@@ -44,11 +44,13 @@ class lmdb_changes_t {
   size_t hash_data_merged_same;
   size_t hash_data_mismatched_data_detected;
   size_t hash_data_mismatched_sub_count_detected;
+  size_t hash_data_removed;
 
   // hash
   size_t hash_inserted;
   size_t hash_count_changed;
   size_t hash_count_not_changed;
+  size_t hash_removed;
 
   // source_data
   size_t source_data_inserted;
@@ -58,6 +60,7 @@ class lmdb_changes_t {
   // source_id
   size_t source_id_inserted;
   size_t source_id_already_present;
+  size_t source_id_removed;
 
   // source_name
   size_t source_name_inserted;
@@ -69,18 +72,46 @@ class lmdb_changes_t {
             hash_data_merged_same(0),
             hash_data_mismatched_data_detected(0),
             hash_data_mismatched_sub_count_detected(0),
+            hash_data_removed(0),
             hash_inserted(0),
             hash_count_changed(0),
             hash_count_not_changed(0),
+            hash_removed(0),
             source_data_inserted(0),
             source_data_changed(0),
             source_data_same(0),
             source_id_inserted(0),
             source_id_already_present(0),
+            source_id_removed(0),
             source_name_inserted(0),
             source_name_already_present(0) {
   }
 
+  // add the changes counted elsewhere, for example for one shard
+  lmdb_changes_t& operator+=(const lmdb_changes_t& other) {
+    hash_data_inserted += other.hash_data_inserted;
+    hash_data_merged += other.hash_data_merged;
+    hash_data_merged_same += other.hash_data_merged_same;
+    hash_data_mismatched_data_detected +=
+                       other.hash_data_mismatched_data_detected;
+    hash_data_mismatched_sub_count_detected +=
+                       other.hash_data_mismatched_sub_count_detected;
+    hash_data_removed += other.hash_data_removed;
+    hash_inserted += other.hash_inserted;
+    hash_count_changed += other.hash_count_changed;
+    hash_count_not_changed += other.hash_count_not_changed;
+    hash_removed += other.hash_removed;
+    source_data_inserted += other.source_data_inserted;
+    source_data_changed += other.source_data_changed;
+    source_data_same += other.source_data_same;
+    source_id_inserted += other.source_id_inserted;
+    source_id_already_present += other.source_id_already_present;
+    source_id_removed += other.source_id_removed;
+    source_name_inserted += other.source_name_inserted;
+    source_name_already_present += other.source_name_already_present;
+    return *this;
+  }
+
   void report_changes(std::ostream& os) const {
 
     os << "# hashdb changes:\n";
@@ -105,6 +136,9 @@ class lmdb_changes_t {
       os << "#     hash_data_mismatched_sub_count_detected: "
          << hash_data_mismatched_sub_count_detected << "\n";
     }
+    if (hash_data_removed) {
+      os << "#     hash_data_removed: " << hash_data_removed << "\n";
+    }
     if (hash_inserted) {
       os << "#     hash_inserted: " << hash_inserted<< "\n";
     }
@@ -114,6 +148,9 @@ class lmdb_changes_t {
     if (hash_count_not_changed) {
       os << "#     hash_count_not_changed: " << hash_count_not_changed<< "\n";
     }
+    if (hash_removed) {
+      os << "#     hash_removed: " << hash_removed << "\n";
+    }
     if (source_data_inserted) {
       os << "#     source_data_inserted: " << source_data_inserted << "\n";
     }
@@ -129,6 +166,9 @@ class lmdb_changes_t {
     if (source_id_already_present) {
       os << "#     source_id_already_present: " << source_id_already_present << "\n";
     }
+    if (source_id_removed) {
+      os << "#     source_id_removed: " << source_id_removed << "\n";
+    }
     if (source_name_inserted) {
       os << "#     source_name_inserted: " << source_name_inserted << "\n";
     }
@@ -140,14 +180,17 @@ class lmdb_changes_t {
         hash_data_merged_same == 0 &&
         hash_data_mismatched_data_detected == 0 &&
         hash_data_mismatched_sub_count_detected == 0 &&
+        hash_data_removed == 0 &&
         hash_inserted == 0 &&
         hash_count_changed == 0 &&
         hash_count_not_changed == 0 &&
+        hash_removed == 0 &&
         source_data_inserted == 0 &&
         source_data_changed == 0 &&
         source_data_same == 0 &&
         source_id_inserted == 0 &&
         source_id_already_present == 0 &&
+        source_id_removed == 0 &&
         source_name_inserted == 0 &&
         source_name_already_present == 0) {
        os << "No changes.\n";
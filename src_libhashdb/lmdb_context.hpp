@@ -22,11 +22,21 @@
  * Provides a working context for accessing a LMDB DB.
  *
  * A context must be opened then closed exactly once.
+ *
+ * A read-only context given a read txn cache uses this thread's cached
+ * read txn and cursor when available rather than opening its own.
+ *
+ * A context on a split store, see lmdb_helper::dbis_t, uses the open
+ * records database and also has a cursor on the dupfixed database.
  */
 
 #ifndef LMDB_CONTEXT_HPP
 #define LMDB_CONTEXT_HPP
 #include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_read_txn_cache.hpp"
+#include "stage_stats.hpp"
+#include "probes.hpp"
 
 namespace hashdb {
   class lmdb_context_t {
@@ -35,6 +45,9 @@ namespace hashdb {
     unsigned int txn_flags; // example MDB_RDONLY
     unsigned int dbi_flags; // example MDB_DUPSORT
     int state;
+    lmdb_read_txn_cache_t* read_txn_cache;
+    lmdb_read_txn_t* read_txn; // taken from read_txn_cache, or NULL
+    const lmdb_helper::dbis_t* dbis; // of a split store, or NULL
 
     // do not allow copy or assignment
     lmdb_context_t(const lmdb_context_t&);
@@ -44,12 +57,17 @@ namespace hashdb {
     MDB_txn* txn;
     MDB_dbi dbi;
     MDB_cursor* cursor;
+    MDB_cursor* dupfixed_cursor; // on the dupfixed database, or NULL
     MDB_val key;
     MDB_val data;
 
-    lmdb_context_t(MDB_env* p_env, bool is_writable, bool is_duplicates) :
+    lmdb_context_t(MDB_env* p_env, bool is_writable, bool is_duplicates,
+                   lmdb_read_txn_cache_t* const p_read_txn_cache = NULL,
+                   const lmdb_helper::dbis_t* const p_dbis = NULL) :
            env(p_env), txn_flags(0), dbi_flags(0),
-           state(0), txn(0), dbi(0), cursor(0), key(), data() {
+           state(0), read_txn_cache(p_read_txn_cache), read_txn(0),
+           dbis((p_dbis != NULL && p_dbis->is_split) ? p_dbis : NULL),
+           txn(0), dbi(0), cursor(0), dupfixed_cursor(0), key(), data() {
 
       // set flags based on bool inputs
       if (is_writable) {
@@ -75,15 +93,34 @@ namespace hashdb {
         assert(0);
       }
 
+      // use this thread's cached read txn if available
+      if (read_txn_cache != NULL && (txn_flags & MDB_RDONLY) == MDB_RDONLY) {
+        read_txn = read_txn_cache->take();
+        if (read_txn != NULL) {
+          txn = read_txn->txn;
+          dbi = read_txn->dbi;
+          cursor = read_txn->cursor;
+          dupfixed_cursor = read_txn->dupfixed_cursor;
+          return;
+        }
+      }
+
       // create txn object
+      HASHDB_PROBE2(txn_begin, env,
+                    static_cast<int>((txn_flags & MDB_RDONLY) != 0));
       int rc = mdb_txn_begin(env, NULL, txn_flags, &txn);
       if (rc != 0) {
-        std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
-        assert(0);
+        lmdb_helper::txn_begin_error(env, rc);
       }
 
-      // create the database handle integer
-      rc = mdb_dbi_open(txn, NULL, dbi_flags, &dbi);
+      // create the database handle integer, or use the open databases
+      // of a split store
+      if (dbis != NULL) {
+        dbi = dbis->dbi;
+        rc = mdb_cursor_open(txn, dbis->dupfixed_dbi, &dupfixed_cursor);
+      } else {
+        rc = mdb_dbi_open(txn, NULL, dbi_flags, &dbi);
+      }
       if (rc != 0) {
         std::cerr << "LMDB dbi error: " << mdb_strerror(rc) << "\n";
         assert(0);
@@ -102,8 +139,18 @@ namespace hashdb {
         assert(0);
       }
 
-      // free cursor
+      // give back the cached read txn
+      if (read_txn != NULL) {
+        read_txn_cache->give_back(read_txn);
+        read_txn = NULL;
+        return;
+      }
+
+      // free cursors
       mdb_cursor_close(cursor);
+      if (dupfixed_cursor != NULL) {
+        mdb_cursor_close(dupfixed_cursor);
+      }
 
       // do not close dbi handle, why not close it?
 
@@ -111,11 +158,14 @@ namespace hashdb {
       if ((txn_flags & MDB_RDONLY) != MDB_RDONLY) {
 
         // RW
+        stage_timer_t timer(STAGE_COMMIT);
+        HASHDB_PROBE1(txn_commit, env);
         int rc = mdb_txn_commit(txn);
         if (rc != 0) {
           std::cerr << "LMDB txn commit error: " << mdb_strerror(rc) << "\n";
           assert(0);
         }
+        HASHDB_PROBE1(txn_committed, env);
 
       } else {
         // RO
@@ -0,0 +1,283 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Manage the optional LMDB count index store, a secondary index from
+ * each hash count to the block hashes that have it.  Counts are keyed
+ * big-endian so that the hashes in a count range are read in count order
+ * from one cursor position, and block hashes are the sorted duplicate
+ * values of their count.  Only hashes seen at least min_indexed_count
+ * times are indexed, so the index stays small while most hashes are
+ * seen once.  Count changes are kept in memory and written in batches.
+ * Threadsafe.
+ */
+
+#ifndef LMDB_COUNT_INDEX_MANAGER_HPP
+#define LMDB_COUNT_INDEX_MANAGER_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_context.hpp"
+#include <vector>
+#include <map>
+#include <iostream>
+#include <string>
+#include <cassert>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class lmdb_count_index_manager_t {
+
+  public:
+  // the smallest count that is indexed
+  static const uint64_t min_indexed_count = 2;
+
+  private:
+  // the indexed count a hash had before and has after its pending
+  // changes, 0 if not indexed
+  typedef std::pair<uint64_t, uint64_t> count_change_t;
+
+  // the number of changed hashes kept before writing them
+  static const size_t max_pending = 16384;
+
+  // conservative number of new LMDB pages one pending change may consume
+  static const size_t pages_per_change = 2;
+
+  MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+  std::map<std::string, count_change_t> pending; // changes not yet written
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_count_index_manager_t(const lmdb_count_index_manager_t&);
+  lmdb_count_index_manager_t& operator=(const lmdb_count_index_manager_t&);
+
+  static uint64_t indexed_count(const uint64_t count) {
+    return (count >= min_indexed_count) ? count : 0;
+  }
+
+  static void encode_count(const uint64_t count, uint8_t* const key) {
+    for (size_t i=0; i<8; ++i) {
+      key[i] = static_cast<uint8_t>(count >> (56 - 8 * i));
+    }
+  }
+
+  static uint64_t decode_count(const uint8_t* const key) {
+    uint64_t count = 0;
+    for (size_t i=0; i<8; ++i) {
+      count = (count << 8) | key[i];
+    }
+    return count;
+  }
+
+  // write the pending changes, call while locked
+  void write_pending() {
+    if (pending.size() == 0) {
+      return;
+    }
+
+    // maybe grow the DB with room for every change since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + pending.size() * pages_per_change);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+
+    uint8_t key[8];
+    for (std::map<std::string, count_change_t>::const_iterator it =
+         pending.begin(); it != pending.end(); ++it) {
+      const uint64_t old_count = it->second.first;
+      const uint64_t new_count = it->second.second;
+      if (old_count == new_count) {
+        continue;
+      }
+
+      // key=count, data=block_hash
+      context.key.mv_size = sizeof(key);
+      context.key.mv_data = key;
+      if (old_count != 0) {
+        encode_count(old_count, key);
+        context.data.mv_size = it->first.size();
+        context.data.mv_data = const_cast<char*>(it->first.data());
+        int rc = mdb_del(context.txn, context.dbi, &context.key,
+                         &context.data);
+        if (rc != 0 && rc != MDB_NOTFOUND) {
+          // invalid rc
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+      }
+      if (new_count != 0) {
+        encode_count(new_count, key);
+        context.data.mv_size = it->first.size();
+        context.data.mv_data = const_cast<char*>(it->first.data());
+        int rc = mdb_put(context.txn, context.dbi,
+                         &context.key, &context.data, MDB_NODUPDATA);
+        if (rc != 0 && rc != MDB_KEYEXIST) {
+          // invalid rc
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+      }
+    }
+
+    context.close();
+    pending.clear();
+  }
+
+  public:
+  lmdb_count_index_manager_t(const std::string& hashdb_dir,
+                      const hashdb::file_mode_type_t file_mode,
+                      const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_count_index_store",
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, true,
+                             policy.max_snapshot_ms) : NULL),
+       pending(),
+       M() {
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_count_index_manager_t() {
+    flush();
+
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    lmdb_helper::close_env(env);
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
+  /**
+   * Move the block hash from its old count to its new count, where a
+   * count of 0 means the hash is not there.
+   */
+  void change(const std::string& block_hash, const uint64_t old_count,
+              const uint64_t new_count) {
+    if (indexed_count(old_count) == indexed_count(new_count)) {
+      return;
+    }
+    MUTEX_LOCK(&M);
+    std::map<std::string, count_change_t>::iterator it =
+                                              pending.find(block_hash);
+    if (it == pending.end()) {
+      pending[block_hash] = count_change_t(indexed_count(old_count),
+                                           indexed_count(new_count));
+    } else {
+      it->second.second = indexed_count(new_count);
+    }
+    if (pending.size() >= max_pending) {
+      write_pending();
+    }
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Read the block hashes whose count is from min_count through
+   * max_count, or with no upper bound when max_count is 0, in count then
+   * hash order.  min_count must be at least min_indexed_count.
+   */
+  void find(const uint64_t min_count, const uint64_t max_count,
+            std::vector<std::string>& block_hashes) const {
+
+    block_hashes.clear();
+    assert(min_count >= min_indexed_count);
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+
+    // set key
+    uint8_t key[8];
+    encode_count(min_count, key);
+    context.key.mv_size = sizeof(key);
+    context.key.mv_data = key;
+    context.data.mv_size = 0;
+    context.data.mv_data = NULL;
+
+    // read the hashes of each count in range
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+    while (rc == 0) {
+      if (context.key.mv_size != sizeof(key)) {
+        std::cerr << "corrupted DB\n";
+        assert(0);
+      }
+      const uint64_t count = decode_count(
+                           static_cast<uint8_t*>(context.key.mv_data));
+      if (max_count != 0 && count > max_count) {
+        break;
+      }
+      block_hashes.push_back(std::string(
+                         static_cast<char*>(context.data.mv_data),
+                         context.data.mv_size));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+  }
+
+  // write the pending changes then sync to disk if the sync policy is
+  // flush or force is set
+  void flush(const bool force = false) {
+    MUTEX_LOCK(&M);
+    write_pending();
+    MUTEX_UNLOCK(&M);
+    lmdb_helper::flush_env(env, force);
+  }
+
+  // call this from a lock to prevent getting an unstable answer.
+  size_t size() const {
+    return lmdb_helper::size(env);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -34,11 +34,39 @@
  * Type 3: remaining lines of multi-entry hash:
  *         source_id, 2-byte sub_count up to 65535, clip, do not wrap.
  *
+ * These records use varints in the original format.  In the fixed format,
+ * selected by settings_t::hash_data_format, numbers are at fixed offsets
+ * so that they are read in place without decoding, see
+ * lmdb_hash_data_support.cpp.  Fixed format source IDs, entropy, and
+ * counts are 4 bytes.  A fixed format Type 1 record holds up to
+ * max_type1_sources sources inline so that small source lists are read
+ * without walking duplicate records.  Adding one more source promotes
+ * the Type 1 record to a Type 2 record followed by Type 3 records.
+ *
+ * The dupfixed format is the fixed format with Type 3 records kept apart
+ * in a MDB_DUPFIXED database of the store, see lmdb_helper::dbis_t,
+ * where they are 6 bytes and sorted by source_id.  The source list of a
+ * Type 2 record is then copied out a page at a time using
+ * MDB_GET_MULTIPLE rather than read a record at a time, and the Type 3
+ * record of a source is found by seeking rather than by walking.
+ *
+ * The store may be partitioned by hash prefix into shards that are
+ * written concurrently, see lmdb_shard.hpp.
+ *
+ * When READ_ONLY on a frozen hashdb the hashes are read from the frozen
+ * hash store instead, see frozen_hash_store.hpp.
+ *
  * NOTES:
  *   * Source ID must be > 0 because this field also distinguishes between
  *     type 1 and Type 2 data.
  *   * LMDB sorts Type 2 before Type 3 records because of the NULL byte
  *     in type 2.
+ *   * Keys are full block hashes.  DUPSORT stores a key once and keeps the
+ *     Type 2 and Type 3 records of a multi-entry hash under it, so the
+ *     key costs the same for one source or many.  Unlike the approximate
+ *     prefix keys of lmdb_hash_manager_t, a truncated key here would need
+ *     the rest of the hash in every record for exact lookup and export,
+ *     so it would move bytes rather than save them.
  *   * Some entropy precision is lost because entropy values are stored as
  *     integers, see entropy_scale.
  *   * Count and sub_count fields clip at 0xffffffff and 0xffff, respectively.
@@ -55,7 +83,13 @@
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
 #include "lmdb_hash_data_support.hpp"
+#include "lmdb_shard.hpp"
+#include "stage_stats.hpp"
+#include "hash_stats.hpp"
+#include "hash_batch.hpp"
 #include "source_id_sub_counts.hpp"
+#include "frozen_hash_store.hpp"
+#include "lmdb_count_index_manager.hpp"
 #include "tprint.hpp"
 #include <vector>
 #include <unistd.h>
@@ -98,6 +132,30 @@ inline uint64_t add4(const uint64_t a, const uint64_t b) {
   return (a+b>0xffffffff) ? 0xffffffff : a+b;
 }
 
+// the total of the sub_counts, clipped like count
+inline uint64_t total_sub_count(
+                    const source_id_sub_counts_t& source_id_sub_counts) {
+  uint64_t total = 0;
+  for (source_id_sub_counts_t::const_iterator it =
+                  source_id_sub_counts.begin();
+                  it != source_id_sub_counts.end(); ++it) {
+    total = add4(total, it->sub_count);
+  }
+  return total;
+}
+
+// find the source in the sources else end
+inline source_id_sub_counts_t::iterator find_source(
+                    source_id_sub_counts_t& source_id_sub_counts,
+                    const uint64_t source_id) {
+  source_id_sub_counts_t::iterator it = source_id_sub_counts.lower_bound(
+                                 source_id_sub_count_t(source_id, 0));
+  if (it != source_id_sub_counts.end() && it->source_id != source_id) {
+    it = source_id_sub_counts.end();
+  }
+  return it;
+}
+
 // maybe truncate block_label
 static std::string truncate_block_label(std::string block_label) {
   if (block_label.size() > hashdb::max_block_label_size) {
@@ -112,15 +170,65 @@ static std::string truncate_block_label(std::string block_label) {
   return block_label;
 }
 
+// hash data read by find_sorted
+struct hash_data_t {
+  bool found;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  source_id_sub_counts_t source_id_sub_counts;
+  uint64_t num_sources;   // sources of the hash, read or not
+  hash_data_t() : found(false), k_entropy(0), block_label(), count(0),
+                  source_id_sub_counts(), num_sources(0) {
+  }
+};
+
+// keep the max_sources sources of source_id_sub_counts after the first
+// first_source, all if max_sources is 0
+inline void source_window(const size_t first_source,
+                          const size_t max_sources,
+                          source_id_sub_counts_t& source_id_sub_counts) {
+  source_id_sub_counts_t::iterator begin = source_id_sub_counts.begin();
+  for (size_t i=0; i<first_source && begin != source_id_sub_counts.end();
+       ++i) {
+    ++begin;
+  }
+  source_id_sub_counts.erase(source_id_sub_counts.begin(), begin);
+  if (max_sources > 0 && source_id_sub_counts.size() > max_sources) {
+    source_id_sub_counts_t::iterator end = source_id_sub_counts.begin();
+    for (size_t i=0; i<max_sources; ++i) {
+      ++end;
+    }
+    source_id_sub_counts.erase(end, source_id_sub_counts.end());
+  }
+}
+
+// a removal for remove_batch
+struct hash_remove_entry_t {
+  std::string block_hash;
+  uint64_t source_id;   // the source to remove, or 0 for all sources
+  hash_remove_entry_t(const std::string& p_block_hash,
+                      const uint64_t p_source_id) :
+          block_hash(p_block_hash), source_id(p_source_id) {
+  }
+};
+typedef std::vector<hash_remove_entry_t> hash_remove_entries_t;
+
 class lmdb_hash_data_manager_t {
+  friend class lmdb_hash_data_cursor_t;
 
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
-  MDB_env* env;
+  const uint32_t hash_data_format;
+  const uint32_t hash_shard_bits;
+  hashdb::lmdb_shards_t shards;
+  std::vector<hashdb::hash_stats_t*> hash_stats; // per shard, or NULL
+  hashdb::frozen_hash_store_t* frozen;           // or NULL
+  hashdb::lmdb_count_index_manager_t* count_index; // not owned, or NULL
 
 #ifdef HAVE_PTHREAD
-  mutable pthread_mutex_t M;                  // mutext
+  mutable pthread_mutex_t M;                  // mutext for changes
 #else
   mutable int M;                              // placeholder
 #endif
@@ -131,77 +239,125 @@ class lmdb_hash_data_manager_t {
 
   public:
   lmdb_hash_data_manager_t(const std::string& p_hashdb_dir,
-                           const hashdb::file_mode_type_t p_file_mode) :
+                           const hashdb::file_mode_type_t p_file_mode,
+                           const uint32_t p_hash_data_format =
+                                      hashdb::varint_hash_data_format,
+                           const uint32_t p_hash_shard_bits = 0,
+                           const lmdb_helper::env_policy_t& policy =
+                                                lmdb_helper::env_policy_t()) :
        hashdb_dir(p_hashdb_dir),
        file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_hash_data_store",
-                                                                file_mode)),
+       hash_data_format(p_hash_data_format),
+       hash_shard_bits(p_hash_shard_bits),
+       shards(hashdb_dir, "lmdb_hash_data_store", file_mode, true,
+              hash_shard_bits, policy,
+              hash_data_format == hashdb::dupfixed_hash_data_format),
+       hash_stats(shards.count(), NULL),
+       frozen((file_mode == hashdb::READ_ONLY) ?
+              hashdb::frozen_hash_store_t::open(hashdb_dir) : NULL),
+       count_index(NULL),
        M() {
 
     MUTEX_INIT(&M);
+
+    // maintain the statistics of each shard if they are known
+    if (file_mode != hashdb::READ_ONLY) {
+      for (size_t s=0; s<shards.count(); ++s) {
+        const uint64_t num_keys = shards[s].size();
+        if (num_keys == 0) {
+          // an empty shard has empty statistics
+          hash_stats[s] = new hashdb::hash_stats_t(shards[s].last_txnid(),
+                                                   0);
+        } else {
+          hash_stats[s] = hashdb::hash_stats_t::read(stats_filename(s),
+                                    shards[s].last_txnid(), num_keys);
+        }
+      }
+    }
   }
 
-  ~lmdb_hash_data_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+  // keep the count index of the hashdb current with count changes
+  void set_count_index(hashdb::lmdb_count_index_manager_t* const
+                                                         p_count_index) {
+    count_index = p_count_index;
+  }
 
+  ~lmdb_hash_data_manager_t() {
+    for (size_t s=0; s<hash_stats.size(); ++s) {
+      delete hash_stats[s];
+    }
+    delete frozen;
     MUTEX_DESTROY(&M);
   }
 
-  // ************************************************************
-  // insert
-  // ************************************************************
-
   /**
-   * Insert hash with accompanying data.  Warn if data present but different.
-   * Return updated source count.
-   *
-   * Use when counting source occurrences for this hash.
+   * Reopen the read-only shards in a child process after fork.  The
+   * frozen store is kept as the child inherited it.
    */
-  size_t insert(const std::string& block_hash,
-                const uint64_t k_entropy,
-                const std::string& p_block_label,
-                const uint64_t source_id,
-                hashdb::lmdb_changes_t& changes) {
+  void reopen_after_fork() {
+    shards.reopen_after_fork();
+  }
 
-    // program error if source ID is 0 since NULL distinguishes between
-    // type 1 and type 2 data.
-    if (source_id == 0) {
-      std::cerr << "program error in source_id\n";
-      assert(0);
+  // the number of shards and the shard of a hash, for writers that
+  // write shards in parallel
+  size_t shard_count() const {
+    return shards.count();
+  }
+  size_t shard_index(const std::string& block_hash) const {
+    return shards.index(block_hash);
+  }
+
+  private:
+  // add changes counted while holding a shard lock
+  void add_changes(hashdb::lmdb_changes_t& changes,
+                   const hashdb::lmdb_changes_t& shard_changes) const {
+    MUTEX_LOCK(&M);
+    changes += shard_changes;
+    MUTEX_UNLOCK(&M);
+  }
+
+  std::string stats_filename(const size_t s) const {
+    return shard_store_dir(hashdb_dir, "hash_stats", hash_shard_bits, s);
+  }
+
+  // Account for a change in the count of a hash in the statistics of its
+  // shard and in the count index.  The caller owns the shard lock.
+  void count_changed(const std::string& block_hash,
+                     const uint64_t old_count, const uint64_t new_count) {
+    hashdb::hash_stats_t* const stats = hash_stats[shards.index(block_hash)];
+    if (stats != NULL) {
+      stats->change(old_count, new_count);
+    }
+    if (count_index != NULL) {
+      count_index->change(block_hash, old_count, new_count);
     }
+  }
+
+  // ************************************************************
+  // insert and merge using an open RW context
+  // ************************************************************
+  // Insert occurrences of the block of source_id into the context.  The
+  // caller validates input and owns the lock and the context.
+  size_t insert_in_context(hashdb::lmdb_context_t& context,
+                           const std::string& block_hash,
+                           const uint64_t k_entropy,
+                           const std::string& block_label,
+                           const uint64_t source_id,
+                           const uint64_t occurrences,
+                           hashdb::lmdb_changes_t& changes) {
 
     // get key size
     const size_t key_size = block_hash.size();
     uint8_t* const key_start = static_cast<uint8_t*>(
                  static_cast<void*>(const_cast<char*>(block_hash.c_str())));
 
-    // require valid block_hash
-    if (key_size == 0) {
-      std::cerr << "Usage error: the block_hash value provided to insert is empty.\n";
-      return 0;
-    }
-
-    // maybe truncate block_label
-    const std::string block_label = truncate_block_label(p_block_label);
-
-    MUTEX_LOCK(&M);
-
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
-
-    // get context
-    hashdb::lmdb_context_t context(env, true, true);
-    context.open();
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_whole_mdb("hash_data_manager insert begin", context.cursor);
-#endif
 
     // set key
     context.key.mv_size = key_size;
     context.key.mv_data = key_start;
 
     // return new count when done
+    uint64_t old_count = 0;
     uint64_t count;
 
     // see if hash is already there
@@ -210,8 +366,11 @@ print_whole_mdb("hash_data_manager insert begin", context.cursor);
 
     if (rc == MDB_NOTFOUND) {
       // new Type 1
-      new_type1(context, block_hash, k_entropy, block_label, source_id, 1);
-      count = 1;
+      source_id_sub_counts_t sources;
+      sources.insert(source_id_sub_count_t(source_id, add2(occurrences, 0)));
+      new_type1(context, hash_data_format, block_hash, k_entropy, block_label,
+                sources);
+      count = add2(occurrences, 0);
 
     } else if (rc == 0) {
       // hash is already there
@@ -234,10 +393,10 @@ print_mdb_val("hash_data_manager insert found data", context.data);
         // read type 1
         uint64_t existing_k_entropy;
         std::string existing_block_label;
-        uint64_t existing_source_id;
-        uint64_t existing_sub_count;
-        decode_type1(context, existing_k_entropy, existing_block_label,
-                     existing_source_id, existing_sub_count);
+        source_id_sub_counts_t sources;
+        decode_type1(context, hash_data_format, existing_k_entropy,
+                     existing_block_label, sources);
+        old_count = total_sub_count(sources);
 
         // check for mismatched data
         if (mismatched_data(k_entropy, existing_k_entropy,
@@ -245,21 +404,33 @@ print_mdb_val("hash_data_manager insert found data", context.data);
           ++changes.hash_data_mismatched_data_detected;
         }
 
-        // see if source_id is the same
-        if (source_id == existing_source_id) {
-          // increment Type 1
-          count = add2(existing_sub_count, 1);
-          replace_type1(context, block_hash, existing_k_entropy,
-                        existing_block_label, source_id, count);
+        // see if source_id is already there
+        source_id_sub_counts_t::iterator it = find_source(sources, source_id);
+        if (it != sources.end()) {
+          // increment its sub_count in Type 1
+          const uint64_t sub_count = add2(it->sub_count, occurrences);
+          sources.erase(it);
+          sources.insert(source_id_sub_count_t(source_id, sub_count));
+          replace_type1(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, sources);
+          count = total_sub_count(sources);
+
+        } else if (sources.size() < max_type1_sources(hash_data_format)) {
+          // add the source to Type 1
+          sources.insert(source_id_sub_count_t(source_id,
+                                               add2(occurrences, 0)));
+          replace_type1(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, sources);
+          count = total_sub_count(sources);
 
         } else {
-          // split type 1 into type 2 and two type 3
-          count = add4(existing_sub_count, 1);
-          replace_type2(context, block_hash, existing_k_entropy,
-                        existing_block_label, count);
-          new_type3(context, block_hash, existing_source_id,
-                    existing_sub_count);
-          new_type3(context, block_hash, source_id, 1);
+          // promote Type 1 to Type 2 and Type 3 records
+          count = add4(total_sub_count(sources), add2(occurrences, 0));
+          promote_type1(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, count,
+                        sources);
+          new_type3(context, hash_data_format, block_hash, source_id,
+                    add2(occurrences, 0));
         }
 
       } else {
@@ -270,8 +441,9 @@ print_mdb_val("hash_data_manager insert found data", context.data);
         uint64_t existing_k_entropy;
         std::string existing_block_label;
         uint64_t existing_count;
-        decode_type2(context, existing_k_entropy, existing_block_label,
-                     existing_count);
+        decode_type2(context, hash_data_format, existing_k_entropy,
+                     existing_block_label, existing_count);
+        old_count = existing_count;
 
         // check for mismatched data
         if (mismatched_data(k_entropy, existing_k_entropy,
@@ -280,19 +452,21 @@ print_mdb_val("hash_data_manager insert found data", context.data);
         }
 
         // increment count at type 2
-        count = add4(existing_count,1);
-        replace_type2(context, block_hash, existing_k_entropy,
-                      existing_block_label, count);
+        count = add4(existing_count, add2(occurrences, 0));
+        replace_type2(context, hash_data_format, block_hash,
+                      existing_k_entropy, existing_block_label, count);
 
         // look for existing type 3
         uint64_t existing_sub_count;
-        if (cursor_to_type3(context, source_id, existing_sub_count)) {
+        if (cursor_to_type3(context, hash_data_format, source_id,
+                            existing_sub_count)) {
           // increment sub_count at type 3
-          replace_type3(context, block_hash, source_id,
-                        add2(existing_sub_count,1));
+          replace_type3(context, hash_data_format, block_hash, source_id,
+                        add2(existing_sub_count, occurrences));
         } else {
           // new type 3
-          new_type3(context, block_hash, source_id, 1);
+          new_type3(context, hash_data_format, block_hash, source_id,
+                    add2(occurrences, 0));
         }
       }
 
@@ -306,66 +480,34 @@ print_mdb_val("hash_data_manager insert found data", context.data);
 print_whole_mdb("hash_data_manager insert end", context.cursor);
 #endif
 
-    // insert is always accepted
-    ++changes.hash_data_inserted;
-
-    context.close();
-    MUTEX_UNLOCK(&M);
+    // insert is always accepted, each occurrence counted
+    count_changed(block_hash, old_count, count);
+    changes.hash_data_inserted += occurrences;
     return count;
   }
 
-  // ************************************************************
-  // merge
-  // ************************************************************
-  /**
-   * Merge hash with accompanying data.  Warn if data present but different.
-   * Return updated source count.
-   */
-  size_t merge(const std::string& block_hash,
-               const uint64_t k_entropy,
-               const std::string& p_block_label,
-               const uint64_t source_id,
-               const uint64_t sub_count,
-               hashdb::lmdb_changes_t& changes) {
-
-    // program error if source ID is 0 since NULL distinguishes between
-    // type 1 and type 2 data.
-    if (source_id == 0) {
-      std::cerr << "program error in source_id\n";
-      assert(0);
-    }
+  // Merge into the context.  The caller validates input and owns
+  // the lock and the context.
+  size_t merge_in_context(hashdb::lmdb_context_t& context,
+                          const std::string& block_hash,
+                          const uint64_t k_entropy,
+                          const std::string& block_label,
+                          const uint64_t source_id,
+                          const uint64_t sub_count,
+                          hashdb::lmdb_changes_t& changes) {
 
     // get key size
     const size_t key_size = block_hash.size();
     uint8_t* const key_start = static_cast<uint8_t*>(
                  static_cast<void*>(const_cast<char*>(block_hash.c_str())));
 
-    // require valid block_hash
-    if (key_size == 0) {
-      std::cerr << "Usage error: the block_hash value provided to mergeis empty.\n";
-      return 0;
-    }
-
-    // maybe truncate block_label
-    const std::string block_label = truncate_block_label(p_block_label);
-
-    MUTEX_LOCK(&M);
-
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
-
-    // get context
-    hashdb::lmdb_context_t context(env, true, true);
-    context.open();
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_whole_mdb("hash_data_manager merge begin", context.cursor);
-#endif
 
     // set key
     context.key.mv_size = key_size;
     context.key.mv_data = key_start;
 
     // return new count when done
+    uint64_t old_count = 0;
     uint64_t count;
 
     // see if hash is already there
@@ -374,8 +516,10 @@ print_whole_mdb("hash_data_manager merge begin", context.cursor);
 
     if (rc == MDB_NOTFOUND) {
       // new Type 1
-      new_type1(context, block_hash, k_entropy, block_label, source_id,
-                sub_count);
+      source_id_sub_counts_t sources;
+      sources.insert(source_id_sub_count_t(source_id, sub_count));
+      new_type1(context, hash_data_format, block_hash, k_entropy, block_label,
+                sources);
       count = add2(sub_count,0);
       ++changes.hash_data_merged;
 
@@ -400,10 +544,10 @@ print_mdb_val("hash_data_manager merge found data", context.data);
         // read type 1
         uint64_t existing_k_entropy;
         std::string existing_block_label;
-        uint64_t existing_source_id;
-        uint64_t existing_sub_count;
-        decode_type1(context, existing_k_entropy, existing_block_label,
-                     existing_source_id, existing_sub_count);
+        source_id_sub_counts_t sources;
+        decode_type1(context, hash_data_format, existing_k_entropy,
+                     existing_block_label, sources);
+        old_count = total_sub_count(sources);
 
         // check for mismatched data
         if (mismatched_data(k_entropy, existing_k_entropy,
@@ -411,27 +555,37 @@ print_mdb_val("hash_data_manager merge found data", context.data);
           ++changes.hash_data_mismatched_data_detected;
         }
 
-        // see if source_id is the same
-        if (source_id == existing_source_id) {
+        // see if source_id is already there
+        source_id_sub_counts_t::iterator it = find_source(sources, source_id);
+        if (it != sources.end()) {
 
           // check for mismatched sub_count
-          if (mismatched_sub_count(sub_count, existing_sub_count)) {
+          if (mismatched_sub_count(sub_count, it->sub_count)) {
             ++changes.hash_data_mismatched_sub_count_detected;
           }
 
           // merged before, no change
           ++changes.hash_data_merged_same;
 
-          count = existing_sub_count;
+          count = total_sub_count(sources);
+
+        } else if (sources.size() < max_type1_sources(hash_data_format)) {
+          // add the source to Type 1
+          sources.insert(source_id_sub_count_t(source_id, add2(sub_count,0)));
+          replace_type1(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, sources);
+          count = total_sub_count(sources);
+
+          ++changes.hash_data_merged;
 
         } else {
-          // split type 1 into type 2 and two type 3
-          count = add4(existing_sub_count,sub_count);
-          replace_type2(context, block_hash, existing_k_entropy,
-                        existing_block_label, count);
-          new_type3(context, block_hash, existing_source_id,
-                    existing_sub_count);
-          new_type3(context, block_hash, source_id, sub_count);
+          // promote Type 1 to Type 2 and Type 3 records
+          count = add4(total_sub_count(sources), sub_count);
+          promote_type1(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, count,
+                        sources);
+          new_type3(context, hash_data_format, block_hash, source_id,
+                    sub_count);
 
           ++changes.hash_data_merged;
         }
@@ -444,8 +598,9 @@ print_mdb_val("hash_data_manager merge found data", context.data);
         uint64_t existing_k_entropy;
         std::string existing_block_label;
         uint64_t existing_count;
-        decode_type2(context, existing_k_entropy, existing_block_label,
-                     existing_count);
+        decode_type2(context, hash_data_format, existing_k_entropy,
+                     existing_block_label, existing_count);
+        old_count = existing_count;
 
         // check for mismatched data
         if (mismatched_data(k_entropy, existing_k_entropy,
@@ -455,7 +610,8 @@ print_mdb_val("hash_data_manager merge found data", context.data);
 
         // look for existing type 3
         uint64_t existing_sub_count;
-        if (cursor_to_type3(context, source_id, existing_sub_count)) {
+        if (cursor_to_type3(context, hash_data_format, source_id,
+                            existing_sub_count)) {
 
           // existing type 3 was merged before, no change
 
@@ -472,11 +628,12 @@ print_mdb_val("hash_data_manager merge found data", context.data);
           // add sub_count to type 2
           count = add4(existing_count,sub_count);
           cursor_to_first_current(context);
-          replace_type2(context, block_hash, existing_k_entropy,
-                        existing_block_label, count);
+          replace_type2(context, hash_data_format, block_hash,
+                        existing_k_entropy, existing_block_label, count);
 
           // new type 3 for new souce_id
-          new_type3(context, block_hash, source_id, sub_count);
+          new_type3(context, hash_data_format, block_hash, source_id,
+                    sub_count);
 
           ++changes.hash_data_merged;
         }
@@ -492,232 +649,1019 @@ print_mdb_val("hash_data_manager merge found data", context.data);
 print_whole_mdb("hash_data_manager merge end", context.cursor);
 #endif
 
-    context.close();
-    MUTEX_UNLOCK(&M);
+    count_changed(block_hash, old_count, count);
     return count;
   }
 
+  public:
   // ************************************************************
-  // find
+  // insert
   // ************************************************************
+
   /**
-   * Read data for the hash.  If the hash does not exist return false
-   * and empty fields.
+   * Insert hash with accompanying data.  Warn if data present but different.
+   * Return updated source count.
+   *
+   * Use when counting source occurrences for this hash.
    */
-  bool find(const std::string& block_hash,
-            uint64_t& k_entropy,
-            std::string& block_label,
-            uint64_t& count,
-            source_id_sub_counts_t& source_id_sub_counts) const {
+  size_t insert(const std::string& block_hash,
+                const uint64_t k_entropy,
+                const std::string& p_block_label,
+                const uint64_t source_id,
+                hashdb::lmdb_changes_t& changes) {
 
-    // clear any previous values
-    k_entropy = 0;
-    block_label = "";
-    count = 0;
-    source_id_sub_counts.clear();
+    // program error if source ID is 0 since NULL distinguishes between
+    // type 1 and type 2 data.
+    if (source_id == 0) {
+      std::cerr << "program error in source_id\n";
+      assert(0);
+    }
 
     // require valid block_hash
     if (block_hash.size() == 0) {
-      std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
-      return false;
+      std::cerr << "Usage error: the block_hash value provided to insert is empty.\n";
+      return 0;
     }
 
+    // maybe truncate block_label
+    const std::string block_label = truncate_block_label(p_block_label);
+
+    lmdb_shard_t& shard = shards.of(block_hash);
+    hashdb::lmdb_changes_t shard_changes;
+    MUTEX_LOCK(&shard.M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(shard.env);
+
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(shard.env, true, true, NULL,
+                                   &shard.dbis);
     context.open();
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_whole_mdb("hash_data_manager find", context.cursor);
+print_whole_mdb("hash_data_manager insert begin", context.cursor);
 #endif
 
-    // set key
-    const size_t key_size = block_hash.size();
-    uint8_t* const key_start = static_cast<uint8_t*>(
-                 static_cast<void*>(const_cast<char*>(block_hash.c_str())));
-    context.key.mv_size = key_size;
-    context.key.mv_data = key_start;
+    const size_t count = insert_in_context(context, block_hash, k_entropy,
+                                           block_label, source_id, 1,
+                                           shard_changes);
 
-    // set the cursor to this key
-    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_SET_KEY);
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find start at key", context.key);
-print_mdb_val("hash_data_manager find start at data", context.data);
-#endif
+    context.close();
+    MUTEX_UNLOCK(&shard.M);
+    add_changes(changes, shard_changes);
+    return count;
+  }
 
-    if (rc == MDB_NOTFOUND) {
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find did not find key", context.key);
-#endif
-      // no hash
-      context.close();
-      return false;
+  // ************************************************************
+  // merge
+  // ************************************************************
+  /**
+   * Merge hash with accompanying data.  Warn if data present but different.
+   * Return updated source count.
+   */
+  size_t merge(const std::string& block_hash,
+               const uint64_t k_entropy,
+               const std::string& p_block_label,
+               const uint64_t source_id,
+               const uint64_t sub_count,
+               hashdb::lmdb_changes_t& changes) {
 
-    } else if (rc == 0) {
-      // check first byte to see if the entry is Type 1 or Type 2
-      // require data to have size
-      if (context.data.mv_size == 0) {
-        std::cerr << "program error in data size\n";
-        assert(0);
-      }
+    // program error if source ID is 0 since NULL distinguishes between
+    // type 1 and type 2 data.
+    if (source_id == 0) {
+      std::cerr << "program error in source_id\n";
+      assert(0);
+    }
 
-      // find the existing entry type
-      if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to merge is empty.\n";
+      return 0;
+    }
 
-        // existing entry is Type 1 so read it and be done:
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 1 key", context.key);
-print_mdb_val("hash_data_manager find Type 1 data", context.data);
-#endif
-        uint64_t source_id;
-        uint64_t sub_count;
-        decode_type1(context, k_entropy, block_label, source_id, sub_count);
-        source_id_sub_counts.insert(source_id_sub_count_t(source_id,
-                                                          sub_count));
-        count = sub_count;
-        context.close();
-        return true;
+    // maybe truncate block_label
+    const std::string block_label = truncate_block_label(p_block_label);
 
-      } else {
-        // existing entry is Type 2 so read all entries for this hash
-#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 2 key", context.key);
-print_mdb_val("hash_data_manager find Type 2 data", context.data);
-#endif
-        // read the existing Type 2 entry into returned fields
-        decode_type2(context, k_entropy, block_label, count);
+    lmdb_shard_t& shard = shards.of(block_hash);
+    hashdb::lmdb_changes_t shard_changes;
+    MUTEX_LOCK(&shard.M);
 
-        // read Type 3 entries while data available and key matches
-        while (true) {
-          rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                              MDB_NEXT);
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(shard.env);
+
+    // get context
+    hashdb::lmdb_context_t context(shard.env, true, true, NULL,
+                                   &shard.dbis);
+    context.open();
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
-print_mdb_val("hash_data_manager find Type 3 key", context.key);
-print_mdb_val("hash_data_manager find Type 3 data", context.data);
+print_whole_mdb("hash_data_manager merge begin", context.cursor);
 #endif
 
-          if (rc == MDB_NOTFOUND || context.key.mv_size != key_size ||
-              memcmp(context.key.mv_data, key_start, key_size) != 0) {
-            // EOF or past key so done
-            break;
-          }
+    const size_t count = merge_in_context(context, block_hash, k_entropy,
+                                      block_label, source_id, sub_count,
+                                      shard_changes);
 
-          // make sure rc is valid
-          if (rc != 0) {
-            // invalid rc
-            std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-            assert(0);
-          }
+    context.close();
+    MUTEX_UNLOCK(&shard.M);
+    add_changes(changes, shard_changes);
+    return count;
+  }
 
-          // read Type 3
-          uint64_t source_id;
-          uint64_t sub_count;
-          decode_type3(context, source_id, sub_count);
+  // ************************************************************
+  // insert batch
+  // ************************************************************
+  /**
+   * Insert or merge a batch of hashes in order using one write
+   * transaction.  Set counts to the updated source count for each entry,
+   * or 0 for rejected entries.  Change counters are the same as for
+   * calling insert or merge on each entry.
+   */
+  void insert_batch(const hash_batch_entries_t& entries,
+                    std::vector<size_t>& counts,
+                    hashdb::lmdb_changes_t& changes) {
+
+    counts.clear();
+    counts.resize(entries.size(), 0);
+    if (entries.size() == 0) {
+      return;
+    }
 
-          // add the LMDB hash data
-          source_id_sub_counts.insert(source_id_sub_count_t(source_id,
-                                                            sub_count));
-        }
+    // find the shard of each valid entry
+    std::vector<size_t> entry_shards(entries.size(), shards.count());
+    std::vector<size_t> shard_sizes(shards.count(), 0);
+    for (size_t i=0; i<entries.size(); ++i) {
 
-        context.close();
-        return true;
+      // program error if source ID is 0
+      if (entries[i].source_id == 0) {
+        std::cerr << "program error in source_id\n";
+        assert(0);
       }
 
-    } else {
-      // invalid rc
-      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-      assert(0);
-      return false; // for mingw
+      // require valid block_hash
+      if (entries[i].block_hash.size() == 0) {
+        std::cerr << "Usage error: the block_hash value provided to insert_batch is empty.\n";
+        continue;
+      }
+      entry_shards[i] = shards.index(entries[i].block_hash);
+      ++shard_sizes[entry_shards[i]];
+    }
+
+    // write the entries of each shard in one write transaction
+    hashdb::lmdb_changes_t shard_changes;
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (shard_sizes[s] == 0) {
+        continue;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+
+      // maybe grow the DB with room for every entry since the map cannot
+      // grow while the transaction is open
+      lmdb_helper::maybe_grow(shard.env,
+                              10 + shard_sizes[s] * batch_pages_per_entry);
+
+      // get context
+      hashdb::lmdb_context_t context(shard.env, true, true, NULL,
+                                   &shard.dbis);
+      context.open();
+
+      for (size_t i=0; i<entries.size(); ++i) {
+        if (entry_shards[i] != s) {
+          continue;
+        }
+        const hash_batch_entry_t& entry = entries[i];
+
+        // maybe truncate block_label
+        const std::string block_label =
+                                 truncate_block_label(entry.block_label);
+
+        if (entry.is_merge) {
+          counts[i] = merge_in_context(context, entry.block_hash,
+                         entry.k_entropy, block_label, entry.source_id,
+                         entry.sub_count, shard_changes);
+        } else {
+          counts[i] = insert_in_context(context, entry.block_hash,
+                         entry.k_entropy, block_label, entry.source_id,
+                         insert_occurrences(entry), shard_changes);
+        }
+      }
+
+      context.close();
+      MUTEX_UNLOCK(&shard.M);
     }
-    std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
-    assert(0); // for mingw
-    return false; // for mingw
+    add_changes(changes, shard_changes);
   }
 
+
   // ************************************************************
-  // find_count
+  // append batch
   // ************************************************************
   /**
-   * Return source count for this hash.
+   * Append final hash data in one write transaction.  Hashes must be
+   * unique, in LMDB key order, and greater than all existing hashes.
+   * Use to load sorted hashes into a new store.  No changes are counted
+   * here since the caller calculates them while building the entries.
    */
-  size_t find_count(const std::string& block_hash) const {
+  void append_batch(const hash_append_entries_t& entries) {
+
+    // append each run of entries of one shard in one write transaction
+    size_t begin = 0;
+    while (begin < entries.size()) {
+      const size_t s = shards.index(entries[begin].block_hash);
+      size_t end = begin + 1;
+      while (end < entries.size() &&
+             shards.index(entries[end].block_hash) == s) {
+        ++end;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+
+      // maybe grow the DB with room for every entry since the map cannot
+      // grow while the transaction is open
+      lmdb_helper::maybe_grow(shard.env,
+                              10 + (end - begin) * batch_pages_per_entry);
+
+      // get context
+      hashdb::lmdb_context_t context(shard.env, true, true, NULL,
+                                   &shard.dbis);
+      context.open();
+
+      for (size_t i=begin; i<end; ++i) {
+        const hash_append_entry_t& entry = entries[i];
+        if (entry.source_id_sub_counts.size() <=
+                                  max_type1_sources(hash_data_format)) {
+          // Type 1
+          append_type1(context, hash_data_format, entry.block_hash,
+                       entry.k_entropy, entry.block_label,
+                       entry.source_id_sub_counts);
+          count_changed(entry.block_hash, 0,
+                        total_sub_count(entry.source_id_sub_counts));
+        } else {
+          // Type 2 and its Type 3 records
+          append_type2(context, hash_data_format, entry.block_hash,
+                       entry.k_entropy, entry.block_label, entry.count,
+                       entry.source_id_sub_counts);
+          count_changed(entry.block_hash, 0, entry.count);
+        }
+      }
 
-    // require valid block_hash
-    if (block_hash.size() == 0) {
-      std::cerr << "Usage error: the block_hash value provided to find_count is empty.\n";
+      context.close();
+      MUTEX_UNLOCK(&shard.M);
+      begin = end;
+    }
+  }
+
+  // ************************************************************
+  // remove batch
+  // ************************************************************
+  /**
+   * Remove sources from hashes, or whole hashes, using one write
+   * transaction per shard.  A hash keeping some of its sources is
+   * rewritten from them, so its count becomes the total of their
+   * sub_counts.  Set counts to the remaining source count for each
+   * entry, 0 when the hash is gone.
+   */
+  void remove_batch(const hash_remove_entries_t& entries,
+                    std::vector<size_t>& counts,
+                    hashdb::lmdb_changes_t& changes) {
+
+    counts.clear();
+    counts.resize(entries.size(), 0);
+
+    // find the shard of each valid entry
+    std::vector<size_t> entry_shards(entries.size(), shards.count());
+    std::vector<size_t> shard_sizes(shards.count(), 0);
+    for (size_t i=0; i<entries.size(); ++i) {
+      if (entries[i].block_hash.size() == 0) {
+        std::cerr << "Usage error: the block_hash value provided to remove_batch is empty.\n";
+        continue;
+      }
+      entry_shards[i] = shards.index(entries[i].block_hash);
+      ++shard_sizes[entry_shards[i]];
+    }
+
+    hashdb::lmdb_changes_t shard_changes;
+    hashdb::lmdb_changes_t rewrite_changes;  // not reported
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (shard_sizes[s] == 0) {
+        continue;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+
+      // maybe grow the DB with room for every entry since the map cannot
+      // grow while the transaction is open
+      lmdb_helper::maybe_grow(shard.env,
+                              10 + shard_sizes[s] * batch_pages_per_entry);
+
+      // get context
+      hashdb::lmdb_context_t context(shard.env, true, true, NULL,
+                                   &shard.dbis);
+      context.open();
+
+      for (size_t i=0; i<entries.size(); ++i) {
+        if (entry_shards[i] != s) {
+          continue;
+        }
+        const hash_remove_entry_t& entry = entries[i];
+
+        // read the hash
+        uint64_t k_entropy = 0;
+        std::string block_label = "";
+        uint64_t count = 0;
+        source_id_sub_counts_t source_id_sub_counts;
+        if (!find_in_context(context, entry.block_hash, k_entropy,
+                             block_label, count, source_id_sub_counts)) {
+          // no hash
+          continue;
+        }
+
+        // find the sources that stay
+        size_t removed = source_id_sub_counts.size();
+        if (entry.source_id != 0) {
+          source_id_sub_counts_t::iterator it =
+                    find_source(source_id_sub_counts, entry.source_id);
+          if (it == source_id_sub_counts.end()) {
+            // the source is not in this hash
+            counts[i] = count;
+            continue;
+          }
+          source_id_sub_counts.erase(it);
+          removed = 1;
+        } else {
+          source_id_sub_counts.clear();
+        }
+
+        // remove every record of the hash
+        context.key.mv_size = entry.block_hash.size();
+        context.key.mv_data = const_cast<char*>(entry.block_hash.c_str());
+        int rc = mdb_del(context.txn, context.dbi, &context.key, NULL);
+        if (rc != 0) {
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        delete_type3(context, hash_data_format, entry.block_hash);
+        shard_changes.hash_data_removed += removed;
+        count_changed(entry.block_hash, count, 0);
+
+        // write back the sources that stay
+        for (source_id_sub_counts_t::const_iterator it =
+             source_id_sub_counts.begin();
+             it != source_id_sub_counts.end(); ++it) {
+          counts[i] = merge_in_context(context, entry.block_hash, k_entropy,
+                             block_label, it->source_id, it->sub_count,
+                             rewrite_changes);
+        }
+      }
+
+      context.close();
+      MUTEX_UNLOCK(&shard.M);
+    }
+    add_changes(changes, shard_changes);
+  }
+
+  /**
+   * Return the source count of the first hash starting with prefix, or 0
+   * if no hash starts with it.
+   */
+  size_t find_prefix_count(const std::string& prefix) const {
+
+    if (frozen != NULL) {
+      const uint64_t index = frozen->lower_bound(prefix);
+      if (index < frozen->size() &&
+          frozen->hash_at(index).compare(0, prefix.size(), prefix) == 0) {
+        return frozen->read_count(index);
+      }
       return 0;
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    const lmdb_shard_t& shard = shards.of(prefix);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
     context.open();
 
+    // set the cursor at or after the prefix
+    context.key.mv_size = prefix.size();
+    context.key.mv_data = const_cast<char*>(prefix.c_str());
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    size_t count = 0;
+    if (rc == 0 && context.key.mv_size >= prefix.size() &&
+        memcmp(context.key.mv_data, prefix.c_str(), prefix.size()) == 0) {
+      const std::string block_hash(static_cast<char*>(context.key.mv_data),
+                                   context.key.mv_size);
+      count = find_count_in_context(context, block_hash);
+    }
+    context.close();
+    return count;
+  }
+
+  /**
+   * Find the hashes that start with prefix, in key order.
+   */
+  void find_prefix_hashes(const std::string& prefix,
+                          std::vector<std::string>& block_hashes) const {
+    block_hashes.clear();
+
+    if (frozen != NULL) {
+      for (uint64_t index = frozen->lower_bound(prefix);
+           index < frozen->size(); ++index) {
+        const std::string block_hash = frozen->hash_at(index);
+        if (block_hash.compare(0, prefix.size(), prefix) != 0) {
+          break;
+        }
+        block_hashes.push_back(block_hash);
+      }
+      return;
+    }
+
+    // get context
+    const lmdb_shard_t& shard = shards.of(prefix);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
+    context.open();
+
+    // step through the keys at or after the prefix, once per key
+    context.key.mv_size = prefix.size();
+    context.key.mv_data = const_cast<char*>(prefix.c_str());
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+    while (rc == 0 && context.key.mv_size >= prefix.size() &&
+           memcmp(context.key.mv_data, prefix.c_str(), prefix.size()) == 0) {
+      block_hashes.push_back(std::string(
+                               static_cast<char*>(context.key.mv_data),
+                               context.key.mv_size));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_NODUP);
+    }
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+  }
+
+  // ************************************************************
+  // find
+  // ************************************************************
+  private:
+  // Set the cursor at the first record for block_hash.  MDB_SET_RANGE
+  // lets probes in key order move forward from the current cursor page.
+  // Return false if block_hash is not present.
+  bool cursor_to_hash(hashdb::lmdb_context_t& context,
+                      const std::string& block_hash) const {
+
     // set key
     context.key.mv_size = block_hash.size();
     context.key.mv_data =
                  static_cast<void*>(const_cast<char*>(block_hash.c_str()));
 
-    // set the cursor to this key
+    // set the cursor at or after this key
     int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_SET_KEY);
+                            MDB_SET_RANGE);
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find start at key", context.key);
+print_mdb_val("hash_data_manager find start at data", context.data);
+#endif
 
     if (rc == MDB_NOTFOUND) {
-      // this hash is not in the DB
-      context.close();
-      return 0;
+      // past the last hash
+      return false;
+    }
+    if (rc != 0) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
 
-    } else if (rc == 0) {
-      // hash found
-      // require data to have size
-      if (context.data.mv_size == 0) {
-        std::cerr << "program error in data size\n";
+    // the key must match
+    if (context.key.mv_size != block_hash.size() ||
+        memcmp(context.key.mv_data, block_hash.c_str(),
+               block_hash.size()) != 0) {
+      return false;
+    }
+
+    // require data to have size
+    if (context.data.mv_size == 0) {
+      std::cerr << "program error in data size\n";
+      assert(0);
+    }
+    return true;
+  }
+
+  // The end of the run of hashes from begin that are in the shard of
+  // the hash at begin.  Empty hashes join the run.
+  size_t shard_run_end(const std::vector<std::string>& block_hashes,
+                       const size_t begin) const {
+    const size_t s = shards.index(block_hashes[begin]);
+    size_t end = begin + 1;
+    while (end < block_hashes.size() && (block_hashes[end].size() == 0 ||
+                          shards.index(block_hashes[end]) == s)) {
+      ++end;
+    }
+    return end;
+  }
+
+  // Read the data of the hash at the cursor, which is at the hash's first
+  // record.  Fields must be clear.  Leave the cursor at the first record
+  // of the next hash when advance is true or a Type 2 record was read
+  // from the same database as its Type 3 records.  Return 0 if the
+  // cursor is at a record or MDB_NOTFOUND if past the last hash.
+  int read_at_cursor(hashdb::lmdb_context_t& context,
+                     const bool advance,
+                     uint64_t& k_entropy,
+                     std::string& block_label,
+                     uint64_t& count,
+                     source_id_sub_counts_t& source_id_sub_counts) const {
+
+    // find the existing entry type
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+
+      // existing entry is Type 1 so read it and be done:
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find Type 1 key", context.key);
+print_mdb_val("hash_data_manager find Type 1 data", context.data);
+#endif
+      decode_type1(context, hash_data_format, k_entropy, block_label,
+                   source_id_sub_counts);
+      count = total_sub_count(source_id_sub_counts);
+      if (!advance) {
+        return 0;
+      }
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_NEXT);
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
         assert(0);
       }
+      return rc;
+    }
 
-      // check first byte to see if the entry is Type 1 or Type 2
-      if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
-        // Type 1
+    // existing entry is Type 2 so read all entries for this hash
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find Type 2 key", context.key);
+print_mdb_val("hash_data_manager find Type 2 data", context.data);
+#endif
+    // keep the key, which stays mapped while the cursor moves past it
+    const MDB_val hash_key = context.key;
 
-        // read the existing Type 1 entry into fields:
-        uint64_t k_entropy;
-        std::string block_label;
-        uint64_t source_id;
-        uint64_t sub_count;
-        decode_type1(context, k_entropy, block_label, source_id, sub_count);
+    // read the existing Type 2 entry into returned fields
+    decode_type2(context, hash_data_format, k_entropy, block_label, count);
 
-        context.close();
-        return sub_count;
+    // read the Type 3 entries kept apart a page at a time
+    if (hash_data_format == hashdb::dupfixed_hash_data_format) {
+      read_dupfixed_type3(context, hash_key, 0, 0, source_id_sub_counts);
+      if (!advance) {
+        return 0;
+      }
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_NEXT);
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      return rc;
+    }
 
-      } else {
-        // Type 2
+    // read Type 3 entries while data available and key matches
+    while (true) {
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_NEXT);
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find Type 3 key", context.key);
+print_mdb_val("hash_data_manager find Type 3 data", context.data);
+#endif
 
-        // read the existing Type 2 entry into fields:
-        uint64_t k_entropy;
-        std::string block_label;
-        uint64_t count;
-        decode_type2(context, k_entropy, block_label, count);
+      if (rc == MDB_NOTFOUND) {
+        // EOF so done
+        return rc;
+      }
 
-        context.close();
-        return count;
+      // make sure rc is valid
+      if (rc != 0) {
+        // invalid rc
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
       }
 
-    } else {
-      // invalid rc
+      if (context.key.mv_size != hash_key.mv_size ||
+          memcmp(context.key.mv_data, hash_key.mv_data,
+                 hash_key.mv_size) != 0) {
+        // past key so done
+        return 0;
+      }
+
+      // read Type 3
+      uint64_t source_id;
+      uint64_t sub_count;
+      decode_type3(context, hash_data_format, source_id, sub_count);
+
+      // add the LMDB hash data
+      source_id_sub_counts.insert(source_id_sub_count_t(source_id,
+                                                        sub_count));
+    }
+  }
+
+  // Read data for the hash using an open context.  Fields must be clear.
+  bool find_in_context(hashdb::lmdb_context_t& context,
+                       const std::string& block_hash,
+                       uint64_t& k_entropy,
+                       std::string& block_label,
+                       uint64_t& count,
+                       source_id_sub_counts_t& source_id_sub_counts) const {
+
+    if (!cursor_to_hash(context, block_hash)) {
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_mdb_val("hash_data_manager find did not find key", context.key);
+#endif
+      // no hash
+      return false;
+    }
+
+    read_at_cursor(context, false, k_entropy, block_label, count,
+                   source_id_sub_counts);
+    return true;
+  }
+
+  // Read data for the hash using an open context, reading only the
+  // max_sources sources after the first first_source, all if max_sources
+  // is 0.  Type 3 records that are skipped or past the window are not
+  // decoded.  Fields must be clear.
+  bool find_in_context(hashdb::lmdb_context_t& context,
+                       const std::string& block_hash,
+                       const size_t first_source,
+                       const size_t max_sources,
+                       uint64_t& k_entropy,
+                       std::string& block_label,
+                       uint64_t& count,
+                       source_id_sub_counts_t& source_id_sub_counts,
+                       uint64_t& num_sources) const {
+
+    if (!cursor_to_hash(context, block_hash)) {
+      // no hash
+      num_sources = 0;
+      return false;
+    }
+
+    // Type 1 holds few sources
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+      decode_type1(context, hash_data_format, k_entropy, block_label,
+                   source_id_sub_counts);
+      count = total_sub_count(source_id_sub_counts);
+      num_sources = source_id_sub_counts.size();
+      source_window(first_source, max_sources, source_id_sub_counts);
+      return true;
+    }
+
+    // Type 2 has one Type 3 record per source
+    decode_type2(context, hash_data_format, k_entropy, block_label, count);
+    if (hash_data_format == hashdb::dupfixed_hash_data_format) {
+      num_sources = read_dupfixed_type3(context, context.key, first_source,
+                                        max_sources, source_id_sub_counts);
+      return true;
+    }
+    size_t duplicates;
+    int rc = mdb_cursor_count(context.cursor, &duplicates);
+    if (rc != 0) {
       std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
       assert(0);
-      return 0; // for mingw
+    }
+    num_sources = duplicates - 1;
+
+    // skip to the window
+    for (size_t i=0; i<first_source && i<num_sources; ++i) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_DUP);
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+    // read the window
+    const size_t remaining = (first_source < num_sources) ?
+                             num_sources - first_source : 0;
+    const size_t n = (max_sources > 0 && max_sources < remaining) ?
+                     max_sources : remaining;
+    for (size_t i=0; i<n; ++i) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_DUP);
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      uint64_t source_id;
+      uint64_t sub_count;
+      decode_type3(context, hash_data_format, source_id, sub_count);
+      source_id_sub_counts.insert(source_id_sub_count_t(source_id,
+                                                        sub_count));
+    }
+    return true;
+  }
+
+  // Return source count for the hash using an open context.
+  size_t find_count_in_context(hashdb::lmdb_context_t& context,
+                               const std::string& block_hash) const {
+
+    if (!cursor_to_hash(context, block_hash)) {
+      // this hash is not in the DB
+      return 0;
+    }
+
+    // check first byte to see if the entry is Type 1 or Type 2
+    uint64_t k_entropy;
+    std::string block_label;
+    if (static_cast<uint8_t*>(context.data.mv_data)[0] != 0) {
+      // Type 1
+      source_id_sub_counts_t sources;
+      decode_type1(context, hash_data_format, k_entropy, block_label,
+                   sources);
+      return total_sub_count(sources);
+
+    } else {
+      // Type 2
+      uint64_t count;
+      decode_type2(context, hash_data_format, k_entropy, block_label, count);
+      return count;
     }
   }
 
+  public:
+  /**
+   * Read data for the hash.  If the hash does not exist return false
+   * and empty fields.
+   */
+  bool find(const std::string& block_hash,
+            uint64_t& k_entropy,
+            std::string& block_label,
+            uint64_t& count,
+            source_id_sub_counts_t& source_id_sub_counts) const {
+
+    // clear any previous values
+    k_entropy = 0;
+    block_label = "";
+    count = 0;
+    source_id_sub_counts.clear();
+
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
+      return false;
+    }
+
+    if (frozen != NULL) {
+      uint64_t index;
+      const bool found = frozen->find(block_hash, index);
+      if (found) {
+        frozen->read(index, k_entropy, block_label, count,
+                     source_id_sub_counts);
+      }
+      lookup_record(found ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+      return found;
+    }
+
+    // get context
+    const lmdb_shard_t& shard = shards.of(block_hash);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
+    context.open();
+#ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
+print_whole_mdb("hash_data_manager find", context.cursor);
+#endif
+
+    const bool found = find_in_context(context, block_hash, k_entropy,
+                                       block_label, count,
+                                       source_id_sub_counts);
+    context.close();
+    lookup_record(found ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+    return found;
+  }
+
+  /**
+   * Read data for the hash as find does, but only the max_sources
+   * sources after the first first_source in stored order, all if
+   * max_sources is 0.  num_sources is the number of sources of the
+   * hash.  Bounds the time to read hashes with very many sources.
+   */
+  bool find_sources(const std::string& block_hash,
+                    const size_t first_source,
+                    const size_t max_sources,
+                    uint64_t& k_entropy,
+                    std::string& block_label,
+                    uint64_t& count,
+                    source_id_sub_counts_t& source_id_sub_counts,
+                    uint64_t& num_sources) const {
+
+    // clear any previous values
+    k_entropy = 0;
+    block_label = "";
+    count = 0;
+    source_id_sub_counts.clear();
+    num_sources = 0;
+
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
+      return false;
+    }
+
+    if (frozen != NULL) {
+      uint64_t index;
+      const bool found = frozen->find(block_hash, index);
+      if (found) {
+        frozen->read(index, k_entropy, block_label, count,
+                     source_id_sub_counts);
+        num_sources = source_id_sub_counts.size();
+        source_window(first_source, max_sources, source_id_sub_counts);
+      }
+      lookup_record(found ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+      return found;
+    }
+
+    // get context
+    const lmdb_shard_t& shard = shards.of(block_hash);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
+    context.open();
+    const bool found = find_in_context(context, block_hash, first_source,
+                                       max_sources, k_entropy, block_label,
+                                       count, source_id_sub_counts,
+                                       num_sources);
+    context.close();
+    lookup_record(found ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+    return found;
+  }
+
+  /**
+   * Read data for each hash in block_hashes, which must be in ascending
+   * order, using one cursor per shard that sweeps forward.  results[i]
+   * is for block_hashes[i].  Read at most max_sources sources of each
+   * hash unless max_sources is 0.
+   */
+  void find_sorted(const std::vector<std::string>& block_hashes,
+                   std::vector<hash_data_t>& results,
+                   const size_t max_sources = 0) const {
+
+    results.clear();
+    results.resize(block_hashes.size());
+
+    size_t begin = 0;
+    if (frozen != NULL) {
+      std::vector<uint64_t> indexes;
+      frozen->find_batch(block_hashes, indexes, true);
+      for (size_t i=0; i<block_hashes.size(); ++i) {
+        hash_data_t& result = results[i];
+        result.found = (indexes[i] != frozen->size());
+        if (result.found) {
+          frozen->read(indexes[i], result.k_entropy, result.block_label,
+                       result.count, result.source_id_sub_counts);
+          result.num_sources = result.source_id_sub_counts.size();
+          source_window(0, max_sources, result.source_id_sub_counts);
+        }
+      }
+      begin = block_hashes.size();
+    }
+    while (begin < block_hashes.size()) {
+      const size_t end = shard_run_end(block_hashes, begin);
+
+      // get context
+      const lmdb_shard_t& shard = shards.of(block_hashes[begin]);
+      hashdb::lmdb_context_t context(shard.env, false, true,
+                                     shard.read_txn_cache, &shard.dbis);
+      context.open();
+
+      for (size_t i=begin; i<end; ++i) {
+        if (block_hashes[i].size() == 0) {
+          std::cerr << "Usage error: the block_hash value provided to find is empty.\n";
+          continue;
+        }
+        hash_data_t& result = results[i];
+        result.found = find_in_context(context, block_hashes[i], 0,
+                                       max_sources, result.k_entropy,
+                                       result.block_label, result.count,
+                                       result.source_id_sub_counts,
+                                       result.num_sources);
+      }
+      context.close();
+      begin = end;
+    }
+
+    size_t hits = 0;
+    for (size_t i=0; i<results.size(); ++i) {
+      hits += results[i].found;
+    }
+    lookup_record(HASH_DATA_STORE_HIT, hits);
+    lookup_record(HASH_DATA_STORE_MISS, results.size() - hits);
+  }
+
   // ************************************************************
-  // first_hash
+  // find_count
   // ************************************************************
   /**
-   * Return first hash else "".
+   * Return source count for this hash.
    */
-  std::string first_hash() const {
+  size_t find_count(const std::string& block_hash) const {
+
+    // require valid block_hash
+    if (block_hash.size() == 0) {
+      std::cerr << "Usage error: the block_hash value provided to find_count is empty.\n";
+      return 0;
+    }
+
+    if (frozen != NULL) {
+      uint64_t index;
+      const size_t count = frozen->find(block_hash, index) ?
+                           frozen->read_count(index) : 0;
+      lookup_record(count ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+      return count;
+    }
+
+    // get context
+    const lmdb_shard_t& shard = shards.of(block_hash);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
+    context.open();
+    const size_t count = find_count_in_context(context, block_hash);
+    context.close();
+    lookup_record(count ? HASH_DATA_STORE_HIT : HASH_DATA_STORE_MISS, 1);
+    return count;
+  }
+
+  /**
+   * Return the source count for each hash in block_hashes, which must
+   * be in ascending order, using one cursor per shard that sweeps
+   * forward.
+   */
+  void find_count_sorted(const std::vector<std::string>& block_hashes,
+                         std::vector<size_t>& counts) const {
+
+    counts.clear();
+    counts.resize(block_hashes.size(), 0);
+
+    size_t begin = 0;
+    if (frozen != NULL) {
+      std::vector<uint64_t> indexes;
+      frozen->find_batch(block_hashes, indexes, true);
+      for (size_t i=0; i<block_hashes.size(); ++i) {
+        if (indexes[i] != frozen->size()) {
+          counts[i] = frozen->read_count(indexes[i]);
+        }
+      }
+      begin = block_hashes.size();
+    }
+    while (begin < block_hashes.size()) {
+      const size_t end = shard_run_end(block_hashes, begin);
+
+      // get context
+      const lmdb_shard_t& shard = shards.of(block_hashes[begin]);
+      hashdb::lmdb_context_t context(shard.env, false, true,
+                                     shard.read_txn_cache, &shard.dbis);
+      context.open();
+      for (size_t i=begin; i<end; ++i) {
+        if (block_hashes[i].size() == 0) {
+          std::cerr << "Usage error: the block_hash value provided to find_count is empty.\n";
+          continue;
+        }
+        counts[i] = find_count_in_context(context, block_hashes[i]);
+      }
+      context.close();
+      begin = end;
+    }
+
+    size_t hits = 0;
+    for (size_t i=0; i<counts.size(); ++i) {
+      hits += (counts[i] != 0);
+    }
+    lookup_record(HASH_DATA_STORE_HIT, hits);
+    lookup_record(HASH_DATA_STORE_MISS, counts.size() - hits);
+  }
+
+  // ************************************************************
+  // first_hash
+  // ************************************************************
+  private:
+  // Return the first hash in shards from first_shard on else "".
+  std::string first_hash_from(const size_t first_shard) const {
+    for (size_t s=first_shard; s<shards.count(); ++s) {
+      const std::string block_hash = first_hash_in(shards[s]);
+      if (block_hash.size() != 0) {
+        return block_hash;
+      }
+    }
+    return "";
+  }
+
+  // Return the first hash in the shard else "".
+  std::string first_hash_in(const lmdb_shard_t& shard) const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(shard.env, false, true,
+                                   shard.read_txn_cache, &shard.dbis);
     context.open();
 
     int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
@@ -747,6 +1691,17 @@ print_mdb_val("hash_data_manager find_begin data", context.data);
     }
   }
 
+  public:
+  /**
+   * Return first hash else "".
+   */
+  std::string first_hash() const {
+    if (frozen != NULL) {
+      return (frozen->size() == 0) ? "" : frozen->hash_at(0);
+    }
+    return first_hash_from(0);
+  }
+
   // ************************************************************
   // next_hash
   // ************************************************************
@@ -761,8 +1716,20 @@ print_mdb_val("hash_data_manager find_begin data", context.data);
       return "";
     }
 
+    if (frozen != NULL) {
+      uint64_t index;
+      if (!frozen->find(block_hash, index)) {
+        std::cerr << "Usage error: the block_hash value provided to next_hash does not exist.\n";
+        return "";
+      }
+      return (index + 1 < frozen->size()) ? frozen->hash_at(index + 1) : "";
+    }
+
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    const size_t s = shards.index(block_hash);
+    hashdb::lmdb_context_t context(shards[s].env, false, true,
+                                   shards[s].read_txn_cache,
+                                   &shards[s].dbis);
     context.open();
 
     // set the cursor to previous hash
@@ -790,9 +1757,9 @@ print_mdb_val("hash_data_manager find_begin data", context.data);
                         MDB_NEXT_NODUP);
 
     if (rc == MDB_NOTFOUND) {
-      // no values for this hash
+      // no more hashes in this shard
       context.close();
-      return "";
+      return first_hash_from(s + 1);
 
     } else if (rc == 0) {
 #ifdef DEBUG_LMDB_HASH_DATA_MANAGER_HPP
@@ -814,9 +1781,283 @@ print_mdb_val("hash_data_manager find_next data", context.data);
     }
   }
 
+  /**
+   * Add the files that lookups read, for lmdb_helper::warm_files.
+   */
+  void store_files(std::vector<std::string>& filenames) const {
+    if (frozen != NULL) {
+      filenames.push_back(hashdb::frozen_hash_store_t::filename(hashdb_dir));
+      return;
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      filenames.push_back(lmdb_helper::data_filename(shards[s].env));
+    }
+  }
+
+  // sync to disk if the sync policy is flush or force is set
+  void flush(const bool force = false) const {
+    shards.flush(force);
+  }
+
+  // ************************************************************
+  // statistics
+  // ************************************************************
+  /**
+   * Save the maintained statistics for the current state of the hash
+   * data store.  A shard whose statistics cannot be saved has its file
+   * removed so that the next reader rebuilds them.
+   */
+  void flush_stats() {
+    for (size_t s=0; s<shards.count(); ++s) {
+      hashdb::hash_stats_t* const stats = hash_stats[s];
+      if (stats == NULL) {
+        continue;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+      stats->stamp(shard.last_txnid(), shard.size());
+      if (!stats->write(stats_filename(s))) {
+        std::remove(stats_filename(s).c_str());
+      }
+      MUTEX_UNLOCK(&shard.M);
+    }
+  }
+
+  /**
+   * Add the statistics of the hash data store to stats.  Statistics that
+   * are maintained or saved for the current store are used, else they
+   * are calculated by walking the shard and saved when READ_ONLY.
+   */
+  void find_stats(hashdb::hash_stats_t& stats) const {
+    if (frozen != NULL) {
+      frozen->find_stats(stats);
+      return;
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      const lmdb_shard_t& shard = shards[s];
+
+      // maintained
+      if (hash_stats[s] != NULL) {
+        MUTEX_LOCK(&shard.M);
+        stats.add(*hash_stats[s]);
+        MUTEX_UNLOCK(&shard.M);
+        continue;
+      }
+
+      // saved
+      hashdb::hash_stats_t* saved = hashdb::hash_stats_t::read(
+                           stats_filename(s), shard.last_txnid(),
+                           shard.size());
+      if (saved != NULL) {
+        stats.add(*saved);
+        delete saved;
+        continue;
+      }
+
+      // calculate from every hash in one read snapshot
+      hashdb::lmdb_context_t context(shard.env, false, true,
+                                     shard.read_txn_cache, &shard.dbis);
+      context.open();
+      MDB_stat stat;
+      int rc = mdb_stat(context.txn, context.dbi, &stat);
+      size_t num_records = stat.ms_entries;
+      if (rc == 0 && context.dupfixed_cursor != NULL) {
+        rc = mdb_stat(context.txn, mdb_cursor_dbi(context.dupfixed_cursor),
+                      &stat);
+        num_records += stat.ms_entries;
+      }
+      if (rc != 0) {
+        std::cerr << "LMDB stat error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      hashdb::hash_stats_t shard_stats(mdb_txn_id(context.txn),
+                                       num_records);
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_FIRST);
+      while (rc == 0) {
+        uint64_t k_entropy = 0;
+        std::string block_label = "";
+        uint64_t count = 0;
+        source_id_sub_counts_t source_id_sub_counts;
+        rc = read_at_cursor(context, true, k_entropy, block_label, count,
+                            source_id_sub_counts);
+        shard_stats.change(0, count);
+      }
+      if (rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      context.close();
+      stats.add(shard_stats);
+
+      // save them for next time if possible
+      if (file_mode == hashdb::READ_ONLY) {
+        shard_stats.write(stats_filename(s));
+      }
+    }
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    return (frozen != NULL) ? frozen->size() : shards.size();
+  }
+};
+
+/**
+ * Walk the hash data store in key order, reading each hash with its data.
+ * The walk holds one read transaction and cursor, on each shard in turn,
+ * so each step reads forward from the last instead of searching for it.
+ * The walk sees the store as it was when it reached the shard.
+ *
+ * A walk may be bounded to the hashes from begin_hash up to but not
+ * including end_hash, where "" is the start or end of the store, so that
+ * walks of disjoint ranges can run in parallel.
+ *
+ * A walk of a frozen hash store steps through its hash indexes instead.
+ */
+class lmdb_hash_data_cursor_t {
+
+  private:
+  const lmdb_hash_data_manager_t& manager;
+  const std::string begin_hash;
+  const std::string end_hash;
+  size_t shard;                     // the shard being walked
+  hashdb::lmdb_context_t* context;  // open on shard, or NULL at end
+  int rc;                           // 0 if the cursor is at a record
+  uint64_t frozen_index;            // the next hash when frozen
+  uint64_t frozen_end;              // the end of the walk when frozen
+
+  // do not allow copy or assignment
+  lmdb_hash_data_cursor_t(const lmdb_hash_data_cursor_t&);
+  lmdb_hash_data_cursor_t& operator=(const lmdb_hash_data_cursor_t&);
+
+  // close the shard being walked
+  void close_shard() {
+    if (context != NULL) {
+      context->close();
+      delete context;
+      context = NULL;
+    }
+  }
+
+  // open shards from shard on until one has a record, else end
+  void open_shard() {
+    if (manager.frozen != NULL) {
+      // no shards to walk
+      return;
+    }
+    for (; shard < manager.shards.count(); ++shard) {
+      // use a transaction of our own so that reads during the walk may
+      // use the cached read transactions
+      context = new hashdb::lmdb_context_t(manager.shards[shard].env,
+                                           false, true, NULL,
+                                           &manager.shards[shard].dbis);
+      context->open();
+      if (begin_hash.size() != 0 &&
+                              shard == manager.shards.index(begin_hash)) {
+        // start at begin_hash
+        context->key.mv_size = begin_hash.size();
+        context->key.mv_data = const_cast<char*>(begin_hash.c_str());
+        rc = mdb_cursor_get(context->cursor, &context->key, &context->data,
+                            MDB_SET_RANGE);
+      } else {
+        rc = mdb_cursor_get(context->cursor, &context->key, &context->data,
+                            MDB_FIRST);
+      }
+      if (rc == 0) {
+        return;
+      }
+      if (rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      close_shard();
+    }
+  }
+
+  // true if the cursor has reached end_hash
+  bool at_end_hash() const {
+    if (end_hash.size() == 0) {
+      return false;
+    }
+    const std::string key(static_cast<char*>(context->key.mv_data),
+                          context->key.mv_size);
+    return key >= end_hash;
+  }
+
+  public:
+  lmdb_hash_data_cursor_t(const lmdb_hash_data_manager_t& p_manager,
+                          const std::string& p_begin_hash = "",
+                          const std::string& p_end_hash = "") :
+          manager(p_manager), begin_hash(p_begin_hash),
+          end_hash(p_end_hash),
+          shard((p_begin_hash.size() == 0) ? 0 :
+                                     p_manager.shards.index(p_begin_hash)),
+          context(NULL), rc(MDB_NOTFOUND),
+          frozen_index((p_manager.frozen == NULL) ? 0 :
+                       p_manager.frozen->lower_bound(p_begin_hash)),
+          frozen_end((p_manager.frozen == NULL) ? 0 :
+                     (p_end_hash.size() == 0) ? p_manager.frozen->size() :
+                     p_manager.frozen->lower_bound(p_end_hash)) {
+    open_shard();
+  }
+
+  ~lmdb_hash_data_cursor_t() {
+    close_shard();
+  }
+
+  /**
+   * Read the next hash and its data.  Return false and empty fields at
+   * the end of the walk.
+   */
+  bool next(std::string& block_hash,
+            uint64_t& k_entropy,
+            std::string& block_label,
+            uint64_t& count,
+            source_id_sub_counts_t& source_id_sub_counts) {
+
+    // clear any previous values
+    block_hash = "";
+    k_entropy = 0;
+    block_label = "";
+    count = 0;
+    source_id_sub_counts.clear();
+
+    if (manager.frozen != NULL) {
+      if (frozen_index >= frozen_end) {
+        // at end
+        return false;
+      }
+      block_hash = manager.frozen->hash_at(frozen_index);
+      manager.frozen->read(frozen_index, k_entropy, block_label, count,
+                           source_id_sub_counts);
+      ++frozen_index;
+      return true;
+    }
+
+    if (context != NULL && at_end_hash()) {
+      // the rest of the store is beyond the walk
+      close_shard();
+      shard = manager.shards.count();
+    }
+
+    if (context == NULL) {
+      // at end
+      return false;
+    }
+
+    // read the hash at the cursor and move to the next hash
+    block_hash = std::string(static_cast<char*>(context->key.mv_data),
+                             context->key.mv_size);
+    rc = manager.read_at_cursor(*context, true, k_entropy, block_label,
+                                count, source_id_sub_counts);
+    if (rc == MDB_NOTFOUND) {
+      // this shard is done
+      close_shard();
+      ++shard;
+      open_shard();
+    }
+    return true;
   }
 };
 
@@ -45,12 +45,15 @@
 #include "lmdb.h"
 #include "lmdb_helper.h"
 #include "lmdb_hash_data_support.hpp"
+#include "block_label_code.hpp"
 #include "lmdb_context.hpp"
 #include "tprint.hpp"
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <cassert>
 
 #ifdef DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
@@ -60,10 +63,52 @@
 namespace hashdb {
 
 const size_t max_block_label_size = 10;
+const uint32_t varint_hash_data_format = 1;
+const uint32_t fixed_hash_data_format = 2;
+const uint32_t dupfixed_hash_data_format = 3;
 static const size_t type1_max_size = 10+1+max_block_label_size+10+2;
 // not used: static const size_t type2_max_size = 10+1+max_block_label_size+4;
 static const size_t type3_max_size = 10+2;
 
+// A varint label size above max_block_label_size is instead
+// varint_label_code_base plus the code of a dictionary label, see
+// block_label_code.hpp, and no label bytes follow.
+static const uint64_t varint_label_code_base = 0x10;
+
+// Fixed format field offsets.  Type 1 and Type 2 share an 8-byte head:
+//   0: type, 1 for Type 1, 0 for Type 2
+//   1: block_label size, 0 when byte 3 holds its code
+//   2: number of sources for Type 1, else 0
+//   3: code of a dictionary block_label, see block_label_code.hpp, else 0
+//   4: 4-byte k_entropy
+// Type 1 continues with up to max_fixed_type1_sources packed sources,
+// each a 4-byte source_id and a 2-byte sub_count, then the block_label.
+// Type 2 continues with a 4-byte count then the block_label.
+// Type 3 records are 8 bytes:
+//   0: 1, which sorts Type 3 after Type 2
+//   1: 0
+//   2: 2-byte sub_count
+//   4: 4-byte source_id
+static const size_t fixed_head_size = 8;
+static const size_t fixed_source_size = 6;
+static const size_t fixed_type3_size = 8;
+static const size_t max_fixed_type1_sources = 4;
+
+// The dupfixed format keeps Type 1 and Type 2 records as the fixed
+// format does, in the records database of the store, and keeps Type 3
+// records apart in its dupfixed database, see lmdb_helper::dbis_t.
+// There every duplicate has the same size, so LMDB packs them into
+// pages that MDB_GET_MULTIPLE returns whole.  Dupfixed Type 3 records
+// are 6 bytes:
+//   0: 4-byte big-endian source_id, so records sort by source_id
+//   4: 2-byte sub_count
+static const size_t dupfixed_type3_size = 6;
+
+// space for encoding any record
+static const size_t record_max_size = fixed_head_size +
+               max_fixed_type1_sources * fixed_source_size +
+               max_block_label_size;
+
 // put and get fixed-width numbers
 inline uint8_t* put1(uint8_t* p, uint64_t n) {
   if (n > 0xff) {
@@ -102,22 +147,132 @@ inline uint8_t* put4(uint8_t* p, uint64_t n) {
   return p+4;
 }
 inline const uint8_t* get4(const uint8_t* const p, uint64_t &n) {
-  n = p[0] | (p[1]<<8) | (p[2]<<16) | (p[3]<<24);
+  n = static_cast<uint64_t>(p[0]) | (static_cast<uint64_t>(p[1])<<8) |
+      (static_cast<uint64_t>(p[2])<<16) | (static_cast<uint64_t>(p[3])<<24);
   return p+4;
 }
 
-// encode Type 1 record
-static size_t encode_type1(const uint64_t k_entropy,
-                           const std::string& block_label,
-                           const uint64_t source_id,
-                           const uint64_t sub_count,
-                           uint8_t* const p_buf) {
+// source IDs are not clipped
+inline uint8_t* put_source_id4(uint8_t* p, uint64_t source_id) {
+  if (source_id > 0xffffffff) {
+    std::cerr << "source_id too large for the fixed hash data format: "
+              << source_id << "\n";
+    assert(0);
+  }
+  return put4(p, source_id);
+}
+
+// reject an unknown record format
+static void validate_format(const uint32_t format) {
+  if (format != varint_hash_data_format && format != fixed_hash_data_format &&
+      format != dupfixed_hash_data_format) {
+    std::cerr << "invalid hash data format " << format << "\n";
+    assert(0);
+  }
+}
 
-  const size_t block_label_size = block_label.size();
+// whether Type 1 and Type 2 records use fixed-width fields
+static bool is_fixed_format(const uint32_t format) {
+  return format == fixed_hash_data_format ||
+         format == dupfixed_hash_data_format;
+}
+
+// encode a dupfixed Type 3 record
+static void encode_dupfixed_type3(const uint64_t source_id,
+                                  const uint64_t sub_count,
+                                  uint8_t* const p_buf) {
+  if (source_id > 0xffffffff) {
+    std::cerr << "source_id too large for the dupfixed hash data format: "
+              << source_id << "\n";
+    assert(0);
+  }
+  p_buf[0] = static_cast<uint8_t>(source_id >> 24);
+  p_buf[1] = static_cast<uint8_t>((source_id >> 16) & 0xff);
+  p_buf[2] = static_cast<uint8_t>((source_id >> 8) & 0xff);
+  p_buf[3] = static_cast<uint8_t>(source_id & 0xff);
+  put2(p_buf+4, sub_count);
+}
+
+// decode a dupfixed Type 3 record
+inline void decode_dupfixed_type3(const uint8_t* const p,
+                                  uint64_t& source_id,
+                                  uint64_t& sub_count) {
+  source_id = (static_cast<uint64_t>(p[0])<<24) |
+              (static_cast<uint64_t>(p[1])<<16) |
+              (static_cast<uint64_t>(p[2])<<8) | static_cast<uint64_t>(p[3]);
+  get2(p+4, sub_count);
+}
+
+// write a dupfixed Type 3 record for the key
+static void write_dupfixed_type3(hashdb::lmdb_context_t& context,
+                                 const std::string& key,
+                                 const uint64_t source_id,
+                                 const uint64_t sub_count,
+                                 const unsigned int flags) {
+  uint8_t p_buf[dupfixed_type3_size];
+  encode_dupfixed_type3(source_id, sub_count, p_buf);
+  MDB_val dupfixed_key;
+  dupfixed_key.mv_size = key.size();
+  dupfixed_key.mv_data = const_cast<char*>(key.c_str());
+  MDB_val dupfixed_data;
+  dupfixed_data.mv_size = dupfixed_type3_size;
+  dupfixed_data.mv_data = p_buf;
+  int rc = mdb_cursor_put(context.dupfixed_cursor, &dupfixed_key,
+                          &dupfixed_data, flags);
+  if (rc != 0) {
+    std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+    assert(0);
+  }
+}
+
+// the number of block_label bytes a record keeps, 0 when its code is kept
+static size_t stored_label_size(const std::string& block_label) {
   if (block_label.size() > max_block_label_size) {
     std::cerr << "block_label too large: " << block_label << "\n";
     assert(0);
   }
+  return (block_label_code(block_label) == 0) ? block_label.size() : 0;
+}
+
+// add the varint block_label size and block_label, or its code
+static uint8_t* encode_varint_label(const std::string& block_label,
+                                    uint8_t* p) {
+  const uint8_t code = block_label_code(block_label);
+  if (code != 0) {
+    return lmdb_helper::encode_uint64_t(varint_label_code_base + code, p);
+  }
+  const size_t block_label_size = stored_label_size(block_label);
+  p = lmdb_helper::encode_uint64_t(block_label_size, p);
+  std::memcpy(p, block_label.c_str(), block_label_size);
+  return p + block_label_size;
+}
+
+// read the varint block_label size and block_label, or its code
+static const uint8_t* decode_varint_label(const uint8_t* p,
+                                          std::string& block_label) {
+  uint64_t block_label_size;
+  p = lmdb_helper::decode_uint64_t(p, block_label_size);
+  if (block_label_size > varint_label_code_base &&
+      block_label_size <= varint_label_code_base + max_block_label_code) {
+    block_label = block_label_of_code(static_cast<uint8_t>(
+                            block_label_size - varint_label_code_base));
+    return p;
+  }
+  if (block_label_size > max_block_label_size) {
+    std::cerr << "data decode label error in LMDB hash data store\n";
+    assert(0);
+  }
+  block_label = std::string(reinterpret_cast<const char*>(p),
+                            block_label_size);
+  return p + block_label_size;
+}
+
+// encode Type 1 record in the varint format
+static size_t encode_varint_type1(const uint64_t k_entropy,
+                           const std::string& block_label,
+                           const uint64_t source_id,
+                           const uint64_t sub_count,
+                           uint8_t* const p_buf) {
 
   uint8_t* p = p_buf;
 
@@ -131,9 +286,7 @@ static size_t encode_type1(const uint64_t k_entropy,
   p = lmdb_helper::encode_uint64_t(k_entropy, p);
 
   // add block_label size and block_label
-  p = lmdb_helper::encode_uint64_t(block_label_size, p);
-  std::memcpy(p, block_label.c_str(), block_label_size);
-  p += block_label_size;
+  p = encode_varint_label(block_label, p);
 
   // add padding to allow transition to type2
   if (source_id < 0x4000) {
@@ -154,18 +307,12 @@ static size_t encode_type1(const uint64_t k_entropy,
   return p - p_buf;
 }
 
-// encode Type 2 record
-static size_t encode_type2(const uint64_t k_entropy,
+// encode Type 2 record in the varint format
+static size_t encode_varint_type2(const uint64_t k_entropy,
                            const std::string& block_label,
                            const uint64_t count,
                            uint8_t* const p_buf) {
 
-  const size_t block_label_size = block_label.size();
-  if (block_label.size() > max_block_label_size) {
-    std::cerr << "block_label too large: " << block_label << "\n";
-    assert(0);
-  }
-
   uint8_t* p = p_buf;
 
   // add type2 identifier, type2 starts with 0x00
@@ -176,9 +323,7 @@ static size_t encode_type2(const uint64_t k_entropy,
   p = lmdb_helper::encode_uint64_t(k_entropy, p);
 
   // add block_label size and block_label
-  p = lmdb_helper::encode_uint64_t(block_label_size, p);
-  std::memcpy(p, block_label.c_str(), block_label_size);
-  p += block_label_size;
+  p = encode_varint_label(block_label, p);
 
   // add count
   p = put4(p, count);
@@ -192,10 +337,10 @@ static size_t encode_type2(const uint64_t k_entropy,
   return p - p_buf;
 }
 
-// encode Type 3 record
-static size_t encode_type3(uint64_t source_id,
-                           uint64_t sub_count,
-                           uint8_t* const p_buf) {
+// encode Type 3 record in the varint format
+static size_t encode_varint_type3(uint64_t source_id,
+                                  uint64_t sub_count,
+                                  uint8_t* const p_buf) {
 
   uint8_t* p = p_buf;
 
@@ -214,10 +359,111 @@ static size_t encode_type3(uint64_t source_id,
   return p - p_buf;
 }
 
-// write the record given key and data.
+// encode the fixed format head
+static uint8_t* encode_fixed_head(const uint8_t type,
+                                  const size_t num_sources,
+                                  const uint64_t k_entropy,
+                                  const std::string& block_label,
+                                  uint8_t* const p_buf) {
+
+  uint8_t* p = p_buf;
+  *p++ = type;
+  *p++ = static_cast<uint8_t>(stored_label_size(block_label));
+  *p++ = static_cast<uint8_t>(num_sources);
+  *p++ = block_label_code(block_label);
+  return put4(p, k_entropy);
+}
+
+// encode Type 1 record in the given format
+static size_t encode_type1(const uint32_t format,
+                           const uint64_t k_entropy,
+                           const std::string& block_label,
+                           const source_id_sub_counts_t& source_id_sub_counts,
+                           uint8_t* const p_buf) {
+
+  if (source_id_sub_counts.size() == 0 ||
+      source_id_sub_counts.size() > max_type1_sources(format)) {
+    std::cerr << "invalid Type 1 source count "
+              << source_id_sub_counts.size() << "\n";
+    assert(0);
+  }
+
+  if (is_fixed_format(format)) {
+    uint8_t* p = encode_fixed_head(1, source_id_sub_counts.size(),
+                                   k_entropy, block_label, p_buf);
+    for (source_id_sub_counts_t::const_iterator it =
+                    source_id_sub_counts.begin();
+                    it != source_id_sub_counts.end(); ++it) {
+      p = put_source_id4(p, it->source_id);
+      p = put2(p, it->sub_count);
+    }
+    const size_t label_size = stored_label_size(block_label);
+    std::memcpy(p, block_label.c_str(), label_size);
+    return (p - p_buf) + label_size;
+  }
+
+  const source_id_sub_count_t& source = *source_id_sub_counts.begin();
+  return encode_varint_type1(k_entropy, block_label, source.source_id,
+                             source.sub_count, p_buf);
+}
+
+// encode Type 2 record in the given format
+static size_t encode_type2(const uint32_t format,
+                           const uint64_t k_entropy,
+                           const std::string& block_label,
+                           const uint64_t count,
+                           uint8_t* const p_buf) {
+  if (is_fixed_format(format)) {
+    uint8_t* p = encode_fixed_head(0, 0, k_entropy, block_label, p_buf);
+    p = put4(p, count);
+    const size_t label_size = stored_label_size(block_label);
+    std::memcpy(p, block_label.c_str(), label_size);
+    return (p - p_buf) + label_size;
+  }
+  validate_format(format);
+  return encode_varint_type2(k_entropy, block_label, count, p_buf);
+}
+
+// encode Type 3 record in the given format
+static size_t encode_type3(const uint32_t format,
+                           const uint64_t source_id,
+                           const uint64_t sub_count,
+                           uint8_t* const p_buf) {
+  if (format == fixed_hash_data_format) {
+    uint8_t* p = p_buf;
+    *p++ = 1;
+    *p++ = 0;
+    p = put2(p, sub_count);
+    put_source_id4(p, source_id);
+    return fixed_type3_size;
+  }
+  validate_format(format);
+  return encode_varint_type3(source_id, sub_count, p_buf);
+}
+
+// validate the fixed format head and return the size of the fields
+// between the head and the block_label
+static size_t check_fixed_head(const hashdb::lmdb_context_t& context,
+                               const uint8_t type) {
+
+  const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+  const size_t fields_size = (type == 1) ? p[2] * fixed_source_size : 4;
+  if (context.data.mv_size < fixed_head_size || p[0] != type ||
+      context.data.mv_size != fixed_head_size + fields_size + p[1] ||
+      (type == 1 && (p[2] == 0 || p[2] > max_fixed_type1_sources)) ||
+      p[3] > max_block_label_code || (p[3] != 0 && p[1] != 0)) {
+    std::cerr << "data decode error in LMDB hash data store\n";
+    assert(0);
+  }
+  return fields_size;
+}
+
+// write the record given key and data.  Use MDB_APPEND or MDB_APPENDDUP
+// flags when writing in sorted order.
 static void write_record(hashdb::lmdb_context_t& context,
                          const std::string& key,
-                         const uint8_t* const data, const size_t data_size) {
+                         const uint8_t* const data, const size_t data_size,
+                         const unsigned int flags = MDB_NODUPDATA) {
 
   // set key and data
   context.key.mv_size = key.size();
@@ -232,13 +478,27 @@ print_mdb_val("hash_data_support write_record data", context.data);
 #endif
 
   int rc = mdb_cursor_put(context.cursor, &context.key, &context.data,
-                          MDB_NODUPDATA);
+                          flags);
   if (rc != 0) {
     std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
     assert(0);
   }
 }
 
+// delete the only record for the key at cursor and write the given data
+// for the key, which may differ in size.
+static void rewrite_record(hashdb::lmdb_context_t& context,
+                           const std::string& key,
+                           const uint8_t* const data, const size_t data_size) {
+
+  int rc = mdb_cursor_del(context.cursor, 0);
+  if (rc != 0) {
+    std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+    assert(0);
+  }
+  write_record(context, key, data, data_size);
+}
+
 // replace the record given data.  Types 1 and 3 must match size.
 // New type 2 can be smaller but the record size must stay the same.
 static void replace_record(hashdb::lmdb_context_t& context,
@@ -295,9 +555,37 @@ print_mdb_val("hash_data_support replace_record data", context.data);
   // Move cursor forward from Type 2 to correct Type 3 else false and rewind.
   // Return sub_count.
   bool cursor_to_type3(hashdb::lmdb_context_t& context,
+                       const uint32_t format,
                        const uint64_t source_id,
                        uint64_t& sub_count) {
 
+    // seek the record of the source in the dupfixed database
+    if (format == dupfixed_hash_data_format) {
+      uint8_t p_buf[dupfixed_type3_size];
+      encode_dupfixed_type3(source_id, 0, p_buf);
+      MDB_val dupfixed_key = context.key;
+      MDB_val dupfixed_data;
+      dupfixed_data.mv_size = dupfixed_type3_size;
+      dupfixed_data.mv_data = p_buf;
+      int rc = mdb_cursor_get(context.dupfixed_cursor, &dupfixed_key,
+                              &dupfixed_data, MDB_GET_BOTH_RANGE);
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      uint64_t existing_source_id = 0;
+      sub_count = 0;
+      if (rc == 0) {
+        decode_dupfixed_type3(static_cast<uint8_t*>(dupfixed_data.mv_data),
+                              existing_source_id, sub_count);
+      }
+      if (existing_source_id != source_id) {
+        sub_count = 0;
+        return false;
+      }
+      return true;
+    }
+
     while (true) {
       // get next Type 3 record
       int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
@@ -306,7 +594,8 @@ print_mdb_val("hash_data_support replace_record data", context.data);
       if (rc == 0) {
         uint64_t existing_source_id;
         uint64_t existing_sub_count;
-        decode_type3(context, existing_source_id, existing_sub_count);
+        decode_type3(context, format, existing_source_id,
+                     existing_sub_count);
         if (existing_source_id == source_id) {
           sub_count = existing_sub_count;
           return true;
@@ -325,18 +614,50 @@ print_mdb_val("hash_data_support replace_record data", context.data);
     }
   }
 
+  // number of sources a Type 1 record can hold
+  size_t max_type1_sources(const uint32_t format) {
+    validate_format(format);
+    return is_fixed_format(format) ? max_fixed_type1_sources : 1;
+  }
+
   // parse Type 1 context.data into these parameters
   void decode_type1(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& k_entropy,
                     std::string& block_label,
-                    uint64_t& source_id,
-                    uint64_t& sub_count) {
+                    source_id_sub_counts_t& source_id_sub_counts) {
 
 #ifdef DEBUG_LMDB_HASH_DATA_SUPPORT_HPP
 print_mdb_val("hash_data_support decode_type1 key", context.key);
 print_mdb_val("hash_data_support decode_type1 data", context.data);
 #endif
 
+    // read the packed sources in place
+    if (is_fixed_format(format)) {
+      const size_t sources_size = check_fixed_head(context, 1);
+      const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
+      const uint8_t block_label_size = p[1];
+      const uint8_t label_code = p[3];
+      const uint8_t* const p_end = p + fixed_head_size + sources_size;
+      get4(p+4, k_entropy);
+      for (p += fixed_head_size; p < p_end; p += fixed_source_size) {
+        uint64_t source_id;
+        uint64_t sub_count;
+        get4(p, source_id);
+        get2(p+4, sub_count);
+        source_id_sub_counts.insert(source_id_sub_count_t(source_id,
+                                                          sub_count));
+      }
+      block_label = (label_code != 0) ?
+                    block_label_of_code(label_code) :
+                    std::string(reinterpret_cast<const char*>(p_end),
+                                block_label_size);
+      return;
+    }
+    validate_format(format);
+
+    uint64_t source_id;
+    uint64_t sub_count;
     // prepare to read Type 1 entry:
     const uint8_t* const p_start = static_cast<uint8_t*>(context.data.mv_data);
     const uint8_t* p = p_start;
@@ -350,14 +671,8 @@ print_mdb_val("hash_data_support decode_type1 data", context.data);
     // read scaled entropy
     p = lmdb_helper::decode_uint64_t(p, k_entropy);
 
-    // read the hash data block_label size
-    uint64_t block_label_size;
-    p = lmdb_helper::decode_uint64_t(p, block_label_size);
-
-    // read the hash data block_label
-    block_label =
-       std::string(reinterpret_cast<const char*>(p), block_label_size);
-    p += block_label_size;
+    // read the hash data block_label size and block_label
+    p = decode_varint_label(p, block_label);
 
     // compensate for padding
     if (source_id < 0x4000) {
@@ -380,10 +695,12 @@ print_mdb_val("hash_data_support decode_type1 data", context.data);
       std::cerr << "data decode error in LMDB hash data store\n";
       assert(0);
     }
+    source_id_sub_counts.insert(source_id_sub_count_t(source_id, sub_count));
   }
 
   // parse Type 2 context.data into these parameters
   void decode_type2(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& k_entropy,
                     std::string& block_label,
                     uint64_t& count) {
@@ -393,6 +710,19 @@ print_mdb_val("hash_data_support decode_type2 key", context.key);
 print_mdb_val("hash_data_support decode_type2 data", context.data);
 #endif
 
+    // read fields at fixed offsets
+    if (is_fixed_format(format)) {
+      check_fixed_head(context, 0);
+      const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+      get4(p+4, k_entropy);
+      get4(p+8, count);
+      block_label = (p[3] != 0) ? block_label_of_code(p[3]) :
+                    std::string(reinterpret_cast<const char*>(p) +
+                                fixed_head_size + 4, p[1]);
+      return;
+    }
+    validate_format(format);
+
     // prepare to read Type 2 entry:
     const uint8_t* const p_start = static_cast<uint8_t*>(context.data.mv_data);
     const uint8_t* p = p_start;
@@ -407,14 +737,8 @@ print_mdb_val("hash_data_support decode_type2 data", context.data);
     // read scaled entropy
     p = lmdb_helper::decode_uint64_t(p, k_entropy);
 
-    // read the hash data block_label size
-    uint64_t block_label_size;
-    p = lmdb_helper::decode_uint64_t(p, block_label_size);
-
-    // read the hash data block_label
-    block_label =
-       std::string(reinterpret_cast<const char*>(p), block_label_size);
-    p += block_label_size;
+    // read the hash data block_label size and block_label
+    p = decode_varint_label(p, block_label);
 
     // read count
     p = get4(p, count);
@@ -428,6 +752,7 @@ print_mdb_val("hash_data_support decode_type2 data", context.data);
 
   // parse Type 3 context.data into these parameters
   void decode_type3(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& source_id,
                     uint64_t& sub_count) {
 
@@ -436,6 +761,19 @@ print_mdb_val("hash_data_support decode_type3 key", context.key);
 print_mdb_val("hash_data_support decode_type3 data", context.data);
 #endif
 
+    // read fields at fixed offsets
+    if (format == fixed_hash_data_format) {
+      const uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
+      if (context.data.mv_size != fixed_type3_size || p[0] != 1) {
+        std::cerr << "data decode error in LMDB hash data store\n";
+        assert(0);
+      }
+      get2(p+2, sub_count);
+      get4(p+4, source_id);
+      return;
+    }
+    validate_format(format);
+
     // prepare to read Type 1 entry:
     const uint8_t* const p_start = static_cast<uint8_t*>(context.data.mv_data);
     const uint8_t* p = p_start;
@@ -455,18 +793,18 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
 
   // write new Type 1 record, key must be valid
   void new_type1(hashdb::lmdb_context_t& context,
+                 const uint32_t format,
                  const std::string& key,
                  const uint64_t k_entropy,
                  const std::string& block_label,
-                 const uint64_t source_id,
-                 const uint64_t sub_count) {
+                 const source_id_sub_counts_t& source_id_sub_counts) {
 
     // space for encoding
-    uint8_t p_buf[type1_max_size];
+    uint8_t p_buf[record_max_size];
 
     // encode type1
-    const size_t size = encode_type1(k_entropy, block_label,
-                                     source_id, sub_count, p_buf);
+    const size_t size = encode_type1(format, k_entropy, block_label,
+                                     source_id_sub_counts, p_buf);
 
     // write
     write_record(context, key, p_buf, size);
@@ -474,51 +812,93 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
 
   // write new Type 3 record, key must be valid
   void new_type3(hashdb::lmdb_context_t& context,
+                 const uint32_t format,
                  const std::string& key,
                  const uint64_t source_id,
                  const uint64_t sub_count) {
 
+    // write apart from Type 2
+    if (format == dupfixed_hash_data_format) {
+      write_dupfixed_type3(context, key, source_id, sub_count,
+                           MDB_NODUPDATA);
+      return;
+    }
+
     // space for encoding
     uint8_t p_buf[type3_max_size];
 
     // encode type3
-    const size_t size = encode_type3(source_id, sub_count, p_buf);
+    const size_t size = encode_type3(format, source_id, sub_count, p_buf);
 
     // write
     write_record(context, key, p_buf, size);
   }
 
-  // replace Type 1 record at cursor
+  // replace Type 1 record at cursor, which may change its size
   void replace_type1(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t k_entropy,
                      const std::string& block_label,
-                     const uint64_t source_id,
-                     const uint64_t sub_count) {
+                     const source_id_sub_counts_t& source_id_sub_counts) {
 
     // space for encoding
-    uint8_t p_buf[type1_max_size];
+    uint8_t p_buf[record_max_size];
 
     // encode type1
-    const size_t size = encode_type1(k_entropy, block_label,
-                                     source_id, sub_count, p_buf);
+    const size_t size = encode_type1(format, k_entropy, block_label,
+                                     source_id_sub_counts, p_buf);
 
-    // write
-    replace_record(context, key, p_buf, size, true);
+    // write in place if the size is the same
+    if (size == context.data.mv_size) {
+      replace_record(context, key, p_buf, size, true);
+      return;
+    }
+
+    // otherwise rewrite it
+    rewrite_record(context, key, p_buf, size);
+  }
+
+  // replace Type 1 record at cursor with a Type 2 record followed by
+  // Type 3 records for its sources
+  void promote_type1(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
+                     const std::string& key,
+                     const uint64_t k_entropy,
+                     const std::string& block_label,
+                     const uint64_t count,
+                     const source_id_sub_counts_t& source_id_sub_counts) {
+
+    // space for encoding
+    uint8_t p_buf[record_max_size];
+
+    // encode type2
+    const size_t size = encode_type2(format, k_entropy, block_label, count,
+                                     p_buf);
+
+    // rewrite Type 1 as Type 2 then add Type 3 records
+    rewrite_record(context, key, p_buf, size);
+    for (source_id_sub_counts_t::const_iterator it =
+                    source_id_sub_counts.begin();
+                    it != source_id_sub_counts.end(); ++it) {
+      new_type3(context, format, key, it->source_id, it->sub_count);
+    }
   }
 
   // replace Type 2 record at cursor
   void replace_type2(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t k_entropy,
                      const std::string& block_label,
                      const uint64_t count) {
 
     // space for encoding that can replace old type1
-    uint8_t p_buf[type1_max_size];
+    uint8_t p_buf[record_max_size];
 
-    // encode type1
-    const size_t size = encode_type2(k_entropy, block_label, count, p_buf);
+    // encode type2
+    const size_t size = encode_type2(format, k_entropy, block_label, count,
+                                     p_buf);
 
     // write
     replace_record(context, key, p_buf, size, false);
@@ -526,19 +906,185 @@ print_mdb_val("hash_data_support decode_type3 data", context.data);
 
   // replace Type 3 record at cursor
   void replace_type3(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t& source_id,
                      const uint64_t& sub_count) {
 
+    // the record keeps its place since it sorts by source_id
+    if (format == dupfixed_hash_data_format) {
+      write_dupfixed_type3(context, key, source_id, sub_count, MDB_CURRENT);
+      return;
+    }
+
     // space for encoding
     uint8_t p_buf[type3_max_size];
 
     // encode type3
-    const size_t size = encode_type3(source_id, sub_count, p_buf);
+    const size_t size = encode_type3(format, source_id, sub_count, p_buf);
 
     // write
     replace_record(context, key, p_buf, size, true);
   }
 
+  // append Type 1 record, key must be greater than all existing keys
+  void append_type1(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const source_id_sub_counts_t& source_id_sub_counts) {
+
+    // space for encoding
+    uint8_t p_buf[record_max_size];
+
+    // encode type1
+    const size_t size = encode_type1(format, k_entropy, block_label,
+                                     source_id_sub_counts, p_buf);
+
+    // append
+    write_record(context, key, p_buf, size, MDB_APPEND);
+  }
+
+  // append Type 2 record followed by its Type 3 records, key must be
+  // greater than all existing keys
+  void append_type2(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t count,
+                    const source_id_sub_counts_t& source_id_sub_counts) {
+
+    // space for encoding
+    uint8_t p_buf[record_max_size];
+
+    // encode and append type2, which sorts before all type3
+    const size_t size = encode_type2(format, k_entropy, block_label, count,
+                                     p_buf);
+    write_record(context, key, p_buf, size, MDB_APPEND);
+
+    // dupfixed type3 records sort by source_id, as the sources do
+    if (format == dupfixed_hash_data_format) {
+      unsigned int flags = MDB_APPEND;
+      for (source_id_sub_counts_t::const_iterator it =
+                      source_id_sub_counts.begin();
+                      it != source_id_sub_counts.end(); ++it) {
+        write_dupfixed_type3(context, key, it->source_id, it->sub_count,
+                             flags);
+        flags = MDB_APPENDDUP;
+      }
+      return;
+    }
+
+    // encode type3 records and sort them the way LMDB sorts duplicates
+    std::vector<std::string> encodings;
+    encodings.reserve(source_id_sub_counts.size());
+    for (source_id_sub_counts_t::const_iterator it =
+                    source_id_sub_counts.begin();
+                    it != source_id_sub_counts.end(); ++it) {
+      const size_t type3_size = encode_type3(format, it->source_id,
+                                             it->sub_count, p_buf);
+      encodings.push_back(std::string(reinterpret_cast<char*>(p_buf),
+                                      type3_size));
+    }
+    std::sort(encodings.begin(), encodings.end());
+
+    // append type3 records
+    for (std::vector<std::string>::const_iterator it = encodings.begin();
+                    it != encodings.end(); ++it) {
+      write_record(context, key,
+                   reinterpret_cast<const uint8_t*>(it->c_str()),
+                   it->size(), MDB_APPENDDUP);
+    }
+  }
+
+  // read the dupfixed Type 3 records of the key a page at a time
+  size_t read_dupfixed_type3(hashdb::lmdb_context_t& context,
+                             const MDB_val& key,
+                             const size_t first_source,
+                             const size_t max_sources,
+                             source_id_sub_counts_t& source_id_sub_counts) {
+
+    // set the cursor at the first record of the key
+    MDB_val dupfixed_key = key;
+    MDB_val dupfixed_data;
+    int rc = mdb_cursor_get(context.dupfixed_cursor, &dupfixed_key,
+                            &dupfixed_data, MDB_SET);
+    if (rc == MDB_NOTFOUND) {
+      return 0;
+    }
+    size_t num_sources = 0;
+    if (rc == 0) {
+      rc = mdb_cursor_count(context.dupfixed_cursor, &num_sources);
+    }
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    // the sources to keep
+    const size_t end = (max_sources > 0 &&
+                        first_source + max_sources < num_sources) ?
+                       first_source + max_sources : num_sources;
+
+    // a lone record is not kept on a page of duplicates, so it is the
+    // data at the cursor
+    if (num_sources > 1) {
+      rc = mdb_cursor_get(context.dupfixed_cursor, &dupfixed_key,
+                          &dupfixed_data, MDB_GET_MULTIPLE);
+    }
+
+    // decode the records in the window from each page, which are in
+    // source_id order
+    size_t index = 0;
+    while (rc == 0 && index < end) {
+      if (dupfixed_data.mv_size % dupfixed_type3_size != 0) {
+        std::cerr << "data decode error in LMDB hash data store\n";
+        assert(0);
+      }
+      const size_t n = dupfixed_data.mv_size / dupfixed_type3_size;
+      const uint8_t* const p =
+                         static_cast<const uint8_t*>(dupfixed_data.mv_data);
+      for (size_t i = (first_source > index) ? first_source - index : 0;
+           i < n && index + i < end; ++i) {
+        uint64_t source_id;
+        uint64_t sub_count;
+        decode_dupfixed_type3(p + i * dupfixed_type3_size, source_id,
+                              sub_count);
+        source_id_sub_counts.insert(source_id_sub_counts.end(),
+                             source_id_sub_count_t(source_id, sub_count));
+      }
+      index += n;
+      if (index < end) {
+        rc = mdb_cursor_get(context.dupfixed_cursor, &dupfixed_key,
+                            &dupfixed_data, MDB_NEXT_MULTIPLE);
+      }
+    }
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return num_sources;
+  }
+
+  // delete any Type 3 records of the key kept apart from its Type 2
+  void delete_type3(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key) {
+    if (format != dupfixed_hash_data_format) {
+      return;
+    }
+    MDB_val dupfixed_key;
+    dupfixed_key.mv_size = key.size();
+    dupfixed_key.mv_data = const_cast<char*>(key.c_str());
+    int rc = mdb_del(context.txn, mdb_cursor_dbi(context.dupfixed_cursor),
+                     &dupfixed_key, NULL);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+  }
+
 } // end namespace hashdb
 
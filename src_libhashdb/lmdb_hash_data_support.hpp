@@ -29,64 +29,89 @@
 
 #include <unistd.h>
 #include <string>
+#include <stdint.h>
 #include "lmdb_context.hpp"
+#include "source_id_sub_counts.hpp"
 
 namespace hashdb {
 
   // MAX
   extern const size_t max_block_label_size;
 
+  // record formats, selected by settings_t::hash_data_format
+  extern const uint32_t varint_hash_data_format;
+  extern const uint32_t fixed_hash_data_format;
+  extern const uint32_t dupfixed_hash_data_format;
+
   // move cursor to first entry of current key
   void cursor_to_first_current(hashdb::lmdb_context_t& context);
 
   // Move cursor forward from Type 2 to correct Type 3 else false and rewind.
   // Return sub_count.
   bool cursor_to_type3(hashdb::lmdb_context_t& context,
+                       const uint32_t format,
                        const uint64_t source_id,
                        uint64_t& sub_count);
 
-  // parse Type 1 context.data into these parameters
+  // number of sources a Type 1 record can hold
+  size_t max_type1_sources(const uint32_t format);
+
+  // parse Type 1 context.data into these parameters, adding its sources
   void decode_type1(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& k_entropy,
                     std::string& block_label,
-                    uint64_t& source_id,
-                    uint64_t& sub_count);
+                    source_id_sub_counts_t& source_id_sub_counts);
 
   // parse Type 2 context.data into these parameters
   void decode_type2(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& k_entropy,
                     std::string& block_label,
                     uint64_t& count);
 
   // parse Type 3 context.data into these parameters
   void decode_type3(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
                     uint64_t& source_id,
                     uint64_t& sub_count);
 
   // write new Type 1 record, key must be valid
   void new_type1(hashdb::lmdb_context_t& context,
+                 const uint32_t format,
                  const std::string& key,
                  const uint64_t k_entropy,
                  const std::string& block_label,
-                 const uint64_t source_id,
-                 const uint64_t sub_count);
+                 const source_id_sub_counts_t& source_id_sub_counts);
 
   // write new Type 3 record, key must be valid
   void new_type3(hashdb::lmdb_context_t& context,
+                 const uint32_t format,
                  const std::string& key,
                  const uint64_t source_id,
                  const uint64_t sub_count);
 
-  // replace Type 1 record at cursor
+  // replace Type 1 record at cursor, which may change its size
   void replace_type1(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t k_entropy,
                      const std::string& block_label,
-                     const uint64_t source_id,
-                     const uint64_t sub_count);
+                     const source_id_sub_counts_t& source_id_sub_counts);
+
+  // replace Type 1 record at cursor with a Type 2 record followed by
+  // Type 3 records for its sources
+  void promote_type1(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
+                     const std::string& key,
+                     const uint64_t k_entropy,
+                     const std::string& block_label,
+                     const uint64_t count,
+                     const source_id_sub_counts_t& source_id_sub_counts);
 
   // replace Type 2 record at cursor, maybe over discontinued type 1
   void replace_type2(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t k_entropy,
                      const std::string& block_label,
@@ -94,10 +119,44 @@ namespace hashdb {
 
   // replace Type 3 record at cursor
   void replace_type3(hashdb::lmdb_context_t& context,
+                     const uint32_t format,
                      const std::string& key,
                      const uint64_t& source_id,
                      const uint64_t& sub_count);
 
+  // append Type 1 record, key must be greater than all existing keys
+  void append_type1(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const source_id_sub_counts_t& source_id_sub_counts);
+
+  // append Type 2 record followed by its Type 3 records, key must be
+  // greater than all existing keys
+  void append_type2(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key,
+                    const uint64_t k_entropy,
+                    const std::string& block_label,
+                    const uint64_t count,
+                    const source_id_sub_counts_t& source_id_sub_counts);
+
+  // Add the max_sources dupfixed Type 3 sources of the key after the
+  // first first_source, all if max_sources is 0.  Records are read from
+  // the dupfixed database a page at a time and only those kept are
+  // decoded.  Return the number of Type 3 records of the key.
+  size_t read_dupfixed_type3(hashdb::lmdb_context_t& context,
+                             const MDB_val& key,
+                             const size_t first_source,
+                             const size_t max_sources,
+                             source_id_sub_counts_t& source_id_sub_counts);
+
+  // delete any Type 3 records of the key kept apart from its Type 2
+  void delete_type3(hashdb::lmdb_context_t& context,
+                    const uint32_t format,
+                    const std::string& key);
+
 } // end namespace hashdb
 
 #endif
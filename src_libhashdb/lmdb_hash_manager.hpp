@@ -20,6 +20,41 @@
 /**
  * \file
  * Manage the LMDB hash store.  Threadsafe.
+ *
+ * When opened READ_ONLY, a Bloom filter of the hash store prefixes may
+ * be kept in memory so that most absent hashes are rejected without an
+ * LMDB lookup.  The filter is read from hash_filter in the hashdb
+ * directory when it matches the hash store.  Else it is built in memory
+ * only when asked for, since building it reads the whole store, and it
+ * is not saved.  The filter is not used once the hash store changes.
+ *
+ * When opened RW_MODIFY, a current saved filter is loaded and new
+ * prefixes are added to it as they are inserted.  Call flush_filter to
+ * save it for the new state of the hash store, building it first if
+ * there was none.
+ *
+ * The store may be partitioned by hash prefix into shards that are
+ * written concurrently, see lmdb_shard.hpp.  Each shard has its own
+ * filter, saved to hash_filter_i for shard i.
+ *
+ * When opened READ_ONLY, a shard may also have a sorted prefix array,
+ * see hash_prefix_index.hpp, that answers lookups instead of LMDB while
+ * the shard is unchanged.  The index saved to hash_prefix_index in the
+ * hashdb directory by save_prefix_indexes is mapped when it matches the
+ * shard.  Else the index is built in memory only when asked for, since
+ * building it reads the whole shard, and it is not saved.  A shard with
+ * a prefix index needs no filter.
+ *
+ * When READ_ONLY on a frozen hashdb, hashes are found in the frozen hash
+ * store, which has exact counts, and their counts are rounded to the
+ * approximate count encoding, see frozen_hash_store.hpp.
+ *
+ * When RW_MODIFY, maintenance may be deferred during a bulk load so that
+ * inserts and removals do not write the hash store at all.  The store is
+ * then cleared and rebuilt from the hash data store in one pass of
+ * appends, see clear and append_batch.  Until then it is stale, and a
+ * READ_ONLY manager opened with the hash data manager finds hashes there
+ * instead, with their counts rounded to the approximate count encoding.
  */
 
 /** The following Python program generates example count encodings:
@@ -60,11 +95,20 @@ for i in range(1500):
 #include "lmdb_helper.h"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
+#include "hash_batch.hpp"
+#include "hash_filter.hpp"
+#include "portable_filter.hpp"
+#include "hash_prefix_index.hpp"
+#include "lmdb_shard.hpp"
+#include "lmdb_hash_data_manager.hpp"
+#include "frozen_hash_store.hpp"
+#include "stage_stats.hpp"
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <string>
 #include <set>
+#include <vector>
 #include <cassert>
 #ifdef DEBUG_LMDB_HASH_MANAGER_HPP
 #include "lmdb_print_val.hpp"
@@ -87,9 +131,15 @@ class lmdb_hash_manager_t {
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
-  MDB_env* env;
+  const uint32_t hash_shard_bits;
+  hashdb::lmdb_shards_t shards;
+  std::vector<hashdb::hash_filter_t*> hash_filters; // per shard, or NULL
+  std::vector<hashdb::hash_prefix_index_t*> prefix_indexes; // or NULL
+  hashdb::frozen_hash_store_t* frozen;              // or NULL
+  const hashdb::lmdb_hash_data_manager_t* hash_data; // if stale, or NULL
+  bool is_deferred;                           // writes are skipped
 #ifdef HAVE_PTHREAD
-  mutable pthread_mutex_t M;                  // mutext
+  mutable pthread_mutex_t M;                  // mutext for changes
 #else
   mutable int M;                              // placeholder
 #endif
@@ -122,32 +172,20 @@ class lmdb_hash_manager_t {
     return (m + 4) * lookup[x] - 5;
   }
 
-  public:
-  lmdb_hash_manager_t(const std::string& p_hashdb_dir,
-                      const hashdb::file_mode_type_t p_file_mode) :
-          hashdb_dir(p_hashdb_dir),
-          file_mode(p_file_mode),
-          env(lmdb_helper::open_env(
-                           hashdb_dir + "/lmdb_hash_store", file_mode)),
-          M() {
-    MUTEX_INIT(&M);
+  // add changes counted while holding a shard lock
+  void add_changes(hashdb::lmdb_changes_t& changes,
+                   const hashdb::lmdb_changes_t& shard_changes) const {
+    MUTEX_LOCK(&M);
+    changes += shard_changes;
+    MUTEX_UNLOCK(&M);
   }
 
-  ~lmdb_hash_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
-
-    MUTEX_DESTROY(&M);
-  }
-
-  void insert(const std::string& binary_hash, const size_t count,
-              hashdb::lmdb_changes_t& changes) {
-
-    // require valid binary_hash
-    if (binary_hash.size() == 0) {
-      std::cerr << "Usage error: the binary_hash value provided to insert is empty.\n";
-      return;
-    }
+  // Insert into the context and the filter of its shard.  The caller
+  // owns the shard lock and the context.
+  void insert_in_context(hashdb::lmdb_context_t& context,
+                         hashdb::hash_filter_t* const hash_filter,
+                         const std::string& binary_hash, const size_t count,
+                         hashdb::lmdb_changes_t& changes) {
 
     // ************************************************************
     // make key and data from binary_hash and count
@@ -168,15 +206,6 @@ class lmdb_hash_manager_t {
     // ************************************************************
     // insert
     // ************************************************************
-    MUTEX_LOCK(&M);
-
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
-
-    // get context
-    hashdb::lmdb_context_t context(env, true, false);
-    context.open();
-
     // see if key is already there
     // set context key
     context.key.mv_size = prefix_size;
@@ -208,9 +237,10 @@ print_mdb_val("hash_manager insert not found data", context.data);
       }
 
       // new hash inserted
-      context.close();
+      if (hash_filter != NULL) {
+        hash_filter->add(key, prefix_size);
+      }
       ++changes.hash_inserted;
-      MUTEX_UNLOCK(&M);
       return;
 
     // handle when key already exists
@@ -247,8 +277,6 @@ print_mdb_val("hash_manager insert update count data", context.data);
       }
 
       // done because suffix matched
-      context.close();
-      MUTEX_UNLOCK(&M);
       return;
     } else {
 
@@ -258,6 +286,561 @@ print_mdb_val("hash_manager insert update count data", context.data);
     }
   }
 
+  std::string filter_filename(const size_t s) const {
+    return shard_store_dir(hashdb_dir, "hash_filter", hash_shard_bits, s);
+  }
+
+  // read the saved filter of a shard if it is current, else build it if
+  // is_built is set.  NULL if the shard is empty.
+  hashdb::hash_filter_t* open_filter(const size_t s,
+                                     const bool is_built) const {
+    const lmdb_shard_t& shard = shards[s];
+    const size_t num_keys = lmdb_helper::size(shard.env);
+    if (num_keys == 0) {
+      // no filter for an empty store
+      return NULL;
+    }
+    hashdb::hash_filter_t* filter = hashdb::hash_filter_t::read(
+                       filter_filename(s), shard.last_txnid(), num_keys);
+    if (filter != NULL || !is_built) {
+      return filter;
+    }
+    return build_filter(s);
+  }
+
+  // build the filter of a shard from every prefix in one read snapshot.
+  // NULL if the shard is empty.
+  hashdb::hash_filter_t* build_filter(const size_t s) const {
+    const lmdb_shard_t& shard = shards[s];
+    if (lmdb_helper::size(shard.env) == 0) {
+      return NULL;
+    }
+    hashdb::lmdb_context_t context(shard.env, false, false,
+                                   shard.read_txn_cache);
+    context.open();
+    MDB_stat stat;
+    int rc = mdb_stat(context.txn, context.dbi, &stat);
+    if (rc != 0) {
+      std::cerr << "LMDB stat error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    hashdb::hash_filter_t* filter = new hashdb::hash_filter_t(
+                                 mdb_txn_id(context.txn), stat.ms_entries);
+    rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                        MDB_FIRST);
+    while (rc == 0) {
+      filter->add(context.key.mv_data, context.key.mv_size);
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return filter;
+  }
+
+  std::string prefix_index_filename(const size_t s) const {
+    return shard_store_dir(hashdb_dir, "hash_prefix_index",
+                           hash_shard_bits, s);
+  }
+
+  // map the saved prefix index of a shard if it is current, else build
+  // it if is_built is set.  NULL if the shard is empty or has short
+  // keys.
+  hashdb::hash_prefix_index_t* open_prefix_index(const size_t s,
+                                                 const bool is_built) const {
+    const lmdb_shard_t& shard = shards[s];
+    const size_t num_keys = lmdb_helper::size(shard.env);
+    if (num_keys == 0) {
+      return NULL;
+    }
+    hashdb::hash_prefix_index_t* index = hashdb::hash_prefix_index_t::read(
+               prefix_index_filename(s), shard.last_txnid(), num_keys);
+    if (index != NULL || !is_built) {
+      return index;
+    }
+    return build_prefix_index(s);
+  }
+
+  // build the prefix index of a shard from every key in one read
+  // snapshot.  NULL if the shard is empty or has short keys.
+  hashdb::hash_prefix_index_t* build_prefix_index(const size_t s) const {
+    const lmdb_shard_t& shard = shards[s];
+    if (lmdb_helper::size(shard.env) == 0) {
+      return NULL;
+    }
+    hashdb::lmdb_context_t context(shard.env, false, false,
+                                   shard.read_txn_cache);
+    context.open();
+    MDB_stat stat;
+    int rc = mdb_stat(context.txn, context.dbi, &stat);
+    if (rc != 0) {
+      std::cerr << "LMDB stat error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    hashdb::hash_prefix_index_t* index = new hashdb::hash_prefix_index_t(
+                                 mdb_txn_id(context.txn), stat.ms_entries);
+    rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                        MDB_FIRST);
+    while (rc == 0) {
+      if (context.key.mv_size != hashdb::hash_prefix_index_t::prefix_size ||
+          context.data.mv_size != 1) {
+        // keys of short hashes are not indexed
+        context.close();
+        delete index;
+        return NULL;
+      }
+      index->add(context.key.mv_data,
+                 static_cast<uint8_t*>(context.data.mv_data)[0]);
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+    if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    index->finish();
+    return index;
+  }
+
+  // the prefix index of the shard if it is current, else NULL
+  const hashdb::hash_prefix_index_t* current_prefix_index(
+                                               const size_t s) const {
+    const hashdb::hash_prefix_index_t* const index = prefix_indexes[s];
+    if (index == NULL || index->txnid != shards[s].last_txnid()) {
+      // no index or the hash store changed
+      return NULL;
+    }
+    return index;
+  }
+
+  // false if the filter of the shard shows that the prefix is absent
+  bool filter_may_contain(const size_t s, const void* const prefix,
+                          const size_t prefix_size) const {
+    const hashdb::hash_filter_t* const hash_filter = hash_filters[s];
+    if (hash_filter == NULL || hash_filter->txnid != shards[s].last_txnid()) {
+      // no filter or the hash store changed
+      return true;
+    }
+    return hash_filter->maybe_contains(prefix, prefix_size);
+  }
+
+  public:
+  /**
+   * Open the hash store.  A READ_ONLY store that is stale because its
+   * rebuild was deferred is opened with the hash data manager that
+   * lookups use instead, which must outlive it.  A READ_ONLY store
+   * builds the prefix indexes and filters that are not saved if
+   * build_indexes is set, for long-running scans that make up the cost.
+   */
+  lmdb_hash_manager_t(const std::string& p_hashdb_dir,
+                      const hashdb::file_mode_type_t p_file_mode,
+                      const uint32_t p_hash_shard_bits = 0,
+                      const lmdb_helper::env_policy_t& policy =
+                                                lmdb_helper::env_policy_t(),
+                      const hashdb::lmdb_hash_data_manager_t* const
+                                                p_hash_data = NULL,
+                      const bool build_indexes = false) :
+          hashdb_dir(p_hashdb_dir),
+          file_mode(p_file_mode),
+          hash_shard_bits(p_hash_shard_bits),
+          shards(hashdb_dir, "lmdb_hash_store", file_mode, false,
+                 hash_shard_bits, policy),
+          hash_filters(shards.count(), NULL),
+          prefix_indexes(shards.count(), NULL),
+          frozen((file_mode == hashdb::READ_ONLY) ?
+                 hashdb::frozen_hash_store_t::open(hashdb_dir) : NULL),
+          hash_data((file_mode == hashdb::READ_ONLY) ? p_hash_data : NULL),
+          is_deferred(false),
+          M() {
+    MUTEX_INIT(&M);
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (hash_data != NULL) {
+        // lookups do not use the stale store
+        continue;
+      }
+      if (file_mode == hashdb::READ_ONLY) {
+        prefix_indexes[s] = open_prefix_index(s, build_indexes);
+        if (prefix_indexes[s] == NULL) {
+          hash_filters[s] = open_filter(s, build_indexes);
+        }
+      } else if (file_mode == hashdb::RW_MODIFY) {
+        // maintain the saved filter if it is current
+        hash_filters[s] = hashdb::hash_filter_t::read(filter_filename(s),
+                  shards[s].last_txnid(), lmdb_helper::size(shards[s].env));
+      }
+    }
+  }
+
+  ~lmdb_hash_manager_t() {
+    for (size_t s=0; s<hash_filters.size(); ++s) {
+      delete hash_filters[s];
+    }
+    for (size_t s=0; s<prefix_indexes.size(); ++s) {
+      delete prefix_indexes[s];
+    }
+    delete frozen;
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only shards in a child process after fork.  The
+   * hash filters, prefix indexes, and frozen store are kept as the child
+   * inherited them, so they are shared with the parent until written.
+   */
+  void reopen_after_fork() {
+    shards.reopen_after_fork();
+  }
+
+  /**
+   * Skip or resume maintaining the hash store.  While deferred, insert,
+   * insert_batch, append_batch, and remove_batch do nothing.  Set before
+   * writing.
+   */
+  void set_deferred(const bool p_is_deferred) {
+    is_deferred = p_is_deferred;
+  }
+
+  bool deferred() const {
+    return is_deferred;
+  }
+
+  /**
+   * Remove every hash for a rebuild, and drop the filters, which the next
+   * READ_ONLY open builds again.
+   */
+  void clear() {
+    for (size_t s=0; s<shards.count(); ++s) {
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+      hashdb::lmdb_context_t context(shard.env, true, false);
+      context.open();
+      const int rc = mdb_drop(context.txn, context.dbi, 0);
+      if (rc != 0) {
+        std::cerr << "LMDB drop error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      context.close();
+      delete hash_filters[s];
+      hash_filters[s] = NULL;
+      std::remove(filter_filename(s).c_str());
+      MUTEX_UNLOCK(&shard.M);
+    }
+  }
+
+  void insert(const std::string& binary_hash, const size_t count,
+              hashdb::lmdb_changes_t& changes) {
+
+    if (is_deferred) {
+      return;
+    }
+
+    // require valid binary_hash
+    if (binary_hash.size() == 0) {
+      std::cerr << "Usage error: the binary_hash value provided to insert is empty.\n";
+      return;
+    }
+
+    const size_t s = shards.index(binary_hash);
+    lmdb_shard_t& shard = shards[s];
+    hashdb::lmdb_changes_t shard_changes;
+    MUTEX_LOCK(&shard.M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(shard.env);
+
+    // get context
+    hashdb::lmdb_context_t context(shard.env, true, false);
+    context.open();
+    insert_in_context(context, hash_filters[s], binary_hash, count,
+                      shard_changes);
+    context.close();
+    MUTEX_UNLOCK(&shard.M);
+    add_changes(changes, shard_changes);
+  }
+
+  /**
+   * Insert the hashes of a batch using one write transaction, where
+   * counts holds the updated source count for each entry.
+   */
+  void insert_batch(const hash_batch_entries_t& entries,
+                    const std::vector<size_t>& counts,
+                    hashdb::lmdb_changes_t& changes) {
+
+    if (entries.size() != counts.size()) {
+      std::cerr << "program error in insert_batch counts\n";
+      assert(0);
+    }
+    if (entries.size() == 0 || is_deferred) {
+      return;
+    }
+
+    // find the shard of each entry, skipping entries rejected by the
+    // hash data store
+    std::vector<size_t> entry_shards(entries.size(), shards.count());
+    std::vector<size_t> shard_sizes(shards.count(), 0);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].block_hash.size() == 0) {
+        continue;
+      }
+      entry_shards[i] = shards.index(entries[i].block_hash);
+      ++shard_sizes[entry_shards[i]];
+    }
+
+    // write the entries of each shard in one write transaction
+    hashdb::lmdb_changes_t shard_changes;
+    for (size_t s = 0; s < shards.count(); ++s) {
+      if (shard_sizes[s] == 0) {
+        continue;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+
+      // maybe grow the DB with room for every entry since the map cannot
+      // grow while the transaction is open
+      lmdb_helper::maybe_grow(shard.env,
+                              10 + shard_sizes[s] * batch_pages_per_entry);
+
+      // get context
+      hashdb::lmdb_context_t context(shard.env, true, false);
+      context.open();
+      for (size_t i = 0; i < entries.size(); ++i) {
+        if (entry_shards[i] == s) {
+          insert_in_context(context, hash_filters[s], entries[i].block_hash,
+                            counts[i], shard_changes);
+        }
+      }
+      context.close();
+      MUTEX_UNLOCK(&shard.M);
+    }
+    add_changes(changes, shard_changes);
+  }
+
+  /**
+   * Update the hashes of a removal using one write transaction per
+   * shard, where counts holds the source count left under the prefix of
+   * each hash.  A count of 0 removes the prefix.  The filter keeps the
+   * prefix, which only adds a false positive.
+   */
+  void remove_batch(const std::vector<std::string>& block_hashes,
+                    const std::vector<size_t>& counts,
+                    hashdb::lmdb_changes_t& changes) {
+
+    if (block_hashes.size() != counts.size()) {
+      std::cerr << "program error in remove_batch counts\n";
+      assert(0);
+    }
+    if (is_deferred) {
+      return;
+    }
+
+    // find the shard of each hash
+    std::vector<size_t> entry_shards(block_hashes.size(), shards.count());
+    std::vector<size_t> shard_sizes(shards.count(), 0);
+    for (size_t i = 0; i < block_hashes.size(); ++i) {
+      if (block_hashes[i].size() == 0) {
+        continue;
+      }
+      entry_shards[i] = shards.index(block_hashes[i]);
+      ++shard_sizes[entry_shards[i]];
+    }
+
+    // write the entries of each shard in one write transaction
+    hashdb::lmdb_changes_t shard_changes;
+    for (size_t s = 0; s < shards.count(); ++s) {
+      if (shard_sizes[s] == 0) {
+        continue;
+      }
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+
+      // get context
+      hashdb::lmdb_context_t context(shard.env, true, false);
+      context.open();
+      for (size_t i = 0; i < block_hashes.size(); ++i) {
+        if (entry_shards[i] != s) {
+          continue;
+        }
+        const std::string& binary_hash = block_hashes[i];
+        if (counts[i] != 0) {
+          insert_in_context(context, NULL, binary_hash, counts[i],
+                            shard_changes);
+          continue;
+        }
+
+        // remove the prefix
+        const size_t prefix_size = (binary_hash.size() > num_prefix_bytes) ?
+                                   num_prefix_bytes : binary_hash.size();
+        context.key.mv_size = prefix_size;
+        context.key.mv_data = const_cast<char*>(binary_hash.c_str());
+        int rc = mdb_del(context.txn, context.dbi, &context.key, NULL);
+        if (rc == 0) {
+          ++shard_changes.hash_removed;
+        } else if (rc != MDB_NOTFOUND) {
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+      }
+      context.close();
+      MUTEX_UNLOCK(&shard.M);
+    }
+    add_changes(changes, shard_changes);
+  }
+
+  /**
+   * Append the hashes of a batch using one write transaction, where
+   * counts holds the updated source count for each entry.  Hashes must
+   * be in LMDB key order and not less than existing hashes.  Hashes
+   * that share the prefix of the previous hash update its count.
+   */
+  void append_batch(const hash_batch_entries_t& entries,
+                    const std::vector<size_t>& counts,
+                    hashdb::lmdb_changes_t& changes) {
+
+    if (entries.size() != counts.size()) {
+      std::cerr << "program error in append_batch counts\n";
+      assert(0);
+    }
+    if (entries.size() == 0 || is_deferred) {
+      return;
+    }
+
+    // append each run of entries of one shard in one write transaction,
+    // where entries rejected by the hash data store join the run
+    hashdb::lmdb_changes_t shard_changes;
+    size_t begin = 0;
+    while (begin < entries.size()) {
+      const size_t s = shards.index(entries[begin].block_hash);
+      size_t end = begin + 1;
+      while (end < entries.size() && (entries[end].block_hash.size() == 0 ||
+                               shards.index(entries[end].block_hash) == s)) {
+        ++end;
+      }
+      append_run(s, entries, counts, begin, end, shard_changes);
+      begin = end;
+    }
+    add_changes(changes, shard_changes);
+  }
+
+  private:
+  // append entries [begin, end) to one shard in one write transaction
+  void append_run(const size_t s,
+                  const hash_batch_entries_t& entries,
+                  const std::vector<size_t>& counts,
+                  const size_t begin, const size_t end,
+                  hashdb::lmdb_changes_t& changes) {
+
+    lmdb_shard_t& shard = shards[s];
+    hashdb::hash_filter_t* const hash_filter = hash_filters[s];
+    MUTEX_LOCK(&shard.M);
+
+    // maybe grow the DB with room for every entry since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(shard.env,
+                            10 + (end - begin) * batch_pages_per_entry);
+
+    // get context
+    hashdb::lmdb_context_t context(shard.env, true, false);
+    context.open();
+
+    // start from the last existing prefix
+    std::string last_prefix = "";
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_LAST);
+    if (rc == 0) {
+      last_prefix = std::string(static_cast<char*>(context.key.mv_data),
+                                context.key.mv_size);
+    } else if (rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    for (size_t i = begin; i < end; ++i) {
+
+      const std::string& binary_hash = entries[i].block_hash;
+      if (binary_hash.size() == 0) {
+        continue;
+      }
+      const std::string prefix = binary_hash.substr(0, num_prefix_bytes);
+
+      if (prefix == last_prefix) {
+        // update the last prefix in place
+        insert_in_context(context, hash_filter, binary_hash, counts[i],
+                          changes);
+        continue;
+      }
+
+      // append the new prefix
+      uint8_t data[1];
+      data[0] = count_to_byte(counts[i]);
+      context.key.mv_size = prefix.size();
+      context.key.mv_data =
+                 static_cast<void*>(const_cast<char*>(prefix.c_str()));
+      context.data.mv_size = 1;
+      context.data.mv_data = data;
+      rc = mdb_put(context.txn, context.dbi,
+                   &context.key, &context.data, MDB_APPEND);
+
+      // the append must work
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      if (hash_filter != NULL) {
+        hash_filter->add(prefix.c_str(), prefix.size());
+      }
+      ++changes.hash_inserted;
+      last_prefix = prefix;
+    }
+    context.close();
+    MUTEX_UNLOCK(&shard.M);
+  }
+
+  public:
+
+  /**
+   * Save the maintained filters for the current state of the hash store,
+   * first building the filter of a shard that has none or has outgrown
+   * it.  Returns the sum of the transaction IDs the saved filters are
+   * for, or 0 if a shard has no current filter.
+   */
+  uint64_t flush_filter() {
+    if (file_mode != hashdb::RW_MODIFY) {
+      return 0;
+    }
+    uint64_t generation = 0;
+    bool is_current = true;
+    for (size_t s=0; s<shards.count(); ++s) {
+      lmdb_shard_t& shard = shards[s];
+      MUTEX_LOCK(&shard.M);
+      if (hash_filters[s] != NULL) {
+        hash_filters[s]->stamp(shard.last_txnid(),
+                               lmdb_helper::size(shard.env));
+      }
+      if (hash_filters[s] == NULL || hash_filters[s]->is_overfull()) {
+        // build a right-sized filter
+        delete hash_filters[s];
+        hash_filters[s] = build_filter(s);
+      }
+      hashdb::hash_filter_t* const hash_filter = hash_filters[s];
+      if (hash_filter == NULL) {
+        // an empty shard has no filter
+        std::remove(filter_filename(s).c_str());
+        is_current = false;
+      } else if (!hash_filter->write(filter_filename(s))) {
+        std::remove(filter_filename(s).c_str());
+        is_current = false;
+      } else {
+        generation += hash_filter->txnid;
+      }
+      MUTEX_UNLOCK(&shard.M);
+    }
+    return is_current ? generation : 0;
+  }
+
   /**
    * Find if hash is present, return approximate count.
    */
@@ -269,6 +852,16 @@ print_mdb_val("hash_manager insert update count data", context.data);
       assert(0);
     }
 
+    if (frozen != NULL) {
+      const size_t approximate_count = find_frozen(binary_hash);
+      lookup_record(approximate_count ? HASH_STORE_HIT : HASH_STORE_MISS, 1);
+      return approximate_count;
+    }
+
+    if (hash_data != NULL) {
+      return byte_to_count(count_to_byte(hash_data->find_count(binary_hash)));
+    }
+
     // ************************************************************
     // make key and data from binary_hash
     // ************************************************************
@@ -279,12 +872,35 @@ print_mdb_val("hash_manager insert update count data", context.data);
     size_t prefix_size =
               (hash_size > num_prefix_bytes) ? num_prefix_bytes : hash_size;
     memcpy(key, binary_hash.c_str(), prefix_size);
+    const size_t s = shard_of(key, prefix_size, hash_shard_bits);
+
+    // hashes are found in memory when the shard has a current prefix
+    // index, where short hashes are absent
+    const hashdb::hash_prefix_index_t* const prefix_index =
+                                               current_prefix_index(s);
+    if (prefix_index != NULL) {
+      uint8_t count_byte;
+      if (prefix_size != num_prefix_bytes ||
+          !prefix_index->find(key, count_byte)) {
+        lookup_record(HASH_STORE_MISS, 1);
+        return 0;
+      }
+      lookup_record(HASH_STORE_HIT, 1);
+      return byte_to_count(count_byte);
+    }
+
+    // most absent hashes are rejected by the filter
+    if (!filter_may_contain(s, key, prefix_size)) {
+      lookup_record(HASH_STORE_MISS, 1);
+      return 0;
+    }
 
     // ************************************************************
     // find
     // ************************************************************
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(shards[s].env, false, false,
+                                   shards[s].read_txn_cache);
     context.open();
 
     // see if prefix is already there
@@ -303,6 +919,7 @@ print_mdb_val("hash_manager find look for key", context.key);
     if (rc == MDB_NOTFOUND) {
       // the hash is not present because the prefix is not present
       context.close();
+      lookup_record(HASH_STORE_MISS, 1);
       return 0;
 
     } else if (rc == 0) {
@@ -322,6 +939,7 @@ print_mdb_val("hash_manager find data", context.data);
       uint8_t* const p = static_cast<uint8_t*>(context.data.mv_data);
       size_t approximate_count = byte_to_count(p[0]);
       context.close();
+      lookup_record(HASH_STORE_HIT, 1);
       return approximate_count;
 
     } else {
@@ -332,9 +950,469 @@ print_mdb_val("hash_manager find data", context.data);
     }
   }
 
+  /**
+   * Find the approximate count for each hash in binary_hashes, which
+   * must be in ascending order.  One cursor per shard sweeps forward
+   * using MDB_SET_RANGE, and a probe that sorts before the current cursor
+   * key is answered from that key without moving the cursor.  Frozen
+   * stores and shards with a current prefix index are searched in
+   * batches whose memory accesses are interleaved.
+   */
+  void find_sorted(const std::vector<std::string>& binary_hashes,
+                   std::vector<size_t>& counts) const {
+
+    counts.clear();
+    counts.resize(binary_hashes.size(), 0);
+
+    size_t begin = 0;
+    if (frozen != NULL) {
+      std::vector<uint64_t> indexes;
+      frozen->find_batch(binary_hashes, indexes, true);
+      for (size_t i=0; i<binary_hashes.size(); ++i) {
+        if (indexes[i] != frozen->size()) {
+          counts[i] = byte_to_count(count_to_byte(
+                                    frozen->read_count(indexes[i])));
+        }
+      }
+      begin = binary_hashes.size();
+    }
+    if (hash_data != NULL) {
+      hash_data->find_count_sorted(binary_hashes, counts);
+      for (size_t i=0; i<counts.size(); ++i) {
+        counts[i] = byte_to_count(count_to_byte(counts[i]));
+      }
+      return;
+    }
+    while (begin < binary_hashes.size()) {
+      const size_t s = shards.index(binary_hashes[begin]);
+      size_t end = begin + 1;
+      while (end < binary_hashes.size() &&
+             shards.index(binary_hashes[end]) == s) {
+        ++end;
+      }
+      const hashdb::hash_prefix_index_t* const prefix_index =
+                                               current_prefix_index(s);
+      if (prefix_index != NULL) {
+        find_indexed_run(*prefix_index, binary_hashes, begin, end, counts);
+      } else {
+        find_run(s, binary_hashes, begin, end, counts);
+      }
+      begin = end;
+    }
+
+    size_t hits = 0;
+    for (size_t i=0; i<counts.size(); ++i) {
+      hits += (counts[i] != 0);
+    }
+    lookup_record(HASH_STORE_HIT, hits);
+    lookup_record(HASH_STORE_MISS, counts.size() - hits);
+  }
+
+  /**
+   * Set bit i of bitmap, bit i % 8 of byte i / 8, for each of the count
+   * hashes packed at packed_hashes that find reports present, and clear
+   * the other bits.  Hashes are not sorted.  Shards with a current
+   * prefix index are searched in batches whose memory accesses are
+   * interleaved, other hashes are found one at a time.
+   */
+  void find_exists(const char* const packed_hashes, const size_t count,
+                   const size_t hash_size, uint8_t* const bitmap) const {
+    memset(bitmap, 0, (count + 7) / 8);
+
+    // the current prefix indexes, looked up once for the whole batch
+    std::vector<const hashdb::hash_prefix_index_t*> indexes(
+                                                  shards.count(), NULL);
+    if (frozen == NULL && hash_data == NULL &&
+        hash_size >= num_prefix_bytes) {
+      for (size_t s=0; s<shards.count(); ++s) {
+        indexes[s] = current_prefix_index(s);
+      }
+    }
+
+    const char* prefixes[lmdb_helper::prefetch_batch_size];
+    size_t positions[lmdb_helper::prefetch_batch_size];
+    size_t n = 0;
+    size_t batch_shard = 0;
+    size_t hits = 0;
+    size_t indexed = 0;
+    for (size_t i=0; i<count; ++i) {
+      const char* const hash = packed_hashes + i * hash_size;
+      const size_t s = (frozen == NULL && hash_data == NULL) ?
+                       shard_of(hash, (hash_size > num_prefix_bytes) ?
+                                num_prefix_bytes : hash_size,
+                                hash_shard_bits) : 0;
+      if (frozen != NULL || hash_data != NULL || indexes[s] == NULL) {
+        // one at a time
+        if (find(std::string(hash, hash_size)) != 0) {
+          bitmap[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+        }
+        continue;
+      }
+
+      // batches of one shard
+      if (n != 0 && s != batch_shard) {
+        hits += find_exists_batch(*indexes[batch_shard], prefixes,
+                                  positions, n, bitmap);
+        n = 0;
+      }
+      batch_shard = s;
+      prefixes[n] = hash;
+      positions[n] = i;
+      ++n;
+      ++indexed;
+      if (n == lmdb_helper::prefetch_batch_size) {
+        hits += find_exists_batch(*indexes[batch_shard], prefixes,
+                                  positions, n, bitmap);
+        n = 0;
+      }
+    }
+    if (n != 0) {
+      hits += find_exists_batch(*indexes[batch_shard], prefixes,
+                                positions, n, bitmap);
+    }
+    lookup_record(HASH_STORE_HIT, hits);
+    lookup_record(HASH_STORE_MISS, indexed - hits);
+  }
+
+  private:
+  // the approximate count of a hash in the frozen hash store
+  size_t find_frozen(const std::string& binary_hash) const {
+    uint64_t index;
+    if (!frozen->find(binary_hash, index)) {
+      return 0;
+    }
+    return byte_to_count(count_to_byte(frozen->read_count(index)));
+  }
+
+  // find_sorted for hashes [begin, end) of one shard with a current
+  // prefix index
+  void find_indexed_run(const hashdb::hash_prefix_index_t& prefix_index,
+                        const std::vector<std::string>& binary_hashes,
+                        const size_t begin, const size_t end,
+                        std::vector<size_t>& counts) const {
+    const size_t batch_size = lmdb_helper::prefetch_batch_size;
+    const char* prefixes[lmdb_helper::prefetch_batch_size];
+    size_t positions[lmdb_helper::prefetch_batch_size];
+    uint8_t count_bytes[lmdb_helper::prefetch_batch_size];
+    bool found[lmdb_helper::prefetch_batch_size];
+    size_t n = 0;
+    for (size_t i=begin; i<end; ++i) {
+
+      // require valid binary_hash
+      if (binary_hashes[i].size() == 0) {
+        std::cerr << "empty key\n";
+        assert(0);
+      }
+
+      // look up full batches together
+      if (binary_hashes[i].size() >= num_prefix_bytes) {
+        prefixes[n] = binary_hashes[i].c_str();
+        positions[n] = i;
+        ++n;
+      }
+      if (n == batch_size || (i + 1 == end && n != 0)) {
+        prefix_index.find_batch(prefixes, n, count_bytes, found);
+        for (size_t j=0; j<n; ++j) {
+          if (found[j]) {
+            counts[positions[j]] = byte_to_count(count_bytes[j]);
+          }
+        }
+        n = 0;
+      }
+    }
+  }
+
+  // find_exists for n hashes of one shard with a current prefix index,
+  // returns the number found
+  size_t find_exists_batch(const hashdb::hash_prefix_index_t& prefix_index,
+                           const char* const* const prefixes,
+                           const size_t* const positions, const size_t n,
+                           uint8_t* const bitmap) const {
+    uint8_t count_bytes[lmdb_helper::prefetch_batch_size];
+    bool found[lmdb_helper::prefetch_batch_size];
+    prefix_index.find_batch(prefixes, n, count_bytes, found);
+    size_t hits = 0;
+    for (size_t j=0; j<n; ++j) {
+      if (found[j]) {
+        bitmap[positions[j] / 8] |=
+                          static_cast<uint8_t>(1 << (positions[j] % 8));
+        ++hits;
+      }
+    }
+    return hits;
+  }
+
+  // find_sorted for hashes [begin, end) of one shard
+  void find_run(const size_t s,
+                const std::vector<std::string>& binary_hashes,
+                const size_t begin, const size_t end,
+                std::vector<size_t>& counts) const {
+
+    // get context
+    hashdb::lmdb_context_t context(shards[s].env, false, false,
+                                   shards[s].read_txn_cache);
+    context.open();
+
+    // the filter is current if it was built from this snapshot
+    const hashdb::hash_filter_t* const hash_filter = hash_filters[s];
+    const bool use_filter = (hash_filter != NULL &&
+                             hash_filter->txnid == mdb_txn_id(context.txn));
+
+    bool positioned = false;  // the cursor is at the first key >= a probe
+    for (size_t i=begin; i<end; ++i) {
+
+      // require valid binary_hash
+      if (binary_hashes[i].size() == 0) {
+        std::cerr << "empty key\n";
+        assert(0);
+      }
+
+      // the prefix to look for
+      const size_t hash_size = binary_hashes[i].size();
+      const size_t prefix_size =
+              (hash_size > num_prefix_bytes) ? num_prefix_bytes : hash_size;
+      const char* const prefix = binary_hashes[i].c_str();
+
+      // most absent hashes are rejected by the filter
+      if (use_filter && !hash_filter->maybe_contains(prefix, prefix_size)) {
+        continue;
+      }
+
+      // compare the cursor key with the prefix, as LMDB orders keys
+      int cmp = -1;
+      if (positioned) {
+        const size_t n = (context.key.mv_size < prefix_size) ?
+                         context.key.mv_size : prefix_size;
+        cmp = memcmp(context.key.mv_data, prefix, n);
+        if (cmp == 0) {
+          cmp = (context.key.mv_size < prefix_size) ? -1 :
+                (context.key.mv_size > prefix_size) ? 1 : 0;
+        }
+      }
+
+      if (cmp < 0) {
+        // the cursor is before the prefix so move to the first key >= it
+        context.key.mv_size = prefix_size;
+        context.key.mv_data = const_cast<char*>(prefix);
+        int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                                MDB_SET_RANGE);
+        if (rc == MDB_NOTFOUND) {
+          // no more keys so no remaining hash in this shard is present
+          break;
+        } else if (rc != 0) {
+          // invalid rc
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        positioned = true;
+        cmp = (context.key.mv_size == prefix_size &&
+               memcmp(context.key.mv_data, prefix, prefix_size) == 0) ? 0 : 1;
+      }
+
+      if (cmp == 0) {
+        // prefix present, so use its count
+        if (context.data.mv_size != 1) {
+          std::cerr << "corrupted DB\n";
+          assert(0);
+        }
+        counts[i] = byte_to_count(
+                           static_cast<uint8_t*>(context.data.mv_data)[0]);
+      }
+    }
+    context.close();
+  }
+
+  public:
+  /**
+   * Find the keys whose approximate count is at least min_count, in key
+   * order.  Keys are hash prefixes, or whole hashes when frozen.
+   */
+  void find_common(const size_t min_count,
+                   std::vector<std::string>& keys) const {
+    keys.clear();
+    if (frozen != NULL) {
+      for (uint64_t i=0; i<frozen->size(); ++i) {
+        if (byte_to_count(count_to_byte(frozen->read_count(i))) >=
+                                                          min_count) {
+          keys.push_back(frozen->hash_at(i));
+        }
+      }
+      return;
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (lmdb_helper::size(shards[s].env) == 0) {
+        continue;
+      }
+      hashdb::lmdb_context_t context(shards[s].env, false, false,
+                                     shards[s].read_txn_cache);
+      context.open();
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_FIRST);
+      while (rc == 0) {
+        if (context.data.mv_size != 1) {
+          std::cerr << "corrupted DB\n";
+          assert(0);
+        }
+        if (byte_to_count(static_cast<uint8_t*>(context.data.mv_data)[0]) >=
+                                                          min_count) {
+          keys.push_back(std::string(static_cast<char*>(context.key.mv_data),
+                                     context.key.mv_size));
+        }
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT);
+      }
+      if (rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      context.close();
+    }
+  }
+
+  /**
+   * Add every key to the portable filter, which cuts them to its prefix
+   * size.  Keys are hash prefixes, or whole hashes when frozen.
+   */
+  void add_to_filter(hashdb::portable_filter_t& filter) const {
+    if (frozen != NULL) {
+      for (uint64_t i=0; i<frozen->size(); ++i) {
+        const std::string hash = frozen->hash_at(i);
+        filter.add(hash.c_str(), hash.size());
+      }
+      return;
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (lmdb_helper::size(shards[s].env) == 0) {
+        continue;
+      }
+      hashdb::lmdb_context_t context(shards[s].env, false, false,
+                                     shards[s].read_txn_cache);
+      context.open();
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_FIRST);
+      while (rc == 0) {
+        filter.add(context.key.mv_data, context.key.mv_size);
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT);
+      }
+      if (rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      context.close();
+    }
+  }
+
+  /**
+   * A number that changes whenever the hash store changes: the sum of
+   * the transaction IDs of the shards, or the number of hashes when
+   * frozen.
+   */
+  uint64_t generation() const {
+    if (frozen != NULL) {
+      return frozen->size();
+    }
+    uint64_t sum = 0;
+    for (size_t s=0; s<shards.count(); ++s) {
+      sum += shards[s].last_txnid();
+    }
+    return sum;
+  }
+
+  /**
+   * Add the files that lookups not answered from memory read, for
+   * lmdb_helper::warm_files.
+   */
+  void store_files(std::vector<std::string>& filenames) const {
+    if (frozen != NULL || hash_data != NULL) {
+      // lookups read the hash data store instead
+      return;
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (prefix_indexes[s] == NULL) {
+        filenames.push_back(lmdb_helper::data_filename(shards[s].env));
+      }
+    }
+  }
+
+  /**
+   * Lock the in-memory copy of the store.  Return "" if successful else
+   * reason if not.
+   */
+  std::string lock_in_memory() const {
+    if (frozen != NULL) {
+      return frozen->lock() ? "" : "Unable to lock the frozen hash store "
+                     "in memory.  Raise the memory lock limit, see ulimit -l.";
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (prefix_indexes[s] == NULL) {
+        if (lmdb_helper::size(shards[s].env) == 0) {
+          continue;
+        }
+        return "The hash store has no prefix index to lock in memory.";
+      }
+      if (!prefix_indexes[s]->lock()) {
+        return "Unable to lock the hash store in memory.  Raise the memory "
+               "lock limit, see ulimit -l.";
+      }
+    }
+    return "";
+  }
+
+  /**
+   * Interleave the in-memory copy of the store across the NUMA nodes.
+   * Return "" if successful else reason if not.
+   */
+  std::string interleave_in_memory() const {
+    if (frozen != NULL) {
+      return frozen->interleave() ? "" : "Unable to interleave the frozen "
+                     "hash store across NUMA nodes.";
+    }
+    for (size_t s=0; s<shards.count(); ++s) {
+      if (prefix_indexes[s] == NULL) {
+        if (lmdb_helper::size(shards[s].env) == 0) {
+          continue;
+        }
+        return "The hash store has no prefix index to interleave.";
+      }
+      if (!prefix_indexes[s]->interleave()) {
+        return "Unable to interleave the hash store across NUMA nodes.";
+      }
+    }
+    return "";
+  }
+
+  /**
+   * Build the prefix index of each shard and save it for READ_ONLY opens
+   * to map, removing the stale index of a shard that gets none.  Call
+   * while the store is not being written.  Return "" if successful else
+   * reason if not.
+   */
+  std::string save_prefix_indexes() const {
+    for (size_t s=0; s<shards.count(); ++s) {
+      const std::string filename = prefix_index_filename(s);
+      hashdb::hash_prefix_index_t* const index = build_prefix_index(s);
+      if (index == NULL) {
+        std::remove(filename.c_str());
+        continue;
+      }
+      const bool is_written = index->write(filename);
+      delete index;
+      if (!is_written) {
+        return "Unable to write the prefix index '" + filename + "'.";
+      }
+    }
+    return "";
+  }
+
+  // sync to disk if the sync policy is flush or force is set
+  void flush(const bool force = false) const {
+    shards.flush(force);
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
-    return lmdb_helper::size(env);
+    return (frozen != NULL) ? frozen->size() : shards.size();
   }
 };
 
@@ -44,49 +44,199 @@
 #include "sys/stat.h"
 #include "lmdb.h"
 #include "file_modes.h"
+#include "lmdb_helper.h"
+#include "stage_stats.hpp"
+#include "metrics.hpp"
+#include "probes.hpp"
 #include <stdexcept>
 #include <cassert>
 #include <stdint.h>
 #include <cstring>
+#include <cstdlib>  // for realpath and mkdtemp
 #include <sstream>
 #include <unistd.h>
 #include <iomanip>
 #include <pthread.h>
 #include <iostream>
+#include <fcntl.h>  // for posix_fallocate
+#include <sys/time.h>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H) && !defined(WIN32)
+#define LMDB_HELPER_MLOCK
+#include <sys/mman.h>
+#endif
 
 //#define DEBUG
 
 namespace lmdb_helper {
 
-  // thread support to sync to prevent long delays
-  static bool sync_busy = false;
-  static void *perform_mdb_env_sync(void* env) {
-    if (sync_busy) {
-      // busy, so drop this sync request
-#ifdef DEBUG
-      std::cout << "sync busy\n";
-#endif
-    } else {
-      sync_busy=true;
+  // maps smaller than this double when they grow, larger maps grow by half
+  static const uint64_t map_doubling_limit = 1<<30; // 1,073,741,824
+
+  // the longest a writer waits for a background sync that fell behind
+  static const uint32_t max_sync_stall_seconds = 1;
+
+  // growth and sync state of an environment, kept in its user context
+  struct env_state_t {
+    MDB_env* env;
+    const env_policy_t policy;
+    const bool is_writable;
+    size_t unchecked_pages;  // pages writes may claim before the next check
+    size_t seen_pgno;        // last page at the last map check
+    size_t synced_pgno;      // last page covered by the last sync
+    size_t synced_txnid;     // last transaction covered by the last sync
+    bool has_syncer;
+    bool sync_requested;
+    bool syncing;
+    bool stopping;
+    pthread_t syncer;
+    pthread_mutex_t M;       // guards the sync fields
+    pthread_cond_t cond;     // signals sync requests and completions
+    pthread_mutex_t map_M;   // keeps syncs out of map resizes
+
+    env_state_t(MDB_env* p_env, const env_policy_t& p_policy,
+                const bool p_is_writable) :
+          env(p_env), policy(p_policy), is_writable(p_is_writable),
+          unchecked_pages(0), seen_pgno(0), synced_pgno(0), synced_txnid(0),
+          has_syncer(false), sync_requested(false), syncing(false),
+          stopping(false), syncer(), M(), cond(), map_M() {
+      pthread_mutex_init(&M, NULL);
+      pthread_cond_init(&cond, NULL);
+      pthread_mutex_init(&map_M, NULL);
+    }
+
+    ~env_state_t() {
+      pthread_mutex_destroy(&map_M);
+      pthread_cond_destroy(&cond);
+      pthread_mutex_destroy(&M);
+    }
+
+    private:
+    // do not allow copy or assignment
+    env_state_t(const env_state_t&);
+    env_state_t& operator=(const env_state_t&);
+  };
+
+  // the time some seconds from now
+  static timespec deadline_after(const uint32_t seconds) {
+    struct timeval t_now;
+    gettimeofday(&t_now, 0);
+    timespec deadline;
+    deadline.tv_sec = t_now.tv_sec + seconds;
+    deadline.tv_nsec = t_now.tv_usec * 1000;
+    return deadline;
+  }
+
+  // sync the environment unless nothing was committed since the last sync
+  static void sync_state(env_state_t* state) {
+    pthread_mutex_lock(&state->map_M);
+    MDB_envinfo env_info;
+    int rc = mdb_env_info(state->env, &env_info);
+    if (rc == 0 && env_info.me_last_txnid != state->synced_txnid) {
 #ifdef DEBUG
       std::cout << "sync start\n";
 #endif
-      int rc = mdb_env_sync(static_cast<MDB_env*>(env), 1);
+      const uint64_t sync_start = hashdb::stage_clock_ns();
+      rc = mdb_env_sync(state->env, 1);
+      hashdb::stage_record(hashdb::STAGE_SYNC,
+                           hashdb::stage_clock_ns() - sync_start);
       if (rc != 0) {
-        // silently let the error go.  sync is a convenience and also sync is
-        // expected to fail when the program closes env and exits.
-#ifdef DEBUG
-        std::cout << "Note in sync DB: " <<  mdb_strerror(rc) << "\n";
-#endif
+        std::cerr << "Warning: unable to sync DB: " << mdb_strerror(rc)
+                  << "\n";
+      } else {
+        state->synced_txnid = env_info.me_last_txnid;
       }
-#ifdef DEBUG
-      std::cout << "sync done\n";
-#endif
-      sync_busy = false;
     }
+    pthread_mutex_unlock(&state->map_M);
+  }
+
+  // report the map use and reader slots of the environment
+  static void add_env_metrics(const void* const data, const uint64_t id,
+                              hashdb::metric_samples_t& samples) {
+    const env_state_t* const state = static_cast<const env_state_t*>(data);
+    MDB_envinfo env_info;
+    MDB_stat ms;
+    const char* path = "";
+    if (mdb_env_info(state->env, &env_info) != 0 ||
+        mdb_env_stat(state->env, &ms) != 0 ||
+        mdb_env_get_path(state->env, &path) != 0) {
+      return;
+    }
+    std::stringstream ss;
+    ss << "store=" << hashdb::metric_label(path) << ",env=\"" << id << "\"";
+    const std::string labels = ss.str();
+    samples.push_back(hashdb::metric_sample_t("hashdb_lmdb_map_size_bytes",
+                "gauge", "Size of the LMDB memory map.", labels,
+                static_cast<double>(env_info.me_mapsize)));
+    samples.push_back(hashdb::metric_sample_t("hashdb_lmdb_map_used_bytes",
+                "gauge", "Bytes of the LMDB memory map holding pages.",
+                labels, static_cast<double>(env_info.me_last_pgno + 1) *
+                ms.ms_psize));
+    samples.push_back(hashdb::metric_sample_t("hashdb_lmdb_readers",
+                "gauge", "LMDB reader slots in use.", labels,
+                static_cast<double>(env_info.me_numreaders)));
+    samples.push_back(hashdb::metric_sample_t("hashdb_lmdb_max_readers",
+                "gauge", "LMDB reader slots available.", labels,
+                static_cast<double>(env_info.me_maxreaders)));
+  }
+
+  // background syncer, syncing every sync_seconds or when a writer
+  // requests it after sync_bytes of new pages, until stopped
+  static void* run_syncer(void* p_state) {
+    env_state_t* state = static_cast<env_state_t*>(p_state);
+    pthread_mutex_lock(&state->M);
+    while (!state->stopping) {
+      // wait for a request or the interval
+      const timespec deadline = deadline_after(state->policy.sync_seconds);
+      int rc = 0;
+      while (!state->stopping && !state->sync_requested && rc == 0) {
+        rc = pthread_cond_timedwait(&state->cond, &state->M, &deadline);
+      }
+      if (state->stopping) {
+        break;
+      }
+
+      // sync without holding the lock so that writers do not wait
+      const size_t pgno = state->seen_pgno;
+      state->sync_requested = false;
+      state->syncing = true;
+      pthread_mutex_unlock(&state->M);
+      sync_state(state);
+      pthread_mutex_lock(&state->M);
+      state->synced_pgno = pgno;
+      state->syncing = false;
+      pthread_cond_broadcast(&state->cond);
+    }
+    pthread_mutex_unlock(&state->M);
     return NULL;
   }
 
+  bool sync_policy_from_name(const std::string& name,
+                             sync_policy_t& sync_policy) {
+    if (name == "none") sync_policy = SYNC_NONE;
+    else if (name == "periodic") sync_policy = SYNC_PERIODIC;
+    else if (name == "flush") sync_policy = SYNC_FLUSH;
+    else return false;
+    return true;
+  }
+
+  env_policy_t::env_policy_t() :
+          initial_map_size(0),
+          max_map_size(0),
+          sync_policy(SYNC_PERIODIC),
+          sync_seconds(30),
+          sync_bytes(static_cast<uint64_t>(1)<<30),
+          store_location(""),
+          max_readers(0),
+          max_snapshot_ms(0),
+          max_dbs(0) {
+  }
+
+  dbis_t::dbis_t() : is_split(false), dbi(0), dupfixed_dbi(0) {
+  }
+
   // write value into encoding, return pointer past value written.
   // each write will add no more than 10 bytes.
   // note: code adapted directly from:
@@ -195,8 +345,75 @@ namespace lmdb_helper {
     return ptr;
   }
 
+  // the keys of source_ids in key order
+  void source_id_keys(const std::vector<uint64_t>& source_ids,
+                      std::vector<source_id_key_t>& keys) {
+    keys.resize(source_ids.size());
+    for (size_t i=0; i<source_ids.size(); ++i) {
+      uint8_t key[10];
+      const uint8_t* const key_p = encode_uint64_t(source_ids[i], key);
+      keys[i].key.assign(reinterpret_cast<const char*>(key), key_p - key);
+      keys[i].index = i;
+    }
+    std::sort(keys.begin(), keys.end());
+  }
+
+  // make a new store directory in location, named for the hashdb and
+  // the store, and link store_dir to it
+  static void make_placed_store(const std::string& store_dir,
+                                const std::string& location) {
+#ifdef _WIN32
+    std::cerr << "Error: Store '" << store_dir << "' cannot be placed in '"
+              << location << "' on this platform.\nCannot continue.\n";
+    exit(1);
+#else
+    // the location may already exist
+    mkdir(location.c_str(),0777);
+    char* const real_location = realpath(location.c_str(), NULL);
+    if (real_location == NULL) {
+      std::cerr << "Error: Could not find store location '" << location
+                << "'.\nCannot continue.\n";
+      exit(1);
+    }
+
+    // name the directory <hashdb>.<store>.<unique suffix>
+    std::string parent_dir = store_dir.substr(0, store_dir.rfind('/') + 1);
+    while (parent_dir.size() > 1 &&
+           parent_dir[parent_dir.size() - 1] == '/') {
+      parent_dir.erase(parent_dir.size() - 1);
+    }
+    const std::string hashdb_name =
+                         parent_dir.substr(parent_dir.rfind('/') + 1);
+    const std::string store_name =
+                         store_dir.substr(store_dir.rfind('/') + 1);
+    std::string placed_dir = std::string(real_location) + "/" +
+                         hashdb_name + "." + store_name + ".XXXXXX";
+    free(real_location);
+    std::vector<char> name(placed_dir.begin(), placed_dir.end());
+    name.push_back('\0');
+    if (mkdtemp(&name[0]) == NULL) {
+      std::cerr << "Error: Could not make new store directory in '"
+                << location << "'.\nCannot continue.\n";
+      exit(1);
+    }
+    placed_dir = &name[0];
+
+    // give it the permissions of a store made by mkdir
+    const mode_t mask = umask(0);
+    umask(mask);
+    chmod(placed_dir.c_str(), 0777 & ~mask);
+    if (symlink(placed_dir.c_str(), store_dir.c_str()) != 0) {
+      std::cerr << "Error: Could not link new store directory '"
+                << store_dir << "'.\nCannot continue.\n";
+      rmdir(placed_dir.c_str());
+      exit(1);
+    }
+#endif
+  }
+
   MDB_env* open_env(const std::string& store_dir,
-                           const hashdb::file_mode_type_t file_mode) {
+                    const hashdb::file_mode_type_t file_mode,
+                    const env_policy_t& policy) {
 
     // create the DB environment
     MDB_env* env;
@@ -221,19 +438,23 @@ namespace lmdb_helper {
         }
 
         // create the store directory
+        if (policy.store_location.size() != 0) {
+          make_placed_store(store_dir, policy.store_location);
+        } else {
 #ifdef _WIN32
-        if(mkdir(store_dir.c_str())){
-          std::cerr << "Error: Could not make new store directory '"
-                    << store_dir << "'.\nCannot continue.\n";
-          exit(1);
-        }
+          if(mkdir(store_dir.c_str())){
+            std::cerr << "Error: Could not make new store directory '"
+                      << store_dir << "'.\nCannot continue.\n";
+            exit(1);
+          }
 #else
-        if(mkdir(store_dir.c_str(),0777)){
-          std::cerr << "Error: Could not make new store directory '"
-                    << store_dir << "'.\nCannot continue.\n";
-          exit(1);
-        }
+          if(mkdir(store_dir.c_str(),0777)){
+            std::cerr << "Error: Could not make new store directory '"
+                      << store_dir << "'.\nCannot continue.\n";
+            exit(1);
+          }
 #endif
+        }
         // NOTE: These flags improve performance significantly so use them.
         // No sync means no requisite disk action after every transaction.
         // writemap suppresses checking but improves Windows performance.
@@ -248,6 +469,54 @@ namespace lmdb_helper {
         return 0; // for mingw compiler
     }
 
+    // start writable stores at the initial map size.  LMDB keeps the
+    // larger of this and the map size the store was last grown to.
+    if (file_mode != hashdb::READ_ONLY && policy.initial_map_size != 0) {
+      rc = mdb_env_set_mapsize(env, policy.initial_map_size);
+      if (rc != 0) {
+        std::cerr << "Error setting map size of store: " << store_dir
+                  << ": " <<  mdb_strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+
+    // map a read-only store at the maximum map size so that it keeps
+    // reading when a writer in another process grows the store
+    if (file_mode == hashdb::READ_ONLY && policy.max_map_size != 0) {
+      rc = mdb_env_set_mapsize(env, policy.max_map_size);
+      if (rc != 0) {
+        std::cerr << "Error setting map size of store: " << store_dir
+                  << ": " <<  mdb_strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+
+    // reserve reader slots for every scan thread.  The first process to
+    // open the store sizes its lock file for the others.
+    if (policy.max_readers != 0) {
+      rc = mdb_env_set_maxreaders(env, policy.max_readers);
+      if (rc != 0) {
+        std::cerr << "Error setting max readers of store: " << store_dir
+                  << ": " <<  mdb_strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+
+    // allow the named databases of a split store
+    if (policy.max_dbs != 0) {
+      rc = mdb_env_set_maxdbs(env, policy.max_dbs);
+      if (rc != 0) {
+        std::cerr << "Error setting max databases of store: " << store_dir
+                  << ": " <<  mdb_strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+
+    // tie read slots to transactions rather than threads so that a
+    // thread may walk a store with one transaction while reading it
+    // with another
+    env_flags |= MDB_NOTLS;
+
     // open the MDB environment
     rc = mdb_env_open(env, store_dir.c_str(), env_flags, 0664);
     if (rc != 0) {
@@ -257,13 +526,134 @@ namespace lmdb_helper {
       exit(1);
     }
 
+    // with no maximum map size, map a read-only store past its current
+    // map so that it keeps reading while a writer grows the store
+    if (file_mode == hashdb::READ_ONLY && policy.max_map_size == 0 &&
+        read_only_map_headroom != 0) {
+      MDB_envinfo open_info;
+      rc = mdb_env_info(env, &open_info);
+      if (rc != 0) {
+        assert(0);
+      }
+      rc = mdb_env_set_mapsize(env, open_info.me_mapsize +
+                                    read_only_map_headroom);
+      if (rc != 0) {
+        std::cerr << "Error setting map size of store: " << store_dir
+                  << ": " <<  mdb_strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+
+#ifdef HAVE_POSIX_FALLOCATE
+    // a writemap only extends the store file sparsely, so allocate the
+    // initial map on disk now rather than risk running out of space
+    // part way through an import
+    if (file_mode == hashdb::RW_NEW && policy.initial_map_size != 0) {
+      mdb_filehandle_t fd;
+      rc = mdb_env_get_fd(env, &fd);
+      if (rc != 0) {
+        assert(0);
+      }
+      rc = posix_fallocate(fd, 0,
+                           static_cast<off_t>(policy.initial_map_size));
+      if (rc != 0) {
+        std::cerr << "Error preallocating store: " << store_dir
+                  << ": " <<  std::strerror(rc) << "\nAborting.\n";
+        exit(1);
+      }
+    }
+#endif
+
+    // track map growth and syncs from the current end of the store
+    MDB_envinfo env_info;
+    rc = mdb_env_info(env, &env_info);
+    if (rc != 0) {
+      assert(0);
+    }
+    env_state_t* state = new env_state_t(env, policy,
+                                         file_mode != hashdb::READ_ONLY);
+    state->seen_pgno = env_info.me_last_pgno;
+    state->synced_pgno = env_info.me_last_pgno;
+    state->synced_txnid = env_info.me_last_txnid;
+    mdb_env_set_userctx(env, state);
+    hashdb::metrics_register(add_env_metrics, state);
+
+    // start the background syncer
+    if (state->is_writable && policy.sync_policy == SYNC_PERIODIC) {
+      if (pthread_create(&state->syncer, NULL, run_syncer,
+                         static_cast<void*>(state)) != 0) {
+        assert(0);
+      }
+      state->has_syncer = true;
+    }
     return env;
   }
 
-  void maybe_grow(MDB_env* env) {
+  void flush_env(MDB_env* env, const bool force) {
+    env_state_t* state = static_cast<env_state_t*>(mdb_env_get_userctx(env));
+    if (state->is_writable &&
+        (force || state->policy.sync_policy == SYNC_FLUSH)) {
+      sync_state(state);
+    }
+  }
+
+  void close_env(MDB_env* env) {
+    env_state_t* state = static_cast<env_state_t*>(mdb_env_get_userctx(env));
+    hashdb::metrics_unregister(state);
+    if (state->has_syncer) {
+      pthread_mutex_lock(&state->M);
+      state->stopping = true;
+      pthread_cond_broadcast(&state->cond);
+      pthread_mutex_unlock(&state->M);
+      pthread_join(state->syncer, NULL);
+    }
+    if (state->is_writable && state->policy.sync_policy != SYNC_NONE) {
+      sync_state(state);
+    }
+    delete state;
+    mdb_env_close(env);
+  }
+
+  MDB_env* reopen_env_after_fork(MDB_env* env) {
+    env_state_t* state = static_cast<env_state_t*>(mdb_env_get_userctx(env));
+    if (state->is_writable) {
+      std::cerr << "Error: only read-only stores may be reopened after "
+                << "fork.\n";
+      assert(0);
+    }
+    const char* path = "";
+    mdb_env_get_path(env, &path);
+    const std::string store_dir(path);
+    const env_policy_t policy(state->policy);
+    hashdb::metrics_unregister(state);
+
+#ifdef LMDB_HELPER_MLOCK
+    // release the inherited map and data file.  The lock file and the
+    // MDB_env are left as they are, since LMDB frees them only on close.
+    MDB_envinfo env_info;
+    if (mdb_env_info(env, &env_info) == 0 && env_info.me_mapaddr != NULL) {
+      munmap(env_info.me_mapaddr, env_info.me_mapsize);
+    }
+    int fd;
+    if (mdb_env_get_fd(env, &fd) == 0 && fd >= 0) {
+      close(fd);
+    }
+#endif
+    delete state;
+    return open_env(store_dir, hashdb::READ_ONLY, policy);
+  }
+
+  void maybe_grow(MDB_env* env, const size_t reserve_pages) {
     // http://comments.gmane.org/gmane.network.openldap.technical/11699
     // also see mdb_env_set_mapsize
 
+    // skip measuring while an earlier check left room for this write
+    env_state_t* state = static_cast<env_state_t*>(mdb_env_get_userctx(env));
+    if (reserve_pages <= state->unchecked_pages) {
+      state->unchecked_pages -= reserve_pages;
+      return;
+    }
+
     // read environment info
     MDB_envinfo env_info;
     int rc = mdb_env_info(env, &env_info);
@@ -277,19 +667,33 @@ namespace lmdb_helper {
     if (rc != 0) {
       assert(0);
     }
-
-    // occasionally sync to prevent long flush delays
-    if (ms.ms_entries % 10000000 == 10000000 - 1) {
-      pthread_t thread;
-      int result_code = pthread_create(&thread, NULL, perform_mdb_env_sync,
-                            static_cast<void*>(env));
-      if (result_code != 0) {
-        assert(0);
+    const size_t sync_pages = state->policy.sync_bytes / ms.ms_psize;
+
+    // request a background sync after sync_bytes of new pages.  If the
+    // syncer is a whole interval behind, wait a bounded time for it.
+    if (state->has_syncer) {
+      pthread_mutex_lock(&state->M);
+      state->seen_pgno = env_info.me_last_pgno;
+      if (env_info.me_last_pgno >= state->synced_pgno + sync_pages) {
+        state->sync_requested = true;
+        pthread_cond_broadcast(&state->cond);
+        if (state->syncing &&
+            env_info.me_last_pgno >= state->synced_pgno + 2 * sync_pages) {
+          const timespec deadline = deadline_after(max_sync_stall_seconds);
+          int wait_rc = 0;
+          while (state->syncing && wait_rc == 0) {
+            wait_rc = pthread_cond_timedwait(&state->cond, &state->M,
+                                             &deadline);
+          }
+        }
       }
+      pthread_mutex_unlock(&state->M);
     }
 
     // maybe grow the DB
-    if (env_info.me_mapsize / ms.ms_psize <= env_info.me_last_pgno + 10) {
+    uint64_t size = env_info.me_mapsize;
+    const uint64_t needed_pages = env_info.me_last_pgno + reserve_pages + 1;
+    if (size / ms.ms_psize < needed_pages) {
 
       // could call mdb_env_sync(env, 1) here but it does not help
       // rc = mdb_env_sync(env, 1);
@@ -299,21 +703,42 @@ namespace lmdb_helper {
       //   exit(1);
       // }
 
-      // grow the DB
-      size_t size = env_info.me_mapsize;
-      if (size > (1<<30)) { // 1<<30 = 1,073,741,824
-        // add 1GiB
-        size += (1<<30);
-      } else {
-        // double
-        size *= 2;
+      // grow the DB geometrically until the reserve fits so that the
+      // number of grows is logarithmic in the size of the store
+      while (size / ms.ms_psize < needed_pages) {
+        if (size < map_doubling_limit) {
+          size *= 2;
+        } else {
+          size += size / 2;
+        }
+      }
+      size = (size + ms.ms_psize - 1) / ms.ms_psize * ms.ms_psize;
+
+      // do not grow past the maximum map size.  Batch reserves are
+      // estimates, so only fail when not even a single write fits.
+      const uint64_t max_map_size = state->policy.max_map_size;
+      if (max_map_size != 0 && size > max_map_size) {
+        size = max_map_size / ms.ms_psize * ms.ms_psize;
+        if (size / ms.ms_psize < env_info.me_last_pgno + 1 +
+                       ((reserve_pages < 10) ? reserve_pages : 10)) {
+          const char* path = "";
+          mdb_env_get_path(env, &path);
+          std::cerr << "Error growing DB: store " << path
+                    << " is full at its maximum map size of "
+                    << max_map_size << " bytes.\nAborting.\n";
+          exit(1);
+        }
       }
 #ifdef DEBUG
       std::cout << "Growing DB " << env << " from " << env_info.me_mapsize
                 << " to " << size << "\n";
 #endif
 
+      // a sync must not run while the map moves
+      HASHDB_PROBE3(map_grow, env, env_info.me_mapsize, size);
+      pthread_mutex_lock(&state->map_M);
       rc = mdb_env_set_mapsize(env, size);
+      pthread_mutex_unlock(&state->map_M);
       if (rc != 0) {
         // grow failed
         std::cerr << "Error growing DB: " <<  mdb_strerror(rc)
@@ -321,6 +746,30 @@ namespace lmdb_helper {
         exit(1);
       }
     }
+
+    // writes may claim the free pages without measuring again, up to the
+    // next background sync request
+    const size_t free_pages = (size / ms.ms_psize > needed_pages) ?
+                                    size / ms.ms_psize - needed_pages : 0;
+    state->unchecked_pages = (state->has_syncer && sync_pages < free_pages) ?
+                                                   sync_pages : free_pages;
+  }
+
+  void txn_begin_error(MDB_env* env, const int rc) {
+    const char* path = "";
+    mdb_env_get_path(env, &path);
+    if (rc == MDB_READERS_FULL) {
+      unsigned int max_readers = 0;
+      mdb_env_get_maxreaders(env, &max_readers);
+      std::cerr << "Error: all " << max_readers << " reader slots of store "
+                << path << " are in use.\nRaise max_readers in the "
+                << "settings of the hash database.  Aborting.\n";
+      exit(1);
+    }
+    std::cerr << "LMDB txn error: store " << path << ": "
+              << mdb_strerror(rc) << "\n";
+    assert(0);
+    exit(1);
   }
 
   // size
@@ -336,5 +785,207 @@ namespace lmdb_helper {
     }
     return stat.ms_entries;
   }
+
+  dbis_t open_dbis(MDB_env* env, const hashdb::file_mode_type_t file_mode,
+                   const bool is_duplicates, const bool is_split) {
+    dbis_t dbis;
+    if (!is_split) {
+      return dbis;
+    }
+    dbis.is_split = true;
+
+    // the handles outlive this transaction once it commits
+    const bool is_writable = (file_mode != hashdb::READ_ONLY);
+    MDB_txn* txn;
+    int rc = mdb_txn_begin(env, NULL, is_writable ? 0 : MDB_RDONLY, &txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    const unsigned int create = is_writable ? MDB_CREATE : 0;
+    rc = mdb_dbi_open(txn, "records",
+                      create | (is_duplicates ? MDB_DUPSORT : 0), &dbis.dbi);
+    if (rc == 0) {
+      rc = mdb_dbi_open(txn, "dupfixed",
+                        create | MDB_DUPSORT | MDB_DUPFIXED,
+                        &dbis.dupfixed_dbi);
+    }
+    if (rc != 0) {
+      const char* path = "";
+      mdb_env_get_path(env, &path);
+      std::cerr << "Error opening the databases of store " << path
+                << ": " << mdb_strerror(rc) << "\nAborting.\n";
+      exit(1);
+    }
+    rc = mdb_txn_commit(txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn commit error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return dbis;
+  }
+
+  size_t size(MDB_env* env, const dbis_t& dbis) {
+    if (!dbis.is_split) {
+      return size(env);
+    }
+    MDB_txn* txn;
+    int rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+    if (rc != 0) {
+      std::cerr << "LMDB txn error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    MDB_stat stat;
+    MDB_stat dupfixed_stat;
+    rc = mdb_stat(txn, dbis.dbi, &stat);
+    if (rc == 0) {
+      rc = mdb_stat(txn, dbis.dupfixed_dbi, &dupfixed_stat);
+    }
+    if (rc != 0) {
+      // program error
+      std::cerr << "size failure: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    mdb_txn_abort(txn);
+    return stat.ms_entries + dupfixed_stat.ms_entries;
+  }
+
+  std::string data_filename(MDB_env* env) {
+    const char* path;
+    int rc = mdb_env_get_path(env, &path);
+    if (rc != 0) {
+      std::cerr << "LMDB path error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    return std::string(path) + "/data.mdb";
+  }
+
+  // read files in chunks of this size
+  static const uint64_t warm_chunk_size = 8 * 1024 * 1024;
+
+  // the chunks of files for warm_files threads to read in turn
+  struct warm_chunks_t {
+    const std::vector<std::string>& filenames;
+    std::vector<std::pair<size_t, uint64_t> > chunks; // file, offset
+    size_t next;
+    uint64_t bytes_read;
+    warm_progress_t* const progress;
+    pthread_mutex_t M;
+    warm_chunks_t(const std::vector<std::string>& p_filenames,
+                  warm_progress_t* const p_progress) :
+          filenames(p_filenames), chunks(), next(0), bytes_read(0),
+          progress(p_progress), M() {
+      pthread_mutex_init(&M, NULL);
+    }
+    ~warm_chunks_t() {
+      pthread_mutex_destroy(&M);
+    }
+
+    private:
+    // do not allow copy or assignment
+    warm_chunks_t(const warm_chunks_t&);
+    warm_chunks_t& operator=(const warm_chunks_t&);
+  };
+
+  static void* run_warm_chunks(void* const arg) {
+    warm_chunks_t& warm_chunks = *static_cast<warm_chunks_t*>(arg);
+    std::vector<char> buffer(warm_chunk_size);
+    while (true) {
+      pthread_mutex_lock(&warm_chunks.M);
+      if (warm_chunks.progress != NULL &&
+          warm_chunks.progress->stop.load()) {
+        // stop early, taking no more chunks
+        warm_chunks.next = warm_chunks.chunks.size();
+      }
+      const size_t i = warm_chunks.next;
+      if (i < warm_chunks.chunks.size()) {
+        ++warm_chunks.next;
+      }
+      pthread_mutex_unlock(&warm_chunks.M);
+      if (i == warm_chunks.chunks.size()) {
+        return NULL;
+      }
+
+      // read the chunk
+      const std::pair<size_t, uint64_t>& chunk = warm_chunks.chunks[i];
+      std::ifstream in(warm_chunks.filenames[chunk.first].c_str(),
+                       std::ios::binary);
+      in.seekg(static_cast<std::streamoff>(chunk.second));
+      in.read(&buffer[0], static_cast<std::streamsize>(buffer.size()));
+      pthread_mutex_lock(&warm_chunks.M);
+      warm_chunks.bytes_read += static_cast<uint64_t>(in.gcount());
+      if (warm_chunks.progress != NULL) {
+        warm_chunks.progress->bytes_read.store(warm_chunks.bytes_read);
+      }
+      pthread_mutex_unlock(&warm_chunks.M);
+    }
+  }
+
+  uint64_t warm_files(const std::vector<std::string>& filenames,
+                      const size_t num_threads,
+                      warm_progress_t* const progress) {
+
+    // the chunks of every file, in order
+    warm_chunks_t warm_chunks(filenames, progress);
+    uint64_t bytes_to_read = 0;
+    for (size_t f=0; f<filenames.size(); ++f) {
+      struct stat s;
+      if (stat(filenames[f].c_str(), &s) != 0) {
+        continue;
+      }
+      bytes_to_read += static_cast<uint64_t>(s.st_size);
+      for (uint64_t offset=0; offset<static_cast<uint64_t>(s.st_size);
+           offset += warm_chunk_size) {
+        warm_chunks.chunks.push_back(std::pair<size_t, uint64_t>(f, offset));
+      }
+    }
+
+    if (progress != NULL) {
+      progress->bytes_read.store(0);
+      progress->bytes_to_read.store(bytes_to_read);
+    }
+
+    // read them, the first thread in this thread
+    const size_t thread_count = (num_threads == 0) ? 1 : num_threads;
+    std::vector<pthread_t> threads(thread_count);
+    for (size_t i=1; i<thread_count; ++i) {
+      if (pthread_create(&threads[i], NULL, run_warm_chunks,
+                         &warm_chunks) != 0) {
+        std::cerr << "Error: unable to start warm thread.\n";
+        exit(1);
+      }
+    }
+    run_warm_chunks(&warm_chunks);
+    for (size_t i=1; i<thread_count; ++i) {
+      pthread_join(threads[i], NULL);
+    }
+    return warm_chunks.bytes_read;
+  }
+
+  bool lock_memory(const void* const p, const size_t size,
+                   const bool huge_pages) {
+    if (size == 0) {
+      return true;
+    }
+#ifdef LMDB_HELPER_MLOCK
+    // whole pages inside and around the range
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p) / page * page;
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(p) + size + page - 1)
+                          / page * page;
+#ifdef MADV_HUGEPAGE
+    if (huge_pages) {
+      ::madvise(reinterpret_cast<void*>(begin), end - begin, MADV_HUGEPAGE);
+    }
+#else
+    (void)huge_pages;
+#endif
+    return ::mlock(reinterpret_cast<void*>(begin), end - begin) == 0;
+#else
+    (void)p;
+    (void)huge_pages;
+    return false;
+#endif
+  }
 }
 
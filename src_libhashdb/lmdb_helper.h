@@ -35,11 +35,14 @@
 #include <cassert>
 #include <stdint.h>
 #include <cstring>
+#include <string>
+#include <vector>
 #include <sstream>
 #include <unistd.h>
 #include <iomanip>
 #include <pthread.h>
 #include <iostream>
+#include <atomic>
 
 //#define DEBUG
 
@@ -57,13 +60,164 @@ namespace lmdb_helper {
   // https://code.google.com/p/protobuf/source/browse/trunk/src/google/protobuf/io/coded_stream.cc?r=417
   const uint8_t* decode_uint64_t(const uint8_t* p_ptr, uint64_t& value);
 
+  // the encoded key of a source ID and its index in a batch
+  struct source_id_key_t {
+    std::string key;
+    size_t index;
+    source_id_key_t() : key(), index(0) {
+    }
+    bool operator<(const source_id_key_t& that) const {
+      return key < that.key;
+    }
+  };
+
+  // the keys of source_ids in key order, which is not numeric order, so
+  // that stores keyed by source ID read a batch in one forward sweep
+  void source_id_keys(const std::vector<uint64_t>& source_ids,
+                      std::vector<source_id_key_t>& keys);
+
+  // batch lookups interleave the memory accesses of this many keys
+  const size_t prefetch_batch_size = 16;
+
+  // hint that the cache line at p will be read soon
+  inline void prefetch(const void* const p) {
+#if defined(__GNUC__)
+    __builtin_prefetch(p, 0, 3);
+#else
+    (void)p;
+#endif
+  }
+
+  // when writable stores are synced to disk
+  enum sync_policy_t {
+    SYNC_NONE,      // never, leaving writeback to the operating system
+    SYNC_PERIODIC,  // in the background by time or volume, and at close
+    SYNC_FLUSH      // when the importer flushes, and at close
+  };
+
+  // the sync policy of a name, one of none, periodic, or flush.
+  // Return false if the name is not a sync policy.
+  bool sync_policy_from_name(const std::string& name,
+                             sync_policy_t& sync_policy);
+
+  // how a store's map grows, when it is synced, and how it is read
+  struct env_policy_t {
+    uint64_t initial_map_size;  // map to open with and preallocate, or 0
+    uint64_t max_map_size;      // largest map, or 0 for no limit
+    sync_policy_t sync_policy;
+    uint32_t sync_seconds;      // periodic sync interval
+    uint64_t sync_bytes;        // periodic sync after this many new bytes
+    std::string store_location; // directory to place a new store in, or ""
+    uint32_t max_readers;       // reader slots, or 0 for the LMDB default
+    uint32_t max_snapshot_ms;   // how long cached read snapshots are kept
+    uint32_t max_dbs;           // named databases, or 0 for only the main
+    env_policy_t();
+  };
+
+  // the databases of a store.  A store keeps its records in the main
+  // database, or splits them between a named records database and a
+  // named dupfixed database of fixed-size duplicates that are read a
+  // page at a time using MDB_GET_MULTIPLE.
+  struct dbis_t {
+    bool is_split;
+    MDB_dbi dbi;            // the records database when split
+    MDB_dbi dupfixed_dbi;   // the dupfixed database when split
+    dbis_t();
+  };
+
+  // the named databases of a split store
+  const uint32_t split_max_dbs = 2;
+
+  // how far past its map a read-only store maps.  Windows cannot map
+  // a read-only file past its end.
+#ifdef _WIN32
+  const uint64_t read_only_map_headroom = 0;
+#else
+  const uint64_t read_only_map_headroom =
+          (sizeof(size_t) < 8) ? 0 : static_cast<uint64_t>(1) << 34;
+#endif
+
+  // open a store.  A writable store opens with a map of at least
+  // initial_map_size bytes, and a new store preallocates that many bytes
+  // on disk.  The map may grow to max_map_size bytes, or without limit
+  // when max_map_size is 0.  A read-only store maps max_map_size bytes
+  // when it is set, else read_only_map_headroom bytes past its current
+  // map, so that it keeps reading while another process imports into
+  // it.  The store has max_readers reader slots.  A writable store
+  // with the periodic sync policy gets a background syncer.  A new store
+  // with a store_location is made in a uniquely named directory there
+  // and store_dir links to it, so that later opens find it through
+  // store_dir.  Close the store using close_env.
   MDB_env* open_env(const std::string& store_dir,
-                           const hashdb::file_mode_type_t file_mode);
+                    const hashdb::file_mode_type_t file_mode,
+                    const env_policy_t& policy = env_policy_t());
+
+  // sync a writable store if its sync policy is flush, or whatever its
+  // policy when force is set
+  void flush_env(MDB_env* env, const bool force = false);
+
+  // stop any syncer, sync as the policy requires, and close a store
+  // opened using open_env
+  void close_env(MDB_env* env);
+
+  // reopen a read-only store opened using open_env, in a child process
+  // after fork.  The inherited environment is abandoned rather than
+  // closed, since closing it would clear the reader slots of the parent,
+  // but its data map and file are released.  Returns the new
+  // environment, which is closed using close_env.
+  MDB_env* reopen_env_after_fork(MDB_env* env);
+
+  // grow the map when fewer than reserve_pages pages remain free.
+  // Callers that write many records in one transaction must reserve
+  // room for all of them since the map cannot grow during a transaction.
+  // The map is only measured once earlier reserves are used up, so
+  // calling this before every write is cheap.
+  void maybe_grow(MDB_env* env, const size_t reserve_pages = 10);
+
+  // report why a transaction of a store could not begin, and exit.
+  // Running out of reader slots is reported with the setting to raise.
+  void txn_begin_error(MDB_env* env, const int rc)
+                                              __attribute__((noreturn));
 
-  void maybe_grow(MDB_env* env);
+  // open the databases of a split store once, creating them in a new
+  // store, so that every transaction of the store may use them.  The
+  // store must be opened with split_max_dbs named databases.  A store
+  // that is not split uses the main database that each transaction
+  // opens.
+  dbis_t open_dbis(MDB_env* env, const hashdb::file_mode_type_t file_mode,
+                   const bool is_duplicates, const bool is_split);
 
   // size
   size_t size(MDB_env* env);
+
+  // the records of a store with these databases
+  size_t size(MDB_env* env, const dbis_t& dbis);
+
+  // the data file of a store
+  std::string data_filename(MDB_env* env);
+
+  // the progress of warm_files, which other threads may read while it
+  // runs, and a request that it stop early
+  struct warm_progress_t {
+    std::atomic<uint64_t> bytes_to_read;
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<bool> stop;
+    warm_progress_t() : bytes_to_read(0), bytes_read(0), stop(false) {
+    }
+  };
+
+  // read files into the page cache in order using num_threads threads
+  // that each read large sequential chunks, reporting into progress if
+  // it is not NULL.  Return the bytes read.
+  uint64_t warm_files(const std::vector<std::string>& filenames,
+                      const size_t num_threads,
+                      warm_progress_t* const progress = NULL);
+
+  // lock memory so that it is not paged out, first advising huge pages
+  // for it if huge_pages.  Return false if it cannot be locked, for
+  // example over the memory lock limit.
+  bool lock_memory(const void* const p, const size_t size,
+                   const bool huge_pages);
 }
 
 #endif
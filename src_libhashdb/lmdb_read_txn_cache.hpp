@@ -0,0 +1,359 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides reusable read-only LMDB transactions, one per thread.
+ *
+ * Each thread that reads through the cache gets its own read-only
+ * transaction and cursor.  Between reads the transaction is reset, which
+ * releases its snapshot so idle threads do not hold old pages.  Each
+ * read renews the transaction, so it sees the latest committed data.
+ * Lookups then skip allocating and freeing a transaction and cursor.
+ *
+ * Given a maximum snapshot age, a thread instead keeps its snapshot
+ * between reads until it is that old, so that frequent lookups also skip
+ * renewing while another process imports into the store.  Reads then
+ * see committed data at most that late.  Each renew also resets the
+ * idle snapshots of other threads that are past the age, so threads that
+ * stop reading do not keep old pages from being reused and grow the
+ * store.
+ *
+ * When a thread exits, its transaction is ended and its reader slot freed,
+ * so threads that come and go do not use up the reader slots.
+ *
+ * The cache must be deleted before its environment is closed, and after
+ * the threads that read through it have exited.
+ */
+
+#ifndef LMDB_READ_TXN_CACHE_HPP
+#define LMDB_READ_TXN_CACHE_HPP
+
+#include <config.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <stdint.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "mutex_lock.hpp"
+#include "stage_stats.hpp"
+
+namespace hashdb {
+
+  class lmdb_read_txn_cache_t;
+
+  // one thread's read-only transaction and cursors
+  struct lmdb_read_txn_t {
+    lmdb_read_txn_cache_t* cache; // to end the txn when the thread exits
+    MDB_txn* txn;
+    MDB_dbi dbi;
+    MDB_cursor* cursor;
+    MDB_cursor* dupfixed_cursor; // on the dupfixed database, or NULL
+    bool in_use;
+    bool is_held;           // snapshot kept while idle
+    uint64_t renewed_ns;    // when the snapshot was taken
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t M;      // mutext for in_use and is_held
+#else
+    int M;                  // placeholder
+#endif
+    lmdb_read_txn_t() : cache(0), txn(0), dbi(0), cursor(0),
+                        dupfixed_cursor(0), in_use(false),
+                        is_held(false), renewed_ns(0), M() {
+      MUTEX_INIT(&M);
+    }
+
+    ~lmdb_read_txn_t() {
+      MUTEX_DESTROY(&M);
+    }
+
+    private:
+    // do not allow copy or assignment
+    lmdb_read_txn_t(const lmdb_read_txn_t&);
+    lmdb_read_txn_t& operator=(const lmdb_read_txn_t&);
+  };
+
+  class lmdb_read_txn_cache_t {
+    private:
+    MDB_env* env;
+    const unsigned int dbi_flags; // example MDB_DUPSORT
+    const uint64_t max_snapshot_ns; // 0 to renew for every read
+    const lmdb_helper::dbis_t* dbis; // of a split store, or NULL
+#ifdef HAVE_PTHREAD
+    pthread_key_t key;            // this thread's lmdb_read_txn_t
+    mutable pthread_mutex_t M;    // mutext for read_txns
+#endif
+    std::vector<lmdb_read_txn_t*> read_txns;
+
+    // do not allow copy or assignment
+    lmdb_read_txn_cache_t(const lmdb_read_txn_cache_t&);
+    lmdb_read_txn_cache_t& operator=(const lmdb_read_txn_cache_t&);
+
+    // renew a reset read transaction and its cursor
+    void renew(lmdb_read_txn_t* const read_txn) {
+      int rc = mdb_txn_renew(read_txn->txn);
+      if (rc == MDB_MAP_RESIZED) {
+        const char* path = "";
+        mdb_env_get_path(env, &path);
+        std::cerr << "Error: store " << path << " grew past the map of "
+                  << "this reader.\nSet max_map_size to scan while "
+                  << "importing.  Aborting.\n";
+        exit(1);
+      }
+      if (rc != 0) {
+        std::cerr << "LMDB txn renew error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      rc = mdb_cursor_renew(read_txn->txn, read_txn->cursor);
+      if (rc == 0 && read_txn->dupfixed_cursor != NULL) {
+        rc = mdb_cursor_renew(read_txn->txn, read_txn->dupfixed_cursor);
+      }
+      if (rc != 0) {
+        std::cerr << "LMDB cursor renew error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+#ifdef HAVE_PTHREAD
+    // end the transaction of a thread that exits, freeing its reader slot
+    static void end_thread_txn(void* const value) {
+      lmdb_read_txn_t* const read_txn = static_cast<lmdb_read_txn_t*>(value);
+      lmdb_read_txn_cache_t* const cache = read_txn->cache;
+      MUTEX_LOCK(&cache->M);
+      std::vector<lmdb_read_txn_t*>::iterator it = std::find(
+              cache->read_txns.begin(), cache->read_txns.end(), read_txn);
+      if (it == cache->read_txns.end()) {
+        // dropped by reattach, the txn is not ours to end
+        MUTEX_UNLOCK(&cache->M);
+        return;
+      }
+      cache->read_txns.erase(it);
+      MUTEX_UNLOCK(&cache->M);
+      mdb_txn_abort(read_txn->txn);
+      mdb_cursor_close(read_txn->cursor);
+      if (read_txn->dupfixed_cursor != NULL) {
+        mdb_cursor_close(read_txn->dupfixed_cursor);
+      }
+      delete read_txn;
+    }
+
+    // reset the idle snapshots of other threads that are too old
+    void reset_stale(const lmdb_read_txn_t* const self, const uint64_t now) {
+      MUTEX_LOCK(&M);
+      for (size_t i=0; i<read_txns.size(); ++i) {
+        lmdb_read_txn_t* const read_txn = read_txns[i];
+        if (read_txn == self || pthread_mutex_trylock(&read_txn->M) != 0) {
+          continue;
+        }
+        if (!read_txn->in_use && read_txn->is_held &&
+            now - read_txn->renewed_ns >= max_snapshot_ns) {
+          mdb_txn_reset(read_txn->txn);
+          read_txn->is_held = false;
+        }
+        MUTEX_UNLOCK(&read_txn->M);
+      }
+      MUTEX_UNLOCK(&M);
+    }
+#endif
+
+    public:
+    /**
+     * Cache read transactions of env.  Snapshots are kept between reads
+     * for up to max_snapshot_ms milliseconds, or are released after each
+     * read when it is 0.  The transactions of a split store use its
+     * open databases, dbis, which must outlive the cache.
+     */
+    lmdb_read_txn_cache_t(MDB_env* p_env, bool is_duplicates,
+                          const uint32_t max_snapshot_ms = 0,
+                          const lmdb_helper::dbis_t* const p_dbis = NULL) :
+           env(p_env),
+           dbi_flags(is_duplicates ? MDB_DUPSORT : 0),
+           max_snapshot_ns(static_cast<uint64_t>(max_snapshot_ms) * 1000000),
+           dbis((p_dbis != NULL && p_dbis->is_split) ? p_dbis : NULL),
+#ifdef HAVE_PTHREAD
+           key(), M(),
+#endif
+           read_txns() {
+#ifdef HAVE_PTHREAD
+      if (pthread_key_create(&key, end_thread_txn) != 0) {
+        std::cerr << "Error obtaining LMDB read txn key.\n";
+        assert(0);
+      }
+      MUTEX_INIT(&M);
+#endif
+    }
+
+    ~lmdb_read_txn_cache_t() {
+#ifdef HAVE_PTHREAD
+      // free the transactions of all threads, read-only cursors may be
+      // closed after their transaction ends
+      MUTEX_LOCK(&M);
+      for (size_t i=0; i<read_txns.size(); ++i) {
+        if (read_txns[i]->in_use) {
+          std::cerr << "Error: LMDB read txn is still in use.\n";
+          assert(0);
+        }
+        mdb_txn_abort(read_txns[i]->txn);
+        mdb_cursor_close(read_txns[i]->cursor);
+        if (read_txns[i]->dupfixed_cursor != NULL) {
+          mdb_cursor_close(read_txns[i]->dupfixed_cursor);
+        }
+        delete read_txns[i];
+      }
+      read_txns.clear();
+      MUTEX_UNLOCK(&M);
+      pthread_key_delete(key);
+      MUTEX_DESTROY(&M);
+#endif
+    }
+
+    /**
+     * Use p_env in a child process after fork.  The transactions of the
+     * parent hold its reader slots, so they are dropped without being
+     * ended, and the forking thread, the one thread of the child, starts
+     * a new one on its next read.
+     */
+    void reattach(MDB_env* p_env) {
+#ifdef HAVE_PTHREAD
+      MUTEX_LOCK(&M);
+      read_txns.clear();
+      env = p_env;
+      pthread_setspecific(key, NULL);
+      MUTEX_UNLOCK(&M);
+#else
+      env = p_env;
+#endif
+    }
+
+    /**
+     * Take this thread's read transaction with its cursor renewed.
+     * Returns NULL if it is already taken or if threads are not
+     * available, in which case use a transaction of your own.
+     */
+    lmdb_read_txn_t* take() {
+#ifdef HAVE_PTHREAD
+      lmdb_read_txn_t* read_txn =
+                 static_cast<lmdb_read_txn_t*>(pthread_getspecific(key));
+
+      if (read_txn == NULL) {
+        // first read on this thread so create its transaction
+        read_txn = new lmdb_read_txn_t;
+        read_txn->cache = this;
+        int rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &read_txn->txn);
+        if (rc != 0) {
+          lmdb_helper::txn_begin_error(env, rc);
+        }
+        if (dbis != NULL) {
+          read_txn->dbi = dbis->dbi;
+          rc = mdb_cursor_open(read_txn->txn, dbis->dupfixed_dbi,
+                               &read_txn->dupfixed_cursor);
+        } else {
+          rc = mdb_dbi_open(read_txn->txn, NULL, dbi_flags, &read_txn->dbi);
+        }
+        if (rc != 0) {
+          std::cerr << "LMDB dbi error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        rc = mdb_cursor_open(read_txn->txn, read_txn->dbi,
+                             &read_txn->cursor);
+        if (rc != 0) {
+          std::cerr << "LMDB cursor error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        read_txn->in_use = true;
+        read_txn->renewed_ns = (max_snapshot_ns == 0) ? 0 : stage_clock_ns();
+        MUTEX_LOCK(&M);
+        read_txns.push_back(read_txn);
+        MUTEX_UNLOCK(&M);
+        pthread_setspecific(key, read_txn);
+        return read_txn;
+      }
+
+      if (max_snapshot_ns == 0) {
+        if (read_txn->in_use) {
+          // nested read on this thread
+          return NULL;
+        }
+
+        // renew the reset transaction to see the latest data
+        renew(read_txn);
+        read_txn->in_use = true;
+        return read_txn;
+      }
+
+      // keep a young snapshot, else take a new one.  Other threads may
+      // reset this snapshot while it is idle.
+      MUTEX_LOCK(&read_txn->M);
+      if (read_txn->in_use) {
+        // nested read on this thread
+        MUTEX_UNLOCK(&read_txn->M);
+        return NULL;
+      }
+      read_txn->in_use = true;
+      const uint64_t now = stage_clock_ns();
+      const bool is_young = read_txn->is_held &&
+                            now - read_txn->renewed_ns < max_snapshot_ns;
+      if (read_txn->is_held && !is_young) {
+        mdb_txn_reset(read_txn->txn);
+        read_txn->is_held = false;
+      }
+      MUTEX_UNLOCK(&read_txn->M);
+      if (is_young) {
+        return read_txn;
+      }
+      renew(read_txn);
+      read_txn->renewed_ns = now;
+      reset_stale(read_txn, now);
+      return read_txn;
+#else
+      return NULL;
+#endif
+    }
+
+    /**
+     * Give back a read transaction obtained from take.  The transaction
+     * is reset so that it holds no snapshot while idle, unless its
+     * snapshot is younger than the maximum snapshot age.
+     */
+    void give_back(lmdb_read_txn_t* const read_txn) {
+      if (max_snapshot_ns == 0) {
+        mdb_txn_reset(read_txn->txn);
+        read_txn->in_use = false;
+        return;
+      }
+      MUTEX_LOCK(&read_txn->M);
+      read_txn->is_held =
+               stage_clock_ns() - read_txn->renewed_ns < max_snapshot_ns;
+      if (!read_txn->is_held) {
+        mdb_txn_reset(read_txn->txn);
+      }
+      read_txn->in_use = false;
+      MUTEX_UNLOCK(&read_txn->M);
+    }
+  };
+}
+
+#endif
+
@@ -0,0 +1,391 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Manage the LMDB repository store, which indexes the source IDs that
+ * have a name in each repository as a source_id_bitmap_t.  A record
+ * holds one bitmap container, keyed by the repository name followed by
+ * the high bits of the container's IDs, so the containers of a
+ * repository are adjacent.  Added IDs are kept in memory and written in
+ * one transaction on flush.  Threadsafe.
+ *
+ * Hash databases made before the repository store existed do not have
+ * one.  Opening such a database for writing creates the store and the
+ * caller must fill it from the source name store.  Opening it read-only
+ * leaves the store unavailable.
+ */
+
+#ifndef LMDB_REPOSITORY_MANAGER_HPP
+#define LMDB_REPOSITORY_MANAGER_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_context.hpp"
+#include "source_id_bitmap.hpp"
+#include <vector>
+#include <map>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class lmdb_repository_manager_t {
+
+  private:
+  const std::string store_dir;
+  const bool is_new_store;               // whether open created the store
+  MDB_env* env;                          // or NULL if unavailable
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+  std::map<std::string, source_id_bitmap_t> pending; // IDs not yet written
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_repository_manager_t(const lmdb_repository_manager_t&);
+  lmdb_repository_manager_t& operator=(const lmdb_repository_manager_t&);
+
+  static bool store_exists(const std::string& dir) {
+    return access(dir.c_str(), F_OK) == 0;
+  }
+
+  // open the store, creating it for writing if it is missing
+  static MDB_env* open(const std::string& dir,
+                       const hashdb::file_mode_type_t file_mode,
+                       const lmdb_helper::env_policy_t& policy) {
+    if (file_mode == hashdb::READ_ONLY && !store_exists(dir)) {
+      return NULL;
+    }
+    if (file_mode == hashdb::RW_MODIFY && !store_exists(dir)) {
+      return lmdb_helper::open_env(dir, hashdb::RW_NEW, policy);
+    }
+    return lmdb_helper::open_env(dir, file_mode, policy);
+  }
+
+  // the key prefix of the containers of a repository
+  static std::string key_prefix(const std::string& repository_name) {
+    uint8_t size_bytes[10];
+    const uint8_t* const p = lmdb_helper::encode_uint64_t(
+                                   repository_name.size(), size_bytes);
+    return std::string(reinterpret_cast<const char*>(size_bytes),
+                       p - size_bytes) + repository_name;
+  }
+
+  // the key of one container, with its high bits in big-endian order
+  static std::string key(const std::string& prefix, const uint64_t high) {
+    std::string k(prefix);
+    for (int i=7; i>=0; --i) {
+      k.push_back(static_cast<char>((high >> (8*i)) & 0xff));
+    }
+    return k;
+  }
+
+  // add the container to the one in the store, call while locked
+  void merge(MDB_txn* const txn, const MDB_dbi dbi,
+             const std::string& container_key,
+             const source_id_container_t& container) {
+    MDB_val k;
+    k.mv_size = container_key.size();
+    k.mv_data = const_cast<char*>(container_key.data());
+    MDB_val v;
+    source_id_container_t stored;
+    int rc = mdb_get(txn, dbi, &k, &v);
+    if (rc == 0) {
+      if (!stored.decode(static_cast<uint8_t*>(v.mv_data), v.mv_size)) {
+        std::cerr << "data decode error in LMDB repository store\n";
+        assert(0);
+      }
+      const size_t old_size = stored.size();
+      stored.unite(container);
+      if (stored.size() == old_size) {
+        return;
+      }
+    } else if (rc == MDB_NOTFOUND) {
+      stored = container;
+    } else {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    const std::string encoding = stored.encode();
+    v.mv_size = encoding.size();
+    v.mv_data = const_cast<char*>(encoding.data());
+    rc = mdb_put(txn, dbi, &k, &v, 0);
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+  }
+
+  public:
+  lmdb_repository_manager_t(const std::string& hashdb_dir,
+                      const hashdb::file_mode_type_t file_mode,
+                      const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       store_dir(hashdb_dir + "/lmdb_repository_store"),
+       is_new_store(file_mode != hashdb::READ_ONLY &&
+                    (file_mode == hashdb::RW_NEW || !store_exists(store_dir))),
+       env(open(store_dir, file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY && env != NULL) ?
+             new hashdb::lmdb_read_txn_cache_t(env, false,
+                             policy.max_snapshot_ms) : NULL),
+       pending(),
+       M() {
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_repository_manager_t() {
+    flush();
+
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    if (env != NULL) {
+      lmdb_helper::close_env(env);
+    }
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store, if it exists, in a child process after
+   * fork.
+   */
+  void reopen_after_fork() {
+    if (env != NULL) {
+      env = lmdb_helper::reopen_env_after_fork(env);
+      read_txn_cache->reattach(env);
+    }
+  }
+
+  // whether the store exists
+  bool is_available() const {
+    return env != NULL;
+  }
+
+  // whether opening created the store, so it must be filled
+  bool is_new() const {
+    return is_new_store;
+  }
+
+  /**
+   * Add the source ID to the repository when the store is next flushed.
+   */
+  void insert(const std::string& repository_name,
+              const uint64_t source_id) {
+    MUTEX_LOCK(&M);
+    pending[repository_name].add(source_id);
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Remove the source ID from the repository, writing any added IDs
+   * first.
+   */
+  void remove(const std::string& repository_name,
+              const uint64_t source_id) {
+    if (env == NULL) {
+      return;
+    }
+    flush();
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false);
+    context.open();
+
+    const std::string container_key = key(key_prefix(repository_name),
+                                 source_id_bitmap_t::high(source_id));
+    MDB_val k;
+    k.mv_size = container_key.size();
+    k.mv_data = const_cast<char*>(container_key.data());
+    MDB_val v;
+    int rc = mdb_get(context.txn, context.dbi, &k, &v);
+    if (rc == 0) {
+      source_id_container_t stored;
+      if (!stored.decode(static_cast<uint8_t*>(v.mv_data), v.mv_size)) {
+        std::cerr << "data decode error in LMDB repository store\n";
+        assert(0);
+      }
+      if (stored.remove(source_id_bitmap_t::low(source_id))) {
+        if (stored.size() == 0) {
+          rc = mdb_del(context.txn, context.dbi, &k, NULL);
+        } else {
+          const std::string encoding = stored.encode();
+          v.mv_size = encoding.size();
+          v.mv_data = const_cast<char*>(encoding.data());
+          rc = mdb_put(context.txn, context.dbi, &k, &v, 0);
+        }
+      }
+    }
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Read the source IDs of the repository, false if it has none.
+   */
+  bool find(const std::string& repository_name,
+            source_id_bitmap_t& bitmap) const {
+
+    bitmap.containers.clear();
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
+    context.open();
+
+    // walk the containers of the repository
+    const std::string prefix = key_prefix(repository_name);
+    context.key.mv_size = prefix.size();
+    context.key.mv_data = const_cast<char*>(prefix.data());
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+    while (rc == 0 && context.key.mv_size == prefix.size() + 8 &&
+           memcmp(context.key.mv_data, prefix.data(), prefix.size()) == 0) {
+      const uint8_t* const high_p =
+            static_cast<uint8_t*>(context.key.mv_data) + prefix.size();
+      uint64_t high = 0;
+      for (size_t i=0; i<8; ++i) {
+        high = (high << 8) | high_p[i];
+      }
+      if (!bitmap.containers[high].decode(
+                    static_cast<uint8_t*>(context.data.mv_data),
+                    context.data.mv_size)) {
+        std::cerr << "data decode error in LMDB repository store\n";
+        assert(0);
+      }
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return bitmap.containers.size() != 0;
+  }
+
+  /**
+   * The names of all repositories in the store, in key order.
+   */
+  std::vector<std::string> repository_names() const {
+    std::vector<std::string> names;
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
+    context.open();
+
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_FIRST);
+    while (rc == 0) {
+      uint64_t name_size;
+      const uint8_t* const name_p = lmdb_helper::decode_uint64_t(
+               static_cast<uint8_t*>(context.key.mv_data), name_size);
+      const std::string name(reinterpret_cast<const char*>(name_p),
+                             name_size);
+      if (names.size() == 0 || names.back() != name) {
+        names.push_back(name);
+      }
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+
+    if (rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return names;
+  }
+
+  // write the added IDs then sync to disk if the sync policy is flush or
+  // force is set
+  void flush(const bool force = false) {
+    if (env == NULL) {
+      return;
+    }
+
+    MUTEX_LOCK(&M);
+    if (pending.size() != 0) {
+
+      // maybe grow the DB, allowing a bitset and its branch pages for
+      // each container
+      size_t num_containers = 0;
+      for (std::map<std::string, source_id_bitmap_t>::const_iterator it =
+           pending.begin(); it != pending.end(); ++it) {
+        num_containers += it->second.containers.size();
+      }
+      lmdb_helper::maybe_grow(env, 10 + 4 * num_containers);
+
+      // get context
+      hashdb::lmdb_context_t context(env, true, false);
+      context.open();
+
+      for (std::map<std::string, source_id_bitmap_t>::const_iterator it =
+           pending.begin(); it != pending.end(); ++it) {
+        const std::string prefix = key_prefix(it->first);
+        for (source_id_bitmap_t::containers_t::const_iterator c_it =
+             it->second.containers.begin();
+             c_it != it->second.containers.end(); ++c_it) {
+          merge(context.txn, context.dbi, key(prefix, c_it->first),
+                c_it->second);
+        }
+      }
+
+      context.close();
+      pending.clear();
+    }
+    MUTEX_UNLOCK(&M);
+
+    lmdb_helper::flush_env(env, force);
+  }
+
+  // call this from a lock to prevent getting an unstable answer.
+  size_t size() const {
+    return (env == NULL) ? 0 : lmdb_helper::size(env);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
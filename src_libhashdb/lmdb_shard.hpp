@@ -0,0 +1,240 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides the LMDB environments of a store partitioned by hash prefix.
+ *
+ * A store with 0 shard bits is one environment at hashdb_dir/store_name.
+ * A store with k shard bits is 2^k environments at
+ * hashdb_dir/store_name_i, where shard i holds the hashes whose leading
+ * k bits are i.  Shards are in key order, so walking the shards in
+ * order walks the store in key order.
+ *
+ * Each shard has its own lock because LMDB allows one writer per
+ * environment, so writes to different shards commit concurrently.
+ *
+ * The initial map size of a store is divided evenly among its shards and
+ * the rest of the store's policy applies to each shard.
+ *
+ * The shards of a split store keep their records in the named databases
+ * of lmdb_helper::dbis_t, which each shard opens once.
+ */
+
+#ifndef LMDB_SHARD_HPP
+#define LMDB_SHARD_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_read_txn_cache.hpp"
+#include <string>
+#include <sstream>
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <stdint.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+  static const uint32_t max_hash_shard_bits = 6;
+
+  // the directory of one shard of a store
+  inline std::string shard_store_dir(const std::string& hashdb_dir,
+                                     const std::string& store_name,
+                                     const uint32_t shard_bits,
+                                     const size_t shard) {
+    if (shard_bits == 0) {
+      return hashdb_dir + "/" + store_name;
+    }
+    std::stringstream ss;
+    ss << hashdb_dir << "/" << store_name << "_" << shard;
+    return ss.str();
+  }
+
+  // the shard of a hash given its leading bits
+  inline size_t shard_of(const void* const hash, const size_t hash_size,
+                         const uint32_t shard_bits) {
+    if (shard_bits == 0 || hash_size == 0) {
+      return 0;
+    }
+    return static_cast<const uint8_t*>(hash)[0] >> (8 - shard_bits);
+  }
+
+  // one LMDB environment of a store
+  class lmdb_shard_t {
+    private:
+    // do not allow copy or assignment
+    lmdb_shard_t(const lmdb_shard_t&);
+    lmdb_shard_t& operator=(const lmdb_shard_t&);
+
+    const bool is_duplicates;
+
+    public:
+    MDB_env* env;
+    lmdb_helper::dbis_t dbis;
+    hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+#ifdef HAVE_PTHREAD
+    mutable pthread_mutex_t M;                     // mutext for writes
+#else
+    mutable int M;                                 // placeholder
+#endif
+
+    lmdb_shard_t(const std::string& store_dir,
+                 const hashdb::file_mode_type_t file_mode,
+                 const bool p_is_duplicates,
+                 const lmdb_helper::env_policy_t& policy,
+                 const bool is_split = false) :
+          is_duplicates(p_is_duplicates),
+          env(lmdb_helper::open_env(store_dir, file_mode, policy)),
+          dbis(lmdb_helper::open_dbis(env, file_mode, is_duplicates,
+                                      is_split)),
+          read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+                new hashdb::lmdb_read_txn_cache_t(env, is_duplicates,
+                                    policy.max_snapshot_ms, &dbis) : NULL),
+          M() {
+      MUTEX_INIT(&M);
+    }
+
+    // the ID of the last committed transaction of the shard
+    uint64_t last_txnid() const {
+      MDB_envinfo info;
+      int rc = mdb_env_info(env, &info);
+      if (rc != 0) {
+        std::cerr << "LMDB env info error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+      return info.me_last_txnid;
+    }
+
+    // the records of the shard
+    size_t size() const {
+      return lmdb_helper::size(env, dbis);
+    }
+
+    // reopen the read-only shard in a child process after fork
+    void reopen_after_fork() {
+      env = lmdb_helper::reopen_env_after_fork(env);
+      dbis = lmdb_helper::open_dbis(env, hashdb::READ_ONLY, is_duplicates,
+                                    dbis.is_split);
+      read_txn_cache->reattach(env);
+    }
+
+    ~lmdb_shard_t() {
+      // free cached read txns then close the DB environment
+      delete read_txn_cache;
+      lmdb_helper::close_env(env);
+      MUTEX_DESTROY(&M);
+    }
+  };
+
+  // the shards of a store
+  class lmdb_shards_t {
+    private:
+    const uint32_t shard_bits;
+    std::vector<lmdb_shard_t*> shards;
+
+    // do not allow copy or assignment
+    lmdb_shards_t(const lmdb_shards_t&);
+    lmdb_shards_t& operator=(const lmdb_shards_t&);
+
+    public:
+    lmdb_shards_t(const std::string& hashdb_dir,
+                  const std::string& store_name,
+                  const hashdb::file_mode_type_t file_mode,
+                  const bool is_duplicates,
+                  const uint32_t p_shard_bits,
+                  const lmdb_helper::env_policy_t& policy =
+                                                lmdb_helper::env_policy_t(),
+                  const bool is_split = false) :
+          shard_bits(p_shard_bits),
+          shards() {
+      if (shard_bits > max_hash_shard_bits) {
+        std::cerr << "program error in shard_bits " << shard_bits << "\n";
+        assert(0);
+      }
+      const size_t num_shards = static_cast<size_t>(1) << shard_bits;
+      lmdb_helper::env_policy_t shard_policy(policy);
+      shard_policy.initial_map_size = policy.initial_map_size / num_shards;
+      if (is_split) {
+        shard_policy.max_dbs = lmdb_helper::split_max_dbs;
+      }
+      shards.reserve(num_shards);
+      for (size_t i=0; i<num_shards; ++i) {
+        shards.push_back(new lmdb_shard_t(shard_store_dir(
+                   hashdb_dir, store_name, shard_bits, i),
+                   file_mode, is_duplicates, shard_policy, is_split));
+      }
+    }
+
+    ~lmdb_shards_t() {
+      for (size_t i=0; i<shards.size(); ++i) {
+        delete shards[i];
+      }
+    }
+
+    // reopen the read-only shards in a child process after fork
+    void reopen_after_fork() {
+      for (size_t i=0; i<shards.size(); ++i) {
+        shards[i]->reopen_after_fork();
+      }
+    }
+
+    // the number of shards
+    size_t count() const {
+      return shards.size();
+    }
+
+    lmdb_shard_t& operator[](const size_t shard) const {
+      return *shards[shard];
+    }
+
+    // the shard index of a hash or hash prefix
+    size_t index(const std::string& hash) const {
+      return shard_of(hash.c_str(), hash.size(), shard_bits);
+    }
+
+    // the shard of a hash or hash prefix
+    lmdb_shard_t& of(const std::string& hash) const {
+      return *shards[index(hash)];
+    }
+
+    // sync the shards if their sync policy is flush or force is set
+    void flush(const bool force = false) const {
+      for (size_t i=0; i<shards.size(); ++i) {
+        lmdb_helper::flush_env(shards[i]->env, force);
+      }
+    }
+
+    // the number of entries in all shards
+    size_t size() const {
+      size_t total = 0;
+      for (size_t i=0; i<shards.size(); ++i) {
+        total += shards[i]->size();
+      }
+      return total;
+    }
+  };
+}
+
+#endif
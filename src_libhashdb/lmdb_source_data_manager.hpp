@@ -35,6 +35,7 @@
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
 #include "hashdb.hpp"
+#include "hash_batch.hpp"
 #include <vector>
 #include <unistd.h>
 #include <sstream>
@@ -53,12 +54,28 @@
 
 namespace hashdb {
 
+// the source data of one source, for writing in a batch
+struct source_data_entry_t {
+  uint64_t source_id;
+  std::string file_binary_hash;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  source_data_entry_t() : source_id(0), file_binary_hash(), filesize(0),
+                          file_type(), zero_count(0), nonprobative_count(0) {
+  }
+};
+
+typedef std::vector<source_data_entry_t> source_data_entries_t;
+
 class lmdb_source_data_manager_t {
 
   private:
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
   MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -70,43 +87,15 @@ class lmdb_source_data_manager_t {
   lmdb_source_data_manager_t(const lmdb_source_data_manager_t&);
   lmdb_source_data_manager_t& operator=(const lmdb_source_data_manager_t&);
 
-  public:
-  lmdb_source_data_manager_t(const std::string& p_hashdb_dir,
-                            const hashdb::file_mode_type_t p_file_mode) :
-       hashdb_dir(p_hashdb_dir),
-       file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_data_store",
-                                                            file_mode)),
-       M() {
-    MUTEX_INIT(&M);
-  }
-
-  ~lmdb_source_data_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
-
-    MUTEX_DESTROY(&M);
-  }
-
-  /**
-   * Insert unless there and same.
-   */
-  void insert(const uint64_t source_id,
-              const std::string& file_binary_hash,
-              const uint64_t filesize,
-              const std::string& file_type,
-              const uint64_t zero_count,
-              const uint64_t nonprobative_count,
-              hashdb::lmdb_changes_t& changes) {
-
-    MUTEX_LOCK(&M);
-
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
-
-    // get context
-    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
-    context.open();
+  // insert unless there and same, the caller holds the write context
+  static void insert_in_context(hashdb::lmdb_context_t& context,
+                                const uint64_t source_id,
+                                const std::string& file_binary_hash,
+                                const uint64_t filesize,
+                                const std::string& file_type,
+                                const uint64_t zero_count,
+                                const uint64_t nonprobative_count,
+                                hashdb::lmdb_changes_t& changes) {
 
     // set key
     uint8_t key_start[10];
@@ -155,9 +144,6 @@ print_mdb_val("source_data_manager insert new data", context.data);
 
       // new source data inserted
       ++changes.source_data_inserted;
-      context.close();
-      MUTEX_UNLOCK(&M);
-      return;
 
     } else if (rc == 0) {
 #ifdef DEBUG_LMDB_SOURCE_DATA_MANAGER_HPP
@@ -171,7 +157,10 @@ print_mdb_val("source_data_manager insert change from data", context.data);
         ++changes.source_data_same;
       } else {
 
-        // different so overwrite
+        // different so overwrite, with the key in our buffer since the
+        // cursor key may point into a page dirtied earlier in the batch
+        context.key.mv_size = key_p - key_start;
+        context.key.mv_data = key_start;
         context.data.mv_size = new_data_size;
         context.data.mv_data = data;
 #ifdef DEBUG_LMDB_SOURCE_DATA_MANAGER_HPP
@@ -189,11 +178,6 @@ print_mdb_val("source_data_manager insert change to data", context.data);
         ++changes.source_data_changed;
       }
 
-      // close for already there
-      context.close();
-      MUTEX_UNLOCK(&M);
-      return;
-
     } else {
       // invalid rc
       std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
@@ -201,6 +185,132 @@ print_mdb_val("source_data_manager insert change to data", context.data);
     }
   }
 
+  // read the source data in data
+  static void decode_data(const MDB_val& data,
+                          std::string& file_binary_hash,
+                          uint64_t& filesize,
+                          std::string& file_type,
+                          uint64_t& zero_count,
+                          uint64_t& nonprobative_count) {
+    const uint8_t* p = static_cast<uint8_t*>(data.mv_data);
+    const uint8_t* const p_stop = p + data.mv_size;
+
+    // read file_binary_hash
+    uint64_t file_binary_hash_size;
+    p = lmdb_helper::decode_uint64_t(p, file_binary_hash_size);
+    file_binary_hash = std::string(reinterpret_cast<const char*>(p),
+                          file_binary_hash_size);
+    p += file_binary_hash_size;
+
+    // read filesize
+    p = lmdb_helper::decode_uint64_t(p, filesize);
+
+    // read file_type
+    uint64_t file_type_size;
+    p = lmdb_helper::decode_uint64_t(p, file_type_size);
+    file_type = std::string(reinterpret_cast<const char*>(p),
+                          file_type_size);
+    p += file_type_size;
+
+    // read zero_count
+    p = lmdb_helper::decode_uint64_t(p, zero_count);
+
+    // read nonprobative_count
+    p = lmdb_helper::decode_uint64_t(p, nonprobative_count);
+
+    // validate that the decoding was properly consumed
+    if (p != p_stop) {
+      std::cerr << "data decode error in LMDB source data store\n";
+      assert(0);
+    }
+  }
+
+  public:
+  lmdb_source_data_manager_t(const std::string& p_hashdb_dir,
+                            const hashdb::file_mode_type_t p_file_mode,
+                            const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       hashdb_dir(p_hashdb_dir),
+       file_mode(p_file_mode),
+       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_data_store",
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, false,
+                             policy.max_snapshot_ms) : NULL),
+       M() {
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_source_data_manager_t() {
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    lmdb_helper::close_env(env);
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
+  /**
+   * Insert unless there and same.
+   */
+  void insert(const uint64_t source_id,
+              const std::string& file_binary_hash,
+              const uint64_t filesize,
+              const std::string& file_type,
+              const uint64_t zero_count,
+              const uint64_t nonprobative_count,
+              hashdb::lmdb_changes_t& changes) {
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    context.open();
+    insert_in_context(context, source_id, file_binary_hash, filesize,
+                      file_type, zero_count, nonprobative_count, changes);
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Insert each entry unless there and same, using one write
+   * transaction.  Entries sorted by source ID are written in key order.
+   */
+  void insert_batch(const source_data_entries_t& entries,
+                    hashdb::lmdb_changes_t& changes) {
+    if (entries.size() == 0) {
+      return;
+    }
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB with room for every entry since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + entries.size() * batch_pages_per_entry);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    context.open();
+    for (source_data_entries_t::const_iterator it = entries.begin();
+         it != entries.end(); ++it) {
+      insert_in_context(context, it->source_id, it->file_binary_hash,
+                        it->filesize, it->file_type, it->zero_count,
+                        it->nonprobative_count, changes);
+    }
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
   /**
    * Find data, false on no source ID.
    */
@@ -212,7 +322,8 @@ print_mdb_val("source_data_manager insert change to data", context.data);
             uint64_t& nonprobative_count) const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false); // not writable, no duplicates
+    // not writable, no duplicates
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
     context.open();
 
     // set key
@@ -233,38 +344,8 @@ print_mdb_val("source_data_manager find key", context.key);
 print_mdb_val("source_data_manager find data", context.data);
 #endif
       // read data
-      const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
-      const uint8_t* const p_stop = p + context.data.mv_size;
-
-      // read file_binary_hash
-      uint64_t file_binary_hash_size;
-      p = lmdb_helper::decode_uint64_t(p, file_binary_hash_size);
-      file_binary_hash = std::string(reinterpret_cast<const char*>(p),
-                            file_binary_hash_size);
-      p += file_binary_hash_size;
-
-      // read filesize
-      p = lmdb_helper::decode_uint64_t(p, filesize);
-
-      // read file_type
-      uint64_t file_type_size;
-      p = lmdb_helper::decode_uint64_t(p, file_type_size);
-      file_type = std::string(reinterpret_cast<const char*>(p),
-                            file_type_size);
-      p += file_type_size;
-
-      // read zero_count
-      p = lmdb_helper::decode_uint64_t(p, zero_count);
-
-      // read nonprobative_count
-      p = lmdb_helper::decode_uint64_t(p, nonprobative_count);
-
-      // validate that the decoding was properly consumed
-      if (p != p_stop) {
-        std::cerr << "data decode error in LMDB source data store\n";
-        assert(0);
-      }
-
+      decode_data(context.data, file_binary_hash, filesize, file_type,
+                  zero_count, nonprobative_count);
       context.close();
       return true;
 
@@ -288,6 +369,113 @@ print_mdb_val("source_data_manager no find key", context.key);
     }
   }
 
+  /**
+   * Find the data of the source ID of each entry, leaving the other
+   * fields of entries without data empty.  The entries are read in key
+   * order whatever their order, sweeping one cursor forward in one read
+   * transaction.  Return the number of entries found.
+   */
+  size_t find_batch(source_data_entries_t& entries) const {
+
+    // the keys of the entries, in key order
+    std::vector<uint64_t> source_ids(entries.size());
+    for (size_t i=0; i<entries.size(); ++i) {
+      source_ids[i] = entries[i].source_id;
+    }
+    std::vector<lmdb_helper::source_id_key_t> keys;
+    lmdb_helper::source_id_keys(source_ids, keys);
+    if (keys.size() == 0) {
+      return 0;
+    }
+
+    // get context
+    // not writable, no duplicates
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
+    context.open();
+
+    size_t num_found = 0;
+    int rc = MDB_NOTFOUND;
+    for (size_t j=0; j<keys.size(); ++j) {
+      source_data_entry_t& entry = entries[keys[j].index];
+      MDB_val target;
+      target.mv_size = keys[j].key.size();
+      target.mv_data = static_cast<void*>(
+                                const_cast<char*>(keys[j].key.c_str()));
+
+      // step the cursor once, then seek only if it is still behind
+      if (rc == 0 && mdb_cmp(context.txn, context.dbi, &context.key,
+                             &target) < 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT);
+      }
+      if (j == 0 || rc != 0 ||
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) < 0) {
+        context.key = target;
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+      }
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+
+      if (rc == 0 &&
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) == 0) {
+        decode_data(context.data, entry.file_binary_hash, entry.filesize,
+                    entry.file_type, entry.zero_count,
+                    entry.nonprobative_count);
+        ++num_found;
+      } else {
+        entry.file_binary_hash = "";
+        entry.filesize = 0;
+        entry.file_type = "";
+        entry.zero_count = 0;
+        entry.nonprobative_count = 0;
+      }
+    }
+
+    context.close();
+    return num_found;
+  }
+
+  /**
+   * Remove the data of the source ID, false if it has none.
+   */
+  bool remove(const uint64_t source_id) {
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false);
+    context.open();
+
+    // set key
+    uint8_t key_start[10];
+    uint8_t* key_p = key_start;
+    key_p = lmdb_helper::encode_uint64_t(source_id, key_p);
+    context.key.mv_size = key_p - key_start;
+    context.key.mv_data = key_start;
+
+    int rc = mdb_del(context.txn, context.dbi, &context.key, NULL);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+    return rc == 0;
+  }
+
+  // sync to disk if the sync policy is flush or force is set
+  void flush(const bool force = false) const {
+    lmdb_helper::flush_env(env, force);
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
     return lmdb_helper::size(env);
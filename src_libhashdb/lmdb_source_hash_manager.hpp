@@ -0,0 +1,253 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Manage the optional LMDB source hash store, a reverse index from each
+ * source ID to the block hashes that reference it.  Block hashes are the
+ * sorted duplicate values of the source ID key, so the hashes of one
+ * source are read in hash order from one cursor position.  Inserts are
+ * kept in memory and written in sorted batches.  Threadsafe.
+ */
+
+#ifndef LMDB_SOURCE_HASH_MANAGER_HPP
+#define LMDB_SOURCE_HASH_MANAGER_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_context.hpp"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+class lmdb_source_hash_manager_t {
+
+  private:
+  typedef std::pair<uint64_t, std::string> source_hash_t;
+
+  // the number of inserts kept before writing them
+  static const size_t max_pending = 16384;
+
+  // conservative number of new LMDB pages one pending insert may consume
+  static const size_t pages_per_insert = 2;
+
+  MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+  std::vector<source_hash_t> pending;            // inserts not yet written
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_source_hash_manager_t(const lmdb_source_hash_manager_t&);
+  lmdb_source_hash_manager_t& operator=(const lmdb_source_hash_manager_t&);
+
+  // write the pending inserts in key order, call while locked
+  void write_pending() {
+    if (pending.size() == 0) {
+      return;
+    }
+    std::sort(pending.begin(), pending.end());
+    pending.erase(std::unique(pending.begin(), pending.end()), pending.end());
+
+    // maybe grow the DB with room for every insert since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + pending.size() * pages_per_insert);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+
+    uint8_t key[10];
+    for (std::vector<source_hash_t>::const_iterator it = pending.begin();
+         it != pending.end(); ++it) {
+
+      // key=source_id, data=block_hash
+      uint8_t* const key_p = lmdb_helper::encode_uint64_t(it->first, key);
+      context.key.mv_size = key_p - key;
+      context.key.mv_data = key;
+      context.data.mv_size = it->second.size();
+      context.data.mv_data = const_cast<char*>(it->second.data());
+      int rc = mdb_put(context.txn, context.dbi,
+                       &context.key, &context.data, MDB_NODUPDATA);
+      if (rc != 0 && rc != MDB_KEYEXIST) {
+        // invalid rc
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+    context.close();
+    pending.clear();
+  }
+
+  public:
+  lmdb_source_hash_manager_t(const std::string& hashdb_dir,
+                      const hashdb::file_mode_type_t file_mode,
+                      const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_hash_store",
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, true,
+                             policy.max_snapshot_ms) : NULL),
+       pending(),
+       M() {
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_source_hash_manager_t() {
+    flush();
+
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    lmdb_helper::close_env(env);
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
+  /**
+   * Index the block hash under the source ID.  Indexing a pair that is
+   * already there does nothing.
+   */
+  void insert(const uint64_t source_id, const std::string& block_hash) {
+    MUTEX_LOCK(&M);
+    pending.push_back(source_hash_t(source_id, block_hash));
+    if (pending.size() >= max_pending) {
+      write_pending();
+    }
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Remove the block hash from the source ID, or all of the source ID's
+   * block hashes when block_hash is "".  Pending inserts are written
+   * first.
+   */
+  void remove(const uint64_t source_id, const std::string& block_hash) {
+    MUTEX_LOCK(&M);
+    write_pending();
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+
+    uint8_t key[10];
+    uint8_t* const key_p = lmdb_helper::encode_uint64_t(source_id, key);
+    context.key.mv_size = key_p - key;
+    context.key.mv_data = key;
+    context.data.mv_size = block_hash.size();
+    context.data.mv_data = const_cast<char*>(block_hash.data());
+    int rc = mdb_del(context.txn, context.dbi, &context.key,
+                     (block_hash.size() == 0) ? NULL : &context.data);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Read the block hashes of the source ID in hash order, false if it
+   * has none.
+   */
+  bool find(const uint64_t source_id,
+            std::vector<std::string>& block_hashes) const {
+
+    block_hashes.clear();
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+
+    // set key
+    uint8_t key[10];
+    uint8_t* const key_p = lmdb_helper::encode_uint64_t(source_id, key);
+    context.key.mv_size = key_p - key;
+    context.key.mv_data = key;
+    context.data.mv_size = 0;
+    context.data.mv_data = NULL;
+
+    // read the duplicates of the key
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_KEY);
+    while (rc == 0) {
+      block_hashes.push_back(std::string(
+                         static_cast<char*>(context.data.mv_data),
+                         context.data.mv_size));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_DUP);
+    }
+
+    if (rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return block_hashes.size() != 0;
+  }
+
+  // write the pending inserts then sync to disk if the sync policy is
+  // flush or force is set
+  void flush(const bool force = false) {
+    MUTEX_LOCK(&M);
+    write_pending();
+    MUTEX_UNLOCK(&M);
+    lmdb_helper::flush_env(env, force);
+  }
+
+  // call this from a lock to prevent getting an unstable answer.
+  size_t size() const {
+    return lmdb_helper::size(env);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -21,6 +21,10 @@
  * \file
  * Manage the LMDB source ID store of key=file_binary_hash, value=source_id.
  * Threadsafe.
+ *
+ * New source IDs are the store size + 1, so a removed source keeps its
+ * record as a tombstone, its source ID followed by a 0 byte.  Finds and
+ * walks skip tombstones and inserting the source again revives its ID.
  */
 
 #ifndef LMDB_SOURCE_ID_MANAGER_HPP
@@ -33,7 +37,10 @@
 #include "lmdb_helper.h"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
+#include "hashdb.hpp"
+#include "hash_batch.hpp"
 #include <vector>
+#include <algorithm>
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
@@ -57,6 +64,7 @@ class lmdb_source_id_manager_t {
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
   MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -67,24 +75,80 @@ class lmdb_source_id_manager_t {
   lmdb_source_id_manager_t(const lmdb_source_id_manager_t&);
   lmdb_source_id_manager_t& operator=(const lmdb_source_id_manager_t&);
 
+  // read the source ID in data, return true if it is a tombstone
+  static bool decode_source_id(const MDB_val& data, uint64_t& source_id) {
+    const uint8_t* const p = lmdb_helper::decode_uint64_t(
+                         static_cast<uint8_t*>(data.mv_data), source_id);
+    const uint8_t* const p_stop =
+                         static_cast<uint8_t*>(data.mv_data) + data.mv_size;
+
+    // read must align to data record
+    if (p == p_stop) {
+      return false;
+    }
+    if (p + 1 == p_stop && *p == 0) {
+      return true;
+    }
+    std::cerr << "data decode error in LMDB source ID store\n";
+    assert(0);
+    return false; // for mingw
+  }
+
+  // order indexes of file hashes by file hash
+  class file_hash_index_less_t {
+    private:
+    const std::vector<std::string>* file_binary_hashes;
+    public:
+    file_hash_index_less_t(const std::vector<std::string>& p_hashes) :
+                                       file_binary_hashes(&p_hashes) {
+    }
+    bool operator()(const size_t a, const size_t b) const {
+      return (*file_binary_hashes)[a] < (*file_binary_hashes)[b];
+    }
+  };
+
+  // move the cursor forward past tombstones, return the rc at the end
+  static int skip_tombstones(hashdb::lmdb_context_t& context, int rc) {
+    uint64_t source_id;
+    while (rc == 0 && decode_source_id(context.data, source_id)) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT_NODUP);
+    }
+    return rc;
+  }
+
   public:
   lmdb_source_id_manager_t(const std::string& p_hashdb_dir,
-                           const hashdb::file_mode_type_t p_file_mode) :
+                           const hashdb::file_mode_type_t p_file_mode,
+                           const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
        hashdb_dir(p_hashdb_dir),
        file_mode(p_file_mode),
        env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_id_store",
-                                                            file_mode)),
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, false,
+                             policy.max_snapshot_ms) : NULL),
        M() {
     MUTEX_INIT(&M);
   }
 
   ~lmdb_source_id_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    lmdb_helper::close_env(env);
 
     MUTEX_DESTROY(&M);
   }
 
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
   /**
    * Insert key=file_binary_hash, value=source_id.  Return bool, source_id.
    * True if new.
@@ -122,14 +186,25 @@ print_mdb_val("source_id_manager insert has key", context.key);
 print_mdb_val("source_id_manager insert has data", context.data);
 #endif
       // source ID found
-      const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
-      p = lmdb_helper::decode_uint64_t(p, source_id);
-
-      // read must align to data record
-      if (p != static_cast<uint8_t*>(context.data.mv_data) +
-                                                context.data.mv_size) {
-        std::cerr << "data decode error in LMDB source ID store\n";
-        assert(0);
+      if (decode_source_id(context.data, source_id)) {
+
+        // revive the removed source with its source ID
+        uint8_t data[10];
+        uint8_t* const p = lmdb_helper::encode_uint64_t(source_id, data);
+        context.data.mv_size = p - data;
+        context.data.mv_data = data;
+        context.key.mv_size = file_binary_hash.size();
+        context.key.mv_data = static_cast<void*>(
+                             const_cast<char*>(file_binary_hash.c_str()));
+        rc = mdb_put(context.txn, context.dbi, &context.key, &context.data, 0);
+        if (rc != 0) {
+          std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+          assert(0);
+        }
+        ++changes.source_id_inserted;
+        context.close();
+        MUTEX_UNLOCK(&M);
+        return true;
       }
 
       ++changes.source_id_already_present;
@@ -174,6 +249,142 @@ print_mdb_val("source_id_manager insert new data", context.data);
     }
   }
 
+  /**
+   * Insert key=file_binary_hash, value=source_id for each of
+   * file_binary_hashes, returning the source_id of each.  Existing IDs
+   * are resolved by sweeping one cursor forward through the sorted keys,
+   * new IDs are allocated contiguously in the order the file hashes are
+   * given, as insert would, and everything is written in one write
+   * transaction.  Return the number of new or revived IDs.
+   */
+  size_t insert_batch(const std::vector<std::string>& file_binary_hashes,
+                      hashdb::lmdb_changes_t& changes,
+                      std::vector<uint64_t>& source_ids) {
+
+    source_ids.assign(file_binary_hashes.size(), 0);
+
+    // the indexes of the valid file hashes in key order
+    std::vector<size_t> order;
+    order.reserve(file_binary_hashes.size());
+    for (size_t i=0; i<file_binary_hashes.size(); ++i) {
+      if (file_binary_hashes[i].size() == 0) {
+        std::cerr << "Usage error: the file_binary_hash value provided to insert_batch is empty.\n";
+        continue;
+      }
+      order.push_back(i);
+    }
+    if (order.size() == 0) {
+      return 0;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     file_hash_index_less_t(file_binary_hashes));
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB with room for every entry since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + order.size() * batch_pages_per_entry);
+
+    // new source IDs follow the IDs of the store before this transaction
+    uint64_t next_source_id = size() + 1;
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    context.open();
+
+    // resolve the distinct keys in one sweep, recording at the first
+    // index of each key whether it must be written
+    std::vector<bool> is_written(file_binary_hashes.size(), false);
+    int rc = MDB_NOTFOUND;
+    for (size_t j=0; j<order.size(); ++j) {
+      const size_t i = order[j];
+      if (j > 0 && file_binary_hashes[order[j-1]] == file_binary_hashes[i]) {
+        continue;
+      }
+      MDB_val target;
+      target.mv_size = file_binary_hashes[i].size();
+      target.mv_data = static_cast<void*>(
+                          const_cast<char*>(file_binary_hashes[i].c_str()));
+
+      // step the cursor once, then seek only if it is still behind
+      if (rc == 0 && mdb_cmp(context.txn, context.dbi, &context.key,
+                             &target) < 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT);
+      }
+      if (j == 0 || rc != 0 ||
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) < 0) {
+        context.key = target;
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+      }
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+
+      if (rc == 0 &&
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) == 0) {
+        // present, or removed and revived with its source ID
+        is_written[i] = decode_source_id(context.data, source_ids[i]);
+      } else {
+        // absent
+        is_written[i] = true;
+      }
+    }
+
+    // allocate new IDs in the given order
+    std::vector<size_t> first(file_binary_hashes.size());
+    for (size_t j=0; j<order.size(); ++j) {
+      first[order[j]] = (j > 0 && file_binary_hashes[order[j-1]] ==
+                         file_binary_hashes[order[j]]) ?
+                        first[order[j-1]] : order[j];
+    }
+    size_t num_inserted = 0;
+    for (size_t i=0; i<file_binary_hashes.size(); ++i) {
+      if (file_binary_hashes[i].size() == 0) {
+        continue;
+      }
+      if (first[i] != i || !is_written[i]) {
+        ++changes.source_id_already_present;
+        continue;
+      }
+      if (source_ids[i] == 0) {
+        source_ids[i] = next_source_id++;
+      }
+      ++changes.source_id_inserted;
+      ++num_inserted;
+    }
+
+    // write the new and revived IDs in key order
+    for (size_t j=0; j<order.size(); ++j) {
+      const size_t i = order[j];
+      if (first[i] != i) {
+        source_ids[i] = source_ids[first[i]];
+        continue;
+      }
+      if (!is_written[i]) {
+        continue;
+      }
+      uint8_t data[10];
+      uint8_t* const p = lmdb_helper::encode_uint64_t(source_ids[i], data);
+      context.data.mv_size = p - data;
+      context.data.mv_data = data;
+      context.key.mv_size = file_binary_hashes[i].size();
+      context.key.mv_data = static_cast<void*>(
+                          const_cast<char*>(file_binary_hashes[i].c_str()));
+      rc = mdb_cursor_put(context.cursor, &context.key, &context.data, 0);
+      if (rc != 0) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+    return num_inserted;
+  }
+
   /**
    * Find source ID else false and 0.
    */
@@ -186,7 +397,7 @@ print_mdb_val("source_id_manager insert new data", context.data);
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
     context.open();
 
     // set key
@@ -204,17 +415,12 @@ print_mdb_val("source_id_manager insert new data", context.data);
 print_mdb_val("source_id_manager find key", context.key);
 print_mdb_val("source_id_manager find data", context.data);
 #endif
-      const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
-      p = lmdb_helper::decode_uint64_t(p, source_id);
-
-      // read must align to data record
-      if (p != static_cast<uint8_t*>(context.data.mv_data) +
-                                                context.data.mv_size) {
-        std::cerr << "data decode error in LMDB source ID store\n";
-        assert(0);
-      }
-
+      const bool is_removed = decode_source_id(context.data, source_id);
       context.close();
+      if (is_removed) {
+        source_id = 0;
+        return false;
+      }
       return true;
 
     } else if (rc == MDB_NOTFOUND) {
@@ -240,11 +446,11 @@ print_mdb_val("source_id_manager find not found key", context.key);
   std::string first_source() const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
     context.open();
 
-    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                            MDB_FIRST);
+    int rc = skip_tombstones(context, mdb_cursor_get(context.cursor,
+                             &context.key, &context.data, MDB_FIRST));
 
     if (rc == 0) {
 #ifdef DEBUG_LMDB_SOURCE_ID_MANAGER_HPP
@@ -282,7 +488,7 @@ print_mdb_val("source_id_manager find_begin data", context.data);
     }
 
     // get context
-    hashdb::lmdb_context_t context(env, false, false);
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
     context.open();
 
     // set the cursor to last file binary hash
@@ -305,9 +511,9 @@ print_mdb_val("source_id_manager find_begin data", context.data);
       assert(0);
     }
 
-    // move cursor to this file binary hash
-    rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
-                        MDB_NEXT_NODUP);
+    // move cursor to the next source
+    rc = skip_tombstones(context, mdb_cursor_get(context.cursor,
+                         &context.key, &context.data, MDB_NEXT_NODUP));
 
     if (rc == MDB_NOTFOUND) {
       // no values for this file binary hash
@@ -334,6 +540,162 @@ print_mdb_val("source_id_manager find_next data", context.data);
     }
   }
 
+  /**
+   * Call callback for every source in key order, walking one cursor in
+   * one read transaction.
+   */
+  void walk_sources(hashdb::source_callback_t callback,
+                    void* const data) const {
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
+    context.open();
+
+    int rc = skip_tombstones(context, mdb_cursor_get(context.cursor,
+                             &context.key, &context.data, MDB_FIRST));
+    std::string file_binary_hash;
+    while (rc == 0) {
+      file_binary_hash.assign(static_cast<char*>(context.key.mv_data),
+                              context.key.mv_size);
+      callback(data, file_binary_hash);
+      rc = skip_tombstones(context, mdb_cursor_get(context.cursor,
+                           &context.key, &context.data, MDB_NEXT_NODUP));
+    }
+
+    if (rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+  }
+
+  /**
+   * Read up to max_count sources after file_binary_hash, or from the
+   * first if it is "", in key order with their source IDs, walking one
+   * cursor in one read transaction.  Return false when there are none.
+   */
+  bool read_batch(const std::string& file_binary_hash,
+                  const size_t max_count,
+                  std::vector<std::string>& file_binary_hashes,
+                  std::vector<uint64_t>& source_ids) const {
+
+    // file_binary_hash may be in file_binary_hashes
+    const std::string after_hash(file_binary_hash);
+    file_binary_hashes.clear();
+    source_ids.clear();
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, false, read_txn_cache);
+    context.open();
+
+    // start after file_binary_hash
+    int rc;
+    if (after_hash.size() == 0) {
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_FIRST);
+    } else {
+      context.key.mv_size = after_hash.size();
+      context.key.mv_data =
+            static_cast<void*>(const_cast<char*>(after_hash.c_str()));
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_SET_RANGE);
+      if (rc == 0 && context.key.mv_size == after_hash.size() &&
+          std::memcmp(context.key.mv_data, after_hash.c_str(),
+                      after_hash.size()) == 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_NODUP);
+      }
+    }
+    rc = skip_tombstones(context, rc);
+
+    while (rc == 0 && file_binary_hashes.size() < max_count) {
+      uint64_t source_id;
+      decode_source_id(context.data, source_id);
+      file_binary_hashes.push_back(std::string(
+              static_cast<char*>(context.key.mv_data), context.key.mv_size));
+      source_ids.push_back(source_id);
+      rc = skip_tombstones(context, mdb_cursor_get(context.cursor,
+                           &context.key, &context.data, MDB_NEXT_NODUP));
+    }
+
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+    return file_binary_hashes.size() != 0;
+  }
+
+  /**
+   * Mark the source removed.  Return false and 0 if it is not present.
+   */
+  bool remove(const std::string& file_binary_hash,
+              hashdb::lmdb_changes_t& changes, uint64_t& source_id) {
+
+    // require valid file_binary_hash
+    if (file_binary_hash.size() == 0) {
+      std::cerr << "Usage error: the file_binary_hash value provided to remove is empty.\n";
+      source_id = 0;
+      return false;
+    }
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, false); // writable, no duplicates
+    context.open();
+
+    // set key
+    context.key.mv_size = file_binary_hash.size();
+    context.key.mv_data =
+            static_cast<void*>(const_cast<char*>(file_binary_hash.c_str()));
+
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_KEY);
+    if (rc == MDB_NOTFOUND ||
+        (rc == 0 && decode_source_id(context.data, source_id))) {
+      // not present or already removed
+      context.close();
+      MUTEX_UNLOCK(&M);
+      source_id = 0;
+      return false;
+    }
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    // write the tombstone
+    uint8_t data[11];
+    uint8_t* p = lmdb_helper::encode_uint64_t(source_id, data);
+    *p++ = 0;
+    context.data.mv_size = p - data;
+    context.data.mv_data = data;
+    context.key.mv_size = file_binary_hash.size();
+    context.key.mv_data =
+            static_cast<void*>(const_cast<char*>(file_binary_hash.c_str()));
+    rc = mdb_put(context.txn, context.dbi, &context.key, &context.data, 0);
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    ++changes.source_id_removed;
+    context.close();
+    MUTEX_UNLOCK(&M);
+    return true;
+  }
+
+  // sync to disk if the sync policy is flush or force is set
+  void flush(const bool force = false) const {
+    lmdb_helper::flush_env(env, force);
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
     return lmdb_helper::size(env);
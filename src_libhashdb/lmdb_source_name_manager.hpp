@@ -19,7 +19,9 @@
 
 /**
  * \file
- * Manage the LMDB source name store.  Threadsafe.
+ * Manage the LMDB source name store.  Threadsafe.  In the compressed
+ * source name format, name pairs are coded with the dictionary of the
+ * hashdb, see source_name_codec.hpp, and decoded only when read.
  */
 
 #ifndef LMDB_SOURCE_NAME_MANAGER_HPP
@@ -32,11 +34,14 @@
 #include "lmdb_helper.h"
 #include "lmdb_context.hpp"
 #include "lmdb_changes.hpp"
+#include "hash_batch.hpp"
+#include "source_name_codec.hpp"
 #include <vector>
 #include <unistd.h>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <cstdlib>
 #include <cassert>
 #ifdef DEBUG_LMDB_SOURCE_NAME_MANAGER_HPP
 #include "lmdb_print_val.hpp"
@@ -50,6 +55,24 @@
 
 namespace hashdb {
 
+// called for each source ID, repository name, and filename when walking
+// the source name store
+typedef void (*source_name_callback_t)(void* const data,
+                                       const uint64_t source_id,
+                                       const std::string& repository_name,
+                                       const std::string& filename);
+
+// a source name of one source, for writing in a batch
+struct source_name_entry_t {
+  uint64_t source_id;
+  std::string repository_name;
+  std::string filename;
+  source_name_entry_t() : source_id(0), repository_name(), filename() {
+  }
+};
+
+typedef std::vector<source_name_entry_t> source_name_entries_t;
+
 class lmdb_source_name_manager_t {
 
   private:
@@ -59,6 +82,8 @@ class lmdb_source_name_manager_t {
   const std::string hashdb_dir;
   const hashdb::file_mode_type_t file_mode;
   MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+  hashdb::source_name_codec_t* codec;         // or NULL for plain names
 #ifdef HAVE_PTHREAD
   mutable pthread_mutex_t M;                  // mutext
 #else
@@ -69,41 +94,14 @@ class lmdb_source_name_manager_t {
   lmdb_source_name_manager_t(const lmdb_source_name_manager_t&);
   lmdb_source_name_manager_t& operator=(const lmdb_source_name_manager_t&);
 
-  public:
-  lmdb_source_name_manager_t(const std::string& p_hashdb_dir,
-                      const hashdb::file_mode_type_t p_file_mode) :
-       hashdb_dir(p_hashdb_dir),
-       file_mode(p_file_mode),
-       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_name_store",
-                                                                file_mode)),
-       M() {
-
-    MUTEX_INIT(&M);
-  }
-
-  ~lmdb_source_name_manager_t() {
-    // close the lmdb_hash_store DB environment
-    mdb_env_close(env);
-
-    MUTEX_DESTROY(&M);
-  }
-
-  /**
-   * Insert repository_name, filename pair unless pair is already there.
-   */
-  void insert(const uint64_t source_id,
-              const std::string& repository_name,
-              const std::string& filename,
-              hashdb::lmdb_changes_t& changes) {
-
-    MUTEX_LOCK(&M);
-
-    // maybe grow the DB
-    lmdb_helper::maybe_grow(env);
-
-    // get context
-    hashdb::lmdb_context_t context(env, true, true);
-    context.open();
+  // insert the pair unless it is already there, the caller holds the
+  // write context
+  static void insert_in_context(hashdb::lmdb_context_t& context,
+                                hashdb::source_name_codec_t* const codec,
+                                const uint64_t source_id,
+                                const std::string& repository_name,
+                                const std::string& filename,
+                                hashdb::lmdb_changes_t& changes) {
 
     // set key=source_id
     uint8_t key[10];
@@ -126,6 +124,15 @@ class lmdb_source_name_manager_t {
     context.data.mv_size = p - data;
     context.data.mv_data = data;
 
+    // or the coded pair
+    std::string encoding;
+    if (codec != NULL) {
+      codec->encode(repository_name, filename, encoding);
+      context.data.mv_size = encoding.size();
+      context.data.mv_data =
+                  static_cast<void*>(const_cast<char*>(encoding.c_str()));
+    }
+
     // write the new source name
 #ifdef DEBUG_LMDB_SOURCE_NAME_MANAGER_HPP
 print_mdb_val("source_name_manager insert new key", context.key);
@@ -137,16 +144,10 @@ print_mdb_val("source_name_manager insert new data", context.data);
     if (rc == 0) {
       // the new name pair went in
       ++changes.source_name_inserted;
-      context.close();
-      MUTEX_UNLOCK(&M);
-      return;
 
     } else if (rc == MDB_KEYEXIST) {
       // the name pair was already there
       ++changes.source_name_already_present;
-      context.close();
-      MUTEX_UNLOCK(&M);
-      return;
 
     } else {
       // invalid rc
@@ -155,6 +156,135 @@ print_mdb_val("source_name_manager insert new data", context.data);
     }
   }
 
+  // read the repository_name, filename pair in data
+  void decode_name(const MDB_val& data, std::string& repository_name,
+                   std::string& filename) const {
+    const uint8_t* p = static_cast<uint8_t*>(data.mv_data);
+    const uint8_t* const p_stop = p + data.mv_size;
+    if (codec != NULL) {
+      if (!codec->decode(p, data.mv_size, repository_name, filename)) {
+        std::cerr << "data decode error in LMDB source name store\n";
+        assert(0);
+      }
+      return;
+    }
+    uint64_t repository_name_size;
+    const uint8_t* const rn_p = lmdb_helper::decode_uint64_t(
+                                         p, repository_name_size);
+    p = rn_p + repository_name_size;
+    uint64_t filename_size;
+    const uint8_t* const fn_p = lmdb_helper::decode_uint64_t(
+                                       p, filename_size);
+    p = fn_p + filename_size;
+    repository_name.assign(reinterpret_cast<const char*>(rn_p),
+                           repository_name_size);
+    filename.assign(reinterpret_cast<const char*>(fn_p), filename_size);
+
+    // validate that the decoding was properly consumed
+    if (p != p_stop) {
+      std::cerr << "data decode error in LMDB source name store\n";
+      assert(0);
+    }
+  }
+
+  public:
+  lmdb_source_name_manager_t(const std::string& p_hashdb_dir,
+                      const hashdb::file_mode_type_t p_file_mode,
+                      const uint32_t source_name_format =
+                                hashdb::plain_source_name_format,
+                      const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       hashdb_dir(p_hashdb_dir),
+       file_mode(p_file_mode),
+       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_name_store",
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, true,
+                             policy.max_snapshot_ms) : NULL),
+       codec((source_name_format == hashdb::plain_source_name_format) ?
+             NULL : hashdb::source_name_codec_t::read(hashdb_dir + "/" +
+                             hashdb::source_name_dictionary_filename)),
+       M() {
+
+    // compressed names need the dictionary
+    if (source_name_format != hashdb::plain_source_name_format &&
+        codec == NULL) {
+      std::cerr << "Error: Unable to read the source name dictionary of "
+                << "the hashdb at path '" << hashdb_dir << "'.\n";
+      exit(1);
+    }
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_source_name_manager_t() {
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    delete codec;
+    lmdb_helper::close_env(env);
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
+  /**
+   * Insert repository_name, filename pair unless pair is already there.
+   */
+  void insert(const uint64_t source_id,
+              const std::string& repository_name,
+              const std::string& filename,
+              hashdb::lmdb_changes_t& changes) {
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+    insert_in_context(context, codec, source_id, repository_name,
+                      filename, changes);
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Insert each repository_name, filename pair unless it is already
+   * there, using one write transaction.  Entries sorted by source ID are
+   * written in key order.
+   */
+  void insert_batch(const source_name_entries_t& entries,
+                    hashdb::lmdb_changes_t& changes) {
+    if (entries.size() == 0) {
+      return;
+    }
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB with room for every entry since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + entries.size() * batch_pages_per_entry);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+    for (source_name_entries_t::const_iterator it = entries.begin();
+         it != entries.end(); ++it) {
+      insert_in_context(context, codec, it->source_id,
+                        it->repository_name, it->filename, changes);
+    }
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
   /**
    * Find source names, false on no source ID.
    */
@@ -162,7 +292,7 @@ print_mdb_val("source_name_manager insert new data", context.data);
             source_names_t& names) const {
 
     // get context
-    hashdb::lmdb_context_t context(env, false, true);
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
     context.open();
 
     // set key
@@ -196,27 +326,10 @@ print_mdb_val("source_name_manager find key", context.key);
 print_mdb_val("source_name_manager find data", context.data);
 #endif
       // read repository_name, filename pair into names
-      const uint8_t* p = static_cast<uint8_t*>(context.data.mv_data);
-      const uint8_t* const p_stop = p + context.data.mv_size;
-      uint64_t repository_name_size;
-      const uint8_t* const rn_p = lmdb_helper::decode_uint64_t(
-                                           p, repository_name_size);
-      p = rn_p + repository_name_size;
-      uint64_t filename_size;
-      const uint8_t* const fn_p = lmdb_helper::decode_uint64_t(
-                                         p, filename_size);
-      p = fn_p + filename_size;
-      names.insert(source_name_t(
-              std::string(reinterpret_cast<const char*>(rn_p),
-                          repository_name_size),
-              std::string(reinterpret_cast<const char*>(fn_p),
-                          filename_size)));
-
-      // validate that the decoding was properly consumed
-      if (p != p_stop) {
-        std::cerr << "data decode error in LMDB source name store\n";
-        assert(0);
-      }
+      std::string repository_name;
+      std::string filename;
+      decode_name(context.data, repository_name, filename);
+      names.insert(source_name_t(repository_name, filename));
 
       // next
       rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
@@ -237,6 +350,155 @@ print_mdb_val("source_name_manager find data", context.data);
     }
   }
 
+  /**
+   * Find the source names of each of source_ids into names, empty for
+   * source IDs without names.  The source IDs are read in key order
+   * whatever their order, sweeping one cursor forward in one read
+   * transaction.
+   */
+  void find_batch(const std::vector<uint64_t>& source_ids,
+                  std::vector<source_names_t>& names) const {
+
+    names.assign(source_ids.size(), source_names_t());
+
+    // the keys of the source IDs, in key order
+    std::vector<lmdb_helper::source_id_key_t> keys;
+    lmdb_helper::source_id_keys(source_ids, keys);
+    if (keys.size() == 0) {
+      return;
+    }
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+
+    int rc = MDB_NOTFOUND;
+    for (size_t j=0; j<keys.size(); ++j) {
+      if (j > 0 && keys[j-1].key == keys[j].key) {
+        names[keys[j].index] = names[keys[j-1].index];
+        continue;
+      }
+      MDB_val target;
+      target.mv_size = keys[j].key.size();
+      target.mv_data = static_cast<void*>(
+                                const_cast<char*>(keys[j].key.c_str()));
+
+      // step the cursor once, then seek only if it is still behind
+      if (rc == 0 && mdb_cmp(context.txn, context.dbi, &context.key,
+                             &target) < 0) {
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_NODUP);
+      }
+      if (j == 0 || rc != 0 ||
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) < 0) {
+        context.key = target;
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_SET_RANGE);
+      }
+
+      // read the name pairs of the key, leaving the cursor on the key
+      if (rc == 0 &&
+          mdb_cmp(context.txn, context.dbi, &context.key, &target) == 0) {
+        source_names_t& source_names = names[keys[j].index];
+        int dup_rc = 0;
+        while (dup_rc == 0) {
+          std::string repository_name;
+          std::string filename;
+          decode_name(context.data, repository_name, filename);
+          source_names.insert(source_name_t(repository_name, filename));
+          dup_rc = mdb_cursor_get(context.cursor, &context.key,
+                                  &context.data, MDB_NEXT_DUP);
+        }
+        if (dup_rc != MDB_NOTFOUND) {
+          rc = dup_rc;
+        }
+      }
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+
+    context.close();
+  }
+
+  /**
+   * Remove the source names of the source ID, false if it has none.
+   */
+  bool remove(const uint64_t source_id) {
+
+    MUTEX_LOCK(&M);
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+
+    // set key=source_id
+    uint8_t key[10];
+    uint8_t* key_p = key;
+    key_p = lmdb_helper::encode_uint64_t(source_id, key_p);
+    context.key.mv_size = key_p - key;
+    context.key.mv_data = key;
+
+    // remove all name pairs of the key
+    int rc = mdb_del(context.txn, context.dbi, &context.key, NULL);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    context.close();
+    MUTEX_UNLOCK(&M);
+    return rc == 0;
+  }
+
+  /**
+   * Call callback for every source name in source ID order, walking one
+   * cursor in one read transaction.
+   */
+  void walk(source_name_callback_t callback, void* const data) const {
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+
+    int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_FIRST);
+    while (rc == 0) {
+
+      // read source ID
+      uint64_t source_id;
+      lmdb_helper::decode_uint64_t(
+                 static_cast<uint8_t*>(context.key.mv_data), source_id);
+
+      // read repository_name, filename pair
+      std::string repository_name;
+      std::string filename;
+      decode_name(context.data, repository_name, filename);
+      callback(data, source_id, repository_name, filename);
+
+      // next
+      rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                          MDB_NEXT);
+    }
+
+    if (rc != MDB_NOTFOUND) {
+      // invalid rc
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    context.close();
+  }
+
+  // sync to disk if the sync policy is flush or force is set
+  void flush(const bool force = false) const {
+    lmdb_helper::flush_env(env, force);
+  }
+
   // call this from a lock to prevent getting an unstable answer.
   size_t size() const {
     return lmdb_helper::size(env);
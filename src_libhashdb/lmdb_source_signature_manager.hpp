@@ -0,0 +1,452 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Manage the optional LMDB source signature store, which keeps a MinHash
+ * signature of the block hashes of each source and a locality-sensitive
+ * hashing index of the signatures, for finding the sources that share
+ * content with a set of block hashes in one lookup.
+ *
+ * A signature is the minimum of each of 64 hash functions over the block
+ * hashes of the source, so the fraction of positions at which two
+ * signatures agree estimates the Jaccard similarity of their sources.
+ * The hash functions are h + i * g for i of 0 to 63, where h and g are
+ * the halves of one 64-bit mix of the block hash.  Signatures only take
+ * smaller values as hashes are added, so a signature is updated by
+ * taking the minimum with the stored one.  Removing a hash from a source
+ * does not change its signature.
+ *
+ * The index splits a signature into 16 bands of 4 positions and keys
+ * each source under each of its bands, so sources that agree on any
+ * band are candidates.  Sources of similarity 0.5 are candidates about
+ * 65% of the time, and of similarity 0.8 nearly always.
+ *
+ * Keys are 's' and the source ID for signatures, and 'b', the band, and
+ * the hash of its positions for the index, with each source ID a sorted
+ * duplicate value.  Updates are kept in memory and written in batches.
+ * Threadsafe.
+ */
+
+#ifndef LMDB_SOURCE_SIGNATURE_MANAGER_HPP
+#define LMDB_SOURCE_SIGNATURE_MANAGER_HPP
+
+#include "file_modes.h"
+#include "lmdb.h"
+#include "lmdb_helper.h"
+#include "lmdb_context.hpp"
+#include <map>
+#include <set>
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <stdint.h>
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+// the MinHash signature of the block hashes of one source
+struct source_signature_t {
+  static const size_t num_positions = 64;
+  uint32_t mins[num_positions];
+
+  // the signature of no hashes
+  source_signature_t() {
+    for (size_t i=0; i<num_positions; ++i) {
+      mins[i] = 0xffffffff;
+    }
+  }
+
+  // add a block hash
+  void add(const std::string& block_hash) {
+    uint64_t x = 0xcbf29ce484222325ULL;
+    for (size_t i=0; i<block_hash.size(); ++i) {
+      x = (x ^ static_cast<uint8_t>(block_hash[i])) * 0x100000001b3ULL;
+    }
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    const uint32_t h = static_cast<uint32_t>(x);
+    const uint32_t g = static_cast<uint32_t>(x >> 32) | 1;
+    uint32_t v = h;
+    for (size_t i=0; i<num_positions; ++i) {
+      if (v < mins[i]) {
+        mins[i] = v;
+      }
+      v += g;
+    }
+  }
+
+  // add the hashes of another signature, true if this one changed
+  bool merge(const source_signature_t& other) {
+    bool changed = false;
+    for (size_t i=0; i<num_positions; ++i) {
+      if (other.mins[i] < mins[i]) {
+        mins[i] = other.mins[i];
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // the estimated Jaccard similarity of the sources of two signatures
+  double similarity(const source_signature_t& other) const {
+    size_t same = 0;
+    for (size_t i=0; i<num_positions; ++i) {
+      if (mins[i] == other.mins[i]) {
+        ++same;
+      }
+    }
+    return static_cast<double>(same) / num_positions;
+  }
+};
+
+class lmdb_source_signature_manager_t {
+
+  private:
+  static const size_t num_bands = 16;
+  static const size_t rows_per_band = source_signature_t::num_positions /
+                                      num_bands;
+
+  // the number of sources kept before writing them
+  static const size_t max_pending = 4096;
+
+  // conservative number of new LMDB pages one pending source may consume
+  static const size_t pages_per_source = 2 + 2 * num_bands;
+
+  MDB_env* env;
+  hashdb::lmdb_read_txn_cache_t* read_txn_cache; // or NULL if writable
+  std::map<uint64_t, source_signature_t> pending; // updates not yet written
+#ifdef HAVE_PTHREAD
+  mutable pthread_mutex_t M;                  // mutext
+#else
+  mutable int M;                              // placeholder
+#endif
+
+  // do not allow copy or assignment
+  lmdb_source_signature_manager_t(const lmdb_source_signature_manager_t&);
+  lmdb_source_signature_manager_t& operator=(
+                                const lmdb_source_signature_manager_t&);
+
+  // the key of the signature of a source
+  static size_t signature_key(const uint64_t source_id, uint8_t* key) {
+    key[0] = 's';
+    return lmdb_helper::encode_uint64_t(source_id, key + 1) - key;
+  }
+
+  // the key of a band of a signature
+  static size_t band_key(const source_signature_t& signature,
+                         const size_t band, uint8_t* key) {
+    uint64_t x = 0xcbf29ce484222325ULL;
+    for (size_t i=band * rows_per_band; i<(band + 1) * rows_per_band;
+         ++i) {
+      x = (x ^ signature.mins[i]) * 0x100000001b3ULL;
+    }
+    key[0] = 'b';
+    key[1] = static_cast<uint8_t>(band);
+    memcpy(key + 2, &x, sizeof(x));
+    return 2 + sizeof(x);
+  }
+
+  // source IDs are big-endian so that duplicates sort numerically
+  static void source_id_value(const uint64_t source_id, uint8_t* value) {
+    for (size_t i=0; i<8; ++i) {
+      value[i] = static_cast<uint8_t>(source_id >> (56 - 8 * i));
+    }
+  }
+
+  static uint64_t source_id_of(const MDB_val& data) {
+    const uint8_t* const p = static_cast<const uint8_t*>(data.mv_data);
+    uint64_t source_id = 0;
+    for (size_t i=0; i<8; ++i) {
+      source_id = (source_id << 8) | p[i];
+    }
+    return source_id;
+  }
+
+  // read a signature in an open context, false if the source has none
+  static bool read_signature(hashdb::lmdb_context_t& context,
+                             const uint64_t source_id,
+                             source_signature_t& signature) {
+    uint8_t key[11];
+    context.key.mv_size = signature_key(source_id, key);
+    context.key.mv_data = key;
+    int rc = mdb_get(context.txn, context.dbi, &context.key, &context.data);
+    if (rc == MDB_NOTFOUND) {
+      return false;
+    }
+    if (rc != 0 || context.data.mv_size != sizeof(signature.mins)) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+    memcpy(signature.mins, context.data.mv_data, sizeof(signature.mins));
+    return true;
+  }
+
+  // remove the signature and bands of a source in an open write context
+  static void remove_signature(hashdb::lmdb_context_t& context,
+                               const uint64_t source_id,
+                               const source_signature_t& signature) {
+    uint8_t key[11];
+    uint8_t value[8];
+    source_id_value(source_id, value);
+    for (size_t band=0; band<num_bands; ++band) {
+      context.key.mv_size = band_key(signature, band, key);
+      context.key.mv_data = key;
+      context.data.mv_size = sizeof(value);
+      context.data.mv_data = value;
+      int rc = mdb_del(context.txn, context.dbi, &context.key,
+                       &context.data);
+      if (rc != 0 && rc != MDB_NOTFOUND) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+    context.key.mv_size = signature_key(source_id, key);
+    context.key.mv_data = key;
+    int rc = mdb_del(context.txn, context.dbi, &context.key, NULL);
+    if (rc != 0 && rc != MDB_NOTFOUND) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+  }
+
+  // write the signature and bands of a source in an open write context
+  static void write_signature(hashdb::lmdb_context_t& context,
+                              const uint64_t source_id,
+                              const source_signature_t& signature) {
+    uint8_t key[11];
+    context.key.mv_size = signature_key(source_id, key);
+    context.key.mv_data = key;
+    context.data.mv_size = sizeof(signature.mins);
+    context.data.mv_data = const_cast<uint32_t*>(signature.mins);
+    int rc = mdb_put(context.txn, context.dbi, &context.key, &context.data,
+                     MDB_NODUPDATA);
+    if (rc != 0) {
+      std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+      assert(0);
+    }
+
+    uint8_t value[8];
+    source_id_value(source_id, value);
+    for (size_t band=0; band<num_bands; ++band) {
+      context.key.mv_size = band_key(signature, band, key);
+      context.key.mv_data = key;
+      context.data.mv_size = sizeof(value);
+      context.data.mv_data = value;
+      rc = mdb_put(context.txn, context.dbi, &context.key, &context.data,
+                   MDB_NODUPDATA);
+      if (rc != 0 && rc != MDB_KEYEXIST) {
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+  }
+
+  // merge the pending updates into the stored signatures in source ID
+  // order, call while locked
+  void write_pending() {
+    if (pending.size() == 0) {
+      return;
+    }
+
+    // maybe grow the DB with room for every update since the map cannot
+    // grow while the transaction is open
+    lmdb_helper::maybe_grow(env, 10 + pending.size() * pages_per_source);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+
+    for (std::map<uint64_t, source_signature_t>::const_iterator it =
+         pending.begin(); it != pending.end(); ++it) {
+      source_signature_t signature;
+      if (read_signature(context, it->first, signature)) {
+        source_signature_t merged = signature;
+        if (!merged.merge(it->second)) {
+          continue;
+        }
+        remove_signature(context, it->first, signature);
+        write_signature(context, it->first, merged);
+      } else {
+        write_signature(context, it->first, it->second);
+      }
+    }
+
+    context.close();
+    pending.clear();
+  }
+
+  public:
+  lmdb_source_signature_manager_t(const std::string& hashdb_dir,
+                      const hashdb::file_mode_type_t file_mode,
+                      const lmdb_helper::env_policy_t& policy =
+                                lmdb_helper::env_policy_t()) :
+       env(lmdb_helper::open_env(hashdb_dir + "/lmdb_source_signature_store",
+                                  file_mode, policy)),
+       read_txn_cache((file_mode == hashdb::READ_ONLY) ?
+             new hashdb::lmdb_read_txn_cache_t(env, true,
+                             policy.max_snapshot_ms) : NULL),
+       pending(),
+       M() {
+
+    MUTEX_INIT(&M);
+  }
+
+  ~lmdb_source_signature_manager_t() {
+    flush();
+
+    // free cached read txns then close the DB environment
+    delete read_txn_cache;
+    lmdb_helper::close_env(env);
+
+    MUTEX_DESTROY(&M);
+  }
+
+  /**
+   * Reopen the read-only store in a child process after fork.
+   */
+  void reopen_after_fork() {
+    env = lmdb_helper::reopen_env_after_fork(env);
+    read_txn_cache->reattach(env);
+  }
+
+  /**
+   * Add a block hash to the signature of the source ID.
+   */
+  void add(const uint64_t source_id, const std::string& block_hash) {
+    MUTEX_LOCK(&M);
+    pending[source_id].add(block_hash);
+    if (pending.size() >= max_pending) {
+      write_pending();
+    }
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Add the block hashes of a signature to the signature of the source
+   * ID.
+   */
+  void merge(const uint64_t source_id,
+             const source_signature_t& signature) {
+    MUTEX_LOCK(&M);
+    pending[source_id].merge(signature);
+    if (pending.size() >= max_pending) {
+      write_pending();
+    }
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Remove the signature of the source ID.  Pending updates are written
+   * first.
+   */
+  void remove(const uint64_t source_id) {
+    MUTEX_LOCK(&M);
+    write_pending();
+
+    // maybe grow the DB
+    lmdb_helper::maybe_grow(env, 10 + pages_per_source);
+
+    // get context
+    hashdb::lmdb_context_t context(env, true, true);
+    context.open();
+    source_signature_t signature;
+    if (read_signature(context, source_id, signature)) {
+      remove_signature(context, source_id, signature);
+    }
+    context.close();
+    MUTEX_UNLOCK(&M);
+  }
+
+  /**
+   * Read the signature of the source ID, false if it has none.
+   */
+  bool find(const uint64_t source_id,
+            source_signature_t& signature) const {
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+    const bool found = read_signature(context, source_id, signature);
+    context.close();
+    return found;
+  }
+
+  /**
+   * Find the source IDs that share a band with the signature.
+   */
+  void find_candidates(const source_signature_t& signature,
+                       std::set<uint64_t>& source_ids) const {
+
+    source_ids.clear();
+
+    // get context
+    hashdb::lmdb_context_t context(env, false, true, read_txn_cache);
+    context.open();
+
+    uint8_t key[11];
+    for (size_t band=0; band<num_bands; ++band) {
+      context.key.mv_size = band_key(signature, band, key);
+      context.key.mv_data = key;
+      context.data.mv_size = 0;
+      context.data.mv_data = NULL;
+
+      // read the duplicates of the key
+      int rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                              MDB_SET_KEY);
+      while (rc == 0) {
+        source_ids.insert(source_id_of(context.data));
+        rc = mdb_cursor_get(context.cursor, &context.key, &context.data,
+                            MDB_NEXT_DUP);
+      }
+      if (rc != MDB_NOTFOUND) {
+        // invalid rc
+        std::cerr << "LMDB error: " << mdb_strerror(rc) << "\n";
+        assert(0);
+      }
+    }
+    context.close();
+  }
+
+  // write the pending updates then sync to disk if the sync policy is
+  // flush or force is set
+  void flush(const bool force = false) {
+    MUTEX_LOCK(&M);
+    write_pending();
+    MUTEX_UNLOCK(&M);
+    lmdb_helper::flush_env(env, force);
+  }
+
+  // call this from a lock to prevent getting an unstable answer.
+  size_t size() const {
+    return lmdb_helper::size(env);
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
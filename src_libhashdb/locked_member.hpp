@@ -20,6 +20,19 @@
 /**
  * \file
  * Provide a threadsafe interface for checking membership.
+ *
+ * Members are spread across independently locked shards so that
+ * concurrent scan threads rarely wait on each other.  Each shard is an
+ * open addressing table of fixed size binary keys, so members cost a
+ * few bytes more than the key instead of a string node.  Keys longer
+ * than a slot, which are not hashes, are kept in a set.
+ *
+ * Membership may be capped in bytes, and its memory is drawn from the
+ * memory budget.  A full shard or a shard refused memory stops accepting
+ * members and reports every further item as new, so callers that use
+ * membership to suppress repeats may repeat but never omit.
+ *
+ * Membership may instead be shared with other processes, see share.
  */
 
 #ifndef LOCKED_MEMBER_HPP
@@ -27,12 +40,17 @@
 
 #include <string>
 #include <set>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
 
 // no concurrent writes
 #ifdef HAVE_PTHREAD
 #include <pthread.h>
 #endif
 #include "mutex_lock.hpp"
+#include "memory_budget.hpp"
+#include "shared_member.hpp"
 
 namespace hashdb {
 
@@ -40,33 +58,201 @@ class locked_member_t {
 
   private:
   typedef std::set<std::string> set_t;
-  set_t member;
 
+  // a power of two
+  static const size_t num_shards = 64;
+
+  // the longest key kept in a slot, the size of an MD5 or a truncated
+  // SHA hash
+  static const size_t slot_key_size = 16;
+
+  // the initial slots per shard, a power of two
+  static const size_t initial_slots = 64;
+
+  // the approximate cost of a member in the set of long keys
+  static const size_t long_key_overhead = 64;
+
+  struct slot_t {
+    uint8_t size;                             // 0 if empty
+    char key[slot_key_size];
+  };
+
+  struct shard_t {
+    std::vector<slot_t> slots;
+    size_t count;
+    set_t long_keys;
+    size_t long_key_bytes;
+    size_t charged;                           // bytes from the budget
 #ifdef HAVE_PTHREAD
-  mutable pthread_mutex_t M;                  // mutext
+    pthread_mutex_t M;                        // mutext
 #else
-  mutable int M;                              // placeholder
+    int M;                                    // placeholder
 #endif
+    shard_t() : slots(), count(0), long_keys(), long_key_bytes(0),
+                charged(0), M() {
+      MUTEX_INIT(&M);
+    }
+    ~shard_t() {
+      memory_budget().release(charged);
+      MUTEX_DESTROY(&M);
+    }
+
+    private:
+    // do not allow copy or assignment
+    shard_t(const shard_t&);
+    shard_t& operator=(const shard_t&);
+  };
+
+  const size_t max_shard_bytes;               // 0 for no cap
+  shard_t shards[num_shards];
+  shared_member_t* shared;                    // or NULL
 
   // do not allow copy or assignment
   locked_member_t(const locked_member_t&);
   locked_member_t& operator=(const locked_member_t&);
 
+  // items are typically binary hashes, hash the whole item
+  static uint64_t item_hash(const char* const item, const size_t size) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i=0; i<size; ++i) {
+      h = (h ^ static_cast<uint8_t>(item[i])) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  // the shard uses the high bits and the slot uses the low bits
+  static size_t shard_index(const uint64_t h) {
+    return static_cast<size_t>(h >> 58) & (num_shards - 1);
+  }
+
+  // true if the shard may use this many bytes, taking the added bytes
+  // from the memory budget
+  bool fits(shard_t& shard, const size_t bytes, const size_t added) const {
+    if (max_shard_bytes != 0 &&
+        shard.long_key_bytes + bytes > max_shard_bytes) {
+      return false;
+    }
+    if (!memory_budget().try_acquire(added)) {
+      return false;
+    }
+    shard.charged += added;
+    return true;
+  }
+
+  // find the slot holding the key or the empty slot to put it in
+  static size_t probe(const std::vector<slot_t>& slots, const uint64_t h,
+                      const char* const key, const size_t size) {
+    const size_t mask = slots.size() - 1;
+    size_t i = static_cast<size_t>(h) & mask;
+    while (slots[i].size != 0 &&
+           (slots[i].size != size || memcmp(slots[i].key, key, size) != 0)) {
+      i = (i + 1) & mask;
+    }
+    return i;
+  }
+
+  // double the slots of the shard
+  static void grow(shard_t& shard) {
+    std::vector<slot_t> old_slots;
+    old_slots.swap(shard.slots);
+    slot_t empty_slot;
+    memset(&empty_slot, 0, sizeof(empty_slot));
+    shard.slots.assign((old_slots.size() == 0) ? initial_slots :
+                       old_slots.size() * 2, empty_slot);
+    for (size_t i=0; i<old_slots.size(); ++i) {
+      if (old_slots[i].size != 0) {
+        const uint64_t h = item_hash(old_slots[i].key, old_slots[i].size);
+        shard.slots[probe(shard.slots, h, old_slots[i].key,
+                          old_slots[i].size)] = old_slots[i];
+      }
+    }
+  }
+
+  // insert a key that fits in a slot, the caller holds the lock
+  bool insert_slot(shard_t& shard, const uint64_t h,
+                   const std::string& item) {
+
+    // grow at half full while the grown slots fit, else take slots
+    // until three quarters full
+    const size_t slot_bytes = sizeof(slot_t);
+    if (shard.slots.size() == 0 || shard.count * 2 >= shard.slots.size()) {
+      const size_t new_size = (shard.slots.size() == 0) ? initial_slots :
+                              shard.slots.size() * 2;
+      if (fits(shard, new_size * slot_bytes,
+               (new_size - shard.slots.size()) * slot_bytes)) {
+        grow(shard);
+      } else if (shard.count * 4 >= shard.slots.size() * 3) {
+        // full, so accept a possible repeat
+        return !contains_slot(shard, h, item);
+      }
+    }
+    const size_t i = probe(shard.slots, h, item.c_str(), item.size());
+    if (shard.slots[i].size != 0) {
+      return false;
+    }
+    shard.slots[i].size = static_cast<uint8_t>(item.size());
+    memcpy(shard.slots[i].key, item.c_str(), item.size());
+    ++shard.count;
+    return true;
+  }
+
+  static bool contains_slot(const shard_t& shard, const uint64_t h,
+                            const std::string& item) {
+    if (shard.slots.size() == 0) {
+      return false;
+    }
+    return shard.slots[probe(shard.slots, h, item.c_str(),
+                             item.size())].size != 0;
+  }
+
   public:
-  locked_member_t() : member(), M() {
-    MUTEX_INIT(&M);
+  /**
+   * Track members using up to about max_bytes, or without a cap if
+   * max_bytes is 0.
+   */
+  locked_member_t(const size_t max_bytes = 0) :
+          max_shard_bytes((max_bytes == 0) ? 0 :
+                          (max_bytes + num_shards - 1) / num_shards),
+          shards(), shared(NULL) {
   }
 
   ~locked_member_t() {
-    MUTEX_DESTROY(&M);
+    delete shared;
+  }
+
+  /**
+   * Keep members in shared membership from now on instead of in this
+   * process, taking ownership of it.  Call before inserting from other
+   * threads.
+   */
+  void share(shared_member_t* const p_shared) {
+    delete shared;
+    shared = p_shared;
   }
 
   // return true if new else false
   bool locked_insert(const std::string& item) {
-    MUTEX_LOCK(&M);
-    std::pair<set_t::const_iterator, bool> pair = member.insert(item);
-    bool did_insert = pair.second;
-    MUTEX_UNLOCK(&M);
+    if (shared != NULL) {
+      return shared->insert(item);
+    }
+    const uint64_t h = item_hash(item.c_str(), item.size());
+    shard_t& shard = shards[shard_index(h)];
+    bool did_insert;
+    MUTEX_LOCK(&shard.M);
+    if (item.size() != 0 && item.size() <= slot_key_size) {
+      did_insert = insert_slot(shard, h, item);
+    } else if (shard.long_keys.find(item) != shard.long_keys.end()) {
+      did_insert = false;
+    } else {
+      const size_t bytes = item.size() + long_key_overhead;
+      if (fits(shard, shard.slots.size() * sizeof(slot_t) + bytes, bytes)) {
+        shard.long_keys.insert(item);
+        shard.long_key_bytes += bytes;
+      }
+      // else full, so accept a possible repeat
+      did_insert = true;
+    }
+    MUTEX_UNLOCK(&shard.M);
     return did_insert;
   }
 };
@@ -74,4 +260,3 @@ class locked_member_t {
 } // end namespace hashdb
 
 #endif
-
@@ -0,0 +1,123 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Provides the one memory budget that the large memory users of a
+ * process draw from: ingest and scan buffer pools, the source and
+ * source list caches of expanded scans, batches waiting for the hash
+ * writer, and the hashes and sources remembered by EXPANDED_OPTIMIZED
+ * scans.  Set it with set_memory_budget.
+ *
+ * Users that can wait for their own memory to come back, the buffer
+ * pools and the hash writer, wait instead of growing past the budget.
+ * Users that cannot, the caches and the remembered sets, stop growing,
+ * so a cache evicts sooner and a remembered set reports repeats.  Each
+ * user may always take the little it needs to make progress, so the
+ * budget may be exceeded by that much but never deadlocks.
+ *
+ * Lock-free.  A limit of 0 means no budget, but use is still counted.
+ */
+
+#ifndef MEMORY_BUDGET_HPP
+#define MEMORY_BUDGET_HPP
+
+#include <atomic>
+#include <stdint.h>
+
+namespace hashdb {
+
+class memory_budget_t {
+
+  private:
+  std::atomic<uint64_t> limit;               // 0 for no limit
+  std::atomic<uint64_t> used;
+  std::atomic<uint64_t> peak;
+  std::atomic<uint64_t> refusals;
+
+  // do not allow copy or assignment
+  memory_budget_t(const memory_budget_t&);
+  memory_budget_t& operator=(const memory_budget_t&);
+
+  void note_peak(const uint64_t now_used) {
+    uint64_t old_peak = peak.load(std::memory_order_relaxed);
+    while (now_used > old_peak &&
+           !peak.compare_exchange_weak(old_peak, now_used,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+
+  public:
+  memory_budget_t() : limit(0), used(0), peak(0), refusals(0) {
+  }
+
+  void set_limit(const uint64_t bytes) {
+    limit.store(bytes, std::memory_order_relaxed);
+  }
+
+  uint64_t get_limit() const {
+    return limit.load(std::memory_order_relaxed);
+  }
+
+  // take bytes if they fit, else count a refusal and return false
+  bool try_acquire(const uint64_t bytes) {
+    const uint64_t max_bytes = limit.load(std::memory_order_relaxed);
+    uint64_t old_used = used.load(std::memory_order_relaxed);
+    do {
+      if (max_bytes != 0 && old_used + bytes > max_bytes) {
+        refusals.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    } while (!used.compare_exchange_weak(old_used, old_used + bytes,
+                                         std::memory_order_relaxed));
+    note_peak(old_used + bytes);
+    return true;
+  }
+
+  // take bytes needed for progress, even past the limit
+  void charge(const uint64_t bytes) {
+    note_peak(used.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  }
+
+  // return bytes taken by try_acquire or charge
+  void release(const uint64_t bytes) {
+    used.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+
+  uint64_t used_bytes() const {
+    return used.load(std::memory_order_relaxed);
+  }
+
+  uint64_t peak_bytes() const {
+    return peak.load(std::memory_order_relaxed);
+  }
+
+  // the number of times try_acquire refused bytes
+  uint64_t refusal_count() const {
+    return refusals.load(std::memory_order_relaxed);
+  }
+};
+
+// the budget of the process
+memory_budget_t& memory_budget();
+
+} // end namespace hashdb
+
+#endif
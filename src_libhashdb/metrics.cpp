@@ -0,0 +1,415 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * The metrics registry, its Prometheus text rendering, and the metrics
+ * server that answers each connection with the current metrics as an
+ * HTTP response.
+ */
+
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+#include "metrics.hpp"
+#include "stage_stats.hpp"
+#include "memory_budget.hpp"
+#include "hashdb.hpp"
+#include <map>
+#include <iostream>
+#include <cassert>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <pthread.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace hashdb {
+
+  struct metrics_entry_t {
+    metrics_callback_t callback;
+    uint64_t id;
+  };
+
+  // registered objects, never freed so that objects destroyed during
+  // shutdown may still unregister
+  static pthread_mutex_t registry_M = PTHREAD_MUTEX_INITIALIZER;
+  static std::map<const void*, metrics_entry_t>* registry =
+                          new std::map<const void*, metrics_entry_t>;
+  static uint64_t next_id = 0;
+
+  void metrics_register(const metrics_callback_t callback,
+                        const void* const data) {
+    pthread_mutex_lock(&registry_M);
+    metrics_entry_t entry;
+    entry.callback = callback;
+    entry.id = next_id++;
+    (*registry)[data] = entry;
+    pthread_mutex_unlock(&registry_M);
+  }
+
+  void metrics_unregister(const void* const data) {
+    pthread_mutex_lock(&registry_M);
+    registry->erase(data);
+    pthread_mutex_unlock(&registry_M);
+  }
+
+  std::string metric_label(const std::string& text) {
+    std::string quoted = "\"";
+    for (size_t i=0; i<text.size(); ++i) {
+      if (text[i] == '\\' || text[i] == '"') {
+        quoted += '\\';
+        quoted += text[i];
+      } else if (text[i] == '\n') {
+        quoted += "\\n";
+      } else {
+        quoted += text[i];
+      }
+    }
+    return quoted + "\"";
+  }
+
+  // the stage and lookup counters since the process started
+  static void add_stage_samples(metric_samples_t& samples) {
+    stage_totals_t totals;
+    stage_snapshot(totals);
+    for (size_t s=0; s<NUM_STAGES; ++s) {
+      const std::string labels = "stage=" +
+                  metric_label(stage_name(static_cast<stage_t>(s)));
+      samples.push_back(metric_sample_t("hashdb_stage_events_total",
+                  "counter", "Number of timed stage events.", labels,
+                  static_cast<double>(totals.count[s])));
+      samples.push_back(metric_sample_t("hashdb_stage_seconds_total",
+                  "counter", "Time spent in each stage, over all threads.",
+                  labels, totals.ns[s] / 1000000000.0));
+    }
+
+    const char* const stores[2] = {"hash", "hash_data"};
+    for (size_t i=0; i<2; ++i) {
+      const uint64_t hits = totals.lookups[2*i];
+      const uint64_t misses = totals.lookups[2*i + 1];
+      const std::string store = "store=" + metric_label(stores[i]);
+      samples.push_back(metric_sample_t("hashdb_lookups_total", "counter",
+                  "Number of store lookups by result.",
+                  store + ",result=\"hit\"", static_cast<double>(hits)));
+      samples.push_back(metric_sample_t("hashdb_lookups_total", "counter",
+                  "Number of store lookups by result.",
+                  store + ",result=\"miss\"",
+                  static_cast<double>(misses)));
+      samples.push_back(metric_sample_t("hashdb_lookup_hit_ratio", "gauge",
+                  "Fraction of store lookups that found the hash.", store,
+                  (hits + misses == 0) ? 0.0 :
+                  static_cast<double>(hits) / (hits + misses)));
+    }
+  }
+
+  // the memory budget and its use
+  static void add_memory_samples(metric_samples_t& samples) {
+    const memory_budget_t& budget = memory_budget();
+    samples.push_back(metric_sample_t("hashdb_memory_budget_bytes", "gauge",
+                "The memory budget, or 0 for no budget.", "",
+                static_cast<double>(budget.get_limit())));
+    samples.push_back(metric_sample_t("hashdb_memory_used_bytes", "gauge",
+                "Memory drawn from the memory budget.", "",
+                static_cast<double>(budget.used_bytes())));
+    samples.push_back(metric_sample_t("hashdb_memory_peak_bytes", "gauge",
+                "The most memory drawn from the memory budget.", "",
+                static_cast<double>(budget.peak_bytes())));
+    samples.push_back(metric_sample_t("hashdb_memory_refusals_total",
+                "counter", "Number of requests the memory budget refused.",
+                "", static_cast<double>(budget.refusal_count())));
+  }
+
+  std::string metrics_text() {
+    metric_samples_t samples;
+    add_stage_samples(samples);
+    add_memory_samples(samples);
+    pthread_mutex_lock(&registry_M);
+    for (std::map<const void*, metrics_entry_t>::const_iterator it =
+         registry->begin(); it != registry->end(); ++it) {
+      it->second.callback(it->first, it->second.id, samples);
+    }
+    pthread_mutex_unlock(&registry_M);
+
+    // group the samples of each family after its HELP and TYPE lines,
+    // keeping the order in which families first appear
+    std::vector<std::string> names;
+    std::map<std::string, std::string> families;
+    for (metric_samples_t::const_iterator it = samples.begin();
+         it != samples.end(); ++it) {
+      std::string& family = families[it->name];
+      if (family.size() == 0) {
+        names.push_back(it->name);
+        family = "# HELP " + it->name + " " + it->help + "\n" +
+                 "# TYPE " + it->name + " " + it->type + "\n";
+      }
+      std::stringstream ss;
+      ss.precision(17);
+      ss << it->name;
+      if (it->labels.size() != 0) {
+        ss << "{" << it->labels << "}";
+      }
+      ss << " " << it->value << "\n";
+      family += ss.str();
+    }
+
+    std::string text;
+    for (size_t i=0; i<names.size(); ++i) {
+      text += families[names[i]];
+    }
+    return text;
+  }
+
+#ifdef WIN32
+  std::string start_metrics_server(const std::string& /*address*/) {
+    return "the metrics server is not available on Windows";
+  }
+
+  void stop_metrics_server() {
+  }
+#else
+  struct metrics_server_t {
+    int listen_fd;
+    int stop_fds[2];
+    std::string unix_path;   // or "" for TCP
+    pthread_t thread;
+    metrics_server_t() : listen_fd(-1), stop_fds(), unix_path(""),
+                         thread() {
+      stop_fds[0] = -1;
+      stop_fds[1] = -1;
+    }
+  };
+
+  // the running server or NULL
+  static pthread_mutex_t server_M = PTHREAD_MUTEX_INITIALIZER;
+  static metrics_server_t* server = NULL;
+
+  // answer one connection, ignoring the request
+  static void serve(const int fd) {
+
+    // read the request head, but do not let a slow client stall scrapes
+    struct timeval timeout;
+    timeout.tv_sec = 1;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string request;
+    char buffer[1024];
+    while (request.size() < 8192 &&
+           request.find("\r\n\r\n") == std::string::npos &&
+           request.find("\n\n") == std::string::npos) {
+      const ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+      if (count <= 0) {
+        break;
+      }
+      request.append(buffer, static_cast<size_t>(count));
+    }
+
+    const std::string body = metrics_text();
+    std::stringstream ss;
+    ss << "HTTP/1.0 200 OK\r\n"
+       << "Content-Type: text/plain; version=0.0.4\r\n"
+       << "Content-Length: " << body.size() << "\r\n"
+       << "\r\n" << body;
+    const std::string response = ss.str();
+    size_t sent = 0;
+    while (sent < response.size()) {
+      const ssize_t count = send(fd, response.data() + sent,
+                                 response.size() - sent, MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        break;
+      }
+      sent += static_cast<size_t>(count);
+    }
+    close(fd);
+  }
+
+  static void* run_server(void* const arg) {
+    const metrics_server_t* const p = static_cast<metrics_server_t*>(arg);
+    while (true) {
+      struct pollfd fds[2];
+      fds[0].fd = p->listen_fd;
+      fds[0].events = POLLIN;
+      fds[0].revents = 0;
+      fds[1].fd = p->stop_fds[0];
+      fds[1].events = POLLIN;
+      fds[1].revents = 0;
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "Warning: metrics server stopped: "
+                  << strerror(errno) << "\n";
+        return NULL;
+      }
+      if (fds[1].revents != 0) {
+        return NULL;
+      }
+      if (fds[0].revents != 0) {
+        const int fd = accept(p->listen_fd, NULL, NULL);
+        if (fd >= 0) {
+          serve(fd);
+        }
+      }
+    }
+  }
+
+  // open the listening socket of address, return "" or the reason
+  static std::string open_listener(const std::string& address,
+                                   metrics_server_t& s) {
+    if (address.compare(0, 5, "unix:") == 0) {
+      s.unix_path = address.substr(5);
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      if (s.unix_path.size() == 0 ||
+          s.unix_path.size() >= sizeof(addr.sun_path)) {
+        return "invalid socket path '" + s.unix_path + "'";
+      }
+      addr.sun_family = AF_UNIX;
+      memcpy(addr.sun_path, s.unix_path.c_str(), s.unix_path.size());
+      s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (s.listen_fd < 0) {
+        return strerror(errno);
+      }
+      unlink(s.unix_path.c_str());
+      if (bind(s.listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) != 0) {
+        return strerror(errno);
+      }
+
+    } else {
+      // [host:]port, listening on the loopback address by default
+      std::string host = "127.0.0.1";
+      std::string port = address;
+      const size_t colon = address.rfind(':');
+      if (colon != std::string::npos) {
+        host = address.substr(0, colon);
+        port = address.substr(colon + 1);
+      }
+      char* end;
+      const long port_number = strtol(port.c_str(), &end, 10);
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      if (port.size() == 0 || *end != '\0' || port_number < 0 ||
+          port_number > 65535 ||
+          inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        return "invalid address '" + address +
+               "', expected [host:]port or unix:path";
+      }
+      addr.sin_port = htons(static_cast<uint16_t>(port_number));
+      s.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (s.listen_fd < 0) {
+        return strerror(errno);
+      }
+      const int on = 1;
+      setsockopt(s.listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (bind(s.listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+               sizeof(addr)) != 0) {
+        return strerror(errno);
+      }
+    }
+
+    if (listen(s.listen_fd, 16) != 0) {
+      return strerror(errno);
+    }
+    return "";
+  }
+
+  static void close_server(metrics_server_t* const s) {
+    if (s->listen_fd >= 0) {
+      close(s->listen_fd);
+      if (s->unix_path.size() != 0) {
+        unlink(s->unix_path.c_str());
+      }
+    }
+    if (s->stop_fds[0] >= 0) {
+      close(s->stop_fds[0]);
+      close(s->stop_fds[1]);
+    }
+    delete s;
+  }
+
+  std::string start_metrics_server(const std::string& address) {
+    pthread_mutex_lock(&server_M);
+    if (server != NULL) {
+      pthread_mutex_unlock(&server_M);
+      return "the metrics server is already running";
+    }
+    metrics_server_t* const s = new metrics_server_t;
+    std::string error_message = open_listener(address, *s);
+    if (error_message.size() == 0 && pipe(s->stop_fds) != 0) {
+      error_message = strerror(errno);
+    }
+    if (error_message.size() == 0 &&
+        pthread_create(&s->thread, NULL, run_server, s) != 0) {
+      error_message = "unable to start the metrics server thread";
+    }
+    if (error_message.size() != 0) {
+      close_server(s);
+      pthread_mutex_unlock(&server_M);
+      return "Unable to serve metrics on " + address + ": " +
+             error_message;
+    }
+    server = s;
+    pthread_mutex_unlock(&server_M);
+    return "";
+  }
+
+  void stop_metrics_server() {
+    pthread_mutex_lock(&server_M);
+    if (server != NULL) {
+      const char stop = 0;
+      if (write(server->stop_fds[1], &stop, 1) != 1) {
+        assert(0);
+      }
+      pthread_join(server->thread, NULL);
+      close_server(server);
+      server = NULL;
+    }
+    pthread_mutex_unlock(&server_M);
+  }
+#endif
+}
@@ -0,0 +1,81 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides live metrics in the Prometheus text format for long running
+ * ingest and scan services.
+ *
+ * Queues and LMDB environments register a callback while they exist,
+ * and each callback adds the current samples of its object under a
+ * registry ID that keeps the series of like objects apart.  The stage
+ * and lookup counters of stage_stats.hpp and the memory budget are
+ * always included.
+ *
+ * Callbacks run with the registry locked, so an object is never asked
+ * for samples after metrics_unregister returns.  A callback may take
+ * the object's own lock but must not register or unregister.
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace hashdb {
+
+  struct metric_sample_t {
+    std::string name;     // metric family name
+    std::string type;     // "gauge" or "counter"
+    std::string help;
+    std::string labels;   // without braces, for example store="hash"
+    double value;
+
+    metric_sample_t(const std::string& p_name, const std::string& p_type,
+                    const std::string& p_help, const std::string& p_labels,
+                    const double p_value) :
+              name(p_name), type(p_type), help(p_help), labels(p_labels),
+              value(p_value) {
+    }
+  };
+
+  typedef std::vector<metric_sample_t> metric_samples_t;
+
+  /**
+   * The callback that adds the current samples of data, where id is
+   * the registry ID of data for use in labels.
+   */
+  typedef void (*metrics_callback_t)(const void* const data,
+                                     const uint64_t id,
+                                     metric_samples_t& samples);
+
+  // add the samples of data to reported metrics until unregistered
+  void metrics_register(const metrics_callback_t callback,
+                        const void* const data);
+
+  // stop reporting the samples of data
+  void metrics_unregister(const void* const data);
+
+  // return text quoted as a label value
+  std::string metric_label(const std::string& text);
+}
+
+#endif
@@ -0,0 +1,140 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * The NUMA topology of the machine, see numa_nodes.hpp.
+ */
+
+#include <config.h>
+#include "numa_nodes.hpp"
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef HAVE_SCHED_GETCPU
+#include <sched.h>
+#endif
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(HAVE_SYS_SYSCALL_H)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+namespace hashdb {
+
+  bool parse_cpu_list(const std::string& cpu_list, std::vector<int>& ids) {
+    std::stringstream ss(cpu_list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+      if (range.size() > 0 && range[range.size()-1] == '\n') {
+        range.erase(range.size()-1);
+      }
+      if (range.size() == 0) {
+        continue;
+      }
+      char* end;
+      const long first = std::strtol(range.c_str(), &end, 10);
+      long last = first;
+      if (*end == '-') {
+        last = std::strtol(end + 1, &end, 10);
+      }
+      if (*end != '\0' || first < 0 || last < first) {
+        return false;
+      }
+      for (long id = first; id <= last; ++id) {
+        ids.push_back(static_cast<int>(id));
+      }
+    }
+    return ids.size() > 0;
+  }
+
+  // read the first line of a sysfs file, false if it cannot be read
+  static bool read_line(const std::string& filename, std::string& line) {
+    std::ifstream in(filename.c_str());
+    return in.is_open() && std::getline(in, line);
+  }
+
+  bool numa_nodes(std::vector<numa_node_t>& nodes) {
+    nodes.clear();
+    std::string line;
+    std::vector<int> node_ids;
+    if (!read_line("/sys/devices/system/node/online", line) ||
+        !parse_cpu_list(line, node_ids)) {
+      return false;
+    }
+    for (size_t i=0; i<node_ids.size(); ++i) {
+      std::stringstream ss;
+      ss << "/sys/devices/system/node/node" << node_ids[i] << "/cpulist";
+      numa_node_t node;
+      node.node_id = node_ids[i];
+
+      // nodes of memory only have an empty CPU list
+      if (read_line(ss.str(), line) && parse_cpu_list(line, node.cpus)) {
+        nodes.push_back(node);
+      }
+    }
+    return nodes.size() > 0;
+  }
+
+  int current_cpu() {
+#ifdef HAVE_SCHED_GETCPU
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+  }
+
+  bool interleave_memory(const void* const p, const size_t size) {
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(HAVE_SYS_SYSCALL_H) && \
+    defined(SYS_mbind)
+    std::string line;
+    std::vector<int> node_ids;
+    if (size == 0 ||
+        !read_line("/sys/devices/system/node/online", line) ||
+        !parse_cpu_list(line, node_ids) || node_ids.size() < 2) {
+      return false;
+    }
+
+    // the mask of online nodes
+    const size_t bits_per_word = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(
+                      static_cast<size_t>(node_ids.back()) / bits_per_word + 1);
+    for (size_t i=0; i<node_ids.size(); ++i) {
+      const size_t node = static_cast<size_t>(node_ids[i]);
+      mask[node / bits_per_word] |= 1UL << (node % bits_per_word);
+    }
+
+    // whole pages inside and around the range
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(p) / page * page;
+    const uintptr_t end = (reinterpret_cast<uintptr_t>(p) + size + page - 1)
+                          / page * page;
+    return ::syscall(SYS_mbind, begin, end - begin, MPOL_INTERLEAVE,
+                     &mask[0], mask.size() * bits_per_word + 1,
+                     MPOL_MF_MOVE) == 0;
+#else
+    (void)p;
+    (void)size;
+    return false;
+#endif
+  }
+
+} // end namespace hashdb
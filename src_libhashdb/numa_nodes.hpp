@@ -0,0 +1,71 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * The NUMA topology of the machine, read from
+ * /sys/devices/system/node, and placement of memory across its nodes.
+ * A machine without NUMA information is one node holding every CPU.
+ */
+
+#ifndef NUMA_NODES_HPP
+#define NUMA_NODES_HPP
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace hashdb {
+
+  // a NUMA node and its CPUs
+  struct numa_node_t {
+    int node_id;
+    std::vector<int> cpus;
+    numa_node_t() : node_id(0), cpus() {
+    }
+  };
+
+  /**
+   * Parse a CPU or node list such as "0-3,8" into ids, false if
+   * malformed or empty.
+   */
+  bool parse_cpu_list(const std::string& cpu_list, std::vector<int>& ids);
+
+  /**
+   * Get the online NUMA nodes that have CPUs, in node order, false and
+   * no nodes if the machine has no NUMA information.
+   */
+  bool numa_nodes(std::vector<numa_node_t>& nodes);
+
+  /**
+   * The CPU the calling thread is running on, or -1 if unknown.
+   */
+  int current_cpu();
+
+  /**
+   * Spread the pages of memory at p round-robin across the online NUMA
+   * nodes, moving pages already placed.  Return false if memory
+   * placement is not supported or the machine has one node.
+   */
+  bool interleave_memory(const void* const p, const size_t size);
+
+} // end namespace hashdb
+
+#endif
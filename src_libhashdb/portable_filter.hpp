@@ -0,0 +1,216 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides a membership filter file of the hashes of a hashdb, small
+ * enough to copy to a field laptop in place of the hashdb, see
+ * hashdb::export_filter.
+ *
+ * The filter is a blocked Bloom filter, see hash_filter.hpp, of the hash
+ * store prefixes at 12 bits per hash, so about 1% of absent block hashes
+ * are reported as candidates.  A candidate is confirmed by scanning it
+ * against the full hashdb.  A filter never misses a hash that is there.
+ *
+ * The file holds a header with a version, the block size and block hash
+ * algorithm of the hashdb so that media is hashed the way the hashdb
+ * was, the prefix size, and the key and block counts, followed by the
+ * filter words.  Numbers are in host byte order, like the hash filter
+ * file.
+ */
+
+#ifndef PORTABLE_FILTER_HPP
+#define PORTABLE_FILTER_HPP
+
+#include "hash_filter.hpp"
+#include <string>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <stdint.h>
+
+namespace hashdb {
+
+class portable_filter_t {
+
+  private:
+  static const uint32_t file_version = 1;
+
+  struct file_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    char block_hash_algorithm[16];
+    uint64_t prefix_size;
+    uint64_t num_keys;
+    uint64_t num_blocks;
+  };
+
+  hash_filter_t* filter;
+
+  // do not allow copy or assignment
+  portable_filter_t(const portable_filter_t&);
+  portable_filter_t& operator=(const portable_filter_t&);
+
+  portable_filter_t(hash_filter_t* const p_filter,
+                    const uint32_t p_block_size,
+                    const std::string& p_block_hash_algorithm,
+                    const size_t p_prefix_size) :
+           filter(p_filter), block_size(p_block_size),
+           block_hash_algorithm(p_block_hash_algorithm),
+           prefix_size(p_prefix_size) {
+  }
+
+  public:
+  const uint32_t block_size;
+  const std::string block_hash_algorithm;
+  const size_t prefix_size;  // bytes of each hash that are looked up
+
+  /**
+   * Create an empty filter sized for num_keys hash prefixes of
+   * p_prefix_size bytes.
+   */
+  portable_filter_t(const uint64_t num_keys,
+                    const uint32_t p_block_size,
+                    const std::string& p_block_hash_algorithm,
+                    const size_t p_prefix_size) :
+           filter(new hash_filter_t(0, num_keys)), block_size(p_block_size),
+           block_hash_algorithm(p_block_hash_algorithm),
+           prefix_size(p_prefix_size) {
+  }
+
+  ~portable_filter_t() {
+    delete filter;
+  }
+
+  // add a hash or hash prefix
+  void add(const void* const key, const size_t key_size) {
+    filter->add(key, (key_size < prefix_size) ? key_size : prefix_size);
+  }
+
+  // false if the block hash is certainly not in the hashdb
+  bool maybe_contains(const std::string& block_hash) const {
+    return filter->maybe_contains(block_hash.c_str(),
+                 (block_hash.size() < prefix_size) ?
+                                     block_hash.size() : prefix_size);
+  }
+
+  /**
+   * True if filename is a filter file, so that it is scanned against in
+   * place of a hashdb directory.
+   */
+  static bool is_filter_file(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    char magic[8];
+    in.read(magic, sizeof(magic));
+    return in.good() && memcmp(magic, "hdbpflt", 8) == 0;
+  }
+
+  /**
+   * Read the filter from filename.  Returns NULL and sets error_message
+   * if the file cannot be read or is not a filter of a known version.
+   */
+  static portable_filter_t* read(const std::string& filename,
+                                 std::string& error_message) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      error_message = "Unable to open filter file '" + filename + "'.";
+      return NULL;
+    }
+    file_header_t header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in.good() || memcmp(header.magic, "hdbpflt", 8) != 0) {
+      error_message = "'" + filename + "' is not a filter file.";
+      return NULL;
+    }
+    if (header.version != file_version) {
+      error_message = "Filter file '" + filename +
+                      "' has an unsupported version.";
+      return NULL;
+    }
+    if (header.num_blocks == 0 || header.num_blocks > 0xffffffffULL ||
+        header.prefix_size == 0 ||
+        header.block_hash_algorithm[sizeof(header.block_hash_algorithm) - 1]
+                                                                     != 0) {
+      error_message = "Filter file '" + filename + "' is corrupt.";
+      return NULL;
+    }
+    hash_filter_t* const filter =
+                new hash_filter_t(0, header.num_keys, header.num_blocks);
+    in.read(reinterpret_cast<char*>(&filter->words[0]),
+            filter->words.size() * sizeof(uint32_t));
+    if (!in.good()) {
+      delete filter;
+      error_message = "Filter file '" + filename + "' is truncated.";
+      return NULL;
+    }
+    return new portable_filter_t(filter, header.block_size,
+                                 header.block_hash_algorithm,
+                                 static_cast<size_t>(header.prefix_size));
+  }
+
+  /**
+   * Write the filter to filename, replacing any existing file.  Returns
+   * "" if successful else reason if not.
+   */
+  std::string write(const std::string& filename) const {
+    file_header_t header;
+    memset(&header, 0, sizeof(header));
+    if (block_hash_algorithm.size() >= sizeof(header.block_hash_algorithm)) {
+      return "Block hash algorithm name '" + block_hash_algorithm +
+             "' is too long for a filter file.";
+    }
+    memcpy(header.magic, "hdbpflt", 8);
+    header.version = file_version;
+    header.block_size = block_size;
+    memcpy(header.block_hash_algorithm, block_hash_algorithm.c_str(),
+           block_hash_algorithm.size());
+    header.prefix_size = prefix_size;
+    header.num_keys = filter->num_keys;
+    header.num_blocks = filter->num_blocks;
+
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return "Unable to create filter file '" + filename + "'.";
+    }
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(&filter->words[0]),
+              filter->words.size() * sizeof(uint32_t));
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return "Unable to write filter file '" + filename + "'.";
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return "Unable to replace filter file '" + filename + "'.";
+    }
+    return "";
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
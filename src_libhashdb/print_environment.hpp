@@ -33,6 +33,7 @@
 
 #include <iostream>
 #include <cstring>
+#include "hashdb.hpp"
 
 namespace hashdb {
 
@@ -50,6 +51,9 @@ namespace hashdb {
 #endif
     os << "\n";
 
+    // kernels selected for this CPU
+    os << "# cpu kernels: " << hashdb::cpu_kernels() << "\n";
+
     // username
 #ifdef HAVE_GETPWUID
     os << "# username: " << getpwuid(getuid())->pw_name << "\n";
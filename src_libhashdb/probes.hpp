@@ -0,0 +1,66 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Static tracepoints for profiling ingest and scan without rebuilding.
+ *
+ * When SystemTap's sys/sdt.h is available, each probe is a USDT probe of
+ * provider hashdb that bcc, bpftrace, perf, and SystemTap can attach to,
+ * for example:
+ *
+ *   bpftrace -e 'usdt:.libs/libhashdb.so:hashdb:job_start { ... }'
+ *
+ * An unattached probe is one nop instruction and tracers read its
+ * arguments in place, so disabled probes cost next to nothing.  Without
+ * sys/sdt.h, or with --disable-probes, probes compile away.
+ *
+ * Probes and arguments:
+ *   job_dispatch(job_type, file_offset, data_size) - ingest queues a job.
+ *   job_start(job_type, file_offset, data_size) - a thread starts a job.
+ *   job_end(job_type, file_offset, data_size) - the job is done.
+ *   txn_begin(env, is_read_only) - an LMDB transaction begins, not
+ *     counting renewed cached read transactions.
+ *   txn_commit(env) - a writable LMDB transaction is about to commit.
+ *   txn_committed(env) - the commit is done.
+ *   map_grow(env, old_map_size, new_map_size) - maybe_grow grows a map.
+ *   scan_batch_put(queue, sequence_id, size) - a scanned batch is put
+ *     on its scan_stream queue.
+ *   scan_batch_get(queue, sequence_id, size) - a caller gets a scanned
+ *     batch from its queue.
+ */
+
+#ifndef PROBES_HPP
+#define PROBES_HPP
+
+#include <config.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define HASHDB_PROBE1(name, a) DTRACE_PROBE1(hashdb, name, a)
+#define HASHDB_PROBE2(name, a, b) DTRACE_PROBE2(hashdb, name, a, b)
+#define HASHDB_PROBE3(name, a, b, c) DTRACE_PROBE3(hashdb, name, a, b, c)
+#else
+#define HASHDB_PROBE1(name, a) do { (void)(a); } while (0)
+#define HASHDB_PROBE2(name, a, b) do { (void)(a); (void)(b); } while (0)
+#define HASHDB_PROBE3(name, a, b, c) \
+        do { (void)(a); (void)(b); (void)(c); } while (0)
+#endif
+
+#endif
@@ -0,0 +1,349 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides the async_scan_t interface.  Submitted batches wait in a
+ * request queue for a pool of scan threads.  Each thread scans a whole
+ * batch and completes it by callback, by future, or by queueing its
+ * results and signaling the event file descriptor.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
+#include "hashdb.hpp"
+#include "num_cpus.hpp"
+
+namespace scan_stream {
+
+  // a submitted batch and how to complete it
+  struct async_request_t {
+    const uint64_t request_id;
+    const std::vector<std::string> block_hashes;
+    hashdb::scan_completion_t completion;     // or NULL
+    void* completion_data;
+#if __cplusplus >= 201103L
+    std::promise<hashdb::hash_results_t>* promise; // or NULL
+#endif
+    async_request_t(const uint64_t p_request_id,
+                    const std::vector<std::string>& p_block_hashes) :
+              request_id(p_request_id), block_hashes(p_block_hashes),
+              completion(NULL), completion_data(NULL)
+#if __cplusplus >= 201103L
+              , promise(NULL)
+#endif
+    {
+    }
+
+    private:
+    // do not allow copy or assignment
+    async_request_t(const async_request_t&);
+    async_request_t& operator=(const async_request_t&);
+  };
+
+  // results queued for get_completed
+  typedef std::pair<uint64_t, hashdb::hash_results_t*> async_completed_t;
+
+  class async_scan_data_t {
+    private:
+    // do not allow copy or assignment
+    async_scan_data_t(const async_scan_data_t&);
+    async_scan_data_t& operator=(const async_scan_data_t&);
+
+    public:
+    const hashdb::scan_manager_t* const scan_manager;
+    std::vector< ::pthread_t> threads;
+    std::deque<async_request_t*> requests;
+    std::deque<async_completed_t> completed;
+    uint64_t next_request_id;
+    size_t active;                 // submitted and not yet completed
+    bool closed;
+    pthread_mutex_t M;             // mutex
+    pthread_cond_t request_available;
+    pthread_cond_t idle;
+    int read_fd;                   // event_fd, or -1
+    int write_fd;                  // signals read_fd, or -1
+
+    async_scan_data_t(const hashdb::scan_manager_t* const p_scan_manager) :
+              scan_manager(p_scan_manager), threads(), requests(),
+              completed(), next_request_id(0), active(0), closed(false),
+              M(), request_available(), idle(),
+              read_fd(-1), write_fd(-1) {
+      if(pthread_mutex_init(&M,NULL)) {
+        std::cerr << "Error obtaining mutex.\n";
+        assert(0);
+      }
+      if(pthread_cond_init(&request_available,NULL) ||
+         pthread_cond_init(&idle,NULL)) {
+        std::cerr << "Error obtaining condition variable.\n";
+        assert(0);
+      }
+
+      // open the event file descriptor
+#if defined(HAVE_SYS_EVENTFD_H)
+      read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      write_fd = read_fd;
+#elif !defined(WIN32)
+      int fds[2];
+      if (pipe(fds) == 0) {
+        read_fd = fds[0];
+        write_fd = fds[1];
+        fcntl(read_fd, F_SETFL, O_NONBLOCK);
+        fcntl(write_fd, F_SETFL, O_NONBLOCK);
+      }
+#endif
+    }
+
+    ~async_scan_data_t() {
+      if (read_fd != -1) {
+        close(read_fd);
+      }
+      if (write_fd != -1 && write_fd != read_fd) {
+        close(write_fd);
+      }
+      pthread_cond_destroy(&request_available);
+      pthread_cond_destroy(&idle);
+      pthread_mutex_destroy(&M);
+    }
+
+    // make read_fd readable.  A full pipe is already readable.
+    void signal() {
+      if (write_fd == -1) {
+        return;
+      }
+#ifdef HAVE_SYS_EVENTFD_H
+      const uint64_t one = 1;
+      const ssize_t count = write(write_fd, &one, sizeof(one));
+#else
+      const char one = 1;
+      const ssize_t count = write(write_fd, &one, sizeof(one));
+#endif
+      (void)count;
+    }
+
+    // queue a request and wake a scan thread
+    uint64_t submit(async_request_t* const request) {
+      pthread_mutex_lock(&M);
+      const uint64_t request_id = request->request_id;
+      requests.push_back(request);
+      pthread_cond_signal(&request_available);
+      pthread_mutex_unlock(&M);
+      return request_id;
+    }
+
+    // take the next request ID
+    uint64_t take_request_id() {
+      pthread_mutex_lock(&M);
+      const uint64_t request_id = next_request_id++;
+      ++active;
+      pthread_mutex_unlock(&M);
+      return request_id;
+    }
+  };
+
+  // scan the batch of a request into results
+  static void scan_request(const hashdb::scan_manager_t& scan_manager,
+                           const async_request_t& request,
+                           hashdb::hash_results_t& results) {
+    results.resize(request.block_hashes.size());
+    for (size_t i=0; i<request.block_hashes.size(); ++i) {
+      hashdb::hash_result_t& result = results[i];
+      result.block_hash = request.block_hashes[i];
+      result.found = scan_manager.find_hash(result.block_hash,
+                                           result.k_entropy,
+                                           result.block_label,
+                                           result.count,
+                                           result.source_sub_counts);
+    }
+  }
+
+  static void* run(void* const arg) {
+    async_scan_data_t* const data = static_cast<async_scan_data_t*>(arg);
+    while (true) {
+      // wait for a request
+      pthread_mutex_lock(&data->M);
+      while (data->requests.empty() && !data->closed) {
+        pthread_cond_wait(&data->request_available, &data->M);
+      }
+      if (data->requests.empty()) {
+        pthread_mutex_unlock(&data->M);
+        return 0;
+      }
+      async_request_t* const request = data->requests.front();
+      data->requests.pop_front();
+      pthread_mutex_unlock(&data->M);
+
+      // scan and complete it
+      hashdb::hash_results_t* results = new hashdb::hash_results_t;
+      scan_request(*data->scan_manager, *request, *results);
+      bool is_queued = false;
+      if (request->completion != NULL) {
+        request->completion(request->completion_data,
+                            request->request_id, *results);
+#if __cplusplus >= 201103L
+      } else if (request->promise != NULL) {
+        request->promise->set_value(std::move(*results));
+        delete request->promise;
+#endif
+      } else {
+        is_queued = true;
+      }
+
+      pthread_mutex_lock(&data->M);
+      if (is_queued) {
+        data->completed.push_back(async_completed_t(request->request_id,
+                                                    results));
+        results = NULL;
+        data->signal();
+      }
+      --data->active;
+      if (data->active == 0) {
+        pthread_cond_broadcast(&data->idle);
+      }
+      pthread_mutex_unlock(&data->M);
+      delete results;
+      delete request;
+    }
+  }
+} // end namespace scan_stream
+
+namespace hashdb {
+
+  hash_result_t::hash_result_t() :
+          block_hash(), found(false), k_entropy(0), block_label(),
+          count(0), source_sub_counts() {
+  }
+
+  async_scan_t::async_scan_t(const scan_manager_t* const scan_manager,
+                             const int num_threads) :
+          data(new scan_stream::async_scan_data_t(scan_manager)) {
+    const int count = (num_threads > 0) ? num_threads : hashdb::numCPU();
+    data->threads.resize(count);
+    for (int i=0; i<count; i++) {
+      const int rc = ::pthread_create(&data->threads[i], NULL,
+                                      scan_stream::run, (void*)data);
+      if (rc != 0) {
+        std::cerr << "Unable to start async_scan thread: "
+                  << strerror(rc) << ".\n";
+        assert(0);
+      }
+    }
+  }
+
+  async_scan_t::~async_scan_t() {
+    // finish the submitted batches and stop the threads
+    wait_idle();
+    pthread_mutex_lock(&data->M);
+    data->closed = true;
+    pthread_cond_broadcast(&data->request_available);
+    pthread_mutex_unlock(&data->M);
+    for (size_t i=0; i<data->threads.size(); i++) {
+      ::pthread_join(data->threads[i], NULL);
+    }
+
+    // discard results not retrieved
+    for (size_t i=0; i<data->completed.size(); ++i) {
+      delete data->completed[i].second;
+    }
+    delete data;
+  }
+
+  uint64_t async_scan_t::submit(const std::vector<std::string>& block_hashes,
+                                scan_completion_t completion,
+                                void* const completion_data) {
+    scan_stream::async_request_t* const request =
+                      new scan_stream::async_request_t(
+                                data->take_request_id(), block_hashes);
+    request->completion = completion;
+    request->completion_data = completion_data;
+    return data->submit(request);
+  }
+
+  uint64_t async_scan_t::submit(
+                      const std::vector<std::string>& block_hashes) {
+    return data->submit(new scan_stream::async_request_t(
+                                data->take_request_id(), block_hashes));
+  }
+
+#if __cplusplus >= 201103L
+  std::future<hash_results_t> async_scan_t::submit_future(
+                      const std::vector<std::string>& block_hashes) {
+    scan_stream::async_request_t* const request =
+                      new scan_stream::async_request_t(
+                                data->take_request_id(), block_hashes);
+    request->promise = new std::promise<hash_results_t>;
+    std::future<hash_results_t> future = request->promise->get_future();
+    data->submit(request);
+    return future;
+  }
+#endif
+
+  int async_scan_t::event_fd() const {
+    return data->read_fd;
+  }
+
+  bool async_scan_t::get_completed(uint64_t& request_id,
+                                   hash_results_t& results) {
+    pthread_mutex_lock(&data->M);
+    if (data->completed.empty()) {
+      pthread_mutex_unlock(&data->M);
+      return false;
+    }
+    request_id = data->completed.front().first;
+    hash_results_t* const completed_results = data->completed.front().second;
+    data->completed.pop_front();
+    pthread_mutex_unlock(&data->M);
+    results.swap(*completed_results);
+    delete completed_results;
+    return true;
+  }
+
+  void async_scan_t::wait_idle() {
+    pthread_mutex_lock(&data->M);
+    while (data->active != 0) {
+      pthread_cond_wait(&data->idle, &data->M);
+    }
+    pthread_mutex_unlock(&data->M);
+  }
+} // end namespace hashdb
@@ -0,0 +1,522 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides the remote_scan_stream_t interface, a scan_stream_t that
+ * scans through a hashdb server, see src/scan_server.hpp for the
+ * protocol.
+ *
+ * Records put on the stream are coalesced into requests of about
+ * batch_size bytes, and up to max_in_flight requests are sent before
+ * put waits for a response.  A reader thread receives the responses.
+ * Hashes that a response shows as missing are kept in a bounded
+ * negative cache, oldest first out, and are not sent again while they
+ * are in it.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <sys/time.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#endif
+#include "hashdb.hpp"
+#include "tprint.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+namespace scan_stream {
+
+  static const size_t header_size = 16;
+
+  static uint64_t get_le(const char* const p, const size_t size) {
+    uint64_t value = 0;
+    for (size_t i=size; i>0; --i) {
+      value = (value << 8) | static_cast<uint8_t>(p[i-1]);
+    }
+    return value;
+  }
+
+  static void put_le(std::string& s, uint64_t value, const size_t size) {
+    for (size_t i=0; i<size; ++i) {
+      s += static_cast<char>(value & 0xff);
+      value >>= 8;
+    }
+  }
+
+  class remote_stream_data_t {
+    private:
+    // do not allow copy or assignment
+    remote_stream_data_t(const remote_stream_data_t&);
+    remote_stream_data_t& operator=(const remote_stream_data_t&);
+
+    public:
+    int fd;
+    const size_t hash_size;
+    const size_t batch_size;
+    const size_t max_in_flight;
+    const size_t negative_cache_size;
+
+    // guarded by M
+    std::string error_message;
+    std::string pending;                    // records of the next request
+    std::vector<std::string> pending_hashes;
+    uint64_t next_id;
+    std::map<uint64_t, std::vector<std::string> > in_flight;
+    std::deque<std::string> scanned;
+    std::set<std::string> missed;           // the negative cache
+    std::deque<std::string> missed_order;   // oldest first
+    bool closing;
+
+    pthread_mutex_t M;       // guards the state
+    pthread_mutex_t W;       // serializes writers
+    pthread_cond_t changed;  // signals responses and errors
+    pthread_t reader;
+    bool has_reader;
+
+    remote_stream_data_t(const size_t p_hash_size,
+                         const size_t p_batch_size,
+                         const size_t p_max_in_flight,
+                         const size_t p_negative_cache_size) :
+          fd(-1), hash_size(p_hash_size),
+          batch_size((p_batch_size > 0) ? p_batch_size : 1),
+          max_in_flight((p_max_in_flight > 0) ? p_max_in_flight : 1),
+          negative_cache_size(p_negative_cache_size),
+          error_message(""), pending(), pending_hashes(), next_id(0),
+          in_flight(), scanned(), missed(), missed_order(), closing(false),
+          M(), W(), changed(), reader(), has_reader(false) {
+      pthread_mutex_init(&M, NULL);
+      pthread_mutex_init(&W, NULL);
+      pthread_cond_init(&changed, NULL);
+    }
+
+    ~remote_stream_data_t() {
+      pthread_cond_destroy(&changed);
+      pthread_mutex_destroy(&W);
+      pthread_mutex_destroy(&M);
+    }
+
+    // record the first error and wake waiters, call with M locked
+    void fail(const std::string& message) {
+      if (error_message.size() == 0) {
+        error_message = message;
+      }
+      pthread_cond_broadcast(&changed);
+    }
+
+    // remember a missing hash, call with M locked
+    void add_missed(const std::string& hash) {
+      if (negative_cache_size == 0 || !missed.insert(hash).second) {
+        return;
+      }
+      missed_order.push_back(hash);
+      if (missed_order.size() > negative_cache_size) {
+        missed.erase(missed_order.front());
+        missed_order.pop_front();
+      }
+    }
+
+    bool is_idle() const {
+      return error_message.size() != 0 || in_flight.size() == 0;
+    }
+  };
+
+#ifndef WIN32
+  static bool send_all(const int fd, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      const ssize_t count = send(fd, data.data() + sent, data.size() - sent,
+                                 MSG_NOSIGNAL);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        return false;
+      }
+      sent += static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  static bool recv_all(const int fd, char* const buffer, const size_t size) {
+    size_t received = 0;
+    while (received < size) {
+      const ssize_t count = recv(fd, buffer + received, size - received, 0);
+      if (count < 0 && errno == EINTR) {
+        continue;
+      }
+      if (count <= 0) {
+        return false;
+      }
+      received += static_cast<size_t>(count);
+    }
+    return true;
+  }
+
+  // receive responses until the connection closes
+  static void* run_reader(void* const arg) {
+    remote_stream_data_t& d = *static_cast<remote_stream_data_t*>(arg);
+    std::vector<char> payload;
+    while (true) {
+      char header[header_size];
+      if (!recv_all(d.fd, header, header_size)) {
+        break;
+      }
+      const size_t size = static_cast<size_t>(get_le(header, 4));
+      const uint64_t status = get_le(header + 4, 4);
+      const uint64_t request_id = get_le(header + 8, 8);
+      payload.resize(size + 1);
+      if (!recv_all(d.fd, &payload[0], size)) {
+        break;
+      }
+
+      // convert the matches to scan_stream_t output and note their hashes
+      std::string scanned_array;
+      std::set<std::string> matched;
+      size_t index = 0;
+      while (size - index >= d.hash_size + 2) {
+        const char* const p = &payload[index];
+        const uint16_t label_size = static_cast<uint16_t>(
+                                          get_le(p + d.hash_size, 2));
+        const size_t json_at = d.hash_size + 2 + label_size;
+        if (size - index < json_at + 4) {
+          break;
+        }
+        const uint32_t json_size = static_cast<uint32_t>(
+                                          get_le(p + json_at, 4));
+        if (size - index - json_at - 4 < json_size) {
+          break;
+        }
+        matched.insert(std::string(p, d.hash_size));
+        scanned_array.append(p, d.hash_size);
+        scanned_array.append(reinterpret_cast<const char*>(&label_size),
+                             sizeof(uint16_t));
+        scanned_array.append(p + d.hash_size + 2, label_size);
+        scanned_array.append(reinterpret_cast<const char*>(&json_size),
+                             sizeof(uint32_t));
+        scanned_array.append(p + json_at + 4, json_size);
+        index += json_at + 4 + json_size;
+      }
+      if (status != 0) {
+        hashdb::tprint(std::cerr,
+                  "Warning: the hashdb server rejected a request.\n");
+      }
+
+      pthread_mutex_lock(&d.M);
+      std::map<uint64_t, std::vector<std::string> >::iterator it =
+                                               d.in_flight.find(request_id);
+      if (it != d.in_flight.end()) {
+        for (size_t i=0; i<it->second.size(); ++i) {
+          if (matched.find(it->second[i]) == matched.end()) {
+            d.add_missed(it->second[i]);
+          }
+        }
+        d.in_flight.erase(it);
+      }
+      if (scanned_array.size() > 0) {
+        d.scanned.push_back("");
+        d.scanned.back().swap(scanned_array);
+      }
+      pthread_cond_broadcast(&d.changed);
+      pthread_mutex_unlock(&d.M);
+    }
+
+    pthread_mutex_lock(&d.M);
+    d.fail(d.closing ? "closed" : "the hashdb server closed the connection");
+    pthread_mutex_unlock(&d.M);
+    return NULL;
+  }
+
+  // connect to address, [host:]port, return "" or the reason
+  static std::string connect_to(const std::string& address, int& fd) {
+    std::string host = "127.0.0.1";
+    std::string port = address;
+    const size_t colon = address.rfind(':');
+    if (colon != std::string::npos) {
+      host = address.substr(0, colon);
+      port = address.substr(colon + 1);
+    }
+    char* end;
+    const long port_number = strtol(port.c_str(), &end, 10);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (port.size() == 0 || *end != '\0' || port_number <= 0 ||
+        port_number > 65535 ||
+        inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+      return "invalid address '" + address + "', expected [host:]port";
+    }
+    addr.sin_port = htons(static_cast<uint16_t>(port_number));
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return strerror(errno);
+    }
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                sizeof(addr)) != 0) {
+      const std::string reason = strerror(errno);
+      close(fd);
+      fd = -1;
+      return "unable to connect to " + address + ": " + reason;
+    }
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return "";
+  }
+
+  // send the pending records as one request, call with W locked
+  static void flush(remote_stream_data_t& d) {
+    pthread_mutex_lock(&d.M);
+    while (d.error_message.size() == 0 && d.pending.size() > 0 &&
+           d.in_flight.size() >= d.max_in_flight) {
+      pthread_cond_wait(&d.changed, &d.M);
+    }
+    if (d.error_message.size() != 0 || d.pending.size() == 0) {
+      d.pending.clear();
+      d.pending_hashes.clear();
+      pthread_mutex_unlock(&d.M);
+      return;
+    }
+    const uint64_t request_id = d.next_id++;
+    std::string request;
+    put_le(request, d.pending.size(), 4);
+    put_le(request, d.hash_size, 4);
+    put_le(request, request_id, 8);
+    request += d.pending;
+    d.pending.clear();
+    d.in_flight[request_id].swap(d.pending_hashes);
+    pthread_mutex_unlock(&d.M);
+
+    if (!send_all(d.fd, request)) {
+      pthread_mutex_lock(&d.M);
+      d.fail(std::string("unable to send to the hashdb server: ") +
+             strerror(errno));
+      pthread_mutex_unlock(&d.M);
+    }
+  }
+
+  // a deadline timeout_milliseconds from now
+  static struct timespec deadline_after(const size_t timeout_milliseconds) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const uint64_t usec = now.tv_usec +
+                          static_cast<uint64_t>(timeout_milliseconds) * 1000;
+    struct timespec until;
+    until.tv_sec = now.tv_sec + usec / 1000000;
+    until.tv_nsec = (usec % 1000000) * 1000;
+    return until;
+  }
+#endif
+}
+
+namespace hashdb {
+
+  remote_scan_stream_t::remote_scan_stream_t(const std::string& address,
+                                             const size_t hash_size,
+                                             const size_t batch_size,
+                                             const size_t max_in_flight,
+                                             const size_t negative_cache_size) :
+        data(new scan_stream::remote_stream_data_t(hash_size, batch_size,
+                                  max_in_flight, negative_cache_size)) {
+#ifdef WIN32
+    data->error_message = "remote scanning is not available on Windows";
+#else
+    if (hash_size == 0) {
+      data->error_message = "invalid hash size 0";
+      return;
+    }
+    data->error_message = scan_stream::connect_to(address, data->fd);
+    if (data->error_message.size() == 0) {
+      if (pthread_create(&data->reader, NULL, scan_stream::run_reader,
+                         data) != 0) {
+        data->error_message = "unable to start the remote scan thread";
+      } else {
+        data->has_reader = true;
+      }
+    }
+#endif
+    if (data->error_message.size() != 0) {
+      std::cerr << "Error: " << data->error_message << "\n";
+    }
+  }
+
+  remote_scan_stream_t::~remote_scan_stream_t() {
+#ifndef WIN32
+    if (data->has_reader) {
+      pthread_mutex_lock(&data->M);
+      data->closing = true;
+      pthread_mutex_unlock(&data->M);
+      shutdown(data->fd, SHUT_RDWR);
+      pthread_join(data->reader, NULL);
+    }
+    if (data->fd >= 0) {
+      close(data->fd);
+    }
+#endif
+    delete data;
+  }
+
+  std::string remote_scan_stream_t::error_message() const {
+    pthread_mutex_lock(&data->M);
+    const std::string message = data->error_message;
+    pthread_mutex_unlock(&data->M);
+    return message;
+  }
+
+  uint64_t remote_scan_stream_t::put(const std::string& unscanned_data) {
+    return put(unscanned_data.data(), unscanned_data.size());
+  }
+
+  uint64_t remote_scan_stream_t::put(const char* const unscanned_data,
+                                     const size_t size) {
+    scan_stream::remote_stream_data_t& d = *data;
+    pthread_mutex_lock(&d.W);
+    pthread_mutex_lock(&d.M);
+    const uint64_t request_id = d.next_id;
+
+    // add the records not known to be missing, in little-endian form
+    const size_t hash_size = d.hash_size;
+    size_t index = 0;
+    std::string hash;
+    while (index < size) {
+      uint16_t label_size;
+      if (size - index < hash_size + sizeof(uint16_t)) {
+        std::cerr << "Unexpected end of data error in unscanned data size "
+                  << size << " index " << index << ".\n";
+        break;
+      }
+      std::memcpy(&label_size, unscanned_data + index + hash_size,
+                  sizeof(uint16_t));
+      if (size - index - hash_size - sizeof(uint16_t) < label_size) {
+        std::cerr << "Unexpected end of data error in unscanned data size "
+                  << size << " index " << index << " while reading label.\n";
+        break;
+      }
+      hash.assign(unscanned_data + index, hash_size);
+      if (d.missed.find(hash) == d.missed.end()) {
+        d.pending.append(hash);
+        scan_stream::put_le(d.pending, label_size, 2);
+        d.pending.append(unscanned_data + index + hash_size +
+                         sizeof(uint16_t), label_size);
+        if (d.negative_cache_size != 0) {
+          d.pending_hashes.push_back(hash);
+        }
+      }
+      index += hash_size + sizeof(uint16_t) + label_size;
+#ifndef WIN32
+      if (d.pending.size() >= d.batch_size) {
+        pthread_mutex_unlock(&d.M);
+        scan_stream::flush(d);
+        pthread_mutex_lock(&d.M);
+      }
+#endif
+    }
+    pthread_mutex_unlock(&d.M);
+    pthread_mutex_unlock(&d.W);
+    return request_id;
+  }
+
+  std::string remote_scan_stream_t::get() {
+    return get(0);
+  }
+
+  std::string remote_scan_stream_t::get(const size_t timeout_milliseconds) {
+    scan_stream::remote_stream_data_t& d = *data;
+#ifndef WIN32
+    pthread_mutex_lock(&d.W);
+    scan_stream::flush(d);
+    pthread_mutex_unlock(&d.W);
+    const struct timespec until =
+                     scan_stream::deadline_after(timeout_milliseconds);
+#endif
+    std::string scanned_array;
+    pthread_mutex_lock(&d.M);
+#ifndef WIN32
+    while (d.scanned.empty() && !d.is_idle() && timeout_milliseconds > 0) {
+      if (pthread_cond_timedwait(&d.changed, &d.M, &until) != 0) {
+        // timed out
+        break;
+      }
+    }
+#endif
+    if (!d.scanned.empty()) {
+      scanned_array.swap(d.scanned.front());
+      d.scanned.pop_front();
+    }
+    pthread_mutex_unlock(&d.M);
+    return scanned_array;
+  }
+
+  bool remote_scan_stream_t::empty() {
+    scan_stream::remote_stream_data_t& d = *data;
+#ifndef WIN32
+    pthread_mutex_lock(&d.W);
+    scan_stream::flush(d);
+    pthread_mutex_unlock(&d.W);
+#endif
+    pthread_mutex_lock(&d.M);
+    const bool is_empty = d.is_idle() && d.scanned.empty();
+    pthread_mutex_unlock(&d.M);
+    return is_empty;
+  }
+
+  void remote_scan_stream_t::wait_empty() {
+    scan_stream::remote_stream_data_t& d = *data;
+#ifndef WIN32
+    pthread_mutex_lock(&d.W);
+    scan_stream::flush(d);
+    pthread_mutex_unlock(&d.W);
+#endif
+    pthread_mutex_lock(&d.M);
+    while (!d.is_idle()) {
+      pthread_cond_wait(&d.changed, &d.M);
+    }
+    pthread_mutex_unlock(&d.M);
+  }
+}
@@ -0,0 +1,624 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A pool of scanner threads, see scan_pool.hpp.
+ */
+#include <config.h>
+// this process of getting WIN32 defined was inspired
+// from i686-w64-mingw32/sys-root/mingw/include/windows.h.
+// All this to include winsock2.h before windows.h to avoid a warning.
+#if defined(__MINGW64__) && defined(__cplusplus)
+#  ifndef WIN32
+#    define WIN32
+#  endif
+#endif
+#ifdef WIN32
+  // including winsock2.h now keeps an included header somewhere from
+  // including windows.h first, resulting in a warning.
+  #include <winsock2.h>
+#endif
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <stdint.h>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+#include <pthread.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <sched.h>  // cpu_set_t
+#endif
+#include "scan_pool.hpp"
+#include "scan_thread_data.hpp"
+#include "num_cpus.hpp"
+#include "numa_nodes.hpp"
+#include "tprint.hpp"
+#include "stage_stats.hpp"   // stage_clock_ns, stage_record
+
+// report truncated unscanned data
+static void report_truncated(const size_t size, const size_t index,
+                             const char* const field) {
+  std::stringstream ss;
+  ss << "Unexpected end of data error in unscanned data size "
+     << size << " index " << index << " while reading " << field << ".\n";
+  hashdb::tprint(std::cerr, ss.str());
+}
+
+// scan one unscanned array in scan mode EXISTS into a membership bitmap,
+// packing its hashes into hashes
+static void scan_array_exists(
+                const scan_stream::scan_thread_data_t* const scan_thread_data,
+                hashdb::scan_manager_t* const scan_manager,
+                const std::string& unscanned_array,
+                std::string& scanned_array,
+                std::string& hashes) {
+
+  // gather the hashes
+  const size_t hash_size = scan_thread_data->hash_size;
+  const char* const begin = unscanned_array.data();
+  const size_t size = unscanned_array.size();
+  hashes.clear();
+  size_t index = 0;
+  while (index < size) {
+    if (size - index < hash_size + sizeof(uint16_t)) {
+      report_truncated(size, index, "hash");
+      break;
+    }
+    uint16_t char_label_length;
+    std::memcpy(&char_label_length, begin + index + hash_size,
+                sizeof(uint16_t));
+    if (size - index - hash_size - sizeof(uint16_t) < char_label_length) {
+      report_truncated(size, index, "label");
+      break;
+    }
+    hashes.append(begin + index, hash_size);
+    index += hash_size + sizeof(uint16_t) + char_label_length;
+  }
+
+  // one bit per record
+  const size_t count = hashes.size() / hash_size;
+  scanned_array.assign((count + 7) / 8, '\0');
+  if (count != 0) {
+    scan_manager->find_hash_exists(hashes.data(),
+                   hashes.size(), hash_size,
+                   reinterpret_cast<uint8_t*>(&scanned_array[0]),
+                   scanned_array.size());
+  }
+}
+
+// scan one unscanned array into scanned_array using reusable buffers
+static void scan_array(
+                const scan_stream::scan_thread_data_t* const scan_thread_data,
+                hashdb::scan_manager_t* const scan_manager,
+                const std::string& unscanned_array,
+                std::string& scanned_array,
+                std::string& hash,
+                size_t& arena_size) {
+
+  if (scan_thread_data->scan_mode == hashdb::scan_mode_t::EXISTS) {
+    scan_array_exists(scan_thread_data, scan_manager, unscanned_array,
+                      scanned_array, hash);
+    return;
+  }
+
+  // preallocate the scanned output arena
+  scanned_array.clear();
+  scanned_array.reserve(arena_size);
+
+  // parse records in place
+  const char* const begin = unscanned_array.data();
+  const size_t size = unscanned_array.size();
+  size_t index = 0;
+  while (index < size) {
+
+    // char_hash
+    if (size - index < scan_thread_data->hash_size) {
+      report_truncated(size, index, "hash");
+      break;
+    }
+    const char* const char_hash = begin + index;
+    index += scan_thread_data->hash_size;
+
+    // char_label length, size uint16_t
+    if (size - index < sizeof(uint16_t)) {
+      report_truncated(size, index, "label length");
+      break;
+    }
+    uint16_t char_label_length;
+    std::memcpy(&char_label_length, begin + index, sizeof(uint16_t));
+    index += sizeof(uint16_t);
+
+    // char_label
+    if (size - index < char_label_length) {
+      report_truncated(size, index, "label");
+      break;
+    }
+    const char* const char_label = begin + index;
+    index += char_label_length;
+
+    // scan
+    hash.assign(char_hash, scan_thread_data->hash_size);
+    const std::string json_response =
+                scan_manager->find_hash_json(scan_thread_data->scan_mode,
+                                             hash);
+
+    if (json_response.size() > 0) {
+
+      // write char_hash
+      scanned_array.append(char_hash, scan_thread_data->hash_size);
+
+      // write char_label length
+      scanned_array.append(
+                      reinterpret_cast<const char*>(&char_label_length),
+                      sizeof(uint16_t));
+
+      // write char_label
+      scanned_array.append(char_label, char_label_length);
+
+      // write json_response length
+      const uint32_t json_response_length = json_response.size();
+      scanned_array.append(
+                      reinterpret_cast<const char*>(&json_response_length),
+                      sizeof(uint32_t));
+
+      // write json_response
+      scanned_array.append(json_response);
+    }
+  }
+
+  if (scanned_array.size() > arena_size) {
+    arena_size = scanned_array.size();
+  }
+}
+
+// get the CPUs named by a CPU list or by "node<N>", false if invalid
+static bool cpu_affinity_cpus(const std::string& cpu_affinity,
+                              std::vector<int>& cpus) {
+  if (cpu_affinity.compare(0, 4, "node") != 0) {
+    return hashdb::parse_cpu_list(cpu_affinity, cpus);
+  }
+
+  // read the CPU list of the NUMA node
+  const std::string filename = "/sys/devices/system/node/" +
+                               cpu_affinity + "/cpulist";
+  std::ifstream in(filename.c_str());
+  std::string cpu_list;
+  if (!in.is_open() || !std::getline(in, cpu_list)) {
+    return false;
+  }
+  return hashdb::parse_cpu_list(cpu_list, cpus);
+}
+
+// pin a thread to cpus, warns to stderr and returns false if not possible
+static bool pin_thread(const ::pthread_t thread,
+                       const std::vector<int>& cpus) {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (std::vector<int>::const_iterator it = cpus.begin();
+                                        it != cpus.end(); ++it) {
+    if (*it < CPU_SETSIZE) {
+      CPU_SET(*it, &cpu_set);
+    }
+  }
+  const int rc = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+  if (rc != 0) {
+    std::cerr << "Unable to set scan_stream CPU affinity: "
+              << strerror(rc) << ".\n";
+    return false;
+  }
+  return true;
+#else
+  (void)thread;
+  (void)cpus;
+  std::cerr << "CPU affinity is not supported on this platform, "
+            << "scan_stream threads will not be pinned.\n";
+  return false;
+#endif
+}
+
+namespace scan_stream {
+
+  // the process-wide shared pool and its number of users
+  static scan_pool_t* shared_pool = NULL;
+  static size_t shared_pool_users = 0;
+  static pthread_mutex_t shared_pool_M = PTHREAD_MUTEX_INITIALIZER;
+
+  void* scan_pool_t::run(void* const arg) {
+    const worker_t* const worker = static_cast<const worker_t*>(arg);
+    scan_pool_t* const scan_pool = worker->scan_pool;
+
+    // buffers reused across arrays so records are scanned without
+    // per-record heap allocation
+    std::vector<scan_task_t> batch;
+    std::string scanned_array;
+    std::string hash;
+
+    // output arena size, grows to the largest scanned array seen
+    size_t arena_size = 0;
+
+    // the cost of the last batch
+    size_t scanned_bytes = 0;
+    uint64_t scanned_ns = 0;
+
+    // get and process batches of input arrays until the pool is closed,
+    // sleeping while there is nothing to scan
+    // print warnings to stderr
+    while (scan_pool->wait_task(worker->node, scanned_bytes, scanned_ns,
+                                batch)) {
+      scanned_bytes = 0;
+      scanned_ns = 0;
+      for (std::vector<scan_task_t>::iterator it = batch.begin();
+                                              it != batch.end(); ++it) {
+        const uint64_t start = hashdb::stage_clock_ns();
+        hashdb::stage_record(hashdb::STAGE_SCAN_QUEUE_WAIT,
+                             start - it->queued_ns);
+        scan_array(it->scan_thread_data, it->scan_manager,
+                   it->unscanned_array, scanned_array, hash, arena_size);
+        const uint64_t ns = hashdb::stage_clock_ns() - start;
+        hashdb::stage_record(hashdb::STAGE_SCAN_ARRAY, ns);
+        scanned_ns += ns;
+        scanned_bytes += it->unscanned_array.size();
+
+        // move result back to the submitting stream, even if empty
+        it->scan_thread_data->scan_queue.put_scanned(it->sequence_id,
+                                                     it->part,
+                                                     scanned_array);
+
+        // the scan manager may now be closed if it was swapped out
+        it->scan_thread_data->release(it->scan_manager);
+      }
+    }
+
+    return 0;
+  }
+
+  scan_pool_t::scan_pool_t(const int p_num_threads,
+                           const std::string& cpu_affinity) :
+         num_threads((p_num_threads > 0) ? p_num_threads : hashdb::numCPU()),
+         threads(new ::pthread_t[num_threads]),
+         workers(new worker_t[num_threads]),
+         nodes(),
+         node_of_cpu(),
+         next_node(0),
+         closed(false),
+         ns_per_byte(5.0),  // about 100ns per record before measuring
+         M(), task_available(NULL) {
+
+    // the nodes, one per NUMA node in NUMA mode
+    if (cpu_affinity == "numa") {
+      std::vector<hashdb::numa_node_t> numa_nodes;
+      if (!hashdb::numa_nodes(numa_nodes)) {
+        std::cerr << "No NUMA nodes found, scan_stream threads will not "
+                  << "be pinned.\n";
+      }
+      for (size_t i=0; i<numa_nodes.size(); ++i) {
+        nodes.push_back(node_t());
+        nodes.back().node_id = numa_nodes[i].node_id;
+        nodes.back().cpus = numa_nodes[i].cpus;
+        for (size_t j=0; j<numa_nodes[i].cpus.size(); ++j) {
+          const size_t cpu = static_cast<size_t>(numa_nodes[i].cpus[j]);
+          if (node_of_cpu.size() <= cpu) {
+            node_of_cpu.resize(cpu + 1, -1);
+          }
+          node_of_cpu[cpu] = static_cast<int>(i);
+        }
+      }
+    }
+    if (nodes.size() == 0) {
+      nodes.push_back(node_t());
+      if (cpu_affinity != "" && cpu_affinity != "numa" &&
+          !cpu_affinity_cpus(cpu_affinity, nodes[0].cpus)) {
+        std::cerr << "Invalid scan_stream CPU affinity '" << cpu_affinity
+                  << "', threads will not be pinned.\n";
+      }
+    }
+
+    if(pthread_mutex_init(&M,NULL)) {
+      std::cerr << "Error obtaining mutex.\n";
+      assert(0);
+    }
+    task_available = new pthread_cond_t[nodes.size()];
+    for (size_t i=0; i<nodes.size(); ++i) {
+      if(pthread_cond_init(&task_available[i],NULL)) {
+        std::cerr << "Error obtaining condition variable.\n";
+        assert(0);
+      }
+    }
+
+    // open the scan threads, spread over the nodes
+    for (int i=0; i<num_threads; i++) {
+      workers[i].scan_pool = this;
+      workers[i].node = static_cast<size_t>(i) % nodes.size();
+      int rc = ::pthread_create(&threads[i], NULL, scan_pool_t::run,
+                                (void*)&workers[i]);
+      if (rc != 0) {
+        std::cerr << "Unable to start scan_stream thread: "
+                  << strerror(rc) << ".\n";
+        assert(0);
+      }
+    }
+
+    // maybe pin them
+    for (int i=0; i<num_threads; i++) {
+      const std::vector<int>& cpus = nodes[workers[i].node].cpus;
+      if (cpus.size() != 0 && !pin_thread(threads[i], cpus)) {
+        break;
+      }
+    }
+    hashdb::metrics_register(add_metrics, this);
+  }
+
+  scan_pool_t::~scan_pool_t() {
+    hashdb::metrics_unregister(this);
+
+    // wake and join each thread
+    lock();
+    closed = true;
+    for (size_t i=0; i<nodes.size(); ++i) {
+      pthread_cond_broadcast(&task_available[i]);
+    }
+    unlock();
+    for (int i=0; i<num_threads; i++) {
+      int status = pthread_join(threads[i], NULL);
+      if (status != 0) {
+        std::cerr << "Error in threadpool join: " << strerror(status) << ".\n";
+      }
+    }
+
+    for (size_t i=0; i<nodes.size(); ++i) {
+      pthread_cond_destroy(&task_available[i]);
+    }
+    pthread_mutex_destroy(&M);
+    delete[] task_available;
+    delete[] workers;
+    delete[] threads;
+  }
+
+  void scan_pool_t::add_metrics(const void* const data, const uint64_t id,
+                                hashdb::metric_samples_t& samples) {
+    const scan_pool_t* const p = static_cast<const scan_pool_t*>(data);
+    std::stringstream ss;
+    ss << "pool=\"" << id << "\"";
+    const std::string labels = ss.str();
+    pthread_mutex_lock(&p->M);
+    size_t num_tasks = 0;
+    for (size_t i=0; i<p->nodes.size(); ++i) {
+      num_tasks += p->nodes[i].tasks.size();
+    }
+    samples.push_back(hashdb::metric_sample_t("hashdb_scan_pool_tasks",
+                "gauge", "Unscanned arrays waiting for a scanner thread.",
+                labels, static_cast<double>(num_tasks)));
+    samples.push_back(hashdb::metric_sample_t("hashdb_scan_pool_threads",
+                "gauge", "Scanner threads in the pool.", labels,
+                static_cast<double>(p->num_threads)));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_pool_ns_per_byte", "gauge",
+                "Measured scan time per byte of unscanned data, used to "
+                "size batches.", labels, p->ns_per_byte));
+
+    // where arrays were queued and scanned, in NUMA mode
+    for (size_t i=0; i<p->nodes.size() && p->node_of_cpu.size() != 0;
+         ++i) {
+      const node_t& node = p->nodes[i];
+      std::stringstream node_ss;
+      node_ss << labels << ",node=\"" << node.node_id << "\"";
+      const std::string node_labels = node_ss.str();
+      samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_pool_node_tasks", "gauge",
+                "Unscanned arrays waiting on a NUMA node.", node_labels,
+                static_cast<double>(node.tasks.size())));
+      samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_pool_node_routed_total", "counter",
+                "Unscanned arrays queued on a NUMA node.", node_labels,
+                static_cast<double>(node.routed)));
+      samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_pool_node_scanned_total", "counter",
+                "Arrays queued on a NUMA node and scanned by its own or "
+                "by another node's threads.",
+                node_labels + ",by=\"local\"",
+                static_cast<double>(node.scanned_local)));
+      samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_pool_node_scanned_total", "counter",
+                "Arrays queued on a NUMA node and scanned by its own or "
+                "by another node's threads.",
+                node_labels + ",by=\"remote\"",
+                static_cast<double>(node.scanned_remote)));
+    }
+    pthread_mutex_unlock(&p->M);
+  }
+
+  size_t scan_pool_t::route() {
+    if (nodes.size() == 1) {
+      return 0;
+    }
+    const int cpu = hashdb::current_cpu();
+    if (cpu >= 0 && static_cast<size_t>(cpu) < node_of_cpu.size() &&
+        node_of_cpu[cpu] >= 0) {
+      return static_cast<size_t>(node_of_cpu[cpu]);
+    }
+    next_node = (next_node + 1) % nodes.size();
+    return next_node;
+  }
+
+  size_t scan_pool_t::target_bytes(const uint64_t latency_ns) const {
+    const double bytes = static_cast<double>(latency_ns) / ns_per_byte;
+    if (bytes < min_batch_bytes) {
+      return min_batch_bytes;
+    }
+    if (bytes > max_batch_bytes) {
+      return max_batch_bytes;
+    }
+    return static_cast<size_t>(bytes);
+  }
+
+  size_t scan_pool_t::batch_bytes(const uint64_t latency_ns) const {
+    pthread_mutex_lock(&M);
+    const size_t bytes = target_bytes(latency_ns);
+    pthread_mutex_unlock(&M);
+    return bytes;
+  }
+
+  bool scan_pool_t::wait_task(const size_t node,
+                              const size_t scanned_bytes,
+                              const uint64_t scanned_ns,
+                              std::vector<scan_task_t>& batch) {
+    lock();
+
+    // fold the cost of the last batch into the moving average,
+    // ignoring batches too small to time
+    if (scanned_bytes >= min_batch_bytes && scanned_ns > 0) {
+      ns_per_byte = ns_per_byte * 0.875 +
+                    0.125 * static_cast<double>(scanned_ns) / scanned_bytes;
+    }
+
+    while (!closed) {
+
+      // take from this node first, then from the others
+      size_t from = nodes.size();
+      for (size_t i=0; i<nodes.size(); ++i) {
+        const size_t candidate = (node + i) % nodes.size();
+        if (!nodes[candidate].tasks.empty()) {
+          from = candidate;
+          break;
+        }
+      }
+      if (from == nodes.size()) {
+        ++nodes[node].idle_workers;
+        pthread_cond_wait(&task_available[node], &M);
+        --nodes[node].idle_workers;
+        continue;
+      }
+
+      // take consecutive tasks of the first task's stream up to its
+      // batch size
+      std::deque<scan_task_t>& tasks = nodes[from].tasks;
+      const scan_thread_data_t* const scan_thread_data =
+                                       tasks.front().scan_thread_data;
+      const uint64_t latency_ns = scan_thread_data->batch_latency_ns;
+      const size_t max_bytes = (latency_ns == 0) ? 0 :
+                               target_bytes(latency_ns);
+      size_t bytes = 0;
+      size_t count = 0;
+      do {
+        if (batch.size() <= count) {
+          batch.resize(count + 1);
+        }
+        scan_task_t& task = batch[count];
+        task.scan_thread_data = tasks.front().scan_thread_data;
+        task.scan_manager = tasks.front().scan_manager;
+        task.sequence_id = tasks.front().sequence_id;
+        task.part = tasks.front().part;
+        task.queued_ns = tasks.front().queued_ns;
+        task.unscanned_array.swap(tasks.front().unscanned_array);
+        tasks.pop_front();
+        bytes += task.unscanned_array.size();
+        ++count;
+      } while (!tasks.empty() &&
+               tasks.front().scan_thread_data == scan_thread_data &&
+               bytes + tasks.front().unscanned_array.size() <= max_bytes);
+      batch.resize(count);
+      if (from == node) {
+        nodes[from].scanned_local += count;
+      } else {
+        nodes[from].scanned_remote += count;
+      }
+      unlock();
+      return true;
+    }
+    unlock();
+    return false;
+  }
+
+  void scan_pool_t::put(scan_thread_data_t* const scan_thread_data,
+                        const uint64_t sequence_id,
+                        const size_t part,
+                        std::string& unscanned_array) {
+    hashdb::scan_manager_t* const scan_manager = scan_thread_data->acquire();
+    lock();
+    const size_t node = route();
+    std::deque<scan_task_t>& tasks = nodes[node].tasks;
+    tasks.push_back(scan_task_t());
+    tasks.back().scan_thread_data = scan_thread_data;
+    tasks.back().scan_manager = scan_manager;
+    tasks.back().sequence_id = sequence_id;
+    tasks.back().part = part;
+    tasks.back().queued_ns = hashdb::stage_clock_ns();
+    tasks.back().unscanned_array.swap(unscanned_array);
+    ++nodes[node].routed;
+
+    // wake a worker of the node, else an idle worker of another node
+    size_t wake = node;
+    for (size_t i=0; i<nodes.size(); ++i) {
+      const size_t candidate = (node + i) % nodes.size();
+      if (nodes[candidate].idle_workers != 0) {
+        wake = candidate;
+        break;
+      }
+    }
+    pthread_cond_signal(&task_available[wake]);
+    unlock();
+  }
+
+  void scan_pool_t::cancel(
+                   const scan_thread_data_t* const scan_thread_data,
+                   std::vector<std::pair<uint64_t, size_t> >& cancelled) {
+    lock();
+    for (size_t i=0; i<nodes.size(); ++i) {
+      std::deque<scan_task_t>& tasks = nodes[i].tasks;
+      std::deque<scan_task_t>::iterator it = tasks.begin();
+      while (it != tasks.end()) {
+        if (it->scan_thread_data == scan_thread_data) {
+          cancelled.push_back(std::pair<uint64_t, size_t>(
+                                                 it->sequence_id, it->part));
+          it = tasks.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    unlock();
+  }
+
+  scan_pool_t* scan_pool_t::acquire_shared(const int p_num_threads,
+                                           const std::string& cpu_affinity) {
+    pthread_mutex_lock(&shared_pool_M);
+    if (shared_pool == NULL) {
+      shared_pool = new scan_pool_t(p_num_threads, cpu_affinity);
+    }
+    ++shared_pool_users;
+    scan_pool_t* const scan_pool = shared_pool;
+    pthread_mutex_unlock(&shared_pool_M);
+    return scan_pool;
+  }
+
+  void scan_pool_t::release_shared() {
+    pthread_mutex_lock(&shared_pool_M);
+    --shared_pool_users;
+    if (shared_pool_users == 0) {
+      delete shared_pool;
+      shared_pool = NULL;
+    }
+    pthread_mutex_unlock(&shared_pool_M);
+  }
+
+} // end namespace scan_stream
@@ -0,0 +1,216 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A pool of scanner threads that scans unscanned arrays submitted by
+ * one or more scan_stream_t objects.  Each task carries the
+ * scan_thread_data_t of the stream that submitted it, and results are
+ * put back on that stream's scan_queue_t.
+ *
+ * A scan_stream_t may own its pool or use a process-wide shared pool
+ * obtained with acquire_shared and returned with release_shared.
+ *
+ * Worker threads may be pinned to a CPU affinity, given as a CPU list
+ * such as "0-3,8" or as a NUMA node such as "node1".
+ *
+ * With the affinity "numa" the workers are spread over the NUMA nodes
+ * and pinned to the CPUs of their node, and each node has its own task
+ * queue.  An array is queued on the node of the CPU that submits it, so
+ * it is scanned where its memory was written, and a worker takes from
+ * other nodes only when its own queue is empty and the other node's
+ * workers are busy.
+ *
+ * The pool measures the cost of scanning a byte of unscanned data and
+ * reports the batch size that takes a stream's batch latency to scan.
+ * Streams split larger arrays into parts of about that size, and a
+ * worker takes consecutive small arrays of one stream together up to
+ * that size, so that neither queue overhead nor huge arrays dominate.
+ *
+ * The time each task waits in the queue and the time each is scanned
+ * are recorded as the scan_queue_wait and scan_array stages, see
+ * stage_stats.hpp.
+ */
+
+#ifndef SCAN_POOL_HPP
+#define SCAN_POOL_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+#include <pthread.h>
+#include "metrics.hpp"
+
+namespace hashdb {
+  class scan_manager_t;
+}
+
+namespace scan_stream {
+
+class scan_thread_data_t;
+
+// an unscanned array or part of one, its sequence ID, the stream that
+// submitted it, the scan manager to scan it against, and when it was
+// queued
+struct scan_task_t {
+  scan_thread_data_t* scan_thread_data;
+  hashdb::scan_manager_t* scan_manager;
+  uint64_t sequence_id;
+  size_t part;                  // the part of a split array, else 0
+  uint64_t queued_ns;           // stage_clock_ns when queued
+  std::string unscanned_array;
+  scan_task_t() : scan_thread_data(NULL), scan_manager(NULL),
+                  sequence_id(0), part(0), queued_ns(0), unscanned_array() {
+  }
+  scan_task_t(const scan_task_t& other) :
+              scan_thread_data(other.scan_thread_data),
+              scan_manager(other.scan_manager),
+              sequence_id(other.sequence_id),
+              part(other.part),
+              queued_ns(other.queued_ns),
+              unscanned_array(other.unscanned_array) {
+  }
+  scan_task_t& operator=(const scan_task_t& other) {
+    scan_thread_data = other.scan_thread_data;
+    scan_manager = other.scan_manager;
+    sequence_id = other.sequence_id;
+    part = other.part;
+    queued_ns = other.queued_ns;
+    unscanned_array = other.unscanned_array;
+    return *this;
+  }
+};
+
+class scan_pool_t {
+
+  public:
+  // batch size bounds, so a bad measurement cannot make batches useless
+  static const size_t min_batch_bytes = 4096;
+  static const size_t max_batch_bytes = 1 << 26;
+
+  private:
+  // a worker thread and the node it takes tasks from first
+  struct worker_t {
+    scan_pool_t* scan_pool;
+    size_t node;
+    worker_t() : scan_pool(NULL), node(0) {
+    }
+  };
+
+  // the tasks of one node and what happened to them
+  struct node_t {
+    int node_id;
+    std::vector<int> cpus;       // to pin to, or empty to not pin
+    std::deque<scan_task_t> tasks;
+    size_t idle_workers;
+    uint64_t routed;             // tasks queued here
+    uint64_t scanned_local;      // tasks taken by this node's workers
+    uint64_t scanned_remote;     // tasks taken by other nodes' workers
+    node_t() : node_id(0), cpus(), tasks(), idle_workers(0), routed(0),
+               scanned_local(0), scanned_remote(0) {
+    }
+  };
+
+  const int num_threads;
+  ::pthread_t* threads;
+  worker_t* workers;
+  std::vector<node_t> nodes;
+  std::vector<int> node_of_cpu; // node index of each CPU, or -1
+  size_t next_node;             // for arrays from CPUs of no node
+  bool closed;
+  double ns_per_byte;           // moving average of the scan cost
+  mutable pthread_mutex_t M;   // mutex
+  pthread_cond_t* task_available; // one per node
+
+  // do not allow copy or assignment
+  scan_pool_t(const scan_pool_t&);
+  scan_pool_t& operator=(const scan_pool_t&);
+
+  void lock() {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() {
+    pthread_mutex_unlock(&M);
+  }
+
+  static void* run(void* const arg);
+
+  // report the queued tasks and the number of threads
+  static void add_metrics(const void* const data, const uint64_t id,
+                          hashdb::metric_samples_t& samples);
+
+  // the node to queue an array from the calling thread on
+  size_t route();
+
+  // the batch size for latency_ns, call while locked
+  size_t target_bytes(const uint64_t latency_ns) const;
+
+  // add the cost of the last batch, then block until tasks are
+  // available, preferring node, and move a batch of them into batch,
+  // false if closed
+  bool wait_task(const size_t node,
+                 const size_t scanned_bytes, const uint64_t scanned_ns,
+                 std::vector<scan_task_t>& batch);
+
+  public:
+  /**
+   * Start num_threads scanner threads, or one per CPU if num_threads
+   * is not positive.  Pin them to cpu_affinity unless it is "", or
+   * spread them over the NUMA nodes if it is "numa".
+   */
+  scan_pool_t(const int p_num_threads, const std::string& cpu_affinity);
+
+  /**
+   * Stop and join the scanner threads.  Tasks still queued are not
+   * scanned, use cancel first.
+   */
+  ~scan_pool_t();
+
+  // move unscanned_array into the pool, leaving unscanned_array empty,
+  // to scan against the current scan manager of scan_thread_data
+  void put(scan_thread_data_t* const scan_thread_data,
+           const uint64_t sequence_id,
+           const size_t part,
+           std::string& unscanned_array);
+
+  // the number of bytes of unscanned data that takes about latency_ns
+  // to scan, at least min_batch_bytes
+  size_t batch_bytes(const uint64_t latency_ns) const;
+
+  // remove tasks queued by scan_thread_data, returning their sequence
+  // IDs and parts
+  void cancel(const scan_thread_data_t* const scan_thread_data,
+              std::vector<std::pair<uint64_t, size_t> >& cancelled);
+
+  // get the process-wide shared pool, creating it on first use
+  static scan_pool_t* acquire_shared(const int p_num_threads,
+                                     const std::string& cpu_affinity);
+
+  // release the shared pool, deleting it after its last user
+  static void release_shared();
+};
+
+} // end namespace scan_stream
+
+#endif
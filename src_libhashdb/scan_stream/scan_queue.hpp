@@ -19,12 +19,28 @@
 
 /**
  * \file
- * A simple non-blocking threadsafe scan queue.
+ * A threadsafe queue of scanned results for one scan_stream.  Unscanned
+ * arrays are queued on the scan_pool_t that scans them.  Callers may
+ * block in wait_scanned and wait_idle instead of polling.
  *
  * Warns to stderr
  *
- * To correctly detect busy threads, every non-empty put_unscanned call
- * must be matched with a put_scanned call.
+ * Arrays are moved in and out of the queue by swapping so batches are
+ * not copied.
+ *
+ * Each submitted array gets a sequence ID.  In ordered mode, scanned
+ * arrays are released in sequence order.  Arrays that finish early wait
+ * in a reorder buffer.  put_scanned blocks while its sequence ID is
+ * reorder_window or more ahead of the next ID to release, which bounds
+ * the buffer.
+ *
+ * An array may be split into parts that are scanned separately.  Its
+ * scanned parts are joined in part order and released as one array
+ * when the last part is put or cancelled.
+ *
+ * To correctly detect busy threads, every submitted call must be
+ * matched with a put_scanned call or a cancelled call, one per part
+ * for a split array.
  */
 
 #ifndef SCAN_QUEUE_HPP
@@ -32,7 +48,15 @@
 
 #include <string>
 #include <queue>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <utility>
+#include <stdint.h>
+#include <sys/time.h>
 #include <pthread.h>
+#include "metrics.hpp"
+#include "probes.hpp"
 
 // diagnostic
 //#define TEST_SCAN_QUEUE_HPP
@@ -46,11 +70,24 @@ namespace scan_stream {
 class scan_queue_t {
 
   private:
-  std::queue<std::string> unscanned;
-  std::queue<std::string> scanned;
-  size_t unscanned_submitted;
+  // released scanned arrays and their sequence IDs
+  std::queue<std::pair<uint64_t, std::string> > scanned;
+  size_t unscanned_submitted;   // also the next sequence ID
   size_t scanned_submitted;
+  size_t cancelled_count;
+
+  // ordered mode
+  bool ordered;
+  size_t reorder_window;
+  uint64_t next_release;
+  std::map<uint64_t, std::string> reorder_buffer;
+
+  // split arrays waiting for parts, and the number of parts waited for
+  std::map<uint64_t, std::pair<size_t, std::vector<std::string> > > splits;
+
   mutable pthread_mutex_t M;   // mutex
+  pthread_cond_t scanned_changed;
+  pthread_cond_t window_advanced;
 
   // do not allow copy or assignment
   scan_queue_t(const scan_queue_t&);
@@ -66,93 +103,248 @@ class scan_queue_t {
     pthread_mutex_unlock(&M);
   }
 
+  // true when all submitted data has been scanned, call while locked
+  bool is_idle() const {
+    return unscanned_submitted == scanned_submitted;
+  }
+
+  // release one scanned array, dropping it if empty, call while locked
+  // report the arrays in flight, waiting to be read, and reordering
+  static void add_metrics(const void* const data, const uint64_t id,
+                          hashdb::metric_samples_t& samples) {
+    const scan_queue_t* const q = static_cast<const scan_queue_t*>(data);
+    std::stringstream ss;
+    ss << "queue=\"" << id << "\"";
+    const std::string labels = ss.str();
+    pthread_mutex_lock(&q->M);
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_queue_in_flight", "gauge",
+                "Arrays submitted to scan_stream and not yet scanned.",
+                labels, static_cast<double>(
+                q->unscanned_submitted - q->scanned_submitted)));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_queue_scanned", "gauge",
+                "Scanned arrays waiting to be read.", labels,
+                static_cast<double>(q->scanned.size())));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_queue_reorder", "gauge",
+                "Scanned arrays held back to keep sequence order.", labels,
+                static_cast<double>(q->reorder_buffer.size())));
+    samples.push_back(hashdb::metric_sample_t(
+                "hashdb_scan_queue_arrays_total", "counter",
+                "Arrays submitted to scan_stream.", labels,
+                static_cast<double>(q->unscanned_submitted)));
+    pthread_mutex_unlock(&q->M);
+  }
+
+  void release(const uint64_t sequence_id, std::string& scanned_data) {
+    ++scanned_submitted;
+#ifdef TEST_SCAN_QUEUE_HPP
+    std::cerr << "release: " << sequence_id << " '" << scanned_data
+              << "', " << hashdb::bin_to_hex(scanned_data) << "\n";
+#endif
+    if (scanned_data.size() > 0) {
+      scanned.push(std::pair<uint64_t, std::string>(sequence_id, ""));
+      scanned.back().second.swap(scanned_data);
+    } else {
+      // drop the result
+    }
+  }
+
+  // store one scanned array, call while locked
+  void store(const uint64_t sequence_id, std::string& scanned_data,
+             const bool wait_for_window) {
+    if (!ordered) {
+      release(sequence_id, scanned_data);
+    } else {
+      // bound the reorder buffer
+      while (wait_for_window &&
+             sequence_id >= next_release + reorder_window) {
+        pthread_cond_wait(&window_advanced, &M);
+      }
+
+      // buffer it, then release everything now in sequence
+      reorder_buffer[sequence_id].swap(scanned_data);
+      while (reorder_buffer.size() > 0 &&
+             reorder_buffer.begin()->first == next_release) {
+        release(next_release, reorder_buffer.begin()->second);
+        reorder_buffer.erase(reorder_buffer.begin());
+        ++next_release;
+      }
+      pthread_cond_broadcast(&window_advanced);
+    }
+
+    // wake callers waiting for scanned data or for idle
+    pthread_cond_broadcast(&scanned_changed);
+  }
+
+  // keep one part of a split array, true and the joined array in
+  // scanned_data when it was the last part, call while locked
+  bool join(const uint64_t sequence_id, const size_t part,
+            std::string& scanned_data) {
+    std::map<uint64_t, std::pair<size_t, std::vector<std::string> > >::
+                              iterator it = splits.find(sequence_id);
+    if (it == splits.end()) {
+      // not split
+      return true;
+    }
+    it->second.second[part].swap(scanned_data);
+    if (--it->second.first > 0) {
+      return false;
+    }
+    size_t size = 0;
+    for (size_t i=0; i<it->second.second.size(); ++i) {
+      size += it->second.second[i].size();
+    }
+    scanned_data.clear();
+    scanned_data.reserve(size);
+    for (size_t i=0; i<it->second.second.size(); ++i) {
+      scanned_data.append(it->second.second[i]);
+    }
+    splits.erase(it);
+    return true;
+  }
+
   public:
-  scan_queue_t() : unscanned(), scanned(),
+  scan_queue_t() : scanned(),
                    unscanned_submitted(0), scanned_submitted(0),
-                   M() {
+                   cancelled_count(0),
+                   ordered(false), reorder_window(0), next_release(0),
+                   reorder_buffer(), splits(),
+                   M(), scanned_changed(), window_advanced() {
     if(pthread_mutex_init(&M,NULL)) {
       std::cerr << "Error obtaining mutex.\n";
       assert(0);
     }
+    if(pthread_cond_init(&scanned_changed,NULL) ||
+       pthread_cond_init(&window_advanced,NULL)) {
+      std::cerr << "Error obtaining condition variable.\n";
+      assert(0);
+    }
+    hashdb::metrics_register(add_metrics, this);
   }
 
   ~scan_queue_t() {
-    if (!empty()) {
+    hashdb::metrics_unregister(this);
+    if (!empty() || cancelled_count > 0) {
       // warn
       std::cerr << "Processing error: The scan_stream queue was closed but it was not empty.\n";
     }
+    pthread_cond_destroy(&scanned_changed);
+    pthread_cond_destroy(&window_advanced);
     pthread_mutex_destroy(&M);
   }
 
-  std::string get_unscanned() {
+  // release scanned arrays in sequence order, call before submitting
+  void set_ordered(const size_t p_reorder_window) {
     lock();
-    if (unscanned.empty()) {
-      unlock();
-      return "";
+    if (unscanned_submitted != 0) {
+      std::cerr << "Usage error: scan_stream ordered mode must be set before data is submitted.\n";
+      assert(0);
     }
-    std::string unscanned_data = unscanned.front();
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "get_unscanned: '" << unscanned_data
-              << "', " << hashdb::bin_to_hex(unscanned_data) << "\n";
-#endif
-    unscanned.pop();
+    ordered = true;
+    reorder_window = (p_reorder_window > 0) ? p_reorder_window : 1;
     unlock();
-    return unscanned_data;
   }
 
-  void put_unscanned(const std::string unscanned_data) {
-    if (unscanned_data.size() == 0) {
-      // drop the request
-      return;
-    }
+  // record that an unscanned array was submitted, returns its sequence ID
+  uint64_t submitted() {
     lock();
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "put_unscanned: '" << unscanned_data
-              << "', " << hashdb::bin_to_hex(unscanned_data) << "\n";
-#endif
+    const uint64_t sequence_id = unscanned_submitted;
     ++unscanned_submitted;
-    unscanned.push(unscanned_data);
+    unlock();
+    return sequence_id;
+  }
+
+  // record that a submitted array will be scanned in parts, call
+  // before submitting its parts
+  void split(const uint64_t sequence_id, const size_t parts) {
+    lock();
+    splits[sequence_id].first = parts;
+    splits[sequence_id].second.resize(parts);
+    unlock();
+  }
+
+  // record that a submitted array or part was removed without scanning
+  void cancelled(const uint64_t sequence_id, const size_t part) {
+    lock();
+    ++cancelled_count;
+    std::string none;
+    if (join(sequence_id, part, none)) {
+      store(sequence_id, none, false);
+    }
     unlock();
   }
 
-  std::string get_scanned() {
+  // move the next scanned array into scanned_data, false if none
+  bool get_scanned(std::string& scanned_data, uint64_t& sequence_id) {
     lock();
     if (scanned.empty()) {
       unlock();
-      return "";
+      return false;
     }
-    std::string scanned_data = scanned.front();
+    sequence_id = scanned.front().first;
+    scanned_data.swap(scanned.front().second);
+    HASHDB_PROBE3(scan_batch_get, this, sequence_id, scanned_data.size());
 #ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "get_scanned: '" << scanned_data
+    std::cerr << "get_scanned: " << sequence_id << " '" << scanned_data
               << "', " << hashdb::bin_to_hex(scanned_data) << "\n";
 #endif
     scanned.pop();
     unlock();
-    return scanned_data;
+    return true;
   }
 
-  void put_scanned(const std::string scanned_data) {
+  // move scanned_data of an array or part into the queue, leaving
+  // scanned_data empty.  In ordered mode this blocks while sequence_id
+  // is beyond the window.
+  void put_scanned(const uint64_t sequence_id, const size_t part,
+                   std::string& scanned_data) {
+    HASHDB_PROBE3(scan_batch_put, this, sequence_id, scanned_data.size());
     lock();
-    ++scanned_submitted;
-#ifdef TEST_SCAN_QUEUE_HPP
-    std::cerr << "put_scanned: '" << scanned_data
-              << "', " << hashdb::bin_to_hex(scanned_data) << "\n";
-#endif
-    if (scanned_data.size() == 0) {
-      // drop the result
-      unlock();
-      return;
+    if (join(sequence_id, part, scanned_data)) {
+      store(sequence_id, scanned_data, true);
+    }
+    unlock();
+  }
+
+  // block until a scanned array is available, until all submitted data
+  // is scanned, or until timeout_milliseconds passes.  Moves the scanned
+  // array into scanned_data, false if none.
+  bool wait_scanned(std::string& scanned_data, uint64_t& sequence_id,
+                    const size_t timeout_milliseconds) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const uint64_t usec = now.tv_usec +
+                          static_cast<uint64_t>(timeout_milliseconds) * 1000;
+    struct timespec until;
+    until.tv_sec = now.tv_sec + usec / 1000000;
+    until.tv_nsec = (usec % 1000000) * 1000;
+
+    lock();
+    while (scanned.empty() && !is_idle()) {
+      if (pthread_cond_timedwait(&scanned_changed, &M, &until) != 0) {
+        // timed out
+        break;
+      }
+    }
+    unlock();
+    return get_scanned(scanned_data, sequence_id);
+  }
+
+  // block until all submitted data has been scanned
+  void wait_idle() {
+    lock();
+    while (!is_idle()) {
+      pthread_cond_wait(&scanned_changed, &M);
     }
-    scanned.push(scanned_data);
     unlock();
   }
 
   bool empty() {
     lock();
-    // Empty when both queues are empty and processing is not active.
-    const bool is_empty = unscanned.size() == 0 &&
-                          scanned.size() == 0 &&
-                          unscanned_submitted == scanned_submitted;
+    // Empty when no scanned data is queued and processing is not active.
+    const bool is_empty = scanned.size() == 0 && is_idle();
     unlock();
     return is_empty;
   }
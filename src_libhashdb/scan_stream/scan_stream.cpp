@@ -19,8 +19,12 @@
 
 /**
  * \file
- * Creates a pool of scanner threads that consume from input pipe
- * and write matches to output pipe until input pipe closes.
+ * Provides the scan_stream_t interface.  Unscanned arrays are scanned by
+ * a scan_pool_t, which is either owned by the stream or shared by all
+ * streams in the process.  Scanned arrays are returned through the
+ * stream's scan_queue_t.  Each array is scanned against the scan
+ * manager current when it was put, so that swap_scan_manager lets
+ * arrays already put drain on the scan manager it replaces.
  */
 #include <config.h>
 // this process of getting WIN32 defined was inspired
@@ -45,184 +49,205 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <iostream>
+#include <vector>
 #include <unistd.h>
-#include <sched.h>  // sched_yield
 #include <pthread.h>
 #include "scan_thread_data.hpp"
-#include "num_cpus.hpp"
-#include "tprint.hpp"
+#include "scan_pool.hpp"
 
-static void* run(void* const arg) {
-  // get pointer to scan thread data job
-  scan_stream::scan_thread_data_t* const job =
-                    static_cast<scan_stream::scan_thread_data_t* const>(arg);
-
-  // make space for the hash and label
-  char* char_hash = new char[job->hash_size]();
-  char* char_label = new char[65536](); // fits uint16_t
+namespace hashdb {
 
-  // get and process input arrays until signaled to close
-  // print warnings to stderr
-  while (!job->done) {
+  scan_stream_t::scan_stream_t(
+              hashdb::scan_manager_t* const scan_manager,
+              const size_t hash_size,
+              const hashdb::scan_mode_t scan_mode) :
+         scan_pool(new scan_stream::scan_pool_t(0, "")),
+         use_shared_pool(false),
+         scan_thread_data(new scan_stream::scan_thread_data_t(
+                          scan_manager, hash_size, scan_mode)) {
+  }
 
-    // read unscanned array from scan_queue
-    const std::string unscanned_array = job->scan_queue.get_unscanned();
+  scan_stream_t::scan_stream_t(
+              hashdb::scan_manager_t* const scan_manager,
+              const size_t hash_size,
+              const hashdb::scan_mode_t scan_mode,
+              const int num_threads,
+              const std::string& cpu_affinity,
+              const bool p_use_shared_pool) :
+         scan_pool((p_use_shared_pool)
+               ? scan_stream::scan_pool_t::acquire_shared(
+                                           num_threads, cpu_affinity)
+               : new scan_stream::scan_pool_t(num_threads, cpu_affinity)),
+         use_shared_pool(p_use_shared_pool),
+         scan_thread_data(new scan_stream::scan_thread_data_t(
+                          scan_manager, hash_size, scan_mode)) {
 
-    // empty so pause and retry
-    if (unscanned_array.size() == 0) {
-      sched_yield();
-      continue;
+    // spread the hash store over the nodes the threads run on,
+    // best effort since a one-node machine has nothing to spread
+    if (cpu_affinity == "numa") {
+      scan_thread_data->interleave = true;
+      scan_manager->interleave_hash_store();
     }
+  }
 
-    // set up input stream from unscanned_array
-    std::istringstream unscanned_stream(unscanned_array);
-
-    // set up empty scanned output stream
-    std::ostringstream scanned_stream;
-
-    // read and process the scan input elements
-    size_t next_index = 0;
-    while (unscanned_stream.peek() != EOF) {
-
-      // read char_hash
-      unscanned_stream.read(char_hash, job->hash_size);
-
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading hash.\n";
-        hashdb::tprint(std::cerr, ss.str());
-        continue;
-      }
-      next_index += job->hash_size;
-
-      // read char_label length, size uint16_t
-      uint16_t char_label_length = 0;
-      unscanned_stream.read(reinterpret_cast<char*>(&char_label_length),
-                            sizeof(uint16_t));
-
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading label length.\n";
-        hashdb::tprint(std::cerr, ss.str());
-        continue;
-      }
-      next_index += sizeof(uint16_t);
-
-      // read char_label
-      unscanned_stream.read(char_label, char_label_length);
-
-      // check for EOF
-      if (unscanned_stream.rdstate() & std::ios::eofbit) {
-        std::stringstream ss;
-        ss << "Unexpected end of data error in unscanned data size "
-           << unscanned_array.size() << " index " << next_index
-           << " while reading label.\n";
-        hashdb::tprint(std::cerr, ss.str());
-        continue;
-      }
-      next_index += char_label_length;
+  // release scanned data in submission order
+  void scan_stream_t::set_ordered(const size_t reorder_window) {
+    scan_thread_data->scan_queue.set_ordered(reorder_window);
+  }
 
-      // scan
-      const std::string json_response = job->scan_manager->find_hash_json(
-                     job->scan_mode, std::string(char_hash, job->hash_size));
+  // size batches to about this much scan time
+  void scan_stream_t::set_batch_latency(const size_t microseconds) {
+    scan_thread_data->batch_latency_ns =
+                         static_cast<uint64_t>(microseconds) * 1000;
+  }
 
-      if (json_response.size() > 0) {
+  // put in data to scan
+  uint64_t scan_stream_t::put(const std::string& unscanned_data) {
+    std::string data(unscanned_data);
+    return submit(data);
+  }
 
-        // write char_hash
-        scanned_stream.write(char_hash, job->hash_size);
+  // put in data to scan from a buffer
+  uint64_t scan_stream_t::put(const char* const unscanned_data,
+                              const size_t size) {
+    std::string data(unscanned_data, size);
+    return submit(data);
+  }
 
-        // write char_label length
-        scanned_stream.write(
-                        reinterpret_cast<const char*>(&char_label_length),
-                        sizeof(uint16_t));
+#if __cplusplus >= 201103L
+  // move in data to scan
+  uint64_t scan_stream_t::put(std::string&& unscanned_data) {
+    return submit(unscanned_data);
+  }
+#endif
 
-        // write char_label
-        scanned_stream.write(char_label, char_label_length);
+  // move data to the scan pool, empty requests have no result.
+  // Arrays much larger than the batch size are split at record
+  // boundaries so that their parts are scanned in parallel.
+  uint64_t scan_stream_t::submit(std::string& unscanned_data) {
+    const uint64_t sequence_id = scan_thread_data->scan_queue.submitted();
+    if (unscanned_data.size() == 0) {
+      // nothing to scan
+      scan_thread_data->scan_queue.put_scanned(sequence_id, 0,
+                                               unscanned_data);
+      return sequence_id;
+    }
 
-        // write json_response length
-        const uint32_t json_response_length = json_response.size();
-        scanned_stream.write(
-                        reinterpret_cast<const char*>(&json_response_length),
-                        sizeof(uint32_t));
+    const uint64_t latency_ns = scan_thread_data->batch_latency_ns;
+    const size_t batch_bytes = (latency_ns == 0) ? 0 :
+                               scan_pool->batch_bytes(latency_ns);
+    if (batch_bytes == 0 || unscanned_data.size() < 2 * batch_bytes) {
+      scan_pool->put(scan_thread_data, sequence_id, 0, unscanned_data);
+      return sequence_id;
+    }
 
-        // write json_response
-        scanned_stream << json_response;
+    // find the part boundaries, leaving truncated data in the last part
+    // for the scanner to report.  EXISTS bitmaps are joined bytewise so
+    // their parts hold whole bytes of records.
+    std::vector<size_t> ends;
+    const size_t hash_size = scan_thread_data->hash_size;
+    const size_t records_per_cut =
+           (scan_thread_data->scan_mode == hashdb::scan_mode_t::EXISTS) ? 8 : 1;
+    const size_t size = unscanned_data.size();
+    size_t begin = 0;
+    size_t index = 0;
+    size_t records = 0;
+    while (index + hash_size + sizeof(uint16_t) <= size) {
+      uint16_t label_length;
+      std::memcpy(&label_length, unscanned_data.data() + index + hash_size,
+                  sizeof(uint16_t));
+      index += hash_size + sizeof(uint16_t) + label_length;
+      ++records;
+      if (records % records_per_cut == 0 &&
+          index - begin >= batch_bytes && size - index >= batch_bytes) {
+        ends.push_back(index);
+        begin = index;
       }
     }
+    ends.push_back(size);
 
-    // push result back, even if empty
-    job->scan_queue.put_scanned(scanned_stream.str());
+    // queue the parts
+    if (ends.size() > 1) {
+      scan_thread_data->scan_queue.split(sequence_id, ends.size());
+    }
+    begin = 0;
+    for (size_t part=0; part<ends.size(); ++part) {
+      std::string part_data(unscanned_data, begin, ends[part] - begin);
+      scan_pool->put(scan_thread_data, sequence_id, part, part_data);
+      begin = ends[part];
+    }
+    unscanned_data.clear();
+    return sequence_id;
   }
 
-  // clean up
-  delete[] char_hash;
-  delete[] char_label;
-  return 0;
-}
+  // get scanned data or "" if none available
+  std::string scan_stream_t::get() {
+    std::string scanned_data;
+    uint64_t sequence_id;
+    scan_thread_data->scan_queue.get_scanned(scanned_data, sequence_id);
+    return scanned_data;
+  }
 
-namespace hashdb {
+  // get scanned data, waiting up to timeout_milliseconds, or "" if none
+  std::string scan_stream_t::get(const size_t timeout_milliseconds) {
+    uint64_t sequence_id;
+    return get(timeout_milliseconds, sequence_id);
+  }
 
-  scan_stream_t::scan_stream_t(
-              hashdb::scan_manager_t* const scan_manager,
-              const size_t hash_size,
-              const hashdb::scan_mode_t scan_mode) :
-         num_threads(hashdb::numCPU()),
-         threads(new ::pthread_t[num_threads]),
-         scan_thread_data(new scan_stream::scan_thread_data_t(
-                          scan_manager, hash_size, scan_mode)),
-         done(false) {
-
-    // open one scan thread per CPU
-    for (int i=0; i<num_threads; i++) {
-      int rc = ::pthread_create(&threads[i], NULL, run,
-                                (void*)scan_thread_data);
-      if (rc != 0) {
-        std::cerr << "Unable to start scan_stream thread: "
-                  << strerror(rc) << ".\n";
-        assert(0);
-      }
-    }
+  // get scanned data and its sequence ID, waiting up to
+  // timeout_milliseconds, or "" if none
+  std::string scan_stream_t::get(const size_t timeout_milliseconds,
+                                 uint64_t& sequence_id) {
+    std::string scanned_data;
+    scan_thread_data->scan_queue.wait_scanned(scanned_data, sequence_id,
+                                              timeout_milliseconds);
+    return scanned_data;
   }
 
-  // put in data to scan
-  void scan_stream_t::put(const std::string& unscanned_data) {
-    scan_thread_data->scan_queue.put_unscanned(unscanned_data);
+  // return true if scan_stream is empty
+  bool scan_stream_t::empty() {
+    return scan_thread_data->scan_queue.empty();
   }
 
-  // get scanned data or "" if none available
-  std::string scan_stream_t::get() {
-    return scan_thread_data->scan_queue.get_scanned();
+  // wait until all submitted data has been scanned
+  void scan_stream_t::wait_empty() {
+    scan_thread_data->scan_queue.wait_idle();
   }
 
-  // return true if scan_stream is empty, may yield
-  bool scan_stream_t::empty() {
-    bool is_empty = scan_thread_data->scan_queue.empty();
-    if (!is_empty) {
-      // yield so caller can busy-wait with less waste
-      sched_yield();
+  // scan arrays put next against new_scan_manager
+  hashdb::scan_manager_t* scan_stream_t::swap_scan_manager(
+                       hashdb::scan_manager_t* const new_scan_manager) {
+    if (scan_thread_data->interleave) {
+      new_scan_manager->interleave_hash_store();
     }
+    return scan_thread_data->swap(new_scan_manager);
+  }
 
-    return is_empty;
+  // wait until nothing is being scanned against scan_manager
+  bool scan_stream_t::wait_drained(
+                       const hashdb::scan_manager_t* const scan_manager,
+                       const size_t timeout_milliseconds) {
+    return scan_thread_data->wait_drained(scan_manager,
+                                          timeout_milliseconds);
   }
 
   scan_stream_t::~scan_stream_t() {
 
-    // join each thread
-    scan_thread_data->done = true;
-    for (int i=0; i<num_threads; i++) {
-      int status = pthread_join(threads[i], NULL);
-      if (status != 0) {
-        std::cerr << "Error in threadpool join: " << strerror(status) << ".\n";
-      }
+    // drop unscanned work and wait for arrays being scanned
+    std::vector<std::pair<uint64_t, size_t> > cancelled;
+    scan_pool->cancel(scan_thread_data, cancelled);
+    for (std::vector<std::pair<uint64_t, size_t> >::const_iterator it =
+                      cancelled.begin(); it != cancelled.end(); ++it) {
+      scan_thread_data->scan_queue.cancelled(it->first, it->second);
     }
+    scan_thread_data->scan_queue.wait_idle();
 
-    delete[] threads;
+    // release the scan threads
+    if (use_shared_pool) {
+      scan_stream::scan_pool_t::release_shared();
+    } else {
+      delete scan_pool;
+    }
     delete scan_thread_data;
   }
 
@@ -20,26 +20,58 @@
 /**
  * \file
  * The data structure used by all scan threads.
+ *
+ * Each array is scanned against the scan manager that was current when
+ * it was put, so swap_scan_manager moves arrays put later to a new scan
+ * manager while arrays already put drain on the old one.  The time from
+ * a swap until the replaced scan manager drains is recorded as the
+ * scan_swap stage.
  */
 
 #ifndef SCAN_THREAD_DATA_HPP
 #define SCAN_THREAD_DATA_HPP
 
 #include <stdint.h>
+#include <cassert>
+#include <map>
+#include <pthread.h>
+#include <sys/time.h>
 #include "hashdb.hpp"
 #include "scan_queue.hpp"
+#include "stage_stats.hpp"
 
 namespace scan_stream {
 
 // common information used by scanner threads
 class scan_thread_data_t {
 
+  private:
+  hashdb::scan_manager_t* scan_manager;  // for arrays put next
+
+  // the array parts put and not yet scanned against each scan manager,
+  // and when each replaced scan manager still in use was swapped out
+  std::map<const hashdb::scan_manager_t*, size_t> in_flight;
+  std::map<const hashdb::scan_manager_t*, uint64_t> swapped_ns;
+
+  pthread_mutex_t M;   // mutex
+  pthread_cond_t drained;
+
+  void lock() {
+    if(pthread_mutex_lock(&M)) {
+      assert(0);
+    }
+  }
+
+  void unlock() {
+    pthread_mutex_unlock(&M);
+  }
+
   public:
-  hashdb::scan_manager_t* const scan_manager;
   const size_t hash_size;
   const ::hashdb::scan_mode_t scan_mode;
   scan_queue_t scan_queue;
-  volatile bool done;
+  uint64_t batch_latency_ns;  // scan time to size batches to, 0 for none
+  bool interleave;            // interleave the hash store of new managers
 
   // do not allow copy or assignment
   scan_thread_data_t(const scan_thread_data_t&);
@@ -50,10 +82,100 @@ class scan_thread_data_t {
                      const size_t p_hash_size,
                      const hashdb::scan_mode_t p_scan_mode) :
             scan_manager(p_scan_manager),
+            in_flight(),
+            swapped_ns(),
+            M(),
+            drained(),
             hash_size(p_hash_size),
             scan_mode(p_scan_mode),
             scan_queue(),
-            done(false) {
+            batch_latency_ns(1000000),
+            interleave(false) {
+    if (pthread_mutex_init(&M, NULL) ||
+        pthread_cond_init(&drained, NULL)) {
+      assert(0);
+    }
+  }
+
+  ~scan_thread_data_t() {
+    pthread_mutex_destroy(&M);
+    pthread_cond_destroy(&drained);
+  }
+
+  // the scan manager to scan an array part being put against, which
+  // stays in use until release
+  hashdb::scan_manager_t* acquire() {
+    lock();
+    hashdb::scan_manager_t* const current = scan_manager;
+    ++in_flight[current];
+    unlock();
+    return current;
+  }
+
+  // an array part has been scanned against p_scan_manager
+  void release(const hashdb::scan_manager_t* const p_scan_manager) {
+    lock();
+    std::map<const hashdb::scan_manager_t*, size_t>::iterator it =
+                                          in_flight.find(p_scan_manager);
+    if (it != in_flight.end() && --it->second == 0) {
+      in_flight.erase(it);
+      std::map<const hashdb::scan_manager_t*, uint64_t>::iterator swapped =
+                                          swapped_ns.find(p_scan_manager);
+      if (swapped != swapped_ns.end()) {
+        // the replaced scan manager is drained
+        hashdb::stage_record(hashdb::STAGE_SCAN_SWAP,
+                             hashdb::stage_clock_ns() - swapped->second);
+        swapped_ns.erase(swapped);
+      }
+      pthread_cond_broadcast(&drained);
+    }
+    unlock();
+  }
+
+  // scan arrays put next against new_scan_manager, returning the scan
+  // manager replaced
+  hashdb::scan_manager_t* swap(hashdb::scan_manager_t* const
+                                                     new_scan_manager) {
+    lock();
+    hashdb::scan_manager_t* const old_scan_manager = scan_manager;
+    if (new_scan_manager != old_scan_manager) {
+      scan_manager = new_scan_manager;
+      swapped_ns.erase(new_scan_manager);
+      const uint64_t now = hashdb::stage_clock_ns();
+      if (in_flight.find(old_scan_manager) == in_flight.end()) {
+        // nothing to drain
+        hashdb::stage_record(hashdb::STAGE_SCAN_SWAP, 0);
+      } else {
+        swapped_ns[old_scan_manager] = now;
+      }
+    }
+    unlock();
+    return old_scan_manager;
+  }
+
+  // block until no array part is being scanned against p_scan_manager
+  // or until timeout_milliseconds passes, true if none is
+  bool wait_drained(const hashdb::scan_manager_t* const p_scan_manager,
+                    const size_t timeout_milliseconds) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    const uint64_t usec = now.tv_usec +
+                          static_cast<uint64_t>(timeout_milliseconds) * 1000;
+    struct timespec until;
+    until.tv_sec = now.tv_sec + usec / 1000000;
+    until.tv_nsec = (usec % 1000000) * 1000;
+
+    lock();
+    while (in_flight.find(p_scan_manager) != in_flight.end()) {
+      if (pthread_cond_timedwait(&drained, &M, &until) != 0) {
+        // timed out
+        break;
+      }
+    }
+    const bool is_drained = in_flight.find(p_scan_manager) ==
+                            in_flight.end();
+    unlock();
+    return is_drained;
   }
 };
 
@@ -34,6 +34,11 @@
 #include <cerrno>
 #include <fstream>
 #include "hashdb.hpp" // for settings
+#include "hash_calculator.hpp" // for block_hash_md
+#include "lmdb_hash_data_support.hpp" // for hash data formats
+#include "source_name_codec.hpp" // for source name formats
+#include "lmdb_shard.hpp" // for max_hash_shard_bits
+#include "lmdb_helper.h" // for sync policies
 #include "rapidjson.h"
 #include "writer.h"
 #include "document.h"
@@ -95,6 +100,235 @@ namespace hashdb {
       settings.settings_version = document["settings_version"].GetUint64();
       settings.block_size = document["block_size"].GetUint64();
 
+      // block_hash_algorithm is optional and defaults to md5
+      if (document.HasMember("block_hash_algorithm")) {
+        if (!document["block_hash_algorithm"].IsString()) {
+          return "Invalid block_hash_algorithm in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.block_hash_algorithm =
+                            document["block_hash_algorithm"].GetString();
+      } else {
+        settings.block_hash_algorithm = "md5";
+      }
+
+      // hash_filter_generation is optional and defaults to 0
+      if (document.HasMember("hash_filter_generation")) {
+        if (!document["hash_filter_generation"].IsUint64()) {
+          return "Invalid hash_filter_generation in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.hash_filter_generation =
+                            document["hash_filter_generation"].GetUint64();
+      } else {
+        settings.hash_filter_generation = 0;
+      }
+
+      // hash_data_format is optional and defaults to the varint format
+      if (document.HasMember("hash_data_format")) {
+        if (!document["hash_data_format"].IsUint()) {
+          return "Invalid hash_data_format in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.hash_data_format = document["hash_data_format"].GetUint();
+      } else {
+        settings.hash_data_format = hashdb::varint_hash_data_format;
+      }
+
+      // source_name_format is optional and defaults to plain names
+      if (document.HasMember("source_name_format")) {
+        if (!document["source_name_format"].IsUint()) {
+          return "Invalid source_name_format in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.source_name_format =
+                            document["source_name_format"].GetUint();
+      } else {
+        settings.source_name_format = hashdb::plain_source_name_format;
+      }
+
+      // hash_shard_bits is optional and defaults to one shard
+      if (document.HasMember("hash_shard_bits")) {
+        if (!document["hash_shard_bits"].IsUint()) {
+          return "Invalid hash_shard_bits in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.hash_shard_bits = document["hash_shard_bits"].GetUint();
+      } else {
+        settings.hash_shard_bits = 0;
+      }
+
+      // initial_map_size is optional and defaults to starting small
+      if (document.HasMember("initial_map_size")) {
+        if (!document["initial_map_size"].IsUint64()) {
+          return "Invalid initial_map_size in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.initial_map_size = document["initial_map_size"].GetUint64();
+      } else {
+        settings.initial_map_size = 0;
+      }
+
+      // max_map_size is optional and defaults to no limit
+      if (document.HasMember("max_map_size")) {
+        if (!document["max_map_size"].IsUint64()) {
+          return "Invalid max_map_size in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.max_map_size = document["max_map_size"].GetUint64();
+      } else {
+        settings.max_map_size = 0;
+      }
+
+      // sync_policy is optional and defaults to periodic
+      if (document.HasMember("sync_policy")) {
+        if (!document["sync_policy"].IsString()) {
+          return "Invalid sync_policy in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.sync_policy = document["sync_policy"].GetString();
+      } else {
+        settings.sync_policy = "periodic";
+      }
+
+      // sync_seconds is optional and defaults to 30 seconds
+      if (document.HasMember("sync_seconds")) {
+        if (!document["sync_seconds"].IsUint()) {
+          return "Invalid sync_seconds in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.sync_seconds = document["sync_seconds"].GetUint();
+      } else {
+        settings.sync_seconds = 30;
+      }
+
+      // sync_mb is optional and defaults to 1 GiB
+      if (document.HasMember("sync_mb")) {
+        if (!document["sync_mb"].IsUint()) {
+          return "Invalid sync_mb in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.sync_mb = document["sync_mb"].GetUint();
+      } else {
+        settings.sync_mb = 1024;
+      }
+
+      // min_chunk_size and max_chunk_size are optional and default to
+      // fixed blocks
+      if (document.HasMember("min_chunk_size") ||
+          document.HasMember("max_chunk_size")) {
+        if (!document.HasMember("min_chunk_size") ||
+            !document["min_chunk_size"].IsUint() ||
+            !document.HasMember("max_chunk_size") ||
+            !document["max_chunk_size"].IsUint()) {
+          return "Invalid chunk sizes in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.min_chunk_size = document["min_chunk_size"].GetUint();
+        settings.max_chunk_size = document["max_chunk_size"].GetUint();
+      } else {
+        settings.min_chunk_size = 0;
+        settings.max_chunk_size = 0;
+      }
+
+      // max_readers is optional and defaults to sizing for the CPUs
+      if (document.HasMember("max_readers")) {
+        if (!document["max_readers"].IsUint()) {
+          return "Invalid max_readers in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.max_readers = document["max_readers"].GetUint();
+      } else {
+        settings.max_readers = 0;
+      }
+
+      // source_hash_index is optional and defaults to no reverse index
+      if (document.HasMember("source_hash_index")) {
+        if (!document["source_hash_index"].IsBool()) {
+          return "Invalid source_hash_index in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.source_hash_index = document["source_hash_index"].GetBool();
+      } else {
+        settings.source_hash_index = false;
+      }
+
+      // similarity_index is optional and defaults to no similarity index
+      if (document.HasMember("similarity_index")) {
+        if (!document["similarity_index"].IsBool()) {
+          return "Invalid similarity_index in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.similarity_index = document["similarity_index"].GetBool();
+      } else {
+        settings.similarity_index = false;
+      }
+
+      // count_index is optional and defaults to no count index
+      if (document.HasMember("count_index")) {
+        if (!document["count_index"].IsBool()) {
+          return "Invalid count_index in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.count_index = document["count_index"].GetBool();
+      } else {
+        settings.count_index = false;
+      }
+
+      // change_log is optional and defaults to no change log
+      if (document.HasMember("change_log")) {
+        if (!document["change_log"].IsBool()) {
+          return "Invalid change_log in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.change_log = document["change_log"].GetBool();
+      } else {
+        settings.change_log = false;
+      }
+
+      // frozen is optional and defaults to not frozen
+      if (document.HasMember("frozen")) {
+        if (!document["frozen"].IsBool()) {
+          return "Invalid frozen in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.frozen = document["frozen"].GetBool();
+      } else {
+        settings.frozen = false;
+      }
+
+      // hash_store_rebuild is optional and defaults to a current store
+      if (document.HasMember("hash_store_rebuild")) {
+        if (!document["hash_store_rebuild"].IsBool()) {
+          return "Invalid hash_store_rebuild in settings file at path '"
+                 + filename + "'.";
+        }
+        settings.hash_store_rebuild =
+                            document["hash_store_rebuild"].GetBool();
+      } else {
+        settings.hash_store_rebuild = false;
+      }
+
+      // store_paths is optional and defaults to every store in place
+      settings.store_paths.clear();
+      if (document.HasMember("store_paths")) {
+        const rapidjson::Value& store_paths = document["store_paths"];
+        if (!store_paths.IsObject()) {
+          return "Invalid store_paths in settings file at path '"
+                 + filename + "'.";
+        }
+        for (rapidjson::Value::ConstMemberIterator it =
+             store_paths.MemberBegin(); it != store_paths.MemberEnd();
+             ++it) {
+          if (!it->value.IsString()) {
+            return "Invalid store_paths in settings file at path '"
+                   + filename + "'.";
+          }
+          settings.store_paths[it->name.GetString()] =
+                                                   it->value.GetString();
+        }
+      }
+
     } else {
       return "Missing JSON settings in settings file at path '"
              + filename + "'.";
@@ -106,6 +340,44 @@ namespace hashdb {
       return "The hashdb at path '" + hashdb_dir + "' is not compatible.";
     }
 
+    // the hash data format must be known
+    if (settings.hash_data_format != hashdb::varint_hash_data_format &&
+        settings.hash_data_format != hashdb::fixed_hash_data_format &&
+        settings.hash_data_format != hashdb::dupfixed_hash_data_format) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' uses unsupported hash data format.";
+    }
+
+    // the source name format must be known
+    if (settings.source_name_format != hashdb::plain_source_name_format &&
+        settings.source_name_format !=
+                                   hashdb::compressed_source_name_format) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' uses unsupported source name format.";
+    }
+
+    // the number of shard bits must be supported
+    if (settings.hash_shard_bits > hashdb::max_hash_shard_bits) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' uses unsupported hash shard bits.";
+    }
+
+    // the sync policy must be known and its intervals nonzero
+    lmdb_helper::sync_policy_t sync_policy;
+    if (!lmdb_helper::sync_policy_from_name(settings.sync_policy,
+                                            sync_policy) ||
+        settings.sync_seconds == 0 || settings.sync_mb == 0) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' uses an unsupported sync policy.";
+    }
+
+    // the block hash algorithm must be supported by this build
+    if (hasher::block_hash_md(settings.block_hash_algorithm) == NULL) {
+      return "The hashdb at path '" + hashdb_dir +
+             "' uses unsupported block hash algorithm '" +
+             settings.block_hash_algorithm + "'.";
+    }
+
     // accept the read
     return "";
   }
@@ -0,0 +1,292 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provide membership shared by processes, for the hashes and sources
+ * that EXPANDED_OPTIMIZED scans in several processes have reported, see
+ * scan_manager_t::share_optimized_state.
+ *
+ * Members are kept in a named POSIX shared memory segment holding an
+ * open addressing table of fixed size binary keys.  Inserts are lock
+ * free: a slot is claimed by compare and swap, its key is written, and
+ * it is then marked full.  The first process to open a name creates and
+ * sizes the table, and it lasts until remove removes the name, even
+ * after every process closes it.
+ *
+ * The table does not grow.  Once three quarters full it stops accepting
+ * members and reports every further item as new, as do keys longer
+ * than a slot, so callers that use membership to suppress repeats may
+ * repeat but never omit.
+ */
+
+#ifndef SHARED_MEMBER_HPP
+#define SHARED_MEMBER_HPP
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <stdint.h>
+#ifdef HAVE_SHM_OPEN
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
+
+namespace hashdb {
+
+class shared_member_t {
+
+  private:
+  // the longest key kept in a slot, the size of a SHA-256 hash
+  static const size_t slot_key_size = 32;
+
+  // the fewest slots
+  static const uint64_t min_slots = 1024;
+
+  // yields spent waiting for a slot being written before passing it
+  static const size_t max_write_waits = 4096;
+
+  // slot states
+  static const uint32_t slot_empty = 0;
+  static const uint32_t slot_writing = 1;
+  static const uint32_t slot_full = 2;
+
+  // header states
+  static const uint32_t header_ready = 2;
+
+  struct slot_t {
+    std::atomic<uint32_t> state;
+    uint32_t size;
+    char key[slot_key_size];
+  };
+
+  struct header_t {
+    std::atomic<uint32_t> state;
+    uint32_t slot_size;
+    uint64_t num_slots;
+    std::atomic<uint64_t> count;
+  };
+
+  void* segment;
+  size_t segment_size;
+  header_t* header;
+  slot_t* slots;
+  uint64_t mask;
+
+  // do not allow copy or assignment
+  shared_member_t(const shared_member_t&);
+  shared_member_t& operator=(const shared_member_t&);
+
+  shared_member_t(void* const p_segment, const size_t p_segment_size) :
+          segment(p_segment), segment_size(p_segment_size),
+          header(static_cast<header_t*>(p_segment)),
+          slots(reinterpret_cast<slot_t*>(
+                         static_cast<char*>(p_segment) + sizeof(header_t))),
+          mask(header->num_slots - 1) {
+  }
+
+  // items are typically binary hashes, hash the whole item
+  static uint64_t item_hash(const char* const item, const size_t size) {
+    uint64_t h = 14695981039346656037ULL; // FNV-1a
+    for (size_t i=0; i<size; ++i) {
+      h = (h ^ static_cast<uint8_t>(item[i])) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  // the slots in about max_bytes, a power of two
+  static uint64_t slots_in(const size_t max_bytes) {
+    uint64_t num_slots = min_slots;
+    while ((num_slots * 2) * sizeof(slot_t) <= max_bytes) {
+      num_slots *= 2;
+    }
+    return num_slots;
+  }
+
+  // the segment name of a name
+  static std::string segment_name(const std::string& name) {
+    return "/" + name;
+  }
+
+  public:
+  /**
+   * Open the shared membership of name, creating it in about max_bytes
+   * if it does not exist.  The name may not contain a slash.  Returns
+   * the membership, or NULL and sets error_message.
+   */
+  static shared_member_t* open(const std::string& name,
+                               const size_t max_bytes,
+                               std::string& error_message) {
+    if (name.size() == 0 || name.find('/') != std::string::npos) {
+      error_message = "Invalid shared state name '" + name + "'.";
+      return NULL;
+    }
+#ifdef HAVE_SHM_OPEN
+    const std::string path = segment_name(name);
+
+    // create and size the segment, or open the existing one
+    bool is_creator = true;
+    int fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+      is_creator = false;
+      fd = ::shm_open(path.c_str(), O_RDWR, 0600);
+    }
+    if (fd < 0) {
+      error_message = "Unable to open shared state '" + name + "': " +
+                      std::strerror(errno) + ".";
+      return NULL;
+    }
+    size_t size = 0;
+    if (is_creator) {
+      size = sizeof(header_t) + slots_in(max_bytes) * sizeof(slot_t);
+      if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        error_message = "Unable to size shared state '" + name + "': " +
+                        std::strerror(errno) + ".";
+        ::close(fd);
+        ::shm_unlink(path.c_str());
+        return NULL;
+      }
+    } else {
+      // wait briefly for the creator to size it
+      for (int i=0; i<1000 && size == 0; ++i) {
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+          size = static_cast<size_t>(st.st_size);
+        } else {
+          ::usleep(1000);
+        }
+      }
+    }
+    void* const segment = (size < sizeof(header_t)) ? MAP_FAILED :
+          ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (segment == MAP_FAILED) {
+      error_message = "Unable to map shared state '" + name + "'.";
+      return NULL;
+    }
+
+    // the creator fills in the header, which the others wait for
+    header_t* const header = static_cast<header_t*>(segment);
+    if (is_creator) {
+      header->slot_size = sizeof(slot_t);
+      header->num_slots = (size - sizeof(header_t)) / sizeof(slot_t);
+      header->count.store(0, std::memory_order_relaxed);
+      header->state.store(header_ready, std::memory_order_release);
+    } else {
+      for (int i=0; i<1000 && header->state.load(
+                      std::memory_order_acquire) != header_ready; ++i) {
+        ::usleep(1000);
+      }
+      if (header->state.load(std::memory_order_acquire) != header_ready ||
+          header->slot_size != sizeof(slot_t) ||
+          sizeof(header_t) + header->num_slots * sizeof(slot_t) > size) {
+        ::munmap(segment, size);
+        error_message = "Shared state '" + name + "' is not usable.";
+        return NULL;
+      }
+    }
+    return new shared_member_t(segment, size);
+#else
+    (void)max_bytes;
+    error_message = "Shared state is not supported on this system.";
+    return NULL;
+#endif
+  }
+
+  /**
+   * Remove the shared membership of name.  Processes that have it open
+   * keep it until they close it.  Returns "" if successful else reason.
+   */
+  static std::string remove(const std::string& name) {
+#ifdef HAVE_SHM_OPEN
+    if (name.size() == 0 || name.find('/') != std::string::npos) {
+      return "Invalid shared state name '" + name + "'.";
+    }
+    if (::shm_unlink(segment_name(name).c_str()) != 0) {
+      return "Unable to remove shared state '" + name + "': " +
+             std::strerror(errno) + ".";
+    }
+    return "";
+#else
+    (void)name;
+    return "Shared state is not supported on this system.";
+#endif
+  }
+
+  ~shared_member_t() {
+#ifdef HAVE_SHM_OPEN
+    ::munmap(segment, segment_size);
+#endif
+  }
+
+  // return true if new else false
+  bool insert(const std::string& item) {
+    const size_t size = item.size();
+    if (size == 0 || size > slot_key_size) {
+      return true;
+    }
+    const bool full = header->count.load(std::memory_order_relaxed) * 4 >=
+                      header->num_slots * 3;
+    uint64_t i = item_hash(item.c_str(), size) & mask;
+    for (uint64_t probes = 0; probes < header->num_slots;
+                              ++probes, i = (i + 1) & mask) {
+      slot_t& slot = slots[i];
+      uint32_t state = slot.state.load(std::memory_order_acquire);
+
+      // claim an empty slot, unless full
+      if (state == slot_empty) {
+        if (full) {
+          return true;
+        }
+        if (slot.state.compare_exchange_strong(state, slot_writing,
+                                            std::memory_order_acquire)) {
+          slot.size = static_cast<uint32_t>(size);
+          memcpy(slot.key, item.c_str(), size);
+          slot.state.store(slot_full, std::memory_order_release);
+          header->count.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+        // else another insert claimed it, so compare its key
+      }
+
+      // wait for a slot being written, passing it if its writer died
+      for (size_t waits = 0; state == slot_writing &&
+                             waits < max_write_waits; ++waits) {
+#ifdef HAVE_SHM_OPEN
+        sched_yield();
+#endif
+        state = slot.state.load(std::memory_order_acquire);
+      }
+      if (state == slot_full && slot.size == size &&
+          memcmp(slot.key, item.c_str(), size) == 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+} // end namespace hashdb
+
+#endif
+
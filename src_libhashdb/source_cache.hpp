@@ -0,0 +1,301 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provide bounded threadsafe caches for expanded scans.
+ *
+ * Expanded scans report the data and names of every source of a
+ * matched hash, and popular sources and source lists are reported for
+ * many hashes.  The source cache keeps the information and serialized
+ * JSON object of sources by file hash.  The source list cache keeps the
+ * serialized source_sub_counts array of source lists by source_list_id,
+ * together with the list so that lists with the same ID are told apart.
+ *
+ * Each shard is independently locked and evicts by CLOCK: a hit marks
+ * its entry referenced, and a miss replaces the first unreferenced
+ * entry at the clock hand, clearing marks as the hand passes them.
+ * New entries are drawn from the memory budget, and a shard whose
+ * entry is refused evicts instead of growing.
+ *
+ * Hits and misses are reported through metrics_text while a cache
+ * exists, see metrics.hpp.
+ */
+
+#ifndef SOURCE_CACHE_HPP
+#define SOURCE_CACHE_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <sstream>
+#include <stdint.h>
+#include "hashdb.hpp"
+#include "memory_budget.hpp"
+#include "metrics.hpp"
+
+// no concurrent writes
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "mutex_lock.hpp"
+
+namespace hashdb {
+
+// the default number of sources and source lists to cache
+static const size_t default_source_cache_capacity = 65536;
+
+// the information of a source as reported by expanded scans
+struct source_information_t {
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  source_names_t source_names;
+  std::string json;                     // the JSON source object
+  source_information_t() : filesize(0), file_type(),
+                           zero_count(0), nonprobative_count(0),
+                           source_names(), json() {
+  }
+};
+
+// a source list as reported by expanded scans
+struct source_list_t {
+  source_sub_counts_t source_sub_counts;
+  std::string json;                     // the JSON source_sub_counts array
+  source_list_t() : source_sub_counts(), json() {
+  }
+};
+
+template <typename value_t>
+class clock_cache_t {
+
+  private:
+  // a power of two
+  static const size_t num_shards = 16;
+
+  // the approximate cost of an index node
+  static const size_t index_overhead = 64;
+
+  struct entry_t {
+    std::string key;
+    bool referenced;
+    value_t value;
+    size_t charged;                           // bytes from the budget
+    entry_t() : key(), referenced(false), value(), charged(0) {
+    }
+  };
+
+  struct shard_t {
+    std::vector<entry_t> entries;
+    std::map<std::string, size_t> index;      // key to entry
+    size_t hand;                              // the CLOCK hand
+    uint64_t hits;
+    uint64_t misses;
+#ifdef HAVE_PTHREAD
+    mutable pthread_mutex_t M;                // mutext
+#else
+    mutable int M;                            // placeholder
+#endif
+    shard_t() : entries(), index(), hand(0), hits(0), misses(0), M() {
+      MUTEX_INIT(&M);
+    }
+    ~shard_t() {
+      MUTEX_DESTROY(&M);
+    }
+
+    private:
+    // do not allow copy or assignment
+    shard_t(const shard_t&);
+    shard_t& operator=(const shard_t&);
+  };
+
+  const std::string name;
+  const size_t shard_capacity;
+  shard_t shards[num_shards];
+
+  // do not allow copy or assignment
+  clock_cache_t(const clock_cache_t&);
+  clock_cache_t& operator=(const clock_cache_t&);
+
+  // keys are binary hashes or IDs so a few bytes pick a shard
+  static size_t shard_index(const std::string& key) {
+    uint32_t h = 2166136261u; // FNV-1a
+    const size_t n = (key.size() < 8) ? key.size() : 8;
+    for (size_t i=0; i<n; ++i) {
+      h = (h ^ static_cast<uint8_t>(key[i])) * 16777619u;
+    }
+    return h & (num_shards - 1);
+  }
+
+  // the approximate memory of an entry and its index node
+  static size_t entry_bytes(const std::string& key, const value_t& value) {
+    return sizeof(entry_t) + index_overhead + 2 * key.size() +
+           value.json.size();
+  }
+
+  // the hits and misses of all shards
+  void totals(uint64_t& hits, uint64_t& misses) const {
+    hits = 0;
+    misses = 0;
+    for (size_t i=0; i<num_shards; ++i) {
+      MUTEX_LOCK(&shards[i].M);
+      hits += shards[i].hits;
+      misses += shards[i].misses;
+      MUTEX_UNLOCK(&shards[i].M);
+    }
+  }
+
+  // report the hits and misses
+  static void add_metrics(const void* const data, const uint64_t id,
+                          hashdb::metric_samples_t& samples) {
+    const clock_cache_t* const cache =
+                                  static_cast<const clock_cache_t*>(data);
+    uint64_t hits;
+    uint64_t misses;
+    cache->totals(hits, misses);
+    std::stringstream ss;
+    ss << "cache=\"" << cache->name << "\",id=\"" << id << "\"";
+    const std::string labels = ss.str();
+    samples.push_back(hashdb::metric_sample_t("hashdb_cache_hits",
+                "counter", "Lookups found in a scan cache.", labels,
+                static_cast<double>(hits)));
+    samples.push_back(hashdb::metric_sample_t("hashdb_cache_misses",
+                "counter", "Lookups not found in a scan cache.", labels,
+                static_cast<double>(misses)));
+  }
+
+  public:
+  // cache up to capacity values, reporting metrics under p_name
+  clock_cache_t(const std::string& p_name, const size_t capacity) :
+          name(p_name),
+          shard_capacity((capacity + num_shards - 1) / num_shards),
+          shards() {
+    hashdb::metrics_register(add_metrics, this);
+  }
+
+  ~clock_cache_t() {
+    hashdb::metrics_unregister(this);
+    for (size_t i=0; i<num_shards; ++i) {
+      for (size_t j=0; j<shards[i].entries.size(); ++j) {
+        memory_budget().release(shards[i].entries[j].charged);
+      }
+    }
+  }
+
+  // return true and the value if cached, else count a miss
+  bool find(const std::string& key, value_t& value) {
+    shard_t& shard = shards[shard_index(key)];
+    MUTEX_LOCK(&shard.M);
+    typename std::map<std::string, size_t>::const_iterator it =
+                                                     shard.index.find(key);
+    const bool is_cached = (it != shard.index.end());
+    if (is_cached) {
+      entry_t& entry = shard.entries[it->second];
+      entry.referenced = true;
+      value = entry.value;
+      ++shard.hits;
+    } else {
+      ++shard.misses;
+    }
+    MUTEX_UNLOCK(&shard.M);
+    return is_cached;
+  }
+
+  // cache the value, evicting an unreferenced value if full
+  void insert(const std::string& key, const value_t& value) {
+    if (shard_capacity == 0) {
+      return;
+    }
+    shard_t& shard = shards[shard_index(key)];
+    MUTEX_LOCK(&shard.M);
+    typename std::map<std::string, size_t>::const_iterator it =
+                                                     shard.index.find(key);
+    if (it != shard.index.end()) {
+      // replace the value under the key
+      shard.entries[it->second].value = value;
+      MUTEX_UNLOCK(&shard.M);
+      return;
+    }
+
+    const size_t bytes = entry_bytes(key, value);
+    size_t slot;
+    if (shard.entries.size() < shard_capacity &&
+        (shard.entries.size() == 0 || memory_budget().try_acquire(bytes))) {
+      // use a new entry
+      if (shard.entries.size() == 0) {
+        memory_budget().charge(bytes);
+      }
+      slot = shard.entries.size();
+      shard.entries.push_back(entry_t());
+      shard.entries[slot].charged = bytes;
+    } else {
+      // advance the hand to an unreferenced entry and evict it
+      while (shard.entries[shard.hand].referenced) {
+        shard.entries[shard.hand].referenced = false;
+        shard.hand = (shard.hand + 1) % shard.entries.size();
+      }
+      slot = shard.hand;
+      shard.hand = (shard.hand + 1) % shard.entries.size();
+      shard.index.erase(shard.entries[slot].key);
+
+      // the entry is reused, charge for its new size
+      memory_budget().release(shard.entries[slot].charged);
+      memory_budget().charge(bytes);
+      shard.entries[slot].charged = bytes;
+    }
+    entry_t& entry = shard.entries[slot];
+    entry.key = key;
+    entry.referenced = false;
+    entry.value = value;
+    shard.index[key] = slot;
+    MUTEX_UNLOCK(&shard.M);
+  }
+
+  // hits and misses as JSON members named after the cache
+  std::string stats_json() const {
+    uint64_t hits;
+    uint64_t misses;
+    totals(hits, misses);
+    std::stringstream ss;
+    ss << "\"" << name << "_hits\":" << hits
+       << ", \"" << name << "_misses\":" << misses;
+    return ss.str();
+  }
+};
+
+// sources by file hash
+class source_cache_t : public clock_cache_t<source_information_t> {
+  public:
+  source_cache_t(const size_t capacity) :
+          clock_cache_t<source_information_t>("source_cache", capacity) {
+  }
+};
+
+// source lists by source_list_id
+class source_list_cache_t : public clock_cache_t<source_list_t> {
+  public:
+  source_list_cache_t(const size_t capacity) :
+          clock_cache_t<source_list_t>("source_list_cache", capacity) {
+  }
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,262 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * A compressed bitmap of source IDs in the style of a roaring bitmap.
+ * IDs are grouped into containers of 65536 by their high bits.  A
+ * container of up to 4096 IDs is a sorted array of the low 16 bits and a
+ * fuller container is a bitset, so dense and sparse sets both stay
+ * small.  Containers are encoded one per record for storing in LMDB.
+ */
+
+#ifndef SOURCE_ID_BITMAP_HPP
+#define SOURCE_ID_BITMAP_HPP
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <iterator>
+#include <stdint.h>
+
+namespace hashdb {
+
+  // one container of IDs sharing their high bits
+  class source_id_container_t {
+    private:
+    static const size_t max_array_size = 4096;
+    static const size_t bitset_words = 65536 / 64;
+    std::vector<uint16_t> array;  // sorted, if not a bitset
+    std::vector<uint64_t> bits;   // bitset_words words, if a bitset
+    size_t count;
+
+    void to_bitset() {
+      bits.assign(bitset_words, 0);
+      for (size_t i=0; i<array.size(); ++i) {
+        bits[array[i] >> 6] |= static_cast<uint64_t>(1) << (array[i] & 63);
+      }
+      std::vector<uint16_t>().swap(array);
+    }
+
+    public:
+    source_id_container_t() : array(), bits(), count(0) {
+    }
+
+    size_t size() const {
+      return count;
+    }
+
+    bool is_bitset() const {
+      return bits.size() != 0;
+    }
+
+    bool contains(const uint16_t low) const {
+      if (is_bitset()) {
+        return (bits[low >> 6] >> (low & 63)) & 1;
+      }
+      return std::binary_search(array.begin(), array.end(), low);
+    }
+
+    // add the ID, false if it was already present
+    bool add(const uint16_t low) {
+      if (is_bitset()) {
+        const uint64_t mask = static_cast<uint64_t>(1) << (low & 63);
+        if (bits[low >> 6] & mask) {
+          return false;
+        }
+        bits[low >> 6] |= mask;
+        ++count;
+        return true;
+      }
+      std::vector<uint16_t>::iterator it =
+                         std::lower_bound(array.begin(), array.end(), low);
+      if (it != array.end() && *it == low) {
+        return false;
+      }
+      array.insert(it, low);
+      ++count;
+      if (count > max_array_size) {
+        to_bitset();
+      }
+      return true;
+    }
+
+    // remove the ID, false if it was not present
+    bool remove(const uint16_t low) {
+      if (is_bitset()) {
+        const uint64_t mask = static_cast<uint64_t>(1) << (low & 63);
+        if ((bits[low >> 6] & mask) == 0) {
+          return false;
+        }
+        bits[low >> 6] &= ~mask;
+        --count;
+
+        // a container that fits an array again becomes one
+        if (count <= max_array_size) {
+          array.reserve(count);
+          for (size_t i=0; i<bitset_words; ++i) {
+            for (uint64_t word = bits[i]; word != 0; word &= word - 1) {
+              array.push_back(static_cast<uint16_t>(
+                                 i * 64 + __builtin_ctzll(word)));
+            }
+          }
+          std::vector<uint64_t>().swap(bits);
+        }
+        return true;
+      }
+      std::vector<uint16_t>::iterator it =
+                         std::lower_bound(array.begin(), array.end(), low);
+      if (it == array.end() || *it != low) {
+        return false;
+      }
+      array.erase(it);
+      --count;
+      return true;
+    }
+
+    // add the IDs of the other container
+    void unite(const source_id_container_t& other) {
+      if (other.is_bitset() && !is_bitset()) {
+        to_bitset();
+      }
+      if (is_bitset()) {
+        if (other.is_bitset()) {
+          count = 0;
+          for (size_t i=0; i<bitset_words; ++i) {
+            bits[i] |= other.bits[i];
+            count += __builtin_popcountll(bits[i]);
+          }
+        } else {
+          for (size_t i=0; i<other.array.size(); ++i) {
+            add(other.array[i]);
+          }
+        }
+        return;
+      }
+      std::vector<uint16_t> merged;
+      merged.reserve(array.size() + other.array.size());
+      std::set_union(array.begin(), array.end(),
+                     other.array.begin(), other.array.end(),
+                     std::back_inserter(merged));
+      array.swap(merged);
+      count = array.size();
+      if (count > max_array_size) {
+        to_bitset();
+      }
+    }
+
+    // the container as bytes: a type byte, then little-endian 16-bit IDs
+    // for an array or little-endian 64-bit words for a bitset
+    std::string encode() const {
+      std::string encoding;
+      if (is_bitset()) {
+        encoding.reserve(1 + bitset_words * 8);
+        encoding.push_back('\1');
+        for (size_t i=0; i<bitset_words; ++i) {
+          for (size_t j=0; j<8; ++j) {
+            encoding.push_back(static_cast<char>((bits[i] >> (8*j)) & 0xff));
+          }
+        }
+      } else {
+        encoding.reserve(1 + array.size() * 2);
+        encoding.push_back('\0');
+        for (size_t i=0; i<array.size(); ++i) {
+          encoding.push_back(static_cast<char>(array[i] & 0xff));
+          encoding.push_back(static_cast<char>(array[i] >> 8));
+        }
+      }
+      return encoding;
+    }
+
+    // read an encoded container, false if the encoding is invalid
+    bool decode(const uint8_t* const p, const size_t size) {
+      array.clear();
+      bits.clear();
+      count = 0;
+      if (size == 1 + bitset_words * 8 && p[0] == 1) {
+        bits.assign(bitset_words, 0);
+        for (size_t i=0; i<bitset_words; ++i) {
+          for (size_t j=0; j<8; ++j) {
+            bits[i] |= static_cast<uint64_t>(p[1 + i*8 + j]) << (8*j);
+          }
+          count += __builtin_popcountll(bits[i]);
+        }
+        return true;
+      }
+      if (size % 2 == 1 && p[0] == 0) {
+        array.resize(size / 2);
+        for (size_t i=0; i<array.size(); ++i) {
+          array[i] = static_cast<uint16_t>(p[1 + i*2] | (p[2 + i*2] << 8));
+        }
+        count = array.size();
+        return true;
+      }
+      return false;
+    }
+  };
+
+  class source_id_bitmap_t {
+    public:
+    typedef std::map<uint64_t, source_id_container_t> containers_t;
+    containers_t containers;      // by the high bits of their IDs
+
+    source_id_bitmap_t() : containers() {
+    }
+
+    static uint64_t high(const uint64_t source_id) {
+      return source_id >> 16;
+    }
+
+    static uint16_t low(const uint64_t source_id) {
+      return static_cast<uint16_t>(source_id & 0xffff);
+    }
+
+    bool contains(const uint64_t source_id) const {
+      const containers_t::const_iterator it =
+                                       containers.find(high(source_id));
+      return (it != containers.end() && it->second.contains(low(source_id)));
+    }
+
+    // add the ID, false if it was already present
+    bool add(const uint64_t source_id) {
+      return containers[high(source_id)].add(low(source_id));
+    }
+
+    // add the IDs of the other bitmap
+    void unite(const source_id_bitmap_t& other) {
+      for (containers_t::const_iterator it = other.containers.begin();
+           it != other.containers.end(); ++it) {
+        containers[it->first].unite(it->second);
+      }
+    }
+
+    // the number of IDs
+    size_t size() const {
+      size_t total = 0;
+      for (containers_t::const_iterator it = containers.begin();
+           it != containers.end(); ++it) {
+        total += it->second.size();
+      }
+      return total;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,456 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Codes source names in the compressed source name format.
+ */
+
+#include <config.h>
+#include "source_name_codec.hpp"
+#include "lmdb_helper.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+
+namespace hashdb {
+
+  const uint32_t plain_source_name_format = 1;
+  const uint32_t compressed_source_name_format = 2;
+  const char* const source_name_dictionary_filename =
+                                                 "source_name_dictionary";
+
+  // dictionary bounds
+  static const size_t max_dictionary_names = 16384;
+  static const size_t max_zlib_dictionary_size = 32768;
+
+  // distinct strings counted per kind while training
+  static const size_t max_counted = 1 << 20;
+
+  // shorter suffixes are not worth deflating
+  static const size_t min_deflate_size = 16;
+
+  // names are bounded by the LMDB value size, far below this
+  static const size_t max_inflated_size = 65536;
+
+  // append a varint
+  static void put_uint64(std::string& s, const uint64_t value) {
+    uint8_t bytes[10];
+    const uint8_t* const p = lmdb_helper::encode_uint64_t(value, bytes);
+    s.append(reinterpret_cast<const char*>(bytes), p - bytes);
+  }
+
+  // append a size then the bytes of the string
+  static void put_string(std::string& s, const std::string& value) {
+    put_uint64(s, value.size());
+    s.append(value);
+  }
+
+  // read a varint that must end before p_stop
+  static bool get_uint64(const uint8_t*& p, const uint8_t* const p_stop,
+                         uint64_t& value) {
+    size_t i = 0;
+    while (p + i < p_stop && i < 10 && (p[i] & 0x80) != 0) {
+      ++i;
+    }
+    if (p + i >= p_stop || i == 10) {
+      return false;
+    }
+    p = lmdb_helper::decode_uint64_t(p, value);
+    return true;
+  }
+
+  // read a size then the bytes of a string that must end by p_stop
+  static bool get_string(const uint8_t*& p, const uint8_t* const p_stop,
+                         std::string& value) {
+    uint64_t size;
+    if (!get_uint64(p, p_stop, size) ||
+        size > static_cast<uint64_t>(p_stop - p)) {
+      return false;
+    }
+    value.assign(reinterpret_cast<const char*>(p), size);
+    p += size;
+    return true;
+  }
+
+  // ************************************************************
+  // source_name_codec_t
+  // ************************************************************
+  source_name_codec_t::source_name_codec_t(
+                   const std::vector<std::string>& p_repository_names,
+                   const std::vector<std::string>& p_prefixes,
+                   const std::string& p_zlib_dictionary) :
+         repository_names(p_repository_names),
+         repository_codes(),
+         prefixes(p_prefixes),
+         prefix_codes(),
+         zlib_dictionary(p_zlib_dictionary),
+         deflater(),
+         deflated() {
+    index_codes();
+
+    // raw deflate, so the stored suffix carries no header
+    deflater.zalloc = Z_NULL;
+    deflater.zfree = Z_NULL;
+    deflater.opaque = Z_NULL;
+    if (deflateInit2(&deflater, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+      std::cerr << "zlib error initializing the source name codec\n";
+      assert(0);
+    }
+  }
+
+  source_name_codec_t::~source_name_codec_t() {
+    deflateEnd(&deflater);
+  }
+
+  void source_name_codec_t::index_codes() {
+    for (size_t i=0; i<repository_names.size(); ++i) {
+      repository_codes[repository_names[i]] = i + 1;
+    }
+    for (size_t i=0; i<prefixes.size(); ++i) {
+      prefix_codes[prefixes[i]] = i + 1;
+    }
+  }
+
+  source_name_codec_t* source_name_codec_t::read(
+                                          const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in.is_open()) {
+      return NULL;
+    }
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string bytes = ss.str();
+    if (bytes.size() < 8 || memcmp(bytes.c_str(), "hdbsnd1", 8) != 0) {
+      return NULL;
+    }
+
+    // the repository names, the prefixes, then the zlib dictionary
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(bytes.c_str()) + 8;
+    const uint8_t* const p_stop =
+                 reinterpret_cast<const uint8_t*>(bytes.c_str()) +
+                 bytes.size();
+    std::vector<std::string> lists[2];
+    for (size_t k=0; k<2; ++k) {
+      uint64_t count;
+      if (!get_uint64(p, p_stop, count) || count > max_dictionary_names) {
+        return NULL;
+      }
+      lists[k].resize(count);
+      for (uint64_t i=0; i<count; ++i) {
+        if (!get_string(p, p_stop, lists[k][i])) {
+          return NULL;
+        }
+      }
+    }
+    std::string zlib_dictionary;
+    if (!get_string(p, p_stop, zlib_dictionary) || p != p_stop ||
+        zlib_dictionary.size() > max_zlib_dictionary_size) {
+      return NULL;
+    }
+    return new source_name_codec_t(lists[0], lists[1], zlib_dictionary);
+  }
+
+  bool source_name_codec_t::write(const std::string& filename) const {
+    std::string bytes("hdbsnd1", 8);
+    put_uint64(bytes, repository_names.size());
+    for (size_t i=0; i<repository_names.size(); ++i) {
+      put_string(bytes, repository_names[i]);
+    }
+    put_uint64(bytes, prefixes.size());
+    for (size_t i=0; i<prefixes.size(); ++i) {
+      put_string(bytes, prefixes[i]);
+    }
+    put_string(bytes, zlib_dictionary);
+
+    const std::string temp_filename = filename + ".tmp";
+    std::ofstream out(temp_filename.c_str(),
+                      std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    out.write(bytes.c_str(), bytes.size());
+    out.close();
+    if (out.fail()) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(filename.c_str());
+#endif
+    if (std::rename(temp_filename.c_str(), filename.c_str()) != 0) {
+      std::remove(temp_filename.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  void source_name_codec_t::encode(const std::string& repository_name,
+                                   const std::string& filename,
+                                   std::string& encoding) {
+    encoding.clear();
+
+    // repository name
+    codes_t::const_iterator it = repository_codes.find(repository_name);
+    if (it != repository_codes.end()) {
+      put_uint64(encoding, it->second);
+    } else {
+      put_uint64(encoding, 0);
+      put_string(encoding, repository_name);
+    }
+
+    // longest dictionary prefix ending in a path separator
+    size_t prefix_size = 0;
+    uint64_t prefix_code = 0;
+    for (size_t i = filename.size(); i > 0 && prefix_codes.size() != 0;
+         --i) {
+      const char c = filename[i - 1];
+      if (c != '/' && c != '\\') {
+        continue;
+      }
+      it = prefix_codes.find(filename.substr(0, i));
+      if (it != prefix_codes.end()) {
+        prefix_size = i;
+        prefix_code = it->second;
+        break;
+      }
+    }
+    put_uint64(encoding, prefix_code);
+
+    // the rest, deflated if that is smaller
+    const size_t suffix_size = filename.size() - prefix_size;
+    const char* const suffix = filename.c_str() + prefix_size;
+    if (suffix_size >= min_deflate_size) {
+      deflated.resize(deflateBound(&deflater, suffix_size));
+      if (deflateReset(&deflater) != Z_OK ||
+          (zlib_dictionary.size() != 0 && deflateSetDictionary(&deflater,
+                 reinterpret_cast<const Bytef*>(zlib_dictionary.c_str()),
+                 static_cast<uInt>(zlib_dictionary.size())) != Z_OK)) {
+        std::cerr << "zlib error in the source name codec\n";
+        assert(0);
+      }
+      deflater.next_in =
+                reinterpret_cast<Bytef*>(const_cast<char*>(suffix));
+      deflater.avail_in = static_cast<uInt>(suffix_size);
+      deflater.next_out = &deflated[0];
+      deflater.avail_out = static_cast<uInt>(deflated.size());
+      if (deflate(&deflater, Z_FINISH) != Z_STREAM_END) {
+        std::cerr << "zlib error in the source name codec\n";
+        assert(0);
+      }
+      const size_t deflated_size = deflater.total_out;
+      if (deflated_size + 2 < suffix_size) {
+        put_uint64(encoding, (static_cast<uint64_t>(deflated_size) << 1) | 1);
+        put_uint64(encoding, suffix_size);
+        encoding.append(reinterpret_cast<const char*>(&deflated[0]),
+                        deflated_size);
+        return;
+      }
+    }
+    put_uint64(encoding, static_cast<uint64_t>(suffix_size) << 1);
+    encoding.append(suffix, suffix_size);
+  }
+
+  bool source_name_codec_t::decode(const uint8_t* const p_start,
+                                   const size_t size,
+                                   std::string& repository_name,
+                                   std::string& filename) const {
+    const uint8_t* p = p_start;
+    const uint8_t* const p_stop = p_start + size;
+
+    // repository name
+    uint64_t code;
+    if (!get_uint64(p, p_stop, code)) {
+      return false;
+    }
+    if (code == 0) {
+      if (!get_string(p, p_stop, repository_name)) {
+        return false;
+      }
+    } else if (code <= repository_names.size()) {
+      repository_name = repository_names[code - 1];
+    } else {
+      return false;
+    }
+
+    // prefix
+    if (!get_uint64(p, p_stop, code) || code > prefixes.size()) {
+      return false;
+    }
+    filename = (code == 0) ? std::string() : prefixes[code - 1];
+
+    // suffix
+    uint64_t header;
+    if (!get_uint64(p, p_stop, header)) {
+      return false;
+    }
+    const uint64_t stored_size = header >> 1;
+    uint64_t suffix_size = stored_size;
+    if ((header & 1) != 0 && !get_uint64(p, p_stop, suffix_size)) {
+      return false;
+    }
+    if (stored_size != static_cast<uint64_t>(p_stop - p) ||
+        suffix_size > max_inflated_size) {
+      return false;
+    }
+    if ((header & 1) == 0) {
+      filename.append(reinterpret_cast<const char*>(p), stored_size);
+      return true;
+    }
+
+    // inflate with the preset dictionary
+    std::vector<uint8_t> inflated(suffix_size + 1);
+    z_stream inflater;
+    memset(&inflater, 0, sizeof(inflater));
+    if (inflateInit2(&inflater, -15) != Z_OK) {
+      return false;
+    }
+    bool is_valid = zlib_dictionary.size() == 0 ||
+                    inflateSetDictionary(&inflater,
+                 reinterpret_cast<const Bytef*>(zlib_dictionary.c_str()),
+                 static_cast<uInt>(zlib_dictionary.size())) == Z_OK;
+    if (is_valid) {
+      inflater.next_in = const_cast<Bytef*>(p);
+      inflater.avail_in = static_cast<uInt>(stored_size);
+      inflater.next_out = &inflated[0];
+      inflater.avail_out = static_cast<uInt>(inflated.size());
+      is_valid = inflate(&inflater, Z_FINISH) == Z_STREAM_END &&
+                 inflater.total_out == suffix_size;
+    }
+    inflateEnd(&inflater);
+    if (is_valid) {
+      filename.append(reinterpret_cast<const char*>(&inflated[0]),
+                      suffix_size);
+    }
+    return is_valid;
+  }
+
+  size_t source_name_codec_t::num_repository_names() const {
+    return repository_names.size();
+  }
+
+  size_t source_name_codec_t::num_prefixes() const {
+    return prefixes.size();
+  }
+
+  size_t source_name_codec_t::zlib_dictionary_size() const {
+    return zlib_dictionary.size();
+  }
+
+  // ************************************************************
+  // source_name_trainer_t
+  // ************************************************************
+  // count a string unless too many distinct strings are already counted
+  static void count_string(std::map<std::string, uint64_t>& counts,
+                           const std::string& value) {
+    std::map<std::string, uint64_t>::iterator it = counts.find(value);
+    if (it != counts.end()) {
+      ++it->second;
+    } else if (counts.size() < max_counted) {
+      counts[value] = 1;
+    }
+  }
+
+  // the strings seen more than once by the bytes they would save, most
+  // first, at most max_size of them
+  typedef std::pair<uint64_t, std::string> scored_string_t;
+  static void best_strings(const std::map<std::string, uint64_t>& counts,
+                           const bool score_by_size,
+                           const size_t max_size,
+                           std::vector<std::string>& best) {
+    std::vector<scored_string_t> scored;
+    for (std::map<std::string, uint64_t>::const_iterator it =
+         counts.begin(); it != counts.end(); ++it) {
+      if (it->second > 1) {
+        scored.push_back(scored_string_t(score_by_size ?
+                               it->second * it->first.size() : it->second,
+                               it->first));
+      }
+    }
+    std::sort(scored.begin(), scored.end());
+    best.clear();
+    for (std::vector<scored_string_t>::reverse_iterator it =
+         scored.rbegin(); it != scored.rend() && best.size() < max_size;
+         ++it) {
+      best.push_back(it->second);
+    }
+  }
+
+  source_name_trainer_t::source_name_trainer_t() :
+         repository_counts(), prefix_counts(), component_counts() {
+  }
+
+  void source_name_trainer_t::add(const std::string& repository_name,
+                                  const std::string& filename) {
+    count_string(repository_counts, repository_name);
+    size_t start = 0;
+    for (size_t i=0; i<filename.size(); ++i) {
+      const char c = filename[i];
+      if (c != '/' && c != '\\') {
+        continue;
+      }
+      count_string(prefix_counts, filename.substr(0, i + 1));
+      if (i - start >= 3) {
+        count_string(component_counts, filename.substr(start, i - start));
+      }
+      start = i + 1;
+    }
+    if (filename.size() - start >= 3) {
+      count_string(component_counts, filename.substr(start));
+    }
+  }
+
+  source_name_codec_t* source_name_trainer_t::train() const {
+    std::vector<std::string> repository_names;
+    best_strings(repository_counts, false, max_dictionary_names,
+                 repository_names);
+    std::vector<std::string> prefixes;
+    best_strings(prefix_counts, true, max_dictionary_names, prefixes);
+
+    // zlib finds nearer matches in fewer bits, so the best components
+    // go at the end of the dictionary
+    std::vector<std::string> components;
+    best_strings(component_counts, true, max_dictionary_names, components);
+    std::vector<std::string> chosen;
+    size_t zlib_dictionary_size = 0;
+    for (size_t i=0; i<components.size(); ++i) {
+      if (zlib_dictionary_size + components[i].size() + 1 >
+                                           max_zlib_dictionary_size) {
+        break;
+      }
+      chosen.push_back(components[i]);
+      zlib_dictionary_size += components[i].size() + 1;
+    }
+    std::string zlib_dictionary;
+    for (std::vector<std::string>::reverse_iterator it = chosen.rbegin();
+         it != chosen.rend(); ++it) {
+      zlib_dictionary.append(*it);
+      zlib_dictionary.push_back('/');
+    }
+    return new source_name_codec_t(repository_names, prefixes,
+                                   zlib_dictionary);
+  }
+
+} // end namespace hashdb
@@ -0,0 +1,149 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+
+/**
+ * \file
+ * Codes the repository name, filename pairs of the source name store in
+ * the compressed source name format.  A trained dictionary, kept in the
+ * source_name_dictionary file of the hashdb directory, lists the common
+ * repository names, the common directory prefixes of filenames, and a
+ * preset zlib dictionary of common path components.
+ *
+ * A pair is encoded as:
+ *   repository code, or 0 then the repository name size and bytes,
+ *   prefix code of the longest dictionary prefix of the filename, or 0,
+ *   (suffix size << 1 | deflated), and if deflated the raw suffix size,
+ *   then the rest of the filename, raw or deflated with the preset
+ *   zlib dictionary, whichever is smaller.
+ *
+ * Codes are index + 1 into the dictionary lists, most frequent first, so
+ * common names take one byte.  The encoding depends only on the pair and
+ * the dictionary so the store can compare values for duplicates.
+ *
+ * encode is not threadsafe, decode is.
+ */
+
+#ifndef SOURCE_NAME_CODEC_HPP
+#define SOURCE_NAME_CODEC_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+#include <zlib.h>
+
+namespace hashdb {
+
+  // record formats, selected by settings_t::source_name_format
+  extern const uint32_t plain_source_name_format;
+  extern const uint32_t compressed_source_name_format;
+
+  // the name of the dictionary file in the hashdb directory
+  extern const char* const source_name_dictionary_filename;
+
+class source_name_codec_t {
+
+  private:
+  typedef std::map<std::string, uint64_t> codes_t;
+
+  std::vector<std::string> repository_names;
+  codes_t repository_codes;
+  std::vector<std::string> prefixes;
+  codes_t prefix_codes;
+  std::string zlib_dictionary;
+  z_stream deflater;
+  std::vector<uint8_t> deflated;
+
+  // do not allow copy or assignment
+  source_name_codec_t(const source_name_codec_t&);
+  source_name_codec_t& operator=(const source_name_codec_t&);
+
+  // index the code of each name and prefix
+  void index_codes();
+
+  public:
+  source_name_codec_t(const std::vector<std::string>& p_repository_names,
+                      const std::vector<std::string>& p_prefixes,
+                      const std::string& p_zlib_dictionary);
+
+  ~source_name_codec_t();
+
+  /**
+   * Read the dictionary in filename, NULL if it is missing or invalid.
+   */
+  static source_name_codec_t* read(const std::string& filename);
+
+  /**
+   * Write the dictionary to filename, replacing any existing file.
+   * Returns false if it cannot be written.
+   */
+  bool write(const std::string& filename) const;
+
+  /**
+   * Set encoding to the encoded repository_name, filename pair.
+   */
+  void encode(const std::string& repository_name,
+              const std::string& filename,
+              std::string& encoding);
+
+  /**
+   * Decode the pair in the bytes at p, false if they are not a valid
+   * encoding.
+   */
+  bool decode(const uint8_t* const p, const size_t size,
+              std::string& repository_name,
+              std::string& filename) const;
+
+  // the dictionary sizes, for reporting
+  size_t num_repository_names() const;
+  size_t num_prefixes() const;
+  size_t zlib_dictionary_size() const;
+};
+
+/**
+ * Counts the repository names, filename prefixes, and path components
+ * of the names it is given, then trains a dictionary of the common ones.
+ * Past a bound on distinct strings, only strings already seen are
+ * counted, so the ones seen early stand for the rest.
+ */
+class source_name_trainer_t {
+
+  private:
+  typedef std::map<std::string, uint64_t> counts_t;
+
+  counts_t repository_counts;
+  counts_t prefix_counts;
+  counts_t component_counts;
+
+  public:
+  source_name_trainer_t();
+
+  // count the parts of one name
+  void add(const std::string& repository_name, const std::string& filename);
+
+  /**
+   * The codec of the dictionary trained from the names added.
+   */
+  source_name_codec_t* train() const;
+};
+
+} // end namespace hashdb
+
+#endif
@@ -0,0 +1,241 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Per-thread stage and lookup counters and their JSON report.
+ */
+
+#include <config.h>
+#include "stage_stats.hpp"
+#include "hashdb.hpp"
+#include <set>
+#include <sstream>
+#include <cstring>
+#include <ctime>
+#include <sys/time.h>
+#include <pthread.h>
+#include <atomic>
+
+namespace hashdb {
+
+  static const char* const stage_names[NUM_STAGES] = {
+    "read", "zero_check", "hash", "entropy", "label", "insert_wait",
+    "commit", "sync", "scan_queue_wait", "scan_array", "scan_swap"};
+
+  static const char* const lookup_names[NUM_LOOKUPS] = {
+    "hash_store_hits", "hash_store_misses",
+    "hash_data_store_hits", "hash_data_store_misses"};
+
+  stage_totals_t::stage_totals_t() :
+                   count(), ns(), max_ns(), buckets(), lookups() {
+  }
+
+  // The counters of one thread.  Only the owning thread writes them, so
+  // a relaxed load and store is enough and costs no locked instruction.
+  struct thread_stage_stats_t {
+    std::atomic<uint64_t> count[NUM_STAGES];
+    std::atomic<uint64_t> ns[NUM_STAGES];
+    std::atomic<uint64_t> max_ns[NUM_STAGES];
+    std::atomic<uint64_t> buckets[NUM_STAGES][num_stage_buckets];
+    std::atomic<uint64_t> lookups[NUM_LOOKUPS];
+    thread_stage_stats_t() :
+                   count(), ns(), max_ns(), buckets(), lookups() {
+    }
+  };
+
+  static void add(std::atomic<uint64_t>& counter, const uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  }
+
+  static uint64_t get(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+  }
+
+  // add the counters of a thread into totals
+  static void fold(const thread_stage_stats_t& stats,
+                   stage_totals_t& totals) {
+    for (size_t s=0; s<NUM_STAGES; ++s) {
+      totals.count[s] += get(stats.count[s]);
+      totals.ns[s] += get(stats.ns[s]);
+      if (get(stats.max_ns[s]) > totals.max_ns[s]) {
+        totals.max_ns[s] = get(stats.max_ns[s]);
+      }
+      for (size_t b=0; b<num_stage_buckets; ++b) {
+        totals.buckets[s][b] += get(stats.buckets[s][b]);
+      }
+    }
+    for (size_t l=0; l<NUM_LOOKUPS; ++l) {
+      totals.lookups[l] += get(stats.lookups[l]);
+    }
+  }
+
+  // the live threads and the totals of threads that have exited, never
+  // freed so that threads exiting during shutdown may still use them
+  static pthread_mutex_t registry_M = PTHREAD_MUTEX_INITIALIZER;
+  static std::set<const thread_stage_stats_t*>* live_stats =
+                               new std::set<const thread_stage_stats_t*>;
+  static stage_totals_t* retired_totals = new stage_totals_t;
+
+  // registers the counters of this thread while the thread runs
+  class thread_stage_stats_owner_t {
+    private:
+    thread_stage_stats_owner_t(const thread_stage_stats_owner_t&);
+    thread_stage_stats_owner_t& operator=(
+                                  const thread_stage_stats_owner_t&);
+
+    public:
+    thread_stage_stats_t stats;
+
+    thread_stage_stats_owner_t() : stats() {
+      pthread_mutex_lock(&registry_M);
+      live_stats->insert(&stats);
+      pthread_mutex_unlock(&registry_M);
+    }
+
+    ~thread_stage_stats_owner_t() {
+      pthread_mutex_lock(&registry_M);
+      live_stats->erase(&stats);
+      fold(stats, *retired_totals);
+      pthread_mutex_unlock(&registry_M);
+    }
+  };
+
+  static thread_stage_stats_t& thread_stats() {
+    static thread_local thread_stage_stats_owner_t owner;
+    return owner.stats;
+  }
+
+  const char* stage_name(const stage_t stage) {
+    return stage_names[stage];
+  }
+
+  const char* lookup_name(const lookup_t lookup) {
+    return lookup_names[lookup];
+  }
+
+  uint64_t stage_clock_ns() {
+#ifdef CLOCK_MONOTONIC
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL + t.tv_nsec;
+#else
+    struct timeval t;
+    gettimeofday(&t, 0);
+    return static_cast<uint64_t>(t.tv_sec) * 1000000000ULL +
+           static_cast<uint64_t>(t.tv_usec) * 1000;
+#endif
+  }
+
+  void stage_record(const stage_t stage, const uint64_t ns) {
+    thread_stage_stats_t& stats = thread_stats();
+    add(stats.count[stage], 1);
+    add(stats.ns[stage], ns);
+    if (ns > get(stats.max_ns[stage])) {
+      stats.max_ns[stage].store(ns, std::memory_order_relaxed);
+    }
+
+    // bucket by the highest set bit
+    size_t b = 0;
+    for (uint64_t n = ns >> 1; n != 0 && b+1 < num_stage_buckets;
+         n >>= 1) {
+      ++b;
+    }
+    add(stats.buckets[stage][b], 1);
+  }
+
+  void lookup_record(const lookup_t lookup, const uint64_t count) {
+    if (count != 0) {
+      add(thread_stats().lookups[lookup], count);
+    }
+  }
+
+  void stage_snapshot(stage_totals_t& totals) {
+    pthread_mutex_lock(&registry_M);
+    totals = *retired_totals;
+    for (std::set<const thread_stage_stats_t*>::const_iterator it =
+         live_stats->begin(); it != live_stats->end(); ++it) {
+      fold(**it, totals);
+    }
+    pthread_mutex_unlock(&registry_M);
+  }
+
+  // the upper bound in microseconds of the bucket holding quantile q,
+  // no more than the maximum
+  static double quantile_us(const uint64_t* const buckets,
+                            const uint64_t count, const uint64_t max_ns,
+                            const double q) {
+    const uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    size_t b = 0;
+    for (; b+1 < num_stage_buckets; ++b) {
+      seen += buckets[b];
+      if (seen >= rank) {
+        break;
+      }
+    }
+    const uint64_t bound = static_cast<uint64_t>(2) << b;
+    return ((bound < max_ns) ? bound : max_ns) / 1000.0;
+  }
+
+  std::string stage_stats_json(const stage_totals_t& since) {
+    stage_totals_t now;
+    stage_snapshot(now);
+
+    std::stringstream ss;
+    ss << "{\"stages\":{";
+    for (size_t s=0; s<NUM_STAGES; ++s) {
+      const uint64_t count = now.count[s] - since.count[s];
+      const uint64_t ns = now.ns[s] - since.ns[s];
+      uint64_t buckets[num_stage_buckets];
+      for (size_t b=0; b<num_stage_buckets; ++b) {
+        buckets[b] = now.buckets[s][b] - since.buckets[s][b];
+      }
+      if (s != 0) {
+        ss << ",";
+      }
+      ss << "\"" << stage_names[s] << "\":{\"count\":" << count
+         << ",\"seconds\":" << ns / 1000000000.0;
+      if (count != 0) {
+        ss << ",\"mean_us\":" << ns / 1000.0 / count
+           << ",\"p50_us\":"
+           << quantile_us(buckets, count, now.max_ns[s], 0.50)
+           << ",\"p99_us\":"
+           << quantile_us(buckets, count, now.max_ns[s], 0.99)
+           << ",\"max_us\":" << now.max_ns[s] / 1000.0;
+      }
+      ss << "}";
+    }
+    ss << "},\"lookups\":{";
+    for (size_t l=0; l<NUM_LOOKUPS; ++l) {
+      if (l != 0) {
+        ss << ",";
+      }
+      ss << "\"" << lookup_names[l] << "\":"
+         << now.lookups[l] - since.lookups[l];
+    }
+    ss << "}}";
+    return ss.str();
+  }
+
+  std::string stage_stats_json() {
+    return stage_stats_json(stage_totals_t());
+  }
+}
@@ -0,0 +1,131 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Provides per-stage latency and throughput counters for ingest and
+ * scan: reading, zero checking, hashing, entropy, labeling, waiting to
+ * insert, committing, syncing, and, for scan_stream, waiting in the
+ * scan queue, scanning an array, and draining the scan manager replaced
+ * by a swap, plus hit and miss counts for lookups in the hash store and
+ * the hash data store.
+ *
+ * Each thread records into its own block of counters, so recording
+ * takes no lock and bounces no cache line.  The counters are relaxed
+ * atomics written only by their thread, so other threads may read them
+ * while they change.  A thread's counters are folded into the retired
+ * totals when it exits.  Durations are also recorded into power-of-two
+ * nanosecond buckets from which approximate percentiles are reported.
+ */
+
+#ifndef STAGE_STATS_HPP
+#define STAGE_STATS_HPP
+
+#include <string>
+#include <stdint.h>
+
+namespace hashdb {
+
+  enum stage_t {
+    STAGE_READ,
+    STAGE_ZERO_CHECK,
+    STAGE_HASH,
+    STAGE_ENTROPY,
+    STAGE_LABEL,
+    STAGE_INSERT_WAIT,
+    STAGE_COMMIT,
+    STAGE_SYNC,
+    STAGE_SCAN_QUEUE_WAIT,
+    STAGE_SCAN_ARRAY,
+    STAGE_SCAN_SWAP,
+    NUM_STAGES
+  };
+
+  enum lookup_t {
+    HASH_STORE_HIT,
+    HASH_STORE_MISS,
+    HASH_DATA_STORE_HIT,
+    HASH_DATA_STORE_MISS,
+    NUM_LOOKUPS
+  };
+
+  // bucket b counts durations in [2^b, 2^(b+1)) ns, 2^48 ns is 78 hours
+  const size_t num_stage_buckets = 48;
+
+  /**
+   * A copy of the counters of all threads.  The maximum durations are
+   * since the process started.
+   */
+  struct stage_totals_t {
+    uint64_t count[NUM_STAGES];
+    uint64_t ns[NUM_STAGES];
+    uint64_t max_ns[NUM_STAGES];
+    uint64_t buckets[NUM_STAGES][num_stage_buckets];
+    uint64_t lookups[NUM_LOOKUPS];
+    stage_totals_t();
+  };
+
+  // the names used in reports, such as "insert_wait" and
+  // "hash_store_hits"
+  const char* stage_name(const stage_t stage);
+  const char* lookup_name(const lookup_t lookup);
+
+  // monotonic time in nanoseconds
+  uint64_t stage_clock_ns();
+
+  // record one duration of the stage for this thread
+  void stage_record(const stage_t stage, const uint64_t ns);
+
+  // record count lookups of the kind for this thread
+  void lookup_record(const lookup_t lookup, const uint64_t count);
+
+  // copy the counters of all threads, live and retired
+  void stage_snapshot(stage_totals_t& totals);
+
+  /**
+   * Return the stage and lookup counts since the since snapshot as JSON.
+   * The public hashdb::stage_stats_json() reports them since the process
+   * started.
+   */
+  std::string stage_stats_json(const stage_totals_t& since);
+
+  /**
+   * Time the scope as one duration of the stage.
+   */
+  class stage_timer_t {
+    private:
+    const stage_t stage;
+    const uint64_t start;
+
+    // do not copy
+    stage_timer_t(const stage_timer_t&);
+    stage_timer_t& operator=(const stage_timer_t&);
+
+    public:
+    explicit stage_timer_t(const stage_t p_stage) :
+                      stage(p_stage), start(stage_clock_ns()) {
+    }
+
+    ~stage_timer_t() {
+      stage_record(stage, stage_clock_ns() - start);
+    }
+  };
+}
+
+#endif
@@ -44,6 +44,7 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
+#include <sstream>
 #include <cstring>
 
 void make_dir_if_not_there(const std::string& temp_dir) {
@@ -60,7 +61,33 @@ void make_dir_if_not_there(const std::string& temp_dir) {
   }
 }
 
+// remove any shards of a sharded hash store
+void rm_hashdb_shards(const std::string& hashdb_dir,
+                      const std::string& store_name) {
+  for (int i=0; i<64; ++i) {
+    std::stringstream ss;
+    ss << hashdb_dir << "/" << store_name << "_" << i;
+    remove((ss.str() + "/data.mdb").c_str());
+    remove((ss.str() + "/lock.mdb").c_str());
+    rmdir(ss.str().c_str());
+  }
+}
+
 void rm_hashdb_dir(const std::string& hashdb_dir) {
+  rm_hashdb_shards(hashdb_dir, "lmdb_hash_data_store");
+  rm_hashdb_shards(hashdb_dir, "lmdb_hash_store");
+  for (int i=0; i<64; ++i) {
+    std::stringstream ss;
+    ss << hashdb_dir << "/hash_filter_" << i;
+    remove(ss.str().c_str());
+    std::stringstream ss2;
+    ss2 << hashdb_dir << "/hash_stats_" << i;
+    remove(ss2.str().c_str());
+    std::stringstream ss3;
+    ss3 << hashdb_dir << "/hash_prefix_index_" << i;
+    remove(ss3.str().c_str());
+  }
+
   remove((hashdb_dir + "/lmdb_hash_data_store/data.mdb").c_str());
   remove((hashdb_dir + "/lmdb_hash_data_store/lock.mdb").c_str());
   rmdir((hashdb_dir + "/lmdb_hash_data_store").c_str());
@@ -81,7 +108,25 @@ void rm_hashdb_dir(const std::string& hashdb_dir) {
   remove((hashdb_dir + "/lmdb_source_name_store/lock.mdb").c_str());
   rmdir((hashdb_dir + "/lmdb_source_name_store").c_str());
 
+  remove((hashdb_dir + "/lmdb_repository_store/data.mdb").c_str());
+  remove((hashdb_dir + "/lmdb_repository_store/lock.mdb").c_str());
+  rmdir((hashdb_dir + "/lmdb_repository_store").c_str());
+
+  remove((hashdb_dir + "/lmdb_source_hash_store/data.mdb").c_str());
+  remove((hashdb_dir + "/lmdb_source_hash_store/lock.mdb").c_str());
+  rmdir((hashdb_dir + "/lmdb_source_hash_store").c_str());
+
+  remove((hashdb_dir + "/lmdb_source_signature_store/data.mdb").c_str());
+  remove((hashdb_dir + "/lmdb_source_signature_store/lock.mdb").c_str());
+  rmdir((hashdb_dir + "/lmdb_source_signature_store").c_str());
+
+  remove((hashdb_dir + "/hash_filter").c_str());
+  remove((hashdb_dir + "/hash_prefix_index").c_str());
+  remove((hashdb_dir + "/hash_stats").c_str());
+  remove((hashdb_dir + "/hll_sketch").c_str());
+  remove((hashdb_dir + "/source_name_dictionary").c_str());
   remove((hashdb_dir + "/log.txt").c_str());
+  remove((hashdb_dir + "/ingest_cache.txt").c_str());
   remove((hashdb_dir + "/settings.json").c_str());
   remove((hashdb_dir + "/_old_settings.json").c_str());
 
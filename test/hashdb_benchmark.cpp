@@ -0,0 +1,280 @@
+// Author:  Bruce Allen
+// Created: 2/25/2013
+//
+// The software provided here is released by the Naval Postgraduate
+// School, an agency of the U.S. Department of Navy.  The software
+// bears no warranty, either expressed or implied. NPS does not assume
+// legal liability nor responsibility for a User's use of the software
+// or the results of such use.
+//
+// Please note that within the United States, copyright protection,
+// under Section 105 of the United States Code, Title 17, is not
+// available for any work of the United States Government and/or for
+// any works created by United States Government employees. User
+// acknowledges that this software contains work which was created by
+// NPS government employees and is therefore in the public domain and
+// not subject to copyright.
+//
+// Released into the public domain on February 25, 2013 by Bruce Allen.
+
+/**
+ * \file
+ * Micro-benchmarks of the hasher kernels and the LMDB managers, using
+ * Google Benchmark.  Run "make benchmark" to write the results to
+ * benchmark.json, or run hashdb_benchmark with any Google Benchmark
+ * options, for example --benchmark_filter=hash_calculator.  Set
+ * HASHDB_CPU, for example to scalar, to benchmark other kernels.
+ */
+
+#include <config.h>
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "lmdb_hash_data_manager.hpp"
+#include "lmdb_hash_manager.hpp"
+#include "lmdb_changes.hpp"
+#include "source_id_sub_counts.hpp"
+#include "../src_libhashdb/hashdb.hpp"
+#include "../src_libhashdb/hasher/hash_calculator.hpp"
+#include "../src_libhashdb/hasher/entropy_calculator.hpp"
+#include "../src_libhashdb/hasher/calculate_block_label.hpp"
+#include "../src_libhashdb/hasher/zero_scanner.hpp"
+#include "directory_helper.hpp"
+
+static const std::string hashdb_dir = "temp_dir_hashdb_benchmark.hdb";
+static const size_t block_size = 512;
+static const size_t buffer_size = 1024 * 1024;
+
+// the number of hashes in the benchmark database
+static const size_t num_hashes = 100000;
+
+// repeatable pseudorandom bytes
+static std::vector<uint8_t> random_bytes(const size_t size) {
+  std::vector<uint8_t> bytes(size);
+  uint64_t x = 0x9e3779b97f4a7c15ULL;
+  for (size_t i=0; i<size; ++i) {
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    bytes[i] = static_cast<uint8_t>(x >> 56);
+  }
+  return bytes;
+}
+
+// the binary block hash numbered i
+static std::string block_hash(const uint64_t i) {
+  std::string hash(16, '\0');
+  uint64_t x = i * 0x9e3779b97f4a7c15ULL + 1;
+  for (size_t j=0; j<16; ++j) {
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    hash[j] = static_cast<char>(x >> 56);
+  }
+  return hash;
+}
+
+// the benchmark database, made once and opened for scanning
+static void make_benchmark_hashdb() {
+  static bool made = false;
+  if (made) {
+    return;
+  }
+  made = true;
+  rm_hashdb_dir(hashdb_dir);
+  hashdb::settings_t settings;
+  settings.block_size = block_size;
+  std::string error_message = hashdb::create_hashdb(hashdb_dir, settings,
+                                                    "hashdb_benchmark");
+  if (error_message != "") {
+    std::cerr << "Error: " << error_message << "\n";
+    exit(1);
+  }
+
+  // two sources, with every tenth hash in both
+  hashdb::import_manager_t manager(hashdb_dir, "hashdb_benchmark");
+  const std::string file_hash_1(16, '1');
+  const std::string file_hash_2(16, '2');
+  hashdb::hash_inserts_t inserts_1;
+  hashdb::hash_inserts_t inserts_2;
+  for (size_t i=0; i<num_hashes; ++i) {
+    inserts_1.push_back(hashdb::hash_insert_t(block_hash(i), 1000, ""));
+    if (i % 10 == 0) {
+      inserts_2.push_back(hashdb::hash_insert_t(block_hash(i), 1000, ""));
+    }
+  }
+  manager.insert_source_name(file_hash_1, "repository", "file1");
+  manager.insert_source_data(file_hash_1, num_hashes * block_size, "", 0, 0);
+  manager.insert_hashes(file_hash_1, inserts_1);
+  manager.insert_source_name(file_hash_2, "repository", "file2");
+  manager.insert_source_data(file_hash_2, num_hashes / 10 * block_size,
+                             "", 0, 0);
+  manager.insert_hashes(file_hash_2, inserts_2);
+}
+
+// ************************************************************
+// hasher kernels
+// ************************************************************
+static void hash_calculator(benchmark::State& state) {
+  const std::vector<uint8_t> buffer = random_bytes(buffer_size);
+  hasher::hash_calculator_t calculator;
+  size_t offset = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(calculator.calculate(
+                    &buffer[0], buffer.size(), offset, block_size));
+    offset = (offset + block_size) % buffer.size();
+  }
+  state.SetBytesProcessed(state.iterations() * block_size);
+}
+BENCHMARK(hash_calculator);
+
+static void hash_calculator_batch(benchmark::State& state) {
+  const std::vector<uint8_t> buffer = random_bytes(buffer_size);
+  hasher::hash_calculator_t calculator;
+  std::vector<size_t> offsets;
+  for (size_t offset=0; offset<buffer.size(); offset+=block_size) {
+    offsets.push_back(offset);
+  }
+  std::vector<std::string> hashes;
+  for (auto _ : state) {
+    calculator.calculate_batch(&buffer[0], buffer.size(), offsets,
+                               block_size, hashes);
+    benchmark::DoNotOptimize(hashes);
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(hash_calculator_batch);
+
+// step size is the argument, block_size for no overlap
+static void entropy_calculator(benchmark::State& state) {
+  const size_t step_size = static_cast<size_t>(state.range(0));
+  const std::vector<uint8_t> buffer = random_bytes(buffer_size);
+  hasher::entropy_calculator_t calculator(block_size);
+  size_t offset = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(calculator.calculate(
+                    &buffer[0], buffer.size(), offset));
+    offset += step_size;
+    if (offset + block_size > buffer.size()) {
+      offset = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(entropy_calculator)->Arg(512)->Arg(64);
+
+static void calculate_block_label(benchmark::State& state) {
+  const std::vector<uint8_t> buffer = random_bytes(buffer_size);
+  size_t offset = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher::calculate_block_label(
+                    &buffer[0], buffer.size(), offset, block_size));
+    offset = (offset + block_size) % buffer.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(calculate_block_label);
+
+// step size is the argument, block_size for no overlap
+static void block_label_calculator(benchmark::State& state) {
+  const size_t step_size = static_cast<size_t>(state.range(0));
+  const std::vector<uint8_t> buffer = random_bytes(buffer_size);
+  hasher::block_label_calculator_t calculator(block_size, step_size);
+  size_t offset = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(calculator.calculate(
+                    &buffer[0], buffer.size(), offset));
+    offset += step_size;
+    if (offset + block_size > buffer.size()) {
+      offset = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(block_label_calculator)->Arg(512)->Arg(64);
+
+// the argument is 1 for a zero buffer, 0 for random data
+static void all_zero(benchmark::State& state) {
+  const std::vector<uint8_t> buffer = (state.range(0) == 1) ?
+               std::vector<uint8_t>(buffer_size, 0) : random_bytes(buffer_size);
+  for (auto _ : state) {
+    hasher::zero_scanner_t zero_scanner(&buffer[0], buffer.size());
+    size_t zero_count = 0;
+    for (size_t offset=0; offset<buffer.size(); offset+=block_size) {
+      zero_count += zero_scanner.all_zero(offset, block_size) ? 1 : 0;
+    }
+    benchmark::DoNotOptimize(zero_count);
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(all_zero)->Arg(1)->Arg(0);
+
+// ************************************************************
+// LMDB managers
+// ************************************************************
+// encode Type 1 records into a new hash data store
+static void hash_data_encode(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    rm_hashdb_dir(hashdb_dir + "_encode");
+    create_new_dir(hashdb_dir + "_encode");
+    hashdb::lmdb_changes_t changes;
+    state.ResumeTiming();
+    {
+      hashdb::lmdb_hash_data_manager_t manager(hashdb_dir + "_encode",
+                                               hashdb::RW_NEW);
+      for (size_t i=0; i<10000; ++i) {
+        manager.insert(block_hash(i), 1000, "", 1, changes);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 10000);
+  rm_hashdb_dir(hashdb_dir + "_encode");
+}
+BENCHMARK(hash_data_encode)->Unit(benchmark::kMillisecond);
+
+// decode the hash data records of present hashes
+static void hash_data_decode(benchmark::State& state) {
+  make_benchmark_hashdb();
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(manager.find(block_hash(i), k_entropy,
+                             block_label, count, source_id_sub_counts));
+    i = (i + 1) % num_hashes;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(hash_data_decode);
+
+// the argument is 1 for present hashes, 0 for absent hashes
+static void lmdb_hash_manager_find(benchmark::State& state) {
+  make_benchmark_hashdb();
+  hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+  const uint64_t first = (state.range(0) == 1) ? 0 : num_hashes;
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(manager.find(block_hash(first + i)));
+    i = (i + 1) % num_hashes;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(lmdb_hash_manager_find)->Arg(1)->Arg(0);
+
+// EXPANDED scans, which use find_expanded_hash_json
+static void find_expanded_hash_json(benchmark::State& state) {
+  make_benchmark_hashdb();
+  hashdb::scan_manager_t manager(hashdb_dir);
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(manager.find_hash_json(
+                    hashdb::scan_mode_t::EXPANDED, block_hash(i)));
+    i = (i + 1) % num_hashes;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(find_expanded_hash_json);
+
+BENCHMARK_MAIN();
@@ -30,7 +30,9 @@
 #include "lmdb_hash_data_manager.hpp"
 #include "lmdb_helper.h"
 #include "lmdb_changes.hpp"
+#include "hash_batch.hpp"
 #include "source_id_sub_counts.hpp"
+#include "block_label_code.hpp"
 #include "../src_libhashdb/hashdb.hpp"
 #include "directory_helper.hpp"
 
@@ -45,6 +47,9 @@ static const std::string binary_1(hashdb::hex_to_bin(
 static const std::string binary_2(hashdb::hex_to_bin(
                                   "00000000000000000000000000000002"));
 
+// the record format under test
+static uint32_t hash_data_format = hashdb::varint_hash_data_format;
+
 void make_new_hashdb_dir(std::string p_hashdb_dir) {
   // remove any previous hashdb_dir
   rm_hashdb_dir(p_hashdb_dir);
@@ -97,7 +102,8 @@ void test_empty() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // attempt to insert an empty key.  A warning is sent to stderr.
   TEST_EQ(manager.insert("", 1000, "bl", 1, changes), 0);
@@ -139,7 +145,8 @@ void test_insert_type1() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // insert something at source_id=1
   TEST_EQ(manager.insert(binary_0, 1000, "bl", 1, changes), 1);
@@ -192,7 +199,8 @@ void test_insert_split() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // insert something at source_id=1
   TEST_EQ(manager.insert(binary_0, 1000, "bl", 1, changes), 1);
@@ -275,7 +283,8 @@ void test_merge() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // merge something at source_id=1
   TEST_EQ(manager.merge(binary_0, 2000, "l", 1, 10, changes), 10);
@@ -380,7 +389,8 @@ void test_maximums() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // merge above max at source_id=1
   TEST_EQ(manager.merge(binary_0, 0, "", 1, 65536, changes), 65535);
@@ -419,7 +429,8 @@ void test_block_label() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // test max block_label length, Type 1
   manager.insert(binary_0, 0, "0123456789a", 1, changes);
@@ -450,6 +461,49 @@ void test_block_label() {
   TEST_EQ(block_label, "0123456789");
 }
 
+void test_block_label_code() {
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+
+  // the dictionary
+  TEST_EQ(hashdb::block_label_code(""), 0);
+  TEST_EQ(hashdb::block_label_code("RHWM"), 15);
+  TEST_EQ(hashdb::block_label_code("HM"), 10);
+  TEST_EQ(hashdb::block_label_code("MH"), 0);
+  TEST_EQ(hashdb::block_label_code("RR"), 0);
+  TEST_EQ(hashdb::block_label_code("w"), 0);
+  for (uint8_t code = 0; code <= hashdb::max_block_label_code; ++code) {
+    TEST_EQ(hashdb::block_label_code(hashdb::block_label_of_code(code)),
+            code);
+  }
+
+  // create new manager
+  make_new_hashdb_dir(hashdb_dir);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
+
+  // dictionary and other labels at Type 1
+  manager.insert(binary_0, 0, "RW", 1, changes);
+  manager.insert(binary_1, 0, "MH", 1, changes);
+  check_changes(changes,2,0,0,0,0);
+  manager.find(binary_0, k_entropy, block_label, count, source_id_sub_counts);
+  TEST_EQ(block_label, "RW");
+  manager.find(binary_1, k_entropy, block_label, count, source_id_sub_counts);
+  TEST_EQ(block_label, "MH");
+
+  // dictionary label through the transition to Type 2
+  manager.insert(binary_0, 0, "RW", 2, changes);
+  manager.insert(binary_0, 0, "RW", 3, changes);
+  manager.find(binary_0, k_entropy, block_label, count, source_id_sub_counts);
+  TEST_EQ(block_label, "RW");
+  TEST_EQ(count, 3);
+  TEST_EQ(source_id_sub_counts.size(), 3);
+}
+
 void test_other_manager_functions() {
 // hash_data_inserted
 // hash_data_merged
@@ -462,7 +516,8 @@ void test_other_manager_functions() {
 
   // create new manager
   make_new_hashdb_dir(hashdb_dir);
-  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
 
   // add some items
   manager.insert(binary_1, 0, "", 1, changes);
@@ -482,8 +537,481 @@ void test_other_manager_functions() {
   block_hash = manager.next_hash(block_hash);
   TEST_EQ(block_hash, "");
 
-  // size
-  TEST_EQ(manager.size(), 4);
+  // size, where the fixed format keeps both sources of binary_1 in Type 1
+  TEST_EQ(manager.size(),
+          ((hash_data_format == hashdb::varint_hash_data_format) ? 4 : 2));
+}
+
+// Type 1 sources and promotion to Type 2 and Type 3
+void test_type1_sources() {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+
+  // create new manager
+  make_new_hashdb_dir(hashdb_dir);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
+  const size_t max_sources = hashdb::max_type1_sources(hash_data_format);
+
+  // fill Type 1 with sources then promote it
+  for (uint64_t source_id = 1; source_id <= max_sources + 1; source_id++) {
+    TEST_EQ(manager.insert(binary_0, 1000, "bl", source_id, changes),
+            source_id);
+    TEST_EQ(manager.size(),
+            ((source_id <= max_sources) ? 1 : max_sources + 2));
+  }
+  // std::cout << "test_type1_sources.a\n";
+  check_changes(changes,max_sources+1,0,0,0,0);
+
+  // add to a Type 1 source and then to a Type 3 source
+  TEST_EQ(manager.insert(binary_0, 1000, "bl", 1, changes),
+          max_sources + 2);
+  TEST_EQ(manager.merge(binary_0, 1000, "bl", max_sources + 2, 7, changes),
+          max_sources + 9);
+  TEST_EQ(manager.merge(binary_0, 1000, "bl", 2, 1, changes),
+          max_sources + 9);
+  // std::cout << "test_type1_sources.b\n";
+  check_changes(changes,max_sources+2,1,1,0,0);
+
+  // validate storage for binary_0
+  TEST_EQ(manager.find(binary_0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(k_entropy, 1000);
+  TEST_EQ(block_label, "bl");
+  TEST_EQ(count, max_sources + 9);
+  TEST_EQ(source_id_sub_counts.size(), max_sources + 2);
+  hashdb::source_id_sub_counts_t::const_iterator it =
+                                          source_id_sub_counts.begin();
+  TEST_EQ(it->source_id, 1);
+  TEST_EQ(it->sub_count, 2);
+  it = source_id_sub_counts.end();
+  --it;
+  TEST_EQ(it->source_id, max_sources + 2);
+  TEST_EQ(it->sub_count, 7);
+
+  // merge sources into a new hash to stay in Type 1
+  for (uint64_t source_id = 1; source_id <= max_sources; source_id++) {
+    TEST_EQ(manager.merge(binary_1, 0, "", source_id, 2, changes),
+            2 * source_id);
+  }
+  TEST_EQ(manager.find_count(binary_1), 2 * max_sources);
+  TEST_EQ(manager.find(binary_1, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(source_id_sub_counts.size(), max_sources);
+}
+
+// batch
+void test_insert_batch() {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+  hashdb::hash_batch_entries_t entries;
+  std::vector<size_t> counts;
+
+  // create new manager
+  make_new_hashdb_dir(hashdb_dir);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
+
+  // empty batch
+  manager.insert_batch(entries, counts, changes);
+  TEST_EQ(counts.size(), 0);
+
+  // same sequence as test_insert_split, plus a merge and an empty hash
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1000, "bl", 1, 0,
+                                               false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 0, "", 1, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 0, "", 2, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t("", 0, "", 2, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 0, "", 3, 4, true));
+  manager.insert_batch(entries, counts, changes);
+  TEST_EQ(counts.size(), 5);
+  TEST_EQ(counts[0], 1);
+  TEST_EQ(counts[1], 2);
+  TEST_EQ(counts[2], 3);
+  TEST_EQ(counts[3], 0);
+  TEST_EQ(counts[4], 7);
+
+  // validate storage for binary_0
+  TEST_EQ(manager.find(binary_0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(k_entropy, 1000);
+  TEST_EQ(block_label, "bl");
+  TEST_EQ(count, 7);
+  TEST_EQ(source_id_sub_counts.size(), 3);
+  auto it = source_id_sub_counts.begin();
+  TEST_EQ(it->source_id, 1);
+  TEST_EQ(it->sub_count, 2);
+  ++it;
+  TEST_EQ(it->source_id, 2);
+  TEST_EQ(it->sub_count, 1);
+  ++it;
+  TEST_EQ(it->source_id, 3);
+  TEST_EQ(it->sub_count, 4);
+
+  // changes match unbatched inserts and merges
+  check_changes(changes,3,1,0,3,0);
+}
+
+// collapsed inserts of repeated blocks
+void test_insert_collapsed() {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+  hashdb::hash_batch_entries_t entries;
+  std::vector<size_t> counts;
+
+  // create new manager
+  make_new_hashdb_dir(hashdb_dir);
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                           hash_data_format);
+
+  // source 1 repeats binary_0 three times, source 2 once
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1000, "bl", 1, 0,
+                                               false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1000, "bl", 1, 0,
+                                               false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1000, "bl", 1, 0,
+                                               false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_1, 0, "", 1, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1000, "bl", 2, 0,
+                                               false));
+  hashdb::collapse_inserts(entries);
+  TEST_EQ(entries.size(), 3);
+  TEST_EQ(hashdb::insert_occurrences(entries[0]), 3);
+  TEST_EQ(hashdb::insert_occurrences(entries[1]), 1);
+  manager.insert_batch(entries, counts, changes);
+  TEST_EQ(counts.size(), 3);
+  TEST_EQ(counts[0], 3);
+  TEST_EQ(counts[1], 1);
+  TEST_EQ(counts[2], 4);
+
+  // storage matches one insert per occurrence
+  TEST_EQ(manager.find(binary_0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(count, 4);
+  TEST_EQ(source_id_sub_counts.size(), 2);
+  auto it = source_id_sub_counts.begin();
+  TEST_EQ(it->source_id, 1);
+  TEST_EQ(it->sub_count, 3);
+  ++it;
+  TEST_EQ(it->source_id, 2);
+  TEST_EQ(it->sub_count, 1);
+  check_changes(changes,5,0,0,0,0);
+}
+
+// hashes in every shard of a store with two shard bits
+void test_shards() {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+  const std::string binary_40(hashdb::hex_to_bin(
+                                  "40000000000000000000000000000000"));
+  const std::string binary_41(hashdb::hex_to_bin(
+                                  "41000000000000000000000000000000"));
+  const std::string binary_c0(hashdb::hex_to_bin(
+                                  "c0000000000000000000000000000000"));
+
+  // create new manager
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                             hash_data_format, 2);
+    TEST_EQ(manager.shard_count(), 4);
+    TEST_EQ(manager.shard_index(binary_0), 0);
+    TEST_EQ(manager.shard_index(binary_41), 1);
+    TEST_EQ(manager.shard_index(binary_c0), 3);
+
+    // insert into shards 3, 1, and 0 using one batch
+    hashdb::hash_batch_entries_t entries;
+    entries.push_back(hashdb::hash_batch_entry_t(binary_c0, 1, "", 1, 0,
+                                                 false));
+    entries.push_back(hashdb::hash_batch_entry_t(binary_41, 1, "", 1, 0,
+                                                 false));
+    entries.push_back(hashdb::hash_batch_entry_t(binary_0, 1, "", 1, 0,
+                                                 false));
+    entries.push_back(hashdb::hash_batch_entry_t(binary_c0, 1, "", 2, 0,
+                                                 false));
+    std::vector<size_t> counts;
+    manager.insert_batch(entries, counts, changes);
+    TEST_EQ(counts.size(), 4);
+    TEST_EQ(counts[0], 1);
+    TEST_EQ(counts[1], 1);
+    TEST_EQ(counts[2], 1);
+    TEST_EQ(counts[3], 2);
+    TEST_EQ(manager.insert(binary_40, 1, "", 1, changes), 1);
+    check_changes(changes,5,0,0,0,0);
+    TEST_EQ(manager.size(),
+            ((hash_data_format == hashdb::varint_hash_data_format) ? 6 : 4));
+  }
+
+  // read across shards
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::READ_ONLY,
+                                           hash_data_format, 2);
+
+  // hashes are in key order across shards
+  TEST_EQ(manager.first_hash(), binary_0);
+  TEST_EQ(manager.next_hash(binary_0), binary_40);
+  TEST_EQ(manager.next_hash(binary_40), binary_41);
+  TEST_EQ(manager.next_hash(binary_41), binary_c0);
+  TEST_EQ(manager.next_hash(binary_c0), "");
+
+  // find
+  TEST_EQ(manager.find(binary_c0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(count, 2);
+  TEST_EQ(manager.find(binary_1, k_entropy, block_label, count,
+                       source_id_sub_counts), false);
+
+  // sorted finds sweep each shard
+  std::vector<std::string> block_hashes;
+  block_hashes.push_back(binary_0);
+  block_hashes.push_back(binary_1);
+  block_hashes.push_back(binary_40);
+  block_hashes.push_back(binary_c0);
+  std::vector<hashdb::hash_data_t> results;
+  manager.find_sorted(block_hashes, results);
+  TEST_EQ(results.size(), 4);
+  TEST_EQ(results[0].found, true);
+  TEST_EQ(results[1].found, false);
+  TEST_EQ(results[2].found, true);
+  TEST_EQ(results[3].found, true);
+  TEST_EQ(results[3].count, 2);
+  std::vector<size_t> counts;
+  manager.find_count_sorted(block_hashes, counts);
+  TEST_EQ(counts[0], 1);
+  TEST_EQ(counts[1], 0);
+  TEST_EQ(counts[2], 1);
+  TEST_EQ(counts[3], 2);
+}
+
+// walk a sharded store with a cursor
+void test_cursor() {
+
+  // variables
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  uint64_t found_k_entropy;
+  std::string found_block_label;
+  uint64_t found_count;
+  hashdb::source_id_sub_counts_t found_source_id_sub_counts;
+  hashdb::lmdb_changes_t changes;
+  const std::string binary_41(hashdb::hex_to_bin(
+                                  "41000000000000000000000000000000"));
+  const std::string binary_c0(hashdb::hex_to_bin(
+                                  "c0000000000000000000000000000000"));
+
+  // an empty store has no hashes
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                             hash_data_format, 2);
+  }
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::READ_ONLY,
+                                             hash_data_format, 2);
+    hashdb::lmdb_hash_data_cursor_t cursor(manager);
+    TEST_EQ(cursor.next(block_hash, k_entropy, block_label, count,
+                        source_id_sub_counts), false);
+    TEST_EQ(block_hash, "");
+  }
+
+  // hashes in shards 0, 1, and 3, with many sources on binary_41
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                             hash_data_format, 2);
+    manager.insert(binary_0, 1, "bl", 1, changes);
+    manager.insert(binary_1, 2, "", 1, changes);
+    for (uint64_t source_id=1; source_id<=6; ++source_id) {
+      manager.insert(binary_41, 3, "", source_id, changes);
+    }
+    manager.insert(binary_c0, 4, "", 1, changes);
+    manager.insert(binary_c0, 4, "", 2, changes);
+  }
+
+  // the walk reads each hash once in key order with the data find reads
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::READ_ONLY,
+                                           hash_data_format, 2);
+  hashdb::lmdb_hash_data_cursor_t cursor(manager);
+  std::vector<std::string> walked;
+  while (cursor.next(block_hash, k_entropy, block_label, count,
+                     source_id_sub_counts)) {
+    walked.push_back(block_hash);
+    TEST_EQ(manager.find(block_hash, found_k_entropy, found_block_label,
+                         found_count, found_source_id_sub_counts), true);
+    TEST_EQ(k_entropy, found_k_entropy);
+    TEST_EQ(block_label, found_block_label);
+    TEST_EQ(count, found_count);
+    TEST_EQ(source_id_sub_counts.size(), found_source_id_sub_counts.size());
+    hashdb::source_id_sub_counts_t::const_iterator it =
+                                       source_id_sub_counts.begin();
+    hashdb::source_id_sub_counts_t::const_iterator found_it =
+                                       found_source_id_sub_counts.begin();
+    for (; it != source_id_sub_counts.end(); ++it, ++found_it) {
+      TEST_EQ(it->source_id, found_it->source_id);
+      TEST_EQ(it->sub_count, found_it->sub_count);
+    }
+  }
+  TEST_EQ(walked.size(), 4);
+  TEST_EQ(walked[0], binary_0);
+  TEST_EQ(walked[1], binary_1);
+  TEST_EQ(walked[2], binary_41);
+  TEST_EQ(walked[3], binary_c0);
+
+  // the end stays at the end
+  TEST_EQ(cursor.next(block_hash, k_entropy, block_label, count,
+                      source_id_sub_counts), false);
+  TEST_EQ(source_id_sub_counts.size(), 0);
+
+  // bounded walks partition the store
+  hashdb::lmdb_hash_data_cursor_t cursor1(manager, "", binary_1);
+  TEST_EQ(cursor1.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_0);
+  TEST_EQ(cursor1.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), false);
+  hashdb::lmdb_hash_data_cursor_t cursor2(manager, binary_1, "\x41");
+  TEST_EQ(cursor2.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_1);
+  TEST_EQ(cursor2.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), false);
+  hashdb::lmdb_hash_data_cursor_t cursor3(manager, "\x41", "\x80");
+  TEST_EQ(cursor3.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_41);
+  TEST_EQ(count, 6);
+  TEST_EQ(cursor3.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), false);
+  hashdb::lmdb_hash_data_cursor_t cursor4(manager, "\x80", "");
+  TEST_EQ(cursor4.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_c0);
+  TEST_EQ(cursor4.next(block_hash, k_entropy, block_label, count,
+                       source_id_sub_counts), false);
+}
+
+// hashes with more sources than fit on one page of duplicates
+void test_many_sources() {
+
+  // variables
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_id_sub_counts_t source_id_sub_counts;
+  uint64_t num_sources;
+  hashdb::lmdb_changes_t changes;
+  const uint64_t many = 3000;
+
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                             hash_data_format);
+
+    // merge sources in descending order then add to one
+    for (uint64_t source_id = many; source_id >= 1; --source_id) {
+      manager.merge(binary_0, 1000, "bl", source_id, 2, changes);
+    }
+    TEST_EQ(manager.insert(binary_0, 1000, "bl", 1500, changes),
+            2 * many + 1);
+
+    // append sources
+    hashdb::hash_append_entries_t entries(1);
+    entries[0].block_hash = binary_2;
+    entries[0].k_entropy = 2000;
+    for (uint64_t source_id = 1; source_id <= many; ++source_id) {
+      entries[0].source_id_sub_counts.insert(
+                          hashdb::source_id_sub_count_t(source_id, 1));
+    }
+    entries[0].count = many;
+    manager.append_batch(entries);
+
+    // remove a source
+    hashdb::hash_remove_entries_t removes;
+    removes.push_back(hashdb::hash_remove_entry_t(binary_2, 7));
+    std::vector<size_t> counts;
+    manager.remove_batch(removes, counts, changes);
+    TEST_EQ(counts[0], many - 1);
+    TEST_EQ(manager.size(), 2 * many + 1);
+  }
+
+  // every source is read in order
+  hashdb::lmdb_hash_data_manager_t manager(hashdb_dir, hashdb::READ_ONLY,
+                                           hash_data_format);
+  TEST_EQ(manager.find(binary_0, k_entropy, block_label, count,
+                       source_id_sub_counts), true);
+  TEST_EQ(k_entropy, 1000);
+  TEST_EQ(count, 2 * many + 1);
+  TEST_EQ(source_id_sub_counts.size(), many);
+  uint64_t expected_source_id = 1;
+  for (hashdb::source_id_sub_counts_t::const_iterator it =
+       source_id_sub_counts.begin(); it != source_id_sub_counts.end();
+       ++it, ++expected_source_id) {
+    TEST_EQ(it->source_id, expected_source_id);
+    TEST_EQ(it->sub_count, ((expected_source_id == 1500) ? 3 : 2));
+  }
+  TEST_EQ(manager.find_count(binary_2), many - 1);
+
+  // a window spanning pages, where only the dupfixed format stores
+  // sources in source_id order
+  const bool is_ordered =
+               (hash_data_format == hashdb::dupfixed_hash_data_format);
+  TEST_EQ(manager.find_sources(binary_0, 1000, 1200, k_entropy,
+                               block_label, count, source_id_sub_counts,
+                               num_sources), true);
+  TEST_EQ(num_sources, many);
+  TEST_EQ(source_id_sub_counts.size(), 1200);
+  if (is_ordered) {
+    TEST_EQ(source_id_sub_counts.begin()->source_id, 1001);
+    TEST_EQ(source_id_sub_counts.rbegin()->source_id, 2200);
+  }
+
+  // a window past the end
+  TEST_EQ(manager.find_sources(binary_2, many - 10, 100, k_entropy,
+                               block_label, count, source_id_sub_counts,
+                               num_sources), true);
+  TEST_EQ(num_sources, many - 1);
+  TEST_EQ(source_id_sub_counts.size(), 9);
+  if (is_ordered) {
+    TEST_EQ(source_id_sub_counts.rbegin()->source_id, many);
+  }
+
+  // the walk reads the same sources
+  hashdb::lmdb_hash_data_cursor_t cursor(manager);
+  std::string block_hash;
+  TEST_EQ(cursor.next(block_hash, k_entropy, block_label, count,
+                      source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_0);
+  TEST_EQ(source_id_sub_counts.size(), many);
+  TEST_EQ(cursor.next(block_hash, k_entropy, block_label, count,
+                      source_id_sub_counts), true);
+  TEST_EQ(block_hash, binary_2);
+  TEST_EQ(source_id_sub_counts.size(), many - 1);
+  TEST_EQ((hashdb::find_source(source_id_sub_counts, 7) ==
+           source_id_sub_counts.end()), true);
+  TEST_EQ(cursor.next(block_hash, k_entropy, block_label, count,
+                      source_id_sub_counts), false);
 }
 
 // ************************************************************
@@ -491,13 +1019,28 @@ void test_other_manager_functions() {
 // ************************************************************
 int main(int argc, char* argv[]) {
 
+  // run the tests for each record format
+  const uint32_t formats[] = {hashdb::varint_hash_data_format,
+                              hashdb::fixed_hash_data_format,
+                              hashdb::dupfixed_hash_data_format};
+  for (size_t i=0; i<3; i++) {
+    hash_data_format = formats[i];
+
 test_empty();
 test_insert_type1();
 test_insert_split();
 test_merge();
 test_maximums();
 test_block_label();
+test_block_label_code();
 test_other_manager_functions();
+test_insert_batch();
+test_insert_collapsed();
+test_type1_sources();
+test_shards();
+test_cursor();
+test_many_sources();
+  }
 
   // done
   std::cout << "lmdb_hash_data_manager_test Done.\n";
@@ -32,11 +32,33 @@
 #include "lmdb_source_data_manager.hpp"
 #include "lmdb_source_id_manager.hpp"
 #include "lmdb_source_name_manager.hpp"
+#include "source_name_codec.hpp"
+#include "lmdb_repository_manager.hpp"
+#include "source_id_bitmap.hpp"
 #include "lmdb_helper.h"
 #include "lmdb_changes.hpp"
+#include "hash_bulk_loader.hpp"
 #include "source_id_sub_counts.hpp"
+#include "source_cache.hpp"
+#include "locked_member.hpp"
+#include "shared_member.hpp"
+#include "memory_budget.hpp"
+#include "numa_nodes.hpp"
+#include "stage_stats.hpp"
+#include "scan_stream/scan_queue.hpp"
+#include "crc32.h"
+#include "hasher/entropy_calculator.hpp"
+#include "hasher/calculate_block_label.hpp"
 #include "../src_libhashdb/hashdb.hpp"
 #include "directory_helper.hpp"
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <algorithm>
 
 typedef std::pair<std::string, std::string> source_name_t;
 typedef std::set<source_name_t>             source_names_t;
@@ -148,6 +170,278 @@ void lmdb_hash_manager_count() {
   TEST_EQ(manager.find(binary_00), 1495);
 }
 
+// hashes in two shards with a filter in each
+void lmdb_hash_manager_shards() {
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW, 1);
+    hashdb::lmdb_changes_t changes;
+    manager.insert(binary_00, 1, changes);
+    manager.insert(binary_26, 2, changes);
+    TEST_EQ(changes.hash_inserted, 2);
+  }
+  {
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_MODIFY, 1);
+    hashdb::lmdb_changes_t changes;
+    const std::string binary_f0(hashdb::hex_to_bin(
+                                  "f0000000000000000000000000000000"));
+    hashdb::hash_batch_entries_t entries;
+    entries.push_back(hashdb::hash_batch_entry_t(binary_01, 0, "", 1, 0,
+                                                 false));
+    entries.push_back(hashdb::hash_batch_entry_t(binary_f0, 0, "", 1, 0,
+                                                 false));
+    std::vector<size_t> counts;
+    counts.push_back(3);
+    counts.push_back(1);
+    manager.insert_batch(entries, counts, changes);
+    TEST_EQ(changes.hash_inserted, 1);
+    TEST_EQ(changes.hash_count_changed, 1);
+    TEST_EQ(manager.size(), 3);
+  }
+
+  // the shards build their filters when read
+  hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::READ_ONLY, 1);
+  TEST_EQ(manager.find(binary_00), 3);
+  TEST_EQ(manager.find(binary_10), 0);
+  TEST_EQ(manager.find(binary_26), 2);
+  TEST_EQ(manager.find(hashdb::hex_to_bin(
+                       "f0000000000000000000000000000000")), 1);
+  std::vector<std::string> binary_hashes;
+  binary_hashes.push_back(binary_00);
+  binary_hashes.push_back(binary_10);
+  binary_hashes.push_back(hashdb::hex_to_bin(
+                       "f0000000000000000000000000000000"));
+  std::vector<size_t> counts;
+  manager.find_sorted(binary_hashes, counts);
+  TEST_EQ(counts[0], 3);
+  TEST_EQ(counts[1], 0);
+  TEST_EQ(counts[2], 1);
+}
+
+// bulk loads change the hash store the way per-record inserts do, also
+// when hashes share a hash store prefix
+void hash_bulk_loader() {
+  // binary_10 and binary_11 share a prefix
+  hashdb::hash_batch_entries_t entries;
+  entries.push_back(hashdb::hash_batch_entry_t(binary_10, 0, "", 1, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_11, 0, "", 1, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_10, 0, "", 2, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_11, 0, "", 2, 0, false));
+  entries.push_back(hashdb::hash_batch_entry_t(binary_10, 0, "", 3, 0, false));
+
+  // into empty stores by appending, then into stores holding binary_26
+  for (int is_append = 1; is_append >= 0; --is_append) {
+    hashdb::lmdb_changes_t per_record_changes;
+    size_t per_record_count;
+    make_new_hashdb_dir(hashdb_dir);
+    {
+      hashdb::lmdb_hash_data_manager_t hash_data_manager(hashdb_dir,
+                                                         hashdb::RW_NEW);
+      hashdb::lmdb_hash_manager_t hash_manager(hashdb_dir, hashdb::RW_NEW);
+      if (!is_append) {
+        hashdb::lmdb_changes_t changes;
+        hash_manager.insert(binary_26, hash_data_manager.insert(
+                                   binary_26, 0, "", 1, changes), changes);
+      }
+      for (size_t i=0; i<entries.size(); ++i) {
+        const size_t count = hash_data_manager.insert(entries[i].block_hash,
+                     0, "", entries[i].source_id, per_record_changes);
+        hash_manager.insert(entries[i].block_hash, count, per_record_changes);
+      }
+      per_record_count = hash_manager.find(binary_10);
+    }
+
+    hashdb::lmdb_changes_t bulk_changes;
+    make_new_hashdb_dir(hashdb_dir);
+    {
+      hashdb::lmdb_hash_data_manager_t hash_data_manager(hashdb_dir,
+                                                         hashdb::RW_NEW);
+      hashdb::lmdb_hash_manager_t hash_manager(hashdb_dir, hashdb::RW_NEW);
+      if (!is_append) {
+        hashdb::lmdb_changes_t changes;
+        hash_manager.insert(binary_26, hash_data_manager.insert(
+                                   binary_26, 0, "", 1, changes), changes);
+      }
+      hashdb::hash_bulk_loader_t loader(hashdb_dir);
+      loader.set_run_size(1000);
+      for (size_t i=0; i<entries.size(); ++i) {
+        loader.add(entries[i]);
+      }
+      loader.load(hash_data_manager, hash_manager, bulk_changes);
+      TEST_EQ(hash_manager.find(binary_10), per_record_count);
+    }
+    TEST_EQ(bulk_changes.hash_data_inserted,
+            per_record_changes.hash_data_inserted);
+    TEST_EQ(bulk_changes.hash_inserted, per_record_changes.hash_inserted);
+    TEST_EQ(bulk_changes.hash_count_changed,
+            per_record_changes.hash_count_changed);
+    TEST_EQ(bulk_changes.hash_count_not_changed,
+            per_record_changes.hash_count_not_changed);
+  }
+}
+
+// lookups from the in-memory prefix index
+void lmdb_hash_manager_prefix_index() {
+  // enough keys for a directory of more than one entry
+  hashdb::hash_prefix_index_t index(1, 1000);
+  for (uint64_t i=0; i<1000; ++i) {
+    uint8_t prefix[7];
+    for (size_t j=0; j<7; ++j) {
+      prefix[j] = static_cast<uint8_t>((i * 0x4000000000ULL) >> (48 - 8*j));
+    }
+    index.add(prefix, static_cast<uint8_t>(i));
+  }
+  index.finish();
+  for (uint64_t i=0; i<1000; ++i) {
+    uint8_t prefix[7];
+    for (size_t j=0; j<7; ++j) {
+      prefix[j] = static_cast<uint8_t>((i * 0x4000000000ULL) >> (48 - 8*j));
+    }
+    uint8_t count_byte = 0;
+    TEST_EQ(index.find(prefix, count_byte), true);
+    TEST_EQ(count_byte, static_cast<uint8_t>(i));
+    prefix[6] ^= 1;
+    TEST_EQ(index.find(prefix, count_byte), false);
+  }
+
+  // batches find what find finds
+  char batch[16][7];
+  const char* prefixes[16];
+  for (uint64_t i=0; i<16; ++i) {
+    for (size_t j=0; j<7; ++j) {
+      batch[i][j] = static_cast<char>(
+                    ((i * 61) * 0x4000000000ULL) >> (48 - 8*j));
+    }
+    batch[i][6] ^= static_cast<char>(i % 2);
+    prefixes[i] = batch[i];
+  }
+  uint8_t count_bytes[16];
+  bool found[16];
+  index.find_batch(prefixes, 16, count_bytes, found);
+  for (uint64_t i=0; i<16; ++i) {
+    TEST_EQ(found[i], (i % 2 == 0));
+    if (found[i]) {
+      TEST_EQ(count_bytes[i], static_cast<uint8_t>(i * 61));
+    }
+  }
+
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    hashdb::lmdb_changes_t changes;
+    manager.insert(binary_00, 1, changes);
+    manager.insert(binary_26, 2, changes);
+  }
+
+  // a reader finds hashes in LMDB until an index is saved, and a reader
+  // that builds its index does not save it
+  {
+    hashdb::lmdb_hash_manager_t reader(hashdb_dir, hashdb::READ_ONLY);
+    std::vector<std::string> filenames;
+    reader.store_files(filenames);
+    TEST_EQ(filenames.size(), 1);
+    TEST_EQ(reader.find(binary_26), 2);
+  }
+  {
+    hashdb::lmdb_hash_manager_t reader(hashdb_dir, hashdb::READ_ONLY, 0,
+                                lmdb_helper::env_policy_t(), NULL, true);
+    std::vector<std::string> filenames;
+    reader.store_files(filenames);
+    TEST_EQ(filenames.size(), 0);
+    TEST_EQ(reader.find(binary_26), 2);
+  }
+  TEST_EQ(access((hashdb_dir + "/hash_prefix_index").c_str(), F_OK), -1);
+
+  // the reader maps the saved index
+  {
+    hashdb::lmdb_hash_manager_t writer(hashdb_dir, hashdb::RW_MODIFY);
+    TEST_EQ(writer.save_prefix_indexes(), "");
+  }
+  TEST_EQ(access((hashdb_dir + "/hash_prefix_index").c_str(), F_OK), 0);
+  hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+  std::vector<std::string> filenames;
+  manager.store_files(filenames);
+  TEST_EQ(filenames.size(), 0);
+  TEST_EQ(manager.find(binary_00), 1);
+  TEST_EQ(manager.find(binary_01), 1);
+  TEST_EQ(manager.find(binary_10), 0);
+  TEST_EQ(manager.find(binary_26), 2);
+
+  // membership bitmaps in input order, over more than one batch
+  std::string packed;
+  for (size_t i=0; i<20; ++i) {
+    packed += (i % 3 == 0) ? binary_26 : (i % 3 == 1) ? binary_10 : binary_00;
+  }
+  uint8_t bitmap[3];
+  manager.find_exists(packed.data(), 20, 16, bitmap);
+  TEST_EQ(static_cast<int>(bitmap[0]), 0x6d);
+  TEST_EQ(static_cast<int>(bitmap[1]), 0xdb);
+  TEST_EQ(static_cast<int>(bitmap[2]), 0x06);
+
+  // a stale index is not used
+  {
+    hashdb::lmdb_hash_manager_t writer(hashdb_dir, hashdb::RW_MODIFY);
+    hashdb::lmdb_changes_t changes;
+    writer.insert(binary_10, 5, changes);
+  }
+  TEST_EQ(manager.find(binary_10), 5);
+  manager.find_exists(packed.data(), 20, 16, bitmap);
+  TEST_EQ(static_cast<int>(bitmap[0]), 0xff);
+  TEST_EQ(static_cast<int>(bitmap[2]), 0x0f);
+  std::vector<std::string> binary_hashes;
+  binary_hashes.push_back(binary_00);
+  binary_hashes.push_back(binary_10);
+  std::vector<size_t> counts;
+  manager.find_sorted(binary_hashes, counts);
+  TEST_EQ(counts[0], 1);
+  TEST_EQ(counts[1], 5);
+
+  // a new reader reads the new store
+  hashdb::lmdb_hash_manager_t manager2(hashdb_dir, hashdb::READ_ONLY);
+  TEST_EQ(manager2.find(binary_10), 5);
+  manager2.find_sorted(binary_hashes, counts);
+  TEST_EQ(counts[0], 1);
+  TEST_EQ(counts[1], 5);
+}
+
+// the hash filter is saved by writers and not by readers
+void lmdb_hash_manager_filter() {
+  const std::string filter_filename = hashdb_dir + "/hash_filter";
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_hash_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    hashdb::lmdb_changes_t changes;
+    manager.insert(binary_00, 1, changes);
+  }
+
+  // readers, even one that builds its filter, do not save it
+  {
+    hashdb::lmdb_hash_manager_t reader(hashdb_dir, hashdb::READ_ONLY);
+    TEST_EQ(reader.find(binary_00), 1);
+    TEST_EQ(reader.find(binary_10), 0);
+  }
+  {
+    hashdb::lmdb_hash_manager_t reader(hashdb_dir, hashdb::READ_ONLY, 0,
+                                lmdb_helper::env_policy_t(), NULL, true);
+    TEST_EQ(reader.find(binary_00), 1);
+    TEST_EQ(reader.find(binary_10), 0);
+  }
+  TEST_EQ(access(filter_filename.c_str(), F_OK), -1);
+
+  // a writer builds the missing filter and saves it
+  {
+    hashdb::lmdb_hash_manager_t writer(hashdb_dir, hashdb::RW_MODIFY);
+    hashdb::lmdb_changes_t changes;
+    writer.insert(binary_10, 2, changes);
+    TEST_EQ((writer.flush_filter() != 0), true);
+  }
+  TEST_EQ(access(filter_filename.c_str(), F_OK), 0);
+  hashdb::lmdb_hash_manager_t reader(hashdb_dir, hashdb::READ_ONLY);
+  TEST_EQ(reader.find(binary_00), 1);
+  TEST_EQ(reader.find(binary_10), 2);
+  TEST_EQ(reader.find(binary_26), 0);
+}
+
 // ************************************************************
 // lmdb_source_id_manager
 // ************************************************************
@@ -211,6 +505,52 @@ void lmdb_source_id_manager() {
   file_binary_hash = manager.next_source(binary_26);
   TEST_EQ(file_binary_hash, "")
 
+  // batch: present, removed, new, and repeated sources in one sweep,
+  // with new IDs in the given order
+  TEST_EQ(manager.remove(binary_01, changes, source_id), true);
+  std::vector<std::string> file_binary_hashes;
+  file_binary_hashes.push_back(binary_26);
+  file_binary_hashes.push_back(binary_00);
+  file_binary_hashes.push_back(binary_01);
+  file_binary_hashes.push_back(binary_11);
+  file_binary_hashes.push_back(binary_2);
+  file_binary_hashes.push_back(binary_10);
+  file_binary_hashes.push_back(binary_26);
+  std::vector<uint64_t> source_ids;
+  hashdb::lmdb_changes_t batch_changes;
+  TEST_EQ(manager.insert_batch(file_binary_hashes, batch_changes,
+                               source_ids), 4);
+  TEST_EQ(source_ids.size(), 7);
+  TEST_EQ(source_ids[0], 4);
+  TEST_EQ(source_ids[1], 1);
+  TEST_EQ(source_ids[2], 3);
+  TEST_EQ(source_ids[3], 5);
+  TEST_EQ(source_ids[4], 2);
+  TEST_EQ(source_ids[5], 6);
+  TEST_EQ(source_ids[6], 4);
+  TEST_EQ(batch_changes.source_id_inserted, 4);
+  TEST_EQ(batch_changes.source_id_already_present, 3);
+  did_find = manager.find(binary_26, source_id);
+  TEST_EQ(did_find, true);
+  TEST_EQ(source_id, 4);
+  TEST_EQ(manager.size(), 6);
+
+  // read in batches, skipping removed sources
+  TEST_EQ(manager.remove(binary_10, changes, source_id), true);
+  TEST_EQ(manager.read_batch("", 3, file_binary_hashes, source_ids), true);
+  TEST_EQ(file_binary_hashes.size(), 3);
+  TEST_EQ(file_binary_hashes[0], manager.first_source());
+  TEST_EQ(file_binary_hashes[1],
+          manager.next_source(file_binary_hashes[0]));
+  manager.find(file_binary_hashes[1], source_id);
+  TEST_EQ(source_ids[1], source_id);
+  TEST_EQ(manager.read_batch(file_binary_hashes[2], 3, file_binary_hashes,
+                             source_ids), true);
+  TEST_EQ(file_binary_hashes.size(), 2);
+  TEST_EQ(manager.next_source(file_binary_hashes[1]), "");
+  TEST_EQ(manager.read_batch(file_binary_hashes[1], 3, file_binary_hashes,
+                             source_ids), false);
+  TEST_EQ(file_binary_hashes.size(), 0);
 }
 
 // ************************************************************
@@ -295,6 +635,41 @@ void lmdb_source_data_manager() {
 
   // size
   TEST_EQ(manager.size(), 2);
+
+  // batch: one same, one changed, one new
+  hashdb::source_data_entries_t entries(3);
+  entries[0].source_id = 0;
+  entries[1].source_id = 1;
+  entries[1].file_binary_hash = "fbh3";
+  entries[2].source_id = 2;
+  entries[2].file_binary_hash = "fbh4";
+  entries[2].filesize = 44;
+  hashdb::lmdb_changes_t batch_changes;
+  manager.insert_batch(entries, batch_changes);
+  TEST_EQ(batch_changes.source_data_same, 1);
+  TEST_EQ(batch_changes.source_data_changed, 1);
+  TEST_EQ(batch_changes.source_data_inserted, 1);
+  manager.find(2, file_binary_hash, filesize, file_type, zero_count, nonprobative_count);
+  TEST_EQ(file_binary_hash, "fbh4");
+  TEST_EQ(filesize, 44);
+  TEST_EQ(manager.size(), 3);
+
+  // find batch, where 256 precedes 129 in key order
+  manager.insert(129, "fbh129", 129, "", 0, 0, changes);
+  manager.insert(256, "fbh256", 256, "", 0, 0, changes);
+  hashdb::source_data_entries_t found_entries(5);
+  found_entries[0].source_id = 129;
+  found_entries[1].source_id = 2;
+  found_entries[2].source_id = 7;
+  found_entries[3].source_id = 256;
+  found_entries[4].source_id = 2;
+  TEST_EQ(manager.find_batch(found_entries), 4);
+  TEST_EQ(found_entries[0].file_binary_hash, "fbh129");
+  TEST_EQ(found_entries[0].filesize, 129);
+  TEST_EQ(found_entries[1].file_binary_hash, "fbh4");
+  TEST_EQ(found_entries[2].file_binary_hash, "");
+  TEST_EQ(found_entries[3].file_binary_hash, "fbh256");
+  TEST_EQ(found_entries[4].filesize, 44);
 }
 
 // ************************************************************
@@ -358,11 +733,1111 @@ void lmdb_source_name_manager() {
 
   // size
   TEST_EQ(manager.size(), 4);
+
+  // batch: one present, two new
+  hashdb::source_name_entries_t entries(3);
+  entries[0].source_id = 1;
+  entries[0].repository_name = "rn";
+  entries[0].filename = "fn";
+  entries[1].source_id = 2;
+  entries[1].repository_name = "rn12";
+  entries[1].filename = "fn12";
+  entries[2].source_id = 3;
+  entries[2].repository_name = "rn3";
+  entries[2].filename = "fn3";
+  hashdb::lmdb_changes_t batch_changes;
+  manager.insert_batch(entries, batch_changes);
+  TEST_EQ(batch_changes.source_name_already_present, 1);
+  TEST_EQ(batch_changes.source_name_inserted, 2);
+  found = manager.find(2, source_names);
+  TEST_EQ(source_names.size(), 2);
+  TEST_EQ(manager.size(), 6);
+
+  // find batch, where 256 precedes 129 in key order
+  manager.insert(129, "rn129", "fn129", changes);
+  manager.insert(256, "rn256", "fn256", changes);
+  std::vector<uint64_t> source_ids;
+  source_ids.push_back(129);
+  source_ids.push_back(1);
+  source_ids.push_back(7);
+  source_ids.push_back(256);
+  source_ids.push_back(1);
+  std::vector<source_names_t> batch_names;
+  manager.find_batch(source_ids, batch_names);
+  TEST_EQ(batch_names.size(), 5);
+  TEST_EQ(batch_names[0].size(), 1);
+  TEST_EQ(batch_names[0].begin()->second, "fn129");
+  TEST_EQ(batch_names[1].size(), 3);
+  TEST_EQ(batch_names[2].size(), 0);
+  TEST_EQ(batch_names[3].begin()->first, "rn256");
+  TEST_EQ(batch_names[4].size(), 3);
+}
+
+void lmdb_source_name_manager_compressed() {
+
+  // variables
+  source_names_t source_names;
+  hashdb::lmdb_changes_t changes;
+
+  // train a dictionary
+  hashdb::source_name_trainer_t trainer;
+  trainer.add("repo", "/usr/lib/a/libone_component.so");
+  trainer.add("repo", "/usr/lib/a/libtwo_component.so");
+  trainer.add("other", "/usr/lib/b/x");
+  hashdb::source_name_codec_t* codec = trainer.train();
+  TEST_EQ(codec->num_repository_names(), 1);
+  TEST_EQ((codec->num_prefixes() >= 2), true);
+  TEST_EQ((codec->zlib_dictionary_size() > 0), true);
+
+  // encodings decode to their pairs and repeat exactly
+  std::string encoding;
+  std::string encoding2;
+  std::string repository_name;
+  std::string filename;
+  codec->encode("repo", "/usr/lib/a/libthree_component.so", encoding);
+  TEST_EQ((encoding.size() < 30), true); // 38 bytes plain
+  TEST_EQ(codec->decode(reinterpret_cast<const uint8_t*>(encoding.c_str()),
+                        encoding.size(), repository_name, filename), true);
+  TEST_EQ(repository_name, "repo");
+  TEST_EQ(filename, "/usr/lib/a/libthree_component.so");
+  codec->encode("repo", "/usr/lib/a/libthree_component.so", encoding2);
+  TEST_EQ(encoding2, encoding);
+  codec->encode("new repo", "relative", encoding);
+  TEST_EQ(codec->decode(reinterpret_cast<const uint8_t*>(encoding.c_str()),
+                        encoding.size(), repository_name, filename), true);
+  TEST_EQ(repository_name, "new repo");
+  TEST_EQ(filename, "relative");
+  TEST_EQ(codec->decode(reinterpret_cast<const uint8_t*>(encoding.c_str()),
+                        encoding.size() - 1, repository_name, filename),
+          false);
+
+  // the manager reads the dictionary from the hashdb directory
+  make_new_hashdb_dir(hashdb_dir);
+  TEST_EQ(codec->write(hashdb_dir + "/" +
+                       hashdb::source_name_dictionary_filename), true);
+  delete codec;
+  hashdb::lmdb_source_name_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                             hashdb::compressed_source_name_format);
+  manager.insert(1, "repo", "/usr/lib/a/libone_component.so", changes);
+  manager.insert(1, "repo", "/usr/lib/a/libone_component.so", changes);
+  manager.insert(1, "other", "/usr/lib/b/y", changes);
+  TEST_EQ(changes.source_name_inserted, 2);
+  TEST_EQ(changes.source_name_already_present, 1);
+  TEST_EQ(manager.find(1, source_names), true);
+  TEST_EQ(source_names.size(), 2);
+  TEST_EQ((source_names.find(source_name_t("repo",
+           "/usr/lib/a/libone_component.so")) != source_names.end()), true);
+  TEST_EQ((source_names.find(source_name_t("other", "/usr/lib/b/y")) !=
+           source_names.end()), true);
+}
+
+// ************************************************************
+// source_id_bitmap
+// ************************************************************
+void source_id_bitmap() {
+  hashdb::source_id_bitmap_t bitmap;
+  TEST_EQ(bitmap.contains(1), false);
+  TEST_EQ(bitmap.add(1), true);
+  TEST_EQ(bitmap.add(1), false);
+  TEST_EQ(bitmap.add(70000), true);
+  TEST_EQ(bitmap.contains(1), true);
+  TEST_EQ(bitmap.contains(2), false);
+  TEST_EQ(bitmap.contains(70000), true);
+  TEST_EQ(bitmap.containers.size(), 2);
+  TEST_EQ(bitmap.size(), 2);
+
+  // a full container becomes a bitset
+  for (uint64_t i=0; i<10000; i+=2) {
+    bitmap.add(i);
+  }
+  TEST_EQ(bitmap.size(), 5002);
+  TEST_EQ(bitmap.containers[0].is_bitset(), true);
+  TEST_EQ(bitmap.contains(9998), true);
+  TEST_EQ(bitmap.contains(9999), false);
+
+  // unite
+  hashdb::source_id_bitmap_t other;
+  other.add(3);
+  other.add(4);
+  other.add(200000);
+  bitmap.unite(other);
+  TEST_EQ(bitmap.size(), 5004);
+  TEST_EQ(bitmap.contains(3), true);
+  TEST_EQ(bitmap.contains(200000), true);
+
+  // encode and decode both container types
+  for (hashdb::source_id_bitmap_t::containers_t::const_iterator it =
+       bitmap.containers.begin(); it != bitmap.containers.end(); ++it) {
+    const std::string encoding = it->second.encode();
+    hashdb::source_id_container_t container;
+    TEST_EQ(container.decode(reinterpret_cast<const uint8_t*>(
+                             encoding.data()), encoding.size()), true);
+    TEST_EQ(container.size(), it->second.size());
+    TEST_EQ(container.is_bitset(), it->second.is_bitset());
+  }
+  hashdb::source_id_container_t container;
+  const uint8_t invalid[2] = {0, 1};
+  TEST_EQ(container.decode(invalid, 2), false);
+
+  // a bitset that fits an array again becomes one
+  hashdb::source_id_container_t& low_container = bitmap.containers[0];
+  TEST_EQ(low_container.remove(9999), false);
+  for (uint16_t i=0; low_container.is_bitset(); i+=2) {
+    TEST_EQ(low_container.remove(i), true);
+  }
+  TEST_EQ(low_container.size(), 4096);
+  TEST_EQ(low_container.contains(0), false);
+  TEST_EQ(low_container.contains(9998), true);
+  TEST_EQ(low_container.remove(9998), true);
+  TEST_EQ(low_container.remove(9998), false);
+  TEST_EQ(low_container.contains(9998), false);
+}
+
+// ************************************************************
+// lmdb_repository_manager
+// ************************************************************
+void lmdb_repository_manager() {
+  hashdb::source_id_bitmap_t bitmap;
+
+  // no store in a read-only database made without one
+  make_new_hashdb_dir(hashdb_dir);
+  {
+    hashdb::lmdb_repository_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+    TEST_EQ(manager.is_available(), false);
+  }
+
+  // opening for writing creates it
+  {
+    hashdb::lmdb_repository_manager_t manager(hashdb_dir, hashdb::RW_MODIFY);
+    TEST_EQ(manager.is_available(), true);
+    TEST_EQ(manager.is_new(), true);
+    manager.insert("rn", 1);
+    manager.insert("rn", 70000);
+    manager.insert("rn2", 2);
+    manager.insert("r", 3);
+
+    // inserts are written on flush
+    TEST_EQ(manager.find("rn", bitmap), false);
+    manager.flush();
+    TEST_EQ(manager.size(), 4);
+    manager.insert("rn", 1);
+    manager.insert("rn", 5);
+  }
+
+  // read
+  hashdb::lmdb_repository_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+  TEST_EQ(manager.is_available(), true);
+  TEST_EQ(manager.find("rn", bitmap), true);
+  TEST_EQ(bitmap.size(), 3);
+  TEST_EQ(bitmap.contains(1), true);
+  TEST_EQ(bitmap.contains(5), true);
+  TEST_EQ(bitmap.contains(70000), true);
+  TEST_EQ(bitmap.contains(2), false);
+  TEST_EQ(manager.find("rn2", bitmap), true);
+  TEST_EQ(bitmap.size(), 1);
+  TEST_EQ(manager.find("rn3", bitmap), false);
+  TEST_EQ(bitmap.size(), 0);
+  const std::vector<std::string> names = manager.repository_names();
+  TEST_EQ(names.size(), 3);
+  TEST_EQ(names[0], "r");
+  TEST_EQ(names[1], "rn");
+  TEST_EQ(names[2], "rn2");
+}
+
+// ************************************************************
+// lmdb_helper map size
+// ************************************************************
+void lmdb_helper_map_size() {
+  const uint64_t initial_map_size = 1<<22;
+  make_new_hashdb_dir(hashdb_dir);
+  const std::string store_dir = hashdb_dir + "/lmdb_source_id_store";
+
+  // a new store opens with its initial map preallocated
+  lmdb_helper::env_policy_t policy;
+  policy.initial_map_size = initial_map_size;
+  MDB_env* env = lmdb_helper::open_env(store_dir, hashdb::RW_NEW, policy);
+  MDB_envinfo env_info;
+  TEST_EQ(mdb_env_info(env, &env_info), 0);
+  TEST_EQ((env_info.me_mapsize >= initial_map_size), true);
+#ifdef HAVE_POSIX_FALLOCATE
+  struct stat s;
+  TEST_EQ(stat((store_dir + "/data.mdb").c_str(), &s), 0);
+  TEST_EQ((static_cast<uint64_t>(s.st_size) >= initial_map_size), true);
+#endif
+  lmdb_helper::close_env(env);
+
+  // single inserts grow the map past its initial size
+  make_new_hashdb_dir(hashdb_dir);
+  hashdb::lmdb_changes_t changes;
+  uint64_t source_id;
+  {
+    hashdb::lmdb_source_id_manager_t manager(hashdb_dir, hashdb::RW_NEW);
+    for (uint64_t i=0; i<100000; ++i) {
+      std::string file_binary_hash(reinterpret_cast<char*>(&i), sizeof(i));
+      manager.insert(file_binary_hash, changes, source_id);
+    }
+    TEST_EQ(manager.size(), 100000);
+  }
+  TEST_EQ(changes.source_id_inserted, 100000);
+}
+
+// ************************************************************
+// lmdb_helper sync policy
+// ************************************************************
+void lmdb_helper_sync_policy() {
+  lmdb_helper::sync_policy_t sync_policy;
+  TEST_EQ(lmdb_helper::sync_policy_from_name("none", sync_policy), true);
+  TEST_EQ(sync_policy, lmdb_helper::SYNC_NONE);
+  TEST_EQ(lmdb_helper::sync_policy_from_name("periodic", sync_policy), true);
+  TEST_EQ(sync_policy, lmdb_helper::SYNC_PERIODIC);
+  TEST_EQ(lmdb_helper::sync_policy_from_name("flush", sync_policy), true);
+  TEST_EQ(sync_policy, lmdb_helper::SYNC_FLUSH);
+  TEST_EQ(lmdb_helper::sync_policy_from_name("always", sync_policy), false);
+
+  // writes survive each policy, with periodic syncs by volume
+  const char* names[] = {"none", "periodic", "flush"};
+  for (size_t i=0; i<3; ++i) {
+    lmdb_helper::env_policy_t policy;
+    lmdb_helper::sync_policy_from_name(names[i], policy.sync_policy);
+    policy.sync_bytes = 1<<16;
+    hashdb::lmdb_changes_t changes;
+    uint64_t source_id;
+    make_new_hashdb_dir(hashdb_dir);
+    {
+      hashdb::lmdb_source_id_manager_t manager(hashdb_dir, hashdb::RW_NEW,
+                                               policy);
+      for (uint64_t j=0; j<10000; ++j) {
+        std::string file_binary_hash(reinterpret_cast<char*>(&j), sizeof(j));
+        manager.insert(file_binary_hash, changes, source_id);
+      }
+      manager.flush();
+    }
+    hashdb::lmdb_source_id_manager_t manager(hashdb_dir, hashdb::READ_ONLY);
+    TEST_EQ(manager.size(), 10000);
+  }
 }
 
 // ************************************************************
 // main
 // ************************************************************
+void source_cache() {
+  hashdb::source_information_t information;
+  information.filesize = 100;
+  information.source_names.insert(
+                     hashdb::source_name_t("repository", "filename"));
+
+  // one entry per shard
+  hashdb::source_cache_t source_cache(16);
+  hashdb::source_information_t found_information;
+  TEST_EQ(source_cache.find("fh", found_information), false);
+  source_cache.insert("fh", information);
+  TEST_EQ(source_cache.find("fh", found_information), true);
+  TEST_EQ(found_information.filesize, 100);
+  TEST_EQ(found_information.source_names.size(), 1);
+  TEST_EQ(source_cache.stats_json(),
+          "\"source_cache_hits\":1, \"source_cache_misses\":1");
+  const std::string metrics = hashdb::metrics_text();
+  TEST_EQ((metrics.find("hashdb_cache_hits{cache=\"source_cache\"") !=
+           std::string::npos), true);
+
+  // other sources evict it
+  for (char c='a'; c<='z'; ++c) {
+    for (char d='a'; d<='z'; ++d) {
+      source_cache.insert(std::string(1, c) + d, information);
+    }
+  }
+  TEST_EQ(source_cache.find("fh", found_information), false);
+
+  // a cache of no sources keeps none
+  hashdb::source_cache_t empty_cache(0);
+  empty_cache.insert("fh", information);
+  TEST_EQ(empty_cache.find("fh", found_information), false);
+}
+
+void source_list_cache() {
+  hashdb::source_list_t source_list;
+  source_list.source_sub_counts.insert(
+                     hashdb::source_sub_count_t("fh", 2));
+  source_list.json = "[\"6668\",2]";
+
+  hashdb::source_list_cache_t source_list_cache(16);
+  hashdb::source_list_t found_source_list;
+  TEST_EQ(source_list_cache.find("crc1", found_source_list), false);
+  source_list_cache.insert("crc1", source_list);
+  TEST_EQ(source_list_cache.find("crc1", found_source_list), true);
+  TEST_EQ(found_source_list.source_sub_counts.size(), 1);
+  TEST_EQ(found_source_list.json, "[\"6668\",2]");
+  TEST_EQ(source_list_cache.stats_json(),
+          "\"source_list_cache_hits\":1, \"source_list_cache_misses\":1");
+}
+
+void hex_helper() {
+  // round trip lengths around the vector widths
+  std::string binary;
+  for (size_t i=0; i<40; ++i) {
+    TEST_EQ(hashdb::hex_to_bin(hashdb::bin_to_hex(binary)), binary);
+    binary += static_cast<char>(i * 37);
+  }
+  TEST_EQ(hashdb::bin_to_hex(std::string("\x01\xab\xff", 3)), "01abff");
+  TEST_EQ(hashdb::hex_to_bin("01ABff"), std::string("\x01\xab\xff", 3));
+
+  // invalid digits inside and after the vector width
+  const std::string hex = hashdb::bin_to_hex(std::string(20, 'x'));
+  TEST_EQ(hashdb::hex_to_bin(hex).size(), 20);
+  TEST_EQ(hashdb::hex_to_bin(hex.substr(0, 5) + "g" + hex.substr(6)), "");
+  TEST_EQ(hashdb::hex_to_bin(hex.substr(0, 35) + ":" + hex.substr(36)), "");
+  TEST_EQ(hashdb::hex_to_bin(hex.substr(1)), "");
+}
+
+// bitwise CRC-32 of the reflected polynomial, as in zlib
+static uint32_t bitwise_crc32(const uint8_t* const p, const size_t size) {
+  uint32_t crc = ~0U;
+  for (size_t i=0; i<size; ++i) {
+    crc ^= p[i];
+    for (int bit=0; bit<8; ++bit) {
+      crc = (crc >> 1) ^ (0xedb88320U & (0U - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+void crc32_kernel() {
+  // known vectors
+  const uint8_t check[] = "123456789";
+  uint8_t zeros[32];
+  uint8_t ones[32];
+  uint8_t ramp[32];
+  for (size_t i=0; i<32; ++i) {
+    zeros[i] = 0;
+    ones[i] = 0xff;
+    ramp[i] = static_cast<uint8_t>(i);
+  }
+  TEST_EQ(hashdb::crc32(0, check, 0), 0);
+  TEST_EQ(hashdb::crc32(0, check, 9), 0xcbf43926);
+  TEST_EQ(hashdb::crc32(0, zeros, 32), 0x190a55ad);
+  TEST_EQ(hashdb::crc32(0, ones, 32), 0xff6cab0b);
+  TEST_EQ(hashdb::crc32(0, ramp, 32), 0x91267e8a);
+
+  // the selected kernel matches the bitwise CRC at lengths around the
+  // 64-byte fold and at unaligned offsets
+  std::vector<uint8_t> buffer(1100);
+  uint32_t state = 1;
+  for (size_t i=0; i<buffer.size(); ++i) {
+    state = state * 1103515245 + 12345;
+    buffer[i] = static_cast<uint8_t>(state >> 16);
+  }
+  for (size_t offset=0; offset<16; ++offset) {
+    for (size_t size=0; size+offset<=buffer.size(); size+=(size<160)?1:61) {
+      TEST_EQ(hashdb::crc32(0, &buffer[offset], size),
+              bitwise_crc32(&buffer[offset], size));
+    }
+  }
+
+  // crc values continue across calls
+  const uint32_t first = hashdb::crc32(0, &buffer[0], 100);
+  TEST_EQ(hashdb::crc32(first, &buffer[100], 1000),
+          bitwise_crc32(&buffer[0], 1100));
+}
+
+// entropy as calculated over an ordered map before the flat histogram
+static uint64_t map_entropy(const uint8_t* const p, const size_t size) {
+  const size_t slots = size / 2;
+  std::map<size_t, size_t> buckets;
+  for (size_t i=0; i<slots; i++) {
+    buckets[(uint16_t)(p[i*2+0]<<0 | p[i*2+1]<<8)] += 1;
+  }
+  float entropy = 0;
+  for (std::map<size_t, size_t>::const_iterator it = buckets.begin();
+       it != buckets.end(); ++it) {
+    const float probability = (float)it->second / slots;
+    entropy += -probability * (log2f(probability));
+  }
+  return round(entropy * 1000);
+}
+
+// block label as calculated over an ordered map before the one-pass kernel
+static std::string map_block_label(const uint8_t* const p,
+                                   const size_t size) {
+  uint32_t ramp_count = 0;
+  int increasing = 0, decreasing = 0, same = 0;
+  for (size_t i=0; i+8 < size; i+= 4) {
+    const uint32_t a = (uint32_t)(p[i+0]<<0) | (uint32_t)(p[i+1]<<8) |
+                       (uint32_t)(p[i+2]<<16) | (uint32_t)(p[i+3]<<24);
+    const uint32_t b = (uint32_t)(p[i+4]<<0) | (uint32_t)(p[i+5]<<8) |
+                       (uint32_t)(p[i+6]<<16) | (uint32_t)(p[i+7]<<24);
+    if (a+1 == b) ramp_count += 1;
+    if (b > a) {
+      increasing++;
+    } else if (b < a) {
+      decreasing++;
+    } else {
+      same++;
+    }
+  }
+  std::map<uint32_t,uint32_t> hist;
+  for (size_t i=0; i+4 < size; i+= 4) {
+    hist[(uint32_t)(p[i+3]<<0) | (uint32_t)(p[i+2]<<8) |
+         (uint32_t)(p[i+1]<<16) | (uint32_t)(p[i+0]<<24)] += 1;
+  }
+  bool is_hist = (hist.size() < 3);
+  for (std::map<uint32_t,uint32_t>::const_iterator it = hist.begin();
+       it != hist.end(); it++) {
+    if (it->second > size/16) is_hist = true;
+  }
+  size_t space_count = 0;
+  for (size_t i=0; i<size; i++) {
+    if (::isspace(p[i])) space_count += 1;
+  }
+  const double total = size / 4.0;
+
+  std::string label;
+  if (ramp_count > size/8) label += "R";
+  if (is_hist) label += "H";
+  if (space_count >= (size * 3)/4) label += "W";
+  if (increasing / total >= 0.75 || decreasing / total >= 0.75 ||
+      same / total >= 0.75) label += "M";
+  return label;
+}
+
+// entropy and label kernels match the ordered map results exactly
+void block_kernels() {
+  // zeros, ramp, random, 4 and 8 byte patterns, and spaces
+  const size_t num_kinds = 6;
+  const uint8_t pattern[] = {0x12, 0x9a, 0xfe, 0x00, 0x35, 0x35, 0x80, 0x7f};
+  const char spaces[] = " \t\n x   ";
+  const size_t block_sizes[] = {512, 1024, 4096};
+
+  for (size_t s=0; s<3; ++s) {
+    const size_t block_size = block_sizes[s];
+
+    // one block of each kind
+    std::vector<uint8_t> buffer(block_size * num_kinds);
+    uint32_t state = 7;
+    for (size_t kind=0; kind<num_kinds; ++kind) {
+      uint8_t* const p = &buffer[kind * block_size];
+      for (size_t i=0; i<block_size; ++i) {
+        state = state * 1103515245 + 12345;
+        switch (kind) {
+          case 0: p[i] = 0; break;
+          case 1: p[i] = (uint8_t)((i / 4) >> (8 * (i % 4))); break;
+          case 2: p[i] = (uint8_t)(state >> 16); break;
+          case 3: p[i] = pattern[i % 4]; break;
+          case 4: p[i] = pattern[i % 8]; break;
+          default: p[i] = spaces[i % 8]; break;
+        }
+      }
+
+      // whole blocks, with the kernel of the block size
+      hasher::entropy_calculator_t entropy_calculator(block_size);
+      hasher::block_label_calculator_t label_calculator(block_size,
+                                                        block_size);
+      const uint64_t entropy = map_entropy(p, block_size);
+      const std::string label = map_block_label(p, block_size);
+      TEST_EQ(entropy_calculator.calculate(p, block_size, 0), entropy);
+      TEST_EQ(hasher::calculate_block_label(p, block_size, 0, block_size),
+              label);
+      TEST_EQ(label_calculator.calculate(p, block_size, 0), label);
+    }
+    TEST_EQ(map_entropy(&buffer[0], block_size), 0);
+    TEST_EQ(map_block_label(&buffer[0], block_size), "HM");
+
+    // windows sliding across the kinds and past the end of the buffer
+    const size_t steps[] = {12, block_size / 8};
+    for (size_t t=0; t<2; ++t) {
+      hasher::entropy_calculator_t entropy_calculator(block_size);
+      hasher::block_label_calculator_t label_calculator(block_size,
+                                                        steps[t]);
+      for (size_t offset=0; offset<buffer.size(); offset+=steps[t]) {
+        std::vector<uint8_t> block(block_size, 0);
+        std::memcpy(&block[0], &buffer[offset],
+                    std::min(block_size, buffer.size() - offset));
+
+        // the entropy of a zero-padded block has always been scaled twice
+        const uint64_t scale = (offset + block_size > buffer.size()) ?
+                               1000 : 1;
+        TEST_EQ(entropy_calculator.calculate(&buffer[0], buffer.size(),
+                                             offset),
+                map_entropy(&block[0], block_size) * scale);
+        TEST_EQ(label_calculator.calculate(&buffer[0], buffer.size(),
+                                           offset),
+                map_block_label(&block[0], block_size));
+      }
+    }
+  }
+}
+
+void numa_nodes() {
+  // CPU lists
+  std::vector<int> ids;
+  TEST_EQ(hashdb::parse_cpu_list("0-3,8\n", ids), true);
+  TEST_EQ(ids.size(), 5);
+  TEST_EQ(ids[3], 3);
+  TEST_EQ(ids[4], 8);
+  ids.clear();
+  TEST_EQ(hashdb::parse_cpu_list("", ids), false);
+  TEST_EQ(hashdb::parse_cpu_list("3-1", ids), false);
+  TEST_EQ(hashdb::parse_cpu_list("1,x", ids), false);
+
+  // every node found has CPUs and the CPUs are on one node
+  std::vector<hashdb::numa_node_t> nodes;
+  const bool has_nodes = hashdb::numa_nodes(nodes);
+  TEST_EQ(has_nodes, (nodes.size() > 0));
+  std::set<int> cpus;
+  size_t num_cpus = 0;
+  for (size_t i=0; i<nodes.size(); ++i) {
+    TEST_EQ((nodes[i].cpus.size() > 0), true);
+    cpus.insert(nodes[i].cpus.begin(), nodes[i].cpus.end());
+    num_cpus += nodes[i].cpus.size();
+  }
+  TEST_EQ(cpus.size(), num_cpus);
+}
+
+void hash_binary() {
+  hashdb::source_sub_counts_t source_sub_counts;
+  source_sub_counts.insert(hashdb::source_sub_count_t("fh1", 1));
+  source_sub_counts.insert(hashdb::source_sub_count_t("fh2", 2));
+  const std::string binary = hashdb::hash_binary(
+                    std::string("h\0sh", 4), 3, "label", 4, source_sub_counts);
+  TEST_EQ(binary.size(), 2+4 + 8 + 2+5 + 8 + 4 + 2*(2+3 + 8));
+
+  // read it back
+  std::string block_hash;
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_sub_counts_t found_source_sub_counts;
+  TEST_EQ(hashdb::read_hash_binary(binary, block_hash, k_entropy,
+                   block_label, count, found_source_sub_counts), true);
+  TEST_EQ(block_hash, std::string("h\0sh", 4));
+  TEST_EQ(k_entropy, 3);
+  TEST_EQ(block_label, "label");
+  TEST_EQ(count, 4);
+  TEST_EQ(found_source_sub_counts.size(), 2);
+  TEST_EQ(found_source_sub_counts.begin()->file_hash, "fh1");
+  TEST_EQ(found_source_sub_counts.rbegin()->sub_count, 2);
+
+  // truncated
+  TEST_EQ(hashdb::read_hash_binary(binary.substr(0, binary.size() - 1),
+                   block_hash, k_entropy, block_label, count,
+                   found_source_sub_counts), false);
+  TEST_EQ(found_source_sub_counts.size(), 0);
+}
+
+void shared_member() {
+  std::stringstream ss;
+  ss << "hashdb_test_" << getpid();
+  const std::string name = ss.str();
+  hashdb::shared_member_t::remove(name);
+  std::string error_message;
+  hashdb::shared_member_t* member =
+                   hashdb::shared_member_t::open(name, 1 << 20, error_message);
+  TEST_EQ(error_message, "");
+  TEST_EQ((member != NULL), true);
+  for (uint32_t i=0; i<1000; ++i) {
+    std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+    TEST_EQ(member->insert(item), true);
+    TEST_EQ(member->insert(item), false);
+  }
+
+  // keys longer than a slot are always new
+  TEST_EQ(member->insert(std::string(33, 'x')), true);
+  TEST_EQ(member->insert(std::string(33, 'x')), true);
+
+  // a child sees the members of the parent, and the parent sees its own
+  const pid_t pid = fork();
+  TEST_EQ((pid >= 0), true);
+  if (pid == 0) {
+    std::string child_error_message;
+    hashdb::shared_member_t* child_member =
+             hashdb::shared_member_t::open(name, 1 << 20, child_error_message);
+    bool is_shared = (child_member != NULL);
+    for (uint32_t i=0; is_shared && i<1000; ++i) {
+      std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+      is_shared = !child_member->insert(item);
+    }
+    is_shared = is_shared && child_member->insert("child");
+    delete child_member;
+    _exit(is_shared ? 0 : 1);
+  }
+  int status = 0;
+  TEST_EQ(waitpid(pid, &status, 0), pid);
+  TEST_EQ(WIFEXITED(status), true);
+  TEST_EQ(WEXITSTATUS(status), 0);
+  TEST_EQ(member->insert("child"), false);
+  delete member;
+  TEST_EQ(hashdb::shared_member_t::remove(name), "");
+  TEST_EQ((hashdb::shared_member_t::remove(name) != ""), true);
+  TEST_EQ((hashdb::shared_member_t::open("a/b", 1 << 20, error_message) ==
+           NULL), true);
+
+  // scan managers sharing state report a hash once between them
+  const std::string shared_dir = "temp_dir_shared_scan.hdb";
+  rm_hashdb_dir(shared_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(shared_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(shared_dir, "test");
+    manager.insert_hash(binary_00, 100, "bl", binary_10);
+    manager.insert_source_data(binary_10, 1000, "ft", 0, 0);
+  }
+  hashdb::scan_manager_t scan_manager1(shared_dir);
+  hashdb::scan_manager_t scan_manager2(shared_dir);
+  hashdb::scan_manager_t scan_manager3(shared_dir);
+  TEST_EQ(scan_manager1.share_optimized_state(name, 1 << 20), "");
+  TEST_EQ(scan_manager2.share_optimized_state(name, 1 << 20), "");
+  const std::string first = scan_manager1.find_hash_json(
+                             hashdb::scan_mode_t::EXPANDED_OPTIMIZED, binary_00);
+  const std::string repeat = scan_manager2.find_hash_json(
+                             hashdb::scan_mode_t::EXPANDED_OPTIMIZED, binary_00);
+  const std::string unshared = scan_manager3.find_hash_json(
+                             hashdb::scan_mode_t::EXPANDED_OPTIMIZED, binary_00);
+  TEST_EQ((first.find("sources") != std::string::npos), true);
+  TEST_EQ((repeat.find("sources") == std::string::npos), true);
+  TEST_EQ(unshared, first);
+  TEST_EQ(hashdb::scan_manager_t::remove_optimized_state(name), "");
+  rm_hashdb_dir(shared_dir);
+}
+
+void locked_member() {
+  // hashes and long keys, through several table growths
+  hashdb::locked_member_t member;
+  for (uint32_t i=0; i<10000; ++i) {
+    std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+    TEST_EQ(member.locked_insert(item), true);
+    TEST_EQ(member.locked_insert(item + std::string(20, 'x')), true);
+  }
+  for (uint32_t i=0; i<10000; ++i) {
+    std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+    TEST_EQ(member.locked_insert(item), false);
+    TEST_EQ(member.locked_insert(item + std::string(20, 'x')), false);
+  }
+
+  // a capped member stops remembering but stays correct for members
+  hashdb::locked_member_t capped_member(256 * 1024);
+  size_t new_count = 0;
+  for (uint32_t i=0; i<100000; ++i) {
+    std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+    TEST_EQ(capped_member.locked_insert(item), true);
+  }
+  TEST_EQ(capped_member.locked_insert(std::string(4, '\0')), false);
+  for (uint32_t i=0; i<100000; ++i) {
+    std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+    if (capped_member.locked_insert(item)) {
+      ++new_count;
+    }
+  }
+  TEST_EQ((new_count > 0 && new_count < 100000), true);
+}
+
+void memory_budget() {
+  hashdb::memory_budget_t& budget = hashdb::memory_budget();
+  const uint64_t used = budget.used_bytes();
+
+  // refuse past the limit, but always charge
+  budget.set_limit(used + 1000);
+  TEST_EQ(budget.try_acquire(600), true);
+  TEST_EQ(budget.try_acquire(600), false);
+  budget.charge(600);
+  TEST_EQ(budget.used_bytes(), used + 1200);
+  TEST_EQ((budget.peak_bytes() >= used + 1200), true);
+  budget.release(1200);
+  TEST_EQ(budget.try_acquire(600), true);
+  budget.release(600);
+  TEST_EQ((budget.refusal_count() > 0), true);
+
+  // an uncapped member stops remembering when the budget is spent and
+  // gives its memory back when destroyed
+  budget.set_limit(used + 256 * 1024);
+  {
+    hashdb::locked_member_t member;
+    size_t new_count = 0;
+    for (uint32_t i=0; i<100000; ++i) {
+      std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+      TEST_EQ(member.locked_insert(item), true);
+    }
+    for (uint32_t i=0; i<100000; ++i) {
+      std::string item(reinterpret_cast<const char*>(&i), sizeof(i));
+      if (member.locked_insert(item)) {
+        ++new_count;
+      }
+    }
+    TEST_EQ((new_count > 0 && new_count < 100000), true);
+    TEST_EQ((budget.used_bytes() <= used + 256 * 1024), true);
+  }
+
+  // a cache evicts instead of growing past the budget
+  budget.set_limit(used + 4096);
+  {
+    hashdb::source_cache_t cache(1000);
+    hashdb::source_information_t information;
+    information.json = std::string(1000, 'x');
+    for (uint32_t i=0; i<1000; ++i) {
+      cache.insert(std::string(reinterpret_cast<const char*>(&i),
+                               sizeof(i)), information);
+    }
+    TEST_EQ((budget.used_bytes() < used + 40 * 1024), true);
+  }
+  TEST_EQ(budget.used_bytes(), used);
+  budget.set_limit(0);
+}
+
+// async_scan completion callback counts found hashes
+static void count_found(void* const data, const uint64_t request_id,
+                        const hashdb::hash_results_t& results) {
+  (void)request_id;
+  for (size_t i=0; i<results.size(); ++i) {
+    if (results[i].found) {
+      __sync_fetch_and_add(static_cast<size_t*>(data), 1);
+    }
+  }
+}
+
+void scan_queue_split() {
+  scan_stream::scan_queue_t queue;
+  std::string data;
+  uint64_t sequence_id;
+
+  // parts are joined in part order when the last part is put
+  TEST_EQ(queue.submitted(), 0);
+  TEST_EQ(queue.submitted(), 1);
+  queue.split(0, 3);
+  data = "c";
+  queue.put_scanned(0, 2, data);
+  data = "a";
+  queue.put_scanned(0, 0, data);
+  TEST_EQ(queue.get_scanned(data, sequence_id), false);
+  data = "d";
+  queue.put_scanned(1, 0, data);
+  data = "b";
+  queue.put_scanned(0, 1, data);
+  TEST_EQ(queue.get_scanned(data, sequence_id), true);
+  TEST_EQ(sequence_id, 1);
+  TEST_EQ(data, "d");
+  TEST_EQ(queue.get_scanned(data, sequence_id), true);
+  TEST_EQ(sequence_id, 0);
+  TEST_EQ(data, "abc");
+  TEST_EQ(queue.empty(), true);
+}
+
+void async_scan() {
+  const std::string async_dir = "temp_dir_async_scan.hdb";
+  rm_hashdb_dir(async_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(async_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(async_dir, "test");
+    manager.insert_hash(binary_00, 100, "bl", binary_10);
+    manager.insert_hash(binary_01, 200, "", binary_10);
+  }
+  hashdb::scan_manager_t scan_manager(async_dir);
+  std::vector<std::string> block_hashes;
+  block_hashes.push_back(binary_00);
+  block_hashes.push_back(binary_2);
+  block_hashes.push_back(binary_01);
+  {
+    hashdb::async_scan_t async_scan(&scan_manager, 2);
+
+    // results queued for the event loop
+    TEST_EQ(async_scan.submit(block_hashes), 0);
+    TEST_EQ((async_scan.event_fd() >= 0), true);
+    struct pollfd pfd;
+    pfd.fd = async_scan.event_fd();
+    pfd.events = POLLIN;
+    TEST_EQ(poll(&pfd, 1, 10000), 1);
+    char discard[8];
+    TEST_EQ((read(async_scan.event_fd(), discard, sizeof(discard)) > 0),
+            true);
+    uint64_t request_id = 9;
+    hashdb::hash_results_t results;
+    TEST_EQ(async_scan.get_completed(request_id, results), true);
+    TEST_EQ(request_id, 0);
+    TEST_EQ(results.size(), 3);
+    TEST_EQ(results[0].found, true);
+    TEST_EQ(results[0].k_entropy, 100);
+    TEST_EQ(results[0].block_label, "bl");
+    TEST_EQ(results[0].count, 1);
+    TEST_EQ(results[0].source_sub_counts.size(), 1);
+    TEST_EQ(results[1].block_hash, binary_2);
+    TEST_EQ(results[1].found, false);
+    TEST_EQ(results[2].k_entropy, 200);
+    TEST_EQ(async_scan.get_completed(request_id, results), false);
+
+    // callbacks on the scan threads
+    size_t found = 0;
+    for (int i=0; i<100; ++i) {
+      async_scan.submit(block_hashes, count_found, &found);
+    }
+    async_scan.wait_idle();
+    TEST_EQ(found, 200);
+
+    // futures
+    std::future<hashdb::hash_results_t> future =
+                                async_scan.submit_future(block_hashes);
+    results = future.get();
+    TEST_EQ(results.size(), 3);
+    TEST_EQ(results[2].found, true);
+    TEST_EQ(async_scan.get_completed(request_id, results), false);
+  }
+  rm_hashdb_dir(async_dir);
+}
+
+// the first hash of each record of scanned data
+static std::vector<std::string> swap_scan_hashes(const std::string& scanned,
+                                                 const size_t hash_size) {
+  std::vector<std::string> hashes;
+  size_t index = 0;
+  while (index + hash_size + sizeof(uint16_t) <= scanned.size()) {
+    hashes.push_back(scanned.substr(index, hash_size));
+    uint16_t label_size;
+    memcpy(&label_size, scanned.data() + index + hash_size,
+           sizeof(label_size));
+    index += hash_size + sizeof(uint16_t) + label_size;
+    uint32_t json_size;
+    memcpy(&json_size, scanned.data() + index, sizeof(json_size));
+    index += sizeof(json_size) + json_size;
+  }
+  return hashes;
+}
+
+void swap_scan() {
+  // an old and a new version of a database
+  const std::string old_dir = "temp_dir_swap_old.hdb";
+  const std::string new_dir = "temp_dir_swap_new.hdb";
+  rm_hashdb_dir(old_dir);
+  rm_hashdb_dir(new_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(old_dir, settings, "test"), "");
+  TEST_EQ(hashdb::create_hashdb(new_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(old_dir, "test");
+    manager.insert_hash(binary_00, 100, "bl", binary_10);
+  }
+  {
+    hashdb::import_manager_t manager(new_dir, "test");
+    manager.insert_hash(binary_01, 200, "", binary_10);
+  }
+  const size_t hash_size = binary_00.size();
+  const uint16_t label_size = 0;
+  std::string records;
+  records.append(binary_00);
+  records.append(reinterpret_cast<const char*>(&label_size),
+                 sizeof(label_size));
+  records.append(binary_01);
+  records.append(reinterpret_cast<const char*>(&label_size),
+                 sizeof(label_size));
+
+  hashdb::scan_manager_t old_manager(old_dir);
+  hashdb::scan_manager_t* const new_manager =
+                                       new hashdb::scan_manager_t(new_dir);
+  hashdb::scan_stream_t scan_stream(&old_manager, hash_size,
+                                    hashdb::scan_mode_t::COUNT, 2);
+  scan_stream.put(records);
+
+  // warm the new version in the background
+  uint64_t bytes_read = 0;
+  uint64_t bytes_to_read = 0;
+  TEST_EQ(new_manager->warm_progress(bytes_read, bytes_to_read), false);
+  new_manager->start_warm(2);
+  bool done = false;
+  for (int i=0; i<10000 && !done; ++i) {
+    done = new_manager->warm_progress(bytes_read, bytes_to_read);
+    if (!done) {
+      usleep(1000);
+    }
+  }
+  TEST_EQ(done, true);
+  TEST_EQ((bytes_to_read > 0), true);
+  TEST_EQ(bytes_read, bytes_to_read);
+
+  // the array put before the swap drains on the old version
+  hashdb::stage_totals_t before;
+  hashdb::stage_snapshot(before);
+  TEST_EQ(scan_stream.swap_scan_manager(new_manager), &old_manager);
+  TEST_EQ(scan_stream.wait_drained(&old_manager, 10000), true);
+  hashdb::stage_totals_t after;
+  hashdb::stage_snapshot(after);
+  TEST_EQ(after.count[hashdb::STAGE_SCAN_SWAP] -
+          before.count[hashdb::STAGE_SCAN_SWAP], 1);
+  std::vector<std::string> found = swap_scan_hashes(
+                                  scan_stream.get(10000), hash_size);
+  TEST_EQ(found.size(), 1);
+  TEST_EQ(found[0], binary_00);
+
+  // arrays put after it scan the new version
+  scan_stream.put(records);
+  found = swap_scan_hashes(scan_stream.get(10000), hash_size);
+  TEST_EQ(found.size(), 1);
+  TEST_EQ(found[0], binary_01);
+
+  // and back, closing the new version once drained
+  TEST_EQ(scan_stream.swap_scan_manager(&old_manager), new_manager);
+  TEST_EQ(scan_stream.wait_drained(new_manager, 10000), true);
+  delete new_manager;
+  scan_stream.put(records);
+  found = swap_scan_hashes(scan_stream.get(10000), hash_size);
+  TEST_EQ(found.size(), 1);
+  TEST_EQ(found[0], binary_00);
+  rm_hashdb_dir(old_dir);
+  rm_hashdb_dir(new_dir);
+}
+
+// scan in a child using the scan manager of the parent
+static bool fork_scan_found(const hashdb::scan_manager_t& scan_manager) {
+  uint64_t k_entropy;
+  std::string block_label;
+  uint64_t count;
+  hashdb::source_sub_counts_t source_sub_counts;
+  uint64_t filesize;
+  std::string file_type;
+  uint64_t zero_count;
+  uint64_t nonprobative_count;
+  return scan_manager.find_hash(binary_00, k_entropy, block_label, count,
+                                source_sub_counts) &&
+         k_entropy == 100 && block_label == "bl" && count == 1 &&
+         scan_manager.find_source_data(binary_10, filesize, file_type,
+                           zero_count, nonprobative_count);
+}
+
+void fork_scan() {
+  const std::string fork_dir = "temp_dir_fork_scan.hdb";
+  rm_hashdb_dir(fork_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(fork_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(fork_dir, "test");
+    manager.insert_hash(binary_00, 100, "bl", binary_10);
+    manager.insert_source_data(binary_10, 1000, "ft", 0, 0);
+  }
+  hashdb::scan_manager_t scan_manager(fork_dir);
+
+  // the parent holds cached read txns when it forks
+  TEST_EQ(fork_scan_found(scan_manager), true);
+  for (int i=0; i<2; ++i) {
+    const pid_t pid = fork();
+    TEST_EQ((pid >= 0), true);
+    if (pid == 0) {
+      scan_manager.reopen_after_fork();
+      _exit(fork_scan_found(scan_manager) ? 0 : 1);
+    }
+    int status = 0;
+    TEST_EQ(waitpid(pid, &status, 0), pid);
+    TEST_EQ(WIFEXITED(status), true);
+    TEST_EQ(WEXITSTATUS(status), 0);
+  }
+
+  // the parent still reads, and reopening there does nothing
+  TEST_EQ(fork_scan_found(scan_manager), true);
+  scan_manager.reopen_after_fork();
+  TEST_EQ(fork_scan_found(scan_manager), true);
+  rm_hashdb_dir(fork_dir);
+}
+
+// scan on a thread of its own
+static void* thread_exit_scan_found(void* const arg) {
+  hashdb::scan_manager_t& scan_manager =
+                               *static_cast<hashdb::scan_manager_t*>(arg);
+  std::string* const json = new std::string;
+  *json = scan_manager.find_hash_json(hashdb::EXPANDED, binary_00);
+  return json;
+}
+
+void thread_exit_scan() {
+  const std::string thread_dir = "temp_dir_thread_exit_scan.hdb";
+  rm_hashdb_dir(thread_dir);
+  hashdb::settings_t settings;
+  settings.max_readers = 8;
+  TEST_EQ(hashdb::create_hashdb(thread_dir, settings, "test"), "");
+  {
+    hashdb::import_manager_t manager(thread_dir, "test");
+    manager.insert_hash(binary_00, 100, "bl", binary_10);
+    manager.insert_source_data(binary_10, 1000, "ft", 0, 0);
+  }
+  hashdb::scan_manager_t scan_manager(thread_dir);
+
+  // threads that exit free their reader slots for the threads after them
+  for (int i=0; i<40; ++i) {
+    pthread_t thread;
+    TEST_EQ(pthread_create(&thread, NULL, thread_exit_scan_found,
+                           &scan_manager), 0);
+    void* json = NULL;
+    TEST_EQ(pthread_join(thread, &json), 0);
+    TEST_EQ((static_cast<std::string*>(json)->size() > 0), true);
+    delete static_cast<std::string*>(json);
+  }
+  rm_hashdb_dir(thread_dir);
+}
+
+// ingest and scan with the parameters of earlier releases or with options
+void ingest_api() {
+  const std::string api_dir = "temp_dir_ingest_api.hdb";
+  const std::string media = "temp_ingest_api_media";
+  rm_hashdb_dir(api_dir);
+  hashdb::settings_t settings;
+  TEST_EQ(hashdb::create_hashdb(api_dir, settings, "test"), "");
+  {
+    std::ofstream out(media.c_str(), std::ios::binary);
+    for (int i=0; i<4096; ++i) {
+      out.put(static_cast<char>((i * 7919) >> 3));
+    }
+  }
+
+  TEST_EQ(hashdb::ingest(api_dir, media, 512, "repository", "",
+                         false, false, false, "test"), "");
+  {
+    hashdb::scan_manager_t manager(api_dir);
+    TEST_EQ((manager.first_source().size() > 0), true);
+  }
+
+  // by default jobs print their status, as in earlier releases
+  hashdb::ingest_options_t options;
+  TEST_EQ(options.quiet, false);
+  TEST_EQ(hashdb::scan_media_options_t().quiet, false);
+  options.skip_unchanged = true;
+  options.quiet = true;
+  TEST_EQ(hashdb::ingest(api_dir, media, 512, "repository", "",
+                         false, false, false, "test", options), "");
+
+  // streams are ingested without the options for files
+  TEST_EQ((hashdb::ingest_stream(std::vector<std::string>(1, api_dir),
+                         std::vector<size_t>(1, 512), 0, "stdin", "", "",
+                         false, false, false, "test", options) != ""), true);
+
+  // scan with the parameters of earlier releases or with options
+  TEST_EQ(hashdb::scan_media(api_dir, media, 512, false, hashdb::EXPANDED),
+          "");
+  hashdb::scan_media_options_t scan_options;
+  scan_options.summarize = true;
+  scan_options.quiet = true;
+  TEST_EQ(hashdb::scan_media(api_dir, media, 512, false, hashdb::EXPANDED,
+                             scan_options), "");
+  scan_options.checkpoint_file = "temp_ingest_api_checkpoint";
+  TEST_EQ((hashdb::scan_media(api_dir, media, 512, false, hashdb::EXPANDED,
+                              scan_options) != ""), true);
+
+  // a completed scan removes its checkpoint
+  scan_options.summarize = false;
+  TEST_EQ(hashdb::scan_media(api_dir, media, 512, false, hashdb::EXPANDED,
+                             scan_options), "");
+  TEST_EQ(std::ifstream("temp_ingest_api_checkpoint").is_open(), false);
+
+  // a run resumes only from a checkpoint of the same kind and path
+  {
+    std::ofstream out("temp_ingest_api_checkpoint");
+    out << "kind\tingest\npath\t" << media << "\ndone\t0\n";
+  }
+  scan_options.resume = true;
+  TEST_EQ((hashdb::scan_media(api_dir, media, 512, false, hashdb::EXPANDED,
+                              scan_options) != ""), true);
+  options.checkpoint_file = "temp_ingest_api_checkpoint";
+  options.resume = true;
+  TEST_EQ(hashdb::ingest(api_dir, media, 512, "repository", "",
+                         false, false, false, "test", options), "");
+  TEST_EQ(std::ifstream("temp_ingest_api_checkpoint").is_open(), false);
+
+  std::remove(media.c_str());
+  rm_hashdb_dir(api_dir);
+}
+
 int main(int argc, char* argv[]) {
 
   // lmdb_hash_manager
@@ -370,6 +1845,10 @@ int main(int argc, char* argv[]) {
   lmdb_hash_manager_write();
   lmdb_hash_manager_read();
   lmdb_hash_manager_count();
+  lmdb_hash_manager_shards();
+  lmdb_hash_manager_prefix_index();
+  lmdb_hash_manager_filter();
+  hash_bulk_loader();
 
   // source ID manager
   lmdb_source_id_manager();
@@ -379,6 +1858,43 @@ int main(int argc, char* argv[]) {
 
   // source name manager
   lmdb_source_name_manager();
+  lmdb_source_name_manager_compressed();
+
+  // repository manager
+  source_id_bitmap();
+  lmdb_repository_manager();
+
+  // map size
+  lmdb_helper_map_size();
+  lmdb_helper_sync_policy();
+
+  // source cache
+  source_cache();
+  source_list_cache();
+  hex_helper();
+  crc32_kernel();
+  block_kernels();
+  hash_binary();
+  numa_nodes();
+
+  // membership
+  locked_member();
+  shared_member();
+  memory_budget();
+
+  // asynchronous scans
+  scan_queue_split();
+  async_scan();
+  swap_scan();
+
+  // prefork workers
+  fork_scan();
+
+  // short-lived scan threads
+  thread_exit_scan();
+
+  // ingest and scan parameters
+  ingest_api();
 
   // done
   std::cout << "lmdb_other_managers_test Done.\n";
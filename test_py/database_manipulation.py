@@ -2,6 +2,7 @@
 #
 # Test database maniplation commands
 
+import os
 import shutil
 import helpers as H
 
@@ -45,16 +46,18 @@ def test_add():
     H.make_hashdb("temp_1.hdb", json_out1)
     H.rm_tempdir("temp_2.hdb")
 
-    # add to new temp_2.hdb
-    H.hashdb(["add", "temp_1.hdb", "temp_2.hdb"])
+    # add to new temp_2.hdb, which copies the stores
+    returned_answer = H.hashdb(["add", "temp_1.hdb", "temp_2.hdb"])
+    H.str_equals(returned_answer[0], "# Cloned temp_1.hdb into empty temp_2.hdb")
 
     # temp_2.hdb should match
     H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
     json2 = H.read_file("temp_2.json")
     H.lines_equals(json2, json_out1)
 
-    # add to existing temp_2.hdb
-    H.hashdb(["add", "temp_1.hdb", "temp_2.hdb"])
+    # add to existing temp_2.hdb, which adds hash by hash
+    returned_answer = H.hashdb(["add", "temp_1.hdb", "temp_2.hdb"])
+    H.bool_equals(returned_answer[0][:8] != "# Cloned", True)
 
     # temp_2.hdb should match
     H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
@@ -337,6 +340,112 @@ def test_subtract_repository():
 '{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab"]}'
 ])
 
+def test_remove():
+    # create new hashdb
+    H.make_hashdb("temp_1.hdb", json_out1)
+
+    # remove a source, dropping its references
+    H.hashdb(["remove_source", "temp_1.hdb", "0011223344556677"])
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, [
+'# command: ',
+'# hashdb-Version: ',
+'{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","source_sub_counts":["1111111111111111",1]}',
+'{"block_hash":"8899aabbccddeeff","k_entropy":0,"block_label":"","source_sub_counts":["0000000000000000",1]}',
+'{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab"]}',
+'{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab","repository2","second_temp_1.tab"]}'
+])
+
+    # the removed source is not in its repository
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["add_repository", "temp_1.hdb", "temp_2.hdb", "repository1"])
+    H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
+    json2 = H.read_file("temp_2.json")
+    H.lines_equals(json2, [
+'# command: ',
+'# hashdb-Version: ',
+'{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","source_sub_counts":["1111111111111111",1]}',
+'{"block_hash":"8899aabbccddeeff","k_entropy":0,"block_label":"","source_sub_counts":["0000000000000000",1]}',
+'{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab"]}',
+'{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab"]}'
+])
+
+    # remove a hash, keeping its source
+    H.hashdb(["remove_hash", "temp_1.hdb", "8899aabbccddeeff"])
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, [
+'# command: ',
+'# hashdb-Version: ',
+'{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","source_sub_counts":["1111111111111111",1]}',
+'{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab"]}',
+'{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["repository1","temp_1.tab","repository2","second_temp_1.tab"]}'
+])
+
+    # a removed source may be imported again
+    H.make_tempfile("temp_1.json", json_out1)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, json_out1)
+
+def test_optimize():
+    # create new hashdb, then remove and import again to leave free pages
+    H.make_hashdb("temp_1.hdb", json_out1)
+    H.hashdb(["remove_source", "temp_1.hdb", "0011223344556677"])
+    H.make_tempfile("temp_1.json", json_out1)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+
+    # optimize, which does not grow the stores
+    returned_answer = H.hashdb(["optimize", "temp_1.hdb"])
+    words = returned_answer[0].split()
+    H.str_equals(" ".join(words[:4]), "Hash database optimized from")
+    H.bool_equals(int(words[6]) <= int(words[4]), True)
+    H.bool_equals(int(words[12]) <= int(words[10]), True)
+
+    # the prefix index is saved for scans to map
+    H.bool_equals(os.path.exists("temp_1.hdb/hash_prefix_index"), True)
+
+    # the data is unchanged
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, json_out1)
+
+    # the optimized hashdb may be imported into and scanned
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    returned_answer = H.hashdb(["scan_hash", "temp_1.hdb", "2222222222222222"])
+    H.bool_equals(returned_answer[0][:1] == "{", True)
+
+def test_compress_names():
+    H.make_hashdb("temp_1.hdb", json_out1)
+
+    # compress, which does not grow the source name store
+    returned_answer = H.hashdb(["compress_names", "temp_1.hdb"])
+    words = returned_answer[0].split()
+    H.str_equals(" ".join(words[:4]), "Source names compressed from")
+    H.bool_equals(int(words[6]) <= int(words[4]), True)
+
+    # the data is unchanged
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, json_out1)
+
+    # names imported later are compressed too
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["add", "temp_1.hdb", "temp_2.hdb"])
+    H.hashdb(["remove_source", "temp_1.hdb", "0011223344556677"])
+    H.hashdb(["add", "temp_2.hdb", "temp_1.hdb"])
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    json1 = H.read_file("temp_1.json")
+    H.lines_equals(json1, json_out1)
+
+    # only once
+    p = H.hashdb_start(["compress_names", "temp_1.hdb"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+
 if __name__=="__main__":
     test_add()
     test_add_multiple()
@@ -347,5 +456,8 @@ if __name__=="__main__":
     test_subtract()
     test_subtract_hash()
     test_subtract_repository()
+    test_remove()
+    test_optimize()
+    test_compress_names()
     print("Test Done.")
 
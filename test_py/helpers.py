@@ -8,8 +8,8 @@ import shutil
 import zipfile
 import gzip
 
-# run command array and return lines from it
-def hashdb(cmd):
+# insert the path to hashdb into command array
+def _hashdb_command(cmd):
     # find hashdb
     if os.path.isfile("../src/hashdb"):
         # path for "make check" from base dir
@@ -27,6 +27,10 @@ def hashdb(cmd):
         print("hashdb tool not found.  Aborting.\n")
         raise ValueError("hashdb not found")
 
+# run command array and return lines from it
+def hashdb(cmd):
+    _hashdb_command(cmd)
+
     # run hashdb command
     p = Popen(cmd, stdout=PIPE)
     lines = p.communicate()[0].decode('utf-8').split("\n")
@@ -38,6 +42,12 @@ def hashdb(cmd):
 
     return lines
 
+# start command array in the background, returning the process, whose
+# output may be read from its stdout.  Its stdin may be given.
+def hashdb_start(cmd, stdin=None):
+    _hashdb_command(cmd)
+    return Popen(cmd, stdin=stdin, stdout=PIPE)
+
 def read_file(filename):
     with open(filename, 'r') as myfile:
         lines = myfile.readlines()
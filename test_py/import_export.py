@@ -2,6 +2,12 @@
 #
 # Test the Import Export command group
 
+import bz2
+import os
+import io
+import json
+import tarfile
+import shutil
 import helpers as H
 
 # test basic DB integrity
@@ -177,6 +183,100 @@ def test_export_json_hash_partition_range():
     returned_answer = H.read_file("temp_2.json")
     H.lines_equals(returned_answer, expected_answer)
 
+# test sharded export and import of its manifest
+def test_export_json_shards():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.rm_tempfile("temp_2.json")
+    H.rm_tempfile("temp_3.json")
+
+    temp1_input = [
+'{"block_hash":"2222222222222222","k_entropy":1,"block_label":"bl1","source_sub_counts":["1111111111111111",2]}',
+'{"block_hash":"8899aabbccddeeff","k_entropy":2,"block_label":"bl2","source_sub_counts":["0000000000000000",1,"0011223344556677",2]}',
+'{"block_hash":"ffffffffffffffff","k_entropy":3,"block_label":"bl3","source_sub_counts":["0011223344556677",1]}',
+'{"file_hash":"0000000000000000","filesize":3,"file_type":"ftb","zero_count":4,"nonprobative_count":5,"name_pairs":["r2","f2"]}',
+'{"file_hash":"0011223344556677","filesize":6,"file_type":"fta","zero_count":7,"nonprobative_count":8,"name_pairs":["r1","f1"]}',
+'{"file_hash":"1111111111111111","filesize":9,"file_type":"ftc","zero_count":10,"nonprobative_count":11,"name_pairs":["r3","f3"]}'
+]
+
+    H.make_tempfile("temp_1.json", temp1_input)
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["export", "-S", "2", "-n", "2", "temp_1.hdb", "temp_3.json"])
+
+    # the manifest
+    H.lines_equals(H.read_file("temp_3.json"), [
+"# command: ","# hashdb-Version: ",
+"# hashdb-Manifest: 3",
+"# hashdb-Shard: temp_3.json.0",
+"# hashdb-Shard: temp_3.json.1",
+"# hashdb-Shard: temp_3.json.2"])
+
+    # the shards, hashes by key range then sources
+    H.lines_equals(H.read_file("temp_3.json.0"), [
+"# command: ","# hashdb-Version: ",
+temp1_input[0]])
+    H.lines_equals(H.read_file("temp_3.json.1"), [
+"# command: ","# hashdb-Version: ",
+temp1_input[1], temp1_input[2]])
+    H.lines_equals(H.read_file("temp_3.json.2"), [
+"# command: ","# hashdb-Version: ",
+temp1_input[3], temp1_input[4], temp1_input[5]])
+
+    # import the manifest
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["import", "temp_2.hdb", "temp_3.json"])
+    H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
+    H.lines_equals(H.read_file("temp_2.json"),
+                   ["# command: ","# hashdb-Version: "] + temp1_input)
+
+# test binary export and its import
+def test_export_bin():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempdir("temp_3.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.rm_tempfile("temp_2.json")
+    H.rm_tempfile("temp_3.json")
+    H.rm_tempfile("temp_1.bin")
+    H.rm_tempfile("temp_2.bin")
+
+    # one hash refers to a source without source data
+    temp1_input = [
+'{"block_hash":"2222222222222222","k_entropy":1,"block_label":"bl1","source_sub_counts":["1111111111111111",2]}',
+'{"block_hash":"8899aabbccddeeff","k_entropy":2,"block_label":"bl2","source_sub_counts":["0000000000000000",1,"0011223344556677",2]}',
+'{"block_hash":"88aaaaaaaaaaaaaa","k_entropy":4,"block_label":"","source_sub_counts":["2222222222222222",3]}',
+'{"block_hash":"ffffffffffffffff","k_entropy":3,"block_label":"bl3","source_sub_counts":["0011223344556677",1]}',
+'{"file_hash":"0000000000000000","filesize":3,"file_type":"ftb","zero_count":4,"nonprobative_count":5,"name_pairs":["r2","f2"]}',
+'{"file_hash":"0011223344556677","filesize":6,"file_type":"fta","zero_count":7,"nonprobative_count":8,"name_pairs":["r1","f1","r2","f4"]}',
+'{"file_hash":"1111111111111111","filesize":9,"file_type":"ftc","zero_count":10,"nonprobative_count":11,"name_pairs":["r3","f3"]}'
+]
+
+    H.make_tempfile("temp_1.json", temp1_input)
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["export", "temp_1.hdb", "temp_2.json"])
+    H.hashdb(["export", "-c", "bin", "temp_1.hdb", "temp_1.bin"])
+
+    # the binary export imports to the same content
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["import", "temp_2.hdb", "temp_1.bin"])
+    H.hashdb(["export", "temp_2.hdb", "temp_3.json"])
+    H.lines_equals(H.read_file("temp_3.json"), H.read_file("temp_2.json"))
+
+    # a corrupted frame is rejected
+    with open("temp_1.bin", "rb") as f:
+        data = bytearray(f.read())
+    data[-1] ^= 0xff
+    with open("temp_2.bin", "wb") as f:
+        f.write(data)
+    H.hashdb(["create", "temp_3.hdb"])
+    p = H.hashdb_start(["import", "temp_3.hdb", "temp_2.bin"])
+    p.communicate()
+    if p.returncode == 0:
+        raise ValueError("corrupted binary export was imported")
+
 def test_ingest():
     H.make_temp_media("temp_1_media")
     H.rm_tempdir("temp_1.hdb")
@@ -203,6 +303,587 @@ def test_ingest():
 #''
 #])
 
+def test_ingest_containers():
+    # bzip2 and tar content after 600 bytes of 0x00
+    tar_content = b"tar content"
+    tar_header = tarfile.TarInfo("temp_0_file_3")
+    tar_header.size = len(tar_content)
+    tar_bytes = io.BytesIO()
+    with tarfile.open(fileobj=tar_bytes, mode='w',
+                      format=tarfile.USTAR_FORMAT) as f:
+        f.addfile(tar_header, io.BytesIO(tar_content))
+    with open("temp_1_media", 'wb') as f:
+        f.write(b'\0' * 600)
+        f.write(bz2.compress(b"bzip2 content"))
+        f.write(tar_bytes.getvalue())
+
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "temp_1.hdb", "temp_1_media"])
+    returned_answer = H.hashdb(["size", "temp_1.hdb"])
+    H.lines_equals(returned_answer, [
+'{"hash_data_store":4, "hash_store":4, "source_data_store":3, "source_id_store":3, "source_name_store":3}',
+''
+])
+
+    # read recursed bytes back by forensic path
+    returned_answer = H.hashdb(["read_media", "temp_1_media", "600-bzip2-0",
+                                "5"])
+    H.lines_equals(returned_answer, ['bzip2'])
+
+def test_ingest_skip_unchanged():
+    H.make_temp_media("temp_1_media")
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    returned_answer = H.hashdb(["ingest", "-u", "temp_1.hdb", "temp_1_media"])
+    H.str_equals(returned_answer[0], "# Skipping 0 unchanged files")
+
+    # the unchanged file and its members are attributed to the new
+    # repository without being read
+    returned_answer = H.hashdb(["ingest", "-u", "-r", "repository2",
+                                "temp_1.hdb", "temp_1_media"])
+    H.str_equals(returned_answer[0], "# Skipping 1 unchanged files")
+    returned_answer = H.hashdb(["size", "temp_1.hdb"])
+    H.lines_equals(returned_answer, [
+'{"hash_data_store":4, "hash_store":4, "source_data_store":4, "source_id_store":4, "source_name_store":8}',
+''
+])
+    sources = "\n".join(H.hashdb(["sources", "temp_1.hdb"]))
+    H.bool_equals('"repository2","temp_1_media-600-zip"' in sources, True)
+
+    # a rewrite of the same size within the same second is not skipped
+    with open("temp_1_media", 'r+b') as f:
+        f.write(b"\1")
+    returned_answer = H.hashdb(["ingest", "-u", "-r", "repository3",
+                                "temp_1.hdb", "temp_1_media"])
+    H.str_equals(returned_answer[0], "# Skipping 0 unchanged files")
+
+def test_ingest_direct_reads():
+    # a file of more than one read, not a multiple of the page size
+    with open("temp_2_media", 'wb') as f:
+        f.write(os.urandom(3 * 2**20 + 1000))
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["ingest", "temp_1.hdb", "temp_2_media"])
+    H.hashdb(["ingest", "-O", "temp_2.hdb", "temp_2_media"])
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_1.hdb"]))
+
+    # scans read the same bytes
+    scan1 = H.hashdb(["scan_media", "-q", "temp_1.hdb", "temp_2_media"])
+    scan2 = H.hashdb(["scan_media", "-q", "-O", "temp_1.hdb", "temp_2_media"])
+    H.lines_equals([line for line in scan2 if line[:1] != "#"],
+                   [line for line in scan1 if line[:1] != "#"])
+    H.rm_tempfile("temp_2_media")
+
+def test_memory_budget():
+    # a budget smaller than one buffer slows but does not change results
+    with open("temp_2_media", 'wb') as f:
+        f.write(os.urandom(3 * 2**20 + 1000))
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_2_media"])
+    H.hashdb(["-g", "1M", "ingest", "-q", "temp_2.hdb", "temp_2_media"])
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_1.hdb"]))
+    scan1 = H.hashdb(["scan_media", "-q", "-j", "e", "temp_1.hdb",
+                      "temp_2_media"])
+    scan2 = H.hashdb(["-g", "1M", "scan_media", "-q", "-j", "e",
+                      "temp_1.hdb", "temp_2_media"])
+    H.lines_equals([line for line in scan2 if line[:1] != "#"],
+                   [line for line in scan1 if line[:1] != "#"])
+    H.rm_tempfile("temp_2_media")
+
+def test_ingest_sparse():
+    # holes read as zeros, so a sparse file ingests and scans like a
+    # dense copy
+    data = os.urandom(2**20 + 1000)
+    with open("temp_2_media", 'wb') as f:
+        f.seek(40 * 2**20)
+        f.write(data)
+        f.truncate(100 * 2**20)
+    with open("temp_3_media", 'wb') as f:
+        f.write(b'\0' * (40 * 2**20))
+        f.write(data)
+        f.write(b'\0' * (60 * 2**20 - len(data)))
+    for name in ["temp_2", "temp_3"]:
+        H.rm_tempdir(name + ".hdb")
+        H.hashdb(["create", name + ".hdb"])
+        H.hashdb(["ingest", "-q", "-r", "r", name + ".hdb", name + "_media"])
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_3.hdb"]))
+    sources2 = H.hashdb(["sources", "temp_2.hdb"])
+    sources3 = H.hashdb(["sources", "temp_3.hdb"])
+    H.str_equals(sources2[0].split('"name_pairs"')[0],
+                 sources3[0].split('"name_pairs"')[0])
+    scan2 = H.hashdb(["scan_media", "-q", "-jc", "temp_3.hdb", "temp_2_media"])
+    scan3 = H.hashdb(["scan_media", "-q", "-jc", "temp_3.hdb", "temp_3_media"])
+    H.lines_equals([line for line in scan2 if line[:1] != "#" or
+                    line[:7] == "# Total"],
+                   [line for line in scan3 if line[:1] != "#" or
+                    line[:7] == "# Total"])
+    H.rm_tempfile("temp_2_media")
+    H.rm_tempfile("temp_3_media")
+
+def test_scan_filter():
+    # random blocks then low entropy blocks of repeated text
+    with open("temp_2_media", 'wb') as f:
+        f.write(os.urandom(65536))
+        f.write(b'abcdefghijklmnopqrstuvwxyz012345' * 2048)
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_2_media"])
+    scan1 = H.hashdb(["scan_media", "-q", "-je", "temp_1.hdb",
+                      "temp_2_media"])
+    matches1 = [line for line in scan1 if line[:1] != "#" and line != ""]
+
+    # filtered blocks are not reported, and the rest are as before
+    scan2 = H.hashdb(["scan_media", "-q", "-je", "-e", "5000", "temp_1.hdb",
+                      "temp_2_media"])
+    matches2 = [line for line in scan2 if line[:1] != "#" and line != ""]
+    H.bool_equals(len(matches2) > 0, True)
+    H.bool_equals(len(matches2) < len(matches1), True)
+    for line in matches2:
+        H.bool_equals(line in matches1, True)
+        H.bool_equals(json.loads(line.split("\t")[2])["k_entropy"] >= 5000,
+                      True)
+    H.str_equals([line for line in scan2
+                  if line[:25] == "# Total filtered blocks: "][0],
+                 "# Total filtered blocks: %d" %
+                 (len(matches1) - len(matches2)))
+
+    # labeled blocks are skipped
+    scan3 = H.hashdb(["scan_media", "-q", "-je", "-o", "temp_1.hdb",
+                      "temp_2_media"])
+    for line in scan3:
+        if line[:1] != "#" and line != "":
+            H.str_equals(json.loads(line.split("\t")[2])["block_label"], "")
+    H.rm_tempfile("temp_2_media")
+
+# test counting but not storing non-probative blocks
+def test_ingest_skip_nonprobative():
+    # random blocks then labeled blocks of repeated text
+    with open("temp_2_media", 'wb') as f:
+        f.write(os.urandom(65536))
+        f.write(b'abcdefghijklmnopqrstuvwxyz012345' * 2048)
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_2_media"])
+    H.hashdb(["ingest", "-q", "-x", "n", "temp_2.hdb", "temp_2_media"])
+
+    # labeled blocks are not stored
+    size1 = json.loads(H.hashdb(["size", "temp_1.hdb"])[0])
+    size2 = json.loads(H.hashdb(["size", "temp_2.hdb"])[0])
+    H.int_equals(size2["hash_store"], 128)
+    H.bool_equals(size2["hash_store"] < size1["hash_store"], True)
+
+    # but are still counted
+    sources1 = json.loads(H.hashdb(["sources", "temp_1.hdb"])[0])
+    sources2 = json.loads(H.hashdb(["sources", "temp_2.hdb"])[0])
+    H.bool_equals(sources2["nonprobative_count"] > 0, True)
+    H.int_equals(sources2["nonprobative_count"],
+                 sources1["nonprobative_count"])
+    H.rm_tempfile("temp_2_media")
+
+# test resuming interrupted ingest and scan_media runs from checkpoints
+def test_checkpoint_resume():
+    # a completed run removes its checkpoint
+    H.make_temp_media("temp_1_media")
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.checkpoint")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "-K", "temp_1.checkpoint", "temp_1.hdb",
+              "temp_1_media"])
+    H.bool_equals(os.path.exists("temp_1.checkpoint"), False)
+
+    # ingest resumes after the files the checkpoint records as ingested
+    shutil.rmtree("temp_dir", True)
+    os.mkdir("temp_dir")
+    for name in ["a", "b", "c"]:
+        with open("temp_dir/" + name, 'wb') as f:
+            f.write(os.urandom(8192))
+    with open("temp_1.checkpoint", 'w') as f:
+        f.write("kind\tingest\npath\ttemp_dir\ndone\ttemp_dir/b\n")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_2.hdb"])
+    returned_answer = H.hashdb(["ingest", "-q", "-K", "temp_1.checkpoint",
+                                "-Z", "temp_2.hdb", "temp_dir"])
+    H.str_equals(returned_answer[0],
+                 "# Resuming after 2 files ingested through temp_dir/b")
+    sources = H.hashdb(["sources", "temp_2.hdb"])
+    H.int_equals(len([line for line in sources if line[:1] == "{"]), 1)
+    H.bool_equals("temp_dir/c" in sources[0], True)
+    H.bool_equals(os.path.exists("temp_1.checkpoint"), False)
+
+    # scan_media resumes at the checkpoint offset with its zero count
+    block = os.urandom(4096)
+    with open("temp_2_media", 'wb') as f:
+        f.write(block)
+        f.seek(32 * 2**20)
+        f.write(block)
+        f.truncate(40 * 2**20)
+    with open("temp_3_media", 'wb') as f:
+        f.write(block)
+    H.rm_tempdir("temp_3.hdb")
+    H.hashdb(["create", "temp_3.hdb"])
+    H.hashdb(["ingest", "-q", "temp_3.hdb", "temp_3_media"])
+    scan = H.hashdb(["scan_media", "-q", "-jc", "temp_3.hdb", "temp_2_media"])
+    expected = [line for line in scan if line[:1] != "#" and line != "" and
+                int(line.split("\t")[0]) >= 32 * 2**20]
+    H.int_equals(len(expected), 8)
+    with open("temp_1.checkpoint", 'w') as f:
+        f.write("kind\tscan_media\npath\ttemp_2_media\ndone\t33554432\n"
+                "zero_count\t100\n")
+    scan = H.hashdb(["scan_media", "-q", "-jc", "-K", "temp_1.checkpoint",
+                     "-Z", "temp_3.hdb", "temp_2_media"])
+    H.lines_equals([line for line in scan if line[:1] != "#" or
+                    line[:7] == "# Total"],
+                   expected + ["# Total zero-byte blocks found: 16476", ""])
+    H.bool_equals(os.path.exists("temp_1.checkpoint"), False)
+
+    # the checkpoint must be for the same run
+    with open("temp_1.checkpoint", 'w') as f:
+        f.write("kind\tingest\npath\ttemp_dir\ndone\ttemp_dir/b\n")
+    p = H.hashdb_start(["scan_media", "-K", "temp_1.checkpoint", "-Z",
+                        "temp_3.hdb", "temp_2_media"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+    shutil.rmtree("temp_dir", True)
+    H.rm_tempfile("temp_1.checkpoint")
+    H.rm_tempfile("temp_2_media")
+    H.rm_tempfile("temp_3_media")
+
+# test scanning media against several hash databases in one pass
+def test_scan_media_multiple():
+    block1 = os.urandom(512)
+    block2 = os.urandom(512)
+    with open("temp_2_media", 'wb') as f:
+        f.write(block1)
+    with open("temp_3_media", 'wb') as f:
+        f.write(block2)
+    with open("temp_4_media", 'wb') as f:
+        f.write(block1 + block2 + block1)
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempdir("temp_3.hdb")
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["create", "temp_3.hdb"])
+    H.hashdb(["ingest", "-q", "temp_2.hdb", "temp_2_media"])
+    H.hashdb(["ingest", "-q", "temp_2.hdb", "temp_3_media"])
+    H.hashdb(["ingest", "-q", "temp_3.hdb", "temp_3_media"])
+
+    # each match is tagged with each hash database it is in
+    scan = H.hashdb(["scan_media", "-q", "-jc", "temp_2.hdb", "temp_3.hdb",
+                     "temp_4_media"])
+    lines = [line.split("\t") for line in scan if line[:1] != "#" and
+             line != ""]
+    H.lines_equals(["%s %s" % (l[0], l[2]) for l in lines],
+                   ["0 temp_2.hdb", "512 temp_2.hdb", "512 temp_3.hdb",
+                    "1024 temp_2.hdb"])
+
+    # a single hash database is not tagged
+    scan = H.hashdb(["scan_media", "-q", "-jc", "temp_3.hdb", "temp_4_media"])
+    lines = [line.split("\t") for line in scan if line[:1] != "#" and
+             line != ""]
+    H.int_equals(len(lines), 1)
+    H.int_equals(len(lines[0]), 3)
+
+    # the hash databases must hash blocks the same way
+    H.rm_tempdir("temp_4.hdb")
+    H.hashdb(["create", "-b", "4096", "temp_4.hdb"])
+    p = H.hashdb_start(["scan_media", "temp_2.hdb", "temp_4.hdb",
+                        "temp_4_media"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+    H.rm_tempfile("temp_2_media")
+    H.rm_tempfile("temp_3_media")
+    H.rm_tempfile("temp_4_media")
+
+# test ingesting into databases of several block sizes in one pass
+def test_ingest_multiple():
+    shutil.rmtree("temp_dir", True)
+    os.mkdir("temp_dir")
+    with open("temp_dir/small", 'wb') as f:
+        f.write(os.urandom(20000))
+    with open("temp_dir/large", 'wb') as f:
+        f.write(os.urandom(3 * 2**20 + 1000))
+        f.write(b'\0' * 65536)
+    for name in ["temp_1", "temp_2", "temp_3", "temp_4"]:
+        H.rm_tempdir(name + ".hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "-b", "4096", "temp_2.hdb"])
+    H.hashdb(["create", "temp_3.hdb"])
+    H.hashdb(["create", "-b", "4096", "temp_4.hdb"])
+
+    # one pass matches separate ingests
+    H.hashdb(["ingest", "-q", "-s", "512,4096", "temp_1.hdb", "temp_2.hdb",
+              "temp_dir"])
+    H.hashdb(["ingest", "-q", "-s", "512", "temp_3.hdb", "temp_dir"])
+    H.hashdb(["ingest", "-q", "-s", "4096", "temp_4.hdb", "temp_dir"])
+    H.lines_equals(H.hashdb(["size", "temp_1.hdb"]),
+                   H.hashdb(["size", "temp_3.hdb"]))
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_4.hdb"]))
+    H.lines_equals(H.hashdb(["sources", "temp_2.hdb"]),
+                   H.hashdb(["sources", "temp_4.hdb"]))
+    shutil.rmtree("temp_dir", True)
+
+# test ingesting through staging databases written in parallel
+def test_ingest_staged():
+    shutil.rmtree("temp_dir", True)
+    os.mkdir("temp_dir")
+    same = os.urandom(30000)
+    with open("temp_dir/a", 'wb') as f:
+        f.write(same)
+    for name in ["b", "c", "d"]:
+        with open("temp_dir/" + name, 'wb') as f:
+            f.write(os.urandom(40000))
+    with open("temp_dir/c0", 'wb') as f:
+        f.write(b'\0' * 4096)
+    with open("temp_dir/e", 'wb') as f:
+        f.write(same)
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "temp_2.hdb"])
+
+    # staged writers match one writer, with files of the same content
+    # in different runs counted once and files without hashes kept
+    H.hashdb(["ingest", "-q", "-r", "repo", "temp_1.hdb", "temp_dir"])
+    H.hashdb(["ingest", "-q", "-r", "repo", "-N", "3", "temp_2.hdb",
+              "temp_dir"])
+    H.lines_equals(H.hashdb(["size", "temp_1.hdb"]),
+                   H.hashdb(["size", "temp_2.hdb"]))
+    H.lines_equals(H.hashdb(["sources", "temp_1.hdb"]),
+                   H.hashdb(["sources", "temp_2.hdb"]))
+    H.lines_equals(H.hashdb(["histogram", "temp_1.hdb"])[2:],
+                   H.hashdb(["histogram", "temp_2.hdb"])[2:])
+    H.bool_equals(os.path.exists("temp_2.hdb.staging.0"), False)
+
+    # one hashdb only
+    p = H.hashdb_start(["ingest", "-N", "2", "temp_1.hdb", "temp_2.hdb",
+                        "temp_dir"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+    shutil.rmtree("temp_dir", True)
+
+# test ingesting a tar archive and a single file from stdin
+def test_ingest_stream():
+    shutil.rmtree("temp_dir", True)
+    os.mkdir("temp_dir")
+    with open("temp_dir/small", 'wb') as f:
+        f.write(os.urandom(20000))
+    with open("temp_dir/large", 'wb') as f:
+        f.write(os.urandom(3 * 2**20 + 1000))
+    with open("temp_dir/empty", 'wb') as f:
+        pass
+    with tarfile.open("temp_1.tar", "w") as tar:
+        tar.add("temp_dir")
+    for name in ["temp_1", "temp_2", "temp_3", "temp_4"]:
+        H.rm_tempdir(name + ".hdb")
+        H.hashdb(["create", name + ".hdb"])
+
+    # the tar stream matches ingesting its directory
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_dir"])
+    with open("temp_1.tar", 'rb') as f:
+        p = H.hashdb_start(["ingest", "-q", "temp_2.hdb", "-"], f)
+        p.communicate()
+    H.int_equals(p.returncode, 0)
+    H.lines_equals(H.hashdb(["size", "temp_1.hdb"]),
+                   H.hashdb(["size", "temp_2.hdb"]))
+    H.lines_equals(H.hashdb(["histogram", "temp_1.hdb"])[2:],
+                   H.hashdb(["histogram", "temp_2.hdb"])[2:])
+
+    # any other stream is one file
+    H.hashdb(["ingest", "-q", "temp_3.hdb", "temp_dir/large"])
+    with open("temp_dir/large", 'rb') as f:
+        p = H.hashdb_start(["ingest", "-q", "temp_4.hdb", "-"], f)
+        p.communicate()
+    H.int_equals(p.returncode, 0)
+    H.lines_equals(H.hashdb(["histogram", "temp_3.hdb"])[2:],
+                   H.hashdb(["histogram", "temp_4.hdb"])[2:])
+    H.rm_tempfile("temp_1.tar")
+    shutil.rmtree("temp_dir", True)
+
+# test ingesting on two nodes and loading the partitions on their owners
+def test_sorted_runs():
+    shared = os.urandom(40 * 512)
+    for node in ["temp_dir1", "temp_dir2"]:
+        shutil.rmtree(node, True)
+        os.mkdir(node)
+        with open(node + "/shared", 'wb') as f:
+            f.write(shared)
+        with open(node + "/own", 'wb') as f:
+            f.write(os.urandom(60 * 512))
+    for name in ["temp_1", "temp_2", "temp_3", "temp_4", "temp_5"]:
+        H.rm_tempdir(name + ".hdb")
+        H.hashdb(["create", name + ".hdb"])
+
+    # each node ingests its files and exports two partitions
+    H.hashdb(["ingest_runs", "-q", "-r", "repo", "-S", "2", "temp_1.hdb",
+              "temp_dir1", "temp_runs1"])
+    H.hashdb(["ingest_runs", "-q", "-r", "repo", "-S", "2", "temp_2.hdb",
+              "temp_dir2", "temp_runs2"])
+
+    # each owner loads its partition from both nodes
+    H.hashdb(["load_runs", "temp_3.hdb", "temp_runs1.0", "temp_runs2.0"])
+    H.hashdb(["load_runs", "temp_4.hdb", "temp_runs1.1", "temp_runs2.1"])
+
+    # the owners together hold what one ingest of both nodes holds
+    H.hashdb(["ingest", "-q", "-r", "repo", "temp_5.hdb", "temp_dir1"])
+    H.hashdb(["ingest", "-q", "-r", "repo", "temp_5.hdb", "temp_dir2"])
+    with open("temp_1_media", 'wb') as f:
+        f.write(shared)
+        with open("temp_dir2/own", 'rb') as own:
+            f.write(own.read())
+    expected = H.hashdb(["scan_media", "-q", "-jc", "temp_5.hdb",
+                         "temp_1_media"])
+    scan = H.hashdb(["scan_media", "-q", "-jc", "temp_3.hdb", "temp_4.hdb",
+                     "temp_1_media"])
+    lines = sorted([line.split("\t")[:2] for line in scan
+                    if line[:1] != "#" and line != ""])
+    H.lines_equals(["%s %s" % (l[0], l[1]) for l in lines],
+                   sorted(["%s %s" % tuple(line.split("\t")[:2])
+                           for line in expected
+                           if line[:1] != "#" and line != ""]))
+    H.int_equals(len(lines), 100)
+
+    # a run of another partition is refused
+    p = H.hashdb_start(["load_runs", "temp_3.hdb", "temp_runs1.0",
+                        "temp_runs1.1"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+    for name in ["temp_runs1.0", "temp_runs1.1", "temp_runs2.0",
+                 "temp_runs2.1", "temp_1_media"]:
+        H.rm_tempfile(name)
+    shutil.rmtree("temp_dir1", True)
+    shutil.rmtree("temp_dir2", True)
+
+# test scanning the media images in a media list file
+def test_scan_media_list():
+    block1 = os.urandom(512)
+    block2 = os.urandom(512)
+    with open("temp_2_media", 'wb') as f:
+        f.write(block1 + block2)
+    with open("temp_3_media", 'wb') as f:
+        f.write(block2 + block2 + block1)
+    with open("temp_4_media", 'wb') as f:
+        f.write(block1)
+    with open("temp_list", 'w') as f:
+        f.write("# media images\ntemp_2_media\n\ntemp_3_media\n")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_2.hdb"])
+    H.hashdb(["ingest", "-q", "temp_2.hdb", "temp_4_media"])
+
+    # each match is tagged with the media image it is in
+    scan = H.hashdb(["scan_media_list", "-q", "-jc", "-Q", "1", "temp_2.hdb",
+                     "temp_list"])
+    lines = [line.split("\t") for line in scan if line[:1] != "#" and
+             line != ""]
+    H.lines_equals(sorted(["%s %s" % (l[0], l[1]) for l in lines]),
+                   ["temp_2_media 0", "temp_3_media 1024"])
+
+    # every media image must be there
+    with open("temp_list", 'w') as f:
+        f.write("temp_2_media\ntemp_5_media\n")
+    p = H.hashdb_start(["scan_media_list", "temp_2.hdb", "temp_list"])
+    p.communicate()
+    H.bool_equals(p.returncode != 0, True)
+    H.rm_tempfile("temp_2_media")
+    H.rm_tempfile("temp_3_media")
+    H.rm_tempfile("temp_4_media")
+    H.rm_tempfile("temp_list")
+
+# test shipping changes to a replica
+def test_export_apply_changes():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.rm_tempfile("temp_2.json")
+    H.rm_tempfile("temp_3.json")
+    H.hashdb(["create", "-C", "temp_1.hdb"])
+    H.make_tempfile("temp_1.tab", [
+          "0011223344556677	8899aabbccddeeff	1",
+          "1111111111111111	2222222222222222	9"])
+    H.hashdb(["import_tab", "temp_1.hdb", "temp_1.tab"])
+
+    # start the replica right after an export
+    H.hashdb(["export_changes", "temp_1.hdb", "temp_1.json"])
+    H.lines_equals(H.read_file("temp_1.json"), [
+'{"changes_from":0, "changes_to":680}',
+'{"op":"source_data","file_hash":"0011223344556677","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0}',
+'{"op":"source_name","file_hash":"0011223344556677","repository_name":"temp_1.tab","filename":"temp_1.tab"}',
+'{"op":"source_data","file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0}',
+'{"op":"source_name","file_hash":"1111111111111111","repository_name":"temp_1.tab","filename":"temp_1.tab"}',
+'{"op":"insert_hash","block_hash":"8899aabbccddeeff","k_entropy":0,"block_label":"","file_hash":"0011223344556677"}',
+'{"op":"insert_hash","block_hash":"2222222222222222","k_entropy":0,"block_label":"","file_hash":"1111111111111111"}'])
+    shutil.copytree("temp_1.hdb", "temp_2.hdb")
+
+    # change the primary, then ship the changes
+    H.make_tempfile("temp_2.json", [
+'{"block_hash":"ffffffffffffffff","k_entropy":3,"block_label":"bl3","source_sub_counts":["0011223344556677",2]}',
+'{"file_hash":"0011223344556677","filesize":6,"file_type":"fta","zero_count":7,"nonprobative_count":8,"name_pairs":["r1","f1"]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_2.json"])
+    H.hashdb(["remove_hash", "temp_1.hdb", "2222222222222222"])
+    H.hashdb(["export_changes", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["apply_changes", "temp_2.hdb", "temp_1.json"])
+
+    # applying again changes nothing
+    H.hashdb(["apply_changes", "temp_2.hdb", "temp_1.json"])
+
+    H.hashdb(["export", "temp_1.hdb", "temp_2.json"])
+    H.hashdb(["export", "temp_2.hdb", "temp_3.json"])
+    H.lines_equals(H.read_file("temp_3.json")[2:], [
+'{"block_hash":"8899aabbccddeeff","k_entropy":0,"block_label":"","source_sub_counts":["0011223344556677",1]}',
+'{"block_hash":"ffffffffffffffff","k_entropy":3,"block_label":"bl3","source_sub_counts":["0011223344556677",2]}',
+'{"file_hash":"0011223344556677","filesize":6,"file_type":"fta","zero_count":7,"nonprobative_count":8,"name_pairs":["r1","f1","temp_1.tab","temp_1.tab"]}',
+'{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["temp_1.tab","temp_1.tab"]}'])
+    H.lines_equals(H.read_file("temp_2.json")[2:], H.read_file("temp_3.json")[2:])
+
+# test deferring the hash store during an import then rebuilding it
+def test_defer_hash_store():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["create", "temp_2.hdb"])
+    H.make_tempfile("temp_1.tab", [
+          "# <file hash> <tab> <block hash> <tab> <index>",
+          "0011223344556677	8899aabbccddeeff	1",
+          "0000000000000000	8899aabbccddeeff	1",
+          "0011223344556677	ffffffffffffffff	3",
+          "1111111111111111	2222222222222222	9"])
+    H.hashdb(["import_tab", "temp_1.hdb", "temp_1.tab"])
+    H.hashdb(["import_tab", "-J", "temp_2.hdb", "temp_1.tab"])
+
+    # the hash store is rebuilt when the import closes
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_1.hdb"]))
+    H.bool_equals("hash_store_rebuild" in
+                  H.read_file("temp_2.hdb/settings.json")[0], False)
+
+    # an interrupted deferred import leaves the mark, and scans use the
+    # hash data store until the hash store is rebuilt
+    settings = H.read_file("temp_2.hdb/settings.json")[0].strip()
+    H.make_tempfile("temp_2.hdb/settings.json",
+                    [settings[:-1] + ', "hash_store_rebuild":true}'])
+    H.rm_tempdir("temp_3.hdb")
+    H.hashdb(["create", "temp_3.hdb"])
+    shutil.copy("temp_3.hdb/lmdb_hash_store/data.mdb",
+                "temp_2.hdb/lmdb_hash_store/data.mdb")
+    returned_answer = H.hashdb(["scan_hash", "-jc", "temp_2.hdb",
+                                "8899aabbccddeeff"])
+    H.lines_equals(returned_answer, ['{"block_hash":"8899aabbccddeeff","count":2}', ''])
+    H.hashdb(["rebuild_hash_store", "temp_2.hdb"])
+    H.lines_equals(H.hashdb(["size", "temp_2.hdb"]),
+                   H.hashdb(["size", "temp_1.hdb"]))
+    H.bool_equals("hash_store_rebuild" in
+                  H.read_file("temp_2.hdb/settings.json")[0], False)
+
 if __name__=="__main__":
     test_import_tab1()
     test_import_tab2()
@@ -210,6 +891,24 @@ if __name__=="__main__":
     test_import_tab4()
     test_import_json()
     test_export_json_hash_partition_range()
+    test_export_json_shards()
+    test_export_bin()
     test_ingest()
+    test_ingest_containers()
+    test_ingest_skip_unchanged()
+    test_ingest_direct_reads()
+    test_memory_budget()
+    test_ingest_sparse()
+    test_scan_filter()
+    test_ingest_skip_nonprobative()
+    test_checkpoint_resume()
+    test_scan_media_multiple()
+    test_ingest_multiple()
+    test_ingest_staged()
+    test_ingest_stream()
+    test_sorted_runs()
+    test_scan_media_list()
+    test_export_apply_changes()
+    test_defer_hash_store()
     print("Test Done.")
 
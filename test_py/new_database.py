@@ -19,11 +19,59 @@ def test_basic_settings():
     # validate settings parameters
     lines = h.read_file(settings1)
     h.lines_equals(lines, [
-'{"settings_version":4, "block_size":4}'
+'{"settings_version":4, "block_size":4, "block_hash_algorithm":"md5"}'
 
 ])
 
+# check block hash algorithm setting
+def test_block_hash_algorithm():
+    # remove existing DB
+    h.rm_tempdir("temp_1.hdb")
+
+    # create new DB
+    h.hashdb(["create", "-b4", "-a", "sha256", "temp_1.hdb"])
+
+    # validate settings parameters
+    lines = h.read_file(settings1)
+    h.lines_equals(lines, [
+'{"settings_version":4, "block_size":4, "block_hash_algorithm":"sha256"}'
+
+])
+
+# check store placement
+def test_store_paths():
+    # remove existing DB and store location
+    h.rm_tempdir("temp_1.hdb")
+    h.rm_tempdir("temp_fast")
+
+    # create new DB with its hash store placed
+    h.hashdb(["create", "-d", "lmdb_hash_store=temp_fast", "temp_1.hdb"])
+    lines = h.read_file(settings1)
+    h.lines_equals(lines, [
+'{"settings_version":4, "block_size":512, "block_hash_algorithm":"md5", "store_paths":{"lmdb_hash_store":"temp_fast"}}'
+])
+
+    # the hash store links to its placed directory
+    store = os.path.join("temp_1.hdb", "lmdb_hash_store")
+    h.bool_equals(os.path.islink(store), True)
+    placed = os.listdir("temp_fast")
+    h.int_equals(len(placed), 1)
+    h.str_equals(placed[0][:22], "temp_1.hdb.lmdb_hash_s")
+    h.bool_equals(os.path.samefile(store,
+                               os.path.join("temp_fast", placed[0])), True)
+    h.bool_equals(os.path.islink(os.path.join("temp_1.hdb",
+                                              "lmdb_hash_data_store")), False)
+
+    # an unknown store may not be placed
+    h.rm_tempdir("temp_2.hdb")
+    h.bool_equals(h.hashdb_start(["create", "-d", "lmdb_bad_store=temp_fast",
+                                  "temp_2.hdb"]).wait() != 0, True)
+    h.bool_equals(os.path.exists("temp_2.hdb"), False)
+    h.rm_tempdir("temp_fast")
+
 if __name__=="__main__":
     test_basic_settings()
+    test_block_hash_algorithm()
+    test_store_paths()
     print("Test Done.")
 
@@ -2,6 +2,8 @@
 #
 # Test performance analysis interfaces.
 
+import os
+import json
 import helpers as H
 
 db1 = "temp_1.hdb"
@@ -54,10 +56,93 @@ def test_same():
 '# Processing 100 of 100 completed.',
 ''])
 
+def test_benchmark():
+    H.rm_tempdir("temp_1.hdb")
+    lines = H.hashdb(["benchmark", "-j", "c", "-n", "2", "-P", "1",
+                      "temp_1.hdb", "1000"])
+    records = [json.loads(line) for line in lines if line[:1] == "{"]
+    H.int_equals(len(records), 4)
+    H.int_equals(records[0]["ingest"]["hashes"], 1000)
+    H.bool_equals(records[0]["ingest"]["records"] >= 1000, True)
+    H.bool_equals(records[1]["size"]["bytes"] > 0, True)
+    H.int_equals(records[2]["scan"]["threads"], 1)
+    H.int_equals(records[2]["scan"]["matches"], 1000)
+    H.int_equals(records[3]["scan"]["threads"], 2)
+
+    # calibrate source multiplicity from the histogram of the database
+    H.make_tempfile("temp_1.txt", H.hashdb(["histogram", "temp_1.hdb"]))
+    H.rm_tempdir("temp_2.hdb")
+    lines = H.hashdb(["benchmark", "-D", "temp_1.txt", "-n", "1", "-P", "0",
+                      "temp_2.hdb", "1000"])
+    records = [json.loads(line) for line in lines if line[:1] == "{"]
+    H.int_equals(len(records), 3)
+    H.int_equals(records[2]["scan"]["matches"], 0)
+
+def test_benchmark_scan_stream():
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["add_random", "temp_1.hdb", "100"])
+    lines = H.hashdb(["benchmark_scan_stream", "-j", "c", "-n", "2", "-P",
+                      "1", "temp_1.hdb", "3", "10", "20"])
+    records = [json.loads(line) for line in lines if line[:1] == "{"]
+    H.int_equals(len(records), 1)
+    record = records[0]["scan_stream"]
+    H.int_equals(record["producers"], 3)
+    H.int_equals(record["scan_threads"], 2)
+    H.int_equals(record["batches"], 60)
+    H.int_equals(record["batches_returned"], 60)
+    H.int_equals(len(record["producer_cpu_utilization"]), 3)
+    H.bool_equals(record["queue_wait"]["count"] >= 1, True)
+    H.bool_equals(record["latency_p99_us"] >= record["latency_p50_us"], True)
+
+    # absent hashes are not returned
+    lines = H.hashdb(["benchmark_scan_stream", "-P", "0", "temp_1.hdb", "2",
+                      "10", "5"])
+    record = json.loads(lines[-2])["scan_stream"]
+    H.int_equals(record["batches_returned"], 0)
+
+def test_benchmark_read():
+    # more than one job at each job size, not a multiple of the page size
+    with open("temp_1_media", 'wb') as f:
+        f.write(os.urandom(17 * 2**20 + 1000))
+    lines = H.hashdb(["benchmark_read", "-n", "2", "-Q", "2", "temp_1_media"])
+    records = [json.loads(line)["read"] for line in lines if line[:1] == "{"]
+    H.int_equals(len(records), 18)
+    H.str_equals(records[0]["reader"], "mapped")
+    H.str_equals(records[17]["reader"], "direct")
+    H.int_equals(records[0]["queue_depth"], 1)
+    H.int_equals(records[1]["queue_depth"], 2)
+    H.int_equals(records[17]["job_size"], 16777216)
+    for record in records:
+        H.int_equals(record["bytes"], 17 * 2**20 + 1000)
+        H.int_equals(record["threads"], 2)
+    H.rm_tempfile("temp_1_media")
+
+# read the stage statistics from the last stage_stats line of a log
+def read_stage_stats(filename):
+    lines = [line for line in H.read_file(filename) if "stage_stats: " in line]
+    return json.loads(lines[-1].split("stage_stats: ", 1)[1])
+
+def test_stage_stats():
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["add_random", "temp_1.hdb", "100"])
+    stats = read_stage_stats("temp_1.hdb/log.txt")
+    H.bool_equals("insert_wait" in stats["stages"], True)
+    H.bool_equals(stats["stages"]["commit"]["count"] > 0, True)
 
+    H.hashdb(["scan_random", "temp_1.hdb", "100"])
+    stats = read_stage_stats("temp_1.hdb/timestamp.json")
+    lookups = stats["lookups"]
+    H.int_equals(lookups["hash_store_hits"] + lookups["hash_store_misses"],
+                 100)
 
 if __name__=="__main__":
     test_random()
     test_same()
+    test_benchmark()
+    test_benchmark_scan_stream()
+    test_benchmark_read()
+    test_stage_stats()
     print("Test Done.")
 
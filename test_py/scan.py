@@ -2,7 +2,16 @@
 #
 # Test the Scan command group
 
+import os
 import helpers as H
+import socket
+import struct
+import binascii
+import time
+import json
+import random
+import hashlib
+import shutil
 
 json_data = ["# command: ","# hashdb-Version: ", \
 '{"file_hash":"0011223344556677","filesize":1,"file_type":"fta","zero_count":20,"nonprobative_count":2,"name_pairs":["r1","f1"]}',
@@ -72,8 +81,523 @@ def test_scan_hash():
 'Hash not found for \'0000000000000000\'', \
 ''])
 
+def test_max_sources():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+
+    # first page of a hash with two sources
+    returned_answer = H.hashdb(["scan_hash", "-T1", "temp_1.hdb",
+                                "8899aabbccddeeff"])
+    H.lines_equals(returned_answer, [
+'{"block_hash":"8899aabbccddeeff","k_entropy":8,"block_label":"bl2","count":3,"source_list_id":2343118327,"sources":[{"file_hash":"0011223344556677","filesize":1,"file_type":"fta","zero_count":20,"nonprobative_count":2,"name_pairs":["r1","f1"]}],"source_sub_counts":["0011223344556677",2],"source_count":2,"next_source_offset":1}',
+''])
+
+    # last page
+    returned_answer = H.hashdb(["scan_hash", "-T1", "-G1", "temp_1.hdb",
+                                "8899aabbccddeeff"])
+    H.lines_equals(returned_answer, [
+'{"block_hash":"8899aabbccddeeff","k_entropy":8,"block_label":"bl2","count":3,"source_list_id":1696784233,"sources":[{"file_hash":"0000000000000000","filesize":3,"file_type":"ftb","zero_count":40,"nonprobative_count":4,"name_pairs":["r2","f2"]}],"source_sub_counts":["0000000000000000",1],"source_count":2}',
+''])
+
+    # a cap at or above the source count changes nothing
+    H.lines_equals(H.hashdb(["scan_hash", "-T2", "temp_1.hdb",
+                             "8899aabbccddeeff"]),
+                   H.hashdb(["scan_hash", "temp_1.hdb", "8899aabbccddeeff"]))
+
+def test_pin_common():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    expanded = H.hashdb(["scan_hash", "temp_1.hdb", "8899aabbccddeeff"])
+
+    # only the hash with three sources is common
+    returned_answer = H.hashdb(["pin_common", "temp_1.hdb", "3"])
+    H.str_equals(returned_answer[2], "# pinned 1 common blocks")
+
+    # pinned hashes scan the same, or compactly
+    H.lines_equals(H.hashdb(["scan_hash", "temp_1.hdb", "8899aabbccddeeff"]),
+                   expanded)
+    returned_answer = H.hashdb(["scan_hash", "-X", "temp_1.hdb",
+                                "8899aabbccddeeff"])
+    H.lines_equals(returned_answer, [
+'{"block_hash":"8899aabbccddeeff","count":3,"common_block":true}',
+''])
+    returned_answer = H.hashdb(["scan_hash", "-X", "temp_1.hdb",
+                                "ffffffffffffffff"])
+    H.str_equals(returned_answer[0][:40],
+                 '{"block_hash":"ffffffffffffffff","k_entr')
+
+    # the pinned set is not used once the hashdb changes
+    H.make_tempfile("temp_1.json", [json_data[0], json_data[1],
+'{"block_hash":"8899aabbccddeeff","k_entropy":8,"block_label":"bl2","source_sub_counts":["1111111111111111",1]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    returned_answer = H.hashdb(["scan_hash", "-X", "temp_1.hdb",
+                                "8899aabbccddeeff"])
+    H.str_equals(returned_answer[0][:40],
+                 '{"block_hash":"8899aabbccddeeff","k_entr')
+
+# a server request of (hex hash, label) records
+def server_request(request_id, records, hash_size=8):
+    payload = b""
+    for hex_hash, label in records:
+        payload += binascii.unhexlify(hex_hash)
+        payload += struct.pack("<H", len(label)) + label
+    return struct.pack("<IIQ", len(payload), hash_size, request_id) + payload
+
+# read a server response as (request ID, status, [(hex hash, label, json)])
+def server_response(client):
+    def read(size):
+        data = b""
+        while len(data) < size:
+            more = client.recv(size - len(data))
+            if not more:
+                raise ValueError("server closed the connection")
+            data += more
+        return data
+    size, status, request_id = struct.unpack("<IIQ", read(16))
+    payload = read(size)
+    matches = []
+    offset = 0
+    while offset < size:
+        block_hash = binascii.hexlify(payload[offset:offset+8]).decode()
+        label_size = struct.unpack("<H", payload[offset+8:offset+10])[0]
+        label = payload[offset+10:offset+10+label_size]
+        offset += 10 + label_size
+        json_size = struct.unpack("<I", payload[offset:offset+4])[0]
+        json = payload[offset+4:offset+4+json_size].decode()
+        offset += 4 + json_size
+        matches.append((block_hash, label, json))
+    return (request_id, status, matches)
+
+def test_server():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+
+    # start the server on a port chosen by the system
+    server = H.hashdb_start(["server", "-j", "c", "-n", "2", "temp_1.hdb", "0"])
+    port = 0
+    for line in server.stdout:
+        line = line.decode()
+        if line.startswith("# hashdb server listening on "):
+            port = int(line.strip().split(":")[-1])
+            break
+    H.bool_equals(port > 0, True)
+
+    # pipeline three requests, one malformed, before reading responses
+    client = socket.create_connection(("127.0.0.1", port))
+    client.sendall(server_request(7, [("2222222222222222", b"a"),
+                                      ("0000000000000000", b"")]) +
+                   server_request(9, [("ffffffffffffffff", b"zz")]) +
+                   struct.pack("<IIQ", 5, 8, 11) + b"short")
+    responses = {}
+    for i in range(3):
+        request_id, status, matches = server_response(client)
+        responses[request_id] = (status, matches)
+    client.close()
+
+    H.int_equals(responses[7][0], 0)
+    H.int_equals(len(responses[7][1]), 1)
+    H.str_equals(responses[7][1][0][0], "2222222222222222")
+    H.bool_equals(responses[7][1][0][1] == b"a", True)
+    H.str_equals(responses[7][1][0][2],
+                 '{"block_hash":"2222222222222222","count":1}')
+    H.int_equals(responses[9][0], 0)
+    H.bool_equals(responses[9][1][0][1] == b"zz", True)
+    H.int_equals(responses[11][0], 1)
+    H.int_equals(len(responses[11][1]), 0)
+
+    server.terminate()
+    H.str_equals(server.stdout.read().decode(), "# hashdb server stopped\n")
+    H.int_equals(server.wait(), 0)
+
+def test_server_while_importing():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.rm_tempfile("temp_2.json")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+
+    # reader slots may be set in the settings and are kept by import
+    settings = os.path.join("temp_1.hdb", "settings.json")
+    line = H.read_file(settings)[0].strip()
+    with open(settings, "w") as f:
+        f.write(line[:-1] + ', "max_readers":200}\n')
+
+    # many new hashes of an existing source
+    new_data = ["# command: ","# hashdb-Version: "]
+    for i in range(20000):
+        new_data.append('{"block_hash":"a%015x","k_entropy":1,"block_label":"","source_sub_counts":["1111111111111111",1]}' % i)
+    H.make_tempfile("temp_2.json", new_data)
+
+    server = H.hashdb_start(["server", "-j", "c", "-n", "2", "-L", "50",
+                             "temp_1.hdb", "0"])
+    port = 0
+    for line in server.stdout:
+        line = line.decode()
+        if line.startswith("# hashdb server listening on "):
+            port = int(line.strip().split(":")[-1])
+            break
+    H.bool_equals(port > 0, True)
+    client = socket.create_connection(("127.0.0.1", port))
+
+    # existing hashes are found throughout the import
+    importer = H.hashdb_start(["import", "temp_1.hdb", "temp_2.json"])
+    request_id = 0
+    while True:
+        done = importer.poll() is not None
+        request_id += 1
+        client.sendall(server_request(request_id,
+                                      [("2222222222222222", b"")]))
+        response = server_response(client)
+        H.int_equals(response[0], request_id)
+        H.int_equals(len(response[2]), 1)
+        if done:
+            break
+    H.int_equals(importer.wait(), 0)
+    H.bool_equals('"max_readers":200' in H.read_file(settings)[0], True)
+
+    # and new hashes are found once snapshots are refreshed
+    time.sleep(0.2)
+    client.sendall(server_request(request_id + 1,
+                                  [("a000000000000000", b""),
+                                   ("a000000000004e1f", b"")]))
+    response = server_response(client)
+    H.int_equals(len(response[2]), 2)
+    H.str_equals(response[2][1][2],
+                 '{"block_hash":"a000000000004e1f","count":1}')
+    client.close()
+
+    server.terminate()
+    H.str_equals(server.stdout.read().decode(), "# hashdb server stopped\n")
+    H.int_equals(server.wait(), 0)
+
+def test_freeze():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempdir("temp_3.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.rm_tempfile("temp_2.json")
+    H.hashdb(["create", "-k1", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["freeze", "temp_1.hdb", "temp_2.hdb"])
+
+    # the frozen hashdb scans like the hashdb it was frozen from
+    for block_hash in ["2222222222222222", "8899aabbccddeeff",
+                       "ffffffffffffffff", "0000000000000000",
+                       "8899aabbccddeefe"]:
+        H.lines_equals(H.hashdb(["scan_hash", "temp_2.hdb", block_hash]),
+                       H.hashdb(["scan_hash", "temp_1.hdb", block_hash]))
+
+    # and exports the same hashes and sources
+    H.hashdb(["export", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
+    lines1 = [line for line in H.read_file("temp_1.json") if line[:1] != "#"]
+    lines2 = [line for line in H.read_file("temp_2.json") if line[:1] != "#"]
+    H.lines_equals(lines2, lines1)
+
+    # it cannot be frozen again
+    H.hashdb_start(["freeze", "temp_2.hdb", "temp_3.hdb"]).wait()
+    H.bool_equals(os.path.exists("temp_3.hdb"), False)
+
+def test_warm():
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.rm_tempfile("temp_1.json")
+    H.hashdb(["create", "-k1", "temp_1.hdb"])
+    H.make_tempfile("temp_1.json", json_data)
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    H.hashdb(["freeze", "temp_1.hdb", "temp_2.hdb"])
+
+    # warm reads the stores of both formats
+    for hashdb_dir in ["temp_1.hdb", "temp_2.hdb"]:
+        lines = H.hashdb(["warm", "-n2", hashdb_dir])
+        read_lines = [line for line in lines if line[:12] == "# warm read "]
+        H.int_equals(len(read_lines), 1)
+        H.bool_equals(int(read_lines[0].split()[3]) > 0, True)
+
+    # and scans are unchanged after warming
+    H.lines_equals(H.hashdb(["scan_hash", "temp_2.hdb", "8899aabbccddeeff"]),
+                   H.hashdb(["scan_hash", "temp_1.hdb", "8899aabbccddeeff"]))
+
+def test_export_filter():
+    # media whose first half is in the hashdb
+    known = os.urandom(2**18)
+    with open("temp_1_known", 'wb') as f:
+        f.write(known)
+    with open("temp_1_media", 'wb') as f:
+        f.write(known + os.urandom(2**18))
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempfile("temp_1.filter")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_1_known"])
+    H.hashdb(["export_filter", "temp_1.hdb", "temp_1.filter"])
+
+    # every match is a candidate, printed as its offset and block hash,
+    # and about 1% of the other blocks are
+    matches = [line for line in H.hashdb(["scan_media", "-q", "temp_1.hdb",
+                                          "temp_1_media"])
+               if line[:1] not in ("#", "")]
+    candidates = [line for line in H.hashdb(["scan_media", "-q",
+                                        "temp_1.filter", "temp_1_media"])
+                  if line[:1] not in ("#", "")]
+    H.bool_equals(len(matches) > 0, True)
+    for match in matches:
+        H.bool_equals("\t".join(match.split("\t")[:2]) in candidates, True)
+    H.bool_equals(len(candidates) - len(matches) < len(matches) // 10, True)
+
+    # candidates are confirmed against the hashdb with scan_list
+    H.make_tempfile("temp_1.txt", candidates)
+    confirmed = [line for line in H.hashdb(["scan_list", "temp_1.hdb",
+                                            "temp_1.txt"])
+                 if line[:1] not in ("#", "")]
+    H.int_equals(len(confirmed), len(matches))
+
+    # a filter is scanned against alone
+    H.bool_equals(H.hashdb_start(["scan_media", "-q", "temp_1.filter",
+                  "temp_1.hdb", "temp_1_media"]).wait() != 0, True)
+    H.rm_tempfile("temp_1_known")
+    H.rm_tempfile("temp_1_media")
+    H.rm_tempfile("temp_1.filter")
+
+def test_similar():
+    # a file, a file sharing 7/8 of its blocks, and an unrelated file
+    rng = random.Random(1)
+    blocks = [bytes(rng.getrandbits(8) for _ in range(512))
+              for _ in range(640)]
+    H.rm_tempdir("temp_1_dir")
+    os.mkdir("temp_1_dir")
+    contents = [b"".join(blocks[:512]), b"".join(blocks[:448] + blocks[512:576]),
+                b"".join(blocks[576:])]
+    for i, content in enumerate(contents):
+        with open("temp_1_dir/f%d" % i, 'wb') as f:
+            f.write(content)
+    file_hashes = [hashlib.md5(content).hexdigest() for content in contents]
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "-Y", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_1_dir"])
+
+    # a file is most similar to itself then to the file sharing blocks
+    similar = json.loads(H.hashdb(["similar", "temp_1.hdb",
+                                   "temp_1_dir/f0"])[0])
+    H.int_equals(len(similar), 2)
+    H.str_equals(similar[0]["file_hash"], file_hashes[0])
+    H.bool_equals(similar[0]["similarity"], 1.0)
+    H.str_equals(similar[1]["file_hash"], file_hashes[1])
+    if abs(similar[1]["similarity"] - 448.0 / 576) > 0.2:
+        raise ValueError("similarity %f is not near 0.78" %
+                         similar[1]["similarity"])
+
+    # a source in the hashdb is not similar to itself
+    similar = json.loads(H.hashdb(["similar", "temp_1.hdb",
+                                   file_hashes[1]])[0])
+    H.int_equals(len(similar), 1)
+    H.str_equals(similar[0]["file_hash"], file_hashes[0])
+    H.lines_equals(H.hashdb(["similar", "temp_1.hdb", file_hashes[2]]),
+                   ["[]", ""])
+
+    # -T limits the sources
+    similar = json.loads(H.hashdb(["similar", "-T1", "temp_1.hdb",
+                                   "temp_1_dir/f0"])[0])
+    H.int_equals(len(similar), 1)
+
+    # removed sources are not found
+    H.hashdb(["remove_source", "temp_1.hdb", file_hashes[1]])
+    similar = json.loads(H.hashdb(["similar", "temp_1.hdb",
+                                   "temp_1_dir/f0"])[0])
+    H.int_equals(len(similar), 1)
+
+    # a hashdb needs a similarity index
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "temp_2.hdb"])
+    H.bool_equals(H.hashdb_start(["similar", "temp_2.hdb",
+                                  "temp_1_dir/f0"]).wait() != 0, True)
+    shutil.rmtree("temp_1_dir")
+
+def test_scan_summary():
+    # media holding one file, other data, then half of another file
+    rng = random.Random(2)
+    blocks = [bytes(rng.getrandbits(8) for _ in range(512))
+              for _ in range(160)]
+    H.rm_tempdir("temp_1_dir")
+    os.mkdir("temp_1_dir")
+    contents = [b"".join(blocks[:64]), b"".join(blocks[64:128])]
+    for i, content in enumerate(contents):
+        with open("temp_1_dir/f%d" % i, 'wb') as f:
+            f.write(content)
+    file_hashes = [hashlib.md5(content).hexdigest() for content in contents]
+    with open("temp_1_media", 'wb') as f:
+        f.write(contents[0] + b"".join(blocks[128:160]) + contents[1][:16384])
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_1_dir"])
+
+    # one line per source, most matching blocks first
+    lines = [line for line in H.hashdb(["scan_media", "-q", "-j", "s",
+                                        "temp_1.hdb", "temp_1_media"])
+             if line[:1] not in ("#", "")]
+    H.int_equals(len(lines), 2)
+    summary = json.loads(lines[0])
+    H.str_equals(summary["file_hash"], file_hashes[0])
+    H.int_equals(summary["filesize"], 32768)
+    H.int_equals(summary["blocks"], 64)
+    H.int_equals(summary["first_offset"], 0)
+    H.int_equals(summary["last_offset"], 63 * 512)
+    summary = json.loads(lines[1])
+    H.str_equals(summary["file_hash"], file_hashes[1])
+    H.int_equals(summary["blocks"], 32)
+    H.int_equals(summary["first_offset"], 96 * 512)
+    H.int_equals(summary["last_offset"], 127 * 512)
+
+    # scan_media_list tags each line with its media image
+    H.make_tempfile("temp_1.txt", ["temp_1_media"])
+    lines = [line for line in H.hashdb(["scan_media_list", "-q", "-j", "s",
+                                        "temp_1.hdb", "temp_1.txt"])
+             if line[:1] not in ("#", "")]
+    H.int_equals(len(lines), 2)
+    H.str_equals(lines[0].split("\t")[0], "temp_1_media")
+
+    # only media scans are summarized
+    H.bool_equals(H.hashdb_start(["scan_hash", "-j", "s", "temp_1.hdb",
+                                  "00"]).wait() != 0, True)
+    shutil.rmtree("temp_1_dir")
+    H.rm_tempfile("temp_1_media")
+    H.rm_tempfile("temp_1.txt")
+
+def test_chunks():
+    # a file and media holding it shifted by a few bytes
+    rng = random.Random(3)
+    content = rng.getrandbits(8 * 262144).to_bytes(262144, "little")
+    H.rm_tempdir("temp_1_dir")
+    os.mkdir("temp_1_dir")
+    with open("temp_1_dir/f0", 'wb') as f:
+        f.write(content)
+    with open("temp_1_media", 'wb') as f:
+        f.write(b"shift" + content)
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "-b", "256:1K:8K", "temp_1.hdb"])
+    settings = json.loads(H.read_file("temp_1.hdb/settings.json")[0])
+    H.int_equals(settings["min_chunk_size"], 256)
+    H.int_equals(settings["block_size"], 1024)
+    H.int_equals(settings["max_chunk_size"], 8192)
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_1_dir"])
+    chunks = json.loads(H.hashdb(["size", "temp_1.hdb"])[0])["hash_store"]
+
+    # every chunk but the first is found after the shift
+    lines = [line for line in H.hashdb(["scan_media", "temp_1.hdb",
+                                        "temp_1_media"])
+             if line[:1] not in ("#", "")]
+    H.int_equals(len(lines), chunks - 1)
+
+    # chunk sizes must straddle the average and filters do not chunk
+    H.rm_tempdir("temp_2.hdb")
+    H.bool_equals(H.hashdb_start(["create", "-b", "1K:1K:8K",
+                                  "temp_2.hdb"]).wait() != 0, True)
+    H.bool_equals(H.hashdb_start(["export_filter", "temp_1.hdb",
+                                  "temp_1.filter"]).wait() != 0, True)
+    shutil.rmtree("temp_1_dir")
+    H.rm_tempfile("temp_1_media")
+
+def test_quiet():
+    H.rm_tempdir("temp_1_dir")
+    os.mkdir("temp_1_dir")
+    with open("temp_1_dir/f0", 'wb') as f:
+        f.write(random.Random(4).getrandbits(8 * 4096).to_bytes(4096,
+                                                                 "little"))
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+
+    # jobs print status lines unless quiet
+    def status_lines(lines, status):
+        return len([line for line in lines if line.startswith(status)])
+    H.int_equals(status_lines(H.hashdb(["ingest", "temp_1.hdb",
+                                        "temp_1_dir"]), "# Ingesting"), 1)
+    H.int_equals(status_lines(H.hashdb(["scan_media", "temp_1.hdb",
+                                        "temp_1_dir/f0"]), "# Scanning"), 1)
+    lines = H.hashdb(["scan_media", "-q", "temp_1.hdb", "temp_1_dir/f0"])
+    H.int_equals(status_lines(lines, "# Scanning"), 0)
+
+    # quiet does not hold back matches
+    H.int_equals(len([line for line in lines if line[:1] not in ("#", "")]),
+                 8)
+    shutil.rmtree("temp_1_dir")
+
+# the sampled regions of media of a size, as picked by scan_media -F
+def sample_regions(filesize, fraction, region_size=2**20, step_size=512):
+    mask = 2**64 - 1
+    state = filesize
+    stratum_size = max(int(region_size / fraction) // step_size * step_size,
+                       region_size)
+    regions = []
+    for stratum in range(0, filesize, stratum_size):
+        span = min(filesize - stratum, stratum_size)
+        begin = stratum
+        if span > region_size:
+            # splitmix64
+            state = (state + 0x9e3779b97f4a7c15) & mask
+            z = state
+            z = ((z ^ (z >> 30)) * 0xbf58476d1ce4e5b9) & mask
+            z = ((z ^ (z >> 27)) * 0x94d049bb133111eb) & mask
+            z = z ^ (z >> 31)
+            begin += z % ((span - region_size) // step_size + 1) * step_size
+        regions.append((begin, min(begin + region_size, stratum + span)))
+    return regions
+
+def test_sample():
+    # media whose every block is in the database
+    H.rm_tempfile("temp_1_media")
+    with open("temp_1_media", 'wb') as f:
+        f.write(random.Random(5).getrandbits(8 * 2**22).to_bytes(2**22,
+                                                                  "little"))
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["ingest", "-q", "temp_1.hdb", "temp_1_media"])
+
+    def match_offsets(lines):
+        return sorted(int(line.split("\t")[0]) for line in lines
+                      if line[:1] not in ("#", ""))
+
+    # matches are reported at every block of the sampled regions only
+    regions = sample_regions(2**22, 0.5)
+    H.int_equals(len(regions), 2)
+    lines = H.hashdb(["scan_media", "-q", "-F", "0.5", "temp_1.hdb",
+                      "temp_1_media"])
+    H.bool_equals("# Sampled 2 regions, 2097152 of 4194304 bytes" in lines,
+                  True)
+    expected = [offset for begin, end in regions
+                for offset in range(begin, end, 512)]
+    H.int_equals(len(expected), 4096)
+    H.bool_equals(match_offsets(lines) == expected, True)
+
+    # scanning around hits reports the rest of each stratum
+    lines = H.hashdb(["scan_media", "-q", "-F", "0.5", "-A", "temp_1.hdb",
+                      "temp_1_media"])
+    H.bool_equals(match_offsets(lines) == list(range(0, 2**22, 512)), True)
+    H.rm_tempfile("temp_1_media")
+
 if __name__=="__main__":
     test_scan_list()
     test_scan_hash()
+    test_max_sources()
+    test_pin_common()
+    test_server()
+    test_server_while_importing()
+    test_freeze()
+    test_warm()
+    test_export_filter()
+    test_similar()
+    test_scan_summary()
+    test_chunks()
+    test_quiet()
+    test_sample()
     print("Test Done.")
 
@@ -2,6 +2,8 @@
 #
 # Test the Scan command group
 
+import os
+import json
 import helpers as H
 
 def test_size():
@@ -33,6 +35,40 @@ def test_size():
     returned_answer = H.hashdb(["size", "temp_1.hdb"])
     H.lines_equals(expected_answer, returned_answer)
 
+def test_estimate():
+    H.make_hashdb("temp_1.hdb", [
+'{"block_hash":"1111111111111111", "source_sub_counts":["0000000000000000", 1]}',
+'{"block_hash":"2222222222222222", "source_sub_counts":["0000000000000000", 1]}',
+'{"block_hash":"3333333333333333", "source_sub_counts":["0000000000000000", 2]}'])
+    H.make_hashdb("temp_2.hdb", [
+'{"block_hash":"2222222222222222", "source_sub_counts":["0011223344556677", 1]}',
+'{"block_hash":"3333333333333333", "source_sub_counts":["0011223344556677", 1]}',
+'{"block_hash":"4444444444444444", "source_sub_counts":["0011223344556677", 1]}'])
+
+    # one hashdb
+    returned_answer = H.hashdb(["estimate", "temp_1.hdb"])
+    H.lines_equals(['{"hashes":3}', ''], returned_answer)
+
+    # two hashdbs
+    expected_answer = [
+'{"hashes_1":3,"hashes_2":3,"union":4,"intersect":2,"subtract":1}', '']
+    returned_answer = H.hashdb(["estimate", "temp_1.hdb", "temp_2.hdb"])
+    H.lines_equals(expected_answer, returned_answer)
+
+    # a hashdb without a sketch is read to make one
+    os.remove("temp_2.hdb/hll_sketch")
+    returned_answer = H.hashdb(["estimate", "temp_1.hdb", "temp_2.hdb"])
+    H.lines_equals(expected_answer, returned_answer)
+    H.bool_equals(os.path.exists("temp_2.hdb/hll_sketch"), True)
+
+    # a larger hashdb is estimated within a few percent
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "temp_1.hdb"])
+    H.hashdb(["add_random", "temp_1.hdb", "20000"])
+    count = json.loads(H.hashdb(["estimate", "temp_1.hdb"])[0])["hashes"]
+    if abs(count - 20000) > 1000:
+        raise ValueError("estimate %d is not near 20000" % count)
+
 def test_sources():
 
     # source stores, no name_pairs
@@ -66,7 +102,41 @@ def test_histogram():
 '{"total_hashes": 3, "total_distinct_hashes": 1}',
 '{"duplicates":1, "distinct_hashes":1, "total":1}',
 '{"duplicates":2, "distinct_hashes":1, "total":2}',
+''])
+
+    # recompute by reading every hash
+    returned_answer = H.hashdb(["histogram", "-R", "temp_1.hdb"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'{"total_hashes": 3, "total_distinct_hashes": 1}',
+'{"duplicates":1, "distinct_hashes":1, "total":1}',
+'{"duplicates":2, "distinct_hashes":1, "total":2}',
 '# Processing 2 of 2 completed.',
+''])
+
+    # the maintained histogram follows changes
+    H.hashdb(["remove_hash", "temp_1.hdb", "1111111111111111"])
+    H.make_tempfile("temp_1.json", [
+'{"block_hash":"2222222222222222", "source_sub_counts":["1111111111111111", 1]}',
+'{"block_hash":"3333333333333333", "source_sub_counts":["1111111111111111", 3]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_1.json"])
+    returned_answer = H.hashdb(["histogram", "temp_1.hdb"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'{"total_hashes": 6, "total_distinct_hashes": 0}',
+'{"duplicates":3, "distinct_hashes":2, "total":6}',
+''])
+
+    # a missing histogram is calculated
+    H.rm_tempfile("temp_1.hdb/hash_stats")
+    returned_answer = H.hashdb(["histogram", "temp_1.hdb"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'{"total_hashes": 6, "total_distinct_hashes": 0}',
+'{"duplicates":3, "distinct_hashes":2, "total":6}',
 ''])
 
 def test_duplicates():
@@ -84,7 +154,6 @@ def test_duplicates():
 '# command: ',
 '# hashdb-Version: ',
 'No hashes were found with this count.',
-'# Processing 2 of 2 completed.',
 ''])
 
     # one
@@ -111,9 +180,64 @@ def test_duplicates():
 '# command: ',
 '# hashdb-Version: ',
 'No hashes were found with this count.',
-'# Processing 2 of 2 completed.',
 ''])
 
+def test_duplicates_count_index():
+    # counts 1, 2, and 3 in a hashdb that keeps a count index
+    H.rm_tempdir("temp_1.hdb")
+    H.rm_tempdir("temp_2.hdb")
+    H.hashdb(["create", "-U", "temp_1.hdb"])
+    H.make_tempfile("temp_0.json", [
+'{"block_hash":"1111111111111111", "source_sub_counts":["0000000000000000", 1]}',
+'{"block_hash":"2222222222222222", "source_sub_counts":["0000000000000000", 2]}',
+'{"block_hash":"3333333333333333", "source_sub_counts":["0000000000000000", 1, "1111111111111111", 2]}',
+'{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["r1","f1"]}',
+'{"file_hash":"1111111111111111","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["r2","f2"]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_0.json"])
+
+    # counts of at least 2 are read from the index without a walk
+    returned_answer = H.hashdb(["duplicates", "-j", "c", "temp_1.hdb", "3"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'3333333333333333	{"block_hash":"3333333333333333","count":3}',
+''])
+
+    # the index follows count changes
+    H.hashdb(["remove_source", "temp_1.hdb", "1111111111111111"])
+    returned_answer = H.hashdb(["duplicates", "-j", "c", "temp_1.hdb", "3"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'No hashes were found with this count.',
+''])
+    returned_answer = H.hashdb(["duplicates", "-j", "c", "temp_1.hdb", "2"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'2222222222222222	{"block_hash":"2222222222222222","count":2}',
+''])
+
+    # count 1 is not indexed and is found by walking
+    returned_answer = H.hashdb(["duplicates", "-j", "c", "temp_1.hdb", "1"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'1111111111111111	{"block_hash":"1111111111111111","count":1}',
+'3333333333333333	{"block_hash":"3333333333333333","count":1}',
+'# Processing 3 of 3 completed.',
+''])
+
+    # add_range reads the range from the index
+    H.hashdb(["add_range", "temp_1.hdb", "temp_2.hdb", "2:0"])
+    H.hashdb(["export", "temp_2.hdb", "temp_2.json"])
+    json2 = H.read_file("temp_2.json")
+    H.lines_equals(json2, [
+'# command: ',
+'# hashdb-Version: ',
+'{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","source_sub_counts":["0000000000000000",2]}',
+'{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":["r1","f1"]}'])
+
 def test_hash_table():
     # note that the first hash doesn't go in at all, next goes in once, last goes in twice.
     H.make_hashdb("temp_1.hdb", [
@@ -137,6 +261,41 @@ def test_hash_table():
 '# Processing 2 of 2 completed.',
 ''])
 
+def test_hash_table_index():
+    # the same hashes read from the source hash index
+    H.rm_tempdir("temp_1.hdb")
+    H.hashdb(["create", "-I", "temp_1.hdb"])
+    H.make_tempfile("temp_0.json", [
+'{"block_hash":"0000000000000000", "source_sub_counts":[]}',
+'{"block_hash":"2222222222222222", "source_sub_counts":["0000000000000000", 2]}',
+'{"block_hash":"1111111111111111", "source_sub_counts":["0000000000000000", 1]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_0.json"])
+
+    # two matches in hash order
+    returned_answer = H.hashdb(["hash_table", "temp_1.hdb", "0000000000000000"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'1111111111111111	{"block_hash":"1111111111111111","k_entropy":0,"block_label":"","count":1,"source_list_id":1696784233,"sources":[{"file_hash":"0000000000000000","filesize":0,"file_type":"","zero_count":0,"nonprobative_count":0,"name_pairs":[]}],"source_sub_counts":["0000000000000000",1]}',
+'2222222222222222	{"block_hash":"2222222222222222","k_entropy":0,"block_label":"","count":2,"source_list_id":1696784233,"sources":[],"source_sub_counts":["0000000000000000",2]}',
+'# Processing 2 of 2 completed.',
+''])
+
+    # the index is kept by later imports
+    H.make_tempfile("temp_0.json", [
+'{"block_hash":"3333333333333333", "source_sub_counts":["0000000000000000", 1]}'])
+    H.hashdb(["import", "temp_1.hdb", "temp_0.json"])
+    returned_answer = H.hashdb(["hash_table", "-j", "c", "temp_1.hdb",
+                                "0000000000000000"])
+    H.lines_equals(returned_answer, [
+'# command: ',
+'# hashdb-Version: ',
+'1111111111111111	{"block_hash":"1111111111111111","count":1}',
+'2222222222222222	{"block_hash":"2222222222222222","count":2}',
+'3333333333333333	{"block_hash":"3333333333333333","count":1}',
+'# Processing 3 of 3 completed.',
+''])
+
 def test_media():
     # create media to read
     H.make_temp_media("temp_1_media")
@@ -186,16 +345,40 @@ def test_media():
                                 "872-gzip-100", "50"])
     H.lines_equals(returned_answer, [""])
 
+    # read a batch, decompressing each member once
+    with open("temp_1_media_offsets", 'w') as f:
+        f.write("600-zip-0\n630\n666-zip-0\n872-gzip-3\n600-zip-3\n"
+                "1000000000\n632\n600-zip-100\n872-gzip-0\n")
+    returned_answer = H.hashdb(["read_media_list", "temp_1_media",
+                                "temp_1_media_offsets", "10"])
+    H.lines_equals(returned_answer, [
+'600-zip-0	74656d705f305f66696c',
+'630	74656d705f305f66696c',
+'666-zip-0	74656d705f305f66696c',
+'872-gzip-3	7020636f6e74656e74',
+'600-zip-3	705f305f66696c655f31',
+'1000000000	',
+'632	6d705f305f66696c655f',
+'600-zip-100	',
+'872-gzip-0	677a697020636f6e7465',
+'# Member cache hits: 3',
+'# Member cache misses: 3',
+''])
+    H.rm_tempfile("temp_1_media_offsets")
+
     # read media size
     returned_answer = H.hashdb(["read_media_size", "temp_1_media"])
     H.lines_equals(returned_answer, ["917", ""])
 
 if __name__=="__main__":
     test_size()
+    test_estimate()
     test_sources()
     test_histogram()
     test_duplicates()
+    test_duplicates_count_index()
     test_hash_table()
+    test_hash_table_index()
     test_media()
 
     print("Test Done.")